@@ -21,6 +21,7 @@ option(USE_WEBP "Enable WebP export support" ON)
 option(USE_AVIF "Enable AVIF support" ON)
 option(USE_XCF "Enable XCF support" ON)
 option(BUILD_CMSTEST "Build a test program to check your system's color management setup" ON)
+option(BUILD_BENCH "Build darktable-bench to measure module and pixelpipe throughput" OFF)
 option(USE_OPENEXR "Enable OpenEXR support" ON)
 option(BUILD_PRINT "Build the print module" ON)
 option(BUILD_RS_IDENTIFY "Build the darktable-rs-identify debug aid" ON)
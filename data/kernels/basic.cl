@@ -426,6 +426,134 @@ highlights_1f_lch_xtrans (read_only image2d_t in, write_only image2d_t out, cons
 #undef SQRT3
 #undef SQRT12
 
+float
+inpaint_clip(const float4 clips, const int c)
+{
+  return c == 0 ? clips.x : (c == 1 ? clips.y : (c == 2 ? clips.z : clips.w));
+}
+
+float
+inpaint_pix_xtrans(const int ratio_next, const float val_next, const float clip0, const float clip_next,
+                   const float *ratios)
+{
+  const float clip_val = fmax(clip0, clip_next);
+  if(val_next >= clip_next - 1e-5f) return clip_val;
+  return (ratio_next > 0) ? fmin(val_next / ratios[ratio_next], clip_val)
+                          : fmin(val_next * ratios[-ratio_next], clip_val);
+}
+
+/* color inpainting, the same scans as interpolate_color() and interpolate_color_xtrans() in
+ * highlights.c. every work item walks one row (dim 0) or one column (dim 1) forth and back. the row
+ * passes sum up their guesses for the clipped pixels in acc, the column passes add theirs and
+ * write the average to out. */
+kernel void
+highlights_1f_inpaint (read_only image2d_t in, write_only image2d_t out, global float *acc, const int width,
+                       const int height, const int rx, const int ry, const int filters,
+                       global const unsigned char (*const xtrans)[6], const float4 clips, const int dim)
+{
+  const int other = get_global_id(0);
+  const int len = dim ? height : width;
+
+  if(other >= (dim ? width : height)) return;
+
+  // xtrans color transitions 1:RG, 2:RB, 3:GB, negative for the inverse ratio
+  const int roff[3][3] = { { 0, -1, -2 }, { 1, 0, -3 }, { 2, 3, 0 } };
+  const float clip_max = fmax(fmax(clips.x, clips.y), clips.z);
+
+  for(int pass = 2 * dim; pass < 2 * dim + 2; pass++)
+  {
+    const int dir = (pass & 1) ? -1 : 1;
+    const int di = dim ? 0 : dir;
+    const int dj = dim ? dir : 0;
+    float ratio = 1.0f;
+    float ratios[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+    for(int k = (dir > 0) ? 0 : len - 1; k >= 0 && k < len; k += dir)
+    {
+      const int i = dim ? other : k;
+      const int j = dim ? k : other;
+      const float c0 = read_imagef(in, sampleri, (int2)(i, j)).x;
+
+      if(i == 0 || i == width - 1 || j == 0 || j == height - 1)
+      {
+        if(pass == 3) write_imagef(out, (int2)(i, j), filters == 9u ? fmin(clip_max, c0) : c0);
+        continue;
+      }
+
+      const float c1 = read_imagef(in, sampleri, (int2)(i + di, j + dj)).x;
+      float clip0, add;
+
+      if(filters == 9u)
+      {
+        const int f0 = FCxtrans(j + ry, i + rx, xtrans);
+        const int f1 = FCxtrans(j + dj + ry, i + di + rx, xtrans);
+        clip0 = inpaint_clip(clips, f0);
+        const float clip1 = inpaint_clip(clips, f1);
+
+        // ratio to the next pixel if both are unclipped and not in a 2x2 green block
+        if(f0 != f1 && c0 < clip0 && c0 > 1e-5f && c1 < clip1 && c1 > 1e-5f)
+        {
+          const int r = roff[f0][f1];
+          if(r > 0)
+            ratios[r] = (3.0f * ratios[r] + c1 / c0) / 4.0f;
+          else
+            ratios[-r] = (3.0f * ratios[-r] + c0 / c1) / 4.0f;
+        }
+        if(c0 < clip0 - 1e-5f)
+        {
+          if(pass == 3) write_imagef(out, (int2)(i, j), c0);
+          continue;
+        }
+
+        if(f0 != f1)
+          add = inpaint_pix_xtrans(roff[f0][f1], c1, clip0, clip1, ratios);
+        else
+        {
+          // at the start of a 2x2 green block, look diagonally
+          const int li = dim ? i - 1 : i + dir, lj = dim ? j + dir : j - 1;
+          const int ri = dim ? i + 1 : i + dir, rj = dim ? j + dir : j + 1;
+          const int fl = FCxtrans(lj + ry, li + rx, xtrans);
+          const int fr = FCxtrans(rj + ry, ri + rx, xtrans);
+          add = (fl != f0) ? inpaint_pix_xtrans(roff[f0][fl], read_imagef(in, sampleri, (int2)(li, lj)).x, clip0,
+                                                inpaint_clip(clips, fl), ratios)
+                           : inpaint_pix_xtrans(roff[f0][fr], read_imagef(in, sampleri, (int2)(ri, rj)).x, clip0,
+                                                inpaint_clip(clips, fr), ratios);
+        }
+      }
+      else
+      {
+        clip0 = inpaint_clip(clips, FC(j + ry, i + rx, filters));
+        const float clip1 = inpaint_clip(clips, FC(j + ry + (dim ? 1 : 0), i + rx + (dim ? 0 : 1), filters));
+
+        // ratio = in[odd] / in[even], exponential decay
+        if(c0 < clip0 && c0 > 1e-5f && c1 < clip1 && c1 > 1e-5f)
+          ratio = (k & 1) ? (3.0f * ratio + c0 / c1) / 4.0f : (3.0f * ratio + c1 / c0) / 4.0f;
+        if(c0 < clip0 - 1e-5f)
+        {
+          if(pass == 3) write_imagef(out, (int2)(i, j), c0);
+          continue;
+        }
+
+        if(c1 >= clip1 - 1e-5f)
+          add = fmax(clip0, clip1);
+        else
+          add = (k & 1) ? c1 * ratio : c1 / ratio;
+      }
+
+      const int idx = mad24(j, width, i);
+      if(pass == 0)
+        acc[idx] = add;
+      else if(pass == 3)
+      {
+        const float pixel = (acc[idx] + add) / 4.0f;
+        write_imagef(out, (int2)(i, j), filters == 9u ? fmin(clip_max, pixel) : pixel);
+      }
+      else
+        acc[idx] += add;
+    }
+  }
+}
+
 float
 lookup_unbounded_twosided(read_only image2d_t lut, const float x, constant float *a)
 {
@@ -1659,6 +1787,33 @@ lens_vignette (read_only image2d_t in, write_only image2d_t out, const int width
 }
 
 
+/* expands the coarse distortion map of src/iop/lens.cc to the per pixel coordinates of the lens_distort kernels */
+kernel void
+lens_map_expand (global const float *map, const int map_width, const int map_height, const float step,
+                 global float *pi, const int width, const int height, const int roi_x, const int roi_y)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float fx = (roi_x + x) / step;
+  const float fy = (roi_y + y) / step;
+  const int i = clamp((int)floor(fx), 0, map_width - 2);
+  const int j = clamp((int)floor(fy), 0, map_height - 2);
+  const float tx = fx - i;
+  const float ty = fy - j;
+
+  global const float *n00 = map + 6 * mad24(j, map_width, i);
+  global const float *n10 = n00 + 6 * map_width;
+  global float *ppi = pi + 6 * mad24(y, width, x);
+
+  for(int c = 0; c < 6; c++)
+    ppi[c] = (1.0f - ty) * ((1.0f - tx) * n00[c] + tx * n00[c + 6])
+             + ty * ((1.0f - tx) * n10[c] + tx * n10[c + 6]);
+}
+
+
 
 /* kernel for flip */
 __kernel void
@@ -0,0 +1,152 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+#include "colorspace.cl"
+
+// the windowed histogram equalisation of src/iop/clahe.c, see process() there
+
+#define CLAHE_BINS 256
+
+kernel void
+clahe_bins(read_only image2d_t in, global ushort *bins, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float pmax = clamp(fmax(pixel.x, fmax(pixel.y, pixel.z)), 0.0f, 1.0f);
+  const float pmin = clamp(fmin(pixel.x, fmin(pixel.y, pixel.z)), 0.0f, 1.0f);
+
+  bins[mad24(y, width, x)] = (ushort)((pmax + pmin) / 2.0f * (float)CLAHE_BINS + 0.5f);
+}
+
+
+// one work item per row, which slides its window histogram from left to right. the histograms of all
+// rows are interleaved, bin b of row j is at hist[b * height + j], so neighbouring work items access
+// neighbouring addresses
+kernel void
+clahe_rows(global const ushort *bins, global int *hist, global int *clipped, global float *dest,
+           const int width, const int height, const int rad, const float slope)
+{
+  const int j = get_global_id(0);
+
+  if(j >= height) return;
+
+  const int yMin = max(0, j - rad);
+  const int yMax = min(height, j + rad + 1);
+  const int h = yMax - yMin;
+  const int xMax0 = min(width - 1, rad);
+
+  global int *hs = hist + j;
+  global int *cl = clipped + j;
+
+  // initially fill histogram
+  for(int b = 0; b <= CLAHE_BINS; b++) hs[b * height] = 0;
+  for(int yi = yMin; yi < yMax; yi++)
+    for(int xi = 0; xi < xMax0; xi++)
+      hs[bins[yi * width + xi] * height]++;
+
+  for(int i = 0; i < width; i++)
+  {
+    const int v = bins[j * width + i];
+
+    const int xMin = max(0, i - rad);
+    const int xMax = i + rad + 1;
+    const int w = min(width, xMax) - xMin;
+    const int n = h * w;
+
+    const int limit = (int)(slope * n / CLAHE_BINS + 0.5f);
+
+    // remove left behind values from histogram
+    if(xMin > 0)
+      for(int yi = yMin; yi < yMax; yi++)
+        hs[bins[yi * width + xMin - 1] * height]--;
+
+    // add newly included values to histogram
+    if(xMax <= width)
+      for(int yi = yMin; yi < yMax; yi++)
+        hs[bins[yi * width + xMax - 1] * height]++;
+
+    // clip histogram and redistribute clipped entries, only the bins raised by the last
+    // redistribution need to be clipped again. s is their stride, 1 for all, 0 for none
+    for(int b = 0; b <= CLAHE_BINS; b++) cl[b * height] = hs[b * height];
+    int ce = 0, ceb = 0, s = 1;
+    do
+    {
+      ceb = ce;
+      ce = 0;
+      for(int b = 0; s && b <= CLAHE_BINS; b += s)
+      {
+        const int d = cl[b * height] - limit;
+        if(d > 0)
+        {
+          ce += d;
+          cl[b * height] = limit;
+        }
+      }
+
+      const int d = (ce / (float)(CLAHE_BINS + 1));
+      const int m = ce % (CLAHE_BINS + 1);
+      if(d != 0)
+        for(int b = 0; b <= CLAHE_BINS; b++) cl[b * height] += d;
+
+      s = 0;
+      if(m != 0)
+      {
+        s = CLAHE_BINS / (float)m;
+        for(int b = 0; b <= CLAHE_BINS; b += s) cl[b * height]++;
+      }
+      if(d != 0) s = 1;
+    } while(ce != ceb);
+
+    // build cdf of clipped histogram
+    int hMin = CLAHE_BINS;
+    for(int b = 0; b < hMin; b++)
+      if(cl[b * height] != 0) hMin = b;
+
+    int cdf = 0;
+    for(int b = hMin; b <= v; b++) cdf += cl[b * height];
+
+    int cdfMax = cdf;
+    for(int b = v + 1; b <= CLAHE_BINS; b++) cdfMax += cl[b * height];
+
+    const int cdfMin = cl[hMin * height];
+
+    dest[j * width + i] = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+  }
+}
+
+
+kernel void
+clahe_apply(read_only image2d_t in, write_only image2d_t out, global const float *dest, const int width,
+            const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  float4 hsl = RGB_2_HSL(pixel);
+  hsl.z = dest[mad24(y, width, x)];
+
+  write_imagef(out, (int2)(x, y), HSL_2_RGB(hsl));
+}
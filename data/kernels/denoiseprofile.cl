@@ -367,23 +367,61 @@ denoiseprofile_finish_v2(read_only image2d_t in, global float4* U2, write_only i
 
 
 
+float4
+backtransform_px(float4 px, const float4 a, const float4 sigma2)
+{
+  px = (px < (float4)0.5f ? (float4)0.0f :
+    0.25f*px*px + 0.25f*sqrt(1.5f)/px - 1.375f/(px*px) + 0.625f*sqrt(1.5f)/(px*px*px) - 0.125f - sigma2);
+
+  return px * a;
+}
+
+float4
+backtransform_v2_px(float4 px, const float4 a, const float4 p, const float4 b, const float bias, const float4 wb)
+{
+  px = fmax((float4)0.0f, px);
+  const float4 delta = px * px + (float4)bias;
+  const float4 denominator = 4.0f / (sqrt(a) * (2.0f - p));
+  const float4 z1 = (px + sqrt(fmax((float4)0.0f, delta))) / denominator;
+  px = native_powr(z1, 1.0f / (1.0f - p / 2.0f)) - b;
+  return px * wb;
+}
+
+float4
+backtransform_Y0U0V0_px(const float4 t, const float4 a, const float4 p, const float4 b, const float bias,
+                        const float4 wb, global const float *toRGB)
+{
+  float4 px = (float4)0.0f;
+  px.x += toRGB[0] * t.x;
+  px.x += toRGB[1] * t.y;
+  px.x += toRGB[2] * t.z;
+  px.y += toRGB[3] * t.x;
+  px.y += toRGB[4] * t.y;
+  px.y += toRGB[5] * t.z;
+  px.z += toRGB[6] * t.x;
+  px.z += toRGB[7] * t.y;
+  px.z += toRGB[8] * t.z;
+
+  px = fmax((float4)0.0f, px);
+  const float4 delta = px * px + (float4)bias * wb;
+  const float4 denominator = 4.0f / (sqrt(a) * (2.0f - p));
+  const float4 z1 = (px + sqrt(fmax((float4)0.0f, delta))) / denominator;
+  return native_powr(z1, 1.0f / (1.0f - p / 2.0f)) - b;
+}
+
 kernel void
 denoiseprofile_backtransform(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
                              const float4 a, const float4 sigma2)
 {
   const int x = get_global_id(0);
   const int y = get_global_id(1);
-  const int gidx = mad24(y, width, x);
 
   if(x >= width || y >= height) return;
 
   float4 px = read_imagef(in, sampleri, (int2)(x, y));
   const float alpha = px.w;
 
-  px = (px < (float4)0.5f ? (float4)0.0f :
-    0.25f*px*px + 0.25f*sqrt(1.5f)/px - 1.375f/(px*px) + 0.625f*sqrt(1.5f)/(px*px*px) - 0.125f - sigma2);
-
-  px *= a;
+  px = backtransform_px(px, a, sigma2);
   px.w = alpha;
 
   write_imagef (out, (int2)(x, y), px);
@@ -396,19 +434,13 @@ denoiseprofile_backtransform_v2(read_only image2d_t in, write_only image2d_t out
 {
   const int x = get_global_id(0);
   const int y = get_global_id(1);
-  const int gidx = mad24(y, width, x);
 
   if(x >= width || y >= height) return;
 
   float4 px = read_imagef(in, sampleri, (int2)(x, y));
   const float alpha = px.w;
 
-  px = fmax((float4)0.0f, px);
-  const float4 delta = px * px + (float4)bias;
-  const float4 denominator = 4.0f / (sqrt(a) * (2.0f - p));
-  const float4 z1 = (px + sqrt(fmax((float4)0.0f, delta))) / denominator;
-  px = native_powr(z1, 1.0f / (1.0f - p / 2.0f)) - b;
-  px = px * wb;
+  px = backtransform_v2_px(px, a, p, b, bias, wb);
   px.w = alpha;
 
   write_imagef (out, (int2)(x, y), px);
@@ -420,30 +452,13 @@ denoiseprofile_backtransform_Y0U0V0(read_only image2d_t in, write_only image2d_t
 {
   const int x = get_global_id(0);
   const int y = get_global_id(1);
-  const int gidx = mad24(y, width, x);
 
   if(x >= width || y >= height) return;
 
   const float4 t = read_imagef(in, sampleri, (int2)(x, y));
-  const float alpha = t.w;
 
-  float4 px = (float4)0.0f;
-  px.x += toRGB[0] * t.x;
-  px.x += toRGB[1] * t.y;
-  px.x += toRGB[2] * t.z;
-  px.y += toRGB[3] * t.x;
-  px.y += toRGB[4] * t.y;
-  px.y += toRGB[5] * t.z;
-  px.z += toRGB[6] * t.x;
-  px.z += toRGB[7] * t.y;
-  px.z += toRGB[8] * t.z;
-
-  px = fmax((float4)0.0f, px);
-  const float4 delta = px * px + (float4)bias * wb;
-  const float4 denominator = 4.0f / (sqrt(a) * (2.0f - p));
-  const float4 z1 = (px + sqrt(fmax((float4)0.0f, delta))) / denominator;
-  px = native_powr(z1, 1.0f / (1.0f - p / 2.0f)) - b;
-  px.w = alpha;
+  float4 px = backtransform_Y0U0V0_px(t, a, p, b, bias, wb, toRGB);
+  px.w = t.w;
 
   write_imagef (out, (int2)(x, y), px);
 }
@@ -520,6 +535,36 @@ denoiseprofile_synthesize(read_only image2d_t coarse, read_only image2d_t detail
 }
 
 
+// the last synthesis step with the inverse variance stabilizing transform, vst is
+// 0 for the anscombe transform, 1 for v2 and 2 for Y0U0V0
+kernel void
+denoiseprofile_synthesize_backtransform(read_only image2d_t coarse, read_only image2d_t detail,
+     write_only image2d_t out, const int width, const int height, const float4 threshold, const float4 boost,
+     const int vst, const float4 a, const float4 p, const float4 b, const float4 sigma2, const float bias,
+     const float4 wb, global const float *toRGB)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 c = read_imagef(coarse, sampleri, (int2)(x, y));
+  float4 d = read_imagef(detail, sampleri, (int2)(x, y));
+  float4 amount = copysign(max((float4)(0.0f), fabs(d) - threshold), d);
+  float4 sum = c + boost*amount;
+
+  if(vst == 0)
+    sum = backtransform_px(sum, a, sigma2);
+  else if(vst == 1)
+    sum = backtransform_v2_px(sum, a, p, b, bias, wb);
+  else
+    sum = backtransform_Y0U0V0_px(sum, a, p, b, bias, wb, toRGB);
+
+  sum.w = c.w;
+  write_imagef (out, (int2)(x, y), sum);
+}
+
+
 kernel void
 denoiseprofile_reduce_first(read_only image2d_t in, const int width, const int height,
                             global float4 *accu, local float4 *buffer)
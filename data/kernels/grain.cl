@@ -0,0 +1,134 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the film grain of src/iop/grain.c, see process() there
+
+#define GRAIN_LUT_SIZE 128
+
+constant int grad3[12][3] = { { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+                              { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+                              { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 } };
+
+constant float octave_f[3] = { 0.4910f, 0.9441f, 1.7280f };
+constant float octave_a[3] = { 0.2340f, 0.7850f, 1.2150f };
+
+#define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
+
+float
+simplex_corner(const int gi, const float x, const float y, const float z)
+{
+  float t = fmax(0.6f - x * x - y * y - z * z, 0.0f);
+  t *= t;
+  return t * t * (grad3[gi][0] * x + grad3[gi][1] * y + grad3[gi][2] * z);
+}
+
+// perm holds the permutation twice, 512 entries
+float
+simplex_noise(const float xin, const float yin, const float zin, global const int *perm)
+{
+  const float F3 = 1.0f / 3.0f;
+  const float s = (xin + yin + zin) * F3;
+  const int i = FASTFLOOR(xin + s);
+  const int j = FASTFLOOR(yin + s);
+  const int k = FASTFLOOR(zin + s);
+  const float G3 = 1.0f / 6.0f;
+  const float t = (i + j + k) * G3;
+  const float x0 = xin - (i - t);
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
+
+  const int xy = x0 >= y0, yz = y0 >= z0, xz = x0 >= z0;
+  const int i1 = xy & (yz | xz);
+  const int j1 = !xy & yz;
+  const int k1 = !yz & !(xy & xz);
+  const int i2 = xy | (yz & xz);
+  const int j2 = !xy | yz;
+  const int k2 = !yz | (!xy & !xz);
+
+  const int ii = i & 255;
+  const int jj = j & 255;
+  const int kk = k & 255;
+  const int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
+  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
+  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
+  const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+
+  return 32.0f * (simplex_corner(gi0, x0, y0, z0)
+                  + simplex_corner(gi1, x0 - i1 + G3, y0 - j1 + G3, z0 - k1 + G3)
+                  + simplex_corner(gi2, x0 - i2 + 2.0f * G3, y0 - j2 + 2.0f * G3, z0 - k2 + 2.0f * G3)
+                  + simplex_corner(gi3, x0 - 1.0f + 3.0f * G3, y0 - 1.0f + 3.0f * G3, z0 - 1.0f + 3.0f * G3));
+}
+
+float
+grain_lut_lookup(global const float *lut, const float x, const float y)
+{
+  const float _x = clamp((x + 0.5f) * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+  const float _y = clamp(y * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+
+  const int _x0 = _x < GRAIN_LUT_SIZE - 2 ? (int)_x : GRAIN_LUT_SIZE - 2;
+  const int _y0 = _y < GRAIN_LUT_SIZE - 2 ? (int)_y : GRAIN_LUT_SIZE - 2;
+
+  const float x_diff = _x - _x0;
+  const float y_diff = _y - _y0;
+
+  const float l00 = lut[_y0 * GRAIN_LUT_SIZE + _x0];
+  const float l01 = lut[_y0 * GRAIN_LUT_SIZE + _x0 + 1];
+  const float l10 = lut[(_y0 + 1) * GRAIN_LUT_SIZE + _x0];
+  const float l11 = lut[(_y0 + 1) * GRAIN_LUT_SIZE + _x0 + 1];
+
+  const float xy0 = (1.0f - y_diff) * l00 + l10 * y_diff;
+  const float xy1 = (1.0f - y_diff) * l01 + l11 * y_diff;
+  return xy0 * (1.0f - x_diff) + xy1 * x_diff;
+}
+
+// origin_x/y are the noise coordinates of the roi's first pixel per octave, wrapped by the host, and step
+// the distance of two pixels. lattice holds the offsets of the samples, without the octave's frequency.
+kernel void
+grain(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+      const float4 origin_x, const float4 origin_y, const float4 step, global const float *lattice,
+      const int samples, const float strength, global const int *perm, global const float *lut)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  const float ox[3] = { origin_x.x, origin_x.y, origin_x.z };
+  const float oy[3] = { origin_y.x, origin_y.y, origin_y.z };
+  const float st[3] = { step.x, step.y, step.z };
+
+  float noise = 0.0f;
+  for(int l = 0; l < samples; l++)
+  {
+    for(int o = 0; o < 3; o++)
+    {
+      const float u = ox[o] + x * st[o] + lattice[2 * l] * octave_f[o];
+      const float v = oy[o] + y * st[o] + lattice[2 * l + 1] * octave_f[o];
+      noise += simplex_noise(u, v, o, perm) * octave_a[o];
+    }
+  }
+  noise /= samples;
+
+  pixel.x += grain_lut_lookup(lut, noise * strength, pixel.x / 100.0f);
+
+  write_imagef(out, (int2)(x, y), pixel);
+}
@@ -0,0 +1,106 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// offsets holds, for each cell of the 6x6 sensor pattern, the x/y offsets of the four
+// nearest pixels of the same color, see process_bayer() and process_xtrans() in hotpixels.c
+int
+hotpixel_fix(read_only image2d_t in, const int x, const int y, const int width, const int height,
+             const float threshold, const float multiplier, const int min_neighbours,
+             global const int *offsets, float *fixed)
+{
+  if(x < 2 || x >= width - 2 || y < 2 || y >= height - 2) return 0;
+
+  const float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+  if(!(pixel > threshold)) return 0;
+
+  const float mid = pixel * multiplier;
+  global const int *off = offsets + ((y % 6) * 6 + (x % 6)) * 8;
+
+  int count = 0;
+  float maxin = 0.0f;
+  for(int n = 0; n < 4; n++)
+  {
+    const float other = read_imagef(in, sampleri, (int2)(x + off[2 * n], y + off[2 * n + 1])).x;
+    if(mid > other)
+    {
+      count++;
+      if(other > maxin) maxin = other;
+    }
+  }
+
+  if(count < min_neighbours) return 0;
+
+  *fixed = maxin;
+  return 1;
+}
+
+
+kernel void
+hotpixels(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+          const float threshold, const float multiplier, const int min_neighbours, const int markfixed,
+          global const int *offsets, const unsigned int filters, const int r_x, const int r_y,
+          global const unsigned char (*const xtrans)[6], global int *fixed_count)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+
+  float fixed = 0.0f;
+  const int hot = hotpixel_fix(in, x, y, width, height, threshold, multiplier, min_neighbours, offsets, &fixed);
+  if(hot) atomic_inc(fixed_count);
+
+  float o = hot ? fixed : pixel;
+
+  if(markfixed)
+  {
+    // the CPU code marks up to 10 pixels of the same color on each side of a fixed pixel with its
+    // original value, in row order. so the last writer is the nearest fixed pixel on the right,
+    // then the pixel itself, then the nearest fixed pixel on the left
+    const int c = (filters == 9u) ? FCxtrans(y + r_y, x + r_x, xtrans) : 0;
+    int marked = 0;
+
+    for(int i = min(10, width - 3 - x); i >= 2 && !marked; i--)
+    {
+      if(filters == 9u ? (FCxtrans(y + r_y, x + i + r_x, xtrans) != c) : (i & 1)) continue;
+      float other_fixed;
+      if(hotpixel_fix(in, x + i, y, width, height, threshold, multiplier, min_neighbours, offsets, &other_fixed))
+      {
+        o = read_imagef(in, sampleri, (int2)(x + i, y)).x;
+        marked = 1;
+      }
+    }
+
+    for(int i = 2; i <= min(10, x - 2) && !marked && !hot; i++)
+    {
+      if(filters == 9u ? (FCxtrans(y + r_y, x - i + r_x, xtrans) != c) : (i & 1)) continue;
+      float other_fixed;
+      if(hotpixel_fix(in, x - i, y, width, height, threshold, multiplier, min_neighbours, offsets, &other_fixed))
+      {
+        o = read_imagef(in, sampleri, (int2)(x - i, y)).x;
+        marked = 1;
+      }
+    }
+  }
+
+  write_imagef(out, (int2)(x, y), (float4)(o, 0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,368 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// the 5d (x, y, r, g, b) permutohedral lattice of src/iop/Permutohedral.h for the bilateral module.
+//
+// the lattice is kept in a flat open addressing hash table: entries[] holds, for each bucket, the
+// index of the first splatted key which landed there (or -1), the keys themselves stay in the per
+// pixel keys[] array written by permutohedral_splat_keys. buckets are claimed with atomic_cmpxchg, so
+// building the table needs no locking. afterwards every occupied bucket gets a dense vertex id which
+// is used to address the value vectors { r, g, b, weight }.
+
+#define PL_D 5
+
+// the canonical simplex, see PermutohedralLattice::PermutohedralLattice()
+#define CANONICAL(remainder, rank) ((rank) <= PL_D - (remainder) ? (remainder) : (remainder) - (PL_D + 1))
+
+void
+atomic_add_f(
+    global float *val,
+    const  float  delta)
+{
+  union
+  {
+    float f;
+    unsigned int i;
+  }
+  old_val;
+  union
+  {
+    float f;
+    unsigned int i;
+  }
+  new_val;
+
+  global volatile unsigned int *ival = (global volatile unsigned int *)val;
+
+  do
+  {
+    old_val.i = atomic_add(ival, 0);
+    new_val.f = old_val.f + delta;
+  }
+  while (atomic_cmpxchg (ival, old_val.i, new_val.i) != old_val.i);
+}
+
+
+inline unsigned int
+lattice_hash(const short *key)
+{
+  unsigned int k = 0;
+  for(int i = 0; i < PL_D; i++)
+  {
+    k += (unsigned int)key[i];
+    k *= 2531011u;
+  }
+  return k;
+}
+
+
+inline int
+lattice_key_equal(global const short *stored, const short *key)
+{
+  for(int i = 0; i < PL_D; i++)
+    if(stored[i] != key[i]) return 0;
+  return 1;
+}
+
+
+// returns the bucket holding key, -1 if the key isn't in the lattice
+inline int
+lattice_find(global const short *keys, global const int *entries, const unsigned int mask, const short *key)
+{
+  unsigned int h = lattice_hash(key) & mask;
+  while(1)
+  {
+    const int other = entries[h];
+    if(other == -1) return -1;
+    if(lattice_key_equal(keys + other * PL_D, key)) return h;
+    h = (h + 1) & mask;
+  }
+}
+
+
+kernel void
+permutohedral_clear(global int *buf, const int n, const int width, const int value)
+{
+  const int x = get_global_id(0);
+  const int k = get_global_id(1) * width + x;
+
+  if(x >= width || k >= n) return;
+
+  buf[k] = value;
+}
+
+
+kernel void
+permutohedral_splat_keys(read_only image2d_t in, const int width, const int height, const float sx,
+                         const float sy, const float sr, const float sg, const float sb, global short *keys,
+                         global float *weights)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float position[PL_D] = { x * sx, y * sy, pixel.x * sr, pixel.y * sg, pixel.z * sb };
+
+  float scale_factor[PL_D];
+  for(int i = 0; i < PL_D; i++) scale_factor[i] = (PL_D + 1) * sqrt(2.0f / 3.0f) / sqrt((float)(i + 1) * (i + 2));
+
+  // first rotate position into the (d+1)-dimensional hyperplane
+  float elevated[PL_D + 1];
+  elevated[PL_D] = -PL_D * position[PL_D - 1] * scale_factor[PL_D - 1];
+  for(int i = PL_D - 1; i > 0; i--)
+    elevated[i] = (elevated[i + 1] - i * position[i - 1] * scale_factor[i - 1]
+                   + (i + 2) * position[i] * scale_factor[i]);
+  elevated[0] = elevated[1] + 2 * position[0] * scale_factor[0];
+
+  const float scale = 1.0f / (PL_D + 1);
+
+  // greedily search for the closest zero-colored lattice point
+  int greedy[PL_D + 1];
+  int sum = 0;
+  for(int i = 0; i <= PL_D; i++)
+  {
+    const float v = elevated[i] * scale;
+    const float up = ceil(v) * (PL_D + 1);
+    const float down = floor(v) * (PL_D + 1);
+    greedy[i] = (up - elevated[i] < elevated[i] - down) ? up : down;
+    sum += greedy[i];
+  }
+  sum /= PL_D + 1;
+
+  // rank differential to find the permutation between this simplex and the canonical one
+  int rank[PL_D + 1] = { 0 };
+  for(int i = 0; i < PL_D; i++)
+    for(int j = i + 1; j <= PL_D; j++)
+      if(elevated[i] - greedy[i] < elevated[j] - greedy[j])
+        rank[i]++;
+      else
+        rank[j]++;
+
+  if(sum > 0)
+  {
+    for(int i = 0; i <= PL_D; i++)
+    {
+      if(rank[i] >= PL_D + 1 - sum)
+      {
+        greedy[i] -= PL_D + 1;
+        rank[i] += sum - (PL_D + 1);
+      }
+      else
+        rank[i] += sum;
+    }
+  }
+  else if(sum < 0)
+  {
+    for(int i = 0; i <= PL_D; i++)
+    {
+      if(rank[i] < -sum)
+      {
+        greedy[i] += PL_D + 1;
+        rank[i] += (PL_D + 1) + sum;
+      }
+      else
+        rank[i] += sum;
+    }
+  }
+
+  // barycentric coordinates
+  float barycentric[PL_D + 2] = { 0.0f };
+  for(int i = 0; i <= PL_D; i++)
+  {
+    barycentric[PL_D - rank[i]] += (elevated[i] - greedy[i]) * scale;
+    barycentric[PL_D + 1 - rank[i]] -= (elevated[i] - greedy[i]) * scale;
+  }
+  barycentric[0] += 1.0f + barycentric[PL_D + 1];
+
+  const int base = (y * width + x) * (PL_D + 1);
+  for(int remainder = 0; remainder <= PL_D; remainder++)
+  {
+    for(int i = 0; i < PL_D; i++)
+      keys[(base + remainder) * PL_D + i] = greedy[i] + CANONICAL(remainder, rank[i]);
+    weights[base + remainder] = barycentric[remainder];
+  }
+}
+
+
+kernel void
+permutohedral_insert(global const short *keys, const int nkeys, const int width, global int *entries,
+                     const unsigned int mask, global int *slots)
+{
+  const int x = get_global_id(0);
+  const int k = get_global_id(1) * width + x;
+
+  if(x >= width || k >= nkeys) return;
+
+  short key[PL_D];
+  for(int i = 0; i < PL_D; i++) key[i] = keys[k * PL_D + i];
+
+  // the table has more buckets than there are keys, so this always terminates
+  unsigned int h = lattice_hash(key) & mask;
+  while(1)
+  {
+    const int other = atomic_cmpxchg(entries + h, -1, k);
+    if(other == -1 || lattice_key_equal(keys + other * PL_D, key)) break;
+    h = (h + 1) & mask;
+  }
+
+  slots[k] = h;
+}
+
+
+kernel void
+permutohedral_enumerate(global const int *entries, const int capacity, const int width,
+                        global int *vertex_of_slot, global int *vertex_key, global int *count)
+{
+  const int x = get_global_id(0);
+  const int s = get_global_id(1) * width + x;
+
+  if(x >= width || s >= capacity) return;
+
+  const int k = entries[s];
+  if(k == -1) return;
+
+  const int v = atomic_inc(count);
+  vertex_of_slot[s] = v;
+  vertex_key[v] = k;
+}
+
+
+kernel void
+permutohedral_splat_values(read_only image2d_t in, const int width, const int height,
+                           global const float *weights, global int *slots, global const int *vertex_of_slot,
+                           global float *values)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const int base = (y * width + x) * (PL_D + 1);
+
+  for(int remainder = 0; remainder <= PL_D; remainder++)
+  {
+    const int k = base + remainder;
+    const int v = vertex_of_slot[slots[k]];
+    const float w = weights[k];
+
+    atomic_add_f(values + 4 * v + 0, w * pixel.x);
+    atomic_add_f(values + 4 * v + 1, w * pixel.y);
+    atomic_add_f(values + 4 * v + 2, w * pixel.z);
+    atomic_add_f(values + 4 * v + 3, w);
+
+    // from now on only the vertex is needed, slicing replays the splat
+    slots[k] = v;
+  }
+}
+
+
+kernel void
+permutohedral_blur(global const short *keys, global const int *entries, const unsigned int mask,
+                   global const int *vertex_of_slot, global const int *vertex_key, const int nvertices,
+                   const int width, const int dim, global const float *in, global float *out)
+{
+  const int x = get_global_id(0);
+  const int v = get_global_id(1) * width + x;
+
+  if(x >= width || v >= nvertices) return;
+
+  // the neighbours along axis dim, see HashTablePermutohedral::Key::Key(origin, dim, direction)
+  global const short *key = keys + vertex_key[v] * PL_D;
+  short neighbour1[PL_D], neighbour2[PL_D];
+  for(int i = 0; i < PL_D; i++)
+  {
+    neighbour1[i] = key[i] + 1;
+    neighbour2[i] = key[i] - 1;
+  }
+  if(dim < PL_D)
+  {
+    neighbour1[dim] = key[dim] - PL_D;
+    neighbour2[dim] = key[dim] + PL_D;
+  }
+
+  const int h1 = lattice_find(keys, entries, mask, neighbour1);
+  const int h2 = lattice_find(keys, entries, mask, neighbour2);
+
+  const float4 vm1 = (h1 >= 0) ? vload4(vertex_of_slot[h1], in) : (float4)0.0f;
+  const float4 vp1 = (h2 >= 0) ? vload4(vertex_of_slot[h2], in) : (float4)0.0f;
+
+  vstore4(0.25f * vm1 + 0.5f * vload4(v, in) + 0.25f * vp1, v, out);
+}
+
+
+kernel void
+permutohedral_slice(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                    global const float *weights, global const int *vertices, global const float *values)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int base = (y * width + x) * (PL_D + 1);
+
+  float4 sum = (float4)0.0f;
+  for(int remainder = 0; remainder <= PL_D; remainder++)
+    sum += weights[base + remainder] * vload4(vertices[base + remainder], values);
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  write_imagef(out, (int2)(x, y), (float4)(sum.x / sum.w, sum.y / sum.w, sum.z / sum.w, pixel.w));
+}
+
+
+// the brute force filter used for small radii, see process() in src/iop/bilateral.cc
+kernel void
+bilateral_small(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                const int rad, const float sigma_s, const float4 isig2col)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  // the unprocessed border passes through
+  if(x < rad || y < rad || x >= width - rad || y >= height - rad)
+  {
+    write_imagef(out, (int2)(x, y), pixel);
+    return;
+  }
+
+  const float isig2s = 1.0f / (2.0f * sigma_s * sigma_s);
+
+  float sumw = 0.0f;
+  float4 sum = (float4)0.0f;
+  for(int l = -rad; l <= rad; l++)
+    for(int k = -rad; k <= rad; k++)
+    {
+      const float4 other = read_imagef(in, sampleri, (int2)(x + k, y + l));
+      const float4 d = pixel - other;
+      const float w = exp(-(l * l + k * k) * isig2s
+                          - (d.x * d.x * isig2col.x + d.y * d.y * isig2col.y + d.z * d.z * isig2col.z));
+      sumw += w;
+      sum += w * other;
+    }
+
+  write_imagef(out, (int2)(x, y), (float4)(sum.x / sumw, sum.y / sumw, sum.z / sumw, pixel.w));
+}
@@ -0,0 +1,285 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// these mirror src/common/luminance_mask.h and src/common/fast_guided_filter.h,
+// keep them in sync with the CPU code path of src/iop/toneequal.c
+
+#define MIN_FLOAT 1.52587890625e-05f // exp2f(-16.0f)
+
+#define PIXEL_CHAN 8
+
+typedef enum dt_iop_luminance_mask_method_t
+{
+  DT_TONEEQ_MEAN = 0,
+  DT_TONEEQ_LIGHTNESS,
+  DT_TONEEQ_VALUE,
+  DT_TONEEQ_NORM_1,
+  DT_TONEEQ_NORM_2,
+  DT_TONEEQ_NORM_POWER,
+  DT_TONEEQ_GEOMEAN,
+  DT_TONEEQ_LAST
+} dt_iop_luminance_mask_method_t;
+
+// radial distances used for pixel ops, split 8 EV into 7 evenly-spaced channels
+constant float centers_ops[PIXEL_CHAN] = { -56.0f / 7.0f, -48.0f / 7.0f, -40.0f / 7.0f, -32.0f / 7.0f,
+                                           -24.0f / 7.0f, -16.0f / 7.0f,  -8.0f / 7.0f,   0.0f / 7.0f };
+
+
+inline float linear_contrast(const float pixel, const float fulcrum, const float contrast)
+{
+  // Increase the slope of the value around a fulcrum value
+  return fmax((pixel - fulcrum) * contrast + fulcrum, MIN_FLOAT);
+}
+
+
+inline float pixel_luminance(const float4 pixel, const int method)
+{
+  switch(method)
+  {
+    case DT_TONEEQ_MEAN:
+      return (pixel.x + pixel.y + pixel.z) / 3.0f;
+
+    case DT_TONEEQ_LIGHTNESS:
+      return (fmax(fmax(pixel.x, pixel.y), pixel.z) + fmin(fmin(pixel.x, pixel.y), pixel.z)) / 2.0f;
+
+    case DT_TONEEQ_VALUE:
+      return fmax(fmax(pixel.x, pixel.y), pixel.z);
+
+    case DT_TONEEQ_NORM_1:
+      return fabs(pixel.x) + fabs(pixel.y) + fabs(pixel.z);
+
+    case DT_TONEEQ_NORM_2:
+      return sqrt(pixel.x * pixel.x + pixel.y * pixel.y + pixel.z * pixel.z);
+
+    case DT_TONEEQ_NORM_POWER:
+    {
+      const float4 value = fabs(pixel);
+      const float4 RGB_square = value * value;
+      const float4 RGB_cubic = RGB_square * value;
+      return (RGB_cubic.x + RGB_cubic.y + RGB_cubic.z) / (RGB_square.x + RGB_square.y + RGB_square.z);
+    }
+
+    case DT_TONEEQ_GEOMEAN:
+      return pow(fabs(pixel.x) * fabs(pixel.y) * fabs(pixel.z), 1.0f / 3.0f);
+
+    default:
+      return 0.0f;
+  }
+}
+
+
+kernel void
+toneequalizer_luminance_mask(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                             const int method, const float exposure_boost, const float fulcrum,
+                             const float contrast_boost)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float lum = linear_contrast(exposure_boost * pixel_luminance(pixel, method), fulcrum, contrast_boost);
+
+  write_imagef(out, (int2)(x, y), (float4)(lum, 0.0f, 0.0f, 0.0f));
+}
+
+
+kernel void
+toneequalizer_interpolate_bilinear(read_only image2d_t in, const int width_in, const int height_in,
+                                   write_only image2d_t out, const int width_out, const int height_out)
+{
+  const int j = get_global_id(0);
+  const int i = get_global_id(1);
+
+  if(j >= width_out || i >= height_out) return;
+
+  // Corresponding absolute coordinates of the pixel in input space
+  const float x_in = (float)j / (float)width_out * (float)width_in;
+  const float y_in = (float)i / (float)height_out * (float)height_in;
+
+  // Nearest neighbours coordinates in input space
+  const int x_prev = min((int)floor(x_in), width_in - 1);
+  const int x_next = min((int)floor(x_in) + 1, width_in - 1);
+  const int y_prev = min((int)floor(y_in), height_in - 1);
+  const int y_next = min((int)floor(y_in) + 1, height_in - 1);
+
+  const float4 Q_NW = read_imagef(in, sampleri, (int2)(x_prev, y_prev));
+  const float4 Q_NE = read_imagef(in, sampleri, (int2)(x_next, y_prev));
+  const float4 Q_SE = read_imagef(in, sampleri, (int2)(x_next, y_next));
+  const float4 Q_SW = read_imagef(in, sampleri, (int2)(x_prev, y_next));
+
+  // Spatial differences between nodes
+  const float Dy_next = (float)y_next - y_in;
+  const float Dy_prev = 1.f - Dy_next; // because next - prev = 1
+  const float Dx_next = (float)x_next - x_in;
+  const float Dx_prev = 1.f - Dx_next; // because next - prev = 1
+
+  write_imagef(out, (int2)(j, i), Dy_prev * (Q_SW * Dx_next + Q_SE * Dx_prev) +
+                                  Dy_next * (Q_NW * Dx_next + Q_NE * Dx_prev));
+}
+
+
+kernel void
+toneequalizer_variance_products(read_only image2d_t image, write_only image2d_t out, const int width,
+                                const int height, const float sampling, const float clip_min, const float clip_max)
+{
+  // the guide is the image quantized in exposure levels evenly spaced in log by sampling,
+  // the mask is the image itself. output { I, p, I * I, I * p } for the box averages
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float mask = read_imagef(image, sampleri, (int2)(x, y)).x;
+  const float guide = (sampling == 0.0f)
+                          ? mask
+                          : clamp(exp2(floor(log2(mask) / sampling) * sampling), clip_min, clip_max);
+
+  write_imagef(out, (int2)(x, y), (float4)(guide, mask, guide * guide, guide * mask));
+}
+
+
+kernel void
+toneequalizer_box_mean_x(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                         const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int begin_convol = max(x - radius, 0);
+  const int end_convol = min(x + radius, width - 1);
+
+  float4 w = (float4)0.0f;
+  for(int c = begin_convol; c <= end_convol; c++) w += read_imagef(in, sampleri, (int2)(c, y));
+
+  write_imagef(out, (int2)(x, y), w / (float)(end_convol - begin_convol + 1));
+}
+
+
+kernel void
+toneequalizer_box_mean_y(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                         const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int begin_convol = max(y - radius, 0);
+  const int end_convol = min(y + radius, height - 1);
+
+  float4 w = (float4)0.0f;
+  for(int c = begin_convol; c <= end_convol; c++) w += read_imagef(in, sampleri, (int2)(x, c));
+
+  write_imagef(out, (int2)(x, y), w / (float)(end_convol - begin_convol + 1));
+}
+
+
+kernel void
+toneequalizer_variance_solve(read_only image2d_t in, write_only image2d_t ab, const int width, const int height,
+                             const float feathering)
+{
+  // in holds the box averages { mean_I, mean_p, corr_I, corr_Ip }, output the linear blending
+  // params s.t. mask = a * I + b
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 tmp = read_imagef(in, sampleri, (int2)(x, y));
+  const float d = fmax((tmp.z - tmp.x * tmp.x) + feathering, 1e-15f); // avoid division by 0.
+  const float a = (tmp.w - tmp.x * tmp.y) / d;
+  const float b = tmp.y - a * tmp.x;
+
+  write_imagef(ab, (int2)(x, y), (float4)(a, b, 0.0f, 0.0f));
+}
+
+
+kernel void
+toneequalizer_linear_blending(read_only image2d_t image, read_only image2d_t ab, write_only image2d_t out,
+                              const int width, const int height, const int geomean)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float pixel = read_imagef(image, sampleri, (int2)(x, y)).x;
+  const float4 coeffs = read_imagef(ab, sampleri, (int2)(x, y));
+
+  // Note : pixel is positive at the outside of the luminance mask
+  const float blended = fmax(pixel * coeffs.x + coeffs.y, MIN_FLOAT);
+  const float result = geomean ? sqrt(pixel * blended) : blended;
+
+  write_imagef(out, (int2)(x, y), (float4)(result, 0.0f, 0.0f, 0.0f));
+}
+
+
+kernel void
+toneequalizer_apply(read_only image2d_t in, read_only image2d_t luminance, write_only image2d_t out,
+                    const int width, const int height, const int offset_x, const int offset_y,
+                    constant float *factors, const float sigma)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x + offset_x, y + offset_y));
+  const float lum = read_imagef(luminance, sampleri, (int2)(x + offset_x, y + offset_y)).x;
+
+  // The radial-basis interpolation is valid in [-8; 0] EV and can quickely diverge outside
+  const float exposure = clamp(log2(lum), -8.0f, 0.0f);
+  const float gauss_denom = 2.0f * sigma * sigma;
+
+  float result = 0.0f;
+  for(int i = 0; i < PIXEL_CHAN; ++i)
+  {
+    const float radius = exposure - centers_ops[i];
+    result += exp(-radius * radius / gauss_denom) * factors[i];
+  }
+
+  // the user-set correction is expected in [-2;+2] EV, so is the interpolated one
+  const float correction = clamp(result, 0.25f, 4.0f);
+
+  float4 o = pixel * correction;
+  o.w = pixel.w; // pass-through alpha mask
+
+  write_imagef(out, (int2)(x, y), o);
+}
+
+
+kernel void
+toneequalizer_show_luminance_mask(read_only image2d_t in, read_only image2d_t luminance, write_only image2d_t out,
+                                  const int width, const int height, const int offset_x, const int offset_y)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x + offset_x, y + offset_y));
+  const float lum = read_imagef(luminance, sampleri, (int2)(x + offset_x, y + offset_y)).x;
+
+  write_imagef(out, (int2)(x, y), (float4)(lum, lum, lum, pixel.w));
+}
@@ -178,6 +178,7 @@ static void _stop_cursor()
 
 
 static void dt_bauhaus_slider_set_normalized(dt_bauhaus_widget_t *w, float pos);
+static void _slider_set_normalized_deferred(dt_bauhaus_widget_t *w, float pos);
 
 static float slider_right_pos(float width)
 {
@@ -379,7 +380,7 @@ static gboolean dt_bauhaus_popup_motion_notify(GtkWidget *widget, GdkEventMotion
         // remember mouse position for motion effects in draw
         darktable.bauhaus->mouse_x = ex;
         darktable.bauhaus->mouse_y = ey;
-        dt_bauhaus_slider_set_normalized(w, d->oldpos + mouse_off);
+        _slider_set_normalized_deferred(w, d->oldpos + mouse_off);
       }
     }
     break;
@@ -921,6 +922,8 @@ static void dt_bauhaus_slider_destroy(dt_bauhaus_widget_t *widget, gpointer user
   dt_bauhaus_slider_data_t *d = &w->data.slider;
   if(d->timeout_handle) g_source_remove(d->timeout_handle);
   d->timeout_handle = 0;
+  if(d->tick_handle) gtk_widget_remove_tick_callback(GTK_WIDGET(w), d->tick_handle);
+  d->tick_handle = 0;
 }
 
 GtkWidget *dt_bauhaus_slider_new(dt_iop_module_t *self)
@@ -965,6 +968,7 @@ GtkWidget *dt_bauhaus_slider_from_widget(dt_bauhaus_widget_t* w,dt_iop_module_t
   d->is_dragging = 0;
   d->is_changed = 0;
   d->timeout_handle = 0;
+  d->tick_handle = 0;
   d->callback = _default_linear_callback;
 
   gtk_widget_add_events(GTK_WIDGET(w), GDK_KEY_PRESS_MASK);
@@ -1962,7 +1966,7 @@ static gboolean dt_bauhaus_slider_add_delta_internal(GtkWidget *widget, float de
 
   if(w->module) dt_iop_request_focus(w->module);
 
-  dt_bauhaus_slider_set_normalized(w, d->pos + delta);
+  _slider_set_normalized_deferred(w, d->pos + delta);
 
   return TRUE;
 }
@@ -2242,7 +2246,7 @@ void dt_bauhaus_slider_set_soft(GtkWidget *widget, float pos)
   dt_bauhaus_slider_set_normalized(w, rpos);
 }
 
-static void dt_bauhaus_slider_set_normalized(dt_bauhaus_widget_t *w, float pos)
+static void _slider_set_pos(dt_bauhaus_widget_t *w, float pos)
 {
   dt_bauhaus_slider_data_t *d = &w->data.slider;
   float rpos = CLAMP(pos, 0.0f, 1.0f);
@@ -2252,11 +2256,48 @@ static void dt_bauhaus_slider_set_normalized(dt_bauhaus_widget_t *w, float pos)
   d->pos = (rpos - d->min) / (d->max - d->min);
   gtk_widget_queue_draw(GTK_WIDGET(w));
   d->is_changed = 1;
+}
+
+static void dt_bauhaus_slider_set_normalized(dt_bauhaus_widget_t *w, float pos)
+{
+  dt_bauhaus_slider_data_t *d = &w->data.slider;
+  _slider_set_pos(w, pos);
   if(!darktable.gui->reset && !d->is_dragging)
+  {
+    if(d->tick_handle) gtk_widget_remove_tick_callback(GTK_WIDGET(w), d->tick_handle);
+    d->tick_handle = 0;
+    g_signal_emit_by_name(G_OBJECT(w), "value-changed");
+    d->is_changed = 0;
+  }
+}
+
+static gboolean _slider_value_change_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+  dt_bauhaus_widget_t *w = (dt_bauhaus_widget_t *)widget;
+  dt_bauhaus_slider_data_t *d = &w->data.slider;
+  d->tick_handle = 0;
+  if(d->is_changed && !d->is_dragging)
   {
     g_signal_emit_by_name(G_OBJECT(w), "value-changed");
     d->is_changed = 0;
   }
+  return G_SOURCE_REMOVE;
+}
+
+/* as dt_bauhaus_slider_set_normalized(), but value-changed is emitted at the next frame with the latest
+   value. popup drags, scrolling and key repeats can change the value many times per frame, and every
+   emission adds a history item and invalidates the pipes */
+static void _slider_set_normalized_deferred(dt_bauhaus_widget_t *w, float pos)
+{
+  dt_bauhaus_slider_data_t *d = &w->data.slider;
+  if(darktable.gui->reset || d->is_dragging || !gtk_widget_get_realized(GTK_WIDGET(w)))
+  {
+    dt_bauhaus_slider_set_normalized(w, pos);
+    return;
+  }
+  _slider_set_pos(w, pos);
+  if(!d->tick_handle)
+    d->tick_handle = gtk_widget_add_tick_callback(GTK_WIDGET(w), _slider_value_change_tick, NULL, NULL);
 }
 
 static gboolean dt_bauhaus_slider_postponed_value_change(gpointer data)
@@ -84,6 +84,7 @@ typedef struct dt_bauhaus_slider_data_t
   int is_dragging;      // indicates is mouse is dragging slider
   int is_changed;       // indicates new data
   guint timeout_handle; // used to store id of timeout routine
+  guint tick_handle;    // pending value change of popup drags and scrolling, once per frame
   float (*callback)(GtkWidget*, float, dt_bauhaus_callback_t); // callback function
 } dt_bauhaus_slider_data_t;
 
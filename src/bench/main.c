@@ -0,0 +1,556 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * darktable-bench measures the throughput of the pixelpipe:
+ *  - whole pipe exports of the given reference images (with their xmp)
+ *  - every enabled module of their history on its own, through process(), process_sse2(),
+ *    process_avx2(), process_avx512() and process_cl(), on synthetic frames of several sizes in the
+ *    module's input format
+ * results are reported in megapixels per second and can be stored as json and compared
+ * against a baseline written by an earlier run.
+ */
+
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/iop_order.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "develop/develop.h"
+#include "develop/format.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include "osx/osx.h"
+#endif
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define DT_BENCH_MAX_SIZES 8
+
+typedef struct dt_bench_options_t
+{
+  float sizes[DT_BENCH_MAX_SIZES]; // megapixels of the module runs
+  int num_sizes;
+  int iterations;
+  gchar **modules; // only these, NULL for all
+  gboolean export;
+  const char *output;
+  const char *baseline;
+  float tolerance; // relative slowdown reported as regression
+} dt_bench_options_t;
+
+typedef struct dt_bench_result_t
+{
+  gchar *image;
+  gchar *module;
+  const char *path; // plain, sse2, opencl or export
+  float megapixels;
+  double seconds;   // best of all iterations
+} dt_bench_result_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [options] <image> [<xmp file>] [<image> [<xmp file>] ...] [--core <darktable options>]\n",
+          progname);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "   --sizes <megapixels,...> default: 1,4,16\n");
+  fprintf(stderr, "   --iterations <n> default: 3, the best run is reported\n");
+  fprintf(stderr, "   --modules <op,...> default: all modules in the history\n");
+  fprintf(stderr, "   --no-export, skip the whole pipe exports\n");
+  fprintf(stderr, "   --output <json file>\n");
+  fprintf(stderr, "   --baseline <json file> written by an earlier --output\n");
+  fprintf(stderr, "   --tolerance <percent> slowdown reported as regression, default: 10\n");
+}
+
+static double _mps(const dt_bench_result_t *r)
+{
+  return r->seconds > 0.0 ? r->megapixels / r->seconds : 0.0;
+}
+
+static gchar *_result_key(const char *image, const char *module, const char *path, const float megapixels)
+{
+  return g_strdup_printf("%s/%s/%s/%.1f", image, module, path, megapixels);
+}
+
+static void _add_result(GList **results, const char *image, const char *module, const char *path,
+                        const float megapixels, const double seconds)
+{
+  dt_bench_result_t *r = g_malloc0(sizeof(dt_bench_result_t));
+  r->image = g_strdup(image);
+  r->module = g_strdup(module);
+  r->path = path;
+  r->megapixels = megapixels;
+  r->seconds = seconds;
+  *results = g_list_append(*results, r);
+  printf("%-24s %-20s %-7s %6.1f MP %10.4f s %10.2f MP/s\n", image, module, path, megapixels, seconds, _mps(r));
+  fflush(stdout);
+}
+
+static void _free_result(gpointer data)
+{
+  dt_bench_result_t *r = (dt_bench_result_t *)data;
+  g_free(r->image);
+  g_free(r->module);
+  g_free(r);
+}
+
+// deterministic content, so runs on different machines see the same data
+static void _fill_synthetic(void *buf, const dt_iop_buffer_dsc_t *dsc, const size_t npixels)
+{
+  uint32_t state = 0x9e3779b9u;
+  const size_t n = npixels * dsc->channels;
+  if(dsc->datatype == TYPE_UINT16)
+  {
+    uint16_t *out = (uint16_t *)buf;
+    for(size_t k = 0; k < n; k++)
+    {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      out[k] = state & 0xffff;
+    }
+  }
+  else
+  {
+    float *out = (float *)buf;
+    for(size_t k = 0; k < n; k++)
+    {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      out[k] = (state >> 8) * (1.0f / (1 << 24));
+    }
+  }
+}
+
+// time one cpu code path of a module, returns the best time or -1 on failure
+static double _time_cpu(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                        void (*process)(struct dt_iop_module_t *, struct dt_dev_pixelpipe_iop_t *,
+                                        const void *const, void *const, const struct dt_iop_roi_t *const,
+                                        const struct dt_iop_roi_t *const),
+                        const void *const input, void *const output, const dt_iop_roi_t *roi_in,
+                        const dt_iop_roi_t *roi_out, const int iterations)
+{
+  double best = -1.0;
+  for(int it = 0; it < iterations; it++)
+  {
+    const double start = dt_get_wtime();
+    process(module, piece, input, output, roi_in, roi_out);
+    const double t = dt_get_wtime() - start;
+    if(best < 0.0 || t < best) best = t;
+  }
+  return best;
+}
+
+#ifdef HAVE_OPENCL
+static double _time_cl(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const input,
+                       const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in_bpp,
+                       const int out_bpp, const int iterations)
+{
+  if(!module->process_cl || !piece->process_cl_ready || !dt_opencl_is_inited()) return -1.0;
+  const int devid = dt_opencl_lock_device(DT_DEV_PIXELPIPE_EXPORT);
+  if(devid < 0) return -1.0;
+
+  double best = -1.0;
+  cl_mem dev_in = dt_opencl_alloc_device(devid, roi_in->width, roi_in->height, in_bpp);
+  cl_mem dev_out = dt_opencl_alloc_device(devid, roi_out->width, roi_out->height, out_bpp);
+  if(dev_in && dev_out
+     && dt_opencl_write_host_to_device(devid, (void *)input, dev_in, roi_in->width, roi_in->height, in_bpp)
+            == CL_SUCCESS)
+  {
+    // modules pick their device from the pipe
+    const int pipe_devid = piece->pipe->devid;
+    piece->pipe->devid = devid;
+    dt_opencl_finish(devid);
+    for(int it = 0; it < iterations; it++)
+    {
+      const double start = dt_get_wtime();
+      const int ok = module->process_cl(module, piece, dev_in, dev_out, roi_in, roi_out);
+      dt_opencl_finish(devid);
+      if(!ok)
+      {
+        best = -1.0;
+        break;
+      }
+      const double t = dt_get_wtime() - start;
+      if(best < 0.0 || t < best) best = t;
+    }
+    piece->pipe->devid = pipe_devid;
+  }
+  dt_opencl_release_mem_object(dev_in);
+  dt_opencl_release_mem_object(dev_out);
+  dt_opencl_unlock_device(devid);
+  return best;
+}
+#endif
+
+static void _bench_modules(dt_dev_pixelpipe_t *pipe, const char *image, const dt_bench_options_t *opts,
+                           GList **results)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    if(!piece->enabled || !module->process_plain) continue;
+    if(opts->modules && !g_strv_contains((const gchar *const *)opts->modules, module->op)) continue;
+
+    const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(&piece->dsc_in);
+    const size_t out_bpp = dt_iop_buffer_dsc_to_bpp(&piece->dsc_out);
+    if(!in_bpp || !out_bpp) continue;
+
+    const float aspect = pipe->iheight > 0 ? (float)pipe->iwidth / pipe->iheight : 1.5f;
+    for(int s = 0; s < opts->num_sizes; s++)
+    {
+      const float megapixels = opts->sizes[s];
+      dt_iop_roi_t roi_out = { 0, 0, 0, 0, 1.0f };
+      roi_out.height = MAX(16, (int)sqrtf(megapixels * 1.0e6f / aspect));
+      roi_out.width = MAX(16, (int)(roi_out.height * aspect));
+      dt_iop_roi_t roi_in = roi_out;
+      module->modify_roi_in(module, piece, &roi_out, &roi_in);
+
+      void *input = dt_alloc_align(64, in_bpp * roi_in.width * roi_in.height);
+      void *output = dt_alloc_align(64, out_bpp * roi_out.width * roi_out.height);
+      if(!input || !output)
+      {
+        fprintf(stderr, "[bench] not enough memory to run `%s' at %.1f MP\n", module->op, megapixels);
+        dt_free_align(input);
+        dt_free_align(output);
+        continue;
+      }
+      _fill_synthetic(input, &piece->dsc_in, (size_t)roi_in.width * roi_in.height);
+
+      const float mp = roi_out.width * (float)roi_out.height * 1.0e-6f;
+      const double plain = _time_cpu(module, piece, module->process_plain, input, output, &roi_in, &roi_out,
+                                     opts->iterations);
+      _add_result(results, image, module->op, "plain", mp, plain);
+#if defined(__SSE2__)
+      if(module->process_sse2 && darktable.codepath.SSE2)
+      {
+        const double sse2 = _time_cpu(module, piece, module->process_sse2, input, output, &roi_in, &roi_out,
+                                      opts->iterations);
+        _add_result(results, image, module->op, "sse2", mp, sse2);
+      }
+      if(module->process_avx2 && darktable.codepath.AVX2)
+      {
+        const double avx2 = _time_cpu(module, piece, module->process_avx2, input, output, &roi_in, &roi_out,
+                                      opts->iterations);
+        _add_result(results, image, module->op, "avx2", mp, avx2);
+      }
+      if(module->process_avx512 && darktable.codepath.AVX512)
+      {
+        const double avx512 = _time_cpu(module, piece, module->process_avx512, input, output, &roi_in,
+                                        &roi_out, opts->iterations);
+        _add_result(results, image, module->op, "avx512", mp, avx512);
+      }
+#endif
+#ifdef HAVE_OPENCL
+      const double cl = _time_cl(module, piece, input, &roi_in, &roi_out, in_bpp, out_bpp, opts->iterations);
+      if(cl >= 0.0) _add_result(results, image, module->op, "opencl", mp, cl);
+#endif
+      dt_free_align(input);
+      dt_free_align(output);
+    }
+  }
+}
+
+static int _bench_image(const char *filename, const char *xmp, const dt_bench_options_t *opts, GList **results)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int imgid = dt_image_import(filmid, filename, TRUE);
+  if(!imgid)
+  {
+    fprintf(stderr, "[bench] can't open file %s\n", filename);
+    return 1;
+  }
+  if(xmp)
+  {
+    dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+    const int err = dt_exif_xmp_read(img, xmp, 1);
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    if(err)
+    {
+      fprintf(stderr, "[bench] can't open xmp file %s\n", xmp);
+      return 1;
+    }
+  }
+
+  gchar *image = g_path_get_basename(filename);
+  int res = 1;
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf || !buf.width || !buf.height)
+  {
+    fprintf(stderr, "[bench] image %s is not available\n", filename);
+    goto error_early;
+  }
+
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_export(&pipe, dev.image_storage.width, dev.image_storage.height,
+                                   IMAGEIO_RGB | IMAGEIO_FLOAT, FALSE))
+  {
+    fprintf(stderr, "[bench] can't allocate the pixelpipe for %s\n", filename);
+    goto error_early;
+  }
+  dt_ioppr_resync_modules_order(&dev);
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  // the whole pipe, which also leaves the buffer formats of all pieces behind for the module runs
+  const float mp = pipe.processed_width * (float)pipe.processed_height * 1.0e-6f;
+  double best = -1.0;
+  for(int it = 0; it < (opts->export ? opts->iterations : 1); it++)
+  {
+    dt_dev_pixelpipe_cache_flush(&pipe.cache);
+    const double start = dt_get_wtime();
+    if(dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, pipe.processed_width, pipe.processed_height, 1.0f))
+    {
+      fprintf(stderr, "[bench] processing %s failed\n", filename);
+      goto error;
+    }
+    const double t = dt_get_wtime() - start;
+    if(best < 0.0 || t < best) best = t;
+  }
+  if(opts->export) _add_result(results, image, "pixelpipe", "export", mp, best);
+
+  _bench_modules(&pipe, image, opts, results);
+  res = 0;
+
+error:
+  dt_dev_pixelpipe_cleanup(&pipe);
+error_early:
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  g_free(image);
+  return res;
+}
+
+static int _write_results(const char *filename, GList *results)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[bench] can't write %s\n", filename);
+    return 1;
+  }
+  gchar *version = g_strescape(darktable_package_string, NULL);
+  fprintf(f, "{\n  \"darktable\": \"%s\",\n  \"results\": [", version);
+  g_free(version);
+  for(GList *iter = results; iter; iter = g_list_next(iter))
+  {
+    const dt_bench_result_t *r = (dt_bench_result_t *)iter->data;
+    gchar *image = g_strescape(r->image, NULL);
+    fprintf(f, "%s\n    { \"image\": \"%s\", \"module\": \"%s\", \"path\": \"%s\", \"megapixels\": %.1f, "
+               "\"seconds\": %.6f, \"mps\": %.3f }",
+            iter == results ? "" : ",", image, r->module, r->path, r->megapixels, r->seconds, _mps(r));
+    g_free(image);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+  return 0;
+}
+
+// returns the number of results that got slower than the baseline by more than the tolerance
+static int _compare_baseline(const char *filename, GList *results, const float tolerance)
+{
+  GError *error = NULL;
+  JsonParser *parser = json_parser_new();
+  if(!json_parser_load_from_file(parser, filename, &error))
+  {
+    fprintf(stderr, "[bench] can't read baseline %s: %s\n", filename, error->message);
+    g_error_free(error);
+    g_object_unref(parser);
+    return -1;
+  }
+
+  GHashTable *baseline = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  JsonNode *root = json_parser_get_root(parser);
+  JsonObject *obj = root && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+  JsonArray *array = obj && json_object_has_member(obj, "results") ? json_object_get_array_member(obj, "results")
+                                                                    : NULL;
+  for(guint k = 0; array && k < json_array_get_length(array); k++)
+  {
+    JsonObject *r = json_array_get_object_element(array, k);
+    if(!r) continue;
+    double *mps = g_malloc(sizeof(double));
+    *mps = json_object_get_double_member(r, "mps");
+    g_hash_table_insert(baseline,
+                        _result_key(json_object_get_string_member(r, "image"),
+                                    json_object_get_string_member(r, "module"),
+                                    json_object_get_string_member(r, "path"),
+                                    json_object_get_double_member(r, "megapixels")),
+                        mps);
+  }
+  g_object_unref(parser);
+
+  int regressions = 0;
+  printf("\ncompared to %s:\n", filename);
+  for(GList *iter = results; iter; iter = g_list_next(iter))
+  {
+    const dt_bench_result_t *r = (dt_bench_result_t *)iter->data;
+    gchar *key = _result_key(r->image, r->module, r->path, r->megapixels);
+    const double *old = g_hash_table_lookup(baseline, key);
+    g_free(key);
+    if(!old || *old <= 0.0) continue;
+    const double ratio = _mps(r) / *old;
+    const gboolean regression = ratio < 1.0 - tolerance;
+    if(regression) regressions++;
+    printf("%-24s %-20s %-7s %6.1f MP %10.2f -> %10.2f MP/s %+7.1f%%%s\n", r->image, r->module, r->path,
+           r->megapixels, *old, _mps(r), 100.0 * (ratio - 1.0), regression ? "  REGRESSION" : "");
+  }
+  g_hash_table_destroy(baseline);
+  return regressions;
+}
+
+int main(int argc, char *arg[])
+{
+#ifdef __APPLE__
+  dt_osx_prepare_environment();
+#endif
+  dt_bench_options_t opts = { .sizes = { 1.0f, 4.0f, 16.0f },
+                              .num_sizes = 3,
+                              .iterations = 3,
+                              .modules = NULL,
+                              .export = TRUE,
+                              .output = NULL,
+                              .baseline = NULL,
+                              .tolerance = 0.1f };
+  GList *inputs = NULL; // pairs of image and xmp file (or NULL)
+  int k;
+
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "-h") || !strcmp(arg[k], "--help"))
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    else if(!strcmp(arg[k], "--sizes") && argc > k + 1)
+    {
+      gchar **sizes = g_strsplit(arg[++k], ",", DT_BENCH_MAX_SIZES);
+      opts.num_sizes = 0;
+      for(gchar **s = sizes; *s; s++)
+        if(g_ascii_strtod(*s, NULL) > 0.0) opts.sizes[opts.num_sizes++] = g_ascii_strtod(*s, NULL);
+      g_strfreev(sizes);
+    }
+    else if(!strcmp(arg[k], "--iterations") && argc > k + 1)
+      opts.iterations = MAX(1, atoi(arg[++k]));
+    else if(!strcmp(arg[k], "--modules") && argc > k + 1)
+      opts.modules = g_strsplit(arg[++k], ",", -1);
+    else if(!strcmp(arg[k], "--no-export"))
+      opts.export = FALSE;
+    else if(!strcmp(arg[k], "--output") && argc > k + 1)
+      opts.output = arg[++k];
+    else if(!strcmp(arg[k], "--baseline") && argc > k + 1)
+      opts.baseline = arg[++k];
+    else if(!strcmp(arg[k], "--tolerance") && argc > k + 1)
+      opts.tolerance = MAX(0.0, g_ascii_strtod(arg[++k], NULL) / 100.0);
+    else if(!strcmp(arg[k], "--core"))
+    {
+      // everything from here on is passed to dt_init()
+      k++;
+      break;
+    }
+    else if(g_str_has_suffix(arg[k], ".xmp") || g_str_has_suffix(arg[k], ".XMP"))
+    {
+      GList *last = g_list_last(inputs);
+      if(!last || last->data)
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      last->data = arg[k];
+    }
+    else
+    {
+      inputs = g_list_append(inputs, arg[k]);
+      inputs = g_list_append(inputs, NULL);
+    }
+  }
+
+  if(!inputs)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  // init dt without gui and without data.db:
+  char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
+  int m_argc = 0;
+  m_arg[m_argc++] = arg[0];
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL))
+  {
+    free(m_arg);
+    exit(1);
+  }
+
+  GList *results = NULL;
+  int failed = 0;
+  for(GList *iter = inputs; iter && iter->next; iter = g_list_next(iter->next))
+    failed += _bench_image((const char *)iter->data, (const char *)iter->next->data, &opts, &results);
+
+  if(opts.output) failed += _write_results(opts.output, results);
+  int regressions = 0;
+  if(opts.baseline) regressions = _compare_baseline(opts.baseline, results, opts.tolerance);
+
+  g_list_free_full(results, _free_result);
+  g_list_free(inputs);
+  g_strfreev(opts.modules);
+
+  dt_cleanup();
+  free(m_arg);
+
+  if(regressions < 0 || failed) exit(1);
+  exit(regressions > 0 ? 2 : 0);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -137,6 +137,35 @@ static inline int solve(double *As, double *w, double *v, const double *b, doubl
   return 0;
 }
 
+// appends column col of A as column k to the thin QR decomposition of the columns chosen so far. Q holds the
+// orthonormal columns one after another, R is upper triangular with row stride S. the column is orthogonalised
+// twice (gram-schmidt), which keeps Q orthonormal to working precision. returns 1 if the column is (nearly)
+// linearly dependent on the others.
+static inline int qr_append(double *Q, double *R, const double *A, const int wd, const int col, const int k,
+                            const int S)
+{
+  double *q = Q + (size_t)k * wd;
+  for(int j = 0; j < wd; j++) q[j] = A[j * wd + col];
+  for(int i = 0; i < k; i++) R[i * S + k] = 0.0;
+  for(int pass = 0; pass < 2; pass++)
+    for(int i = 0; i < k; i++)
+    {
+      const double *qi = Q + (size_t)i * wd;
+      double d = 0.0;
+      for(int j = 0; j < wd; j++) d += qi[j] * q[j];
+      for(int j = 0; j < wd; j++) q[j] -= d * qi[j];
+      R[i * S + k] += d;
+    }
+  double n = 0.0;
+  for(int j = 0; j < wd; j++) n += q[j] * q[j];
+  n = sqrt(n);
+  if(n < 1e-3) // same threshold the svd used for the smallest singular value
+    return 1;
+  R[k * S + k] = n;
+  for(int j = 0; j < wd; j++) q[j] /= n;
+  return 0;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wvla"
 
@@ -199,6 +228,8 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
   double *w = malloc(S * sizeof(double));
   double *v = malloc(S * S * sizeof(double));
   double *As = calloc(wd * S, sizeof(double));
+  // Q^t b for every channel, the right hand side of R c = Q^t b
+  double *qtb = calloc(dim * S, sizeof(double));
 
   // for rank from 0 to sparsity level
   int s = 0, patches = 0;
@@ -215,6 +246,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
       free(w);
       free(v);
       free(As);
+      free(qtb);
       free(norm);
       free(A);
       return sparsity;
@@ -246,6 +278,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
             free(w);
             free(v);
             free(As);
+            free(qtb);
             free(norm);
             free(A);
             return sparsity;
@@ -313,6 +346,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
             free(w);
             free(v);
             free(As);
+            free(qtb);
             free(norm);
             free(A);
             return s;
@@ -371,6 +405,43 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
 
 #ifdef EXACT
     double err = 1. / maxdot;
+#elif !defined(REPLACEMENT)
+    // the chosen columns only grow, so instead of solving the least squares problem for all of them again,
+    // the new one is appended to a QR decomposition of the others and the residual just loses its
+    // component along it.
+    const int sp = sparsity;
+    double *Q = As, *R = v;
+    if(qr_append(Q, R, A, wd, permutation[sp], sp, S))
+    {
+      // on error, return last valid configuration
+      free(r);
+      free(b);
+      free(w);
+      free(v);
+      free(As);
+      free(qtb);
+      free(norm);
+      free(A);
+      return sparsity;
+    }
+    const double *q = Q + (size_t)sp * wd;
+    for(int ch = 0; ch < dim; ch++)
+    {
+      double d = 0.0;
+      for(int j = 0; j < wd; j++) d += q[j] * r[ch][j];
+      for(int j = 0; j < wd; j++) r[ch][j] -= d * q[j];
+      qtb[ch * S + sp] = d;
+      // back substitution R c = Q^t b
+      for(int i = sp; i >= 0; i--)
+      {
+        double c = qtb[ch * S + i];
+        for(int m = i + 1; m <= sp; m++) c -= R[i * S + m] * coeff[ch][m];
+        coeff[ch][i] = c / R[i * S + i];
+      }
+    }
+
+    double merr = 0.0;
+    const double err = compute_error(curve, target, r[0], r[1], r[2], wd, &merr);
 #else
     const int sp = MIN(sparsity, S-1); // need to fix up for replacement
     // solve linear least squares for sparse c for every output channel:
@@ -389,6 +460,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
         free(w);
         free(v);
         free(As);
+        free(qtb);
         free(norm);
         free(A);
         return sparsity;
@@ -425,6 +497,7 @@ int thinplate_match(const tonecurve_t *curve, // tonecurve to apply after this (
   free(w);
   free(v);
   free(As);
+  free(qtb);
   free(norm);
   free(A);
   return -1;
@@ -25,6 +25,7 @@
  *  - profit
  */
 
+#include "common/autotune.h"
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
@@ -36,15 +37,29 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/metrics.h"
 #include "common/points.h"
+#include "common/utility.h"
 #include "control/conf.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_estimate.h"
 
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <libintl.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#if defined(_WIN32)
+#include "win/getdelim.h"
+#else
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
 #ifdef __APPLE__
 #include "osx/osx.h"
 #endif
@@ -54,10 +69,17 @@
 #endif
 
 #define DT_MAX_STYLE_NAME_LENGTH 128
+// columns of dt_dev_pixelpipe_estimate_print()
+#define DT_CLI_ESTIMATE_HEADER "image\tmodule\troi_in\troi_out\tmemory_mb\ttiling\tdevice\tseconds\n"
+// columns of the lines dt_autotune_run() reports
+#define DT_CLI_AUTOTUNE_HEADER "date\tversion\tkind\tsettings\tseconds\n"
 
 static void usage(const char *progname)
 {
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --batch <manifest file|-> [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --serve <socket> [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --autotune <input file|folder> [<xmp file>] [--core <darktable options>]\n", progname);
   fprintf(stderr, "\n");
   fprintf(stderr, "options:\n");
   fprintf(stderr, "   --width <max width> default: 0 = full resolution\n");
@@ -69,11 +91,610 @@ static void usage(const char *progname)
   fprintf(stderr, "   --style <style name>\n");
   fprintf(stderr, "   --style-overwrite\n");
   fprintf(stderr, "   --apply-custom-presets <0|1|false|true>, default: true\n");
+  fprintf(stderr, "   --format <format name>, default: derived from the output file extension\n");
+  fprintf(stderr, "   --icc-type <type> --icc-file <file> --icc-intent <intent>, default: from the history\n");
+  fprintf(stderr, "   --metadata <export metadata configuration>\n");
+  fprintf(stderr, "   --batch <manifest file|->, one \"[--xmp <xmp file>] [--sequence <num> <total>] <input file> "
+                  "<output file> [<style name>]\" per line\n");
+  fprintf(stderr, "   --serve <socket>, render requests received on a local socket\n");
+  fprintf(stderr, "   --estimate, report the expected memory, tiling, device and time of every module "
+                  "instead of exporting, styles are not taken into account\n");
+  fprintf(stderr, "   --autotune, time the input with several thread, OpenCL and memory settings and keep the "
+                  "fastest in darktablerc\n");
   fprintf(stderr, "   --verbose\n");
   fprintf(stderr, "   --help,-h\n");
   fprintf(stderr, "   --version\n");
 }
 
+typedef struct dt_cli_export_t
+{
+  int width, height;
+  gboolean verbose, high_quality, upscale, style_overwrite, export_masks;
+  gboolean estimate;    // dry run, only report what the export would take
+  const char *format;   // format module name, NULL to go by the output extension
+  dt_colorspaces_color_profile_type_t icc_type;
+  const char *icc_filename;
+  dt_iop_color_intent_t icc_intent;
+  const char *metadata; // metadata configuration as stored by the export module, NULL for the defaults
+} dt_cli_export_t;
+
+// import a single file or a whole folder and optionally attach the given xmp.
+// returns the list of image ids, NULL on error (which has been reported already)
+static GList *_import_input(const char *input_filename, const char *xmp_filename)
+{
+  GList *id_list = NULL;
+
+  if(g_file_test(input_filename, G_FILE_TEST_IS_DIR))
+  {
+    const int filmid = dt_film_import(input_filename);
+    if(!filmid)
+    {
+      fprintf(stderr, _("error: can't open folder %s"), input_filename);
+      fprintf(stderr, "\n");
+      return NULL;
+    }
+    id_list = dt_film_get_image_ids(filmid);
+  }
+  else
+  {
+    dt_film_t film;
+    int id = 0;
+    int filmid = 0;
+
+    gchar *directory = g_path_get_dirname(input_filename);
+    filmid = dt_film_new(&film, directory);
+    id = dt_image_import(filmid, input_filename, TRUE);
+    g_free(directory);
+    if(!id)
+    {
+      fprintf(stderr, _("error: can't open file %s"), input_filename);
+      fprintf(stderr, "\n");
+      return NULL;
+    }
+
+    id_list = g_list_append(id_list, GINT_TO_POINTER(id));
+  }
+
+  if(id_list == NULL)
+  {
+    fprintf(stderr, _("no images to export, aborting\n"));
+    return NULL;
+  }
+
+  // attach xmp, if requested:
+  if(xmp_filename)
+  {
+    for(GList *iter = id_list; iter; iter = g_list_next(iter))
+    {
+      int id = GPOINTER_TO_INT(iter->data);
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+      if(dt_exif_xmp_read(image, xmp_filename, 1) != 0)
+      {
+        fprintf(stderr, _("error: can't open xmp file %s"), xmp_filename);
+        fprintf(stderr, "\n");
+        dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+        g_list_free(id_list);
+        return NULL;
+      }
+      // don't write new xmp:
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    }
+  }
+
+  return id_list;
+}
+
+// print the dry run estimate of exporting every image in id_list. returns 0 on success
+static int _estimate_images(GList *id_list, const dt_cli_export_t *opts)
+{
+  int res = 0;
+  for(GList *iter = id_list; iter; iter = g_list_next(iter))
+  {
+    const int id = GPOINTER_TO_INT(iter->data);
+    char filename[PATH_MAX] = { 0 };
+    gboolean from_cache = FALSE;
+    dt_image_full_path(id, filename, sizeof(filename), &from_cache);
+
+    dt_dev_pixelpipe_estimate_t estimate;
+    if(dt_dev_pixelpipe_estimate_export(id, opts->width, opts->height, opts->high_quality, opts->upscale,
+                                        &estimate))
+      dt_dev_pixelpipe_estimate_print(stdout, filename, &estimate);
+    else
+    {
+      fprintf(stderr, _("error: can't estimate %s"), filename);
+      fprintf(stderr, "\n");
+      res = 1;
+    }
+    dt_dev_pixelpipe_estimate_cleanup(&estimate);
+  }
+  fflush(stdout);
+  return res;
+}
+
+// export all images in id_list to output_filename, deriving the format from its extension unless given.
+// the images are numbered from first on, out of total (0 to count the list). returns 0 on success
+static int _export_images(GList *id_list, const char *output_filename, const char *style,
+                          const dt_cli_export_t *opts, const int first, const int of_total)
+{
+  if(opts->estimate) return _estimate_images(id_list, opts);
+
+  const int total = of_total > 0 ? of_total : g_list_length(id_list);
+
+  // print the history stack. only look at the first image and assume all got the same processing applied
+  if(opts->verbose)
+  {
+    int id = GPOINTER_TO_INT(id_list->data);
+    gchar *history = dt_history_get_items_as_string(id);
+    if(history)
+      printf("%s\n", history);
+    else
+      printf("[%s]\n", _("empty history stack"));
+    g_free(history);
+  }
+
+  // try to find out the export format from the output_filename
+  gchar *filename = g_strdup(output_filename);
+  char *ext = filename + strlen(filename);
+  while(ext > filename && *ext != '.') ext--;
+  *ext = '\0';
+  ext++;
+
+  if(!strcmp(ext, "jpg")) ext = "jpeg";
+
+  if(!strcmp(ext, "tif")) ext = "tiff";
+
+  // init the export data structures
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *sdata, *fdata;
+
+  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
+  if(storage == NULL)
+  {
+    fprintf(
+        stderr, "%s\n",
+        _("cannot find disk storage module. please check your installation, something seems to be broken."));
+    g_free(filename);
+    return 1;
+  }
+
+  sdata = storage->get_params(storage);
+  if(sdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+    g_free(filename);
+    return 1;
+  }
+
+  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
+  // any longer ...
+  g_strlcpy((char *)sdata, filename, DT_MAX_PATH_FOR_PARAMS);
+  // all is good now, the last line didn't happen.
+
+  format = dt_imageio_get_format_by_name(opts->format ? opts->format : ext);
+  if(format == NULL)
+  {
+    fprintf(stderr, _("unknown extension '.%s'"), opts->format ? opts->format : ext);
+    fprintf(stderr, "\n");
+    storage->free_params(storage, sdata);
+    g_free(filename);
+    return 1;
+  }
+
+  fdata = format->get_params(format);
+  if(fdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    storage->free_params(storage, sdata);
+    g_free(filename);
+    return 1;
+  }
+
+  uint32_t w, h, fw, fh, sw, sh;
+  fw = fh = sw = sh = 0;
+  storage->dimension(storage, sdata, &sw, &sh);
+  format->dimension(format, fdata, &fw, &fh);
+
+  if(sw == 0 || fw == 0)
+    w = sw > fw ? sw : fw;
+  else
+    w = sw < fw ? sw : fw;
+
+  if(sh == 0 || fh == 0)
+    h = sh > fh ? sh : fh;
+  else
+    h = sh < fh ? sh : fh;
+
+  fdata->max_width = opts->width;
+  fdata->max_height = opts->height;
+  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
+  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
+  fdata->style[0] = '\0';
+  fdata->style_append = 1; // make append the default and override with --style-overwrite
+
+  if(style)
+  {
+    g_strlcpy((char *)fdata->style, style, DT_MAX_STYLE_NAME_LENGTH);
+    fdata->style[127] = '\0';
+    if(opts->style_overwrite)
+      fdata->style_append = 0;
+  }
+
+  if(storage->initialize_store)
+  {
+    storage->initialize_store(storage, sdata, &format, &fdata, &id_list, opts->high_quality, opts->upscale);
+
+    format->set_params(format, fdata, format->params_size(format));
+    storage->set_params(storage, sdata, storage->params_size(storage));
+  }
+
+  // TODO: add a callback to set the bpp without going through the config
+
+  // same encoding as the export job
+  dt_export_metadata_t metadata;
+  metadata.flags = dt_lib_export_metadata_default_flags();
+  metadata.list = NULL;
+  if(opts->metadata)
+  {
+    metadata.list = dt_util_str_to_glist("\1", opts->metadata);
+    if(metadata.list)
+    {
+      metadata.flags = strtol(metadata.list->data, NULL, 16);
+      g_free(metadata.list->data);
+      metadata.list = g_list_delete_link(metadata.list, metadata.list);
+    }
+  }
+
+  int res = 0;
+  int num = first > 0 ? first : 1;
+  for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
+  {
+    const int id = GPOINTER_TO_INT(iter->data);
+    const double start = dt_get_wtime();
+    const gboolean failed
+        = storage->store(storage, sdata, id, format, fdata, num, total, opts->high_quality, opts->upscale,
+                         opts->export_masks, opts->icc_type, opts->icc_filename, opts->icc_intent, &metadata);
+    dt_metrics_observe_export(dt_get_wtime() - start);
+    dt_metrics_count(failed ? DT_METRICS_EXPORT_FAILURES : DT_METRICS_EXPORTED_IMAGES, 1);
+    if(failed) res = 1;
+  }
+  g_list_free_full(metadata.list, g_free);
+
+  // cleanup time
+  if(storage->finalize_store) storage->finalize_store(storage, sdata);
+  storage->free_params(storage, sdata);
+  format->free_params(format, fdata);
+  g_free(filename);
+
+  return res;
+}
+
+// drop the images from the in-memory library again so that neither it nor the image cache grow with the
+// number of jobs a warm process handles. the mipmap and pixelpipe caches keep what they deem worth it.
+static void _forget_images(GList *id_list)
+{
+  for(GList *iter = id_list; iter; iter = g_list_next(iter)) dt_image_remove(GPOINTER_TO_INT(iter->data));
+  g_list_free(id_list);
+}
+
+// process a manifest with one "<input file> <output file> [<style name>]" job per line. arguments are split
+// like a shell would, so names containing blanks can be quoted. empty lines and lines starting with '#' are
+// skipped. a job may be preceded by "--xmp <file>" to apply that sidecar instead of the one next to the input,
+// and by "--sequence <num> <total>" to number the output as part of a larger export. the process (and with it
+// the loaded modules, the opencl context and the caches) stays warm for all jobs, and every line reports "ok"
+// or "failed" on stdout so a caller can track progress.
+// returns the number of failed jobs
+static int _process_batch(const char *manifest, const char *default_style, const dt_cli_export_t *opts)
+{
+  FILE *fd = strcmp(manifest, "-") ? g_fopen(manifest, "r") : stdin;
+  if(!fd)
+  {
+    fprintf(stderr, _("error: can't open manifest %s"), manifest);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  char *line = NULL;
+  size_t len = 0;
+  int lineno = 0, failed = 0;
+
+  while(getline(&line, &len, fd) != -1)
+  {
+    lineno++;
+    g_strstrip(line);
+    if(line[0] == '\0' || line[0] == '#') continue;
+
+    gint job_argc = 0;
+    gchar **job_argv = NULL;
+    GError *error = NULL;
+    const char *xmp_filename = NULL;
+    int first = 0, of_total = 0, arg0 = 0;
+    if(g_shell_parse_argv(line, &job_argc, &job_argv, &error))
+    {
+      for(; arg0 < job_argc && job_argv[arg0][0] == '-'; arg0++)
+      {
+        if(!strcmp(job_argv[arg0], "--xmp") && arg0 + 1 < job_argc)
+          xmp_filename = job_argv[++arg0];
+        else if(!strcmp(job_argv[arg0], "--sequence") && arg0 + 2 < job_argc)
+        {
+          first = MAX(atoi(job_argv[++arg0]), 0);
+          of_total = MAX(atoi(job_argv[++arg0]), 0);
+        }
+        else
+          break;
+      }
+    }
+    if(!job_argv || job_argc - arg0 < 2 || job_argc - arg0 > 3 || job_argv[arg0][0] == '-')
+    {
+      fprintf(stderr, _("error: can't parse line %d of %s: %s"), lineno, manifest,
+              error ? error->message : line);
+      fprintf(stderr, "\n");
+      printf("failed %d\n", lineno);
+      fflush(stdout);
+      if(error) g_error_free(error);
+      g_strfreev(job_argv);
+      failed++;
+      continue;
+    }
+
+    const char *input_filename = job_argv[arg0];
+    const char *output_filename = job_argv[arg0 + 1];
+    const char *style = job_argc - arg0 > 2 ? job_argv[arg0 + 2] : default_style;
+
+    int res = 1;
+    if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
+    {
+      fprintf(stderr, _("error: output file is a directory. please specify file name"));
+      fprintf(stderr, "\n");
+    }
+    else
+    {
+      GList *id_list = _import_input(input_filename, xmp_filename);
+      if(id_list)
+      {
+        res = _export_images(id_list, output_filename, style, opts, first, of_total);
+
+        _forget_images(id_list);
+      }
+    }
+
+    printf("%s %d %s\n", res ? "failed" : "ok", lineno, output_filename);
+    fflush(stdout);
+    if(res) failed++;
+    g_strfreev(job_argv);
+  }
+
+  free(line);
+  if(fd != stdin) fclose(fd);
+  dt_film_remove_empty();
+
+  return failed;
+}
+
+#ifndef _WIN32
+static gboolean _parse_bool(const char *value, gboolean *result)
+{
+  gchar *str = g_ascii_strup(value, -1);
+  gboolean ok = TRUE;
+  if(!g_strcmp0(str, "0") || !g_strcmp0(str, "FALSE"))
+    *result = FALSE;
+  else if(!g_strcmp0(str, "1") || !g_strcmp0(str, "TRUE"))
+    *result = TRUE;
+  else
+    ok = FALSE;
+  g_free(str);
+  return ok;
+}
+
+static void _serve_error(FILE *out, const char *message)
+{
+  fprintf(out, "error %s\n", message);
+  fflush(out);
+}
+
+// handle one request line of shell-quoted key=value pairs:
+//   input=<file> [xmp=<file>] [format=<extension>] [width=<max width>] [height=<max height>]
+//   [style=<style name>] [hq=<bool>] [upscale=<bool>]
+// the reply is either "error <message>\n" or "ok <size> <file name>\n" followed by size bytes of the encoded image.
+static void _serve_request(FILE *out, const char *line, const char *tmpdir, const char *default_style,
+                           const dt_cli_export_t *defaults)
+{
+  const double start = dt_get_wtime();
+  gint req_argc = 0;
+  gchar **req_argv = NULL;
+  GError *error = NULL;
+  if(!g_shell_parse_argv(line, &req_argc, &req_argv, &error))
+  {
+    _serve_error(out, error->message);
+    g_error_free(error);
+    return;
+  }
+
+  dt_cli_export_t opts = *defaults;
+  const char *input_filename = NULL, *xmp_filename = NULL, *style = default_style, *ext = "jpg";
+  for(int i = 0; i < req_argc; i++)
+  {
+    char *value = strchr(req_argv[i], '=');
+    if(!value)
+    {
+      _serve_error(out, "malformed argument");
+      g_strfreev(req_argv);
+      return;
+    }
+    *value++ = '\0';
+    const char *key = req_argv[i];
+    gboolean ok = TRUE;
+    if(!strcmp(key, "input"))
+      input_filename = value;
+    else if(!strcmp(key, "xmp"))
+      xmp_filename = value;
+    else if(!strcmp(key, "format"))
+      ext = value;
+    else if(!strcmp(key, "style"))
+      style = *value ? value : NULL;
+    else if(!strcmp(key, "width"))
+      opts.width = MAX(atoi(value), 0);
+    else if(!strcmp(key, "height"))
+      opts.height = MAX(atoi(value), 0);
+    else if(!strcmp(key, "hq"))
+      ok = _parse_bool(value, &opts.high_quality);
+    else if(!strcmp(key, "upscale"))
+      ok = _parse_bool(value, &opts.upscale);
+    else
+      ok = FALSE;
+    if(!ok)
+    {
+      _serve_error(out, "unknown argument");
+      g_strfreev(req_argv);
+      return;
+    }
+  }
+
+  if(!input_filename || !g_file_test(input_filename, G_FILE_TEST_IS_REGULAR))
+  {
+    _serve_error(out, "missing or invalid input");
+    g_strfreev(req_argv);
+    return;
+  }
+  if(!*ext || strchr(ext, '/') || strchr(ext, '.'))
+  {
+    _serve_error(out, "invalid format");
+    g_strfreev(req_argv);
+    return;
+  }
+
+  GList *id_list = _import_input(input_filename, xmp_filename);
+  if(!id_list)
+  {
+    _serve_error(out, "can't import input");
+    g_strfreev(req_argv);
+    return;
+  }
+
+  // the disk storage picks the final name (extension, sequence numbers), so render into an otherwise empty
+  // directory and just take whatever shows up there
+  gchar *output_filename = g_strdup_printf("%s" G_DIR_SEPARATOR_S "render.%s", tmpdir, ext);
+  const int res = _export_images(id_list, output_filename, style, &opts, 0, 0);
+  _forget_images(id_list);
+  g_free(output_filename);
+
+  gchar *rendered = NULL;
+  GDir *dir = g_dir_open(tmpdir, 0, NULL);
+  const gchar *name = dir ? g_dir_read_name(dir) : NULL;
+  if(name) rendered = g_build_filename(tmpdir, name, NULL);
+
+  gchar *data = NULL;
+  gsize size = 0;
+  if(!res && rendered && g_file_get_contents(rendered, &data, &size, NULL))
+  {
+    fprintf(out, "ok %" G_GSIZE_FORMAT " %s\n", size, name);
+    fwrite(data, 1, size, out);
+    fflush(out);
+  }
+  else
+    _serve_error(out, "export failed");
+
+  // leave the directory empty for the next request
+  for(; name; name = g_dir_read_name(dir))
+  {
+    gchar *path = g_build_filename(tmpdir, name, NULL);
+    g_unlink(path);
+    g_free(path);
+  }
+  if(dir) g_dir_close(dir);
+
+  dt_print(DT_DEBUG_PERF, "[darktable-cli] request for %s took %.3f secs\n", input_filename,
+           dt_get_wtime() - start);
+
+  g_free(data);
+  g_free(rendered);
+  g_strfreev(req_argv);
+}
+
+// listen on a unix domain socket and render requests until a client sends "quit". the process stays warm
+// between requests, so only the first one pays for module loading and opencl initialisation. a connection
+// may send any number of requests, they are answered in order.
+static int _serve(const char *socket_path, const char *default_style, const dt_cli_export_t *opts)
+{
+  struct sockaddr_un addr = { 0 };
+  addr.sun_family = AF_UNIX;
+  if(strlen(socket_path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, _("error: socket path %s is too long"), socket_path);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  g_strlcpy(addr.sun_path, socket_path, sizeof(addr.sun_path));
+
+  // remove a stale socket left behind by an earlier instance, but nothing else
+  struct stat st;
+  if(!stat(socket_path, &st) && S_ISSOCK(st.st_mode)) unlink(socket_path);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 16))
+  {
+    fprintf(stderr, _("error: can't listen on %s: %s"), socket_path, g_strerror(errno));
+    fprintf(stderr, "\n");
+    if(fd >= 0) close(fd);
+    return 1;
+  }
+
+  gchar *tmpdir = g_dir_make_tmp("darktable-cli-XXXXXX", NULL);
+  if(!tmpdir)
+  {
+    fprintf(stderr, "%s\n", _("error: can't create a temporary directory"));
+    close(fd);
+    unlink(socket_path);
+    return 1;
+  }
+
+  // a client hanging up mid-reply must not take the server down
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, _("listening on %s"), socket_path);
+  fprintf(stderr, "\n");
+
+  char *line = NULL;
+  size_t len = 0;
+  gboolean quit = FALSE;
+  while(!quit)
+  {
+    const int client = accept(fd, NULL, NULL);
+    if(client < 0)
+    {
+      if(errno == EINTR) continue;
+      fprintf(stderr, "[darktable-cli] accept failed: %s\n", g_strerror(errno));
+      break;
+    }
+
+    FILE *in = fdopen(client, "r");
+    FILE *out = fdopen(dup(client), "w");
+    while(in && out && getline(&line, &len, in) != -1)
+    {
+      g_strstrip(line);
+      if(line[0] == '\0') continue;
+      if(!strcmp(line, "quit"))
+      {
+        quit = TRUE;
+        break;
+      }
+      _serve_request(out, line, tmpdir, default_style, opts);
+      if(ferror(out)) break;
+    }
+    if(in) fclose(in); else close(client);
+    if(out) fclose(out);
+  }
+
+  free(line);
+  close(fd);
+  unlink(socket_path);
+  g_rmdir(tmpdir);
+  g_free(tmpdir);
+  dt_film_remove_empty();
+
+  return 0;
+}
+#endif
+
 int main(int argc, char *arg[])
 {
 #ifdef __APPLE__
@@ -90,10 +711,16 @@ int main(int argc, char *arg[])
   char *xmp_filename = NULL;
   char *output_filename = NULL;
   char *style = NULL;
+  char *manifest = NULL;
+  char *socket_path = NULL;
+  char *format_name = NULL, *icc_filename = NULL, *metadata = NULL;
+  dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
+  dt_iop_color_intent_t icc_intent = DT_INTENT_LAST;
   int file_counter = 0;
   int width = 0, height = 0, bpp = 0;
   gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE,
-           style_overwrite = FALSE, custom_presets = TRUE, export_masks = FALSE;
+           style_overwrite = FALSE, custom_presets = TRUE, export_masks = FALSE, estimate = FALSE,
+           autotune = FALSE;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -202,6 +829,49 @@ int main(int argc, char *arg[])
         g_free(str);
       }
 
+      else if(!strcmp(arg[k], "--format") && argc > k + 1)
+      {
+        k++;
+        format_name = arg[k];
+      }
+      else if(!strcmp(arg[k], "--icc-type") && argc > k + 1)
+      {
+        k++;
+        icc_type = CLAMP(atoi(arg[k]), DT_COLORSPACE_NONE, DT_COLORSPACE_LAST - 1);
+      }
+      else if(!strcmp(arg[k], "--icc-file") && argc > k + 1)
+      {
+        k++;
+        icc_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--icc-intent") && argc > k + 1)
+      {
+        k++;
+        icc_intent = CLAMP(atoi(arg[k]), DT_INTENT_PERCEPTUAL, DT_INTENT_LAST);
+      }
+      else if(!strcmp(arg[k], "--metadata") && argc > k + 1)
+      {
+        k++;
+        metadata = arg[k];
+      }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        manifest = arg[k];
+      }
+      else if(!strcmp(arg[k], "--serve") && argc > k + 1)
+      {
+        k++;
+        socket_path = arg[k];
+      }
+      else if(!strcmp(arg[k], "--estimate"))
+      {
+        estimate = TRUE;
+      }
+      else if(!strcmp(arg[k], "--autotune"))
+      {
+        autotune = TRUE;
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -235,238 +905,152 @@ int main(int argc, char *arg[])
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
-  if(file_counter < 2 || file_counter > 3)
-  {
-    usage(arg[0]);
-    free(m_arg);
-    exit(1);
-  }
-  else if(file_counter == 2)
-  {
-    // no xmp file given
-    output_filename = xmp_filename;
-    xmp_filename = NULL;
-  }
+  const dt_cli_export_t opts = { .width = width,
+                                 .height = height,
+                                 .verbose = verbose,
+                                 .high_quality = high_quality,
+                                 .upscale = upscale,
+                                 .style_overwrite = style_overwrite,
+                                 .export_masks = export_masks,
+                                 .estimate = estimate,
+                                 .format = format_name,
+                                 .icc_type = icc_type,
+                                 .icc_filename = icc_filename,
+                                 .icc_intent = icc_intent,
+                                 .metadata = metadata };
 
-  if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
+  if(autotune)
   {
-    fprintf(stderr, _("error: output file is a directory. please specify file name"));
-    fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
-  }
+    if(file_counter < 1 || file_counter > 2 || socket_path || manifest || estimate)
+    {
+      usage(arg[0]);
+      free(m_arg);
+      exit(1);
+    }
 
-  // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
-  {
-    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
-  }
+    if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
+    {
+      free(m_arg);
+      exit(1);
+    }
 
-  // init dt without gui and without data.db:
-  if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
-  {
+    GList *id_list = _import_input(input_filename, xmp_filename);
+    int res = 1;
+    if(id_list)
+    {
+      printf(DT_CLI_AUTOTUNE_HEADER);
+      res = dt_autotune_run(id_list, stdout, NULL, NULL);
+      if(res) fprintf(stderr, "%s\n", _("error: the input couldn't be processed, nothing was tuned"));
+      g_list_free(id_list);
+    }
+
+    // writes the tuned settings to darktablerc
+    dt_cleanup();
     free(m_arg);
-    exit(1);
+    exit(res);
   }
 
-  GList *id_list = NULL;
-
-  if(g_file_test(input_filename, G_FILE_TEST_IS_DIR))
+  if(socket_path)
   {
-    const int filmid = dt_film_import(input_filename);
-    if(!filmid)
+#ifdef _WIN32
+    fprintf(stderr, "%s\n", _("error: --serve is not supported on this platform"));
+    free(m_arg);
+    exit(1);
+#else
+    if(file_counter != 0 || manifest || estimate)
     {
-      fprintf(stderr, _("error: can't open folder %s"), input_filename);
-      fprintf(stderr, "\n");
+      usage(arg[0]);
       free(m_arg);
       exit(1);
     }
-    id_list = dt_film_get_image_ids(filmid);
-  }
-  else
-  {
-    dt_film_t film;
-    int id = 0;
-    int filmid = 0;
 
-    gchar *directory = g_path_get_dirname(input_filename);
-    filmid = dt_film_new(&film, directory);
-    id = dt_image_import(filmid, input_filename, TRUE);
-    if(!id)
+    // init dt once without gui and without data.db and keep it around for all requests
+    if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
     {
-      fprintf(stderr, _("error: can't open file %s"), input_filename);
-      fprintf(stderr, "\n");
       free(m_arg);
       exit(1);
     }
-    g_free(directory);
-
-    id_list = g_list_append(id_list, GINT_TO_POINTER(id));
-  }
 
-  const int total = g_list_length(id_list);
+    const int res = _serve(socket_path, style, &opts);
 
-  if(total == 0)
-  {
-    fprintf(stderr, _("no images to export, aborting\n"));
+    dt_cleanup();
     free(m_arg);
-    exit(1);
+    exit(res);
+#endif
   }
 
-  // attach xmp, if requested:
-  if(xmp_filename)
+  if(manifest)
   {
-    for(GList *iter = id_list; iter; iter = g_list_next(iter))
+    if(file_counter != 0)
     {
-      int id = GPOINTER_TO_INT(iter->data);
-      dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
-      if(dt_exif_xmp_read(image, xmp_filename, 1) != 0)
-      {
-        fprintf(stderr, _("error: can't open xmp file %s"), xmp_filename);
-        fprintf(stderr, "\n");
-        free(m_arg);
-        exit(1);
-      }
-      // don't write new xmp:
-      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+      usage(arg[0]);
+      free(m_arg);
+      exit(1);
     }
-  }
-
-  // print the history stack. only look at the first image and assume all got the same processing applied
-  if(verbose)
-  {
-    int id = GPOINTER_TO_INT(id_list->data);
-    gchar *history = dt_history_get_items_as_string(id);
-    if(history)
-      printf("%s\n", history);
-    else
-      printf("[%s]\n", _("empty history stack"));
-  }
 
-  // try to find out the export format from the output_filename
-  char *ext = output_filename + strlen(output_filename);
-  while(ext > output_filename && *ext != '.') ext--;
-  *ext = '\0';
-  ext++;
-
-  if(!strcmp(ext, "jpg")) ext = "jpeg";
-
-  if(!strcmp(ext, "tif")) ext = "tiff";
+    // init dt once without gui and without data.db and keep it around for the whole manifest
+    if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
+    {
+      free(m_arg);
+      exit(1);
+    }
 
-  // init the export data structures
-  dt_imageio_module_format_t *format;
-  dt_imageio_module_storage_t *storage;
-  dt_imageio_module_data_t *sdata, *fdata;
+    if(estimate) printf(DT_CLI_ESTIMATE_HEADER);
+    const int failed = _process_batch(manifest, style, &opts);
 
-  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
-  if(storage == NULL)
-  {
-    fprintf(
-        stderr, "%s\n",
-        _("cannot find disk storage module. please check your installation, something seems to be broken."));
+    dt_cleanup();
     free(m_arg);
-    exit(1);
+    exit(failed ? 1 : 0);
   }
 
-  sdata = storage->get_params(storage);
-  if(sdata == NULL)
+  if(file_counter < 2 || file_counter > 3)
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+    usage(arg[0]);
     free(m_arg);
     exit(1);
   }
-
-  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night
-  // any longer ...
-  g_strlcpy((char *)sdata, output_filename, DT_MAX_PATH_FOR_PARAMS);
-  // all is good now, the last line didn't happen.
-
-  format = dt_imageio_get_format_by_name(ext);
-  if(format == NULL)
+  else if(file_counter == 2)
   {
-    fprintf(stderr, _("unknown extension '.%s'"), ext);
-    fprintf(stderr, "\n");
-    free(m_arg);
-    exit(1);
+    // no xmp file given
+    output_filename = xmp_filename;
+    xmp_filename = NULL;
   }
 
-  fdata = format->get_params(format);
-  if(fdata == NULL)
+  if(g_file_test(output_filename, G_FILE_TEST_IS_DIR))
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    fprintf(stderr, _("error: output file is a directory. please specify file name"));
+    fprintf(stderr, "\n");
     free(m_arg);
     exit(1);
   }
 
-  uint32_t w, h, fw, fh, sw, sh;
-  fw = fh = sw = sh = 0;
-  storage->dimension(storage, sdata, &sw, &sh);
-  format->dimension(format, fdata, &fw, &fh);
-
-  if(sw == 0 || fw == 0)
-    w = sw > fw ? sw : fw;
-  else
-    w = sw < fw ? sw : fw;
-
-  if(sh == 0 || fh == 0)
-    h = sh > fh ? sh : fh;
-  else
-    h = sh < fh ? sh : fh;
-
-  fdata->max_width = width;
-  fdata->max_height = height;
-  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
-  fdata->style[0] = '\0';
-  fdata->style_append = 1; // make append the default and override with --style-overwrite
-
-  if(style)
+  // the output file already exists, so there will be a sequence number added
+  if(!estimate && g_file_test(output_filename, G_FILE_TEST_EXISTS))
   {
-    g_strlcpy((char *)fdata->style, style, DT_MAX_STYLE_NAME_LENGTH);
-    fdata->style[127] = '\0';
-    if(style_overwrite)
-      fdata->style_append = 0;
+    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
   }
 
-  if(storage->initialize_store)
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
   {
-    storage->initialize_store(storage, sdata, &format, &fdata, &id_list, high_quality, upscale);
-
-    format->set_params(format, fdata, format->params_size(format));
-    storage->set_params(storage, sdata, storage->params_size(storage));
+    free(m_arg);
+    exit(1);
   }
 
-  // TODO: do we want to use the settings from conf?
-  // TODO: expose these via command line arguments
-  dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
-  const gchar *icc_filename = NULL;
-  dt_iop_color_intent_t icc_intent = DT_INTENT_LAST;
-
-  // TODO: add a callback to set the bpp without going through the config
-
-  int num = 1;
-  for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
+  GList *id_list = _import_input(input_filename, xmp_filename);
+  if(id_list == NULL)
   {
-    const int id = GPOINTER_TO_INT(iter->data);
-    // TODO: have a parameter in command line to get the export presets
-    dt_export_metadata_t metadata;
-    metadata.flags = dt_lib_export_metadata_default_flags();
-    metadata.list = NULL;
-    storage->store(storage, sdata, id, format, fdata, num, total, high_quality, upscale, export_masks,
-                   icc_type, icc_filename, icc_intent, &metadata);
+    free(m_arg);
+    exit(1);
   }
 
-  // cleanup time
-  if(storage->finalize_store) storage->finalize_store(storage, sdata);
-  storage->free_params(storage, sdata);
-  format->free_params(format, fdata);
+  if(estimate) printf(DT_CLI_ESTIMATE_HEADER);
+  const int res = _export_images(id_list, output_filename, style, &opts, 0, 0);
   g_list_free(id_list);
 
   dt_cleanup();
 
   free(m_arg);
+  return res;
 }
 
-// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
-// vim: shiftwidth=2 expandtab tabstop=2 cindent
-// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
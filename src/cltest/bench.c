@@ -0,0 +1,292 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bench.h"
+#include "common/colorspaces.h"
+#include "common/darktable.h"
+#include "common/iop_profile.h"
+#include "common/opencl.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// seconds to wait for a device to finish building its programs in the background
+#define BENCH_BUILD_TIMEOUT 300.0
+
+typedef enum bench_input_t
+{
+  BENCH_INPUT_RANDOM = 0,
+  BENCH_INPUT_REFERENCE = 1
+} bench_input_t;
+
+static const char *_input_name[] = { "random", "reference" };
+
+// a fixed seed keeps runs comparable between machines and driver versions
+static inline uint32_t _xorshift(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// random pixels or smooth ramps, in the value range of the colorspace the module expects
+static void _fill_input(float *const buf, const int width, const int height, const int cst,
+                        const bench_input_t input)
+{
+  uint32_t state = 0x2545f491u;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *const px = buf + 4 * ((size_t)j * width + i);
+      float v[3];
+      if(input == BENCH_INPUT_RANDOM)
+      {
+        for(int c = 0; c < 3; c++) v[c] = _xorshift(&state) / (float)UINT32_MAX;
+      }
+      else
+      {
+        v[0] = (float)i / (width - 1);
+        v[1] = (float)j / (height - 1);
+        v[2] = 0.5f * (v[0] + v[1]);
+      }
+
+      if(cst == iop_cs_Lab)
+      {
+        px[0] = 100.0f * v[0];
+        px[1] = 128.0f * (2.0f * v[1] - 1.0f);
+        px[2] = 128.0f * (2.0f * v[2] - 1.0f);
+      }
+      else
+        for(int c = 0; c < 3; c++) px[c] = v[c];
+      px[3] = 1.0f;
+    }
+}
+
+// differences of the colour channels, Lab is scaled so that the error is comparable to rgb
+static void _compare(const float *const a, const float *const b, const size_t npixels, const int cst,
+                     double *max_error, double *mean_error)
+{
+  const float scale = (cst == iop_cs_Lab) ? 0.01f : 1.0f;
+  double max = 0.0, sum = 0.0;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = a[4 * k + c], y = b[4 * k + c];
+      // both paths agreeing on a NaN is not a divergence
+      if(isnan(x) && isnan(y)) continue;
+      const double d = (isfinite(x) && isfinite(y)) ? fabsf(x - y) * scale : INFINITY;
+      max = fmax(max, d);
+      sum += d;
+    }
+  *max_error = max;
+  *mean_error = sum / (3.0 * npixels);
+}
+
+static gboolean _wait_for_device(const int devid)
+{
+  const double start = dt_get_wtime();
+  while(!g_atomic_int_get(&darktable.opencl->dev[devid].programs_ready))
+  {
+    if(dt_get_wtime() - start > BENCH_BUILD_TIMEOUT) return FALSE;
+    dt_iop_nap(10000);
+  }
+  return TRUE;
+}
+
+static gboolean _wanted(const dt_cltest_bench_params_t *params, const dt_iop_module_so_t *so)
+{
+  if(!so->process_cl) return FALSE;
+  if(!params->modules) return TRUE;
+  for(gchar **m = params->modules; *m; m++)
+    if(!strcmp(*m, so->op)) return TRUE;
+  return FALSE;
+}
+
+// runs both paths of one module on one device and input, prints the result line. returns 1 on failure.
+static int _bench_module(const dt_cltest_bench_params_t *params, dt_dev_pixelpipe_t *pipe,
+                         dt_iop_module_t *module, const int devid, const bench_input_t input)
+{
+  const int width = params->width, height = params->height;
+  const size_t npixels = (size_t)width * height;
+  const size_t bpp = 4 * sizeof(float);
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+
+  pipe->devid = devid;
+
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)calloc(1, sizeof(dt_dev_pixelpipe_iop_t));
+  piece->enabled = TRUE;
+  piece->colors = 4;
+  piece->iscale = pipe->iscale;
+  piece->iwidth = pipe->iwidth;
+  piece->iheight = pipe->iheight;
+  piece->module = module;
+  piece->pipe = pipe;
+  piece->buf_in = piece->buf_out = roi;
+  piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
+  dt_iop_init_pipe(module, pipe, piece);
+
+  const int cst = module->input_colorspace(module, pipe, piece);
+
+  float *in = dt_alloc_align(64, npixels * bpp);
+  float *out_cpu = dt_alloc_align(64, npixels * bpp);
+  float *out_cl = dt_alloc_align(64, npixels * bpp);
+  cl_mem dev_in = NULL, dev_out = NULL;
+  const char *result = "ok";
+  double max_error = 0.0, mean_error = 0.0, cpu_time = INFINITY, cl_time = INFINITY;
+  int failed = 0;
+
+  if(!in || !out_cpu || !out_cl)
+  {
+    result = "failed";
+    goto end;
+  }
+  if(!piece->process_cl_ready)
+  {
+    result = "cpu-only";
+    goto end;
+  }
+
+  _fill_input(in, width, height, cst, input);
+
+  for(int r = 0; r < params->runs; r++)
+  {
+    const double start = dt_get_wtime();
+    module->process(module, piece, in, out_cpu, &roi, &roi);
+    cpu_time = fmin(cpu_time, dt_get_wtime() - start);
+  }
+
+  dev_in = dt_opencl_copy_host_to_device(devid, in, width, height, bpp);
+  dev_out = dt_opencl_alloc_device(devid, width, height, bpp);
+  if(!dev_in || !dev_out)
+  {
+    result = "failed";
+    goto end;
+  }
+
+  for(int r = 0; r < params->runs; r++)
+  {
+    const double start = dt_get_wtime();
+    const int ok = module->process_cl(module, piece, dev_in, dev_out, &roi, &roi);
+    if(!ok || !dt_opencl_finish(devid))
+    {
+      result = "failed";
+      goto end;
+    }
+    cl_time = fmin(cl_time, dt_get_wtime() - start);
+  }
+
+  if(dt_opencl_copy_device_to_host(devid, out_cl, dev_out, width, height, bpp) != CL_SUCCESS
+     || !dt_opencl_finish(devid))
+  {
+    result = "failed";
+    goto end;
+  }
+
+  _compare(out_cpu, out_cl, npixels, cst, &max_error, &mean_error);
+  if(!(max_error <= params->tolerance)) result = "diverged";
+
+end:
+  failed = strcmp(result, "ok") && strcmp(result, "cpu-only");
+  printf("%s\t%d\t%s\t%s\t%.6g\t%.6g\t%.3f\t%.3f\t%.2f\t%s\n", module->op, devid,
+         darktable.opencl->dev[devid].name, _input_name[input], max_error, mean_error, cpu_time * 1e3,
+         cl_time * 1e3, isfinite(cl_time) && cl_time > 0.0 ? cpu_time / cl_time : 0.0, result);
+  fflush(stdout);
+
+  if(dev_in) dt_opencl_release_mem_object(dev_in);
+  if(dev_out) dt_opencl_release_mem_object(dev_out);
+  dt_free_align(in);
+  dt_free_align(out_cpu);
+  dt_free_align(out_cl);
+
+  module->cleanup_pipe(module, pipe, piece);
+  free(piece->blendop_data);
+  g_hash_table_destroy(piece->raster_masks);
+  free(piece);
+
+  return failed;
+}
+
+int dt_cltest_bench(const dt_cltest_bench_params_t *params)
+{
+  if(!dt_opencl_is_inited())
+  {
+    fprintf(stderr, "[cltest] opencl is not available\n");
+    return 1;
+  }
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, FALSE);
+
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_init_dummy(&pipe, params->width, params->height);
+  pipe.type = DT_DEV_PIXELPIPE_EXPORT;
+  dt_dev_pixelpipe_set_input(&pipe, &dev, NULL, params->width, params->height, 1.0f);
+  dt_ioppr_set_pipe_work_profile_info(&dev, &pipe, DT_COLORSPACE_LIN_REC2020, "", DT_INTENT_PERCEPTUAL);
+
+  printf("module\tdevid\tdevice\tinput\tmax_error\tmean_error\tcpu_ms\tgpu_ms\tspeedup\tresult\n");
+
+  int failures = 0;
+  for(int devid = 0; devid < darktable.opencl->num_devs; devid++)
+  {
+    // slots run on the same hardware as their device
+    if(darktable.opencl->dev[devid].parent != devid) continue;
+    if(!_wait_for_device(devid))
+    {
+      fprintf(stderr, "[cltest] device %d (%s) could not build its programs\n", devid,
+              darktable.opencl->dev[devid].name);
+      failures++;
+      continue;
+    }
+
+    for(GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+    {
+      dt_iop_module_so_t *so = (dt_iop_module_so_t *)iop->data;
+      if(!_wanted(params, so)) continue;
+
+      dt_iop_module_t *module = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
+      // dt_iop_load_module() frees the module on failure
+      if(dt_iop_load_module(module, so, &dev)) continue;
+
+      // modules changing the roi or reading raw data need a real image, they are left to the pipe
+      if(!(module->operation_tags() & IOP_TAG_DISTORT)
+         && module->default_colorspace(module, &pipe, NULL) != iop_cs_RAW)
+      {
+        for(int input = BENCH_INPUT_RANDOM; input <= BENCH_INPUT_REFERENCE; input++)
+          failures += _bench_module(params, &pipe, module, devid, input);
+      }
+
+      dt_iop_cleanup_module(module);
+      free(module);
+    }
+  }
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+
+  return failures;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
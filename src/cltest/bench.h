@@ -0,0 +1,38 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct dt_cltest_bench_params_t
+{
+  int width, height;  // size of the test images
+  int runs;           // timed runs per path, the fastest one is reported
+  float tolerance;    // largest acceptable difference between the paths
+  gchar **modules;    // ops to test, NULL for all modules with process_cl()
+} dt_cltest_bench_params_t;
+
+/** runs the cpu and opencl paths of the modules on a random and a reference image on every device
+    and prints error and speedup as tab separated lines to stdout. returns the number of runs which
+    failed or diverged beyond the tolerance. dt_init() has to be done. */
+int dt_cltest_bench(const dt_cltest_bench_params_t *params);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
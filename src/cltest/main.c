@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "bench.h"
 #include "common/darktable.h"
 #include "common/opencl.h"
 
@@ -34,22 +35,54 @@ int main(int argc, char *arg[])
   dt_osx_prepare_environment();
 #endif
   int result = 1;
-  // only used to force-init opencl, so we want these options:
+  // --bench [--bench-modules op,op] [--bench-size WxH] [--bench-runs n] [--bench-tolerance t] compares the
+  // cpu and opencl paths of the modules, the other arguments go to dt_init()
+  gboolean bench = FALSE;
+  dt_cltest_bench_params_t params = { 1024, 768, 3, 1e-3f, NULL };
+  // only used to force-init opencl, so we want these options. in bench mode the debug output would
+  // clutter the results on stdout:
   char *m_arg[] = { "-d", "opencl", "--library", ":memory:"};
+  char *m_bench_arg[] = { "--conf", "opencl=TRUE", "--library", ":memory:"};
   const int m_argc = sizeof(m_arg) / sizeof(m_arg[0]);
   char **argv = malloc(argc * sizeof(arg[0]) + sizeof(m_arg));
   if(!argv) goto end;
+  int k = 0;
   for(int i = 0; i < argc; i++)
-    argv[i] = arg[i];
+  {
+    if(!strcmp(arg[i], "--bench"))
+      bench = TRUE;
+    else if(!strcmp(arg[i], "--bench-modules") && i + 1 < argc)
+    {
+      g_strfreev(params.modules);
+      params.modules = g_strsplit(arg[++i], ",", -1);
+    }
+    else if(!strcmp(arg[i], "--bench-size") && i + 1 < argc)
+    {
+      if(sscanf(arg[++i], "%dx%d", &params.width, &params.height) != 2 || params.width < 2 || params.height < 2)
+      {
+        fprintf(stderr, "[cltest] invalid size `%s'\n", arg[i]);
+        goto end;
+      }
+    }
+    else if(!strcmp(arg[i], "--bench-runs") && i + 1 < argc)
+      params.runs = MAX(1, atoi(arg[++i]));
+    else if(!strcmp(arg[i], "--bench-tolerance") && i + 1 < argc)
+      params.tolerance = g_ascii_strtod(arg[++i], NULL);
+    else
+      argv[k++] = arg[i];
+  }
   for(int i = 0; i < m_argc; i++)
-    argv[argc + i] = m_arg[i];
-  argc += m_argc;
+    argv[k + i] = bench ? m_bench_arg[i] : m_arg[i];
+  argc = k + m_argc;
   if(dt_init(argc, argv, FALSE, FALSE, NULL)) goto end;
+  // the number of failed or diverged runs, capped to stay a valid exit status
+  const int failures = bench ? dt_cltest_bench(&params) : 0;
   dt_cleanup();
-  free(argv);
 
-  result = 0;
+  result = MIN(failures, 100);
 end:
+  free(argv);
+  g_strfreev(params.modules);
 
 #ifdef _WIN32
   printf("\npress any key to exit\n");
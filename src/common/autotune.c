@@ -0,0 +1,317 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/autotune.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "common/imageio.h"
+#include "common/iop_order.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/pixelpipe.h"
+#include "develop/tiling.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define AUTOTUNE_FILE "autotune.txt"
+// runs of the pipe per image and candidate, the fastest one counts
+#define AUTOTUNE_ITERATIONS 2
+// a candidate has to be this much faster than the best so far to replace it, anything less is noise
+#define AUTOTUNE_MARGIN 0.03
+#define AUTOTUNE_MAX_CANDIDATES 4
+
+typedef struct _autotune_setting_t
+{
+  const char *name;
+  int candidates[AUTOTUNE_MAX_CANDIDATES];
+  int count;
+  int current;
+  void (*apply)(const int value);
+  void (*print)(char *label, const size_t len, const int value);
+} _autotune_setting_t;
+
+static void _print_int(char *label, const size_t len, const int value)
+{
+  snprintf(label, len, "%d", value);
+}
+
+static void _apply_threads(const int value)
+{
+  darktable.num_openmp_threads = value;
+#ifdef _OPENMP
+  omp_set_num_threads(value);
+  // all cores is stored as such, it carries over to other machines sharing the config
+  dt_conf_set_int("openmp_threads", value == omp_get_num_procs() ? 0 : value);
+#endif
+}
+
+// the opencl candidates
+enum
+{
+  AUTOTUNE_OPENCL_OFF = 0,
+  AUTOTUNE_OPENCL_DEFAULT = 1,
+  AUTOTUNE_OPENCL_ADAPTIVE = 2,
+  AUTOTUNE_OPENCL_ON = 3 // with a profile for the gui's two pipes, which an export can't compare
+};
+
+static void _apply_opencl(const int value)
+{
+  dt_conf_set_bool("opencl", value != AUTOTUNE_OPENCL_OFF);
+  if(value == AUTOTUNE_OPENCL_DEFAULT) dt_conf_set_string("opencl_scheduling_profile", "default");
+  if(value == AUTOTUNE_OPENCL_ADAPTIVE) dt_conf_set_string("opencl_scheduling_profile", "adaptive");
+  dt_opencl_update_settings();
+}
+
+static void _print_opencl(char *label, const size_t len, const int value)
+{
+  const char *names[] = { "off", "default", "adaptive", "on" };
+  g_strlcpy(label, names[value], len);
+}
+
+static void _apply_host_memory_limit(const int value)
+{
+  dt_conf_set_int("host_memory_limit", value);
+  dt_tiling_update_settings();
+}
+
+static void _apply_singlebuffer_limit(const int value)
+{
+  dt_conf_set_int("singlebuffer_limit", value);
+}
+
+static void _add_candidate(_autotune_setting_t *s, const int value)
+{
+  for(int k = 0; k < s->count; k++)
+    if(s->candidates[k] == value) return;
+  if(s->count < AUTOTUNE_MAX_CANDIDATES) s->candidates[s->count++] = value;
+}
+
+// the settings and their candidates, the current value always is one of them. returns their number.
+static int _autotune_settings(_autotune_setting_t *settings)
+{
+  int n = 0;
+#ifdef _OPENMP
+  const int procs = omp_get_num_procs();
+  if(procs > 1)
+  {
+    _autotune_setting_t *s = &settings[n++];
+    *s = (_autotune_setting_t){ "openmp_threads", { 0 }, 0, darktable.num_openmp_threads, _apply_threads, _print_int };
+    _add_candidate(s, s->current);
+    _add_candidate(s, procs);
+    _add_candidate(s, MAX(1, procs * 3 / 4));
+    _add_candidate(s, MAX(1, procs / 2));
+  }
+#endif
+
+  if(dt_opencl_is_inited())
+  {
+    _autotune_setting_t *s = &settings[n++];
+    int current = AUTOTUNE_OPENCL_OFF;
+    if(dt_conf_get_bool("opencl"))
+    {
+      gchar *profile = dt_conf_get_string("opencl_scheduling_profile");
+      current = !strcmp(profile, "default") ? AUTOTUNE_OPENCL_DEFAULT
+              : !strcmp(profile, "adaptive") ? AUTOTUNE_OPENCL_ADAPTIVE : AUTOTUNE_OPENCL_ON;
+      g_free(profile);
+    }
+    *s = (_autotune_setting_t){ "opencl", { 0 }, 0, current, _apply_opencl, _print_opencl };
+    _add_candidate(s, current);
+    _add_candidate(s, AUTOTUNE_OPENCL_OFF);
+    if(current != AUTOTUNE_OPENCL_ON)
+    {
+      _add_candidate(s, AUTOTUNE_OPENCL_DEFAULT);
+      _add_candidate(s, AUTOTUNE_OPENCL_ADAPTIVE);
+    }
+  }
+
+  // limits below what tiling.c clamps to, and without a limit at all, aren't worth trying
+  const int physical = dt_get_total_memory() / 1024;
+  const int host_memory_limit = dt_conf_get_int("host_memory_limit");
+  if(physical > 0 && host_memory_limit > 0)
+  {
+    _autotune_setting_t *s = &settings[n++];
+    *s = (_autotune_setting_t){ "host_memory_limit", { 0 }, 0, host_memory_limit, _apply_host_memory_limit,
+                                _print_int };
+    _add_candidate(s, host_memory_limit);
+    _add_candidate(s, CLAMP(physical / 4, 500, 50000));
+    _add_candidate(s, CLAMP(physical / 2, 500, 50000));
+  }
+
+  {
+    _autotune_setting_t *s = &settings[n++];
+    *s = (_autotune_setting_t){ "singlebuffer_limit", { 0 }, 0, dt_conf_get_int("singlebuffer_limit"),
+                                _apply_singlebuffer_limit, _print_int };
+    _add_candidate(s, s->current);
+    _add_candidate(s, 16);
+    _add_candidate(s, 32);
+    _add_candidate(s, 64);
+  }
+  return n;
+}
+
+// the fastest of iterations runs of the full pipe of the image, as darktable-bench times it. negative if the
+// image can't be processed.
+static double _autotune_image(const int32_t imgid, const int iterations)
+{
+  double best = -1.0;
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf || !buf.width || !buf.height) goto error_early;
+
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_export(&pipe, dev.image_storage.width, dev.image_storage.height,
+                                   IMAGEIO_RGB | IMAGEIO_FLOAT, FALSE))
+    goto error_early;
+  dt_ioppr_resync_modules_order(&dev);
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  for(int it = 0; it < iterations; it++)
+  {
+    dt_dev_pixelpipe_cache_flush(&pipe.cache);
+    const double start = dt_get_wtime();
+    if(dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, pipe.processed_width, pipe.processed_height, 1.0f))
+    {
+      best = -1.0;
+      break;
+    }
+    const double t = dt_get_wtime() - start;
+    if(best < 0.0 || t < best) best = t;
+  }
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+error_early:
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  dt_dev_cleanup(&dev);
+  return best;
+}
+
+static double _autotune_measure(GList *imgs, const int iterations)
+{
+  double seconds = 0.0;
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const double t = _autotune_image(GPOINTER_TO_INT(l->data), iterations);
+    if(t < 0.0)
+    {
+      fprintf(stderr, "[autotune] can't process image %d\n", GPOINTER_TO_INT(l->data));
+      return -1.0;
+    }
+    seconds += t;
+  }
+  return seconds;
+}
+
+// one line per measurement: date, version, all settings and the summed run time of the images
+static void _autotune_record(FILE *report, FILE *results, const _autotune_setting_t *settings, const int n,
+                             const char *stamp, const char *what, const double seconds)
+{
+  GString *line = g_string_new(NULL);
+  g_string_append_printf(line, "%s\t%s\t%s\t", stamp, darktable_package_version, what);
+  for(int k = 0; k < n; k++)
+  {
+    char value[64] = { 0 };
+    settings[k].print(value, sizeof(value), settings[k].current);
+    g_string_append_printf(line, "%s%s=%s", k ? " " : "", settings[k].name, value);
+  }
+  g_string_append_printf(line, "\t%.3f\n", seconds);
+  if(report) fputs(line->str, report);
+  if(results) fputs(line->str, results);
+  g_string_free(line, TRUE);
+}
+
+int dt_autotune_run(GList *imgs, FILE *report, dt_autotune_progress_t progress, void *data)
+{
+  if(!imgs) return 1;
+
+  _autotune_setting_t settings[4];
+  const int n = _autotune_settings(settings);
+  int steps = 1, step = 0;
+  for(int k = 0; k < n; k++) steps += settings[k].count - 1;
+
+  char path[PATH_MAX] = { 0 };
+  char configdir[PATH_MAX] = { 0 };
+  dt_loc_get_user_config_dir(configdir, sizeof(configdir));
+  snprintf(path, sizeof(path), "%s/" AUTOTUNE_FILE, configdir);
+  FILE *results = g_fopen(path, "ab");
+  if(!results) fprintf(stderr, "[autotune] can't write `%s'\n", path);
+
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(now, "%F %T");
+  g_date_time_unref(now);
+
+  // the first run loads the images and builds the opencl kernels, none of which should count
+  double best = _autotune_measure(imgs, 1);
+  if(best >= 0.0) best = _autotune_measure(imgs, AUTOTUNE_ITERATIONS);
+  if(best < 0.0)
+  {
+    g_free(stamp);
+    if(results) fclose(results);
+    return 1;
+  }
+  _autotune_record(report, results, settings, n, stamp, "current", best);
+  gboolean go_on = !progress || progress(data, (double)++step / steps);
+
+  for(int k = 0; k < n && go_on; k++)
+  {
+    _autotune_setting_t *s = &settings[k];
+    const int winner = s->current;
+    int best_value = winner;
+    for(int c = 0; c < s->count && go_on; c++)
+    {
+      if(s->candidates[c] == winner) continue;
+      s->current = s->candidates[c];
+      s->apply(s->current);
+      const double t = _autotune_measure(imgs, AUTOTUNE_ITERATIONS);
+      if(t >= 0.0)
+      {
+        _autotune_record(report, results, settings, n, stamp, "candidate", t);
+        if(t < best * (1.0 - AUTOTUNE_MARGIN))
+        {
+          best = t;
+          best_value = s->current;
+        }
+      }
+      go_on = !progress || progress(data, (double)++step / steps);
+    }
+    s->current = best_value;
+    s->apply(best_value);
+  }
+
+  _autotune_record(report, results, settings, n, stamp, "best", best);
+  g_free(stamp);
+  if(results) fclose(results);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
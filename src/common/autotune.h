@@ -0,0 +1,49 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stdio.h>
+
+/**
+ * tuning of the processing settings for this machine. the full pipe of the given images is timed as
+ * darktable-bench does it, with one setting after the other walked through its candidates while the others
+ * keep their best value so far:
+ *
+ * - openmp_threads: all cores, three quarters and half of them
+ * - opencl: off, on with the default and with the adaptive scheduling profile
+ * - host_memory_limit: the current limit, a quarter and half of the physical memory
+ * - singlebuffer_limit: 16, 32 and 64 MB
+ *
+ * a candidate only wins if it is clearly faster. the winners stay set in the configuration, so they are
+ * written to darktablerc on shutdown, and every measurement is appended to autotune.txt in the config
+ * directory.
+ */
+
+/** called after each measurement with the fraction done. returning FALSE stops the tuning, the best
+    settings found so far are kept. */
+typedef gboolean (*dt_autotune_progress_t)(void *data, const double fraction);
+
+/** tunes with imgs (a list of image ids), writes the measurements to report if not NULL. returns 0 on
+    success, non-zero if the images couldn't be processed. */
+int dt_autotune_run(GList *imgs, FILE *report, dt_autotune_progress_t progress, void *data);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -21,7 +21,7 @@
 #include <glib.h>             // for MIN, MAX
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
-#include <string.h>           // for memset
+#include <string.h>           // for memset, memmove
 
 // these clamp away insane memory requirements.
 // they should reasonably faithfully represent the
@@ -130,46 +130,69 @@ void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
   const int oz = b->size_y * b->size_x;
   const float sigma_s = b->sigma_s * b->sigma_s;
   float *const buf = b->buf;
+  const int size_y = b->size_y;
+  const int width = b->width;
+  const int height = b->height;
+
+  // the pixels of an image row splat into the grid rows yi and yi+1 of the cell the row falls into.
+  // so all cells with even yi can be splatted at the same time without two threads ever writing to
+  // the same grid row, and then all odd ones. find the first image row of every cell for that:
+  int *const first_row = malloc(sizeof(int) * size_y);
+  if(!first_row) return;
+  int cell = 0;
+  for(int j = 0; j < height; j++)
+  {
+    const int yi = MIN((int)CLAMPS(j / b->sigma_s, 0, size_y - 1), size_y - 2);
+    while(cell <= yi) first_row[cell++] = j;
+  }
+  while(cell < size_y) first_row[cell++] = height;
 
 // splat into downsampled grid
+  for(int parity = 0; parity < 2; parity++)
+  {
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, oy, oz, ox, sigma_s, buf) \
+  dt_omp_firstprivate(in, oy, oz, ox, sigma_s, buf, first_row, parity, size_y, width) \
   shared(b) \
-  collapse(2)
+  schedule(dynamic)
 #endif
-  for(int j = 0; j < b->height; j++)
-  {
-    for(int i = 0; i < b->width; i++)
+    for(int yc = parity; yc < size_y - 1; yc += 2)
     {
-      size_t index = 4 * (j * b->width + i);
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
-      // sum up payload here, doesn't have to be same as edge stopping data
-      // for cross bilateral applications.
-      // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
-      // should not cause clipping here.
+      for(int j = first_row[yc]; j < first_row[yc + 1]; j++)
+      {
+        for(int i = 0; i < width; i++)
+        {
+          size_t index = 4 * ((size_t)j * width + i);
+          float x, y, z;
+          const float L = in[index];
+          image_to_grid(b, i, j, L, &x, &y, &z);
+          const int xi = MIN((int)x, b->size_x - 2);
+          const int yi = MIN((int)y, b->size_y - 2);
+          const int zi = MIN((int)z, b->size_z - 2);
+          const float xf = x - xi;
+          const float yf = y - yi;
+          const float zf = z - zi;
+          // nearest neighbour splatting:
+          const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+          // sum up payload here, doesn't have to be same as edge stopping data
+          // for cross bilateral applications.
+          // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
+          // should not cause clipping here.
 #ifdef _OPENMP
 #pragma omp simd aligned(buf:64)
 #endif
-      for(int k = 0; k < 8; k++)
-      {
-        const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
-        const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / sigma_s;
-        buf[ii] += contrib;
+          for(int k = 0; k < 8; k++)
+          {
+            const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
+            const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
+                                  * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / sigma_s;
+            buf[ii] += contrib;
+          }
+        }
       }
     }
   }
+  free(first_row);
 }
 
 #ifdef _OPENMP
@@ -270,53 +293,64 @@ void dt_bilateral_blur(dt_bilateral_t *b)
 }
 
 
+// trilinear interpolation in the grid cell starting at g, written as nested lerps so the compiler
+// can vectorise the lookups of a whole row of pixels
 #ifdef _OPENMP
-#pragma omp declare simd aligned(out, in :64)
+#pragma omp declare simd uniform(oy, oz)
 #endif
+static inline float trilinear(const float *const g, const int oy, const int oz, const float xf, const float yf,
+                              const float zf)
+{
+  const float c00 = g[0] + xf * (g[1] - g[0]);
+  const float c10 = g[oy] + xf * (g[oy + 1] - g[oy]);
+  const float c01 = g[oz] + xf * (g[oz + 1] - g[oz]);
+  const float c11 = g[oy + oz] + xf * (g[oy + oz + 1] - g[oy + oz]);
+  const float c0 = c00 + yf * (c10 - c00);
+  const float c1 = c01 + yf * (c11 - c01);
+  return c0 + zf * (c1 - c0);
+}
+
+__DT_CLONE_TARGETS__
 void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
-  float *const buf = b->buf;
+  const float *const buf = b->buf;
   const int size_x = b->size_x;
   const int size_y = b->size_y;
   const int size_z = b->size_z;
   const int width = b->width;
   const int height = b->height;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(b, in, norm, ox, oy, oz, size_x, size_y, size_z, height, width, buf) \
-    shared(out) collapse(2)
+  dt_omp_firstprivate(in, norm, oy, oz, size_x, size_y, size_z, height, width, buf, sigma_s, sigma_r) \
+    shared(out) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
+    // the row of grid cells is the same for the whole image row
+    const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+    const int yi = MIN((int)y, size_y - 2);
+    const float yf = y - yi;
+    const float *const row = buf + (size_t)yi * oy;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < width; i++)
     {
-      size_t index = 4 * (j * width + i);
-      float x, y, z;
+      const size_t index = 4 * ((size_t)j * width + i);
       const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
+      const float x = CLAMPS(i / sigma_s, 0, size_x - 1);
+      const float z = CLAMPS(L / sigma_r, 0, size_z - 1);
       // trilinear lookup:
       const int xi = MIN((int)x, size_x - 2);
-      const int yi = MIN((int)y, size_y - 2);
       const int zi = MIN((int)z, size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + size_x * (yi + size_y * zi);
-      const float Lout = L
-                         + norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                   + buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                   + buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                   + buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+      const float Lout = L + norm * trilinear(row + xi + (size_t)oz * zi, oy, oz, x - xi, yf, z - zi);
       out[index] = Lout;
       // and copy color and mask
       out[index + 1] = in[index + 1];
@@ -326,53 +360,48 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(out, in :64)
-#endif
+__DT_CLONE_TARGETS__
 void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
                                   const float detail)
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
   const int oy = b->size_x;
   const int oz = b->size_y * b->size_x;
-  float *const buf = b->buf;
+  const float *const buf = b->buf;
   const int size_x = b->size_x;
   const int size_y = b->size_y;
   const int size_z = b->size_z;
   const int width = b->width;
   const int height = b->height;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(b, in, norm, oy, oz, ox, buf, size_x, size_y, size_z, width, height) \
-  shared(out) collapse(2)
+  dt_omp_firstprivate(in, norm, oy, oz, buf, size_x, size_y, size_z, width, height, sigma_s, sigma_r) \
+  shared(out) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
+    // the row of grid cells is the same for the whole image row
+    const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+    const int yi = MIN((int)y, size_y - 2);
+    const float yf = y - yi;
+    const float *const row = buf + (size_t)yi * oy;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < width; i++)
     {
-      size_t index = 4 * (j * width + i);
-      float x, y, z;
+      const size_t index = 4 * ((size_t)j * width + i);
       const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
+      const float x = CLAMPS(i / sigma_s, 0, size_x - 1);
+      const float z = CLAMPS(L / sigma_r, 0, size_z - 1);
       // trilinear lookup:
       const int xi = MIN((int)x, size_x - 2);
-      const int yi = MIN((int)y, size_y - 2);
       const int zi = MIN((int)z, size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + size_x * (yi + size_y * zi);
-      const float Lout = norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                 + buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                 + buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                 + buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+      const float Lout = norm * trilinear(row + xi + (size_t)oz * zi, oy, oz, x - xi, yf, z - zi);
       out[index] = MAX(0.0f, out[index] + Lout);
     }
   }
@@ -385,6 +414,62 @@ void dt_bilateral_free(dt_bilateral_t *b)
   free(b);
 }
 
+// a couple of blurred grids, one each for the preview and the full pipe
+#define DT_BILATERAL_CACHE_SIZE 2
+
+typedef struct dt_bilateral_cache_entry_t
+{
+  uint64_t hash;
+  float sigma_s, sigma_r; // as requested, not as clamped by the grid
+  dt_bilateral_t *b;
+} dt_bilateral_cache_entry_t;
+
+static GMutex _cache_lock;
+static dt_bilateral_cache_entry_t _cache[DT_BILATERAL_CACHE_SIZE] = { { 0 } };
+
+dt_bilateral_t *dt_bilateral_cache_take(const uint64_t hash, const int width, const int height,
+                                        const float sigma_s, const float sigma_r)
+{
+  dt_bilateral_t *b = NULL;
+  g_mutex_lock(&_cache_lock);
+  for(int k = 0; k < DT_BILATERAL_CACHE_SIZE; k++)
+  {
+    dt_bilateral_cache_entry_t *e = _cache + k;
+    if(e->b && e->hash == hash && e->b->width == width && e->b->height == height && e->sigma_s == sigma_s
+       && e->sigma_r == sigma_r)
+    {
+      b = e->b;
+      e->b = NULL;
+      break;
+    }
+  }
+  g_mutex_unlock(&_cache_lock);
+  return b;
+}
+
+void dt_bilateral_cache_put(const uint64_t hash, const float sigma_s, const float sigma_r, dt_bilateral_t *b)
+{
+  if(!b) return;
+  g_mutex_lock(&_cache_lock);
+  // the least recently put grid goes, the others move down
+  dt_bilateral_free(_cache[DT_BILATERAL_CACHE_SIZE - 1].b);
+  memmove(_cache + 1, _cache, sizeof(dt_bilateral_cache_entry_t) * (DT_BILATERAL_CACHE_SIZE - 1));
+  _cache[0] = (dt_bilateral_cache_entry_t){ .hash = hash, .sigma_s = sigma_s, .sigma_r = sigma_r, .b = b };
+  g_mutex_unlock(&_cache_lock);
+}
+
+void dt_bilateral_cache_cleanup(void)
+{
+  g_mutex_lock(&_cache_lock);
+  for(int k = 0; k < DT_BILATERAL_CACHE_SIZE; k++)
+  {
+    dt_bilateral_free(_cache[k].b);
+    _cache[k].b = NULL;
+  }
+  g_mutex_unlock(&_cache_lock);
+}
+
+#undef DT_BILATERAL_CACHE_SIZE
 #undef DT_COMMON_BILATERAL_MAX_RES_S
 #undef DT_COMMON_BILATERAL_MAX_RES_R
 
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
 
 typedef struct dt_bilateral_t
 {
@@ -64,6 +65,17 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 
 void dt_bilateral_free(dt_bilateral_t *b);
 
+// a small cache of splatted and blurred grids, for modules slicing the same input again with other
+// parameters. the hash identifies the input, usually dt_dev_pixelpipe_cache_hash() of the module.
+// take hands out a matching grid, which is removed from the cache until it is put back, or NULL.
+dt_bilateral_t *dt_bilateral_cache_take(const uint64_t hash, const int width, const int height,
+                                        const float sigma_s, const float sigma_r);
+
+// gives the grid to the cache, which owns it from then on and may free it right away
+void dt_bilateral_cache_put(const uint64_t hash, const float sigma_s, const float sigma_r, dt_bilateral_t *b);
+
+void dt_bilateral_cache_cleanup(void);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -27,56 +27,217 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-// this implements a concurrent LRU cache
+// this implements a concurrent LRU cache, optionally split into a number of
+// independently locked segments, and optionally with a frequency aware (w-tinylfu)
+// eviction policy instead of plain LRU.
 
-void dt_cache_init(
+// share of a segment's quota that the admission window of the frequency aware policy gets
+#define DT_CACHE_WINDOW_PERCENT 1
+// smallest number of counters in a frequency sketch
+#define DT_CACHE_SKETCH_MIN 64
+
+static inline dt_cache_segment_t *_cache_segment(dt_cache_t *cache, const uint32_t key)
+{
+  if(cache->num_segments == 1) return cache->segments;
+  // keys are often sequential image ids with the mip level in the high bits,
+  // so mix them a bit before picking the segment:
+  const uint32_t h = (key ^ (key >> 16)) * 0x45d9f3bu;
+  return cache->segments + ((h ^ (h >> 16)) & (cache->num_segments - 1));
+}
+
+// lru list helpers, all expect the segment lock to be held.
+// an entry is either in the main list or, with the frequency aware policy, in the window.
+static inline void _lru_unlink(dt_cache_segment_t *seg, dt_cache_entry_t *entry)
+{
+  dt_cache_entry_t **head = entry->_in_window ? &seg->window_head : &seg->lru_head;
+  dt_cache_entry_t **tail = entry->_in_window ? &seg->window_tail : &seg->lru_tail;
+  if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+  else *head = entry->lru_next;
+  if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+  else *tail = entry->lru_prev;
+  entry->lru_prev = entry->lru_next = NULL;
+  if(entry->_in_window) seg->window_cost -= entry->cost;
+}
+
+static inline void _lru_append(dt_cache_segment_t *seg, dt_cache_entry_t *entry)
+{
+  dt_cache_entry_t **head = entry->_in_window ? &seg->window_head : &seg->lru_head;
+  dt_cache_entry_t **tail = entry->_in_window ? &seg->window_tail : &seg->lru_tail;
+  entry->lru_next = NULL;
+  entry->lru_prev = *tail;
+  if(*tail) (*tail)->lru_next = entry;
+  else *head = entry;
+  *tail = entry;
+  if(entry->_in_window) seg->window_cost += entry->cost;
+}
+
+static inline void _lru_touch(dt_cache_segment_t *seg, dt_cache_entry_t *entry)
+{
+  if((entry->_in_window ? seg->window_tail : seg->lru_tail) == entry) return;
+  _lru_unlink(seg, entry);
+  _lru_append(seg, entry);
+}
+
+// moves an entry from the window to the most recently used end of the main list
+static inline void _lru_promote(dt_cache_segment_t *seg, dt_cache_entry_t *entry)
+{
+  _lru_unlink(seg, entry);
+  entry->_in_window = 0;
+  _lru_append(seg, entry);
+}
+
+// count-min sketch helpers, all expect the segment lock to be held.
+static inline uint32_t _sketch_index(const dt_cache_segment_t *seg, const uint32_t key, const uint32_t k)
+{
+  uint32_t h = (key + k * 0x9e3779b9u) * 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  return (h ^ (h >> 16)) & seg->sketch_mask;
+}
+
+static inline void _sketch_increment(dt_cache_segment_t *seg, const uint32_t key)
+{
+  if(!seg->sketch) return;
+  for(uint32_t k = 0; k < 4; k++)
+  {
+    uint8_t *counter = seg->sketch + _sketch_index(seg, key, k);
+    if(*counter < UINT8_MAX) (*counter)++;
+  }
+  // age all counters now and then, so the estimate follows the recent past
+  if(++seg->sketch_additions >= 10 * (seg->sketch_mask + 1))
+  {
+    for(uint32_t i = 0; i <= seg->sketch_mask; i++) seg->sketch[i] >>= 1;
+    seg->sketch_additions = 0;
+  }
+}
+
+static inline uint32_t _sketch_estimate(const dt_cache_segment_t *seg, const uint32_t key)
+{
+  uint32_t estimate = UINT8_MAX;
+  for(uint32_t k = 0; k < 4; k++) estimate = MIN(estimate, seg->sketch[_sketch_index(seg, key, k)]);
+  return estimate;
+}
+
+void dt_cache_init_sharded(
     dt_cache_t *cache,
     size_t entry_size,
-    size_t cost_quota)
+    size_t cost_quota,
+    uint32_t num_segments)
 {
-  cache->cost = 0;
-  cache->lru = 0;
+  uint32_t n = 1;
+  while(n < MAX(num_segments, 1)) n <<= 1;
+
   cache->entry_size = entry_size;
   cache->cost_quota = cost_quota;
-  dt_pthread_mutex_init(&cache->lock, 0);
+  cache->num_segments = n;
+  cache->segments = (dt_cache_segment_t *)calloc(n, sizeof(dt_cache_segment_t));
+  for(uint32_t k = 0; k < n; k++)
+  {
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_init(&seg->lock, 0);
+    seg->cost = 0;
+    // the remainder goes to the first segment, so the quotas sum up exactly:
+    seg->cost_quota = cost_quota / n + (k == 0 ? cost_quota % n : 0);
+    seg->lru_head = seg->lru_tail = NULL;
+    seg->window_head = seg->window_tail = NULL;
+    seg->window_cost = 0;
+    seg->sketch = NULL;
+    seg->sketch_mask = 0;
+    seg->sketch_additions = 0;
+    seg->hashtable = g_hash_table_new(0, 0);
+  }
   cache->allocate = 0;
   cache->allocate_data = 0;
   cache->cleanup = 0;
   cache->cleanup_data = 0;
-  cache->hashtable = g_hash_table_new(0, 0);
+  cache->frequency_aware = 0;
 }
 
-void dt_cache_cleanup(dt_cache_t *cache)
+void dt_cache_set_frequency_aware(dt_cache_t *cache, const size_t expected_entries)
 {
-  g_hash_table_destroy(cache->hashtable);
-  GList *l = cache->lru;
-  while(l)
+  // four counters per key, spread over the segments
+  const size_t wanted = MAX(4 * expected_entries / cache->num_segments, DT_CACHE_SKETCH_MIN);
+  uint32_t width = DT_CACHE_SKETCH_MIN;
+  while(width < wanted && width < (1u << 30)) width <<= 1;
+
+  for(uint32_t k = 0; k < cache->num_segments; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    assert(!g_hash_table_size(seg->hashtable));
+    seg->sketch = (uint8_t *)calloc(width, sizeof(uint8_t));
+    seg->sketch_mask = seg->sketch ? width - 1 : 0;
+    seg->sketch_additions = 0;
+    dt_pthread_mutex_unlock(&seg->lock);
+  }
+  cache->frequency_aware = 1;
+}
 
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+void dt_cache_init(
+    dt_cache_t *cache,
+    size_t entry_size,
+    size_t cost_quota)
+{
+  dt_cache_init_sharded(cache, entry_size, cost_quota, 1);
+}
 
-      cache->cleanup(cache->cleanup_data, entry);
+void dt_cache_cleanup(dt_cache_t *cache)
+{
+  for(uint32_t k = 0; k < cache->num_segments; k++)
+  {
+    dt_cache_segment_t *seg = cache->segments + k;
+    g_hash_table_destroy(seg->hashtable);
+    // the window first, then the main list
+    dt_cache_entry_t *entry = seg->window_head ? seg->window_head : seg->lru_head;
+    while(entry)
+    {
+      dt_cache_entry_t *next = entry->lru_next;
+      if(!next && entry->_in_window) next = seg->lru_head;
+
+      if(cache->cleanup)
+      {
+        assert(entry->data_size);
+        ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+
+        cache->cleanup(cache->cleanup_data, entry);
+      }
+      else
+        dt_free_align(entry->data);
+
+      dt_pthread_rwlock_destroy(&entry->lock);
+      g_slice_free1(sizeof(*entry), entry);
+      entry = next;
     }
-    else
-      dt_free_align(entry->data);
+    seg->lru_head = seg->lru_tail = NULL;
+    seg->window_head = seg->window_tail = NULL;
+    free(seg->sketch);
+    seg->sketch = NULL;
+    dt_pthread_mutex_destroy(&seg->lock);
+  }
+  free(cache->segments);
+  cache->segments = NULL;
+  cache->num_segments = 0;
+}
 
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
-    l = g_list_next(l);
+size_t dt_cache_get_cost(dt_cache_t *cache)
+{
+  size_t cost = 0;
+  for(uint32_t k = 0; k < cache->num_segments; k++)
+  {
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    cost += seg->cost;
+    dt_pthread_mutex_unlock(&seg->lock);
   }
-  g_list_free(cache->lru);
-  dt_pthread_mutex_destroy(&cache->lock);
+  return cost;
 }
 
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  int32_t result = g_hash_table_contains(cache->hashtable, GINT_TO_POINTER(key));
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
+  dt_pthread_mutex_lock(&seg->lock);
+  int32_t result = g_hash_table_contains(seg->hashtable, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&seg->lock);
   return result;
 }
 
@@ -85,35 +246,133 @@ int dt_cache_for_all(
     int (*process)(const uint32_t key, const void *data, void *user_data),
     void *user_data)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  GHashTableIter iter;
-  gpointer key, value;
-
-  g_hash_table_iter_init (&iter, cache->hashtable);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for(uint32_t k = 0; k < cache->num_segments; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
-    const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
-    if(err)
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init (&iter, seg->hashtable);
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      dt_pthread_mutex_unlock(&cache->lock);
-      return err;
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
+      const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
+      if(err)
+      {
+        dt_pthread_mutex_unlock(&seg->lock);
+        return err;
+      }
     }
+    dt_pthread_mutex_unlock(&seg->lock);
   }
-  dt_pthread_mutex_unlock(&cache->lock);
   return 0;
 }
 
+// removes the entry unless someone else holds a lock on it. expects the segment lock to be held.
+static void _cache_segment_evict(dt_cache_t *cache, dt_cache_segment_t *seg, dt_cache_entry_t *entry)
+{
+  // if still locked by anyone else give up:
+  if(dt_pthread_rwlock_trywrlock(&entry->lock)) return;
+
+  if(entry->_lock_demoting)
+  {
+    // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
+    dt_pthread_rwlock_unlock(&entry->lock);
+    return;
+  }
+
+  // delete!
+  g_hash_table_remove(seg->hashtable, GINT_TO_POINTER(entry->key));
+  _lru_unlink(seg, entry);
+  seg->cost -= entry->cost;
+
+  if(cache->cleanup)
+  {
+    assert(entry->data_size);
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+
+    cache->cleanup(cache->cleanup_data, entry);
+  }
+  else
+    dt_free_align(entry->data);
+
+  dt_pthread_rwlock_unlock(&entry->lock);
+  dt_pthread_rwlock_destroy(&entry->lock);
+  g_slice_free1(sizeof(*entry), entry);
+}
+
+// the frequency aware version of _cache_segment_gc(). entries that don't fit into the window
+// move on to the main list while that has room. to free space, the oldest entries of window
+// and main list compete: the one used less often recently goes, a winning window entry
+// moves on to the main list.
+static void _cache_segment_gc_frequency(dt_cache_t *cache, dt_cache_segment_t *seg, const float fill_ratio)
+{
+  const size_t limit = seg->cost_quota * fill_ratio;
+  const size_t window_quota = seg->cost_quota * DT_CACHE_WINDOW_PERCENT / 100;
+  const size_t main_limit = limit > window_quota ? limit - window_quota : 0;
+
+  while(seg->window_head && seg->window_cost > window_quota
+        && seg->cost - seg->window_cost + seg->window_head->cost <= main_limit)
+    _lru_promote(seg, seg->window_head);
+
+  // we might remove or move entries, so always keep the pointer to the next one in both lists
+  dt_cache_entry_t *w = seg->window_head, *m = seg->lru_head;
+  while((w || m) && seg->cost >= limit)
+  {
+    dt_cache_entry_t *victim;
+    if(w && m && _sketch_estimate(seg, w->key) > _sketch_estimate(seg, m->key))
+    {
+      dt_cache_entry_t *candidate = w;
+      w = w->lru_next;
+      victim = m;
+      _lru_promote(seg, candidate);
+      m = victim->lru_next;
+    }
+    else if(w)
+    {
+      victim = w;
+      w = w->lru_next;
+    }
+    else
+    {
+      victim = m;
+      m = m->lru_next;
+    }
+    _cache_segment_evict(cache, seg, victim);
+  }
+}
+
+// best-effort garbage collection of one segment. expects the segment lock to be held.
+static void _cache_segment_gc(dt_cache_t *cache, dt_cache_segment_t *seg, const float fill_ratio)
+{
+  if(cache->frequency_aware)
+  {
+    _cache_segment_gc_frequency(cache, seg, fill_ratio);
+    return;
+  }
+
+  dt_cache_entry_t *next = seg->lru_head;
+  while(next)
+  {
+    dt_cache_entry_t *entry = next;
+    next = entry->lru_next; // we might remove this element, so walk to the next one while we still have the pointer..
+    if(seg->cost < seg->cost_quota * fill_ratio) break;
+    _cache_segment_evict(cache, seg, entry);
+  }
+}
+
 // return read locked bucket, or NULL if it's not already there.
 // never attempt to allocate a new slot.
 dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char mode)
 {
   gpointer orig_key, value;
   gboolean res;
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
   double start = dt_get_wtime();
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&seg->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      seg->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   {
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -123,13 +382,13 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&seg->lock);
       return 0;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    _lru_touch(seg, entry);
+    _sketch_increment(seg, key);
+    dt_pthread_mutex_unlock(&seg->lock);
     double end = dt_get_wtime();
     if(end - start > 0.1)
       fprintf(stderr, "try+ wait time %.06fs mode %c \n", end - start, mode);
@@ -144,7 +403,7 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 
     return entry;
   }
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&seg->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "try- wait time %.06fs\n", end - start);
@@ -159,11 +418,12 @@ dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key
   gpointer orig_key, value;
   gboolean res;
   int result;
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
   double start = dt_get_wtime();
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&seg->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      seg->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   { // yay, found. read lock and pass on.
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -172,14 +432,14 @@ restart:
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&seg->lock);
       g_usleep(5);
       goto restart;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    _lru_touch(seg, entry);
+    _sketch_increment(seg, key);
+    dt_pthread_mutex_unlock(&seg->lock);
 
 #ifdef _DEBUG
     const pthread_t writer = dt_pthread_rwlock_get_writer(&entry->lock);
@@ -205,13 +465,14 @@ restart:
   }
 
   // else, not found, need to allocate.
+  _sketch_increment(seg, key);
 
   // first try to clean up.
   // also wait if we can't free more than the requested fill ratio.
-  if(cache->cost > 0.8f * cache->cost_quota)
+  if(seg->cost > 0.8f * seg->cost_quota)
   {
     // need to roll back all the way to get a consistent lock state:
-    dt_cache_gc(cache, 0.8f);
+    _cache_segment_gc(cache, seg, 0.8f);
   }
 
   // here dies your 32-bit system:
@@ -221,11 +482,12 @@ restart:
   entry->data = 0;
   entry->data_size = cache->entry_size;
   entry->cost = 1;
-  entry->link = g_list_append(0, entry);
+  entry->lru_prev = entry->lru_next = NULL;
   entry->key = key;
   entry->_lock_demoting = 0;
+  entry->_in_window = cache->frequency_aware;
 
-  g_hash_table_insert(cache->hashtable, GINT_TO_POINTER(key), entry);
+  g_hash_table_insert(seg->hashtable, GINT_TO_POINTER(key), entry);
 
   assert(cache->allocate || entry->data_size);
 
@@ -244,12 +506,12 @@ restart:
   if(write) dt_pthread_rwlock_wrlock_with_caller(&entry->lock, file, line);
   else      dt_pthread_rwlock_rdlock_with_caller(&entry->lock, file, line);
 
-  cache->cost += entry->cost;
+  seg->cost += entry->cost;
 
-  // put at end of lru list (most recently used):
-  cache->lru = g_list_concat(cache->lru, entry->link);
+  // put at end of lru list (most recently used), or of the window:
+  _lru_append(seg, entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&seg->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "wait time %.06fs\n", end - start);
@@ -265,22 +527,23 @@ int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
   gboolean res;
   int result;
   dt_cache_entry_t *entry;
+  dt_cache_segment_t *seg = _cache_segment(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&seg->lock);
 
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      seg->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   entry = (dt_cache_entry_t *)value;
   if(!res)
   { // not found in cache, not deleting.
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&seg->lock);
     return 1;
   }
   // need write lock to be able to delete:
   result = dt_pthread_rwlock_trywrlock(&entry->lock);
   if(result)
   {
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&seg->lock);
     g_usleep(5);
     goto restart;
   }
@@ -289,15 +552,15 @@ restart:
   {
     // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
     dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&seg->lock);
     g_usleep(5);
     goto restart;
   }
 
-  gboolean removed = g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(key));
+  gboolean removed = g_hash_table_remove(seg->hashtable, GINT_TO_POINTER(key));
   (void)removed; // make non-assert compile happy
   assert(removed);
-  cache->lru = g_list_delete_link(cache->lru, entry->link);
+  _lru_unlink(seg, entry);
 
   if(cache->cleanup)
   {
@@ -311,54 +574,23 @@ restart:
 
   dt_pthread_rwlock_unlock(&entry->lock);
   dt_pthread_rwlock_destroy(&entry->lock);
-  cache->cost -= entry->cost;
+  seg->cost -= entry->cost;
   g_slice_free1(sizeof(*entry), entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&seg->lock);
   return 0;
 }
 
-// best-effort garbage collection. never blocks, never fails. well, sometimes it just doesn't free anything.
+// best-effort garbage collection. never blocks on entries, never fails.
+// well, sometimes it just doesn't free anything.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-  GList *l = cache->lru;
-  int cnt = 0;
-  while(l)
+  for(uint32_t k = 0; k < cache->num_segments; k++)
   {
-    cnt++;
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-    assert(entry->link->data == entry);
-    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
-    if(cache->cost < cache->cost_quota * fill_ratio) break;
-
-    // if still locked by anyone else give up:
-    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
-
-    if(entry->_lock_demoting)
-    {
-      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
-      dt_pthread_rwlock_unlock(&entry->lock);
-      continue;
-    }
-
-    // delete!
-    g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(entry->key));
-    cache->lru = g_list_delete_link(cache->lru, entry->link);
-    cache->cost -= entry->cost;
-
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
+    dt_cache_segment_t *seg = cache->segments + k;
+    dt_pthread_mutex_lock(&seg->lock);
+    _cache_segment_gc(cache, seg, fill_ratio);
+    dt_pthread_mutex_unlock(&seg->lock);
   }
 }
 
@@ -28,9 +28,11 @@ typedef struct dt_cache_entry_t
   void *data;
   size_t data_size;
   size_t cost;
-  GList *link;
+  // intrusive lru list links, so touching and evicting entries never allocates:
+  struct dt_cache_entry_t *lru_prev, *lru_next;
   dt_pthread_rwlock_t lock;
   int _lock_demoting;
+  int _in_window; // with the frequency aware policy: still in the admission window
   uint32_t key;
 }
 dt_cache_entry_t;
@@ -38,29 +40,65 @@ dt_cache_entry_t;
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
-typedef struct dt_cache_t
+// one independently locked part of the cache. keys are distributed over the
+// segments by hash, so threads working on different images rarely contend.
+typedef struct dt_cache_segment_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_pthread_mutex_t lock; // protects the hashtable, lru list and cost of this segment only
+
+  size_t cost;       // user supplied cost of all cache lines in this segment
+  size_t cost_quota; // this segment's share of the total quota
+
+  GHashTable *hashtable; // stores (key, entry) pairs
+  // intrusive doubly linked lru list:
+  dt_cache_entry_t *lru_head; // about to be kicked from cache
+  dt_cache_entry_t *lru_tail; // most recently used
+
+  // only used with the frequency aware policy, see dt_cache_set_frequency_aware():
+  // new entries wait in a small lru window before they may enter the main list above.
+  dt_cache_entry_t *window_head, *window_tail;
+  size_t window_cost;
+  // count-min sketch of recent access frequencies, four saturating counters per key
+  uint8_t *sketch;
+  uint32_t sketch_mask;      // number of counters - 1, a power of two minus one
+  uint32_t sketch_additions; // since the counters were last halved
+}
+dt_cache_segment_t;
 
+typedef struct dt_cache_t
+{
   size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
   size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
-  GHashTable *hashtable; // stores (key, entry) pairs
-  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
+  // a power of two. with only one segment we have the old big fat lock behaviour,
+  // which is what you want for caches holding only a few very expensive lines.
+  uint32_t num_segments;
+  dt_cache_segment_t *segments;
 
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
   dt_cache_allocate_t cleanup;
   void *allocate_data;
   void *cleanup_data;
+
+  int frequency_aware; // w-tinylfu instead of pure lru eviction
 }
 dt_cache_t;
 
 // entry size is only used if alloc callback is 0
 void dt_cache_init(dt_cache_t *cache, size_t entry_size, size_t cost_quota);
+// same, but split into num_segments (rounded up to a power of two) separately locked
+// segments, each with its own lru list and an equal share of cost_quota.
+void dt_cache_init_sharded(dt_cache_t *cache, size_t entry_size, size_t cost_quota, uint32_t num_segments);
 void dt_cache_cleanup(dt_cache_t *cache);
 
+// switch an empty cache from lru to a frequency aware policy (w-tinylfu): new entries go
+// into a small lru window first. once that is full, its oldest entry only replaces the
+// lru entry of the main list if it was accessed more often recently, as estimated by a
+// count-min sketch sized for about expected_entries keys. a single scan over many keys
+// then only churns the window and leaves the often used entries alone.
+void dt_cache_set_frequency_aware(dt_cache_t *cache, const size_t expected_entries);
+
 static inline void dt_cache_set_allocate_callback(dt_cache_t *cache, dt_cache_allocate_t allocate_cb,
                                                   void *allocate_data)
 {
@@ -93,6 +131,9 @@ int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
 // is locked)
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
+// current cost summed over all segments. only a snapshot, other threads may change it.
+size_t dt_cache_get_cost(dt_cache_t *cache);
+
 // iterate over all currently contained data blocks.
 // not thread safe! only use this for init/cleanup!
 // returns non zero the first time process() returns non zero.
@@ -20,6 +20,7 @@
 #endif
 #include "common/camera_control.h"
 #include "common/exif.h"
+#include "common/imageio_jpeg.h"
 #include "control/control.h"
 #include <gphoto2/gphoto2-file.h>
 
@@ -332,35 +333,60 @@ static void _camera_process_job(const dt_camctl_t *c, const dt_camera_t *camera,
       else
       {
         // everything worked
-        GError *error = NULL;
-        GdkPixbufLoader *loader = gdk_pixbuf_loader_new_with_mime_type(
-            "image/jpeg", &error); // there were cases where GDKPixbufLoader failed to recognize the JPEG
-        if(error)
+        dt_imageio_jpeg_t jpg;
+        if(dt_imageio_jpeg_decompress_header(data, data_size, &jpg))
         {
-          dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to create jpeg image loader: %s\n",
-                   error->message);
-          g_error_free(error);
+          dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to read the preview header\n");
         }
         else
         {
-          if(gdk_pixbuf_loader_write(loader, (guchar *)data, data_size, NULL) == TRUE)
+          // decode in the dct at the smallest scale that still covers the view, unless shown 1:1
+          const gint vw = cam->live_view_width, vh = cam->live_view_height;
+          if(!cam->live_view_zoom && vw > 0 && vh > 0)
           {
+            if(cam->live_view_rotation % 2 == 0)
+              dt_imageio_jpeg_set_min_size(&jpg, vw, vh);
+            else
+              dt_imageio_jpeg_set_min_size(&jpg, vh, vw);
+          }
+
+          // reuse the previous frame when it is no longer shown and nobody else holds it
+          GdkPixbuf *pixbuf = cam->live_view_spare;
+          cam->live_view_spare = NULL;
+          if(pixbuf
+             && (gdk_pixbuf_get_width(pixbuf) != jpg.width || gdk_pixbuf_get_height(pixbuf) != jpg.height
+                 || G_OBJECT(pixbuf)->ref_count != 1))
+          {
+            g_object_unref(pixbuf);
+            pixbuf = NULL;
+          }
+          if(!pixbuf)
+          {
+            pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, jpg.width, jpg.height);
+            // the decoder writes rgbx, and without libjpeg-turbo's extensions it leaves x alone
+            if(pixbuf) gdk_pixbuf_fill(pixbuf, 0xff);
+          }
+
+          if(!pixbuf || gdk_pixbuf_get_rowstride(pixbuf) != 4 * jpg.width)
+          {
+            dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to allocate the preview\n");
+            if(pixbuf) g_object_unref(pixbuf);
+            jpeg_destroy_decompress(&jpg.dinfo);
+          }
+          else if(dt_imageio_jpeg_decompress(&jpg, gdk_pixbuf_get_pixels(pixbuf)))
+          {
+            dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to decode the preview\n");
+            cam->live_view_spare = pixbuf;
+          }
+          else
+          {
+            // only the swap is guarded, drawing never waits for a decode. a frame not drawn yet is dropped
             dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
-            if(cam->live_view_pixbuf != NULL) g_object_unref(cam->live_view_pixbuf);
-            // Calling gdk_pixbuf_loader_close forces the data to be parsed by the
-            // loader.  We must do this before calling gdk_pixbuf_loader_get_pixbuf.
-            gdk_pixbuf_loader_close(loader, &error);
-            if(error)
-            {
-              dt_print(DT_DEBUG_CAMCTL, "[camera_control] live view failed to close image loader: %s\n",
-                       error->message);
-              g_error_free(error);
-            }
-            cam->live_view_pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+            cam->live_view_spare = cam->live_view_pixbuf;
+            cam->live_view_pixbuf = pixbuf;
             dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
           }
         }
-        gdk_pixbuf_loader_close(loader, NULL);
       }
       if(fp) gp_file_free(fp);
       dt_pthread_mutex_BAD_unlock(&cam->live_view_synch);
@@ -624,6 +650,11 @@ static void dt_camctl_camera_destroy(dt_camera_t *cam)
     g_object_unref(cam->live_view_pixbuf);
     cam->live_view_pixbuf = NULL; // just in case someone else is using this
   }
+  if(cam->live_view_spare != NULL)
+  {
+    g_object_unref(cam->live_view_spare);
+    cam->live_view_spare = NULL;
+  }
   g_free(cam->model);
   g_free(cam->port);
   dt_pthread_mutex_destroy(&cam->config_lock);
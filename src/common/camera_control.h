@@ -84,6 +84,10 @@ typedef struct dt_camera_t
   gboolean is_live_viewing;
   /** The last preview image from the camera */
   GdkPixbuf *live_view_pixbuf;
+  /** The frame before it, reused for the next one when nobody else holds it */
+  GdkPixbuf *live_view_spare;
+  /** The size the live view is shown at, frames are decoded no larger than needed to cover it */
+  gint live_view_width, live_view_height;
   /** Rotation of live view, multiples of 90° */
   int32_t live_view_rotation;
   /** Zoom level for live view */
@@ -21,11 +21,13 @@
 #include "common/image.h"
 #include "common/imageio_rawspeed.h"
 #include "common/metadata.h"
+#include "common/selection.h"
 #include "common/utility.h"
 #include "control/conf.h"
 #include "control/control.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <glib.h>
 #include <memory.h>
 #include <stdio.h>
@@ -78,6 +80,7 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
     collection->where_ext = g_strdupv(clone->where_ext);
     collection->query = g_strdup(clone->query);
     collection->query_no_group = g_strdup(clone->query_no_group);
+    collection->query_where = g_strdup(clone->query_where);
     collection->clone = 1;
     collection->count = clone->count;
     collection->count_no_group = clone->count_no_group;
@@ -112,6 +115,7 @@ void dt_collection_free(const dt_collection_t *collection)
 
   g_free(collection->query);
   g_free(collection->query_no_group);
+  g_free(collection->query_where);
   g_strfreev(collection->where_ext);
   g_free((dt_collection_t *)collection);
 }
@@ -396,6 +400,8 @@ int dt_collection_update(const dt_collection_t *collection)
       = dt_util_dstrcat(query_no_group, "%s%s%s %s%s", selq_pre, wq_no_group, selq_post ? selq_post : "", sq ? sq : "",
                         (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) ? " " LIMIT_QUERY : "");
   result = _dt_collection_store(collection, query, query_no_group);
+  g_free(collection->query_where);
+  ((dt_collection_t *)collection)->query_where = g_strdup(wq);
 
 #ifdef _DEBUG
   printf("SQL Collection for 1st:%d and 2nd:%d: %s\n\n",collection->params.sort,collection->params.sort_second_order,query);/*only for debugging*/
@@ -887,7 +893,11 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection,
   else
     count_query = dt_util_dstrcat(count_query, "SELECT COUNT(DISTINCT mi.id) %s", fq);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
+  // counting walks the whole library, don't make it wait for a write. the read connections can't see the
+  // memory tables though.
+  sqlite3 *db = strstr(count_query, "memory.") ? dt_database_get(darktable.db)
+                                                : dt_database_get_reader(darktable.db);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, count_query, -1, &stmt, NULL);
   if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
      && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
   {
@@ -1447,8 +1457,9 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
       query = dt_util_dstrcat(query, ")");
       break;
     case DT_COLLECTION_PROP_TAG: // tag
-      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
-                                     "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
+      // look the tags up first so tagged_images is only searched through its tagid index
+      query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN "
+                                     "(SELECT id FROM data.tags WHERE name LIKE '%s')))",
                               escaped_text);
       break;
 
@@ -1603,9 +1614,10 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
 
     case DT_COLLECTION_PROP_MODULE: // dev module
       {
-        query = dt_util_dstrcat(query, "(id IN (SELECT imgid AS id FROM main.history AS h "
-                                       "JOIN memory.darktable_iop_names AS m ON m.operation = h.operation "
-                                       "WHERE h.enabled = 1 AND m.name LIKE '%s'))", escaped_text);
+        query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.history "
+                                       "WHERE enabled = 1 AND operation IN "
+                                       "(SELECT operation FROM memory.darktable_iop_names WHERE name LIKE '%s')))",
+                                escaped_text);
       }
       break;
 
@@ -1733,47 +1745,43 @@ void dt_collection_deserialize(char *buf)
   dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_NEW_QUERY, NULL);
 }
 
-void dt_collection_update_query(const dt_collection_t *collection, dt_collection_change_t query_change, GList *list)
+static gchar *_collection_imgid_list(GList *list)
+{
+  gchar *txt = NULL;
+  for(GList *l = list; l; l = g_list_next(l))
+    txt = dt_util_dstrcat(txt, txt ? ",%d" : "%d", GPOINTER_TO_INT(l->data));
+  return txt;
+}
+
+// for changing offsets, thumbtable needs to know the first untouched imageid after the list
+static int _collection_next_untouched(GList *list)
 {
   int next = -1;
-  if(!collection->clone)
+  if(!list) return next;
+
+  const int id0 = GPOINTER_TO_INT(list->data);
+  gchar *txt = _collection_imgid_list(list);
+  gchar *query = dt_util_dstrcat(NULL,
+                                 "SELECT imgid FROM memory.collected_images "
+                                 "WHERE imgid NOT IN (%s) AND "
+                                 "rowid>(SELECT rowid FROM memory.collected_images WHERE imgid=%d) "
+                                 "ORDER BY rowid LIMIT 1",
+                                 txt, id0);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    if(g_list_length(list) > 0)
-    {
-      // for changing offsets, thumbtable needs to know the first untouched imageid after the list
-      // we do this here
-      const int id0 = GPOINTER_TO_INT(g_list_nth_data(list, 0));
-      gchar *txt = NULL;
-      GList *l = g_list_first(list);
-      int i = 0;
-      while(l)
-      {
-        const int id = GPOINTER_TO_INT(l->data);
-        if(i == 0)
-          txt = dt_util_dstrcat(txt, "%d", id);
-        else
-          txt = dt_util_dstrcat(txt, ",%d", id);
-        l = g_list_next(l);
-        i++;
-      }
-      gchar *query = dt_util_dstrcat(NULL,
-                                     "SELECT imgid FROM memory.collected_images "
-                                     "WHERE imgid NOT IN (%s) AND "
-                                     "rowid>(SELECT rowid FROM memory.collected_images WHERE imgid=%d) "
-                                     "ORDER BY rowid LIMIT 1",
-                                     txt, id0);
-      sqlite3_stmt *stmt2;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt2, NULL);
-      if(sqlite3_step(stmt2) == SQLITE_ROW)
-      {
-        next = sqlite3_column_int(stmt2, 0);
-      }
-      sqlite3_finalize(stmt2);
-      g_free(query);
-      g_free(txt);
-    }
+    next = sqlite3_column_int(stmt, 0);
   }
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_free(txt);
+  return next;
+}
 
+static void _collection_update_query(const dt_collection_t *collection, dt_collection_change_t query_change,
+                                     GList *list, const int next)
+{
   char confname[200];
 
   const int _n_r = dt_conf_get_int("plugins/lighttable/collect/num_rules");
@@ -1837,6 +1845,7 @@ void dt_collection_update_query(const dt_collection_t *collection, dt_collection
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    dt_selection_invalidate(darktable.selection);
 
     /* free allocated strings */
     g_free(complete_query);
@@ -1850,6 +1859,148 @@ void dt_collection_update_query(const dt_collection_t *collection, dt_collection
   }
 }
 
+void dt_collection_update_query(const dt_collection_t *collection, dt_collection_change_t query_change, GList *list)
+{
+  const int next = collection->clone ? -1 : _collection_next_untouched(list);
+  _collection_update_query(collection, query_change, list, next);
+}
+
+// re-evaluate the images of list against the unchanged where part of the query and drop the ones which
+// don't match anymore from memory.collected_images, renumbering the rows behind them so rowid stays the
+// position. returns FALSE, without touching anything, if the change can't be applied in place: an image
+// entered the collection, its position may have moved or another image of its group may be shown instead.
+static gboolean _collection_update_delta(const dt_collection_t *collection, const dt_collection_sort_t sort,
+                                         GList *list)
+{
+  if(collection->clone || !list || !collection->query_where) return FALSE;
+  if(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT) return FALSE;
+  if(sort != DT_COLLECTION_SORT_NONE && (collection->params.query_flags & COLLECTION_QUERY_USE_SORT)
+     && (collection->params.sort == sort || collection->params.sort_second_order == sort))
+    return FALSE;
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  gchar *txt = _collection_imgid_list(list);
+  gchar *query = NULL;
+  gboolean ok = TRUE;
+
+  if(darktable.gui && darktable.gui->grouping)
+  {
+    query = dt_util_dstrcat(NULL,
+                            "SELECT 1 FROM main.images"
+                            " WHERE group_id IN (SELECT group_id FROM main.images WHERE id IN (%s))"
+                            "   AND id NOT IN (%s) LIMIT 1",
+                            txt, txt);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, query, -1, &stmt, NULL);
+    if(sqlite3_step(stmt) == SQLITE_ROW) ok = FALSE;
+    sqlite3_finalize(stmt);
+    g_free(query);
+  }
+
+  if(ok)
+  {
+    // we don't know where a new image would go without running the sorted query
+    query = dt_util_dstrcat(NULL,
+                            "SELECT 1 FROM main.images AS mi WHERE mi.id IN (%s) AND (%s)"
+                            " AND mi.id NOT IN (SELECT imgid FROM memory.collected_images WHERE imgid IN (%s))"
+                            " LIMIT 1",
+                            txt, collection->query_where, txt);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, query, -1, &stmt, NULL);
+    if(sqlite3_step(stmt) == SQLITE_ROW) ok = FALSE;
+    sqlite3_finalize(stmt);
+    g_free(query);
+  }
+
+  if(!ok)
+  {
+    g_free(txt);
+    return FALSE;
+  }
+
+  GList *rowids = NULL;
+  gchar *removed = NULL;
+  query = dt_util_dstrcat(NULL,
+                          "SELECT rowid, imgid FROM memory.collected_images"
+                          " WHERE imgid IN (%s)"
+                          "   AND imgid NOT IN (SELECT mi.id FROM main.images AS mi WHERE mi.id IN (%s) AND (%s))"
+                          " ORDER BY rowid",
+                          txt, txt, collection->query_where);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    rowids = g_list_prepend(rowids, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+    removed = dt_util_dstrcat(removed, removed ? ",%d" : "%d", sqlite3_column_int(stmt, 1));
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_free(txt);
+
+  if(!rowids) return TRUE;
+
+  rowids = g_list_reverse(rowids);
+  const int nb = g_list_length(rowids);
+
+  DT_DEBUG_SQLITE3_EXEC(db, "BEGIN", NULL, NULL, NULL);
+  query = dt_util_dstrcat(NULL, "DELETE FROM memory.collected_images WHERE imgid IN (%s)", removed);
+  DT_DEBUG_SQLITE3_EXEC(db, query, NULL, NULL, NULL);
+  g_free(query);
+
+  // the rows between the i-th and the (i+1)-th removed one move up by i. going through negative rowids
+  // keeps the primary key unique whatever order sqlite updates the rows in.
+  int shift = 1;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "UPDATE memory.collected_images SET rowid = -(rowid - ?1)"
+                              " WHERE rowid > ?2 AND rowid < ?3",
+                              -1, &stmt, NULL);
+  for(GList *l = rowids; l; l = g_list_next(l), shift++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, shift);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, GPOINTER_TO_INT(l->data));
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, l->next ? GPOINTER_TO_INT(l->next->data) : INT_MAX);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_EXEC(db, "UPDATE memory.collected_images SET rowid = -rowid WHERE rowid < 0", NULL, NULL, NULL);
+  // keep the autoincrement in line with a fresh rebuild
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "UPDATE memory.sqlite_sequence"
+                        " SET seq = (SELECT IFNULL(MAX(rowid), 0) FROM memory.collected_images)"
+                        " WHERE name='collected_images'",
+                        NULL, NULL, NULL);
+
+  query = dt_util_dstrcat(NULL, "DELETE FROM main.selected_images WHERE imgid IN (%s)", removed);
+  DT_DEBUG_SQLITE3_EXEC(db, query, NULL, NULL, NULL);
+  g_free(query);
+  dt_selection_invalidate(darktable.selection);
+  DT_DEBUG_SQLITE3_EXEC(db, "COMMIT", NULL, NULL, NULL);
+
+  g_list_free(rowids);
+  g_free(removed);
+
+  // the images were alone in their group, so they count the same with and without grouping
+  dt_collection_t *c = (dt_collection_t *)collection;
+  c->count = c->count > nb ? c->count - nb : 0;
+  c->count_no_group = c->count_no_group > nb ? c->count_no_group - nb : 0;
+  dt_collection_hint_message(collection);
+
+  return TRUE;
+}
+
+void dt_collection_update_query_images(const dt_collection_t *collection, dt_collection_sort_t sort, GList *list)
+{
+  const int next = collection->clone ? -1 : _collection_next_untouched(list);
+
+  if(!_collection_update_delta(collection, sort, list))
+  {
+    _collection_update_query(collection, DT_COLLECTION_CHANGE_RELOAD, list, next);
+    return;
+  }
+
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED, DT_COLLECTION_CHANGE_RELOAD, list,
+                          next);
+}
+
 gboolean dt_collection_hint_message_internal(void *message)
 {
   dt_control_hinter_message(darktable.control, message);
@@ -152,6 +152,7 @@ typedef struct dt_collection_t
 {
   int clone;
   gchar *query, *query_no_group;
+  gchar *query_where; // where part of query, used to test single images against the collection
   gchar **where_ext;
   unsigned int count, count_no_group;
   dt_collection_params_t params;
@@ -233,6 +234,10 @@ uint32_t dt_collection_get_selected_count(const dt_collection_t *collection);
 /** update query by conf vars */
 void dt_collection_update_query(const dt_collection_t *collection, dt_collection_change_t query_change,
                                 GList *list);
+/** the images in list have been changed in a way that can only affect sorting by sort (or nothing if
+ * DT_COLLECTION_SORT_NONE). re-evaluates only these images against the unchanged query and patches the
+ * collected images in place, falls back to dt_collection_update_query() when that isn't possible */
+void dt_collection_update_query_images(const dt_collection_t *collection, dt_collection_sort_t sort, GList *list);
 
 /** updates the hint message for collection */
 void dt_collection_hint_message(const dt_collection_t *collection);
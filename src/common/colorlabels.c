@@ -39,30 +39,72 @@ typedef struct dt_undo_colorlabels_t
   uint8_t after;
 } dt_undo_colorlabels_t;
 
-int dt_colorlabels_get_labels(const int imgid)
+// the statements of a bulk change, prepared once for all images
+typedef struct dt_colorlabels_stmts_t
+{
+  sqlite3_stmt *get, *set, *remove;
+} dt_colorlabels_stmts_t;
+
+static void _colorlabels_prepare(dt_colorlabels_stmts_t *stmts)
 {
-  sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT color FROM main.color_labels WHERE imgid = ?1", -1, &stmt, NULL);
+                              "SELECT color FROM main.color_labels WHERE imgid = ?1", -1, &stmts->get, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO main.color_labels (imgid, color) VALUES (?1, ?2)", -1, &stmts->set,
+                              NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.color_labels WHERE imgid=?1 AND color=?2", -1, &stmts->remove,
+                              NULL);
+}
+
+static void _colorlabels_finalize(dt_colorlabels_stmts_t *stmts)
+{
+  sqlite3_finalize(stmts->get);
+  sqlite3_finalize(stmts->set);
+  sqlite3_finalize(stmts->remove);
+}
+
+static int _colorlabels_get(sqlite3_stmt *stmt, const int imgid)
+{
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   int colors = 0;
   while(sqlite3_step(stmt) == SQLITE_ROW)
     colors |= (1<<sqlite3_column_int(stmt, 0));
+  sqlite3_reset(stmt);
+  return colors;
+}
+
+int dt_colorlabels_get_labels(const int imgid)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT color FROM main.color_labels WHERE imgid = ?1", -1, &stmt, NULL);
+  const int colors = _colorlabels_get(stmt, imgid);
   sqlite3_finalize(stmt);
   return colors;
 }
 
-static void _pop_undo_execute(const int imgid, const uint8_t before, const uint8_t after)
+static void _pop_undo_execute(dt_colorlabels_stmts_t *stmts, const int imgid, const uint8_t before,
+                              const uint8_t after)
 {
   for(int color=0; color<5; color++)
   {
+    sqlite3_stmt *stmt = NULL;
     if(after & (1<<color))
     {
       if (!(before & (1<<color)))
-        dt_colorlabels_set_label(imgid, color);
+        stmt = stmts->set;
     }
     else if (before & (1<<color))
-      dt_colorlabels_remove_label(imgid, color);
+      stmt = stmts->remove;
+
+    if(stmt)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+    }
   }
 }
 
@@ -71,6 +113,9 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
   if(type == DT_UNDO_COLORLABELS)
   {
     GList *list = (GList *)data;
+    dt_colorlabels_stmts_t stmts;
+    _colorlabels_prepare(&stmts);
+    const gboolean transaction = dt_database_start_transaction(darktable.db);
 
     while(list)
     {
@@ -78,10 +123,13 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
 
       const uint8_t before = (action == DT_ACTION_UNDO) ? undocolorlabels->after : undocolorlabels->before;
       const uint8_t after = (action == DT_ACTION_UNDO) ? undocolorlabels->before : undocolorlabels->after;
-      _pop_undo_execute(undocolorlabels->imgid, before, after);
+      _pop_undo_execute(&stmts, undocolorlabels->imgid, before, after);
       *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(undocolorlabels->imgid));
       list = g_list_next(list);
     }
+
+    dt_database_release_transaction(darktable.db, transaction);
+    _colorlabels_finalize(&stmts);
     dt_collection_hint_message(darktable.collection);
   }
 }
@@ -135,11 +183,15 @@ typedef enum dt_colorlabels_actions_t
 
 static void _colorlabels_execute(GList *imgs, const int labels, GList **undo, const gboolean undo_on, const int action)
 {
+  dt_colorlabels_stmts_t stmts;
+  _colorlabels_prepare(&stmts);
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
+
   GList *images = imgs;
   while(images)
   {
     const int image_id = GPOINTER_TO_INT(images->data);
-    const uint8_t before = dt_colorlabels_get_labels(image_id);
+    const uint8_t before = _colorlabels_get(stmts.get, image_id);
     uint8_t after = 0;
     switch(action)
     {
@@ -163,13 +215,17 @@ static void _colorlabels_execute(GList *imgs, const int labels, GList **undo, co
       undocolorlabels->imgid = image_id;
       undocolorlabels->before = before;
       undocolorlabels->after = after;
-      *undo = g_list_append(*undo, undocolorlabels);
+      *undo = g_list_prepend(*undo, undocolorlabels);
     }
 
-    _pop_undo_execute(image_id, before, after);
+    _pop_undo_execute(&stmts, image_id, before, after);
 
     images = g_list_next(images);
   }
+
+  dt_database_release_transaction(darktable.db, transaction);
+  _colorlabels_finalize(&stmts);
+  if(undo_on) *undo = g_list_reverse(*undo);
 }
 
 void dt_colorlabels_set_labels(const GList *img, const int labels, const gboolean clear_on,
@@ -211,12 +267,7 @@ void dt_colorlabels_toggle_label_on_list(GList *list, const int color, const gbo
   }
 
   // synchronise xmp files
-  GList *l = list;
-  while(l)
-  {
-    dt_image_synch_xmp(GPOINTER_TO_INT(l->data));
-    l = g_list_next(l);
-  }
+  dt_image_synch_xmps(list);
 
   if(undo_on)
   {
@@ -21,6 +21,10 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/file_location.h"
+#ifdef HAVE_PRINT
+#include "common/printprof.h"
+#endif
+#include "common/simd.h"
 #include "common/srgb_tone_curve_values.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -261,16 +265,124 @@ static int dt_colorspaces_get_matrix_from_profile(cmsHPROFILE prof, float *matri
   return 0;
 }
 
+/*
+ * sampling the tone curves into luts of 0x10000 entries, and reversing them for output profiles, takes a
+ * few milliseconds per profile. colorin, colorout and the work profile of every pipe do it again in their
+ * commit_params, for the same handful of profiles, which adds up in a batch export. the results are kept
+ * by the contents of the profile, so profiles created anew for each image hit the cache as well.
+ */
+#define DT_COLORSPACES_MATRIX_CACHE_SIZE 8
+
+typedef struct dt_colorspaces_matrix_cache_entry_t
+{
+  float matrix[9];
+  float *lut[3];
+} dt_colorspaces_matrix_cache_entry_t;
+
+static void _matrix_cache_entry_free(gpointer data)
+{
+  dt_colorspaces_matrix_cache_entry_t *e = (dt_colorspaces_matrix_cache_entry_t *)data;
+  for(int k = 0; k < 3; k++) dt_free_align(e->lut[k]);
+  free(e);
+}
+
+static gchar *_matrix_cache_key(cmsHPROFILE prof, const int lutsize, const int input, const int intent)
+{
+  cmsUInt32Number size = 0;
+  if(!cmsSaveProfileToMem(prof, NULL, &size) || size == 0) return NULL;
+  uint8_t *buf = (uint8_t *)g_malloc(size);
+  gchar *key = NULL;
+  if(cmsSaveProfileToMem(prof, buf, &size))
+  {
+    gchar *md5 = g_compute_checksum_for_data(G_CHECKSUM_MD5, buf, size);
+    key = g_strdup_printf("%s:%d:%d:%d", md5, lutsize, input, intent);
+    g_free(md5);
+  }
+  g_free(buf);
+  return key;
+}
+
+static int _get_matrix_from_profile_cached(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg, float *lutb,
+                                           const int lutsize, const int input, const int intent)
+{
+  dt_colorspaces_t *cs = darktable.color_profiles;
+  // small luts are cheap, and before dt_colorspaces_init() is done there is no cache
+  if(!cs || !cs->matrix_cache || !prof || lutsize < 2 || !cmsIsMatrixShaper(prof))
+    return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, input, intent);
+
+  gchar *key = _matrix_cache_key(prof, lutsize, input, intent);
+  if(!key) return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, input, intent);
+
+  float *luts[3] = { lutr, lutg, lutb };
+
+  pthread_mutex_lock(&cs->matrix_cache_lock);
+  const dt_colorspaces_matrix_cache_entry_t *hit
+      = (dt_colorspaces_matrix_cache_entry_t *)g_hash_table_lookup(cs->matrix_cache, key);
+  if(hit)
+  {
+    memcpy(matrix, hit->matrix, sizeof(float) * 9);
+    for(int k = 0; k < 3; k++)
+    {
+      // linear curves are only marked in the first element
+      if(hit->lut[k][0] < 0.0f)
+        luts[k][0] = -1.0f;
+      else
+        memcpy(luts[k], hit->lut[k], sizeof(float) * lutsize);
+    }
+    pthread_mutex_unlock(&cs->matrix_cache_lock);
+    g_free(key);
+    return 0;
+  }
+  pthread_mutex_unlock(&cs->matrix_cache_lock);
+
+  // profiles that fail are cheap to check again and don't get cached
+  const int ret = dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, input, intent);
+  if(ret)
+  {
+    g_free(key);
+    return ret;
+  }
+
+  dt_colorspaces_matrix_cache_entry_t *e
+      = (dt_colorspaces_matrix_cache_entry_t *)calloc(1, sizeof(dt_colorspaces_matrix_cache_entry_t));
+  memcpy(e->matrix, matrix, sizeof(float) * 9);
+  gboolean ok = TRUE;
+  for(int k = 0; k < 3; k++)
+  {
+    e->lut[k] = dt_alloc_align(64, sizeof(float) * (luts[k][0] < 0.0f ? 1 : lutsize));
+    if(!e->lut[k])
+      ok = FALSE;
+    else if(luts[k][0] < 0.0f)
+      e->lut[k][0] = -1.0f;
+    else
+      memcpy(e->lut[k], luts[k], sizeof(float) * lutsize);
+  }
+  if(!ok)
+  {
+    _matrix_cache_entry_free(e);
+    g_free(key);
+    return ret;
+  }
+
+  pthread_mutex_lock(&cs->matrix_cache_lock);
+  if(g_hash_table_size(cs->matrix_cache) >= DT_COLORSPACES_MATRIX_CACHE_SIZE)
+    g_hash_table_remove_all(cs->matrix_cache);
+  g_hash_table_replace(cs->matrix_cache, key, e);
+  pthread_mutex_unlock(&cs->matrix_cache_lock);
+
+  return ret;
+}
+
 int dt_colorspaces_get_matrix_from_input_profile(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg,
                                                  float *lutb, const int lutsize, const int intent)
 {
-  return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, 1, intent);
+  return _get_matrix_from_profile_cached(prof, matrix, lutr, lutg, lutb, lutsize, 1, intent);
 }
 
 int dt_colorspaces_get_matrix_from_output_profile(cmsHPROFILE prof, float *matrix, float *lutr, float *lutg,
                                                   float *lutb, const int lutsize, const int intent)
 {
-  return dt_colorspaces_get_matrix_from_profile(prof, matrix, lutr, lutg, lutb, lutsize, 0, intent);
+  return _get_matrix_from_profile_cached(prof, matrix, lutr, lutg, lutb, lutsize, 0, intent);
 }
 
 static cmsHPROFILE dt_colorspaces_create_lab_profile()
@@ -1139,6 +1251,133 @@ static dt_colorspaces_color_profile_t *_create_profile(dt_colorspaces_color_prof
   return prof;
 }
 
+#define DISPLAY_LUT_NODES                                                                                    \
+  (DT_COLORSPACES_DISPLAY_LUT_SIZE * DT_COLORSPACES_DISPLAY_LUT_SIZE * DT_COLORSPACES_DISPLAY_LUT_SIZE)
+
+// samples the transform from in to out at the nodes of a display lut, see dt_colorspaces_display_lut_apply()
+static dt_colorspaces_display_lut_t *_build_display_lut(cmsHPROFILE in, cmsHPROFILE out,
+                                                        const dt_iop_color_intent_t intent)
+{
+  if(!in || !out) return NULL;
+
+  // sample in 16 bit, so that the nodes don't add another rounding step to the 8 bit output
+  cmsHTRANSFORM transform = cmsCreateTransform(in, TYPE_RGB_16, out, TYPE_BGR_16, intent, 0);
+  if(!transform) return NULL;
+
+  uint16_t *samples = malloc(sizeof(uint16_t) * 3 * DISPLAY_LUT_NODES);
+  dt_colorspaces_display_lut_t *lut = malloc(sizeof(dt_colorspaces_display_lut_t));
+  if(!samples || !lut)
+  {
+    free(samples);
+    free(lut);
+    cmsDeleteTransform(transform);
+    return NULL;
+  }
+
+  // node i sits at (i / step)^1.5 of the input range, which keeps the error at one level even for
+  // pure gamma displays
+  const int step = DT_COLORSPACES_DISPLAY_LUT_SIZE - 1;
+  double pos[DT_COLORSPACES_DISPLAY_LUT_SIZE];
+  for(int i = 0; i <= step; i++) pos[i] = pow(i / (double)step, 1.5);
+
+  for(int v = 0, i = 0; v < 256; v++)
+  {
+    const double x = v / 255.0;
+    while(i < step - 1 && pos[i + 1] <= x) i++;
+    lut->idx[v] = i;
+    lut->frac[v] = (uint16_t)(256.0 * (x - pos[i]) / (pos[i + 1] - pos[i]) + 0.5);
+  }
+
+  uint16_t *s = samples;
+  for(int r = 0; r <= step; r++)
+    for(int g = 0; g <= step; g++)
+      for(int b = 0; b <= step; b++, s += 3)
+      {
+        s[0] = (uint16_t)(pos[r] * 65535.0 + 0.5);
+        s[1] = (uint16_t)(pos[g] * 65535.0 + 0.5);
+        s[2] = (uint16_t)(pos[b] * 65535.0 + 0.5);
+      }
+
+  cmsDoTransform(transform, samples, samples, DISPLAY_LUT_NODES);
+  cmsDeleteTransform(transform);
+
+  for(int k = 0; k < DISPLAY_LUT_NODES; k++)
+  {
+    for(int c = 0; c < 3; c++) lut->nodes[k][c] = ((uint32_t)samples[3 * k + c] * 256 + 128) / 257;
+    lut->nodes[k][3] = 0;
+  }
+
+  free(samples);
+  return lut;
+}
+
+#undef DISPLAY_LUT_NODES
+
+static inline dt_simd4i _display_lut_node(const dt_colorspaces_display_lut_t *const lut, const int k)
+{
+  const uint16_t *const n = lut->nodes[k];
+  return (dt_simd4i){ n[0], n[1], n[2], n[3] };
+}
+
+void dt_colorspaces_display_lut_apply(const dt_colorspaces_display_lut_t *const lut, const uint8_t *in,
+                                      uint8_t *out, const int width)
+{
+  const int sr = DT_COLORSPACES_DISPLAY_LUT_SIZE * DT_COLORSPACES_DISPLAY_LUT_SIZE;
+  const int sg = DT_COLORSPACES_DISPLAY_LUT_SIZE;
+
+  for(int j = 0; j < width; j++, in += 4, out += 4)
+  {
+    const int fr = lut->frac[in[0]], fg = lut->frac[in[1]], fb = lut->frac[in[2]];
+    const int k = lut->idx[in[0]] * sr + lut->idx[in[1]] * sg + lut->idx[in[2]];
+
+    // tetrahedral interpolation, the cell is split into six tetrahedra along its main diagonal
+    const dt_simd4i c000 = _display_lut_node(lut, k);
+    const dt_simd4i c111 = _display_lut_node(lut, k + sr + sg + 1);
+    dt_simd4i c1, c2;
+    int w1, w2, w3;
+    if(fr >= fg && fg >= fb)
+    {
+      c1 = _display_lut_node(lut, k + sr);
+      c2 = _display_lut_node(lut, k + sr + sg);
+      w1 = fr, w2 = fg, w3 = fb;
+    }
+    else if(fr >= fb && fb >= fg)
+    {
+      c1 = _display_lut_node(lut, k + sr);
+      c2 = _display_lut_node(lut, k + sr + 1);
+      w1 = fr, w2 = fb, w3 = fg;
+    }
+    else if(fb >= fr && fr >= fg)
+    {
+      c1 = _display_lut_node(lut, k + 1);
+      c2 = _display_lut_node(lut, k + sr + 1);
+      w1 = fb, w2 = fr, w3 = fg;
+    }
+    else if(fg >= fr && fr >= fb)
+    {
+      c1 = _display_lut_node(lut, k + sg);
+      c2 = _display_lut_node(lut, k + sr + sg);
+      w1 = fg, w2 = fr, w3 = fb;
+    }
+    else if(fg >= fb && fb >= fr)
+    {
+      c1 = _display_lut_node(lut, k + sg);
+      c2 = _display_lut_node(lut, k + sg + 1);
+      w1 = fg, w2 = fb, w3 = fr;
+    }
+    else
+    {
+      c1 = _display_lut_node(lut, k + 1);
+      c2 = _display_lut_node(lut, k + sg + 1);
+      w1 = fb, w2 = fg, w3 = fr;
+    }
+
+    const dt_simd4i v = (c000 << 8) + (c1 - c000) * w1 + (c2 - c1) * w2 + (c111 - c2) * w3 + (1 << 15);
+    for(int c = 0; c < 3; c++) out[c] = v[c] >> 16;
+  }
+}
+
+
 // this function is basically thread safe, at least when not called on the global darktable.color_profiles
 static void _update_display_transforms(dt_colorspaces_t *self)
 {
@@ -1148,6 +1387,12 @@ static void _update_display_transforms(dt_colorspaces_t *self)
   if(self->transform_adobe_rgb_to_display) cmsDeleteTransform(self->transform_adobe_rgb_to_display);
   self->transform_adobe_rgb_to_display = NULL;
 
+  free(self->lut_srgb_to_display);
+  self->lut_srgb_to_display = NULL;
+
+  free(self->lut_adobe_rgb_to_display);
+  self->lut_adobe_rgb_to_display = NULL;
+
   const dt_colorspaces_color_profile_t *display_dt_profile = _get_profile(self, self->display_type,
                                                                           self->display_filename,
                                                                           DT_PROFILE_DIRECTION_DISPLAY);
@@ -1170,6 +1415,16 @@ static void _update_display_transforms(dt_colorspaces_t *self)
                                                             TYPE_BGRA_8,
                                                             self->display_intent,
                                                             0);
+
+  if(self->transform_srgb_to_display)
+    self->lut_srgb_to_display
+        = _build_display_lut(_get_profile(self, DT_COLORSPACE_SRGB, "", DT_PROFILE_DIRECTION_DISPLAY)->profile,
+                             display_profile, self->display_intent);
+
+  if(self->transform_adobe_rgb_to_display)
+    self->lut_adobe_rgb_to_display
+        = _build_display_lut(_get_profile(self, DT_COLORSPACE_ADOBERGB, "", DT_PROFILE_DIRECTION_DISPLAY)->profile,
+                             display_profile, self->display_intent);
 }
 
 static void _update_display2_transforms(dt_colorspaces_t *self)
@@ -1229,6 +1484,10 @@ static void _update_display_profile(guchar *tmp_data, gsize size, char *name, si
 
         // update cached transforms for color management of thumbnails
         dt_colorspaces_update_display_transforms();
+#ifdef HAVE_PRINT
+        // the printer LUT may be keyed on the profile we just freed
+        dt_printer_profile_cleanup();
+#endif
 
         break;
       }
@@ -1256,6 +1515,10 @@ static void _update_display2_profile(guchar *tmp_data, gsize size, char *name, s
 
         // update cached transforms for color management of thumbnails
         dt_colorspaces_update_display2_transforms();
+#ifdef HAVE_PRINT
+        // the printer LUT may be keyed on the profile we just freed
+        dt_printer_profile_cleanup();
+#endif
 
         break;
       }
@@ -1368,6 +1631,8 @@ dt_colorspaces_t *dt_colorspaces_init()
   _compute_prequantized_primaries(&D65xyY, &Rec709_Primaries, &Rec709_Primaries_Prequantized);
 
   pthread_rwlock_init(&res->xprofile_lock, NULL);
+  pthread_mutex_init(&res->matrix_cache_lock, NULL);
+  res->matrix_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _matrix_cache_entry_free);
 
   int in_pos = -1,
       out_pos = -1,
@@ -1567,6 +1832,12 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   if(self->transform_adobe_rgb_to_display) cmsDeleteTransform(self->transform_adobe_rgb_to_display);
   self->transform_adobe_rgb_to_display = NULL;
 
+  free(self->lut_srgb_to_display);
+  self->lut_srgb_to_display = NULL;
+
+  free(self->lut_adobe_rgb_to_display);
+  self->lut_adobe_rgb_to_display = NULL;
+
   if(self->transform_srgb_to_display2) cmsDeleteTransform(self->transform_srgb_to_display2);
   self->transform_srgb_to_display2 = NULL;
 
@@ -1580,6 +1851,8 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   }
   g_list_free_full(self->profiles, free);
 
+  g_hash_table_destroy(self->matrix_cache);
+  pthread_mutex_destroy(&self->matrix_cache_lock);
   pthread_rwlock_destroy(&self->xprofile_lock);
   g_free(self->colord_profile_file);
   g_free(self->xprofile_data);
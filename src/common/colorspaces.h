@@ -101,6 +101,21 @@ typedef enum dt_colorspaces_profile_direction_t
                              | DT_PROFILE_DIRECTION_DISPLAY2
 } dt_colorspaces_profile_direction_t;
 
+/** the number of nodes per axis of a display lut */
+#define DT_COLORSPACES_DISPLAY_LUT_SIZE 33
+
+/** an 8 bit thumbnail-to-display transform sampled on a grid. the nodes are spaced more densely towards black,
+ * where display curves are steepest */
+typedef struct dt_colorspaces_display_lut_t
+{
+  // grid cell of each 8 bit input value, and its position in the cell in 1/256
+  uint8_t idx[256];
+  uint16_t frac[256];
+  // the transform at the nodes as b, g, r, 0 in 8.8 fixed point
+  uint16_t nodes[DT_COLORSPACES_DISPLAY_LUT_SIZE * DT_COLORSPACES_DISPLAY_LUT_SIZE
+                 * DT_COLORSPACES_DISPLAY_LUT_SIZE][4];
+} dt_colorspaces_display_lut_t;
+
 typedef struct dt_colorspaces_t
 {
   GList *profiles;
@@ -133,6 +148,14 @@ typedef struct dt_colorspaces_t
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
   cmsHTRANSFORM transform_srgb_to_display2, transform_adobe_rgb_to_display2;
 
+  // the two display transforms above sampled into 3d luts, see dt_colorspaces_display_lut_apply()
+  dt_colorspaces_display_lut_t *lut_srgb_to_display, *lut_adobe_rgb_to_display;
+
+  // matrices and tone curve luts extracted from matrix/shaper profiles, by profile contents, see
+  // dt_colorspaces_get_matrix_from_input_profile()
+  pthread_mutex_t matrix_cache_lock;
+  GHashTable *matrix_cache;
+
 } dt_colorspaces_t;
 
 typedef struct dt_colorspaces_color_profile_t
@@ -206,6 +229,11 @@ const char *dt_colorspaces_get_name(dt_colorspaces_color_profile_type_t type, co
 void rgb2hsl(const float rgb[3], float *h, float *s, float *l);
 void hsl2rgb(float rgb[3], float h, float s, float l);
 
+/** converts width 8 bit rgba pixels to bgra through one of the display luts of dt_colorspaces_t. it gives the
+ * same result as the matching 8 bit transform up to one level, without going through lcms2 per pixel */
+void dt_colorspaces_display_lut_apply(const dt_colorspaces_display_lut_t *const lut, const uint8_t *in,
+                                      uint8_t *out, const int width);
+
 /** trigger updating the display profile from the system settings (x atom, colord, ...) */
 void dt_colorspaces_set_display_profile(const dt_colorspaces_color_profile_type_t profile_type);
 /** get the profile described by type & filename.
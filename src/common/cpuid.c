@@ -44,6 +44,8 @@ dt_cpu_flags_t dt_detect_cpu_features()
   g_mutex_lock(&lock);
   if(__get_cpuid(0x00000000,&ax,&bx,&cx,&dx))
   {
+    const guint32 max_level = ax;
+
     /* Request for standard features */
     if(__get_cpuid(0x00000001,&ax,&bx,&cx,&dx))
     {
@@ -57,9 +59,18 @@ dt_cpu_flags_t dt_detect_cpu_features()
       if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
       if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
 
+      if(cx & 0x00001000) cpuflags |= CPU_FLAG_FMA;
       if(cx & 0x08000000) cpuflags |= CPU_FLAG_AVX;
     }
 
+    /* Request for structured extended features */
+    if(max_level >= 7)
+    {
+      __cpuid_count(0x00000007, 0, ax, bx, cx, dx);
+      if(bx & 0x00000020) cpuflags |= CPU_FLAG_AVX2;
+      if(bx & 0x00010000) cpuflags |= CPU_FLAG_AVX512F;
+    }
+
     /* Are there extensions? */
     if (__get_cpuid(0x80000000,&ax,&bx,&cx,&dx))
     {
@@ -28,6 +28,7 @@
 #include <sys/malloc.h>
 #endif
 
+#include "common/bilateral.h"
 #include "common/collection.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
@@ -43,15 +44,22 @@
 #include "common/file_location.h"
 #include "common/film.h"
 #include "common/grealpath.h"
+#include "common/heal.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
 #include "common/iop_order.h"
 #include "common/l10n.h"
+#include "common/memory_governor.h"
+#include "common/metrics.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#ifdef HAVE_PRINT
+#include "common/printprof.h"
+#endif
+#include "common/profiling.h"
 #include "common/resource_limits.h"
 #include "common/undo.h"
 #include "control/conf.h"
@@ -61,6 +69,8 @@
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_hb.h"
+#include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "gui/guides.h"
 #include "gui/presets.h"
@@ -119,7 +129,7 @@ static int usage(const char *argv0)
   printf("  --configdir <user config directory>\n");
   printf("  -d {all,cache,camctl,camsupport,control,dev,fswatch,input,lighttable,\n");
   printf("      lua, masks,memory,nan,opencl,perf,pwstorage,print,sql,ioporder\n");
-  printf("      imageio\n");
+  printf("      imageio,tiling,tilingcalib}\n");
   printf("  --datadir <data directory>\n");
 #ifdef HAVE_OPENCL
   printf("  --disable-opencl\n");
@@ -138,6 +148,7 @@ static int usage(const char *argv0)
   printf("  --noiseprofiles <noiseprofiles json file>\n");
   printf("  -t <num openmp threads>\n");
   printf("  --tmpdir <tmp directory>\n");
+  printf("  --trace <chrome trace json file>\n");
   printf("  --version\n");
 #ifdef _WIN32
   printf("\n");
@@ -303,15 +314,25 @@ static void dt_codepaths_init()
   {
 #ifdef HAVE_BUILTIN_CPU_SUPPORTS
     darktable.codepath.SSE2 = (__builtin_cpu_supports("sse") && __builtin_cpu_supports("sse2"));
+    darktable.codepath.AVX2 = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+    darktable.codepath.AVX512 = __builtin_cpu_supports("avx512f");
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+    darktable.codepath.AVX2 = ((flags & (CPU_FLAG_AVX2)) && (flags & (CPU_FLAG_FMA)));
+    darktable.codepath.AVX512 = ((flags & (CPU_FLAG_AVX512F)) != 0);
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx2")) darktable.codepath.AVX2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx512")) darktable.codepath.AVX512 = 0;
+
+  // the wider sets build on top of each other, don't let them outlive the narrower ones
+  if(!darktable.codepath.SSE2) darktable.codepath.AVX2 = 0;
+  if(!darktable.codepath.AVX2) darktable.codepath.AVX512 = 0;
 
   // last: do we have any intrinsics sets enabled?
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
@@ -338,6 +359,14 @@ static void dt_codepaths_init()
   }
 }
 
+// report the time spent in one phase of dt_init() with -d perf and return the start of the next one
+static double _init_phase(const char *phase, const double start)
+{
+  const double now = dt_get_wtime();
+  dt_print(DT_DEBUG_PERF, "[init] %s took %.3f secs\n", phase, now - start);
+  return now;
+}
+
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
 {
   double start_wtime = dt_get_wtime();
@@ -446,7 +475,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_pthread_mutex_init(&(darktable.dev_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.capabilities_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.exiv2_threadsafe), NULL);
-  dt_pthread_mutex_init(&(darktable.readFile_mutex), NULL);
+  for(int k = 0; k < DT_READFILE_LOCKS; k++)
+  {
+    dt_pthread_mutex_init(&(darktable.readFile_mutex[k]), NULL);
+  }
   darktable.control = (dt_control_t *)calloc(1, sizeof(dt_control_t));
 
   // database
@@ -472,6 +504,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 #ifdef _OPENMP
   darktable.num_openmp_threads = omp_get_num_procs();
 #endif
+  gboolean threads_from_command = FALSE;
   darktable.unmuted = 0;
   GSList *config_override = NULL;
   for(int k = 1; k < argc; k++)
@@ -588,6 +621,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
         argv[k-1] = NULL;
         argv[k] = NULL;
       }
+      else if(!strcmp(argv[k], "--trace") && argc > k + 1)
+      {
+        dt_trace_init(argv[++k]);
+        argv[k-1] = NULL;
+        argv[k] = NULL;
+      }
       else if(!strcmp(argv[k], "--configdir") && argc > k + 1)
       {
         configdir_from_command = argv[++k];
@@ -610,7 +649,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
       else if(argv[k][1] == 'd' && argc > k + 1)
       {
         if(!strcmp(argv[k + 1], "all"))
-          darktable.unmuted = 0xffffffff; // enable all debug information
+          darktable.unmuted = 0xffffffff & ~DT_DEBUG_TILING_CALIBRATE; // enable all debug information
         else if(!strcmp(argv[k + 1], "cache"))
           darktable.unmuted |= DT_DEBUG_CACHE; // enable debugging for lib/film/cache module
         else if(!strcmp(argv[k + 1], "control"))
@@ -647,7 +686,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
           darktable.unmuted |= DT_DEBUG_IOPORDER; // iop order information are reported on console
         else if(!strcmp(argv[k + 1], "imageio")) {
           darktable.unmuted |= DT_DEBUG_IMAGEIO; // image importing or exporting mesages on console
-        } else
+        }
+        else if(!strcmp(argv[k + 1], "tiling"))
+          darktable.unmuted |= DT_DEBUG_TILING; // tile plans and their overhead
+        else if(!strcmp(argv[k + 1], "tilingcalib"))
+          darktable.unmuted |= DT_DEBUG_TILING | DT_DEBUG_TILING_CALIBRATE; // measure what modules allocate
+        else
           return usage(argv[0]);
         k++;
         argv[k-1] = NULL;
@@ -656,6 +700,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
       else if(argv[k][1] == 't' && argc > k + 1)
       {
         darktable.num_openmp_threads = CLAMP(atol(argv[k + 1]), 1, 100);
+        threads_from_command = TRUE;
         printf("[dt_init] using %d threads for openmp parallel sections\n", darktable.num_openmp_threads);
         k++;
         argv[k-1] = NULL;
@@ -766,6 +811,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   }
   dt_loc_init_user_config_dir(configdir_from_command);
   dt_loc_init_user_cache_dir(cachedir_from_command);
+  double phase_start = _init_phase("command line and locations", start_wtime);
 
 #ifdef USE_LUA
   dt_lua_init_early(L);
@@ -783,8 +829,23 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_conf_init(darktable.conf, darktablerc, config_override);
   g_slist_free_full(config_override, g_free);
 
+  // the number of threads tuned for this machine, see dt_autotune_run()
+  if(!threads_from_command && dt_conf_get_int("openmp_threads") > 0)
+  {
+    darktable.num_openmp_threads = CLAMP(dt_conf_get_int("openmp_threads"), 1, 100);
+#ifdef _OPENMP
+    omp_set_num_threads(darktable.num_openmp_threads);
+#endif
+  }
+
+  // numa placement and huge pages of the large image buffers, pins the openmp threads if asked to
+  dt_configure_memory_policy();
+  // the caches register with it as they come up
+  dt_memory_governor_init();
+
   // set the interface language and prepare selection for prefs
   darktable.l10n = dt_l10n_init(init_gui);
+  phase_start = _init_phase("configuration", phase_start);
 
   // we need this REALLY early so that error messages can be shown, however after gtk_disable_setlocale
   if(init_gui)
@@ -819,11 +880,14 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     }
   }
 
+  phase_start = _init_phase("gtk", phase_start);
+
   // detect cpu features and decide which codepaths to enable
   dt_codepaths_init();
 
   // get the list of color profiles
   darktable.color_profiles = dt_colorspaces_init();
+  phase_start = _init_phase("color profiles", phase_start);
 
   // initialize the database
   darktable.db = dt_database_init(dbfilename_from_command, load_data, init_gui);
@@ -868,6 +932,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   //db maintenance on startup (if configured to do so)
   dt_database_maybe_maintenance(darktable.db, init_gui, FALSE);
 
+  phase_start = _init_phase("database", phase_start);
+
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
@@ -893,6 +959,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     dt_pthread_mutex_init(&darktable.control->run_mutex, NULL);
   }
 
+  phase_start = _init_phase("control", phase_start);
+
   // initialize collection query
   darktable.collection = dt_collection_new(NULL);
 
@@ -920,12 +988,16 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.opencl = (dt_opencl_t *)calloc(1, sizeof(dt_opencl_t));
 #ifdef HAVE_OPENCL
   dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics);
+  // without a gui there is nothing to keep responsive, exports would just run on the cpu meanwhile
+  if(!init_gui) dt_opencl_wait_for_programs();
 #endif
 
+  phase_start = _init_phase("opencl", phase_start);
+
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
-  darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
+  dt_noiseprofile_init(noiseprofiles_from_command);
 
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
@@ -935,6 +1007,17 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  // optional cache for early module output shared by all interactive pipes
+  if(init_gui && dt_conf_get_bool("darkroom_shared_cache"))
+  {
+    darktable.pixelpipe_cache = (dt_dev_pixelpipe_shared_cache_t *)calloc(1, sizeof(dt_dev_pixelpipe_shared_cache_t));
+    dt_dev_pixelpipe_shared_cache_init(darktable.pixelpipe_cache, dt_dev_pixelpipe_darkroom_cache_memory());
+  }
+
+  phase_start = _init_phase("caches", phase_start);
+
+  dt_metrics_init();
+
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
@@ -952,6 +1035,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   else
     darktable.gui = NULL;
 
+  phase_start = _init_phase("gui", phase_start);
+
   darktable.view_manager = (dt_view_manager_t *)calloc(1, sizeof(dt_view_manager_t));
   dt_view_manager_init(darktable.view_manager);
 
@@ -962,9 +1047,13 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     return 1;
   }
 
+  phase_start = _init_phase("views", phase_start);
+
   darktable.imageio = (dt_imageio_t *)calloc(1, sizeof(dt_imageio_t));
   dt_imageio_init(darktable.imageio);
 
+  phase_start = _init_phase("imageio modules", phase_start);
+
   // load default iop order
   darktable.iop_order_list = dt_ioppr_get_iop_order_list(0, FALSE);
   // load iop order rules
@@ -984,6 +1073,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // set up the list of exiv2 metadata
   dt_exif_set_exiv2_taglist();
 
+  phase_start = _init_phase("processing modules", phase_start);
+
   if(init_gui)
   {
 #ifdef HAVE_GPHOTO2
@@ -1020,6 +1111,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     darktable.undo = dt_undo_init();
   }
 
+  phase_start = _init_phase("utility modules and shortcuts", phase_start);
+
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
     fprintf(stderr, "[memory] after successful startup\n");
@@ -1028,10 +1121,13 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   dt_image_local_copy_synch();
 
+  phase_start = _init_phase("local copies", phase_start);
+
 /* init lua last, since it's user made stuff it must be in the real environment */
 #ifdef USE_LUA
   dt_lua_init(darktable.lua_state.state, lua_command);
 #endif
+  phase_start = _init_phase("lua", phase_start);
 
   if(init_gui)
   {
@@ -1094,7 +1190,17 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     dt_control_crawler_show_image_list(changed_xmp_files);
   }
 
-  dt_print(DT_DEBUG_CONTROL, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
+  // free pages found by the maintenance check at startup are given back once everything is up,
+  // as are snapshots of the databases written
+  if(init_gui)
+  {
+    dt_database_start_maintenance_job(darktable.db);
+    dt_database_start_snapshot_job(darktable.db);
+  }
+
+  _init_phase("initial view", phase_start);
+
+  dt_print(DT_DEBUG_CONTROL | DT_DEBUG_PERF, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
 
   return 0;
 }
@@ -1122,6 +1228,8 @@ void dt_cleanup()
     dt_lib_cleanup(darktable.lib);
     free(darktable.lib);
   }
+  // no jobs left that could still record something, and the caches it reports on are still there
+  dt_metrics_cleanup();
 #ifdef USE_LUA
   dt_lua_finalize();
 #endif
@@ -1133,22 +1241,38 @@ void dt_cleanup()
     free(darktable.imageio);
     free(darktable.gui);
   }
+  // the job system is gone, write what the bulk edits left for it
+  dt_image_synch_xmps_flush();
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  if(darktable.pixelpipe_cache)
+  {
+    dt_dev_pixelpipe_shared_cache_cleanup(darktable.pixelpipe_cache);
+    free(darktable.pixelpipe_cache);
+    darktable.pixelpipe_cache = NULL;
+  }
+  dt_bilateral_cache_cleanup();
+  dt_gui_presets_cleanup();
+  dt_tiling_calibration_cleanup();
+  dt_memory_governor_cleanup();
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
     free(darktable.control);
     dt_undo_cleanup(darktable.undo);
   }
+#ifdef HAVE_PRINT
+  dt_printer_profile_cleanup();
+#endif
   dt_colorspaces_cleanup(darktable.color_profiles);
   dt_conf_cleanup(darktable.conf);
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
   free(darktable.points);
   dt_iop_unload_modules_so();
+  dt_heal_cleanup();
   g_list_free_full(darktable.iop_order_list, free);
   darktable.iop_order_list = NULL;
   g_list_free_full(darktable.iop_order_rules, free);
@@ -1184,9 +1308,13 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.dev_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.capabilities_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.exiv2_threadsafe));
-  dt_pthread_mutex_destroy(&(darktable.readFile_mutex));
+  for(int k = 0; k < DT_READFILE_LOCKS; k++)
+  {
+    dt_pthread_mutex_destroy(&(darktable.readFile_mutex[k]));
+  }
 
   dt_exif_cleanup();
+  dt_trace_cleanup();
 }
 
 void dt_print(dt_debug_thread_t thread, const char *msg, ...)
@@ -1214,18 +1342,66 @@ void dt_gettime(char *datetime, size_t datetime_len)
   dt_gettime_t(datetime, datetime_len, time(NULL));
 }
 
+// bookkeeping of dt_alloc_align() for the tiling calibration. free() does not know the size of a
+// block, so the sizes are kept in a table while -d tilingcalib runs.
+static GMutex _alloc_track_lock;
+static GHashTable *_alloc_track_sizes = NULL;
+static size_t _alloc_track_in_use = 0;
+static size_t _alloc_track_peak = 0;
+
+static void _alloc_track(void *ptr, const size_t size)
+{
+  g_mutex_lock(&_alloc_track_lock);
+  if(!_alloc_track_sizes) _alloc_track_sizes = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_hash_table_insert(_alloc_track_sizes, ptr, GSIZE_TO_POINTER(size));
+  _alloc_track_in_use += size;
+  _alloc_track_peak = MAX(_alloc_track_peak, _alloc_track_in_use);
+  g_mutex_unlock(&_alloc_track_lock);
+}
+
+static void _alloc_untrack(void *ptr)
+{
+  g_mutex_lock(&_alloc_track_lock);
+  gpointer size;
+  if(_alloc_track_sizes && g_hash_table_lookup_extended(_alloc_track_sizes, ptr, NULL, &size))
+  {
+    _alloc_track_in_use -= GPOINTER_TO_SIZE(size);
+    g_hash_table_remove(_alloc_track_sizes, ptr);
+  }
+  g_mutex_unlock(&_alloc_track_lock);
+}
+
+size_t dt_alloc_align_mark(void)
+{
+  g_mutex_lock(&_alloc_track_lock);
+  _alloc_track_peak = _alloc_track_in_use;
+  const size_t in_use = _alloc_track_in_use;
+  g_mutex_unlock(&_alloc_track_lock);
+  return in_use;
+}
+
+size_t dt_alloc_align_peak(void)
+{
+  g_mutex_lock(&_alloc_track_lock);
+  const size_t peak = _alloc_track_peak;
+  g_mutex_unlock(&_alloc_track_lock);
+  return peak;
+}
+
 void *dt_alloc_align(size_t alignment, size_t size)
 {
   const size_t aligned_size = dt_round_size(size, alignment);
+  void *ptr = NULL;
 #if defined(__FreeBSD_version) && __FreeBSD_version < 700013
-  return malloc(aligned_size);
+  ptr = malloc(aligned_size);
 #elif defined(_WIN32)
-  return _aligned_malloc(aligned_size, alignment);
+  ptr = _aligned_malloc(aligned_size, alignment);
 #else
-  void *ptr = NULL;
   if(posix_memalign(&ptr, alignment, aligned_size)) return NULL;
-  return ptr;
+  dt_memory_policy_apply(ptr, aligned_size);
 #endif
+  if(ptr && (darktable.unmuted & DT_DEBUG_TILING_CALIBRATE)) _alloc_track(ptr, aligned_size);
+  return ptr;
 }
 
 size_t dt_round_size(const size_t size, const size_t alignment)
@@ -1241,12 +1417,15 @@ size_t dt_round_size_sse(const size_t size)
 }
 
 
-#ifdef _WIN32
 void dt_free_align(void *mem)
 {
+  if(mem && (darktable.unmuted & DT_DEBUG_TILING_CALIBRATE)) _alloc_untrack(mem);
+#ifdef _WIN32
   _aligned_free(mem);
-}
+#else
+  free(mem);
 #endif
+}
 
 void dt_show_times(const dt_times_t *start, const char *prefix)
 {
@@ -104,6 +104,8 @@ typedef unsigned int u_int;
 /* TL;DR : use only on SIMD functions containing low-level paralellized/vectorized loops */
 #if __has_attribute(target_clones) && !defined(_WIN32) && defined(__SSE__)
 #define __DT_CLONE_TARGETS__ __attribute__((target_clones("default", "sse2", "sse3", "sse4.1", "sse4.2", "popcnt", "avx", "avx2", "avx512f", "fma4")))
+/* process_avx2() of the modules builds on the avx2/avx512f clones of their plain code */
+#define DT_HAVE_CLONE_TARGETS 1
 #else
 #define __DT_CLONE_TARGETS__
 #endif
@@ -187,6 +189,8 @@ static inline int dt_version()
 #define STR(x) STR_HELPER(x)
 
 #define DT_IMAGE_DBLOCKS 64
+// whole file reads are serialised per storage device, see dt_imageio_open_rawspeed()
+#define DT_READFILE_LOCKS 16
 
 struct dt_gui_gtk_t;
 struct dt_control_t;
@@ -223,11 +227,15 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_CAMERA_SUPPORT = 1 << 16,
   DT_DEBUG_IOPORDER = 1 << 17,
   DT_DEBUG_IMAGEIO = 1 << 18,
+  DT_DEBUG_TILING = 1 << 19,
+  DT_DEBUG_TILING_CALIBRATE = 1 << 20, // not debug output but a mode, see develop/tiling.h
 } dt_debug_thread_t;
 
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int AVX2 : 1;
+  unsigned int AVX512 : 1;
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
@@ -242,7 +250,6 @@ typedef struct darktable_t
   GList *iop_order_list;
   GList *iop_order_rules;
   GList *capabilities;
-  JsonParser *noiseprofile_parser;
   struct dt_conf_t *conf;
   struct dt_develop_t *develop;
   struct dt_lib_t *lib;
@@ -252,6 +259,7 @@ typedef struct darktable_t
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
   struct dt_image_cache_t *image_cache;
+  struct dt_dev_pixelpipe_shared_cache_t *pixelpipe_cache;
   struct dt_bauhaus_t *bauhaus;
   const struct dt_database_t *db;
   const struct dt_pwstorage_t *pwstorage;
@@ -270,7 +278,7 @@ typedef struct darktable_t
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
   dt_pthread_mutex_t exiv2_threadsafe;
-  dt_pthread_mutex_t readFile_mutex;
+  dt_pthread_mutex_t readFile_mutex[DT_READFILE_LOCKS];
   char *progname;
   char *datadir;
   char *plugindir;
@@ -301,13 +309,13 @@ void *dt_alloc_align(size_t alignment, size_t size);
 size_t dt_round_size(const size_t size, const size_t alignment);
 size_t dt_round_size_sse(const size_t size);
 
-#ifdef _WIN32
 void dt_free_align(void *mem);
 #define dt_free_align_ptr dt_free_align
-#else
-#define dt_free_align(A) free(A)
-#define dt_free_align_ptr free
-#endif
+
+// the bytes of dt_alloc_align() memory in use, and the most since the last mark. only counted
+// with -d tilingcalib, to measure what modules allocate in process().
+size_t dt_alloc_align_mark(void);
+size_t dt_alloc_align_peak(void);
 
 static inline void dt_lock_image(uint32_t imgid) ACQUIRE(darktable.db_image[imgid & (DT_IMAGE_DBLOCKS-1)])
 {
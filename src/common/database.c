@@ -23,6 +23,7 @@
 #include "common/database.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/dtpthread.h"
 #include "common/file_location.h"
 #include "common/iop_order.h"
 #include "common/styles.h"
@@ -44,9 +45,12 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 29
+#define CURRENT_DATABASE_VERSION_LIBRARY 34
 #define CURRENT_DATABASE_VERSION_DATA     6
 
+// read connections handed out at most, threads beyond that share the main connection
+#define DT_DATABASE_MAX_READERS 16
+
 typedef struct dt_database_t
 {
   gboolean lock_acquired;
@@ -60,10 +64,30 @@ typedef struct dt_database_t
   /* ondisk DB */
   sqlite3 *handle;
 
+  /* read-only connections to the same files, one per thread. only in WAL mode where they don't
+   * wait for the writer, NULL otherwise */
+  GHashTable *readers;
+  dt_pthread_mutex_t readers_mutex;
+
   gchar *error_message, *error_dbfilename;
   int error_other_pid;
+
+  /* free pages are left for the background maintenance job once the gui is up */
+  gboolean maintenance_pending;
 } dt_database_t;
 
+// pages given back to the file system per statement of the background maintenance, and the pause between
+// two of them so that the gui never waits long for the database
+#define DT_DATABASE_VACUUM_SLICE 64
+#define DT_DATABASE_VACUUM_PAUSE 50000
+// what's left of the free pages at closing time is only worked on for so many seconds
+#define DT_DATABASE_VACUUM_CLOSE_BUDGET 1.0
+// below that, rewriting the databases doesn't pay off whatever the fragmentation
+#define DT_DATABASE_MAINTENANCE_MIN_SIZE (1 << 20)
+// pages copied per step of an online snapshot, and the pause after each of them
+#define DT_DATABASE_SNAPSHOT_PAGES 32
+#define DT_DATABASE_SNAPSHOT_PAUSE 10
+
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
@@ -1611,6 +1635,135 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 29;
   }
+  else if(version == 29)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    // indexes covering the subqueries of the collection filters, so they don't scan the whole table
+    TRY_EXEC("DROP INDEX IF EXISTS main.tagged_images_tagid_index",
+             "[init] can't drop index tagged_images_tagid_index\n");
+    TRY_EXEC("CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)",
+             "[init] can't create index tagged_images_tagid_index\n");
+    TRY_EXEC("CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)",
+             "[init] can't create index color_labels_color_index\n");
+    TRY_EXEC("CREATE INDEX main.metadata_key_index ON meta_data (key, id, value)",
+             "[init] can't create index metadata_key_index\n");
+    TRY_EXEC("CREATE INDEX main.module_order_version_index ON module_order (version, imgid)",
+             "[init] can't create index module_order_version_index\n");
+    TRY_EXEC("CREATE INDEX main.history_operation_index ON history (operation, enabled, imgid)",
+             "[init] can't create index history_operation_index\n");
+    TRY_EXEC("CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)",
+             "[init] can't create index images_datetime_taken_index\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 30;
+  }
+  else if(version == 30)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    // state of the folder when the crawler last found nothing to report, see dt_control_crawler_run()
+    TRY_EXEC("ALTER TABLE main.film_rolls ADD COLUMN crawler_mtime INTEGER",
+             "[init] can't add `crawler_mtime' column to film_rolls table in database\n");
+    TRY_EXEC("ALTER TABLE main.film_rolls ADD COLUMN crawler_checksum INTEGER",
+             "[init] can't add `crawler_checksum' column to film_rolls table in database\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 31;
+  }
+  else if(version == 31)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    // number of images per tag, kept up to date by triggers so the tagging and collect modules don't have
+    // to count tagged_images on every refresh
+    TRY_EXEC("CREATE TABLE main.tag_counts (tagid INTEGER PRIMARY KEY, count INTEGER NOT NULL)",
+             "[init] can't create table tag_counts\n");
+    TRY_EXEC("INSERT INTO main.tag_counts (tagid, count)"
+             " SELECT tagid, COUNT(*) FROM main.tagged_images GROUP BY tagid",
+             "[init] can't populate table tag_counts\n");
+    TRY_EXEC("CREATE TRIGGER main.tag_counts_attach AFTER INSERT ON tagged_images"
+             " BEGIN"
+             "   INSERT OR IGNORE INTO tag_counts (tagid, count) VALUES (new.tagid, 0);"
+             "   UPDATE tag_counts SET count = count + 1 WHERE tagid = new.tagid;"
+             " END",
+             "[init] can't create trigger tag_counts_attach\n");
+    TRY_EXEC("CREATE TRIGGER main.tag_counts_detach AFTER DELETE ON tagged_images"
+             " BEGIN"
+             "   UPDATE tag_counts SET count = count - 1 WHERE tagid = old.tagid;"
+             "   DELETE FROM tag_counts WHERE tagid = old.tagid AND count <= 0;"
+             " END",
+             "[init] can't create trigger tag_counts_detach\n");
+    TRY_EXEC("CREATE TRIGGER main.tag_counts_update AFTER UPDATE OF tagid ON tagged_images"
+             " BEGIN"
+             "   UPDATE tag_counts SET count = count - 1 WHERE tagid = old.tagid;"
+             "   DELETE FROM tag_counts WHERE tagid = old.tagid AND count <= 0;"
+             "   INSERT OR IGNORE INTO tag_counts (tagid, count) VALUES (new.tagid, 0);"
+             "   UPDATE tag_counts SET count = count + 1 WHERE tagid = new.tagid;"
+             " END",
+             "[init] can't create trigger tag_counts_update\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 32;
+  }
+  else if(version == 32)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    // bounding box lookups of the map view, see _view_map_build_main_query()
+    TRY_EXEC("CREATE INDEX main.images_geoloc_index ON images (longitude, latitude)",
+             "[init] can't create index images_geoloc_index\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 33;
+  }
+  else if(version == 33)
+  {
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    // number of images per day taken, kept up to date by triggers so the timeline doesn't have to group
+    // the whole images table on every redraw
+    TRY_EXEC("CREATE TABLE main.images_day_counts (day CHAR(10) PRIMARY KEY, count INTEGER NOT NULL)",
+             "[init] can't create table images_day_counts\n");
+    TRY_EXEC("INSERT INTO main.images_day_counts (day, count)"
+             " SELECT SUBSTR(datetime_taken, 1, 10), COUNT(*) FROM main.images"
+             " WHERE LENGTH(datetime_taken) = 19 AND datetime_taken > '0001:01:01 00:00:00'"
+             " GROUP BY SUBSTR(datetime_taken, 1, 10)",
+             "[init] can't populate table images_day_counts\n");
+    TRY_EXEC("CREATE TRIGGER main.images_day_counts_insert AFTER INSERT ON images"
+             " WHEN LENGTH(new.datetime_taken) = 19 AND new.datetime_taken > '0001:01:01 00:00:00'"
+             " BEGIN"
+             "   INSERT OR IGNORE INTO images_day_counts (day, count) VALUES (SUBSTR(new.datetime_taken, 1, 10), 0);"
+             "   UPDATE images_day_counts SET count = count + 1 WHERE day = SUBSTR(new.datetime_taken, 1, 10);"
+             " END",
+             "[init] can't create trigger images_day_counts_insert\n");
+    TRY_EXEC("CREATE TRIGGER main.images_day_counts_delete AFTER DELETE ON images"
+             " WHEN LENGTH(old.datetime_taken) = 19 AND old.datetime_taken > '0001:01:01 00:00:00'"
+             " BEGIN"
+             "   UPDATE images_day_counts SET count = count - 1 WHERE day = SUBSTR(old.datetime_taken, 1, 10);"
+             "   DELETE FROM images_day_counts WHERE day = SUBSTR(old.datetime_taken, 1, 10) AND count <= 0;"
+             " END",
+             "[init] can't create trigger images_day_counts_delete\n");
+    TRY_EXEC("CREATE TRIGGER main.images_day_counts_update_old AFTER UPDATE OF datetime_taken ON images"
+             " WHEN old.datetime_taken IS NOT new.datetime_taken"
+             "   AND LENGTH(old.datetime_taken) = 19 AND old.datetime_taken > '0001:01:01 00:00:00'"
+             " BEGIN"
+             "   UPDATE images_day_counts SET count = count - 1 WHERE day = SUBSTR(old.datetime_taken, 1, 10);"
+             "   DELETE FROM images_day_counts WHERE day = SUBSTR(old.datetime_taken, 1, 10) AND count <= 0;"
+             " END",
+             "[init] can't create trigger images_day_counts_update_old\n");
+    TRY_EXEC("CREATE TRIGGER main.images_day_counts_update_new AFTER UPDATE OF datetime_taken ON images"
+             " WHEN old.datetime_taken IS NOT new.datetime_taken"
+             "   AND LENGTH(new.datetime_taken) = 19 AND new.datetime_taken > '0001:01:01 00:00:00'"
+             " BEGIN"
+             "   INSERT OR IGNORE INTO images_day_counts (day, count) VALUES (SUBSTR(new.datetime_taken, 1, 10), 0);"
+             "   UPDATE images_day_counts SET count = count + 1 WHERE day = SUBSTR(new.datetime_taken, 1, 10);"
+             " END",
+             "[init] can't create trigger images_day_counts_update_new\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 34;
+  }
   else
     new_version = version; // should be the fallback so that calling code sees that we are in an infinite loop
 
@@ -1861,7 +2014,7 @@ static void _create_library_schema(dt_database_t *db)
                //                        "folder VARCHAR(1024), external_drive VARCHAR(1024))", //
                //                        FIXME: make sure to bump CURRENT_DATABASE_VERSION_LIBRARY and add a
                //                        case to _upgrade_library_schema_step when adding this!
-               "folder VARCHAR(1024) NOT NULL)",
+               "folder VARCHAR(1024) NOT NULL, crawler_mtime INTEGER, crawler_checksum INTEGER)",
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.film_rolls_folder_index ON film_rolls (folder)", NULL, NULL, NULL);
   ////////////////////////////// images
@@ -1886,6 +2039,46 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE INDEX main.images_film_id_index ON images (film_id)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.images_filename_index ON images (filename)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.image_position_index ON images (position)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_datetime_taken_index ON images (datetime_taken)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_geoloc_index ON images (longitude, latitude)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE main.images_day_counts (day CHAR(10) PRIMARY KEY, count INTEGER NOT NULL)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.images_day_counts_insert AFTER INSERT ON images"
+               " WHEN LENGTH(new.datetime_taken) = 19 AND new.datetime_taken > '0001:01:01 00:00:00'"
+               " BEGIN"
+               "   INSERT OR IGNORE INTO images_day_counts (day, count) VALUES (SUBSTR(new.datetime_taken, 1, 10), 0);"
+               "   UPDATE images_day_counts SET count = count + 1 WHERE day = SUBSTR(new.datetime_taken, 1, 10);"
+               " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.images_day_counts_delete AFTER DELETE ON images"
+               " WHEN LENGTH(old.datetime_taken) = 19 AND old.datetime_taken > '0001:01:01 00:00:00'"
+               " BEGIN"
+               "   UPDATE images_day_counts SET count = count - 1 WHERE day = SUBSTR(old.datetime_taken, 1, 10);"
+               "   DELETE FROM images_day_counts WHERE day = SUBSTR(old.datetime_taken, 1, 10) AND count <= 0;"
+               " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.images_day_counts_update_old AFTER UPDATE OF datetime_taken ON images"
+               " WHEN old.datetime_taken IS NOT new.datetime_taken"
+               "   AND LENGTH(old.datetime_taken) = 19 AND old.datetime_taken > '0001:01:01 00:00:00'"
+               " BEGIN"
+               "   UPDATE images_day_counts SET count = count - 1 WHERE day = SUBSTR(old.datetime_taken, 1, 10);"
+               "   DELETE FROM images_day_counts WHERE day = SUBSTR(old.datetime_taken, 1, 10) AND count <= 0;"
+               " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.images_day_counts_update_new AFTER UPDATE OF datetime_taken ON images"
+               " WHEN old.datetime_taken IS NOT new.datetime_taken"
+               "   AND LENGTH(new.datetime_taken) = 19 AND new.datetime_taken > '0001:01:01 00:00:00'"
+               " BEGIN"
+               "   INSERT OR IGNORE INTO images_day_counts (day, count) VALUES (SUBSTR(new.datetime_taken, 1, 10), 0);"
+               "   UPDATE images_day_counts SET count = count + 1 WHERE day = SUBSTR(new.datetime_taken, 1, 10);"
+               " END",
+               NULL, NULL, NULL);
 
   ////////////////////////////// selected_images
   sqlite3_exec(db->handle, "CREATE TABLE main.selected_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
@@ -1897,6 +2090,8 @@ static void _create_library_schema(dt_database_t *db)
       "blendop_params BLOB, blendop_version INTEGER, multi_priority INTEGER, multi_name VARCHAR(256))",
       NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.history_imgid_index ON history (imgid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.history_operation_index ON history (operation, enabled, imgid)",
+               NULL, NULL, NULL);
   ////////////////////////////// masks history
   sqlite3_exec(db->handle,
                "CREATE TABLE main.masks_history (imgid INTEGER, num INTEGER, formid INTEGER, form INTEGER, name VARCHAR(256), "
@@ -1910,17 +2105,48 @@ static void _create_library_schema(dt_database_t *db)
   ////////////////////////////// tagged_images
   sqlite3_exec(db->handle, "CREATE TABLE main.tagged_images (imgid INTEGER, tagid INTEGER, "
                            "PRIMARY KEY (imgid, tagid))", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid, imgid)", NULL,
+               NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE main.tag_counts (tagid INTEGER PRIMARY KEY, count INTEGER NOT NULL)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.tag_counts_attach AFTER INSERT ON tagged_images"
+               " BEGIN"
+               "   INSERT OR IGNORE INTO tag_counts (tagid, count) VALUES (new.tagid, 0);"
+               "   UPDATE tag_counts SET count = count + 1 WHERE tagid = new.tagid;"
+               " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.tag_counts_detach AFTER DELETE ON tagged_images"
+               " BEGIN"
+               "   UPDATE tag_counts SET count = count - 1 WHERE tagid = old.tagid;"
+               "   DELETE FROM tag_counts WHERE tagid = old.tagid AND count <= 0;"
+               " END",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle,
+               "CREATE TRIGGER main.tag_counts_update AFTER UPDATE OF tagid ON tagged_images"
+               " BEGIN"
+               "   UPDATE tag_counts SET count = count - 1 WHERE tagid = old.tagid;"
+               "   DELETE FROM tag_counts WHERE tagid = old.tagid AND count <= 0;"
+               "   INSERT OR IGNORE INTO tag_counts (tagid, count) VALUES (new.tagid, 0);"
+               "   UPDATE tag_counts SET count = count + 1 WHERE tagid = new.tagid;"
+               " END",
+               NULL, NULL, NULL);
   ////////////////////////////// color_labels
   sqlite3_exec(db->handle, "CREATE TABLE main.color_labels (imgid INTEGER, color INTEGER)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.color_labels_idx ON color_labels (imgid, color)", NULL, NULL,
                NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)", NULL, NULL,
+               NULL);
   ////////////////////////////// meta_data
   sqlite3_exec(db->handle, "CREATE TABLE main.meta_data (id INTEGER, key INTEGER, value VARCHAR)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index ON meta_data (id, key)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_key_index ON meta_data (key, id, value)", NULL, NULL, NULL);
 
   sqlite3_exec(db->handle, "CREATE TABLE main.module_order (imgid INTEGER PRIMARY KEY, version INTEGER, iop_list VARCHAR)",
                NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.module_order_version_index ON module_order (version, imgid)", NULL,
+               NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE main.history_hash (imgid INTEGER PRIMARY KEY, "
                "basic_hash BLOB, auto_hash BLOB, current_hash BLOB, mipmap_hash BLOB)",
                NULL, NULL, NULL);
@@ -1982,6 +2208,7 @@ static void _create_memory_schema(dt_database_t *db)
       "CREATE TABLE memory.collected_images (rowid INTEGER PRIMARY KEY AUTOINCREMENT, imgid INTEGER)", NULL,
       NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.tmp_selection (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE memory.removed_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.taglist "
                            "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT IGNORE, count INTEGER)",
                NULL, NULL, NULL);
@@ -2369,6 +2596,54 @@ void dt_database_backup(const char *filename)
   g_free(backup);
 }
 
+// switches all attached databases to WAL, returns FALSE if sqlite refused
+static gboolean _set_wal(sqlite3 *handle)
+{
+  sqlite3_stmt *stmt;
+  gboolean wal = FALSE;
+  sqlite3_prepare_v2(handle, "PRAGMA journal_mode = WAL", -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) wal = !g_strcmp0((const char *)sqlite3_column_text(stmt, 0), "wal");
+  sqlite3_finalize(stmt);
+  if(!wal) fprintf(stderr, "[init] can't switch the database to write-ahead logging, using a memory journal\n");
+  return wal;
+}
+
+static void _close_reader(gpointer data)
+{
+  if(data) sqlite3_close((sqlite3 *)data);
+}
+
+static sqlite3 *_open_reader(const dt_database_t *db)
+{
+  sqlite3 *handle = NULL;
+  // only ever used by the thread it got handed to, so sqlite doesn't need to lock it
+  if(sqlite3_open_v2(db->dbfilename_library, &handle, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL)
+     != SQLITE_OK)
+  {
+    fprintf(stderr, "[db] can't open a read connection to `%s': %s\n", db->dbfilename_library,
+            sqlite3_errmsg(handle));
+    sqlite3_close(handle);
+    return NULL;
+  }
+
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(handle, "ATTACH DATABASE ?1 AS data", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, db->dbfilename_data, -1, SQLITE_TRANSIENT);
+  const int rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if(rc != SQLITE_DONE)
+  {
+    fprintf(stderr, "[db] can't attach `%s' to a read connection: %s\n", db->dbfilename_data,
+            sqlite3_errmsg(handle));
+    sqlite3_close(handle);
+    return NULL;
+  }
+
+  // a checkpoint of the writer can briefly lock the readers out
+  sqlite3_busy_timeout(handle, 1000);
+  return handle;
+}
+
 dt_database_t *dt_database_init(const char *alternative, const gboolean load_data, const gboolean has_gui)
 {
   /*  set the threading mode to Serialized */
@@ -2493,10 +2768,27 @@ start:
   }
   sqlite3_finalize(stmt);
 
-  // some sqlite3 config
-  sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  // some sqlite3 config. the page size has to be set before a new database switches to WAL.
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
+  // new databases start out incremental right away, existing ones switch with their next full vacuum
+  if(dt_conf_get_bool("database/incremental_vacuum"))
+  {
+    sqlite3_exec(db->handle, "PRAGMA main.auto_vacuum = INCREMENTAL", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA data.auto_vacuum = INCREMENTAL", NULL, NULL, NULL);
+  }
+  // WAL only makes sense for files, an in-memory database couldn't be shared with the readers anyway
+  if(dt_conf_get_bool("database/wal") && g_strcmp0(dbfilename_library, ":memory:")
+     && g_strcmp0(dbfilename_data, ":memory:") && _set_wal(db->handle))
+  {
+    sqlite3_exec(db->handle, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+    db->readers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _close_reader);
+    dt_pthread_mutex_init(&db->readers_mutex, NULL);
+  }
+  else
+  {
+    sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  }
 
   /* now that we got functional databases that are locked for us we can make sure that the schema is set up */
 
@@ -2726,6 +3018,11 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  if(db->readers)
+  {
+    g_hash_table_destroy(db->readers);
+    dt_pthread_mutex_destroy(&((dt_database_t *)db)->readers_mutex);
+  }
   sqlite3_close(db->handle);
   if (db->lockfile_data)
   {
@@ -2749,6 +3046,43 @@ sqlite3 *dt_database_get(const dt_database_t *db)
   return db ? db->handle : NULL;
 }
 
+gboolean dt_database_start_transaction(const dt_database_t *db)
+{
+  // nested bulk edits simply become part of the outer transaction
+  if(!db || !sqlite3_get_autocommit(db->handle)) return FALSE;
+  return sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL) == SQLITE_OK;
+}
+
+void dt_database_release_transaction(const dt_database_t *db, const gboolean started)
+{
+  if(db && started) sqlite3_exec(db->handle, "COMMIT TRANSACTION", NULL, NULL, NULL);
+}
+
+sqlite3 *dt_database_get_reader(const dt_database_t *db)
+{
+  if(!db) return NULL;
+  // what an open transaction changed is only visible through the main connection
+  if(!db->readers || !sqlite3_get_autocommit(db->handle)) return db->handle;
+
+  dt_database_t *d = (dt_database_t *)db;
+  GThread *self = g_thread_self();
+  sqlite3 *reader = NULL;
+  gpointer found = NULL;
+
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  if(g_hash_table_lookup_extended(d->readers, self, NULL, &found))
+    reader = (sqlite3 *)found;
+  else if(g_hash_table_size(d->readers) < DT_DATABASE_MAX_READERS)
+  {
+    // a failed open is remembered as NULL so we don't retry on every query
+    reader = _open_reader(d);
+    g_hash_table_insert(d->readers, self, reader);
+  }
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+
+  return reader ? reader : db->handle;
+}
+
 const gchar *dt_database_get_path(const struct dt_database_t *db)
 {
   return db->dbfilename_library;
@@ -2876,7 +3210,201 @@ int _get_pragma_val(const struct dt_database_t *db, const char* pragma)
   return val;
 }
 
-void dt_database_maybe_maintenance(const struct dt_database_t *db, const gboolean has_gui, const gboolean closing_time)
+// gives the free pages of one schema back in slices, until none are left, the job is cancelled or the
+// deadline passed. returns the number of pages freed.
+static int _incremental_vacuum(const struct dt_database_t *db, const char *schema, dt_job_t *job,
+                               const double deadline)
+{
+  gchar *free_pragma = g_strdup_printf("%s.freelist_count", schema);
+  gchar *query = g_strdup_printf("PRAGMA %s.incremental_vacuum(%d)", schema, DT_DATABASE_VACUUM_SLICE);
+  const int start_count = _get_pragma_val(db, free_pragma);
+  int free_count = start_count;
+
+  while(free_count > 0)
+  {
+    if(job && dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) break;
+    if(deadline > 0.0 && dt_get_wtime() > deadline) break;
+
+    sqlite3_exec(db->handle, query, NULL, NULL, NULL);
+    const int count = _get_pragma_val(db, free_pragma);
+    // nothing moved, better not spin on it
+    if(count < 0 || count >= free_count) break;
+    free_count = count;
+
+    if(job) g_usleep(DT_DATABASE_VACUUM_PAUSE);
+  }
+
+  g_free(query);
+  g_free(free_pragma);
+  return start_count - MAX(free_count, 0);
+}
+
+static void _incremental_maintenance(const struct dt_database_t *db, dt_job_t *job, const double deadline)
+{
+  const double start = dt_get_wtime();
+  const int main_freed = _incremental_vacuum(db, "main", job, deadline);
+  const int data_freed = _incremental_vacuum(db, "data", job, deadline);
+  const guint64 size = (guint64)main_freed * _get_pragma_val(db, "main.page_size")
+                       + (guint64)data_freed * _get_pragma_val(db, "data.page_size");
+  dt_print(DT_DEBUG_SQL | DT_DEBUG_PERF,
+           "[db maintenance] incremental vacuum freed %d main and %d data pages (%" G_GUINT64_FORMAT
+           " bytes) in %.3f secs.\n",
+           main_freed, data_freed, size, dt_get_wtime() - start);
+}
+
+static int32_t _maintenance_job_run(dt_job_t *job)
+{
+  _incremental_maintenance(darktable.db, job, 0.0);
+  return 0;
+}
+
+void dt_database_start_maintenance_job(struct dt_database_t *db)
+{
+  if(!db->maintenance_pending) return;
+  db->maintenance_pending = FALSE;
+
+  dt_job_t *job = dt_control_job_create(&_maintenance_job_run, "database maintenance");
+  if(job) dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
+// copies schema of the open databases into a compressed file next to filename, while darktable keeps using them
+static gboolean _snapshot_schema(const struct dt_database_t *db, const char *schema, const char *filename,
+                                 const char *stamp, dt_job_t *job)
+{
+  gchar *tmp = g_strdup_printf("%s-snp-%s.tmp", filename, stamp);
+  gchar *snapshot = g_strdup_printf("%s-snp-%s.gz", filename, stamp);
+  gboolean res = FALSE;
+
+  sqlite3 *dest = NULL;
+  if(sqlite3_open(tmp, &dest) == SQLITE_OK)
+  {
+    sqlite3_backup *backup = sqlite3_backup_init(dest, "main", db->handle, schema);
+    if(backup)
+    {
+      // small batches only hold the database for a moment, writes in between are picked up by the backup
+      int rc;
+      do
+      {
+        if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) break;
+        rc = sqlite3_backup_step(backup, DT_DATABASE_SNAPSHOT_PAGES);
+        if(rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) sqlite3_sleep(DT_DATABASE_SNAPSHOT_PAUSE);
+      } while(rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+      res = sqlite3_backup_finish(backup) == SQLITE_OK && rc == SQLITE_DONE;
+    }
+  }
+  sqlite3_close(dest);
+
+  if(res)
+  {
+    GError *gerror = NULL;
+    GFile *src = g_file_new_for_path(tmp);
+    GFile *dst = g_file_new_for_path(snapshot);
+    GFileInputStream *in = g_file_read(src, NULL, &gerror);
+    GFileOutputStream *out = in ? g_file_replace(dst, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, &gerror) : NULL;
+    if(out)
+    {
+      GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+      GOutputStream *zout = g_converter_output_stream_new(G_OUTPUT_STREAM(out), G_CONVERTER(compressor));
+      res = g_output_stream_splice(zout, G_INPUT_STREAM(in),
+                                   G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                   NULL, &gerror) >= 0;
+      g_object_unref(zout);
+      g_object_unref(compressor);
+      g_object_unref(out);
+    }
+    else
+      res = FALSE;
+    if(in) g_object_unref(in);
+    if(!res) g_unlink(snapshot);
+    if(gerror)
+    {
+      fprintf(stderr, "[db snapshot] %s: %s\n", snapshot, gerror->message);
+      g_error_free(gerror);
+    }
+    g_object_unref(src);
+    g_object_unref(dst);
+  }
+  g_unlink(tmp);
+
+  if(!res) fprintf(stderr, "[db snapshot] couldn't write %s\n", snapshot);
+  g_free(tmp);
+  g_free(snapshot);
+  return res;
+}
+
+// removes all but the newest keep snapshots of filename. the time stamps in their names sort by age.
+static void _snapshot_prune(const char *filename, const int keep)
+{
+  gchar *dirname = g_path_get_dirname(filename);
+  gchar *basename = g_path_get_basename(filename);
+  gchar *prefix = g_strdup_printf("%s-snp-", basename);
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  GList *snapshots = NULL;
+  if(dir)
+  {
+    const gchar *entry;
+    while((entry = g_dir_read_name(dir)))
+      if(g_str_has_prefix(entry, prefix) && g_str_has_suffix(entry, ".gz"))
+        snapshots = g_list_prepend(snapshots, g_strdup(entry));
+    g_dir_close(dir);
+  }
+
+  snapshots = g_list_sort(snapshots, (GCompareFunc)g_strcmp0);
+  const int drop = (int)g_list_length(snapshots) - keep;
+  int k = 0;
+  for(GList *l = snapshots; l && k < drop; l = g_list_next(l), k++)
+  {
+    gchar *path = g_build_filename(dirname, (gchar *)l->data, NULL);
+    g_unlink(path);
+    g_free(path);
+  }
+
+  g_list_free_full(snapshots, g_free);
+  g_free(prefix);
+  g_free(basename);
+  g_free(dirname);
+}
+
+static int32_t _snapshot_job_run(dt_job_t *job)
+{
+  const dt_database_t *db = darktable.db;
+  const double start = dt_get_wtime();
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(now, "%Y%m%d%H%M%S");
+
+  gboolean res = _snapshot_schema(db, "main", db->dbfilename_library, stamp, job)
+                 && _snapshot_schema(db, "data", db->dbfilename_data, stamp, job);
+  if(res)
+  {
+    dt_conf_set_int64("database/last_snapshot", g_date_time_to_unix(now));
+    const int keep = MAX(dt_conf_get_int("database/keep_snapshots"), 1);
+    _snapshot_prune(db->dbfilename_library, keep);
+    _snapshot_prune(db->dbfilename_data, keep);
+  }
+  dt_print(DT_DEBUG_SQL | DT_DEBUG_PERF, "[db snapshot] %s %s in %.3f secs\n", res ? "written" : "failed", stamp,
+           dt_get_wtime() - start);
+
+  g_free(stamp);
+  g_date_time_unref(now);
+  return 0;
+}
+
+void dt_database_start_snapshot_job(struct dt_database_t *db)
+{
+  const int interval = dt_conf_get_int("database/snapshot_interval");
+  if(interval <= 0 || !g_strcmp0(db->dbfilename_library, ":memory:") || !g_strcmp0(db->dbfilename_data, ":memory:"))
+    return;
+
+  GDateTime *now = g_date_time_new_now_local();
+  const gint64 age = g_date_time_to_unix(now) - dt_conf_get_int64("database/last_snapshot");
+  g_date_time_unref(now);
+  if(age < (gint64)interval * 24 * 60 * 60) return;
+
+  dt_job_t *job = dt_control_job_create(&_snapshot_job_run, "database snapshot");
+  if(job) dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
+void dt_database_maybe_maintenance(struct dt_database_t *db, const gboolean has_gui, const gboolean closing_time)
 {
   char *config = dt_conf_get_string("database/maintenance_check");
 
@@ -2918,9 +3446,15 @@ void dt_database_maybe_maintenance(const struct dt_database_t *db, const gboolea
   const int data_page_count = _get_pragma_val(db, "data.page_count");
   const int data_page_size = _get_pragma_val(db, "data.page_size");
 
+  // 0 none, 1 full, 2 incremental
+  const int main_auto_vacuum = _get_pragma_val(db, "main.auto_vacuum");
+  const int data_auto_vacuum = _get_pragma_val(db, "data.auto_vacuum");
+
   dt_print(DT_DEBUG_SQL,
-      "[db maintenance] main: [%d/%d pages], data: [%d/%d pages].\n",
-      main_free_count, main_page_count, data_free_count, data_page_count);
+      "[db maintenance] main: [%d/%d pages of %d bytes, auto_vacuum %d], data: [%d/%d pages of %d bytes,"
+      " auto_vacuum %d].\n",
+      main_free_count, main_page_count, main_page_size, main_auto_vacuum,
+      data_free_count, data_page_count, data_page_size, data_auto_vacuum);
 
   if(main_page_count <= 0 || data_page_count <= 0)
   {
@@ -2937,10 +3471,32 @@ void dt_database_maybe_maintenance(const struct dt_database_t *db, const gboolea
 
   const int freepage_ratio = dt_conf_get_int("database/maintenance_freepage_ratio");
 
+  const guint64 calc_size = ((guint64)main_free_count * main_page_size) + ((guint64)data_free_count * data_page_size);
+
+  dt_print(DT_DEBUG_SQL, "[db maintenance] main: %d%% free, data: %d%% free, %" G_GUINT64_FORMAT
+           " bytes of %" G_GUINT64_FORMAT " could be freed.\n",
+           main_free_percentage, data_free_percentage, calc_size,
+           (guint64)main_page_count * main_page_size + (guint64)data_page_count * data_page_size);
+
+  if(calc_size < DT_DATABASE_MAINTENANCE_MIN_SIZE)
+  {
+    dt_print(DT_DEBUG_SQL, "[db maintenance] not worth it.\n");
+    return;
+  }
+
+  // incremental databases just give their free pages back, in short slices. no need to ask for that.
+  if(dt_conf_get_bool("database/incremental_vacuum") && main_auto_vacuum == 2 && data_auto_vacuum == 2)
+  {
+    if(closing_time)
+      _incremental_maintenance(db, NULL, dt_get_wtime() + DT_DATABASE_VACUUM_CLOSE_BUDGET);
+    else
+      db->maintenance_pending = TRUE;
+    return;
+  }
+
   if((main_free_percentage >= freepage_ratio)
       || (data_free_percentage >= freepage_ratio))
   {
-    const guint64 calc_size = (main_free_count*main_page_size) + (data_free_count*data_page_size);
     dt_print(DT_DEBUG_SQL, "[db maintenance] maintenance suggested, %" G_GUINT64_FORMAT " bytes to free.\n", calc_size);
 
     if(force_maintenance || _ask_for_maintenance(has_gui, closing_time, calc_size))
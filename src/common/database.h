@@ -28,6 +28,15 @@ struct dt_database_t *dt_database_init(const char *alternative, const gboolean l
 void dt_database_destroy(const struct dt_database_t *);
 /** get handle */
 struct sqlite3 *dt_database_get(const struct dt_database_t *);
+/** get a read-only handle for the calling thread. in WAL mode (database/wal) that is a connection of its own
+ *  which doesn't wait for writes on the main one, otherwise the main handle. it doesn't see the memory.* tables
+ *  and must not be used for statements that write. */
+struct sqlite3 *dt_database_get_reader(const struct dt_database_t *);
+/** wrap the following writes on the main handle into one transaction. returns FALSE and does nothing if one is
+ *  already open, pass the result on to dt_database_release_transaction() */
+gboolean dt_database_start_transaction(const struct dt_database_t *db);
+/** commit the transaction if dt_database_start_transaction() started one */
+void dt_database_release_transaction(const struct dt_database_t *db, const gboolean started);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
@@ -36,8 +45,14 @@ gboolean dt_database_get_lock_acquired(const struct dt_database_t *db);
 void dt_database_show_error(const struct dt_database_t *db);
 /** perform pre-db-close optimizations (always call when quiting darktable) */
 void dt_database_optimize(const struct dt_database_t *);
-/** conditionally perfrom db maintenance */
-void dt_database_maybe_maintenance(const struct dt_database_t *db, const gboolean has_gui, const gboolean closing_time);
+/** conditionally perfrom db maintenance. databases in incremental auto-vacuum mode free their pages without
+ *  asking, at startup that is left for dt_database_start_maintenance_job() */
+void dt_database_maybe_maintenance(struct dt_database_t *db, const gboolean has_gui, const gboolean closing_time);
+/** free the pages found at startup in the background, once the control jobs are running */
+void dt_database_start_maintenance_job(struct dt_database_t *db);
+/** write a compressed snapshot of both databases in the background if the last one is older than
+ *  database/snapshot_interval days. darktable keeps working on them meanwhile */
+void dt_database_start_snapshot_job(struct dt_database_t *db);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -203,6 +203,11 @@ dt_dlopencl_t *dt_dlopencl_init(const char *name)
     success = success && dt_gmodule_symbol(module, "clGetImageInfo",
                                            ((void (**)(void)) & ocl->symbols->dt_clGetImageInfo));
 
+    /* optional symbols, not required for a working runtime */
+    if(!dt_gmodule_symbol(module, "clCreateProgramWithIL",
+                          (void (**)(void)) & ocl->symbols->dt_clCreateProgramWithIL))
+      ocl->symbols->dt_clCreateProgramWithIL = NULL;
+
     ocl->have_opencl = success;
 
     if(!success)
@@ -69,6 +69,7 @@ typedef cl_program (*dt_clCreateProgramWithSource_t)(cl_context, cl_uint, const
 typedef cl_program (*dt_clCreateProgramWithBinary_t)(cl_context, cl_uint, const cl_device_id *,
                                                      const size_t *, const unsigned char **, cl_int *,
                                                      cl_int *);
+typedef cl_program (*dt_clCreateProgramWithIL_t)(cl_context, const void *, size_t, cl_int *);
 typedef cl_int (*dt_clRetainProgram_t)(cl_program);
 typedef cl_int (*dt_clReleaseProgram_t)(cl_program);
 typedef cl_int (*dt_clBuildProgram_t)(cl_program, cl_uint, const cl_device_id *, const char *, void(*),
@@ -172,6 +173,7 @@ typedef struct dt_dlopencl_symbols_t
   dt_clGetSamplerInfo_t dt_clGetSamplerInfo;
   dt_clCreateProgramWithSource_t dt_clCreateProgramWithSource;
   dt_clCreateProgramWithBinary_t dt_clCreateProgramWithBinary;
+  dt_clCreateProgramWithIL_t dt_clCreateProgramWithIL; // OpenCL 2.1, NULL if the runtime lacks it
   dt_clRetainProgram_t dt_clRetainProgram;
   dt_clReleaseProgram_t dt_clReleaseProgram;
   dt_clBuildProgram_t dt_clBuildProgram;
@@ -46,6 +46,7 @@ dwt_params_t *dt_dwt_init(float *image, const int width, const int height, const
   p->user_data = user_data;
   p->preview_scale = preview_scale;
   p->use_sse = use_sse;
+  p->cache = NULL;
 
   return p;
 }
@@ -57,6 +58,19 @@ void dt_dwt_free(dwt_params_t *p)
   free(p);
 }
 
+dt_dwt_cache_t *dt_dwt_cache_new(void)
+{
+  return (dt_dwt_cache_t *)calloc(1, sizeof(dt_dwt_cache_t));
+}
+
+void dt_dwt_cache_free(dt_dwt_cache_t *c)
+{
+  if(!c) return;
+
+  if(c->layers) dt_free_align(c->layers);
+  free(c);
+}
+
 static int _get_max_scale(const int width, const int height, const float preview_scale)
 {
   int maxscale = 0;
@@ -280,6 +294,41 @@ static void dwt_subtract_layer(float *bl, float *bh, dwt_params_t *const p)
   }
 }
 
+// djb2 over the raw bits, enough to tell two input buffers apart
+static uint64_t dwt_buffer_hash(const float *const buf, const size_t size)
+{
+  const uint32_t *const b = (const uint32_t *)buf;
+  uint64_t hash = 5381;
+  for(size_t k = 0; k < size; k++) hash = ((hash << 5) + hash) ^ b[k];
+  return hash;
+}
+
+/* returns TRUE if the cache holds the decomposition of img, otherwise prepares it to store it */
+static int dwt_cache_lookup(dt_dwt_cache_t *const cache, const float *const img, dwt_params_t *const p,
+                            const size_t size)
+{
+  const uint64_t hash = dwt_buffer_hash(img, size);
+  if(cache->valid && cache->hash == hash && cache->width == p->width && cache->height == p->height
+     && cache->ch == p->ch && cache->scales == p->scales && cache->preview_scale == p->preview_scale)
+    return TRUE;
+
+  cache->valid = 0;
+  const size_t layers_size = (p->scales + 1) * size;
+  if(cache->layers_size != layers_size)
+  {
+    if(cache->layers) dt_free_align(cache->layers);
+    cache->layers = dt_alloc_align(64, layers_size * sizeof(float));
+    cache->layers_size = cache->layers ? layers_size : 0;
+  }
+  cache->hash = hash;
+  cache->width = p->width;
+  cache->height = p->height;
+  cache->ch = p->ch;
+  cache->scales = p->scales;
+  cache->preview_scale = p->preview_scale;
+  return FALSE;
+}
+
 /* actual decomposing algorithm */
 static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_func layer_func)
 {
@@ -294,6 +343,11 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
 
   if(p->scales <= 0) goto cleanup;
 
+  // replay the layers of the last decomposition if the input hasn't changed
+  dt_dwt_cache_t *const cache = (p->cache && p->return_layer == 0) ? p->cache : NULL;
+  const int cached = cache ? dwt_cache_lookup(cache, img, p, size) : FALSE;
+  float *const cache_layers = cache ? cache->layers : NULL;
+
   /* image buffers */
   buffer[0] = img;
   /* temporary storage */
@@ -340,23 +394,33 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   {
     unsigned int lpass = (1 - (lev & 1));
 
-    for(int row = 0; row < p->height; row++)
+    if(cached)
     {
-      dwt_hat_transform(temp, buffer[hpass] + (row * p->width * p->ch), 1, p->width, 1 << lev, p);
-      memcpy(&(buffer[lpass][row * p->width * p->ch]), temp, p->width * p->ch * sizeof(float));
+      // the low pass is only needed for the next scale, which comes from the cache as well
+      memcpy(buffer[hpass], cache_layers + (size_t)lev * size, size * sizeof(float));
     }
-
-    for(int col = 0; col < p->width; col++)
+    else
     {
-      dwt_hat_transform(temp, buffer[lpass] + col * p->ch, p->width, p->height, 1 << lev, p);
       for(int row = 0; row < p->height; row++)
       {
-        for(int c = 0; c < p->ch; c++)
-          buffer[lpass][INDEX_WT_IMAGE(row * p->width + col, p->ch, c)] = temp[INDEX_WT_IMAGE(row, p->ch, c)];
+        dwt_hat_transform(temp, buffer[hpass] + (row * p->width * p->ch), 1, p->width, 1 << lev, p);
+        memcpy(&(buffer[lpass][row * p->width * p->ch]), temp, p->width * p->ch * sizeof(float));
       }
-    }
 
-    dwt_subtract_layer(buffer[lpass], buffer[hpass], p);
+      for(int col = 0; col < p->width; col++)
+      {
+        dwt_hat_transform(temp, buffer[lpass] + col * p->ch, p->width, p->height, 1 << lev, p);
+        for(int row = 0; row < p->height; row++)
+        {
+          for(int c = 0; c < p->ch; c++)
+            buffer[lpass][INDEX_WT_IMAGE(row * p->width + col, p->ch, c)] = temp[INDEX_WT_IMAGE(row, p->ch, c)];
+        }
+      }
+
+      dwt_subtract_layer(buffer[lpass], buffer[hpass], p);
+
+      if(cache_layers) memcpy(cache_layers + (size_t)lev * size, buffer[hpass], size * sizeof(float));
+    }
 
     // no merge scales or we didn't reach the merge scale from yet
     if(p->merge_from_scale == 0 || p->merge_from_scale > lev + 1)
@@ -404,6 +468,14 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   // all scales have been processed
   if(bcontinue)
   {
+    if(cached)
+      memcpy(buffer[hpass], cache_layers + (size_t)p->scales * size, size * sizeof(float));
+    else if(cache_layers)
+    {
+      memcpy(cache_layers + (size_t)p->scales * size, buffer[hpass], size * sizeof(float));
+      cache->valid = 1;
+    }
+
     // allow to process residual image
     if(layer_func) layer_func(buffer[hpass], p, p->scales + 1);
 
@@ -19,6 +19,23 @@
 #ifndef DT_DEVELOP_DWT_H
 #define DT_DEVELOP_DWT_H
 
+#include <stdint.h>
+
+/* keeps the detail scales and the residual of the last decomposition, so that decomposing the same input again
+ * only replays them to layer_func. owned by the caller, see dt_dwt_cache_new() */
+typedef struct dt_dwt_cache_t
+{
+  uint64_t hash; // of the input image after layer_func() has been called for scale 0
+  int width;
+  int height;
+  int ch;
+  int scales;
+  float preview_scale;
+  int valid;
+  float *layers; // scales detail layers followed by the residual
+  size_t layers_size;
+} dt_dwt_cache_t;
+
 /* structure returned by dt_dwt_init() to be used when calling dwt_decompose() */
 typedef struct dwt_params_t
 {
@@ -32,6 +49,7 @@ typedef struct dwt_params_t
   void *user_data;
   float preview_scale;
   int use_sse;
+  dt_dwt_cache_t *cache; // optional, NULL after dt_dwt_init()
 } dwt_params_t;
 
 /* function prototype for the layer_func on dwt_decompose() call */
@@ -55,6 +73,10 @@ dwt_params_t *dt_dwt_init(float *image, const int width, const int height, const
 /* free resources used by dwt_decompose() */
 void dt_dwt_free(dwt_params_t *p);
 
+/* a decomposition cache to be set as dwt_params_t.cache, it costs scales + 1 image buffers */
+dt_dwt_cache_t *dt_dwt_cache_new(void);
+void dt_dwt_cache_free(dt_dwt_cache_t *c);
+
 /* returns the maximum number of scales that dwt_decompose() will accept for the current image size */
 int dwt_get_max_scale(dwt_params_t *p);
 
@@ -36,6 +36,8 @@ extern "C" {
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
 #include <sstream>
 #include <string>
 
@@ -273,13 +275,19 @@ static const char *_exif_get_exiv2_tag_type(const char *tagname)
 
 // exiv2's readMetadata is not thread safe in 0.26. so we lock it. since readMetadata might throw an exception we
 // wrap it into some c++ magic to make sure we unlock in all cases. well, actually not magic but basic raii.
-// FIXME: check again once we rely on 0.27
+// 0.27 is fine with distinct images being read in parallel, which the import readers rely on.
+#if defined(EXIV2_TEST_VERSION) && EXIV2_TEST_VERSION(0,27,0)
+class Lock
+{
+};
+#else
 class Lock
 {
 public:
   Lock() { dt_pthread_mutex_lock(&darktable.exiv2_threadsafe); }
   ~Lock() { dt_pthread_mutex_unlock(&darktable.exiv2_threadsafe); }
 };
+#endif
 
 #define read_metadata_threadsafe(image)                       \
 {                                                             \
@@ -287,6 +295,103 @@ public:
   image->readMetadata();                                      \
 }
 
+// images and sidecars whose metadata got parsed ahead of time by dt_exif_preload(), keyed by path
+static std::map<std::string, std::unique_ptr<Exiv2::Image>> _preloaded;
+static GMutex _preloaded_lock;
+
+// the last few images and sidecars parsed for a reader, also protected by _preloaded_lock. the metadata
+// without the pixels is small, this only has to outlive a burst of imports.
+#define EXIF_KEPT_MAX 64
+typedef struct _exif_kept_t
+{
+  std::string path;
+  time_t mtime;
+  off_t size;
+  std::unique_ptr<Exiv2::Image> image;
+} _exif_kept_t;
+static std::list<_exif_kept_t> _kept;
+
+// opens the file and reads its metadata, unless a preloaded or kept copy is waiting
+static std::unique_ptr<Exiv2::Image> _exif_open(const char *path)
+{
+  g_mutex_lock(&_preloaded_lock);
+  auto it = _preloaded.find(path);
+  if(it != _preloaded.end())
+  {
+    std::unique_ptr<Exiv2::Image> image = std::move(it->second);
+    _preloaded.erase(it);
+    g_mutex_unlock(&_preloaded_lock);
+    return image;
+  }
+
+  // then one a previous reader handed back, if the file didn't change since
+  struct stat statbuf;
+  const gboolean have_stat = !stat(path, &statbuf);
+  for(auto k = _kept.begin(); have_stat && k != _kept.end(); k++)
+  {
+    if(k->path != path) continue;
+    std::unique_ptr<Exiv2::Image> image;
+    if(k->mtime == statbuf.st_mtime && k->size == statbuf.st_size) image = std::move(k->image);
+    _kept.erase(k);
+    if(image)
+    {
+      g_mutex_unlock(&_preloaded_lock);
+      return image;
+    }
+    break;
+  }
+  g_mutex_unlock(&_preloaded_lock);
+
+  std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+  assert(image.get() != 0);
+  read_metadata_threadsafe(image);
+  return image;
+}
+
+// drops what _exif_keep() holds for a file we are about to rewrite
+static void _exif_forget(const char *path)
+{
+  g_mutex_lock(&_preloaded_lock);
+  for(auto k = _kept.begin(); k != _kept.end(); k++)
+    if(k->path == path)
+    {
+      _kept.erase(k);
+      break;
+    }
+  g_mutex_unlock(&_preloaded_lock);
+}
+
+// hands a parsed image back for the next reader of the same file, the import reads the sidecar twice
+// and the embedded thumbnail of a fresh import gets asked for a moment later
+static void _exif_keep(const char *path, std::unique_ptr<Exiv2::Image> image)
+{
+  struct stat statbuf;
+  if(!image || stat(path, &statbuf)) return;
+
+  _exif_forget(path);
+  g_mutex_lock(&_preloaded_lock);
+  _kept.push_back({ path, statbuf.st_mtime, statbuf.st_size, std::move(image) });
+  if(_kept.size() > EXIF_KEPT_MAX) _kept.pop_front();
+  g_mutex_unlock(&_preloaded_lock);
+}
+
+static void _exif_preload_file(const char *path)
+{
+  try
+  {
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    assert(image.get() != 0);
+    read_metadata_threadsafe(image);
+    g_mutex_lock(&_preloaded_lock);
+    _preloaded[path] = std::move(image);
+    g_mutex_unlock(&_preloaded_lock);
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    // dt_exif_read() will try again and report the error
+  }
+}
+
 static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos);
 static gboolean read_xmp_timestamps(Exiv2::XmpData &xmpData, const int imgid);
 
@@ -1363,9 +1468,7 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 {
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> image = _exif_open(path);
 
     // Get a list of preview images available in the image. The list is sorted
     // by the preview image pixel size, starting with the smallest preview.
@@ -1424,9 +1527,7 @@ int dt_exif_read(dt_image_t *img, const char *path)
 
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> image = _exif_open(path);
     bool res = true;
 
     // EXIF metadata
@@ -1454,6 +1555,9 @@ int dt_exif_read(dt_image_t *img, const char *path)
     img->height = image->pixelHeight();
     img->width = image->pixelWidth();
 
+    // the embedded preview is read from the same parsed image
+    _exif_keep(path, std::move(image));
+
     return res ? 0 : 1;
   }
   catch(Exiv2::AnyError &e)
@@ -1464,6 +1568,25 @@ int dt_exif_read(dt_image_t *img, const char *path)
   }
 }
 
+void dt_exif_preload(const char *path)
+{
+  _exif_preload_file(path);
+
+  gchar *xmp = g_strconcat(path, ".xmp", NULL);
+  if(g_file_test(xmp, G_FILE_TEST_EXISTS)) _exif_preload_file(xmp);
+  g_free(xmp);
+}
+
+void dt_exif_preload_release(const char *path)
+{
+  gchar *xmp = g_strconcat(path, ".xmp", NULL);
+  g_mutex_lock(&_preloaded_lock);
+  _preloaded.erase(path);
+  _preloaded.erase(xmp);
+  g_mutex_unlock(&_preloaded_lock);
+  g_free(xmp);
+}
+
 int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char *path, const int compressed)
 {
   try
@@ -2701,9 +2824,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
   try
   {
     // read xmp sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> image = _exif_open(filename);
     Exiv2::XmpData &xmpData = image->xmpData();
 
     sqlite3_stmt *stmt;
@@ -3127,6 +3248,8 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       return 1;
     }
 
+    // the import reads the same sidecar again for the duplicates
+    _exif_keep(filename, std::move(image));
   }
   catch(Exiv2::AnyError &e)
   {
@@ -3948,6 +4071,8 @@ int dt_exif_xmp_write(const int imgid, const char *filename)
   dt_image_full_path(imgid, imgfname, sizeof(imgfname), &from_cache);
   if(!g_file_test(imgfname, G_FILE_TEST_IS_REGULAR)) return 1;
 
+  _exif_forget(filename);
+
   try
   {
     Exiv2::XmpData xmpData;
@@ -4138,6 +4263,11 @@ void dt_exif_init()
 
 void dt_exif_cleanup()
 {
+  g_mutex_lock(&_preloaded_lock);
+  _kept.clear();
+  _preloaded.clear();
+  g_mutex_unlock(&_preloaded_lock);
+
   Exiv2::XmpParser::terminate();
 }
 
@@ -37,6 +37,13 @@ const GList * const dt_exif_get_exiv2_taglist();
  * struct. returns 0 on success. */
 int dt_exif_read(dt_image_t *img, const char *path);
 
+/** parse the metadata of the file and its .xmp sidecar ahead of time, so the next dt_exif_read() and
+ * dt_exif_xmp_read() of them don't have to. may be called from any thread. */
+void dt_exif_preload(const char *path);
+
+/** drop whatever dt_exif_preload() kept for the file and didn't get used. */
+void dt_exif_preload_release(const char *path);
+
 /** read exif data to image struct from given data blob, wherever you got it from. */
 int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
 
@@ -0,0 +1,196 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/export_cache.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "control/conf.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+// how much of the beginning and the end of the source goes into the fingerprint
+#define EXPORT_CACHE_KEY_BYTES 65536
+
+static size_t _cache_limit()
+{
+  const int mb = dt_conf_get_int("cache_export_size");
+  return mb > 0 ? (size_t)mb << 20 : 0;
+}
+
+static void _cache_dir(char *dir, size_t bufsize)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  g_snprintf(dir, bufsize, "%s/exports", cachedir);
+}
+
+static gchar *_cache_path(const char *fingerprint)
+{
+  char dir[PATH_MAX] = { 0 };
+  _cache_dir(dir, sizeof(dir));
+  return g_strdup_printf("%s/%s.dtexp", dir, fingerprint);
+}
+
+GChecksum *dt_export_cache_fingerprint_new(const char *filename)
+{
+  if(!_cache_limit()) return NULL;
+
+  GStatBuf st;
+  if(g_stat(filename, &st)) return NULL;
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return NULL;
+
+  // modules change with the version, so may their output for the same parameters
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(checksum, (const guchar *)darktable_package_version, strlen(darktable_package_version));
+  const int64_t size = st.st_size, mtime = st.st_mtime;
+  g_checksum_update(checksum, (const guchar *)&size, sizeof(size));
+  g_checksum_update(checksum, (const guchar *)&mtime, sizeof(mtime));
+
+  guchar *block = g_malloc(EXPORT_CACHE_KEY_BYTES);
+  size_t rd = fread(block, 1, EXPORT_CACHE_KEY_BYTES, f);
+  g_checksum_update(checksum, block, rd);
+  if(size > EXPORT_CACHE_KEY_BYTES
+     && !fseek(f, -(long)MIN(size - EXPORT_CACHE_KEY_BYTES, EXPORT_CACHE_KEY_BYTES), SEEK_END))
+  {
+    rd = fread(block, 1, EXPORT_CACHE_KEY_BYTES, f);
+    g_checksum_update(checksum, block, rd);
+  }
+  g_free(block);
+  fclose(f);
+  return checksum;
+}
+
+// writes the contents of file from to to, replacing it at once
+static gboolean _copy(const char *from, const char *to)
+{
+  GMappedFile *mf = g_mapped_file_new(from, FALSE, NULL);
+  if(!mf) return FALSE;
+  const gchar *contents = g_mapped_file_get_contents(mf);
+  const gsize length = g_mapped_file_get_length(mf);
+  const gboolean ok = g_file_set_contents(to, contents ? contents : "", length, NULL);
+  g_mapped_file_unref(mf);
+  return ok;
+}
+
+gboolean dt_export_cache_fetch(const char *fingerprint, const char *filename)
+{
+  gchar *path = _cache_path(fingerprint);
+  const gboolean hit = g_file_test(path, G_FILE_TEST_IS_REGULAR) && _copy(path, filename);
+  // touch it, eviction goes by modification time
+  if(hit)
+  {
+    g_utime(path, NULL);
+    dt_print(DT_DEBUG_PERF, "[export_cache] `%s' rendered as %s before\n", filename, fingerprint);
+  }
+  g_free(path);
+  return hit;
+}
+
+typedef struct _export_cache_file_t
+{
+  gchar *path;
+  size_t size;
+  time_t mtime;
+} _export_cache_file_t;
+
+static gint _sort_by_mtime(gconstpointer a, gconstpointer b)
+{
+  const _export_cache_file_t *fa = (const _export_cache_file_t *)a;
+  const _export_cache_file_t *fb = (const _export_cache_file_t *)b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+static void _export_cache_file_free(gpointer data)
+{
+  _export_cache_file_t *file = (_export_cache_file_t *)data;
+  g_free(file->path);
+  g_free(file);
+}
+
+// drops the least recently used entries until incoming more bytes fit into the limit
+static void _cache_evict(const char *dir, const size_t limit, const size_t incoming)
+{
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return;
+
+  GList *files = NULL;
+  size_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    if(!g_str_has_suffix(name, ".dtexp")) continue;
+    GStatBuf st;
+    gchar *path = g_build_filename(dir, name, NULL);
+    if(g_stat(path, &st))
+    {
+      g_free(path);
+      continue;
+    }
+    _export_cache_file_t *file = g_malloc(sizeof(_export_cache_file_t));
+    file->path = path;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    files = g_list_prepend(files, file);
+    total += file->size;
+  }
+  g_dir_close(d);
+
+  files = g_list_sort(files, _sort_by_mtime);
+  for(GList *l = files; l && total + incoming > limit; l = g_list_next(l))
+  {
+    _export_cache_file_t *file = (_export_cache_file_t *)l->data;
+    if(!g_unlink(file->path)) total -= file->size;
+  }
+  g_list_free_full(files, _export_cache_file_free);
+}
+
+void dt_export_cache_store(const char *fingerprint, const char *filename)
+{
+  const size_t limit = _cache_limit();
+  GStatBuf st;
+  if(!limit || g_stat(filename, &st)) return;
+  // a single export that would push everything else out isn't worth keeping
+  if((size_t)st.st_size > limit / 2) return;
+
+  gchar *path = _cache_path(fingerprint);
+  if(g_file_test(path, G_FILE_TEST_EXISTS))
+  {
+    g_free(path);
+    return;
+  }
+
+  char dir[PATH_MAX] = { 0 };
+  _cache_dir(dir, sizeof(dir));
+  if(g_mkdir_with_parents(dir, 0750))
+  {
+    fprintf(stderr, "[export_cache] can't create directory `%s'\n", dir);
+    g_free(path);
+    return;
+  }
+  _cache_evict(dir, limit, st.st_size);
+
+  if(!_copy(filename, path)) fprintf(stderr, "[export_cache] can't write `%s'\n", path);
+  g_free(path);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,44 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * content addressed cache of encoded exports. an export is identified by a render fingerprint: a
+ * checksum over the source file (its size, modification time and its first and last 64 kB, as for the
+ * raw cache), the hashes of all pieces of the synched pipe, the output size and the format with its
+ * parameters. exports repeating a fingerprint, within a job or in a later run, copy the encoded file
+ * from <cachedir>/exports instead of processing the image again. the cache is disabled unless
+ * cache_export_size gives it a size in megabytes, the least recently used entries are dropped once it
+ * grows beyond that.
+ */
+
+/** starts the fingerprint of an export of the source file filename. returns NULL if the cache is disabled
+    or the file can't be read. the caller adds the rest of the render and frees it with g_checksum_free(). */
+GChecksum *dt_export_cache_fingerprint_new(const char *filename);
+
+/** writes the cached output for fingerprint to filename. returns TRUE on a hit. */
+gboolean dt_export_cache_fetch(const char *fingerprint, const char *filename);
+/** keeps a copy of the freshly exported filename under fingerprint. */
+void dt_export_cache_store(const char *fingerprint, const char *filename);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,404 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/export_processes.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/exif.h"
+#include "common/image.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+typedef struct _export_process_t
+{
+  GPid pid;
+  FILE *in;  // manifest lines to the process
+  FILE *out; // and its replies
+  gchar *configdir;
+  int line;  // lines sent so far, the replies are numbered by them
+  gboolean busy, dead;
+} _export_process_t;
+
+struct dt_export_processes_t
+{
+  gchar *tmpdir; // config directories and sidecars
+  gchar *ext;
+  int count;
+  _export_process_t *proc;
+
+  GMutex lock; // protects the busy and dead flags
+  GCond idle;
+};
+
+#ifndef _WIN32
+
+// the darktable-cli installed next to us, or else the one in the path
+static gchar *_find_cli(void)
+{
+  gchar *self = g_file_read_link("/proc/self/exe", NULL);
+  if(self)
+  {
+    gchar *dir = g_path_get_dirname(self);
+    gchar *cli = g_build_filename(dir, "darktable-cli", NULL);
+    g_free(dir);
+    g_free(self);
+    if(g_file_test(cli, G_FILE_TEST_IS_EXECUTABLE)) return cli;
+    g_free(cli);
+  }
+  return g_find_program_in_path("darktable-cli");
+}
+
+// data.db is locked by us, the processes get a copy of it. that carries the styles and presets.
+static gboolean _copy_data_db(const char *filename)
+{
+  sqlite3 *dst = NULL;
+  if(sqlite3_open(filename, &dst) != SQLITE_OK)
+  {
+    sqlite3_close(dst);
+    return FALSE;
+  }
+  int rc = SQLITE_ERROR;
+  sqlite3_backup *backup = sqlite3_backup_init(dst, "main", dt_database_get(darktable.db), "data");
+  if(backup)
+  {
+    rc = sqlite3_backup_step(backup, -1);
+    sqlite3_backup_finish(backup);
+  }
+  sqlite3_close(dst);
+  return rc == SQLITE_DONE;
+}
+
+static void _remove_dir(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if(dir)
+  {
+    const gchar *name;
+    while((name = g_dir_read_name(dir)))
+    {
+      gchar *file = g_build_filename(path, name, NULL);
+      if(g_file_test(file, G_FILE_TEST_IS_DIR))
+        _remove_dir(file);
+      else
+        g_unlink(file);
+      g_free(file);
+    }
+    g_dir_close(dir);
+  }
+  g_rmdir(path);
+}
+
+static gboolean _spawn(_export_process_t *proc, const char *cli, GPtrArray *args, const char *configdir,
+                       const int threads, const gboolean opencl)
+{
+  if(g_mkdir_with_parents(configdir, 0700)) return FALSE;
+  gchar *rc = g_build_filename(configdir, "darktablerc", NULL);
+  gchar *db = g_build_filename(configdir, "data.db", NULL);
+  const gboolean ok = dt_conf_save(rc) && _copy_data_db(db);
+  g_free(rc);
+  g_free(db);
+  if(!ok) return FALSE;
+
+  gchar *t = g_strdup_printf("%d", threads);
+  GPtrArray *argv = g_ptr_array_new();
+  g_ptr_array_add(argv, (gpointer)cli);
+  for(guint k = 0; k < args->len; k++) g_ptr_array_add(argv, g_ptr_array_index(args, k));
+  g_ptr_array_add(argv, (gpointer)"--core");
+  g_ptr_array_add(argv, (gpointer)"--configdir");
+  g_ptr_array_add(argv, (gpointer)configdir);
+  g_ptr_array_add(argv, (gpointer)"-t");
+  g_ptr_array_add(argv, t);
+  if(!opencl) g_ptr_array_add(argv, (gpointer)"--disable-opencl");
+  g_ptr_array_add(argv, NULL);
+
+  gint in = -1, out = -1;
+  GError *error = NULL;
+  const gboolean spawned
+      = g_spawn_async_with_pipes(NULL, (gchar **)argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+                                 &proc->pid, &in, &out, NULL, &error);
+  g_ptr_array_free(argv, TRUE);
+  g_free(t);
+  if(!spawned)
+  {
+    fprintf(stderr, "[export_processes] can't start %s: %s\n", cli, error ? error->message : "");
+    if(error) g_error_free(error);
+    return FALSE;
+  }
+
+  proc->in = fdopen(in, "w");
+  proc->out = fdopen(out, "r");
+  if(!proc->in || !proc->out)
+  {
+    if(proc->in) fclose(proc->in); else close(in);
+    if(proc->out) fclose(proc->out); else close(out);
+    proc->in = proc->out = NULL;
+    kill(proc->pid, SIGTERM);
+    waitpid(proc->pid, NULL, 0);
+    g_spawn_close_pid(proc->pid);
+    return FALSE;
+  }
+  proc->configdir = g_strdup(configdir);
+  return TRUE;
+}
+
+dt_export_processes_t *dt_export_processes_start(const int count, const dt_control_export_t *settings,
+                                                 const dt_imageio_module_format_t *format,
+                                                 const dt_imageio_module_data_t *fdata)
+{
+  if(count < 1) return NULL;
+  gchar *cli = _find_cli();
+  if(!cli)
+  {
+    fprintf(stderr, "[export_processes] darktable-cli not found, exporting in process\n");
+    return NULL;
+  }
+
+  dt_export_processes_t *p = (dt_export_processes_t *)calloc(1, sizeof(dt_export_processes_t));
+  p->tmpdir = g_dir_make_tmp("darktable-export-XXXXXX", NULL);
+  p->ext = g_strdup(format->extension((dt_imageio_module_data_t *)fdata));
+  p->proc = (_export_process_t *)calloc(count, sizeof(_export_process_t));
+  g_mutex_init(&p->lock);
+  g_cond_init(&p->idle);
+  if(!p->tmpdir)
+  {
+    dt_export_processes_stop(p);
+    g_free(cli);
+    return NULL;
+  }
+
+  // a process dying under our feet must not take darktable down. the write fails and is handled instead.
+  signal(SIGPIPE, SIG_IGN);
+
+  // everything but the images is the same for all of them
+  GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
+  g_ptr_array_add(args, g_strdup("--batch"));
+  g_ptr_array_add(args, g_strdup("-"));
+  g_ptr_array_add(args, g_strdup("--format"));
+  g_ptr_array_add(args, g_strdup(format->plugin_name));
+  g_ptr_array_add(args, g_strdup("--width"));
+  g_ptr_array_add(args, g_strdup_printf("%d", fdata->max_width));
+  g_ptr_array_add(args, g_strdup("--height"));
+  g_ptr_array_add(args, g_strdup_printf("%d", fdata->max_height));
+  g_ptr_array_add(args, g_strdup("--hq"));
+  g_ptr_array_add(args, g_strdup(settings->high_quality ? "1" : "0"));
+  g_ptr_array_add(args, g_strdup("--upscale"));
+  g_ptr_array_add(args, g_strdup(settings->upscale ? "1" : "0"));
+  g_ptr_array_add(args, g_strdup("--export_masks"));
+  g_ptr_array_add(args, g_strdup(settings->export_masks ? "1" : "0"));
+  g_ptr_array_add(args, g_strdup("--icc-type"));
+  g_ptr_array_add(args, g_strdup_printf("%d", settings->icc_type));
+  g_ptr_array_add(args, g_strdup("--icc-intent"));
+  g_ptr_array_add(args, g_strdup_printf("%d", settings->icc_intent));
+  if(settings->icc_filename && *settings->icc_filename)
+  {
+    g_ptr_array_add(args, g_strdup("--icc-file"));
+    g_ptr_array_add(args, g_strdup(settings->icc_filename));
+  }
+  if(settings->metadata_export)
+  {
+    g_ptr_array_add(args, g_strdup("--metadata"));
+    g_ptr_array_add(args, g_strdup(settings->metadata_export));
+  }
+  if(*settings->style)
+  {
+    g_ptr_array_add(args, g_strdup("--style"));
+    g_ptr_array_add(args, g_strdup(settings->style));
+    if(!settings->style_append) g_ptr_array_add(args, g_strdup("--style-overwrite"));
+  }
+
+  // only the first one gets the gpu, a context per process would just fight over its memory
+  const int threads = MAX(1, dt_get_num_threads() / count);
+  for(int k = 0; k < count; k++)
+  {
+    gchar *configdir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%d", p->tmpdir, k);
+    if(_spawn(&p->proc[p->count], cli, args, configdir, threads, k == 0 && dt_opencl_is_enabled()))
+      p->count++;
+    else
+      _remove_dir(configdir);
+    g_free(configdir);
+  }
+  g_ptr_array_free(args, TRUE);
+  g_free(cli);
+
+  if(!p->count)
+  {
+    dt_export_processes_stop(p);
+    return NULL;
+  }
+  dt_print(DT_DEBUG_PERF, "[export_processes] started %d processes with %d threads each\n", p->count, threads);
+  return p;
+}
+
+int dt_export_processes_count(const dt_export_processes_t *p)
+{
+  return p->count;
+}
+
+// wait for an idle process. NULL once all of them died
+static _export_process_t *_take(dt_export_processes_t *p)
+{
+  g_mutex_lock(&p->lock);
+  _export_process_t *proc = NULL;
+  while(!proc)
+  {
+    gboolean alive = FALSE;
+    for(int k = 0; k < p->count && !proc; k++)
+    {
+      alive |= !p->proc[k].dead;
+      if(!p->proc[k].dead && !p->proc[k].busy) proc = &p->proc[k];
+    }
+    if(!alive) break;
+    if(!proc) g_cond_wait(&p->idle, &p->lock);
+  }
+  if(proc) proc->busy = TRUE;
+  g_mutex_unlock(&p->lock);
+  return proc;
+}
+
+static void _give_back(dt_export_processes_t *p, _export_process_t *proc, const gboolean dead)
+{
+  g_mutex_lock(&p->lock);
+  proc->busy = FALSE;
+  proc->dead |= dead;
+  g_cond_broadcast(&p->idle);
+  g_mutex_unlock(&p->lock);
+}
+
+int dt_export_processes_store(dt_export_processes_t *p, const int imgid, const char *pattern, const int num,
+                              const int total)
+{
+  char input[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, input, sizeof(input), &from_cache);
+
+  // the history as it is now, the sidecar next to the input might be outdated or shared by duplicates
+  gchar *xmp = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%d.xmp", p->tmpdir, imgid);
+  if(dt_exif_xmp_write(imgid, xmp))
+  {
+    g_free(xmp);
+    return 1;
+  }
+
+  int res = 1;
+  _export_process_t *proc = _take(p);
+  if(proc)
+  {
+    gchar *output = g_strdup_printf("%s.%s", pattern, p->ext);
+    gchar *q_xmp = g_shell_quote(xmp);
+    gchar *q_input = g_shell_quote(input);
+    gchar *q_output = g_shell_quote(output);
+    const gboolean sent = fprintf(proc->in, "--xmp %s --sequence %d %d %s %s\n", q_xmp, num, total, q_input,
+                                  q_output) > 0
+                          && !fflush(proc->in);
+    g_free(q_xmp);
+    g_free(q_input);
+    g_free(q_output);
+    g_free(output);
+
+    // the reply to this line, whatever else the process prints to stdout is skipped
+    gboolean replied = FALSE;
+    if(sent)
+    {
+      proc->line++;
+      char *line = NULL;
+      size_t len = 0;
+      while(!replied && getline(&line, &len, proc->out) != -1)
+      {
+        char status[8] = { 0 };
+        int lineno = 0;
+        if(sscanf(line, "%7s %d", status, &lineno) == 2 && lineno == proc->line
+           && (!strcmp(status, "ok") || !strcmp(status, "failed")))
+        {
+          replied = TRUE;
+          res = strcmp(status, "ok") != 0;
+        }
+      }
+      free(line);
+    }
+    if(!replied) fprintf(stderr, "[export_processes] process %d went away\n", (int)proc->pid);
+    _give_back(p, proc, !replied);
+  }
+
+  g_unlink(xmp);
+  g_free(xmp);
+  return res;
+}
+
+void dt_export_processes_stop(dt_export_processes_t *p)
+{
+  if(!p) return;
+  // end of the manifest, every process finishes its line and exits
+  for(int k = 0; k < p->count; k++)
+    if(p->proc[k].in) fclose(p->proc[k].in);
+  for(int k = 0; k < p->count; k++)
+  {
+    _export_process_t *proc = &p->proc[k];
+    waitpid(proc->pid, NULL, 0);
+    g_spawn_close_pid(proc->pid);
+    if(proc->out) fclose(proc->out);
+    g_free(proc->configdir);
+  }
+  if(p->tmpdir) _remove_dir(p->tmpdir);
+  g_mutex_clear(&p->lock);
+  g_cond_clear(&p->idle);
+  free(p->proc);
+  g_free(p->ext);
+  g_free(p->tmpdir);
+  free(p);
+}
+
+#else
+
+dt_export_processes_t *dt_export_processes_start(const int count, const dt_control_export_t *settings,
+                                                 const dt_imageio_module_format_t *format,
+                                                 const dt_imageio_module_data_t *fdata)
+{
+  return NULL;
+}
+
+int dt_export_processes_count(const dt_export_processes_t *p)
+{
+  return 0;
+}
+
+int dt_export_processes_store(dt_export_processes_t *p, const int imgid, const char *pattern, const int num,
+                              const int total)
+{
+  return 1;
+}
+
+void dt_export_processes_stop(dt_export_processes_t *p)
+{
+}
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,46 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/imageio_module.h"
+#include "control/jobs/control_jobs.h"
+
+/** a set of darktable-cli processes exporting to disk on behalf of one export job. they share nothing with
+ * this process but a snapshot of the configuration and of data.db (for styles and presets), and get every
+ * image as input file plus a freshly written xmp, so libraries that aren't safe to use from several threads
+ * of one process can still run side by side. */
+typedef struct dt_export_processes_t dt_export_processes_t;
+
+/** start at most count processes for the given export settings, splitting the cores between them.
+ * returns NULL if none could be started, the caller then exports in process. */
+dt_export_processes_t *dt_export_processes_start(const int count, const dt_control_export_t *settings,
+                                                 const dt_imageio_module_format_t *format,
+                                                 const dt_imageio_module_data_t *fdata);
+/** the number of processes running, the export job keeps that many images in flight. */
+int dt_export_processes_count(const dt_export_processes_t *processes);
+/** export image num of total to the file name pattern of the disk storage, on the next idle process.
+ * blocks until it is written, may be called from several threads. returns 0 on success. */
+int dt_export_processes_store(dt_export_processes_t *processes, const int imgid, const char *pattern,
+                              const int num, const int total);
+/** let the processes finish their images and exit, and clean up after them. */
+void dt_export_processes_stop(dt_export_processes_t *processes);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
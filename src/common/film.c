@@ -21,6 +21,7 @@
 #include "common/debug.h"
 #include "common/dtpthread.h"
 #include "common/image_cache.h"
+#include "common/selection.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -430,6 +431,7 @@ void dt_film_remove(const int id)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_selection_invalidate(darktable.selection);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM main.images WHERE film_id = ?1", -1,
                               &stmt, NULL);
@@ -83,12 +83,22 @@ static inline void get_indices(const size_t i, const size_t j, const size_t widt
   index[7] = lower_line + right_row;      // south east
 }
 
-static inline void dt_focuspeaking(cairo_t *cr, int width, int height,
-                                   uint8_t *const restrict image,
-                                   const int buf_width, const int buf_height)
+// sharpness levels of the focus peaking map, painted blue, green and yellow
+typedef enum dt_focuspeaking_level_t
+{
+  DT_FOCUSPEAKING_NONE = 0,
+  DT_FOCUSPEAKING_LOW = 1,
+  DT_FOCUSPEAKING_MEDIUM = 2,
+  DT_FOCUSPEAKING_HIGH = 3
+} dt_focuspeaking_level_t;
+
+// computes the sharpness level of every pixel of the 4 channel 8 bit image, the channel order doesn't
+// matter. the map has one byte per pixel and has to be freed with dt_free_align().
+static inline uint8_t *dt_focuspeaking_compute(const uint8_t *const restrict image,
+                                               const int buf_width, const int buf_height)
 {
   float *const restrict luma =  dt_alloc_sse_ps(buf_width * buf_height);
-  uint8_t *const restrict focus_peaking = dt_alloc_align(64, 4 * buf_width * buf_height * sizeof(uint8_t));
+  uint8_t *const restrict focus_peaking = dt_alloc_align(64, buf_width * buf_height * sizeof(uint8_t));
 
   // Create a luma buffer as the euclidian norm of RGB channels
 #ifdef _OPENMP
@@ -178,114 +188,63 @@ schedule(static) collapse(2) aligned(focus_peaking, luma_ds:64) reduction(+:sigm
   // Postfilter to connect isolated dots and draw lines
   fast_surface_blur(luma_ds, buf_width, buf_height, 12, 0.00001f, 4, DT_GF_BLENDING_LINEAR, 1, 0.0f, exp2f(-8.0f), 1.0f);
 
-  // Prepare the focus-peaking image overlay
+  // Classify the sharpness
 #ifdef _OPENMP
 #pragma omp parallel for simd default(none) \
-dt_omp_firstprivate(focus_peaking, luma_ds, buf_height, buf_width, six_sigma, four_sigma, two_sigma, sigma) \
+dt_omp_firstprivate(focus_peaking, luma_ds, buf_height, buf_width, six_sigma, four_sigma, two_sigma) \
 schedule(static) collapse(2) aligned(focus_peaking, luma_ds:64)
 #endif
-  for(size_t i = 2; i < buf_height - 2; ++i)
-    for(size_t j = 2; j < buf_width - 2; ++j)
+  for(size_t i = 0; i < buf_height; ++i)
+    for(size_t j = 0; j < buf_width; ++j)
     {
-      const size_t index = (i * buf_width + j) * 4;
-      const float TV = luma_ds[index / 4];
-
-      if(TV > six_sigma)
-      {
-        // Very sharp : paint yellow, BGR = (0, 255, 255)
-        focus_peaking[index + 0] = 0;
-        focus_peaking[index + 1] = 255;
-        focus_peaking[index + 2] = 255;
-
-        // alpha channel
-        focus_peaking[index + 3] = 255;
-      }
+      const size_t index = i * buf_width + j;
+      const float TV = luma_ds[index];
+
+      // the borders, 4 pixels top and left, 5 bottom and right, aren't meaningful
+      if(i < 4 || j < 4 || i + 5 >= buf_height || j + 5 >= buf_width)
+        focus_peaking[index] = DT_FOCUSPEAKING_NONE;
+      else if(TV > six_sigma)
+        focus_peaking[index] = DT_FOCUSPEAKING_HIGH;
       else if(TV > four_sigma)
-      {
-        // Mediun sharp : paint green, BGR = (0, 255, 0)
-        focus_peaking[index + 0] = 0;
-        focus_peaking[index + 1] = 255;
-        focus_peaking[index + 2] = 0;
-
-        // alpha channel
-        focus_peaking[index + 3] = 255;
-      }
+        focus_peaking[index] = DT_FOCUSPEAKING_MEDIUM;
       else if(TV > two_sigma)
-      {
-        // Little sharp : paint blue, BGR = (255, 0, 0)
-        focus_peaking[index + 0] = 255;
-        focus_peaking[index + 1] = 0;
-        focus_peaking[index + 2] = 0;
-
-        // alpha channel
-        focus_peaking[index + 3] = 255;
-      }
+        focus_peaking[index] = DT_FOCUSPEAKING_LOW;
       else
-      {
-        // Not sharp enough : paint 0
-        focus_peaking[index + 3] = focus_peaking[index + 2] = focus_peaking[index + 1] = focus_peaking[index] = 0;
-      }
+        focus_peaking[index] = DT_FOCUSPEAKING_NONE;
     }
 
-  // deal with image borders : top rows
-#ifdef _OPENMP
-#pragma omp parallel for simd default(none) \
-dt_omp_firstprivate(focus_peaking, buf_height, buf_width) \
-schedule(static) collapse(2) aligned(focus_peaking:64)
-#endif
-  for(size_t i = 0; i < 4; ++i)
-    for(size_t j = 2; j < buf_width - 2; ++j)
-    {
-      const size_t index = (i * buf_width + j) * 4;
-      focus_peaking[index + 3] = focus_peaking[index + 2] = focus_peaking[index + 1] = focus_peaking[index] = 0;
-    }
+  dt_free_align(luma);
+  dt_free_align(luma_ds);
+  return focus_peaking;
+}
 
-  // deal with image borders : left columns
-#ifdef _OPENMP
-#pragma omp parallel for simd default(none) \
-dt_omp_firstprivate(focus_peaking, buf_height, buf_width) \
-schedule(static) collapse(2) aligned(focus_peaking:64)
-#endif
-  for(size_t i = 0; i < buf_height; ++i)
-    for(size_t j = 0; j < 4; ++j)
-    {
-      const size_t index = (i * buf_width + j) * 4;
-      focus_peaking[index + 3] = focus_peaking[index + 2] = focus_peaking[index + 1] = focus_peaking[index] = 0;
-    }
+// paints the map of dt_focuspeaking_compute() over the buf_width x buf_height area at the origin of cr
+static inline void dt_focuspeaking_draw(cairo_t *cr, const uint8_t *const restrict levels,
+                                        const int buf_width, const int buf_height)
+{
+  // premultiplied BGRA of the levels
+  const uint32_t colors[4] = { 0x00000000u, 0xff0000ffu, 0xff00ff00u, 0xffffff00u };
+  const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, buf_width);
+  uint8_t *const restrict focus_peaking = dt_alloc_align(64, (size_t)stride * buf_height);
 
-  // deal with image borders : right columns
 #ifdef _OPENMP
-#pragma omp parallel for simd default(none) \
-dt_omp_firstprivate(focus_peaking, buf_height, buf_width) \
-schedule(static) collapse(2) aligned(focus_peaking:64)
+#pragma omp parallel for default(none) \
+dt_omp_firstprivate(focus_peaking, levels, buf_height, buf_width, stride, colors) \
+schedule(static)
 #endif
   for(size_t i = 0; i < buf_height; ++i)
-    for(size_t j = buf_width - 5; j < buf_width; ++j)
-    {
-      const size_t index = (i * buf_width + j) * 4;
-      focus_peaking[index + 3] = focus_peaking[index + 2] = focus_peaking[index + 1] = focus_peaking[index] = 0;
-    }
-
-  // deal with image borders : bottom rows
-#ifdef _OPENMP
-#pragma omp parallel for simd default(none) \
-dt_omp_firstprivate(focus_peaking, buf_height, buf_width) \
-schedule(static) collapse(2) aligned(focus_peaking:64)
-#endif
-  for(size_t i = buf_height - 5; i < buf_height; ++i)
-    for(size_t j = 0; j < buf_width; ++j)
-    {
-      const size_t index = (i * buf_width + j) * 4;
-      focus_peaking[index + 3] = focus_peaking[index + 2] = focus_peaking[index + 1] = focus_peaking[index] = 0;
-    }
+  {
+    uint32_t *const out = (uint32_t *)(focus_peaking + i * stride);
+    const uint8_t *const in = levels + i * buf_width;
+    for(size_t j = 0; j < buf_width; ++j) out[j] = colors[in[j]];
+  }
 
   // draw the focus peaking overlay
   cairo_save(cr);
   cairo_rectangle(cr, 0, 0, buf_width, buf_height);
   cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *)focus_peaking,
                                                                  CAIRO_FORMAT_ARGB32,
-                                                                 buf_width, buf_height,
-                                                                 cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, buf_width));
+                                                                 buf_width, buf_height, stride);
   cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
   cairo_set_source_surface(cr, surface, 0.0, 0.0);
   cairo_pattern_set_filter(cairo_get_source (cr), darktable.gui->filter_image);
@@ -294,11 +253,18 @@ schedule(static) collapse(2) aligned(focus_peaking:64)
 
   // cleanup
   cairo_surface_destroy(surface);
-  dt_free_align(luma);
-  dt_free_align(luma_ds);
   dt_free_align(focus_peaking);
 }
 
+static inline void dt_focuspeaking(cairo_t *cr, int width, int height,
+                                   uint8_t *const restrict image,
+                                   const int buf_width, const int buf_height)
+{
+  uint8_t *const levels = dt_focuspeaking_compute(image, buf_width, buf_height);
+  dt_focuspeaking_draw(cr, levels, buf_width, buf_height);
+  dt_free_align(levels);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -19,20 +19,19 @@
 
 #include <assert.h>
 #include <math.h>
-#if defined(__SSE__)
-#include <xmmintrin.h>
-#endif
 #include "common/gaussian.h"
 #include "common/opencl.h"
+#include "common/simd.h"
 
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 
-#if defined(__SSE__)
-#define MMCLAMPPS(a, mn, mx) (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
-#endif
-
 #define BLOCKSIZE (1 << 6)
 
+// columns of the vertical pass that are filtered together, 16 pixels of 4 channels are four cache lines
+#define DT_GAUSSIAN_STRIP 16
+// lines of the horizontal pass that are filtered together
+#define DT_GAUSSIAN_LINES 4
+
 static void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1,
                                  float *a2, float *a3, float *b1, float *b2, float *coefp, float *coefn)
 {
@@ -171,76 +170,84 @@ void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
   float *Labmax = g->max;
   float *Labmin = g->min;
 
-// vertical blur column by column
+// vertical blur in strips of adjacent columns. a row of a strip is one contiguous run of memory instead
+// of a single pixel per cache line, and the recursions of its columns and channels are independent of each
+// other, so they run side by side in the simd lanes.
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(in, width, height, ch) \
   shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn) \
   schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(int i0 = 0; i0 < width; i0 += DT_GAUSSIAN_STRIP)
   {
-    float xp[4] = {0.0f};
-    float yb[4] = {0.0f};
-    float yp[4] = {0.0f};
-    float xc[4] = {0.0f};
-    float yc[4] = {0.0f};
-    float xn[4] = {0.0f};
-    float xa[4] = {0.0f};
-    float yn[4] = {0.0f};
-    float ya[4] = {0.0f};
+    const int n = MIN(DT_GAUSSIAN_STRIP, width - i0) * ch;
+    float mn[DT_GAUSSIAN_STRIP * 4], mx[DT_GAUSSIAN_STRIP * 4];
+    float xp[DT_GAUSSIAN_STRIP * 4], yb[DT_GAUSSIAN_STRIP * 4], yp[DT_GAUSSIAN_STRIP * 4];
+    float xn[DT_GAUSSIAN_STRIP * 4], xa[DT_GAUSSIAN_STRIP * 4], yn[DT_GAUSSIAN_STRIP * 4],
+        ya[DT_GAUSSIAN_STRIP * 4];
+
+    for(int e = 0; e < n; e++)
+    {
+      mn[e] = Labmin[e % ch];
+      mx[e] = Labmax[e % ch];
+    }
 
     // forward filter
-    for(int k = 0; k < ch; k++)
+    const float *const top = in + (size_t)i0 * ch;
+    for(int e = 0; e < n; e++)
     {
-      xp[k] = CLAMPF(in[(size_t)i * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
+      xp[e] = CLAMPF(top[e], mn[e], mx[e]);
+      yb[e] = xp[e] * coefp;
+      yp[e] = yb[e];
     }
 
     for(int j = 0; j < height; j++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
+      const size_t offset = ((size_t)j * width + i0) * ch;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for(int e = 0; e < n; e++)
       {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+        const float xc = CLAMPF(in[offset + e], mn[e], mx[e]);
+        const float yc = (a0 * xc) + (a1 * xp[e]) - (b1 * yp[e]) - (b2 * yb[e]);
 
-        temp[offset + k] = yc[k];
+        temp[offset + e] = yc;
 
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
+        xp[e] = xc;
+        yb[e] = yp[e];
+        yp[e] = yc;
       }
     }
 
     // backward filter
-    for(int k = 0; k < ch; k++)
+    const float *const bottom = in + ((size_t)(height - 1) * width + i0) * ch;
+    for(int e = 0; e < n; e++)
     {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
+      xn[e] = CLAMPF(bottom[e], mn[e], mx[e]);
+      xa[e] = xn[e];
+      yn[e] = xn[e] * coefn;
+      ya[e] = yn[e];
     }
 
     for(int j = height - 1; j > -1; j--)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
+      const size_t offset = ((size_t)j * width + i0) * ch;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for(int e = 0; e < n; e++)
       {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+        const float xc = CLAMPF(in[offset + e], mn[e], mx[e]);
+        const float yc = (a2 * xn[e]) + (a3 * xa[e]) - (b1 * yn[e]) - (b2 * ya[e]);
 
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+        xa[e] = xn[e];
+        xn[e] = xc;
+        ya[e] = yn[e];
+        yn[e] = yc;
 
-        temp[offset + k] += yc[k];
+        temp[offset + e] += yc;
       }
     }
   }
@@ -322,8 +329,8 @@ void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
 
 
 
-#if defined(__SSE__)
-static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, float *const out)
+// the 4 channel variant, on the portable vectors of common/simd.h (sse, neon or altivec)
+static void dt_gaussian_blur_4c_vec(dt_gaussian_t *g, const float *const in, float *const out)
 {
 
   const int width = g->width;
@@ -336,165 +343,149 @@ static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, flo
 
   compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+  const dt_simd4f Labmax = { g->max[0], g->max[1], g->max[2], g->max[3] };
+  const dt_simd4f Labmin = { g->min[0], g->min[1], g->min[2], g->min[3] };
 
   float *temp = g->buf;
 
 
-// vertical blur column by column
+// vertical blur in strips of adjacent columns, as in dt_gaussian_blur()
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(in, Labmin, Labmax, width, height, ch) \
   shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) \
   schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(int i0 = 0; i0 < width; i0 += DT_GAUSSIAN_STRIP)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
+    const int n = MIN(DT_GAUSSIAN_STRIP, width - i0);
+    dt_simd4f xp[DT_GAUSSIAN_STRIP], yb[DT_GAUSSIAN_STRIP], yp[DT_GAUSSIAN_STRIP];
+    dt_simd4f xn[DT_GAUSSIAN_STRIP], xa[DT_GAUSSIAN_STRIP], yn[DT_GAUSSIAN_STRIP], ya[DT_GAUSSIAN_STRIP];
 
     // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in + i * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
+    for(int s = 0; s < n; s++)
+    {
+      xp[s] = dt_simd4f_clamp(dt_simd4f_load(in + (size_t)(i0 + s) * ch), Labmin, Labmax);
+      yb[s] = coefp * xp[s];
+      yp[s] = yb[s];
+    }
 
     for(int j = 0; j < height; j++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
+      const size_t offset = ((size_t)j * width + i0) * ch;
 
+      for(int s = 0; s < n; s++)
+      {
+        const dt_simd4f xc = dt_simd4f_clamp(dt_simd4f_load(in + offset + s * ch), Labmin, Labmax);
+        const dt_simd4f yc = (a0 * xc) + ((a1 * xp[s]) - ((b1 * yp[s]) + (b2 * yb[s])));
 
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(temp + offset, yc);
+        dt_simd4f_store(temp + offset + s * ch, yc);
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
+        xp[s] = xc;
+        yb[s] = yp[s];
+        yp[s] = yc;
+      }
     }
 
     // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in + ((size_t)(height - 1) * width + i) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
+    for(int s = 0; s < n; s++)
+    {
+      xn[s] = dt_simd4f_clamp(dt_simd4f_load(in + ((size_t)(height - 1) * width + i0 + s) * ch), Labmin, Labmax);
+      xa[s] = xn[s];
+      yn[s] = coefn * xn[s];
+      ya[s] = yn[s];
+    }
 
     for(int j = height - 1; j > -1; j--)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+      const size_t offset = ((size_t)j * width + i0) * ch;
 
+      for(int s = 0; s < n; s++)
+      {
+        const dt_simd4f xc = dt_simd4f_clamp(dt_simd4f_load(in + offset + s * ch), Labmin, Labmax);
+        const dt_simd4f yc = (a2 * xn[s]) + ((a3 * xa[s]) - ((b1 * yn[s]) + (b2 * ya[s])));
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+        xa[s] = xn[s];
+        xn[s] = xc;
+        ya[s] = yn[s];
+        yn[s] = yc;
 
-      _mm_store_ps(temp + offset, _mm_add_ps(_mm_load_ps(temp + offset), yc));
+        dt_simd4f_store(temp + offset + s * ch, dt_simd4f_load(temp + offset + s * ch) + yc);
+      }
     }
   }
 
-// horizontal blur line by line
+// horizontal blur, a few lines at a time so that their recursions overlap in the pipeline
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(out, Labmin, Labmax, width, height, ch) \
   shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) \
   schedule(static)
 #endif
-  for(size_t j = 0; j < height; j++)
+  for(int j0 = 0; j0 < height; j0 += DT_GAUSSIAN_LINES)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
+    const int n = MIN(DT_GAUSSIAN_LINES, height - j0);
+    dt_simd4f xp[DT_GAUSSIAN_LINES], yb[DT_GAUSSIAN_LINES], yp[DT_GAUSSIAN_LINES];
+    dt_simd4f xn[DT_GAUSSIAN_LINES], xa[DT_GAUSSIAN_LINES], yn[DT_GAUSSIAN_LINES], ya[DT_GAUSSIAN_LINES];
 
     // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp + j * width * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
+    for(int l = 0; l < n; l++)
+    {
+      xp[l] = dt_simd4f_clamp(dt_simd4f_load(temp + (size_t)(j0 + l) * width * ch), Labmin, Labmax);
+      yb[l] = coefp * xp[l];
+      yp[l] = yb[l];
+    }
 
     for(int i = 0; i < width; i++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
+      for(int l = 0; l < n; l++)
+      {
+        const size_t offset = ((size_t)(j0 + l) * width + i) * ch;
 
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+        const dt_simd4f xc = dt_simd4f_clamp(dt_simd4f_load(temp + offset), Labmin, Labmax);
+        const dt_simd4f yc = (a0 * xc) + ((a1 * xp[l]) - ((b1 * yp[l]) + (b2 * yb[l])));
 
-      _mm_store_ps(out + offset, yc);
+        dt_simd4f_store(out + offset, yc);
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
+        xp[l] = xc;
+        yb[l] = yp[l];
+        yp[l] = yc;
+      }
     }
 
     // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp + ((size_t)(j + 1) * width - 1) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
+    for(int l = 0; l < n; l++)
+    {
+      xn[l] = dt_simd4f_clamp(dt_simd4f_load(temp + ((size_t)(j0 + l + 1) * width - 1) * ch), Labmin, Labmax);
+      xa[l] = xn[l];
+      yn[l] = coefn * xn[l];
+      ya[l] = yn[l];
+    }
 
     for(int i = width - 1; i > -1; i--)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+      for(int l = 0; l < n; l++)
+      {
+        const size_t offset = ((size_t)(j0 + l) * width + i) * ch;
 
+        const dt_simd4f xc = dt_simd4f_clamp(dt_simd4f_load(temp + offset), Labmin, Labmax);
+        const dt_simd4f yc = (a2 * xn[l]) + ((a3 * xa[l]) - ((b1 * yn[l]) + (b2 * ya[l])));
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+        xa[l] = xn[l];
+        xn[l] = xc;
+        ya[l] = yn[l];
+        yn[l] = yc;
 
-      _mm_store_ps(out + offset, _mm_add_ps(_mm_load_ps(out + offset), yc));
+        dt_simd4f_store(out + offset, dt_simd4f_load(out + offset) + yc);
+      }
     }
   }
 }
-#endif
 
 void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
 {
-  if(darktable.codepath.OPENMP_SIMD) return dt_gaussian_blur(g, in, out);
-#if defined(__SSE__)
-  else if(darktable.codepath.SSE2)
-    return dt_gaussian_blur_4c_sse(g, in, out);
-#endif
-  else
-    dt_unreachable_codepath();
+  // plain C on every codepath, the vector extensions compile to the native simd unit
+  dt_gaussian_blur_4c_vec(g, in, out);
 }
 
 void dt_gaussian_free(dt_gaussian_t *g)
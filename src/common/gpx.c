@@ -37,8 +37,8 @@ typedef enum _gpx_parser_element_t
 
 typedef struct dt_gpx_t
 {
-  /* the list of track records parsed */
-  GList *track;
+  /* the track records parsed, sorted by time once parsing is done */
+  GArray *track;
 
   /* currently parsed track point */
   _gpx_track_point_t *current_track_point;
@@ -89,6 +89,7 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
 
   /* allocate new dt_gpx_t context */
   gpx = g_malloc0(sizeof(dt_gpx_t));
+  gpx->track = g_array_new(FALSE, FALSE, sizeof(_gpx_track_point_t));
 
   /* skip UTF-8 BOM */
   if(gpxmf_size > 3 && gpxmf_content[0] == '\xef' && gpxmf_content[1] == '\xbb' && gpxmf_content[2] == '\xbf')
@@ -105,7 +106,7 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
   g_mapped_file_unref(gpxmf);
 
   /* safeguard against corrupt gpx files that have the points not ordered by time */
-  gpx->track = g_list_sort(gpx->track, _sort_track);
+  g_array_sort(gpx->track, _sort_track);
 
   return gpx;
 
@@ -118,6 +119,11 @@ error:
 
   if(ctx) g_markup_parse_context_free(ctx);
 
+  if(gpx)
+  {
+    g_free(gpx->current_track_point);
+    g_array_free(gpx->track, TRUE);
+  }
   g_free(gpx);
 
   if(gpxmf) g_mapped_file_unref(gpxmf);
@@ -129,7 +135,8 @@ void dt_gpx_destroy(struct dt_gpx_t *gpx)
 {
   g_assert(gpx != NULL);
 
-  if(gpx->track) g_list_free_full(gpx->track, g_free);
+  g_free(gpx->current_track_point);
+  g_array_free(gpx->track, TRUE);
 
   g_free(gpx);
 }
@@ -138,40 +145,33 @@ gboolean dt_gpx_get_location(struct dt_gpx_t *gpx, GTimeVal *timestamp, dt_image
 {
   g_assert(gpx != NULL);
 
-  GList *item = g_list_first(gpx->track);
+  const guint n = gpx->track->len;
 
   /* verify that we got at least 2 trackpoints */
-  if(!item || !item->next) return FALSE;
-
-  do
-  {
+  if(n < 2) return FALSE;
 
-    _gpx_track_point_t *tp = (_gpx_track_point_t *)item->data;
-
-    /* if timestamp is out of time range return false but fill
-       closest location value start or end point */
-    if((!item->next && timestamp->tv_sec >= tp->time.tv_sec) || (timestamp->tv_sec <= tp->time.tv_sec))
-    {
-      geoloc->longitude = tp->longitude;
-      geoloc->latitude = tp->latitude;
-      geoloc->elevation = tp->elevation;
-      return FALSE;
-    }
+  const _gpx_track_point_t *track = (const _gpx_track_point_t *)gpx->track->data;
 
-    /* check if timestamp is within current and next trackpoint */
-    if(timestamp->tv_sec >= tp->time.tv_sec
-       && timestamp->tv_sec <= ((_gpx_track_point_t *)item->next->data)->time.tv_sec)
-    {
-      geoloc->longitude = tp->longitude;
-      geoloc->latitude = tp->latitude;
-      geoloc->elevation = tp->elevation;
-      return TRUE;
-    }
+  /* binary search for the first trackpoint not before timestamp */
+  guint lo = 0, hi = n;
+  while(lo < hi)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if(track[mid].time.tv_sec < timestamp->tv_sec)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-  } while((item = g_list_next(item)) != NULL);
+  /* if timestamp is out of time range return false but fill
+     closest location value start or end point */
+  const gboolean in_range = lo > 0 && lo < n;
+  const _gpx_track_point_t *tp = lo == 0 ? &track[0] : &track[lo - 1];
 
-  /* should not reach this point */
-  return FALSE;
+  geoloc->longitude = tp->longitude;
+  geoloc->latitude = tp->latitude;
+  geoloc->elevation = tp->elevation;
+  return in_range;
 }
 
 /*
@@ -200,6 +200,7 @@ void _gpx_parser_start_element(GMarkupParseContext *ctx, const gchar *element_na
     {
       fprintf(stderr, "broken gpx file, new trkpt element before the previous ended.\n");
       g_free(gpx->current_track_point);
+      gpx->current_track_point = NULL;
     }
 
     const gchar **attribute_name = attribute_names;
@@ -275,10 +276,9 @@ void _gpx_parser_end_element(GMarkupParseContext *context, const gchar *element_
     }
     else if(strcmp(element_name, "trkpt") == 0)
     {
-      if(!gpx->invalid_track_point)
-        gpx->track = g_list_append(gpx->track, gpx->current_track_point);
-      else
-        g_free(gpx->current_track_point);
+      if(gpx->current_track_point && !gpx->invalid_track_point)
+        g_array_append_val(gpx->track, *gpx->current_track_point);
+      g_free(gpx->current_track_point);
 
       gpx->current_track_point = NULL;
     }
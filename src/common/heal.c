@@ -36,9 +36,8 @@
  * but subtract them I2 = I0 - I1, where I0 is the sample image to be
  * corrected, I1 is the reference pattern. Then we solve DeltaI=0
  * (Laplace) with I2 Dirichlet conditions at the borders of the
- * mask. The solver is a red/black checker Gauss-Seidel with over-relaxation.
- * It could benefit from a multi-grid evaluation of an initial solution
- * before the main iteration loop.
+ * mask. The solver is a multigrid v-cycle with red/black checker Gauss-Seidel
+ * smoothing, finished by Gauss-Seidel with over-relaxation.
  *
  * I reduced the convergence criteria to 0.1% (0.001) as we are
  * dealing here with RGB integer components, more is overkill.
@@ -77,15 +76,40 @@ static void dt_heal_add(const float *const first_buffer, const float *const seco
   for(int i = 0; i < i_size; i++) result_buffer[i] = first_buffer[i] + second_buffer[i];
 }
 
+/* The linear system of one grid of the solver. On the finest grid pixels is the difference image and rhs is
+ * zero, the coarser grids solve for the correction of the next finer one, with its restricted residual as rhs.
+ */
+typedef struct dt_heal_grid_t
+{
+  int width, height;
+  int nmask;       // number of unknowns
+  int nmask2;      // index of the first black cell in Adiag and Aidx
+  float *pixels;   // ch * (width * height + 1), the last pixel is the empty one of the dummy neighbours
+  float *rhs;      // ch * width * height
+  float *mask;     // width * height
+  float *Adiag;
+  int *Aidx;
+  gboolean owned;  // pixels and mask belong to the grid (not to the caller)
+  struct dt_heal_grid_t *coarse;
+} dt_heal_grid_t;
+
+// the coarsest grid, below that the relaxation converges quickly anyway
+#define DT_HEAL_COARSE_MIN 32
+
+// smoothing sweeps before and after the coarse grid correction, and the upper bound of v-cycles
+#define DT_HEAL_SMOOTH 2
+#define DT_HEAL_MAX_CYCLES 20
+
 #if defined(__SSE__)
-static float dt_heal_laplace_iteration_sse(float *pixels, const float *const Adiag, const int *const Aidx,
-                                           const float w, const int nmask_from, const int nmask_to)
+static float dt_heal_laplace_iteration_sse(float *pixels, const float *const rhs, const float *const Adiag,
+                                           const int *const Aidx, const float w, const int nmask_from,
+                                           const int nmask_to)
 {
   float err = 0.f;
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(Adiag, Aidx, w, nmask_from, nmask_to) \
+  dt_omp_firstprivate(Adiag, Aidx, rhs, w, nmask_from, nmask_to) \
   shared(pixels) \
   schedule(static) \
   reduction(+ : err)
@@ -107,15 +131,18 @@ static float dt_heal_laplace_iteration_sse(float *pixels, const float *const Adi
     __m128 valb_j2 = _mm_load_ps(pixels + j2); // S
     __m128 valb_j3 = _mm_load_ps(pixels + j3); // W
     __m128 valb_j4 = _mm_load_ps(pixels + j4); // N
+    __m128 valb_b = _mm_load_ps(rhs + j0);
 
     /*  float diff = w * (a * pixels[j0 + k] -
                             (pixels[j1 + k] +
                              pixels[j2 + k] +
                              pixels[j3 + k] +
-                             pixels[j4 + k]));*/
+                             pixels[j4 + k]) - rhs[j0 + k]);*/
     __m128 valb_diff
-        = _mm_mul_ps(valb_w, _mm_sub_ps(_mm_mul_ps(valb_a, valb_j0),
-                                        _mm_add_ps(valb_j1, _mm_add_ps(valb_j2, _mm_add_ps(valb_j3, valb_j4)))));
+        = _mm_mul_ps(valb_w, _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(valb_a, valb_j0),
+                                                   _mm_add_ps(valb_j1, _mm_add_ps(valb_j2,
+                                                                                  _mm_add_ps(valb_j3, valb_j4)))),
+                                        valb_b));
 
     /*  pixels[j0 + k] -= diff;*/
     _mm_store_ps(pixels + j0, _mm_sub_ps(valb_j0, valb_diff));
@@ -133,12 +160,12 @@ static float dt_heal_laplace_iteration_sse(float *pixels, const float *const Adi
 #endif
 
 // Perform one iteration of Gauss-Seidel, and return the sum squared residual.
-static float dt_heal_laplace_iteration(float *pixels, const float *const Adiag, const int *const Aidx,
-                                       const float w, const int nmask_from, const int nmask_to, const int ch,
-                                       const int use_sse)
+static float dt_heal_laplace_iteration(float *pixels, const float *const rhs, const float *const Adiag,
+                                       const int *const Aidx, const float w, const int nmask_from,
+                                       const int nmask_to, const int ch, const int use_sse)
 {
 #if defined(__SSE__)
-  if(ch == 4 && use_sse) return dt_heal_laplace_iteration_sse(pixels, Adiag, Aidx, w, nmask_from, nmask_to);
+  if(ch == 4 && use_sse) return dt_heal_laplace_iteration_sse(pixels, rhs, Adiag, Aidx, w, nmask_from, nmask_to);
 #endif
 
   float err = 0.f;
@@ -146,7 +173,7 @@ static float dt_heal_laplace_iteration(float *pixels, const float *const Adiag,
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(Adiag, Aidx, w, nmask_from, nmask_to, ch1) \
+  dt_omp_firstprivate(Adiag, Aidx, rhs, w, nmask_from, nmask_to, ch1) \
   shared(pixels) \
   schedule(static) \
   reduction(+ : err)
@@ -162,8 +189,8 @@ static float dt_heal_laplace_iteration(float *pixels, const float *const Adiag,
 
     for(int k = 0; k < ch1; k++)
     {
-      const float diff
-          = w * (a * pixels[j0 + k] - (pixels[j1 + k] + pixels[j2 + k] + pixels[j3 + k] + pixels[j4 + k]));
+      const float diff = w * (a * pixels[j0 + k] - (pixels[j1 + k] + pixels[j2 + k] + pixels[j3 + k] + pixels[j4 + k])
+                              - rhs[j0 + k]);
 
       pixels[j0 + k] -= diff;
       err += diff * diff;
@@ -173,21 +200,32 @@ static float dt_heal_laplace_iteration(float *pixels, const float *const Adiag,
   return err;
 }
 
-// Solve the laplace equation for pixels and store the result in-place.
-static void dt_heal_laplace_loop(float *pixels, const int width, const int height, const int ch,
-                                 const float *const mask, const int use_sse)
+// one red and one black half sweep over the grid
+static float dt_heal_laplace_sweep(dt_heal_grid_t *g, const float w, const int ch, const int use_sse)
+{
+  float err = dt_heal_laplace_iteration(g->pixels, g->rhs, g->Adiag, g->Aidx, w, 0, g->nmask2, ch, use_sse);
+  err += dt_heal_laplace_iteration(g->pixels, g->rhs, g->Adiag, g->Aidx, w, g->nmask2, g->nmask, ch, use_sse);
+  return err;
+}
+
+// Build the system of equations of the masked pixels of the grid. Returns FALSE if out of memory.
+static gboolean dt_heal_grid_build(dt_heal_grid_t *g, const int ch)
 {
+  const int width = g->width;
+  const int height = g->height;
+  const float *const mask = g->mask;
   int nmask = 0;
-  int nmask2 = 0;
 
-  float *Adiag = dt_alloc_align(64, sizeof(float) * width * height);
-  int *Aidx = dt_alloc_align(64, sizeof(int) * 5 * width * height);
+  g->Adiag = dt_alloc_align(64, sizeof(float) * width * height);
+  g->Aidx = dt_alloc_align(64, sizeof(int) * 5 * width * height);
+  g->rhs = dt_alloc_align(64, sizeof(float) * ch * width * height);
 
-  if((Adiag == NULL) || (Aidx == NULL))
-  {
-    fprintf(stderr, "dt_heal_laplace_loop: error allocating memory for healing\n");
-    goto cleanup;
-  }
+  if((g->Adiag == NULL) || (g->Aidx == NULL) || (g->rhs == NULL)) return FALSE;
+
+  memset(g->rhs, 0, sizeof(float) * ch * width * height);
+
+  float *const Adiag = g->Adiag;
+  int *const Aidx = g->Aidx;
 
   /* All off-diagonal elements of A are either -1 or 0. We could store it as a
    * general-purpose sparse matrix, but that adds some unnecessary overhead to
@@ -196,7 +234,7 @@ static void dt_heal_laplace_loop(float *pixels, const int width, const int heigh
    * coefs can put them in a dummy column to be multiplied by an empty pixel.
    */
   const int zero = ch * width * height;
-  memset(pixels + zero, 0, ch * sizeof(float));
+  memset(g->pixels + zero, 0, ch * sizeof(float));
 
   /* Construct the system of equations.
    * Arrange Aidx in checkerboard order, so that a single linear pass over that
@@ -204,7 +242,7 @@ static void dt_heal_laplace_loop(float *pixels, const int width, const int heigh
    */
   for(int parity = 0; parity < 2; parity++)
   {
-    if(parity == 1) nmask2 = nmask;
+    if(parity == 1) g->nmask2 = nmask;
 
     for(int i = 0; i < height; i++)
     {
@@ -235,31 +273,317 @@ static void dt_heal_laplace_loop(float *pixels, const int width, const int heigh
 
 #undef A_NEIGHBOR
 
+  g->nmask = nmask;
+  return TRUE;
+}
+
+static void dt_heal_grid_free(dt_heal_grid_t *g)
+{
+  while(g)
+  {
+    dt_heal_grid_t *coarse = g->coarse;
+    if(g->Adiag) dt_free_align(g->Adiag);
+    if(g->Aidx) dt_free_align(g->Aidx);
+    if(g->rhs) dt_free_align(g->rhs);
+    if(g->owned)
+    {
+      if(g->pixels) dt_free_align(g->pixels);
+      if(g->mask) dt_free_align(g->mask);
+    }
+    free(g);
+    g = coarse;
+  }
+}
+
+// Returns the grid of half the size of g, and recursively its own coarser grids, NULL if g is small enough
+// to be solved directly. A coarse cell is only unknown if all its pixels are, growing the domain at the
+// edges of the mask makes the v-cycles diverge. The smoothing takes care of the fine pixels left out.
+static dt_heal_grid_t *dt_heal_grid_coarsen(const dt_heal_grid_t *const g, const int ch)
+{
+  if(g->width < 2 * DT_HEAL_COARSE_MIN || g->height < 2 * DT_HEAL_COARSE_MIN) return NULL;
+
+  dt_heal_grid_t *c = (dt_heal_grid_t *)calloc(1, sizeof(dt_heal_grid_t));
+  if(c == NULL) return NULL;
+
+  c->owned = TRUE;
+  c->width = (g->width + 1) / 2;
+  c->height = (g->height + 1) / 2;
+  c->pixels = dt_alloc_align(64, sizeof(float) * ch * ((size_t)c->width * c->height + 1));
+  c->mask = dt_alloc_align(64, sizeof(float) * c->width * c->height);
+  if((c->pixels == NULL) || (c->mask == NULL)) goto error;
+
+  for(int ci = 0; ci < c->height; ci++)
+    for(int cj = 0; cj < c->width; cj++)
+    {
+      int masked = 1;
+      for(int i = 2 * ci; i < MIN(2 * ci + 2, g->height); i++)
+        for(int j = 2 * cj; j < MIN(2 * cj + 2, g->width); j++) masked &= (g->mask[i * g->width + j] != 0.f);
+      c->mask[ci * c->width + cj] = masked ? 1.f : 0.f;
+    }
+
+  if(!dt_heal_grid_build(c, ch)) goto error;
+
+  c->coarse = dt_heal_grid_coarsen(c, ch);
+  return c;
+
+error:
+  // not fatal, the finer grid is just solved by relaxation alone
+  dt_heal_grid_free(c);
+  return NULL;
+}
+
+// Restrict the residual of the fine grid into the rhs of the coarse one, and start it from a zero correction.
+static void dt_heal_grid_restrict(const dt_heal_grid_t *const g, dt_heal_grid_t *c, const int ch)
+{
+  const int width = g->width;
+  const int height = g->height;
+  const float *const pixels = g->pixels;
+  const float *const rhs = g->rhs;
+  const float *const mask = g->mask;
+  const int cwidth = c->width;
+  const int cheight = c->height;
+  float *const crhs = c->rhs;
+
+  memset(c->pixels, 0, sizeof(float) * ch * ((size_t)cwidth * cheight + 1));
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(ch, cheight, crhs, cwidth, height, mask, pixels, rhs, width) \
+  schedule(static)
+#endif
+  for(int ci = 0; ci < cheight; ci++)
+  {
+    for(int cj = 0; cj < cwidth; cj++)
+    {
+      float *const r = crhs + (ci * cwidth + cj) * ch;
+      for(int k = 0; k < ch; k++) r[k] = 0.f;
+
+      for(int i = 2 * ci; i < MIN(2 * ci + 2, height); i++)
+        for(int j = 2 * cj; j < MIN(2 * cj + 2, width); j++)
+        {
+          if(mask[i * width + j] == 0.f) continue;
+
+          const float *const p = pixels + (i * width + j) * ch;
+          const float a = 4 - (i == 0) - (j == 0) - (i == height - 1) - (j == width - 1);
+          for(int k = 0; k < ch; k++)
+          {
+            float sum = 0.f;
+            if(j < width - 1) sum += p[ch + k];
+            if(i < height - 1) sum += p[width * ch + k];
+            if(j > 0) sum += p[k - ch];
+            if(i > 0) sum += p[k - width * ch];
+            // the coarse operator carries four times the fine residual of a cell, summing does the averaging
+            r[k] += rhs[(i * width + j) * ch + k] - (a * p[k] - sum);
+          }
+        }
+    }
+  }
+}
+
+// Interpolate the correction of the coarse grid bilinearly and add it to the unknowns of the fine one.
+static void dt_heal_grid_prolong(dt_heal_grid_t *g, const dt_heal_grid_t *const c, const int ch)
+{
+  const int width = g->width;
+  const int height = g->height;
+  float *const pixels = g->pixels;
+  const float *const mask = g->mask;
+  const int cwidth = c->width;
+  const int cheight = c->height;
+  const float *const cpixels = c->pixels;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(ch, cheight, cpixels, cwidth, height, mask, pixels, width) \
+  schedule(static)
+#endif
+  for(int i = 0; i < height; i++)
+  {
+    const float fi = CLAMPS((i + 0.5f) * 0.5f - 0.5f, 0.f, cheight - 1);
+    const int i0 = MIN((int)fi, cheight - 2);
+    const float ti = fi - i0;
+    for(int j = 0; j < width; j++)
+    {
+      if(mask[i * width + j] == 0.f) continue;
+
+      const float fj = CLAMPS((j + 0.5f) * 0.5f - 0.5f, 0.f, cwidth - 1);
+      const int j0 = MIN((int)fj, cwidth - 2);
+      const float tj = fj - j0;
+      const float *const c00 = cpixels + (i0 * cwidth + j0) * ch;
+      const float *const c10 = c00 + cwidth * ch;
+      for(int k = 0; k < ch; k++)
+        pixels[(i * width + j) * ch + k] += (1.f - ti) * ((1.f - tj) * c00[k] + tj * c00[ch + k])
+                                            + ti * ((1.f - tj) * c10[k] + tj * c10[ch + k]);
+    }
+  }
+}
+
+/* Gauss-Seidel with successive over-relaxation until the sum of the squared updates drops below err_exit,
+ * the plain solver for the coarsest grid and the final one for the finest.
+ */
+static void dt_heal_grid_relax(dt_heal_grid_t *g, const int ch, const int use_sse)
+{
   /* Empirically optimal over-relaxation factor. (Benchmarked on
    * round brushes, at least. I don't know whether aspect ratio
    * affects it.)
    */
-  float w = ((2.0f - 1.0f / (0.1575f * sqrtf(nmask) + 0.8f)) * .25f);
+  const float w = ((2.0f - 1.0f / (0.1575f * sqrtf(g->nmask) + 0.8f)) * .25f);
 
   const int max_iter = 1000;
   const float epsilon = (0.1 / 255);
   const float err_exit = epsilon * epsilon * w * w;
 
-  /* Gauss-Seidel with successive over-relaxation */
   for(int iter = 0; iter < max_iter; iter++)
   {
-    // process red/black cells separate
-    float err = dt_heal_laplace_iteration(pixels, Adiag, Aidx, w, 0, nmask2, ch, use_sse);
-    err += dt_heal_laplace_iteration(pixels, Adiag, Aidx, w, nmask2, nmask, ch, use_sse);
+    if(dt_heal_laplace_sweep(g, w, ch, use_sse) < err_exit) break;
+  }
+}
+
+// One multigrid v-cycle, returns the sum of the squared updates of the last smoothing sweep.
+static float dt_heal_grid_vcycle(dt_heal_grid_t *g, const int ch, const int use_sse)
+{
+  if(g->coarse == NULL)
+  {
+    dt_heal_grid_relax(g, ch, use_sse);
+    return 0.f;
+  }
+
+  // plain Gauss-Seidel smooths best
+  const float w = 0.25f;
+  for(int k = 0; k < DT_HEAL_SMOOTH; k++) dt_heal_laplace_sweep(g, w, ch, use_sse);
+
+  dt_heal_grid_restrict(g, g->coarse, ch);
+  dt_heal_grid_vcycle(g->coarse, ch, use_sse);
+  dt_heal_grid_prolong(g, g->coarse, ch);
+
+  float err = 0.f;
+  for(int k = 0; k < DT_HEAL_SMOOTH; k++) err = dt_heal_laplace_sweep(g, w, ch, use_sse);
+  return err;
+}
+
+// Solve the laplace equation for pixels and store the result in-place.
+static void dt_heal_laplace_loop(float *pixels, const int width, const int height, const int ch,
+                                 const float *const mask, const int use_sse)
+{
+  dt_heal_grid_t *g = (dt_heal_grid_t *)calloc(1, sizeof(dt_heal_grid_t));
+  if(g == NULL)
+  {
+    fprintf(stderr, "dt_heal_laplace_loop: error allocating memory for healing\n");
+    return;
+  }
+
+  g->width = width;
+  g->height = height;
+  g->pixels = pixels;
+  g->mask = (float *)mask;
+  g->owned = FALSE;
+
+  if(!dt_heal_grid_build(g, ch))
+  {
+    fprintf(stderr, "dt_heal_laplace_loop: error allocating memory for healing\n");
+    goto cleanup;
+  }
+
+  g->coarse = dt_heal_grid_coarsen(g, ch);
 
-    if(err < err_exit) break;
+  /* Multigrid v-cycles take care of the smooth part of the error the relaxation is slow at. They stop with
+   * the same criterion as the relaxation (for its weight of the smoothing), which takes over if they don't
+   * converge or if the patch is too small for a coarser grid.
+   */
+  gboolean converged = FALSE;
+  if(g->coarse)
+  {
+    const float epsilon = (0.1 / 255);
+    const float err_exit = epsilon * epsilon * 0.0625f;
+    for(int cycle = 0; cycle < DT_HEAL_MAX_CYCLES && !converged; cycle++)
+      converged = dt_heal_grid_vcycle(g, ch, use_sse) < err_exit;
   }
 
+  if(!converged) dt_heal_grid_relax(g, ch, use_sse);
+
 cleanup:
-  if(Adiag) dt_free_align(Adiag);
-  if(Aidx) dt_free_align(Aidx);
+  dt_heal_grid_free(g);
+}
+
+
+/* Healed patches of the last runs. A pipe run which doesn't touch a heal shape hands it the same source,
+ * destination and mask again, the result is looked up by a hash of all three instead of solved again.
+ */
+#define DT_HEAL_CACHE_ENTRIES 4
+
+typedef struct dt_heal_cache_entry_t
+{
+  uint64_t hash;
+  int width, height, ch;
+  uint64_t age;
+  float *healed;
+} dt_heal_cache_entry_t;
+
+static GMutex _heal_cache_lock;
+static dt_heal_cache_entry_t _heal_cache[DT_HEAL_CACHE_ENTRIES];
+static uint64_t _heal_cache_age = 0;
+
+static uint64_t dt_heal_hash(uint64_t hash, const float *const buffer, const size_t n)
+{
+  // fnv-1a over the bit patterns of the floats
+  const uint32_t *const words = (const uint32_t *)buffer;
+  for(size_t i = 0; i < n; i++) hash = (hash ^ words[i]) * 0x100000001b3ull;
+  return hash;
+}
+
+static gboolean dt_heal_cache_lookup(const uint64_t hash, float *dest_buffer, const int width, const int height,
+                                     const int ch)
+{
+  gboolean found = FALSE;
+  g_mutex_lock(&_heal_cache_lock);
+  for(int k = 0; k < DT_HEAL_CACHE_ENTRIES; k++)
+  {
+    dt_heal_cache_entry_t *e = _heal_cache + k;
+    if(e->healed && e->hash == hash && e->width == width && e->height == height && e->ch == ch)
+    {
+      memcpy(dest_buffer, e->healed, sizeof(float) * width * height * ch);
+      e->age = ++_heal_cache_age;
+      found = TRUE;
+      break;
+    }
+  }
+  g_mutex_unlock(&_heal_cache_lock);
+  return found;
 }
 
+static void dt_heal_cache_insert(const uint64_t hash, const float *const dest_buffer, const int width,
+                                 const int height, const int ch)
+{
+  float *healed = dt_alloc_align(64, sizeof(float) * width * height * ch);
+  if(healed == NULL) return;
+  memcpy(healed, dest_buffer, sizeof(float) * width * height * ch);
+
+  g_mutex_lock(&_heal_cache_lock);
+  // replace the least recently used entry
+  dt_heal_cache_entry_t *e = _heal_cache;
+  for(int k = 1; k < DT_HEAL_CACHE_ENTRIES; k++)
+    if(_heal_cache[k].age < e->age) e = _heal_cache + k;
+  float *old = e->healed;
+  e->hash = hash;
+  e->width = width;
+  e->height = height;
+  e->ch = ch;
+  e->age = ++_heal_cache_age;
+  e->healed = healed;
+  g_mutex_unlock(&_heal_cache_lock);
+
+  if(old) dt_free_align(old);
+}
+
+void dt_heal_cleanup()
+{
+  g_mutex_lock(&_heal_cache_lock);
+  for(int k = 0; k < DT_HEAL_CACHE_ENTRIES; k++)
+  {
+    if(_heal_cache[k].healed) dt_free_align(_heal_cache[k].healed);
+    memset(_heal_cache + k, 0, sizeof(dt_heal_cache_entry_t));
+  }
+  g_mutex_unlock(&_heal_cache_lock);
+}
 
 /* Original Algorithm Design:
  *
@@ -269,6 +593,13 @@ cleanup:
 void dt_heal(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer, const int width,
              const int height, const int ch, const int use_sse)
 {
+  const size_t npixels = (size_t)width * height;
+  uint64_t hash = 14695981039346656037ull;
+  hash = dt_heal_hash(hash, src_buffer, npixels * ch);
+  hash = dt_heal_hash(hash, dest_buffer, npixels * ch);
+  hash = dt_heal_hash(hash, mask_buffer, npixels);
+  if(dt_heal_cache_lookup(hash, dest_buffer, width, height, ch)) return;
+
   float *diff_buffer = dt_alloc_align(64, width * (height + 1) * ch * sizeof(float));
 
   if(diff_buffer == NULL)
@@ -285,6 +616,8 @@ void dt_heal(const float *const src_buffer, float *dest_buffer, const float *con
   /* add solution to original image and store in dest */
   dt_heal_add(diff_buffer, src_buffer, dest_buffer, width, height, ch);
 
+  dt_heal_cache_insert(hash, dest_buffer, width, height, ch);
+
 cleanup:
   if(diff_buffer) dt_free_align(diff_buffer);
 }
@@ -19,12 +19,17 @@
 #ifndef DT_DEVELOP_HEAL_H
 #define DT_DEVELOP_HEAL_H
 
+#include "common/opencl.h"
+
 /* heals dest_buffer using src_buffer as a reference and mask_buffer to define the area to be healed
  * the 3 buffers must have the same size, but mask_buffer is 1 channel and is tested for != 0.f
  */
 void dt_heal(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer, const int width,
              const int height, const int ch, const int use_sse);
 
+/* frees the patches dt_heal() keeps for the next pipe runs */
+void dt_heal_cleanup(void);
+
 #ifdef HAVE_OPENCL
 
 typedef struct dt_heal_cl_global_t
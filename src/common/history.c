@@ -483,36 +483,29 @@ int dt_history_merge_module_into_history(dt_develop_t *dev_dest, dt_develop_t *d
   return module_added;
 }
 
-static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_imgid, GList *ops)
+// the source of a merge paste: its develop with the history applied and the modules to merge. loading the
+// modules and reading the history is the expensive part, so pasting onto a list does it only once.
+typedef struct dt_history_merge_src_t
 {
-  GList *modules_used = NULL;
-
-  dt_develop_t _dev_src = { 0 };
-  dt_develop_t _dev_dest = { 0 };
+  int32_t imgid;
+  dt_develop_t dev;
+  GList *mod_list;
+} dt_history_merge_src_t;
 
-  dt_develop_t *dev_src = &_dev_src;
-  dt_develop_t *dev_dest = &_dev_dest;
+static void _history_merge_src_init(dt_history_merge_src_t *src, int32_t imgid, GList *ops)
+{
+  dt_develop_t *dev_src = &src->dev;
+  memset(dev_src, 0, sizeof(dt_develop_t));
+  src->imgid = imgid;
 
   // we will do the copy/paste on memory so we can deal with masks
   dt_dev_init(dev_src, FALSE);
-  dt_dev_init(dev_dest, FALSE);
-
   dev_src->iop = dt_iop_load_modules_ext(dev_src, TRUE);
-  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
-
   dt_dev_read_history_ext(dev_src, imgid, TRUE);
 
-  // This prepends the default modules and converts just in case it's an empty history
-  dt_dev_read_history_ext(dev_dest, dest_imgid, TRUE);
-
   dt_ioppr_check_iop_order(dev_src, imgid, "_history_copy_and_paste_on_image_merge ");
-  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge ");
-
   dt_dev_pop_history_items_ext(dev_src, dev_src->history_end);
-  dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
-
   dt_ioppr_check_iop_order(dev_src, imgid, "_history_copy_and_paste_on_image_merge 1");
-  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 1");
 
   GList *mod_list = NULL;
 
@@ -565,6 +558,255 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   }
   if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv\n");
 
+  src->mod_list = mod_list;
+}
+
+static void _history_merge_src_cleanup(dt_history_merge_src_t *src)
+{
+  g_list_free(src->mod_list);
+  src->mod_list = NULL;
+  dt_dev_cleanup(&src->dev);
+  src->imgid = -1;
+}
+
+// an instance of a module in the history of the destination of a merge paste
+typedef struct dt_history_merge_instance_t
+{
+  dt_dev_operation_t op;
+  int multi_priority;
+  char multi_name[128];
+  gboolean in_history; // FALSE for the base instance of a module not in history
+  gboolean used;       // already replaced by a module of the source
+} dt_history_merge_instance_t;
+
+static dt_iop_module_so_t *_history_get_so(const char *op)
+{
+  for(GList *l = darktable.iop; l; l = g_list_next(l))
+  {
+    dt_iop_module_so_t *so = (dt_iop_module_so_t *)l->data;
+    if(!strcmp(so->op, op)) return so;
+  }
+  return NULL;
+}
+
+static dt_history_merge_instance_t *_history_get_instance(GList *instances, const char *op,
+                                                          const int multi_priority)
+{
+  for(GList *l = instances; l; l = g_list_next(l))
+  {
+    dt_history_merge_instance_t *inst = (dt_history_merge_instance_t *)l->data;
+    if(!strcmp(inst->op, op) && inst->multi_priority == multi_priority) return inst;
+  }
+  return NULL;
+}
+
+/* the merge paste without a develop for the destination, straight on the history rows. this is what
+   dt_history_merge_module_into_history() followed by dt_dev_write_history_ext() ends up writing, but only
+   for the simple and by far most common case:
+   - the destination history is contiguous, history_end is at its top and the auto presets are applied,
+   - all its rows have the current module and blend versions, so nothing needs to be upgraded,
+   - every pasted module replaces an existing instance (no new instances) and uses no masks.
+   returns FALSE without touching anything if the develop based merge is needed. */
+static gboolean _history_copy_and_paste_on_image_merge_sql(dt_history_merge_src_t *src, int32_t dest_imgid)
+{
+  sqlite3_stmt *stmt;
+  int history_end = 0;
+  int flags = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT history_end, flags FROM main.images WHERE id = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    history_end = sqlite3_column_int(stmt, 0);
+    flags = sqlite3_column_int(stmt, 1);
+  }
+  sqlite3_finalize(stmt);
+  if(history_end <= 0 || !(flags & DT_IMAGE_AUTO_PRESETS_APPLIED)) return FALSE;
+
+  gboolean ok = TRUE;
+  int count = 0;
+  GList *instances = NULL;
+  dt_history_merge_instance_t *top = NULL;
+  int top_enabled = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT num, operation, module, enabled, blendop_params IS NULL, blendop_version,"
+                              "       multi_priority, multi_name"
+                              " FROM main.history"
+                              " WHERE imgid = ?1"
+                              " ORDER BY num",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+  while(ok && sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *op = (const char *)sqlite3_column_text(stmt, 1);
+    dt_iop_module_so_t *so = op ? _history_get_so(op) : NULL;
+    if(sqlite3_column_int(stmt, 0) != count++ || !so || so->version() != sqlite3_column_int(stmt, 2)
+       || (!sqlite3_column_int(stmt, 4) && sqlite3_column_int(stmt, 5) != dt_develop_blend_version()))
+    {
+      ok = FALSE;
+      break;
+    }
+    const int multi_priority = sqlite3_column_int(stmt, 6);
+    dt_history_merge_instance_t *inst = _history_get_instance(instances, op, multi_priority);
+    if(!inst)
+    {
+      inst = (dt_history_merge_instance_t *)calloc(1, sizeof(dt_history_merge_instance_t));
+      g_strlcpy(inst->op, op, sizeof(inst->op));
+      inst->multi_priority = multi_priority;
+      inst->in_history = TRUE;
+      instances = g_list_append(instances, inst);
+    }
+    // the last history item of an instance sets its name
+    const char *multi_name = (const char *)sqlite3_column_text(stmt, 7);
+    g_strlcpy(inst->multi_name, multi_name ? multi_name : "", sizeof(inst->multi_name));
+    top = inst;
+    top_enabled = sqlite3_column_int(stmt, 3);
+  }
+  sqlite3_finalize(stmt);
+  if(count != history_end) ok = FALSE;
+
+  // the instance of the destination each source module goes to
+  const int nb = g_list_length(src->mod_list);
+  dt_history_merge_instance_t **dest = (dt_history_merge_instance_t **)calloc(MAX(nb, 1), sizeof(void *));
+  GList *iop_order_list = ok ? dt_ioppr_get_iop_order_list(dest_imgid, FALSE) : NULL;
+  int k = 0;
+  for(GList *l = src->mod_list; ok && l; l = g_list_next(l), k++)
+  {
+    const dt_iop_module_t *mod = (dt_iop_module_t *)l->data;
+    if((mod->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && mod->blend_params->mask_id > 0)
+    {
+      ok = FALSE;
+      break;
+    }
+
+    // the develop always has the base instance, with or without history
+    if(!_history_get_instance(instances, mod->op, 0))
+    {
+      dt_history_merge_instance_t *inst = (dt_history_merge_instance_t *)calloc(1, sizeof(dt_history_merge_instance_t));
+      g_strlcpy(inst->op, mod->op, sizeof(inst->op));
+      instances = g_list_append(instances, inst);
+    }
+
+    if(mod->flags() & IOP_FLAGS_ONE_INSTANCE)
+      dest[k] = _history_get_instance(instances, mod->op, 0);
+    else
+    {
+      // an unused instance of the same name, which must be unique as we don't know the pipe order here
+      int matches = 0;
+      gboolean in_history = FALSE;
+      for(GList *i = instances; i; i = g_list_next(i))
+      {
+        dt_history_merge_instance_t *inst = (dt_history_merge_instance_t *)i->data;
+        if(strcmp(inst->op, mod->op)) continue;
+        in_history |= inst->in_history;
+        if(!inst->used && !strcmp(inst->multi_name, mod->multi_name))
+        {
+          matches++;
+          dest[k] = inst;
+        }
+      }
+      if(matches > 1)
+        ok = FALSE;
+      else if(matches == 1)
+        dest[k]->used = TRUE;
+      else if(!in_history)
+        dest[k] = _history_get_instance(instances, mod->op, 0);
+      else
+        ok = FALSE; // needs a new instance
+    }
+
+    if(ok && !dt_ioppr_get_iop_order_entry(iop_order_list, dest[k]->op, dest[k]->multi_priority)) ok = FALSE;
+  }
+  g_list_free_full(iop_order_list, g_free);
+
+  if(ok)
+  {
+    k = 0;
+    for(GList *l = src->mod_list; l; l = g_list_next(l), k++)
+    {
+      const dt_iop_module_t *mod = (dt_iop_module_t *)l->data;
+      const gboolean blending = mod->flags() & IOP_FLAGS_SUPPORTS_BLENDING;
+      if(dest[k] == top)
+      {
+        // same module on top of history, the develop changes that item in place
+        const int enabled = (!top_enabled && !mod->enabled) ? 1 : mod->enabled;
+        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                    "UPDATE main.history"
+                                    " SET op_params = ?3, module = ?4, enabled = ?5, multi_name = ?6,"
+                                    "     blendop_params = CASE WHEN ?7 THEN ?8 ELSE blendop_params END,"
+                                    "     blendop_version = CASE WHEN ?7 THEN ?9 ELSE blendop_version END"
+                                    " WHERE imgid = ?1 AND num = ?2",
+                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, history_end - 1);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 5, enabled);
+        top_enabled = enabled;
+      }
+      else
+      {
+        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                    "INSERT INTO main.history"
+                                    "  (imgid, num, operation, op_params, module, enabled, multi_name,"
+                                    "   blendop_params, blendop_version, multi_priority)"
+                                    " VALUES (?1, ?2, ?10, ?3, ?4, ?5, ?6, ?8, ?9, ?11)",
+                                    -1, &stmt, NULL);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, history_end++);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 5, mod->enabled);
+        DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, mod->op, -1, SQLITE_TRANSIENT);
+        DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, dest[k]->multi_priority);
+        top = dest[k];
+        top_enabled = mod->enabled;
+      }
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+      DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 3, mod->params, mod->params_size, SQLITE_TRANSIENT);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 4, mod->version());
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, mod->multi_name, -1, SQLITE_TRANSIENT);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 7, blending);
+      DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 8, mod->blend_params, sizeof(dt_develop_blend_params_t), SQLITE_TRANSIENT);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 9, dt_develop_blend_version());
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+      g_strlcpy(dest[k]->multi_name, mod->multi_name, sizeof(dest[k]->multi_name));
+    }
+
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "UPDATE main.images SET history_end = ?2 WHERE id = ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, history_end);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    dt_history_hash_write_from_history(dest_imgid, DT_HISTORY_HASH_CURRENT);
+  }
+
+  free(dest);
+  g_list_free_full(instances, free);
+  return ok;
+}
+
+static int _history_copy_and_paste_on_image_merge(dt_history_merge_src_t *src, int32_t dest_imgid)
+{
+  GList *modules_used = NULL;
+
+  dt_develop_t _dev_dest = { 0 };
+
+  dt_develop_t *dev_src = &src->dev;
+  dt_develop_t *dev_dest = &_dev_dest;
+
+  dt_dev_init(dev_dest, FALSE);
+
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+
+  // This prepends the default modules and converts just in case it's an empty history
+  dt_dev_read_history_ext(dev_dest, dest_imgid, TRUE);
+
+  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge ");
+
+  dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
+
+  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 1");
+
+  GList *mod_list = src->mod_list;
+
   // update iop-order list to have entries for the new modules
   dt_ioppr_update_for_modules(dev_dest, mod_list, FALSE);
 
@@ -584,7 +826,6 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   // write history and forms to db
   dt_dev_write_history_ext(dev_dest, dest_imgid);
 
-  dt_dev_cleanup(dev_src);
   dt_dev_cleanup(dev_dest);
 
   g_list_free(modules_used);
@@ -592,7 +833,29 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   return 0;
 }
 
-static int _history_copy_and_paste_on_image_overwrite(int32_t imgid, int32_t dest_imgid, GList *ops)
+// merges the history of imgid into dest_imgid. src, if given, keeps the loaded source for the next image.
+static int _history_copy_and_paste_on_image_merge_src(int32_t imgid, int32_t dest_imgid, GList *ops,
+                                                      dt_history_merge_src_t *src)
+{
+  dt_history_merge_src_t _src;
+  if(!src)
+  {
+    src = &_src;
+    _history_merge_src_init(src, imgid, ops);
+  }
+  else if(src->imgid != imgid)
+    _history_merge_src_init(src, imgid, ops);
+
+  int ret_val = 0;
+  if(!_history_copy_and_paste_on_image_merge_sql(src, dest_imgid))
+    ret_val = _history_copy_and_paste_on_image_merge(src, dest_imgid);
+
+  if(src == &_src) _history_merge_src_cleanup(src);
+  return ret_val;
+}
+
+static int _history_copy_and_paste_on_image_overwrite(int32_t imgid, int32_t dest_imgid, GList *ops,
+                                                      dt_history_merge_src_t *src)
 {
   int ret_val = 0;
   sqlite3_stmt *stmt;
@@ -710,13 +973,15 @@ static int _history_copy_and_paste_on_image_overwrite(int32_t imgid, int32_t des
   else
   {
     // since the history and masks where deleted we can do a merge
-    ret_val = _history_copy_and_paste_on_image_merge(imgid, dest_imgid, ops);
+    ret_val = _history_copy_and_paste_on_image_merge_src(imgid, dest_imgid, ops, src);
   }
 
   return ret_val;
 }
 
-int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops, gboolean copy_iop_order)
+// src, if given, is the already loaded source of a merge paste onto several images
+static int _history_copy_and_paste_on_image_ext(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops,
+                                                gboolean copy_iop_order, dt_history_merge_src_t *src)
 {
   if(imgid == dest_imgid) return 1;
 
@@ -745,9 +1010,9 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
 
   int ret_val = 0;
   if(merge)
-    ret_val = _history_copy_and_paste_on_image_merge(imgid, dest_imgid, ops);
+    ret_val = _history_copy_and_paste_on_image_merge_src(imgid, dest_imgid, ops, src);
   else
-    ret_val = _history_copy_and_paste_on_image_overwrite(imgid, dest_imgid, ops);
+    ret_val = _history_copy_and_paste_on_image_overwrite(imgid, dest_imgid, ops, src);
 
   dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
   dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
@@ -789,6 +1054,27 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   return ret_val;
 }
 
+int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops, gboolean copy_iop_order)
+{
+  return _history_copy_and_paste_on_image_ext(imgid, dest_imgid, merge, ops, copy_iop_order, NULL);
+}
+
+// pastes the copied history onto every image of the list, reading the source only once
+static void _history_paste_on_list(GList *list, gboolean merge)
+{
+  dt_history_merge_src_t src = { .imgid = -1 };
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
+  for(GList *l = list; l; l = g_list_next(l))
+  {
+    const int dest = GPOINTER_TO_INT(l->data);
+    _history_copy_and_paste_on_image_ext(darktable.view_manager->copy_paste.copied_imageid, dest, merge,
+                                         darktable.view_manager->copy_paste.selops,
+                                         darktable.view_manager->copy_paste.copy_iop_order, &src);
+  }
+  dt_database_release_transaction(darktable.db, transaction);
+  if(src.imgid != -1) _history_merge_src_cleanup(&src);
+}
+
 GList *dt_history_get_items(int32_t imgid, gboolean enabled)
 {
   GList *result = NULL;
@@ -1050,6 +1336,8 @@ void dt_history_compress_on_image(int32_t imgid)
 int dt_history_compress_on_list(GList *imgs)
 {
   int uncompressed=0;
+  // one transaction for the whole list, the rows of each image are rewritten several times
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
 
   // Get the list of selected images
   GList *l = g_list_first(imgs);
@@ -1063,55 +1351,31 @@ int dt_history_compress_on_list(GList *imgs)
       dt_history_set_compress_problem(imgid, FALSE);
       dt_history_compress_on_image(imgid);
 
-      // now the modules are in right order but need renumbering to remove leaks
-      int max=0;    // the maximum num in main_history for an image
-      int size=0;   // the number of items in main_history for an image
-      int done=0;   // used for renumbering index
-
-      sqlite3_stmt *stmt2;
+      // now the modules are in right order but need renumbering to remove leaks.
+      // nums are unique per image, so the rank of a row is its new num.
+      int done = 0; // used for renumbering index
 
-      // get highest num in history
+      sqlite3_stmt *stmt2, *stmt3;
       DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "SELECT MAX(num) FROM main.history WHERE imgid=?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-      if (sqlite3_step(stmt2) == SQLITE_ROW)
-        max = sqlite3_column_int(stmt2, 0);
-      sqlite3_finalize(stmt2);
-
-      // get number of items in main.history
+        "SELECT rowid, num FROM main.history WHERE imgid = ?1 ORDER BY num", -1, &stmt2, NULL);
       DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "SELECT COUNT(*) FROM main.history WHERE imgid = ?1", -1, &stmt2, NULL);
+        "UPDATE main.history SET num = ?2 WHERE rowid = ?1", -1, &stmt3, NULL);
       DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-      if(sqlite3_step(stmt2) == SQLITE_ROW)
-        size = sqlite3_column_int(stmt2, 0);
-      sqlite3_finalize(stmt2);
-
-      if ((size>0) && (max>0))
+      while(sqlite3_step(stmt2) == SQLITE_ROW)
       {
-        for (int index=0;index<(max+1);index++)
+        // only the rows above the first gap move
+        if(sqlite3_column_int(stmt2, 1) != done)
         {
-          sqlite3_stmt *stmt3;
-          DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-            "SELECT num FROM main.history WHERE imgid=?1 AND num=?2", -1, &stmt3, NULL);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 1, imgid);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 2, index);
-          if (sqlite3_step(stmt3) == SQLITE_ROW)
-          {
-            sqlite3_stmt *stmt4;
-            // step by step set the correct num
-            DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-              "UPDATE main.history SET num = ?3 WHERE imgid = ?1 AND num = ?2", -1, &stmt4, NULL);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 1, imgid);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 2, index);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 3, done);
-            sqlite3_step(stmt4);
-            sqlite3_finalize(stmt4);
-
-            done++;
-          }
-          sqlite3_finalize(stmt3);
+          DT_DEBUG_SQLITE3_BIND_INT64(stmt3, 1, sqlite3_column_int64(stmt2, 0));
+          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 2, done);
+          sqlite3_step(stmt3);
+          sqlite3_reset(stmt3);
         }
+        done++;
       }
+      sqlite3_finalize(stmt2);
+      sqlite3_finalize(stmt3);
+
       // update history end
       DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
         "UPDATE main.images SET history_end = ?2 WHERE id = ?1", -1, &stmt2, NULL);
@@ -1134,6 +1398,7 @@ int dt_history_compress_on_list(GList *imgs)
     dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
     l = g_list_next(l);
   }
+  dt_database_release_transaction(darktable.db, transaction);
 
   return uncompressed;
 }
@@ -1527,14 +1792,7 @@ gboolean dt_history_paste_on_list(GList *list, gboolean undo)
   if(mode == 0) merge = TRUE;
 
   if(undo) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  GList *l = list;
-  while(l)
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid, dest, merge,
-                                       darktable.view_manager->copy_paste.selops, darktable.view_manager->copy_paste.copy_iop_order);
-    l = g_list_next(l);
-  }
+  _history_paste_on_list(list, merge);
   if(undo) dt_undo_end_group(darktable.undo);
   return TRUE;
 }
@@ -1554,14 +1812,7 @@ gboolean dt_history_paste_parts_on_list(GList *list, gboolean undo)
   if(res == GTK_RESPONSE_CANCEL) return FALSE;
 
   if(undo) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  GList *l = list;
-  while(l)
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid, dest, merge,
-                                       darktable.view_manager->copy_paste.selops, darktable.view_manager->copy_paste.copy_iop_order);
-    l = g_list_next(l);
-  }
+  _history_paste_on_list(list, merge);
   if(undo) dt_undo_end_group(darktable.undo);
   return TRUE;
 }
@@ -55,7 +55,8 @@ void dt_history_snapshot_undo_create(int32_t imgid, int *snap_id, int *history_e
     *snap_id = sqlite3_column_int(stmt, 0) + 1;
   sqlite3_finalize(stmt);
 
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  // joins the transaction of a bulk operation if there is one
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
 
   // copy current state into undo_history
 
@@ -96,8 +97,8 @@ void dt_history_snapshot_undo_create(int32_t imgid, int *snap_id, int *history_e
   sqlite3_finalize(stmt);
 
   if(all_ok)
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
-  else
+    dt_database_release_transaction(darktable.db, transaction);
+  else if(transaction)
     sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK_TRANSACTION", NULL, NULL, NULL);
 
   dt_unlock_image(imgid);
@@ -111,7 +112,8 @@ static void _history_snapshot_undo_restore(int32_t imgid, int snap_id, int histo
 
   dt_lock_image(imgid);
 
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  // joins the transaction of a bulk operation if there is one
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
 
   dt_history_delete_on_image_ext(imgid, FALSE);
 
@@ -163,8 +165,8 @@ static void _history_snapshot_undo_restore(int32_t imgid, int snap_id, int histo
   sqlite3_finalize(stmt);
 
   if(all_ok)
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
-  else
+    dt_database_release_transaction(darktable.db, transaction);
+  else if(transaction)
     sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK_TRANSACTION", NULL, NULL, NULL);
 
   dt_unlock_image(imgid);
@@ -19,6 +19,7 @@
 #include "common/image.h"
 #include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/file_location.h"
@@ -38,6 +39,8 @@
 #include "develop/lightroom.h"
 #include "win/filepath.h"
 #ifdef USE_LUA
+#include "lua/call.h"
+#include "lua/events.h"
 #include "lua/image.h"
 #endif
 #include <assert.h>
@@ -47,7 +50,9 @@
 #include <string.h>
 #include <strings.h>
 #ifndef _WIN32
+#include <fcntl.h>
 #include <glob.h>
+#include <unistd.h>
 #endif
 #include <glib/gstdio.h>
 
@@ -240,6 +245,22 @@ void dt_image_full_path(const int imgid, char *pathname, size_t pathname_len, gb
   }
 }
 
+void dt_image_readahead(const int imgid)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+  char pathname[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+  if(!pathname[0]) return;
+
+  // the kernel starts reading the whole file into the page cache and returns right away
+  const int fd = g_open(pathname, O_RDONLY, 0);
+  if(fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+#endif
+}
+
 static void _image_local_copy_full_path(const int imgid, char *pathname, size_t pathname_len)
 {
   sqlite3_stmt *stmt;
@@ -361,7 +382,8 @@ static void _set_location(const int imgid, const dt_image_geoloc_t *geoloc)
 
   memcpy(&image->geoloc, geoloc, sizeof(dt_image_geoloc_t));
 
-  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
+  // the sidecars are written by the callers, all at once
+  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
 }
 
 void _pop_undo(gpointer user_data, const dt_undo_type_t type, dt_undo_data_t data, const dt_undo_action_t action, GList **imgs)
@@ -369,7 +391,9 @@ void _pop_undo(gpointer user_data, const dt_undo_type_t type, dt_undo_data_t dat
   if(type == DT_UNDO_GEOTAG)
   {
     GList *list = (GList *)data;
+    GList *changed = NULL;
 
+    const gboolean transaction = dt_database_start_transaction(darktable.db);
     while(list)
     {
       dt_undo_geotag_t *undogeotag = (dt_undo_geotag_t *)list->data;
@@ -378,8 +402,13 @@ void _pop_undo(gpointer user_data, const dt_undo_type_t type, dt_undo_data_t dat
       _set_location(undogeotag->imgid, geoloc);
 
       *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(undogeotag->imgid));
+      changed = g_list_prepend(changed, GINT_TO_POINTER(undogeotag->imgid));
       list = g_list_next(list);
     }
+    dt_database_release_transaction(darktable.db, transaction);
+
+    dt_image_synch_xmps(changed);
+    g_list_free(changed);
 
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_MOUSE_OVER_IMAGE_CHANGE);
   }
@@ -406,7 +435,7 @@ void _image_set_location(GList *imgs, const dt_image_geoloc_t *geoloc, GList **u
 
       memcpy(&undogeotag->after, geoloc, sizeof(dt_image_geoloc_t));
 
-      *undo = g_list_append(*undo, undogeotag);
+      *undo = g_list_prepend(*undo, undogeotag);
     }
 
     _set_location(imgid, geoloc);
@@ -424,11 +453,14 @@ void dt_image_set_locations(const GList *img, const dt_image_geoloc_t *geoloc, c
     if(group_on) dt_grouping_add_grouped_images(&imgs);
     if(undo_on) dt_undo_start_group(darktable.undo, DT_UNDO_GEOTAG);
 
+    const gboolean transaction = dt_database_start_transaction(darktable.db);
     _image_set_location(imgs, geoloc, &undo, undo_on);
+    dt_database_release_transaction(darktable.db, transaction);
+    dt_image_synch_xmps(imgs);
 
     if(undo_on)
     {
-      dt_undo_record(darktable.undo, NULL, DT_UNDO_GEOTAG, undo, _pop_undo, _geotag_undo_data_free);
+      dt_undo_record(darktable.undo, NULL, DT_UNDO_GEOTAG, g_list_reverse(undo), _pop_undo, _geotag_undo_data_free);
       dt_undo_end_group(darktable.undo);
     }
 
@@ -437,6 +469,37 @@ void dt_image_set_locations(const GList *img, const dt_image_geoloc_t *geoloc, c
   }
 }
 
+void dt_image_set_images_locations(const GList *img, const GArray *gloc, const gboolean undo_on,
+                                   const gboolean group_on)
+{
+  if(!img || !gloc) return;
+
+  GList *undo = NULL;
+  GList *changed = NULL;
+  if(undo_on) dt_undo_start_group(darktable.undo, DT_UNDO_GEOTAG);
+
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
+  guint i = 0;
+  for(const GList *l = img; l && i < gloc->len; l = g_list_next(l), i++)
+  {
+    GList *imgs = g_list_prepend(NULL, l->data);
+    if(group_on) dt_grouping_add_grouped_images(&imgs);
+    _image_set_location(imgs, &g_array_index(gloc, dt_image_geoloc_t, i), &undo, undo_on);
+    changed = g_list_concat(imgs, changed);
+  }
+  dt_database_release_transaction(darktable.db, transaction);
+  dt_image_synch_xmps(changed);
+  g_list_free(changed);
+
+  if(undo_on)
+  {
+    dt_undo_record(darktable.undo, NULL, DT_UNDO_GEOTAG, g_list_reverse(undo), _pop_undo, _geotag_undo_data_free);
+    dt_undo_end_group(darktable.undo);
+  }
+
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_MOUSE_OVER_IMAGE_CHANGE);
+}
+
 void dt_image_set_location(const int32_t imgid, const dt_image_geoloc_t *geoloc, const gboolean undo_on, const gboolean group_on)
 {
   GList *imgs = NULL;
@@ -899,71 +962,77 @@ int32_t dt_image_duplicate_with_version(const int32_t imgid, const int32_t newve
   return newid;
 }
 
+static void _sidecar_queue_remove(const int imgid);
+
 void dt_image_remove(const int32_t imgid)
 {
-  // if a local copy exists, remove it
+  GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+  dt_image_remove_list(imgs);
+  g_list_free(imgs);
+}
 
-  if(dt_image_local_copy_reset(imgid)) return;
+void dt_image_remove_list(const GList *imgs)
+{
+  GList *removed = NULL;
+  for(const GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
 
-  sqlite3_stmt *stmt;
-  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
-  int old_group_id = img->group_id;
-  dt_image_cache_read_release(darktable.image_cache, img);
+    // if a local copy exists, remove it
+    if(dt_image_local_copy_reset(imgid)) continue;
 
-  // make sure we remove from the cache first, or else the cache will look for imgid in sql
-  dt_image_cache_remove(darktable.image_cache, imgid);
+    // don't let a pending write bring the sidecar back
+    _sidecar_queue_remove(imgid);
 
-  int new_group_id = dt_grouping_remove_from_group(imgid);
-  if(darktable.gui && darktable.gui->expanded_group_id == old_group_id)
-    darktable.gui->expanded_group_id = new_group_id;
+    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+    int old_group_id = img->group_id;
+    dt_image_cache_read_release(darktable.image_cache, img);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.images WHERE id = ?1", -1, &stmt,
-                              NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.tagged_images WHERE imgid = ?1", -1,
-                              &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
-                              &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.masks_history WHERE imgid = ?1", -1,
-                              &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.color_labels WHERE imgid = ?1", -1,
-                              &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.meta_data WHERE id = ?1", -1, &stmt,
-                              NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.selected_images WHERE imgid = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.module_order WHERE imgid = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history_hash WHERE imgid = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
+    // make sure we remove from the cache first, or else the cache will look for imgid in sql
+    dt_image_cache_remove(darktable.image_cache, imgid);
+
+    int new_group_id = dt_grouping_remove_from_group(imgid);
+    if(darktable.gui && darktable.gui->expanded_group_id == old_group_id)
+      darktable.gui->expanded_group_id = new_group_id;
+
+    removed = g_list_prepend(removed, l->data);
+  }
+  if(!removed) return;
+
+  // one set based delete per table instead of one statement per image and table
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.removed_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR IGNORE INTO memory.removed_images (imgid) VALUES (?1)", -1, &stmt, NULL);
+  for(GList *l = removed; l; l = g_list_next(l))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
   sqlite3_finalize(stmt);
+
+  static const char *const queries[] = {
+    "DELETE FROM main.images WHERE id IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.tagged_images WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.history WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.masks_history WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.color_labels WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.meta_data WHERE id IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.selected_images WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.module_order WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM main.history_hash WHERE imgid IN (SELECT imgid FROM memory.removed_images)",
+    "DELETE FROM memory.removed_images" };
+  for(size_t k = 0; k < sizeof(queries) / sizeof(queries[0]); k++)
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), queries[k], NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db, transaction);
+  dt_selection_invalidate(darktable.selection);
+
   // also clear all thumbnails in mipmap_cache.
-  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  for(GList *l = removed; l; l = g_list_next(l))
+    dt_mipmap_cache_remove(darktable.mipmap_cache, GPOINTER_TO_INT(l->data));
+  g_list_free(removed);
 }
 
 gboolean dt_image_altered(const uint32_t imgid)
@@ -1339,17 +1408,33 @@ static uint32_t dt_image_import_internal(const int32_t film_id, const char *file
   g_free(normalized_filename);
 
 #ifdef USE_LUA
-  //Synchronous calling of lua post-import-image events
-  if(lua_locking)
-    dt_lua_lock();
+  // handlers registered as sync run right here, the others are queued for the lua thread. when
+  // called from lua we already are the lua thread and run all of them.
+  const dt_lua_event_mode_t mode = lua_locking ? DT_LUA_EVENT_SYNC : DT_LUA_EVENT_ALL;
+  if(dt_lua_event_has_handlers("post-import-image", mode))
+  {
+    if(lua_locking)
+      dt_lua_lock();
 
-  lua_State *L = darktable.lua_state.state;
+    lua_State *L = darktable.lua_state.state;
 
-  luaA_push(L, dt_lua_image_t, &id);
-  dt_lua_event_trigger(L, "post-import-image", 1);
+    lua_pushinteger(L, mode);
+    luaA_push(L, dt_lua_image_t, &id);
+    dt_lua_event_trigger(L, "post-import-image", 2);
 
-  if(lua_locking)
-    dt_lua_unlock();
+    if(lua_locking)
+      dt_lua_unlock();
+  }
+  if(lua_locking && dt_lua_event_has_handlers("post-import-image", DT_LUA_EVENT_ASYNC))
+  {
+    dt_lua_event_deferred_reserve();
+    dt_lua_async_call_alien(dt_lua_event_deferred_trigger_wrapper,
+        0, NULL, NULL,
+        LUA_ASYNC_TYPENAME, "const char*", "post-import-image",
+        LUA_ASYNC_TYPENAME, "int", GINT_TO_POINTER(DT_LUA_EVENT_ASYNC),
+        LUA_ASYNC_TYPENAME, "dt_lua_image_t", GINT_TO_POINTER(id),
+        LUA_ASYNC_DONE);
+  }
 #endif
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, id);
@@ -2082,25 +2167,157 @@ void dt_image_write_sidecar_file(int imgid)
   }
 }
 
-void dt_image_synch_xmps(const GList *img)
+// the background sidecar writer. images are kept in a dirty set together with the time of their last
+// change and written once they have been left alone for DT_SIDECAR_DEBOUNCE, so a burst of edits on an
+// image ends up as one write. the set is bounded, once it's full the caller writes the image itself.
+#define DT_SIDECAR_DEBOUNCE (500 * G_TIME_SPAN_MILLISECOND)
+#define DT_SIDECAR_QUEUE_MAX 5000
+
+static GMutex _sidecar_lock;
+static GHashTable *_sidecar_queue = NULL; // imgid -> gint64 time of the last change
+static gboolean _sidecar_job_pending = FALSE;
+
+// takes the images which are due out of the set. with all set every queued image is due. *wait gets the
+// time until the next one is. the job is done once the set is empty.
+static GList *_sidecar_queue_take(const gboolean all, gint64 *wait)
 {
-  if(!img) return;
-  if(dt_conf_get_bool("write_sidecar_files"))
+  GList *imgs = NULL;
+  const gint64 now = g_get_monotonic_time();
+  *wait = 0;
+
+  g_mutex_lock(&_sidecar_lock);
+  if(_sidecar_queue)
   {
-    const GList *imgs = img;
-    while(imgs)
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, _sidecar_queue);
+    while(g_hash_table_iter_next(&iter, &key, &value))
     {
-      dt_image_write_sidecar_file(GPOINTER_TO_INT(imgs->data));
-      imgs = g_list_next(imgs);
+      const gint64 due = *(gint64 *)value + DT_SIDECAR_DEBOUNCE;
+      if(all || due <= now)
+      {
+        imgs = g_list_prepend(imgs, key);
+        g_hash_table_iter_remove(&iter);
+      }
+      else if(*wait == 0 || due - now < *wait)
+        *wait = due - now;
     }
   }
+  if(!imgs && *wait == 0) _sidecar_job_pending = FALSE;
+  g_mutex_unlock(&_sidecar_lock);
+  return imgs;
+}
+
+static void _sidecar_write_list(GList *imgs)
+{
+  dt_print(DT_DEBUG_CONTROL, "[image] writing %u queued sidecar files\n", g_list_length(imgs));
+  for(GList *l = imgs; l; l = g_list_next(l)) dt_image_write_sidecar_file(GPOINTER_TO_INT(l->data));
+  g_list_free(imgs);
+}
+
+static int32_t _sidecar_job_run(dt_job_t *job)
+{
+  while(TRUE)
+  {
+    // on shutdown leave the rest to dt_image_synch_xmps_flush()
+    if(!dt_control_running())
+    {
+      g_mutex_lock(&_sidecar_lock);
+      _sidecar_job_pending = FALSE;
+      g_mutex_unlock(&_sidecar_lock);
+      break;
+    }
+
+    gint64 wait = 0;
+    GList *imgs = _sidecar_queue_take(FALSE, &wait);
+    if(imgs)
+      _sidecar_write_list(imgs);
+    else if(wait > 0)
+      g_usleep(wait);
+    else
+      break;
+  }
+  return 0;
+}
+
+// adds the image to the dirty set. returns FALSE if the caller has to write the sidecar itself.
+static gboolean _sidecar_queue_add(const int imgid, const gint64 now, gboolean *start)
+{
+  gint64 *stamp = _sidecar_queue ? g_hash_table_lookup(_sidecar_queue, GINT_TO_POINTER(imgid)) : NULL;
+  if(!stamp)
+  {
+    if(!_sidecar_queue) _sidecar_queue = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    if(g_hash_table_size(_sidecar_queue) >= DT_SIDECAR_QUEUE_MAX) return FALSE;
+    stamp = g_new(gint64, 1);
+    g_hash_table_insert(_sidecar_queue, GINT_TO_POINTER(imgid), stamp);
+  }
+  *stamp = now;
+
+  if(!_sidecar_job_pending) *start = TRUE;
+  _sidecar_job_pending = TRUE;
+  return TRUE;
+}
+
+static void _sidecar_queue_remove(const int imgid)
+{
+  g_mutex_lock(&_sidecar_lock);
+  if(_sidecar_queue) g_hash_table_remove(_sidecar_queue, GINT_TO_POINTER(imgid));
+  g_mutex_unlock(&_sidecar_lock);
+}
+
+void dt_image_synch_xmps(const GList *img)
+{
+  if(!img || !dt_conf_get_bool("write_sidecar_files")) return;
+
+  // no job system to hand them to
+  if(!darktable.control || !dt_control_running())
+  {
+    for(const GList *l = img; l; l = g_list_next(l)) dt_image_write_sidecar_file(GPOINTER_TO_INT(l->data));
+    return;
+  }
+
+  GList *overflow = NULL;
+  gboolean start = FALSE;
+  const gint64 now = g_get_monotonic_time();
+  g_mutex_lock(&_sidecar_lock);
+  for(const GList *l = img; l; l = g_list_next(l))
+  {
+    const int imgid = GPOINTER_TO_INT(l->data);
+    if(imgid > 0 && !_sidecar_queue_add(imgid, now, &start)) overflow = g_list_prepend(overflow, l->data);
+  }
+  g_mutex_unlock(&_sidecar_lock);
+
+  if(overflow) _sidecar_write_list(overflow);
+  if(!start) return;
+
+  dt_job_t *job = dt_control_job_create(&_sidecar_job_run, "write sidecar files");
+  if(!job || dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job))
+  {
+    g_mutex_lock(&_sidecar_lock);
+    _sidecar_job_pending = FALSE;
+    g_mutex_unlock(&_sidecar_lock);
+    dt_image_synch_xmps_flush();
+  }
+}
+
+void dt_image_synch_xmps_flush(void)
+{
+  gint64 wait;
+  GList *imgs;
+  while((imgs = _sidecar_queue_take(TRUE, &wait))) _sidecar_write_list(imgs);
+  g_mutex_lock(&_sidecar_lock);
+  if(_sidecar_queue) g_hash_table_destroy(_sidecar_queue);
+  _sidecar_queue = NULL;
+  g_mutex_unlock(&_sidecar_lock);
 }
 
 void dt_image_synch_xmp(const int selected)
 {
   if(selected > 0)
   {
-    dt_image_write_sidecar_file(selected);
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(selected));
+    dt_image_synch_xmps(imgs);
+    g_list_free(imgs);
   }
   else
   {
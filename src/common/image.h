@@ -240,6 +240,9 @@ int dt_image_is_rawprepare_supported(const dt_image_t *img);
 /** returns the full path name where the image was imported from. from_cache=TRUE check and return local
  * cached filename if any. */
 void dt_image_full_path(const int imgid, char *pathname, size_t pathname_len, gboolean *from_cache);
+/** asks the os to read the image file in the background, so that a later load doesn't wait for slow or
+ * network storage. does nothing where that isn't supported. */
+void dt_image_readahead(const int imgid);
 /** returns the full directory of the associated film roll. */
 void dt_image_film_roll_directory(const dt_image_t *img, char *pathname, size_t pathname_len);
 /** returns the portion of the path used for the film roll name. */
@@ -260,6 +263,8 @@ uint32_t dt_image_import(int32_t film_id, const char *filename, gboolean overrid
 uint32_t dt_image_import_lua(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
 /** removes the given image from the database. */
 void dt_image_remove(const int32_t imgid);
+/** removes the given images from the database, in one transaction. */
+void dt_image_remove_list(const GList *imgs);
 /** duplicates the given image in the database with the duplicate getting the supplied version number. if that
     version already exists just return the imgid without producing new duplicate. called with newversion -1 a new
     duplicate is produced with the next free version number. */
@@ -279,6 +284,10 @@ void dt_image_set_location(const int32_t imgid, const dt_image_geoloc_t *geoloc,
 /** set images location lon/lat/ele */
 void dt_image_set_locations(const GList *img, const dt_image_geoloc_t *geoloc,
                            const gboolean undo_on, const gboolean group_on);
+/** set the location of each image of img to the one at the same position in gloc (of dt_image_geoloc_t),
+    in one transaction with the sidecars written afterwards */
+void dt_image_set_images_locations(const GList *img, const GArray *gloc,
+                                   const gboolean undo_on, const gboolean group_on);
 /** get image location lon/lat/ele */
 void dt_image_get_location(const int32_t imgid, dt_image_geoloc_t *geoloc);
 /** returns 1 if there is history data found for this image, 0 else. */
@@ -347,7 +356,11 @@ void dt_image_local_copy_synch(void);
 // xmp functions:
 void dt_image_write_sidecar_file(int imgid);
 void dt_image_synch_xmp(const int selected);
+/** queue the sidecars of the images for the background writer. an image is written once it hasn't
+ *  changed for half a second, so a burst of edits results in a single write. */
 void dt_image_synch_xmps(const GList *img);
+/** write the sidecars still queued, at shutdown */
+void dt_image_synch_xmps_flush(void);
 void dt_image_synch_all_xmp(const gchar *pathname);
 
 // add an offset to the exif_datetime_taken field
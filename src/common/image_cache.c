@@ -27,131 +27,161 @@
 #include <sqlite3.h>
 #include <inttypes.h>
 
+#define IMAGE_CACHE_COLUMNS \
+  "id, group_id, film_id, width, height, filename, maker, model, lens, exposure, " \
+  "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, " \
+  "raw_parameters, longitude, latitude, altitude, color_matrix, colorspace, version, raw_black, " \
+  "raw_maximum, aspect_ratio, exposure_bias, " \
+  "import_timestamp, change_timestamp, export_timestamp, print_timestamp"
+
+// fill the image struct from a row of IMAGE_CACHE_COLUMNS
+static void _image_from_row(dt_image_t *img, sqlite3_stmt *stmt)
+{
+  img->id = sqlite3_column_int(stmt, 0);
+  img->group_id = sqlite3_column_int(stmt, 1);
+  img->film_id = sqlite3_column_int(stmt, 2);
+  img->width = sqlite3_column_int(stmt, 3);
+  img->height = sqlite3_column_int(stmt, 4);
+  img->crop_x = img->crop_y = img->crop_width = img->crop_height = 0;
+  img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0]
+      = img->exif_datetime_taken[0] = '\0';
+  char *str;
+  str = (char *)sqlite3_column_text(stmt, 5);
+  if(str) g_strlcpy(img->filename, str, sizeof(img->filename));
+  str = (char *)sqlite3_column_text(stmt, 6);
+  if(str) g_strlcpy(img->exif_maker, str, sizeof(img->exif_maker));
+  str = (char *)sqlite3_column_text(stmt, 7);
+  if(str) g_strlcpy(img->exif_model, str, sizeof(img->exif_model));
+  str = (char *)sqlite3_column_text(stmt, 8);
+  if(str) g_strlcpy(img->exif_lens, str, sizeof(img->exif_lens));
+  img->exif_exposure = sqlite3_column_double(stmt, 9);
+  img->exif_aperture = sqlite3_column_double(stmt, 10);
+  img->exif_iso = sqlite3_column_double(stmt, 11);
+  img->exif_focal_length = sqlite3_column_double(stmt, 12);
+  str = (char *)sqlite3_column_text(stmt, 13);
+  if(str) g_strlcpy(img->exif_datetime_taken, str, sizeof(img->exif_datetime_taken));
+  img->flags = sqlite3_column_int(stmt, 14);
+  img->loader = LOADER_UNKNOWN;
+  img->exif_crop = sqlite3_column_double(stmt, 15);
+  img->orientation = sqlite3_column_int(stmt, 16);
+  img->exif_focus_distance = sqlite3_column_double(stmt, 17);
+  if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
+  uint32_t tmp = sqlite3_column_int(stmt, 18);
+  memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
+  if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
+    img->geoloc.longitude = sqlite3_column_double(stmt, 19);
+  else
+    img->geoloc.longitude = NAN;
+  if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
+    img->geoloc.latitude = sqlite3_column_double(stmt, 20);
+  else
+    img->geoloc.latitude = NAN;
+  if(sqlite3_column_type(stmt, 21) == SQLITE_FLOAT)
+    img->geoloc.elevation = sqlite3_column_double(stmt, 21);
+  else
+    img->geoloc.elevation = NAN;
+  const void *color_matrix = sqlite3_column_blob(stmt, 22);
+  if(color_matrix)
+    memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
+  else
+    img->d65_color_matrix[0] = NAN;
+  g_free(img->profile);
+  img->profile = NULL;
+  img->profile_size = 0;
+  img->colorspace = sqlite3_column_int(stmt, 23);
+  img->version = sqlite3_column_int(stmt, 24);
+  img->raw_black_level = sqlite3_column_int(stmt, 25);
+  for(uint8_t i = 0; i < 4; i++) img->raw_black_level_separate[i] = 0;
+  img->raw_white_point = sqlite3_column_int(stmt, 26);
+  if(sqlite3_column_type(stmt, 27) == SQLITE_FLOAT)
+    img->aspect_ratio = sqlite3_column_double(stmt, 27);
+  else
+    img->aspect_ratio = 0.0;
+  if(sqlite3_column_type(stmt, 28) == SQLITE_FLOAT)
+    img->exif_exposure_bias = sqlite3_column_double(stmt, 28);
+  else
+    img->exif_exposure_bias = NAN;
+  img->import_timestamp = sqlite3_column_int(stmt, 29);
+  img->change_timestamp = sqlite3_column_int(stmt, 30);
+  img->export_timestamp = sqlite3_column_int(stmt, 31);
+  img->print_timestamp = sqlite3_column_int(stmt, 32);
+
+  // buffer size? colorspace?
+  if(img->flags & DT_IMAGE_LDR)
+  {
+    img->buf_dsc.channels = 4;
+    img->buf_dsc.datatype = TYPE_FLOAT;
+    img->buf_dsc.cst = iop_cs_rgb;
+  }
+  else if(img->flags & DT_IMAGE_HDR)
+  {
+    if(img->flags & DT_IMAGE_RAW)
+    {
+      img->buf_dsc.channels = 1;
+      img->buf_dsc.datatype = TYPE_FLOAT;
+      img->buf_dsc.cst = iop_cs_RAW;
+    }
+    else
+    {
+      img->buf_dsc.channels = 4;
+      img->buf_dsc.datatype = TYPE_FLOAT;
+      img->buf_dsc.cst = iop_cs_rgb;
+    }
+  }
+  else
+  {
+    // raw
+    img->buf_dsc.channels = 1;
+    img->buf_dsc.datatype = TYPE_UINT16;
+    img->buf_dsc.cst = iop_cs_RAW;
+  }
+}
+
+// a row read ahead by dt_image_cache_prefetch(), NULL if there is none
+static dt_image_t *_take_prefetched(dt_image_cache_t *cache, const uint32_t imgid)
+{
+  dt_pthread_mutex_lock(&cache->prefetch_lock);
+  dt_image_t *img = (dt_image_t *)g_hash_table_lookup(cache->prefetched, GINT_TO_POINTER(imgid));
+  if(img) g_hash_table_steal(cache->prefetched, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->prefetch_lock);
+  return img;
+}
+
 void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
 {
+  dt_image_cache_t *cache = (dt_image_cache_t *)data;
   entry->cost = sizeof(dt_image_t);
 
   dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
-  dt_image_init(img);
   entry->data = img;
-  // load stuff from db and store in cache:
+
+  dt_image_t *prefetched = _take_prefetched(cache, entry->key);
+  if(prefetched)
+  {
+    memcpy(img, prefetched, sizeof(dt_image_t));
+    g_free(prefetched);
+    img->cache_entry = entry;
+    dt_image_refresh_makermodel(img);
+    return;
+  }
+
+  dt_image_init(img);
+  // load stuff from db and store in cache. this runs in the thumbnail jobs, the read connection keeps them
+  // from waiting on imports and other long writes.
+  sqlite3 *db = dt_database_get_reader(darktable.db);
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
-      "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure, "
-      "aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, "
-      "raw_parameters, longitude, latitude, altitude, color_matrix, colorspace, version, raw_black, "
-      "raw_maximum, aspect_ratio, exposure_bias, "
-      "import_timestamp, change_timestamp, export_timestamp, print_timestamp "
-      "FROM main.images WHERE id = ?1",
-      -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT " IMAGE_CACHE_COLUMNS " FROM main.images WHERE id = ?1", -1, &stmt,
+                              NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    img->id = sqlite3_column_int(stmt, 0);
-    img->group_id = sqlite3_column_int(stmt, 1);
-    img->film_id = sqlite3_column_int(stmt, 2);
-    img->width = sqlite3_column_int(stmt, 3);
-    img->height = sqlite3_column_int(stmt, 4);
-    img->crop_x = img->crop_y = img->crop_width = img->crop_height = 0;
-    img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0]
-        = img->exif_datetime_taken[0] = '\0';
-    char *str;
-    str = (char *)sqlite3_column_text(stmt, 5);
-    if(str) g_strlcpy(img->filename, str, sizeof(img->filename));
-    str = (char *)sqlite3_column_text(stmt, 6);
-    if(str) g_strlcpy(img->exif_maker, str, sizeof(img->exif_maker));
-    str = (char *)sqlite3_column_text(stmt, 7);
-    if(str) g_strlcpy(img->exif_model, str, sizeof(img->exif_model));
-    str = (char *)sqlite3_column_text(stmt, 8);
-    if(str) g_strlcpy(img->exif_lens, str, sizeof(img->exif_lens));
-    img->exif_exposure = sqlite3_column_double(stmt, 9);
-    img->exif_aperture = sqlite3_column_double(stmt, 10);
-    img->exif_iso = sqlite3_column_double(stmt, 11);
-    img->exif_focal_length = sqlite3_column_double(stmt, 12);
-    str = (char *)sqlite3_column_text(stmt, 13);
-    if(str) g_strlcpy(img->exif_datetime_taken, str, sizeof(img->exif_datetime_taken));
-    img->flags = sqlite3_column_int(stmt, 14);
-    img->loader = LOADER_UNKNOWN;
-    img->exif_crop = sqlite3_column_double(stmt, 15);
-    img->orientation = sqlite3_column_int(stmt, 16);
-    img->exif_focus_distance = sqlite3_column_double(stmt, 17);
-    if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
-    uint32_t tmp = sqlite3_column_int(stmt, 18);
-    memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
-    if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
-      img->geoloc.longitude = sqlite3_column_double(stmt, 19);
-    else
-      img->geoloc.longitude = NAN;
-    if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
-      img->geoloc.latitude = sqlite3_column_double(stmt, 20);
-    else
-      img->geoloc.latitude = NAN;
-    if(sqlite3_column_type(stmt, 21) == SQLITE_FLOAT)
-      img->geoloc.elevation = sqlite3_column_double(stmt, 21);
-    else
-      img->geoloc.elevation = NAN;
-    const void *color_matrix = sqlite3_column_blob(stmt, 22);
-    if(color_matrix)
-      memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
-    else
-      img->d65_color_matrix[0] = NAN;
-    g_free(img->profile);
-    img->profile = NULL;
-    img->profile_size = 0;
-    img->colorspace = sqlite3_column_int(stmt, 23);
-    img->version = sqlite3_column_int(stmt, 24);
-    img->raw_black_level = sqlite3_column_int(stmt, 25);
-    for(uint8_t i = 0; i < 4; i++) img->raw_black_level_separate[i] = 0;
-    img->raw_white_point = sqlite3_column_int(stmt, 26);
-    if(sqlite3_column_type(stmt, 27) == SQLITE_FLOAT)
-      img->aspect_ratio = sqlite3_column_double(stmt, 27);
-    else
-      img->aspect_ratio = 0.0;
-    if(sqlite3_column_type(stmt, 28) == SQLITE_FLOAT)
-      img->exif_exposure_bias = sqlite3_column_double(stmt, 28);
-    else
-      img->exif_exposure_bias = NAN;
-    img->import_timestamp = sqlite3_column_int(stmt, 29);
-    img->change_timestamp = sqlite3_column_int(stmt, 30);
-    img->export_timestamp = sqlite3_column_int(stmt, 31);
-    img->print_timestamp = sqlite3_column_int(stmt, 32);
-
-    // buffer size? colorspace?
-    if(img->flags & DT_IMAGE_LDR)
-    {
-      img->buf_dsc.channels = 4;
-      img->buf_dsc.datatype = TYPE_FLOAT;
-      img->buf_dsc.cst = iop_cs_rgb;
-    }
-    else if(img->flags & DT_IMAGE_HDR)
-    {
-      if(img->flags & DT_IMAGE_RAW)
-      {
-        img->buf_dsc.channels = 1;
-        img->buf_dsc.datatype = TYPE_FLOAT;
-        img->buf_dsc.cst = iop_cs_RAW;
-      }
-      else
-      {
-        img->buf_dsc.channels = 4;
-        img->buf_dsc.datatype = TYPE_FLOAT;
-        img->buf_dsc.cst = iop_cs_rgb;
-      }
-    }
-    else
-    {
-      // raw
-      img->buf_dsc.channels = 1;
-      img->buf_dsc.datatype = TYPE_UINT16;
-      img->buf_dsc.cst = iop_cs_RAW;
-    }
+    _image_from_row(img, stmt);
   }
   else
   {
     img->id = -1;
     fprintf(stderr, "[image_cache_allocate] failed to open image %" PRIu32 " from database: %s\n", entry->key,
-            sqlite3_errmsg(dt_database_get(darktable.db)));
+            sqlite3_errmsg(db));
   }
   sqlite3_finalize(stmt);
   img->cache_entry = entry; // init backref
@@ -176,9 +206,13 @@ void dt_image_cache_init(dt_image_cache_t *cache)
   //       can we get away with a fixed size?
   const uint32_t max_mem = 50 * 1024 * 1024;
   const uint32_t num = (uint32_t)(1.5f * max_mem / sizeof(dt_image_t));
-  dt_cache_init(&cache->cache, sizeof(dt_image_t), max_mem);
+  // every worker thread looks up image structs, so split the cache to keep them from
+  // queueing up on a single lock:
+  dt_cache_init_sharded(&cache->cache, sizeof(dt_image_t), max_mem, dt_get_num_threads());
   dt_cache_set_allocate_callback(&cache->cache, &dt_image_cache_allocate, cache);
   dt_cache_set_cleanup_callback(&cache->cache, &dt_image_cache_deallocate, cache);
+  cache->prefetched = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  dt_pthread_mutex_init(&cache->prefetch_lock, NULL);
 
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
 }
@@ -186,13 +220,70 @@ void dt_image_cache_init(dt_image_cache_t *cache)
 void dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
   dt_cache_cleanup(&cache->cache);
+  g_hash_table_destroy(cache->prefetched);
+  dt_pthread_mutex_destroy(&cache->prefetch_lock);
+}
+
+void dt_image_cache_prefetch(dt_image_cache_t *cache, const int32_t *imgids, const int count)
+{
+  // only the ones not in the cache yet, a single one is left to the allocation
+  GString *ids = g_string_new(NULL);
+  int missing = 0;
+  for(int k = 0; k < count; k++)
+    if(imgids[k] > 0 && !dt_cache_contains(&cache->cache, imgids[k]))
+    {
+      g_string_append_printf(ids, "%s%d", missing ? "," : "", imgids[k]);
+      missing++;
+    }
+  if(missing < 2)
+  {
+    g_string_free(ids, TRUE);
+    return;
+  }
+
+  const double start = dt_get_wtime();
+  gchar *query = g_strdup_printf("SELECT " IMAGE_CACHE_COLUMNS " FROM main.images WHERE id IN (%s)", ids->str);
+  g_string_free(ids, TRUE);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get_reader(darktable.db), query, -1, &stmt, NULL);
+  int found = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+    dt_image_init(img);
+    _image_from_row(img, stmt);
+    dt_pthread_mutex_lock(&cache->prefetch_lock);
+    g_hash_table_insert(cache->prefetched, GINT_TO_POINTER(img->id), img);
+    dt_pthread_mutex_unlock(&cache->prefetch_lock);
+    found++;
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  // let the cache take them right away, so no row is left behind to go stale
+  for(int k = 0; k < count; k++)
+  {
+    dt_pthread_mutex_lock(&cache->prefetch_lock);
+    const gboolean pending = g_hash_table_contains(cache->prefetched, GINT_TO_POINTER(imgids[k]));
+    dt_pthread_mutex_unlock(&cache->prefetch_lock);
+    if(!pending) continue;
+    const dt_image_t *img = dt_image_cache_get(cache, imgids[k], 'r');
+    dt_image_cache_read_release(cache, img);
+    // already cached meanwhile, the allocation didn't need the row
+    dt_image_t *stale = _take_prefetched(cache, imgids[k]);
+    g_free(stale);
+  }
+
+  dt_print(DT_DEBUG_CACHE, "[image_cache] prefetched %d of %d image structs in %.4f secs\n", found, count,
+           dt_get_wtime() - start);
 }
 
 void dt_image_cache_print(dt_image_cache_t *cache)
 {
-  printf("[image cache] fill %.2f/%.2f MB (%.2f%%)\n", cache->cache.cost / (1024.0 * 1024.0),
+  const size_t cost = dt_cache_get_cost(&cache->cache);
+  printf("[image cache] fill %.2f/%.2f MB (%.2f%%) in %u segments\n", cost / (1024.0 * 1024.0),
          cache->cache.cost_quota / (1024.0 * 1024.0),
-         (float)cache->cache.cost / (float)cache->cache.cost_quota);
+         (float)cost / (float)cache->cache.cost_quota, cache->cache.num_segments);
 }
 
 dt_image_t *dt_image_cache_get(dt_image_cache_t *cache, const uint32_t imgid, char mode)
@@ -24,6 +24,10 @@
 typedef struct dt_image_cache_t
 {
   dt_cache_t cache;
+
+  // rows read by dt_image_cache_prefetch() until their entries are allocated, imgid -> dt_image_t
+  dt_pthread_mutex_t prefetch_lock;
+  GHashTable *prefetched;
 }
 dt_image_cache_t;
 
@@ -51,6 +55,10 @@ void dt_image_cache_print(dt_image_cache_t *cache);
 // point where sql and xmp can be synched (unsafe setting).
 dt_image_t *dt_image_cache_get(dt_image_cache_t *cache, const uint32_t imgid, char mode);
 
+// make sure the image structs of these images are in the cache, reading the missing ones from the database
+// with a single query instead of one per image. for the thumbs about to be shown.
+void dt_image_cache_prefetch(dt_image_cache_t *cache, const int32_t *imgids, const int count);
+
 // same as read_get, but doesn't block and returns NULL if the image
 // is currently unavailable.
 dt_image_t *dt_image_cache_testget(dt_image_cache_t *cache, const uint32_t imgid, char mode);
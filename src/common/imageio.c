@@ -23,6 +23,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/export_cache.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
@@ -45,6 +46,7 @@
 #include "common/imageio_avif.h"
 #endif
 #include "common/mipmap_cache.h"
+#include "common/raw_cache.h"
 #include "common/styles.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -67,12 +69,21 @@
 #include <strings.h>
 
 #ifdef USE_LUA
+#include "lua/call.h"
+#include "lua/events.h"
 #include "lua/image.h"
 #endif
 
 // load a full-res thumbnail:
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
                                dt_colorspaces_color_profile_type_t *color_space)
+{
+  return dt_imageio_large_thumbnail_scaled(filename, buffer, width, height, color_space, 0, 0);
+}
+
+int dt_imageio_large_thumbnail_scaled(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                                      dt_colorspaces_color_profile_type_t *color_space, const int min_width,
+                                      const int min_height)
 {
   int res = 1;
 
@@ -88,6 +99,7 @@ int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *
     // Decompress the JPG into our own memory format
     dt_imageio_jpeg_t jpg;
     if(dt_imageio_jpeg_decompress_header(buf, bufsize, &jpg)) goto error;
+    if(min_width > 0 && min_height > 0) dt_imageio_jpeg_set_min_size(&jpg, min_width, min_height);
     *buffer = (uint8_t *)dt_alloc_align(64, (size_t)sizeof(uint8_t) * jpg.width * jpg.height * 4);
     if(!*buffer) goto error;
 
@@ -567,22 +579,420 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, dt_imageio_mod
 }
 
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
-int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
-                                 dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
-                                 const gboolean ignore_exif, const gboolean display_byteorder,
-                                 const gboolean high_quality, const gboolean upscale, const gboolean thumbnail_export,
-                                 const char *filter, const gboolean copy_metadata, const gboolean export_masks,
-                                 dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
-                                 dt_iop_color_intent_t icc_intent, dt_imageio_module_storage_t *storage,
-                                 dt_imageio_module_data_t *storage_params, int num, int total,
-                                 dt_export_metadata_t *metadata)
+// identifies the current version of the source file for the on-disk pipe cache,
+// so stored intermediates go stale as soon as the raw is replaced.
+static uint64_t _export_disk_cache_id(const int32_t imgid)
+{
+  char pathname[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+  GStatBuf st;
+  if(!pathname[0] || g_stat(pathname, &st)) return 0;
+
+  // djb2, like the pipe hashes
+  uint64_t id = 5381;
+  for(const char *c = pathname; *c; c++) id = ((id << 5) + id) ^ *c;
+  id = ((id << 5) + id) ^ (uint64_t)st.st_size;
+  id = ((id << 5) + id) ^ (uint64_t)st.st_mtime;
+  return id ? id : 1;
+}
+
+// processes rows y..y+height-1 of the export into pipe->backbuf
+static void _export_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int y, const int width,
+                            const int height, const double scale, const gboolean high_quality_processing,
+                            const int bpp)
+{
+  if(high_quality_processing)
+  {
+    /*
+     * if high quality processing was requested, downsampling will be done
+     * at the very end of the pipe (just before border and watermark)
+     */
+    dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+  }
+  else
+  {
+    // else, downsampling will be right after demosaic
+
+    // so we need to turn temporarily disable in-pipe late downsampling iop.
+
+    // find the finalscale module
+    dt_dev_pixelpipe_iop_t *finalscale = NULL;
+    {
+      GList *nodes = g_list_last(pipe->nodes);
+      while(nodes)
+      {
+        dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
+        if(!strcmp(node->module->op, "finalscale"))
+        {
+          finalscale = node;
+          break;
+        }
+        nodes = g_list_previous(nodes);
+      }
+    }
+
+    if(finalscale) finalscale->enabled = 0;
+
+    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
+    if(bpp == 8)
+      dt_dev_pixelpipe_process(pipe, dev, 0, y, width, height, scale);
+    else
+      dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+
+    if(finalscale) finalscale->enabled = 1;
+  }
+}
+
+// downconversion of the pipe output to the low-precision formats, in place
+static void _export_convert(uint8_t *const outbuf, const size_t npixels, const int bpp,
+                            const gboolean display_byteorder, const gboolean high_quality_processing)
+{
+  if(bpp == 8)
+  {
+    if(display_byteorder)
+    {
+      if(high_quality_processing)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      // else processing output was 8-bit already, and no need to swap order
+    }
+    else // need to flip
+    {
+      // ldr output: char
+      if(high_quality_processing)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
+          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
+          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      else
+      { // !display_byteorder, need to swap:
+        uint8_t *const buf8 = outbuf;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(npixels, buf8) \
+  schedule(static)
+#endif
+        // just flip byte order
+        for(size_t k = 0; k < npixels; k++)
+        {
+          uint8_t tmp = buf8[4 * k + 0];
+          buf8[4 * k + 0] = buf8[4 * k + 2];
+          buf8[4 * k + 2] = tmp;
+        }
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(size_t k = 0; k < npixels; k++)
+    {
+      // convert in place
+      for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
+    }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// processes and writes the export in strips of strip_height rows, so neither the pipe output nor the
+// converted image ever exist in full
+static int _export_streamed(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_imageio_module_format_t *format,
+                            dt_imageio_module_data_t *format_params, const char *filename,
+                            const int processed_width, const int processed_height, const int strip_height,
+                            const double scale, const gboolean high_quality_processing, const int bpp,
+                            const gboolean display_byteorder, const gboolean ignore_exif,
+                            dt_colorspaces_color_profile_type_t icc_type,
+                            const gchar *icc_filename, const uint32_t imgid, const int sRGB, const int num,
+                            const int total)
+{
+  format_params->width = processed_width;
+  format_params->height = processed_height;
+
+  int length = 0;
+  uint8_t *exif_profile = NULL;
+  if(!ignore_exif)
+  {
+    char pathname[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+    // last param is dng mode, it's false here
+    length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
+
+  int res = format->write_image_begin(format_params, filename, icc_type, icc_filename, exif_profile, length,
+                                      imgid, num, total);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  for(int y = 0; !res && y < processed_height; y += strip_height)
+  {
+    const int height = MIN(strip_height, processed_height - y);
+    _export_process(pipe, dev, y, processed_width, height, scale, high_quality_processing, bpp);
+    _export_convert(pipe->backbuf, (size_t)processed_width * height, bpp, display_byteorder,
+                    high_quality_processing);
+    res = format->write_image_rows(format_params, pipe->backbuf, height);
+  }
+  dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing in strips");
+
+  // the format cleans up even after an earlier failure
+  if(format->write_image_end(format_params)) res = 1;
+
+  free(exif_profile);
+  return res;
+}
+
+// export pipes go back to a pool once their image is done. what they keep is the cache lines, sized for
+// the full image, and the scratch arena: the largest allocations of an export, which would otherwise be
+// faulted in again for every image. the nodes are still created per image, from the history of its own
+// dev. idle pipes stay registered with the memory governor, which can shrink their lines under pressure.
+#define DT_IMAGEIO_EXPORT_PIPES 4
+
+static dt_dev_pixelpipe_t *_export_pipe_acquire(const gboolean thumbnail_export, const int wd, const int ht,
+                                                const int levels, const gboolean export_masks)
+{
+  dt_imageio_t *iio = darktable.imageio;
+  const dt_dev_pixelpipe_type_t type = thumbnail_export ? DT_DEV_PIXELPIPE_THUMBNAIL : DT_DEV_PIXELPIPE_EXPORT;
+
+  dt_dev_pixelpipe_t *pipe = NULL;
+  dt_pthread_mutex_lock(&iio->pipes_mutex);
+  for(GList *l = iio->pipes; l; l = g_list_next(l))
+  {
+    if(((dt_dev_pixelpipe_t *)l->data)->type == type)
+    {
+      pipe = (dt_dev_pixelpipe_t *)l->data;
+      iio->pipes = g_list_delete_link(iio->pipes, l);
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&iio->pipes_mutex);
+
+  if(pipe)
+  {
+    dt_dev_pixelpipe_reset(pipe);
+    if(!thumbnail_export)
+    {
+      pipe->levels = levels;
+      pipe->store_all_raster_masks = export_masks;
+    }
+    return pipe;
+  }
+
+  pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
+  if(!pipe) return NULL;
+  const int res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(pipe, wd, ht)
+                                   : dt_dev_pixelpipe_init_export(pipe, wd, ht, levels, export_masks);
+  if(!res)
+  {
+    dt_dev_pixelpipe_cleanup(pipe);
+    free(pipe);
+    return NULL;
+  }
+  return pipe;
+}
+
+static void _export_pipe_release(dt_dev_pixelpipe_t *pipe)
+{
+  dt_imageio_t *iio = darktable.imageio;
+
+  dt_dev_pixelpipe_cleanup_nodes(pipe);
+
+  dt_pthread_mutex_lock(&iio->pipes_mutex);
+  const gboolean keep = g_list_length(iio->pipes) < DT_IMAGEIO_EXPORT_PIPES;
+  if(keep) iio->pipes = g_list_prepend(iio->pipes, pipe);
+  dt_pthread_mutex_unlock(&iio->pipes_mutex);
+
+  if(!keep)
+  {
+    dt_dev_pixelpipe_cleanup(pipe);
+    free(pipe);
+  }
+}
+
+void dt_imageio_export_pipes_cleanup(dt_imageio_t *iio)
+{
+  dt_pthread_mutex_lock(&iio->pipes_mutex);
+  GList *pipes = iio->pipes;
+  iio->pipes = NULL;
+  dt_pthread_mutex_unlock(&iio->pipes_mutex);
+
+  for(GList *l = pipes; l; l = g_list_next(l))
+  {
+    dt_dev_pixelpipe_cleanup((dt_dev_pixelpipe_t *)l->data);
+    free(l->data);
+  }
+  g_list_free(pipes);
+}
+
+// box filters the converted output of the export down to width x height, 4 channels of bpp bits
+static void _export_downscale(const void *const in, const int in_width, const int in_height, void *const out,
+                              const int width, const int height, const int bpp)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, in_width, in_height, out, width, height, bpp) \
+  schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const int y0 = (int64_t)j * in_height / height;
+    const int y1 = MAX(y0 + 1, (int)((int64_t)(j + 1) * in_height / height));
+    for(int i = 0; i < width; i++)
+    {
+      const int x0 = (int64_t)i * in_width / width;
+      const int x1 = MAX(x0 + 1, (int)((int64_t)(i + 1) * in_width / width));
+      float sum[4] = { 0.0f };
+      for(int y = y0; y < y1; y++)
+        for(int x = x0; x < x1; x++)
+        {
+          const size_t k = 4 * ((size_t)y * in_width + x);
+          for(int c = 0; c < 4; c++)
+            sum[c] += bpp == 8 ? ((const uint8_t *)in)[k + c]
+                    : bpp == 16 ? ((const uint16_t *)in)[k + c] : ((const float *)in)[k + c];
+        }
+      const float norm = 1.0f / ((y1 - y0) * (x1 - x0));
+      const size_t k = 4 * ((size_t)j * width + i);
+      for(int c = 0; c < 4; c++)
+      {
+        if(bpp == 8)
+          ((uint8_t *)out)[k + c] = (uint8_t)(sum[c] * norm + 0.5f);
+        else if(bpp == 16)
+          ((uint16_t *)out)[k + c] = (uint16_t)(sum[c] * norm + 0.5f);
+        else
+          ((float *)out)[k + c] = sum[c] * norm;
+      }
+    }
+  }
+}
+
+// writes a copy of the rendered output, fitted into size x size, with the same format
+static int _export_write_thumbnail(dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                                   const char *filename, const void *const outbuf, const int bpp, const int size,
+                                   dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
+                                   const int imgid, const int num, const int total)
+{
+  const int wd = format_params->width;
+  const int ht = format_params->height;
+  const float scale = fminf(1.0f, fminf((float)size / wd, (float)size / ht));
+  const int width = MAX(1, (int)(wd * scale + 0.5f));
+  const int height = MAX(1, (int)(ht * scale + 0.5f));
+
+  void *thumb = dt_alloc_align(64, (size_t)width * height * 4 * (bpp / 8));
+  if(!thumb) return 1;
+  _export_downscale(outbuf, wd, ht, thumb, width, height, bpp);
+
+  const int max_width = format_params->max_width;
+  const int max_height = format_params->max_height;
+  format_params->width = format_params->max_width = width;
+  format_params->height = format_params->max_height = height;
+  const int res = format->write_image(format_params, filename, thumb, icc_type, icc_filename, NULL, 0, imgid, num,
+                                      total, NULL, FALSE);
+  format_params->width = wd;
+  format_params->height = ht;
+  format_params->max_width = max_width;
+  format_params->max_height = max_height;
+  dt_free_align(thumb);
+  return res;
+}
+
+// the render fingerprint of an export, see common/export_cache.h. NULL if the export cache is off.
+static gchar *_export_fingerprint(dt_dev_pixelpipe_t *pipe, dt_imageio_module_format_t *format,
+                                  dt_imageio_module_data_t *format_params, const int processed_width,
+                                  const int processed_height, const double scale,
+                                  const gboolean high_quality_processing, const int bpp,
+                                  const gboolean ignore_exif, dt_colorspaces_color_profile_type_t icc_type,
+                                  const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+                                  const uint32_t imgid, const int sRGB, const int num)
+{
+  char pathname[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+  GChecksum *checksum = dt_export_cache_fingerprint_new(pathname);
+  if(!checksum) return NULL;
+
+  gboolean per_image = FALSE;
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    g_checksum_update(checksum, (const guchar *)piece->module->op, strlen(piece->module->op));
+    g_checksum_update(checksum, (const guchar *)&piece->module->multi_priority, sizeof(int));
+    g_checksum_update(checksum, (const guchar *)&piece->hash, sizeof(piece->hash));
+    // the watermark expands variables of the image it is rendered on
+    if(!strcmp(piece->module->op, "watermark")) per_image = TRUE;
+  }
+  if(per_image)
+  {
+    g_checksum_update(checksum, (const guchar *)&imgid, sizeof(imgid));
+    g_checksum_update(checksum, (const guchar *)&num, sizeof(num));
+  }
+
+  const int dims[] = { pipe->iwidth, pipe->iheight, processed_width, processed_height, high_quality_processing,
+                       bpp, format->levels(format_params), icc_type, icc_intent, ignore_exif };
+  g_checksum_update(checksum, (const guchar *)dims, sizeof(dims));
+  g_checksum_update(checksum, (const guchar *)&scale, sizeof(scale));
+  g_checksum_update(checksum, (const guchar *)format->plugin_name, strlen(format->plugin_name));
+  if(icc_filename) g_checksum_update(checksum, (const guchar *)icc_filename, strlen(icc_filename));
+
+  // the format's own parameters follow the common ones, the output size is in there already
+  const size_t params_size = format->params_size(format);
+  if(params_size > sizeof(dt_imageio_module_data_t))
+    g_checksum_update(checksum, (const guchar *)format_params + sizeof(dt_imageio_module_data_t),
+                      params_size - sizeof(dt_imageio_module_data_t));
+
+  // the exif block carries the metadata of this very image
+  if(!ignore_exif)
+  {
+    uint8_t *exif_profile = NULL;
+    const int length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+    if(exif_profile && length > 0) g_checksum_update(checksum, exif_profile, length);
+    free(exif_profile);
+  }
+
+  gchar *fingerprint = g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return fingerprint;
+}
+
+static int _imageio_export(const uint32_t imgid, const char *filename, dt_imageio_module_format_t *format,
+                           dt_imageio_module_data_t *format_params, const gboolean ignore_exif,
+                           const gboolean display_byteorder, const gboolean high_quality, const gboolean upscale,
+                           const gboolean thumbnail_export, const char *filter, const gboolean copy_metadata,
+                           const gboolean export_masks, dt_colorspaces_color_profile_type_t icc_type,
+                           const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+                           dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params, int num,
+                           int total, dt_export_metadata_t *metadata, const char *thumb_filename,
+                           const int thumb_size, const gboolean style_preview)
 {
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_dev_load_image(&dev, imgid);
 
+  // style previews are thrown away, they always start from the downscaled input
   const int buf_is_downscaled
-      = (thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"));
+      = (thumbnail_export && (style_preview || dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails")));
 
   dt_mipmap_buffer_t buf;
   if(buf_is_downscaled)
@@ -607,19 +1017,21 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   dt_times_t start;
   dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht)
-                         : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params), export_masks);
-  if(!res)
+  dt_dev_pixelpipe_t *pipe
+      = _export_pipe_acquire(thumbnail_export, wd, ht, format->levels(format_params), export_masks);
+  if(!pipe)
   {
     dt_control_log(
         _("failed to allocate memory for %s, please lower the threads used for export or buy more memory."),
         thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
-    goto error;
+    goto error_early;
   }
 
+  if(!thumbnail_export && dt_conf_get_bool("export_disk_cache"))
+    pipe->disk_cache_id = _export_disk_cache_id(imgid);
+
   //  If a style is to be applied during export, add the iop params into the history
-  if(!thumbnail_export && format_params->style[0] != '\0')
+  if((!thumbnail_export || style_preview) && format_params->style[0] != '\0')
   {
     GList *style_items = dt_styles_get_item_list(format_params->style, TRUE, -1);
     if(!style_items)
@@ -649,19 +1061,19 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   dt_ioppr_resync_modules_order(&dev);
 
-  dt_dev_pixelpipe_set_icc(&pipe, icc_type, icc_filename, icc_intent);
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_set_icc(pipe, icc_type, icc_filename, icc_intent);
+  dt_dev_pixelpipe_set_input(pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  dt_dev_pixelpipe_create_nodes(pipe, &dev);
+  dt_dev_pixelpipe_synch_all(pipe, &dev);
 
   if(filter)
   {
-    if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(&pipe, filter + 4);
-    if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(&pipe, filter + 5);
+    if(!strncmp(filter, "pre:", 4)) dt_dev_pixelpipe_disable_after(pipe, filter + 4);
+    if(!strncmp(filter, "post:", 5)) dt_dev_pixelpipe_disable_before(pipe, filter + 5);
   }
 
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
-                                  &pipe.processed_height);
+  dt_dev_pixelpipe_get_dimensions(pipe, &dev, pipe->iwidth, pipe->iheight, &pipe->processed_width,
+                                  &pipe->processed_height);
 
   dt_show_times(&start, "[export] creating pixelpipe");
 
@@ -694,8 +1106,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   // get only once at the beginning, in case the user changes it on the way:
   const gboolean high_quality_processing
-      = ((format_params->max_width == 0 || format_params->max_width >= pipe.processed_width)
-         && (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height))
+      = ((format_params->max_width == 0 || format_params->max_width >= pipe->processed_width)
+         && (format_params->max_height == 0 || format_params->max_height >= pipe->processed_height))
             ? FALSE
             : high_quality;
 
@@ -704,8 +1116,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   const float max_scale = ( upscale && ( width > 0 || height > 0 )) ? 100.0 : 1.0;
 
-  const double scalex = width > 0 ? fminf(width / (double)pipe.processed_width, max_scale) : max_scale;
-  const double scaley = height > 0 ? fminf(height / (double)pipe.processed_height, max_scale) : max_scale;
+  const double scalex = width > 0 ? fminf(width / (double)pipe->processed_width, max_scale) : max_scale;
+  const double scaley = height > 0 ? fminf(height / (double)pipe->processed_height, max_scale) : max_scale;
   const double scale = fminf(scalex, scaley);
 
   int processed_width;
@@ -713,138 +1125,59 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   float origin[] = { 0.0f, 0.0f };
 
-  if(dt_dev_distort_backtransform_plus(&dev, &pipe, 0.f, DT_DEV_TRANSFORM_DIR_ALL, origin, 1))
+  if(dt_dev_distort_backtransform_plus(&dev, pipe, 0.f, DT_DEV_TRANSFORM_DIR_ALL, origin, 1))
   {
-    processed_width = scale * pipe.processed_width + 0.5f;
-    processed_height = scale * pipe.processed_height + 0.5f;
+    processed_width = scale * pipe->processed_width + 0.5f;
+    processed_height = scale * pipe->processed_height + 0.5f;
 
-    if(ceilf(processed_width / scale) + origin[0] > pipe.iwidth) processed_width--;
-    if(ceilf(processed_height / scale) + origin[1] > pipe.iheight) processed_height--;
+    if(ceilf(processed_width / scale) + origin[0] > pipe->iwidth) processed_width--;
+    if(ceilf(processed_height / scale) + origin[1] > pipe->iheight) processed_height--;
   }
   else
   {
-    processed_width = floor(scale * pipe.processed_width);
-    processed_height = floor(scale * pipe.processed_height);
+    processed_width = floor(scale * pipe->processed_width);
+    processed_height = floor(scale * pipe->processed_height);
   }
 
   const int bpp = format->bpp(format_params);
 
-  dt_get_times(&start);
-  if(high_quality_processing)
+  // identical renders are copied from the export cache, only the xmp below is still written per image
+  gchar *fingerprint = NULL;
+  gboolean cached = FALSE;
+  if(!thumbnail_export && !export_masks && !thumb_filename && strcmp(format->mime(format_params), "memory"))
+    fingerprint = _export_fingerprint(pipe, format, format_params, processed_width, processed_height, scale,
+                                      high_quality_processing, bpp, ignore_exif, icc_type, icc_filename,
+                                      icc_intent, imgid, sRGB, num);
+  if(fingerprint && dt_export_cache_fetch(fingerprint, filename))
   {
-    /*
-     * if high quality processing was requested, downsampling will be done
-     * at the very end of the pipe (just before border and watermark)
-     */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    format_params->width = processed_width;
+    format_params->height = processed_height;
+    cached = TRUE;
+    goto cleanup;
   }
-  else
-  {
-    // else, downsampling will be right after demosaic
 
-    // so we need to turn temporarily disable in-pipe late downsampling iop.
-
-    // find the finalscale module
-    dt_dev_pixelpipe_iop_t *finalscale = NULL;
-    {
-      GList *nodes = g_list_last(pipe.nodes);
-      while(nodes)
-      {
-        dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
-        if(!strcmp(node->module->op, "finalscale"))
-        {
-          finalscale = node;
-          break;
-        }
-        nodes = g_list_previous(nodes);
-      }
-    }
-
-    if(finalscale) finalscale->enabled = 0;
-
-    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+  // large exports can be handed to formats which write sequentially in strips
+  const int strip_height = dt_conf_get_int("export_strip_height");
+  const gboolean streaming = !thumbnail_export && !export_masks && !thumb_filename && strip_height > 0
+                             && processed_height > strip_height && format->write_image_begin;
 
-    if(finalscale) finalscale->enabled = 1;
+  if(streaming)
+  {
+    res = _export_streamed(pipe, &dev, format, format_params, filename, processed_width, processed_height,
+                           strip_height, scale, high_quality_processing, bpp, display_byteorder, ignore_exif,
+                           icc_type, icc_filename, imgid, sRGB, num, total);
+    goto cleanup;
   }
+
+  dt_get_times(&start);
+  _export_process(pipe, &dev, 0, processed_width, processed_height, scale, high_quality_processing, bpp);
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing"
                                          : "[dev_process_export] pixel pipeline processing");
 
-  uint8_t *outbuf = pipe.backbuf;
+  uint8_t *outbuf = pipe->backbuf;
 
-  // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
-    {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(processed_width, processed_height, buf8) \
-  schedule(static)
-#endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
-  }
-  // else output float, no further harm done to the pixels :)
+  _export_convert(outbuf, (size_t)processed_width * processed_height, bpp, display_byteorder,
+                  high_quality_processing);
 
   format_params->width = processed_width;
   format_params->height = processed_height;
@@ -862,20 +1195,28 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
 
     res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length, imgid,
-                              num, total, &pipe, export_masks);
+                              num, total, pipe, export_masks);
 
     free(exif_profile);
   }
   else
   {
     res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, NULL, 0, imgid, num, total,
-                              &pipe, export_masks);
+                              pipe, export_masks);
   }
 
-  dt_dev_pixelpipe_cleanup(&pipe);
+  if(!res && thumb_filename)
+    res = _export_write_thumbnail(format, format_params, thumb_filename, outbuf, bpp, thumb_size, icc_type,
+                                  icc_filename, imgid, num, total);
+
+cleanup:
+  _export_pipe_release(pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
+  if(!res && fingerprint && !cached) dt_export_cache_store(fingerprint, filename);
+  g_free(fingerprint);
+
   /* now write xmp into that container, if possible */
   if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
   {
@@ -887,25 +1228,62 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     && !(format->flags(format_params) & FORMAT_FLAGS_NO_TMPFILE))
   {
 #ifdef USE_LUA
-    //Synchronous calling of lua intermediate-export-image events
-    dt_lua_lock();
+    // the handlers registered as sync may still modify the file, the others get a copy of the
+    // arguments on the lua thread
+    if(dt_lua_event_has_handlers("intermediate-export-image", DT_LUA_EVENT_SYNC))
+    {
+      dt_lua_lock();
 
-    lua_State *L = darktable.lua_state.state;
+      lua_State *L = darktable.lua_state.state;
 
-    luaA_push(L, dt_lua_image_t, &imgid);
+      lua_pushinteger(L, DT_LUA_EVENT_SYNC);
 
-    lua_pushstring(L, filename);
+      luaA_push(L, dt_lua_image_t, &imgid);
 
-    luaA_push_type(L, format->parameter_lua_type, format_params);
+      lua_pushstring(L, filename);
 
-    if (storage)
-      luaA_push_type(L, storage->parameter_lua_type, storage_params);
-    else
-      lua_pushnil(L);
+      luaA_push_type(L, format->parameter_lua_type, format_params);
+
+      if (storage)
+        luaA_push_type(L, storage->parameter_lua_type, storage_params);
+      else
+        lua_pushnil(L);
 
-    dt_lua_event_trigger(L, "intermediate-export-image", 4);
+      dt_lua_event_trigger(L, "intermediate-export-image", 5);
 
-    dt_lua_unlock();
+      dt_lua_unlock();
+    }
+    if(dt_lua_event_has_handlers("intermediate-export-image", DT_LUA_EVENT_ASYNC))
+    {
+      const size_t fsize = format->params_size(format);
+      void *fparams = malloc(fsize);
+      memcpy(fparams, format_params, fsize);
+      dt_lua_event_deferred_reserve();
+      if(storage)
+      {
+        const size_t ssize = storage->params_size(storage);
+        void *sparams = malloc(ssize);
+        memcpy(sparams, storage_params, ssize);
+        dt_lua_async_call_alien(dt_lua_event_deferred_trigger_wrapper,
+            0, NULL, NULL,
+            LUA_ASYNC_TYPENAME, "const char*", "intermediate-export-image",
+            LUA_ASYNC_TYPENAME, "int", GINT_TO_POINTER(DT_LUA_EVENT_ASYNC),
+            LUA_ASYNC_TYPENAME, "dt_lua_image_t", GINT_TO_POINTER(imgid),
+            LUA_ASYNC_TYPENAME_WITH_FREE, "char*", g_strdup(filename), g_cclosure_new(G_CALLBACK(&g_free), NULL, NULL),
+            LUA_ASYNC_TYPEID_WITH_FREE, format->parameter_lua_type, fparams, g_cclosure_new(G_CALLBACK(&free), NULL, NULL),
+            LUA_ASYNC_TYPEID_WITH_FREE, storage->parameter_lua_type, sparams, g_cclosure_new(G_CALLBACK(&free), NULL, NULL),
+            LUA_ASYNC_DONE);
+      }
+      else
+        dt_lua_async_call_alien(dt_lua_event_deferred_trigger_wrapper,
+            0, NULL, NULL,
+            LUA_ASYNC_TYPENAME, "const char*", "intermediate-export-image",
+            LUA_ASYNC_TYPENAME, "int", GINT_TO_POINTER(DT_LUA_EVENT_ASYNC),
+            LUA_ASYNC_TYPENAME, "dt_lua_image_t", GINT_TO_POINTER(imgid),
+            LUA_ASYNC_TYPENAME_WITH_FREE, "char*", g_strdup(filename), g_cclosure_new(G_CALLBACK(&g_free), NULL, NULL),
+            LUA_ASYNC_TYPEID_WITH_FREE, format->parameter_lua_type, fparams, g_cclosure_new(G_CALLBACK(&free), NULL, NULL),
+            LUA_ASYNC_DONE);
+    }
 #endif
 
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, filename, format,
@@ -915,13 +1293,74 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   return res;
 
 error:
-  dt_dev_pixelpipe_cleanup(&pipe);
+  _export_pipe_release(pipe);
 error_early:
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
   return 1;
 }
 
+int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
+                                 dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                                 const gboolean ignore_exif, const gboolean display_byteorder,
+                                 const gboolean high_quality, const gboolean upscale, const gboolean thumbnail_export,
+                                 const char *filter, const gboolean copy_metadata, const gboolean export_masks,
+                                 dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
+                                 dt_iop_color_intent_t icc_intent, dt_imageio_module_storage_t *storage,
+                                 dt_imageio_module_data_t *storage_params, int num, int total,
+                                 dt_export_metadata_t *metadata)
+{
+  return _imageio_export(imgid, filename, format, format_params, ignore_exif, display_byteorder, high_quality,
+                         upscale, thumbnail_export, filter, copy_metadata, export_masks, icc_type, icc_filename,
+                         icc_intent, storage, storage_params, num, total, metadata, NULL, 0, FALSE);
+}
+
+int dt_imageio_export_with_thumbnail(const uint32_t imgid, const char *filename,
+                                     dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                                     const gboolean high_quality, const gboolean upscale,
+                                     const gboolean copy_metadata, const gboolean export_masks,
+                                     dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
+                                     dt_iop_color_intent_t icc_intent, dt_imageio_module_storage_t *storage,
+                                     dt_imageio_module_data_t *storage_params, int num, int total,
+                                     dt_export_metadata_t *metadata, const char *thumb_filename,
+                                     const int thumb_size)
+{
+  return _imageio_export(imgid, filename, format, format_params, FALSE, FALSE, high_quality, upscale, FALSE, NULL,
+                         copy_metadata, export_masks, icc_type, icc_filename, icc_intent, storage, storage_params,
+                         num, total, metadata, thumb_filename, thumb_size, FALSE);
+}
+
+int dt_imageio_export_style_preview(const uint32_t imgid, dt_imageio_module_format_t *format,
+                                    dt_imageio_module_data_t *format_params)
+{
+  return _imageio_export(imgid, "unused", format, format_params, TRUE, FALSE, FALSE, FALSE, TRUE, NULL, FALSE,
+                         FALSE, DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL, NULL, 1, 1, NULL, NULL, 0, TRUE);
+}
+
+
+int dt_imageio_encoder_threads()
+{
+  // parallel exports limit every worker to its share of the openmp threads, see
+  // dt_control_export_job_run(), so the encoder doesn't oversubscribe the cores either
+#ifdef _OPENMP
+  const int share = omp_get_max_threads();
+#else
+  const int share = 1;
+#endif
+  const int limit = dt_conf_get_int("export_encoder_threads");
+  return limit > 0 ? MIN(limit, share) : share;
+}
+
+int dt_imageio_decoder_threads()
+{
+  // thumbnail workers and parallel exports lower the openmp threads of their thread, see
+  // dt_image_thumbnails_job_run(), a decoder going wide on its own would undo that
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
 
 // fallback read method in case file could not be opened yet.
 // use GraphicsMagick (if supported) to read exotic LDRs
@@ -992,10 +1431,15 @@ dt_imageio_retval_t dt_imageio_open(dt_image_t *img,               // non-const
   if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL && dt_imageio_is_hdr(filename))
     ret = dt_imageio_open_hdr(img, filename, buf);
 
-  /* use rawspeed to load the raw */
+  /* use rawspeed to load the raw, unless an earlier decode of it is still on disk */
   if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
   {
-    ret = dt_imageio_open_rawspeed(img, filename, buf);
+    ret = dt_raw_cache_open(img, filename, buf);
+    if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
+    {
+      ret = dt_imageio_open_rawspeed(img, filename, buf);
+      if(ret == DT_IMAGEIO_OK) dt_raw_cache_store(img, filename, buf);
+    }
     if(ret == DT_IMAGEIO_OK)
     {
       img->buf_dsc.cst = iop_cs_RAW;
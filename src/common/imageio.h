@@ -77,6 +77,18 @@ int dt_imageio_export(const uint32_t imgid, const char *filename, struct dt_imag
                       dt_iop_color_intent_t icc_intent, dt_imageio_module_storage_t *storage,
                       dt_imageio_module_data_t *storage_params, int num, int total, dt_export_metadata_t *metadata);
 
+/** like dt_imageio_export(), also writing a copy of the rendered output fitted into thumb_size x thumb_size
+    to thumb_filename, in the same format. */
+int dt_imageio_export_with_thumbnail(const uint32_t imgid, const char *filename,
+                                     struct dt_imageio_module_format_t *format,
+                                     struct dt_imageio_module_data_t *format_params, const gboolean high_quality,
+                                     const gboolean upscale, const gboolean copy_metadata,
+                                     const gboolean export_masks, dt_colorspaces_color_profile_type_t icc_type,
+                                     const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+                                     dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params,
+                                     int num, int total, dt_export_metadata_t *metadata,
+                                     const char *thumb_filename, const int thumb_size);
+
 int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  struct dt_imageio_module_format_t *format,
                                  struct dt_imageio_module_data_t *format_params, const gboolean ignore_exif,
@@ -86,6 +98,17 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                                  const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
                                  dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params,
                                  int num, int total, dt_export_metadata_t *metadata);
+/** imgid with the style of format_params applied to its history, through a thumbnail pipe from the downscaled
+ * input, for previews of styles. */
+int dt_imageio_export_style_preview(const uint32_t imgid, struct dt_imageio_module_format_t *format,
+                                    struct dt_imageio_module_data_t *format_params);
+// frees the export pipes kept for reuse
+void dt_imageio_export_pipes_cleanup(dt_imageio_t *iio);
+
+// number of threads a format's encoder should use, the share of the export worker calling it
+int dt_imageio_encoder_threads();
+// number of threads a loader's decoder should use, the share of the job or pipe calling it
+int dt_imageio_decoder_threads();
 
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
@@ -104,6 +127,11 @@ void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const f
 // allocate buffer and return 0 on success along with largest jpg thumbnail from raw.
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
                                dt_colorspaces_color_profile_type_t *color_space);
+// same, but a jpg thumbnail is decoded at the smallest power of two reduction that still covers
+// min_width x min_height when fitted into it.
+int dt_imageio_large_thumbnail_scaled(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
+                                      dt_colorspaces_color_profile_type_t *color_space, const int min_width,
+                                      const int min_height);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
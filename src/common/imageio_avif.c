@@ -137,6 +137,10 @@ dt_imageio_retval_t dt_imageio_open_avif(dt_image_t *img,
     ret = DT_IMAGEIO_FILE_CORRUPTED;
     goto out;
   }
+#if AVIF_VERSION >= 900
+  // libavif decodes on one thread unless told otherwise
+  decoder->maxThreads = dt_imageio_decoder_threads();
+#endif
 
   result = avifDecoderParse(decoder, &raw);
   if (result != AVIF_RESULT_OK) {
@@ -305,6 +309,10 @@ dt_imageio_retval_t dt_imageio_avif_read_color_profile(const char *filename, str
     ret = DT_IMAGEIO_FILE_CORRUPTED;
     goto out;
   }
+#if AVIF_VERSION >= 900
+  // libavif decodes on one thread unless told otherwise
+  decoder->maxThreads = dt_imageio_decoder_threads();
+#endif
 
   result = avifDecoderParse(decoder, &raw);
   if (result != AVIF_RESULT_OK) {
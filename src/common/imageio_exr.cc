@@ -51,7 +51,10 @@ dt_imageio_retval_t dt_imageio_open_exr(dt_image_t *img, const char *filename, d
 {
   bool isTiled = false;
 
-  Imf::setGlobalThreadCount(dt_get_num_threads());
+  // the pool is shared by all files being read, only grow it to our budget instead of tearing it down
+  // for every file. the files themselves keep no more lines or tiles in flight than our share.
+  const int threads = dt_imageio_decoder_threads();
+  if(Imf::globalThreadCount() < threads) Imf::setGlobalThreadCount(threads);
 
   std::unique_ptr<Imf::TiledInputFile> fileTiled;
   std::unique_ptr<Imf::InputFile> file;
@@ -69,12 +72,12 @@ dt_imageio_retval_t dt_imageio_open_exr(dt_image_t *img, const char *filename, d
   {
     if(isTiled)
     {
-      std::unique_ptr<Imf::TiledInputFile> temp(new Imf::TiledInputFile(filename));
+      std::unique_ptr<Imf::TiledInputFile> temp(new Imf::TiledInputFile(filename, threads));
       fileTiled = std::move(temp);
     }
     else
     {
-      std::unique_ptr<Imf::InputFile> temp(new Imf::InputFile(filename));
+      std::unique_ptr<Imf::InputFile> temp(new Imf::InputFile(filename, threads));
       file = std::move(temp);
     }
   }
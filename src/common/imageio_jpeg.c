@@ -154,11 +154,36 @@ int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_
   return 0;
 }
 
+void dt_imageio_jpeg_set_min_size(dt_imageio_jpeg_t *jpg, const int min_width, const int min_height)
+{
+  // libjpeg scales in the dct, so 1/8 costs a fraction of a full decode
+  int denom = 8;
+  while(denom > 1 && jpg->dinfo.image_width < (int64_t)min_width * denom
+        && jpg->dinfo.image_height < (int64_t)min_height * denom)
+    denom /= 2;
+  if(denom == 1) return;
+
+  struct dt_imageio_jpeg_error_mgr jerr;
+  jpg->dinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    // keep decoding at full size
+    jpg->dinfo.scale_denom = 1;
+    return;
+  }
+  jpg->dinfo.scale_num = 1;
+  jpg->dinfo.scale_denom = denom;
+  jpeg_calc_output_dimensions(&(jpg->dinfo));
+  jpg->width = jpg->dinfo.output_width;
+  jpg->height = jpg->dinfo.output_height;
+}
+
 #ifdef JCS_EXTENSIONS
 static int decompress_jsc(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), &tmp, 1) != 1)
     {
@@ -175,14 +200,14 @@ static int decompress_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)dt_alloc_align(64, jpg->dinfo.output_width * jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
       dt_free_align(row_pointer[0]);
       return 1;
     }
-    for(unsigned int i = 0; i < jpg->dinfo.image_width; i++)
+    for(int i = 0; i < jpg->width; i++)
     {
       for(int k = 0; k < 3; k++) tmp[4 * i + k] = row_pointer[0][3 * i + k];
     }
@@ -259,6 +284,46 @@ int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
   return 0;
 }
 
+// the pipe hands out rgbx. libjpeg-turbo can read that directly and runs its simd colour conversion and
+// chroma downsampling on it, otherwise every row is packed to rgb first
+static void _set_input_rgbx(j_compress_ptr cinfo)
+{
+#ifdef JCS_EXTENSIONS
+  cinfo->input_components = 4;
+  cinfo->in_color_space = JCS_EXT_RGBX;
+#else
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+#endif
+}
+
+// feeds the whole image, several rows per call so the compressor gets complete mcu rows at once
+static void _write_rgbx(j_compress_ptr cinfo, const uint8_t *in)
+{
+  const size_t stride = (size_t)4 * cinfo->image_width;
+#ifdef JCS_EXTENSIONS
+  JSAMPROW rows[16];
+  while(cinfo->next_scanline < cinfo->image_height)
+  {
+    const int n = MIN(16, cinfo->image_height - cinfo->next_scanline);
+    for(int j = 0; j < n; j++) rows[j] = (JSAMPROW)(in + stride * (cinfo->next_scanline + j));
+    jpeg_write_scanlines(cinfo, rows, n);
+  }
+#else
+  uint8_t *row = dt_alloc_align(64, (size_t)3 * cinfo->image_width * sizeof(uint8_t));
+  while(cinfo->next_scanline < cinfo->image_height)
+  {
+    JSAMPROW tmp[1];
+    const uint8_t *buf = in + stride * cinfo->next_scanline;
+    for(int i = 0; i < cinfo->image_width; i++)
+      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
+    tmp[0] = row;
+    jpeg_write_scanlines(cinfo, tmp, 1);
+  }
+  dt_free_align(row);
+#endif
+}
+
 int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, const int height,
                              const int quality)
 {
@@ -282,26 +347,14 @@ int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, c
 
   jpg.cinfo.image_width = width;
   jpg.cinfo.image_height = height;
-  jpg.cinfo.input_components = 3;
-  jpg.cinfo.in_color_space = JCS_RGB;
+  _set_input_rgbx(&(jpg.cinfo));
   jpeg_set_defaults(&(jpg.cinfo));
   jpeg_set_quality(&(jpg.cinfo), quality, TRUE);
   if(quality > 90) jpg.cinfo.comp_info[0].v_samp_factor = 1;
   if(quality > 92) jpg.cinfo.comp_info[0].h_samp_factor = 1;
   jpeg_start_compress(&(jpg.cinfo), TRUE);
-  uint8_t *row = dt_alloc_align(64, (size_t)3 * width * sizeof(uint8_t));
-  const uint8_t *buf;
-  while(jpg.cinfo.next_scanline < jpg.cinfo.image_height)
-  {
-    JSAMPROW tmp[1];
-    buf = in + jpg.cinfo.next_scanline * jpg.cinfo.image_width * 4;
-    for(int i = 0; i < width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg.cinfo), tmp, 1);
-  }
+  _write_rgbx(&(jpg.cinfo), in);
   jpeg_finish_compress(&(jpg.cinfo));
-  dt_free_align(row);
   jpeg_destroy_compress(&(jpg.cinfo));
   return 4 * width * height * sizeof(uint8_t) - jpg.dest.free_in_buffer;
 }
@@ -512,8 +565,7 @@ int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *
 
   jpg.cinfo.image_width = width;
   jpg.cinfo.image_height = height;
-  jpg.cinfo.input_components = 3;
-  jpg.cinfo.in_color_space = JCS_RGB;
+  _set_input_rgbx(&(jpg.cinfo));
   jpeg_set_defaults(&(jpg.cinfo));
   jpeg_set_quality(&(jpg.cinfo), quality, TRUE);
   if(quality > 90) jpg.cinfo.comp_info[0].v_samp_factor = 1;
@@ -538,19 +590,8 @@ int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *
 
   if(exif && exif_len > 0 && exif_len < 65534) jpeg_write_marker(&(jpg.cinfo), JPEG_APP0 + 1, exif, exif_len);
 
-  uint8_t *row = dt_alloc_align(64, (size_t)3 * width * sizeof(uint8_t));
-  const uint8_t *buf;
-  while(jpg.cinfo.next_scanline < jpg.cinfo.image_height)
-  {
-    JSAMPROW tmp[1];
-    buf = in + jpg.cinfo.next_scanline * jpg.cinfo.image_width * 4;
-    for(int i = 0; i < width; i++)
-      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg.cinfo), tmp, 1);
-  }
+  _write_rgbx(&(jpg.cinfo), in);
   jpeg_finish_compress(&(jpg.cinfo));
-  dt_free_align(row);
   jpeg_destroy_compress(&(jpg.cinfo));
   fclose(f);
   return 0;
@@ -598,7 +639,7 @@ int dt_imageio_jpeg_read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 static int read_jsc(dt_imageio_jpeg_t *jpg, uint8_t *out)
 {
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), &tmp, 1) != 1)
     {
@@ -615,7 +656,7 @@ static int read_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
   JSAMPROW row_pointer[1];
   row_pointer[0] = (uint8_t *)dt_alloc_align(64, jpg->dinfo.output_width * jpg->dinfo.num_components);
   uint8_t *tmp = out;
-  while(jpg->dinfo.output_scanline < jpg->dinfo.image_height)
+  while(jpg->dinfo.output_scanline < jpg->height)
   {
     if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
     {
@@ -624,7 +665,7 @@ static int read_plain(dt_imageio_jpeg_t *jpg, uint8_t *out)
       fclose(jpg->f);
       return 1;
     }
-    for(unsigned int i = 0; i < jpg->dinfo.image_width; i++)
+    for(int i = 0; i < jpg->width; i++)
       for(int k = 0; k < 3; k++) tmp[4 * i + k] = row_pointer[0][3 * i + k];
     tmp += 4 * jpg->width;
   }
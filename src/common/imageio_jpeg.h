@@ -44,6 +44,9 @@ typedef struct dt_imageio_jpeg_t
 
 /** reads the header and fills width/height in jpg struct. */
 int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_jpeg_t *jpg);
+/** lets the decoder scale down by 1/2, 1/4 or 1/8 as long as the result still covers a min_width x min_height
+ * box when fitted into it. call after reading the header, it updates width/height in jpg struct. */
+void dt_imageio_jpeg_set_min_size(dt_imageio_jpeg_t *jpg, const int min_width, const int min_height);
 /** reads the whole image to the out buffer, which has to be large enough. */
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out);
 /** compresses in to out buffer with given quality (0..100). out buffer must be large enough. returns actual
@@ -122,6 +122,13 @@ typedef struct dt_imageio_module_format_t
                      dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                      void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
                      const gboolean export_masks);
+  /* optional streaming interface, the image is handed over in strips of rows from top to bottom, each
+   * converted like the buffer passed to write_image. exif has to stay valid until write_image_end. */
+  int (*write_image_begin)(dt_imageio_module_data_t *data, const char *filename,
+                           dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                           void *exif, int exif_len, int imgid, int num, int total);
+  int (*write_image_rows)(dt_imageio_module_data_t *data, const void *in, const int rows);
+  int (*write_image_end)(dt_imageio_module_data_t *data);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
@@ -183,6 +190,8 @@ typedef struct dt_imageio_module_storage_t
                dt_iop_color_intent_t icc_intent, dt_export_metadata_t *metadata_flags);
   /* called once at the end (after exporting all images), if implemented. */
   void (*finalize_store)(struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data);
+  /* return TRUE if store() may be called for several images of one export at the same time. */
+  gboolean (*parallel_store)(struct dt_imageio_module_storage_t *self);
 
   void *(*legacy_params)(struct dt_imageio_module_storage_t *self, const void *const old_params,
                          const size_t old_params_size, const int old_version, const int new_version,
@@ -205,6 +214,9 @@ typedef struct dt_imageio_t
 {
   GList *plugins_format;
   GList *plugins_storage;
+  // idle export pipes, see dt_imageio_export_with_flags()
+  dt_pthread_mutex_t pipes_mutex;
+  GList *pipes;
 } dt_imageio_t;
 
 /* load all modules */
@@ -194,17 +194,35 @@ dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, d
     return DT_IMAGEIO_FILE_CORRUPTED;
   }
 
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(buf, mipbuf, width, height, bpp) \
+  schedule(static)
+#endif
   for(size_t j = 0; j < height; j++)
   {
     if(bpp < 16)
+    {
+      const uint8_t *const in = buf + 3 * j * width;
+      float *const out = mipbuf + 4 * j * width;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
       for(size_t i = 0; i < width; i++)
-        for(int k = 0; k < 3; k++)
-          mipbuf[4 * (j * width + i) + k] = buf[3 * (j * width + i) + k] * (1.0f / 255.0f);
+        for(int k = 0; k < 3; k++) out[4 * i + k] = in[3 * i + k] * (1.0f / 255.0f);
+    }
     else
+    {
+      // 16 bit samples are big endian
+      const uint8_t *const in = buf + 6 * j * width;
+      float *const out = mipbuf + 4 * j * width;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
       for(size_t i = 0; i < width; i++)
         for(int k = 0; k < 3; k++)
-          mipbuf[4 * (j * width + i) + k] = (256.0f * buf[2 * (3 * (j * width + i) + k)]
-                                             + buf[2 * (3 * (j * width + i) + k) + 1]) * (1.0f / 65535.0f);
+          out[4 * i + k] = (256.0f * in[2 * (3 * i + k)] + in[2 * (3 * i + k) + 1]) * (1.0f / 65535.0f);
+    }
   }
 
   dt_free_align(buf);
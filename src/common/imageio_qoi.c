@@ -0,0 +1,208 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/imageio_qoi.h"
+
+#include <string.h>
+
+// follows the qoi specification 1.0, 3 channels, so files can be checked with other tools
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_MASK_2 0xc0
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+static const uint8_t _qoi_padding[QOI_PADDING_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+static inline int _qoi_hash(const uint8_t *px)
+{
+  return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+static inline void _write_32(uint8_t *out, const uint32_t v)
+{
+  out[0] = v >> 24;
+  out[1] = v >> 16;
+  out[2] = v >> 8;
+  out[3] = v;
+}
+
+static inline uint32_t _read_32(const uint8_t *in)
+{
+  return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+size_t dt_imageio_qoi_compress_bound(const int width, const int height)
+{
+  // worst case is a full QOI_OP_RGB per pixel
+  return (size_t)width * height * 4 + QOI_HEADER_SIZE + QOI_PADDING_SIZE;
+}
+
+size_t dt_imageio_qoi_compress(const uint8_t *in, uint8_t *out, const int width, const int height)
+{
+  memcpy(out, "qoif", 4);
+  _write_32(out + 4, width);
+  _write_32(out + 8, height);
+  out[12] = 3; // channels
+  out[13] = 0; // srgb with linear alpha
+  size_t p = QOI_HEADER_SIZE;
+
+  uint8_t index[64][4] = { { 0 } };
+  uint8_t prev[4] = { 0, 0, 0, 255 };
+  int run = 0;
+  const size_t npixels = (size_t)width * height;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const uint8_t px[4] = { in[4 * k], in[4 * k + 1], in[4 * k + 2], 255 };
+    if(px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2])
+    {
+      run++;
+      if(run == 62 || k == npixels - 1)
+      {
+        out[p++] = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if(run)
+    {
+      out[p++] = QOI_OP_RUN | (run - 1);
+      run = 0;
+    }
+
+    const int h = _qoi_hash(px);
+    if(!memcmp(index[h], px, 4))
+      out[p++] = QOI_OP_INDEX | h;
+    else
+    {
+      memcpy(index[h], px, 4);
+      const int8_t vr = px[0] - prev[0];
+      const int8_t vg = px[1] - prev[1];
+      const int8_t vb = px[2] - prev[2];
+      const int8_t vg_r = vr - vg;
+      const int8_t vg_b = vb - vg;
+      if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+        out[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+      else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+      {
+        out[p++] = QOI_OP_LUMA | (vg + 32);
+        out[p++] = (vg_r + 8) << 4 | (vg_b + 8);
+      }
+      else
+      {
+        out[p++] = QOI_OP_RGB;
+        out[p++] = px[0];
+        out[p++] = px[1];
+        out[p++] = px[2];
+      }
+    }
+    memcpy(prev, px, 3);
+  }
+  memcpy(out + p, _qoi_padding, QOI_PADDING_SIZE);
+  return p + QOI_PADDING_SIZE;
+}
+
+int dt_imageio_qoi_decompress_header(const uint8_t *in, const size_t length, int *width, int *height)
+{
+  if(length < QOI_HEADER_SIZE + QOI_PADDING_SIZE || memcmp(in, "qoif", 4)) return 1;
+  const uint32_t wd = _read_32(in + 4), ht = _read_32(in + 8);
+  if(!wd || !ht || wd > 1u << 16 || ht > 1u << 16 || (in[12] != 3 && in[12] != 4)) return 1;
+  *width = wd;
+  *height = ht;
+  return 0;
+}
+
+int dt_imageio_qoi_decompress(const uint8_t *in, const size_t length, uint8_t *out)
+{
+  int width, height;
+  if(dt_imageio_qoi_decompress_header(in, length, &width, &height)) return 1;
+
+  uint8_t index[64][4] = { { 0 } };
+  uint8_t px[4] = { 0, 0, 0, 255 };
+  const size_t end = length - QOI_PADDING_SIZE;
+  size_t p = QOI_HEADER_SIZE;
+  int run = 0;
+  const size_t npixels = (size_t)width * height;
+  for(size_t k = 0; k < npixels; k++)
+  {
+    if(run)
+      run--;
+    else if(p < end)
+    {
+      const uint8_t b1 = in[p++];
+      if(b1 == QOI_OP_RGB)
+      {
+        if(p + 3 > end) return 1;
+        px[0] = in[p++];
+        px[1] = in[p++];
+        px[2] = in[p++];
+      }
+      else if(b1 == 0xff) // QOI_OP_RGBA, we don't write it but other encoders might
+      {
+        if(p + 4 > end) return 1;
+        px[0] = in[p++];
+        px[1] = in[p++];
+        px[2] = in[p++];
+        px[3] = in[p++];
+      }
+      else if((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+        memcpy(px, index[b1], 4);
+      else if((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+      {
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += (b1 & 0x03) - 2;
+      }
+      else if((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+      {
+        if(p + 1 > end) return 1;
+        const uint8_t b2 = in[p++];
+        const int vg = (b1 & 0x3f) - 32;
+        px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 + (b2 & 0x0f);
+      }
+      else
+        run = b1 & 0x3f;
+      memcpy(index[_qoi_hash(px)], px, 4);
+    }
+    else
+      return 1;
+    out[4 * k + 0] = px[0];
+    out[4 * k + 1] = px[1];
+    out[4 * k + 2] = px[2];
+    out[4 * k + 3] = 0xff;
+  }
+  return 0;
+}
+
+#undef QOI_OP_INDEX
+#undef QOI_OP_DIFF
+#undef QOI_OP_LUMA
+#undef QOI_OP_RUN
+#undef QOI_OP_RGB
+#undef QOI_MASK_2
+#undef QOI_HEADER_SIZE
+#undef QOI_PADDING_SIZE
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,43 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * lossless "quite ok image" coding of 8 bit rgb buffers in memory. it compresses a lot
+ * worse than jpeg but decodes several times faster, which is what the thumbnail disk
+ * cache wants while scrolling the lighttable. the 4th byte of every pixel is ignored
+ * when compressing and set to 0xff when decompressing, like the jpeg helpers do.
+ */
+
+/** upper bound of the compressed size of a width x height image. */
+size_t dt_imageio_qoi_compress_bound(const int width, const int height);
+/** compresses the 4 channel buffer in to out, which must hold dt_imageio_qoi_compress_bound() bytes.
+ * returns the data length. */
+size_t dt_imageio_qoi_compress(const uint8_t *in, uint8_t *out, const int width, const int height);
+/** reads width and height from the header. returns non-zero on broken data. */
+int dt_imageio_qoi_decompress_header(const uint8_t *in, const size_t length, int *width, int *height);
+/** decodes the whole image into the 4 channel buffer out. returns non-zero on broken data. */
+int dt_imageio_qoi_decompress(const uint8_t *in, const size_t length, uint8_t *out);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -22,6 +22,7 @@
 
 #include "RawSpeed-API.h"
 
+#include <glib/gstdio.h>
 #include <memory>
 
 #define __STDC_LIMIT_MACROS
@@ -37,11 +38,13 @@ extern "C" {
 #include <stdint.h>
 }
 
-// define this function, it is only declared in rawspeed:
+// define this function, it is only declared in rawspeed. the threaded decompressors split their slices
+// over this many threads, so a decode in a parallel export job stays within the threads of that job
+// instead of every concurrent decode claiming all cores.
 int rawspeed_get_number_of_processor_cores()
 {
 #ifdef _OPENMP
-  return omp_get_num_procs();
+  return omp_get_max_threads();
 #else
   return 1;
 #endif
@@ -103,6 +106,16 @@ void dt_rawspeed_lookup_makermodel(const char *maker, const char *model,
   }
 }
 
+// reading whole files concurrently from one spinning disk makes it seek between them, so reads are
+// serialised per device. files on different disks, or a disk and a memory card, load in parallel.
+static dt_pthread_mutex_t *_read_lock(const char *filename)
+{
+  GStatBuf st;
+  const uint32_t dev = g_stat(filename, &st) == 0 ? (uint32_t)st.st_dev : 0;
+  // device numbers of partitions differ in a few low bits only, spread them over the locks
+  return &darktable.readFile_mutex[((uint32_t)(dev * 2654435761u) >> 16) % DT_READFILE_LOCKS];
+}
+
 uint32_t dt_rawspeed_crop_dcraw_filters(uint32_t filters, uint32_t crop_x, uint32_t crop_y)
 {
   if(!filters || filters == 9u) return filters;
@@ -126,9 +139,18 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    dt_pthread_mutex_lock(&darktable.readFile_mutex);
-    m = f.readFile();
-    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    dt_pthread_mutex_t *lock = _read_lock(filen);
+    dt_pthread_mutex_lock(lock);
+    try
+    {
+      m = f.readFile();
+    }
+    catch(...)
+    {
+      dt_pthread_mutex_unlock(lock);
+      throw;
+    }
+    dt_pthread_mutex_unlock(lock);
 
     RawParser t(m.get());
     d = t.getDecoder(meta);
@@ -46,98 +46,133 @@ typedef struct tiff_t
 } tiff_t;
 
 
-static inline int _read_planar_8(tiff_t *t)
+static TIFF *_open(const char *filename)
 {
-  for(uint32_t row = 0; row < t->height; row++)
-  {
-    uint8_t *in = ((uint8_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  TIFF *tiff = TIFFOpenW(wfilename, "rb");
+  g_free(wfilename);
+  return tiff;
+#else
+  return TIFFOpen(filename, "rb");
+#endif
+}
 
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
+/* convert n pixels of one row of 8, 16 bit or float samples to rgb float */
+static inline void _convert_row(const tiff_t *t, const void *const in, float *const out, const uint32_t n)
+{
+  const int s = t->spp;
+  // grey images repeat their first sample
+  const int c1 = (s == 1) ? 0 : 1;
+  const int c2 = (s == 1) ? 0 : 2;
 
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
+  if(t->bpp == 8)
+  {
+    const uint8_t *const i8 = (const uint8_t *)in;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(uint32_t i = 0; i < n; i++)
     {
-      /* set rgb to first sample from scanline */
-      out[0] = ((float)in[0]) * (1.0f / 255.0f);
-
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = ((float)in[1]) * (1.0f / 255.0f);
-        out[2] = ((float)in[2]) * (1.0f / 255.0f);
-      }
-
-      out[3] = 0;
+      out[4 * i + 0] = ((float)i8[s * i]) * (1.0f / 255.0f);
+      out[4 * i + 1] = ((float)i8[s * i + c1]) * (1.0f / 255.0f);
+      out[4 * i + 2] = ((float)i8[s * i + c2]) * (1.0f / 255.0f);
+      out[4 * i + 3] = 0.0f;
     }
   }
-
-  return 1;
-}
-
-static inline int _read_planar_16(tiff_t *t)
-{
-  for(uint32_t row = 0; row < t->height; row++)
+  else if(t->bpp == 16)
   {
-    uint16_t *in = ((uint16_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
-
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
-
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
+    const uint16_t *const i16 = (const uint16_t *)in;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(uint32_t i = 0; i < n; i++)
     {
-      out[0] = ((float)in[0]) * (1.0f / 65535.0f);
-
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = ((float)in[1]) * (1.0f / 65535.0f);
-        out[2] = ((float)in[2]) * (1.0f / 65535.0f);
-      }
-
-      out[3] = 0;
+      out[4 * i + 0] = ((float)i16[s * i]) * (1.0f / 65535.0f);
+      out[4 * i + 1] = ((float)i16[s * i + c1]) * (1.0f / 65535.0f);
+      out[4 * i + 2] = ((float)i16[s * i + c2]) * (1.0f / 65535.0f);
+      out[4 * i + 3] = 0.0f;
+    }
+  }
+  else
+  {
+    const float *const f = (const float *)in;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(uint32_t i = 0; i < n; i++)
+    {
+      out[4 * i + 0] = f[s * i];
+      out[4 * i + 1] = f[s * i + c1];
+      out[4 * i + 2] = f[s * i + c2];
+      out[4 * i + 3] = 0.0f;
     }
   }
-
-  return 1;
 }
 
-static inline int _read_planar_f(tiff_t *t)
+/* read the strips or tiles of a contiguous rgb or grey image on all cores. libtiff handles can't be shared
+ * between threads, so every thread but the calling one opens the file again. large compressed files are
+ * bound by the decoder, and this also takes tiled files which TIFFReadScanline() refuses. */
+static inline int _read_blocks(tiff_t *t, const char *filename)
 {
-  for(uint32_t row = 0; row < t->height; row++)
+  const int tiled = TIFFIsTiled(t->tiff);
+  uint32_t bw = t->width, bh = 0;
+  if(tiled)
   {
-    float *in = ((float *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
+    TIFFGetField(t->tiff, TIFFTAG_TILEWIDTH, &bw);
+    TIFFGetField(t->tiff, TIFFTAG_TILELENGTH, &bh);
+  }
+  else
+    TIFFGetFieldDefaulted(t->tiff, TIFFTAG_ROWSPERSTRIP, &bh);
+  bh = MIN(bh, t->height);
+  if(bw == 0 || bh == 0) return -1;
 
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
+  const uint32_t blocks = tiled ? TIFFNumberOfTiles(t->tiff) : TIFFNumberOfStrips(t->tiff);
+  const tmsize_t blocksize = tiled ? TIFFTileSize(t->tiff) : TIFFStripSize(t->tiff);
+  const tmsize_t rowsize = tiled ? TIFFTileRowSize(t->tiff) : TIFFScanlineSize(t->tiff);
+  const uint32_t across = (t->width + bw - 1) / bw;
+  if(blocksize <= 0 || rowsize <= 0) return -1;
 
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
+  int ok = 1;
+
+#ifdef _OPENMP
+#pragma omp parallel default(none) if(blocks > 1) \
+  dt_omp_firstprivate(t, filename, tiled, bw, bh, blocks, blocksize, rowsize, across) \
+  shared(ok)
+#endif
+  {
+    TIFF *tiff = dt_get_thread_num() == 0 ? t->tiff : _open(filename);
+    uint8_t *buf = (uint8_t *)_TIFFmalloc(blocksize);
+    if(!tiff || !buf) g_atomic_int_set(&ok, -1);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for(uint32_t b = 0; b < blocks; b++)
     {
-      out[0] = in[0];
+      if(!tiff || !buf || g_atomic_int_get(&ok) != 1) continue;
 
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
+      const uint32_t x0 = (b % across) * bw;
+      const uint32_t y0 = (b / across) * bh;
+      const tmsize_t read
+          = tiled ? TIFFReadEncodedTile(tiff, b, buf, blocksize) : TIFFReadEncodedStrip(tiff, b, buf, blocksize);
+      if(read == -1)
       {
-        out[1] = in[1];
-        out[2] = in[2];
+        g_atomic_int_set(&ok, -1);
+        continue;
       }
 
-      out[3] = 0;
+      const uint32_t rows = MIN(bh, t->height - y0);
+      const uint32_t cols = MIN(bw, t->width - x0);
+      for(uint32_t r = 0; r < rows; r++)
+        _convert_row(t, buf + (size_t)r * rowsize, t->mipbuf + (size_t)4 * ((size_t)(y0 + r) * t->width + x0), cols);
     }
+
+    if(buf) _TIFFfree(buf);
+    if(tiff && tiff != t->tiff) TIFFClose(tiff);
   }
 
-  return 1;
+  return ok;
 }
 
 static inline int _read_planar_8_Lab(tiff_t *t, uint16_t photometric)
@@ -269,13 +304,7 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
 
   t.image = img;
 
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  t.tiff = TIFFOpenW(wfilename, "rb");
-  g_free(wfilename);
-#else
-  t.tiff = TIFFOpen(filename, "rb");
-#endif
+  t.tiff = _open(filename);
 
   if(t.tiff == NULL) return DT_IMAGEIO_FILE_CORRUPTED;
 
@@ -349,12 +378,9 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
     ok = _read_planar_16_Lab(&t, photometric);
     t.image->buf_dsc.cst = iop_cs_Lab;
   }
-  else if(t.bpp == 8 && t.sampleformat == SAMPLEFORMAT_UINT && config == PLANARCONFIG_CONTIG)
-    ok = _read_planar_8(&t);
-  else if(t.bpp == 16 && t.sampleformat == SAMPLEFORMAT_UINT && config == PLANARCONFIG_CONTIG)
-    ok = _read_planar_16(&t);
-  else if(t.bpp == 32 && t.sampleformat == SAMPLEFORMAT_IEEEFP && config == PLANARCONFIG_CONTIG)
-    ok = _read_planar_f(&t);
+  else if(((t.bpp == 8 || t.bpp == 16) && t.sampleformat == SAMPLEFORMAT_UINT && config == PLANARCONFIG_CONTIG)
+          || (t.bpp == 32 && t.sampleformat == SAMPLEFORMAT_IEEEFP && config == PLANARCONFIG_CONTIG))
+    ok = _read_blocks(&t, filename);
   else
   {
     fprintf(stderr, "[tiff_open] error: Not a supported tiff image format.");
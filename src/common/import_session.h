@@ -63,6 +63,9 @@ const char *dt_import_session_filename(struct dt_import_session_t *self, gboolea
 */
 const char *dt_import_session_path(struct dt_import_session_t *self, gboolean current);
 
+/** \brief would dt_import_session_path() switch to a new path, and film roll, with the current variables */
+gboolean dt_import_session_path_changed(struct dt_import_session_t *self);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -18,6 +18,7 @@
 
 #include "common/interpolation.h"
 #include "common/darktable.h"
+#include "common/simd.h"
 #include "control/conf.h"
 
 #include <assert.h>
@@ -1522,236 +1523,85 @@ static void dt_interpolation_resample_plain(const struct dt_interpolation *itor,
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, in_stride, out_stride, roi_out) \
-  shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
-#endif
-  for(int oy = 0; oy < roi_out->height; oy++)
-  {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
-    {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      float vs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          const float htap = hkernel[hkidx++];
-          for(int c = 0; c < 3; c++) vhs[c] += i[baseidx + c] * htap;
-        }
-
-        // Accumulate contribution from this line
-        const float vtap = vkernel[vkidx++];
-        for(int c = 0; c < 3; c++) vs[c] += vhs[c] * vtap;
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      for(int c = 0; c < 3; c++) o[c] = vs[c];
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
-    }
-  }
-
-#if DEBUG_RESAMPLING_TIMING
-  ts_resampling = getts() - ts_resampling;
-  fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
-#endif
-
-exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
-}
-
-#if defined(__SSE2__)
-static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
-                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                          const float *const in, const dt_iop_roi_t *const roi_in,
-                                          const int32_t in_stride)
-{
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
-
-  debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
-             roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
-             roi_out->x, roi_out->y, roi_out->scale);
-
-  // Fast code path for 1:1 copy, only cropping area can change
-  if(roi_out->scale == 1.f)
-  {
-    const int x0 = roi_out->x * 4 * sizeof(float);
-#if DEBUG_RESAMPLING_TIMING
-    int64_t ts_resampling = getts();
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(in, in_stride, out_stride, roi_out, x0) \
-    shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
-    {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, out_stride);
-    }
-#if DEBUG_RESAMPLING_TIMING
-    ts_resampling = getts() - ts_resampling;
-    fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
-#endif
-    // All done, so easy case
-    return;
-  }
-
-// Generic non 1:1 case... much more complicated :D
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_plan = getts();
-#endif
-
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
-  {
-    goto exit;
-  }
-
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
-  {
+  /* The filter is separable, so instead of running the horizontal taps again for every vertical tap of
+   * every output pixel, each input line is filtered horizontally once and the output lines are then
+   * computed from those. Every thread handles a contiguous block of output lines and keeps the
+   * horizontally filtered lines of its block in a ring buffer, line y living in slot y % ring. The
+   * lines of one vertical window are a range of at most ring consecutive lines (the border modes only
+   * repeat or mirror lines of that range), so they never evict each other. */
+  int ring = 1;
+  for(int oy = 0; oy < roi_out->height; oy++) ring = MAX(ring, vlength[oy]);
+
+  const int nthreads = dt_get_num_threads();
+  const size_t ringsize = (size_t)ring * roi_out->width * 4;
+  float *const rings = dt_alloc_align(64, sizeof(float) * ringsize * nthreads);
+  int *const tags = malloc(sizeof(int) * ring * nthreads);
+  if(!rings || !tags)
+  {
+    dt_free_align(rings);
+    free(tags);
     goto exit;
   }
+  for(int k = 0; k < ring * nthreads; k++) tags[k] = -1;
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_plan = getts() - ts_plan;
-#endif
-
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_resampling = getts();
-#endif
-
-// Process each output line
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, in_stride, out_stride, roi_out) \
+#pragma omp parallel default(none) \
+  dt_omp_firstprivate(in, in_stride, out_stride, roi_out, ring, ringsize, rings, tags) \
   shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
 #endif
-  for(int oy = 0; oy < roi_out->height; oy++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
+    float *const buf = rings + ringsize * dt_get_thread_num();
+    int *const tag = tags + ring * dt_get_thread_num();
 
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int oy = 0; oy < roi_out->height; oy++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
+      const int vl = vlength[vmeta[3 * oy + 0]]; // V(ertical) L(ength)
+      const int vkidx = vmeta[3 * oy + 1];      // V(ertical) K(ernel) I(n)d(e)x
+      const int viidx = vmeta[3 * oy + 2];      // V(ertical) I(ndex) I(n)d(e)x
 
+      // Filter the input lines of this window that aren't in the ring yet
       for(int iy = 0; iy < vl; iy++)
       {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
+        const int y = vindex[viidx + iy];
+        if(tag[y % ring] == y) continue;
+        tag[y % ring] = y;
 
-        __m128 vhs = _mm_setzero_ps();
+        const float *const i = (float *)((char *)in + (size_t)in_stride * y);
+        float *const h = buf + (size_t)(y % ring) * roi_out->width * 4;
 
-        for(int ix = 0; ix < hl; ix++)
+        int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
+        for(int ox = 0; ox < roi_out->width; ox++)
         {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
+          const int hl = hlength[ox]; // H(orizontal) L(ength)
+          dt_simd4f vhs = dt_simd4f_zero();
+          for(int ix = 0; ix < hl; ix++, hkidx++)
+            vhs += dt_simd4f_load(i + (size_t)hindex[hkidx] * 4) * hkernel[hkidx];
+          dt_simd4f_store(h + (size_t)ox * 4, vhs);
         }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
       }
 
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+      // Combine the filtered lines, this runs over whole lines so the inner loop is a plain stream
+      float *const o = (float *)((char *)out + (size_t)oy * out_stride);
+      for(int iy = 0; iy < vl; iy++)
+      {
+        const float *const h = buf + (size_t)(vindex[viidx + iy] % ring) * roi_out->width * 4;
+        const dt_simd4f vtap = dt_simd4f_set1(vkernel[vkidx + iy]);
+        if(iy == 0)
+          for(int ox = 0; ox < roi_out->width; ox++)
+            dt_simd4f_store(o + (size_t)ox * 4, dt_simd4f_load(h + (size_t)ox * 4) * vtap);
+        else
+          for(int ox = 0; ox < roi_out->width; ox++)
+            dt_simd4f_store(o + (size_t)ox * 4,
+                            dt_simd4f_load(o + (size_t)ox * 4) + dt_simd4f_load(h + (size_t)ox * 4) * vtap);
+      }
     }
   }
 
-  _mm_sfence();
+  dt_free_align(rings);
+  free(tags);
 
 #if DEBUG_RESAMPLING_TIMING
   ts_resampling = getts() - ts_resampling;
@@ -1765,7 +1615,6 @@ exit:
   dt_free_align(hlength);
   dt_free_align(vlength);
 }
-#endif
 
 /** Applies resampling (re-scaling) on *full* input and output buffers.
  *  roi_in and roi_out define the part of the buffers that is affected.
@@ -1775,14 +1624,7 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
                                const float *const in, const dt_iop_roi_t *const roi_in,
                                const int32_t in_stride)
 {
-  if(darktable.codepath.OPENMP_SIMD)
-    return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
-#if defined(__SSE2__)
-  else if(darktable.codepath.SSE2)
-    return dt_interpolation_resample_sse(itor, out, roi_out, out_stride, in, roi_in, in_stride);
-#endif
-  else
-    dt_unreachable_codepath();
+  return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
 }
 
 /** Applies resampling (re-scaling) on a specific region-of-interest of an image. The input
@@ -418,6 +418,75 @@ gboolean dt_ioppr_is_iop_before(GList *iop_order_list, const char *base_operatio
   return op_order < base_order;
 }
 
+struct dt_iop_order_table_t
+{
+  GHashTable *by_instance;  // entry -> entry, hashed and compared on operation and instance
+  GHashTable *by_operation; // operation -> first entry, for multi_priority == -1
+};
+
+static guint _iop_order_entry_hash(gconstpointer key)
+{
+  const dt_iop_order_entry_t *const restrict e = (const dt_iop_order_entry_t *)key;
+  return g_str_hash(e->operation) * 31 + e->instance;
+}
+
+static gboolean _iop_order_entry_equal(gconstpointer a, gconstpointer b)
+{
+  const dt_iop_order_entry_t *const restrict ea = (const dt_iop_order_entry_t *)a;
+  const dt_iop_order_entry_t *const restrict eb = (const dt_iop_order_entry_t *)b;
+  return ea->instance == eb->instance && strcmp(ea->operation, eb->operation) == 0;
+}
+
+dt_iop_order_table_t *dt_ioppr_iop_order_table_new(GList *iop_order_list)
+{
+  dt_iop_order_table_t *table = (dt_iop_order_table_t *)malloc(sizeof(dt_iop_order_table_t));
+  table->by_instance = g_hash_table_new(_iop_order_entry_hash, _iop_order_entry_equal);
+  table->by_operation = g_hash_table_new(g_str_hash, g_str_equal);
+
+  // like the lookups in the list, the first of duplicated entries wins
+  for(GList *l = iop_order_list; l; l = g_list_next(l))
+  {
+    dt_iop_order_entry_t *e = (dt_iop_order_entry_t *)l->data;
+    if(!g_hash_table_contains(table->by_instance, e)) g_hash_table_insert(table->by_instance, e, e);
+    if(!g_hash_table_contains(table->by_operation, e->operation))
+      g_hash_table_insert(table->by_operation, e->operation, e);
+  }
+
+  return table;
+}
+
+void dt_ioppr_iop_order_table_free(dt_iop_order_table_t *table)
+{
+  if(!table) return;
+  g_hash_table_destroy(table->by_instance);
+  g_hash_table_destroy(table->by_operation);
+  free(table);
+}
+
+dt_iop_order_entry_t *dt_ioppr_iop_order_table_get_entry(const dt_iop_order_table_t *table, const char *op_name,
+                                                         const int multi_priority)
+{
+  if(multi_priority == -1) return (dt_iop_order_entry_t *)g_hash_table_lookup(table->by_operation, op_name);
+
+  // an operation that long can't be in the list, don't let the truncated copy match another one
+  dt_iop_order_entry_t key;
+  if(g_strlcpy(key.operation, op_name, sizeof(key.operation)) >= sizeof(key.operation)) return NULL;
+  key.instance = multi_priority;
+  return (dt_iop_order_entry_t *)g_hash_table_lookup(table->by_instance, &key);
+}
+
+int dt_ioppr_iop_order_table_get_order(const dt_iop_order_table_t *table, const char *op_name,
+                                       const int multi_priority)
+{
+  const dt_iop_order_entry_t *const restrict order_entry
+      = dt_ioppr_iop_order_table_get_entry(table, op_name, multi_priority);
+
+  if(order_entry) return order_entry->o.iop_order;
+
+  fprintf(stderr, "cannot get iop-order for %s instance %d\n", op_name, multi_priority);
+  return INT_MAX;
+}
+
 gint dt_sort_iop_list_by_order(gconstpointer a, gconstpointer b)
 {
   const dt_iop_order_entry_t *const restrict am = (const dt_iop_order_entry_t *)a;
@@ -703,6 +772,7 @@ void dt_ioppr_resync_modules_order(dt_develop_t *dev)
 
   // and reset all module iop_order
 
+  dt_iop_order_table_t *table = dt_ioppr_iop_order_table_new(dev->iop_order_list);
   GList *modules = g_list_first(dev->iop);
   while(modules)
   {
@@ -712,10 +782,11 @@ void dt_ioppr_resync_modules_order(dt_develop_t *dev)
     // modules with iop_order set to INT_MAX we keep them as they will be removed (non visible)
     // _lib_modulegroups_update_iop_visibility.
     if(mod->iop_order != INT_MAX)
-      mod->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, mod->op, mod->multi_priority);
+      mod->iop_order = dt_ioppr_iop_order_table_get_order(table, mod->op, mod->multi_priority);
 
     modules = next;
   }
+  dt_ioppr_iop_order_table_free(table);
 
   dev->iop = g_list_sort(dev->iop, dt_sort_iop_by_order);
 }
@@ -1090,6 +1161,7 @@ void dt_ioppr_update_for_style_items(dt_develop_t *dev, GList *st_items, gboolea
 
   // write back the multi-priority
 
+  dt_iop_order_table_t *table = dt_ioppr_iop_order_table_new(dev->iop_order_list);
   si_list = g_list_first(st_items);
   GList *el = g_list_first(e_list);
   while(si_list)
@@ -1098,11 +1170,12 @@ void dt_ioppr_update_for_style_items(dt_develop_t *dev, GList *st_items, gboolea
     const dt_iop_order_entry_t *const restrict e = (dt_iop_order_entry_t *)el->data;
 
     si->multi_priority = e->instance;
-    si->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, si->operation, si->multi_priority);
+    si->iop_order = dt_ioppr_iop_order_table_get_order(table, si->operation, si->multi_priority);
 
     el = g_list_next(el);
     si_list = g_list_next(si_list);
   }
+  dt_ioppr_iop_order_table_free(table);
 
   g_list_free(e_list);
 }
@@ -1131,6 +1204,7 @@ void dt_ioppr_update_for_modules(dt_develop_t *dev, GList *modules, gboolean app
 
   // write back the multi-priority
 
+  dt_iop_order_table_t *table = dt_ioppr_iop_order_table_new(dev->iop_order_list);
   m_list = g_list_first(modules);
   GList *el = g_list_first(e_list);
   while(m_list)
@@ -1139,11 +1213,12 @@ void dt_ioppr_update_for_modules(dt_develop_t *dev, GList *modules, gboolean app
     dt_iop_order_entry_t *e = (dt_iop_order_entry_t *)el->data;
 
     mod->multi_priority = e->instance;
-    mod->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, mod->op, mod->multi_priority);
+    mod->iop_order = dt_ioppr_iop_order_table_get_order(table, mod->op, mod->multi_priority);
 
     el = g_list_next(el);
     m_list = g_list_next(m_list);
   }
+  dt_ioppr_iop_order_table_free(table);
 
   g_list_free_full(e_list, free);
 }
@@ -1278,12 +1353,13 @@ int dt_ioppr_check_so_iop_order(GList *iop_list, GList *iop_order_list)
   int iop_order_missing = 0;
 
   // check if all the modules have their iop_order assigned
+  dt_iop_order_table_t *table = dt_ioppr_iop_order_table_new(iop_order_list);
   GList *modules = g_list_first(iop_list);
   while(modules)
   {
     const dt_iop_module_so_t *const restrict mod = (dt_iop_module_so_t *)(modules->data);
     const dt_iop_order_entry_t *const restrict entry =
-      dt_ioppr_get_iop_order_entry(iop_order_list, mod->op, 0); // mod->multi_priority);
+      dt_ioppr_iop_order_table_get_entry(table, mod->op, 0); // mod->multi_priority);
     if(entry == NULL)
     {
       iop_order_missing = 1;
@@ -1291,6 +1367,7 @@ int dt_ioppr_check_so_iop_order(GList *iop_list, GList *iop_order_list)
     }
     modules = g_list_next(modules);
   }
+  dt_ioppr_iop_order_table_free(table);
 
   return iop_order_missing;
 }
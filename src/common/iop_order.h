@@ -180,6 +180,17 @@ int dt_ioppr_get_iop_order(GList *iop_order_list, const char *op_name, const int
 /** returns TRUE if operation/multi-priority is before base_operation (first in pipe) on the iop-list */
 gboolean dt_ioppr_is_iop_before(GList *iop_order_list, const char *base_operation,
                                 const char *operation, const int multi_priority);
+
+/** lookup table of iop_order_list by operation and instance, for many lookups in a row. it points into the
+    list, so it is only valid as long as no entry is added to or removed from the list. */
+typedef struct dt_iop_order_table_t dt_iop_order_table_t;
+dt_iop_order_table_t *dt_ioppr_iop_order_table_new(GList *iop_order_list);
+void dt_ioppr_iop_order_table_free(dt_iop_order_table_t *table);
+/** same as dt_ioppr_get_iop_order_entry() and dt_ioppr_get_iop_order(), through the table */
+dt_iop_order_entry_t *dt_ioppr_iop_order_table_get_entry(const dt_iop_order_table_t *table, const char *op_name,
+                                                         const int multi_priority);
+int dt_ioppr_iop_order_table_get_order(const dt_iop_order_table_t *table, const char *op_name,
+                                       const int multi_priority);
 /* write iop-order list for the given image */
 gboolean dt_ioppr_write_iop_order_list(GList *iop_order_list, const int32_t imgid);
 gboolean dt_ioppr_write_iop_order(const dt_iop_order_t kind, GList *iop_order_list, const int32_t imgid);
@@ -25,9 +25,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
-#if defined(__SSE2__)
-#include <xmmintrin.h>
-#endif
+#include "common/simd.h"
 
 // the maximum number of levels for the gaussian pyramid
 #define max_levels 30
@@ -148,48 +146,24 @@ static void pad_by_replication(
   }
 }
 
-static inline void gauss_expand(
-    const float *const input, // coarse input
-    float *const fine,        // upsampled, blurry output
-    const int wd,             // fine res
-    const int ht)
-{
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(fine, input, wd, ht) \
-  schedule(static) \
-  collapse(2)
-#endif
-  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
-    for(int i=1;i<((wd-1)&~1);i++)
-      fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
-  ll_fill_boundary2(fine, wd, ht);
-}
-
-#if defined(__SSE2__)
-static inline __m128 convolve14641_vert(const float *in, const int wd)
+static inline dt_simd4f convolve14641_vert(const float *in, const int wd)
 {
-  float four[4] = { 4.f, 4.f, 4.f, 4.f };
-  __m128 r0 = _mm_loadu_ps(in);
-  __m128 r1 = _mm_loadu_ps(in + wd);
-  __m128 r2 = _mm_loadu_ps(in + 2*wd);
-  __m128 r3 = _mm_loadu_ps(in + 3*wd);
-  __m128 r4 = _mm_loadu_ps(in + 4*wd);
-  _mm_prefetch(in+4,_MM_HINT_NTA);		// prefetch next column, which won't be used again afterwards
-  r0 = _mm_add_ps(r0, r4);                      // r0 = r0+r4
-  _mm_prefetch(in+4+wd,_MM_HINT_NTA);		// prefetch next column, which won't be used again afterwards
-  r1 = _mm_add_ps(_mm_add_ps(r1,r3), r2);       // r1 = r1+r2+r3
-  _mm_prefetch(in+4+2*wd,_MM_HINT_T0);
-  r0 = _mm_add_ps(r0, _mm_add_ps(r2, r2));     // r0 = r0+2*r2+r4
-  _mm_prefetch(in+4+3*wd, _MM_HINT_T0);
-  __m128 t = _mm_mul_ps(r1, _mm_load_ps(four)); // t= 4*r1+4*r2+4*r3
-  _mm_prefetch(in+4+4*wd, _MM_HINT_T0);
-  return _mm_add_ps(r0, t);                   // r0+4*r1+6*r2+4*r3+r4 
+  const dt_simd4f r0 = dt_simd4f_loadu(in);
+  const dt_simd4f r1 = dt_simd4f_loadu(in + wd);
+  const dt_simd4f r2 = dt_simd4f_loadu(in + 2*wd);
+  const dt_simd4f r3 = dt_simd4f_loadu(in + 3*wd);
+  const dt_simd4f r4 = dt_simd4f_loadu(in + 4*wd);
+  __builtin_prefetch(in+4, 0, 0);		// prefetch next column, which won't be used again afterwards
+  __builtin_prefetch(in+4+wd, 0, 0);
+  __builtin_prefetch(in+4+2*wd, 0, 3);
+  __builtin_prefetch(in+4+3*wd, 0, 3);
+  __builtin_prefetch(in+4+4*wd, 0, 3);
+  return (r0 + r4) + 2.0f*r2 + 4.0f*(r1 + r2 + r3); // r0+4*r1+6*r2+4*r3+r4
 }
-#endif
 
-#if defined(__SSE2__)
-static inline void gauss_reduce_sse2(
+// separable 1 4 6 4 1 filter on the portable vectors of common/simd.h (sse, neon or altivec)
+__DT_CLONE_TARGETS__
+static inline void gauss_reduce_vec4(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
     const int wd,             // fine res
@@ -210,16 +184,16 @@ static inline void gauss_reduce_sse2(
     const float *base = input + 2*(j-1)*wd;
     float *const out = coarse + j*cw + 1;
     // prime the vertical axis
-    const __m128 kernel = _mm_setr_ps(1.f, 4.f, 6.f, 4.f);
-    __m128 left = convolve14641_vert(base,wd);
+    const dt_simd4f kernel = { 1.f, 4.f, 6.f, 4.f };
+    dt_simd4f left = convolve14641_vert(base,wd);
     for(int col=0; col<cw-3; col+=2)
     {
       // convolve the next four pixel wide vertical slice
       base += 4;
-      __m128 right = convolve14641_vert(base,wd);
+      const dt_simd4f right = convolve14641_vert(base,wd);
       // horizontal pass, generate two output values from convolving with 1 4 6 4 1
       // the first uses pixels 0-4, the second uses 2-6
-      __m128 conv = _mm_mul_ps(left,kernel);
+      const dt_simd4f conv = left * kernel;
       out[col] = (conv[0] + conv[1] + conv[2] + conv[3] + right[0]) / 256.f;
       out[col+1] = (left[2] + 4*(left[3]+right[1]) + 6*right[0] + right[2]) / 256.f;
       // shift to next pair of output columns (four input columns)
@@ -229,15 +203,15 @@ static inline void gauss_reduce_sse2(
     if (cw % 2)
     {
       base += 4;
-      float right = base[0] + 4*(base[wd]+base[3*wd]) + 6*base[2*wd] + base[4*wd];
-      __m128 conv = _mm_mul_ps(left,kernel);
+      const float right = base[0] + 4*(base[wd]+base[3*wd]) + 6*base[2*wd] + base[4*wd];
+      const dt_simd4f conv = left * kernel;
       out[cw-3] = (conv[0] + conv[1] + conv[2] + conv[3] + right) / 256.f;
     }
   }
   ll_fill_boundary1(coarse, cw, ch);
 }
-#endif
 
+__DT_CLONE_TARGETS__
 static inline void gauss_reduce(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
@@ -428,63 +402,51 @@ static inline float curve_scalar(
   return val;
 }
 
-#if defined(__SSE2__)
-static inline __m128 curve_vec4(
-    const __m128 x,
-    const __m128 g,
-    const __m128 sigma,
-    const __m128 shadows,
-    const __m128 highlights,
-    const __m128 clarity)
+static inline dt_simd4f curve_vec4(
+    const dt_simd4f x,
+    const dt_simd4f g,
+    const dt_simd4f sigma,
+    const dt_simd4f shadows,
+    const dt_simd4f highlights,
+    const dt_simd4f clarity)
 {
-  // TODO: pull these non-data dependent constants out of the loop to see
-  // whether the compiler fail to do so
-  const __m128 const0 = _mm_set_ps1(0x3f800000u);
-  const __m128 const1 = _mm_set_ps1((float)0x402DF854u); // for e^x
-  const __m128 sign_mask = _mm_set1_ps(-0.f); // -0.f = 1 << 31
-  const __m128 one = _mm_set1_ps(1.0f);
-  const __m128 two = _mm_set1_ps(2.0f);
-  const __m128 twothirds = _mm_set1_ps(2.0f/3.0f);
-  const __m128 twosig = _mm_mul_ps(two, sigma);
-  const __m128 sigma2 = _mm_mul_ps(sigma, sigma);
-  const __m128 s22 = _mm_mul_ps(twothirds, sigma2);
-
-  const __m128 c = _mm_sub_ps(x, g);
-  const __m128 select = _mm_cmplt_ps(c, _mm_setzero_ps());
+  const dt_simd4f const0 = dt_simd4f_set1(0x3f800000u);
+  const dt_simd4f const1 = dt_simd4f_set1((float)0x402DF854u); // for e^x
+  const dt_simd4f zero = dt_simd4f_zero();
+  const dt_simd4f one = dt_simd4f_set1(1.0f);
+  const dt_simd4f twosig = 2.0f * sigma;
+  const dt_simd4f s22 = (2.0f/3.0f) * (sigma * sigma);
+
+  const dt_simd4f c = x - g;
+  const dt_simd4i select = c < zero;
   // select shadows or highlights as multiplier for linear part, based on c < 0
-  const __m128 shadhi = _mm_or_ps(_mm_andnot_ps(select, shadows), _mm_and_ps(select, highlights));
-  // flip sign bit of sigma based on c < 0 (c < 0 ? - sigma : sigma)
-  const __m128 ssigma = _mm_xor_ps(sigma, _mm_and_ps(select, sign_mask));
+  const dt_simd4f shadhi = dt_simd4f_select(select, highlights, shadows);
+  // flip sign of sigma based on c < 0 (c < 0 ? - sigma : sigma)
+  const dt_simd4f ssigma = dt_simd4f_select(select, -sigma, sigma);
   // this contains the linear parts valid for c > 2*sigma or c < - 2*sigma
-  const __m128 vlin = _mm_add_ps(g, _mm_add_ps(ssigma, _mm_mul_ps(shadhi, _mm_sub_ps(c, ssigma))));
+  const dt_simd4f vlin = g + (ssigma + shadhi * (c - ssigma));
 
-  const __m128 t = _mm_min_ps(one, _mm_max_ps(_mm_setzero_ps(),
-        _mm_div_ps(c, _mm_mul_ps(two, ssigma))));
-  const __m128 t2 = _mm_mul_ps(t, t);
-  const __m128 mt = _mm_sub_ps(one, t);
+  const dt_simd4f t = dt_simd4f_clamp(c / (2.0f * ssigma), zero, one);
+  const dt_simd4f t2 = t * t;
+  const dt_simd4f mt = one - t;
 
   // midtone value fading over to linear part, without local contrast:
-  const __m128 vmid = _mm_add_ps(g,
-      _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ssigma, two), _mm_mul_ps(mt, t)),
-        _mm_mul_ps(t2, _mm_add_ps(ssigma, _mm_mul_ps(ssigma, shadhi)))));
+  const dt_simd4f vmid = g + ((2.0f * ssigma) * (mt * t) + t2 * (ssigma + ssigma * shadhi));
 
   // c > 2*sigma?
-  const __m128 linselect = _mm_cmpgt_ps(_mm_andnot_ps(sign_mask, c), twosig);
-  const __m128 val = _mm_or_ps(_mm_and_ps(linselect, vlin), _mm_andnot_ps(linselect, vmid));
+  const dt_simd4f val = dt_simd4f_select(dt_simd4f_abs(c) > twosig, vlin, vmid);
 
   // midtone local contrast
-  // dt_fast_expf in sse:
-  const __m128 arg = _mm_xor_ps(sign_mask, _mm_div_ps(_mm_mul_ps(c, c), s22));
-  const __m128 k0 = _mm_add_ps(const0, _mm_mul_ps(arg, _mm_sub_ps(const1, const0)));
-  const __m128 k = _mm_max_ps(k0, _mm_setzero_ps());
-  const __m128i ki = _mm_cvtps_epi32(k);
-  const __m128 gauss = _mm_load_ps((float*)&ki);
-  const __m128 vcon = _mm_mul_ps(clarity, _mm_mul_ps(c, gauss));
-  return _mm_add_ps(val, vcon);
+  // dt_fast_expf on four lanes:
+  const dt_simd4f arg = -((c * c) / s22);
+  const dt_simd4f k = dt_simd4f_max(const0 + arg * (const1 - const0), zero);
+  const dt_simd4f gauss = (dt_simd4f)dt_simd4f_to_int(k);
+  return val + clarity * (c * gauss);
 }
 
-// sse (4-wide)
-void apply_curve_sse2(
+// 4-wide vectors, see common/simd.h
+__DT_CLONE_TARGETS__
+void apply_curve_vec4(
     float *const out,
     const float *const in,
     const uint32_t w,
@@ -496,7 +458,6 @@ void apply_curve_sse2(
     const float highlights,
     const float clarity)
 {
-  // TODO: do all this in avx2 8-wide (should be straight forward):
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(clarity, g, h, highlights, in, out, padding, shadows, sigma, w) \
@@ -506,19 +467,17 @@ void apply_curve_sse2(
   {
     const float *in2  = in  + j*w + padding;
     float *out2 = out + j*w + padding;
-    // find 4-byte aligned block in the middle:
-    const float *const beg = (float *)((size_t)(out2+3)&(size_t)0x10ul);
-    const float *const end = (float *)((size_t)(out2+w-padding)&(size_t)0x10ul);
-    const float *const fin = out2+w-padding;
-    const __m128 g4 = _mm_set1_ps(g);
-    const __m128 sig4 = _mm_set1_ps(sigma);
-    const __m128 shd4 = _mm_set1_ps(shadows);
-    const __m128 hil4 = _mm_set1_ps(highlights);
-    const __m128 clr4 = _mm_set1_ps(clarity);
-    for(;out2<beg;out2++,in2++)
-      *out2 = curve_scalar(*in2, g, sigma, shadows, highlights, clarity);
-    for(;out2<end;out2+=4,in2+=4)
-      _mm_stream_ps(out2, curve_vec4(_mm_load_ps(in2), g4, sig4, shd4, hil4, clr4));
+    const float *const fin = out2+w-2*padding;
+    const dt_simd4f g4 = dt_simd4f_set1(g);
+    const dt_simd4f sig4 = dt_simd4f_set1(sigma);
+    const dt_simd4f shd4 = dt_simd4f_set1(shadows);
+    const dt_simd4f hil4 = dt_simd4f_set1(highlights);
+    const dt_simd4f clr4 = dt_simd4f_set1(clarity);
+    for(;out2+4<=fin;out2+=4,in2+=4)
+    {
+      const dt_simd4f v = curve_vec4(dt_simd4f_loadu(in2), g4, sig4, shd4, hil4, clr4);
+      memcpy(out2, &v, sizeof(v));
+    }
     for(;out2<fin;out2++,in2++)
       *out2 = curve_scalar(*in2, g, sigma, shadows, highlights, clarity);
     out2 = out + j*w;
@@ -527,9 +486,9 @@ void apply_curve_sse2(
   }
   pad_by_replication(out, w, h, padding);
 }
-#endif
 
 // scalar version
+__DT_CLONE_TARGETS__
 void apply_curve(
     float *const out,
     const float *const in,
@@ -569,8 +528,9 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    const int use_sse2,         // flag whether to use SSE version
-    local_laplacian_boundary_t *b)
+    const int use_simd,         // flag whether to use the vectorised version
+    local_laplacian_boundary_t *b,
+    const dt_dev_pixelpipe_iop_t *piece)
 {
   // don't divide by 2 more often than we can:
   const int num_levels = MIN(max_levels, 31-__builtin_clz(MIN(wd,ht)));
@@ -589,21 +549,22 @@ void local_laplacian_internal(
   for(int l=1;l<=last_level;l++)
     padded[l] = dt_alloc_align(64, sizeof(float)*dl(w,l)*dl(h,l));
 
-  // allocate pyramid pointers for output
+  // allocate pyramid pointers for output. the finer levels first collect the laplacian
+  // coefficients of all curves and are collapsed into the output gaussian pyramid at the end
   float *output[max_levels] = {0};
   for(int l=0;l<=last_level;l++)
     output[l] = dt_alloc_align(64, sizeof(float)*dl(w,l)*dl(h,l));
+  for(int l=0;l<last_level;l++)
+    memset(output[l], 0, sizeof(float)*dl(w,l)*dl(h,l));
 
   // create gauss pyramid of padded input, write coarse directly to output
-#if defined(__SSE2__)
-  if(use_sse2)
+  if(use_simd)
   {
     for(int l=1;l<last_level;l++)
-      gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce_sse2(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
+      gauss_reduce_vec4(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
+    gauss_reduce_vec4(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
   }
   else
-#endif
   {
     for(int l=1;l<last_level;l++)
       gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
@@ -615,31 +576,59 @@ void local_laplacian_internal(
   for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
   // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
 
-  // allocate memory for intermediate laplacian pyramids
-  float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<=last_level;l++)
-    buf[k][l] = dt_alloc_align(64, sizeof(float)*dl(w,l)*dl(h,l));
+  // the gaussian pyramids of the curved images are streamed one curve at a time and only
+  // ever need two adjacent levels, so two scratch buffers of level 0 and 1 size hold all
+  // of them: level l lives in buf[l&1].
+  float *buf[2] = { dt_alloc_align(64, sizeof(float)*w*h),
+                    dt_alloc_align(64, sizeof(float)*dl(w,1)*dl(h,1)) };
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
   // willing to pay the cost).
   for(int k=0;k<num_gamma;k++)
   { // process images
-#if defined(__SSE2__)
-    if(use_sse2)
-      apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
+    if(piece && dt_iop_process_cancelled(piece)) goto cancelled;
+    if(use_simd)
+      apply_curve_vec4(buf[0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
     else // brackets in next line needed for silly gcc warning:
-#endif
-    {apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
+    {apply_curve(buf[0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
 
-    // create gaussian pyramids
-    for(int l=1;l<=last_level;l++)
-#if defined(__SSE2__)
-      if(use_sse2)
-        gauss_reduce_sse2(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+    for(int l=0;l<last_level;l++)
+    {
+      const int pw = dl(w,l), ph = dl(h,l);
+      const float *const fine = buf[l&1];
+      float *const coarse = buf[(l+1)&1];
+      // create the next coarser level of the gaussian pyramid
+      if(use_simd)
+        gauss_reduce_vec4(fine, coarse, pw, ph);
       else
+        gauss_reduce(fine, coarse, pw, ph);
+
+      // add the laplacian coefficients of this curve, weighted by how close the
+      // brightness of the input is to its gamma:
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(ph, pw, fine, coarse, k) \
+    shared(output,l,gamma,padded) \
+    schedule(static) \
+    collapse(2)
 #endif
-        gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+      for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
+      {
+        const float v = padded[l][j*pw+i];
+        int hi = 1;
+        for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
+        const int lo = hi-1;
+        if(k != lo && k != hi) continue;
+        const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
+        output[l][j*pw+i] += ll_laplacian(coarse, fine, i, j, pw, ph) * (k == hi ? a : 1.0f-a);
+        // we could do this to save on memory (no need for finest buf[]).
+        // unfortunately it results in a quite noticeable loss of sharpness, i think
+        // the extra level is worth it.
+        // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
+        //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
+      }
+    }
   }
 
   // resample output[last_level] from preview
@@ -703,38 +692,25 @@ void local_laplacian_internal(
   // assemble output pyramid coarse to fine
   for(int l=last_level-1;l >= 0; l--)
   {
+    if(piece && dt_iop_process_cancelled(piece)) goto cancelled;
     const int pw = dl(w,l), ph = dl(h,l);
-
-    gauss_expand(output[l+1], output[l], pw, ph);
-    // go through all coefficients in the upsampled gauss buffer:
+    const float *const coarse = output[l+1];
+    float *const fine = output[l];
+    // add the upsampled coarse level, clamping replicates the boundary like ll_laplacian()
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(ph, pw) \
-    shared(w,h,buf,output,l,gamma,padded) \
+    dt_omp_firstprivate(ph, pw, coarse, fine) \
     schedule(static) \
     collapse(2)
 #endif
     for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
-    {
-      const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
-      const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
-      const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
-      const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
-      output[l][j*pw+i] += l0 * (1.0f-a) + l1 * a;
-      // we could do this to save on memory (no need for finest buf[][]).
-      // unfortunately it results in a quite noticeable loss of sharpness, i think
-      // the extra level is worth it.
-      // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
-      //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
-    }
+      fine[j*pw+i] += ll_expand_gaussian(coarse,
+          CLAMPS(i, 1, ((pw-1)&~1)-1), CLAMPS(j, 1, ((ph-1)&~1)-1), pw, ph);
   }
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(ht, input, max_supp, out, wd) \
-  shared(w,output,buf) \
+  shared(w,output) \
   schedule(static) \
   collapse(2)
 #endif
@@ -759,8 +735,20 @@ void local_laplacian_internal(
   {
     if(!b || b->mode != 1 || l)   dt_free_align(padded[l]);
     if(!b || b->mode != 1)        dt_free_align(output[l]);
-    for(int k=0; k<num_gamma;k++) dt_free_align(buf[k][l]);
   }
+  dt_free_align(buf[0]);
+  dt_free_align(buf[1]);
+  return;
+
+cancelled:
+  // the output is discarded anyways, nothing is passed out for preview rendering either
+  for(int l=0;l<max_levels;l++)
+  {
+    dt_free_align(padded[l]);
+    dt_free_align(output[l]);
+  }
+  dt_free_align(buf[0]);
+  dt_free_align(buf[1]);
 }
 
 
@@ -772,10 +760,13 @@ size_t local_laplacian_memory_use(const int width,     // width of input image
   const int paddwd = width  + 2*max_supp;
   const int paddht = height + 2*max_supp;
 
+  // padded input and output pyramids
   size_t memory_use = 0;
-
   for(int l=0;l<num_levels;l++)
-    memory_use += (size_t)(2 + num_gamma) * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+    memory_use += (size_t)2 * dl(paddwd, l) * dl(paddht, l) * sizeof(float);
+
+  // two levels of the gaussian pyramid of the curve being processed
+  memory_use += ((size_t)dl(paddwd, 0) * dl(paddht, 0) + (size_t)dl(paddwd, 1) * dl(paddht, 1)) * sizeof(float);
 
   return memory_use;
 }
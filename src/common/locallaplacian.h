@@ -54,9 +54,10 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    const int use_sse2,         // switch on sse optimised version, if available
+    const int use_simd,         // switch on the vectorised version, see common/simd.h
     // the following is just needed for clipped roi with boundary conditions from coarse buffer (can be 0)
-    local_laplacian_boundary_t *b);
+    local_laplacian_boundary_t *b,
+    const dt_dev_pixelpipe_iop_t *piece); // polled through dt_iop_process_cancelled() (can be 0)
 
 void local_laplacian(
     const float *const input,   // input buffer in some Labx or yuvx format
@@ -67,9 +68,10 @@ void local_laplacian(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    local_laplacian_boundary_t *b) // can be 0
+    local_laplacian_boundary_t *b, // can be 0
+    const dt_dev_pixelpipe_iop_t *piece) // can be 0
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0, b);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1, b, piece);
 }
 
 size_t local_laplacian_memory_use(const int width,      // width of input image
@@ -80,18 +82,3 @@ size_t local_laplacian_singlebuffer_size(const int width,       // width of inpu
                                          const int height);     // height of input image
 
 
-#if defined(__SSE2__)
-void local_laplacian_sse2(
-    const float *const input,   // input buffer in some Labx or yuvx format
-    float *const out,           // output buffer with colour
-    const int wd,               // width and
-    const int ht,               // height of the input buffer
-    const float sigma,          // user param: separate shadows/midtones/highlights
-    const float shadows,        // user param: lift shadows
-    const float highlights,     // user param: compress highlights
-    const float clarity,        // user param: increase clarity/local contrast
-    local_laplacian_boundary_t *b) // can be 0
-{
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1, b);
-}
-#endif
@@ -0,0 +1,150 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/memory_governor.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+
+struct dt_memory_client_t
+{
+  const char *name;
+  dt_memory_priority_t priority;
+  dt_memory_usage_t usage;
+  dt_memory_evict_t evict;
+  void *data;
+};
+
+static struct
+{
+  dt_pthread_mutex_t lock;
+  GList *clients; // sorted by priority
+  size_t budget;
+  int initialized;
+} _governor = { .initialized = 0 };
+
+void dt_memory_governor_init()
+{
+  if(_governor.initialized) return;
+  const int budget_mb = dt_conf_get_int("memory_budget");
+  // dt_get_total_memory() is in kb
+  _governor.budget = budget_mb > 0 ? (size_t)budget_mb << 20 : (dt_get_total_memory() << 10) / 4 * 3;
+  _governor.clients = NULL;
+  dt_pthread_mutex_init(&_governor.lock, NULL);
+  _governor.initialized = 1;
+  dt_print(DT_DEBUG_MEMORY, "[memory governor] budget %zu MB\n", _governor.budget >> 20);
+}
+
+void dt_memory_governor_cleanup()
+{
+  if(!_governor.initialized) return;
+  for(GList *l = _governor.clients; l; l = g_list_next(l))
+    fprintf(stderr, "[memory governor] client `%s' still registered at shutdown\n",
+            ((dt_memory_client_t *)l->data)->name);
+  g_list_free_full(_governor.clients, free);
+  _governor.clients = NULL;
+  dt_pthread_mutex_destroy(&_governor.lock);
+  _governor.initialized = 0;
+}
+
+static gint _client_cmp(gconstpointer a, gconstpointer b)
+{
+  return ((const dt_memory_client_t *)a)->priority - ((const dt_memory_client_t *)b)->priority;
+}
+
+dt_memory_client_t *dt_memory_governor_register(const char *name, dt_memory_priority_t priority,
+                                                dt_memory_usage_t usage, dt_memory_evict_t evict, void *data)
+{
+  if(!_governor.initialized) return NULL;
+  dt_memory_client_t *client = (dt_memory_client_t *)malloc(sizeof(dt_memory_client_t));
+  if(!client) return NULL;
+  client->name = name;
+  client->priority = priority;
+  client->usage = usage;
+  client->evict = evict;
+  client->data = data;
+  dt_pthread_mutex_lock(&_governor.lock);
+  _governor.clients = g_list_insert_sorted(_governor.clients, client, _client_cmp);
+  dt_pthread_mutex_unlock(&_governor.lock);
+  return client;
+}
+
+void dt_memory_governor_unregister(dt_memory_client_t *client)
+{
+  if(!client || !_governor.initialized) return;
+  dt_pthread_mutex_lock(&_governor.lock);
+  _governor.clients = g_list_remove(_governor.clients, client);
+  dt_pthread_mutex_unlock(&_governor.lock);
+  free(client);
+}
+
+// expects the lock to be held
+static size_t _usage()
+{
+  size_t usage = 0;
+  for(GList *l = _governor.clients; l; l = g_list_next(l))
+  {
+    const dt_memory_client_t *client = (const dt_memory_client_t *)l->data;
+    usage += client->usage(client->data);
+  }
+  return usage;
+}
+
+size_t dt_memory_governor_usage()
+{
+  if(!_governor.initialized) return 0;
+  dt_pthread_mutex_lock(&_governor.lock);
+  const size_t usage = _usage();
+  dt_pthread_mutex_unlock(&_governor.lock);
+  return usage;
+}
+
+gboolean dt_memory_governor_request(size_t bytes)
+{
+  if(!_governor.initialized) return TRUE;
+  if(bytes > _governor.budget) return FALSE;
+
+  dt_pthread_mutex_lock(&_governor.lock);
+  size_t usage = _usage();
+  if(usage + bytes <= _governor.budget)
+  {
+    dt_pthread_mutex_unlock(&_governor.lock);
+    return TRUE;
+  }
+
+  // squeeze the caches, cheapest to recompute first
+  for(GList *l = _governor.clients; l && usage + bytes > _governor.budget; l = g_list_next(l))
+  {
+    const dt_memory_client_t *client = (const dt_memory_client_t *)l->data;
+    if(!client->evict) continue;
+    const size_t freed = client->evict(client->data, usage + bytes - _governor.budget);
+    if(freed)
+      dt_print(DT_DEBUG_MEMORY, "[memory governor] evicted %zu MB from %s\n", freed >> 20, client->name);
+    usage -= MIN(usage, freed);
+  }
+  const gboolean fits = usage + bytes <= _governor.budget;
+  dt_pthread_mutex_unlock(&_governor.lock);
+
+  if(!fits)
+    dt_print(DT_DEBUG_MEMORY, "[memory governor] no headroom for %zu MB, %zu of %zu MB in use\n", bytes >> 20,
+             usage >> 20, _governor.budget >> 20);
+  return fits;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,62 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+/**
+ * one host memory budget for everything that keeps large buffers around. the caches
+ * register how much they hold and how to give some of it back, code that is about to
+ * allocate a lot (tiling) asks for headroom. under pressure the governor evicts from
+ * the caches, cheapest to recompute first, before the caller has to fall back to tiling.
+ */
+
+// evicted first: intermediate pixelpipe results, then shared pipe lines, then mipmaps
+typedef enum dt_memory_priority_t
+{
+  DT_MEMORY_PRIORITY_PIPE_CACHE = 0,
+  DT_MEMORY_PRIORITY_SHARED_CACHE = 1,
+  DT_MEMORY_PRIORITY_MIPMAP = 2
+} dt_memory_priority_t;
+
+// bytes currently held by the client
+typedef size_t (*dt_memory_usage_t)(void *data);
+// try to free at least bytes, return how much was actually freed. must not block on
+// locks that may be held by a thread asking for headroom, use trylock.
+typedef size_t (*dt_memory_evict_t)(void *data, size_t bytes);
+
+typedef struct dt_memory_client_t dt_memory_client_t;
+
+// reads the budget from memory_budget, 0 means three quarters of the system memory
+void dt_memory_governor_init();
+void dt_memory_governor_cleanup();
+
+dt_memory_client_t *dt_memory_governor_register(const char *name, dt_memory_priority_t priority,
+                                                dt_memory_usage_t usage, dt_memory_evict_t evict, void *data);
+void dt_memory_governor_unregister(dt_memory_client_t *client);
+
+// bytes held by all clients right now
+size_t dt_memory_governor_usage();
+// TRUE when bytes more fit into the budget, possibly after evicting from the caches
+gboolean dt_memory_governor_request(size_t bytes);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -478,6 +478,7 @@ typedef enum dt_tag_actions_t
 static void _metadata_execute(const GList *imgs, const GList *metadata, GList **undo,
                               const gboolean undo_on, const gint action)
 {
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
   const GList *images = imgs;
   while(images)
   {
@@ -507,11 +508,13 @@ static void _metadata_execute(const GList *imgs, const GList *metadata, GList **
     _pop_undo_execute(image_id, undometadata->before, undometadata->after);
 
     if(undo_on)
-      *undo = g_list_append(*undo, undometadata);
+      *undo = g_list_prepend(*undo, undometadata);
     else
       _undo_metadata_free(undometadata);
     images = g_list_next(images);
   }
+  dt_database_release_transaction(darktable.db, transaction);
+  if(undo_on) *undo = g_list_reverse(*undo);
 }
 
 void dt_metadata_set(const int imgid, const char *key, const char *value, const gboolean undo_on, const gboolean group_on)
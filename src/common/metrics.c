@@ -0,0 +1,470 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/metrics.h"
+#include "common/darktable.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "develop/pixelpipe_cache.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <gio/gunixsocketaddress.h>
+#endif
+
+// upper bounds of the time histograms in seconds, +Inf is implied
+static const double _buckets[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0 };
+#define DT_METRICS_BUCKETS (sizeof(_buckets) / sizeof(_buckets[0]))
+
+typedef struct _histogram_t
+{
+  uint64_t bucket[DT_METRICS_BUCKETS]; // per bucket, summed up when formatting
+  uint64_t count;
+  double sum;
+} _histogram_t;
+
+static const struct
+{
+  const char *name;
+  const char *help;
+} _counters[DT_METRICS_COUNTER_LAST] = {
+  { "darktable_pixelpipe_cache_queries_total", "Lookups in the caches of the pixelpipes." },
+  { "darktable_pixelpipe_cache_misses_total", "Lookups in the caches of the pixelpipes that found nothing." },
+  { "darktable_opencl_module_fallbacks_total", "Modules that failed on the GPU and were run on the CPU." },
+  { "darktable_opencl_pipe_fallbacks_total", "Pixelpipes that were started over on the CPU after OpenCL errors." },
+  { "darktable_exported_images_total", "Images exported and stored." },
+  { "darktable_export_failures_total", "Images that failed to be exported or stored." },
+};
+
+static const char *_queue_names[DT_JOB_QUEUE_MAX] = { "user_fg", "system_fg", "user_bg", "user_export", "system_bg" };
+
+typedef struct _metrics_t
+{
+  uint64_t counter[DT_METRICS_COUNTER_LAST];
+  GMutex lock;         // protects the histograms
+  GHashTable *modules; // op -> _histogram_t
+  _histogram_t exports;
+
+  GSocketListener *listener;
+  GCancellable *cancel;
+  pthread_t thread;
+  gchar *socket_path; // to remove it again
+} _metrics_t;
+
+// set once before anything is recorded, and only cleared when nothing runs any more
+static _metrics_t *_metrics = NULL;
+
+static void _observe(_histogram_t *h, const double seconds)
+{
+  for(size_t k = 0; k < DT_METRICS_BUCKETS; k++)
+    if(seconds <= _buckets[k])
+    {
+      h->bucket[k]++;
+      break;
+    }
+  h->count++;
+  h->sum += seconds;
+}
+
+void dt_metrics_count(const dt_metrics_counter_t counter, const uint64_t n)
+{
+  _metrics_t *m = _metrics;
+  if(!m) return;
+  __sync_fetch_and_add(&m->counter[counter], n);
+}
+
+void dt_metrics_observe_module(const char *op, const double seconds)
+{
+  _metrics_t *m = _metrics;
+  if(!m) return;
+  g_mutex_lock(&m->lock);
+  _histogram_t *h = (_histogram_t *)g_hash_table_lookup(m->modules, op);
+  if(!h)
+  {
+    h = (_histogram_t *)calloc(1, sizeof(_histogram_t));
+    g_hash_table_insert(m->modules, g_strdup(op), h);
+  }
+  _observe(h, seconds);
+  g_mutex_unlock(&m->lock);
+}
+
+void dt_metrics_observe_export(const double seconds)
+{
+  _metrics_t *m = _metrics;
+  if(!m) return;
+  g_mutex_lock(&m->lock);
+  _observe(&m->exports, seconds);
+  g_mutex_unlock(&m->lock);
+}
+
+// label values only need backslashes, quotes and newlines escaped
+static gchar *_escape(const char *value)
+{
+  GString *s = g_string_new(NULL);
+  for(const char *c = value ? value : ""; *c; c++)
+  {
+    if(*c == '\\' || *c == '"')
+      g_string_append_c(s, '\\');
+    if(*c == '\n')
+      g_string_append(s, "\\n");
+    else
+      g_string_append_c(s, *c);
+  }
+  return g_string_free(s, FALSE);
+}
+
+// the prometheus format wants a dot as decimal separator, whatever the locale
+static const char *_double(char *buf, const double value)
+{
+  return g_ascii_formatd(buf, G_ASCII_DTOSTR_BUF_SIZE, "%.6g", value);
+}
+
+static void _header(GString *s, const char *name, const char *type, const char *help)
+{
+  g_string_append_printf(s, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void _append_histogram(GString *s, const char *name, const char *labels, const _histogram_t *h)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  const char *sep = labels[0] ? "," : "";
+  uint64_t cumulative = 0;
+  for(size_t k = 0; k < DT_METRICS_BUCKETS; k++)
+  {
+    cumulative += h->bucket[k];
+    g_string_append_printf(s, "%s_bucket{%s%sle=\"%s\"} %" PRIu64 "\n", name, labels, sep,
+                           _double(buf, _buckets[k]), cumulative);
+  }
+  g_string_append_printf(s, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, h->count);
+  if(labels[0])
+  {
+    g_string_append_printf(s, "%s_sum{%s} %s\n", name, labels, _double(buf, h->sum));
+    g_string_append_printf(s, "%s_count{%s} %" PRIu64 "\n", name, labels, h->count);
+  }
+  else
+  {
+    g_string_append_printf(s, "%s_sum %s\n", name, _double(buf, h->sum));
+    g_string_append_printf(s, "%s_count %" PRIu64 "\n", name, h->count);
+  }
+}
+
+static void _append_mipmap(GString *s)
+{
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  if(!cache) return;
+
+  dt_mipmap_cache_stats_t stats[DT_MIPMAP_NONE];
+  char level[DT_MIPMAP_NONE][8];
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_NONE; k++)
+  {
+    dt_mipmap_cache_get_stats(cache, k, &stats[k]);
+    if(k == DT_MIPMAP_F)
+      g_strlcpy(level[k], "float", sizeof(level[k]));
+    else if(k == DT_MIPMAP_FULL)
+      g_strlcpy(level[k], "full", sizeof(level[k]));
+    else
+      snprintf(level[k], sizeof(level[k]), "mip%d", (int)k);
+  }
+
+#define MIPMAP_METRIC(NAME, TYPE, HELP, FIELD)                                                                  \
+  _header(s, NAME, TYPE, HELP);                                                                               \
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_NONE; k++)                                             \
+    g_string_append_printf(s, NAME "{level=\"%s\"} %" PRIu64 "\n", level[k], stats[k].FIELD);
+
+  MIPMAP_METRIC("darktable_mipmap_cache_hits_total", "counter", "Mipmap requests served from memory.", hits);
+  MIPMAP_METRIC("darktable_mipmap_cache_misses_total", "counter", "Mipmap requests that found nothing in memory.",
+                misses);
+  MIPMAP_METRIC("darktable_mipmap_cache_disk_hits_total", "counter", "Mipmaps loaded from the disk cache.",
+                disk_hits);
+  MIPMAP_METRIC("darktable_mipmap_cache_evictions_total", "counter", "Mipmaps dropped from memory.", evictions);
+  MIPMAP_METRIC("darktable_mipmap_cache_loads_total", "counter", "Mipmaps loaded from disk or generated.", loads);
+  MIPMAP_METRIC("darktable_mipmap_cache_resident_bytes", "gauge", "Memory held by the mipmap cache.", resident);
+#undef MIPMAP_METRIC
+}
+
+static void _append_shared_cache(GString *s)
+{
+  dt_dev_pixelpipe_shared_cache_t *cache = darktable.pixelpipe_cache;
+  if(!cache) return;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  const uint64_t queries = cache->queries, misses = cache->misses;
+  const uint64_t memory = cache->memory;
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  _header(s, "darktable_pixelpipe_shared_cache_queries_total", "counter",
+          "Lookups in the cache shared by the interactive pipes.");
+  g_string_append_printf(s, "darktable_pixelpipe_shared_cache_queries_total %" PRIu64 "\n", queries);
+  _header(s, "darktable_pixelpipe_shared_cache_misses_total", "counter",
+          "Lookups in the cache shared by the interactive pipes that found nothing.");
+  g_string_append_printf(s, "darktable_pixelpipe_shared_cache_misses_total %" PRIu64 "\n", misses);
+  _header(s, "darktable_pixelpipe_shared_cache_bytes", "gauge", "Memory held by the shared pixelpipe cache.");
+  g_string_append_printf(s, "darktable_pixelpipe_shared_cache_bytes %" PRIu64 "\n", memory);
+}
+
+static void _append_opencl(GString *s)
+{
+#ifdef HAVE_OPENCL
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl || !cl->inited) return;
+
+  // only physical devices, slots share the memory of theirs
+  gchar **labels = (gchar **)calloc(cl->num_devs, sizeof(gchar *));
+  for(int dev = 0; dev < cl->num_devs; dev++)
+  {
+    if(cl->dev[dev].parent != dev) continue;
+    gchar *name = _escape(cl->dev[dev].name);
+    labels[dev] = g_strdup_printf("device=\"%d\",name=\"%s\"", dev, name);
+    g_free(name);
+  }
+
+#define OPENCL_METRIC(NAME, TYPE, HELP, VALUE)                                                                  \
+  _header(s, NAME, TYPE, HELP);                                                                               \
+  for(int dev = 0; dev < cl->num_devs; dev++)                                                                 \
+    if(labels[dev]) g_string_append_printf(s, NAME "{%s} %" PRIu64 "\n", labels[dev], (uint64_t)(VALUE));
+
+  OPENCL_METRIC("darktable_opencl_memory_bytes", "gauge", "Device memory allocated by darktable.",
+                cl->dev[dev].memory_in_use);
+  OPENCL_METRIC("darktable_opencl_memory_peak_bytes", "gauge", "Most device memory allocated at a time.",
+                cl->dev[dev].peak_memory);
+  OPENCL_METRIC("darktable_opencl_memory_limit_bytes", "gauge", "Device memory darktable plans with.",
+                cl->dev[dev].max_global_mem);
+  OPENCL_METRIC("darktable_opencl_to_device_bytes_total", "counter", "Bytes copied from host to device.",
+                cl->dev[dev].bytes_to_device);
+  OPENCL_METRIC("darktable_opencl_from_device_bytes_total", "counter", "Bytes copied from device to host.",
+                cl->dev[dev].bytes_from_device);
+#undef OPENCL_METRIC
+
+  for(int dev = 0; dev < cl->num_devs; dev++) g_free(labels[dev]);
+  free(labels);
+#endif
+}
+
+static void _append_jobs(GString *s)
+{
+  dt_control_t *control = darktable.control;
+  // darktable-cli has no job system, its queue lock isn't even set up
+  if(!control || !dt_control_running()) return;
+
+  size_t length[DT_JOB_QUEUE_MAX];
+  dt_pthread_mutex_lock(&control->queue_mutex);
+  for(int k = 0; k < DT_JOB_QUEUE_MAX; k++) length[k] = control->queue_length[k];
+  const int exports = control->export_scheduled;
+  dt_pthread_mutex_unlock(&control->queue_mutex);
+
+  _header(s, "darktable_job_queue_length", "gauge", "Jobs waiting in a queue of the job system.");
+  for(int k = 0; k < DT_JOB_QUEUE_MAX; k++)
+    g_string_append_printf(s, "darktable_job_queue_length{queue=\"%s\"} %zu\n", _queue_names[k], length[k]);
+  _header(s, "darktable_export_jobs_running", "gauge", "Export jobs being run right now.");
+  g_string_append_printf(s, "darktable_export_jobs_running %d\n", exports);
+}
+
+gchar *dt_metrics_format()
+{
+  _metrics_t *m = _metrics;
+  GString *s = g_string_new(NULL);
+  if(!m) return g_string_free(s, FALSE);
+
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+  _header(s, "darktable_uptime_seconds", "gauge", "Time since darktable started.");
+  g_string_append_printf(s, "darktable_uptime_seconds %s\n", _double(buf, dt_get_wtime() - darktable.start_wtime));
+
+  for(int k = 0; k < DT_METRICS_COUNTER_LAST; k++)
+  {
+    _header(s, _counters[k].name, "counter", _counters[k].help);
+    g_string_append_printf(s, "%s %" PRIu64 "\n", _counters[k].name, __sync_fetch_and_add(&m->counter[k], 0));
+  }
+
+  g_mutex_lock(&m->lock);
+  _header(s, "darktable_module_process_seconds", "histogram",
+          "Time a module took to process and blend its output in a pixelpipe.");
+  GList *ops = g_list_sort(g_hash_table_get_keys(m->modules), (GCompareFunc)g_strcmp0);
+  for(GList *op = ops; op; op = g_list_next(op))
+  {
+    gchar *label = g_strdup_printf("module=\"%s\"", (const char *)op->data);
+    _append_histogram(s, "darktable_module_process_seconds", label,
+                      (const _histogram_t *)g_hash_table_lookup(m->modules, op->data));
+    g_free(label);
+  }
+  g_list_free(ops);
+  _header(s, "darktable_export_image_seconds", "histogram", "Time it took to export and store one image.");
+  _append_histogram(s, "darktable_export_image_seconds", "", &m->exports);
+  g_mutex_unlock(&m->lock);
+
+  _append_mipmap(s);
+  _append_shared_cache(s);
+  _append_opencl(s);
+  _append_jobs(s);
+
+  return g_string_free(s, FALSE);
+}
+
+// answers one scrape. the request line is all we look at, everything but /metrics is a 404.
+static void _reply(GSocketConnection *connection)
+{
+  GSocket *socket = g_socket_connection_get_socket(connection);
+  g_socket_set_timeout(socket, 5);
+
+  char request[1024] = { 0 };
+  size_t length = 0;
+  while(length < sizeof(request) - 1 && !strstr(request, "\r\n\r\n") && !strstr(request, "\n\n"))
+  {
+    const gssize got = g_socket_receive(socket, request + length, sizeof(request) - 1 - length, NULL, NULL);
+    if(got <= 0) break;
+    length += got;
+  }
+
+  const gboolean found = !strncmp(request, "GET /metrics", 12)
+                         && (request[12] == ' ' || request[12] == '?' || request[12] == '\r');
+  gchar *body = found ? dt_metrics_format() : g_strdup("not found\n");
+  const size_t body_length = strlen(body);
+  gchar *head = g_strdup_printf("HTTP/1.0 %s\r\n"
+                                "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                "Content-Length: %zu\r\n"
+                                "Connection: close\r\n\r\n",
+                                found ? "200 OK" : "404 Not Found", body_length);
+
+  GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+  if(g_output_stream_write_all(out, head, strlen(head), NULL, NULL, NULL))
+    g_output_stream_write_all(out, body, body_length, NULL, NULL, NULL);
+  g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+
+  g_free(head);
+  g_free(body);
+}
+
+// darktable-cli has no main loop, so the listener gets a thread of its own and blocks in accept
+static void *_serve(void *data)
+{
+  _metrics_t *m = (_metrics_t *)data;
+  dt_pthread_setname("metrics");
+  while(TRUE)
+  {
+    GError *error = NULL;
+    GSocketConnection *connection = g_socket_listener_accept(m->listener, NULL, m->cancel, &error);
+    if(!connection)
+    {
+      if(!g_cancellable_is_cancelled(m->cancel))
+        fprintf(stderr, "[metrics] stopped serving: %s\n", error ? error->message : "unknown error");
+      g_clear_error(&error);
+      break;
+    }
+    _reply(connection);
+    g_object_unref(connection);
+  }
+  return NULL;
+}
+
+static void _free(_metrics_t *m)
+{
+  g_object_unref(m->listener);
+  g_object_unref(m->cancel);
+  if(m->socket_path) g_unlink(m->socket_path);
+  g_free(m->socket_path);
+  g_hash_table_destroy(m->modules);
+  g_mutex_clear(&m->lock);
+  free(m);
+}
+
+void dt_metrics_init()
+{
+  const int port = dt_conf_get_int("metrics_port");
+  gchar *path = dt_conf_get_string("metrics_socket");
+  if(port <= 0 && !(path && path[0]))
+  {
+    g_free(path);
+    return;
+  }
+
+  _metrics_t *m = (_metrics_t *)calloc(1, sizeof(_metrics_t));
+  g_mutex_init(&m->lock);
+  m->modules = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+  m->listener = g_socket_listener_new();
+  m->cancel = g_cancellable_new();
+
+  int listening = 0;
+  GError *error = NULL;
+  if(port > 0)
+  {
+    // never on the network, scrapers on other machines can go through a tunnel or the socket
+    GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(loopback, CLAMP(port, 1, 65535));
+    if(g_socket_listener_add_address(m->listener, address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL,
+                                     NULL, &error))
+      listening++;
+    else
+      fprintf(stderr, "[metrics] can't listen on 127.0.0.1:%d: %s\n", port, error->message);
+    g_clear_error(&error);
+    g_object_unref(address);
+    g_object_unref(loopback);
+  }
+#ifndef _WIN32
+  if(path && path[0])
+  {
+    // a socket left behind by an instance that crashed would make the bind fail. don't touch anything else.
+    struct stat st;
+    if(!g_lstat(path, &st) && S_ISSOCK(st.st_mode)) g_unlink(path);
+
+    GSocketAddress *address = g_unix_socket_address_new(path);
+    if(g_socket_listener_add_address(m->listener, address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL,
+                                     NULL, &error))
+    {
+      listening++;
+      m->socket_path = g_strdup(path);
+    }
+    else
+      fprintf(stderr, "[metrics] can't listen on %s: %s\n", path, error->message);
+    g_clear_error(&error);
+    g_object_unref(address);
+  }
+#endif
+
+  if(!listening || dt_pthread_create(&m->thread, _serve, m))
+  {
+    _free(m);
+    g_free(path);
+    return;
+  }
+
+  dt_print(DT_DEBUG_CONTROL, "[metrics] serving on port %d%s%s\n", port, m->socket_path ? " and " : "",
+           m->socket_path ? m->socket_path : "");
+  g_free(path);
+  _metrics = m;
+}
+
+void dt_metrics_cleanup()
+{
+  _metrics_t *m = _metrics;
+  if(!m) return;
+  _metrics = NULL;
+
+  g_cancellable_cancel(m->cancel);
+  pthread_join(m->thread, NULL);
+  g_socket_listener_close(m->listener);
+  _free(m);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,56 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/** runtime counters for monitoring long running instances, in particular darktable-cli. they are served
+ * in the prometheus text format on 127.0.0.1:metrics_port and/or the unix socket metrics_socket, as given
+ * in darktablerc. with neither set nothing is recorded. */
+
+typedef enum dt_metrics_counter_t
+{
+  DT_METRICS_PIXELPIPE_CACHE_QUERIES = 0,
+  DT_METRICS_PIXELPIPE_CACHE_MISSES,
+  DT_METRICS_OPENCL_MODULE_FALLBACKS, // a module failed on the gpu and ran on the cpu
+  DT_METRICS_OPENCL_PIPE_FALLBACKS,   // a whole pipe started over on the cpu
+  DT_METRICS_EXPORTED_IMAGES,
+  DT_METRICS_EXPORT_FAILURES,
+  DT_METRICS_COUNTER_LAST
+} dt_metrics_counter_t;
+
+/** start recording and serving if darktablerc asks for it. */
+void dt_metrics_init();
+/** stop serving and free everything. */
+void dt_metrics_cleanup();
+
+/** add n to a counter. */
+void dt_metrics_count(const dt_metrics_counter_t counter, const uint64_t n);
+/** record the time one module took to process in a pipe. */
+void dt_metrics_observe_module(const char *op, const double seconds);
+/** record the time it took to export and store one image. */
+void dt_metrics_observe_export(const double seconds);
+
+/** all metrics in the prometheus text exposition format, g_free() the result. */
+gchar *dt_metrics_format();
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
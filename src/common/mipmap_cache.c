@@ -26,8 +26,12 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/imageio_qoi.h"
+#include "common/memory_governor.h"
+#include "common/thumbnail_pack.h"
 #include "control/conf.h"
 #include "control/jobs.h"
+#include "control/signal.h"
 #include "develop/imageop_math.h"
 
 #include <assert.h>
@@ -56,30 +60,22 @@
 #define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
 #define DT_MIPMAP_CACHE_FILE_VERSION 23
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
+// seconds between two stats lines with -d cache
+#define DT_MIPMAP_CACHE_STATS_INTERVAL 30
 
 typedef enum dt_mipmap_buffer_dsc_flags
 {
   DT_MIPMAP_BUFFER_DSC_FLAG_NONE = 0,
   DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE = 1 << 0,
-  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1
+  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1,
+  // embedded preview standing in for an edited image, never written to disk
+  DT_MIPMAP_BUFFER_DSC_FLAG_PROVISIONAL = 1 << 2,
+  // loaded by a prefetch job and not requested since, for the stats
+  DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED = 1 << 3,
+  // just loaded from the disk cache by the allocate callback, for the stats
+  DT_MIPMAP_BUFFER_DSC_FLAG_FROM_DISK = 1 << 4
 } dt_mipmap_buffer_dsc_flags;
 
-// the embedded Exif data to tag thumbnails as sRGB or AdobeRGB
-static const uint8_t dt_mipmap_cache_exif_data_srgb[] = {
-  0x45, 0x78, 0x69, 0x66, 0x00, 0x00, 0x49, 0x49, 0x2a, 0x00, 0x08, 0x00, 0x00, 0x00, 0x01, 0x00, 0x69,
-  0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x1a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
-  0x01, 0xa0, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-static const uint8_t dt_mipmap_cache_exif_data_adobergb[] = {
-  0x45, 0x78, 0x69, 0x66, 0x00, 0x00, 0x49, 0x49, 0x2a, 0x00, 0x08, 0x00, 0x00, 0x00, 0x01, 0x00, 0x69,
-  0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x1a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
-  0x01, 0xa0, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-static const int dt_mipmap_cache_exif_data_srgb_length
-                      = sizeof(dt_mipmap_cache_exif_data_srgb) / sizeof(*dt_mipmap_cache_exif_data_srgb);
-static const int dt_mipmap_cache_exif_data_adobergb_length
-                      = sizeof(dt_mipmap_cache_exif_data_adobergb) / sizeof(*dt_mipmap_cache_exif_data_adobergb);
-
 struct dt_mipmap_buffer_dsc
 {
   uint32_t width;
@@ -241,7 +237,50 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width,
                     const uint32_t imgid);
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
-                    const dt_mipmap_size_t size);
+                    const dt_mipmap_size_t size, const gboolean allow_provisional, gboolean *provisional);
+
+static dt_mipmap_cache_one_t *_get_cache(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip)
+{
+  switch(mip)
+  {
+    case DT_MIPMAP_FULL:
+      return &cache->mip_full;
+    case DT_MIPMAP_F:
+      return &cache->mip_f;
+    default:
+      return &cache->mip_thumbs;
+  }
+}
+
+// keep track of the bytes held by each level for the memory governor
+static inline void _account(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip, const size_t add,
+                            const size_t sub)
+{
+  dt_mipmap_cache_one_t *c = _get_cache(cache, mip);
+  if(add) __sync_fetch_and_add(&c->memory, add);
+  if(sub) __sync_fetch_and_sub(&c->memory, sub);
+  if(add) __sync_fetch_and_add(&cache->stats[mip].resident, add);
+  if(sub) __sync_fetch_and_sub(&cache->stats[mip].resident, sub);
+}
+
+static inline void _stats_loaded(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip, const double start)
+{
+  __sync_fetch_and_add(&cache->stats[mip].loads, 1);
+  __sync_fetch_and_add(&cache->stats[mip].load_usec, (uint64_t)(1e6 * (dt_get_wtime() - start)));
+}
+
+// a request was served from memory
+static inline void _stats_served(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip,
+                                 struct dt_mipmap_buffer_dsc *dsc)
+{
+  __sync_fetch_and_add(&cache->stats[mip].hits, 1);
+  // the first real request of a prefetched buffer makes that prefetch a useful one.
+  // we might only hold a read lock, so clear the flag atomically
+  if((dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED)
+     && (__sync_fetch_and_and((int *)&dsc->flags, ~DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED)
+         & DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED))
+    __sync_fetch_and_add(&cache->stats[mip].prefetch_used, 1);
+}
 
 // callback for the imageio core to allocate memory.
 // only needed for _F and _FULL buffers, as they change size
@@ -264,6 +303,7 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   if(!buf->buf || ((void *)dsc == (void *)dt_mipmap_cache_static_dead_image) || (entry->data_size < buffer_size))
   {
     if((void *)dsc != (void *)dt_mipmap_cache_static_dead_image) dt_free_align(entry->data);
+    _account(darktable.mipmap_cache, DT_MIPMAP_FULL, 0, entry->data_size);
 
     entry->data_size = 0;
 
@@ -279,6 +319,7 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
     }
 
     entry->data_size = buffer_size;
+    _account(darktable.mipmap_cache, DT_MIPMAP_FULL, buffer_size, 0);
 
     // set buffer size only if we're making it larger.
     dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
@@ -307,6 +348,63 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+// decode a cached blob into a thumbnail buffer. color_space comes from the pack index,
+// DT_COLORSPACE_NONE means it has to be read from the exif data of legacy jpg files.
+static gboolean _decompress_thumbnail(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip,
+                                      struct dt_mipmap_buffer_dsc *dsc, uint8_t *out, const uint8_t *blob,
+                                      const size_t len, const int color_space, const dt_thumbnail_codec_t codec)
+{
+  int width = 0, height = 0;
+  if(codec == DT_THUMBNAIL_CODEC_QOI)
+  {
+    if(dt_imageio_qoi_decompress_header(blob, len, &width, &height)
+       || width > cache->max_width[mip] || height > cache->max_height[mip]
+       || dt_imageio_qoi_decompress(blob, len, out))
+      return FALSE;
+    dsc->color_space = color_space;
+  }
+  else if(codec == DT_THUMBNAIL_CODEC_JPEG)
+  {
+    dt_imageio_jpeg_t jpg;
+    if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
+       || jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
+      return FALSE;
+    dsc->color_space = color_space == DT_COLORSPACE_NONE ? dt_imageio_jpeg_read_color_space(&jpg) : color_space;
+    if(dt_imageio_jpeg_decompress(&jpg, out)) return FALSE;
+    width = jpg.width;
+    height = jpg.height;
+  }
+  else
+    return FALSE; // written by a newer version
+  dsc->width = width;
+  dsc->height = height;
+  dsc->iscale = 1.0f;
+  return TRUE;
+}
+
+// encode a thumbnail buffer with the codec from the preferences. returns the blob length, 0 on failure.
+static size_t _compress_thumbnail(const struct dt_mipmap_buffer_dsc *dsc, const uint8_t *in, uint8_t **blob,
+                                  dt_thumbnail_codec_t *codec)
+{
+  gchar *name = dt_conf_get_string("cache_disk_backend_codec");
+  *codec = name && !strcmp(name, "qoi") ? DT_THUMBNAIL_CODEC_QOI : DT_THUMBNAIL_CODEC_JPEG;
+  g_free(name);
+
+  if(*codec == DT_THUMBNAIL_CODEC_QOI)
+  {
+    *blob = dt_alloc_align(64, dt_imageio_qoi_compress_bound(dsc->width, dsc->height));
+    return *blob ? dt_imageio_qoi_compress(in, *blob, dsc->width, dsc->height) : 0;
+  }
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  const size_t max_len = (size_t)4 * dsc->width * dsc->height;
+  *blob = dt_alloc_align(64, max_len);
+  if(!*blob) return 0;
+  const int len = dt_imageio_jpeg_compress(in, *blob, dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)));
+  // the jpeg helper returns 1 on errors, and a full buffer means the output got cut
+  return len > 1 && len < max_len ? len : 0;
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -343,6 +441,7 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
       fprintf(stderr, "[mipmap cache] memory allocation failed!\n");
       exit(1);
     }
+    _account(cache, mip, entry->data_size, 0);
 
     dsc = entry->data;
 
@@ -367,57 +466,63 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
   assert(dsc->size >= sizeof(*dsc));
 
   int loaded_from_disk = 0;
+  const double start = dt_get_wtime();
   if(mip < DT_MIPMAP_F)
   {
     if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
                               || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
     {
-      // try and load from disk, if successful set flag
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
-               get_imgid(entry->key));
-      FILE *f = g_fopen(filename, "rb");
-      if(f)
+      // try and load from the pack, if successful set flag
+      const uint32_t imgid = get_imgid(entry->key);
+      uint8_t *blob = NULL;
+      size_t len = 0;
+      int color_space = DT_COLORSPACE_NONE;
+      dt_thumbnail_codec_t codec = DT_THUMBNAIL_CODEC_JPEG;
+      if(dt_thumbnail_pack_read(cache->pack[mip], imgid, &blob, &len, &color_space, &codec))
       {
-        uint8_t *blob = 0;
-        fseek(f, 0, SEEK_END);
-        const long len = ftell(f);
-        if(len <= 0) goto read_error; // coverity madness
-        blob = (uint8_t *)dt_alloc_align(64, len);
-        if(!blob) goto read_error;
-        fseek(f, 0, SEEK_SET);
-        const int rd = fread(blob, sizeof(uint8_t), len, f);
-        if(rd != len) goto read_error;
-        dt_colorspaces_color_profile_type_t color_space;
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
-           || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
-           || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
-           || dt_imageio_jpeg_decompress(&jpg, entry->data + sizeof(*dsc)))
+        loaded_from_disk
+            = _decompress_thumbnail(cache, mip, dsc, entry->data + sizeof(*dsc), blob, len, color_space, codec);
+        if(!loaded_from_disk)
         {
-          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %" PRIu32 " from `%s'!\n",
-                  get_imgid(entry->key), filename);
-          goto read_error;
+          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %" PRIu32 " from the pack!\n",
+                  imgid);
+          dt_thumbnail_pack_remove(cache->pack[mip], imgid);
         }
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-        dsc->iscale = 1.0f;
-        dsc->color_space = color_space;
-        loaded_from_disk = 1;
-        if(0)
+        g_free(blob);
+      }
+      else
+      {
+        // a thumbnail written by an older version, move it into the pack
+        char filename[PATH_MAX] = { 0 };
+        snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip, imgid);
+        gchar *contents = NULL;
+        gsize length = 0;
+        if(g_file_get_contents(filename, &contents, &length, NULL))
         {
-read_error:
-          g_unlink(filename);
+          loaded_from_disk = _decompress_thumbnail(cache, mip, dsc, entry->data + sizeof(*dsc),
+                                                   (uint8_t *)contents, length, DT_COLORSPACE_NONE,
+                                                   DT_THUMBNAIL_CODEC_JPEG);
+          if(!loaded_from_disk)
+            fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %" PRIu32 " from `%s'!\n",
+                    imgid, filename);
+          else
+            dt_thumbnail_pack_write(cache->pack[mip], imgid, (uint8_t *)contents, length, dsc->color_space,
+                                    DT_THUMBNAIL_CODEC_JPEG);
+          if(!loaded_from_disk || cache->pack[mip]) g_unlink(filename);
+          g_free(contents);
         }
-        dt_free_align(blob);
-        fclose(f);
       }
     }
   }
 
   if(!loaded_from_disk)
     dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
-  else dsc->flags = 0;
+  else
+  {
+    dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_FROM_DISK;
+    __sync_fetch_and_add(&cache->stats[mip].disk_hits, 1);
+    _stats_loaded(cache, mip, start);
+  }
 
   // cost is just flat one for the buffer, as the buffers might have different sizes,
   // to make sure quota is meaningful.
@@ -441,6 +546,7 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid,
     char filename[PATH_MAX] = { 0 };
     snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
     g_unlink(filename);
+    if(mip < DT_MIPMAP_F) dt_thumbnail_pack_remove(cache->pack[mip], imgid);
   }
 }
 
@@ -448,6 +554,8 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
   dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
   const dt_mipmap_size_t mip = get_size(entry->key);
+  if(!(((struct dt_mipmap_buffer_dsc *)entry->data)->flags & DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE))
+    __sync_fetch_and_add(&cache->stats[mip].evictions, 1);
   if(mip < DT_MIPMAP_F)
   {
     struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
@@ -458,62 +566,39 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       {
         dt_mipmap_cache_unlink_ondisk_thumbnail(data, get_imgid(entry->key), mip);
       }
-      else if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
-                                     || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
+      else if(cache->cachedir[0] && !(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PROVISIONAL)
+              && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
+                  || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
       {
-        // serialize to disk
-        char filename[PATH_MAX] = {0};
-        snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
-        const int mkd = g_mkdir_with_parents(filename, 0750);
-        if(!mkd)
+        // serialize to disk. don't rewrite existing thumbnails as both performance and quality (lossy jpg) suffer
+        const uint32_t imgid = get_imgid(entry->key);
+        if(cache->pack[mip] && !dt_thumbnail_pack_contains(cache->pack[mip], imgid))
         {
-          snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
-                   get_imgid(entry->key));
-          // Don't write existing files as both performance and quality (lossy jpg) suffer
-          FILE *f = NULL;
-          if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
+          // first check the disk isn't full
+          char dirname[PATH_MAX] = { 0 };
+          snprintf(dirname, sizeof(dirname), "%s.d", cache->cachedir);
+          struct statvfs vfsbuf;
+          if(!statvfs(dirname, &vfsbuf))
           {
-            // first check the disk isn't full
-            struct statvfs vfsbuf;
-            if (!statvfs(filename, &vfsbuf))
-            {
-              const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
-              if (free_mb < 100)
-              {
-                fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
-                goto write_error;
-              }
-            }
+            const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+            if(free_mb < 100)
+              fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write to %s\n", free_mb, dirname);
             else
             {
-              fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
-              goto write_error;
-            }
-
-            const int cache_quality = dt_conf_get_int("database_cache_quality");
-            const uint8_t *exif = NULL;
-            int exif_len = 0;
-            if(dsc->color_space == DT_COLORSPACE_SRGB)
-            {
-              exif = dt_mipmap_cache_exif_data_srgb;
-              exif_len = dt_mipmap_cache_exif_data_srgb_length;
-            }
-            else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
-            {
-              exif = dt_mipmap_cache_exif_data_adobergb;
-              exif_len = dt_mipmap_cache_exif_data_adobergb_length;
-            }
-            if(dt_imageio_jpeg_write(filename, entry->data + sizeof(*dsc), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
-            {
-write_error:
-              g_unlink(filename);
+              uint8_t *blob = NULL;
+              dt_thumbnail_codec_t codec;
+              const size_t len = _compress_thumbnail(dsc, entry->data + sizeof(*dsc), &blob, &codec);
+              if(len) dt_thumbnail_pack_write(cache->pack[mip], imgid, blob, len, dsc->color_space, codec);
+              dt_free_align(blob);
             }
           }
-          if(f) fclose(f);
+          else
+            fprintf(stderr, "Aborting image write since couldn't determine free space available to write to %s\n", dirname);
         }
       }
     }
   }
+  _account(cache, mip, 0, entry->data_size);
   dt_free_align(entry->data);
 }
 
@@ -524,6 +609,70 @@ static uint32_t nearest_power_of_two(const uint32_t value)
   return rc;
 }
 
+static size_t _memory_usage(void *data)
+{
+  const dt_mipmap_cache_t *cache = (const dt_mipmap_cache_t *)data;
+  return cache->mip_thumbs.memory + cache->mip_f.memory + cache->mip_full.memory;
+}
+
+// drop unlocked entries of one level, least recently used first, until bytes are freed or nothing moves
+static size_t _memory_evict_level(dt_mipmap_cache_one_t *c, const size_t bytes, const int cost_is_count)
+{
+  const size_t before = c->memory;
+  while(before - MIN(before, c->memory) < bytes)
+  {
+    const size_t cost = dt_cache_get_cost(&c->cache);
+    if(!cost) break;
+    // the float and full levels count entries, the thumbnails bytes. so this gc removes
+    // the lru buffer, or about the requested amount of thumbnails.
+    const size_t step = cost_is_count ? 1 : MIN(cost, MAX(bytes, (size_t)1 << 20));
+    dt_cache_gc(&c->cache, ((float)(cost - step) + 0.5f) / (float)c->cache.cost_quota);
+    if(dt_cache_get_cost(&c->cache) >= cost) break; // all locked
+  }
+  return before - MIN(before, c->memory);
+}
+
+static size_t _memory_evict(void *data, size_t bytes)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  // thumbnails are fast to get back from disk, the full buffers cost a raw decode
+  size_t freed = _memory_evict_level(&cache->mip_thumbs, bytes, FALSE);
+  if(freed < bytes) freed += _memory_evict_level(&cache->mip_f, bytes - freed, TRUE);
+  if(freed < bytes) freed += _memory_evict_level(&cache->mip_full, bytes - freed, TRUE);
+  return freed;
+}
+
+void dt_mipmap_cache_get_stats(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip,
+                               dt_mipmap_cache_stats_t *stats)
+{
+  // the counters are only ever added to atomically, reading them one by one is enough for a snapshot
+  *stats = cache->stats[mip];
+}
+
+static gboolean _stats_log(gpointer user_data)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)user_data;
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_NONE; k++)
+  {
+    dt_mipmap_cache_stats_t s;
+    dt_mipmap_cache_get_stats(cache, k, &s);
+    if(!s.hits && !s.misses && !s.prefetches && !s.resident) continue;
+    char level[8];
+    if(k == DT_MIPMAP_F)
+      g_strlcpy(level, "float", sizeof(level));
+    else if(k == DT_MIPMAP_FULL)
+      g_strlcpy(level, "full", sizeof(level));
+    else
+      snprintf(level, sizeof(level), "mip%d", (int)k);
+    dt_print(DT_DEBUG_CACHE,
+             "[mipmap_cache] %-5s hits %" PRIu64 " misses %" PRIu64 " disk %" PRIu64 " evictions %" PRIu64
+             " resident %.1f MB loads %" PRIu64 " (%.1f ms avg) prefetches %" PRIu64 " used %" PRIu64 "\n",
+             level, s.hits, s.misses, s.disk_hits, s.evictions, s.resident / (1024.0 * 1024.0), s.loads,
+             s.loads ? s.load_usec / (1000.0 * s.loads) : 0.0, s.prefetches, s.prefetch_used);
+  }
+  return TRUE;
+}
+
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_get_filename(cache->cachedir, sizeof(cache->cachedir));
@@ -580,8 +729,13 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_full.stats_misses = 0;
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
+  cache->mip_thumbs.memory = cache->mip_f.memory = cache->mip_full.memory = 0;
+  memset(cache->stats, 0, sizeof(cache->stats));
 
-  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
+  // thumbnails are small compared to the quota, so they can be spread over segments
+  // without starving any of them. the float and full caches hold only a handful
+  // of huge buffers and keep a single segment.
+  dt_cache_init_sharded(&cache->mip_thumbs.cache, 0, max_mem, dt_get_num_threads());
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
 
@@ -602,27 +756,68 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->buffer_size[DT_MIPMAP_F] = sizeof(struct dt_mipmap_buffer_dsc)
                                         + 4 * sizeof(float) * cache->max_width[DT_MIPMAP_F]
                                           * cache->max_height[DT_MIPMAP_F];
+
+  // keep the often used buffers, like those of the image in darkroom and its filmstrip
+  // neighbours, when a scroll through a large collection or an export runs over many others
+  if(dt_conf_get_bool("cache_frequency_aware"))
+  {
+    dt_cache_set_frequency_aware(&cache->mip_thumbs.cache, max_mem / cache->buffer_size[DT_MIPMAP_1]);
+    dt_cache_set_frequency_aware(&cache->mip_full.cache, max_mem_bufs);
+    dt_cache_set_frequency_aware(&cache->mip_f.cache, max_mem_bufs);
+  }
+
+  // one packed store per thumbnail level, the legacy per-image files in <mip>/ get moved in on access
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+  {
+    cache->pack[k] = NULL;
+    if(!cache->cachedir[0]) continue;
+    char basename[PATH_MAX] = { 0 };
+    snprintf(basename, sizeof(basename), "%s.d", cache->cachedir);
+    if(g_mkdir_with_parents(basename, 0750)) continue;
+    snprintf(basename, sizeof(basename), "%s.d/%d", cache->cachedir, k);
+    cache->pack[k] = dt_thumbnail_pack_open(basename);
+  }
+
+  cache->memory_client
+      = dt_memory_governor_register("mipmap cache", DT_MEMORY_PRIORITY_MIPMAP, _memory_usage, _memory_evict, cache);
+
+  cache->stats_timeout = (darktable.unmuted & DT_DEBUG_CACHE)
+                             ? g_timeout_add_seconds(DT_MIPMAP_CACHE_STATS_INTERVAL, _stats_log, cache)
+                             : 0;
 }
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
+  if(cache->stats_timeout) g_source_remove(cache->stats_timeout);
+  cache->stats_timeout = 0;
+  dt_memory_governor_unregister(cache->memory_client);
+  cache->memory_client = NULL;
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  // after the caches, their cleanup writes the evicted thumbnails
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+  {
+    dt_thumbnail_pack_close(cache->pack[k]);
+    cache->pack[k] = NULL;
+  }
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
 {
+  const size_t thumbs_cost = dt_cache_get_cost(&cache->mip_thumbs.cache);
+  const size_t f_cost = dt_cache_get_cost(&cache->mip_f.cache);
+  const size_t full_cost = dt_cache_get_cost(&cache->mip_full.cache);
   printf("[mipmap_cache] thumbs fill %.2f/%.2f MB (%.2f%%)\n",
-         cache->mip_thumbs.cache.cost / (1024.0 * 1024.0),
+         thumbs_cost / (1024.0 * 1024.0),
          cache->mip_thumbs.cache.cost_quota / (1024.0 * 1024.0),
-         100.0f * (float)cache->mip_thumbs.cache.cost / (float)cache->mip_thumbs.cache.cost_quota);
+         100.0f * (float)thumbs_cost / (float)cache->mip_thumbs.cache.cost_quota);
   printf("[mipmap_cache] float fill %"PRIu32"/%"PRIu32" slots (%.2f%%)\n",
-         (uint32_t)cache->mip_f.cache.cost, (uint32_t)cache->mip_f.cache.cost_quota,
-         100.0f * (float)cache->mip_f.cache.cost / (float)cache->mip_f.cache.cost_quota);
+         (uint32_t)f_cost, (uint32_t)cache->mip_f.cache.cost_quota,
+         100.0f * (float)f_cost / (float)cache->mip_f.cache.cost_quota);
   printf("[mipmap_cache] full  fill %"PRIu32"/%"PRIu32" slots (%.2f%%)\n",
-         (uint32_t)cache->mip_full.cache.cost, (uint32_t)cache->mip_full.cache.cost_quota,
-         100.0f * (float)cache->mip_full.cache.cost / (float)cache->mip_full.cache.cost_quota);
+         (uint32_t)full_cost, (uint32_t)cache->mip_full.cache.cost_quota,
+         100.0f * (float)full_cost / (float)cache->mip_full.cache.cost_quota);
 
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
@@ -664,17 +859,69 @@ static gboolean _raise_signal_mipmap_updated(gpointer user_data)
   return FALSE; // only call once
 }
 
-static dt_mipmap_cache_one_t *_get_cache(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip)
+typedef struct _refine_t
 {
-  switch(mip)
+  uint32_t imgid;
+  dt_mipmap_size_t mip;
+} _refine_t;
+
+// replace a provisional thumbnail by the processed one
+static int32_t _refine_job_run(dt_job_t *job)
+{
+  const _refine_t *p = dt_control_job_get_params(job);
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  uint32_t width = cache->max_width[p->mip], height = cache->max_height[p->mip];
+  uint8_t *tmp = dt_alloc_align(64, (size_t)4 * width * height);
+  if(!tmp) return 1;
+  float iscale;
+  dt_colorspaces_color_profile_type_t color_space;
+  gboolean provisional;
+  _init_8(tmp, &width, &height, &iscale, &color_space, p->imgid, p->mip, FALSE, &provisional);
+
+  gboolean replaced = FALSE;
+  // don't wait for readers, they only hold the buffer while drawing
+  for(int tries = 0; width && height && !replaced && tries < 50; tries++)
   {
-    case DT_MIPMAP_FULL:
-      return &cache->mip_full;
-    case DT_MIPMAP_F:
-      return &cache->mip_f;
-    default:
-      return &cache->mip_thumbs;
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(cache, &buf, p->imgid, p->mip, DT_MIPMAP_TESTLOCK, 'w');
+    if(!buf.buf)
+    {
+      g_usleep(20000);
+      continue;
+    }
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)buf.buf - 1;
+    // the entry might have been regenerated meanwhile
+    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PROVISIONAL)
+    {
+      memcpy(buf.buf, tmp, (size_t)4 * width * height);
+      dsc->width = width;
+      dsc->height = height;
+      dsc->iscale = iscale;
+      dsc->color_space = color_space;
+      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_PROVISIONAL;
+    }
+    dt_mipmap_cache_release(cache, &buf);
+    replaced = TRUE;
   }
+  dt_free_align(tmp);
+  if(replaced) dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, p->imgid);
+  return 0;
+}
+
+static dt_job_t *_refine_job_create(const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  dt_job_t *job = dt_control_job_create(&_refine_job_run, "refine thumbnail %u mip %d", imgid, mip);
+  if(!job) return NULL;
+  _refine_t *params = (_refine_t *)calloc(1, sizeof(_refine_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  dt_control_job_set_params_with_size(job, params, sizeof(_refine_t), free);
+  params->imgid = imgid;
+  params->mip = mip;
+  return job;
 }
 
 void dt_mipmap_cache_get_with_caller(
@@ -725,6 +972,9 @@ void dt_mipmap_cache_get_with_caller(
     // and opposite: prefetch without locking
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
+    // these always load the whole file, let it come in while the job waits in the queue. smaller sizes
+    // might be served from the disk cache or an embedded thumbnail.
+    if(mip >= DT_MIPMAP_F) dt_image_readahead(imgid);
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
   else if(flags == DT_MIPMAP_PREFETCH_DISK)
@@ -733,13 +983,11 @@ void dt_mipmap_cache_get_with_caller(
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+    if(!dt_mipmap_cache_thumbnail_on_disk(cache, imgid, mip)) return;
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
-  else if(flags == DT_MIPMAP_BLOCKING)
+  else if(flags == DT_MIPMAP_BLOCKING || flags == DT_MIPMAP_BLOCKING_PREFETCH)
   {
     // simple case: blocking get
     dt_cache_entry_t *entry =  dt_cache_get_with_caller(&_get_cache(cache, mip)->cache, key, mode, file, line);
@@ -750,9 +998,14 @@ void dt_mipmap_cache_get_with_caller(
     buf->cache_entry = entry;
 
     int mipmap_generated = 0;
+    // a new entry the allocate callback just filled from disk counts as a load as well
+    gboolean loaded = (dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_FROM_DISK) != 0;
+    dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_FROM_DISK;
     if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
     {
       mipmap_generated = 1;
+      loaded = TRUE;
+      const double start = dt_get_wtime();
 
       __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_fetches), 1);
       // fprintf(stderr, "[mipmap cache get] now initializing buffer for img %u mip %d!\n", imgid, mip);
@@ -817,11 +1070,30 @@ void dt_mipmap_cache_get_with_caller(
       {
         // 8-bit thumbs
         ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
-        _init_8((uint8_t *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, &buf->color_space, imgid, mip);
+        gboolean provisional = FALSE;
+        _init_8((uint8_t *)(dsc + 1), &dsc->width, &dsc->height, &dsc->iscale, &buf->color_space, imgid, mip,
+                TRUE, &provisional);
+        if(provisional)
+        {
+          dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_PROVISIONAL;
+          dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, _refine_job_create(imgid, mip));
+        }
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+      _stats_loaded(cache, mip, start);
+    }
+
+    // still write locked if loaded, so the flags can be set directly
+    if(loaded && flags == DT_MIPMAP_BLOCKING_PREFETCH)
+    {
+      __sync_fetch_and_add(&cache->stats[mip].prefetches, 1);
+      dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED;
     }
+    else if(loaded)
+      __sync_fetch_and_add(&cache->stats[mip].misses, 1);
+    else if(flags != DT_MIPMAP_BLOCKING_PREFETCH)
+      _stats_served(cache, mip, dsc);
 
     // image cache is leaving the write lock in place in case the image has been newly allocated.
     // this leads to a slight increase in thread contention, so we opt for dropping the write lock
@@ -891,7 +1163,13 @@ void dt_mipmap_cache_get_with_caller(
       dt_mipmap_cache_get(cache, buf, imgid, k, DT_MIPMAP_TESTLOCK, 'r');
       if(buf->buf && buf->width > 0 && buf->height > 0)
       {
-        if(mip != k) __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_standin), 1);
+        if(mip != k)
+        {
+          __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_standin), 1);
+          __sync_fetch_and_add(&cache->stats[mip].misses, 1);
+        }
+        else
+          _stats_served(cache, mip, (struct dt_mipmap_buffer_dsc *)buf->cache_entry->data);
         return;
       }
       // didn't succeed the first time? prefetch for later!
@@ -910,19 +1188,16 @@ void dt_mipmap_cache_get_with_caller(
       if(buf->buf && buf->width > 0 && buf->height > 0)
       {
         __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_standin), 1);
+        __sync_fetch_and_add(&cache->stats[mip].misses, 1);
         return;
       }
     }
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
+    __sync_fetch_and_add(&cache->stats[mip].misses, 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(dt_mipmap_cache_thumbnail_on_disk(cache, imgid, mip))
+      dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = 0;
@@ -1141,11 +1416,59 @@ static int _write_image(dt_imageio_module_data_t *data, const char *filename, co
   return 0;
 }
 
+// downsample the thumbnail of a larger level from the disk cache into buf
+static gboolean _init_8_from_disk(uint8_t *buf, const uint32_t wd, const uint32_t ht, uint32_t *width,
+                                  uint32_t *height, dt_colorspaces_color_profile_type_t *color_space,
+                                  const uint32_t imgid, const dt_mipmap_size_t level)
+{
+  uint8_t *blob = NULL;
+  size_t len = 0;
+  int blob_color_space = DT_COLORSPACE_NONE;
+  dt_thumbnail_codec_t codec = DT_THUMBNAIL_CODEC_JPEG;
+  if(!dt_thumbnail_pack_read(darktable.mipmap_cache->pack[level], imgid, &blob, &len, &blob_color_space, &codec))
+    return FALSE;
+
+  uint8_t *tmp = NULL;
+  int tmp_wd = 0, tmp_ht = 0;
+  gboolean ok = FALSE;
+  if(codec == DT_THUMBNAIL_CODEC_JPEG)
+  {
+    dt_imageio_jpeg_t jpg;
+    if(!dt_imageio_jpeg_decompress_header(blob, len, &jpg))
+    {
+      dt_imageio_jpeg_set_min_size(&jpg, wd, ht);
+      tmp_wd = jpg.width;
+      tmp_ht = jpg.height;
+      tmp = dt_alloc_align(64, (size_t)4 * tmp_wd * tmp_ht);
+      if(tmp)
+        ok = !dt_imageio_jpeg_decompress(&jpg, tmp);
+      else
+        jpeg_destroy_decompress(&jpg.dinfo);
+    }
+  }
+  else if(codec == DT_THUMBNAIL_CODEC_QOI && !dt_imageio_qoi_decompress_header(blob, len, &tmp_wd, &tmp_ht))
+  {
+    tmp = dt_alloc_align(64, (size_t)4 * tmp_wd * tmp_ht);
+    ok = tmp && !dt_imageio_qoi_decompress(blob, len, tmp);
+  }
+  g_free(blob);
+
+  if(ok)
+  {
+    dt_print(DT_DEBUG_CACHE, "[_init_8] generate thumbnail of %u from level %d on disk\n", imgid, level);
+    dt_iop_flip_and_zoom_8(tmp, tmp_wd, tmp_ht, buf, wd, ht, ORIENTATION_NONE, width, height);
+    *color_space = blob_color_space;
+  }
+  dt_free_align(tmp);
+  return ok;
+}
+
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
-                    const dt_mipmap_size_t size)
+                    const dt_mipmap_size_t size, const gboolean allow_provisional, gboolean *provisional)
 {
   *iscale = 1.0f;
+  *provisional = FALSE;
   const uint32_t wd = *width, ht = *height;
   char filename[PATH_MAX] = { 0 };
   gboolean from_cache = TRUE;
@@ -1169,9 +1492,16 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
   const int incompatible = !strncmp(cimg->exif_maker, "Phase One", 9);
   dt_image_cache_read_release(darktable.image_cache, cimg);
 
-  if(!altered && !dt_conf_get_bool("never_use_embedded_thumb") && !incompatible)
+  // an edited image first shows its embedded preview, the processed thumbnail replaces it from a
+  // background job. that keeps browsing responsive while thousands of fresh imports wait for the pixelpipe.
+  const gboolean stand_in = altered && allow_provisional && dt_conf_get_bool("thumbnail_embedded_first");
+
+  if((!altered || stand_in) && !dt_conf_get_bool("never_use_embedded_thumb") && !incompatible)
   {
     const dt_image_orientation_t orientation = dt_image_get_orientation(imgid);
+    // the box the decoded preview has to cover, in the orientation of the stored preview
+    const int min_wd = (orientation & ORIENTATION_SWAP_XY) ? ht : wd;
+    const int min_ht = (orientation & ORIENTATION_SWAP_XY) ? wd : ht;
 
     // try to load the embedded thumbnail in raw
     from_cache = TRUE;
@@ -1186,6 +1516,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
       dt_imageio_jpeg_t jpg;
       if(!dt_imageio_jpeg_read_header(filename, &jpg))
       {
+        dt_imageio_jpeg_set_min_size(&jpg, min_wd, min_ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t) * jpg.width * jpg.height * 4);
         *color_space = dt_imageio_jpeg_read_color_space(&jpg);
         if(!dt_imageio_jpeg_read(&jpg, tmp))
@@ -1201,7 +1532,8 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     {
       uint8_t *tmp = 0;
       int32_t thumb_width, thumb_height;
-      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, color_space);
+      res = dt_imageio_large_thumbnail_scaled(filename, &tmp, &thumb_width, &thumb_height, color_space, min_wd,
+                                              min_ht);
       if(!res)
       {
         // if the thumbnail is not large enough, we compute one
@@ -1221,6 +1553,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
         dt_free_align(tmp);
       }
     }
+    *provisional = !res && altered;
   }
 
   if(res)
@@ -1232,6 +1565,14 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
       dt_mipmap_cache_get(darktable.mipmap_cache, &tmp, imgid, k, DT_MIPMAP_TESTLOCK, 'r');
       if(tmp.buf == NULL)
         continue;
+      const gboolean stand_in_level
+          = ((struct dt_mipmap_buffer_dsc *)tmp.buf - 1)->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PROVISIONAL;
+      if(stand_in_level && !allow_provisional)
+      {
+        dt_mipmap_cache_release(darktable.mipmap_cache, &tmp);
+        continue;
+      }
+      *provisional = stand_in_level;
       dt_print(DT_DEBUG_CACHE, "[_init_8] generate mip %d for %s from level %d\n", size, filename, k);
       *color_space = tmp.color_space;
       // downsample
@@ -1243,6 +1584,13 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     }
   }
 
+  if(res)
+  {
+    // or from a larger level in the disk cache. a jpg one only needs a dct scaled decode.
+    for(dt_mipmap_size_t k = size + 1; res && k < DT_MIPMAP_F; k++)
+      res = !_init_8_from_disk(buf, wd, ht, width, height, color_space, imgid, k);
+  }
+
   if(res)
   {
     // try the real thing: rawspeed + pixelpipe
@@ -1250,6 +1598,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     _dummy_data_t dat;
     format.bpp = _bpp;
     format.write_image = _write_image;
+    format.write_image_begin = NULL;
     format.levels = _levels;
     dat.head.max_width = wd;
     dat.head.max_height = ht;
@@ -1301,7 +1650,17 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
     {
-      // try and load from disk, if successful set flag
+      uint8_t *blob = NULL;
+      size_t len = 0;
+      int color_space = DT_COLORSPACE_NONE;
+      dt_thumbnail_codec_t codec = DT_THUMBNAIL_CODEC_JPEG;
+      if(dt_thumbnail_pack_read(cache->pack[mip], src_imgid, &blob, &len, &color_space, &codec))
+      {
+        dt_thumbnail_pack_write(cache->pack[mip], dst_imgid, blob, len, color_space, codec);
+        g_free(blob);
+        continue;
+      }
+      // the source might still have a thumbnail in the legacy layout
       char srcpath[PATH_MAX] = {0};
       char dstpath[PATH_MAX] = {0};
       snprintf(srcpath, sizeof(srcpath), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, src_imgid);
@@ -1318,6 +1677,27 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   }
 }
 
+gboolean dt_mipmap_cache_thumbnail_on_disk(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                           const dt_mipmap_size_t mip)
+{
+  if(!cache->cachedir[0] || mip >= DT_MIPMAP_F) return FALSE;
+  if(dt_thumbnail_pack_contains(cache->pack[mip], imgid)) return TRUE;
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip, imgid);
+  return g_file_test(filename, G_FILE_TEST_EXISTS);
+}
+
+int64_t dt_mipmap_cache_thumbnail_mtime(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                       const dt_mipmap_size_t mip)
+{
+  if(!cache->cachedir[0] || mip >= DT_MIPMAP_F) return 0;
+  if(dt_thumbnail_pack_contains(cache->pack[mip], imgid)) return dt_thumbnail_pack_mtime(cache->pack[mip], imgid);
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip, imgid);
+  GStatBuf st;
+  return g_stat(filename, &st) ? 0 : st.st_mtime;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -56,7 +56,10 @@ typedef enum dt_mipmap_get_flags_t
   DT_MIPMAP_BLOCKING = 3,
   // don't actually acquire the lock if it is not
   // in cache (i.e. would have to be loaded first)
-  DT_MIPMAP_TESTLOCK = 4
+  DT_MIPMAP_TESTLOCK = 4,
+  // blocking get on behalf of a prefetch job. behaves like
+  // DT_MIPMAP_BLOCKING, but is counted as speculative in the stats.
+  DT_MIPMAP_BLOCKING_PREFETCH = 5
 } dt_mipmap_get_flags_t;
 
 // struct to be alloc'ed by the client, filled by dt_mipmap_cache_get()
@@ -83,8 +86,24 @@ typedef struct dt_mipmap_cache_one_t
   long int stats_misses;     // nothing returned at all.
   long int stats_fetches;    // texture was fetched (either as a stand-in or as per request)
   long int stats_standin;    // texture used as stand-in
+
+  size_t memory; // bytes allocated for the buffers of this level
 } dt_mipmap_cache_one_t;
 
+// live counters of one mip level, see dt_mipmap_cache_get_stats()
+typedef struct dt_mipmap_cache_stats_t
+{
+  uint64_t hits;          // requests served from memory
+  uint64_t misses;        // requests that found nothing in memory
+  uint64_t disk_hits;     // buffers loaded from the disk cache
+  uint64_t evictions;     // buffers dropped from memory (not counting invalidated ones)
+  uint64_t resident;      // bytes held in memory
+  uint64_t loads;         // buffers loaded from disk or generated
+  uint64_t load_usec;     // time spent on these loads, in microseconds
+  uint64_t prefetches;    // buffers loaded by prefetch jobs
+  uint64_t prefetch_used; // of these, the ones requested before they were evicted
+} dt_mipmap_cache_stats_t;
+
 typedef struct dt_mipmap_cache_t
 {
   // real width and height are stored per element
@@ -99,6 +118,12 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  struct dt_memory_client_t *memory_client;
+  // on-disk thumbnails, one packed store per level below DT_MIPMAP_F
+  struct dt_thumbnail_pack_t *pack[DT_MIPMAP_F];
+  // per level, updated atomically
+  dt_mipmap_cache_stats_t stats[DT_MIPMAP_NONE];
+  guint stats_timeout; // periodic -d cache log
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -109,6 +134,9 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img);
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache);
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache);
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache);
+// snapshot of the counters of one level
+void dt_mipmap_cache_get_stats(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip,
+                               dt_mipmap_cache_stats_t *stats);
 
 // get a buffer and lock according to mode ('r' or 'w').
 // see dt_mipmap_get_flags_t for explanation of the exact
@@ -164,6 +192,13 @@ dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace();
 // only copies over the jpg backend on disk, doesn't directly affect the in-memory cache.
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid);
 
+// whether the disk backend holds a thumbnail of this size, in the pack or as a legacy jpg file
+gboolean dt_mipmap_cache_thumbnail_on_disk(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                           const dt_mipmap_size_t mip);
+// when that thumbnail was written, in seconds since the epoch. 0 if there is none or its age is unknown
+int64_t dt_mipmap_cache_thumbnail_mtime(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                       const dt_mipmap_size_t mip);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
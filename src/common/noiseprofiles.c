@@ -25,11 +25,34 @@
 
 const dt_noiseprofile_t dt_noiseprofile_generic = {N_("generic poissonian"), "", "", 0, {0.0001f, 0.0001f, 0.0001}, {0.0f, 0.0f, 0.0f}};
 
+// the profiles of one camera model, sorted by iso, with the profiles interpolated for other isos so far
+typedef struct _noiseprofile_model_t
+{
+  GList *profiles;          // dt_noiseprofile_t, maker and model are not set
+  GHashTable *interpolated; // iso -> dt_noiseprofile_t
+} _noiseprofile_model_t;
+
+typedef struct _noiseprofile_maker_t
+{
+  char *maker;
+  GHashTable *models; // model -> _noiseprofile_model_t
+} _noiseprofile_maker_t;
+
+// the noiseprofile file is parsed on first use into an index by maker and model, see _noiseprofile_load()
+static struct
+{
+  GMutex lock; // protects everything below
+  char *filename;
+  gboolean loaded;
+  GList *makers;       // _noiseprofile_maker_t in file order, earlier ones win
+  GHashTable *cameras; // "maker\nmodel" of an image -> _noiseprofile_model_t or NULL
+} _noiseprofiles = { 0 };
+
 static gboolean dt_noiseprofile_verify(JsonParser *parser);
+static void _noiseprofile_index(JsonParser *parser);
 
-JsonParser *dt_noiseprofile_init(const char *alternative)
+void dt_noiseprofile_init(const char *alternative)
 {
-  GError *error = NULL;
   char filename[PATH_MAX] = { 0 };
 
   if(alternative == NULL)
@@ -42,17 +65,33 @@ JsonParser *dt_noiseprofile_init(const char *alternative)
   else
     g_strlcpy(filename, alternative, sizeof(filename));
 
+  g_mutex_lock(&_noiseprofiles.lock);
+  g_free(_noiseprofiles.filename);
+  _noiseprofiles.filename = g_strdup(filename);
+  g_mutex_unlock(&_noiseprofiles.lock);
+}
+
+// parses and indexes the file on first use. needs _noiseprofiles.lock.
+static void _noiseprofile_load(void)
+{
+  if(_noiseprofiles.loaded) return;
+  _noiseprofiles.loaded = TRUE;
+  _noiseprofiles.cameras = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  const char *filename = _noiseprofiles.filename;
+  if(!filename) return;
+
+  GError *error = NULL;
   dt_print(DT_DEBUG_CONTROL, "[noiseprofile] loading noiseprofiles from `%s'\n", filename);
-  if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return NULL;
+  if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
 
-  // TODO: shall we cache the content? for now this looks fast enough(TM)
   JsonParser *parser = json_parser_new();
   if(!json_parser_load_from_file(parser, filename, &error))
   {
     fprintf(stderr, "[noiseprofile] error: parsing json from `%s' failed\n%s\n", filename, error->message);
     g_error_free(error);
     g_object_unref(parser);
-    return NULL;
+    return;
   }
 
   // run over the file once to verify that it is sane
@@ -61,10 +100,11 @@ JsonParser *dt_noiseprofile_init(const char *alternative)
     dt_control_log(_("noiseprofile file `%s' is not valid"), filename);
     fprintf(stderr, "[noiseprofile] error: `%s' is not a valid noiseprofile file. run with -d control for details\n", filename);
     g_object_unref(parser);
-    return NULL;
+    return;
   }
 
-  return parser;
+  _noiseprofile_index(parser);
+  g_object_unref(parser);
 }
 
 int is_member(gchar** names, char* name)
@@ -223,143 +263,227 @@ end:
 }
 #undef _ERROR
 
-GList *dt_noiseprofile_get_matching(const dt_image_t *cimg)
+static void _noiseprofile_model_free(gpointer data)
 {
-  JsonParser *parser = darktable.noiseprofile_parser;
-  JsonReader *reader = NULL;
-  GList *result = NULL;
-
-  if(!parser) goto end;
-
-  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] looking for maker `%s', model `%s'\n", cimg->camera_maker, cimg->camera_model);
-
-  JsonNode *root = json_parser_get_root(parser);
+  _noiseprofile_model_t *model = (_noiseprofile_model_t *)data;
+  g_list_free_full(model->profiles, dt_noiseprofile_free);
+  g_hash_table_destroy(model->interpolated);
+  free(model);
+}
 
-  reader = json_reader_new(root);
+// reads the verified file into _noiseprofiles.makers. needs _noiseprofiles.lock.
+static void _noiseprofile_index(JsonParser *parser)
+{
+  JsonReader *reader = json_reader_new(json_parser_get_root(parser));
+  size_t n_profiles_total = 0;
 
   json_reader_read_member(reader, "noiseprofiles");
 
   // go through all makers
   const int n_makers = json_reader_count_elements(reader);
-  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d makers\n", n_makers);
   for(int i = 0; i < n_makers; i++)
   {
     json_reader_read_element(reader, i);
 
+    _noiseprofile_maker_t *maker = (_noiseprofile_maker_t *)calloc(1, sizeof(_noiseprofile_maker_t));
     json_reader_read_member(reader, "maker");
+    maker->maker = g_strdup(json_reader_get_string_value(reader));
+    json_reader_end_member(reader);
+    maker->models = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _noiseprofile_model_free);
+    _noiseprofiles.makers = g_list_append(_noiseprofiles.makers, maker);
 
-    if(g_strstr_len(cimg->camera_maker, -1, json_reader_get_string_value(reader)))
+    json_reader_read_member(reader, "models");
+
+    const int n_models = json_reader_count_elements(reader);
+    for(int j = 0; j < n_models; j++)
     {
-      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found `%s' as `%s'\n", cimg->camera_maker, json_reader_get_string_value(reader));
-      // go through all models and check those
+      json_reader_read_element(reader, j);
+
+      json_reader_read_member(reader, "model");
+      const char *model_name = json_reader_get_string_value(reader);
       json_reader_end_member(reader);
 
-      json_reader_read_member(reader, "models");
+      // the first entry of a model wins, like it did when the file was searched
+      if(!model_name || g_hash_table_contains(maker->models, model_name))
+      {
+        json_reader_end_element(reader);
+        continue;
+      }
+
+      _noiseprofile_model_t *model = (_noiseprofile_model_t *)calloc(1, sizeof(_noiseprofile_model_t));
+      model->interpolated = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+      g_hash_table_insert(maker->models, g_strdup(model_name), model);
+
+      json_reader_read_member(reader, "profiles");
 
-      const int n_models = json_reader_count_elements(reader);
-      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d models\n", n_models);
-      for(int j = 0; j < n_models; j++)
+      const int n_profiles = json_reader_count_elements(reader);
+      for(int k = 0; k < n_profiles; k++)
       {
-        json_reader_read_element(reader, j);
+        dt_noiseprofile_t tmp_profile = { 0 };
 
-        json_reader_read_member(reader, "model");
+        json_reader_read_element(reader, k);
 
-        if(!g_strcmp0(cimg->camera_model, json_reader_get_string_value(reader)))
+        gchar** member_names = json_reader_list_members(reader);
+
+        // do we want to skip this entry?
+        if(is_member(member_names, "skip"))
         {
-          dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %s\n", cimg->camera_model);
-          // we got a match, return at most bufsize elements
+          json_reader_read_member(reader, "skip");
+          gboolean skip = json_reader_get_boolean_value(reader);
           json_reader_end_member(reader);
-
-          json_reader_read_member(reader, "profiles");
-
-          const int n_profiles = json_reader_count_elements(reader);
-          dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d profiles\n", n_profiles);
-          for(int k = 0; k < n_profiles; k++)
+          if(skip)
           {
-            dt_noiseprofile_t tmp_profile = { 0 };
-
-            json_reader_read_element(reader, k);
-
-            gchar** member_names = json_reader_list_members(reader);
-
-            // do we want to skip this entry?
-            if(is_member(member_names, "skip"))
-            {
-              json_reader_read_member(reader, "skip");
-              gboolean skip = json_reader_get_boolean_value(reader);
-              json_reader_end_member(reader);
-              if(skip)
-              {
-                json_reader_end_element(reader);
-                g_strfreev(member_names);
-                continue;
-              }
-            }
-
-            // maker
-            tmp_profile.maker = g_strdup(cimg->camera_maker);
-
-            // model
-            tmp_profile.model = g_strdup(cimg->camera_model);
-
-            // name
-            json_reader_read_member(reader, "name");
-            tmp_profile.name = g_strdup(json_reader_get_string_value(reader));
-            json_reader_end_member(reader);
-
-            // iso
-            json_reader_read_member(reader, "iso");
-            tmp_profile.iso = json_reader_get_double_value(reader);
-            json_reader_end_member(reader);
-
-            // a
-            json_reader_read_member(reader, "a");
-            for(int a = 0; a < 3; a++)
-            {
-              json_reader_read_element(reader, a);
-              tmp_profile.a[a] = json_reader_get_double_value(reader);
-              json_reader_end_element(reader);
-            }
-            json_reader_end_member(reader);
-
-            // b
-            json_reader_read_member(reader, "b");
-            for(int b = 0; b < 3; b++)
-            {
-              json_reader_read_element(reader, b);
-              tmp_profile.b[b] = json_reader_get_double_value(reader);
-              json_reader_end_element(reader);
-            }
-            json_reader_end_member(reader);
-
             json_reader_end_element(reader);
+            g_strfreev(member_names);
+            continue;
+          }
+        }
 
-            // everything worked out, add tmp_profile to result
-            dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
-            *new_profile = tmp_profile;
-            result = g_list_append(result, new_profile);
+        // name
+        json_reader_read_member(reader, "name");
+        tmp_profile.name = g_strdup(json_reader_get_string_value(reader));
+        json_reader_end_member(reader);
 
-            g_strfreev(member_names);
-          } // profiles
+        // iso
+        json_reader_read_member(reader, "iso");
+        tmp_profile.iso = json_reader_get_double_value(reader);
+        json_reader_end_member(reader);
 
-          goto end;
+        // a
+        json_reader_read_member(reader, "a");
+        for(int a = 0; a < 3; a++)
+        {
+          json_reader_read_element(reader, a);
+          tmp_profile.a[a] = json_reader_get_double_value(reader);
+          json_reader_end_element(reader);
         }
+        json_reader_end_member(reader);
 
+        // b
+        json_reader_read_member(reader, "b");
+        for(int b = 0; b < 3; b++)
+        {
+          json_reader_read_element(reader, b);
+          tmp_profile.b[b] = json_reader_get_double_value(reader);
+          json_reader_end_element(reader);
+        }
         json_reader_end_member(reader);
+
         json_reader_end_element(reader);
-      } // models
-    }
+
+        dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+        *new_profile = tmp_profile;
+        model->profiles = g_list_prepend(model->profiles, new_profile);
+        n_profiles_total++;
+
+        g_strfreev(member_names);
+      } // profiles
+      model->profiles = g_list_sort(model->profiles, _sort_by_iso);
+
+      json_reader_end_member(reader);
+      json_reader_end_element(reader);
+    } // models
 
     json_reader_end_member(reader);
     json_reader_end_element(reader);
   } // makers
 
   json_reader_end_member(reader);
+  g_object_unref(reader);
 
-end:
-  if(reader) g_object_unref(reader);
-  if(result) result = g_list_sort(result, _sort_by_iso);
-  return result;
+  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] indexed %zu profiles of %d makers\n", n_profiles_total, n_makers);
+}
+
+// the profiles of the image's camera, NULL if there are none. needs _noiseprofiles.lock.
+static _noiseprofile_model_t *_noiseprofile_find(const dt_image_t *cimg)
+{
+  _noiseprofile_load();
+
+  gchar *key = g_strdup_printf("%s\n%s", cimg->camera_maker, cimg->camera_model);
+  gpointer found = NULL;
+  if(g_hash_table_lookup_extended(_noiseprofiles.cameras, key, NULL, &found))
+  {
+    g_free(key);
+    return (_noiseprofile_model_t *)found;
+  }
+
+  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] looking for maker `%s', model `%s'\n", cimg->camera_maker, cimg->camera_model);
+
+  // the names in the file are contained in the exif maker, so the makers can't be hashed
+  _noiseprofile_model_t *model = NULL;
+  for(GList *iter = _noiseprofiles.makers; iter && !model; iter = g_list_next(iter))
+  {
+    const _noiseprofile_maker_t *maker = (_noiseprofile_maker_t *)iter->data;
+    if(!g_strstr_len(cimg->camera_maker, -1, maker->maker)) continue;
+    dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found `%s' as `%s'\n", cimg->camera_maker, maker->maker);
+    model = (_noiseprofile_model_t *)g_hash_table_lookup(maker->models, cimg->camera_model);
+  }
+  if(model)
+    dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %s with %d profiles\n", cimg->camera_model,
+             g_list_length(model->profiles));
+
+  g_hash_table_insert(_noiseprofiles.cameras, key, model);
+  return model;
+}
+
+GList *dt_noiseprofile_get_matching(const dt_image_t *cimg)
+{
+  GList *result = NULL;
+
+  g_mutex_lock(&_noiseprofiles.lock);
+  const _noiseprofile_model_t *model = _noiseprofile_find(cimg);
+  for(const GList *iter = model ? model->profiles : NULL; iter; iter = g_list_next(iter))
+  {
+    const dt_noiseprofile_t *profile = (dt_noiseprofile_t *)iter->data;
+    dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+    *new_profile = *profile;
+    new_profile->name = g_strdup(profile->name);
+    new_profile->maker = g_strdup(cimg->camera_maker);
+    new_profile->model = g_strdup(cimg->camera_model);
+    result = g_list_prepend(result, new_profile);
+  }
+  g_mutex_unlock(&_noiseprofiles.lock);
+
+  return g_list_reverse(result);
+}
+
+dt_noiseprofile_t dt_noiseprofile_get_interpolated(const dt_image_t *cimg)
+{
+  dt_noiseprofile_t interpolated = dt_noiseprofile_generic; // default to generic poissonian
+  const int iso = cimg->exif_iso;
+
+  g_mutex_lock(&_noiseprofiles.lock);
+  _noiseprofile_model_t *model = _noiseprofile_find(cimg);
+  const dt_noiseprofile_t *cached
+      = model ? (dt_noiseprofile_t *)g_hash_table_lookup(model->interpolated, GINT_TO_POINTER(iso)) : NULL;
+  if(cached)
+    interpolated = *cached;
+  else if(model)
+  {
+    const dt_noiseprofile_t *last = NULL;
+    for(const GList *iter = model->profiles; iter; iter = g_list_next(iter))
+    {
+      const dt_noiseprofile_t *current = (dt_noiseprofile_t *)iter->data;
+      if(current->iso == iso)
+      {
+        interpolated = *current;
+        break;
+      }
+      if(last && last->iso < iso && current->iso > iso)
+      {
+        interpolated.iso = iso;
+        dt_noiseprofile_interpolate(last, current, &interpolated);
+        break;
+      }
+      last = current;
+    }
+    dt_noiseprofile_t *entry = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+    *entry = interpolated;
+    g_hash_table_insert(model->interpolated, GINT_TO_POINTER(iso), entry);
+  }
+  g_mutex_unlock(&_noiseprofiles.lock);
+
+  return interpolated;
 }
 
 void dt_noiseprofile_free(gpointer data)
@@ -35,8 +35,8 @@ dt_noiseprofile_t;
 
 extern const dt_noiseprofile_t dt_noiseprofile_generic;
 
-/** read the noiseprofile file once on startup (kind of)*/
-JsonParser *dt_noiseprofile_init(const char *alternative);
+/** set the noiseprofile file, it is read on first use */
+void dt_noiseprofile_init(const char *alternative);
 
 /*
  * returns the noiseprofiles matching the image's exif data.
@@ -44,6 +44,12 @@ JsonParser *dt_noiseprofile_init(const char *alternative);
  */
 GList *dt_noiseprofile_get_matching(const dt_image_t *cimg);
 
+/*
+ * returns the profile for the image's iso: the matching one, one interpolated between its neighbours or the
+ * generic one. remembered per camera and iso. don't use name, maker or model of the result.
+ */
+dt_noiseprofile_t dt_noiseprofile_get_interpolated(const dt_image_t *cimg);
+
 /** convenience function to free a list of noiseprofiles */
 void dt_noiseprofile_free(gpointer data);
 
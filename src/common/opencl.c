@@ -31,6 +31,7 @@
 #include "common/locallaplaciancl.h"
 #include "common/nvidia_gpus.h"
 #include "common/opencl_drivers_blacklist.h"
+#include "common/profiling.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -66,6 +67,11 @@ static dt_opencl_sync_cache_t dt_opencl_get_sync_cache(void);
 static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t profile);
 /** set opencl specific synchronization timeout */
 static void dt_opencl_set_synchronization_timeout(int value);
+/** read and write the timings of the adaptive scheduling profile */
+static void _affinity_load(dt_opencl_t *cl);
+static void _affinity_save(dt_opencl_t *cl);
+/** record the bytes moved by the transfer behind eventp, for the trace */
+static void _events_set_bytes(const int devid, const cl_event *eventp, const size_t bytes);
 
 
 int dt_opencl_get_device_info(dt_opencl_t *cl, cl_device_id device, cl_device_info param_name, void **param_value,
@@ -132,6 +138,106 @@ error:
 // returns 0 if all ok
 // returns 1 if we failed hard, and need to skip opencl initialization
 // returns -1 if we failed to init this device
+// loads all programs of programs.conf for dev, from the binary cache in dev's cachedir where possible
+static int _device_build_programs(dt_opencl_t *cl, const int dev)
+{
+  char dtpath[PATH_MAX] = { 0 };
+  char filename[PATH_MAX] = { 0 };
+  char binname[PATH_MAX] = { 0 };
+  char confentry[PATH_MAX] = { 0 };
+  const char *cachedir = cl->dev[dev].cachedir;
+
+  dt_loc_get_datadir(dtpath, sizeof(dtpath));
+  snprintf(filename, sizeof(filename), "%s" G_DIR_SEPARATOR_S "kernels" G_DIR_SEPARATOR_S "programs.conf", dtpath);
+
+  const char *clincludes[DT_OPENCL_MAX_INCLUDES] = { "color_conversion.cl", "colorspaces.cl", "colorspace.cl", "common.h", NULL };
+  char *includemd5[DT_OPENCL_MAX_INCLUDES] = { NULL };
+  dt_opencl_md5sum(clincludes, includemd5);
+
+  int res = 0;
+  const double tstart = dt_get_wtime();
+  FILE *f = g_fopen(filename, "rb");
+  if(f)
+  {
+    while(!feof(f))
+    {
+      // darktable is shutting down while we're still compiling in the background
+      if(g_atomic_int_get(&cl->build_stop))
+      {
+        res = -1;
+        break;
+      }
+
+      int prog = -1;
+      gchar *confline_pattern = g_strdup_printf("%%%zu[^\n]\n", sizeof(confentry) - 1);
+      int rd = fscanf(f, confline_pattern, confentry);
+      g_free(confline_pattern);
+      if(rd != 1) continue;
+      // remove comments:
+      size_t end = strlen(confentry);
+      for(size_t pos = 0; pos < end; pos++)
+        if(confentry[pos] == '#')
+        {
+          confentry[pos] = '\0';
+          for(int l = pos - 1; l >= 0; l--)
+          {
+            if(confentry[l] == ' ')
+              confentry[l] = '\0';
+            else
+              break;
+          }
+          break;
+        }
+      if(confentry[0] == '\0') continue;
+
+      const char *programname = NULL, *programnumber = NULL;
+      gchar **tokens = g_strsplit_set(confentry, " \t", 2);
+      if(tokens)
+      {
+        programname = tokens[0];
+        if(tokens[0])
+          programnumber = tokens[1]; // if the 0st wasn't NULL then we have at least the terminating NULL in [1]
+      }
+
+      prog = programnumber ? strtol(programnumber, NULL, 10) : -1;
+
+      if(!programname || programname[0] == '\0' || prog < 0)
+      {
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] malformed entry in programs.conf `%s'; ignoring it!\n", confentry);
+        g_strfreev(tokens);
+        continue;
+      }
+
+      snprintf(filename, sizeof(filename), "%s" G_DIR_SEPARATOR_S "kernels" G_DIR_SEPARATOR_S "%s", dtpath, programname);
+      snprintf(binname, sizeof(binname), "%s" G_DIR_SEPARATOR_S "%s.bin", cachedir, programname);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] compiling program `%s' for device %d ..\n", programname, dev);
+      int loaded_cached;
+      char md5sum[33];
+      if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, md5sum, includemd5, &loaded_cached)
+         && dt_opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached) != CL_SUCCESS)
+      {
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] failed to compile program `%s'!\n", programname);
+        g_strfreev(tokens);
+        res = -1;
+        break;
+      }
+
+      g_strfreev(tokens);
+    }
+
+    fclose(f);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] kernel loading time for device %d: %2.4lf \n", dev,
+             dt_get_wtime() - tstart);
+  }
+  else
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not open `%s'!\n", filename);
+    res = -1;
+  }
+  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(includemd5[n]);
+  return res;
+}
+
 static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *devices, const int k,
                                  const int opencl_memory_requirement)
 {
@@ -142,6 +248,7 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   memset(cl->dev[dev].program_used, 0x0, sizeof(int) * DT_OPENCL_MAX_PROGRAMS);
   memset(cl->dev[dev].kernel, 0x0, sizeof(cl_kernel) * DT_OPENCL_MAX_KERNELS);
   memset(cl->dev[dev].kernel_used, 0x0, sizeof(int) * DT_OPENCL_MAX_KERNELS);
+  memset(cl->dev[dev].kernel_name, 0x0, sizeof(char *) * DT_OPENCL_MAX_KERNELS);
   cl->dev[dev].eventlist = NULL;
   cl->dev[dev].eventtags = NULL;
   cl->dev[dev].numevents = 0;
@@ -158,8 +265,22 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   cl->dev[dev].name = NULL;
   cl->dev[dev].cname = NULL;
   cl->dev[dev].options = NULL;
+  cl->dev[dev].cachedir = NULL;
+  cl->dev[dev].programs_ready = 0;
   cl->dev[dev].memory_in_use = 0;
   cl->dev[dev].peak_memory = 0;
+  cl->dev[dev].bytes_to_device = 0;
+  cl->dev[dev].bytes_from_device = 0;
+  cl->dev[dev].event_owner[0] = '\0';
+  cl->dev[dev].event_pipe = NULL;
+  memset(cl->dev[dev].pool, 0, sizeof(cl->dev[dev].pool));
+  cl->dev[dev].pool_memory = 0;
+  cl->dev[dev].pool_peak = 0;
+  cl->dev[dev].pool_clock = 0;
+  cl->dev[dev].pool_hits = 0;
+  cl->dev[dev].pool_misses = 0;
+  cl->dev[dev].parent = dev;
+  cl->dev[dev].slots = 1;
   cl_device_id devid = cl->dev[dev].devid = devices[k];
 
   char *infostr = NULL;
@@ -193,9 +314,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   char *drvversion = calloc(1024, sizeof(char));
 
   char *dtpath = calloc(PATH_MAX, sizeof(char));
-  char *filename = calloc(PATH_MAX, sizeof(char));
-  char *confentry = calloc(PATH_MAX, sizeof(char));
-  char *binname = calloc(PATH_MAX, sizeof(char));
 
   // test GPU availability, vendor, memory, image support etc:
   (cl->dlocl->symbols->dt_clGetDeviceInfo)(devid, CL_DEVICE_AVAILABLE, sizeof(cl_bool), &device_available, NULL);
@@ -351,6 +469,7 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
 
   dt_pthread_mutex_init(&cl->dev[dev].lock, NULL);
+  dt_pthread_mutex_init(&cl->dev[dev].pool_lock, NULL);
 
   cl->dev[dev].context = (cl->dlocl->symbols->dt_clCreateContext)(0, 1, &devid, NULL, NULL, &err);
   if(err != CL_SUCCESS)
@@ -361,7 +480,8 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
   // create a command queue for first device the context reported
   cl->dev[dev].cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(
-      cl->dev[dev].context, devid, (darktable.unmuted & DT_DEBUG_PERF) ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+      cl->dev[dev].context, devid, ((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled()) ? CL_QUEUE_PROFILING_ENABLE : 0,
+      &err);
   if(err != CL_SUCCESS)
   {
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not create command queue for device %d: %d\n", k, err);
@@ -369,7 +489,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
     goto end;
   }
 
-  double tstart, tend, tdiff;
   dt_loc_get_user_cache_dir(dtcache, PATH_MAX * sizeof(char));
 
   int len = MIN(strlen(infostr),1024 * sizeof(char));;
@@ -393,7 +512,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
 
   dt_loc_get_datadir(dtpath, PATH_MAX * sizeof(char));
-  snprintf(filename, PATH_MAX * sizeof(char), "%s" G_DIR_SEPARATOR_S "kernels" G_DIR_SEPARATOR_S "programs.conf", dtpath);
   char kerneldir[PATH_MAX] = { 0 };
   snprintf(kerneldir, sizeof(kerneldir), "%s" G_DIR_SEPARATOR_S "kernels", dtpath);
   char *escapedkerneldir = NULL;
@@ -417,88 +535,19 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   g_free(escapedkerneldir);
   escapedkerneldir = NULL;
 
-  const char *clincludes[DT_OPENCL_MAX_INCLUDES] = { "color_conversion.cl", "colorspaces.cl", "colorspace.cl", "common.h", NULL };
-  char *includemd5[DT_OPENCL_MAX_INCLUDES] = { NULL };
-  dt_opencl_md5sum(clincludes, includemd5);
+  cl->dev[dev].cachedir = strdup(cachedir);
 
-  // now load all darktable cl kernels.
-  // TODO: compile as a job?
-  tstart = dt_get_wtime();
-  FILE *f = g_fopen(filename, "rb");
-  if(f)
+  // now load all darktable cl kernels. in the background, if so configured, see _build_thread().
+  cl->dev[dev].programs_ready = 0;
+  if(!cl->background_build)
   {
-
-    while(!feof(f))
+    if(_device_build_programs(cl, dev))
     {
-      int prog = -1;
-      gchar *confline_pattern = g_strdup_printf("%%%zu[^\n]\n", PATH_MAX * sizeof(char) - 1);
-      int rd = fscanf(f, confline_pattern, confentry);
-      g_free(confline_pattern);
-      if(rd != 1) continue;
-      // remove comments:
-      size_t end = strlen(confentry);
-      for(size_t pos = 0; pos < end; pos++)
-        if(confentry[pos] == '#')
-        {
-          confentry[pos] = '\0';
-          for(int l = pos - 1; l >= 0; l--)
-          {
-            if(confentry[l] == ' ')
-              confentry[l] = '\0';
-            else
-              break;
-          }
-          break;
-        }
-      if(confentry[0] == '\0') continue;
-
-      const char *programname = NULL, *programnumber = NULL;
-      gchar **tokens = g_strsplit_set(confentry, " \t", 2);
-      if(tokens)
-      {
-        programname = tokens[0];
-        if(tokens[0])
-          programnumber = tokens[1]; // if the 0st wasn't NULL then we have at least the terminating NULL in [1]
-      }
-
-      prog = programnumber ? strtol(programnumber, NULL, 10) : -1;
-
-      if(!programname || programname[0] == '\0' || prog < 0)
-      {
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] malformed entry in programs.conf `%s'; ignoring it!\n", confentry);
-        continue;
-      }
-
-      snprintf(filename, PATH_MAX * sizeof(char), "%s" G_DIR_SEPARATOR_S "kernels" G_DIR_SEPARATOR_S "%s", dtpath, programname);
-      snprintf(binname, PATH_MAX * sizeof(char), "%s" G_DIR_SEPARATOR_S "%s.bin", cachedir, programname);
-      dt_print(DT_DEBUG_OPENCL, "[opencl_init] compiling program `%s' ..\n", programname);
-      int loaded_cached;
-      char md5sum[33];
-      if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, md5sum, includemd5, &loaded_cached)
-         && dt_opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached) != CL_SUCCESS)
-      {
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] failed to compile program `%s'!\n", programname);
-        fclose(f);
-        g_strfreev(tokens);
-        res = -1;
-        goto end;
-      }
-
-      g_strfreev(tokens);
+      res = -1;
+      goto end;
     }
-
-    fclose(f);
-    tend = dt_get_wtime();
-    tdiff = tend - tstart;
-    dt_print(DT_DEBUG_OPENCL, "[opencl_init] kernel loading time: %2.4lf \n", tdiff);
-  }
-  else
-  {
-    dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not open `%s'!\n", filename);
-    res = -1;
-    goto end;
+    cl->dev[dev].programs_ready = 1;
   }
-  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(includemd5[n]);
 
   res = 0;
 
@@ -517,17 +566,251 @@ end:
   free(drvversion);
 
   free(dtpath);
-  free(filename);
-  free(confentry);
-  free(binname);
 
   return res;
 }
 
+// adds up to wanted - 1 slots of the physical device dev at index slot onwards, returns how many were added.
+// every slot is locked and handed out like a device of its own with its own command queue, kernels and
+// events, so that several pipes can run on one large gpu at the same time. the global memory is split
+// evenly between the device and its slots: the tiling decisions of every pipe stay within its share, and a
+// pipe needing more than that tiles instead of waiting for the others.
+static int _device_init_slots(dt_opencl_t *cl, const int dev, const int slot, const int wanted)
+{
+  const cl_ulong min_memory = (cl_ulong)MAX(dt_conf_get_int("opencl_device_slot_memory"), 200) * 1024 * 1024;
+  const int slots = MIN(wanted, (int)MIN(cl->dev[dev].max_global_mem / min_memory, DT_OPENCL_MAX_SLOTS));
+  const cl_command_queue_properties props
+      = ((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled()) ? CL_QUEUE_PROFILING_ENABLE : 0;
+
+  int added = 0;
+  for(int s = 1; s < slots; s++)
+  {
+    dt_opencl_device_t *d = &cl->dev[slot + added];
+    *d = cl->dev[dev];
+    // the programs are owned and released by the parent
+    memset(d->program_used, 0x0, sizeof(int) * DT_OPENCL_MAX_PROGRAMS);
+    memset(d->kernel, 0x0, sizeof(cl_kernel) * DT_OPENCL_MAX_KERNELS);
+    memset(d->kernel_used, 0x0, sizeof(int) * DT_OPENCL_MAX_KERNELS);
+    memset(d->kernel_name, 0x0, sizeof(char *) * DT_OPENCL_MAX_KERNELS);
+    d->eventlist = NULL;
+    d->eventtags = NULL;
+    d->numevents = d->eventsconsolidated = d->maxevents = 0;
+    d->lostevents = d->totalevents = d->totalsuccess = d->totallost = 0;
+    d->summary = CL_COMPLETE;
+    d->memory_in_use = d->peak_memory = 0;
+    d->bytes_to_device = d->bytes_from_device = 0;
+    d->event_owner[0] = '\0';
+    d->event_pipe = NULL;
+    // pooled memory lives in the parent, see _pool_put()
+    memset(d->pool, 0, sizeof(d->pool));
+    d->pool_memory = d->pool_peak = 0;
+    d->pool_clock = d->pool_hits = d->pool_misses = 0;
+    d->parent = dev;
+    d->slots = 1;
+
+    cl_int err;
+    d->cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(d->context, d->devid, props, &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not create command queue for slot %d of device %d: %d\n",
+               s, dev, err);
+      break;
+    }
+    // every slot releases the context on cleanup
+    (cl->dlocl->symbols->dt_clRetainContext)(d->context);
+    dt_pthread_mutex_init(&d->lock, NULL);
+    dt_pthread_mutex_init(&d->pool_lock, NULL);
+    d->vendor = strdup(cl->dev[dev].vendor);
+    d->name = strdup(cl->dev[dev].name);
+    d->cname = strdup(cl->dev[dev].cname);
+    d->options = strdup(cl->dev[dev].options);
+    d->cachedir = strdup(cl->dev[dev].cachedir);
+    added++;
+  }
+
+  if(added)
+  {
+    const cl_ulong share = cl->dev[dev].max_global_mem / (added + 1);
+    cl->dev[dev].slots = added + 1;
+    cl->dev[dev].max_global_mem = share;
+    for(int s = 0; s < added; s++) cl->dev[slot + s].max_global_mem = share;
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d `%s' runs %d pipes at once with %" PRIu64 "MB each\n",
+             dev, cl->dev[dev].name, added + 1, share / 1024 / 1024);
+  }
+  return added;
+}
+
+// benchmark cpu and devices again if the device setup changed, and pick a scheduling profile for it
+static void _benchmark_if_changed(dt_opencl_t *cl)
+{
+  char checksum[64];
+  snprintf(checksum, sizeof(checksum), "%u", cl->crc);
+  char *oldchecksum = dt_conf_get_string("opencl_checksum");
+
+  // check if the configuration (OpenCL device setup) has changed, indicated by checksum != oldchecksum
+  if(strcasecmp(oldchecksum, "OFF") != 0 && strcmp(oldchecksum, checksum) != 0)
+  {
+    // store new checksum value in config
+    dt_conf_set_string("opencl_checksum", checksum);
+    // do CPU bencharking
+    float tcpu = dt_opencl_benchmark_cpu(1024, 1024, 5, 100.0f);
+    // get best benchmarking value of all detected OpenCL devices
+    float tgpumin = INFINITY;
+    int devices = 0;
+    for(int n = 0; n < cl->num_devs; n++)
+    {
+      // slots are the same hardware
+      if(cl->dev[n].parent != n) continue;
+      devices++;
+      // pipes may already be using the device when we run in the background
+      dt_pthread_mutex_lock(&cl->dev[n].lock);
+      float tgpu = cl->dev[n].benchmark = dt_opencl_benchmark_gpu(n, 1024, 1024, 5, 100.0f);
+      dt_pthread_mutex_unlock(&cl->dev[n].lock);
+      tgpumin = fmin(tgpu, tgpumin);
+    }
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] benchmarking results: %f seconds for fastest GPU versus %f seconds for CPU.\n",
+         tgpumin, tcpu);
+
+    if(tcpu <= 1.5f * tgpumin)
+    {
+      // de-activate opencl for darktable in case of too slow GPU(s). user can always manually overrule this later.
+      cl->enabled = FALSE;
+      dt_conf_set_bool("opencl", FALSE);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] due to a slow GPU the opencl flag has been set to OFF.\n");
+      dt_control_log(_("due to a slow GPU hardware acceleration via opencl has been de-activated."));
+    }
+    else if(devices >= 2)
+    {
+      // set scheduling profile to "multiple GPUs" if more than one device has been found
+      dt_conf_set_string("opencl_scheduling_profile", "multiple GPUs");
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for multiple GPUs.\n");
+      dt_control_log(_("multiple GPUs detected - opencl scheduling profile has been set accordingly."));
+    }
+    else if(tcpu >= 6.0f * tgpumin)
+    {
+      // set scheduling profile to "very fast GPU" if CPU is way too slow
+      dt_conf_set_string("opencl_scheduling_profile", "very fast GPU");
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for very fast GPU.\n");
+      dt_control_log(_("very fast GPU detected - opencl scheduling profile has been set accordingly."));
+    }
+    else
+    {
+      // set scheduling profile to "default"
+      dt_conf_set_string("opencl_scheduling_profile", "default");
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile to default.\n");
+      dt_control_log(_("opencl scheduling profile set to default."));
+    }
+  }
+  g_free(oldchecksum);
+}
+
+// creates the kernels requested while the programs of dev were being built. cl->lock has to be held.
+static int _device_create_pending_kernels(dt_opencl_t *cl, const int dev)
+{
+  for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
+  {
+    if(!cl->dev[dev].kernel_used[k] || !cl->dev[dev].kernel_name[k]) continue;
+    cl_int err;
+    cl->dev[dev].kernel[k] = (cl->dlocl->symbols->dt_clCreateKernel)(
+        cl->dev[dev].program[cl->dev[dev].kernel_prog[k]], cl->dev[dev].kernel_name[k], &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%d)\n",
+               cl->dev[dev].kernel_name[k], err);
+      cl->dev[dev].kernel[k] = NULL;
+      return -1;
+    }
+    g_free(cl->dev[dev].kernel_name[k]);
+    cl->dev[dev].kernel_name[k] = NULL;
+  }
+  return 0;
+}
+
+// hands the programs of a built physical device to its slots and creates their pending kernels.
+// cl->lock has to be held.
+static void _device_share_programs(dt_opencl_t *cl, const int dev)
+{
+  for(int s = 0; s < cl->num_devs; s++)
+  {
+    if(s == dev || cl->dev[s].parent != dev) continue;
+    memcpy(cl->dev[s].program, cl->dev[dev].program, sizeof(cl_program) * DT_OPENCL_MAX_PROGRAMS);
+    if(!_device_create_pending_kernels(cl, s)) g_atomic_int_set(&cl->dev[s].programs_ready, 1);
+  }
+}
+
+// builds the programs of all devices after startup. until a device is ready, dt_opencl_lock_device()
+// doesn't hand it out and the pipes run on the cpu.
+static void *_build_thread(void *data)
+{
+  dt_opencl_t *cl = (dt_opencl_t *)data;
+
+  // same work-around for locale sensitive compilers as in dt_opencl_init(), but just for this thread
+#ifdef _WIN32
+  _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
+  setlocale(LC_ALL, "C");
+#else
+  locale_t c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+  if(c_locale) uselocale(c_locale);
+#endif
+
+  for(int dev = 0; dev < cl->num_devs && !g_atomic_int_get(&cl->build_stop); dev++)
+  {
+    // slots get the programs of their device
+    if(cl->dev[dev].parent != dev) continue;
+    const double start = dt_get_wtime();
+    if(_device_build_programs(cl, dev))
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] building the programs failed, device %d '%s' stays unused\n", dev,
+               cl->dev[dev].name);
+      continue;
+    }
+    dt_pthread_mutex_lock(&cl->lock);
+    if(!_device_create_pending_kernels(cl, dev))
+    {
+      g_atomic_int_set(&cl->dev[dev].programs_ready, 1);
+      _device_share_programs(cl, dev);
+    }
+    dt_pthread_mutex_unlock(&cl->lock);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d '%s' %s after %.3f secs in the background\n", dev,
+             cl->dev[dev].name, cl->dev[dev].programs_ready ? "ready" : "unusable", dt_get_wtime() - start);
+  }
+
+  if(!g_atomic_int_get(&cl->build_stop))
+  {
+    _benchmark_if_changed(cl);
+    dt_opencl_apply_scheduling_profile(dt_opencl_get_scheduling_profile());
+  }
+
+#ifndef _WIN32
+  if(c_locale)
+  {
+    uselocale(LC_GLOBAL_LOCALE);
+    freelocale(c_locale);
+  }
+#endif
+  return NULL;
+}
+
+int dt_opencl_wait_for_programs(void)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return 0;
+  if(cl->build_thread_running)
+  {
+    pthread_join(cl->build_thread, NULL);
+    cl->build_thread_running = FALSE;
+  }
+  int ready = 0;
+  for(int dev = 0; dev < cl->num_devs; dev++) ready += g_atomic_int_get(&cl->dev[dev].programs_ready) ? 1 : 0;
+  return ready;
+}
+
 void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics)
 {
   char *str;
   dt_pthread_mutex_init(&cl->lock, NULL);
+  dt_pthread_mutex_init(&cl->affinity_lock, NULL);
+  cl->affinity = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
   cl->inited = 0;
   cl->enabled = 0;
   cl->stopped = 0;
@@ -550,6 +833,16 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
   cl->async_pixelpipe = dt_conf_get_bool("opencl_async_pixelpipe");
   cl->sync_cache = dt_opencl_get_sync_cache();
   cl->micro_nap = dt_conf_get_int("opencl_micro_nap");
+  cl->memory_pool_limit = (size_t)MAX(dt_conf_get_int("opencl_memory_pool"), 0) << 20;
+  cl->background_build = dt_conf_get_bool("opencl_background_kernel_build");
+  cl->kernel_cache_dir = dt_conf_get_string("opencl_kernel_cache_dir");
+  if(cl->kernel_cache_dir && !cl->kernel_cache_dir[0])
+  {
+    g_free(cl->kernel_cache_dir);
+    cl->kernel_cache_dir = NULL;
+  }
+  cl->build_stop = 0;
+  cl->build_thread_running = FALSE;
   cl->crc = 5781;
   cl->dlocl = NULL;
   cl->dev_priority_image = NULL;
@@ -602,6 +895,12 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_number_event_handles: %d\n",
            dt_conf_get_int("opencl_number_event_handles"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_micro_nap: %d\n", dt_conf_get_int("opencl_micro_nap"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_memory_pool: %d\n", dt_conf_get_int("opencl_memory_pool"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_device_slots: %d\n", dt_conf_get_int("opencl_device_slots"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_device_slot_memory: %d\n",
+           dt_conf_get_int("opencl_device_slot_memory"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_kernel_cache_dir: '%s'\n",
+           cl->kernel_cache_dir ? cl->kernel_cache_dir : "");
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_use_pinned_memory: %d\n",
            dt_conf_get_bool("opencl_use_pinned_memory"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_use_cpu_devices: %d\n",
@@ -671,7 +970,8 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
   cl_device_id *devices = 0;
   if(num_devices)
   {
-    cl->dev = (dt_opencl_device_t *)malloc(sizeof(dt_opencl_device_t) * num_devices);
+    // room for the slots of every device, see _device_init_slots()
+    cl->dev = (dt_opencl_device_t *)malloc(sizeof(dt_opencl_device_t) * num_devices * DT_OPENCL_MAX_SLOTS);
     devices = (cl_device_id *)malloc(sizeof(cl_device_id) * num_devices);
     if(!cl->dev || !devices)
     {
@@ -715,6 +1015,11 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
     ++dev;
   }
   free(devices);
+  // the slots are appended, so that the device numbers in the priority settings keep their meaning
+  const int wanted_slots = CLAMP(dt_conf_get_int("opencl_device_slots"), 1, DT_OPENCL_MAX_SLOTS);
+  const int physical = dev;
+  for(int k = 0; wanted_slots > 1 && k < physical; k++)
+    dev += _device_init_slots(cl, k, dev, wanted_slots);
   if(dev > 0)
   {
     cl->num_devs = dev;
@@ -761,62 +1066,23 @@ finally:
     cl->colorspaces = dt_colorspaces_init_cl_global();
     cl->guided_filter = dt_guided_filter_init_cl_global();
 
-    char checksum[64];
-    snprintf(checksum, sizeof(checksum), "%u", cl->crc);
-    char *oldchecksum = dt_conf_get_string("opencl_checksum");
-
-    // check if the configuration (OpenCL device setup) has changed, indicated by checksum != oldchecksum
-    if(strcasecmp(oldchecksum, "OFF") != 0 && strcmp(oldchecksum, checksum) != 0)
+    if(cl->background_build)
     {
-      // store new checksum value in config
-      dt_conf_set_string("opencl_checksum", checksum);
-      // do CPU bencharking
-      float tcpu = dt_opencl_benchmark_cpu(1024, 1024, 5, 100.0f);
-      // get best benchmarking value of all detected OpenCL devices
-      float tgpumin = INFINITY;
-      for(int n = 0; n < cl->num_devs; n++)
-      {
-        float tgpu = cl->dev[n].benchmark = dt_opencl_benchmark_gpu(n, 1024, 1024, 5, 100.0f);
-        tgpumin = fmin(tgpu, tgpumin);
-      }
-      dt_print(DT_DEBUG_OPENCL, "[opencl_init] benchmarking results: %f seconds for fastest GPU versus %f seconds for CPU.\n",
-           tgpumin, tcpu);
+      // use the configured profile until the programs are built, benchmarking has to wait for them
+      dt_opencl_apply_scheduling_profile(dt_opencl_get_scheduling_profile());
+      g_atomic_int_set(&cl->build_stop, 0);
+      cl->build_thread_running = !dt_pthread_create(&cl->build_thread, _build_thread, cl);
+      if(!cl->build_thread_running) _build_thread(cl);
+    }
+    else
+    {
+      _benchmark_if_changed(cl);
 
-      if(tcpu <= 1.5f * tgpumin)
-      {
-        // de-activate opencl for darktable in case of too slow GPU(s). user can always manually overrule this later.
-        cl->enabled = FALSE;
-        dt_conf_set_bool("opencl", FALSE);
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] due to a slow GPU the opencl flag has been set to OFF.\n");
-        dt_control_log(_("due to a slow GPU hardware acceleration via opencl has been de-activated."));
-      }
-      else if(cl->num_devs >= 2)
-      {
-        // set scheduling profile to "multiple GPUs" if more than one device has been found
-        dt_conf_set_string("opencl_scheduling_profile", "multiple GPUs");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for multiple GPUs.\n");
-        dt_control_log(_("multiple GPUs detected - opencl scheduling profile has been set accordingly."));
-      }
-      else if(tcpu >= 6.0f * tgpumin)
-      {
-        // set scheduling profile to "very fast GPU" if CPU is way too slow
-        dt_conf_set_string("opencl_scheduling_profile", "very fast GPU");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile for very fast GPU.\n");
-        dt_control_log(_("very fast GPU detected - opencl scheduling profile has been set accordingly."));
-      }
-      else
-      {
-        // set scheduling profile to "default"
-        dt_conf_set_string("opencl_scheduling_profile", "default");
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] set scheduling profile to default.\n");
-        dt_control_log(_("opencl scheduling profile set to default."));
-      }
+      // apply config settings for scheduling profile: sets device priorities and pixelpipe synchronization timeout
+      dt_opencl_apply_scheduling_profile(dt_opencl_get_scheduling_profile());
     }
-    g_free(oldchecksum);
 
-    // apply config settings for scheduling profile: sets device priorities and pixelpipe synchronization timeout
-    dt_opencl_scheduling_profile_t profile = dt_opencl_get_scheduling_profile();
-    dt_opencl_apply_scheduling_profile(profile);
+    _affinity_load(cl);
   }
   else // initialization failed
   {
@@ -824,7 +1090,11 @@ finally:
     {
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+      {
+        if(cl->dev[i].kernel_used[k] && cl->dev[i].kernel[k])
+          (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        g_free(cl->dev[i].kernel_name[k]);
+      }
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
@@ -839,6 +1109,7 @@ finally:
       free((void *)(cl->dev[i].name));
       free((void *)(cl->dev[i].cname));
       free((void *)(cl->dev[i].options));
+      free((void *)(cl->dev[i].cachedir));
     }
   }
 
@@ -853,10 +1124,122 @@ finally:
   return;
 }
 
+// released read/write objects are kept per device up to memory_pool_limit bytes for the next
+// allocation of the same shape, creating them costs milliseconds on some drivers.
+static int _pool_put(const int devid, cl_mem mem)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->memory_pool_limit || devid < 0) return FALSE;
+
+  cl_mem_flags flags = 0;
+  cl_mem_object_type type = 0;
+  if((cl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_FLAGS, sizeof(flags), &flags, NULL) != CL_SUCCESS
+     || (cl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_TYPE, sizeof(type), &type, NULL) != CL_SUCCESS)
+    return FALSE;
+  // objects with host pointers or other access flags are not what dt_opencl_alloc_* hands out
+  if(flags != CL_MEM_READ_WRITE) return FALSE;
+
+  int width = 0, height = 0, bpp = 0;
+  if(type == CL_MEM_OBJECT_IMAGE2D)
+  {
+    width = dt_opencl_get_image_width(mem);
+    height = dt_opencl_get_image_height(mem);
+    bpp = dt_opencl_get_image_element_size(mem);
+  }
+  else if(type != CL_MEM_OBJECT_BUFFER)
+    return FALSE;
+  const size_t size = dt_opencl_get_mem_object_size(mem);
+  if(!size || size > cl->memory_pool_limit) return FALSE;
+
+  // slots share the pool of their device, memory is released to the first device of a context anyway
+  dt_opencl_device_t *dev = &cl->dev[cl->dev[devid].parent];
+  dt_pthread_mutex_lock(&dev->pool_lock);
+  int slot = -1;
+  while(TRUE)
+  {
+    slot = -1;
+    int lru = -1;
+    for(int k = 0; k < DT_OPENCL_POOL_ENTRIES; k++)
+    {
+      if(!dev->pool[k].mem)
+        slot = k;
+      else if(lru < 0 || dev->pool[k].used < dev->pool[lru].used)
+        lru = k;
+    }
+    if((slot >= 0 && dev->pool_memory + size <= cl->memory_pool_limit) || lru < 0) break;
+    // make room, oldest first
+    (cl->dlocl->symbols->dt_clReleaseMemObject)(dev->pool[lru].mem);
+    dev->pool_memory -= dev->pool[lru].size;
+    dev->pool[lru].mem = NULL;
+  }
+  if(slot >= 0)
+  {
+    dev->pool[slot] = (dt_opencl_pool_entry_t){ mem, width, height, bpp, size, ++dev->pool_clock };
+    dev->pool_memory += size;
+    dev->pool_peak = MAX(dev->pool_peak, dev->pool_memory);
+  }
+  dt_pthread_mutex_unlock(&dev->pool_lock);
+  return slot >= 0;
+}
+
+// returns a pooled image (bpp > 0) or buffer (bpp == 0) of the given shape, or NULL
+static cl_mem _pool_take(const int devid, const int width, const int height, const int bpp, const size_t size)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->memory_pool_limit || devid < 0) return NULL;
+
+  dt_opencl_device_t *dev = &cl->dev[cl->dev[devid].parent];
+  cl_mem mem = NULL;
+  dt_pthread_mutex_lock(&dev->pool_lock);
+  for(int k = 0; k < DT_OPENCL_POOL_ENTRIES; k++)
+  {
+    dt_opencl_pool_entry_t *e = &dev->pool[k];
+    if(e->mem && e->bpp == bpp && (bpp ? e->width == width && e->height == height : e->size == size))
+    {
+      mem = e->mem;
+      e->mem = NULL;
+      dev->pool_memory -= e->size;
+      break;
+    }
+  }
+  if(mem)
+    dev->pool_hits++;
+  else
+    dev->pool_misses++;
+  dt_pthread_mutex_unlock(&dev->pool_lock);
+  return mem;
+}
+
+// releases everything pooled for devid, returns the number of objects released
+static int _pool_flush(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->memory_pool_limit || devid < 0) return 0;
+
+  dt_opencl_device_t *dev = &cl->dev[cl->dev[devid].parent];
+  int released = 0;
+  dt_pthread_mutex_lock(&dev->pool_lock);
+  for(int k = 0; k < DT_OPENCL_POOL_ENTRIES; k++)
+  {
+    if(!dev->pool[k].mem) continue;
+    (cl->dlocl->symbols->dt_clReleaseMemObject)(dev->pool[k].mem);
+    dev->pool[k].mem = NULL;
+    released++;
+  }
+  dev->pool_memory = 0;
+  dt_pthread_mutex_unlock(&dev->pool_lock);
+  return released;
+}
+
 void dt_opencl_cleanup(dt_opencl_t *cl)
 {
   if(cl->inited)
   {
+    // don't wait for the rest of a background build, the current program still has to finish
+    g_atomic_int_set(&cl->build_stop, 1);
+    dt_opencl_wait_for_programs();
+
+    _affinity_save(cl);
     dt_develop_blend_free_cl_global(cl->blendop);
     dt_bilateral_free_cl_global(cl->bilateral);
     dt_gaussian_free_cl_global(cl->gaussian);
@@ -868,9 +1251,24 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
 
     for(int i = 0; i < cl->num_devs; i++)
     {
+      if(cl->print_statistics && cl->memory_pool_limit && cl->dev[i].parent == i)
+      {
+        const uint64_t requests = cl->dev[i].pool_hits + cl->dev[i].pool_misses;
+        dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] device '%s' (%d): memory pool served %.1f%% of %"
+                                  PRIu64 " allocations, held at most %.1f MB\n",
+                 cl->dev[i].name, i, requests ? 100.0 * cl->dev[i].pool_hits / requests : 0.0, requests,
+                 (float)cl->dev[i].pool_peak / (1024 * 1024));
+      }
+      // the parents come first, their pools are gone when the slots are cleaned up
+      if(cl->dev[i].parent == i) _pool_flush(i);
+      dt_pthread_mutex_destroy(&cl->dev[i].pool_lock);
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+      {
+        if(cl->dev[i].kernel_used[k] && cl->dev[i].kernel[k])
+          (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        g_free(cl->dev[i].kernel_name[k]);
+      }
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
@@ -909,6 +1307,7 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
       free((void *)(cl->dev[i].name));
       free((void *)(cl->dev[i].cname));
       free((void *)(cl->dev[i].options));
+      free((void *)(cl->dev[i].cachedir));
     }
     free(cl->dev_priority_image);
     free(cl->dev_priority_preview);
@@ -925,6 +1324,9 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
   }
 
   free(cl->dev);
+  g_free(cl->kernel_cache_dir);
+  g_hash_table_destroy(cl->affinity);
+  dt_pthread_mutex_destroy(&cl->affinity_lock);
   dt_pthread_mutex_destroy(&cl->lock);
 }
 
@@ -1135,6 +1537,28 @@ int dt_opencl_enqueue_barrier(const int devid)
   return (cl->dlocl->symbols->dt_clEnqueueBarrier)(cl->dev[devid].cmd_queue);
 }
 
+cl_event dt_opencl_enqueue_marker(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return NULL;
+
+  cl_event event = NULL;
+  if((cl->dlocl->symbols->dt_clEnqueueMarker)(cl->dev[devid].cmd_queue, &event) != CL_SUCCESS) return NULL;
+  // make sure everything up to the marker actually gets submitted
+  (cl->dlocl->symbols->dt_clFlush)(cl->dev[devid].cmd_queue);
+  return event;
+}
+
+int dt_opencl_wait_for_marker(cl_event event)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || event == NULL) return -1;
+
+  const cl_int err = (cl->dlocl->symbols->dt_clWaitForEvents)(1, &event);
+  (cl->dlocl->symbols->dt_clReleaseEvent)(event);
+  return err;
+}
+
 static int _take_from_list(int *list, int value)
 {
   int result = -1;
@@ -1387,46 +1811,69 @@ static void dt_opencl_update_priorities(const char *configstr)
              cl->mandatory[1], cl->mandatory[2], cl->mandatory[3], cl->mandatory[4]);
 }
 
-int dt_opencl_lock_device(const int pipetype)
+// locks the first free slot of the device from a priority list, returns it or -1. slots are not listed on
+// their own, they are tried together with their device.
+static int _trylock_device_slot(dt_opencl_t *cl, const int dev)
 {
-  dt_opencl_t *cl = darktable.opencl;
-  if(!cl->inited) return -1;
-
-
-  dt_pthread_mutex_lock(&cl->lock);
+  if(cl->dev[dev].parent != dev) return -1;
+  for(int s = dev; s < cl->num_devs; s++)
+  {
+    // devices still compiling their programs in the background are skipped
+    if(cl->dev[s].parent == dev && g_atomic_int_get(&cl->dev[s].programs_ready)
+       && !dt_pthread_mutex_BAD_trylock(&cl->dev[s].lock))
+      return s;
+  }
+  return -1;
+}
 
+// returns a copy of the device priority list for a pipe type, NULL for unknown types. needs cl->lock.
+static int *_device_priority(dt_opencl_t *cl, const int pipetype, int *mandatory)
+{
   size_t prio_size = sizeof(int) * (cl->num_devs + 1);
   int *priority = (int *)malloc(prio_size);
-  int mandatory;
 
   switch(pipetype)
   {
     case DT_DEV_PIXELPIPE_FULL:
       memcpy(priority, cl->dev_priority_image, prio_size);
-      mandatory = cl->mandatory[0];
+      *mandatory = cl->mandatory[0];
       break;
     case DT_DEV_PIXELPIPE_PREVIEW:
       memcpy(priority, cl->dev_priority_preview, prio_size);
-      mandatory = cl->mandatory[1];
+      *mandatory = cl->mandatory[1];
       break;
     case DT_DEV_PIXELPIPE_EXPORT:
       memcpy(priority, cl->dev_priority_export, prio_size);
-      mandatory = cl->mandatory[2];
+      *mandatory = cl->mandatory[2];
       break;
     case DT_DEV_PIXELPIPE_THUMBNAIL:
       memcpy(priority, cl->dev_priority_thumbnail, prio_size);
-      mandatory = cl->mandatory[3];
+      *mandatory = cl->mandatory[3];
       break;
     case DT_DEV_PIXELPIPE_PREVIEW2:
       memcpy(priority, cl->dev_priority_preview2, prio_size);
-      mandatory = cl->mandatory[4];
+      *mandatory = cl->mandatory[4];
       break;
     default:
       free(priority);
       priority = NULL;
-      mandatory = 0;
+      *mandatory = 0;
   }
 
+  return priority;
+}
+
+int dt_opencl_lock_device(const int pipetype)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1;
+
+
+  dt_pthread_mutex_lock(&cl->lock);
+
+  int mandatory;
+  int *priority = _device_priority(cl, pipetype, &mandatory);
+
   dt_pthread_mutex_unlock(&cl->lock);
 
   if(priority)
@@ -1441,9 +1888,9 @@ int dt_opencl_lock_device(const int pipetype)
 
       while(*prio != -1)
       {
-        if(!dt_pthread_mutex_BAD_trylock(&cl->dev[*prio].lock))
+        const int devid = _trylock_device_slot(cl, *prio);
+        if(devid >= 0)
         {
-          int devid = *prio;
           free(priority);
           return devid;
         }
@@ -1465,7 +1912,9 @@ int dt_opencl_lock_device(const int pipetype)
     for(int try_dev = 0; try_dev < cl->num_devs; try_dev++)
     {
       // get first currently unused processor
-      if(!dt_pthread_mutex_BAD_trylock(&cl->dev[try_dev].lock)) return try_dev;
+      if(g_atomic_int_get(&cl->dev[try_dev].programs_ready)
+         && !dt_pthread_mutex_BAD_trylock(&cl->dev[try_dev].lock))
+        return try_dev;
     }
   }
 
@@ -1476,6 +1925,24 @@ int dt_opencl_lock_device(const int pipetype)
   return -1;
 }
 
+int dt_opencl_trylock_device(const int pipetype)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1;
+
+  dt_pthread_mutex_lock(&cl->lock);
+  int mandatory;
+  int *priority = _device_priority(cl, pipetype, &mandatory);
+  dt_pthread_mutex_unlock(&cl->lock);
+
+  int devid = -1;
+  for(const int *prio = priority; prio && *prio != -1 && devid < 0; prio++)
+    devid = _trylock_device_slot(cl, *prio);
+
+  free(priority);
+  return devid;
+}
+
 void dt_opencl_unlock_device(const int dev)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -1557,6 +2024,80 @@ void dt_opencl_md5sum(const char **files, char **md5sums)
 }
 
 
+#ifndef CL_DEVICE_IL_VERSION
+#define CL_DEVICE_IL_VERSION 0x105B
+#endif
+
+// looks for prog in the read-only system wide kernel cache (opencl_kernel_cache_dir), which deployment
+// tooling can fill by copying the cached_kernels_for_* directories of a machine with the same devices and
+// drivers. device binaries are found by md5sum like in the per-user cache, and the md5sum covers source,
+// includes, compiler options, platform and driver version. failing that, a SPIR-V module
+// spirv/<program>.<ilmd5>.spv is handed to devices accepting intermediate language. *binary tells whether
+// the program came as device binary, which then needs no copy in the per-user cache.
+static gboolean _load_system_cached(const int dev, const int prog, const char *filename, const char *cachedir,
+                                    const char *md5sum, const char *ilmd5, int *binary)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  *binary = 0;
+  if(!cl->kernel_cache_dir) return FALSE;
+
+  cl_int err = CL_SUCCESS;
+  gchar *content = NULL;
+  gsize size = 0;
+  gchar *devdir = g_path_get_basename(cachedir);
+#if defined(_WIN32)
+  gchar *binname = g_strdup_printf("%s.bin.%s", filename, md5sum);
+  gchar *binfile = g_path_get_basename(binname);
+  gchar *path = g_build_filename(cl->kernel_cache_dir, devdir, binfile, NULL);
+  g_free(binfile);
+  g_free(binname);
+#else
+  gchar *path = g_build_filename(cl->kernel_cache_dir, devdir, md5sum, NULL);
+#endif
+  g_free(devdir);
+
+  if(g_file_get_contents(path, &content, &size, NULL))
+  {
+    size_t binsize = size;
+    cl->dev[dev].program[prog] = (cl->dlocl->symbols->dt_clCreateProgramWithBinary)(
+        cl->dev[dev].context, 1, &(cl->dev[dev].devid), &binsize, (const unsigned char **)&content, NULL, &err);
+    if(err == CL_SUCCESS)
+      *binary = 1;
+    else
+      dt_print(DT_DEBUG_OPENCL, "[opencl_load_program] could not load system cached binary '%s'! (%d)\n", path,
+               err);
+    g_free(content);
+  }
+  g_free(path);
+  if(*binary) return TRUE;
+
+  char ilversion[256] = { 0 };
+  if(!cl->dlocl->symbols->dt_clCreateProgramWithIL
+     || (cl->dlocl->symbols->dt_clGetDeviceInfo)(cl->dev[dev].devid, CL_DEVICE_IL_VERSION, sizeof(ilversion) - 1,
+                                                 ilversion, NULL) != CL_SUCCESS
+     || !strstr(ilversion, "SPIR-V"))
+    return FALSE;
+
+  gchar *programname = g_path_get_basename(filename);
+  gchar *ilname = g_strdup_printf("%s.%s.spv", programname, ilmd5);
+  path = g_build_filename(cl->kernel_cache_dir, "spirv", ilname, NULL);
+  g_free(ilname);
+  g_free(programname);
+
+  gboolean res = FALSE;
+  if(g_file_get_contents(path, &content, &size, NULL))
+  {
+    cl->dev[dev].program[prog]
+        = (cl->dlocl->symbols->dt_clCreateProgramWithIL)(cl->dev[dev].context, content, size, &err);
+    res = (err == CL_SUCCESS);
+    if(!res)
+      dt_print(DT_DEBUG_OPENCL, "[opencl_load_program] could not load SPIR-V module '%s'! (%d)\n", path, err);
+    g_free(content);
+  }
+  g_free(path);
+  return res;
+}
+
 int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *binname,
                            const char *cachedir, char *md5sum, char **includemd5, int *loaded_cached)
 {
@@ -1624,6 +2165,16 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
   g_strlcpy(md5sum, source_md5, 33);
   g_free(source_md5);
 
+  // SPIR-V is portable between drivers, so its key leaves out the driver and platform versions
+  GChecksum *ilchecksum = g_checksum_new(G_CHECKSUM_MD5);
+  g_checksum_update(ilchecksum, (guchar *)file, filesize);
+  g_checksum_update(ilchecksum, (guchar *)cl->dev[dev].options, -1);
+  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++)
+    if(includemd5[n]) g_checksum_update(ilchecksum, (guchar *)includemd5[n], -1);
+  char ilmd5[33];
+  g_strlcpy(ilmd5, g_checksum_get_string(ilchecksum), sizeof(ilmd5));
+  g_checksum_free(ilchecksum);
+
   file[filesize] = '\0';
 
   char linkedfile[PATH_MAX] = { 0 };
@@ -1702,6 +2253,18 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
     g_unlink(dup);
 #endif //!defined(_WIN32)
 
+    int system_binary = 0;
+    if(_load_system_cached(dev, prog, filename, cachedir, md5sum, ilmd5, &system_binary))
+    {
+      free(file);
+      cl->dev[dev].program_used[prog] = 1;
+      // a program built from SPIR-V still gets its device binary saved to the per-user cache
+      *loaded_cached = system_binary;
+      dt_print(DT_DEBUG_OPENCL, "[opencl_load_program] loaded program `%s' from system kernel cache %s\n",
+               filename, system_binary ? "binary" : "SPIR-V module");
+      return 1;
+    }
+
     dt_print(DT_DEBUG_OPENCL,
              "[opencl_load_program] could not load cached binary program, trying to compile source\n");
 
@@ -1830,23 +2393,21 @@ int dt_opencl_build_program(const int dev, const int prog, const char *binname,
           if(bytes_written != binary_sizes[i]) goto ret;
           fclose(f);
 
-          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328)
-          char cwd[PATH_MAX] = { 0 };
-          if(!getcwd(cwd, sizeof(cwd))) goto ret;
-          if(chdir(cachedir) != 0) goto ret;
-          char dup[PATH_MAX] = { 0 };
-          g_strlcpy(dup, binname, sizeof(dup));
-          char *bname = basename(dup);
+          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328). the target is relative
+          // to the link's directory, so no need to chdir() there, which would hurt with programs
+          // being built in the background.
 #if defined(_WIN32)
           //CreateSymbolicLink in Windows requires admin privileges, which we don't want/need
           //store has using a simple filerename
+          char dup[PATH_MAX] = { 0 };
+          g_strlcpy(dup, binname, sizeof(dup));
+          char *bname = basename(dup);
           char finalfilename[PATH_MAX] = { 0 };
           snprintf(finalfilename, sizeof(finalfilename), "%s" G_DIR_SEPARATOR_S "%s.%s", cachedir, bname, md5sum);
           rename(link_dest, finalfilename);
 #else
-          if(symlink(md5sum, bname) != 0) goto ret;
+          if(symlink(md5sum, binname) != 0) goto ret;
 #endif //!defined(_WIN32)
-          if(chdir(cwd) != 0) goto ret;
         }
 
     ret:
@@ -1873,6 +2434,14 @@ int dt_opencl_create_kernel(const int prog, const char *name)
       if(!cl->dev[dev].kernel_used[k])
       {
         cl->dev[dev].kernel_used[k] = 1;
+        if(!g_atomic_int_get(&cl->dev[dev].programs_ready))
+        {
+          // still compiling, _device_create_pending_kernels() takes care of it
+          cl->dev[dev].kernel[k] = NULL;
+          cl->dev[dev].kernel_name[k] = g_strdup(name);
+          cl->dev[dev].kernel_prog[k] = prog;
+          break;
+        }
         cl->dev[dev].kernel[k]
             = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], name, &err);
         if(err != CL_SUCCESS)
@@ -1911,7 +2480,10 @@ void dt_opencl_free_kernel(const int kernel)
   for(int dev = 0; dev < cl->num_devs; dev++)
   {
     cl->dev[dev].kernel_used[kernel] = 0;
-    (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    if(cl->dev[dev].kernel[kernel]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    cl->dev[dev].kernel[kernel] = NULL;
+    g_free(cl->dev[dev].kernel_name[kernel]);
+    cl->dev[dev].kernel_name[kernel] = NULL;
   }
   dt_pthread_mutex_unlock(&cl->lock);
 }
@@ -1982,7 +2554,7 @@ int dt_opencl_enqueue_kernel_2d_with_local(const int dev, const int kernel, cons
   int err;
   char buf[256];
   buf[0] = '\0';
-  if(darktable.unmuted & DT_DEBUG_OPENCL)
+  if((darktable.unmuted & DT_DEBUG_OPENCL) || dt_trace_enabled())
     (cl->dlocl->symbols->dt_clGetKernelInfo)(cl->dev[dev].kernel[kernel], CL_KERNEL_FUNCTION_NAME, 256, buf,
                                             NULL);
   cl_event *eventp = dt_opencl_events_get_slot(dev, buf);
@@ -2039,6 +2611,8 @@ int dt_opencl_read_host_from_device_raw(const int devid, void *host, void *devic
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Image (from device to host)]");
+  darktable.opencl->dev[devid].bytes_from_device += (size_t)rowpitch * region[1];
+  _events_set_bytes(devid, eventp, (size_t)rowpitch * region[1]);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueReadImage)(darktable.opencl->dev[devid].cmd_queue,
                                                                    device, blocking, origin, region, rowpitch,
@@ -2084,6 +2658,8 @@ int dt_opencl_write_host_to_device_raw(const int devid, void *host, void *device
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Image (from host to device)]");
+  darktable.opencl->dev[devid].bytes_to_device += (size_t)rowpitch * region[1];
+  _events_set_bytes(devid, eventp, (size_t)rowpitch * region[1]);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteImage)(darktable.opencl->dev[devid].cmd_queue,
                                                                     device, blocking, origin, region,
@@ -2148,6 +2724,8 @@ int dt_opencl_read_buffer_from_device(const int devid, void *host, void *device,
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Buffer (from device to host)]");
+  darktable.opencl->dev[devid].bytes_from_device += size;
+  _events_set_bytes(devid, eventp, size);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueReadBuffer)(
       darktable.opencl->dev[devid].cmd_queue, device, blocking, offset, size, host, 0, NULL, eventp);
@@ -2159,6 +2737,8 @@ int dt_opencl_write_buffer_to_device(const int devid, void *host, void *device,
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Buffer (from host to device)]");
+  darktable.opencl->dev[devid].bytes_to_device += size;
+  _events_set_bytes(devid, eventp, size);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteBuffer)(
       darktable.opencl->dev[devid].cmd_queue, device, blocking, offset, size, host, 0, NULL, eventp);
@@ -2224,7 +2804,10 @@ void dt_opencl_release_mem_object(cl_mem mem)
   // case in a centralized way at this place
   if(mem == NULL) return;
 
-  dt_opencl_memory_statistics(-1, mem, OPENCL_MEMORY_SUB);
+  const int devid = darktable.opencl->memory_pool_limit ? dt_opencl_get_mem_context_id(mem) : -1;
+  dt_opencl_memory_statistics(devid, mem, OPENCL_MEMORY_SUB);
+
+  if(_pool_put(devid, mem)) return;
 
   (darktable.opencl->dlocl->symbols->dt_clReleaseMemObject)(mem);
 }
@@ -2269,8 +2852,21 @@ void *dt_opencl_alloc_device(const int devid, const int width, const int height,
   else
     return NULL;
 
-  cl_mem dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
+  cl_mem dev = _pool_take(devid, width, height, bpp, (size_t)width * height * bpp);
+  if(dev)
+  {
+    dt_opencl_memory_statistics(devid, dev, OPENCL_MEMORY_ADD);
+    return dev;
+  }
+
+  dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
       darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  if(err != CL_SUCCESS && _pool_flush(devid))
+  {
+    // the pool may be what keeps the device full
+    dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
+        darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  }
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device] could not alloc img buffer on device %d: %d\n", devid,
              err);
@@ -2314,18 +2910,7 @@ void *dt_opencl_alloc_device_use_host_pointer(const int devid, const int width,
 
 void *dt_opencl_alloc_device_buffer(const int devid, const size_t size)
 {
-  if(!darktable.opencl->inited) return NULL;
-  cl_int err;
-
-  cl_mem buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
-                                                                     CL_MEM_READ_WRITE, size, NULL, &err);
-  if(err != CL_SUCCESS)
-    dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid,
-             err);
-
-  dt_opencl_memory_statistics(devid, buf, OPENCL_MEMORY_ADD);
-
-  return buf;
+  return dt_opencl_alloc_device_buffer_with_flags(devid, size, CL_MEM_READ_WRITE);
 }
 
 void *dt_opencl_alloc_device_buffer_with_flags(const int devid, const size_t size, const int flags)
@@ -2333,8 +2918,18 @@ void *dt_opencl_alloc_device_buffer_with_flags(const int devid, const size_t siz
   if(!darktable.opencl->inited) return NULL;
   cl_int err;
 
-  cl_mem buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
-                                                                     flags, size, NULL, &err);
+  cl_mem buf = flags == CL_MEM_READ_WRITE ? _pool_take(devid, 0, 0, 0, size) : NULL;
+  if(buf)
+  {
+    dt_opencl_memory_statistics(devid, buf, OPENCL_MEMORY_ADD);
+    return buf;
+  }
+
+  buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context, flags,
+                                                              size, NULL, &err);
+  if(err != CL_SUCCESS && _pool_flush(devid))
+    buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context, flags,
+                                                                size, NULL, &err);
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid,
              err);
@@ -2344,6 +2939,7 @@ void *dt_opencl_alloc_device_buffer_with_flags(const int devid, const size_t siz
   return buf;
 }
 
+
 size_t dt_opencl_get_mem_object_size(cl_mem mem)
 {
   cl_int err;
@@ -2413,7 +3009,8 @@ int dt_opencl_get_image_element_size(cl_mem mem)
 
 void dt_opencl_memory_statistics(int devid, cl_mem mem, dt_opencl_memory_t action)
 {
-  if(!((darktable.unmuted & DT_DEBUG_MEMORY) && (darktable.unmuted & DT_DEBUG_OPENCL)))
+  if(!((darktable.unmuted & DT_DEBUG_MEMORY) && (darktable.unmuted & DT_DEBUG_OPENCL))
+     && !(darktable.unmuted & DT_DEBUG_TILING_CALIBRATE))
     return;
 
   if(devid < 0)
@@ -2434,6 +3031,16 @@ void dt_opencl_memory_statistics(int devid, cl_mem mem, dt_opencl_memory_t actio
     dt_print(DT_DEBUG_OPENCL,
               "[opencl memory] device %d: %zu bytes (%.1f MB) in use\n", devid, darktable.opencl->dev[devid].memory_in_use,
                                       (float)darktable.opencl->dev[devid].memory_in_use/(1024*1024));
+
+  if(darktable.opencl->memory_pool_limit)
+  {
+    const dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+    const uint64_t requests = dev->pool_hits + dev->pool_misses;
+    dt_print(DT_DEBUG_OPENCL,
+             "[opencl memory] device %d: pool holds %.1f MB (peak %.1f MB), hit rate %.1f%%\n", devid,
+             (float)dev->pool_memory / (1024 * 1024), (float)dev->pool_peak / (1024 * 1024),
+             requests ? 100.0 * dev->pool_hits / requests : 0.0);
+  }
 }
 
 /** check if image size fit into limits given by OpenCL runtime */
@@ -2565,6 +3172,8 @@ static dt_opencl_scheduling_profile_t dt_opencl_get_scheduling_profile(void)
     profile = OPENCL_PROFILE_MULTIPLE_GPUS;
   else if(!strcmp(pstr, "very fast GPU"))
     profile = OPENCL_PROFILE_VERYFAST_GPU;
+  else if(!strcmp(pstr, "adaptive"))
+    profile = OPENCL_PROFILE_ADAPTIVE;
 
   g_free(pstr);
 
@@ -2614,6 +3223,11 @@ static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t pr
       dt_opencl_update_priorities("+*/+*/+*/+*/+*");
       dt_opencl_set_synchronization_timeout(0);
       break;
+    case OPENCL_PROFILE_ADAPTIVE:
+      // every pipe may get any device, the pixelpipe then decides per module whether to use it
+      dt_opencl_update_priorities("*/*/*/*/*");
+      dt_opencl_set_synchronization_timeout(dt_conf_get_int("pixelpipe_synchronization_timeout"));
+      break;
     case OPENCL_PROFILE_DEFAULT:
     default:
       str = dt_conf_get_string("opencl_device_priority");
@@ -2625,6 +3239,173 @@ static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t pr
   dt_pthread_mutex_unlock(&darktable.opencl->lock);
 }
 
+typedef struct dt_opencl_affinity_t
+{
+  double seconds; // running average
+  int samples;
+  int decisions;
+} dt_opencl_affinity_t;
+
+// roi sizes are grouped in powers of two of the pixel count
+static int _affinity_sizeclass(const int width, const int height)
+{
+  return (int)roundf(log2f(MAX((float)width * height, 1.0f)));
+}
+
+static gchar *_affinity_key(const int devid, const char *op, const int sizeclass)
+{
+  const char *device = devid < 0 ? "cpu" : darktable.opencl->dev[devid].cname;
+  return g_strdup_printf("%s %s %d", op, device && *device ? device : "unnamed", sizeclass);
+}
+
+// expects affinity_lock to be held
+static dt_opencl_affinity_t *_affinity_lookup(const int devid, const char *op, const int sizeclass)
+{
+  gchar *key = _affinity_key(devid, op, sizeclass);
+  dt_opencl_affinity_t *a = (dt_opencl_affinity_t *)g_hash_table_lookup(darktable.opencl->affinity, key);
+  g_free(key);
+  return a;
+}
+
+int dt_opencl_affinity_prefer_cpu(const int devid, const char *op, const int width, const int height)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || cl->scheduling_profile != OPENCL_PROFILE_ADAPTIVE) return FALSE;
+
+  const int sizeclass = _affinity_sizeclass(width, height);
+  int cpu_first = FALSE;
+  dt_pthread_mutex_lock(&cl->affinity_lock);
+  dt_opencl_affinity_t *gpu = _affinity_lookup(devid, op, sizeclass);
+  dt_opencl_affinity_t *cpu = _affinity_lookup(-1, op, sizeclass);
+  if(!gpu)
+    cpu_first = FALSE; // the device goes first, it is the one we have been asked to use
+  else if(!cpu)
+  {
+    // try the cpu once, but don't let a big export find out the hard way that it is slow:
+    // beyond a few megapixels only if the cpu already won at the next smaller size.
+    const dt_opencl_affinity_t *gpu_smaller = _affinity_lookup(devid, op, sizeclass - 1);
+    const dt_opencl_affinity_t *cpu_smaller = _affinity_lookup(-1, op, sizeclass - 1);
+    cpu_first = sizeclass <= 21
+                || (gpu_smaller && cpu_smaller && cpu_smaller->seconds < gpu_smaller->seconds);
+  }
+  else
+  {
+    cpu_first = cpu->seconds < gpu->seconds;
+    // now and then give the slower one a chance, the situation may have changed
+    if(++gpu->decisions % 64 == 0) cpu_first = !cpu_first;
+  }
+  dt_pthread_mutex_unlock(&cl->affinity_lock);
+  return cpu_first;
+}
+
+void dt_opencl_affinity_record(const int devid, const char *op, const int width, const int height,
+                               const int on_gpu, const double seconds)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || cl->scheduling_profile != OPENCL_PROFILE_ADAPTIVE) return;
+
+  const int sizeclass = _affinity_sizeclass(width, height);
+  dt_pthread_mutex_lock(&cl->affinity_lock);
+  dt_opencl_affinity_t *a = _affinity_lookup(on_gpu ? devid : -1, op, sizeclass);
+  if(!a)
+  {
+    a = (dt_opencl_affinity_t *)calloc(1, sizeof(dt_opencl_affinity_t));
+    g_hash_table_insert(cl->affinity, _affinity_key(on_gpu ? devid : -1, op, sizeclass), a);
+  }
+  a->seconds = a->samples ? 0.7 * a->seconds + 0.3 * seconds : seconds;
+  a->samples = MIN(a->samples + 1, 1000);
+  const double average = a->seconds;
+  dt_pthread_mutex_unlock(&cl->affinity_lock);
+
+  dt_print(DT_DEBUG_OPENCL | DT_DEBUG_PERF, "[opencl_affinity] `%s' at size class %d on %s: %.4f secs, average %.4f\n",
+           op, sizeclass, on_gpu ? cl->dev[devid].name : "cpu", seconds, average);
+}
+
+double dt_opencl_affinity_estimate(const int devid, const char *op, const int width, const int height)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1.0;
+
+  const int sizeclass = _affinity_sizeclass(width, height);
+  double seconds = -1.0;
+  dt_pthread_mutex_lock(&cl->affinity_lock);
+  // the closest size class measured, the run time growing with the pixel count in between
+  for(int d = 0; d <= 4 && seconds < 0.0; d++)
+    for(int sign = 1; sign >= -1 && seconds < 0.0; sign -= 2)
+    {
+      const dt_opencl_affinity_t *a = _affinity_lookup(devid, op, sizeclass + sign * d);
+      if(a && a->samples) seconds = ldexp(a->seconds, -sign * d);
+    }
+  dt_pthread_mutex_unlock(&cl->affinity_lock);
+  return seconds;
+}
+
+int dt_opencl_preferred_device(const int pipetype)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || !cl->enabled || cl->stopped) return -1;
+
+  dt_pthread_mutex_lock(&cl->lock);
+  int mandatory;
+  int *priority = _device_priority(cl, pipetype, &mandatory);
+  dt_pthread_mutex_unlock(&cl->lock);
+
+  const int devid = priority ? priority[0] : -1;
+  free(priority);
+  return devid;
+}
+
+static void _affinity_filename(char *filename, size_t bufsize)
+{
+  char confdir[PATH_MAX] = { 0 };
+  dt_loc_get_user_config_dir(confdir, sizeof(confdir));
+  snprintf(filename, bufsize, "%s/opencl_affinity", confdir);
+}
+
+// one line per entry: op device sizeclass microseconds samples, integers keep it independent of the locale
+static void _affinity_load(dt_opencl_t *cl)
+{
+  char filename[PATH_MAX] = { 0 };
+  _affinity_filename(filename, sizeof(filename));
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return;
+
+  char op[64], device[64];
+  int sizeclass, samples;
+  int64_t usecs;
+  dt_pthread_mutex_lock(&cl->affinity_lock);
+  while(fscanf(f, "%63s %63s %d %" SCNd64 " %d", op, device, &sizeclass, &usecs, &samples) == 5)
+  {
+    dt_opencl_affinity_t *a = (dt_opencl_affinity_t *)calloc(1, sizeof(dt_opencl_affinity_t));
+    a->seconds = usecs * 1e-6;
+    a->samples = samples;
+    g_hash_table_replace(cl->affinity, g_strdup_printf("%s %s %d", op, device, sizeclass), a);
+  }
+  dt_pthread_mutex_unlock(&cl->affinity_lock);
+  fclose(f);
+}
+
+static void _affinity_save(dt_opencl_t *cl)
+{
+  if(!g_hash_table_size(cl->affinity)) return;
+  char filename[PATH_MAX] = { 0 };
+  _affinity_filename(filename, sizeof(filename));
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return;
+
+  GHashTableIter iter;
+  gpointer key, value;
+  dt_pthread_mutex_lock(&cl->affinity_lock);
+  g_hash_table_iter_init(&iter, cl->affinity);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_opencl_affinity_t *a = (const dt_opencl_affinity_t *)value;
+    fprintf(f, "%s %" PRId64 " %d\n", (const char *)key, (int64_t)(a->seconds * 1e6), a->samples);
+  }
+  dt_pthread_mutex_unlock(&cl->affinity_lock);
+  fclose(f);
+}
+
 /** get global memory of device */
 cl_ulong dt_opencl_get_max_global_mem(const int devid)
 {
@@ -2635,6 +3416,54 @@ cl_ulong dt_opencl_get_max_global_mem(const int devid)
 
 /** the following eventlist functions assume that affected structures are locked upstream */
 
+// row of a device in the trace, above the pixelpipe rows which use the pipe type
+#define DT_OPENCL_TRACE_TID(devid) (64 + (devid))
+
+static void _events_set_owner_of_slot(const int devid, const int k)
+{
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  dt_opencl_eventtag_t *tag = &dev->eventtags[k];
+  g_strlcpy(tag->owner, dev->event_owner, DT_OPENCL_EVENTNAMELENGTH);
+  tag->pipe = dev->event_pipe;
+  tag->bytes = 0;
+  tag->host_time = dt_trace_enabled() ? dt_get_wtime() : 0.0;
+}
+
+static void _events_set_bytes(const int devid, const cl_event *eventp, const size_t bytes)
+{
+  if(!eventp) return;
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  dev->eventtags[eventp - dev->eventlist].bytes = bytes;
+}
+
+void dt_opencl_events_set_owner(const int devid, const char *module, const char *pipe)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return;
+  g_strlcpy(cl->dev[devid].event_owner, module ? module : "", DT_OPENCL_EVENTNAMELENGTH);
+  cl->dev[devid].event_pipe = pipe;
+}
+
+// one span per finished event, placed on the host clock relative to the time the slot was taken
+static void _events_trace(const int devid, const dt_opencl_eventtag_t *tag, const cl_ulong queued,
+                          const cl_ulong submit, const cl_ulong start, const cl_ulong end)
+{
+  const double t_start = tag->host_time + (start - queued) * 1e-9;
+  const double t_end = tag->host_time + (end - queued) * 1e-9;
+  const double seconds = (end - start) * 1e-9;
+  const gboolean transfer = tag->bytes > 0;
+  char args[512];
+  snprintf(args, sizeof(args),
+           "\"module\": \"%s\", \"pipe\": \"%s\", \"devid\": %d, \"kind\": \"%s\", \"bytes\": %zu, "
+           "\"bytes_per_second\": %.0f, \"queued_ms\": %.3f, \"submitted_ms\": %.3f, \"run_ms\": %.3f, "
+           "\"status\": %d",
+           tag->owner, tag->pipe ? tag->pipe : "", devid, transfer ? "transfer" : "kernel", tag->bytes,
+           transfer && seconds > 0.0 ? tag->bytes / seconds : 0.0, (submit - queued) * 1e-6,
+           (start - submit) * 1e-6, (end - start) * 1e-6, tag->retval);
+  dt_trace_span(tag->tag[0] == '\0' ? "<?>" : tag->tag, "opencl", DT_OPENCL_TRACE_TID(devid), t_start, t_end,
+                args);
+}
+
 /** get next free slot in eventlist (and manage size of eventlist) */
 cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
 {
@@ -2683,6 +3512,7 @@ cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
       (*eventtags)[*numevents - 1].tag[0] = '\0';
     }
 
+    _events_set_owner_of_slot(devid, *numevents - 1);
     (*totalevents)++;
     return (*eventlist) + *numevents - 1;
   }
@@ -2725,6 +3555,7 @@ cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
     (*eventtags)[*numevents - 1].tag[0] = '\0';
   }
 
+  _events_set_owner_of_slot(devid, *numevents - 1);
   (*totalevents)++;
   return (*eventlist) + *numevents - 1;
 }
@@ -2851,9 +3682,9 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
     else
       (*totalsuccess)++;
 
-    if(darktable.unmuted & DT_DEBUG_PERF)
+    if((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled())
     {
-      // get profiling info of event (only if darktable was called with '-d perf')
+      // get profiling info of event (only if darktable was called with '-d perf' or '--trace')
       cl_ulong start;
       cl_ulong end;
       cl_int errs = (cl->dlocl->symbols->dt_clGetEventProfilingInfo)(
@@ -2863,6 +3694,14 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
       if(errs == CL_SUCCESS && erre == CL_SUCCESS)
       {
         (*eventtags)[k].timelapsed = end - start;
+
+        cl_ulong queued, submit;
+        if(dt_trace_enabled()
+           && (cl->dlocl->symbols->dt_clGetEventProfilingInfo)((*eventlist)[k], CL_PROFILING_COMMAND_QUEUED,
+                                                              sizeof(cl_ulong), &queued, NULL) == CL_SUCCESS
+           && (cl->dlocl->symbols->dt_clGetEventProfilingInfo)((*eventlist)[k], CL_PROFILING_COMMAND_SUBMIT,
+                                                              sizeof(cl_ulong), &submit, NULL) == CL_SUCCESS)
+          _events_trace(devid, &(*eventtags)[k], queued, submit, start, end);
       }
       else
       {
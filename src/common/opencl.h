@@ -30,6 +30,8 @@
 #define DT_OPENCL_MAX_EVENTS 256
 #define DT_OPENCL_MAX_ERRORS 5
 #define DT_OPENCL_MAX_INCLUDES 5
+#define DT_OPENCL_POOL_ENTRIES 32
+#define DT_OPENCL_MAX_SLOTS 8
 
 #include "common/darktable.h"
 
@@ -59,7 +61,8 @@ typedef enum dt_opencl_scheduling_profile_t
 {
   OPENCL_PROFILE_DEFAULT,
   OPENCL_PROFILE_MULTIPLE_GPUS,
-  OPENCL_PROFILE_VERYFAST_GPU
+  OPENCL_PROFILE_VERYFAST_GPU,
+  OPENCL_PROFILE_ADAPTIVE
 } dt_opencl_scheduling_profile_t;
 
 typedef enum dt_opencl_sync_cache_t
@@ -77,9 +80,29 @@ typedef struct dt_opencl_eventtag_t
   cl_int retval;
   cl_ulong timelapsed;
   char tag[DT_OPENCL_EVENTNAMELENGTH];
+  // for the trace: host time when the slot was taken, the module and pipe owning the event and the
+  // bytes moved by transfers
+  double host_time;
+  char owner[DT_OPENCL_EVENTNAMELENGTH];
+  const char *pipe;
+  size_t bytes;
 } dt_opencl_eventtag_t;
 
 
+/**
+ * a released read/write image or buffer kept for reuse by the next allocation of the same shape.
+ * images are matched by width, height and bpp, buffers (bpp 0) by size.
+ */
+typedef struct dt_opencl_pool_entry_t
+{
+  cl_mem mem;
+  int width;
+  int height;
+  int bpp;
+  size_t size;
+  uint64_t used;
+} dt_opencl_pool_entry_t;
+
 /**
  * to support multi-gpu and mixed systems with cpu support,
  * we encapsulate devices and use separate command queues.
@@ -99,6 +122,11 @@ typedef struct dt_opencl_device_t
   cl_kernel kernel[DT_OPENCL_MAX_KERNELS];
   int program_used[DT_OPENCL_MAX_PROGRAMS];
   int kernel_used[DT_OPENCL_MAX_KERNELS];
+  // kernels requested before the programs were built, created once they are:
+  char *kernel_name[DT_OPENCL_MAX_KERNELS];
+  int kernel_prog[DT_OPENCL_MAX_KERNELS];
+  gint programs_ready; // the device is not handed out before
+  const char *cachedir;
   cl_event *eventlist;
   dt_opencl_eventtag_t *eventtags;
   int numevents;
@@ -117,6 +145,24 @@ typedef struct dt_opencl_device_t
   float benchmark;
   size_t memory_in_use;
   size_t peak_memory;
+  // bytes moved between host and device, for the trace
+  size_t bytes_to_device;
+  size_t bytes_from_device;
+  // module and pipe new events are attributed to, see dt_opencl_events_set_owner()
+  char event_owner[DT_OPENCL_EVENTNAMELENGTH];
+  const char *event_pipe;
+  // recycled device memory, see dt_opencl_alloc_device():
+  dt_pthread_mutex_t pool_lock;
+  dt_opencl_pool_entry_t pool[DT_OPENCL_POOL_ENTRIES];
+  size_t pool_memory;
+  size_t pool_peak;
+  uint64_t pool_clock;
+  uint64_t pool_hits;
+  uint64_t pool_misses;
+  // a large device is handed out to several pipes at once as slots, see _device_init_slots().
+  // slots share context, programs and memory pool of their parent and each get its share of the memory.
+  int parent; // index of the physical device, the own index for physical devices
+  int slots;  // number of slots of a physical device, including itself
 } dt_opencl_device_t;
 
 struct dt_bilateral_cl_global_t;
@@ -137,6 +183,10 @@ typedef struct dt_opencl_t
   int avoid_atomics;
   int use_events;
   int async_pixelpipe;
+  int background_build;
+  gint build_stop;
+  int build_thread_running;
+  pthread_t build_thread;
   int number_event_handles;
   int print_statistics;
   dt_opencl_sync_cache_t sync_cache;
@@ -146,6 +196,11 @@ typedef struct dt_opencl_t
   int num_devs;
   int error_count;
   int opencl_synchronization_timeout;
+  size_t memory_pool_limit; // bytes of released device memory kept per device, 0 disables the pool
+  char *kernel_cache_dir;   // read-only system wide kernel cache, NULL if not configured
+  // measured module run times for the adaptive profile, "op device sizeclass" -> dt_opencl_affinity_t
+  dt_pthread_mutex_t affinity_lock;
+  GHashTable *affinity;
   dt_opencl_scheduling_profile_t scheduling_profile;
   uint32_t crc;
   int mandatory[5];
@@ -215,12 +270,37 @@ void dt_opencl_cleanup(dt_opencl_t *cl);
 /** cleans up command queue. */
 int dt_opencl_finish(const int devid);
 
+/** waits for programs still being compiled in the background, returns the number of usable devices. */
+int dt_opencl_wait_for_programs(void);
+
+/** adaptive scheduling: TRUE if module op on a width x height roi is expected to finish
+  * earlier on the cpu than on devid, judging from earlier runs. */
+int dt_opencl_affinity_prefer_cpu(const int devid, const char *op, const int width, const int height);
+/** adaptive scheduling: records how long op took on devid (or the cpu, if on_gpu is FALSE). */
+void dt_opencl_affinity_record(const int devid, const char *op, const int width, const int height,
+                               const int on_gpu, const double seconds);
+/** how long op is expected to take on a width x height roi on devid (-1 for the cpu), from the run times
+  * recorded for the adaptive profile. nearby sizes are scaled by the pixel count, negative if nothing is known. */
+double dt_opencl_affinity_estimate(const int devid, const char *op, const int width, const int height);
+
+/** the device a pipe of pipetype would ask for first, without locking it. -1 if it would run on the cpu. */
+int dt_opencl_preferred_device(const int pipetype);
+
 /** enqueues a synchronization point. */
 int dt_opencl_enqueue_barrier(const int devid);
 
+/** enqueues a marker behind all commands queued so far and flushes the queue. returns NULL on failure. */
+cl_event dt_opencl_enqueue_marker(const int devid);
+
+/** blocks until everything before the marker has completed and releases it. */
+int dt_opencl_wait_for_marker(cl_event event);
+
 /** locks a device for your thread's exclusive use */
 int dt_opencl_lock_device(const int pipetype);
 
+/** locks one more currently free device allowed for pipetype without ever waiting, -1 if there is none. */
+int dt_opencl_trylock_device(const int pipetype);
+
 /** done with your command queue. */
 void dt_opencl_unlock_device(const int dev);
 
@@ -391,6 +471,10 @@ cl_int dt_opencl_events_flush(const int devid, const int reset);
 /** display OpenCL profiling information. If summary is not 0, try to generate summarized info for kernels */
 void dt_opencl_events_profiling(const int devid, const int aggregated);
 
+/** attribute the events queued from now on to module (op and instance name) running in pipe, for the
+    trace. pipe has to be a static string, NULL for both clears the owner. */
+void dt_opencl_events_set_owner(const int devid, const char *module, const char *pipe);
+
 /** utility function to calculate optimal work group dimensions for a given kernel */
 int dt_opencl_local_buffer_opt(const int devid, const int kernel, dt_opencl_local_buffer_t *factors);
 
@@ -428,6 +512,14 @@ static inline int dt_opencl_lock_device(const int dev)
 {
   return -1;
 }
+static inline int dt_opencl_trylock_device(const int pipetype)
+{
+  return -1;
+}
+static inline int dt_opencl_wait_for_programs(void)
+{
+  return 0;
+}
 static inline void dt_opencl_unlock_device(const int dev)
 {
 }
@@ -517,6 +609,18 @@ static inline int dt_opencl_events_flush(const int devid, const int reset)
 static inline void dt_opencl_events_profiling(const int devid, const int aggregated)
 {
 }
+static inline void dt_opencl_events_set_owner(const int devid, const char *module, const char *pipe)
+{
+}
+static inline double dt_opencl_affinity_estimate(const int devid, const char *op, const int width,
+                                                 const int height)
+{
+  return -1.0;
+}
+static inline int dt_opencl_preferred_device(const int pipetype)
+{
+  return -1;
+}
 #endif
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -18,6 +18,7 @@
 
 #include "common/printprof.h"
 #include "common/colorspaces.h"
+#include "common/darktable.h"
 #include "lcms2.h"
 #include <glib.h>
 #include <unistd.h>
@@ -38,59 +39,181 @@ static cmsUInt32Number ComputeFormatDescriptor (int OutColorSpace, int bps)
   return (FLOAT_SH(IsFlt)|COLORSPACE_SH(OutColorSpace)|PLANAR_SH(IsPlanar)|CHANNELS_SH(Channels)|BYTES_SH(bps));
 }
 
+// the printer transform is sampled once into a 3D LUT which is then applied with tetrahedral interpolation,
+// this is much cheaper than cmsDoTransform on 16 bit input and avoids building the transform again when
+// the same image is printed or re-rendered with unchanged settings.
+
+#define PRINTPROF_LUT_SIZE 33
+
+typedef struct dt_printer_lut_t
+{
+  cmsHPROFILE in_profile, out_profile;
+  int intent;
+  gboolean bpc;
+  float *lut; // PRINTPROF_LUT_SIZE^3 * 3 output values in [0, 255], red varying fastest
+} dt_printer_lut_t;
+
+static dt_printer_lut_t _printer_lut = { NULL, NULL, 0, FALSE, NULL };
+static GMutex _printer_lut_lock;
+
+static float *_build_lut(cmsHPROFILE hInProfile, cmsHPROFILE hOutProfile, int intent,
+                         gboolean black_point_compensation)
+{
+  const int n = PRINTPROF_LUT_SIZE;
+  const cmsUInt32Number wInput = ComputeFormatDescriptor(PT_RGB, 2);
+  const int OutputColorSpace = _cmsLCMScolorSpace(cmsGetColorSpace(hOutProfile));
+  const cmsUInt32Number wOutput = ComputeOutputFormatDescriptor(wInput, OutputColorSpace, 2);
+
+  cmsHTRANSFORM hTransform = cmsCreateTransform(hInProfile, wInput, hOutProfile, wOutput, intent,
+                                                black_point_compensation ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0);
+  if(!hTransform) return NULL;
+
+  float *lut = malloc(sizeof(float) * 3 * n * n * n);
+  uint16_t *grid = malloc(sizeof(uint16_t) * 3 * n * n * n);
+  if(!lut || !grid)
+  {
+    free(lut);
+    free(grid);
+    cmsDeleteTransform(hTransform);
+    return NULL;
+  }
+
+  size_t k = 0;
+  for(int b = 0; b < n; b++)
+    for(int g = 0; g < n; g++)
+      for(int r = 0; r < n; r++)
+      {
+        grid[k++] = (uint16_t)(r * 65535 / (n - 1));
+        grid[k++] = (uint16_t)(g * 65535 / (n - 1));
+        grid[k++] = (uint16_t)(b * 65535 / (n - 1));
+      }
+
+  // transform in place, lcms supports that for identical formats
+  cmsDoTransform(hTransform, grid, grid, n * n * n);
+  cmsDeleteTransform(hTransform);
+
+  for(size_t i = 0; i < (size_t)3 * n * n * n; i++) lut[i] = grid[i] * (255.0f / 65535.0f);
+  free(grid);
+
+  return lut;
+}
+
+static inline void _apply_lut_pixel(const float *const lut, const float r, const float g, const float b,
+                                    uint8_t *const out)
+{
+  const int n = PRINTPROF_LUT_SIZE;
+  const float scale = (float)(n - 1);
+
+  const float fr = r * scale, fg = g * scale, fb = b * scale;
+  const int ir = MIN((int)fr, n - 2), ig = MIN((int)fg, n - 2), ib = MIN((int)fb, n - 2);
+  const float dr = fr - ir, dg = fg - ig, db = fb - ib;
+
+  // offsets of the cube corners, red varies fastest
+  const size_t sr = 3, sg = (size_t)3 * n, sb = (size_t)3 * n * n;
+  const float *const c000 = lut + ir * sr + ig * sg + ib * sb;
+  const float *const c111 = c000 + sr + sg + sb;
+
+  // tetrahedral interpolation, pick the two intermediate corners according to the order of the fractions
+  const float *c1, *c2;
+  float w0, w1, w2, w3;
+  if(dr >= dg)
+  {
+    if(dg >= db)
+    {
+      c1 = c000 + sr; c2 = c000 + sr + sg;
+      w0 = 1.0f - dr; w1 = dr - dg; w2 = dg - db; w3 = db;
+    }
+    else if(dr >= db)
+    {
+      c1 = c000 + sr; c2 = c000 + sr + sb;
+      w0 = 1.0f - dr; w1 = dr - db; w2 = db - dg; w3 = dg;
+    }
+    else
+    {
+      c1 = c000 + sb; c2 = c000 + sr + sb;
+      w0 = 1.0f - db; w1 = db - dr; w2 = dr - dg; w3 = dg;
+    }
+  }
+  else
+  {
+    if(db >= dg)
+    {
+      c1 = c000 + sb; c2 = c000 + sg + sb;
+      w0 = 1.0f - db; w1 = db - dg; w2 = dg - dr; w3 = dr;
+    }
+    else if(db >= dr)
+    {
+      c1 = c000 + sg; c2 = c000 + sg + sb;
+      w0 = 1.0f - dg; w1 = dg - db; w2 = db - dr; w3 = dr;
+    }
+    else
+    {
+      c1 = c000 + sg; c2 = c000 + sr + sg;
+      w0 = 1.0f - dg; w1 = dg - dr; w2 = dr - db; w3 = db;
+    }
+  }
+
+  for(int c = 0; c < 3; c++)
+  {
+    const float v = w0 * c000[c] + w1 * c1[c] + w2 * c2[c] + w3 * c111[c];
+    out[c] = (uint8_t)CLAMP(v + 0.5f, 0.0f, 255.0f);
+  }
+}
+
 int dt_apply_printer_profile(void **in, uint32_t width, uint32_t height, int bpp, cmsHPROFILE hInProfile,
                              cmsHPROFILE hOutProfile, int intent, gboolean black_point_compensation)
 {
-  cmsHTRANSFORM hTransform;
-  cmsUInt32Number wInput, wOutput;
-  int OutputColorSpace;
-
   if(!hOutProfile || !hInProfile)
     return 1;
 
-  wInput = ComputeFormatDescriptor (PT_RGB, (bpp==8?1:2));
-
-  OutputColorSpace = _cmsLCMScolorSpace(cmsGetColorSpace(hOutProfile));
-  wOutput = ComputeOutputFormatDescriptor(wInput, OutputColorSpace, 1);
+  g_mutex_lock(&_printer_lut_lock);
 
-  hTransform = cmsCreateTransform
-    (hInProfile,  wInput,
-     hOutProfile, wOutput,
-     intent,
-     black_point_compensation ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0);
+  if(!_printer_lut.lut || _printer_lut.in_profile != hInProfile || _printer_lut.out_profile != hOutProfile
+     || _printer_lut.intent != intent || _printer_lut.bpc != black_point_compensation)
+  {
+    free(_printer_lut.lut);
+    _printer_lut.lut = _build_lut(hInProfile, hOutProfile, intent, black_point_compensation);
+    _printer_lut.in_profile = hInProfile;
+    _printer_lut.out_profile = hOutProfile;
+    _printer_lut.intent = intent;
+    _printer_lut.bpc = black_point_compensation;
+  }
 
-  if (!hTransform)
+  if(!_printer_lut.lut)
   {
+    g_mutex_unlock(&_printer_lut_lock);
     fprintf(stderr, "error printer profile may be corrupted\n");
     return 1;
   }
 
-  void *out = (void *)malloc(width*height*3);
+  const float *const lut = _printer_lut.lut;
+  uint8_t *out = (uint8_t *)malloc((size_t)width * height * 3);
+  const size_t npixels = (size_t)width * height;
 
   if (bpp == 8)
   {
     const uint8_t *ptr_in = (uint8_t *)*in;
-    uint8_t *ptr_out = (uint8_t *)out;
 
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(ptr_in, ptr_out, hTransform, height, width)
+#pragma omp parallel for schedule(static) default(none) dt_omp_firstprivate(lut, npixels, ptr_in, out)
 #endif
-    for (int k=0; k<height; k++)
-      cmsDoTransform(hTransform, (const void *)&ptr_in[k*width*3], (void *)&ptr_out[k*width*3], width);
+    for(size_t k = 0; k < npixels; k++)
+      _apply_lut_pixel(lut, ptr_in[3 * k] / 255.0f, ptr_in[3 * k + 1] / 255.0f, ptr_in[3 * k + 2] / 255.0f,
+                       out + 3 * k);
   }
   else
   {
     const uint16_t *ptr_in = (uint16_t *)*in;
-    uint8_t *ptr_out = (uint8_t *)out;
 
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(ptr_in, ptr_out, hTransform, height, width)
+#pragma omp parallel for schedule(static) default(none) dt_omp_firstprivate(lut, npixels, ptr_in, out)
 #endif
-    for (int k=0; k<height; k++)
-      cmsDoTransform(hTransform, (const void *)&ptr_in[k*width*3], (void *)&ptr_out[k*width*3], width);
+    for(size_t k = 0; k < npixels; k++)
+      _apply_lut_pixel(lut, ptr_in[3 * k] / 65535.0f, ptr_in[3 * k + 1] / 65535.0f,
+                       ptr_in[3 * k + 2] / 65535.0f, out + 3 * k);
   }
 
-  cmsDeleteTransform(hTransform);
+  g_mutex_unlock(&_printer_lut_lock);
 
   free(*in);
   *in = out;
@@ -98,6 +221,14 @@ int dt_apply_printer_profile(void **in, uint32_t width, uint32_t height, int bpp
   return 0;
 }
 
+void dt_printer_profile_cleanup(void)
+{
+  g_mutex_lock(&_printer_lut_lock);
+  free(_printer_lut.lut);
+  _printer_lut.lut = NULL;
+  g_mutex_unlock(&_printer_lut_lock);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
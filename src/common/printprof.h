@@ -27,6 +27,10 @@ int dt_apply_printer_profile(void **in, uint32_t width, uint32_t height, int bpp
                              cmsHPROFILE hOutProfile, int intent, gboolean black_point_compensation);
 // this routines takes as input an image of 8 or 16 bpp but always return a 8 bpp result. It is indeed better to
 // apply the profile to a 16bit input but we do not need this for printing.
+// the transform is kept as a 3D LUT for the last used profiles, intent and black point compensation.
+
+// release the cached printer LUT
+void dt_printer_profile_cleanup(void);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -17,6 +17,18 @@
 */
 
 #include "common/profiling.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+#include <glib/gstdio.h>
+
+static struct
+{
+  FILE *f;
+  double start;
+  int events;
+  dt_pthread_mutex_t lock;
+} _trace = { NULL, 0.0, 0 };
 
 dt_timer_t *dt_timer_start_with_name(const char *file, const char *function, const char *description)
 {
@@ -25,6 +37,7 @@ dt_timer_t *dt_timer_start_with_name(const char *file, const char *function, con
   t->function = function;
   t->timer = g_timer_new();
   t->description = description;
+  t->start = dt_get_wtime();
   return t;
 }
 
@@ -35,9 +48,67 @@ void dt_timer_stop_with_name(dt_timer_t *t)
   gulong ms = 0;
   fprintf(stderr, "Timer %s in function %s took %.3f seconds to execute.\n", t->description, t->function,
           g_timer_elapsed(t->timer, &ms));
+  if(dt_trace_enabled())
+  {
+    gchar *args = g_strdup_printf("\"file\": \"%s\", \"function\": \"%s\"", t->file, t->function);
+    dt_trace_span(t->description, "timer", 0, t->start, dt_get_wtime(), args);
+    g_free(args);
+  }
   g_timer_destroy(t->timer);
   g_free(t);
 }
+
+void dt_trace_init(const char *filename)
+{
+  if(_trace.f) return;
+  _trace.f = g_fopen(filename, "wb");
+  if(!_trace.f)
+  {
+    fprintf(stderr, "[trace] could not open `%s' for writing\n", filename);
+    return;
+  }
+  dt_pthread_mutex_init(&_trace.lock, NULL);
+  _trace.start = dt_get_wtime();
+  _trace.events = 0;
+  fprintf(_trace.f, "[\n");
+}
+
+void dt_trace_cleanup(void)
+{
+  if(!_trace.f) return;
+  dt_pthread_mutex_lock(&_trace.lock);
+  fprintf(_trace.f, "\n]\n");
+  fclose(_trace.f);
+  _trace.f = NULL;
+  dt_pthread_mutex_unlock(&_trace.lock);
+  dt_pthread_mutex_destroy(&_trace.lock);
+}
+
+int dt_trace_enabled(void)
+{
+  return _trace.f != NULL;
+}
+
+void dt_trace_span(const char *name, const char *category, const int tid, const double start,
+                   const double end, const char *args)
+{
+  if(!_trace.f) return;
+  // instance names are user input
+  gchar *escaped = g_strescape(name, NULL);
+  dt_pthread_mutex_lock(&_trace.lock);
+  if(_trace.f)
+  {
+    // timestamps are in microseconds
+    fprintf(_trace.f, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                      "\"ts\": %.1f, \"dur\": %.1f, \"args\": {%s}}",
+            _trace.events++ ? ",\n" : "", escaped, category, tid, (start - _trace.start) * 1.0e6,
+            MAX(0.0, end - start) * 1.0e6, args ? args : "");
+    fflush(_trace.f);
+  }
+  dt_pthread_mutex_unlock(&_trace.lock);
+  g_free(escaped);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -38,18 +38,29 @@
   }
 #endif
 
-#ifdef USE_DARKTABLE_PROFILING
 typedef struct dt_timer_t
 {
   const char *file;
   const char *function;
   const char *description;
   GTimer *timer;
+  double start; // dt_get_wtime() when started, for the trace
 } dt_timer_t;
 
 dt_timer_t *dt_timer_start_with_name(const char *file, const char *function, const char *description);
 void dt_timer_stop_with_name(dt_timer_t *);
-#endif
+
+/*
+ * structured trace in the chrome trace event format, to be loaded into chrome://tracing or
+ * perfetto. enabled with --trace <file>. stopped timers and the pixelpipe write complete events.
+ */
+void dt_trace_init(const char *filename);
+void dt_trace_cleanup(void);
+int dt_trace_enabled(void);
+/** writes a complete event, start and end are dt_get_wtime() values. tid selects the row in the
+    viewer, args is the body of a json object (without braces) or NULL. */
+void dt_trace_span(const char *name, const char *category, const int tid, const double start,
+                   const double end, const char *args);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -66,8 +66,8 @@ static void _ratings_apply_to_image(const int imgid, const int rating)
     else
       image->flags = (image->flags & ~(DT_IMAGE_REJECTED | DT_VIEW_RATINGS_MASK))
         | (DT_VIEW_RATINGS_MASK & rating);
-    // synch through:
-    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
+    // the sidecars are written by the callers, all at once
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
   }
   else
   {
@@ -100,6 +100,7 @@ static void _ratings_undo_data_free(gpointer data)
 
 static void _ratings_apply(GList *imgs, const int rating, GList **undo, const gboolean undo_on)
 {
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
   GList *images = imgs;
   while(images)
   {
@@ -110,13 +111,17 @@ static void _ratings_apply(GList *imgs, const int rating, GList **undo, const gb
       undoratings->imgid = image_id;
       undoratings->before = dt_ratings_get(image_id);
       undoratings->after = rating;
-      *undo = g_list_append(*undo, undoratings);
+      *undo = g_list_prepend(*undo, undoratings);
     }
 
     _ratings_apply_to_image(image_id, rating);
 
     images = g_list_next(images);
   }
+  dt_database_release_transaction(darktable.db, transaction);
+  if(undo_on) *undo = g_list_reverse(*undo);
+
+  dt_image_synch_xmps(imgs);
 }
 
 void dt_ratings_apply_on_list(const GList *img, const int rating, const gboolean undo_on)
@@ -0,0 +1,331 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/raw_cache.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "control/conf.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RAW_CACHE_MAGIC "DTRAWC01"
+// how much of the beginning and the end of a raw goes into its key
+#define RAW_CACHE_KEY_BYTES 65536
+// pixels start at a page boundary so the mapping can be read without realignment
+#define RAW_CACHE_DATA_OFFSET 4096
+
+// everything the raw loader sets on the image, stored in front of the pixels
+typedef struct _raw_cache_header_t
+{
+  char magic[8];
+  uint64_t data_size;
+  int32_t width, height;
+  int32_t crop_x, crop_y, crop_width, crop_height;
+  int32_t flags;
+  int32_t exif_inited;
+  uint32_t channels;
+  int32_t datatype;
+  uint32_t filters;
+  uint8_t xtrans[6][6];
+  float processed_maximum[4];
+  uint16_t raw_black_level;
+  uint16_t raw_black_level_separate[4];
+  uint32_t raw_white_point;
+  float wb_coeffs[4];
+  uint32_t fuji_rotation_pos;
+  float pixel_aspect_ratio;
+  char camera_maker[64];
+  char camera_model[64];
+  char camera_alias[64];
+  char camera_makermodel[128];
+  char camera_legacy_makermodel[128];
+} _raw_cache_header_t;
+
+// the flags that come from the loader rather than from the library
+#define RAW_CACHE_FLAGS                                                                                       \
+  (DT_IMAGE_LDR | DT_IMAGE_RAW | DT_IMAGE_HDR | DT_IMAGE_4BAYER | DT_IMAGE_MONOCHROME | DT_IMAGE_S_RAW)
+
+static size_t _cache_limit()
+{
+  const int mb = dt_conf_get_int("cache_raw_size");
+  return mb > 0 ? (size_t)mb << 20 : 0;
+}
+
+static void _cache_dir(char *dir, size_t bufsize)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  g_snprintf(dir, bufsize, "%s/raws", cachedir);
+}
+
+// cache file for filename, NULL if the raw can't be read
+static gchar *_cache_path(const char *filename)
+{
+  GStatBuf st;
+  if(g_stat(filename, &st)) return NULL;
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return NULL;
+
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(checksum, (const guchar *)darktable_package_version, strlen(darktable_package_version));
+  const int64_t size = st.st_size, mtime = st.st_mtime;
+  g_checksum_update(checksum, (const guchar *)&size, sizeof(size));
+  g_checksum_update(checksum, (const guchar *)&mtime, sizeof(mtime));
+
+  guchar *block = g_malloc(RAW_CACHE_KEY_BYTES);
+  size_t rd = fread(block, 1, RAW_CACHE_KEY_BYTES, f);
+  g_checksum_update(checksum, block, rd);
+  if(size > RAW_CACHE_KEY_BYTES && !fseek(f, -(long)MIN(size - RAW_CACHE_KEY_BYTES, RAW_CACHE_KEY_BYTES), SEEK_END))
+  {
+    rd = fread(block, 1, RAW_CACHE_KEY_BYTES, f);
+    g_checksum_update(checksum, block, rd);
+  }
+  g_free(block);
+  fclose(f);
+
+  char dir[PATH_MAX] = { 0 };
+  _cache_dir(dir, sizeof(dir));
+  gchar *path = g_strdup_printf("%s/%s.dtraw", dir, g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return path;
+}
+
+dt_imageio_retval_t dt_raw_cache_open(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf)
+{
+  if(!_cache_limit()) return DT_IMAGEIO_FILE_NOT_FOUND;
+
+  gchar *path = _cache_path(filename);
+  if(!path) return DT_IMAGEIO_FILE_NOT_FOUND;
+
+  GMappedFile *map = g_mapped_file_new(path, FALSE, NULL);
+  if(!map)
+  {
+    g_free(path);
+    return DT_IMAGEIO_FILE_NOT_FOUND;
+  }
+
+  dt_imageio_retval_t ret = DT_IMAGEIO_FILE_CORRUPTED;
+  const size_t length = g_mapped_file_get_length(map);
+  const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(map);
+  const _raw_cache_header_t *h = (const _raw_cache_header_t *)data;
+
+  if(length < RAW_CACHE_DATA_OFFSET || memcmp(h->magic, RAW_CACHE_MAGIC, sizeof(h->magic))
+     || h->data_size != length - RAW_CACHE_DATA_OFFSET)
+    goto done;
+
+  img->width = h->width;
+  img->height = h->height;
+  img->crop_x = h->crop_x;
+  img->crop_y = h->crop_y;
+  img->crop_width = h->crop_width;
+  img->crop_height = h->crop_height;
+  img->flags = (img->flags & ~RAW_CACHE_FLAGS) | (h->flags & RAW_CACHE_FLAGS);
+  img->exif_inited = h->exif_inited;
+  img->buf_dsc.channels = h->channels;
+  img->buf_dsc.datatype = h->datatype;
+  img->buf_dsc.filters = h->filters;
+  memcpy(img->buf_dsc.xtrans, h->xtrans, sizeof(h->xtrans));
+  memcpy(img->buf_dsc.processed_maximum, h->processed_maximum, sizeof(h->processed_maximum));
+  img->raw_black_level = h->raw_black_level;
+  memcpy(img->raw_black_level_separate, h->raw_black_level_separate, sizeof(h->raw_black_level_separate));
+  img->raw_white_point = h->raw_white_point;
+  memcpy(img->wb_coeffs, h->wb_coeffs, sizeof(h->wb_coeffs));
+  img->fuji_rotation_pos = h->fuji_rotation_pos;
+  img->pixel_aspect_ratio = h->pixel_aspect_ratio;
+  g_strlcpy(img->camera_maker, h->camera_maker, sizeof(img->camera_maker));
+  g_strlcpy(img->camera_model, h->camera_model, sizeof(img->camera_model));
+  g_strlcpy(img->camera_alias, h->camera_alias, sizeof(img->camera_alias));
+  g_strlcpy(img->camera_makermodel, h->camera_makermodel, sizeof(img->camera_makermodel));
+  g_strlcpy(img->camera_legacy_makermodel, h->camera_legacy_makermodel, sizeof(img->camera_legacy_makermodel));
+
+  if((size_t)img->width * img->height * dt_iop_buffer_dsc_to_bpp(&img->buf_dsc) != h->data_size) goto done;
+
+  void *out = dt_mipmap_cache_alloc(buf, img);
+  if(!out)
+  {
+    ret = DT_IMAGEIO_CACHE_FULL;
+    goto done;
+  }
+  memcpy(out, data + RAW_CACHE_DATA_OFFSET, h->data_size);
+  ret = DT_IMAGEIO_OK;
+
+  // keep the entry young for the lru eviction
+  g_utime(path, NULL);
+  dt_print(DT_DEBUG_CACHE, "[raw_cache] loaded `%s' from `%s'\n", filename, path);
+
+done:
+  if(ret == DT_IMAGEIO_FILE_CORRUPTED)
+  {
+    fprintf(stderr, "[raw_cache] `%s' is damaged, removing it\n", path);
+    g_unlink(path);
+  }
+  g_mapped_file_unref(map);
+  g_free(path);
+  return ret;
+}
+
+typedef struct _raw_cache_file_t
+{
+  gchar *path;
+  size_t size;
+  time_t mtime;
+} _raw_cache_file_t;
+
+static gint _sort_by_mtime(gconstpointer a, gconstpointer b)
+{
+  const _raw_cache_file_t *fa = (const _raw_cache_file_t *)a;
+  const _raw_cache_file_t *fb = (const _raw_cache_file_t *)b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+static void _raw_cache_file_free(gpointer data)
+{
+  _raw_cache_file_t *file = (_raw_cache_file_t *)data;
+  g_free(file->path);
+  g_free(file);
+}
+
+// drops the least recently used entries until incoming more bytes fit into the limit
+static void _cache_evict(const char *dir, const size_t limit, const size_t incoming)
+{
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return;
+
+  GList *files = NULL;
+  size_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    if(!g_str_has_suffix(name, ".dtraw")) continue;
+    GStatBuf st;
+    gchar *path = g_build_filename(dir, name, NULL);
+    if(g_stat(path, &st))
+    {
+      g_free(path);
+      continue;
+    }
+    _raw_cache_file_t *file = g_malloc(sizeof(_raw_cache_file_t));
+    file->path = path;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    files = g_list_prepend(files, file);
+    total += file->size;
+  }
+  g_dir_close(d);
+
+  files = g_list_sort(files, _sort_by_mtime);
+  for(GList *l = files; l && total + incoming > limit; l = g_list_next(l))
+  {
+    _raw_cache_file_t *file = (_raw_cache_file_t *)l->data;
+    if(!g_unlink(file->path)) total -= file->size;
+  }
+  g_list_free_full(files, _raw_cache_file_free);
+}
+
+void dt_raw_cache_store(const dt_image_t *img, const char *filename, const dt_mipmap_buffer_t *buf)
+{
+  const size_t limit = _cache_limit();
+  if(!limit || !buf->buf) return;
+
+  const size_t data_size = (size_t)img->width * img->height * dt_iop_buffer_dsc_to_bpp(&img->buf_dsc);
+  // a single raw that would push everything else out isn't worth keeping
+  if(data_size + RAW_CACHE_DATA_OFFSET > limit / 2) return;
+
+  gchar *path = _cache_path(filename);
+  if(!path) return;
+  if(g_file_test(path, G_FILE_TEST_EXISTS))
+  {
+    g_free(path);
+    return;
+  }
+
+  char dir[PATH_MAX] = { 0 };
+  _cache_dir(dir, sizeof(dir));
+  if(g_mkdir_with_parents(dir, 0750))
+  {
+    fprintf(stderr, "[raw_cache] can't create directory `%s'\n", dir);
+    g_free(path);
+    return;
+  }
+  _cache_evict(dir, limit, data_size + RAW_CACHE_DATA_OFFSET);
+
+  uint8_t *header = g_malloc0(RAW_CACHE_DATA_OFFSET);
+  _raw_cache_header_t *h = (_raw_cache_header_t *)header;
+  memcpy(h->magic, RAW_CACHE_MAGIC, sizeof(h->magic));
+  h->data_size = data_size;
+  h->width = img->width;
+  h->height = img->height;
+  h->crop_x = img->crop_x;
+  h->crop_y = img->crop_y;
+  h->crop_width = img->crop_width;
+  h->crop_height = img->crop_height;
+  h->flags = img->flags & RAW_CACHE_FLAGS;
+  h->exif_inited = img->exif_inited;
+  h->channels = img->buf_dsc.channels;
+  h->datatype = img->buf_dsc.datatype;
+  h->filters = img->buf_dsc.filters;
+  memcpy(h->xtrans, img->buf_dsc.xtrans, sizeof(h->xtrans));
+  memcpy(h->processed_maximum, img->buf_dsc.processed_maximum, sizeof(h->processed_maximum));
+  h->raw_black_level = img->raw_black_level;
+  memcpy(h->raw_black_level_separate, img->raw_black_level_separate, sizeof(h->raw_black_level_separate));
+  h->raw_white_point = img->raw_white_point;
+  memcpy(h->wb_coeffs, img->wb_coeffs, sizeof(h->wb_coeffs));
+  h->fuji_rotation_pos = img->fuji_rotation_pos;
+  h->pixel_aspect_ratio = img->pixel_aspect_ratio;
+  g_strlcpy(h->camera_maker, img->camera_maker, sizeof(h->camera_maker));
+  g_strlcpy(h->camera_model, img->camera_model, sizeof(h->camera_model));
+  g_strlcpy(h->camera_alias, img->camera_alias, sizeof(h->camera_alias));
+  g_strlcpy(h->camera_makermodel, img->camera_makermodel, sizeof(h->camera_makermodel));
+  g_strlcpy(h->camera_legacy_makermodel, img->camera_legacy_makermodel, sizeof(h->camera_legacy_makermodel));
+
+  // write to a private name first so concurrent decodes of the same raw and crashes never
+  // leave a half written entry behind
+  gchar *tmp = g_strdup_printf("%s.XXXXXX", path);
+  const int fd = g_mkstemp(tmp);
+  FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  gboolean written = FALSE;
+  if(f)
+  {
+    written = fwrite(header, 1, RAW_CACHE_DATA_OFFSET, f) == RAW_CACHE_DATA_OFFSET
+              && fwrite(buf->buf, 1, data_size, f) == data_size;
+    written = !fclose(f) && written;
+  }
+  else if(fd >= 0)
+    close(fd);
+
+  if(written && !g_rename(tmp, path))
+    dt_print(DT_DEBUG_CACHE, "[raw_cache] stored `%s' as `%s'\n", filename, path);
+  else
+  {
+    fprintf(stderr, "[raw_cache] can't write `%s': %s\n", path, g_strerror(errno));
+    g_unlink(tmp);
+  }
+
+  g_free(header);
+  g_free(tmp);
+  g_free(path);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,44 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/image.h"
+#include "common/imageio.h"
+#include "common/mipmap_cache.h"
+
+/**
+ * on-disk cache of decoded raw files. the unpacked sensor data that rawspeed hands to
+ * rawprepare is written uncompressed, together with the image fields the loader sets, to
+ * one file per raw in <cachedir>/raws. a later full-size open of the same file maps that
+ * file and copies the pixels into the mipmap buffer instead of decoding the raw again.
+ *
+ * entries are keyed by a checksum over the raw file's size, modification time and its
+ * first and last 64 kB, plus the darktable version so camera support updates invalidate
+ * them. the cache is disabled unless cache_raw_size gives it a size in megabytes, and the
+ * least recently used entries are dropped once it grows beyond that.
+ */
+
+/** fills img and buf from the cache. returns DT_IMAGEIO_OK on a hit, something else on a miss. */
+dt_imageio_retval_t dt_raw_cache_open(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
+/** stores the freshly decoded raw in buf for later opens of filename. */
+void dt_raw_cache_store(const dt_image_t *img, const char *filename, const dt_mipmap_buffer_t *buf);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
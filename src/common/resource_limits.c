@@ -16,11 +16,17 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for sched_getaffinity and pthread_setaffinity_np
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #include "common/resource_limits.h"
+#include "common/darktable.h"
+#include "control/conf.h"
 #include <assert.h>       // for assert
 #include <errno.h>        // for errno
 #include <stdint.h>       // for uintmax_t
@@ -28,6 +34,17 @@
 #include <string.h>       // for strerror
 #include <inttypes.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #ifdef _WIN32
 #include "win/rlimit.h"
 #else
@@ -77,6 +94,128 @@ void dt_set_rlimits()
   dt_set_rlimits_stack();
 }
 
+typedef enum dt_memory_numa_policy_t
+{
+  DT_MEMORY_NUMA_DEFAULT = 0, // leave it to the kernel: pages land where the allocating thread runs
+  DT_MEMORY_NUMA_FIRST_TOUCH, // prefault in parallel so every openmp thread owns the rows it works on
+  DT_MEMORY_NUMA_INTERLEAVE   // spread the pages round robin over all nodes
+} dt_memory_numa_policy_t;
+
+static dt_memory_numa_policy_t _numa_policy = DT_MEMORY_NUMA_DEFAULT;
+static int _hugepages = 0;
+static int _numa_nodes = 1;
+
+// buffers smaller than this are left alone, the policy only pays off for full images
+#define DT_MEMORY_POLICY_MIN_SIZE ((size_t)16 << 20)
+
+#if defined(__linux__)
+// MPOL_INTERLEAVE from linux/mempolicy.h, spelled out to not depend on libnuma
+#define DT_MPOL_INTERLEAVE 3
+
+static int _numa_node_count()
+{
+  FILE *f = fopen("/sys/devices/system/node/online", "r");
+  if(!f) return 1;
+  // the format is a list of ranges like "0-1" or "0,2-3", we only need the highest node
+  int last = 0, n = 0;
+  char c = 0;
+  while(fscanf(f, "%d", &n) == 1)
+  {
+    last = MAX(last, n);
+    if(fscanf(f, "%c", &c) != 1) break;
+  }
+  fclose(f);
+  return last + 1;
+}
+
+static void _pin_openmp_threads()
+{
+#ifdef _OPENMP
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed)) return;
+  const int ncpus = CPU_COUNT(&allowed);
+  if(ncpus <= 1) return;
+
+  int cpus[CPU_SETSIZE];
+  int k = 0;
+  for(int i = 0; i < CPU_SETSIZE && k < ncpus; i++)
+    if(CPU_ISSET(i, &allowed)) cpus[k++] = i;
+
+  // the runtime keeps its threads, so thread i of every later static schedule runs on cpus[i]
+  // and finds the pages it touched first on its own node.
+#pragma omp parallel default(none) shared(cpus, k)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[omp_get_thread_num() % k], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+}
+#endif
+
+void dt_configure_memory_policy()
+{
+  gchar *policy = dt_conf_get_string("memory_numa_policy");
+  _hugepages = dt_conf_get_bool("memory_hugepages");
+  _numa_policy = DT_MEMORY_NUMA_DEFAULT;
+  if(!g_strcmp0(policy, "first touch")) _numa_policy = DT_MEMORY_NUMA_FIRST_TOUCH;
+  else if(!g_strcmp0(policy, "interleave")) _numa_policy = DT_MEMORY_NUMA_INTERLEAVE;
+  g_free(policy);
+
+#if defined(__linux__)
+  _numa_nodes = _numa_node_count();
+  // on a single node there is nothing to place
+  if(_numa_nodes <= 1) _numa_policy = DT_MEMORY_NUMA_DEFAULT;
+  if(_numa_policy == DT_MEMORY_NUMA_FIRST_TOUCH) _pin_openmp_threads();
+#else
+  _numa_policy = DT_MEMORY_NUMA_DEFAULT;
+  _hugepages = 0;
+#endif
+
+  dt_print(DT_DEBUG_MEMORY, "[memory policy] %d numa nodes, policy `%s', huge pages %s\n", _numa_nodes,
+           _numa_policy == DT_MEMORY_NUMA_FIRST_TOUCH ? "first touch"
+           : _numa_policy == DT_MEMORY_NUMA_INTERLEAVE ? "interleave" : "default",
+           _hugepages ? "on" : "off");
+}
+
+void dt_memory_policy_apply(void *mem, size_t size)
+{
+#if defined(__linux__)
+  if(!mem || size < DT_MEMORY_POLICY_MIN_SIZE) return;
+  if(_numa_policy == DT_MEMORY_NUMA_DEFAULT && !_hugepages) return;
+
+  // madvise and mbind want whole pages
+  const size_t page = sysconf(_SC_PAGESIZE);
+  char *const start = (char *)(((uintptr_t)mem + page - 1) & ~(uintptr_t)(page - 1));
+  const size_t length = (((char *)mem + size) - start) & ~(page - 1);
+
+#ifdef MADV_HUGEPAGE
+  if(_hugepages) madvise(start, length, MADV_HUGEPAGE);
+#endif
+
+  if(_numa_policy == DT_MEMORY_NUMA_INTERLEAVE)
+  {
+    unsigned long mask[4] = { 0 };
+    const int nodes = MIN(_numa_nodes, (int)(8 * sizeof(mask)));
+    for(int n = 0; n < nodes; n++) mask[n / (8 * sizeof(unsigned long))] |= 1ul << (n % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_mbind, start, length, DT_MPOL_INTERLEAVE, mask, nodes + 1, 0))
+      dt_print(DT_DEBUG_MEMORY, "[memory policy] mbind failed: %s\n", strerror(errno));
+  }
+  else if(_numa_policy == DT_MEMORY_NUMA_FIRST_TOUCH)
+  {
+    // split the buffer the way a static schedule over rows would and let every thread fault in its share
+    const size_t npages = length / page;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(start) firstprivate(npages, page) schedule(static)
+#endif
+    for(size_t k = 0; k < npages; k++) start[k * page] = 0;
+  }
+#endif
+}
+
+#undef DT_MEMORY_POLICY_MIN_SIZE
+
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
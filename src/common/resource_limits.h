@@ -18,8 +18,15 @@
 
 #pragma once
 
+#include <stddef.h>
+
 void dt_set_rlimits();
 
+// read the numa and huge page preferences and pin the openmp threads to match. needs the config.
+void dt_configure_memory_policy();
+// place a freshly allocated buffer according to the memory policy. cheap no-op for small buffers.
+void dt_memory_policy_apply(void *mem, size_t size);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
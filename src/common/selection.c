@@ -19,6 +19,7 @@
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/database.h"
 #include "common/image_cache.h"
 #include "control/signal.h"
 #include "gui/gtk.h"
@@ -31,8 +32,69 @@ typedef struct dt_selection_t
   /* this stores the last single clicked image id indicating
      the start of a selection range */
   uint32_t last_single_id;
+
+  /* one bit per image id mirroring main.selected_images, for membership tests without a query.
+     bulk changes only invalidate it, it is read back from the table on the next test */
+  uint64_t *bits;
+  size_t words;
+  gboolean valid;
 } dt_selection_t;
 
+static void _bits_set(dt_selection_t *selection, const uint32_t imgid, const gboolean selected)
+{
+  const size_t word = imgid / 64;
+  if(word >= selection->words)
+  {
+    if(!selected) return;
+    const size_t words = MAX(word + 1, 2 * selection->words);
+    selection->bits = g_renew(uint64_t, selection->bits, words);
+    memset(selection->bits + selection->words, 0, sizeof(uint64_t) * (words - selection->words));
+    selection->words = words;
+  }
+  if(selected)
+    selection->bits[word] |= (uint64_t)1 << (imgid % 64);
+  else
+    selection->bits[word] &= ~((uint64_t)1 << (imgid % 64));
+}
+
+static void _bits_clear(dt_selection_t *selection)
+{
+  if(selection->bits) memset(selection->bits, 0, sizeof(uint64_t) * selection->words);
+  selection->valid = TRUE;
+}
+
+static void _bits_reload(dt_selection_t *selection)
+{
+  _bits_clear(selection);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images", -1, &stmt,
+                              NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int imgid = sqlite3_column_int(stmt, 0);
+    if(imgid > 0) _bits_set(selection, imgid, TRUE);
+  }
+  sqlite3_finalize(stmt);
+}
+
+gboolean dt_selection_is_selected(struct dt_selection_t *selection, const int32_t imgid)
+{
+  if(imgid <= 0) return FALSE;
+  if(!selection->valid) _bits_reload(selection);
+  const size_t word = (uint32_t)imgid / 64;
+  return word < selection->words && (selection->bits[word] >> (imgid % 64)) & 1;
+}
+
+void dt_selection_invalidate(struct dt_selection_t *selection)
+{
+  if(selection) selection->valid = FALSE;
+}
+
+void dt_selection_mark(struct dt_selection_t *selection, const int32_t imgid, const gboolean selected)
+{
+  if(selection && imgid > 0) _bits_set(selection, imgid, selected);
+}
+
 const dt_collection_t *dt_selection_get_collection(struct dt_selection_t *selection)
 {
   return selection->collection;
@@ -58,6 +120,7 @@ static void _selection_select(dt_selection_t *selection, uint32_t imgid)
          || !selection->collection)
       {
         query = dt_util_dstrcat(query, "INSERT OR IGNORE INTO main.selected_images VALUES (%d)", imgid);
+        _bits_set(selection, imgid, TRUE);
       }
       else
       {
@@ -67,6 +130,7 @@ static void _selection_select(dt_selection_t *selection, uint32_t imgid)
                                 "  FROM main.images "
                                 "  WHERE group_id = %d AND id IN (%s)",
                                 img_group_id, dt_collection_get_query_no_group(selection->collection));
+        selection->valid = FALSE;
       }
 
       DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
@@ -124,6 +188,7 @@ const dt_selection_t *dt_selection_new()
 
 void dt_selection_free(dt_selection_t *selection)
 {
+  g_free(selection->bits);
   g_free(selection);
 }
 
@@ -136,6 +201,8 @@ void dt_selection_invert(dt_selection_t *selection)
   fullq = dt_util_dstrcat(fullq, "%s", "INSERT OR IGNORE INTO main.selected_images ");
   fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query(selection->collection));
 
+  // one transaction for all of it, large collections otherwise pay for every statement on its own
+  const gboolean started = dt_database_start_transaction(darktable.db);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "INSERT INTO memory.tmp_selection SELECT imgid FROM main.selected_images", NULL, NULL,
                         NULL);
@@ -145,6 +212,8 @@ void dt_selection_invert(dt_selection_t *selection)
                         "DELETE FROM main.selected_images WHERE imgid IN (SELECT imgid FROM memory.tmp_selection)",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tmp_selection", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db, started);
+  selection->valid = FALSE;
 
   g_free(fullq);
 
@@ -154,9 +223,10 @@ void dt_selection_invert(dt_selection_t *selection)
   dt_collection_hint_message(darktable.collection);
 }
 
-void dt_selection_clear(const dt_selection_t *selection)
+void dt_selection_clear(dt_selection_t *selection)
 {
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
+  _bits_clear(selection);
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
 
@@ -187,12 +257,14 @@ void dt_selection_deselect(dt_selection_t *selection, uint32_t imgid)
       if(!darktable.gui || !darktable.gui->grouping || darktable.gui->expanded_group_id == img_group_id)
       {
         query = dt_util_dstrcat(query, "DELETE FROM main.selected_images WHERE imgid = %d", imgid);
+        _bits_set(selection, imgid, FALSE);
       }
       else
       {
         query = dt_util_dstrcat(query, "DELETE FROM main.selected_images WHERE imgid IN "
                                        "(SELECT id FROM main.images WHERE group_id = %d)",
                                 img_group_id);
+        selection->valid = FALSE;
       }
 
       DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
@@ -210,25 +282,15 @@ void dt_selection_select_single(dt_selection_t *selection, uint32_t imgid)
 {
   selection->last_single_id = imgid;
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
+  _bits_clear(selection);
   dt_selection_select(selection, imgid);
 }
 
 void dt_selection_toggle(dt_selection_t *selection, uint32_t imgid)
 {
-  sqlite3_stmt *stmt;
-  gboolean exists = FALSE;
-
   if(imgid == -1) return;
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid FROM main.selected_images WHERE imgid=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-
-  if(sqlite3_step(stmt) == SQLITE_ROW) exists = TRUE;
-
-  sqlite3_finalize(stmt);
-
-  if(exists)
+  if(dt_selection_is_selected(selection, imgid))
   {
     dt_selection_deselect(selection, imgid);
   }
@@ -253,8 +315,11 @@ void dt_selection_select_all(dt_selection_t *selection)
   fullq = dt_util_dstrcat(fullq, "%s", "INSERT OR IGNORE INTO main.selected_images ");
   fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query_no_group(selection->collection));
 
+  const gboolean started = dt_database_start_transaction(darktable.db);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq, NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db, started);
+  selection->valid = FALSE;
 
   selection->last_single_id = -1;
 
@@ -311,6 +376,7 @@ void dt_selection_select_range(dt_selection_t *selection, uint32_t imgid)
 
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  selection->valid = FALSE;
 
   /* reset filter */
   dt_collection_set_query_flags(selection->collection, old_flags);
@@ -325,6 +391,7 @@ void dt_selection_select_range(dt_selection_t *selection, uint32_t imgid)
 
 void dt_selection_select_filmroll(dt_selection_t *selection)
 {
+  const gboolean started = dt_database_start_transaction(darktable.db);
   // clear at start, too, just to be sure:
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tmp_selection", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
@@ -337,6 +404,8 @@ void dt_selection_select_filmroll(dt_selection_t *selection)
                         "b ON a.id = b.imgid)",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tmp_selection", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db, started);
+  selection->valid = FALSE;
 
   dt_collection_update(selection->collection);
 
@@ -361,8 +430,11 @@ void dt_selection_select_unaltered(dt_selection_t *selection)
 
 
   /* clean current selection and select unaltered images */
+  const gboolean started = dt_database_start_transaction(darktable.db);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq, NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db, started);
+  selection->valid = FALSE;
 
   /* restore collection filter and update query */
   dt_collection_set_filter_flags(selection->collection, old_filter_flags);
@@ -385,6 +457,7 @@ void dt_selection_select_list(struct dt_selection_t *selection, GList *list)
     int imgid = GPOINTER_TO_INT(list->data);
     selection->last_single_id = imgid;
     query = dt_util_dstrcat(query, "INSERT OR IGNORE INTO main.selected_images VALUES (%d)", imgid);
+    if(imgid > 0) _bits_set(selection, imgid, TRUE);
     list = g_list_next(list);
     while(list && count < 400)
     {
@@ -392,6 +465,7 @@ void dt_selection_select_list(struct dt_selection_t *selection, GList *list)
       count++;
       selection->last_single_id = imgid;
       query = dt_util_dstrcat(query, ",(%d)", imgid);
+      if(imgid > 0) _bits_set(selection, imgid, TRUE);
       list = g_list_next(list);
     }
     char *result = NULL;
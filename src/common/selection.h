@@ -48,6 +48,12 @@ void dt_selection_select_filmroll(struct dt_selection_t *selection);
 void dt_selection_select_unaltered(struct dt_selection_t *selection);
 /** selects a set of images from a list. the list is unaltered */
 void dt_selection_select_list(struct dt_selection_t *selection, GList *list);
+/** tells if imgid is selected, without a query once the selection is known. gui thread only */
+gboolean dt_selection_is_selected(struct dt_selection_t *selection, const int32_t imgid);
+/** to be called after main.selected_images was written outside of these functions */
+void dt_selection_invalidate(struct dt_selection_t *selection);
+/** same for a single image added to or removed from main.selected_images */
+void dt_selection_mark(struct dt_selection_t *selection, const int32_t imgid, const gboolean selected);
 /** selects a set of images from a list. the list is unaltered */
 const struct dt_collection_t *dt_selection_get_collection(struct dt_selection_t *selection);
 
@@ -0,0 +1,102 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * portable 4-wide float vectors, built on the vector extensions of gcc and clang.
+ *
+ * the compiler lowers these to sse on amd64, to neon on arm64 and to altivec/vsx on ppc64le, so a
+ * kernel written against this header is vectorised on every platform we support, unlike the __m128
+ * intrinsics which leave the other platforms with the scalar fallback. arithmetic operators work
+ * element-wise on the vector types directly, comparisons yield a dt_simd4i mask of -1/0 lanes.
+ */
+
+typedef float dt_simd4f __attribute__((vector_size(16)));
+typedef int32_t dt_simd4i __attribute__((vector_size(16)));
+
+static inline dt_simd4f dt_simd4f_set1(const float f)
+{
+  return (dt_simd4f){ f, f, f, f };
+}
+
+static inline dt_simd4f dt_simd4f_zero()
+{
+  return (dt_simd4f){ 0.0f, 0.0f, 0.0f, 0.0f };
+}
+
+/** p has to be 16 byte aligned */
+static inline dt_simd4f dt_simd4f_load(const float *const p)
+{
+  return *(const dt_simd4f *)p;
+}
+
+static inline dt_simd4f dt_simd4f_loadu(const float *const p)
+{
+  dt_simd4f v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/** p has to be 16 byte aligned */
+static inline void dt_simd4f_store(float *const p, const dt_simd4f v)
+{
+  *(dt_simd4f *)p = v;
+}
+
+/** per lane mask ? a : b */
+static inline dt_simd4f dt_simd4f_select(const dt_simd4i mask, const dt_simd4f a, const dt_simd4f b)
+{
+  return (dt_simd4f)((mask & (dt_simd4i)a) | (~mask & (dt_simd4i)b));
+}
+
+static inline dt_simd4f dt_simd4f_min(const dt_simd4f a, const dt_simd4f b)
+{
+  return dt_simd4f_select(a < b, a, b);
+}
+
+static inline dt_simd4f dt_simd4f_max(const dt_simd4f a, const dt_simd4f b)
+{
+  return dt_simd4f_select(a > b, a, b);
+}
+
+static inline dt_simd4f dt_simd4f_clamp(const dt_simd4f v, const dt_simd4f lo, const dt_simd4f hi)
+{
+  return dt_simd4f_min(dt_simd4f_max(v, lo), hi);
+}
+
+static inline dt_simd4f dt_simd4f_abs(const dt_simd4f v)
+{
+  const int32_t m = 0x7fffffff;
+  return (dt_simd4f)((dt_simd4i)v & (dt_simd4i){ m, m, m, m });
+}
+
+/** converts to int, truncating. written per lane, compilers turn this into a single instruction */
+static inline dt_simd4i dt_simd4f_to_int(const dt_simd4f v)
+{
+  dt_simd4i r;
+  for(int k = 0; k < 4; k++) r[k] = (int32_t)v[k];
+  return r;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
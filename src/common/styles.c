@@ -576,6 +576,11 @@ void dt_styles_apply_to_list(const char *name, GList *list, gboolean duplicate)
 
   const int mode = dt_conf_get_int("plugins/lighttable/style/applymode");
 
+  // the style is read once and the whole selection written in one transaction
+  dt_style_apply_t style;
+  const gboolean found = _style_apply_init(&style, name);
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
+
   /* for each selected image apply style */
   dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
   GList *l = g_list_first(list);
@@ -584,12 +589,15 @@ void dt_styles_apply_to_list(const char *name, GList *list, gboolean duplicate)
     const int imgid = GPOINTER_TO_INT(l->data);
     if(mode == DT_STYLE_HISTORY_OVERWRITE)
       dt_history_delete_on_image_ext(imgid, FALSE);
-    dt_styles_apply_to_image(name, duplicate, imgid);
+    if(found) _style_apply_to_image(&style, duplicate, imgid);
     selected = TRUE;
     l = g_list_next(l);
   }
   dt_undo_end_group(darktable.undo);
 
+  dt_database_release_transaction(darktable.db, transaction);
+  if(found) _style_apply_cleanup(&style);
+
   if(!selected) dt_control_log(_("no image selected!"));
 }
 
@@ -707,153 +715,178 @@ void dt_styles_apply_style_item(dt_develop_t *dev, dt_style_item_t *style_item,
   }
 }
 
-void dt_styles_apply_to_image(const char *name, const gboolean duplicate, const int32_t imgid)
+// a style read from the database once, to be applied to one or several images
+typedef struct dt_style_apply_t
+{
+  int id;
+  const char *name;
+  GList *iop_list;
+  GList *items;
+} dt_style_apply_t;
+
+static gboolean _style_apply_init(dt_style_apply_t *style, const char *name)
 {
-  int id = 0;
   sqlite3_stmt *stmt;
 
-  if((id = dt_styles_get_id_by_name(name)) != 0)
+  memset(style, 0, sizeof(dt_style_apply_t));
+  if((style->id = dt_styles_get_id_by_name(name)) == 0) return FALSE;
+  style->name = name;
+  style->iop_list = dt_styles_module_order_list(name);
+
+  // go through all entries in style
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT num, module, operation, op_params, enabled,"
+                              "  blendop_params, blendop_version, multi_priority, multi_name"
+                              " FROM data.style_items WHERE styleid=?1 "
+                              " ORDER BY operation, multi_priority",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, style->id);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    int32_t newimgid;
-    /* check if we should make a duplicate before applying style */
-    if(duplicate)
-    {
-      newimgid = dt_image_duplicate(imgid);
-      if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE);
-    }
-    else
-      newimgid = imgid;
+    dt_style_item_t *style_item = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
+
+    style_item->num = sqlite3_column_int(stmt, 0);
+    style_item->selimg_num = 0;
+    style_item->enabled = sqlite3_column_int(stmt, 4);
+    style_item->multi_priority = sqlite3_column_int(stmt, 7);
+    style_item->name = NULL;
+    style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
+    style_item->multi_name = g_strdup((char *)sqlite3_column_text(stmt, 8));
+    style_item->module_version = sqlite3_column_int(stmt, 1);
+    style_item->blendop_version = sqlite3_column_int(stmt, 6);
+    style_item->params_size = sqlite3_column_bytes(stmt, 3);
+    style_item->params = (void *)malloc(style_item->params_size);
+    memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3), style_item->params_size);
+    style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
+    style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
+    memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5), style_item->blendop_params_size);
+    style_item->iop_order = 0;
+
+    style->items = g_list_prepend(style->items, style_item);
+  }
+  sqlite3_finalize(stmt);
+  style->items = g_list_reverse(style->items);
 
-    // now deal with the history
-    GList *modules_used = NULL;
+  return TRUE;
+}
 
-    dt_develop_t _dev_dest = { 0 };
+static void _style_apply_cleanup(dt_style_apply_t *style)
+{
+  g_list_free_full(style->iop_list, g_free);
+  g_list_free_full(style->items, dt_style_item_free);
+  style->iop_list = style->items = NULL;
+}
 
-    dt_develop_t *dev_dest = &_dev_dest;
+static void _style_apply_to_image(const dt_style_apply_t *style, const gboolean duplicate, const int32_t imgid)
+{
+  int32_t newimgid;
+  /* check if we should make a duplicate before applying style */
+  if(duplicate)
+  {
+    newimgid = dt_image_duplicate(imgid);
+    if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE);
+  }
+  else
+    newimgid = imgid;
 
-    dt_dev_init(dev_dest, FALSE);
+  // now deal with the history
+  GList *modules_used = NULL;
 
-    dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+  dt_develop_t _dev_dest = { 0 };
 
-    GList *iop_list = dt_styles_module_order_list(name);
-    if(iop_list)
-    {
-      dt_ioppr_write_iop_order_list(iop_list, newimgid);
-      g_list_free_full(iop_list, g_free);
-    }
+  dt_develop_t *dev_dest = &_dev_dest;
 
-    dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
+  dt_dev_init(dev_dest, FALSE);
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
 
-    dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
+  if(style->iop_list) dt_ioppr_write_iop_order_list(style->iop_list, newimgid);
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
+  dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
 
-    if (DT_IOP_ORDER_INFO)
-      fprintf(stderr,"\n^^^^^ Apply style on image %i, history size %i",imgid,dev_dest->history_end);
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
 
-    // go through all entries in style
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT num, module, operation, op_params, enabled,"
-                                "  blendop_params, blendop_version, multi_priority, multi_name"
-                                " FROM data.style_items WHERE styleid=?1 "
-                                " ORDER BY operation, multi_priority",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    GList *si_list = NULL;
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      dt_style_item_t *style_item = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
-
-      style_item->num = sqlite3_column_int(stmt, 0);
-      style_item->selimg_num = 0;
-      style_item->enabled = sqlite3_column_int(stmt, 4);
-      style_item->multi_priority = sqlite3_column_int(stmt, 7);
-      style_item->name = NULL;
-      style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
-      style_item->multi_name = g_strdup((char *)sqlite3_column_text(stmt, 8));
-      style_item->module_version = sqlite3_column_int(stmt, 1);
-      style_item->blendop_version = sqlite3_column_int(stmt, 6);
-      style_item->params_size = sqlite3_column_bytes(stmt, 3);
-      style_item->params = (void *)malloc(style_item->params_size);
-      memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3), style_item->params_size);
-      style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
-      style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
-      memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5), style_item->blendop_params_size);
-      style_item->iop_order = 0;
-
-      si_list = g_list_append(si_list, style_item);
-    }
-    sqlite3_finalize(stmt);
+  dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
 
-    dt_ioppr_update_for_style_items(dev_dest, si_list, FALSE);
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
 
-    GList *l = si_list;
-    while(l)
-    {
-      dt_style_item_t *style_item = (dt_style_item_t *)l->data;
-      dt_styles_apply_style_item(dev_dest, style_item, &modules_used, FALSE);
-      l = g_list_next(l);
-    }
+  if (DT_IOP_ORDER_INFO)
+    fprintf(stderr,"\n^^^^^ Apply style on image %i, history size %i",imgid,dev_dest->history_end);
 
-    g_list_free_full(si_list, dt_style_item_free);
+  dt_ioppr_update_for_style_items(dev_dest, style->items, FALSE);
 
-    if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv --> look for written history below\n");
+  GList *l = style->items;
+  while(l)
+  {
+    dt_style_item_t *style_item = (dt_style_item_t *)l->data;
+    dt_styles_apply_style_item(dev_dest, style_item, &modules_used, FALSE);
+    l = g_list_next(l);
+  }
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
+  if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv --> look for written history below\n");
 
-    dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
-    hist->imgid = newimgid;
-    dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
 
-    // write history and forms to db
-    dt_dev_write_history_ext(dev_dest, newimgid);
+  dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
+  hist->imgid = newimgid;
+  dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
 
-    dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
-    dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-    dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
-                   dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
-    dt_undo_end_group(darktable.undo);
+  // write history and forms to db
+  dt_dev_write_history_ext(dev_dest, newimgid);
 
-    dt_dev_cleanup(dev_dest);
+  dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
+  dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+  dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
+                 dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
+  dt_undo_end_group(darktable.undo);
 
-    g_list_free(modules_used);
+  dt_dev_cleanup(dev_dest);
 
-    /* add tag */
-    guint tagid = 0;
-    gchar ntag[512] = { 0 };
-    g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
-    if(dt_tag_new(ntag, &tagid)) dt_tag_attach_from_gui(tagid, newimgid, FALSE, FALSE);
-    if(dt_tag_new("darktable|changed", &tagid))
-    {
-      dt_tag_attach_from_gui(tagid, newimgid, FALSE, FALSE);
-      dt_image_cache_set_change_timestamp(darktable.image_cache, imgid);
-    }
+  g_list_free(modules_used);
 
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items(darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-      dt_dev_modules_update_multishow(darktable.develop);
-    }
+  /* add tag */
+  guint tagid = 0;
+  gchar ntag[512] = { 0 };
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", style->name);
+  if(dt_tag_new(ntag, &tagid)) dt_tag_attach_from_gui(tagid, newimgid, FALSE, FALSE);
+  if(dt_tag_new("darktable|changed", &tagid))
+  {
+    dt_tag_attach_from_gui(tagid, newimgid, FALSE, FALSE);
+    dt_image_cache_set_change_timestamp(darktable.image_cache, imgid);
+  }
 
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
+  /* if current image in develop reload history */
+  if(dt_dev_is_current_image(darktable.develop, newimgid))
+  {
+    dt_dev_reload_history_items(darktable.develop);
+    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    dt_dev_modules_update_multishow(darktable.develop);
+  }
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
-    dt_image_reset_final_size(newimgid);
+  /* update xmp file */
+  dt_image_synch_xmp(newimgid);
 
-    /* update the aspect ratio. recompute only if really needed for performance reasons */
-    if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
-      dt_image_set_aspect_ratio(newimgid, TRUE);
-    else
-      dt_image_reset_aspect_ratio(newimgid, TRUE);
+  /* remove old obsolete thumbnails */
+  dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+  dt_image_reset_final_size(newimgid);
 
-    /* redraw center view to update visible mipmaps */
-    dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
+  /* update the aspect ratio. recompute only if really needed for performance reasons */
+  if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
+    dt_image_set_aspect_ratio(newimgid, TRUE);
+  else
+    dt_image_reset_aspect_ratio(newimgid, TRUE);
+
+  /* redraw center view to update visible mipmaps */
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
+}
+
+void dt_styles_apply_to_image(const char *name, const gboolean duplicate, const int32_t imgid)
+{
+  dt_style_apply_t style;
+  if(_style_apply_init(&style, name))
+  {
+    _style_apply_to_image(&style, duplicate, imgid);
+    _style_apply_cleanup(&style);
   }
 }
 
@@ -381,6 +381,7 @@ static GList *_tag_get_tags(const gint imgid, const dt_tag_type_t type);
 static void _tag_execute(const GList *tags, const GList *imgs,
                          GList **undo, const gboolean undo_on, const gint action)
 {
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
   const GList *images = imgs;
   while(images)
   {
@@ -413,11 +414,13 @@ static void _tag_execute(const GList *tags, const GList *imgs,
     }
     _pop_undo_execute(image_id, undotags->before, undotags->after);
     if(undo_on)
-      *undo = g_list_append(*undo, undotags);
+      *undo = g_list_prepend(*undo, undotags);
     else
       _undo_tags_free(undotags);
     images = g_list_next(images);
   }
+  dt_database_release_transaction(darktable.db, transaction);
+  if(undo_on) *undo = g_list_reverse(*undo);
 }
 
 gboolean dt_tag_attach_images(const guint tagid, const GList *img, const gboolean undo_on, const gboolean group_on)
@@ -1218,9 +1221,7 @@ uint32_t dt_tag_images_count(gint tagid)
   sqlite3_stmt *stmt;
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(DISTINCT imgid) AS imgnb"
-                              " FROM main.tagged_images"
-                              " WHERE tagid = ?1",
+                              "SELECT count FROM main.tag_counts WHERE tagid = ?1",
                               -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
   sqlite3_step(stmt);
@@ -1235,23 +1236,13 @@ uint32_t dt_tag_get_with_usage(GList **result)
 
   dt_set_darktable_tags();
 
-  /* Select tags that are similar to the keyword and are actually used to tag images*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO memory.taglist (id, count)"
-                              "  SELECT tagid, COUNT(*)"
-                              "  FROM main.tagged_images"
-                              "  GROUP BY tagid",
-                              -1, &stmt, NULL);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
   const uint32_t nb_selected = dt_selected_images_count();
 
-  /* Now put all the bits together */
+  /* Now put all the bits together, the usage of each tag is kept in tag_counts */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT T.name, T.id, MT.count, CT.imgnb, T.flags, T.synonyms"
                               "  FROM data.tags T "
-                              "  LEFT JOIN memory.taglist MT ON MT.id = T.id "
+                              "  LEFT JOIN main.tag_counts MT ON MT.tagid = T.id "
                               "  LEFT JOIN (SELECT tagid, COUNT(DISTINCT imgid) AS imgnb"
                               "             FROM main.tagged_images "
                               "             WHERE imgid IN (SELECT imgid FROM main.selected_images) GROUP BY tagid) AS CT "
@@ -1281,7 +1272,6 @@ uint32_t dt_tag_get_with_usage(GList **result)
   }
 
   sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.taglist", NULL, NULL, NULL);
 
   return count;
 }
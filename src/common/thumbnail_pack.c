@@ -0,0 +1,367 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/thumbnail_pack.h"
+#include "common/darktable.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DT_THUMBNAIL_PACK_MAGIC "DTTPIDX2"
+#define DT_THUMBNAIL_PACK_MAGIC_V1 "DTTPIDX1"
+// don't bother compacting less garbage than this
+#define DT_THUMBNAIL_PACK_MIN_GARBAGE ((size_t)16 << 20)
+
+// one record of the index file, little endian as written by the machine that made the cache
+typedef struct _pack_record_t
+{
+  uint32_t imgid;
+  int32_t color_space;
+  uint64_t offset;
+  uint32_t length; // 0 for a removed thumbnail
+  uint32_t codec;  // how the blob is encoded, see dt_thumbnail_codec_t
+  int64_t mtime;   // seconds since the epoch when the blob was written
+} _pack_record_t;
+
+// the first version had no mtime
+typedef struct _pack_record_v1_t
+{
+  uint32_t imgid;
+  int32_t color_space;
+  uint64_t offset;
+  uint32_t length;
+  uint32_t codec;
+} _pack_record_v1_t;
+
+struct dt_thumbnail_pack_t
+{
+  dt_pthread_mutex_t lock;
+  gchar *pack_path, *idx_path;
+  FILE *pack_f, *idx_f; // both opened for appending
+  GMappedFile *map;     // read-only view of the pack, refreshed when it grew
+  size_t map_size;
+  size_t pack_size;
+  size_t live;          // bytes of blobs still referenced
+  GHashTable *index;    // imgid -> _pack_record_t
+};
+
+static gboolean _pack_compact(dt_thumbnail_pack_t *pack);
+
+static void _pack_unmap(dt_thumbnail_pack_t *pack)
+{
+  if(pack->map) g_mapped_file_unref(pack->map);
+  pack->map = NULL;
+  pack->map_size = 0;
+}
+
+static gboolean _pack_remap(dt_thumbnail_pack_t *pack)
+{
+  _pack_unmap(pack);
+  if(pack->pack_f) fflush(pack->pack_f);
+  pack->map = g_mapped_file_new(pack->pack_path, FALSE, NULL);
+  if(!pack->map) return FALSE;
+  pack->map_size = g_mapped_file_get_length(pack->map);
+  return TRUE;
+}
+
+static void _pack_add_record(dt_thumbnail_pack_t *pack, const _pack_record_t *r)
+{
+  // a record whose blob didn't make it to disk before a crash
+  if(r->length && r->offset + r->length > pack->pack_size) return;
+  _pack_record_t *old = g_hash_table_lookup(pack->index, GUINT_TO_POINTER(r->imgid));
+  if(old)
+  {
+    pack->live -= old->length;
+    g_hash_table_remove(pack->index, GUINT_TO_POINTER(r->imgid));
+  }
+  if(!r->length) return;
+  g_hash_table_insert(pack->index, GUINT_TO_POINTER(r->imgid), g_memdup(r, sizeof(_pack_record_t)));
+  pack->live += r->length;
+}
+
+// returns FALSE if the index can't be used, sets *outdated if it has to be rewritten in the current format
+static gboolean _pack_load_index(dt_thumbnail_pack_t *pack, gboolean *outdated)
+{
+  gchar *contents = NULL;
+  gsize length = 0;
+  *outdated = FALSE;
+  if(!g_file_get_contents(pack->idx_path, &contents, &length, NULL))
+  {
+    // a new store
+    FILE *f = g_fopen(pack->idx_path, "wb");
+    if(!f) return FALSE;
+    const gboolean ok = fwrite(DT_THUMBNAIL_PACK_MAGIC, 8, 1, f) == 1;
+    fclose(f);
+    return ok;
+  }
+  if(length >= 8 && !memcmp(contents, DT_THUMBNAIL_PACK_MAGIC, 8))
+  {
+    const size_t n = (length - 8) / sizeof(_pack_record_t);
+    const _pack_record_t *records = (const _pack_record_t *)(contents + 8);
+    for(size_t k = 0; k < n; k++) _pack_add_record(pack, records + k);
+  }
+  else if(length >= 8 && !memcmp(contents, DT_THUMBNAIL_PACK_MAGIC_V1, 8))
+  {
+    const size_t n = (length - 8) / sizeof(_pack_record_v1_t);
+    const _pack_record_v1_t *records = (const _pack_record_v1_t *)(contents + 8);
+    for(size_t k = 0; k < n; k++)
+    {
+      const _pack_record_t r = { .imgid = records[k].imgid, .color_space = records[k].color_space,
+                                 .offset = records[k].offset, .length = records[k].length,
+                                 .codec = records[k].codec, .mtime = 0 };
+      _pack_add_record(pack, &r);
+    }
+    *outdated = TRUE;
+  }
+  else
+  {
+    fprintf(stderr, "[thumbnail_pack] `%s' is not a thumbnail index, ignoring it\n", pack->idx_path);
+    g_free(contents);
+    return FALSE;
+  }
+  g_free(contents);
+  return TRUE;
+}
+
+static gboolean _pack_open_files(dt_thumbnail_pack_t *pack, gboolean *outdated)
+{
+  GStatBuf st;
+  pack->pack_size = g_stat(pack->pack_path, &st) ? 0 : st.st_size;
+  pack->live = 0;
+  g_hash_table_remove_all(pack->index);
+  if(!_pack_load_index(pack, outdated)) return FALSE;
+  pack->pack_f = g_fopen(pack->pack_path, "ab");
+  pack->idx_f = g_fopen(pack->idx_path, "ab");
+  if(!pack->pack_f || !pack->idx_f) return FALSE;
+  if(pack->pack_size) _pack_remap(pack);
+  return TRUE;
+}
+
+static void _pack_close_files(dt_thumbnail_pack_t *pack)
+{
+  _pack_unmap(pack);
+  if(pack->pack_f) fclose(pack->pack_f);
+  if(pack->idx_f) fclose(pack->idx_f);
+  pack->pack_f = pack->idx_f = NULL;
+}
+
+dt_thumbnail_pack_t *dt_thumbnail_pack_open(const char *basename)
+{
+  dt_thumbnail_pack_t *pack = (dt_thumbnail_pack_t *)calloc(1, sizeof(dt_thumbnail_pack_t));
+  if(!pack) return NULL;
+  pack->pack_path = g_strdup_printf("%s.pack", basename);
+  pack->idx_path = g_strdup_printf("%s.idx", basename);
+  pack->index = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  dt_pthread_mutex_init(&pack->lock, NULL);
+
+  gboolean outdated = FALSE;
+  if(!_pack_open_files(pack, &outdated))
+  {
+    fprintf(stderr, "[thumbnail_pack] can't open `%s'\n", pack->pack_path);
+    _pack_close_files(pack);
+    g_hash_table_destroy(pack->index);
+    dt_pthread_mutex_destroy(&pack->lock);
+    g_free(pack->pack_path);
+    g_free(pack->idx_path);
+    free(pack);
+    return NULL;
+  }
+  dt_print(DT_DEBUG_CACHE, "[thumbnail_pack] `%s': %u thumbnails, %zu of %zu kb in use\n", pack->pack_path,
+           g_hash_table_size(pack->index), pack->live >> 10, pack->pack_size >> 10);
+  // appending to an old index would mix record sizes, so stay read-only if it can't be converted
+  if(outdated && !_pack_compact(pack))
+  {
+    if(pack->pack_f) fclose(pack->pack_f);
+    if(pack->idx_f) fclose(pack->idx_f);
+    pack->pack_f = pack->idx_f = NULL;
+  }
+  return pack;
+}
+
+void dt_thumbnail_pack_close(dt_thumbnail_pack_t *pack)
+{
+  if(!pack) return;
+  const size_t garbage = pack->pack_size - pack->live;
+  if(garbage > pack->live && garbage > DT_THUMBNAIL_PACK_MIN_GARBAGE) dt_thumbnail_pack_compact(pack);
+  _pack_close_files(pack);
+  g_hash_table_destroy(pack->index);
+  dt_pthread_mutex_destroy(&pack->lock);
+  g_free(pack->pack_path);
+  g_free(pack->idx_path);
+  free(pack);
+}
+
+gboolean dt_thumbnail_pack_contains(dt_thumbnail_pack_t *pack, const uint32_t imgid)
+{
+  if(!pack) return FALSE;
+  dt_pthread_mutex_lock(&pack->lock);
+  const gboolean found = g_hash_table_contains(pack->index, GUINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&pack->lock);
+  return found;
+}
+
+int64_t dt_thumbnail_pack_mtime(dt_thumbnail_pack_t *pack, const uint32_t imgid)
+{
+  if(!pack) return 0;
+  dt_pthread_mutex_lock(&pack->lock);
+  const _pack_record_t *r = g_hash_table_lookup(pack->index, GUINT_TO_POINTER(imgid));
+  const int64_t mtime = r ? r->mtime : 0;
+  dt_pthread_mutex_unlock(&pack->lock);
+  return mtime;
+}
+
+gboolean dt_thumbnail_pack_read(dt_thumbnail_pack_t *pack, const uint32_t imgid, uint8_t **blob, size_t *length,
+                                int *color_space, dt_thumbnail_codec_t *codec)
+{
+  if(!pack) return FALSE;
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&pack->lock);
+  const _pack_record_t *r = g_hash_table_lookup(pack->index, GUINT_TO_POINTER(imgid));
+  if(r && (r->offset + r->length <= pack->map_size || (_pack_remap(pack) && r->offset + r->length <= pack->map_size)))
+  {
+    // copy out under the lock, a writer may have to remap the pack any time
+    *blob = g_memdup(g_mapped_file_get_contents(pack->map) + r->offset, r->length);
+    *length = r->length;
+    *color_space = r->color_space;
+    *codec = r->codec;
+    found = *blob != NULL;
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+  return found;
+}
+
+// expects the lock to be held
+static gboolean _pack_append_record(dt_thumbnail_pack_t *pack, const _pack_record_t *r)
+{
+  if(!pack->idx_f) return FALSE;
+  if(fwrite(r, sizeof(_pack_record_t), 1, pack->idx_f) != 1) return FALSE;
+  return fflush(pack->idx_f) == 0;
+}
+
+gboolean dt_thumbnail_pack_write(dt_thumbnail_pack_t *pack, const uint32_t imgid, const uint8_t *blob,
+                                 const size_t length, const int color_space, const dt_thumbnail_codec_t codec)
+{
+  if(!pack || !length) return FALSE;
+  dt_pthread_mutex_lock(&pack->lock);
+  // the blob has to be on disk before the index points to it
+  _pack_record_t r = { .imgid = imgid, .color_space = color_space, .offset = pack->pack_size, .length = length,
+                       .codec = codec, .mtime = g_get_real_time() / G_USEC_PER_SEC };
+  gboolean ok = pack->pack_f && fwrite(blob, 1, length, pack->pack_f) == length && fflush(pack->pack_f) == 0;
+  if(ok)
+  {
+    pack->pack_size += length;
+    ok = _pack_append_record(pack, &r);
+  }
+  else if(pack->pack_f)
+  {
+    // a partial blob is garbage, but the next one has to start behind it
+    const long end = ftell(pack->pack_f);
+    if(end >= 0) pack->pack_size = end;
+  }
+  if(ok)
+  {
+    _pack_record_t *old = g_hash_table_lookup(pack->index, GUINT_TO_POINTER(imgid));
+    if(old) pack->live -= old->length;
+    g_hash_table_insert(pack->index, GUINT_TO_POINTER(imgid), g_memdup(&r, sizeof(r)));
+    pack->live += length;
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+  return ok;
+}
+
+void dt_thumbnail_pack_remove(dt_thumbnail_pack_t *pack, const uint32_t imgid)
+{
+  if(!pack) return;
+  dt_pthread_mutex_lock(&pack->lock);
+  _pack_record_t *old = g_hash_table_lookup(pack->index, GUINT_TO_POINTER(imgid));
+  if(old)
+  {
+    const _pack_record_t r = { .imgid = imgid, .length = 0 };
+    pack->live -= old->length;
+    g_hash_table_remove(pack->index, GUINT_TO_POINTER(imgid));
+    _pack_append_record(pack, &r);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+// expects the lock to be held
+static gboolean _pack_compact(dt_thumbnail_pack_t *pack)
+{
+  if(!_pack_remap(pack) && pack->pack_size) return FALSE;
+
+  gchar *tmp_pack = g_strdup_printf("%s.tmp", pack->pack_path);
+  gchar *tmp_idx = g_strdup_printf("%s.tmp", pack->idx_path);
+  FILE *pf = g_fopen(tmp_pack, "wb");
+  FILE *xf = g_fopen(tmp_idx, "wb");
+  gboolean ok = pf && xf && fwrite(DT_THUMBNAIL_PACK_MAGIC, 8, 1, xf) == 1;
+
+  const char *data = pack->map ? g_mapped_file_get_contents(pack->map) : NULL;
+  uint64_t offset = 0;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pack->index);
+  while(ok && g_hash_table_iter_next(&iter, &key, &value))
+  {
+    _pack_record_t r = *(const _pack_record_t *)value;
+    if(r.offset + r.length > pack->map_size) continue;
+    ok = fwrite(data + r.offset, 1, r.length, pf) == r.length;
+    r.offset = offset;
+    offset += r.length;
+    ok = ok && fwrite(&r, sizeof(r), 1, xf) == 1;
+  }
+  if(pf) ok = (fclose(pf) == 0) && ok;
+  if(xf) ok = (fclose(xf) == 0) && ok;
+
+  if(ok)
+  {
+    _pack_close_files(pack);
+    // windows doesn't rename over existing files
+    g_unlink(pack->pack_path);
+    g_unlink(pack->idx_path);
+    ok = !g_rename(tmp_pack, pack->pack_path) && !g_rename(tmp_idx, pack->idx_path);
+    gboolean outdated;
+    if(!_pack_open_files(pack, &outdated)) ok = FALSE;
+    dt_print(DT_DEBUG_CACHE, "[thumbnail_pack] compacted `%s' to %zu kb\n", pack->pack_path, (size_t)offset >> 10);
+  }
+  if(!ok)
+  {
+    fprintf(stderr, "[thumbnail_pack] compacting `%s' failed\n", pack->pack_path);
+    g_unlink(tmp_pack);
+    g_unlink(tmp_idx);
+  }
+  g_free(tmp_pack);
+  g_free(tmp_idx);
+  return ok;
+}
+
+void dt_thumbnail_pack_compact(dt_thumbnail_pack_t *pack)
+{
+  if(!pack) return;
+  dt_pthread_mutex_lock(&pack->lock);
+  _pack_compact(pack);
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+#undef DT_THUMBNAIL_PACK_MAGIC
+#undef DT_THUMBNAIL_PACK_MAGIC_V1
+#undef DT_THUMBNAIL_PACK_MIN_GARBAGE
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
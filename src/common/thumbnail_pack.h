@@ -0,0 +1,65 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * packed on-disk store for the thumbnails of one mip level. all encoded blobs go into one
+ * append-only pack file, an equally append-only index maps image ids to their blob, the
+ * latest record of an id wins. reading goes through a memory map of the pack, so loading
+ * a thumbnail costs no open() or stat() on the file system. replaced and removed blobs
+ * leave holes that dt_thumbnail_pack_close() compacts away once they dominate the file.
+ *
+ * the store is only ever opened by one process, which the library lock guarantees.
+ */
+
+typedef struct dt_thumbnail_pack_t dt_thumbnail_pack_t;
+
+/** encoding of a blob, recorded per blob so a store can hold a mix while the preference changes. */
+typedef enum dt_thumbnail_codec_t
+{
+  DT_THUMBNAIL_CODEC_JPEG = 0, // small, lossy
+  DT_THUMBNAIL_CODEC_QOI = 1   // lossless and much faster to decode
+} dt_thumbnail_codec_t;
+
+/** opens or creates <basename>.pack and <basename>.idx. returns NULL if that fails. */
+dt_thumbnail_pack_t *dt_thumbnail_pack_open(const char *basename);
+/** closes the store and compacts it first if more than half of the pack is garbage. */
+void dt_thumbnail_pack_close(dt_thumbnail_pack_t *pack);
+
+gboolean dt_thumbnail_pack_contains(dt_thumbnail_pack_t *pack, const uint32_t imgid);
+/** seconds since the epoch when the blob of imgid was written, 0 if there is none or it predates the record. */
+int64_t dt_thumbnail_pack_mtime(dt_thumbnail_pack_t *pack, const uint32_t imgid);
+/** copies the blob of imgid to a new buffer (free with g_free()) and returns its color space and codec.
+ * FALSE if there is none. */
+gboolean dt_thumbnail_pack_read(dt_thumbnail_pack_t *pack, const uint32_t imgid, uint8_t **blob, size_t *length,
+                                int *color_space, dt_thumbnail_codec_t *codec);
+/** appends a blob for imgid, replacing any previous one. returns FALSE on write errors. */
+gboolean dt_thumbnail_pack_write(dt_thumbnail_pack_t *pack, const uint32_t imgid, const uint8_t *blob,
+                                 const size_t length, const int color_space, const dt_thumbnail_codec_t codec);
+void dt_thumbnail_pack_remove(dt_thumbnail_pack_t *pack, const uint32_t imgid);
+/** rewrites pack and index with only the live blobs. */
+void dt_thumbnail_pack_compact(dt_thumbnail_pack_t *pack);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -20,6 +20,7 @@
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/image.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include <glib.h>   // for GList, gpointer, g_list_first, g_list_prepend
 #include <stdlib.h> // for NULL, malloc, free
@@ -34,6 +35,7 @@ typedef struct dt_undo_item_t
   dt_undo_data_t data;
   double ts;
   gboolean is_group;
+  size_t size;
   void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t data, dt_undo_action_t action, GList **imgs);
   void (*free_data)(gpointer data);
 } dt_undo_item_t;
@@ -48,6 +50,7 @@ dt_undo_t *dt_undo_init(void)
   dt_pthread_mutex_init(&udata->mutex, NULL);
   udata->group = DT_UNDO_NONE;
   udata->group_indent = 0;
+  udata->memory = 0;
   return udata;
 }
 
@@ -75,8 +78,53 @@ static void _free_undo_data(void *p)
   free(item);
 }
 
+// moves item between the undo and redo lists, keeping the memory of the undo list
+static GList *_undo_list_take(dt_undo_t *self, GList **list, dt_undo_item_t *item)
+{
+  if(list == &self->undo_list) self->memory -= MIN(self->memory, item->size);
+  return g_list_remove(*list, item);
+}
+
+static GList *_undo_list_put(dt_undo_t *self, GList **list, dt_undo_item_t *item)
+{
+  if(list == &self->undo_list) self->memory += item->size;
+  return g_list_prepend(*list, item);
+}
+
+// drops the oldest items of the undo list until it fits the budget again. groups go as a whole, a
+// dangling group marker would swallow the items after it on the next undo.
+static void _undo_trim(dt_undo_t *self)
+{
+  const size_t budget = (size_t)MAX(1, dt_conf_get_int("undo_memory")) << 20;
+
+  while(self->memory > budget && self->undo_list && self->undo_list->next)
+  {
+    GList *l = g_list_last(self->undo_list);
+    dt_undo_item_t *item = (dt_undo_item_t *)l->data;
+    const gboolean group = item->is_group;
+
+    do
+    {
+      GList *prev = g_list_previous(l);
+      item = (dt_undo_item_t *)l->data;
+      self->memory -= MIN(self->memory, item->size);
+      self->undo_list = g_list_delete_link(self->undo_list, l);
+      _free_undo_data(item);
+      l = prev;
+    } while(group && l && !((dt_undo_item_t *)l->data)->is_group);
+
+    // and the closing marker
+    if(group && l)
+    {
+      item = (dt_undo_item_t *)l->data;
+      self->undo_list = g_list_delete_link(self->undo_list, l);
+      _free_undo_data(item);
+    }
+  }
+}
+
 static void _undo_record(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt_undo_data_t data,
-                         gboolean is_group,
+                         gboolean is_group, const size_t size,
                          void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item, dt_undo_action_t action, GList **imgs),
                          void (*free_data)(gpointer data))
 {
@@ -105,13 +153,17 @@ static void _undo_record(dt_undo_t *self, gpointer user_data, dt_undo_type_t typ
       item->free_data = free_data;
       item->ts        = dt_get_wtime();
       item->is_group  = is_group;
+      item->size      = size;
 
-      self->undo_list = g_list_prepend(self->undo_list, (gpointer)item);
+      self->undo_list = _undo_list_put(self, &self->undo_list, item);
 
       // recording an undo data invalidate all the redo
       g_list_free_full(self->redo_list, _free_undo_data);
       self->redo_list = NULL;
 
+      // an open group can't be cut in half, wait for its end
+      if(self->group == DT_UNDO_NONE) _undo_trim(self);
+
       UNLOCK;
     }
   }
@@ -125,7 +177,7 @@ void dt_undo_start_group(dt_undo_t *self, dt_undo_type_t type)
   {
     self->group = type;
     self->group_indent = 1;
-    _undo_record(self, NULL, type, NULL, TRUE, NULL, NULL);
+    _undo_record(self, NULL, type, NULL, TRUE, 0, NULL, NULL);
   }
   else
     self->group_indent++;
@@ -139,8 +191,9 @@ void dt_undo_end_group(dt_undo_t *self)
   self->group_indent--;
   if(self->group_indent == 0)
   {
-    _undo_record(self, NULL, self->group, NULL, TRUE, NULL, NULL);
+    const dt_undo_type_t type_of_group = self->group;
     self->group = DT_UNDO_NONE;
+    _undo_record(self, NULL, type_of_group, NULL, TRUE, 0, NULL, NULL);
   }
 }
 
@@ -148,7 +201,16 @@ void dt_undo_record(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt
                     void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item, dt_undo_action_t action, GList **imgs),
                     void (*free_data)(gpointer data))
 {
-  _undo_record(self, user_data, type, data, FALSE, undo, free_data);
+  _undo_record(self, user_data, type, data, FALSE, 0, undo, free_data);
+}
+
+void dt_undo_record_sized(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt_undo_data_t data,
+                          const size_t size,
+                          void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item,
+                                       dt_undo_action_t action, GList **imgs),
+                          void (*free_data)(gpointer data))
+{
+  _undo_record(self, user_data, type, data, FALSE, size, undo, free_data);
 }
 
 gint _images_list_cmp(gconstpointer a, gconstpointer b)
@@ -184,8 +246,8 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
         GList *next = g_list_next(l);
 
         //  first move the group item into the TO list
-        *from = g_list_remove(*from, item);
-        *to   = g_list_prepend(*to, item);
+        *from = _undo_list_take(self, from, item);
+        *to   = _undo_list_put(self, to, item);
 
         while((l = next) && !is_group)
         {
@@ -193,7 +255,7 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
           next = g_list_next(l);
 
           //  first remove element from FROM list
-          *from = g_list_remove(*from, item);
+          *from = _undo_list_take(self, from, item);
 
           //  callback with undo or redo data
           if(item->is_group)
@@ -202,7 +264,7 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
             item->undo(item->user_data, item->type, item->data, action, &imgs);
 
           //  add old position back into the TO list
-          *to = g_list_prepend(*to, item);
+          *to = _undo_list_put(self, to, item);
         }
       }
       else
@@ -217,7 +279,7 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
           GList *next = g_list_next(l);
 
           //  first remove element from FROM list
-          *from = g_list_remove(*from, item);
+          *from = _undo_list_take(self, from, item);
 
           if(item->is_group)
             in_group = !in_group;
@@ -226,7 +288,7 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
             item->undo(item->user_data, item->type, item->data, action, &imgs);
 
           //  add old position back into the TO list
-          *to = g_list_prepend(*to, item);
+          *to = _undo_list_put(self, to, item);
 
           l = next;
           if (l) item = (dt_undo_item_t *)l->data;
@@ -246,8 +308,7 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
       while(img->next && img->data == img->next->data)
         imgs = g_list_delete_link(imgs, img->next);
     // udpate xmp for updated images
-    for(GList *img = imgs; img != NULL; img = img->next)
-      dt_image_synch_xmp(GPOINTER_TO_INT(img->data));
+    dt_image_synch_xmps(imgs);
   }
 
   dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, imgs);
@@ -292,6 +353,7 @@ void dt_undo_clear(dt_undo_t *self, uint32_t filter)
   _undo_clear_list(&self->redo_list, filter);
   self->undo_list = NULL;
   self->redo_list = NULL;
+  self->memory = 0;
   self->disable_next = FALSE;
   UNLOCK;
 }
@@ -56,6 +56,7 @@ typedef struct dt_undo_t
   dt_pthread_mutex_t mutex;
   gboolean locked;
   gboolean disable_next;
+  size_t memory; // bytes reported by the items of undo_list, see dt_undo_record_sized()
 } dt_undo_t;
 
 dt_undo_t *dt_undo_init(void);
@@ -70,6 +71,14 @@ void dt_undo_record(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt
                     void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item, dt_undo_action_t action, GList **imgs),
                     void (*free_data)(gpointer data));
 
+// same as above, for data taking size bytes. the oldest undo items are dropped once the undo list grows
+// beyond the memory budget (conf undo_memory, in MB)
+void dt_undo_record_sized(dt_undo_t *self, gpointer user_data, dt_undo_type_t type, dt_undo_data_t data,
+                          const size_t size,
+                          void (*undo)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item,
+                                       dt_undo_action_t action, GList **imgs),
+                          void (*free_data)(gpointer data));
+
 //  undo an element which correspond to filter. filter here is expected to be
 //  a set of dt_undo_type_t.
 void dt_undo_do_undo(dt_undo_t *self, uint32_t filter);
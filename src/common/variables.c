@@ -69,8 +69,90 @@ typedef struct dt_variables_data_t
 
   int flags;
 
+  /** the template the data below was worked out for, and what it needs fetched for every image */
+  gchar *compiled;
+  uint32_t needs;
+
+  /** the first value of every metadata field of the image, if the template uses any */
+  gchar *metadata[DT_METADATA_NUMBER];
+  /** -1 until known, if the template needs it */
+  int duplicates;
+
 } dt_variables_data_t;
 
+typedef enum dt_variables_needs_t
+{
+  DT_VARIABLES_NEED_METADATA = 1 << 0,
+  DT_VARIABLES_NEED_DUPLICATES = 1 << 1,
+  DT_VARIABLES_NEED_FOLDERS = 1 << 2,
+} dt_variables_needs_t;
+
+// the variables that need more than the image cache, and what they need
+static const struct
+{
+  const char *name;
+  dt_variables_needs_t needs;
+} _variables_needs[] = {
+  { "$(VERSION_NAME", DT_VARIABLES_NEED_METADATA },
+  { "$(TITLE", DT_VARIABLES_NEED_METADATA },
+  { "$(DESCRIPTION", DT_VARIABLES_NEED_METADATA },
+  { "$(CREATOR", DT_VARIABLES_NEED_METADATA },
+  { "$(PUBLISHER", DT_VARIABLES_NEED_METADATA },
+  { "$(RIGHTS", DT_VARIABLES_NEED_METADATA },
+  { "$(VERSION_IF_MULTI", DT_VARIABLES_NEED_DUPLICATES },
+  { "$(HOME", DT_VARIABLES_NEED_FOLDERS },
+  { "$(PICTURES_FOLDER", DT_VARIABLES_NEED_FOLDERS },
+};
+
+// works out once per template what has to be fetched for each image, exports expand the same one many times
+static void _compile(dt_variables_data_t *data, const gchar *source)
+{
+  if(data->compiled && !g_strcmp0(data->compiled, source)) return;
+
+  g_free(data->compiled);
+  data->compiled = g_strdup(source);
+  data->needs = 0;
+  for(size_t k = 0; k < sizeof(_variables_needs) / sizeof(_variables_needs[0]); k++)
+    if(strstr(source, _variables_needs[k].name)) data->needs |= _variables_needs[k].needs;
+}
+
+// all metadata of the image in one query instead of one per variable
+static void _fetch_metadata(dt_variables_params_t *params)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT key, value FROM main.meta_data WHERE id = ?1 ORDER BY key, value", -1, &stmt,
+                              NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, params->imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int key = sqlite3_column_int(stmt, 0);
+    const char *value = (const char *)sqlite3_column_text(stmt, 1);
+    // the lowest value wins, as with the first of dt_metadata_get()
+    if(key >= 0 && key < DT_METADATA_NUMBER && !params->data->metadata[key])
+      params->data->metadata[key] = g_strdup(value ? value : "");
+  }
+  sqlite3_finalize(stmt);
+}
+
+static int _count_duplicates(const int imgid)
+{
+  int count = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT COUNT(1)"
+                              " FROM images AS i1"
+                              " WHERE EXISTS (SELECT 'y' FROM images AS i2"
+                              "               WHERE  i2.id = ?1"
+                              "               AND    i1.film_id = i2.film_id"
+                              "               AND    i1.filename = i2.filename)",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return count;
+}
+
 static char *expand(dt_variables_params_t *params, char **source, char extra_stop);
 
 // gather some data that might be used for variable expansion
@@ -78,12 +160,16 @@ static void init_expansion(dt_variables_params_t *params, gboolean iterate)
 {
   if(iterate) params->data->sequence++;
 
-  params->data->homedir = dt_loc_get_home_dir(NULL);
+  // the same for all images
+  if((params->data->needs & DT_VARIABLES_NEED_FOLDERS) && !params->data->homedir)
+  {
+    params->data->homedir = dt_loc_get_home_dir(NULL);
 
-  if(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES) == NULL)
-    params->data->pictures_folder = g_build_path(G_DIR_SEPARATOR_S, params->data->homedir, "Pictures", (char *)NULL);
-  else
-    params->data->pictures_folder = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES));
+    if(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES) == NULL)
+      params->data->pictures_folder = g_build_path(G_DIR_SEPARATOR_S, params->data->homedir, "Pictures", (char *)NULL);
+    else
+      params->data->pictures_folder = g_strdup(g_get_user_special_dir(G_USER_DIRECTORY_PICTURES));
+  }
 
   if(params->filename)
   {
@@ -109,6 +195,7 @@ static void init_expansion(dt_variables_params_t *params, gboolean iterate)
   params->data->longitude = 0.0f;
   params->data->latitude = 0.0f;
   params->data->elevation = 0.0f;
+  params->data->duplicates = -1;
   if(params->imgid)
   {
     const dt_image_t *img = dt_image_cache_get(darktable.image_cache, params->imgid, 'r');
@@ -140,6 +227,8 @@ static void init_expansion(dt_variables_params_t *params, gboolean iterate)
     params->data->flags = img->flags;
 
     dt_image_cache_read_release(darktable.image_cache, img);
+
+    if(params->data->needs & DT_VARIABLES_NEED_METADATA) _fetch_metadata(params);
   }
   else if (params->data->exif_time) {
     localtime_r(&params->data->exif_time, &params->data->exif_tm);
@@ -149,10 +238,14 @@ static void init_expansion(dt_variables_params_t *params, gboolean iterate)
 
 static void cleanup_expansion(dt_variables_params_t *params)
 {
-  g_free(params->data->homedir);
-  g_free(params->data->pictures_folder);
   g_free(params->data->camera_maker);
   g_free(params->data->camera_alias);
+  g_free(params->data->exif_lens);
+  for(int k = 0; k < DT_METADATA_NUMBER; k++)
+  {
+    g_free(params->data->metadata[k]);
+    params->data->metadata[k] = NULL;
+  }
 }
 
 static inline gboolean has_prefix(char **str, const char *prefix)
@@ -271,38 +364,14 @@ static char *get_base_value(dt_variables_params_t *params, char **variable)
   else if(has_prefix(variable, "ID"))
     result = g_strdup_printf("%d", params->imgid);
   else if(has_prefix(variable, "VERSION_NAME"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.darktable.version_name", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
+    result = g_strdup(params->data->metadata[DT_METADATA_XMP_VERSION_NAME]);
   else if(has_prefix(variable, "VERSION_IF_MULTI"))
   {
-    sqlite3_stmt *stmt;
-
-    // count duplicates
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT COUNT(1)"
-                                " FROM images AS i1"
-                                " WHERE EXISTS (SELECT 'y' FROM images AS i2"
-                                "               WHERE  i2.id = ?1"
-                                "               AND    i1.film_id = i2.film_id"
-                                "               AND    i1.filename = i2.filename)",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, params->imgid);
-
-    if(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      const int count = sqlite3_column_int(stmt, 0);
-      //only return data if more than one matching image
-      if(count > 1)
-        result = g_strdup_printf("%d", params->data->version);
-    }
-    sqlite3_finalize (stmt);
+    // count duplicates, once per image however often the template uses it
+    if(params->data->duplicates < 0) params->data->duplicates = _count_duplicates(params->imgid);
+    //only return data if more than one matching image
+    if(params->data->duplicates > 1)
+      result = g_strdup_printf("%d", params->data->version);
   }
   else if(has_prefix(variable, "VERSION"))
     result = g_strdup_printf("%d", params->data->version);
@@ -401,55 +470,15 @@ static char *get_base_value(dt_variables_params_t *params, char **variable)
     g_list_free(res);
   }
   else if(has_prefix(variable, "TITLE"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.title", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
+    result = g_strdup(params->data->metadata[DT_METADATA_XMP_DC_TITLE]);
   else if(has_prefix(variable, "DESCRIPTION"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.description", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
+    result = g_strdup(params->data->metadata[DT_METADATA_XMP_DC_DESCRIPTION]);
   else if(has_prefix(variable, "CREATOR"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.creator", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
+    result = g_strdup(params->data->metadata[DT_METADATA_XMP_DC_CREATOR]);
   else if(has_prefix(variable, "PUBLISHER"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.publisher", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
+    result = g_strdup(params->data->metadata[DT_METADATA_XMP_DC_PUBLISHER]);
   else if(has_prefix(variable, "RIGHTS"))
-  {
-    GList *res = dt_metadata_get(params->imgid, "Xmp.dc.rights", NULL);
-    res = g_list_first(res);
-    if(res != NULL)
-    {
-      result = g_strdup((char *)res->data);
-    }
-    g_list_free_full(res, &g_free);
-  }
+    result = g_strdup(params->data->metadata[DT_METADATA_XMP_DC_RIGHTS]);
   else if(has_prefix(variable, "OPENCL_ACTIVATED"))
   {
     if(dt_opencl_is_enabled())
@@ -857,6 +886,7 @@ static char *expand(dt_variables_params_t *params, char **source, char extra_sto
 
 char *dt_variables_expand(dt_variables_params_t *params, gchar *source, gboolean iterate)
 {
+  _compile(params->data, source);
   init_expansion(params, iterate);
 
   char *result = expand(params, &source, '\0');
@@ -878,6 +908,9 @@ void dt_variables_params_init(dt_variables_params_t **params)
 
 void dt_variables_params_destroy(dt_variables_params_t *params)
 {
+  g_free(params->data->compiled);
+  g_free(params->data->homedir);
+  g_free(params->data->pictures_folder);
   g_free(params->data);
   g_free(params);
 }
@@ -249,27 +249,40 @@ static void dt_conf_print(const gchar *key, const gchar *val, FILE *f)
   fprintf(f, "%s=%s\n", key, val);
 }
 
-void dt_conf_cleanup(dt_conf_t *cf)
+static gboolean _conf_write(dt_conf_t *cf, const char *filename)
 {
-  FILE *f = g_fopen(cf->filename, "wb");
-  if(f)
-  {
-    GList *keys = g_hash_table_get_keys(cf->table);
-    GList *sorted = g_list_sort(keys, (GCompareFunc)g_strcmp0);
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return FALSE;
 
-    GList *iter = sorted;
+  GList *keys = g_hash_table_get_keys(cf->table);
+  GList *sorted = g_list_sort(keys, (GCompareFunc)g_strcmp0);
 
-    while(iter)
-    {
-      const gchar *key = (const gchar *)iter->data;
-      const gchar *val = (const gchar *)g_hash_table_lookup(cf->table, key);
-      dt_conf_print(key, val, f);
-      iter = g_list_next(iter);
-    }
+  GList *iter = sorted;
 
-    g_list_free(sorted);
-    fclose(f);
+  while(iter)
+  {
+    const gchar *key = (const gchar *)iter->data;
+    const gchar *val = (const gchar *)g_hash_table_lookup(cf->table, key);
+    dt_conf_print(key, val, f);
+    iter = g_list_next(iter);
   }
+
+  g_list_free(sorted);
+  fclose(f);
+  return TRUE;
+}
+
+gboolean dt_conf_save(const char *filename)
+{
+  dt_pthread_mutex_lock(&darktable.conf->mutex);
+  const gboolean res = _conf_write(darktable.conf, filename);
+  dt_pthread_mutex_unlock(&darktable.conf->mutex);
+  return res;
+}
+
+void dt_conf_cleanup(dt_conf_t *cf)
+{
+  _conf_write(cf, cf->filename);
   g_hash_table_unref(cf->table);
   g_hash_table_unref(cf->defaults);
   g_hash_table_unref(cf->override_entries);
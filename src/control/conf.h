@@ -54,6 +54,8 @@ int dt_conf_get_bool(const char *name);
 gchar *dt_conf_get_string(const char *name);
 void dt_conf_init(dt_conf_t *cf, const char *filename, GSList *override_entries);
 void dt_conf_cleanup(dt_conf_t *cf);
+/** write the current configuration to another file, e.g. for a helper process. returns FALSE on error */
+gboolean dt_conf_save(const char *filename);
 int dt_conf_key_exists(const char *key);
 GSList *dt_conf_all_string_entries(const char *dir);
 void dt_conf_string_entry_free(gpointer data);
@@ -182,7 +182,8 @@ typedef struct dt_control_t
 
   // job management
   int32_t running;
-  gboolean export_scheduled;
+  int32_t export_scheduled; // number of export jobs currently running
+  int32_t max_export_jobs;  // ... and how many of them we allow at once
   dt_pthread_mutex_t queue_mutex, cond_mutex, run_mutex;
   pthread_cond_t cond;
   int32_t num_threads;
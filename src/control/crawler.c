@@ -54,141 +54,209 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
+// the part of the library the crawler depends on, summed up over the images of a film roll. a folder
+// whose directory mtime and checksum match what the last crawl stored doesn't need to be looked at.
+#define DT_CRAWLER_EXTRA_FLAGS (DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV)
+
+static inline int64_t _crawler_checksum(const int id, const int version, const time_t timestamp, const int flags)
+{
+  return (int64_t)id * 1000003 + (int64_t)version * 1009 + (int64_t)timestamp + (flags & DT_CRAWLER_EXTRA_FLAGS) + 1;
+}
+
+// checks one image, appending to result if its xmp is newer than the library. returns its checksum.
+static int64_t _crawler_check_image(sqlite3_stmt *stmt, sqlite3_stmt *inner_stmt, const gboolean look_for_xmp,
+                                    GList **result, gboolean *reported)
+{
+  const int id = sqlite3_column_int(stmt, 0);
+  const time_t timestamp = sqlite3_column_int(stmt, 1);
+  const int version = sqlite3_column_int(stmt, 2);
+  const gchar *image_path = (char *)sqlite3_column_text(stmt, 3);
+  int flags = sqlite3_column_int(stmt, 4);
+
+  // if the image is missing we ignore it.
+  if(!g_file_test(image_path, G_FILE_TEST_EXISTS))
+  {
+    dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is missing.\n", image_path, id);
+    return _crawler_checksum(id, version, timestamp, flags);
+  }
+
+  // no need to look for xmp files if none get written anyway.
+  if(look_for_xmp)
+  {
+    // construct the xmp filename for this image
+    gchar xmp_path[PATH_MAX] = { 0 };
+    g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
+    dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
+    size_t len = strlen(xmp_path);
+    if(len + 4 >= PATH_MAX) return _crawler_checksum(id, version, timestamp, flags);
+    xmp_path[len++] = '.';
+    xmp_path[len++] = 'x';
+    xmp_path[len++] = 'm';
+    xmp_path[len++] = 'p';
+    xmp_path[len] = '\0';
+
+    struct stat statbuf;
+    // on Windows the encoding might not be UTF8
+    gchar *xmp_path_locale = g_locale_from_utf8(xmp_path, -1, NULL, NULL, NULL);
+    const int stat_res = stat(xmp_path, &statbuf);
+    g_free(xmp_path_locale);
+    // step 1: check if the xmp is newer than our db entry. a missing xmp is skipped
+    // TODO: shall we report these?
+    // FIXME: allow for a few seconds difference?
+    if(stat_res != -1 && timestamp < statbuf.st_mtime)
+    {
+      dt_control_crawler_result_t *item
+          = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
+      item->id = id;
+      item->timestamp_xmp = statbuf.st_mtime;
+      item->timestamp_db = timestamp;
+      item->image_path = g_strdup(image_path);
+      item->xmp_path = g_strdup(xmp_path);
+
+      *result = g_list_append(*result, item);
+      *reported = TRUE;
+      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
+    }
+    // older timestamps are the case for all images after the db upgrade. better not report these
+    //       else if(timestamp > statbuf.st_mtime)
+    //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
+  }
+
+  // step 2: check if the image has associated files (.txt, .wav)
+  size_t len = strlen(image_path);
+  const char *c = image_path + len;
+  while((c > image_path) && (*c != '.')) c--;
+  len = c - image_path + 1;
+
+  char *extra_path = (char *)calloc(len + 3 + 1, sizeof(char));
+  g_strlcpy(extra_path, image_path, len + 1);
+
+  extra_path[len] = 't';
+  extra_path[len + 1] = 'x';
+  extra_path[len + 2] = 't';
+  gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_txt)
+  {
+    extra_path[len] = 'T';
+    extra_path[len + 1] = 'X';
+    extra_path[len + 2] = 'T';
+    has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  extra_path[len] = 'w';
+  extra_path[len + 1] = 'a';
+  extra_path[len + 2] = 'v';
+  gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_wav)
+  {
+    extra_path[len] = 'W';
+    extra_path[len + 1] = 'A';
+    extra_path[len + 2] = 'V';
+    has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
+  // else cases)
+  int new_flags = flags;
+  if(has_txt)
+    new_flags |= DT_IMAGE_HAS_TXT;
+  else
+    new_flags &= ~DT_IMAGE_HAS_TXT;
+  if(has_wav)
+    new_flags |= DT_IMAGE_HAS_WAV;
+  else
+    new_flags &= ~DT_IMAGE_HAS_WAV;
+  if(flags != new_flags)
+  {
+    sqlite3_bind_int(inner_stmt, 1, new_flags);
+    sqlite3_bind_int(inner_stmt, 2, id);
+    sqlite3_step(inner_stmt);
+    sqlite3_reset(inner_stmt);
+    sqlite3_clear_bindings(inner_stmt);
+  }
+
+  free(extra_path);
+
+  return _crawler_checksum(id, version, timestamp, new_flags);
+}
+
 GList *dt_control_crawler_run()
 {
-  sqlite3_stmt *stmt, *inner_stmt;
+  sqlite3_stmt *film_stmt, *stmt, *inner_stmt, *snapshot_stmt;
   GList *result = NULL;
   gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
-
+  const gboolean skip_unchanged = dt_conf_get_bool("crawler/skip_unchanged_folders");
+
+  gchar *query = g_strdup_printf("SELECT f.id, f.folder, f.crawler_mtime, f.crawler_checksum, "
+                                 "       SUM(i.id * 1000003 + IFNULL(i.version, 0) * 1009 "
+                                 "           + IFNULL(i.write_timestamp, 0) + (IFNULL(i.flags, 0) & %d) + 1) "
+                                 "FROM main.film_rolls AS f JOIN main.images AS i ON i.film_id = f.id "
+                                 "GROUP BY f.id ORDER BY f.id",
+                                 DT_CRAWLER_EXTRA_FLAGS);
+  sqlite3_prepare_v2(dt_database_get(darktable.db), query, -1, &film_stmt, NULL);
+  g_free(query);
   sqlite3_prepare_v2(dt_database_get(darktable.db),
                      "SELECT i.id, write_timestamp, version, folder || '" G_DIR_SEPARATOR_S "' || filename, flags "
-                     "FROM main.images i, main.film_rolls f ON i.film_id = f.id ORDER BY f.id, filename",
+                     "FROM main.images i, main.film_rolls f ON i.film_id = f.id WHERE f.id = ?1 ORDER BY filename",
                      -1, &stmt, NULL);
   sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
                      &inner_stmt, NULL);
+  sqlite3_prepare_v2(dt_database_get(darktable.db),
+                     "UPDATE main.film_rolls SET crawler_mtime = ?1, crawler_checksum = ?2 WHERE id = ?3", -1,
+                     &snapshot_stmt, NULL);
 
   // let's wrap this into a transaction, it might make it a little faster.
   sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
 
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  int skipped = 0;
+  while(sqlite3_step(film_stmt) == SQLITE_ROW)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    const gchar *image_path = (char *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
-
-    // if the image is missing we ignore it.
-    if(!g_file_test(image_path, G_FILE_TEST_EXISTS))
+    const int film_id = sqlite3_column_int(film_stmt, 0);
+    const gchar *folder = (char *)sqlite3_column_text(film_stmt, 1);
+    const gboolean has_snapshot = sqlite3_column_type(film_stmt, 2) != SQLITE_NULL;
+    const int64_t snapshot_mtime = sqlite3_column_int64(film_stmt, 2);
+    const int64_t snapshot_checksum = sqlite3_column_int64(film_stmt, 3);
+    const int64_t checksum = sqlite3_column_int64(film_stmt, 4);
+
+    // adding, removing or replacing a file touches the directory, so does any sidecar writer saving to a
+    // temporary file first. files rewritten in place are only seen once the folder gets crawled again.
+    GStatBuf statbuf;
+    const int64_t folder_mtime = g_stat(folder, &statbuf) ? -1 : (int64_t)statbuf.st_mtime;
+    if(skip_unchanged && has_snapshot && folder_mtime != -1 && snapshot_mtime == folder_mtime
+       && snapshot_checksum == checksum)
     {
-      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is missing.\n", image_path, id);
+      skipped++;
       continue;
     }
 
-    // no need to look for xmp files if none get written anyway.
-    if(look_for_xmp)
-    {
-      // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      struct stat statbuf;
-      // on Windows the encoding might not be UTF8
-      gchar *xmp_path_locale = g_locale_from_utf8(xmp_path, -1, NULL, NULL, NULL);
-      const int stat_res = stat(xmp_path, &statbuf);
-      g_free(xmp_path_locale);
-      if(stat_res == -1) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
-      {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_append(result, item);
-        dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
-      }
-      // older timestamps are the case for all images after the db upgrade. better not report these
-      //       else if(timestamp > statbuf.st_mtime)
-      //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
-    }
-
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    const char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) c--;
-    len = c - image_path + 1;
-
-    char *extra_path = (char *)calloc(len + 3 + 1, sizeof(char));
-    g_strlcpy(extra_path, image_path, len + 1);
-
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+    gboolean reported = FALSE;
+    int64_t new_checksum = 0;
+    sqlite3_bind_int(stmt, 1, film_id);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      new_checksum += _crawler_check_image(stmt, inner_stmt, look_for_xmp, &result, &reported);
+    sqlite3_reset(stmt);
 
-    if(!has_txt)
+    // only remember folders which had nothing to report, the others have to be looked at next time again
+    if(look_for_xmp && !reported && folder_mtime != -1)
     {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      sqlite3_bind_int64(snapshot_stmt, 1, folder_mtime);
+      sqlite3_bind_int64(snapshot_stmt, 2, new_checksum);
+      sqlite3_bind_int(snapshot_stmt, 3, film_id);
+      sqlite3_step(snapshot_stmt);
+      sqlite3_reset(snapshot_stmt);
     }
-
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-
-    if(!has_wav)
-    {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-    }
-
-    // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
-    // else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
-    else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
-    {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
-      sqlite3_step(inner_stmt);
-      sqlite3_reset(inner_stmt);
-      sqlite3_clear_bindings(inner_stmt);
-    }
-
-    free(extra_path);
   }
 
   sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 
+  dt_print(DT_DEBUG_CONTROL, "[crawler] skipped %d unchanged folders\n", skipped);
+
+  sqlite3_finalize(film_stmt);
   sqlite3_finalize(stmt);
   sqlite3_finalize(inner_stmt);
+  sqlite3_finalize(snapshot_stmt);
 
   return result;
 }
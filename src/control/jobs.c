@@ -246,7 +246,7 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
     if(control->queues[i] == NULL) continue;
-    if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
+    if(i == DT_JOB_QUEUE_USER_EXPORT && control->export_scheduled >= control->max_export_jobs) continue;
     _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
     if(_job->priority > max_priority)
     {
@@ -270,7 +270,7 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
   GList **queue = &control->queues[winner_queue];
   *queue = g_list_delete_link(*queue, *queue);
   control->queue_length[winner_queue]--;
-  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
+  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled++;
 
   // and place it in scheduled job array (for job deduping)
   control->job[dt_control_get_threadid()] = job;
@@ -313,6 +313,14 @@ static int32_t dt_control_run_job(dt_control_t *control)
 
   if(!job) return -1;
 
+  // exports running side by side share the cores instead of each one trying to
+  // saturate all of them. this scales better than a single export with all threads,
+  // large parts of it (loading, encoding, writing) are single threaded.
+  const gboolean split_threads = job->queue == DT_JOB_QUEUE_USER_EXPORT && control->max_export_jobs > 1;
+#ifdef _OPENMP
+  if(split_threads) omp_set_num_threads(MAX(1, darktable.num_openmp_threads / control->max_export_jobs));
+#endif
+
   /* change state to running */
   dt_pthread_mutex_lock(&job->wait_mutex);
   if(dt_control_job_get_state(job) == DT_JOB_STATE_QUEUED)
@@ -320,10 +328,16 @@ static int32_t dt_control_run_job(dt_control_t *control)
 
   dt_pthread_mutex_unlock(&job->wait_mutex);
 
+#ifdef _OPENMP
+  if(split_threads) omp_set_num_threads(darktable.num_openmp_threads);
+#else
+  (void)split_threads;
+#endif
+
   // remove the job from scheduled job array (for job deduping)
   dt_pthread_mutex_lock(&control->queue_mutex);
   control->job[dt_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
+  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled--;
   dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // and free it
@@ -608,6 +622,9 @@ void dt_control_jobs_init(dt_control_t *control)
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
   control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  // keep at least one worker free for thumbnails and other background jobs
+  control->export_scheduled = 0;
+  control->max_export_jobs = CLAMP(dt_conf_get_int("max_parallel_exports"), 1, MAX(1, control->num_threads - 1));
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -17,6 +17,8 @@
 */
 #include "control/jobs/camera_jobs.h"
 #include "common/darktable.h"
+#include "common/database.h"
+#include "common/exif.h"
 #include "common/import_session.h"
 #include "common/utility.h"
 #include "control/conf.h"
@@ -27,6 +29,9 @@
 #include <glib.h>
 #include <stdio.h>
 
+// images imported per database transaction, while downloaded ones are waiting
+#define DT_CAMERA_IMPORT_BATCH 256
+
 typedef struct dt_camera_shared_t
 {
   struct dt_import_session_t *session;
@@ -65,8 +70,26 @@ typedef struct dt_camera_import_t
   dt_job_t *job;
   double fraction;
   uint32_t import_count;
+  uint32_t total;
+
+  /* the downloaded files are imported while the next ones are downloaded. the readers parse their
+     metadata in parallel, the importer is a single thread importing them in download order. */
+  GThreadPool *readers;
+  GThreadPool *importer;
+  GMutex lock;
+  GCond cond;
+  uint32_t pending; // downloaded, not imported yet
+  gboolean transaction;
 } dt_camera_import_t;
 
+// one downloaded file, see dt_camera_import_t
+typedef struct dt_camera_import_item_t
+{
+  gchar *filename;
+  int32_t film_id; // of the session at download time, the next download may switch it
+  gboolean read;
+} dt_camera_import_item_t;
+
 void *dt_camera_previews_job_get_data(const dt_job_t *job)
 {
   if(!job) return NULL;
@@ -270,23 +293,78 @@ dt_job_t *dt_camera_get_previews_job_create(dt_camera_t *camera, dt_camctl_liste
   return job;
 }
 
-/** Listener interface for import job */
-void _camera_import_image_downloaded(const dt_camera_t *camera, const char *filename, void *data)
+static void _camera_import_read(gpointer data, gpointer user_data)
+{
+  dt_camera_import_item_t *item = (dt_camera_import_item_t *)data;
+  dt_camera_import_t *t = (dt_camera_import_t *)user_data;
+
+  gchar *normalized = dt_util_normalize_path(item->filename);
+  if(normalized) dt_exif_preload(normalized);
+  g_free(normalized);
+
+  g_mutex_lock(&t->lock);
+  item->read = TRUE;
+  g_cond_broadcast(&t->cond);
+  g_mutex_unlock(&t->lock);
+}
+
+static void _camera_import_image(gpointer data, gpointer user_data)
 {
+  dt_camera_import_item_t *item = (dt_camera_import_item_t *)data;
+  dt_camera_import_t *t = (dt_camera_import_t *)user_data;
+
+  g_mutex_lock(&t->lock);
+  while(!item->read) g_cond_wait(&t->cond, &t->lock);
+  g_mutex_unlock(&t->lock);
+
+  // while downloads are piling up the imports are batched, otherwise there is nothing to wait for
+  if(!t->transaction) t->transaction = dt_database_start_transaction(darktable.db);
+
   // Import downloaded image to import filmroll
-  dt_camera_import_t *t = (dt_camera_import_t *)data;
-  dt_image_import(dt_import_session_film_id(t->shared.session), filename, FALSE);
+  dt_image_import(item->film_id, item->filename, FALSE);
+  gchar *normalized = dt_util_normalize_path(item->filename);
+  if(normalized) dt_exif_preload_release(normalized);
+  g_free(normalized);
+
+  t->import_count++;
+  if(t->import_count % DT_CAMERA_IMPORT_BATCH == 0 || g_thread_pool_unprocessed(t->importer) == 0)
+  {
+    dt_database_release_transaction(darktable.db, t->transaction);
+    t->transaction = FALSE;
+  }
+
   dt_control_queue_redraw_center();
-  gchar *basename = g_path_get_basename(filename);
-  dt_control_log(ngettext("%d/%d imported to %s", "%d/%d imported to %s", t->import_count + 1),
-                 t->import_count + 1, g_list_length(t->images), basename);
+  gchar *basename = g_path_get_basename(item->filename);
+  dt_control_log(ngettext("%d/%d imported to %s", "%d/%d imported to %s", t->import_count),
+                 t->import_count, t->total, basename);
   g_free(basename);
 
-  t->fraction += 1.0 / g_list_length(t->images);
+  t->fraction += 1.0 / t->total;
 
   dt_control_job_set_progress(t->job, t->fraction);
 
-  t->import_count++;
+  g_free(item->filename);
+  free(item);
+
+  g_mutex_lock(&t->lock);
+  t->pending--;
+  g_cond_broadcast(&t->cond);
+  g_mutex_unlock(&t->lock);
+}
+
+/** Listener interface for import job */
+void _camera_import_image_downloaded(const dt_camera_t *camera, const char *filename, void *data)
+{
+  // leave the import to the other threads and go on with the next download
+  dt_camera_import_t *t = (dt_camera_import_t *)data;
+  dt_camera_import_item_t *item = (dt_camera_import_item_t *)calloc(1, sizeof(dt_camera_import_item_t));
+  item->filename = g_strdup(filename);
+  item->film_id = dt_import_session_film_id(t->shared.session);
+  g_mutex_lock(&t->lock);
+  t->pending++;
+  g_mutex_unlock(&t->lock);
+  g_thread_pool_push(t->readers, item, NULL);
+  g_thread_pool_push(t->importer, item, NULL);
 }
 
 static const char *_camera_request_image_filename(const dt_camera_t *camera, const char *filename,
@@ -317,6 +395,22 @@ static const char *_camera_request_image_path(const dt_camera_t *camera, time_t
   return dt_import_session_path(shared->session, FALSE);
 }
 
+static const char *_camera_import_request_image_path(const dt_camera_t *camera, time_t *exif_time, void *data)
+{
+  dt_camera_import_t *t = (dt_camera_import_t *)data;
+  if(exif_time) dt_import_session_set_exif_time(t->shared.session, *exif_time);
+
+  // the session removes its film roll when switching to a new path if it is still empty, so the
+  // images downloaded to it have to be imported first
+  if(dt_import_session_path_changed(t->shared.session))
+  {
+    g_mutex_lock(&t->lock);
+    while(t->pending) g_cond_wait(&t->cond, &t->lock);
+    g_mutex_unlock(&t->lock);
+  }
+  return _camera_request_image_path(camera, exif_time, data);
+}
+
 static int32_t dt_camera_import_job_run(dt_job_t *job)
 {
   dt_camera_import_t *params = dt_control_job_get_params(job);
@@ -328,7 +422,8 @@ static int32_t dt_camera_import_job_run(dt_job_t *job)
     return 1;
   }
 
-  guint total = g_list_length(params->images);
+  const guint total = g_list_length(params->images);
+  params->total = total;
   char message[512] = { 0 };
   snprintf(message, sizeof(message),
            ngettext("importing %d image from camera", "importing %d images from camera", total), total);
@@ -342,14 +437,28 @@ static int32_t dt_camera_import_job_run(dt_job_t *job)
   dt_camctl_listener_t listener = { 0 };
   listener.data = params;
   listener.image_downloaded = _camera_import_image_downloaded;
-  listener.request_image_path = _camera_request_image_path;
+  listener.request_image_path = _camera_import_request_image_path;
   listener.request_image_filename = _camera_request_image_filename;
 
+  g_mutex_init(&params->lock);
+  g_cond_init(&params->cond);
+  params->readers = g_thread_pool_new(_camera_import_read, params, MAX(1, dt_get_num_threads() - 1), FALSE, NULL);
+  params->importer = g_thread_pool_new(_camera_import_image, params, 1, FALSE, NULL);
+  params->pending = 0;
+  params->transaction = FALSE;
+
   // start download of images
   dt_camctl_register_listener(darktable.camctl, &listener);
   dt_camctl_import(darktable.camctl, params->camera, params->images);
   dt_camctl_unregister_listener(darktable.camctl, &listener);
 
+  // wait for the imports of the last downloads
+  g_thread_pool_free(params->readers, FALSE, TRUE);
+  g_thread_pool_free(params->importer, FALSE, TRUE);
+  dt_database_release_transaction(darktable.db, params->transaction);
+  g_mutex_clear(&params->lock);
+  g_cond_clear(&params->cond);
+
   // notify the user via the window manager
   dt_ui_notify_user();
 
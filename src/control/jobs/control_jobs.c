@@ -16,10 +16,12 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "control/jobs/control_jobs.h"
+#include "common/autotune.h"
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/export_processes.h"
 #include "common/film.h"
 #include "common/gpx.h"
 #include "common/history.h"
@@ -28,6 +30,8 @@
 #include "common/imageio.h"
 #include "common/imageio_dng.h"
 #include "common/imageio_module.h"
+#include "common/metadata_export.h"
+#include "common/metrics.h"
 #include "common/mipmap_cache.h"
 #include "common/tags.h"
 #include "common/undo.h"
@@ -72,6 +76,10 @@ typedef struct dt_control_export_t
   gchar *icc_filename;
   dt_iop_color_intent_t icc_intent;
   gchar *metadata_export;
+  dt_imageio_module_data_t *fdata; // format params of dt_control_export_with_params(), NULL for the gui ones
+  dt_control_export_callback_t callback;
+  gpointer user_data;
+  GDestroyNotify destroy;
 } dt_control_export_t;
 
 typedef struct dt_control_image_enumerator_t
@@ -212,36 +220,106 @@ static dt_job_t *dt_control_generic_image_job_create(dt_job_execute_callback exe
   return job;
 }
 
-static int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
+// sidecars are mostly exiv2 serialisation and small file writes, a few threads keep the disk busy
+#define DT_SIDECAR_WRITERS 4
+
+typedef struct _sidecar_worker_t
 {
-  dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
-  GList *t = params->index;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1", -1,
-                              &stmt, NULL);
-  while(t)
+  dt_job_t *job;
+  dt_pthread_mutex_t lock; // protects everything below
+  GList *t;
+  guint total;
+  guint done;
+  GList *written; // images whose sidecar was written, for the timestamp update
+  double start;
+} _sidecar_worker_t;
+
+static void *_sidecar_worker(void *data)
+{
+  _sidecar_worker_t *w = (_sidecar_worker_t *)data;
+  while(dt_control_job_get_state(w->job) != DT_JOB_STATE_CANCELLED)
   {
+    dt_pthread_mutex_lock(&w->lock);
+    if(!w->t)
+    {
+      dt_pthread_mutex_unlock(&w->lock);
+      break;
+    }
+    const int imgid = GPOINTER_TO_INT(w->t->data);
+    w->t = g_list_next(w->t);
+    dt_pthread_mutex_unlock(&w->lock);
+
     gboolean from_cache = FALSE;
-    const int imgid = GPOINTER_TO_INT(t->data);
     const dt_image_t *img = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
     char dtfilename[PATH_MAX] = { 0 };
     dt_image_full_path(img->id, dtfilename, sizeof(dtfilename), &from_cache);
     dt_image_path_append_version(img->id, dtfilename, sizeof(dtfilename));
     g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
-    if(!dt_exif_xmp_write(imgid, dtfilename))
+    const gboolean written = !dt_exif_xmp_write(imgid, dtfilename);
+    dt_image_cache_read_release(darktable.image_cache, img);
+
+    dt_pthread_mutex_lock(&w->lock);
+    if(written) w->written = g_list_prepend(w->written, GINT_TO_POINTER(imgid));
+    w->done++;
+    const guint done = w->done;
+    dt_pthread_mutex_unlock(&w->lock);
+
+    // every few images is enough for the progress bar
+    if(done % 16 == 0 || done == w->total)
     {
-      // put the timestamp into db. this can't be done in exif.cc since that code gets called
-      // for the copy exporter, too
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-      sqlite3_step(stmt);
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
+      const double elapsed = dt_get_wtime() - w->start;
+      char message[512] = { 0 };
+      snprintf(message, sizeof(message), _("writing sidecar files %d / %d (%.0f/s)"), done, w->total,
+               elapsed > 0.0 ? done / elapsed : 0.0);
+      dt_control_job_set_progress_message(w->job, message);
+      dt_control_job_set_progress(w->job, (double)done / w->total);
     }
-    dt_image_cache_read_release(darktable.image_cache, img);
-    t = g_list_next(t);
+  }
+  return NULL;
+}
+
+static int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
+  _sidecar_worker_t worker = { .job = job,
+                               .t = params->index,
+                               .total = g_list_length(params->index),
+                               .done = 0,
+                               .written = NULL,
+                               .start = dt_get_wtime() };
+  if(!worker.total) return 0;
+  dt_pthread_mutex_init(&worker.lock, NULL);
+
+  const int writers = CLAMP(dt_get_num_threads(), 1, MIN(DT_SIDECAR_WRITERS, (int)worker.total));
+  pthread_t *threads = writers > 1 ? (pthread_t *)calloc(writers - 1, sizeof(pthread_t)) : NULL;
+  int started = 0;
+  for(int k = 0; threads && k < writers - 1; k++)
+    if(!dt_pthread_create(&threads[k], _sidecar_worker, &worker)) started++;
+  _sidecar_worker(&worker);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+  free(threads);
+  dt_pthread_mutex_destroy(&worker.lock);
+
+  // put the timestamps into db. this can't be done in exif.cc since that code gets called
+  // for the copy exporter, too. one transaction for all of them, not one per image.
+  const gboolean transaction = dt_database_start_transaction(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1", -1,
+                              &stmt, NULL);
+  for(GList *l = worker.written; l; l = g_list_next(l))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
   }
   sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db, transaction);
+  g_list_free(worker.written);
+
+  dt_print(DT_DEBUG_PERF, "[write_sidecar_files] %u sidecars in %.3f secs with %d threads\n", worker.done,
+           dt_get_wtime() - worker.start, writers);
   return 0;
 }
 
@@ -365,73 +443,85 @@ static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const c
   const float cal = 100.0f / (aperture * exp * iso);
   // about proportional to how many photons we can expect from this shot:
   const float photoncnt = 100.0f * aperture * exp / iso;
-  float saturation = 1.0f;
+  const float saturation = 1.0f;
   d->whitelevel = fmaxf(d->whitelevel, saturation * cal);
+  const float whitelevel = d->whitelevel;
+  const float epsw = d->epsw;
+  const int wd = d->wd, ht = d->ht;
+  const float *const in = (const float *)ivoid;
+  float *const pixels = d->pixels;
+  float *const weight = d->weight;
+
+  // need some safety margin due to upsampling and 16-bit quantization + dithering?
+  const float offset = 3000.0f / (float)UINT16_MAX;
+
+  // the envelope is based on the 3x3 neighbourhood of the 2x2 block a pixel is in, so it is
+  // only computed once per block and shared by its four pixels.
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ivoid, cal, photoncnt) \
-  shared(d, saturation) \
+  dt_omp_firstprivate(in, pixels, weight, wd, ht, cal, photoncnt, whitelevel, epsw, offset, saturation) \
   schedule(static)
 #endif
-  for(int y = 0; y < d->ht; y++)
-    for(int x = 0; x < d->wd; x++)
+  for(int yy = 0; yy < ht; yy += 2)
+    for(int xx = 0; xx < wd; xx += 2)
     {
-      // read unclamped raw value with subtracted black and rescaled to 1.0 saturation.
-      // this is the output of the rawprepare iop.
-      const float in = ((float *)ivoid)[x + d->wd * y];
       // weights based on siggraph 12 poster
       // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
       // 2d denoising factor for high dynamic range imaging
       float w = photoncnt;
 
-      // need some safety margin due to upsampling and 16-bit quantization + dithering?
-      float offset = 3000.0f / (float)UINT16_MAX;
-
       // cannot do an envelope based on single pixel values here, need to get
       // maximum value of all color channels. to find that, go through the
       // pattern block (we conservatively do a 3x3 for bayer or xtrans):
-      int xx = x & ~1, yy = y & ~1;
       float M = 0.0f, m = FLT_MAX;
-      if(xx < d->wd - 2 && yy < d->ht - 2)
+      if(xx < wd - 2 && yy < ht - 2)
       {
-        for(int i = 0; i < 3; i++)
-          for(int j = 0; j < 3; j++)
-          {
-            M = MAX(M, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-            m = MIN(m, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-          }
+        for(int j = 0; j < 3; j++)
+        {
+          const float *const row = in + (size_t)wd * (yy + j) + xx;
+          M = MAX(M, MAX(row[0], MAX(row[1], row[2])));
+          m = MIN(m, MIN(row[0], MIN(row[1], row[2])));
+        }
         // move envelope a little to allow non-zero weight even for clipped regions.
         // this is because even if the 2x2 block is clipped somewhere, the other channels
         // might still prove useful. we'll check for individual channel saturation below.
-        w *= d->epsw + envelope((M + offset) / saturation);
+        w *= epsw + envelope((M + offset) / saturation);
       }
-
-      if(M + offset >= saturation)
-      {
-        if(d->weight[x + d->wd * y] <= 0.0f)
-        { // only consider saturated pixels in case we have nothing better:
-          if(d->weight[x + d->wd * y] == 0 || m < -d->weight[x + d->wd * y])
+      const gboolean clipped = M + offset >= saturation;
+
+      for(int y = yy; y < MIN(yy + 2, ht); y++)
+        for(int x = xx; x < MIN(xx + 2, wd); x++)
+        {
+          const size_t k = (size_t)wd * y + x;
+          // read unclamped raw value with subtracted black and rescaled to 1.0 saturation.
+          // this is the output of the rawprepare iop.
+          const float v = in[k];
+          if(clipped)
           {
-            if(m + offset >= saturation)
-              d->pixels[x + d->wd * y] = 1.0f; // let's admit we were completely clipped, too
-            else
-              d->pixels[x + d->wd * y] = in * cal / d->whitelevel;
-            d->weight[x + d->wd * y]
-                = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
+            if(weight[k] <= 0.0f)
+            { // only consider saturated pixels in case we have nothing better:
+              if(weight[k] == 0 || m < -weight[k])
+              {
+                if(m + offset >= saturation)
+                  pixels[k] = 1.0f; // let's admit we were completely clipped, too
+                else
+                  pixels[k] = v * cal / whitelevel;
+                weight[k] = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
+              }
+            }
+            // else silently ignore, others have filled in a better color here already
+          }
+          else
+          {
+            if(weight[k] <= 0.0)
+            { // cleanup potentially blown highlights from earlier images
+              pixels[k] = 0.0f;
+              weight[k] = 0.0f;
+            }
+            pixels[k] += w * v * cal;
+            weight[k] += w;
           }
         }
-        // else silently ignore, others have filled in a better color here already
-      }
-      else
-      {
-        if(d->weight[x + d->wd * y] <= 0.0)
-        { // cleanup potentially blown highlights from earlier images
-          d->pixels[x + d->wd * y] = 0.0f;
-          d->weight[x + d->wd * y] = 0.0f;
-        }
-        d->pixels[x + d->wd * y] += w * in * cal;
-        d->weight[x + d->wd * y] += w;
-      }
     }
 
   return 0;
@@ -464,6 +554,12 @@ static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
 
     const uint32_t imgid = GPOINTER_TO_INT(t->data);
 
+    // let a worker thread decode the next bracket while this one goes through the pipe and is merged.
+    // only one bracket is fetched ahead, so at most two full raws are held on top of the accumulation buffers.
+    if(g_list_next(t))
+      dt_mipmap_cache_get(darktable.mipmap_cache, NULL, GPOINTER_TO_INT(g_list_next(t)->data), DT_MIPMAP_FULL,
+                          DT_MIPMAP_PREFETCH, 'r');
+
     dt_imageio_export_with_flags(imgid, "unused", &buf, (dt_imageio_module_data_t *)&dat, TRUE, FALSE, FALSE, TRUE,
                                  FALSE, "pre:rawprepare", FALSE, FALSE, DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL,
                                  NULL, num, total, NULL);
@@ -480,12 +576,19 @@ static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
 
 // normalize by white level to make clipping at 1.0 work as expected
 
+  float *const pixels = d.pixels;
+  const float *const weight = d.weight;
+  const float whitelevel = d.whitelevel;
+  const size_t npixels = (size_t)d.wd * d.ht;
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(d)
+#pragma omp parallel for simd schedule(static) default(none) \
+  dt_omp_firstprivate(pixels, weight, whitelevel, npixels)
 #endif
-  for(size_t k = 0; k < (size_t)d.wd * d.ht; k++)
+  for(size_t k = 0; k < npixels; k++)
   {
-    if(d.weight[k] > 0.0) d.pixels[k] = fmaxf(0.0f, d.pixels[k] / (d.whitelevel * d.weight[k]));
+    // lanes without a positive weight keep their (clipped) value
+    const float merged = fmaxf(0.0f, pixels[k] / (whitelevel * weight[k]));
+    pixels[k] = weight[k] > 0.0f ? merged : pixels[k];
   }
 
   // output hdr as digital negative with exif data.
@@ -624,6 +727,11 @@ static GList *_get_full_pathname(char *imgs)
   return list;
 }
 
+// images removed from the database per transaction
+#define DT_REMOVE_CHUNK 256
+// threads trashing files at the same time
+#define DT_DELETE_THREADS 4
+
 static int32_t dt_control_remove_images_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
@@ -670,13 +778,16 @@ static int32_t dt_control_remove_images_job_run(dt_job_t *job)
 
   free(imgs);
 
+  // in chunks, so the progress bar moves and the database isn't locked for the whole job
+  guint done = 0;
   while(t)
   {
-    int imgid = GPOINTER_TO_INT(t->data);
-    dt_image_remove(imgid);
-    t = g_list_next(t);
-    const double fraction = 1.0 / total;
-    dt_control_job_set_progress(job, fraction);
+    GList *chunk = NULL;
+    for(int k = 0; t && k < DT_REMOVE_CHUNK; k++, t = g_list_next(t), done++)
+      chunk = g_list_prepend(chunk, t->data);
+    dt_image_remove_list(chunk);
+    g_list_free(chunk);
+    dt_control_job_set_progress(job, (double)done / total);
   }
 
   while(list)
@@ -767,8 +878,12 @@ static gboolean _dt_delete_dialog_main_thread(gpointer user_data)
   return FALSE;
 }
 
+// the delete job trashes files from several threads, but asks about failures one at a time
+static GMutex _delete_dialog_lock;
+
 static gint _dt_delete_file_display_modal_dialog(int send_to_trash, const char *filename, const char *error_message)
 {
+  g_mutex_lock(&_delete_dialog_lock);
   _dt_delete_modal_dialog_t modal_dialog;
   modal_dialog.send_to_trash = send_to_trash;
   modal_dialog.filename = filename;
@@ -788,6 +903,7 @@ static gint _dt_delete_file_display_modal_dialog(int send_to_trash, const char *
   dt_pthread_mutex_unlock(&modal_dialog.mutex);
   dt_pthread_mutex_destroy(&modal_dialog.mutex);
   pthread_cond_destroy(&modal_dialog.cond);
+  g_mutex_unlock(&_delete_dialog_lock);
 
   return modal_dialog.dialog_result;
 }
@@ -886,6 +1002,74 @@ static enum _dt_delete_status delete_file_from_disk(const char *filename, gboole
 }
 
 
+typedef struct _delete_task_t
+{
+  gchar *filename;        // file to delete
+  gboolean with_sidecars; // also delete all sidecars of it, including left-overs of removed duplicates
+} _delete_task_t;
+
+static void _delete_task_free(gpointer data)
+{
+  _delete_task_t *task = (_delete_task_t *)data;
+  g_free(task->filename);
+  free(task);
+}
+
+typedef struct _delete_worker_t
+{
+  dt_job_t *job;
+  dt_pthread_mutex_t lock; // protects everything below
+  GList *tasks;
+  gboolean delete_on_trash_error;
+  gboolean stop;
+  guint done;
+  guint total;
+} _delete_worker_t;
+
+static void *_delete_worker(void *data)
+{
+  _delete_worker_t *w = (_delete_worker_t *)data;
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&w->lock);
+    if(w->stop || !w->tasks)
+    {
+      dt_pthread_mutex_unlock(&w->lock);
+      break;
+    }
+    _delete_task_t *task = (_delete_task_t *)w->tasks->data;
+    w->tasks = g_list_delete_link(w->tasks, w->tasks);
+    gboolean delete_on_trash_error = w->delete_on_trash_error;
+    dt_pthread_mutex_unlock(&w->lock);
+
+    enum _dt_delete_status delete_status = delete_file_from_disk(task->filename, &delete_on_trash_error);
+
+    if(task->with_sidecars && delete_status == _DT_DELETE_STATUS_OK_TO_REMOVE)
+    {
+      // all sidecar files - including left-overs - can be deleted;
+      // left-overs can result when previously duplicates have been REMOVED;
+      // no need to keep them as the source data file is gone.
+      GList *files = dt_image_find_duplicates(task->filename);
+      for(GList *file_iter = files; file_iter; file_iter = g_list_next(file_iter))
+      {
+        delete_status = delete_file_from_disk(file_iter->data, &delete_on_trash_error);
+        if(delete_status != _DT_DELETE_STATUS_OK_TO_REMOVE) break;
+      }
+      g_list_free_full(files, g_free);
+    }
+    _delete_task_free(task);
+
+    dt_pthread_mutex_lock(&w->lock);
+    w->delete_on_trash_error |= delete_on_trash_error;
+    if(delete_status == _DT_DELETE_STATUS_STOP_PROCESSING) w->stop = TRUE;
+    w->done++;
+    const double fraction = (double)w->done / w->total;
+    dt_pthread_mutex_unlock(&w->lock);
+    dt_control_job_set_progress(w->job, fraction);
+  }
+  return NULL;
+}
+
 static int32_t dt_control_delete_images_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
@@ -894,7 +1078,6 @@ static int32_t dt_control_delete_images_job_run(dt_job_t *job)
   char imgidstr[25] = { 0 };
   guint total = g_list_length(t);
   char message[512] = { 0 };
-  gboolean delete_on_trash_error = FALSE;
   if (dt_conf_get_bool("send_to_trash"))
     snprintf(message, sizeof(message), ngettext("trashing %d image", "trashing %d images", total), total);
   else
@@ -910,90 +1093,81 @@ static int32_t dt_control_delete_images_job_run(dt_job_t *job)
 
   free(imgs);
 
+  _delete_worker_t worker = { .job = job, .tasks = NULL, .delete_on_trash_error = FALSE, .stop = FALSE,
+                              .done = 0, .total = total };
+  dt_pthread_mutex_init(&worker.lock, NULL);
+  const int threads = CLAMP(dt_get_num_threads(), 1, MIN(DT_DELETE_THREADS, (int)total));
+  pthread_t *thread = threads > 1 ? (pthread_t *)calloc(threads - 1, sizeof(pthread_t)) : NULL;
+
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(*) FROM main.images WHERE filename IN (SELECT filename FROM "
                               "main.images WHERE id = ?1) AND film_id IN (SELECT film_id FROM main.images WHERE "
                               "id = ?1)", -1, &stmt, NULL);
-  while(t)
+  while(t && !worker.stop)
   {
-    enum _dt_delete_status delete_status = _DT_DELETE_STATUS_UNKNOWN;
-    const int imgid = GPOINTER_TO_INT(t->data);
-    char filename[PATH_MAX] = { 0 };
-    gboolean from_cache = FALSE;
-    dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
-
-#ifdef _WIN32
-    char *dirname = g_path_get_dirname(filename);
-#endif
-
-    int duplicates = 0;
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-    if(sqlite3_step(stmt) == SQLITE_ROW) duplicates = sqlite3_column_int(stmt, 0);
-    sqlite3_reset(stmt);
-    sqlite3_clear_bindings(stmt);
-
-    // remove from disk:
-    if(duplicates == 1)
+    // remove a chunk of images from the database in one transaction. the files are deleted afterwards,
+    // because removing will re-write the XMP, and several at a time.
+    const gboolean transaction = dt_database_start_transaction(darktable.db);
+    GList *tasks = NULL;
+    guint skipped = 0;
+    for(int k = 0; t && k < DT_REMOVE_CHUNK; k++, t = g_list_next(t))
     {
-      // first check for local copies, never delete a file whose original file is not accessible
-      if (dt_image_local_copy_reset(imgid))
-        goto delete_next_file;
-
-      snprintf(imgidstr, sizeof(imgidstr), "%d", imgid);
-      _set_remove_flag(imgidstr);
-      dt_image_remove(imgid);
+      const int imgid = GPOINTER_TO_INT(t->data);
+      char filename[PATH_MAX] = { 0 };
+      gboolean from_cache = FALSE;
+      dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
 
-      // there are no further duplicates so we can remove the source data file
-      delete_status = delete_file_from_disk(filename, &delete_on_trash_error);
-      if (delete_status != _DT_DELETE_STATUS_OK_TO_REMOVE)
-        goto delete_next_file;
-
-      // all sidecar files - including left-overs - can be deleted;
-      // left-overs can result when previously duplicates have been REMOVED;
-      // no need to keep them as the source data file is gone.
-
-      GList *files = dt_image_find_duplicates(filename);
+      int duplicates = 0;
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+      if(sqlite3_step(stmt) == SQLITE_ROW) duplicates = sqlite3_column_int(stmt, 0);
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
 
-      GList *file_iter = g_list_first(files);
-      while(file_iter != NULL)
+      _delete_task_t *task = (_delete_task_t *)calloc(1, sizeof(_delete_task_t));
+      // remove from disk:
+      if(duplicates == 1)
       {
-        delete_status = delete_file_from_disk(file_iter->data, &delete_on_trash_error);
-        if (delete_status != _DT_DELETE_STATUS_OK_TO_REMOVE)
-          break;
-        file_iter = g_list_next(file_iter);
+        // first check for local copies, never delete a file whose original file is not accessible
+        if(dt_image_local_copy_reset(imgid))
+        {
+          free(task);
+          skipped++;
+          continue;
+        }
+        // there are no further duplicates so we can remove the source data file
+        task->with_sidecars = TRUE;
       }
+      else
+      {
+        // don't remove the actual source data if there are further duplicates using it;
+        // just delete the xmp file of the duplicate selected.
+        dt_image_path_append_version(imgid, filename, sizeof(filename));
+        g_strlcat(filename, ".xmp", sizeof(filename));
+      }
+      task->filename = g_strdup(filename);
+      tasks = g_list_prepend(tasks, task);
 
-      g_list_free_full(files, g_free);
-    }
-    else
-    {
-      // don't remove the actual source data if there are further duplicates using it;
-      // just delete the xmp file of the duplicate selected.
-
-      dt_image_path_append_version(imgid, filename, sizeof(filename));
-      g_strlcat(filename, ".xmp", sizeof(filename));
-
-      // remove image from db first ...
       snprintf(imgidstr, sizeof(imgidstr), "%d", imgid);
       _set_remove_flag(imgidstr);
       dt_image_remove(imgid);
-
-      // ... and delete afterwards because removing will re-write the XMP
-      delete_status = delete_file_from_disk(filename, &delete_on_trash_error);
     }
-
-delete_next_file:
-#ifdef _WIN32
-    g_free(dirname);
-#endif
-    t = g_list_next(t);
-    const double fraction = 1.0 / total;
-    dt_control_job_set_progress(job, fraction);
-    if (delete_status == _DT_DELETE_STATUS_STOP_PROCESSING)
-      break;
+    dt_database_release_transaction(darktable.db, transaction);
+
+    worker.tasks = g_list_reverse(tasks);
+    worker.done += skipped;
+    int started = 0;
+    for(int k = 0; thread && k < threads - 1; k++)
+      if(!dt_pthread_create(&thread[k], _delete_worker, &worker)) started++;
+    _delete_worker(&worker);
+    for(int k = 0; k < started; k++) pthread_join(thread[k], NULL);
+    // left over when the user stopped the process
+    g_list_free_full(worker.tasks, _delete_task_free);
+    worker.tasks = NULL;
   }
 
   sqlite3_finalize(stmt);
+  free(thread);
+  dt_pthread_mutex_destroy(&worker.lock);
 
   while(list)
   {
@@ -1033,7 +1207,9 @@ static int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
   if(!tz_camera) goto bail_out;
   GTimeZone *tz_utc = g_time_zone_new_utc();
 
-  dt_undo_start_group(darktable.undo, DT_UNDO_GEOTAG);
+  /* the matches are written all at once below */
+  GList *imgs = NULL;
+  GArray *gloc = g_array_new(FALSE, FALSE, sizeof(dt_image_geoloc_t));
 
   /* go thru each selected image and lookup location in gpx */
   do
@@ -1081,14 +1257,18 @@ static int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
     /* only update image location if time is within gpx tack range */
     if(dt_gpx_get_location(gpx, &timestamp, &geoloc))
     {
-      // set location to image and its group
-      dt_image_set_location(imgid, &geoloc, TRUE, TRUE);
+      imgs = g_list_prepend(imgs, GINT_TO_POINTER(imgid));
+      g_array_append_val(gloc, geoloc);
       cntr++;
     }
 
   } while((t = g_list_next(t)) != NULL);
 
-  dt_undo_end_group(darktable.undo);
+  // set location to images and their groups
+  imgs = g_list_reverse(imgs);
+  dt_image_set_images_locations(imgs, gloc, TRUE, TRUE);
+  g_list_free(imgs);
+  g_array_free(gloc, TRUE);
 
   dt_control_log(ngettext("applied matched GPX location onto %d image", "applied matched GPX location onto %d images", cntr), cntr);
 
@@ -1190,6 +1370,148 @@ static int32_t dt_control_refresh_exif_run(dt_job_t *job)
   return 0;
 }
 
+static gboolean _autotune_progress(void *data, const double fraction)
+{
+  dt_job_t *job = (dt_job_t *)data;
+  dt_control_job_set_progress(job, fraction);
+  return dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED;
+}
+
+static int32_t dt_control_autotune_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
+  dt_control_job_set_progress_message(job, _("tuning the processing settings"));
+  if(dt_autotune_run(params->index, NULL, _autotune_progress, job))
+    dt_control_log(_("tuning failed, the images couldn't be processed"));
+  else
+    dt_control_log(_("tuned settings are in place, the results are in autotune.txt"));
+  return 0;
+}
+
+
+// shared state of the images in flight of one export job
+typedef struct _export_worker_t
+{
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_format_t *mformat;
+  dt_imageio_module_storage_t *mstorage;
+  dt_imageio_module_data_t *sdata;
+  dt_imageio_module_data_t *fdata; // the template, every worker uses its own copy
+  dt_export_metadata_t *metadata;
+  guint tagid, etagid;
+  dt_export_processes_t *processes; // darktable-cli processes doing the work, NULL to export in process
+
+  dt_pthread_mutex_t lock; // protects everything below
+  GList *t;
+  guint total;
+  guint done;
+  int in_flight; // number of workers
+  int threads;   // openmp threads for each worker
+} _export_worker_t;
+
+static gboolean _export_image(_export_worker_t *w, dt_imageio_module_data_t *fdata, const int imgid,
+                              const guint num)
+{
+  gboolean ok = FALSE;
+  dt_job_t *job = w->job;
+  dt_control_export_t *settings = w->settings;
+
+  // remove 'changed' tag from image
+  dt_tag_detach(w->tagid, imgid, FALSE, FALSE);
+  // make sure the 'exported' tag is set on the image
+  dt_tag_attach_from_gui(w->etagid, imgid, FALSE, FALSE);
+
+  /* register export timestamp in cache */
+  dt_image_cache_set_export_timestamp(darktable.image_cache, imgid);
+
+  // check if image still exists:
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
+  if(image)
+  {
+    char imgfilename[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
+    if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
+    {
+      dt_control_log(_("image `%s' is currently unavailable"), image->filename);
+      fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
+      // dt_image_remove(imgid);
+      dt_image_cache_read_release(darktable.image_cache, image);
+    }
+    else
+    {
+      dt_image_cache_read_release(darktable.image_cache, image);
+      // the disk storage params start with the file name pattern, darktable-cli relies on that as well
+      const int res = w->processes
+                          ? dt_export_processes_store(w->processes, imgid, (const char *)w->sdata, num, w->total)
+                          : w->mstorage->store(w->mstorage, w->sdata, imgid, w->mformat, fdata, num, w->total,
+                                               settings->high_quality, settings->upscale, settings->export_masks,
+                                               settings->icc_type, settings->icc_filename, settings->icc_intent,
+                                               w->metadata);
+      if(res != 0)
+        dt_control_job_cancel(job);
+      else
+        ok = TRUE;
+    }
+  }
+  return ok;
+}
+
+// pulls images off the list until it is empty. run by every thread of the export job,
+// so while one image is being loaded, another is processed and a third one encoded.
+static void *_export_worker(void *data)
+{
+  _export_worker_t *w = (_export_worker_t *)data;
+#ifdef _OPENMP
+  omp_set_num_threads(w->threads);
+#endif
+
+  dt_imageio_module_data_t *fdata = w->fdata;
+  if(w->in_flight > 1)
+  {
+    // formats keep per image state (one jpeg struct etc) behind the params
+    fdata = w->mformat->get_params(w->mformat);
+    memcpy(fdata, w->fdata, w->mformat->params_size(w->mformat));
+  }
+
+  while(dt_control_job_get_state(w->job) != DT_JOB_STATE_CANCELLED)
+  {
+    dt_pthread_mutex_lock(&w->lock);
+    if(!w->t)
+    {
+      dt_pthread_mutex_unlock(&w->lock);
+      break;
+    }
+    const int imgid = GPOINTER_TO_INT(w->t->data);
+    w->t = g_list_next(w->t);
+    const guint num = w->total - g_list_length(w->t);
+    // the next image is read from disk while this one is processed
+    const int next = w->t ? GPOINTER_TO_INT(w->t->data) : -1;
+
+    // progress message
+    char message[512] = { 0 };
+    snprintf(message, sizeof(message), _("exporting %d / %d to %s"), num, w->total, w->mstorage->name(w->mstorage));
+    // update the message. initialize_store() might have changed the number of images
+    dt_control_job_set_progress_message(w->job, message);
+    dt_pthread_mutex_unlock(&w->lock);
+
+    if(next > 0) dt_image_readahead(next);
+    const double start = dt_get_wtime();
+    const gboolean ok = _export_image(w, fdata, imgid, num);
+    dt_metrics_observe_export(dt_get_wtime() - start);
+    dt_metrics_count(ok ? DT_METRICS_EXPORTED_IMAGES : DT_METRICS_EXPORT_FAILURES, 1);
+    if(w->settings->callback) w->settings->callback(imgid, ok, w->settings->user_data);
+
+    dt_pthread_mutex_lock(&w->lock);
+    w->done++;
+    dt_control_job_set_progress(w->job, MIN(1.0, (double)w->done / w->total));
+    dt_pthread_mutex_unlock(&w->lock);
+  }
+
+  if(fdata != w->fdata) w->mformat->free_params(w->mformat, fdata);
+  return NULL;
+}
 
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
@@ -1203,7 +1525,10 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   dt_imageio_module_data_t *sdata = settings->sdata;
 
   // get a thread-safe fdata struct (one jpeg struct per thread etc):
-  dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
+  // format params handed in by the caller can't be passed on to other processes, those come from the config
+  const gboolean own_fdata = settings->fdata != NULL;
+  dt_imageio_module_data_t *fdata = settings->fdata ? settings->fdata : mformat->get_params(mformat);
+  settings->fdata = NULL;
 
   if(mstorage->initialize_store)
   {
@@ -1235,8 +1560,6 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   const guint total = g_list_length(t);
   dt_control_log(ngettext("exporting %d image..", "exporting %d images..", total), total);
 
-  double fraction = 0;
-
   // set up the fdata struct
   fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
   fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
@@ -1257,54 +1580,48 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     metadata.list = g_list_remove(metadata.list, metadata.list->data);
   }
 
-  while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
-  {
-    const int imgid = GPOINTER_TO_INT(t->data);
-    t = g_list_next(t);
-    const guint num = total - g_list_length(t);
-
-    // progress message
-    char message[512] = { 0 };
-    snprintf(message, sizeof(message), _("exporting %d / %d to %s"), num, total, mstorage->name(mstorage));
-    // update the message. initialize_store() might have changed the number of images
-    dt_control_job_set_progress_message(job, message);
-
-    // remove 'changed' tag from image
-    dt_tag_detach(tagid, imgid, FALSE, FALSE);
-    // make sure the 'exported' tag is set on the image
-    dt_tag_attach_from_gui(etagid, imgid, FALSE, FALSE);
+  _export_worker_t worker = { .job = job,
+                              .settings = settings,
+                              .mformat = mformat,
+                              .mstorage = mstorage,
+                              .sdata = sdata,
+                              .fdata = fdata,
+                              .metadata = &metadata,
+                              .tagid = tagid,
+                              .etagid = etagid,
+                              .t = t,
+                              .total = total,
+                              .done = 0 };
+  dt_pthread_mutex_init(&worker.lock, NULL);
+
+  // how many images to keep in flight. each one holds a full pipe, so this bounds memory as well.
+  // the openmp threads are split between them.
+  int in_flight = 1;
+  if(mstorage->parallel_store && mstorage->parallel_store(mstorage))
+    in_flight = CLAMP(dt_conf_get_int("export_images_in_flight"), 1, MAX(1, (int)total));
+
+  // or leave the images to separate processes, one in flight for each of them. only the disk storage
+  // is available in darktable-cli.
+  const int nprocesses = dt_conf_get_int("export_processes");
+  if(nprocesses > 1 && total > 1 && !own_fdata && !strcmp(mstorage->plugin_name, "disk"))
+    worker.processes = dt_export_processes_start(MIN(nprocesses, (int)total), settings, mformat, fdata);
+  if(worker.processes) in_flight = dt_export_processes_count(worker.processes);
+  worker.in_flight = in_flight;
+  worker.threads = in_flight > 1 ? MAX(1, dt_get_num_threads() / in_flight) : darktable.num_openmp_threads;
+
+  pthread_t *threads = in_flight > 1 ? (pthread_t *)calloc(in_flight - 1, sizeof(pthread_t)) : NULL;
+  int started = 0;
+  for(int k = 0; threads && k < in_flight - 1; k++)
+    if(!dt_pthread_create(&threads[k], _export_worker, &worker)) started++;
+  _export_worker(&worker);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+  free(threads);
+  dt_export_processes_stop(worker.processes);
 
-    /* register export timestamp in cache */
-    dt_image_cache_set_export_timestamp(darktable.image_cache, imgid);
-
-    // check if image still exists:
-    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
-    if(image)
-    {
-      char imgfilename[PATH_MAX] = { 0 };
-      gboolean from_cache = TRUE;
-      dt_image_full_path(image->id, imgfilename, sizeof(imgfilename), &from_cache);
-      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
-      {
-        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
-        fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
-        // dt_image_remove(imgid);
-        dt_image_cache_read_release(darktable.image_cache, image);
-      }
-      else
-      {
-        dt_image_cache_read_release(darktable.image_cache, image);
-        if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality, settings->upscale,
-                           settings->export_masks, settings->icc_type, settings->icc_filename, settings->icc_intent,
-                           &metadata) != 0)
-          dt_control_job_cancel(job);
-      }
-    }
-
-    fraction += 1.0 / total;
-    if(fraction > 1.0) fraction = 1.0;
-    dt_control_job_set_progress(job, fraction);
-  }
+#ifdef _OPENMP
+  omp_set_num_threads(darktable.num_openmp_threads);
+#endif
+  dt_pthread_mutex_destroy(&worker.lock);
   g_list_free_full(metadata.list, g_free);
 
   if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
@@ -1667,6 +1984,13 @@ void dt_control_refresh_exif()
                                                           NULL, PROGRESS_CANCELLABLE, FALSE));
 }
 
+void dt_control_autotune()
+{
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG,
+                     dt_control_generic_images_job_create(&dt_control_autotune_run, N_("tune settings"), 0,
+                                                          NULL, PROGRESS_CANCELLABLE, FALSE));
+}
+
 static dt_control_image_enumerator_t *dt_control_export_alloc()
 {
   dt_control_image_enumerator_t *params = dt_control_image_enumerator_alloc();
@@ -1691,6 +2015,12 @@ static void dt_control_export_cleanup(void *p)
   dt_imageio_module_data_t *sdata = settings->sdata;
 
   mstorage->free_params(mstorage, sdata);
+  if(settings->fdata)
+  {
+    dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(settings->format_index);
+    mformat->free_params(mformat, settings->fdata);
+  }
+  if(settings->destroy) settings->destroy(settings->user_data);
 
   g_free(settings->icc_filename);
   g_free(settings->metadata_export);
@@ -1750,6 +2080,52 @@ void dt_control_export(GList *imgid_list, int max_width, int max_height, int for
   mstorage->export_dispatched(mstorage);
 }
 
+void dt_control_export_with_params(GList *imgid_list, dt_imageio_module_format_t *format,
+                                   dt_imageio_module_data_t *fdata, dt_imageio_module_storage_t *storage,
+                                   dt_imageio_module_data_t *sdata, gboolean high_quality, gboolean upscale,
+                                   const char *style, gboolean style_append,
+                                   dt_control_export_callback_t callback, gpointer user_data,
+                                   GDestroyNotify destroy)
+{
+  dt_job_t *job = dt_control_job_create(&dt_control_export_job_run, "export");
+  dt_control_image_enumerator_t *params = job ? dt_control_export_alloc() : NULL;
+  if(!params)
+  {
+    if(job) dt_control_job_dispose(job);
+    g_list_free(imgid_list);
+    format->free_params(format, fdata);
+    storage->free_params(storage, sdata);
+    if(destroy) destroy(user_data);
+    return;
+  }
+  dt_control_job_set_params(job, params, dt_control_export_cleanup);
+
+  params->index = imgid_list;
+
+  dt_control_export_t *data = params->data;
+  data->max_width = fdata->max_width;
+  data->max_height = fdata->max_height;
+  data->format_index = dt_imageio_get_index_of_format(format);
+  data->storage_index = dt_imageio_get_index_of_storage(storage);
+  data->fdata = fdata;
+  data->sdata = sdata;
+  data->high_quality = high_quality;
+  data->export_masks = dt_conf_get_bool("plugins/lighttable/export/export_masks");
+  data->upscale = upscale;
+  g_strlcpy(data->style, style ? style : "", sizeof(data->style));
+  data->style_append = style_append;
+  data->icc_type = dt_conf_get_int("plugins/lighttable/export/icctype");
+  data->icc_filename = dt_conf_get_string("plugins/lighttable/export/iccprofile");
+  data->icc_intent = DT_INTENT_LAST;
+  data->metadata_export = dt_lib_export_metadata_get_conf();
+  data->callback = callback;
+  data->user_data = user_data;
+  data->destroy = destroy;
+
+  dt_control_job_add_progress(job, _("export images"), TRUE);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_EXPORT, job);
+}
+
 static int32_t dt_control_time_offset_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
@@ -1846,7 +2222,7 @@ void dt_control_write_sidecar_files()
 {
   dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG,
                      dt_control_generic_images_job_create(&dt_control_write_sidecar_files_job_run,
-                                                          N_("write sidecar files"), 0, NULL, PROGRESS_NONE,
+                                                          N_("write sidecar files"), 0, NULL, PROGRESS_CANCELLABLE,
                                                           FALSE));
 }
 
@@ -45,12 +45,26 @@ void dt_control_export(GList *imgid_list, int max_width, int max_height, int for
                        char *style, gboolean style_append,
                        dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
                        dt_iop_color_intent_t icc_intent, const gchar *metadata_export);
+/** called by dt_control_export_with_params() from the export threads after each image, ok is FALSE
+ * if the image is unavailable or the storage failed. */
+typedef void (*dt_control_export_callback_t)(const int imgid, const gboolean ok, gpointer user_data);
+/** exports with the given format and storage params instead of the ones of the export module. the job
+ * takes over fdata, sdata and imgid_list, and releases user_data with destroy once it is done. */
+void dt_control_export_with_params(GList *imgid_list, dt_imageio_module_format_t *format,
+                                   dt_imageio_module_data_t *fdata, dt_imageio_module_storage_t *storage,
+                                   dt_imageio_module_data_t *sdata, gboolean high_quality, gboolean upscale,
+                                   const char *style, gboolean style_append,
+                                   dt_control_export_callback_t callback, gpointer user_data,
+                                   GDestroyNotify destroy);
 void dt_control_merge_hdr();
 
 void dt_control_seed_denoise();
 void dt_control_denoise();
 void dt_control_refresh_exif();
 
+/** times the act-on images with candidate settings and keeps the fastest, see dt_autotune_run(). */
+void dt_control_autotune();
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
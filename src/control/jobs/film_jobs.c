@@ -17,9 +17,55 @@
 */
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
+#include "common/exif.h"
 #include "common/film.h"
+#include "control/jobs/image_jobs.h"
+#include "dtgtk/thumbtable.h"
+#include "gui/gtk.h"
 #include <stdlib.h>
 
+// how many images the metadata readers may run ahead of the import, per reader
+#define DT_FILM_IMPORT_READAHEAD 8
+// images imported per database transaction
+#define DT_FILM_IMPORT_BATCH 256
+
+// one file of the import. the readers parse its metadata, the import job waits for that before
+// handing the file to dt_image_import().
+typedef struct dt_film_import_item_t
+{
+  gchar *filename;
+  gboolean read;
+} dt_film_import_item_t;
+
+typedef struct dt_film_import_readers_t
+{
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+} dt_film_import_readers_t;
+
+static void _film_import_read(gpointer data, gpointer user_data)
+{
+  dt_film_import_item_t *item = (dt_film_import_item_t *)data;
+  dt_film_import_readers_t *readers = (dt_film_import_readers_t *)user_data;
+
+  gchar *normalized = dt_util_normalize_path(item->filename);
+  if(normalized) dt_exif_preload(normalized);
+  g_free(normalized);
+
+  g_mutex_lock(&readers->lock);
+  item->read = TRUE;
+  g_cond_broadcast(&readers->cond);
+  g_mutex_unlock(&readers->lock);
+}
+
+static void _film_import_wait(dt_film_import_readers_t *readers, dt_film_import_item_t *item)
+{
+  g_mutex_lock(&readers->lock);
+  while(!item->read) g_cond_wait(&readers->cond, &readers->lock);
+  g_mutex_unlock(&readers->lock);
+}
+
 typedef struct dt_film_import1_t
 {
   dt_film_t *film;
@@ -200,11 +246,39 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
   dt_control_job_set_progress_message(job, message);
 
 
+  /* parse the metadata of the files in parallel, a few images ahead of the import. the import itself
+     stays on this thread and writes to the database in large transactions. */
+  dt_film_import_item_t *items = calloc(total, sizeof(dt_film_import_item_t));
+  int32_t *imported = malloc(sizeof(int32_t) * total);
+  int nimported = 0;
+  {
+    guint k = 0;
+    for(GList *l = images; l; l = g_list_next(l)) items[k++].filename = (gchar *)l->data;
+  }
+  dt_film_import_readers_t readers;
+  g_mutex_init(&readers.lock);
+  g_cond_init(&readers.cond);
+  const int nreaders = MAX(1, dt_get_num_threads() - 1);
+  readers.pool = g_thread_pool_new(_film_import_read, &readers, nreaders, FALSE, NULL);
+  const guint readahead = DT_FILM_IMPORT_READAHEAD * nreaders;
+  guint queued = 0;
+  guint current = 0;
+  gboolean transaction = FALSE;
+
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
   GList *image = g_list_first(images);
   do
   {
+    for(; queued < total && queued <= current + readahead; queued++)
+      g_thread_pool_push(readers.pool, &items[queued], NULL);
+
+    if(current % DT_FILM_IMPORT_BATCH == 0)
+    {
+      dt_database_release_transaction(darktable.db, transaction);
+      transaction = dt_database_start_transaction(darktable.db);
+    }
+
     gchar *cdn = g_path_get_dirname((const gchar *)image->data);
 
     /* check if we need to initialize a new filmroll */
@@ -253,7 +327,13 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     g_free(cdn);
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    _film_import_wait(&readers, &items[current]);
+    const int32_t imgid = dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    if(imgid > 0 && imported) imported[nimported++] = imgid;
+    gchar *normalized = dt_util_normalize_path((const gchar *)image->data);
+    if(normalized) dt_exif_preload_release(normalized);
+    g_free(normalized);
+    current++;
 
     fraction += 1.0 / total;
     dt_control_job_set_progress(job, fraction);
@@ -261,6 +341,11 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 
   } while((image = g_list_next(image)) != NULL);
 
+  dt_database_release_transaction(darktable.db, transaction);
+  g_thread_pool_free(readers.pool, FALSE, TRUE);
+  g_mutex_clear(&readers.lock);
+  g_cond_clear(&readers.cond);
+  free(items);
   g_list_free_full(images, g_free);
 
   // only redraw at the end, to not spam the cpu with exposure events
@@ -269,6 +354,17 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, film->id);
 
+  // none of the new images has a thumbnail yet, build them all at once instead of one by one
+  // as the thumbtable asks for them
+  if(imported && darktable.gui && dt_conf_get_int("thumbnail_threads_per_image") > 0)
+  {
+    const int size = dt_ui_thumbtable(darktable.gui->ui)->thumb_size;
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, size, size);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG,
+                       dt_image_thumbnails_job_create(imported, nimported, mip));
+  }
+  free(imported);
+
   // FIXME: maybe refactor into function and call it?
   if(cfr && cfr->dir)
   {
@@ -32,7 +32,7 @@ static int32_t dt_image_load_job_run(dt_job_t *job)
 
   // hook back into mipmap_cache:
   dt_mipmap_buffer_t buf;
-  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, params->mip, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, params->mip, DT_MIPMAP_BLOCKING_PREFETCH, 'r');
 
   if (buf.buf && buf.height && buf.width)
   {
@@ -62,6 +62,191 @@ dt_job_t *dt_image_load_job_create(int32_t id, dt_mipmap_size_t mip)
   return job;
 }
 
+typedef struct dt_image_prefetch_t
+{
+  int32_t *imgids;
+  int count;
+  dt_mipmap_size_t mip;
+  int generation;
+} dt_image_prefetch_t;
+
+// bumped by every new prefetch job, older ones stop at their next image
+static int _image_prefetch_generation = 0;
+
+static int32_t dt_image_prefetch_job_run(dt_job_t *job)
+{
+  dt_image_prefetch_t *params = dt_control_job_get_params(job);
+
+  for(int k = 0; k < params->count; k++)
+  {
+    if(g_atomic_int_get(&_image_prefetch_generation) != params->generation) break;
+
+    // let the disk fetch the next file while this one is decoded
+    if(k + 1 < params->count) dt_image_readahead(params->imgids[k + 1]);
+
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgids[k], params->mip,
+                        DT_MIPMAP_BLOCKING_PREFETCH, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+  return 0;
+}
+
+static void dt_image_prefetch_job_cleanup(void *p)
+{
+  dt_image_prefetch_t *params = p;
+
+  free(params->imgids);
+
+  free(params);
+}
+
+dt_job_t *dt_image_prefetch_job_create(const int32_t *imgids, const int count, dt_mipmap_size_t mip)
+{
+  if(count <= 0) return NULL;
+  // the generation is part of the description, so the job isn't taken for a duplicate of a running one
+  const int generation = g_atomic_int_add(&_image_prefetch_generation, 1) + 1;
+  dt_job_t *job = dt_control_job_create(&dt_image_prefetch_job_run, "prefetch %d images mip %d (%d)", count,
+                                        mip, generation);
+  if(!job) return NULL;
+  dt_image_prefetch_t *params = (dt_image_prefetch_t *)calloc(1, sizeof(dt_image_prefetch_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  params->imgids = (int32_t *)malloc(sizeof(int32_t) * count);
+  if(!params->imgids)
+  {
+    free(params);
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  dt_control_job_set_params(job, params, dt_image_prefetch_job_cleanup);
+  memcpy(params->imgids, imgids, sizeof(int32_t) * count);
+  params->count = count;
+  params->mip = mip;
+  params->generation = generation;
+  return job;
+}
+
+typedef struct dt_image_thumbnails_t
+{
+  int32_t *imgids;
+  int count;
+  dt_mipmap_size_t mip;
+} dt_image_thumbnails_t;
+
+typedef struct _thumbnails_worker_t
+{
+  dt_job_t *job;
+  const dt_image_thumbnails_t *params;
+  int threads; // openmp threads for each pipe
+
+  dt_pthread_mutex_t lock; // protects everything below
+  int next;
+  int done;
+} _thumbnails_worker_t;
+
+// every worker runs one small pipe at a time. a thumbnail pipe is too small to keep all cores busy,
+// several of them with a few threads each are much faster. a worker holding the gpu simply comes back
+// for the next image sooner, the others fall back to the cpu instead of waiting for it.
+static void *_thumbnails_worker(void *data)
+{
+  _thumbnails_worker_t *w = (_thumbnails_worker_t *)data;
+  const dt_image_thumbnails_t *params = w->params;
+#ifdef _OPENMP
+  omp_set_num_threads(w->threads);
+#endif
+
+  while(dt_control_job_get_state(w->job) != DT_JOB_STATE_CANCELLED)
+  {
+    dt_pthread_mutex_lock(&w->lock);
+    const int k = w->next++;
+    dt_pthread_mutex_unlock(&w->lock);
+    if(k >= params->count) break;
+
+    const int32_t imgid = params->imgids[k];
+    // the ones already in the disk cache are loaded on demand, that is cheap
+    if(!dt_mipmap_cache_thumbnail_on_disk(darktable.mipmap_cache, imgid, params->mip))
+    {
+      dt_image_readahead(imgid);
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, params->mip, DT_MIPMAP_BLOCKING, 'r');
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    }
+
+    dt_pthread_mutex_lock(&w->lock);
+    w->done++;
+    dt_control_job_set_progress(w->job, (double)w->done / params->count);
+    dt_pthread_mutex_unlock(&w->lock);
+  }
+  return NULL;
+}
+
+static int32_t dt_image_thumbnails_job_run(dt_job_t *job)
+{
+  const dt_image_thumbnails_t *params = dt_control_job_get_params(job);
+
+  const double start = dt_get_wtime();
+  const int per_pipe = CLAMP(dt_conf_get_int("thumbnail_threads_per_image"), 1, dt_get_num_threads());
+  const int workers = CLAMP(dt_get_num_threads() / per_pipe, 1, params->count);
+  _thumbnails_worker_t worker = { .job = job, .params = params, .threads = per_pipe, .next = 0, .done = 0 };
+  dt_pthread_mutex_init(&worker.lock, NULL);
+
+  pthread_t *threads = workers > 1 ? (pthread_t *)calloc(workers - 1, sizeof(pthread_t)) : NULL;
+  int started = 0;
+  for(int k = 0; threads && k < workers - 1; k++)
+    if(!dt_pthread_create(&threads[k], _thumbnails_worker, &worker)) started++;
+  _thumbnails_worker(&worker);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+  free(threads);
+
+#ifdef _OPENMP
+  omp_set_num_threads(darktable.num_openmp_threads);
+#endif
+  dt_pthread_mutex_destroy(&worker.lock);
+
+  dt_print(DT_DEBUG_PERF, "[thumbnails] %d thumbnails of mip %d in %.3f secs with %d pipes of %d threads\n",
+           worker.done, params->mip, dt_get_wtime() - start, started + 1, per_pipe);
+  return 0;
+}
+
+static void dt_image_thumbnails_job_cleanup(void *p)
+{
+  dt_image_thumbnails_t *params = p;
+
+  free(params->imgids);
+
+  free(params);
+}
+
+dt_job_t *dt_image_thumbnails_job_create(const int32_t *imgids, const int count, dt_mipmap_size_t mip)
+{
+  if(count <= 0 || mip >= DT_MIPMAP_F) return NULL;
+  dt_job_t *job = dt_control_job_create(&dt_image_thumbnails_job_run, "generate %d thumbnails mip %d", count, mip);
+  if(!job) return NULL;
+  dt_image_thumbnails_t *params = (dt_image_thumbnails_t *)calloc(1, sizeof(dt_image_thumbnails_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  params->imgids = (int32_t *)malloc(sizeof(int32_t) * count);
+  if(!params->imgids)
+  {
+    free(params);
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  dt_control_job_add_progress(job, _("generating thumbnails"), TRUE);
+  dt_control_job_set_params(job, params, dt_image_thumbnails_job_cleanup);
+  memcpy(params->imgids, imgids, sizeof(int32_t) * count);
+  params->count = count;
+  params->mip = mip;
+  return job;
+}
+
 typedef struct dt_image_import_t
 {
   uint32_t film_id;
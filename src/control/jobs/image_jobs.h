@@ -25,6 +25,14 @@
 
 dt_job_t *dt_image_load_job_create(int32_t imgid, dt_mipmap_size_t mip);
 
+// speculatively load the given images, in order, at the given mip level. creating a new prefetch job
+// cancels the images not yet loaded by the previous one.
+dt_job_t *dt_image_prefetch_job_create(const int32_t *imgids, const int count, dt_mipmap_size_t mip);
+
+// generate the thumbnails of the given images at the given mip level, with several small pipes at once.
+// meant for freshly imported images, the thumbtable would otherwise create them one at a time.
+dt_job_t *dt_image_thumbnails_job_create(const int32_t *imgids, const int count, dt_mipmap_size_t mip);
+
 dt_job_t *dt_image_import_job_create(uint32_t filmid, const char *filename);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -202,14 +202,103 @@ typedef struct _signal_param_t
   GValue *instance_and_params;
   guint signal_id;
   guint n_params;
+  dt_signal_t signal;
+  guint key;          // see _signal_merge_key()
+  gboolean pending;   // waiting for the main loop, later raises of the same key are merged into it
+  GHashTable *imgids; // set of the images of a merged images list
 } _signal_param_t;
 
+/* raises from the other threads which are still waiting for the main loop, by signal and key. a storm
+   of them (import, background jobs, ...) so costs the listeners a single call */
+static GMutex _pending_lock;
+static GHashTable *_pending[DT_SIGNAL_COUNT];
+
+static void _signal_params_free(GValue *instance_and_params, const guint n_params)
+{
+  for(int i = 0; i <= n_params; i++) g_value_unset(&instance_and_params[i]);
+  free(instance_and_params);
+}
+
+// can raises of this signal be merged, and with which others
+static gboolean _signal_merge_key(const dt_signal_t signal, const GValue *instance_and_params, guint *key)
+{
+  switch(signal)
+  {
+    case DT_SIGNAL_DEVELOP_MIPMAP_UPDATED:
+      // the listeners use the image id, only raises for the same image are redundant
+      *key = g_value_get_uint(&instance_and_params[1]);
+      return TRUE;
+    case DT_SIGNAL_IMAGE_INFO_CHANGED:
+      *key = 0;
+      return TRUE;
+    case DT_SIGNAL_COLLECTION_CHANGED:
+      // the kind of change
+      *key = g_value_get_uint(&instance_and_params[1]);
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+// add the images of imgs missing from the list of the pending raise, and free imgs
+static void _signal_merge_imgs(_signal_param_t *pending, GValue *list, GList *imgs)
+{
+  GList *merged = (GList *)g_value_get_pointer(list);
+  if(!pending->imgids)
+  {
+    pending->imgids = g_hash_table_new(NULL, NULL);
+    for(const GList *l = merged; l; l = g_list_next(l)) g_hash_table_add(pending->imgids, l->data);
+  }
+  for(const GList *l = imgs; l; l = g_list_next(l))
+    if(g_hash_table_add(pending->imgids, l->data)) merged = g_list_prepend(merged, l->data);
+  g_list_free(imgs);
+  g_value_set_pointer(list, merged);
+}
+
+// merge the parameters of a new raise into the pending one, FALSE if they can't be
+static gboolean _signal_merge(_signal_param_t *pending, const GValue *instance_and_params)
+{
+  GValue *p = pending->instance_and_params;
+  switch(pending->signal)
+  {
+    case DT_SIGNAL_DEVELOP_MIPMAP_UPDATED:
+      return TRUE;
+    case DT_SIGNAL_IMAGE_INFO_CHANGED:
+    {
+      GList *imgs = (GList *)g_value_get_pointer(&instance_and_params[1]);
+      // no images at all means something else to the listeners
+      if(!imgs != !g_value_get_pointer(&p[1])) return FALSE;
+      _signal_merge_imgs(pending, &p[1], imgs);
+      return TRUE;
+    }
+    case DT_SIGNAL_COLLECTION_CHANGED:
+    {
+      GList *imgs = (GList *)g_value_get_pointer(&instance_and_params[2]);
+      if(!imgs != !g_value_get_pointer(&p[2])) return FALSE;
+      if(g_value_get_uint(&instance_and_params[3]) != g_value_get_uint(&p[3])) return FALSE;
+      _signal_merge_imgs(pending, &p[2], imgs);
+      return TRUE;
+    }
+    default:
+      return FALSE;
+  }
+}
+
 static gboolean _signal_raise(gpointer user_data)
 {
   _signal_param_t *params = (_signal_param_t *)user_data;
+  if(params->pending)
+  {
+    // from now on the raises of this key need a new call
+    g_mutex_lock(&_pending_lock);
+    if(g_hash_table_lookup(_pending[params->signal], GUINT_TO_POINTER(params->key)) == params)
+      g_hash_table_remove(_pending[params->signal], GUINT_TO_POINTER(params->key));
+    params->pending = FALSE;
+    g_mutex_unlock(&_pending_lock);
+  }
+  if(params->imgids) g_hash_table_destroy(params->imgids);
   g_signal_emitv(params->instance_and_params, params->signal_id, 0, NULL);
-  for(int i = 0; i <= params->n_params; i++) g_value_unset(&params->instance_and_params[i]);
-  free(params->instance_and_params);
+  _signal_params_free(params->instance_and_params, params->n_params);
   free(params);
   return FALSE;
 }
@@ -288,9 +377,34 @@ void dt_control_signal_raise(const dt_control_signal_t *ctlsig, dt_signal_t sign
   params->instance_and_params = instance_and_params;
   params->signal_id = g_signal_lookup(_signal_description[signal].name, _signal_type);
   params->n_params = signal_description->n_params;
+  params->signal = signal;
+  params->key = 0;
+  params->pending = FALSE;
+  params->imgids = NULL;
 
   if(!signal_description->synchronous)
   {
+    // raises from the gui thread are delivered at once as before, the others wait for the main loop
+    // anyway and can be merged with the ones still waiting
+    guint key = 0;
+    if(!pthread_equal(darktable.control->gui_thread, pthread_self())
+       && _signal_merge_key(signal, instance_and_params, &key))
+    {
+      g_mutex_lock(&_pending_lock);
+      if(!_pending[signal]) _pending[signal] = g_hash_table_new(NULL, NULL);
+      _signal_param_t *pending = (_signal_param_t *)g_hash_table_lookup(_pending[signal], GUINT_TO_POINTER(key));
+      if(pending && _signal_merge(pending, instance_and_params))
+      {
+        g_mutex_unlock(&_pending_lock);
+        _signal_params_free(instance_and_params, params->n_params);
+        free(params);
+        return;
+      }
+      params->key = key;
+      params->pending = TRUE;
+      g_hash_table_insert(_pending[signal], GUINT_TO_POINTER(key), params);
+      g_mutex_unlock(&_pending_lock);
+    }
     g_main_context_invoke(NULL, _signal_raise, params);
   }
   else
@@ -21,6 +21,7 @@
 #include "common/colorspaces_inline_conversions.h"
 #include "common/math.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/masks.h"
@@ -366,6 +367,7 @@ static inline void _blend_noop(const _blend_buffer_desc_t *bd, const float *a, f
 
 
 /* generate blend mask */
+__DT_CLONE_TARGETS__
 static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int blendif,
                              const float *blendif_parameters, const unsigned int mask_mode,
                              const unsigned int mask_combine, const float gopacity, const float *a, const float *b,
@@ -383,8 +385,14 @@ static void _blend_make_mask(const _blend_buffer_desc_t *bd, const unsigned int
   }
 }
 
+/* the most common blend modes are instantiated twice from an inlined kernel: with mask_step 1 for a per pixel
+ * mask and with mask_step 0 for a uniform opacity, where mask points to one value. the latter has the opacity
+ * hoisted out of the loop, so it vectorises and needs no mask buffer at all. */
+
 /* normal blend with clamping */
-static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+static inline __attribute__((always_inline)) void
+_blend_normal_bounded_kernel(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                             const size_t mask_step)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -393,7 +401,7 @@ static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       float ta[3], tb[3];
       _blend_Lab_scale(&a[j], ta);
       _blend_Lab_scale(&b[j], tb);
@@ -410,7 +418,7 @@ static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k]
             =clamp_range_f(a[j+k]*(1.0f-local_opacity)+b[j+k]*local_opacity, min[k], max[k]);
@@ -421,7 +429,7 @@ static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k]
             =clamp_range_f(a[j+k]*(1.0f-local_opacity)+b[j+k]*local_opacity, min[k], max[k]);
@@ -429,8 +437,23 @@ static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a
   }
 }
 
+__DT_CLONE_TARGETS__
+static void _blend_normal_bounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+{
+  _blend_normal_bounded_kernel(bd, a, b, mask, 1);
+}
+
+__DT_CLONE_TARGETS__
+static void _blend_normal_bounded_uniform(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                          const float *mask)
+{
+  _blend_normal_bounded_kernel(bd, a, b, mask, 0);
+}
+
 /* normal blend without any clamping */
-static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+static inline __attribute__((always_inline)) void
+_blend_normal_unbounded_kernel(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                               const size_t mask_step)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -439,7 +462,7 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       float ta[3], tb[3];
       _blend_Lab_scale(&a[j], ta);
       _blend_Lab_scale(&b[j], tb);
@@ -456,7 +479,7 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k] = a[j + k] * (1.0f - local_opacity) + b[j + k] * local_opacity;
       b[j + 3] = local_opacity;
@@ -466,15 +489,30 @@ static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k] = a[j + k] * (1.0f - local_opacity) + b[j + k] * local_opacity;
     }
   }
 }
 
+__DT_CLONE_TARGETS__
+static void _blend_normal_unbounded(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+{
+  _blend_normal_unbounded_kernel(bd, a, b, mask, 1);
+}
+
+__DT_CLONE_TARGETS__
+static void _blend_normal_unbounded_uniform(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                            const float *mask)
+{
+  _blend_normal_unbounded_kernel(bd, a, b, mask, 0);
+}
+
 /* lighten */
-static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+static inline __attribute__((always_inline)) void
+_blend_lighten_kernel(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                      const size_t mask_step)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -483,7 +521,7 @@ static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       float ta[3], tb[3], tbo;
       _blend_Lab_scale(&a[j], ta);
       _blend_Lab_scale(&b[j], tb);
@@ -504,7 +542,7 @@ static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k] =clamp_range_f(a[j+k]*(1.0f-local_opacity)+fmaxf(a[j+k], b[j+k])*local_opacity,
                                 min[k], max[k]);
@@ -515,7 +553,7 @@ static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k] =clamp_range_f(a[j+k]*(1.0f-local_opacity)+fmaxf(a[j+k], b[j+k])*local_opacity,
                                 min[k], max[k]);
@@ -523,7 +561,21 @@ static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float
   }
 }
 
+__DT_CLONE_TARGETS__
+static void _blend_lighten(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+{
+  _blend_lighten_kernel(bd, a, b, mask, 1);
+}
+
+__DT_CLONE_TARGETS__
+static void _blend_lighten_uniform(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                   const float *mask)
+{
+  _blend_lighten_kernel(bd, a, b, mask, 0);
+}
+
 /* darken */
+__DT_CLONE_TARGETS__
 static void _blend_darken(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -575,7 +627,9 @@ static void _blend_darken(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* multiply */
-static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+static inline __attribute__((always_inline)) void
+_blend_multiply_kernel(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask,
+                       const size_t mask_step)
 {
   float max[4] = { 0 }, min[4] = { 0 };
   _blend_colorspace_channel_range(bd->cst, min, max);
@@ -584,7 +638,7 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       float ta[3], tb[3];
       float lmin = 0.0f, lmax, la, lb;
 
@@ -620,7 +674,7 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
         b[j + k] =clamp_range_f(
             a[j+k]*(1.0f-local_opacity)+(a[j+k]*b[j+k])*local_opacity, min[k], max[k]);
@@ -631,7 +685,7 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
   {
     for(size_t i = 0, j = 0; j < bd->stride; i++, j += bd->ch)
     {
-      float local_opacity = mask[i];
+      float local_opacity = mask[i * mask_step];
       for(int k = 0; k < bd->bch; k++)
 
         b[j + k] =clamp_range_f(
@@ -641,7 +695,21 @@ static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, floa
   // return (a*b);
 }
 
+__DT_CLONE_TARGETS__
+static void _blend_multiply(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
+{
+  _blend_multiply_kernel(bd, a, b, mask, 1);
+}
+
+__DT_CLONE_TARGETS__
+static void _blend_multiply_uniform(const _blend_buffer_desc_t *bd, const float *a, float *b,
+                                    const float *mask)
+{
+  _blend_multiply_kernel(bd, a, b, mask, 0);
+}
+
 /* average */
+__DT_CLONE_TARGETS__
 static void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -693,6 +761,7 @@ static void _blend_average(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* add */
+__DT_CLONE_TARGETS__
 static void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -744,6 +813,7 @@ static void _blend_add(const _blend_buffer_desc_t *bd, const float *a, float *b,
 }
 
 /* substract */
+__DT_CLONE_TARGETS__
 static void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -803,6 +873,7 @@ static void _blend_substract(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* difference (deprecated) */
+__DT_CLONE_TARGETS__
 static void _blend_difference(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -878,6 +949,7 @@ static void _blend_difference(const _blend_buffer_desc_t *bd, const float *a, fl
 }
 
 /* difference 2 (new) */
+__DT_CLONE_TARGETS__
 static void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -945,6 +1017,7 @@ static void _blend_difference2(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 /* screen */
+__DT_CLONE_TARGETS__
 static void _blend_screen(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1037,6 +1110,7 @@ static void _blend_screen(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* overlay */
+__DT_CLONE_TARGETS__
 static void _blend_overlay(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1144,6 +1218,7 @@ static void _blend_overlay(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* softlight */
+__DT_CLONE_TARGETS__
 static void _blend_softlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
 
@@ -1248,6 +1323,7 @@ static void _blend_softlight(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* hardlight */
+__DT_CLONE_TARGETS__
 static void _blend_hardlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1355,6 +1431,7 @@ static void _blend_hardlight(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* vividlight */
+__DT_CLONE_TARGETS__
 static void _blend_vividlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1461,6 +1538,7 @@ static void _blend_vividlight(const _blend_buffer_desc_t *bd, const float *a, fl
 }
 
 /* linearlight */
+__DT_CLONE_TARGETS__
 static void _blend_linearlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1555,6 +1633,7 @@ static void _blend_linearlight(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 /* pinlight */
+__DT_CLONE_TARGETS__
 static void _blend_pinlight(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1649,6 +1728,7 @@ static void _blend_pinlight(const _blend_buffer_desc_t *bd, const float *a, floa
 }
 
 /* lightness blend */
+__DT_CLONE_TARGETS__
 static void _blend_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1702,6 +1782,7 @@ static void _blend_lightness(const _blend_buffer_desc_t *bd, const float *a, flo
 }
 
 /* chroma blend */
+__DT_CLONE_TARGETS__
 static void _blend_chroma(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1762,6 +1843,7 @@ static void _blend_chroma(const _blend_buffer_desc_t *bd, const float *a, float
 }
 
 /* hue blend */
+__DT_CLONE_TARGETS__
 static void _blend_hue(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1828,6 +1910,7 @@ static void _blend_hue(const _blend_buffer_desc_t *bd, const float *a, float *b,
 }
 
 /* color blend; blend hue and chroma, but not lightness */
+__DT_CLONE_TARGETS__
 static void _blend_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1897,6 +1980,7 @@ static void _blend_color(const _blend_buffer_desc_t *bd, const float *a, float *
 }
 
 /* color adjustment; blend hue and chroma; take lightness from module output */
+__DT_CLONE_TARGETS__
 static void _blend_coloradjust(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -1965,6 +2049,7 @@ static void _blend_coloradjust(const _blend_buffer_desc_t *bd, const float *a, f
 }
 
 /* inverse blend */
+__DT_CLONE_TARGETS__
 static void _blend_inverse(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   float max[4] = { 0 }, min[4] = { 0 };
@@ -2012,6 +2097,7 @@ static void _blend_inverse(const _blend_buffer_desc_t *bd, const float *a, float
 
 /* blend only lightness in Lab color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_Lab_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_Lab)
@@ -2037,6 +2123,7 @@ static void _blend_Lab_lightness(const _blend_buffer_desc_t *bd, const float *a,
 
 /* blend only a-channel in Lab color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_Lab_a(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_Lab)
@@ -2062,6 +2149,7 @@ static void _blend_Lab_a(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only b-channel in Lab color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_Lab_b(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_Lab)
@@ -2088,6 +2176,7 @@ static void _blend_Lab_b(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only color in Lab color space without any clamping (a noop for other
  * color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_Lab_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_Lab)
@@ -2113,6 +2202,7 @@ static void _blend_Lab_color(const _blend_buffer_desc_t *bd, const float *a, flo
 
 /* blend only lightness in HSV color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_HSV_lightness(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_rgb)
@@ -2141,6 +2231,7 @@ static void _blend_HSV_lightness(const _blend_buffer_desc_t *bd, const float *a,
 
 /* blend only color in HSV color space without any clamping (a noop for other
  * color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_HSV_color(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_rgb)
@@ -2179,6 +2270,7 @@ static void _blend_HSV_color(const _blend_buffer_desc_t *bd, const float *a, flo
 
 /* blend only R-channel in RGB color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_RGB_R(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_rgb)
@@ -2199,6 +2291,7 @@ static void _blend_RGB_R(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only R-channel in RGB color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_RGB_G(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_rgb)
@@ -2219,6 +2312,7 @@ static void _blend_RGB_G(const _blend_buffer_desc_t *bd, const float *a, float *
 
 /* blend only R-channel in RGB color space without any clamping (a noop for
  * other color spaces) */
+__DT_CLONE_TARGETS__
 static void _blend_RGB_B(const _blend_buffer_desc_t *bd, const float *a, float *b, const float *mask)
 {
   if(bd->cst == iop_cs_rgb)
@@ -2577,6 +2671,223 @@ _blend_row_func *dt_develop_choose_blend_func(const unsigned int blend_mode)
   return blend;
 }
 
+// the blend operators specialised for a uniform opacity, NULL for the modes which have none
+static _blend_row_func *_blend_choose_uniform_func(const unsigned int blend_mode)
+{
+  switch(blend_mode)
+  {
+    case DEVELOP_BLEND_NORMAL:
+    case DEVELOP_BLEND_BOUNDED:
+      return _blend_normal_bounded_uniform;
+    case DEVELOP_BLEND_NORMAL2:
+    case DEVELOP_BLEND_UNBOUNDED:
+      return _blend_normal_unbounded_uniform;
+    case DEVELOP_BLEND_LIGHTEN:
+      return _blend_lighten_uniform;
+    case DEVELOP_BLEND_MULTIPLY:
+      return _blend_multiply_uniform;
+    default:
+      return NULL;
+  }
+}
+
+static void _blend_mask_tone_curve(const dt_develop_blend_params_t *const d, const float opacity,
+                                   float *const mask, const size_t buffsize)
+{
+  const float mask_epsilon = 16 * FLT_EPSILON;  // empirical mask threshold for fully transparent masks
+  const float e = expf(3.f * d->contrast);
+  const float brightness = d->brightness;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(brightness, buffsize, e, mask, mask_epsilon, opacity)
+#endif
+  for(size_t k = 0; k < buffsize; k++)
+  {
+    float x = mask[k] / opacity;
+    x = 2.f * x - 1.f;
+    if (1.f - brightness <= 0.f)
+      x = mask[k] <= mask_epsilon ? -1.f : 1.f;
+    else if (1.f + brightness <= 0.f)
+      x = mask[k] >= 1.f - mask_epsilon ? 1.f : -1.f;
+    else if (brightness > 0.f)
+    {
+      x = (x + brightness) / (1.f - brightness);
+      x = fminf(x, 1.f);
+    }
+    else
+    {
+      x = (x + brightness) / (1.f + brightness);
+      x = fmaxf(x, -1.f);
+    }
+    mask[k] = ((x * e / (1.f + (e - 1.f) * fabsf(x))) / 2.f + 0.5f) * opacity;
+  }
+}
+
+// rows of the output processed per band by _blend_process_bands(), keeping the mask of one band
+// within the memory tiling grants a single buffer
+static int _blend_band_rows(const int owidth)
+{
+  const size_t singlebuffer = (size_t)MAX(dt_conf_get_int("singlebuffer_limit"), 2) << 20;
+  return MAX(singlebuffer / ((size_t)owidth * sizeof(float)), 16);
+}
+
+// drawn and parametric masks without feathering and blurring only depend on their own pixel, so when the
+// mask isn't kept for later modules they are made and applied one band of rows at a time. the drawn shapes
+// are rasterised for the roi of each band, and no mask buffer of the whole roi is needed.
+static void _blend_process_bands(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                 const void *const ivoid, void *const ovoid, const struct dt_iop_roi_t *const roi_in,
+                                 const struct dt_iop_roi_t *const roi_out, const int band)
+{
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  const int ch = piece->colors;
+  const int bch = (ch == 1) ? 1 : ch - 1;
+  const int xoffs = roi_out->x - roi_in->x;
+  const int yoffs = roi_out->y - roi_in->y;
+  const int iwidth = roi_in->width;
+  const int owidth = roi_out->width;
+  const int oheight = roi_out->height;
+  const dt_dev_pixelpipe_display_mask_t mask_display = piece->pipe->mask_display;
+  const dt_iop_colorspace_type_t cst = self->blend_colorspace(self, piece->pipe, piece);
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(piece->pipe);
+  const _Bool mask_tone_curve = fabsf(d->contrast) >= 0.01f || fabsf(d->brightness) >= 0.01f;
+  const float opacity = fminf(fmaxf(0.0f, (d->opacity / 100.0f)), 1.0f);
+  _blend_row_func *const blend = dt_develop_choose_blend_func(d->blend_mode);
+
+  dt_masks_form_t *form = dt_masks_get_from_id_ext(piece->pipe->forms, d->mask_id);
+  const _Bool drawn = !(self->flags() & IOP_FLAGS_NO_MASKS) && (d->mask_mode & DEVELOP_MASK_MASK);
+
+  float *const mask = dt_alloc_align(64, (size_t)owidth * band * sizeof(float));
+  if(!mask)
+  {
+    dt_control_log(_("could not allocate buffer for blending"));
+    return;
+  }
+
+  for(int y0 = 0; y0 < oheight; y0 += band)
+  {
+    const int bheight = MIN(band, oheight - y0);
+    const size_t buffsize = (size_t)owidth * bheight;
+
+    if(form && drawn)
+    {
+      dt_iop_roi_t roi_band = *roi_out;
+      roi_band.y += y0;
+      roi_band.height = bheight;
+      dt_masks_group_render_roi(self, piece, form, &roi_band, mask);
+
+      if(d->mask_combine & DEVELOP_COMBINE_MASKS_POS)
+      {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+        dt_omp_firstprivate(buffsize, mask)
+#endif
+        for(size_t i = 0; i < buffsize; i++) mask[i] = 1.0f - mask[i];
+      }
+    }
+    else
+    {
+      // no form defined but drawn mask active, or no drawn mask at all: see dt_develop_blend_process()
+      const float fill = drawn ? ((d->mask_combine & DEVELOP_COMBINE_MASKS_POS) ? 0.0f : 1.0f)
+                               : ((d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+      dt_omp_firstprivate(buffsize, mask, fill)
+#endif
+      for(size_t i = 0; i < buffsize; i++) mask[i] = fill;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(bch, ch, cst, d, bheight, opacity, ivoid, iwidth, \
+                        mask, owidth, ovoid, work_profile, xoffs, yoffs, y0)
+#endif
+    for(size_t y = 0; y < bheight; y++)
+    {
+      size_t iindex = ((y + y0 + yoffs) * iwidth + xoffs) * ch;
+      size_t oindex = (y + y0) * owidth * ch;
+      _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
+      float *in = (float *)ivoid + iindex;
+      float *out = (float *)ovoid + oindex;
+      float *m = mask + y * owidth;
+      _blend_make_mask(&bd, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m,
+                       work_profile);
+    }
+
+    if(mask_tone_curve && opacity > 1e-4f) _blend_mask_tone_curve(d, opacity, mask, buffsize);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(bch, blend, ch, cst, ivoid, iwidth, mask, mask_display, bheight, ovoid, owidth, \
+                        work_profile, xoffs, yoffs, y0)
+#endif
+    for(size_t y = 0; y < bheight; y++)
+    {
+      size_t iindex = ((y + y0 + yoffs) * iwidth + xoffs) * ch;
+      size_t oindex = (y + y0) * owidth * ch;
+      _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
+      float *in = (float *)ivoid + iindex;
+      float *out = (float *)ovoid + oindex;
+      blend(&bd, in, out, mask + y * owidth);
+
+      if((mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) && cst != iop_cs_RAW)
+        for(size_t j = 0; j < bd.stride; j += 4) out[j + 3] = in[j + 3];
+    }
+  }
+
+  dt_free_align(mask);
+}
+
+// a uniform opacity which isn't kept as raster mask is blended without any mask buffer: the specialised
+// operators take the opacity as a single value, the others read it from one row filled with it.
+static void _blend_process_uniform(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                   const void *const ivoid, void *const ovoid,
+                                   const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out,
+                                   const float opacity)
+{
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  const int ch = piece->colors;
+  const int bch = (ch == 1) ? 1 : ch - 1;
+  const int xoffs = roi_out->x - roi_in->x;
+  const int yoffs = roi_out->y - roi_in->y;
+  const int iwidth = roi_in->width;
+  const int owidth = roi_out->width;
+  const int oheight = roi_out->height;
+  const dt_dev_pixelpipe_display_mask_t mask_display = piece->pipe->mask_display;
+  const dt_iop_colorspace_type_t cst = self->blend_colorspace(self, piece->pipe, piece);
+
+  _blend_row_func *blend = _blend_choose_uniform_func(d->blend_mode);
+  const size_t mask_width = blend ? 1 : owidth;
+  if(!blend) blend = dt_develop_choose_blend_func(d->blend_mode);
+
+  float *const mask = dt_alloc_align(64, mask_width * sizeof(float));
+  if(!mask)
+  {
+    dt_control_log(_("could not allocate buffer for blending"));
+    return;
+  }
+  for(size_t i = 0; i < mask_width; i++) mask[i] = opacity;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(bch, blend, ch, cst, ivoid, iwidth, mask, mask_display, oheight, ovoid, owidth, \
+                      xoffs, yoffs)
+#endif
+  for(size_t y = 0; y < oheight; y++)
+  {
+    size_t iindex = ((y + yoffs) * iwidth + xoffs) * ch;
+    size_t oindex = y * owidth * ch;
+    _blend_buffer_desc_t bd = { .cst = cst, .stride = (size_t)owidth * ch, .ch = ch, .bch = bch };
+    float *in = (float *)ivoid + iindex;
+    float *out = (float *)ovoid + oindex;
+    blend(&bd, in, out, mask);
+
+    if((mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) && cst != iop_cs_RAW)
+      for(size_t j = 0; j < bd.stride; j += 4) out[j + 3] = in[j + 3];
+  }
+
+  dt_free_align(mask);
+}
+
 void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                               const void *const ivoid, void *const ovoid, const struct dt_iop_roi_t *const roi_in,
                               const struct dt_iop_roi_t *const roi_out)
@@ -2642,6 +2953,28 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   // get the clipped opacity value  0 - 1
   const float opacity = fminf(fmaxf(0.0f, (d->opacity / 100.0f)), 1.0f);
 
+  // big drawn and parametric masks which are not needed afterwards are made band by band
+  const gboolean keep_mask = piece->pipe->store_all_raster_masks || dt_iop_is_raster_mask_used(self, 0);
+  if(!keep_mask && !suppress_mask && mask_mode != DEVELOP_MASK_ENABLED && !(mask_mode & DEVELOP_MASK_RASTER)
+     && !mask_feather && !mask_blur && request_mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE)
+  {
+    const int band = _blend_band_rows(owidth);
+    if(band < oheight)
+    {
+      _blend_process_bands(self, piece, ivoid, ovoid, roi_in, roi_out, band);
+      g_hash_table_remove(piece->raster_masks, GINT_TO_POINTER(0));
+      return;
+    }
+  }
+
+  if(!keep_mask && (mask_mode == DEVELOP_MASK_ENABLED || suppress_mask)
+     && request_mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE)
+  {
+    _blend_process_uniform(self, piece, ivoid, ovoid, roi_in, roi_out, opacity);
+    g_hash_table_remove(piece->raster_masks, GINT_TO_POINTER(0));
+    return;
+  }
+
   // allocate space for blend mask
   float *_mask = dt_alloc_align(64, buffsize * sizeof(float));
   if(!_mask)
@@ -2686,6 +3019,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 #endif
         for(size_t i = 0; i < buffsize; i++) mask[i] = raster_mask[i] * opacity;
       if(free_mask) dt_free_align(raster_mask);
+      dt_dev_release_raster_mask(piece->pipe, self->raster_mask.sink.source, self->raster_mask.sink.id, self);
     }
     else
     {
@@ -2813,36 +3147,7 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       }
     }
 
-    if(mask_tone_curve && opacity > 1e-4f)
-    {
-      const float mask_epsilon = 16 * FLT_EPSILON;  // empirical mask threshold for fully transparent masks
-      const float e = expf(3.f * d->contrast);
-      const float brightness = d->brightness;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(brightness, buffsize, e, mask, mask_epsilon, opacity)
-#endif
-      for(size_t k = 0; k < buffsize; k++)
-      {
-        float x = mask[k] / opacity;
-        x = 2.f * x - 1.f;
-        if (1.f - brightness <= 0.f)
-          x = mask[k] <= mask_epsilon ? -1.f : 1.f;
-        else if (1.f + brightness <= 0.f)
-          x = mask[k] >= 1.f - mask_epsilon ? 1.f : -1.f;
-        else if (brightness > 0.f)
-        {
-          x = (x + brightness) / (1.f - brightness);
-          x = fminf(x, 1.f);
-        }
-        else
-        {
-          x = (x + brightness) / (1.f + brightness);
-          x = fmaxf(x, -1.f);
-        }
-        mask[k] = ((x * e / (1.f + (e - 1.f) * fabsf(x))) / 2.f + 0.5f) * opacity;
-      }
-    }
+    if(mask_tone_curve && opacity > 1e-4f) _blend_mask_tone_curve(d, opacity, mask, buffsize);
   }
 
   // now apply blending with per-pixel opacity value as defined in mask
@@ -3057,6 +3362,7 @@ int dt_develop_blend_process_cl(struct dt_iop_module_t *self, struct dt_dev_pixe
 #endif
         for(size_t i = 0; i < buffsize; i++) mask[i] = raster_mask[i] * opacity;
       if(free_mask) dt_free_align(raster_mask);
+      dt_dev_release_raster_mask(piece->pipe, self->raster_mask.sink.source, self->raster_mask.sink.id, self);
     }
     else
     {
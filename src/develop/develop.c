@@ -45,6 +45,7 @@
 #define DT_DEV_AVERAGE_DELAY_START 250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START 50
 #define DT_DEV_AVERAGE_DELAY_COUNT 5
+#define DT_DEV_COARSE_FACTOR 4
 #define DT_IOP_ORDER_INFO (darktable.unmuted & DT_DEBUG_IOPORDER)
 
 const gchar *dt_dev_scope_type_names[DT_DEV_SCOPE_N] = { "histogram", "waveform" };
@@ -111,9 +112,11 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->form_visible = NULL;
   dev->form_gui = NULL;
   dev->allforms = NULL;
+  dev->masks_cache = NULL;
 
   if(dev->gui_attached)
   {
+    dev->masks_cache = dt_masks_cache_init((size_t)MAX(dt_conf_get_int("darkroom_masks_cache_memory"), 0) << 20);
     dev->pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
     dev->preview_pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
     dev->preview2_pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
@@ -179,6 +182,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->second_window.zoom_scale = 1.f;
 }
 
+static void _dev_distort_grid_free(struct dt_dev_distort_grid_t *grid);
+
 void dt_dev_cleanup(dt_develop_t *dev)
 {
   if(!dev) return;
@@ -226,6 +231,7 @@ void dt_dev_cleanup(dt_develop_t *dev)
     free(dev->allprofile_info->data);
     dev->allprofile_info = g_list_delete_link(dev->allprofile_info, dev->allprofile_info);
   }
+  for(int k = 0; k < DT_DEV_DISTORT_GRIDS; k++) _dev_distort_grid_free(dev->distort_grid.entries[k]);
   dt_pthread_mutex_destroy(&dev->history_mutex);
   free(dev->histogram);
   free(dev->histogram_pre_tonecurve);
@@ -234,6 +240,7 @@ void dt_dev_cleanup(dt_develop_t *dev)
 
   g_list_free_full(dev->forms, (void (*)(void *))dt_masks_free_form);
   g_list_free_full(dev->allforms, (void (*)(void *))dt_masks_free_form);
+  dt_masks_cache_cleanup(dev->masks_cache);
 
   g_list_free_full(dev->proxy.exposure, g_free);
 
@@ -613,9 +620,37 @@ restart:
   x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - wd / 2);
   y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - ht / 2);
 
+  // progressive rendering: show a history change from a quick pass at a fraction of the
+  // resolution first, then refine. further changes abort the refinement in dt_iop_breakpoint().
+  const int coarse = (dev->gui_attached && !dev->image_loading
+                      && (pipe_changed & (DT_DEV_PIPE_TOP_CHANGED | DT_DEV_PIPE_REMOVE | DT_DEV_PIPE_SYNCH))
+                      && MIN(wd, ht) >= 16 * DT_DEV_COARSE_FACTOR
+                      && dt_conf_get_bool("darkroom/ui/progressive_rendering"))
+                         ? DT_DEV_COARSE_FACTOR
+                         : 1;
+  if(coarse > 1)
+  {
+    dt_get_times(&start);
+    dev->pipe->coarse = coarse;
+    const int err = dt_dev_pixelpipe_process(dev->pipe, dev, x / coarse, y / coarse, wd / coarse, ht / coarse,
+                                             scale / coarse);
+    dev->pipe->coarse = 1;
+    if(err) goto interrupted;
+    dt_show_times(&start, "[dev_process_image] coarse pixel pipeline processing");
+
+    if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
+
+    // display the coarse image in place of the final one until the refinement is done
+    dev->pipe->backbuf_scale = scale;
+    dev->pipe->backbuf_zoom_x = zoom_x;
+    dev->pipe->backbuf_zoom_y = zoom_y;
+    dt_control_queue_redraw_center();
+  }
+
   dt_get_times(&start);
   if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
   {
+interrupted:
     // interrupted because image changed?
     if(dev->image_force_reload)
     {
@@ -1151,6 +1186,7 @@ void dt_dev_pop_history_items_ext(dt_develop_t *dev, int32_t cnt)
   dev->history_end = cnt;
 
   // reset gui params for all modules
+  dt_iop_order_table_t *table = dt_ioppr_iop_order_table_new(dev->iop_order_list);
   GList *modules = dev->iop;
   while(modules)
   {
@@ -1160,13 +1196,14 @@ void dt_dev_pop_history_items_ext(dt_develop_t *dev, int32_t cnt)
     module->enabled = module->default_enabled;
 
     if(module->multi_priority == 0)
-      module->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, module->op, module->multi_priority);
+      module->iop_order = dt_ioppr_iop_order_table_get_order(table, module->op, module->multi_priority);
     else
     {
       module->iop_order = INT_MAX;
     }
     modules = g_list_next(modules);
   }
+  dt_ioppr_iop_order_table_free(table);
 
   // go through history and set gui params
   GList *forms = NULL;
@@ -1532,7 +1569,7 @@ static void _dev_merge_history(dt_develop_t *dev, const int imgid)
                                   "UPDATE memory.history SET num=?1 WHERE rowid=?2", -1, &stmt, NULL);
 
       // let's wrap this into a transaction, it might make it a little faster.
-      sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+      const gboolean transaction = dt_database_start_transaction(darktable.db);
       for(GList *r = rowids; r; r = g_list_next(r))
       {
         DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
@@ -1545,7 +1582,7 @@ static void _dev_merge_history(dt_develop_t *dev, const int imgid)
         v++;
       }
 
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+      dt_database_release_transaction(darktable.db, transaction);
 
       g_list_free(rowids);
     }
@@ -2161,9 +2198,9 @@ void dt_dev_masks_selection_change(dt_develop_t *dev, int selectid, int throw_ev
     dev->proxy.masks.selection_change(dev->proxy.masks.module, selectid, throw_event);
 }
 
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename)
+void dt_dev_snapshot_request(dt_develop_t *dev, cairo_surface_t **surface)
 {
-  dev->proxy.snapshot.filename = filename;
+  dev->proxy.snapshot.surface = surface;
   dev->proxy.snapshot.request = TRUE;
   dt_control_queue_redraw_center();
 }
@@ -2409,65 +2446,325 @@ int dt_dev_distort_backtransform(dt_develop_t *dev, float *points, size_t points
   return dt_dev_distort_backtransform_plus(dev, dev->preview_pipe, 0.f, DT_DEV_TRANSFORM_DIR_ALL, points, points_count);
 }
 
-int dt_dev_distort_transform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order, const int transf_direction,
-                                  float *points, size_t points_count)
+static inline gboolean _dev_distort_in_range(const dt_iop_module_t *module, const double iop_order,
+                                             const int transf_direction)
 {
-  dt_pthread_mutex_lock(&dev->history_mutex);
-  GList *modules = g_list_first(pipe->iop);
-  GList *pieces = g_list_first(pipe->nodes);
+  return (transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
+         || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
+         || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
+         || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
+         || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order);
+}
+
+// run the modules of the chain on the points, history_mutex has to be held
+static int _dev_distort_chain(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order,
+                              const int transf_direction, const gboolean backward, float *points,
+                              size_t points_count)
+{
+  GList *modules = backward ? g_list_last(pipe->iop) : g_list_first(pipe->iop);
+  GList *pieces = backward ? g_list_last(pipe->nodes) : g_list_first(pipe->nodes);
   while(modules)
   {
-    if(!pieces)
-    {
-      dt_pthread_mutex_unlock(&dev->history_mutex);
-      return 0;
-    }
+    if(!pieces) return 0;
     dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
-    if(piece->enabled && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order)) &&
+    if(piece->enabled && _dev_distort_in_range(module, iop_order, transf_direction) &&
       !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
     {
-      module->distort_transform(module, piece, points, points_count);
+      if(backward)
+        module->distort_backtransform(module, piece, points, points_count);
+      else
+        module->distort_transform(module, piece, points, points_count);
     }
-    modules = g_list_next(modules);
-    pieces = g_list_next(pieces);
+    modules = backward ? g_list_previous(modules) : g_list_next(modules);
+    pieces = backward ? g_list_previous(pieces) : g_list_next(pieces);
   }
-  dt_pthread_mutex_unlock(&dev->history_mutex);
   return 1;
 }
-int dt_dev_distort_backtransform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order, const int transf_direction,
-                                      float *points, size_t points_count)
+
+static uint64_t _dev_hash_distort(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe, const double iop_order,
+                                  const int transf_direction)
 {
-  dt_pthread_mutex_lock(&dev->history_mutex);
+  uint64_t hash = 5381;
   GList *modules = g_list_last(pipe->iop);
   GList *pieces = g_list_last(pipe->nodes);
   while(modules)
   {
-    if(!pieces)
-    {
-      dt_pthread_mutex_unlock(&dev->history_mutex);
-      return 0;
-    }
+    if(!pieces) return 0;
     dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
-    if(piece->enabled && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
-                          || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order)) &&
-      !(dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+    if(piece->enabled && module->operation_tags() & IOP_TAG_DISTORT
+       && _dev_distort_in_range(module, iop_order, transf_direction))
     {
-      module->distort_backtransform(module, piece, points, points_count);
+      hash = ((hash << 5) + hash) ^ piece->hash;
     }
     modules = g_list_previous(modules);
     pieces = g_list_previous(pieces);
   }
+  return hash;
+}
+
+/*
+ * the distort chain of lens correction, perspective, liquify and the like is costly and evaluated for many
+ * points, again and again for the same settings while masks are drawn or adjusted. once a chain has seen
+ * about as many points as its grid has nodes, the chain is sampled on a grid over the pipe input (for
+ * forward transforms) or output (for backtransforms) and points are interpolated from it, until
+ * dt_dev_hash_distort_plus() of the chain changes. chains that the grid doesn't follow within
+ * DT_DEV_DISTORT_GRID_TOLERANCE, and points outside of the grid, keep going through the modules.
+ */
+#define DT_DEV_DISTORT_GRID_STEP 16
+#define DT_DEV_DISTORT_GRID_TOLERANCE 0.25f
+
+typedef struct dt_dev_distort_grid_t
+{
+  // key
+  const dt_dev_pixelpipe_t *pipe;
+  double iop_order;
+  int transf_direction;
+  gboolean backward;
+  uint64_t hash;
+  int filter;
+  int width, height;
+  float iscale;
+
+  size_t seen;      // points of this chain transformed while the grid wasn't built
+  gboolean invalid; // the grid doesn't follow the chain closely enough
+  int gw, gh;
+  float *nodes;     // 2 * gw * gh, transformed positions of x=i*step, y=j*step
+} dt_dev_distort_grid_t;
+
+static void _dev_distort_grid_free(dt_dev_distort_grid_t *grid)
+{
+  if(!grid) return;
+  dt_free_align(grid->nodes);
+  free(grid);
+}
+
+static inline gboolean _dev_distort_grid_lookup(const dt_dev_distort_grid_t *grid, const float x, const float y,
+                                                float *out)
+{
+  // also catches NaN
+  if(!(x >= 0.0f && y >= 0.0f && x <= grid->width && y <= grid->height)) return FALSE;
+
+  const float fx = x / DT_DEV_DISTORT_GRID_STEP;
+  const float fy = y / DT_DEV_DISTORT_GRID_STEP;
+  const int i = MIN((int)fx, grid->gw - 2);
+  const int j = MIN((int)fy, grid->gh - 2);
+  const float u = fx - i;
+  const float v = fy - j;
+
+  const float *n00 = grid->nodes + 2 * ((size_t)j * grid->gw + i);
+  const float *n01 = n00 + 2;
+  const float *n10 = n00 + 2 * grid->gw;
+  const float *n11 = n10 + 2;
+  for(int c = 0; c < 2; c++)
+  {
+    out[c] = (1.0f - v) * ((1.0f - u) * n00[c] + u * n01[c]) + v * ((1.0f - u) * n10[c] + u * n11[c]);
+    if(!isfinite(out[c])) return FALSE;
+  }
+  return TRUE;
+}
+
+static void _dev_distort_grid_build(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, dt_dev_distort_grid_t *grid)
+{
+  grid->gw = (grid->width + DT_DEV_DISTORT_GRID_STEP - 1) / DT_DEV_DISTORT_GRID_STEP + 1;
+  grid->gh = (grid->height + DT_DEV_DISTORT_GRID_STEP - 1) / DT_DEV_DISTORT_GRID_STEP + 1;
+  const size_t count = (size_t)grid->gw * grid->gh;
+  grid->nodes = dt_alloc_align(64, sizeof(float) * 2 * count);
+  if(!grid->nodes)
+  {
+    grid->invalid = TRUE;
+    return;
+  }
+  for(int j = 0; j < grid->gh; j++)
+    for(int i = 0; i < grid->gw; i++)
+    {
+      grid->nodes[2 * ((size_t)j * grid->gw + i)] = i * DT_DEV_DISTORT_GRID_STEP;
+      grid->nodes[2 * ((size_t)j * grid->gw + i) + 1] = j * DT_DEV_DISTORT_GRID_STEP;
+    }
+  int ok = _dev_distort_chain(dev, pipe, grid->iop_order, grid->transf_direction, grid->backward,
+                              grid->nodes, count);
+
+  // check the chain against the grid in the centre of every few cells
+  const int stride = 5;
+  const int pw = (grid->gw - 1 + stride - 1) / stride;
+  const int ph = (grid->gh - 1 + stride - 1) / stride;
+  float *probes = ok ? dt_alloc_align(64, sizeof(float) * 2 * pw * ph) : NULL;
+  if(probes)
+  {
+    for(int j = 0; j < ph; j++)
+      for(int i = 0; i < pw; i++)
+      {
+        probes[2 * (j * pw + i)] = MIN((i * stride + 0.5f) * DT_DEV_DISTORT_GRID_STEP, grid->width);
+        probes[2 * (j * pw + i) + 1] = MIN((j * stride + 0.5f) * DT_DEV_DISTORT_GRID_STEP, grid->height);
+      }
+    float *expected = dt_alloc_align(64, sizeof(float) * 2 * pw * ph);
+    if(expected)
+    {
+      memcpy(expected, probes, sizeof(float) * 2 * pw * ph);
+      ok = _dev_distort_chain(dev, pipe, grid->iop_order, grid->transf_direction, grid->backward, expected,
+                              (size_t)pw * ph);
+      for(int k = 0; ok && k < pw * ph; k++)
+      {
+        float p[2];
+        // probes the grid can't serve keep going through the chain, they don't count
+        if(!isfinite(expected[2 * k]) || !isfinite(expected[2 * k + 1])) continue;
+        if(!_dev_distort_grid_lookup(grid, probes[2 * k], probes[2 * k + 1], p)) continue;
+        if(fabsf(p[0] - expected[2 * k]) > DT_DEV_DISTORT_GRID_TOLERANCE
+           || fabsf(p[1] - expected[2 * k + 1]) > DT_DEV_DISTORT_GRID_TOLERANCE)
+          ok = 0;
+      }
+      dt_free_align(expected);
+    }
+    else
+      ok = 0;
+    dt_free_align(probes);
+  }
+  else
+    ok = 0;
+
+  if(!ok)
+  {
+    dt_free_align(grid->nodes);
+    grid->nodes = NULL;
+    grid->invalid = TRUE;
+  }
+}
+
+// transform the points through the grid of the chain, history_mutex has to be held. returns FALSE if the
+// chain has no grid (yet), the caller runs the modules then.
+static gboolean _dev_distort_grid_apply(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order,
+                                        const int transf_direction, const gboolean backward, float *points,
+                                        size_t points_count)
+{
+  // the grid covers the space the chain starts from: the pipe input if it goes forward from the start of
+  // the pipe, the pipe output if it goes back from its end
+  int width, height;
+  if(!backward && (transf_direction == DT_DEV_TRANSFORM_DIR_ALL || transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL
+                   || transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL))
+  {
+    width = pipe->iwidth;
+    height = pipe->iheight;
+  }
+  else if(backward && (transf_direction == DT_DEV_TRANSFORM_DIR_ALL || transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL
+                       || transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL))
+  {
+    width = pipe->processed_width;
+    height = pipe->processed_height;
+  }
+  else
+    return FALSE;
+  if(width < DT_DEV_DISTORT_GRID_STEP || height < DT_DEV_DISTORT_GRID_STEP) return FALSE;
+
+  const uint64_t hash = _dev_hash_distort(dev, pipe, iop_order, transf_direction);
+  const int filter = dev->gui_module ? dev->gui_module->operation_tags_filter() : 0;
+
+  dt_dev_distort_grid_t *grid = NULL;
+  for(int k = 0; k < DT_DEV_DISTORT_GRIDS && !grid; k++)
+  {
+    dt_dev_distort_grid_t *g = dev->distort_grid.entries[k];
+    if(g && g->pipe == pipe && g->iop_order == iop_order && g->transf_direction == transf_direction
+       && g->backward == backward)
+      grid = g;
+  }
+  if(!grid)
+  {
+    const int k = dev->distort_grid.next;
+    dev->distort_grid.next = (k + 1) % DT_DEV_DISTORT_GRIDS;
+    _dev_distort_grid_free(dev->distort_grid.entries[k]);
+    grid = dev->distort_grid.entries[k] = calloc(1, sizeof(dt_dev_distort_grid_t));
+    if(!grid) return FALSE;
+    grid->pipe = pipe;
+    grid->iop_order = iop_order;
+    grid->transf_direction = transf_direction;
+    grid->backward = backward;
+  }
+
+  // a new entry has no size yet and is set up here as well
+  if(grid->hash != hash || grid->filter != filter || grid->width != width || grid->height != height
+     || grid->iscale != pipe->iscale)
+  {
+    dt_free_align(grid->nodes);
+    grid->nodes = NULL;
+    grid->hash = hash;
+    grid->filter = filter;
+    grid->width = width;
+    grid->height = height;
+    grid->iscale = pipe->iscale;
+    grid->seen = 0;
+    grid->invalid = FALSE;
+    grid->gw = grid->gh = 0;
+  }
+  if(grid->invalid) return FALSE;
+
+  if(!grid->nodes)
+  {
+    // only pays off once the chain has been asked for about as many points as the grid has nodes
+    const size_t nodes = (size_t)((width + DT_DEV_DISTORT_GRID_STEP - 1) / DT_DEV_DISTORT_GRID_STEP + 1)
+                         * ((height + DT_DEV_DISTORT_GRID_STEP - 1) / DT_DEV_DISTORT_GRID_STEP + 1);
+    grid->seen += points_count;
+    if(grid->seen < nodes) return FALSE;
+    _dev_distort_grid_build(dev, pipe, grid);
+    if(!grid->nodes) return FALSE;
+  }
+
+  // points the grid can't serve are collected and go through the chain in one batch
+  size_t *missed_idx = malloc(sizeof(size_t) * points_count);
+  float *missed_pts = dt_alloc_align(64, sizeof(float) * 2 * points_count);
+  if(!missed_idx || !missed_pts)
+  {
+    free(missed_idx);
+    dt_free_align(missed_pts);
+    return FALSE;
+  }
+
+  size_t missed = 0;
+  for(size_t k = 0; k < points_count; k++)
+  {
+    float p[2];
+    if(_dev_distort_grid_lookup(grid, points[2 * k], points[2 * k + 1], p))
+    {
+      points[2 * k] = p[0];
+      points[2 * k + 1] = p[1];
+    }
+    else
+    {
+      missed_pts[2 * missed] = points[2 * k];
+      missed_pts[2 * missed + 1] = points[2 * k + 1];
+      missed_idx[missed++] = k;
+    }
+  }
+  if(missed)
+  {
+    _dev_distort_chain(dev, pipe, iop_order, transf_direction, backward, missed_pts, missed);
+    for(size_t k = 0; k < missed; k++)
+    {
+      points[2 * missed_idx[k]] = missed_pts[2 * k];
+      points[2 * missed_idx[k] + 1] = missed_pts[2 * k + 1];
+    }
+  }
+  free(missed_idx);
+  dt_free_align(missed_pts);
+  return TRUE;
+}
+
+int dt_dev_distort_transform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order, const int transf_direction,
+                                  float *points, size_t points_count)
+{
+  dt_pthread_mutex_lock(&dev->history_mutex);
+  const int ok = _dev_distort_grid_apply(dev, pipe, iop_order, transf_direction, FALSE, points, points_count)
+                 || _dev_distort_chain(dev, pipe, iop_order, transf_direction, FALSE, points, points_count);
   dt_pthread_mutex_unlock(&dev->history_mutex);
-  return 1;
+  return ok;
+}
+int dt_dev_distort_backtransform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order, const int transf_direction,
+                                      float *points, size_t points_count)
+{
+  dt_pthread_mutex_lock(&dev->history_mutex);
+  const int ok = _dev_distort_grid_apply(dev, pipe, iop_order, transf_direction, TRUE, points, points_count)
+                 || _dev_distort_chain(dev, pipe, iop_order, transf_direction, TRUE, points, points_count);
+  dt_pthread_mutex_unlock(&dev->history_mutex);
+  return ok;
 }
 
 dt_dev_pixelpipe_iop_t *dt_dev_distort_get_iop_pipe(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe,
@@ -2590,31 +2887,8 @@ uint64_t dt_dev_hash_distort(dt_develop_t *dev)
 
 uint64_t dt_dev_hash_distort_plus(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe, const double iop_order, const int transf_direction)
 {
-  uint64_t hash = 5381;
   dt_pthread_mutex_lock(&dev->history_mutex);
-  GList *modules = g_list_last(pipe->iop);
-  GList *pieces = g_list_last(pipe->nodes);
-  while(modules)
-  {
-    if(!pieces)
-    {
-      dt_pthread_mutex_unlock(&dev->history_mutex);
-      return 0;
-    }
-    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
-    if(piece->enabled && module->operation_tags() & IOP_TAG_DISTORT
-       && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL && module->iop_order > iop_order)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL && module->iop_order <= iop_order)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL && module->iop_order < iop_order)))
-    {
-      hash = ((hash << 5) + hash) ^ piece->hash;
-    }
-    modules = g_list_previous(modules);
-    pieces = g_list_previous(pieces);
-  }
+  const uint64_t hash = _dev_hash_distort(dev, pipe, iop_order, transf_direction);
   dt_pthread_mutex_unlock(&dev->history_mutex);
   return hash;
 }
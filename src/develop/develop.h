@@ -141,6 +141,11 @@ typedef struct dt_dev_proxy_exposure_t
 } dt_dev_proxy_exposure_t;
 
 struct dt_dev_pixelpipe_t;
+struct dt_dev_distort_grid_t;
+
+// number of distort chains, by pipe, direction and iop_order range, whose displacement grid is kept
+#define DT_DEV_DISTORT_GRIDS 4
+
 typedef struct dt_develop_t
 {
   int32_t gui_attached; // != 0 if the gui should be notified of changes in hist stack and modules should be
@@ -207,6 +212,8 @@ typedef struct dt_develop_t
   struct dt_masks_form_gui_t *form_gui;
   // all forms to be linked here for cleanup:
   GList *allforms;
+  // rendered drawn masks, reused by the darkroom pipes
+  struct dt_masks_cache_t *masks_cache;
 
   //full preview stuff
   int full_preview;
@@ -246,9 +253,9 @@ typedef struct dt_develop_t
     struct
     {
       // this flag is set by snapshot plugin to signal that expose of darkroom
-      // should store cairo surface as snapshot to disk using filename.
+      // should store a copy of its cairo surface as snapshot into *surface.
       gboolean request;
-      const gchar *filename;
+      cairo_surface_t **surface;
     } snapshot;
 
     // masks plugin hooks
@@ -334,6 +341,13 @@ typedef struct dt_develop_t
 
   int mask_form_selected_id; // select a mask inside an iop
   gboolean darkroom_skip_mouse_events; // skip mouse events for masks
+
+  // sampled displacement grids of the distort chains, protected by history_mutex
+  struct
+  {
+    struct dt_dev_distort_grid_t *entries[DT_DEV_DISTORT_GRIDS];
+    int next;
+  } distort_grid;
 } dt_develop_t;
 
 void dt_dev_init(dt_develop_t *dev, int32_t gui_attached);
@@ -422,8 +436,8 @@ gboolean dt_dev_modulegroups_test(dt_develop_t *dev, uint32_t group, uint32_t io
 /** reorder the module list */
 void dt_dev_reorder_gui_module_list(dt_develop_t *dev);
 
-/** request snapshot */
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename);
+/** request snapshot, a copy of the center view goes to *surface once drawn */
+void dt_dev_snapshot_request(dt_develop_t *dev, cairo_surface_t **surface);
 
 /** update gliding average for pixelpipe delay */
 void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_delay);
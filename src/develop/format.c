@@ -31,6 +31,9 @@ size_t dt_iop_buffer_dsc_to_bpp(const struct dt_iop_buffer_dsc_t *dsc)
     case TYPE_UINT16:
       bpp *= sizeof(uint16_t);
       break;
+    case TYPE_UINT8:
+      bpp *= sizeof(uint8_t);
+      break;
     default:
       dt_unreachable_codepath();
       break;
@@ -51,7 +54,12 @@ void default_input_format(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
   if(dt_image_is_raw(&pipe->image)) dsc->channels = 1;
 
   if(dt_ioppr_get_iop_order(pipe->iop_order_list, self->op, self->multi_priority)
-     > dt_ioppr_get_iop_order(pipe->iop_order_list, "rawprepare", 0)) return;
+     > dt_ioppr_get_iop_order(pipe->iop_order_list, "rawprepare", 0))
+  {
+    // the raw stage of the pipe keeps the normalized mosaic as uint16, see pixelpipe_raw_uint16
+    if(pipe->raw_uint16) dsc->datatype = TYPE_UINT16;
+    return;
+  }
 
   if(piece->pipe->dsc.filters)
     dsc->datatype = TYPE_UINT16;
@@ -69,7 +77,11 @@ void default_output_format(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_d
   if(dt_image_is_raw(&pipe->image)) dsc->channels = 1;
 
   if(dt_ioppr_get_iop_order(pipe->iop_order_list, self->op, self->multi_priority)
-     >= dt_ioppr_get_iop_order(pipe->iop_order_list, "rawprepare", 0)) return;
+     >= dt_ioppr_get_iop_order(pipe->iop_order_list, "rawprepare", 0))
+  {
+    if(pipe->raw_uint16) dsc->datatype = TYPE_UINT16;
+    return;
+  }
 
   if(piece->pipe->dsc.filters)
     dsc->datatype = TYPE_UINT16;
@@ -30,6 +30,7 @@ typedef enum dt_iop_buffer_type_t {
   TYPE_UNKNOWN,
   TYPE_FLOAT,
   TYPE_UINT16,
+  TYPE_UINT8,
 } dt_iop_buffer_type_t;
 
 typedef struct dt_iop_buffer_dsc_t
@@ -66,6 +67,21 @@ typedef struct dt_iop_buffer_dsc_t
 
 size_t dt_iop_buffer_dsc_to_bpp(const struct dt_iop_buffer_dsc_t *dsc);
 
+/** with pixelpipe_raw_uint16 the normalized mosaic between rawprepare and demosaic is kept as uint16, this is
+ * what 1.0 maps to. it leaves headroom for white balance coefficients up to 4. */
+#define DT_RAW_UINT16_ONE 16384.0f
+
+static inline uint16_t dt_raw_float_to_uint16(const float v)
+{
+  const float s = v * DT_RAW_UINT16_ONE + 0.5f;
+  return s <= 0.0f ? 0 : (s >= 65535.0f ? 65535 : (uint16_t)s);
+}
+
+static inline float dt_raw_uint16_to_float(const uint16_t v)
+{
+  return v * (1.0f / DT_RAW_UINT16_ONE);
+}
+
 void default_input_format(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe,
                           struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_buffer_dsc_t *dsc);
 
@@ -182,6 +182,10 @@ static void default_process(struct dt_iop_module_t *self, struct dt_dev_pixelpip
   if(darktable.codepath.OPENMP_SIMD && self->process_plain)
     self->process_plain(self, piece, i, o, roi_in, roi_out);
 #if defined(__SSE__)
+  else if(darktable.codepath.AVX512 && self->process_avx512)
+    self->process_avx512(self, piece, i, o, roi_in, roi_out);
+  else if(darktable.codepath.AVX2 && self->process_avx2)
+    self->process_avx2(self, piece, i, o, roi_in, roi_out);
   else if(darktable.codepath.SSE2 && self->process_sse2)
     self->process_sse2(self, piece, i, o, roi_in, roi_out);
 #endif
@@ -208,6 +212,25 @@ static dt_introspection_field_t *default_get_f(const char *name)
   return NULL;
 }
 
+// run init_global() of a module exactly once. with lazy_iop_init this happens when the first instance is
+// created instead of at startup, which can be from any thread (export jobs), hence the lock.
+static void _iop_init_global_so(dt_iop_module_so_t *module)
+{
+  static GMutex lock;
+
+  if(g_atomic_int_get(&module->global_inited)) return;
+
+  g_mutex_lock(&lock);
+  if(!module->global_inited)
+  {
+    const double start = dt_get_wtime();
+    if(module->init_global) module->init_global(module);
+    dt_print(DT_DEBUG_PERF, "[iop_init_global] `%s' took %.3f secs\n", module->op, dt_get_wtime() - start);
+    g_atomic_int_set(&module->global_inited, TRUE);
+  }
+  g_mutex_unlock(&lock);
+}
+
 int dt_iop_load_module_so(void *m, const char *libname, const char *op)
 {
   dt_iop_module_so_t *module = (dt_iop_module_so_t *)m;
@@ -315,6 +338,15 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *op)
   if(!g_module_symbol(module->module, "process_sse2", (gpointer) & (module->process_sse2)))
     module->process_sse2 = NULL;
 
+  if(!g_module_symbol(module->module, "process_avx2", (gpointer) & (module->process_avx2)))
+    module->process_avx2 = NULL;
+
+  if(!g_module_symbol(module->module, "process_avx512", (gpointer) & (module->process_avx512)))
+    module->process_avx512 = NULL;
+
+  if(!g_module_symbol(module->module, "process_pixels", (gpointer) & (module->process_pixels)))
+    module->process_pixels = NULL;
+
   if(!g_module_symbol(module->module, "process", (gpointer) & (module->process_plain))) goto error;
 
   if(!darktable.opencl->inited
@@ -360,7 +392,8 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *op)
       goto error;
   }
 
-  if(module->init_global) module->init_global(module);
+  // the expensive part (opencl kernels, lookup tables) can wait until the module is actually used
+  if(!dt_conf_get_bool("lazy_iop_init")) _iop_init_global_so(module);
   return 0;
 error:
   fprintf(stderr, "[iop_load_module] failed to open operation `%s': %s\n", op, g_module_error());
@@ -452,6 +485,9 @@ int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt
   module->process_tiling = so->process_tiling;
   module->process_plain = so->process_plain;
   module->process_sse2 = so->process_sse2;
+  module->process_avx2 = so->process_avx2;
+  module->process_avx512 = so->process_avx512;
+  module->process_pixels = so->process_pixels;
   module->process_cl = so->process_cl;
   module->process_tiling_cl = so->process_tiling_cl;
   module->distort_transform = so->distort_transform;
@@ -495,6 +531,7 @@ int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt
     dt_iop_gui_set_state(module, state);
   }
 
+  _iop_init_global_so(so);
   module->global_data = so->data;
 
   // now init the instance:
@@ -1216,6 +1253,9 @@ static void init_presets(dt_iop_module_so_t *module_so)
 
   int32_t module_version = module_so->version();
 
+  // usually all presets are up to date, don't query them for nothing
+  if(!dt_gui_presets_need_update(module_so->op, module_version)) return;
+
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(
       dt_database_get(darktable.db),
@@ -1406,18 +1446,14 @@ static void init_key_accels(dt_iop_module_so_t *module)
   // Calling the accelerator initialization callback, if present
   if(module->init_key_accels) (module->init_key_accels)(module);
   /** load shortcuts for presets **/
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT name FROM data.presets WHERE operation=?1 ORDER BY writeprotect DESC, rowid",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->op, -1, SQLITE_TRANSIENT);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  GList *names = dt_gui_presets_get_names(module->op, -1);
+  for(const GList *n = names; n; n = g_list_next(n))
   {
     char path[1024];
-    snprintf(path, sizeof(path), "%s/%s", _("preset"), (const char *)sqlite3_column_text(stmt, 0));
+    snprintf(path, sizeof(path), "%s/%s", _("preset"), (const char *)n->data);
     dt_accel_register_iop(module, FALSE, NC_("accel", path), 0, 0);
   }
-  sqlite3_finalize(stmt);
+  g_list_free_full(names, g_free);
 }
 
 static void dt_iop_init_module_so(void *m)
@@ -1530,7 +1566,7 @@ void dt_iop_unload_modules_so()
   while(darktable.iop)
   {
     dt_iop_module_so_t *module = (dt_iop_module_so_t *)darktable.iop->data;
-    if(module->cleanup_global) module->cleanup_global(module);
+    if(module->cleanup_global && module->global_inited) module->cleanup_global(module);
     if(module->module) g_module_close(module->module);
     free(darktable.iop->data);
     darktable.iop = g_list_delete_link(darktable.iop, darktable.iop);
@@ -1619,6 +1655,11 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
     // register if module allows tiling, commit_params can overwrite this.
     if(module->flags() & IOP_FLAGS_ALLOW_TILING) piece->process_tiling_ready = 1;
 
+    // float buffers only, commit_params can opt in to the uint16 raw stage.
+    piece->process_uint16_ready = 0;
+    // no neighbourhood known, commit_params can tell it's not needed.
+    piece->process_pointwise = 0;
+
     module->commit_params(module, params, pipe, piece);
     uint64_t hash = 5381;
     for(int i = 0; i < length; i++) hash = ((hash << 5) + hash) ^ str[i];
@@ -2060,15 +2101,28 @@ GtkWidget *dt_iop_gui_get_pluginui(dt_iop_module_t *module)
   return dtgtk_expander_get_frame(DTGTK_EXPANDER(module->expander));
 }
 
-int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe)
+static inline int _pipe_result_discarded(const struct dt_develop_t *dev, const struct dt_dev_pixelpipe_t *pipe)
 {
-  if(pipe != dev->preview_pipe && pipe != dev->preview2_pipe) sched_yield();
   if(pipe != dev->preview_pipe && pipe != dev->preview2_pipe && pipe->changed == DT_DEV_PIPE_ZOOMED) return 1;
   if((pipe->changed != DT_DEV_PIPE_UNCHANGED && pipe->changed != DT_DEV_PIPE_ZOOMED) || dev->gui_leaving)
     return 1;
   return 0;
 }
 
+int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe != dev->preview_pipe && pipe != dev->preview2_pipe) sched_yield();
+  return _pipe_result_discarded(dev, pipe);
+}
+
+int dt_iop_process_cancelled(const struct dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_dev_pixelpipe_t *pipe = piece->pipe;
+  if(pipe->shutdown) return 1;
+  const dt_develop_t *dev = piece->module->dev;
+  return dev ? _pipe_result_discarded(dev, pipe) : 0;
+}
+
 void dt_iop_nap(int32_t usec)
 {
   if(usec <= 0) return;
@@ -2188,17 +2242,10 @@ void dt_iop_connect_common_accels(dt_iop_module_t *module)
 
   if(module->fusion_slider) dt_accel_connect_slider_iop(module, "fusion", module->fusion_slider);
 
-  sqlite3_stmt *stmt;
   // don't know for which image. show all we got:
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT name FROM data.presets WHERE operation=?1 ORDER BY writeprotect DESC, rowid",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->op, -1, SQLITE_TRANSIENT);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    dt_accel_connect_preset_iop(module, (char *)sqlite3_column_text(stmt, 0));
-  }
-  sqlite3_finalize(stmt);
+  GList *names = dt_gui_presets_get_names(module->op, -1);
+  for(const GList *n = names; n; n = g_list_next(n)) dt_accel_connect_preset_iop(module, (const char *)n->data);
+  g_list_free_full(names, g_free);
 }
 
 // to be called before issuing any query based on memory.darktable_iop_names
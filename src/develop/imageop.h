@@ -257,6 +257,14 @@ typedef struct dt_iop_module_so_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  void (*process_avx2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                       const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                       const struct dt_iop_roi_t *const roi_out);
+  void (*process_avx512)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                         const struct dt_iop_roi_t *const roi_out);
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *const buf,
+                         const size_t npixels);
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
                     const struct dt_iop_roi_t *const roi_out);
@@ -278,6 +286,9 @@ typedef struct dt_iop_module_so_t
   void *(*get_p)(const void *param, const char *name);
   dt_introspection_field_t *(*get_f)(const char *name);
 
+  /** set once init_global() has run, which may be deferred to the first instance (see lazy_iop_init). */
+  gint global_inited;
+
 } dt_iop_module_so_t;
 
 typedef struct dt_iop_module_t
@@ -506,6 +517,17 @@ typedef struct dt_iop_module_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  /** a variant process(), that can contain AVX2 and FMA code. */
+  void (*process_avx2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                       const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                       const struct dt_iop_roi_t *const roi_out);
+  /** a variant process(), that can contain AVX-512F code. */
+  void (*process_avx512)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
+                         const struct dt_iop_roi_t *const roi_out);
+  /** process() in place on a run of pixels, for pointwise modules. */
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *const buf,
+                         const size_t npixels);
   /** the opencl equivalent of process(). */
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
@@ -612,6 +634,10 @@ void dt_iop_cleanup_histogram(gpointer data, gpointer user_data);
 
 /** let plugins have breakpoints: */
 int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe);
+/** cheap check for long running process() implementations and tiling loops, to be polled per
+    row block or tile: non-zero once the output is going to be discarded anyway. the module may then
+    return early with incomplete output, the pixelpipe throws it away. */
+int dt_iop_process_cancelled(const struct dt_dev_pixelpipe_iop_t *piece);
 
 /** allow plugins to relinquish CPU and go to sleep for some time */
 void dt_iop_nap(int32_t usec);
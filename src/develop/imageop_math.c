@@ -23,6 +23,7 @@
 #endif
 #include <glib.h> // for MIN, MAX, CLAMP, inline
 #include <math.h> // for round, floorf, fmaxf
+#include <string.h> // for memset
 #ifdef __SSE__
 #include <xmmintrin.h> // for _mm_set_ps, _mm_mul_ps, _mm_set...
 #endif
@@ -862,9 +863,26 @@ void dt_iop_clip_and_zoom_mosaic_half_size_f(float *const out, const float *cons
     dt_unreachable_codepath();
 }
 
+// horizontal extent of the box filter of every output column, computed exactly like the
+// original per-pixel loops did so results don't change
+static void _xtrans_footprint(const dt_iop_roi_t *const roi_out, const dt_iop_roi_t *const roi_in,
+                              const float px_footprint, int *const minx, int *const maxx)
+{
+  float fx = roi_out->x * px_footprint;
+  for(int x = 0; x < roi_out->width; x++, fx += px_footprint)
+  {
+    minx[x] = MAX(0, (int)roundf(fx - px_footprint));
+    maxx[x] = MIN(roi_in->width-1, (int)roundf(fx + px_footprint));
+  }
+}
+
 /**
  * downscales and clips a Fujifilm X-Trans mosaiced buffer (in) to the given region of interest (r_*)
  * and writes it to out.
+ *
+ * for every output row the input rows of the box filter are first summed up per column and
+ * color, every output pixel then only adds up the columns of its box. that makes the cost
+ * grow with the filter width instead of its area, which matters a lot for large sensors.
  */
 void dt_iop_clip_and_zoom_mosaic_third_size_xtrans(uint16_t *const out, const uint16_t *const in,
                                                    const dt_iop_roi_t *const roi_out,
@@ -875,39 +893,64 @@ void dt_iop_clip_and_zoom_mosaic_third_size_xtrans(uint16_t *const out, const ui
   // Use box filter of width px_footprint*2+1 centered on the current
   // sample (rounded to nearest input pixel) to anti-alias. Higher MP
   // images need larger filters to avoid artifacts.
+  int *const minx = dt_alloc_align(64, sizeof(int) * 2 * roi_out->width);
+  int *const maxx = minx + roi_out->width;
+  const size_t colsize = (size_t)3 * roi_in->width;
+  uint32_t *const colsum_buf = dt_alloc_align(64, sizeof(uint32_t) * colsize * dt_get_num_threads());
+  uint16_t *const colnum_buf = dt_alloc_align(64, sizeof(uint16_t) * colsize * dt_get_num_threads());
+  if(!minx || !colsum_buf || !colnum_buf) goto error;
+
+  _xtrans_footprint(roi_out, roi_in, px_footprint, minx, maxx);
+  const int xbeg = minx[0], xend = maxx[roi_out->width - 1];
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, in_stride, out, out_stride, px_footprint, roi_in, roi_out, xtrans) \
+  dt_omp_firstprivate(in, in_stride, out, out_stride, px_footprint, roi_in, roi_out, xtrans, minx, maxx, \
+                      colsize, colsum_buf, colnum_buf, xbeg, xend) \
   schedule(static)
 #endif
   for(int y = 0; y < roi_out->height; y++)
   {
     uint16_t *outc = out + out_stride * y;
+    uint32_t *const colsum = colsum_buf + colsize * dt_get_thread_num();
+    uint16_t *const colnum = colnum_buf + colsize * dt_get_thread_num();
 
     const float fy = (y + roi_out->y) * px_footprint;
     const int miny = MAX(0, (int)roundf(fy - px_footprint));
     const int maxy = MIN(roi_in->height-1, (int)roundf(fy + px_footprint));
 
-    float fx = roi_out->x * px_footprint;
-    for(int x = 0; x < roi_out->width; x++, fx += px_footprint, outc++)
+    memset(colsum + 3 * xbeg, 0, sizeof(uint32_t) * 3 * (xend - xbeg + 1));
+    memset(colnum + 3 * xbeg, 0, sizeof(uint16_t) * 3 * (xend - xbeg + 1));
+    for(int yy = miny; yy <= maxy; ++yy)
     {
-      const int minx = MAX(0, (int)roundf(fx - px_footprint));
-      const int maxx = MIN(roi_in->width-1, (int)roundf(fx + px_footprint));
+      const uint16_t *const inrow = in + (size_t)in_stride * yy;
+      const uint8_t *const cfa = xtrans[(yy + roi_in->y + 600) % 6];
+      for(int xx = xbeg, p = (xbeg + roi_in->x + 600) % 6; xx <= xend; ++xx, p = (p == 5) ? 0 : p + 1)
+      {
+        colsum[3 * xx + cfa[p]] += inrow[xx];
+        colnum[3 * xx + cfa[p]]++;
+      }
+    }
 
+    for(int x = 0; x < roi_out->width; x++, outc++)
+    {
       const int c = FCxtrans(y, x, roi_out, xtrans);
       int num = 0;
       uint32_t col = 0;
 
-      for(int yy = miny; yy <= maxy; ++yy)
-        for(int xx = minx; xx <= maxx; ++xx)
-          if(FCxtrans(yy, xx, roi_in, xtrans) == c)
-          {
-            col += in[xx + in_stride * yy];
-            num++;
-          }
+      for(int xx = minx[x]; xx <= maxx[x]; ++xx)
+      {
+        col += colsum[3 * xx + c];
+        num += colnum[3 * xx + c];
+      }
       *outc = col / num;
     }
   }
+
+error:
+  dt_free_align(colnum_buf);
+  dt_free_align(colsum_buf);
+  dt_free_align(minx);
 }
 
 void dt_iop_clip_and_zoom_mosaic_third_size_xtrans_f(float *const out, const float *const in,
@@ -916,39 +959,64 @@ void dt_iop_clip_and_zoom_mosaic_third_size_xtrans_f(float *const out, const flo
                                                      const int32_t in_stride, const uint8_t (*const xtrans)[6])
 {
   const float px_footprint = 1.f / roi_out->scale;
+  int *const minx = dt_alloc_align(64, sizeof(int) * 2 * roi_out->width);
+  int *const maxx = minx + roi_out->width;
+  const size_t colsize = (size_t)3 * roi_in->width;
+  float *const colsum_buf = dt_alloc_align(64, sizeof(float) * colsize * dt_get_num_threads());
+  uint16_t *const colnum_buf = dt_alloc_align(64, sizeof(uint16_t) * colsize * dt_get_num_threads());
+  if(!minx || !colsum_buf || !colnum_buf) goto error;
+
+  _xtrans_footprint(roi_out, roi_in, px_footprint, minx, maxx);
+  const int xbeg = minx[0], xend = maxx[roi_out->width - 1];
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, in_stride, out, out_stride, px_footprint, roi_in, roi_out, xtrans) \
+  dt_omp_firstprivate(in, in_stride, out, out_stride, px_footprint, roi_in, roi_out, xtrans, minx, maxx, \
+                      colsize, colsum_buf, colnum_buf, xbeg, xend) \
   schedule(static)
 #endif
   for(int y = 0; y < roi_out->height; y++)
   {
     float *outc = out + out_stride * y;
+    float *const colsum = colsum_buf + colsize * dt_get_thread_num();
+    uint16_t *const colnum = colnum_buf + colsize * dt_get_thread_num();
 
     const float fy = (y + roi_out->y) * px_footprint;
     const int miny = MAX(0, (int)roundf(fy - px_footprint));
     const int maxy = MIN(roi_in->height-1, (int)roundf(fy + px_footprint));
 
-    float fx = roi_out->x * px_footprint;
-    for(int x = 0; x < roi_out->width; x++, fx += px_footprint, outc++)
+    memset(colsum + 3 * xbeg, 0, sizeof(float) * 3 * (xend - xbeg + 1));
+    memset(colnum + 3 * xbeg, 0, sizeof(uint16_t) * 3 * (xend - xbeg + 1));
+    for(int yy = miny; yy <= maxy; ++yy)
     {
-      const int minx = MAX(0, (int)roundf(fx - px_footprint));
-      const int maxx = MIN(roi_in->width-1, (int)roundf(fx + px_footprint));
+      const float *const inrow = in + (size_t)in_stride * yy;
+      const uint8_t *const cfa = xtrans[(yy + roi_in->y + 600) % 6];
+      for(int xx = xbeg, p = (xbeg + roi_in->x + 600) % 6; xx <= xend; ++xx, p = (p == 5) ? 0 : p + 1)
+      {
+        colsum[3 * xx + cfa[p]] += inrow[xx];
+        colnum[3 * xx + cfa[p]]++;
+      }
+    }
 
+    for(int x = 0; x < roi_out->width; x++, outc++)
+    {
       const int c = FCxtrans(y, x, roi_out, xtrans);
       int num = 0;
       float col = 0.f;
 
-      for(int yy = miny; yy <= maxy; ++yy)
-        for(int xx = minx; xx <= maxx; ++xx)
-          if(FCxtrans(yy, xx, roi_in, xtrans) == c)
-          {
-            col += in[xx + in_stride * yy];
-            num++;
-          }
+      for(int xx = minx[x]; xx <= maxx[x]; ++xx)
+      {
+        col += colsum[3 * xx + c];
+        num += colnum[3 * xx + c];
+      }
       *outc = col / (float)num;
     }
   }
+
+error:
+  dt_free_align(colnum_buf);
+  dt_free_align(colsum_buf);
+  dt_free_align(minx);
 }
 
 void dt_iop_clip_and_zoom_demosaic_passthrough_monochrome_f_plain(float *out, const float *const in,
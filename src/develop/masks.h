@@ -172,6 +172,28 @@ typedef struct dt_masks_form_t
   int version;
 } dt_masks_form_t;
 
+#define DT_MASKS_CACHE_ENTRIES 8
+
+/** a rendered drawn mask, kept for the next pipe run */
+typedef struct dt_masks_cache_entry_t
+{
+  uint64_t hash; // shapes, distortions before the module, pipe size and roi
+  float *mask;
+  size_t size;   // in bytes
+  uint64_t used;
+} dt_masks_cache_entry_t;
+
+/** cache of rendered drawn masks, shared by all pipes of a develop */
+typedef struct dt_masks_cache_t
+{
+  dt_pthread_mutex_t lock;
+  dt_masks_cache_entry_t entry[DT_MASKS_CACHE_ENTRIES];
+  size_t memory;
+  size_t memory_limit;
+  uint64_t clock;
+  int hits, misses;
+} dt_masks_cache_t;
+
 typedef struct dt_masks_form_gui_points_t
 {
   float *points;
@@ -269,6 +291,10 @@ int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
 int dt_masks_group_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                               const dt_iop_roi_t *roi, float *buffer);
 
+/** allocate the cache of rendered masks, NULL if disabled */
+dt_masks_cache_t *dt_masks_cache_init(const size_t memory_limit);
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache);
+
 // returns current masks version
 int dt_masks_version(void);
 
@@ -349,6 +375,10 @@ int dt_masks_form_duplicate(dt_develop_t *dev, int formid);
 dt_masks_form_t *dt_masks_dup_masks_form(const dt_masks_form_t *form);
 /* duplicate the list of forms, replace item in the list with form with the same formid */
 GList *dt_masks_dup_forms_deep(GList *forms, dt_masks_form_t *form);
+/* TRUE if both lists hold the same forms with the same points, in the same order */
+gboolean dt_masks_forms_equal(GList *a, GList *b);
+/* bytes taken by the forms of the list and their points */
+size_t dt_masks_forms_size(GList *forms);
 
 /** utils functions */
 int dt_masks_point_in_form_exact(float x, float y, float *points, int points_start, int points_count);
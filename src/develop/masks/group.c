@@ -619,14 +619,172 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
   return nb_ok != 0;
 }
 
+static uint64_t _hash_data(uint64_t hash, const void *data, const size_t size)
+{
+  const char *str = (const char *)data;
+  for(size_t i = 0; i < size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+// hashes what the rendering of form reads: its points and, for groups, the sub forms as looked up by
+// dt_group_get_mask_roi()
+static uint64_t _masks_form_hash(dt_develop_t *dev, dt_masks_form_t *form, uint64_t hash)
+{
+  hash = _hash_data(hash, &form->type, sizeof(form->type));
+  hash = _hash_data(hash, &form->formid, sizeof(form->formid));
+  hash = _hash_data(hash, &form->version, sizeof(form->version));
+  hash = _hash_data(hash, form->source, sizeof(form->source));
+
+  size_t point_size = 0;
+  if(form->type & DT_MASKS_CIRCLE)
+    point_size = sizeof(dt_masks_point_circle_t);
+  else if(form->type & DT_MASKS_PATH)
+    point_size = sizeof(dt_masks_point_path_t);
+  else if(form->type & DT_MASKS_GRADIENT)
+    point_size = sizeof(dt_masks_point_gradient_t);
+  else if(form->type & DT_MASKS_ELLIPSE)
+    point_size = sizeof(dt_masks_point_ellipse_t);
+  else if(form->type & DT_MASKS_BRUSH)
+    point_size = sizeof(dt_masks_point_brush_t);
+
+  for(GList *pts = g_list_first(form->points); pts; pts = g_list_next(pts))
+  {
+    if(form->type & DT_MASKS_GROUP)
+    {
+      dt_masks_point_group_t *fpt = (dt_masks_point_group_t *)pts->data;
+      hash = _hash_data(hash, &fpt->state, sizeof(fpt->state));
+      hash = _hash_data(hash, &fpt->opacity, sizeof(fpt->opacity));
+      dt_masks_form_t *sel = dt_masks_get_from_id(dev, fpt->formid);
+      if(sel) hash = _masks_form_hash(dev, sel, hash);
+    }
+    else
+      hash = _hash_data(hash, pts->data, point_size);
+  }
+  return hash;
+}
+
+dt_masks_cache_t *dt_masks_cache_init(const size_t memory_limit)
+{
+  if(memory_limit == 0) return NULL;
+  dt_masks_cache_t *cache = (dt_masks_cache_t *)calloc(1, sizeof(dt_masks_cache_t));
+  if(!cache) return NULL;
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->memory_limit = memory_limit;
+  return cache;
+}
+
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache)
+{
+  if(!cache) return;
+  dt_print(DT_DEBUG_MASKS, "[masks cache] %d hits, %d misses\n", cache->hits, cache->misses);
+  for(int k = 0; k < DT_MASKS_CACHE_ENTRIES; k++) dt_free_align(cache->entry[k].mask);
+  dt_pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+static gboolean _masks_cache_get(dt_masks_cache_t *cache, const uint64_t hash, float *buffer, const size_t size)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&cache->lock);
+  for(int k = 0; k < DT_MASKS_CACHE_ENTRIES; k++)
+  {
+    dt_masks_cache_entry_t *e = cache->entry + k;
+    if(e->mask && e->hash == hash && e->size == size)
+    {
+      memcpy(buffer, e->mask, size);
+      e->used = ++cache->clock;
+      found = TRUE;
+      break;
+    }
+  }
+  if(found)
+    cache->hits++;
+  else
+    cache->misses++;
+  dt_pthread_mutex_unlock(&cache->lock);
+  return found;
+}
+
+static void _masks_cache_put(dt_masks_cache_t *cache, const uint64_t hash, const float *buffer, const size_t size)
+{
+  if(size > cache->memory_limit) return;
+  dt_pthread_mutex_lock(&cache->lock);
+  // evict the least recently used masks until there is a free slot and the new mask fits
+  for(;;)
+  {
+    int slot = -1, lru = -1;
+    for(int k = 0; k < DT_MASKS_CACHE_ENTRIES; k++)
+    {
+      const dt_masks_cache_entry_t *e = cache->entry + k;
+      if(e->mask && e->hash == hash && e->size == size) goto done; // another pipe was faster
+      if(!e->mask)
+      {
+        if(slot < 0) slot = k;
+      }
+      else if(lru < 0 || e->used < cache->entry[lru].used)
+        lru = k;
+    }
+    if(slot >= 0 && cache->memory + size <= cache->memory_limit)
+    {
+      dt_masks_cache_entry_t *e = cache->entry + slot;
+      e->mask = dt_alloc_align(64, size);
+      if(!e->mask) break;
+      memcpy(e->mask, buffer, size);
+      e->hash = hash;
+      e->size = size;
+      e->used = ++cache->clock;
+      cache->memory += size;
+      break;
+    }
+    if(lru < 0) break;
+    dt_masks_cache_entry_t *e = cache->entry + lru;
+    dt_free_align(e->mask);
+    e->mask = NULL;
+    cache->memory -= e->size;
+    e->size = 0;
+  }
+done:
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
 int dt_masks_group_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                               const dt_iop_roi_t *roi, float *buffer)
 {
   const double start = dt_get_wtime();
   if(!form) return 0;
 
+  // the mask only changes with the shapes, the distortions up to this module, the pipe size and the roi.
+  // the key leaves out the pipe so the preview and full pipes share masks rendered for the same region.
+  dt_develop_t *dev = module->dev;
+  dt_masks_cache_t *cache = dev->masks_cache;
+  const size_t size = (size_t)roi->width * roi->height * sizeof(float);
+  uint64_t hash = 5381;
+  if(cache)
+  {
+    hash = _masks_form_hash(dev, form, hash);
+    const uint64_t distort
+        = dt_dev_hash_distort_plus(dev, piece->pipe, module->iop_order, DT_DEV_TRANSFORM_DIR_BACK_INCL);
+    hash = _hash_data(hash, &distort, sizeof(distort));
+    // distortions filtered out while a module is focused, see dt_dev_distort_transform_plus()
+    const int filter = dev->gui_module ? dev->gui_module->operation_tags_filter() : 0;
+    hash = _hash_data(hash, &filter, sizeof(filter));
+    hash = _hash_data(hash, &piece->pipe->iwidth, sizeof(piece->pipe->iwidth));
+    hash = _hash_data(hash, &piece->pipe->iheight, sizeof(piece->pipe->iheight));
+    hash = _hash_data(hash, &piece->pipe->iscale, sizeof(piece->pipe->iscale));
+    hash = _hash_data(hash, roi, sizeof(dt_iop_roi_t));
+
+    if(_masks_cache_get(cache, hash, buffer, size))
+    {
+      if(darktable.unmuted & DT_DEBUG_PERF)
+        dt_print(DT_DEBUG_MASKS, "[masks] cached masks took %0.04f sec\n", dt_get_wtime() - start);
+      return 1;
+    }
+  }
+
   const int ok = dt_masks_get_mask_roi(module, piece, form, roi, buffer);
 
+  if(ok && cache) _masks_cache_put(cache, hash, buffer, size);
+
   if(darktable.unmuted & DT_DEBUG_PERF)
     dt_print(DT_DEBUG_MASKS, "[masks] render all masks took %0.04f sec\n", dt_get_wtime() - start);
   return ok;
@@ -95,6 +95,55 @@ GList *dt_masks_dup_forms_deep(GList *forms, dt_masks_form_t *form)
   return (GList *)g_list_copy_deep(forms, _dup_masks_form_cb, (gpointer)form);
 }
 
+static size_t _form_point_size(const dt_masks_type_t type)
+{
+  if(type & DT_MASKS_CIRCLE)
+    return sizeof(struct dt_masks_point_circle_t);
+  else if(type & DT_MASKS_ELLIPSE)
+    return sizeof(struct dt_masks_point_ellipse_t);
+  else if(type & DT_MASKS_GRADIENT)
+    return sizeof(struct dt_masks_point_gradient_t);
+  else if(type & DT_MASKS_BRUSH)
+    return sizeof(struct dt_masks_point_brush_t);
+  else if(type & DT_MASKS_GROUP)
+    return sizeof(struct dt_masks_point_group_t);
+  else if(type & DT_MASKS_PATH)
+    return sizeof(struct dt_masks_point_path_t);
+  return 0;
+}
+
+static gboolean _form_equal(const dt_masks_form_t *a, const dt_masks_form_t *b)
+{
+  if(a->type != b->type || a->formid != b->formid || a->version != b->version
+     || a->source[0] != b->source[0] || a->source[1] != b->source[1] || strcmp(a->name, b->name))
+    return FALSE;
+
+  // points are copied with memcpy() all along, so they compare bytewise
+  const size_t size = _form_point_size(a->type);
+  GList *pa = a->points, *pb = b->points;
+  for(; pa && pb; pa = g_list_next(pa), pb = g_list_next(pb))
+    if(size && memcmp(pa->data, pb->data, size)) return FALSE;
+  return !pa && !pb;
+}
+
+gboolean dt_masks_forms_equal(GList *a, GList *b)
+{
+  for(; a && b; a = g_list_next(a), b = g_list_next(b))
+    if(!_form_equal((dt_masks_form_t *)a->data, (dt_masks_form_t *)b->data)) return FALSE;
+  return !a && !b;
+}
+
+size_t dt_masks_forms_size(GList *forms)
+{
+  size_t size = 0;
+  for(; forms; forms = g_list_next(forms))
+  {
+    const dt_masks_form_t *form = (dt_masks_form_t *)forms->data;
+    size += sizeof(dt_masks_form_t) + g_list_length(form->points) * (_form_point_size(form->type) + sizeof(GList));
+  }
+  return size;
+}
+
 static int _get_opacity(dt_masks_form_gui_t *gui, const dt_masks_form_t *form)
 {
   const dt_masks_point_group_t *fpt = (dt_masks_point_group_t *)g_list_nth_data(form->points, gui->group_edited);
@@ -2544,8 +2544,10 @@ static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
   // segment length
   const int l = sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1])) + 1;
 
-  const float lx = p1[0] - p0[0];
-  const float ly = p1[1] - p0[1];
+  // steps per pixel, so the loop gets along without divisions
+  const float il = 1.0f / (float)l;
+  const float lx = (p1[0] - p0[0]) * il;
+  const float ly = (p1[1] - p0[1]) * il;
 
   const int dx = lx < 0 ? -1 : 1;
   const int dy = ly < 0 ? -1 : 1;
@@ -2554,9 +2556,9 @@ static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
   for(int i = 0; i < l; i++)
   {
     // position
-    const int x = (int)((float)i * lx / (float)l) + p0[0];
-    const int y = (int)((float)i * ly / (float)l) + p0[1];
-    const float op = 1.0 - (float)i / (float)l;
+    const int x = (int)((float)i * lx) + p0[0];
+    const int y = (int)((float)i * ly) + p0[1];
+    const float op = 1.0f - (float)i * il;
     float *buf = buffer + (size_t)y * bw + x;
     if(x >= 0 && x < bw && y >= 0 && y < bh) buf[0] = MAX(buf[0], op);
     if(x + dx >= 0 && x + dx < bw && y >= 0 && y < bh)
@@ -2566,6 +2568,128 @@ static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
   }
 }
 
+static int _path_crossing_compare(const void *a, const void *b)
+{
+  const int xa = *(const int *)a;
+  const int xb = *(const int *)b;
+  return (xa > xb) - (xa < xb);
+}
+
+/** scanline polygon fill of the path inside roi. the crossings of the path with each line are collected and
+ * sorted, and the spans between them are filled with plain stores, instead of flagging edges in the buffer
+ * and toggling through the whole bounding box pixel by pixel. as with edge flags, a pixel crossed an even
+ * number of times is no edge, and edge pixels outside of the filled area are set too. */
+static void _path_fill_scanlines(float *buffer, const float *cpoints, const int first, const int points_count,
+                                 const int width, const int height, const int xxmin, const int xxmax,
+                                 const int yymin, const int yymax)
+{
+  size_t *offset = calloc(height + 1, sizeof(size_t));
+  size_t *cursor = calloc(height, sizeof(size_t));
+  int *crossings = NULL;
+  if(!offset || !cursor) goto end;
+
+  // first pass counts the crossings of each line, the second one stores them
+  for(int pass = 0; pass < 2; pass++)
+  {
+    float xlast = cpoints[(points_count - 1) * 2];
+    float ylast = cpoints[(points_count - 1) * 2 + 1];
+
+    for(int i = first; i < points_count; i++)
+    {
+      float xstart = xlast;
+      float ystart = ylast;
+
+      float xend = xlast = cpoints[i * 2];
+      float yend = ylast = cpoints[i * 2 + 1];
+
+      if(ystart > yend)
+      {
+        float tmp;
+        tmp = ystart, ystart = yend, yend = tmp;
+        tmp = xstart, xstart = xend, xend = tmp;
+      }
+
+      const float m = (xstart - xend) / (ystart - yend); // we don't need special handling of ystart==yend
+                                                         // as following loop will take care
+
+      for(int yy = (int)ceilf(ystart); (float)yy < yend;
+          yy++) // this would normally never touch the last roi line => see comment in dt_path_get_mask_roi()
+      {
+        const float xcross = xstart + m * (yy - ystart);
+
+        int xx = floorf(xcross);
+        if((float)xx + 0.5f <= xcross) xx++;
+
+        if(xx < 0 || xx >= width || yy < 0 || yy >= height)
+          continue; // sanity check just to be on the safe side
+
+        if(pass == 0)
+          offset[yy + 1]++;
+        else
+          crossings[cursor[yy]++] = xx;
+      }
+    }
+
+    if(pass == 0)
+    {
+      for(int yy = 0; yy < height; yy++)
+      {
+        offset[yy + 1] += offset[yy];
+        cursor[yy] = offset[yy];
+      }
+      crossings = malloc(MAX(offset[height], 1) * sizeof(int));
+      if(!crossings) goto end;
+    }
+  }
+
+#ifdef _OPENMP
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(xxmin, xxmax, yymin, yymax, width, height) \
+  shared(buffer, offset, crossings)
+#else
+#pragma omp parallel for shared(buffer)
+#endif
+#endif
+  for(int yy = 0; yy < height; yy++)
+  {
+    int *xs = crossings + offset[yy];
+    const int n = offset[yy + 1] - offset[yy];
+    if(n == 0) continue;
+    qsort(xs, n, sizeof(int), _path_crossing_compare);
+
+    float *row = buffer + (size_t)yy * width;
+    const int fill = yy >= yymin && yy <= yymax;
+    int inside = 0;
+    int open = 0;
+    for(int k = 0; k < n;)
+    {
+      const int xx = xs[k];
+      int j = k + 1;
+      while(j < n && xs[j] == xx) j++;
+      const int edge = (j - k) & 1;
+      k = j;
+      if(!edge) continue;
+
+      row[xx] = 1.0f;
+      if(!fill || xx < xxmin || xx > xxmax) continue;
+      if(inside)
+        for(int x = open; x < xx; x++) row[x] = 1.0f;
+      else
+        open = xx;
+      inside = !inside;
+    }
+    // path isn't closed within this line, fill up to the limit of the shape
+    if(inside)
+      for(int x = open; x <= xxmax; x++) row[x] = 1.0f;
+  }
+
+end:
+  free(crossings);
+  free(cursor);
+  free(offset);
+}
+
 static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                                 const dt_iop_roi_t *roi, float *buffer)
 {
@@ -2761,81 +2885,17 @@ static int dt_path_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
     else
     {
       // all other cases
-
-      // edge-flag polygon fill: we write all the point around the path into the buffer
-      float xlast = cpoints[(points_count - 1) * 2];
-      float ylast = cpoints[(points_count - 1) * 2 + 1];
-
-      for(int i = nb_corner * 3; i < points_count; i++)
-      {
-        float xstart = xlast;
-        float ystart = ylast;
-
-        float xend = xlast = cpoints[i * 2];
-        float yend = ylast = cpoints[i * 2 + 1];
-
-        if(ystart > yend)
-        {
-          float tmp;
-          tmp = ystart, ystart = yend, yend = tmp;
-          tmp = xstart, xstart = xend, xend = tmp;
-        }
-
-        const float m = (xstart - xend) / (ystart - yend); // we don't need special handling of ystart==yend
-                                                           // as following loop will take care
-
-        for(int yy = (int)ceilf(ystart); (float)yy < yend;
-            yy++) // this would normally never touch the last roi line => see comment further above
-        {
-          const float xcross = xstart + m * (yy - ystart);
-
-          int xx = floorf(xcross);
-          if((float)xx + 0.5f <= xcross) xx++;
-
-          if(xx < 0 || xx >= width || yy < 0 || yy >= height)
-            continue; // sanity check just to be on the safe side
-
-          size_t index = (size_t)yy * width + xx;
-
-          buffer[index] = 1.0f - buffer[index];
-        }
-      }
-
-      if(darktable.unmuted & DT_DEBUG_PERF)
-        dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill draw path took %0.04f sec\n", form->name,
-                 dt_get_wtime() - start2);
-      start2 = dt_get_wtime();
-
-      // we fill the inside plain
       // we don't need to deal with parts of shape outside of roi
       const int xxmin = MAX(xmin, 0);
       const int xxmax = MIN(xmax, width - 1);
       const int yymin = MAX(ymin, 0);
       const int yymax = MIN(ymax, height - 1);
 
-#ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__)
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(xxmin, xxmax, yymin, yymax, width) \
-  shared(buffer)
-#else
-#pragma omp parallel for shared(buffer)
-#endif
-#endif
-      for(int yy = yymin; yy <= yymax; yy++)
-      {
-        int state = 0;
-        for(int xx = xxmin; xx <= xxmax; xx++)
-        {
-          size_t index = (size_t)yy * width + xx;
-          float v = buffer[index];
-          if(v > 0.5f) state = !state;
-          if(state) buffer[index] = 1.0f;
-        }
-      }
+      _path_fill_scanlines(buffer, cpoints, nb_corner * 3, points_count, width, height, xxmin, xxmax, yymin,
+                           yymax);
 
       if(darktable.unmuted & DT_DEBUG_PERF)
-        dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill plain took %0.04f sec\n", form->name,
+        dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill scanlines took %0.04f sec\n", form->name,
                  dt_get_wtime() - start2);
       start2 = dt_get_wtime();
     }
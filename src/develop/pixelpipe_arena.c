@@ -0,0 +1,167 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_arena.h"
+#include "common/darktable.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// every allocation is preceded by one of these, padded to keep the payload aligned
+typedef struct _arena_block_t
+{
+  size_t prev; // arena->top before the allocation
+  int freed;
+} _arena_block_t;
+
+#define DT_ARENA_HEADER 64
+// grow in steps of huge pages
+#define DT_ARENA_GRANULARITY ((size_t)2 << 20)
+
+static void _arena_release(dt_dev_pixelpipe_arena_t *arena)
+{
+  if(!arena->base) return;
+#ifdef MADV_HUGEPAGE
+  if(arena->hugepages)
+    munmap(arena->base, arena->size);
+  else
+#endif
+    dt_free_align(arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->hugepages = 0;
+}
+
+static void _arena_allocate(dt_dev_pixelpipe_arena_t *arena, const size_t size)
+{
+#ifdef MADV_HUGEPAGE
+  // transparent huge pages cut the page faults of touching a fresh block by a factor of 512
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem != MAP_FAILED)
+  {
+    madvise(mem, size, MADV_HUGEPAGE);
+    arena->base = mem;
+    arena->size = size;
+    arena->hugepages = 1;
+    return;
+  }
+#endif
+  arena->base = dt_alloc_align(64, size);
+  arena->size = arena->base ? size : 0;
+  arena->hugepages = 0;
+}
+
+dt_dev_pixelpipe_arena_t *dt_dev_pixelpipe_arena_new(const size_t limit)
+{
+  dt_dev_pixelpipe_arena_t *arena = (dt_dev_pixelpipe_arena_t *)calloc(1, sizeof(dt_dev_pixelpipe_arena_t));
+  if(!arena) return NULL;
+  dt_pthread_mutex_init(&arena->lock, NULL);
+  arena->limit = limit;
+  return arena;
+}
+
+void dt_dev_pixelpipe_arena_destroy(dt_dev_pixelpipe_arena_t *arena)
+{
+  if(!arena) return;
+  _arena_release(arena);
+  dt_pthread_mutex_destroy(&arena->lock);
+  free(arena);
+}
+
+void dt_dev_pixelpipe_arena_reserve(dt_dev_pixelpipe_arena_t *arena, const size_t size)
+{
+  if(!arena) return;
+  const size_t want = MIN(size, arena->limit);
+  dt_pthread_mutex_lock(&arena->lock);
+  if(arena->used == 0 && want > arena->size)
+  {
+    // grow by at least half, so a slowly growing roi doesn't reallocate every run
+    size_t grow = MAX(want, arena->size + arena->size / 2);
+    grow = MIN(arena->limit, (grow + DT_ARENA_GRANULARITY - 1) & ~(DT_ARENA_GRANULARITY - 1));
+    _arena_release(arena);
+    _arena_allocate(arena, grow);
+    dt_print(DT_DEBUG_MEMORY, "[pixelpipe_arena] %zu MB of scratch memory%s\n", arena->size >> 20,
+             arena->hugepages ? " (mmap)" : "");
+  }
+  dt_pthread_mutex_unlock(&arena->lock);
+}
+
+void dt_dev_pixelpipe_arena_reset(dt_dev_pixelpipe_arena_t *arena)
+{
+  if(!arena) return;
+  dt_pthread_mutex_lock(&arena->lock);
+  arena->used = 0;
+  arena->top = 0;
+  dt_pthread_mutex_unlock(&arena->lock);
+}
+
+void *dt_dev_pixelpipe_scratch_alloc(dt_dev_pixelpipe_iop_t *piece, const size_t size)
+{
+  dt_dev_pixelpipe_arena_t *arena = piece && piece->pipe ? piece->pipe->arena : NULL;
+  if(arena)
+  {
+    const size_t need = DT_ARENA_HEADER + ((size + 63) & ~(size_t)63);
+    dt_pthread_mutex_lock(&arena->lock);
+    if(arena->base && arena->used + need <= arena->size)
+    {
+      _arena_block_t *block = (_arena_block_t *)(arena->base + arena->used);
+      block->prev = arena->top;
+      block->freed = 0;
+      arena->top = arena->used + 1;
+      arena->used += need;
+      arena->peak = MAX(arena->peak, arena->used);
+      dt_pthread_mutex_unlock(&arena->lock);
+      return (char *)block + DT_ARENA_HEADER;
+    }
+    dt_pthread_mutex_unlock(&arena->lock);
+  }
+  return dt_alloc_align(64, size);
+}
+
+void dt_dev_pixelpipe_scratch_free(dt_dev_pixelpipe_iop_t *piece, void *mem)
+{
+  if(!mem) return;
+  dt_dev_pixelpipe_arena_t *arena = piece && piece->pipe ? piece->pipe->arena : NULL;
+  if(arena && (char *)mem >= arena->base && (char *)mem < arena->base + arena->size)
+  {
+    dt_pthread_mutex_lock(&arena->lock);
+    _arena_block_t *block = (_arena_block_t *)((char *)mem - DT_ARENA_HEADER);
+    block->freed = 1;
+    // memory is given back in stack order: pop all freed allocations from the top
+    while(arena->top)
+    {
+      _arena_block_t *top = (_arena_block_t *)(arena->base + arena->top - 1);
+      if(!top->freed) break;
+      arena->used = arena->top - 1;
+      arena->top = top->prev;
+    }
+    dt_pthread_mutex_unlock(&arena->lock);
+    return;
+  }
+  dt_free_align(mem);
+}
+
+#undef DT_ARENA_HEADER
+#undef DT_ARENA_GRANULARITY
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,62 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+
+#include <stddef.h>
+
+/**
+ * scratch memory of a pixelpipe: one block that is kept across runs, so the
+ * temporary planes modules need inside process() don't go through malloc/mmap
+ * on every call. allocations are bumped off the block and given back in
+ * stack order, everything is released when the module is done.
+ */
+
+typedef struct dt_dev_pixelpipe_arena_t
+{
+  dt_pthread_mutex_t lock;
+  char *base;
+  size_t size;
+  size_t used;
+  size_t top;    // offset of the latest allocation + 1, 0 if none
+  size_t peak;
+  size_t limit;  // the block never grows beyond this
+  int hugepages; // base is mmap()ed, with huge pages if the kernel gives them
+} dt_dev_pixelpipe_arena_t;
+
+/** creates an empty arena that grows up to limit bytes. */
+dt_dev_pixelpipe_arena_t *dt_dev_pixelpipe_arena_new(const size_t limit);
+void dt_dev_pixelpipe_arena_destroy(dt_dev_pixelpipe_arena_t *arena);
+/** makes room for size bytes of scratch, clamped to the limit. only grows while empty. */
+void dt_dev_pixelpipe_arena_reserve(dt_dev_pixelpipe_arena_t *arena, const size_t size);
+/** gives back all allocations at once. */
+void dt_dev_pixelpipe_arena_reset(dt_dev_pixelpipe_arena_t *arena);
+
+struct dt_dev_pixelpipe_iop_t;
+
+/** 64 byte aligned scratch memory for the duration of the module's process() call. falls
+    back to dt_alloc_align() when the arena is full, so it can be used like it. */
+void *dt_dev_pixelpipe_scratch_alloc(struct dt_dev_pixelpipe_iop_t *piece, const size_t size);
+/** frees memory from dt_dev_pixelpipe_scratch_alloc(), mem can be NULL. */
+void dt_dev_pixelpipe_scratch_free(struct dt_dev_pixelpipe_iop_t *piece, void *mem);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
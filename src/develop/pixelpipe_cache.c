@@ -17,10 +17,25 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/file_location.h"
+#include "common/memory_governor.h"
+#include "common/metrics.h"
+#include "common/opencl.h"
+#include "control/conf.h"
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
+#include <glib/gstdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
 
 
 // TODO: make cache global (needs to be thread safe then)
@@ -32,7 +47,164 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
+static inline uint32_t _index_bucket(const dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  // the djb2 hashes have poor low bits, mix them first:
+  uint64_t h = hash ^ (hash >> 33);
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return (uint32_t)h & (cache->index_size - 1);
+}
+
+// returns the cache line holding the hash or -1
+static int _index_lookup(const dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  if(hash == (uint64_t)-1) return -1;
+  for(uint32_t b = _index_bucket(cache, hash);; b = (b + 1) & (cache->index_size - 1))
+  {
+    const int32_t k = cache->index[b] - 1;
+    if(k < 0) return -1;
+    if(cache->hash[k] == hash) return k;
+  }
+}
+
+static void _index_insert(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const int k)
+{
+  uint32_t b = _index_bucket(cache, hash);
+  while(cache->index[b]) b = (b + 1) & (cache->index_size - 1);
+  cache->index[b] = k + 1;
+}
+
+// removes the bucket pointing to cache line k, which has to hold hash
+static void _index_remove(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const int k)
+{
+  if(hash == (uint64_t)-1) return;
+  const uint32_t mask = cache->index_size - 1;
+  uint32_t b = _index_bucket(cache, hash);
+  while(cache->index[b] && cache->index[b] != k + 1) b = (b + 1) & mask;
+  if(!cache->index[b]) return;
+  // backward shift deletion, keeps probe sequences intact without tombstones:
+  cache->index[b] = 0;
+  for(uint32_t j = (b + 1) & mask; cache->index[j]; j = (j + 1) & mask)
+  {
+    const uint32_t home = _index_bucket(cache, cache->hash[cache->index[j] - 1]);
+    // move j back to the hole if its home bucket isn't cyclically within (b, j]
+    if(((j - home) & mask) >= ((j - b) & mask))
+    {
+      cache->index[b] = cache->index[j];
+      cache->index[j] = 0;
+      b = j;
+    }
+  }
+}
+
+#ifdef HAVE_OPENCL
+static void _gpu_release(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(cache->gpu_mem[k])
+  {
+    dt_opencl_release_mem_object(cache->gpu_mem[k]);
+    cache->gpu_memory -= cache->gpu_size[k];
+  }
+  cache->gpu_mem[k] = NULL;
+  cache->gpu_size[k] = 0;
+  cache->host_stale[k] = 0;
+}
+
+// drops the device copy of line k, taking the line with it if that was the only valid copy
+static void _gpu_drop(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(cache->host_stale[k])
+  {
+    _index_remove(cache, cache->hash[k], k);
+    cache->hash[k] = -1;
+  }
+  _gpu_release(cache, k);
+}
+#endif
+
+#ifndef _WIN32
+// an unlinked file of size bytes in dir, mapped shared so dirty pages are written back rather than swapped
+static void *_spill_map(const char *dir, const size_t size)
+{
+  gchar *filename = g_build_filename(dir, "darktable-spill-XXXXXX", NULL);
+  void *mem = NULL;
+  const int fd = g_mkstemp(filename);
+  if(fd >= 0)
+  {
+    g_unlink(filename);
+#ifdef __linux__
+    // reserve the blocks now, a full disk would otherwise only show as SIGBUS while writing the buffer
+    const int reserved = !posix_fallocate(fd, 0, size);
+#else
+    const int reserved = !ftruncate(fd, size);
+#endif
+    if(reserved)
+    {
+      mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(mem == MAP_FAILED) mem = NULL;
+    }
+    close(fd);
+  }
+  if(!mem)
+    dt_print(DT_DEBUG_MEMORY, "[pixelpipe_cache] can't spill %zu bytes to `%s', using host memory\n", size, dir);
+  g_free(filename);
+  return mem;
+}
+#endif
+
+// gives line k a buffer of size bytes, in a file if the cache spills buffers that large
+static void _line_alloc(dt_dev_pixelpipe_cache_t *cache, const int k, const size_t size)
+{
+  cache->data[k] = NULL;
+  cache->spilled[k] = 0;
+#ifndef _WIN32
+  if(cache->spill_dir && size >= cache->spill_min)
+  {
+    cache->data[k] = _spill_map(cache->spill_dir, size);
+    cache->spilled[k] = cache->data[k] != NULL;
+  }
+#endif
+  if(!cache->data[k]) cache->data[k] = (void *)dt_alloc_align(64, size);
+  cache->size[k] = cache->data[k] ? size : 0;
+  if(cache->spilled[k])
+    cache->spilled_memory += cache->size[k];
+  else
+    cache->memory += cache->size[k];
+  cache->memory_peak = MAX(cache->memory_peak, cache->memory);
+}
+
+static void _line_release(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+#ifndef _WIN32
+  if(cache->spilled[k])
+  {
+    munmap(cache->data[k], cache->size[k]);
+    cache->spilled_memory -= cache->size[k];
+  }
+  else
+#endif
+  {
+    dt_free_align(cache->data[k]);
+    cache->memory -= cache->size[k];
+  }
+  cache->data[k] = NULL;
+  cache->size[k] = 0;
+  cache->spilled[k] = 0;
+}
+
+static void _line_free(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+#ifdef HAVE_OPENCL
+  _gpu_release(cache, k);
+#endif
+  _index_remove(cache, cache->hash[k], k);
+  _line_release(cache, k);
+  cache->hash[k] = -1;
+  cache->used[k] = 0;
+}
+
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memory_limit)
 {
   cache->entries = entries;
   cache->data = (void **)calloc(entries, sizeof(void *));
@@ -42,24 +214,46 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
   memset(cache->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t) * entries);
 #endif
   cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
-  cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->used = (int64_t *)calloc(entries, sizeof(int64_t));
+  cache->spilled = (uint8_t *)calloc(entries, sizeof(uint8_t));
+  cache->spill_dir = NULL;
+  cache->spill_min = 0;
+  cache->spilled_memory = 0;
+  // keep the index at most half full:
+  cache->index_size = 8;
+  while(cache->index_size < 2 * entries) cache->index_size <<= 1;
+  cache->index = (int32_t *)calloc(cache->index_size, sizeof(int32_t));
+  cache->memory = 0;
+  cache->memory_peak = 0;
+  cache->memory_limit = memory_limit;
+  cache->pinned = 0;
+#ifdef HAVE_OPENCL
+  cache->gpu_mem = (void **)calloc(entries, sizeof(void *));
+  cache->gpu_size = (size_t *)calloc(entries, sizeof(size_t));
+  cache->host_stale = (int *)calloc(entries, sizeof(int));
+  cache->gpu_devid = -1;
+  cache->gpu_memory = 0;
+  cache->gpu_memory_limit = 0;
+#endif
+  cache->queries = cache->misses = 0;
   for(int k = 0; k < entries; k++)
   {
-    cache->size[k] = size;
-    if(size)
-    { // allow 0 initial buffer size (yet unknown dimensions)
-      cache->data[k] = (void *)dt_alloc_align(64, size);
-      if(!cache->data[k]) goto alloc_memory_fail;
-#ifdef _DEBUG
-      memset(cache->data[k], 0x5d, size);
-#endif
-      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
-    }
-    else cache->data[k] = 0;
     cache->hash[k] = -1;
     cache->used[k] = 0;
+    cache->data[k] = 0;
+  }
+  // allow 0 initial buffer size (yet unknown dimensions). otherwise preallocate
+  // as many lines as the budget allows, there is no point in allocating more.
+  for(int k = 0; k < entries && size; k++)
+  {
+    if(memory_limit && cache->memory + size > memory_limit && k >= 2) break;
+    _line_alloc(cache, k, size);
+    if(!cache->data[k]) goto alloc_memory_fail;
+#ifdef _DEBUG
+    memset(cache->data[k], 0x5d, size);
+#endif
+    ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
-  cache->queries = cache->misses = 0;
   return 1;
 
 alloc_memory_fail:
@@ -68,23 +262,28 @@ alloc_memory_fail:
   // should not cleanup the whole pixelpipe cache but only reset the buffers to null.
   // A warning about low memory will appear but the pipeline still has valid data so dt won't crash
   // but will only fail to generate thumbnails for example.
-  for(int k = 0; k < cache->entries; k++)
-  {
-    dt_free_align(cache->data[k]);
-    cache->size[k] = 0;
-    cache->data[k] = NULL;
-  }
+  for(int k = 0; k < cache->entries; k++) _line_release(cache, k);
+  cache->memory = 0;
   return 0;
 }
 
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
-  for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
+#ifdef HAVE_OPENCL
+  for(int k = 0; k < cache->entries; k++) _gpu_release(cache, k);
+  free(cache->gpu_mem);
+  free(cache->gpu_size);
+  free(cache->host_stale);
+#endif
+  for(int k = 0; k < cache->entries; k++) _line_release(cache, k);
+  free(cache->spilled);
+  g_free(cache->spill_dir);
   free(cache->data);
   free(cache->dsc);
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->index);
 }
 
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
@@ -116,18 +315,33 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_
     }
     pieces = g_list_next(pieces);
   }
+  // float and uint16 raw stages don't share cache lines
+  if(pipe->raw_uint16) hash = ((hash << 5) + hash) ^ TYPE_UINT16;
   // also add scale, x and y:
   const char *str = (const char *)roi;
   for(size_t i = 0; i < sizeof(dt_iop_roi_t); i++) hash = ((hash << 5) + hash) ^ str[i];
   return hash;
 }
 
+static inline int _line_pinned(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  return cache->pinned && cache->hash[k] == cache->pinned;
+}
+
+// a line whose device copy has been checked out and not given back holds no valid data
+static inline int _line_valid(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+#ifdef HAVE_OPENCL
+  return !cache->host_stale[k] || cache->gpu_mem[k];
+#else
+  return 1;
+#endif
+}
+
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
-  // search for hash in cache
-  for(int32_t k = 0; k < cache->entries; k++)
-    if(cache->hash[k] == hash) return 1;
-  return 0;
+  const int k = _index_lookup(cache, hash);
+  return k >= 0 && _line_valid(cache, k);
 }
 
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
@@ -146,68 +360,144 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
                                         void **data, dt_iop_buffer_dsc_t **dsc, int weight)
 {
   cache->queries++;
-  *data = NULL;
-  int max_used = -1, max = 0;
-  size_t sz = 0;
-  for(int k = 0; k < cache->entries; k++)
+  dt_metrics_count(DT_METRICS_PIXELPIPE_CACHE_QUERIES, 1);
+  const int64_t now = cache->queries;
+  int k = _index_lookup(cache, hash);
+  if(k >= 0 && cache->size[k] >= size && _line_valid(cache, k))
   {
-    // search for hash in cache
-    if(cache->used[k] > max_used)
-    {
-      max_used = cache->used[k];
-      max = k;
-    }
-    cache->used[k]++; // age all entries
-    if(cache->hash[k] == hash)
-    {
-      *data = cache->data[k];
-      *dsc = &cache->dsc[k];
-      sz = cache->size[k];
-      cache->used[k] = weight; // this is the MRU entry
+    *data = cache->data[k];
+    *dsc = &cache->dsc[k];
+    cache->used[k] = now - weight; // this is the MRU entry
 
-      ASAN_POISON_MEMORY_REGION(*data, sz);
-      ASAN_UNPOISON_MEMORY_REGION(*data, size);
-    }
+    ASAN_POISON_MEMORY_REGION(*data, cache->size[k]);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+    return 0;
   }
 
-  if(!*data || sz < size)
+  // a line with this hash but too small a buffer is reused in place, else kill the LRU entry:
+  if(k < 0)
   {
-    // kill LRU entry
-    // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
-    // weight);
-    if(cache->size[max] < size)
-    {
-      dt_free_align(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(64, size);
-      cache->size[max] = size;
-    }
-    *data = cache->data[max];
-    sz = cache->size[max];
+    for(int j = 0; j < cache->entries; j++)
+      if(!_line_pinned(cache, j) && (k < 0 || cache->used[j] < cache->used[k])) k = j;
+    if(k < 0) k = 0;
+  }
+  // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", k, cache->entries,
+  // weight);
+  _index_remove(cache, cache->hash[k], k);
+#ifdef HAVE_OPENCL
+  _gpu_release(cache, k);
+#endif
+  if(cache->size[k] < size)
+  {
+    _line_release(cache, k);
+    _line_alloc(cache, k, size);
+  }
+  *data = cache->data[k];
 
-    ASAN_POISON_MEMORY_REGION(*data, sz);
-    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+  ASAN_POISON_MEMORY_REGION(*data, cache->size[k]);
+  ASAN_UNPOISON_MEMORY_REGION(*data, size);
 
-    // first, update our copy, then update the pointer to point at our copy
-    cache->dsc[max] = **dsc;
-    *dsc = &cache->dsc[max];
+  // first, update our copy, then update the pointer to point at our copy
+  cache->dsc[k] = **dsc;
+  *dsc = &cache->dsc[k];
 
-    cache->hash[max] = hash;
-    cache->used[max] = weight;
-    cache->misses++;
-    return 1;
+  cache->hash[k] = hash;
+  cache->used[k] = now - weight;
+  _index_insert(cache, hash, k);
+  cache->misses++;
+  dt_metrics_count(DT_METRICS_PIXELPIPE_CACHE_MISSES, 1);
+
+  // stay within budget. lines touched by this or the previous query are still
+  // in use as output and input of the module being processed, never drop those.
+  while(cache->memory_limit && cache->memory > cache->memory_limit)
+  {
+    int lru = -1;
+    for(int j = 0; j < cache->entries; j++)
+      if(j != k && cache->data[j] && now - cache->used[j] >= 2 && !_line_pinned(cache, j)
+         && (lru < 0 || cache->used[j] < cache->used[lru]))
+        lru = j;
+    if(lru < 0) break;
+    _line_free(cache, lru);
   }
-  else
-    return 0;
+  return 1;
+}
+
+size_t dt_dev_pixelpipe_cache_shrink(dt_dev_pixelpipe_cache_t *cache, const size_t bytes, const void *keep)
+{
+  size_t freed = 0;
+  while(freed < bytes)
+  {
+    int lru = -1;
+    for(int j = 0; j < cache->entries; j++)
+      if(cache->data[j] && cache->data[j] != keep && !_line_pinned(cache, j) && !cache->spilled[j]
+         && (lru < 0 || cache->used[j] < cache->used[lru]))
+        lru = j;
+    if(lru < 0) break;
+    freed += cache->size[lru];
+    _line_free(cache, lru);
+  }
+  return freed;
+}
+
+void dt_dev_pixelpipe_cache_spill(dt_dev_pixelpipe_cache_t *cache, const char *dir, const size_t min)
+{
+#ifndef _WIN32
+  g_free(cache->spill_dir);
+  cache->spill_dir = dir && *dir ? g_strdup(dir) : NULL;
+  cache->spill_min = min;
+  if(!cache->spill_dir) return;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(!cache->data[k] || cache->spilled[k] || cache->size[k] < min) continue;
+    const size_t size = cache->size[k];
+#ifdef HAVE_OPENCL
+    _gpu_release(cache, k);
+#endif
+    _index_remove(cache, cache->hash[k], k);
+    cache->hash[k] = -1;
+    _line_release(cache, k);
+    _line_alloc(cache, k, size);
+  }
+  dt_print(DT_DEBUG_MEMORY, "[pixelpipe_cache] spilling buffers of %.1f MB and more to `%s'\n",
+           min / (1024.0 * 1024.0), cache->spill_dir);
+#endif
+}
+
+int dt_dev_pixelpipe_cache_spilled(const dt_dev_pixelpipe_cache_t *cache, const void *data)
+{
+  if(!data || !cache->spill_dir) return 0;
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) return cache->spilled[k];
+  return 0;
 }
 
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
   {
+#ifdef HAVE_OPENCL
+    _gpu_release(cache, k);
+#endif
     cache->hash[k] = -1;
     cache->used[k] = 0;
     ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
+  memset(cache->index, 0, sizeof(int32_t) * cache->index_size);
+}
+
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  cache->pinned = hash;
+}
+
+void dt_dev_pixelpipe_cache_pin_data(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data && cache->hash[k] != (uint64_t)-1)
+    {
+      cache->pinned = cache->hash[k];
+      return;
+    }
 }
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
@@ -216,7 +506,7 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
   {
     if(cache->data[k] == data)
     {
-      cache->used[k] = -cache->entries;
+      cache->used[k] = cache->queries + cache->entries;
     }
   }
 }
@@ -227,21 +517,562 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
   {
     if(cache->data[k] == data)
     {
+#ifdef HAVE_OPENCL
+      _gpu_release(cache, k);
+#endif
+      _index_remove(cache, cache->hash[k], k);
       cache->hash[k] = -1;
       ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
     }
   }
 }
 
+int dt_dev_pixelpipe_cache_exchange(dt_dev_pixelpipe_cache_t *cache, void *data, void **buf, size_t *size)
+{
+  if(!data) return 0;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->data[k] != data) continue;
+    // the caller would dt_free_align() a mapping
+    if(cache->spilled[k]) return 0;
+#ifdef HAVE_OPENCL
+    _gpu_release(cache, k);
+#endif
+    _index_remove(cache, cache->hash[k], k);
+    cache->hash[k] = -1;
+    ASAN_UNPOISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+
+    const size_t taken = cache->size[k];
+    cache->memory -= taken;
+    cache->data[k] = *buf;
+    cache->size[k] = *buf ? *size : 0;
+    cache->memory += cache->size[k];
+    cache->memory_peak = MAX(cache->memory_peak, cache->memory);
+    if(cache->data[k]) ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+
+    *buf = data;
+    *size = taken;
+    return 1;
+  }
+  return 0;
+}
+
+#ifdef HAVE_OPENCL
+void dt_dev_pixelpipe_cache_gpu_reset(dt_dev_pixelpipe_cache_t *cache, const int devid, const size_t memory_limit)
+{
+  // device buffers can't be used from another device, and we don't hold the lock of the
+  // old one to copy them back. lines only valid there are lost.
+  if(devid != cache->gpu_devid || !memory_limit)
+    for(int k = 0; k < cache->entries; k++) _gpu_drop(cache, k);
+  cache->gpu_devid = devid;
+  cache->gpu_memory_limit = devid >= 0 ? memory_limit : 0;
+}
+
+int dt_dev_pixelpipe_cache_keep_gpu(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem, const size_t size,
+                                    const int host_valid)
+{
+  if(!mem || size > cache->gpu_memory_limit) return 0;
+  int k = -1;
+  for(int j = 0; j < cache->entries; j++)
+    if(cache->data[j] == data && cache->hash[j] != (uint64_t)-1) k = j;
+  if(k < 0) return 0;
+
+  _gpu_release(cache, k);
+  cache->gpu_mem[k] = mem;
+  cache->gpu_size[k] = size;
+  cache->host_stale[k] = !host_valid;
+  cache->gpu_memory += size;
+
+  // stay within the device budget, least recently used first
+  while(cache->gpu_memory > cache->gpu_memory_limit)
+  {
+    int lru = -1;
+    for(int j = 0; j < cache->entries; j++)
+      if(j != k && cache->gpu_mem[j] && (lru < 0 || cache->used[j] < cache->used[lru])) lru = j;
+    if(lru < 0) break;
+    _gpu_drop(cache, lru);
+  }
+  return 1;
+}
+
+void *dt_dev_pixelpipe_cache_checkout_gpu(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->data[k] == data && cache->gpu_mem[k])
+    {
+      // host_stale stays set, such a line is invalid until the consumer gives the buffer back
+      void *mem = cache->gpu_mem[k];
+      cache->gpu_memory -= cache->gpu_size[k];
+      cache->gpu_mem[k] = NULL;
+      cache->gpu_size[k] = 0;
+      return mem;
+    }
+  }
+  return NULL;
+}
+#endif
+
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
   {
     printf("pixelpipe cacheline %d ", k);
-    printf("used %d by %" PRIu64 "", cache->used[k], cache->hash[k]);
+    printf("used %" PRId64 " by %" PRIu64 " size %zu", cache->used[k], cache->hash[k], cache->size[k]);
+#ifdef HAVE_OPENCL
+    if(cache->gpu_mem[k]) printf(" on device %d%s", cache->gpu_devid, cache->host_stale[k] ? " only" : "");
+#endif
+    if(_line_pinned(cache, k)) printf(" pinned");
+    if(cache->spilled[k]) printf(" spilled");
     printf("\n");
   }
-  printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
+  printf("cache hit rate so far: %.3f, %.2f/%.2f MB allocated, %.2f MB spilled\n",
+         (cache->queries - cache->misses) / (float)cache->queries,
+         cache->memory / (1024.0 * 1024.0), cache->memory_limit / (1024.0 * 1024.0),
+         cache->spilled_memory / (1024.0 * 1024.0));
+}
+
+// cache copies of float buffers can be held as ieee half floats (pixelpipe_cache_half_float).
+// 11 significant bits are plenty for what is displayed, and the copies take half the memory
+// and bandwidth. the pipe itself always works on the float buffers.
+static inline uint16_t _float_to_half(const float f)
+{
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000u;
+  const uint32_t absx = x & 0x7fffffffu;
+  if(absx >= 0x7f800000u) return sign | 0x7c00u | (absx > 0x7f800000u ? 0x200u : 0u); // inf, nan
+  if(absx >= 0x477ff000u) return sign | 0x7c00u;                                      // rounds beyond 65504
+  if(absx < 0x38800000u)
+  {
+    // subnormal half in units of 2^-24, round to nearest even
+    if(absx < 0x33000000u) return sign;
+    const uint32_t shift = 126 - (absx >> 23);
+    const uint32_t m = (absx & 0x7fffffu) | 0x800000u;
+    const uint32_t rem = m & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    uint32_t h = m >> shift;
+    if(rem > halfway || (rem == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+  // rebias the exponent and round the mantissa to 10 bits, a carry correctly bumps the exponent
+  uint32_t h = (absx - 0x38000000u) >> 13;
+  const uint32_t rem = absx & 0x1fffu;
+  if(rem > 0x1000u || (rem == 0x1000u && (h & 1))) h++;
+  return sign | h;
+}
+
+static inline float _half_to_float(const uint16_t h)
+{
+  const uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+  const uint32_t e = (h >> 10) & 0x1fu;
+  const uint32_t m = h & 0x3ffu;
+  if(!e)
+  {
+    const float f = (float)m * (1.0f / 16777216.0f);
+    return sign ? -f : f;
+  }
+  const uint32_t x = sign | (e == 0x1f ? 0x7f800000u | (m << 13) : ((e + 112) << 23) | (m << 13));
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+#define DT_HALF_BLOCK 4096
+
+static void _float_to_half_buf(uint16_t *const out, const float *const in, const size_t n)
+{
+  const size_t nblocks = (n + DT_HALF_BLOCK - 1) / DT_HALF_BLOCK;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, n, nblocks) \
+  schedule(static)
+#endif
+  for(size_t b = 0; b < nblocks; b++)
+  {
+    const size_t end = MIN(n, (b + 1) * DT_HALF_BLOCK);
+    size_t k = b * DT_HALF_BLOCK;
+#if defined(__F16C__)
+    for(; k + 8 <= end; k += 8)
+      _mm_storeu_si128((__m128i *)(out + k), _mm256_cvtps_ph(_mm256_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for(; k < end; k++) out[k] = _float_to_half(in[k]);
+  }
+}
+
+static void _half_to_float_buf(float *const out, const uint16_t *const in, const size_t n)
+{
+  const size_t nblocks = (n + DT_HALF_BLOCK - 1) / DT_HALF_BLOCK;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, n, nblocks) \
+  schedule(static)
+#endif
+  for(size_t b = 0; b < nblocks; b++)
+  {
+    const size_t end = MIN(n, (b + 1) * DT_HALF_BLOCK);
+    size_t k = b * DT_HALF_BLOCK;
+#if defined(__F16C__)
+    for(; k + 8 <= end; k += 8)
+      _mm256_storeu_ps(out + k, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + k))));
+#endif
+    for(; k < end; k++) out[k] = _half_to_float(in[k]);
+  }
+}
+
+#undef DT_HALF_BLOCK
+
+// whether a copy of this buffer may be stored as half floats
+static inline gboolean _store_half(const gboolean enabled, const size_t size, const dt_iop_buffer_dsc_t *dsc)
+{
+  return enabled && dsc->datatype == TYPE_FLOAT && size % sizeof(float) == 0;
+}
+
+typedef struct dt_dev_pixelpipe_shared_line_t
+{
+  uint64_t key;
+  void *data;
+  size_t size;   // of the float buffer handed in and out
+  size_t stored; // bytes held in data, half of that for half float lines
+  gboolean half;
+  dt_iop_buffer_dsc_t dsc;
+  int refcount;
+  uint64_t used;
+} dt_dev_pixelpipe_shared_line_t;
+
+static void _shared_line_free(gpointer data)
+{
+  dt_dev_pixelpipe_shared_line_t *line = (dt_dev_pixelpipe_shared_line_t *)data;
+  dt_free_align(line->data);
+  free(line);
+}
+
+static size_t _shared_cache_usage(void *data)
+{
+  return ((const dt_dev_pixelpipe_shared_cache_t *)data)->memory;
+}
+
+static size_t _shared_cache_evict(void *data, size_t bytes)
+{
+  return dt_dev_pixelpipe_shared_cache_shrink((dt_dev_pixelpipe_shared_cache_t *)data, bytes);
+}
+
+void dt_dev_pixelpipe_shared_cache_init(dt_dev_pixelpipe_shared_cache_t *cache, size_t memory_limit)
+{
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->lines = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, _shared_line_free);
+  cache->memory = 0;
+  cache->memory_limit = memory_limit;
+  cache->clock = 0;
+  cache->queries = cache->misses = 0;
+  cache->half_float = dt_conf_get_bool("pixelpipe_cache_half_float");
+  cache->memory_client = dt_memory_governor_register("shared pixelpipe cache", DT_MEMORY_PRIORITY_SHARED_CACHE,
+                                                     _shared_cache_usage, _shared_cache_evict, cache);
+}
+
+void dt_dev_pixelpipe_shared_cache_cleanup(dt_dev_pixelpipe_shared_cache_t *cache)
+{
+  dt_memory_governor_unregister(cache->memory_client);
+  cache->memory_client = NULL;
+  g_hash_table_destroy(cache->lines);
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+int dt_dev_pixelpipe_shared_cache_available(dt_dev_pixelpipe_shared_cache_t *cache, const uint64_t key)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  const int res = g_hash_table_contains(cache->lines, &key);
+  dt_pthread_mutex_unlock(&cache->lock);
+  return res;
+}
+
+int dt_dev_pixelpipe_shared_cache_fetch(dt_dev_pixelpipe_shared_cache_t *cache, const uint64_t key,
+                                        void *data, const size_t size, dt_iop_buffer_dsc_t *dsc)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  cache->queries++;
+  dt_dev_pixelpipe_shared_line_t *line
+      = (dt_dev_pixelpipe_shared_line_t *)g_hash_table_lookup(cache->lines, &key);
+  if(!line || line->size < size)
+  {
+    cache->misses++;
+    dt_pthread_mutex_unlock(&cache->lock);
+    return 1;
+  }
+  // hold a reference so nobody evicts the line while we copy without the lock
+  line->refcount++;
+  line->used = ++cache->clock;
+  *dsc = line->dsc;
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  if(line->half)
+    _half_to_float_buf((float *)data, (const uint16_t *)line->data, size / sizeof(float));
+  else
+    memcpy(data, line->data, size);
+
+  dt_pthread_mutex_lock(&cache->lock);
+  line->refcount--;
+  dt_pthread_mutex_unlock(&cache->lock);
+  return 0;
+}
+
+// drop unreferenced lines, oldest first, until size more bytes fit. expects the lock to be held.
+static void _shared_cache_make_room(dt_dev_pixelpipe_shared_cache_t *cache, const size_t size)
+{
+  while(cache->memory + size > cache->memory_limit)
+  {
+    dt_dev_pixelpipe_shared_line_t *lru = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->lines);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+      dt_dev_pixelpipe_shared_line_t *line = (dt_dev_pixelpipe_shared_line_t *)value;
+      if(!line->refcount && (!lru || line->used < lru->used)) lru = line;
+    }
+    if(!lru) return;
+    cache->memory -= lru->stored;
+    g_hash_table_remove(cache->lines, &lru->key);
+  }
+}
+
+size_t dt_dev_pixelpipe_shared_cache_shrink(dt_dev_pixelpipe_shared_cache_t *cache, const size_t bytes)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  const size_t before = cache->memory;
+  const size_t target = cache->memory > bytes ? cache->memory - bytes : 0;
+  if(target < cache->memory_limit) _shared_cache_make_room(cache, cache->memory_limit - target);
+  const size_t freed = before - cache->memory;
+  dt_pthread_mutex_unlock(&cache->lock);
+  return freed;
+}
+
+void dt_dev_pixelpipe_shared_cache_store(dt_dev_pixelpipe_shared_cache_t *cache, const uint64_t key,
+                                         const void *data, const size_t size, const dt_iop_buffer_dsc_t *dsc)
+{
+  const gboolean half = _store_half(cache->half_float, size, dsc);
+  const size_t stored = half ? size / 2 : size;
+  if(stored > cache->memory_limit) return;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_dev_pixelpipe_shared_line_t *line
+      = (dt_dev_pixelpipe_shared_line_t *)g_hash_table_lookup(cache->lines, &key);
+  if(line && line->size >= size)
+  {
+    // another pipe was faster
+    line->used = ++cache->clock;
+    dt_pthread_mutex_unlock(&cache->lock);
+    return;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+
+  // copy outside the lock, the pipes shouldn't wait for each other's memcpy
+  dt_dev_pixelpipe_shared_line_t *new_line
+      = (dt_dev_pixelpipe_shared_line_t *)malloc(sizeof(dt_dev_pixelpipe_shared_line_t));
+  if(!new_line) return;
+  new_line->data = dt_alloc_align(64, stored);
+  if(!new_line->data)
+  {
+    free(new_line);
+    return;
+  }
+  if(half)
+    _float_to_half_buf((uint16_t *)new_line->data, (const float *)data, size / sizeof(float));
+  else
+    memcpy(new_line->data, data, size);
+  new_line->key = key;
+  new_line->size = size;
+  new_line->stored = stored;
+  new_line->half = half;
+  new_line->dsc = *dsc;
+  new_line->refcount = 0;
+
+  dt_pthread_mutex_lock(&cache->lock);
+  line = (dt_dev_pixelpipe_shared_line_t *)g_hash_table_lookup(cache->lines, &key);
+  if(line && (line->refcount || line->size >= size))
+  {
+    dt_pthread_mutex_unlock(&cache->lock);
+    _shared_line_free(new_line);
+    return;
+  }
+  if(line)
+  {
+    cache->memory -= line->stored;
+    g_hash_table_remove(cache->lines, &key);
+  }
+  _shared_cache_make_room(cache, stored);
+  new_line->used = ++cache->clock;
+  cache->memory += stored;
+  g_hash_table_insert(cache->lines, &new_line->key, new_line);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+#define DT_PIXELPIPE_DISK_CACHE_MAGIC 0x63706474u // "dtpc"
+#define DT_PIXELPIPE_DISK_CACHE_VERSION 2
+
+typedef struct dt_dev_pixelpipe_disk_header_t
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t size;   // of the float buffer
+  uint64_t stored; // bytes following the header, half of size for half float files
+  uint32_t half;
+  dt_iop_buffer_dsc_t dsc; // work_profile_info is meaningless on disk and restored by the loader
+} dt_dev_pixelpipe_disk_header_t;
+
+static void _disk_cache_dir(char *dir, size_t bufsize)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(dir, bufsize, "%s/pixelpipe", cachedir);
+}
+
+static void _disk_cache_filename(const uint64_t key, char *filename, size_t bufsize)
+{
+  char dir[PATH_MAX] = { 0 };
+  _disk_cache_dir(dir, sizeof(dir));
+  snprintf(filename, bufsize, "%s/%016" PRIx64 ".dtpc", dir, key);
+}
+
+int dt_dev_pixelpipe_disk_cache_load(const uint64_t key, void *data, const size_t size, dt_iop_buffer_dsc_t *dsc)
+{
+  char filename[PATH_MAX] = { 0 };
+  _disk_cache_filename(key, filename, sizeof(filename));
+  if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR)) return 1;
+
+  GMappedFile *mf = g_mapped_file_new(filename, FALSE, NULL);
+  if(!mf) return 1;
+
+  int res = 1;
+  const char *contents = g_mapped_file_get_contents(mf);
+  const size_t length = g_mapped_file_get_length(mf);
+  const dt_dev_pixelpipe_disk_header_t *header = (const dt_dev_pixelpipe_disk_header_t *)contents;
+  if(contents && length >= sizeof(*header) && header->magic == DT_PIXELPIPE_DISK_CACHE_MAGIC
+     && header->version == DT_PIXELPIPE_DISK_CACHE_VERSION && header->key == key && header->size == size
+     && header->stored == (header->half ? size / 2 : size) && length >= sizeof(*header) + header->stored)
+  {
+    if(header->half)
+      _half_to_float_buf((float *)data, (const uint16_t *)(contents + sizeof(*header)), size / sizeof(float));
+    else
+      memcpy(data, contents + sizeof(*header), size);
+    struct dt_iop_order_iccprofile_info_t *work_profile_info = dsc->work_profile_info;
+    *dsc = header->dsc;
+    dsc->work_profile_info = work_profile_info;
+    res = 0;
+  }
+  g_mapped_file_unref(mf);
+
+  // touch it, pruning goes by modification time
+  if(!res) g_utime(filename, NULL);
+  return res;
+}
+
+typedef struct _disk_cache_file_t
+{
+  gchar *path;
+  time_t mtime;
+  goffset size;
+} _disk_cache_file_t;
+
+static gint _disk_cache_file_cmp(gconstpointer a, gconstpointer b)
+{
+  const _disk_cache_file_t *fa = (const _disk_cache_file_t *)a;
+  const _disk_cache_file_t *fb = (const _disk_cache_file_t *)b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+static void _disk_cache_file_free(gpointer data)
+{
+  _disk_cache_file_t *f = (_disk_cache_file_t *)data;
+  g_free(f->path);
+  free(f);
+}
+
+// remove the least recently used files until the directory fits the configured size
+static void _disk_cache_prune(const char *dir)
+{
+  const goffset limit = (goffset)MAX(dt_conf_get_int("export_disk_cache_size"), 0) << 20;
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return;
+
+  GList *files = NULL;
+  goffset total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    if(!g_str_has_suffix(name, ".dtpc")) continue;
+    GStatBuf st;
+    gchar *path = g_build_filename(dir, name, NULL);
+    if(g_stat(path, &st))
+    {
+      g_free(path);
+      continue;
+    }
+    _disk_cache_file_t *f = (_disk_cache_file_t *)malloc(sizeof(_disk_cache_file_t));
+    f->path = path;
+    f->mtime = st.st_mtime;
+    f->size = st.st_size;
+    total += f->size;
+    files = g_list_prepend(files, f);
+  }
+  g_dir_close(d);
+
+  files = g_list_sort(files, _disk_cache_file_cmp);
+  for(GList *l = files; l && total > limit; l = g_list_next(l))
+  {
+    _disk_cache_file_t *f = (_disk_cache_file_t *)l->data;
+    if(!g_unlink(f->path)) total -= f->size;
+  }
+  g_list_free_full(files, _disk_cache_file_free);
+}
+
+void dt_dev_pixelpipe_disk_cache_store(const uint64_t key, const void *data, const size_t size,
+                                       const dt_iop_buffer_dsc_t *dsc)
+{
+  char dir[PATH_MAX] = { 0 };
+  char filename[PATH_MAX] = { 0 };
+  _disk_cache_dir(dir, sizeof(dir));
+  _disk_cache_filename(key, filename, sizeof(filename));
+  if(g_mkdir_with_parents(dir, 0750)) return;
+
+  dt_dev_pixelpipe_disk_header_t header = { 0 };
+  header.magic = DT_PIXELPIPE_DISK_CACHE_MAGIC;
+  header.version = DT_PIXELPIPE_DISK_CACHE_VERSION;
+  header.key = key;
+  header.size = size;
+  header.half = _store_half(dt_conf_get_bool("pixelpipe_cache_half_float"), size, dsc);
+  header.stored = header.half ? size / 2 : size;
+  header.dsc = *dsc;
+  header.dsc.work_profile_info = NULL;
+
+  uint16_t *half = NULL;
+  if(header.half)
+  {
+    half = dt_alloc_align(64, header.stored);
+    if(!half) return;
+    _float_to_half_buf(half, (const float *)data, size / sizeof(float));
+  }
+
+  // write to a temporary file first, concurrent exports must never see a partial buffer
+  gchar *tmpname = g_strdup_printf("%s.%p.tmp", filename, (void *)g_thread_self());
+  FILE *f = g_fopen(tmpname, "wb");
+  if(!f)
+  {
+    dt_free_align(half);
+    g_free(tmpname);
+    return;
+  }
+  const gboolean ok = fwrite(&header, sizeof(header), 1, f) == 1
+                      && fwrite(half ? (const void *)half : data, 1, header.stored, f) == header.stored;
+  dt_free_align(half);
+  if(fclose(f) || !ok || g_rename(tmpname, filename))
+    g_unlink(tmpname);
+  else
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_disk_cache] stored %.2f MB as %s\n", header.stored / (1024.0 * 1024.0), filename);
+  g_free(tmpname);
+
+  _disk_cache_prune(dir);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
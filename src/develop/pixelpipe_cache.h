@@ -18,7 +18,10 @@
 
 #pragma once
 
+#include "common/dtpthread.h"
+#include <glib.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 struct dt_dev_pixelpipe_t;
 struct dt_iop_buffer_dsc_t;
@@ -27,7 +30,9 @@ struct dt_iop_roi_t;
 /**
  * implements a simple pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
- * it is optimized for very few entries (~5), so most operations are O(N).
+ * lookups go through a small open addressing hash index, so the number of
+ * cache lines can be large. buffers are allocated on demand and the total
+ * allocation is kept below a memory budget by dropping least recently used lines.
  */
 
 typedef struct dt_dev_pixelpipe_cache_t
@@ -37,9 +42,31 @@ typedef struct dt_dev_pixelpipe_cache_t
   size_t *size;
   struct dt_iop_buffer_dsc_t *dsc;
   uint64_t *hash;
-  int32_t *used;
+  int64_t *used; // query count at last access, shifted by the weight. lowest gets evicted first.
+  // open addressing index from hash to cache line, stores line + 1, 0 is an empty bucket:
+  int32_t index_size;
+  int32_t *index;
+  // bytes currently allocated and the budget we try to stay below (0 for no limit):
+  size_t memory;
+  size_t memory_limit;
+  size_t memory_peak; // high-water mark of memory
+  // the line with this hash is never evicted, 0 for none. see dt_dev_pixelpipe_cache_pin().
+  uint64_t pinned;
+  // lines of at least spill_min bytes are memory mapped files in spill_dir rather than heap memory, NULL
+  // for none. their bytes are counted in spilled_memory instead of memory. see dt_dev_pixelpipe_cache_spill().
+  char *spill_dir;
+  size_t spill_min;
+  uint8_t *spilled;
+  size_t spilled_memory;
 #ifdef HAVE_OPENCL
+  // optional device tier: a line can keep a cl_mem copy on gpu_devid, so the next run can
+  // hand it to the consumer on the gpu. host_stale lines only have valid data there.
   void **gpu_mem;
+  size_t *gpu_size;
+  int *host_stale;
+  int gpu_devid;
+  size_t gpu_memory;
+  size_t gpu_memory_limit; // 0 disables the tier
 #endif
   // profiling:
   uint64_t queries;
@@ -47,9 +74,10 @@ typedef struct dt_dev_pixelpipe_cache_t
 } dt_dev_pixelpipe_cache_t;
 
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
+  memory_limit is the total number of bytes all lines should use, 0 means no limit.
   \param[out] returns 0 if fail to allocate mem cache.
 */
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memory_limit);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
@@ -75,12 +103,101 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** keeps the line for hash, which the pipe will restart from, out of eviction until another one is pinned.
+  * 0 releases the pin. */
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
+/** pins the line holding data, if there is one. */
+void dt_dev_pixelpipe_cache_pin_data(dt_dev_pixelpipe_cache_t *cache, void *data);
+
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** takes the buffer data out of its line instead of copying it: the line gets *buf of *size bytes (allocated
+  * with dt_alloc_align(), or NULL) and is invalidated, *buf and *size return data and its size.
+  * returns 0 if no line holds data or it is spilled to a file, nothing is exchanged then. */
+int dt_dev_pixelpipe_cache_exchange(dt_dev_pixelpipe_cache_t *cache, void *data, void **buf, size_t *size);
+
+/** from now on keeps buffers of at least min bytes in unlinked, memory mapped files in dir, so the kernel can
+  * write them out instead of the pipe running out of memory. lines like that which exist already are moved.
+  * the lines can't be exchanged then. */
+void dt_dev_pixelpipe_cache_spill(dt_dev_pixelpipe_cache_t *cache, const char *dir, const size_t min);
+/** whether data is the buffer of a line that lives in a file. */
+int dt_dev_pixelpipe_cache_spilled(const dt_dev_pixelpipe_cache_t *cache, const void *data);
+
+/** frees least recently used lines, except the pinned one and the one holding keep, until at least
+  * bytes are released. returns the number of bytes freed. the pipe must not be running. */
+size_t dt_dev_pixelpipe_cache_shrink(dt_dev_pixelpipe_cache_t *cache, const size_t bytes, const void *keep);
+
+#ifdef HAVE_OPENCL
+/** switches the device tier to devid with a new budget, dropping all device buffers if the device changed. */
+void dt_dev_pixelpipe_cache_gpu_reset(dt_dev_pixelpipe_cache_t *cache, const int devid, const size_t memory_limit);
+
+/** takes ownership of cl_mem mem holding the contents of the line at data. host_valid tells whether
+  * the host buffer is up to date as well. returns 0 if the line doesn't take it, mem is then left to the caller. */
+int dt_dev_pixelpipe_cache_keep_gpu(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem, const size_t size,
+                                    const int host_valid);
+
+/** hands the device copy of the line at data over to the caller, or returns NULL. */
+void *dt_dev_pixelpipe_cache_checkout_gpu(dt_dev_pixelpipe_cache_t *cache, void *data);
+#endif
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
+/**
+ * process-wide cache for the output of early modules, so several pipes working on the
+ * same image (full, preview2) don't compute these twice. it is keyed by
+ * dt_dev_pixelpipe_cache_hash() combined with anything else that makes pipes differ,
+ * see _shared_cache_key() in pixelpipe_hb.c. buffers are copied in and out, lines with
+ * a non-zero reference count are being copied right now and never evicted.
+ */
+typedef struct dt_dev_pixelpipe_shared_cache_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *lines; // uint64_t key -> dt_dev_pixelpipe_shared_line_t
+  size_t memory;
+  size_t memory_limit;
+  uint64_t clock;
+  gboolean half_float; // store float lines as half floats, see pixelpipe_cache_half_float
+  struct dt_memory_client_t *memory_client;
+  // profiling:
+  uint64_t queries;
+  uint64_t misses;
+} dt_dev_pixelpipe_shared_cache_t;
+
+void dt_dev_pixelpipe_shared_cache_init(dt_dev_pixelpipe_shared_cache_t *cache, size_t memory_limit);
+void dt_dev_pixelpipe_shared_cache_cleanup(dt_dev_pixelpipe_shared_cache_t *cache);
+
+/** test availability of a line, not taking a reference. */
+int dt_dev_pixelpipe_shared_cache_available(dt_dev_pixelpipe_shared_cache_t *cache, const uint64_t key);
+
+/** copies the line for key to data (at most size bytes) and its format to dsc.
+  * returns non-zero if there is no such line. */
+int dt_dev_pixelpipe_shared_cache_fetch(dt_dev_pixelpipe_shared_cache_t *cache, const uint64_t key,
+                                        void *data, const size_t size, struct dt_iop_buffer_dsc_t *dsc);
+
+/** drops unreferenced lines, oldest first, until at least bytes are released. returns the bytes freed. */
+size_t dt_dev_pixelpipe_shared_cache_shrink(dt_dev_pixelpipe_shared_cache_t *cache, const size_t bytes);
+
+/** stores a copy of data under key, evicting unreferenced lines to stay within budget. */
+void dt_dev_pixelpipe_shared_cache_store(dt_dev_pixelpipe_shared_cache_t *cache, const uint64_t key,
+                                         const void *data, const size_t size,
+                                         const struct dt_iop_buffer_dsc_t *dsc);
+
+/**
+ * on-disk store for a few expensive intermediate buffers of the export pipe (see
+ * _disk_cache_module() in pixelpipe_hb.c), so re-exporting with only late modules
+ * changed can resume from there. one file per buffer in the user cache dir: a small
+ * header followed by the raw pixels, read back through a memory map.
+ */
+
+/** fills data (size bytes) and dsc from the file for key. returns non-zero if not available. */
+int dt_dev_pixelpipe_disk_cache_load(const uint64_t key, void *data, const size_t size,
+                                     struct dt_iop_buffer_dsc_t *dsc);
+/** writes the buffer for key and prunes the oldest files beyond export_disk_cache_size. */
+void dt_dev_pixelpipe_disk_cache_store(const uint64_t key, const void *data, const size_t size,
+                                       const struct dt_iop_buffer_dsc_t *dsc);
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,228 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_estimate.h"
+#include "common/darktable.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/iop_order.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "develop/blend.h"
+#include "develop/develop.h"
+#include "develop/format.h"
+#include "develop/pixelpipe.h"
+#include "develop/tiling.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the memory of the module and the device it goes to, as dt_dev_pixelpipe_process_rec() decides it. the
+// memory governor is not asked, a dry run must not evict anything.
+static void _estimate_piece(dt_dev_pixelpipe_estimate_module_t *e, dt_iop_module_t *module,
+                            dt_dev_pixelpipe_iop_t *piece, const int devid, const int host_limit)
+{
+  const unsigned bpp = MAX(e->in_bpp, e->out_bpp);
+  const size_t width = MAX(e->roi_in.width, e->roi_out.width);
+  const size_t height = MAX(e->roi_in.height, e->roi_out.height);
+
+  dt_develop_tiling_t tiling = { 0 };
+  module->tiling_callback(module, piece, &e->roi_in, &e->roi_out, &tiling);
+  if(piece->blendop_data
+     && ((dt_develop_blend_params_t *)piece->blendop_data)->mask_mode != DEVELOP_MASK_DISABLED)
+  {
+    dt_develop_tiling_t tiling_blendop = { 0 };
+    tiling_callback_blendop(module, piece, &e->roi_in, &e->roi_out, &tiling_blendop);
+    tiling.factor = fmax(tiling.factor, tiling_blendop.factor);
+    tiling.overhead = fmax(tiling.overhead, tiling_blendop.overhead);
+  }
+  dt_tiling_calibration_apply(module, &tiling);
+
+  e->memory = (size_t)(tiling.factor * width * height * bpp) + tiling.overhead;
+
+  e->devid = -1;
+  e->tiled = FALSE;
+  if(devid >= 0 && module->process_cl && piece->process_cl_ready)
+  {
+    const int fits = dt_opencl_image_fits_device(devid, width, height, bpp, tiling.factor, tiling.overhead);
+    if(fits || piece->process_tiling_ready)
+    {
+      e->devid = devid;
+      e->tiled = !fits;
+    }
+  }
+  if(e->devid < 0)
+    e->tiled = piece->process_tiling_ready && host_limit > 0 && e->memory > ((size_t)host_limit << 20);
+
+  e->seconds = dt_opencl_affinity_estimate(e->devid, module->op, e->roi_in.width, e->roi_in.height);
+}
+
+gboolean dt_dev_pixelpipe_estimate_export(const int32_t imgid, const int max_width, const int max_height,
+                                          const gboolean high_quality, const gboolean upscale,
+                                          dt_dev_pixelpipe_estimate_t *estimate)
+{
+  memset(estimate, 0, sizeof(dt_dev_pixelpipe_estimate_t));
+
+  const dt_image_t *cimg = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+  if(!cimg) return FALSE;
+  dt_image_t img = *cimg;
+  dt_image_cache_read_release(darktable.image_cache, cimg);
+
+  // freshly imported images only know their size once the file has been opened, as in
+  // dt_image_get_final_size()
+  if(!img.width || !img.height)
+  {
+    char filename[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
+    dt_image_t *wimg = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+    dt_imageio_open(wimg, filename, NULL);
+    img = *wimg;
+    dt_image_cache_write_release(darktable.image_cache, wimg, DT_IMAGE_CACHE_RELAXED);
+  }
+  if(!img.width || !img.height) return FALSE;
+
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+  dt_ioppr_resync_modules_order(&dev);
+
+  const int wd = img.width, ht = img.height;
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_dev_pixelpipe_init_dummy(&pipe, wd, ht))
+  {
+    dt_dev_cleanup(&dev);
+    return FALSE;
+  }
+  // modules pick their export behaviour from the pipe type
+  pipe.type = DT_DEV_PIXELPIPE_EXPORT;
+  // set mem pointer to 0, won't be used.
+  dt_dev_pixelpipe_set_input(&pipe, &dev, NULL, wd, ht, 1.0f);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
+                                  &pipe.processed_height);
+
+  // the scale as _imageio_export() picks it. high quality processes at full size and downscales after.
+  const double max_scale = (upscale && (max_width > 0 || max_height > 0)) ? 100.0 : 1.0;
+  const double scalex = max_width > 0 ? fmin(max_width / (double)pipe.processed_width, max_scale) : max_scale;
+  const double scaley = max_height > 0 ? fmin(max_height / (double)pipe.processed_height, max_scale) : max_scale;
+  const double scale = fmin(scalex, scaley);
+  estimate->width = scale * pipe.processed_width + 0.5;
+  estimate->height = scale * pipe.processed_height + 0.5;
+  const double process_scale = (high_quality && scale < 1.0) ? 1.0 : scale;
+
+  // regions of interest from the end of the pipe back to its input
+  dt_iop_roi_t roi_out = (dt_iop_roi_t){ 0, 0, process_scale * pipe.processed_width + 0.5,
+                                         process_scale * pipe.processed_height + 0.5, process_scale };
+  GList *run = NULL;
+  GList *pieces = g_list_last(pipe.nodes);
+  for(GList *modules = g_list_last(pipe.iop); modules && pieces;
+      modules = g_list_previous(modules), pieces = g_list_previous(pieces))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!piece->enabled) continue;
+
+    dt_dev_pixelpipe_estimate_module_t *e
+        = (dt_dev_pixelpipe_estimate_module_t *)calloc(1, sizeof(dt_dev_pixelpipe_estimate_module_t));
+    g_strlcpy(e->op, module->op, sizeof(e->op));
+    g_strlcpy(e->multi_name, module->multi_name, sizeof(e->multi_name));
+    e->roi_out = roi_out;
+    e->roi_in = roi_out;
+    module->modify_roi_in(module, piece, &e->roi_out, &e->roi_in);
+    roi_out = e->roi_in;
+
+    estimate->modules = g_list_prepend(estimate->modules, e);
+    run = g_list_prepend(run, piece);
+  }
+
+  // formats and requirements from the input on
+  const int devid = dt_opencl_preferred_device(DT_DEV_PIXELPIPE_EXPORT);
+  const int host_limit = dt_conf_get_int("host_memory_limit");
+  dt_iop_buffer_dsc_t dsc = pipe.image.buf_dsc;
+  unsigned in_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
+  size_t host_peak = 0;
+  GList *m = estimate->modules;
+  for(GList *p = run; p && m; p = g_list_next(p), m = g_list_next(m))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    dt_iop_module_t *module = piece->module;
+    dt_dev_pixelpipe_estimate_module_t *e = (dt_dev_pixelpipe_estimate_module_t *)m->data;
+
+    module->output_format(module, &pipe, piece, &dsc);
+    e->in_bpp = in_bpp;
+    e->out_bpp = in_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
+    _estimate_piece(e, module, piece, devid, host_limit);
+
+    if(e->seconds >= 0.0)
+      estimate->seconds += e->seconds;
+    else
+      estimate->unmeasured++;
+
+    // input and output are in the pipe's lines, what comes on top of them on the host. a module on the
+    // device only needs them.
+    const size_t buffers = (size_t)e->in_bpp * e->roi_in.width * e->roi_in.height
+                           + (size_t)e->out_bpp * e->roi_out.width * e->roi_out.height;
+    size_t host = 0;
+    if(e->devid < 0)
+      host = e->tiled ? ((size_t)host_limit << 20) : e->memory - MIN(e->memory, buffers);
+    host_peak = MAX(host_peak, host);
+  }
+  g_list_free(run);
+
+  // the export pipe keeps two full size lines, see dt_dev_pixelpipe_init_export()
+  estimate->host_memory = 2 * 4 * sizeof(float) * (size_t)wd * ht + host_peak;
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  return TRUE;
+}
+
+void dt_dev_pixelpipe_estimate_cleanup(dt_dev_pixelpipe_estimate_t *estimate)
+{
+  g_list_free_full(estimate->modules, free);
+  estimate->modules = NULL;
+}
+
+void dt_dev_pixelpipe_estimate_print(FILE *f, const char *name, const dt_dev_pixelpipe_estimate_t *estimate)
+{
+  const double mb = 1024.0 * 1024.0;
+  for(const GList *l = estimate->modules; l; l = g_list_next(l))
+  {
+    const dt_dev_pixelpipe_estimate_module_t *e = (const dt_dev_pixelpipe_estimate_module_t *)l->data;
+    const char *device = "cpu";
+#ifdef HAVE_OPENCL
+    if(e->devid >= 0) device = darktable.opencl->dev[e->devid].name;
+#endif
+    fprintf(f, "%s\t%s%s%s\t%dx%d\t%dx%d\t%.1f\t%s\t%s\t", name, e->op, e->multi_name[0] ? " " : "",
+            e->multi_name, e->roi_in.width, e->roi_in.height, e->roi_out.width, e->roi_out.height,
+            e->memory / mb, e->tiled ? "tiled" : "untiled", device);
+    if(e->seconds >= 0.0)
+      fprintf(f, "%.3f\n", e->seconds);
+    else
+      fprintf(f, "?\n");
+  }
+  fprintf(f, "%s\ttotal\t\t%dx%d\t%.1f\t\t\t%.3f%s\n", name, estimate->width, estimate->height,
+          estimate->host_memory / mb, estimate->seconds, estimate->unmeasured ? "+?" : "");
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,66 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "develop/imageop.h"
+
+#include <glib.h>
+#include <stdio.h>
+
+/**
+ * a dry run of an export: the history is synched into a pipe and walked like dt_dev_pixelpipe_process()
+ * would, through the dimensions, modify_roi_in() and the tiling callbacks, without processing any pixels.
+ * the run times come from what the adaptive opencl scheduling recorded in earlier runs, see
+ * dt_opencl_affinity_estimate(), so they are only known for modules that ran at some similar size before.
+ */
+
+typedef struct dt_dev_pixelpipe_estimate_module_t
+{
+  dt_dev_operation_t op;
+  char multi_name[128];
+  dt_iop_roi_t roi_in, roi_out;
+  unsigned in_bpp, out_bpp;
+  size_t memory;   // untiled requirement: tiling factor times the larger buffer, plus the overhead
+  gboolean tiled;  // the requirement doesn't fit its device, the module will be tiled
+  int devid;       // opencl device the module is expected to run on, -1 for the cpu
+  double seconds;  // expected run time, negative if there is no measurement
+} dt_dev_pixelpipe_estimate_module_t;
+
+typedef struct dt_dev_pixelpipe_estimate_t
+{
+  int width, height;        // of the exported image
+  size_t host_memory;       // peak of host memory: the pipe's two full size lines and the hungriest cpu module
+  double seconds;           // sum over the modules with a measurement
+  int unmeasured;           // modules without measurement, not part of seconds
+  GList *modules;           // dt_dev_pixelpipe_estimate_module_t, in pipe order
+} dt_dev_pixelpipe_estimate_t;
+
+/** estimates what exporting imgid into max_width x max_height (0 for no limit) would take. returns FALSE if
+    the image dimensions can't be found, estimate is empty then. dt_dev_pixelpipe_estimate_cleanup() it. */
+gboolean dt_dev_pixelpipe_estimate_export(const int32_t imgid, const int max_width, const int max_height,
+                                          const gboolean high_quality, const gboolean upscale,
+                                          dt_dev_pixelpipe_estimate_t *estimate);
+void dt_dev_pixelpipe_estimate_cleanup(dt_dev_pixelpipe_estimate_t *estimate);
+
+/** writes one tab separated line per module and a summary line. */
+void dt_dev_pixelpipe_estimate_print(FILE *f, const char *name, const dt_dev_pixelpipe_estimate_t *estimate);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -21,6 +21,9 @@
 #include "common/imageio.h"
 #include "common/opencl.h"
 #include "common/iop_order.h"
+#include "common/memory_governor.h"
+#include "common/metrics.h"
+#include "common/profiling.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "develop/blend.h"
@@ -61,7 +64,57 @@ typedef enum dt_pixelpipe_picker_source_t
   PIXELPIPE_PICKER_OUTPUT = 1
 } dt_pixelpipe_picker_source_t;
 
+#include "develop/pixelpipe_arena.c"
 #include "develop/pixelpipe_cache.c"
+#include "develop/pixelpipe_estimate.c"
+
+// only modules before colorin are shared between pipes. later ones depend on
+// per pipe settings (display profile, soft proofing) not covered by the hash.
+static gboolean _shared_cache_module(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module)
+{
+  return pipe->shared_cache && module
+         && module->iop_order < dt_ioppr_get_iop_order(pipe->iop_order_list, "colorin", 0);
+}
+
+// the pipe hash doesn't know about the input buffer, and modules may behave differently
+// on the preview pipe. mix that in so only truly identical buffers match.
+static uint64_t _shared_cache_key(const dt_dev_pixelpipe_t *pipe, const uint64_t hash)
+{
+  // full and second window pipes process the same input the same way
+  const uint64_t type = pipe->type == DT_DEV_PIXELPIPE_PREVIEW2 ? DT_DEV_PIXELPIPE_FULL : pipe->type;
+  uint32_t iscale;
+  memcpy(&iscale, &pipe->iscale, sizeof(iscale));
+  uint64_t key = hash;
+  key = ((key << 5) + key) ^ type;
+  key = ((key << 5) + key) ^ (uint64_t)pipe->iwidth;
+  key = ((key << 5) + key) ^ (uint64_t)pipe->iheight;
+  key = ((key << 5) + key) ^ iscale;
+  return key;
+}
+
+// the expensive early stages worth keeping on disk for repeated exports
+static gboolean _disk_cache_module(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module)
+{
+  return pipe->disk_cache_id && module && (!strcmp(module->op, "demosaic") || !strcmp(module->op, "lens"));
+}
+
+static uint64_t _disk_cache_key(const dt_dev_pixelpipe_t *pipe, const uint64_t hash)
+{
+  return ((hash << 5) + hash) ^ pipe->disk_cache_id;
+}
+
+#ifdef HAVE_OPENCL
+// device memory for keeping module outputs on the gpu between runs. only the interactive
+// pipes re-run the same stack often enough to pay for it.
+static size_t _gpu_cache_memory(const dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->devid < 0 || !dt_conf_get_bool("opencl_gpu_resident_cache")) return 0;
+  if(pipe->type != DT_DEV_PIXELPIPE_FULL && pipe->type != DT_DEV_PIXELPIPE_PREVIEW
+     && pipe->type != DT_DEV_PIXELPIPE_PREVIEW2)
+    return 0;
+  return dt_opencl_get_max_global_mem(pipe->devid) / 4;
+}
+#endif
 
 static void get_output_format(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
                               dt_develop_t *dev, dt_iop_buffer_dsc_t *dsc);
@@ -93,26 +146,92 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
+// bytes moved between host and the pipe's device so far, deltas go into the trace
+static void _trace_transfers(const dt_dev_pixelpipe_t *pipe, size_t *to_device, size_t *from_device)
+{
+  *to_device = *from_device = 0;
+#ifdef HAVE_OPENCL
+  if(darktable.opencl->inited && pipe->devid >= 0)
+  {
+    *to_device = darktable.opencl->dev[pipe->devid].bytes_to_device;
+    *from_device = darktable.opencl->dev[pipe->devid].bytes_from_device;
+  }
+#endif
+}
+
+// one span per module and pipe run for --trace, one row per pipe type
+static void _trace_module(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module,
+                          const dt_iop_roi_t *roi, const double start, const char *cache, const int on_gpu,
+                          const int tiling, const size_t to_device, const size_t from_device)
+{
+  size_t to_device_now, from_device_now;
+  _trace_transfers(pipe, &to_device_now, &from_device_now);
+  size_t gpu_peak = 0;
+#ifdef HAVE_OPENCL
+  if(darktable.opencl->inited && pipe->devid >= 0) gpu_peak = darktable.opencl->dev[pipe->devid].peak_memory;
+#endif
+  char args[512];
+  snprintf(args, sizeof(args),
+           "\"pipe\": \"%s\", \"device\": \"%s\", \"devid\": %d, \"roi\": [%d, %d, %d, %d], \"scale\": %g, "
+           "\"tiling\": %s, \"cache\": \"%s\", \"bytes_to_device\": %zu, \"bytes_from_device\": %zu, "
+           "\"cache_memory_peak\": %zu, \"gpu_memory_peak\": %zu",
+           _pipe_type_to_str(pipe->type), on_gpu ? "GPU" : "CPU", on_gpu ? pipe->devid : -1, roi->x, roi->y,
+           roi->width, roi->height, roi->scale, tiling ? "true" : "false", cache, to_device_now - to_device,
+           from_device_now - from_device, pipe->cache.memory_peak, gpu_peak);
+  dt_trace_span(module->op, "pixelpipe", pipe->type, start, dt_get_wtime(), args);
+}
+
+// number of cache lines for the interactive pipes. lines without a buffer are
+// free, the actual footprint is bounded by dt_dev_pixelpipe_darkroom_cache_memory() instead.
+#define DT_DEV_PIXELPIPE_DARKROOM_CACHE_LINES 64
+
+size_t dt_dev_pixelpipedt_dev_pixelpipe_darkroom_cache_memory()
+{
+  const int mb = dt_conf_get_int("darkroom_cache_memory");
+  if(mb > 0) return (size_t)mb << 20;
+  // automatic: an eighth of the physical memory (which is reported in kB)
+  const size_t mem = dt_get_total_memory() << 10;
+  return CLAMPS(mem / 8, ((size_t)256) << 20, ((size_t)8) << 30);
+}
+
+// with host_memory_spill set, exports whose full size input and output of a module don't fit the
+// tiling budget keep their buffers in files. the tiler then only has to fit what modules need on top.
+static void _export_spill(dt_dev_pixelpipe_t *pipe, const size_t size)
+{
+  gchar *dir = dt_conf_get_string("host_memory_spill");
+  if(dir && *dir)
+  {
+    const int limit = dt_conf_get_int("host_memory_limit");
+    // like the tiler, no limit means the physical memory (reported in kB), of which we leave half to others
+    const size_t budget = limit > 0 ? (size_t)limit << 20 : (dt_get_total_memory() << 10) / 2;
+    // a quarter of the full buffer still catches the single channel raw stages
+    if(2 * size > budget) dt_dev_pixelpipe_cache_spill(&pipe->cache, dir, MAX(size / 4, ((size_t)16) << 20));
+  }
+  g_free(dir);
+}
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels,
                                  gboolean store_masks)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  const size_t size = 4 * sizeof(float) * width * height;
+  int res = dt_dev_pixelpipe_init_cached(pipe, size, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_EXPORT;
   pipe->levels = levels;
   pipe->store_all_raster_masks = store_masks;
+  if(res) _export_spill(pipe, size);
   return res;
 }
 
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
 
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
@@ -120,30 +239,52 @@ int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  int res = dt_dev_pixelpipe_init_cached(
-      pipe, 0, 5);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 0, DT_DEV_PIXELPIPE_DARKROOM_CACHE_LINES, dt_dev_pixelpipe_darkroom_cache_memory());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
+  pipe->shared_cache = darktable.pixelpipe_cache != NULL;
   return res;
 }
 
 int dt_dev_pixelpipe_init_preview2(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  int res = dt_dev_pixelpipe_init_cached(pipe, 0, 5);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 0, DT_DEV_PIXELPIPE_DARKROOM_CACHE_LINES, dt_dev_pixelpipe_darkroom_cache_memory());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW2;
+  pipe->shared_cache = darktable.pixelpipe_cache != NULL;
   return res;
 }
 
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  int res = dt_dev_pixelpipe_init_cached(
-      pipe, 0, 5);
+  int res = dt_dev_pixelpipe_init_cached(pipe, 0, DT_DEV_PIXELPIPE_DARKROOM_CACHE_LINES, dt_dev_pixelpipe_darkroom_cache_memory());
   pipe->type = DT_DEV_PIXELPIPE_FULL;
+  pipe->shared_cache = darktable.pixelpipe_cache != NULL;
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+static size_t _pipe_memory_usage(void *data)
+{
+  const dt_dev_pixelpipe_t *pipe = (const dt_dev_pixelpipe_t *)data;
+  return pipe->cache.memory + (pipe->arena ? pipe->arena->size : 0);
+}
+
+static size_t _pipe_memory_evict(void *data, size_t bytes)
+{
+  dt_dev_pixelpipe_t *pipe = (dt_dev_pixelpipe_t *)data;
+  // a running pipe (possibly the one asking) needs its lines, leave it alone
+  if(dt_pthread_mutex_trylock(&pipe->busy_mutex)) return 0;
+  size_t freed = 0;
+  if(!dt_pthread_mutex_trylock(&pipe->backbuf_mutex))
+  {
+    freed = dt_dev_pixelpipe_cache_shrink(&pipe->cache, bytes, pipe->backbuf);
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return freed;
+}
+
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory_limit)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
@@ -151,7 +292,9 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size, memory_limit)) return 0;
+  const int scratch_mb = dt_conf_get_int("pixelpipe_scratch_memory");
+  pipe->arena = scratch_mb > 0 ? dt_dev_pixelpipe_arena_new((size_t)scratch_mb << 20) : NULL;
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->backbuf_scale = 0.f;
@@ -159,9 +302,12 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->backbuf_zoom_y = 0.f;
 
   pipe->output_backbuf = NULL;
+  pipe->output_backbuf_size = 0;
   pipe->output_backbuf_width = 0;
   pipe->output_backbuf_height = 0;
   pipe->output_imgid = 0;
+  pipe->coarse = 1;
+  pipe->output_backbuf_coarse = 1;
 
   pipe->processing = 0;
   pipe->shutdown = 0;
@@ -180,10 +326,49 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->iop_order_list = NULL;
   pipe->forms = NULL;
   pipe->store_all_raster_masks = FALSE;
+  pipe->shared_cache = FALSE;
+  pipe->disk_cache_id = 0;
+  pipe->memory_client = dt_memory_governor_register("pixelpipe cache", DT_MEMORY_PRIORITY_PIPE_CACHE,
+                                                    _pipe_memory_usage, _pipe_memory_evict, pipe);
 
   return 1;
 }
 
+void dt_dev_pixelpipe_reset(dt_dev_pixelpipe_t *pipe)
+{
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  g_assert(pipe->nodes == NULL);
+  dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  if(pipe->arena) dt_dev_pixelpipe_arena_reset(pipe->arena);
+  pipe->devid = -1;
+  pipe->changed = DT_DEV_PIPE_UNCHANGED;
+  pipe->processed_width = pipe->backbuf_width = pipe->iwidth = 0;
+  pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
+  pipe->input = NULL;
+  pipe->cache_obsolete = 0;
+  pipe->backbuf = NULL;
+  pipe->backbuf_scale = 0.f;
+  pipe->backbuf_zoom_x = 0.f;
+  pipe->backbuf_zoom_y = 0.f;
+  pipe->coarse = 1;
+  pipe->processing = 0;
+  pipe->shutdown = 0;
+  pipe->opencl_error = 0;
+  pipe->tiling = 0;
+  pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
+  pipe->bypass_blendif = 0;
+  pipe->input_timestamp = 0;
+  pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
+  pipe->store_all_raster_masks = FALSE;
+  pipe->disk_cache_id = 0;
+  if(pipe->forms)
+  {
+    g_list_free_full(pipe->forms, (void (*)(void *))dt_masks_free_form);
+    pipe->forms = NULL;
+  }
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+}
+
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, float *input, int width, int height,
                                 float iscale)
 {
@@ -206,12 +391,16 @@ void dt_dev_pixelpipe_set_icc(dt_dev_pixelpipe_t *pipe, dt_colorspaces_color_pro
 
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
 {
+  dt_memory_governor_unregister(pipe->memory_client);
+  pipe->memory_client = NULL;
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
   pipe->backbuf = NULL;
   // blocks while busy and sets shutdown bit:
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_arena_destroy(pipe->arena);
+  pipe->arena = NULL;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -219,11 +408,13 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   g_free(pipe->icc_filename);
   pipe->icc_filename = NULL;
 
-  g_free(pipe->output_backbuf);
+  dt_free_align(pipe->output_backbuf);
   pipe->output_backbuf = NULL;
+  pipe->output_backbuf_size = 0;
   pipe->output_backbuf_width = 0;
   pipe->output_backbuf_height = 0;
   pipe->output_imgid = 0;
+  pipe->output_backbuf_coarse = 1;
 
   if(pipe->forms)
   {
@@ -300,6 +491,8 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     piece->pipe = pipe;
     piece->data = NULL;
     piece->hash = 0;
+    piece->clean_hash = 0;
+    piece->output_hash = 0;
     piece->process_cl_ready = 0;
     piece->process_tiling_ready = 0;
     piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
@@ -334,24 +527,38 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
 void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
-  // call reset_params on all pieces first.
+  // the last history item of a module fully defines its piece, the ones before it and the defaults would
+  // only be committed to be overwritten. find it for each module first, so that every piece gets
+  // committed once, which is what a fresh export or thumbnail pipe pays for each image.
+  GHashTable *last = g_hash_table_new(NULL, NULL);
+  GList *history = dev->history;
+  for(int k = 0; k < dev->history_end && history; k++)
+  {
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    g_hash_table_insert(last, hist->module, hist);
+    history = g_list_next(history);
+  }
+
   GList *nodes = pipe->nodes;
   while(nodes)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    const dt_dev_history_item_t *hist = (dt_dev_history_item_t *)g_hash_table_lookup(last, piece->module);
     piece->hash = 0;
-    piece->enabled = piece->module->default_enabled;
-    dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params,
-                         pipe, piece);
+    if(hist)
+    {
+      piece->enabled = hist->enabled;
+      dt_iop_commit_params(piece->module, hist->params, hist->blend_params, pipe, piece);
+    }
+    else
+    {
+      piece->enabled = piece->module->default_enabled;
+      dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params,
+                           pipe, piece);
+    }
     nodes = g_list_next(nodes);
   }
-  // go through all history items and adjust params
-  GList *history = dev->history;
-  for(int k = 0; k < dev->history_end && history; k++)
-  {
-    dt_dev_pixelpipe_synch(pipe, dev, history);
-    history = g_list_next(history);
-  }
+  g_hash_table_destroy(last);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -787,7 +994,21 @@ static void _pixelpipe_pick_from_image(const float *const pixel, const dt_iop_ro
   }
 }
 
-static void _pixelpipe_pick_live_samples(const float *const input, const dt_iop_roi_t *roi_in)
+// the colors of a live sample only change with the buffer they are taken from (hash of the piece, which
+// covers everything upstream and the roi), the sample's area and the profiles converting them
+static uint64_t _live_sample_hash(const dt_colorpicker_sample_t *sample, uint64_t hash)
+{
+  const char *str = (const char *)sample->box;
+  for(size_t k = 0; k < sizeof(sample->box); k++) hash = ((hash << 5) + hash) ^ str[k];
+  str = (const char *)sample->point;
+  for(size_t k = 0; k < sizeof(sample->point); k++) hash = ((hash << 5) + hash) ^ str[k];
+  hash = ((hash << 5) + hash) ^ sample->size;
+  // never 0, which marks samples not picked yet
+  return hash ? hash : 1;
+}
+
+static void _pixelpipe_pick_live_samples(const float *const input, const dt_iop_roi_t *roi_in,
+                                         const uint64_t buffer_hash)
 {
   cmsHPROFILE display_profile = NULL;
   cmsHPROFILE histogram_profile = NULL;
@@ -821,17 +1042,34 @@ static void _pixelpipe_pick_live_samples(const float *const input, const dt_iop_
 
   lab_profile = dt_colorspaces_get_profile(DT_COLORSPACE_LAB, "", DT_PROFILE_DIRECTION_ANY)->profile;
 
+  // a new display profile comes as a new cmsHPROFILE
+  uint64_t hash = buffer_hash;
+  hash = ((hash << 5) + hash) ^ (uint64_t)(uintptr_t)display_profile;
+  hash = ((hash << 5) + hash) ^ (uint64_t)(uintptr_t)histogram_profile;
+
+  // only samples that moved, or whose buffer changed, are picked again. most pipe runs of the
+  // preview change nothing for them, and the transforms aren't needed at all then.
+  gboolean needed = FALSE;
+  for(GSList *samples = darktable.lib->proxy.colorpicker.live_samples; samples && !needed;
+      samples = g_slist_next(samples))
+  {
+    const dt_colorpicker_sample_t *sample = samples->data;
+    needed = !sample->locked && sample->hash != _live_sample_hash(sample, hash);
+  }
+
   // display rgb --> lab
-  if(display_profile && lab_profile)
+  if(needed && display_profile && lab_profile)
     xform_rgb2lab = cmsCreateTransform(display_profile, TYPE_RGB_FLT, lab_profile, TYPE_Lab_FLT, INTENT_PERCEPTUAL, 0);
 
   // display rgb --> histogram rgb
-  if(display_profile && histogram_profile)
+  if(needed && display_profile && histogram_profile)
     xform_rgb2rgb = cmsCreateTransform(display_profile, TYPE_RGB_FLT, histogram_profile, TYPE_RGB_FLT, INTENT_PERCEPTUAL, 0);
 
   if(darktable.color_profiles->display_type == DT_COLORSPACE_DISPLAY || histogram_type == DT_COLORSPACE_DISPLAY)
     pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
+  if(!needed) return;
+
   dt_colorpicker_sample_t *sample = NULL;
   GSList *samples = darktable.lib->proxy.colorpicker.live_samples;
 
@@ -839,11 +1077,13 @@ static void _pixelpipe_pick_live_samples(const float *const input, const dt_iop_
   {
     sample = samples->data;
 
-    if(sample->locked)
+    const uint64_t sample_hash = _live_sample_hash(sample, hash);
+    if(sample->locked || sample->hash == sample_hash)
     {
       samples = g_slist_next(samples);
       continue;
     }
+    sample->hash = sample_hash;
 
     _pixelpipe_pick_from_image(input, roi_in, xform_rgb2lab, xform_rgb2rgb,
         sample->box, sample->point, sample->size,
@@ -911,7 +1151,14 @@ static void _pixelpipe_pick_primary_colorpicker(dt_develop_t *dev, const float *
   if(xform_rgb2rgb) cmsDeleteTransform(xform_rgb2rgb);
 }
 
-static void _pixelpipe_final_histogram(dt_develop_t *dev, const float *const input, const dt_iop_roi_t *roi_in)
+static void _pixelpipe_final_histogram_waveform(dt_develop_t *dev, const float *const input,
+                                                const dt_iop_roi_t *roi_in,
+                                                const dt_histogram_roi_t *const histogram_roi);
+
+// with_waveform also renders the waveform scope. if the histogram is taken from the display profile
+// both are binned in the same pass over the image
+static void _pixelpipe_final_histogram(dt_develop_t *dev, const float *const input, const dt_iop_roi_t *roi_in,
+                                       const gboolean with_waveform)
 {
   float *img_tmp = NULL;
 
@@ -976,7 +1223,17 @@ static void _pixelpipe_final_histogram(dt_develop_t *dev, const float *const inp
   histogram_params.bins_count = 256;
   histogram_params.mul = histogram_params.bins_count - 1;
 
-  dt_histogram_helper(&histogram_params, &histogram_stats, cst, iop_cs_NONE, (img_tmp) ? img_tmp: input, &dev->histogram, FALSE, NULL);
+  if(with_waveform && !img_tmp)
+  {
+    _pixelpipe_final_histogram_waveform(dev, input, roi_in, &histogram_roi);
+    histogram_stats.bins_count = 256;
+    histogram_stats.ch = 3u;
+  }
+  else
+  {
+    dt_histogram_helper(&histogram_params, &histogram_stats, cst, iop_cs_NONE, (img_tmp) ? img_tmp: input, &dev->histogram, FALSE, NULL);
+    if(with_waveform) _pixelpipe_final_histogram_waveform(dev, input, roi_in, NULL);
+  }
   dt_histogram_max_helper(&histogram_stats, cst, iop_cs_NONE, &dev->histogram, histogram_max);
   dev->histogram_max = MAX(MAX(histogram_max[0], histogram_max[1]), histogram_max[2]);
 
@@ -990,7 +1247,11 @@ static void _pixelpipe_final_histogram(dt_develop_t *dev, const float *const inp
   }
 }
 
-static void _pixelpipe_final_histogram_waveform(dt_develop_t *dev, const float *const input, const dt_iop_roi_t *roi_in)
+// renders the waveform scope. given a histogram_roi, dev->histogram is binned in the same pass, the same
+// way dt_histogram_helper() does it for rgb
+static void _pixelpipe_final_histogram_waveform(dt_develop_t *dev, const float *const input,
+                                                const dt_iop_roi_t *roi_in,
+                                                const dt_histogram_roi_t *const histogram_roi)
 {
   dt_times_t start_time = { 0 };
   if(darktable.unmuted & DT_DEBUG_PERF) dt_get_times(&start_time);
@@ -1018,28 +1279,62 @@ static void _pixelpipe_final_histogram_waveform(dt_develop_t *dev, const float *
   // 1.0 is at 8/9 of the height!
   const float _height = (float)(waveform_height - 1);
 
-  // count the colors into buf ...
+  // count the colors into buf ... every block of columns belongs to one thread, which walks its part of
+  // each row, so the counts need no atomics. the histogram goes to per thread partial histograms.
+  const int nthreads = dt_get_num_threads();
+  const int nblocks = MIN(waveform_width, nthreads);
+  uint32_t *const partial_hists
+      = histogram_roi ? calloc((size_t)4 * 256 * nthreads, sizeof(uint32_t)) : NULL;
+  const int hx0 = histogram_roi ? histogram_roi->crop_x : 0;
+  const int hx1 = histogram_roi ? histogram_roi->width - histogram_roi->crop_width : 0;
+  const int hy0 = histogram_roi ? histogram_roi->crop_y : 0;
+  const int hy1 = histogram_roi ? histogram_roi->height - histogram_roi->crop_height : 0;
+
 #ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(roi_in, bin_width, _height, waveform_width, input, buf) \
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(roi_in, bin_width, _height, waveform_width, input, buf, nblocks, partial_hists, \
+                      hx0, hx1, hy0, hy1) \
   schedule(static)
 #endif
-  for(int in_y = 0; in_y < roi_in->height; in_y++)
+  for(int b = 0; b < nblocks; b++)
   {
-    for(int in_x = 0; in_x < roi_in->width; in_x++)
+    const int x0 = (waveform_width * b / nblocks) * bin_width;
+    const int x1 = MIN(roi_in->width, (waveform_width * (b + 1) / nblocks) * bin_width);
+    uint32_t *const hist = partial_hists ? partial_hists + 4 * 256 * dt_get_thread_num() : NULL;
+    for(int in_y = 0; in_y < roi_in->height; in_y++)
     {
-      const float *const in = input + 4 * (in_y*roi_in->width + in_x);
-      const int out_x = in_x / bin_width;
-      for(int k = 0; k < 3; k++)
+      const gboolean row_in_histogram = hist && in_y >= hy0 && in_y < hy1;
+      for(int in_x = x0; in_x < x1; in_x++)
       {
-        const float v = 1.0f - (8.0f / 9.0f) * in[2 - k];
-        // flipped from dt's CLAMPS so as to treat NaN's as 0 (NaN compares false)
-        const int out_y = (v < 1.0f ? (v > 0.0f ? v : 0.0f) : 1.0f) * _height;
-        __sync_add_and_fetch(buf + (out_x + waveform_width * out_y) * 3 + k, 1);
+        const float *const in = input + 4 * ((size_t)in_y * roi_in->width + in_x);
+        const int out_x = in_x / bin_width;
+        for(int k = 0; k < 3; k++)
+        {
+          const float v = 1.0f - (8.0f / 9.0f) * in[2 - k];
+          // flipped from dt's CLAMPS so as to treat NaN's as 0 (NaN compares false)
+          const int out_y = (v < 1.0f ? (v > 0.0f ? v : 0.0f) : 1.0f) * _height;
+          buf[(out_x + waveform_width * out_y) * 3 + k]++;
+        }
+        if(row_in_histogram && in_x >= hx0 && in_x < hx1)
+        {
+          for(int k = 0; k < 3; k++)
+          {
+            const float v = 255.0f * in[k];
+            hist[4 * (int)(v < 255.0f ? (v > 0.0f ? v : 0.0f) : 255.0f) + k]++;
+          }
+        }
       }
     }
   }
 
+  if(partial_hists)
+  {
+    memset(dev->histogram, 0, sizeof(uint32_t) * 4 * 256);
+    for(int n = 0; n < nthreads; n++)
+      for(int k = 0; k < 4 * 256; k++) dev->histogram[k] += partial_hists[4 * 256 * n + k];
+    free(partial_hists);
+  }
+
   // TODO: Find a nicer function to map buf -> image than just clipping
   //         float factor[3];
   //         for(int k = 0; k < 3; k++)
@@ -1119,6 +1414,735 @@ static int _transform_for_blend(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
   return ret;
 }
 
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// pixels per block of a fused run, a quarter of a MB of 4 channel floats stays in the L2 cache
+#define DT_DEV_PIXELPIPE_FUSED_BLOCK ((256 << 10) / (4 * sizeof(float)))
+
+// can this piece be part of a run at all? nothing may need its own input or output: no blending, no
+// histogram or color picker and no cache shared with other pipes.
+static gboolean _runnable_piece(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                                dt_dev_pixelpipe_iop_t *piece)
+{
+  if(module == dev->gui_module) return FALSE;
+
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(bp && bp->mask_mode != DEVELOP_MASK_DISABLED) return FALSE;
+  if(piece->request_histogram & DT_REQUEST_ON) return FALSE;
+  if(_shared_cache_module(pipe, module) || _disk_cache_module(pipe, module)) return FALSE;
+
+  const int cst = module->input_colorspace(module, pipe, piece);
+  return cst != iop_cs_RAW && cst == module->output_colorspace(module, pipe, piece);
+}
+
+// the pieces of runs in the raw stage are only seen by their modules, nothing looks at their buffers in between
+static gboolean _raw_stage_piece(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!piece->enabled) return FALSE;
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(bp && bp->mask_mode != DEVELOP_MASK_DISABLED) return FALSE;
+  if(piece->request_histogram & DT_REQUEST_ON) return FALSE;
+  return module->request_color_pick == DT_REQUEST_COLORPICK_OFF;
+}
+
+// can this piece join a fused run? it has to provide process_pixels().
+static gboolean _fusable_piece(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                               dt_dev_pixelpipe_iop_t *piece)
+{
+  return module->process_pixels && _runnable_piece(pipe, dev, module, piece);
+}
+
+// with pixelpipe_fuse_pointwise a run of consecutive pointwise modules ending in the given one is applied
+// in a single pass: each thread takes a cache sized block of the input through all modules of the run, so
+// the intermediate outputs never make the round trip through memory and don't take cache lines. returns
+// -1 if there is no such run of at least two modules, the result of the recursion otherwise.
+static int _process_fused_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                              dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out, GList *modules,
+                              GList *pieces, const int pos, const uint64_t hash, const size_t bufsize)
+{
+  dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+  if(!_fusable_piece(pipe, dev, module, piece)) return -1;
+
+  const int cst = module->input_colorspace(module, pipe, piece);
+
+  // collect the run backwards. it stops at the first module which can't join, or whose output is
+  // still cached so the recursion picks it up from there.
+  GList *run = g_list_prepend(NULL, piece);
+  GList *first_module = modules, *first_piece = pieces;
+  int first_pos = pos;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  int mpos = pos - 1;
+  for(GList *m = g_list_previous(modules), *p = g_list_previous(pieces); m;
+      m = g_list_previous(m), p = g_list_previous(p), mpos--)
+  {
+    dt_iop_module_t *mod = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(!pc->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() & mod->operation_tags()))
+      continue;
+    if(!_fusable_piece(pipe, dev, mod, pc) || mod->input_colorspace(mod, pipe, pc) != cst) break;
+    if(dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                        dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, mpos)))
+      break;
+    run = g_list_prepend(run, pc);
+    first_module = m;
+    first_piece = p;
+    first_pos = mpos;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  if(!run->next)
+  {
+    g_list_free(run);
+    return -1;
+  }
+
+  // the modules of the run keep the roi, their input is the input of the run
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  for(GList *r = run; r; r = g_list_next(r))
+  {
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+    pc->processed_roi_in = pc->processed_roi_out = *roi_out;
+  }
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos - 1))
+  {
+    g_list_free(run);
+    return 1;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    g_list_free(run);
+    return 1;
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  dt_ioppr_transform_image_colorspace(module, input, input, roi_out->width, roi_out->height, input_format->cst,
+                                      cst, &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+
+  dt_iop_buffer_dsc_t dsc = *input_format;
+  for(GList *r = run; r; r = g_list_next(r))
+  {
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+    pc->dsc_in = pc->dsc_out = dsc;
+    pc->module->output_format(pc->module, pipe, pc, &pc->dsc_out);
+    dsc = pc->dsc_out;
+    // only the last module of the run has its output in the cache
+    if(pc != piece) pc->output_hash = 0;
+  }
+  pipe->dsc = dsc;
+
+  const float *const in = (const float *const)input;
+  float *const out = (float *const)*output;
+  const size_t npixels = (size_t)roi_out->width * roi_out->height;
+  const size_t block = DT_DEV_PIXELPIPE_FUSED_BLOCK;
+  const size_t nblocks = (npixels + block - 1) / block;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(block, in, nblocks, npixels, out) \
+  shared(run) \
+  schedule(static)
+#endif
+  for(size_t b = 0; b < nblocks; b++)
+  {
+    const size_t first = b * block;
+    const size_t n = MIN(block, npixels - first);
+    float *const buf = out + 4 * first;
+    memcpy(buf, in + 4 * first, sizeof(float) * 4 * n);
+    for(GList *r = run; r; r = g_list_next(r))
+    {
+      dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+      pc->module->process_pixels(pc->module, pc, buf, n);
+    }
+  }
+
+  if(dt_trace_enabled()) _trace_module(pipe, module, roi_out, start.clock, "fused", 0, 0, 0, 0);
+  dt_show_times_f(&start, "[dev_pixelpipe]", "processed %u modules up to `%s' fused on CPU [%s]",
+                  g_list_length(run), module->op, _pipe_type_to_str(pipe->type));
+
+  **out_format = pipe->dsc;
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  g_list_free(run);
+  return 0;
+}
+
+// bytes of one strip of a streamed run, a few MB go through all modules of the run while they are in
+// the last level cache
+#define DT_DEV_PIXELPIPE_STREAM_BLOCK (4 << 20)
+// the overlap of a streamed run is recomputed for every strip, beyond this it is cheaper not to stream
+#define DT_DEV_PIXELPIPE_STREAM_MAX_OVERLAP 64
+
+// can this piece join a streamed run? it has to keep the roi and work on tiles, and tell us the
+// neighbourhood it needs in overlap.
+static gboolean _streamable_piece(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                                  dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi, int *overlap)
+{
+  if(!(module->flags() & IOP_FLAGS_ALLOW_TILING) || (module->operation_tags() & IOP_TAG_DISTORT)) return FALSE;
+  if(!_runnable_piece(pipe, dev, module, piece)) return FALSE;
+
+  dt_iop_roi_t roi_in = *roi;
+  module->modify_roi_in(module, piece, roi, &roi_in);
+  if(memcmp(&roi_in, roi, sizeof(dt_iop_roi_t))) return FALSE;
+
+  dt_develop_tiling_t tiling = { 0 };
+  tiling.xalign = tiling.yalign = 1;
+  module->tiling_callback(module, piece, roi, roi, &tiling);
+  if(tiling.xalign > 1 || tiling.yalign > 1) return FALSE;
+  *overlap = tiling.overlap;
+  return TRUE;
+}
+
+typedef struct _stream_run_t
+{
+  const dt_dev_pixelpipe_iop_t *origin; // the last piece of the run, checked for cancellation
+  dt_dev_pixelpipe_iop_t **pieces;
+  int count;
+  int *margin; // rows around the strip stage k processes, the sum of the overlaps from k on
+  const float *input;
+  float *output;
+  const dt_iop_roi_t *roi;
+  int rows, strips;
+
+  dt_pthread_mutex_t lock; // protects next
+  int next;
+} _stream_run_t;
+
+typedef struct _stream_worker_t
+{
+  _stream_run_t *run;
+  // private copies, so processed_maximum of concurrent strips doesn't interfere
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t *pieces;
+  float *buf[2];
+  int processed;
+} _stream_worker_t;
+
+// takes strips off the run until there are none left. every strip goes through all modules of the run
+// on this thread, while the other workers have theirs in whatever stage they got to.
+static void *_stream_worker(void *data)
+{
+  _stream_worker_t *w = (_stream_worker_t *)data;
+  _stream_run_t *run = w->run;
+  const dt_iop_roi_t *const roi = run->roi;
+  const size_t width = roi->width;
+  const int height = roi->height;
+  const int last = run->count - 1;
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+
+  while(1)
+  {
+    dt_pthread_mutex_lock(&run->lock);
+    const int s = run->next++;
+    dt_pthread_mutex_unlock(&run->lock);
+    if(s >= run->strips) break;
+
+    // the result is going to be discarded, skip the remaining strips
+    if(dt_iop_process_cancelled(run->origin)) continue;
+
+    const int y0 = s * run->rows, y1 = MIN(y0 + run->rows, height);
+    int top = MAX(y0 - run->margin[0], 0);
+    const float *src = run->input + 4 * width * top;
+    for(int k = 0; k <= last; k++)
+    {
+      // the rows we got from the previous stage are only good inside its overlap
+      const int ntop = MAX(y0 - run->margin[k], 0), nbottom = MIN(y1 + run->margin[k], height);
+      src += 4 * width * (ntop - top);
+      top = ntop;
+
+      // the last stage writes into the output if its rows are all its own
+      float *const dst = (k == last && run->margin[k] == 0) ? run->output + 4 * width * top : w->buf[k & 1];
+      const dt_iop_roi_t sroi = { roi->x, roi->y + top, roi->width, nbottom - top, roi->scale };
+      dt_dev_pixelpipe_iop_t *pc = w->pieces + k;
+      w->pipe.dsc = pc->dsc_out;
+      pc->module->process(pc->module, pc, src, dst, &sroi, &sroi);
+      src = dst;
+    }
+    if(run->margin[last] > 0)
+      memcpy(run->output + 4 * width * y0, src + 4 * width * (y0 - top), sizeof(float) * 4 * width * (y1 - y0));
+    w->processed++;
+  }
+  return NULL;
+}
+
+// with pixelpipe_stream_tiles a run of consecutive modules which keep the roi and only need a bounded
+// neighbourhood is processed strip by strip in export and thumbnail pipes: each strip goes through all
+// modules of the run back to back and only the strip buffers are touched in between, the strips are spread
+// over the cores. the neighbourhood of later modules is computed twice on adjacent strips, like tiling does.
+// returns -1 if there is no such run of at least two modules, the result of the recursion otherwise.
+static int _process_streamed_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                 dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                                 GList *modules, GList *pieces, const int pos, const uint64_t hash,
+                                 const size_t bufsize)
+{
+  dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+  int overlap = 0;
+  if(!_streamable_piece(pipe, dev, module, piece, roi_out, &overlap)) return -1;
+
+  const int cst = module->input_colorspace(module, pipe, piece);
+
+  // collect the run backwards, like the fused run does, as long as the strips don't get mostly overlap
+  GList *run = g_list_prepend(NULL, piece);
+  GList *overlaps = g_list_prepend(NULL, GINT_TO_POINTER(overlap));
+  int total = overlap;
+  GList *first_module = modules, *first_piece = pieces;
+  int first_pos = pos;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  int mpos = pos - 1;
+  for(GList *m = g_list_previous(modules), *p = g_list_previous(pieces); m;
+      m = g_list_previous(m), p = g_list_previous(p), mpos--)
+  {
+    dt_iop_module_t *mod = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(!pc->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() & mod->operation_tags()))
+      continue;
+    if(!_streamable_piece(pipe, dev, mod, pc, roi_out, &overlap) || mod->input_colorspace(mod, pipe, pc) != cst
+       || total + overlap > DT_DEV_PIXELPIPE_STREAM_MAX_OVERLAP)
+      break;
+    if(dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                        dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, mpos)))
+      break;
+    run = g_list_prepend(run, pc);
+    overlaps = g_list_prepend(overlaps, GINT_TO_POINTER(overlap));
+    total += overlap;
+    first_module = m;
+    first_piece = p;
+    first_pos = mpos;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  const size_t width = roi_out->width;
+  const int rows = MAX((int)(DT_DEV_PIXELPIPE_STREAM_BLOCK / (4 * sizeof(float) * width)), MAX(4 * total, 16));
+  const int strips = (roi_out->height + rows - 1) / rows;
+  const int count = g_list_length(run);
+  if(count < 2 || strips < 2)
+  {
+    g_list_free(run);
+    g_list_free(overlaps);
+    return -1;
+  }
+
+  // the modules of the run keep the roi, their input is the input of the run
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  for(GList *r = run; r; r = g_list_next(r))
+  {
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+    pc->processed_roi_in = pc->processed_roi_out = *roi_out;
+  }
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos - 1))
+  {
+    g_list_free(run);
+    g_list_free(overlaps);
+    return 1;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    g_list_free(run);
+    g_list_free(overlaps);
+    return 1;
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  dt_ioppr_transform_image_colorspace(module, input, input, roi_out->width, roi_out->height, input_format->cst,
+                                      cst, &input_format->cst, dt_ioppr_get_pipe_work_profile_info(pipe));
+
+  _stream_run_t srun = { .origin = piece, .count = count, .input = (const float *)input,
+                         .output = (float *)*output, .roi = roi_out, .rows = rows, .strips = strips, .next = 0 };
+  srun.pieces = (dt_dev_pixelpipe_iop_t **)malloc(sizeof(dt_dev_pixelpipe_iop_t *) * count);
+  srun.margin = (int *)malloc(sizeof(int) * count);
+  dt_iop_buffer_dsc_t dsc = *input_format;
+  int k = 0, margin = total;
+  for(GList *r = run, *o = overlaps; r; r = g_list_next(r), o = g_list_next(o), k++)
+  {
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+    pc->dsc_in = pc->dsc_out = dsc;
+    pc->module->output_format(pc->module, pipe, pc, &pc->dsc_out);
+    dsc = pc->dsc_out;
+    // only the last module of the run has its output in the cache
+    if(pc != piece) pc->output_hash = 0;
+    srun.pieces[k] = pc;
+    srun.margin[k] = margin;
+    margin -= GPOINTER_TO_INT(o->data);
+  }
+  pipe->dsc = dsc;
+  dt_pthread_mutex_init(&srun.lock, NULL);
+
+  // every worker has two strip buffers, the extra ones need room next to the caches
+  const size_t strip_size = sizeof(float) * 4 * width * (rows + 2 * total);
+  int workers = MIN(dt_get_num_threads(), strips);
+  while(workers > 1 && !dt_memory_governor_request((workers - 1) * 2 * strip_size)) workers--;
+  _stream_worker_t *w = (_stream_worker_t *)calloc(workers, sizeof(_stream_worker_t));
+  int ready = 0;
+  for(; ready < workers; ready++)
+  {
+    w[ready].run = &srun;
+    w[ready].pipe = *pipe;
+    w[ready].pipe.tiling = 1;
+    w[ready].pieces = (dt_dev_pixelpipe_iop_t *)malloc(sizeof(dt_dev_pixelpipe_iop_t) * count);
+    w[ready].buf[0] = dt_alloc_align(64, strip_size);
+    w[ready].buf[1] = dt_alloc_align(64, strip_size);
+    if(!w[ready].pieces || !w[ready].buf[0] || !w[ready].buf[1])
+    {
+      free(w[ready].pieces);
+      dt_free_align(w[ready].buf[0]);
+      dt_free_align(w[ready].buf[1]);
+      break;
+    }
+    for(int j = 0; j < count; j++)
+    {
+      w[ready].pieces[j] = *srun.pieces[j];
+      w[ready].pieces[j].pipe = &w[ready].pipe;
+    }
+  }
+
+  int res = 0;
+  if(ready == 0)
+    res = 1;
+  else
+  {
+    /* the first worker runs on our own thread */
+    pthread_t *threads = (pthread_t *)calloc(ready, sizeof(pthread_t));
+    int *started = (int *)calloc(ready, sizeof(int));
+    for(int j = 1; j < ready; j++) started[j] = !dt_pthread_create(&threads[j], _stream_worker, w + j);
+#ifdef _OPENMP
+    const int omp_threads = omp_get_max_threads();
+#endif
+    _stream_worker(w);
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads);
+#endif
+    for(int j = 1; j < ready; j++)
+      if(started[j]) pthread_join(threads[j], NULL);
+    free(threads);
+    free(started);
+
+    // all strips come to the same maximum
+    for(int j = 0; j < ready; j++)
+      if(w[j].processed)
+      {
+        for(int c = 0; c < 4; c++) pipe->dsc.processed_maximum[c] = w[j].pipe.dsc.processed_maximum[c];
+        break;
+      }
+  }
+
+  for(int j = 0; j < ready; j++)
+  {
+    free(w[j].pieces);
+    dt_free_align(w[j].buf[0]);
+    dt_free_align(w[j].buf[1]);
+  }
+  free(w);
+  dt_pthread_mutex_destroy(&srun.lock);
+  free(srun.pieces);
+  free(srun.margin);
+  g_list_free(run);
+  g_list_free(overlaps);
+
+  // scratch memory does not outlive process()
+  dt_dev_pixelpipe_arena_reset(pipe->arena);
+
+  if(res || dt_iop_process_cancelled(piece))
+  {
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  if(dt_trace_enabled()) _trace_module(pipe, module, roi_out, start.clock, "streamed", 0, 0, 0, 0);
+  dt_show_times_f(&start, "[dev_pixelpipe]", "processed %d modules up to `%s' in %d strips on %d threads [%s]",
+                  count, module->op, strips, ready, _pipe_type_to_str(pipe->type));
+
+  **out_format = pipe->dsc;
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+typedef struct _raw_run_t
+{
+  const dt_dev_pixelpipe_iop_t *origin; // the last piece of the run, checked for cancellation
+  dt_dev_pixelpipe_iop_t **pieces;      // rawprepare first
+  int count;
+  const uint8_t *input;
+  size_t in_bpp;
+  float *output;
+  const dt_iop_roi_t *roi_in, *roi_out; // of rawprepare, the others keep roi_out
+  dt_iop_buffer_dsc_t dsc;              // the input of the run
+  int rows, strips;
+
+  dt_pthread_mutex_t lock; // protects next
+  int next;
+} _raw_run_t;
+
+typedef struct _raw_worker_t
+{
+  _raw_run_t *run;
+  // private copies, for the updates of the dsc by every strip
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t *pieces;
+  int processed;
+} _raw_worker_t;
+
+// rawprepare writes the strip into the output, the pointwise modules after it work on it in place while it
+// is in the cache
+static void *_raw_worker(void *data)
+{
+  _raw_worker_t *w = (_raw_worker_t *)data;
+  _raw_run_t *run = w->run;
+  const dt_iop_roi_t *const roi_in = run->roi_in, *const roi_out = run->roi_out;
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+
+  while(1)
+  {
+    dt_pthread_mutex_lock(&run->lock);
+    const int s = run->next++;
+    dt_pthread_mutex_unlock(&run->lock);
+    if(s >= run->strips) break;
+
+    if(dt_iop_process_cancelled(run->origin)) continue;
+
+    const int top = s * run->rows, rows = MIN(run->rows, roi_out->height - top);
+    const dt_iop_roi_t sroi_in
+        = { roi_in->x, roi_in->y + top, roi_in->width, rows + roi_in->height - roi_out->height, roi_in->scale };
+    const dt_iop_roi_t sroi_out = { roi_out->x, roi_out->y + top, roi_out->width, rows, roi_out->scale };
+    const void *src = run->input + run->in_bpp * roi_in->width * top;
+    float *const dst = run->output + (size_t)roi_out->width * top;
+
+    // every module updates the dsc the next one sees, as in the recursion
+    dt_iop_buffer_dsc_t dsc = run->dsc;
+    for(int k = 0; k < run->count; k++)
+    {
+      dt_dev_pixelpipe_iop_t *pc = w->pieces + k;
+      pc->dsc_in = pc->dsc_out = dsc;
+      pc->module->output_format(pc->module, &w->pipe, pc, &pc->dsc_out);
+      w->pipe.dsc = pc->dsc_out;
+      pc->module->process(pc->module, pc, k ? dst : src, dst, k ? &sroi_out : &sroi_in, &sroi_out);
+      dsc = w->pipe.dsc;
+    }
+    w->processed++;
+  }
+  return NULL;
+}
+
+// the pointwise modules right after rawprepare (white balance, highlight clipping) are applied to the mosaic
+// in the same pass, strip by strip, so the raw is read and written once instead of once per module. the
+// outputs are the same as those of the recursion, only the one of the last module is in the cache. returns
+// -1 if there is no such run, the result of the recursion otherwise.
+static int _process_fused_raw_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                  dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                                  GList *modules, GList *pieces, const int pos, const uint64_t hash,
+                                  const size_t bufsize)
+{
+  dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+  if(!piece->process_pointwise || module == dev->gui_module || !_raw_stage_piece(pipe, module, piece)) return -1;
+  // the preview pipes start from a downscaled buffer
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return -1;
+  if(!pipe->image.buf_dsc.filters || pipe->image.buf_dsc.channels != 1) return -1;
+
+  // walk back to rawprepare, every enabled module on the way has to be pointwise and uncached
+  GList *run = g_list_prepend(NULL, piece);
+  GList *first_module = NULL, *first_piece = NULL;
+  int first_pos = 0;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  int mpos = pos - 1;
+  for(GList *m = g_list_previous(modules), *p = g_list_previous(pieces); m;
+      m = g_list_previous(m), p = g_list_previous(p), mpos--)
+  {
+    dt_iop_module_t *mod = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(!pc->enabled) continue;
+    if((dev->gui_module && dev->gui_module->operation_tags_filter() & mod->operation_tags())
+       || mod == dev->gui_module || !_raw_stage_piece(pipe, mod, pc))
+      break;
+    if(dt_dev_pixelpipe_cache_available(&(pipe->cache),
+                                        dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, mpos)))
+      break;
+    run = g_list_prepend(run, pc);
+    if(!strcmp(mod->op, "rawprepare"))
+    {
+      first_module = m;
+      first_piece = p;
+      first_pos = mpos;
+      break;
+    }
+    if(!pc->process_pointwise) break;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  // full rows, a multiple of 16 of them keeps the start of every strip as aligned as the buffer
+  const size_t width = roi_out->width;
+  const int rows = MAX((int)(DT_DEV_PIXELPIPE_STREAM_BLOCK / (sizeof(float) * width)) & ~15, 16);
+  const int strips = (roi_out->height + rows - 1) / rows;
+  if(!first_module || strips < 2)
+  {
+    g_list_free(run);
+    return -1;
+  }
+
+  dt_iop_module_t *head = (dt_iop_module_t *)first_module->data;
+  dt_dev_pixelpipe_iop_t *head_piece = (dt_dev_pixelpipe_iop_t *)first_piece->data;
+  dt_iop_roi_t roi_in = *roi_out;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  head->modify_roi_in(head, head_piece, roi_out, &roi_in);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  head_piece->processed_roi_in = roi_in;
+  head_piece->processed_roi_out = *roi_out;
+  for(GList *r = g_list_next(run); r; r = g_list_next(r))
+  {
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+    pc->processed_roi_in = pc->processed_roi_out = *roi_out;
+  }
+
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &roi_in,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos - 1))
+  {
+    g_list_free(run);
+    return 1;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    g_list_free(run);
+    return 1;
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  const int count = g_list_length(run);
+  _raw_run_t rrun = { .origin = piece, .count = count, .input = (const uint8_t *)input,
+                      .in_bpp = dt_iop_buffer_dsc_to_bpp(input_format), .output = (float *)*output,
+                      .roi_in = &roi_in, .roi_out = roi_out, .dsc = *input_format, .rows = rows,
+                      .strips = strips, .next = 0 };
+  rrun.pieces = (dt_dev_pixelpipe_iop_t **)malloc(sizeof(dt_dev_pixelpipe_iop_t *) * count);
+  int k = 0;
+  for(GList *r = run; r; r = g_list_next(r), k++)
+  {
+    dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)r->data;
+    // only the last module of the run has its output in the cache
+    if(pc != piece) pc->output_hash = 0;
+    rrun.pieces[k] = pc;
+  }
+  dt_pthread_mutex_init(&rrun.lock, NULL);
+
+  const int workers = MIN(dt_get_num_threads(), strips);
+  _raw_worker_t *w = (_raw_worker_t *)calloc(workers, sizeof(_raw_worker_t));
+  int ready = 0;
+  for(; ready < workers; ready++)
+  {
+    w[ready].run = &rrun;
+    w[ready].pipe = *pipe;
+    w[ready].pipe.tiling = 1;
+    w[ready].pieces = (dt_dev_pixelpipe_iop_t *)malloc(sizeof(dt_dev_pixelpipe_iop_t) * count);
+    if(!w[ready].pieces) break;
+    for(int j = 0; j < count; j++)
+    {
+      w[ready].pieces[j] = *rrun.pieces[j];
+      w[ready].pieces[j].pipe = &w[ready].pipe;
+    }
+  }
+
+  int res = 0;
+  if(ready == 0)
+    res = 1;
+  else
+  {
+    /* the first worker runs on our own thread */
+    pthread_t *threads = (pthread_t *)calloc(ready, sizeof(pthread_t));
+    int *started = (int *)calloc(ready, sizeof(int));
+    for(int j = 1; j < ready; j++) started[j] = !dt_pthread_create(&threads[j], _raw_worker, w + j);
+#ifdef _OPENMP
+    const int omp_threads = omp_get_max_threads();
+#endif
+    _raw_worker(w);
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads);
+#endif
+    for(int j = 1; j < ready; j++)
+      if(started[j]) pthread_join(threads[j], NULL);
+    free(threads);
+    free(started);
+
+    // all strips come to the same formats, hand those of one of them back to the pipe
+    for(int j = 0; j < ready; j++)
+      if(w[j].processed)
+      {
+        for(int c = 0; c < count; c++)
+        {
+          rrun.pieces[c]->dsc_in = w[j].pieces[c].dsc_in;
+          rrun.pieces[c]->dsc_out = w[j].pieces[c].dsc_out;
+        }
+        pipe->dsc = w[j].pipe.dsc;
+        break;
+      }
+  }
+
+  for(int j = 0; j < ready; j++) free(w[j].pieces);
+  free(w);
+  dt_pthread_mutex_destroy(&rrun.lock);
+  free(rrun.pieces);
+  g_list_free(run);
+
+  // scratch memory does not outlive process()
+  dt_dev_pixelpipe_arena_reset(pipe->arena);
+
+  if(res || dt_iop_process_cancelled(piece))
+  {
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  if(dt_trace_enabled()) _trace_module(pipe, module, roi_out, start.clock, "fused", 0, 0, 0, 0);
+  dt_show_times_f(&start, "[dev_pixelpipe]", "processed %d raw modules up to `%s' fused in %d strips [%s]",
+                  count, module->op, strips, _pipe_type_to_str(pipe->type));
+
+  **out_format = pipe->dsc;
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
@@ -1163,18 +2187,53 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
     cache_available = dt_dev_pixelpipe_cache_available(&(pipe->cache), hash);
   }
+  if(piece) piece->output_hash = hash;
   if(cache_available)
   {
     // if(module) printf("found valid buf pos %d in cache for module %s %s %lu\n", pos, module->op, pipe ==
     // dev->preview_pipe ? "[preview]" : "", hash);
 
     (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+#ifdef HAVE_OPENCL
+    // a copy left on the device saves the consumer the upload, and is the only one for host_stale lines
+    *cl_mem_output = dt_dev_pixelpipe_cache_checkout_gpu(&(pipe->cache), *output);
+#endif
 
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(!modules) return 0;
+    if(dt_trace_enabled()) _trace_module(pipe, module, roi_out, dt_get_wtime(), "hit", 0, 0, 0, 0);
     // go to post-collect directly:
     goto post_process_collect_info;
   }
+  else if(hash && _shared_cache_module(pipe, module)
+          && dt_dev_pixelpipe_shared_cache_available(darktable.pixelpipe_cache, _shared_cache_key(pipe, hash)))
+  {
+    // another pipe already computed this, take a copy into our own cache line
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    if(!dt_dev_pixelpipe_shared_cache_fetch(darktable.pixelpipe_cache, _shared_cache_key(pipe, hash), *output,
+                                            bufsize, *out_format))
+    {
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      goto post_process_collect_info;
+    }
+    // evicted in the meantime, don't leave a line with garbage behind
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
+  else if(hash && _disk_cache_module(pipe, module))
+  {
+    // a previous export of this image left the buffer on disk, since the recursion
+    // starts at the end of the pipe this resumes from the deepest stored stage.
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    if(!dt_dev_pixelpipe_disk_cache_load(_disk_cache_key(pipe, hash), *output, bufsize, *out_format))
+    {
+      dt_print(DT_DEBUG_DEV, "[dev_pixelpipe] resuming from on-disk output of `%s'\n", module->op);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      goto post_process_collect_info;
+    }
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
   else
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
@@ -1252,6 +2311,30 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   {
     // 3b) recurse and obtain output array in &input
 
+    // the pointwise modules of the raw stage go with rawprepare in one pass
+    if(pipe->devid < 0 && !pipe->raw_uint16 && !(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY))
+    {
+      const int fused = _process_fused_raw_run(pipe, dev, output, out_format, roi_out, modules, pieces, pos,
+                                               hash, bufsize);
+      if(fused >= 0) return fused;
+    }
+
+    // a run of pointwise modules ending here is processed in one pass
+    if(pipe->fuse_pointwise && !(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY))
+    {
+      const int fused = _process_fused_run(pipe, dev, output, out_format, roi_out, modules, pieces, pos, hash,
+                                           bufsize);
+      if(fused >= 0) return fused;
+    }
+
+    // so is a run of modules with a bounded neighbourhood, strip by strip
+    if(pipe->stream_tiles && !(pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY))
+    {
+      const int streamed = _process_streamed_run(pipe, dev, output, out_format, roi_out, modules, pieces, pos,
+                                                 hash, bufsize);
+      if(streamed >= 0) return streamed;
+    }
+
     // get region of interest which is needed in input
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     if(pipe->shutdown)
@@ -1318,6 +2401,15 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     dt_times_t start;
     dt_get_times(&start);
+    size_t to_device_start, from_device_start;
+    _trace_transfers(pipe, &to_device_start, &from_device_start);
+    if(pipe->devid >= 0 && dt_trace_enabled())
+    {
+      char owner[64];
+      snprintf(owner, sizeof(owner), "%s%s%s", module->op, module->multi_name[0] ? " " : "",
+               module->multi_name);
+      dt_opencl_events_set_owner(pipe->devid, owner, _pipe_type_to_str(pipe->type));
+    }
 
     dt_pixelpipe_flow_t pixelpipe_flow = (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
 
@@ -1380,6 +2472,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       tiling.overhead = fmax(tiling.overhead, tiling_blendop.overhead);
     }
 
+    dt_tiling_calibration_apply(module, &tiling);
+
     /* remark: we do not do tiling for blendop step, neither in opencl nor on cpu. if overall tiling
        requirements (maximum of module and blendop) require tiling for opencl path, then following blend
        step is anyhow done on cpu. we assume that blending itself will never require tiling in cpu path,
@@ -1387,12 +2481,26 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     assert(tiling.factor > 0.0f);
 
+    // the module's scratch planes on top of input and output come from the arena
+    dt_dev_pixelpipe_arena_reserve(pipe->arena,
+                                   (size_t)(MAX(0.0f, tiling.factor - 2.0f)
+                                            * MAX(in_bpp * roi_in.width * roi_in.height, bufsize))
+                                       + tiling.overhead);
+
     if(pipe->shutdown)
     {
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 1;
     }
 
+    dt_tiling_calibration_t calibration;
+#ifdef HAVE_OPENCL
+    dt_tiling_calibration_begin(pipe, cl_mem_input ? dt_opencl_get_mem_object_size(cl_mem_input) : 0,
+                                &calibration);
+#else
+    dt_tiling_calibration_begin(pipe, 0, &calibration);
+#endif
+
 #ifdef HAVE_OPENCL
     /* do we have opencl at all? did user tell us to use it? did we get a resource? */
     if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0)
@@ -1419,7 +2527,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       if(module->process_cl && piece->process_cl_ready
          && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW || pipe->type == DT_DEV_PIXELPIPE_PREVIEW2)
               && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL))
-         && (fits_on_device || piece->process_tiling_ready))
+         && (fits_on_device || piece->process_tiling_ready)
+         && !dt_opencl_affinity_prefer_cpu(pipe->devid, module->op, roi_in.width, roi_in.height))
       {
 
         // fprintf(stderr, "[opencl_pixelpipe 0] factor %f, overhead %d, width %d, height %d, bpp %d\n",
@@ -1841,8 +2950,19 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             }
           }
 
-          /* we can now release cl_mem_input */
-          dt_opencl_release_mem_object(cl_mem_input);
+          /* we can now release cl_mem_input, unless the cache keeps it on the device for the next run */
+          // (a host copy in another colorspace than the device one can't share its cache line)
+          if((valid_input_on_gpu_only || input_cst_cl == input_format->cst)
+             && dt_dev_pixelpipe_cache_keep_gpu(&(pipe->cache), input, cl_mem_input,
+                                                (size_t)in_bpp * roi_in.width * roi_in.height,
+                                                !valid_input_on_gpu_only))
+          {
+            // the line is valid again, through its device copy
+            valid_input_on_gpu_only = FALSE;
+            input_format->cst = input_cst_cl;
+          }
+          else
+            dt_opencl_release_mem_object(cl_mem_input);
           cl_mem_input = NULL;
           // we speculate on the next plug-in to possibly copy back cl_mem_output to output,
           // so we're not just yet invalidating the (empty) output cache line.
@@ -1852,6 +2972,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           /* Bad luck, opencl failed. Let's clean up and fall back to cpu module */
           dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] could not run module '%s' on gpu. falling back to cpu path\n",
                    module->op);
+          dt_metrics_count(DT_METRICS_OPENCL_MODULE_FALLBACKS, 1);
 
           // fprintf(stderr, "[opencl_pixelpipe 4] module '%s' running on cpu\n", module->op);
 
@@ -1937,7 +3058,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
           /* process module on cpu. use tiling if needed and possible. */
           if(piece->process_tiling_ready
-             && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
+             && !dt_tiling_piece_fits_host_memory(piece, input, *output, MAX(roi_in.width, roi_out->width),
                                                   MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                                   tiling.factor, tiling.overhead))
           {
@@ -2092,7 +3213,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
         /* process module on cpu. use tiling if needed and possible. */
         if(piece->process_tiling_ready
-           && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
+           && !dt_tiling_piece_fits_host_memory(piece, input, *output, MAX(roi_in.width, roi_out->width),
                                                 MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                                 tiling.factor, tiling.overhead))
         {
@@ -2210,7 +3331,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
       /* process module on cpu. use tiling if needed and possible. */
       if(piece->process_tiling_ready
-         && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
+         && !dt_tiling_piece_fits_host_memory(piece, input, *output, MAX(roi_in.width, roi_out->width),
                                               MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                               tiling.factor, tiling.overhead))
       {
@@ -2316,7 +3437,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     /* process module on cpu. use tiling if needed and possible. */
     if(piece->process_tiling_ready
-       && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
+       && !dt_tiling_piece_fits_host_memory(piece, input, *output, MAX(roi_in.width, roi_out->width),
                                             MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                             tiling.factor, tiling.overhead))
     {
@@ -2382,6 +3503,38 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
 #endif // HAVE_OPENCL
 
+    dt_tiling_calibration_end(module, piece, &calibration, &roi_in, roi_out, MAX(in_bpp, bpp), &tiling,
+                              (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU) != 0,
+                              (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING) != 0);
+
+    // scratch memory does not outlive process()
+    dt_dev_pixelpipe_arena_reset(pipe->arena);
+
+    if(dt_trace_enabled())
+      _trace_module(pipe, module, roi_out, start.clock, "miss", pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU,
+                    pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING, to_device_start, from_device_start);
+
+    // the module may have stopped early on dt_iop_process_cancelled(): the output is incomplete
+    // and must neither stay in the cache nor be offered to the other pipes.
+    if(dt_iop_process_cancelled(piece))
+    {
+      dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+
+#ifdef HAVE_OPENCL
+    // learn which device suits this module best, see dt_opencl_affinity_prefer_cpu()
+    if(pipe->devid >= 0 && darktable.opencl->scheduling_profile == OPENCL_PROFILE_ADAPTIVE)
+    {
+      const int on_gpu = (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU) != 0;
+      // kernels run asynchronously, wait for them to see what the module really costs
+      if(on_gpu) dt_opencl_finish(pipe->devid);
+      dt_opencl_affinity_record(pipe->devid, module->op, roi_in.width, roi_in.height, on_gpu,
+                                dt_get_wtime() - start.clock);
+    }
+#endif
+
     char histogram_log[32] = "";
     if(!(pixelpipe_flow & PIXELPIPE_FLOW_HISTOGRAM_NONE))
     {
@@ -2391,6 +3544,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                     : pixelpipe_flow & PIXELPIPE_FLOW_HISTOGRAM_ON_CPU ? "CPU" : ""));
     }
 
+    dt_metrics_observe_module(module->op, dt_get_wtime() - start.clock);
     gchar *module_label = dt_history_item_get_name(module);
     dt_show_times_f(
         &start, "[dev_pixelpipe]", "processed `%s' on %s%s%s, blended on %s [%s]", module_label,
@@ -2414,9 +3568,25 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(module == darktable.develop->gui_module)
     {
-      // give the input buffer to the currently focused plugin more weight.
-      // the user is likely to change that one soon, so keep it in cache.
-      dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
+      // the user is likely to change the currently focused plugin soon, so keep its input
+      // in cache for the next run to restart from.
+      dt_dev_pixelpipe_cache_pin_data(&(pipe->cache), input);
+    }
+    // offer early results to the other pipes, if they are on the host
+    if(_shared_cache_module(pipe, module)
+#ifdef HAVE_OPENCL
+       && *cl_mem_output == NULL
+#endif
+      )
+      dt_dev_pixelpipe_shared_cache_store(darktable.pixelpipe_cache, _shared_cache_key(pipe, hash), *output,
+                                          bufsize, *out_format);
+    if(_disk_cache_module(pipe, module))
+    {
+#ifdef HAVE_OPENCL
+      if(*cl_mem_output != NULL)
+        dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height, bpp);
+#endif
+      dt_dev_pixelpipe_disk_cache_store(_disk_cache_key(pipe, hash), *output, bufsize, *out_format);
     }
 #ifndef _DEBUG
     if(darktable.unmuted & DT_DEBUG_NAN)
@@ -2519,7 +3689,9 @@ post_process_collect_info:
     if(dev->gui_attached && pipe == dev->preview_pipe && (strcmp(module->op, "gamma") == 0)
        && darktable.lib->proxy.colorpicker.live_samples && input) // samples to pick
     {
-      _pixelpipe_pick_live_samples((const float *const )input, &roi_in);
+      // the preview doesn't hash gamma above, it is never taken from the cache
+      _pixelpipe_pick_live_samples((const float *const )input, &roi_in,
+                                   dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos));
     }
     // Picking RGB for primary colorpicker output and converting to Lab
     if(dev->gui_attached && pipe == dev->preview_pipe
@@ -2560,20 +3732,16 @@ post_process_collect_info:
           input_tmp[i + 3] = 0.f;
         }
 
-        _pixelpipe_final_histogram(dev, (const float *const)input_tmp, roi_out);
+        _pixelpipe_final_histogram(dev, (const float *const)input_tmp, roi_out, FALSE);
 
         dt_free_align(input_tmp);
       }
       else
-        _pixelpipe_final_histogram(dev, (const float *const)input, &roi_in);
-
-      // this HAS to be done on the float input data, otherwise we get really ugly artifacts due to rounding
-      // issues when putting colors into the bins.
-      // FIXME: is above comment true now that waveform is scaled via Cairo?
-      if(input && dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
-      {
-        _pixelpipe_final_histogram_waveform(dev, (const float *const )input, &roi_in);
-      }
+        // the waveform HAS to be done on the float input data, otherwise we get really ugly artifacts due to
+        // rounding issues when putting colors into the bins.
+        // FIXME: is above comment true now that waveform is scaled via Cairo?
+        _pixelpipe_final_histogram(dev, (const float *const)input, &roi_in,
+                                   dev->scope_type == DT_DEV_SCOPE_WAVEFORM);
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
     }
@@ -2681,13 +3849,89 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 }
 
 
+static inline uint64_t _piece_clean_hash(const dt_dev_pixelpipe_iop_t *piece)
+{
+  return piece->enabled ? piece->hash : 0;
+}
+
+// finds the first node changed since the last finished run and pins the cached output of the last clean
+// node before it, so this and the following runs restart from there rather than from whatever the
+// recency weights of the cache left over.
+static void _pin_last_clean_node(dt_dev_pixelpipe_t *pipe)
+{
+  uint64_t clean_output = 0;
+  const char *clean_op = NULL;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(_piece_clean_hash(piece) != piece->clean_hash)
+    {
+      if(clean_output && dt_dev_pixelpipe_cache_available(&pipe->cache, clean_output))
+      {
+        dt_dev_pixelpipe_cache_pin(&pipe->cache, clean_output);
+        dt_print(DT_DEBUG_DEV, "[pixelpipe_process] [%s] `%s' changed, restarting after `%s'\n",
+                 _pipe_type_to_str(pipe->type), piece->module->op, clean_op);
+      }
+      return;
+    }
+    if(piece->enabled && piece->output_hash)
+    {
+      clean_output = piece->output_hash;
+      clean_op = piece->module->op;
+    }
+  }
+}
+
+static void _mark_nodes_clean(dt_dev_pixelpipe_t *pipe)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece->clean_hash = _piece_clean_hash(piece);
+  }
+}
+
+// can the mosaic stay uint16 from rawprepare up to demosaic? every module of the raw stage in between has to
+// take it, and nothing may look at the buffers but the modules themselves.
+static gboolean _raw_uint16_pipe(dt_dev_pixelpipe_t *pipe)
+{
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL)))
+    return FALSE;
+  const dt_iop_buffer_dsc_t *const dsc = &pipe->image.buf_dsc;
+  if(!dsc->filters || dsc->channels != 1 || dsc->datatype != TYPE_UINT16) return FALSE;
+
+  gboolean raw_stage = FALSE;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    const gboolean first = !strcmp(module->op, "rawprepare"), last = !strcmp(module->op, "demosaic");
+    if(first) raw_stage = TRUE;
+    if(!raw_stage) continue;
+
+    if((first || last || piece->enabled) && (!_raw_stage_piece(pipe, module, piece) || !piece->process_uint16_ready))
+      return FALSE;
+    if(last) return TRUE;
+  }
+  return FALSE;
+}
+
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
   pipe->processing = 1;
+  // an aborted run may have left scratch allocations behind
+  dt_dev_pixelpipe_arena_reset(pipe->arena);
   pipe->opencl_enabled = dt_opencl_update_settings(); // update enabled flag and profile from preferences
   pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
                                        : -1; // try to get/lock opencl resource
+  // fused runs are done on the host, the OpenCL path keeps one kernel per module
+  pipe->fuse_pointwise = pipe->devid < 0 && dt_conf_get_bool("pixelpipe_fuse_pointwise");
+  // streamed runs hand copies of the pipe to their workers, which the darkroom pipes can't take
+  pipe->stream_tiles = pipe->devid < 0 && (pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))
+                       && dt_conf_get_bool("pixelpipe_stream_tiles");
+  // the image formats of the OpenCL path are float only
+  pipe->raw_uint16 = pipe->devid < 0 && dt_conf_get_bool("pixelpipe_raw_uint16") && _raw_uint16_pipe(pipe);
 
   dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n", _pipe_type_to_str(pipe->type),
            pipe->devid);
@@ -2698,7 +3942,14 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
     dt_print_mem_usage();
   }
 
-  if(pipe->devid >= 0) dt_opencl_events_reset(pipe->devid);
+  if(pipe->devid >= 0)
+  {
+    dt_opencl_events_reset(pipe->devid);
+    dt_opencl_events_set_owner(pipe->devid, NULL, _pipe_type_to_str(pipe->type));
+  }
+#ifdef HAVE_OPENCL
+  dt_dev_pixelpipe_cache_gpu_reset(&pipe->cache, pipe->devid, _gpu_cache_memory(pipe));
+#endif
 
   dt_iop_roi_t roi = (dt_iop_roi_t){ x, y, width, height, scale };
   // printf("pixelpipe homebrew process start\n");
@@ -2720,6 +3971,10 @@ restart:
   if(pipe->cache_obsolete) dt_dev_pixelpipe_cache_flush(&(pipe->cache));
   pipe->cache_obsolete = 0;
 
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  _pin_last_clean_node(pipe);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
   // mask display off as a starting point
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   // and blendif active
@@ -2770,6 +4025,7 @@ restart:
     dt_dev_pixelpipe_change(pipe, dev);
     dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] falling back to cpu path\n",
              _pipe_type_to_str(pipe->type));
+    dt_metrics_count(DT_METRICS_OPENCL_PIPE_FALLBACKS, 1);
     goto restart; // try again (this time without opencl)
   }
 
@@ -2791,6 +4047,12 @@ restart:
     return 1;
   }
 
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  _mark_nodes_clean(pipe);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
+  dt_dev_pixelpipe_arena_reset(pipe->arena);
+
   // terminate
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
   pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
@@ -2802,17 +4064,30 @@ restart:
     pipe->type == DT_DEV_PIXELPIPE_FULL ||
     pipe->type == DT_DEV_PIXELPIPE_PREVIEW2)
   {
-    if(pipe->output_backbuf == NULL || pipe->output_backbuf_width != pipe->backbuf_width || pipe->output_backbuf_height != pipe->backbuf_height)
+    const size_t size = (size_t)width * height * 4 * sizeof(uint8_t);
+    // take the pixels out of the cache rather than copying them, its line gets the previous display
+    // buffer in return. the display is never taken from the cache, the gamma output is cheap to redo.
+    void *display = pipe->output_backbuf;
+    size_t display_size = pipe->output_backbuf_size;
+    if(dt_dev_pixelpipe_cache_exchange(&pipe->cache, buf, &display, &display_size))
     {
-      g_free(pipe->output_backbuf);
-      pipe->output_backbuf_width = pipe->backbuf_width;
-      pipe->output_backbuf_height = pipe->backbuf_height;
-      pipe->output_backbuf = g_malloc0((size_t)pipe->output_backbuf_width * pipe->output_backbuf_height * 4 * sizeof(uint8_t));
+      pipe->backbuf = pipe->output_backbuf = display;
+      pipe->output_backbuf_size = display_size;
     }
-
-    if(pipe->output_backbuf)
-      memcpy(pipe->output_backbuf, pipe->backbuf, (size_t)pipe->output_backbuf_width * pipe->output_backbuf_height * 4 * sizeof(uint8_t));
+    else
+    {
+      if(pipe->output_backbuf == NULL || pipe->output_backbuf_size < size)
+      {
+        dt_free_align(pipe->output_backbuf);
+        pipe->output_backbuf = dt_alloc_align(64, size);
+        pipe->output_backbuf_size = pipe->output_backbuf ? size : 0;
+      }
+      if(pipe->output_backbuf) memcpy(pipe->output_backbuf, pipe->backbuf, size);
+    }
+    pipe->output_backbuf_width = width;
+    pipe->output_backbuf_height = height;
     pipe->output_imgid = pipe->image.id;
+    pipe->output_backbuf_coarse = pipe->coarse;
   }
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
@@ -2938,6 +4213,41 @@ float *dt_dev_get_raster_mask(const dt_dev_pixelpipe_t *pipe, const dt_iop_modul
   return raster_mask;
 }
 
+void dt_dev_release_raster_mask(dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *raster_mask_source,
+                                const int raster_mask_id, const dt_iop_module_t *target_module)
+{
+  // the darkroom runs modules again from cached inputs, and masks written out by the format are
+  // only taken at the end
+  if(!raster_mask_source || !(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))
+     || pipe->store_all_raster_masks)
+    return;
+
+  dt_dev_pixelpipe_iop_t *source_piece = NULL;
+  gboolean after_target = FALSE;
+  for(GList *iter = pipe->nodes; iter; iter = g_list_next(iter))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)iter->data;
+    if(piece->module == raster_mask_source)
+      source_piece = piece;
+    else if(piece->module == target_module)
+      after_target = TRUE;
+    else if(after_target && piece->enabled)
+    {
+      // is there another user still to come?
+      gpointer id;
+      if(g_hash_table_lookup_extended(raster_mask_source->raster_mask.source.users, piece->module, NULL, &id)
+         && GPOINTER_TO_INT(id) == raster_mask_id)
+        return;
+    }
+  }
+
+  if(source_piece && g_hash_table_remove(source_piece->raster_masks, GINT_TO_POINTER(raster_mask_id)))
+  {
+    // a later run taking the consumers' inputs from the cache would find the mask gone
+    pipe->cache_obsolete = 1;
+  }
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -24,6 +24,7 @@
 #include "control/conf.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/pixelpipe_cache.h"
 
 /**
@@ -58,6 +59,8 @@ typedef struct dt_dev_pixelpipe_iop_t
   float iscale;        // input actually just downscaled buffer? iscale*iwidth = actual width
   int iwidth, iheight; // width and height of input buffer
   uint64_t hash;       // hash of params and enabled.
+  uint64_t clean_hash;  // hash as of the last finished run, to find the first changed node
+  uint64_t output_hash; // cache hash of the output of the last run, 0 if not known
   int bpc;             // bits per channel, 32 means float
   int colors;          // how many colors per pixel
   dt_iop_roi_t buf_in,
@@ -65,6 +68,8 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t processed_roi_in, processed_roi_out; // the actual roi that was used for processing the piece
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   int process_tiling_ready;   // set this to 0 in commit_params to temporarily disable tiling
+  int process_uint16_ready;   // set this to 1 in commit_params if process() takes a uint16 raw mosaic
+  int process_pointwise;      // set this to 1 in commit_params if process() only looks at the pixel itself
 
   // the following are used internally for caching:
   dt_iop_buffer_dsc_t dsc_in, dsc_out;
@@ -109,6 +114,10 @@ typedef struct dt_dev_pixelpipe_t
 
   // instances of pixelpipe, stored in GList of dt_dev_pixelpipe_iop_t
   GList *nodes;
+  // scratch memory for process(), see dt_dev_pixelpipe_scratch_alloc(). NULL if disabled.
+  dt_dev_pixelpipe_arena_t *arena;
+  // registration with the memory governor, see common/memory_governor.h
+  struct dt_memory_client_t *memory_client;
   // event flag
   dt_dev_pixelpipe_change_t changed;
   // backbuffer (output)
@@ -121,8 +130,11 @@ typedef struct dt_dev_pixelpipe_t
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // output buffer (for display)
   uint8_t *output_backbuf;
+  size_t output_backbuf_size; // bytes allocated, at least width * height * 4
   int output_backbuf_width, output_backbuf_height;
   int output_imgid;
+  // downscale factor of the pass being processed and of the one in output_backbuf (1 = full resolution)
+  int coarse, output_backbuf_coarse;
   // working?
   int processing;
   // shutting down?
@@ -158,6 +170,16 @@ typedef struct dt_dev_pixelpipe_t
   GList *forms;
   // the masks generated in the pipe for later reusal are inside dt_dev_pixelpipe_iop_t
   gboolean store_all_raster_masks;
+  // exchange the output of early modules with other pipes through darktable.pixelpipe_cache
+  gboolean shared_cache;
+  // apply runs of modules providing process_pixels() in one pass, see pixelpipe_fuse_pointwise
+  gboolean fuse_pointwise;
+  // process runs of tiling modules strip by strip on all cores, see pixelpipe_stream_tiles
+  gboolean stream_tiles;
+  // keep the mosaic between rawprepare and demosaic as uint16, see pixelpipe_raw_uint16
+  gboolean raw_uint16;
+  // identifies the source file version for the on-disk intermediate cache, 0 if disabled
+  uint64_t disk_cache_id;
 } dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
@@ -176,8 +198,14 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 // inits all but the pixel caches, so you can't actually process an image (just get dimensions and
 // distortions)
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
-// inits the pixelpipe with given cacheline size and number of entries.
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// memory budget in bytes for the caches of the interactive pipes.
+size_t dt_dev_pixelpipe_darkroom_cache_memory();
+// inits the pixelpipe with given cacheline size and number of entries, keeping the cache
+// below memory_limit bytes (0 for no limit).
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory_limit);
+// brings a pipe whose nodes have been cleaned up back to the state right after dt_dev_pixelpipe_init_cached(),
+// keeping the allocated cache lines and scratch arena, so it can run the next image without allocating them.
+void dt_dev_pixelpipe_reset(dt_dev_pixelpipe_t *pipe);
 // constructs a new input buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -228,6 +256,10 @@ void dt_dev_pixelpipe_remove_node(dt_dev_pixelpipe_t *pipe, struct dt_develop_t
 float *dt_dev_get_raster_mask(const dt_dev_pixelpipe_t *pipe, const struct dt_iop_module_t *raster_mask_source,
                               const int raster_mask_id, const struct dt_iop_module_t *target_module,
                               gboolean *free_mask);
+// tells the pipe that target_module is done with the raster mask. export and thumbnail pipes free it
+// right away if no module after target_module uses it, for the darkroom it stays for the next run.
+void dt_dev_release_raster_mask(dt_dev_pixelpipe_t *pipe, const struct dt_iop_module_t *raster_mask_source,
+                                const int raster_mask_id, const struct dt_iop_module_t *target_module);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -18,6 +18,9 @@
 
 
 #include "develop/tiling.h"
+#include "common/dtpthread.h"
+#include "common/file_location.h"
+#include "common/memory_governor.h"
 #include "common/opencl.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -86,6 +89,88 @@ static inline int _align_down(int n, int a)
 }
 
 
+/* fixed cost of a tile in pixel equivalents: setting up the buffers, copying in and out
+   and forking the threads once more. keeps the planner from chasing tiny gains with many tiles. */
+#define TILE_COST 16384
+
+/* cost-model based tile planner. every pixel of a tile gets processed, including the overlap
+   the neighbouring tile computes again, so splitting a dimension of size n into k tiles processes
+   n + 2 * overlap * (k - 1) pixels of it. we go through all tile counts in x, take the smallest
+   count in y that fits into max_pixels per tile and keep the combination with the least work.
+   rows are padded to full cache lines and 4k strides are avoided where the alignment allows.
+   full_wd/full_ht is the guiding image size, max_wd/max_ht the largest tile the device takes.
+   returns the expected overhead of processing the overlaps, 0.1 for 10%. */
+static float _plan_tiles(const char *op, const int full_wd, const int full_ht, const int max_wd,
+                         const int max_ht, const float max_pixels, const int overlap, const unsigned walign,
+                         const unsigned halign, const int bpp, int *width, int *height)
+{
+  const int max_tiles = dt_conf_get_int("maximum_number_tiles");
+  const unsigned lalign = _lcm(walign, _max(64 / _max(bpp, 1), 1));
+  const int calign = lalign <= 64 ? lalign : walign;
+
+  double best = -1.0, best_work = 0.0;
+  int best_wd = 0, best_ht = 0, best_tx = 0, best_ty = 0;
+  for(int tx = 1; tx <= max_tiles; tx++)
+  {
+    int wd = full_wd;
+    if(tx > 1)
+    {
+      wd = _align_up((full_wd + tx - 1) / tx + 2 * overlap, calign);
+      if(((size_t)wd * bpp) % 4096 == 0) wd += calign;
+      if(wd >= full_wd) continue; // not really split, same as tx = 1
+      if(wd <= 3 * overlap) break; // only gets narrower from here
+    }
+    if(wd > max_wd) continue;
+    const int ntx = wd >= full_wd ? 1 : (full_wd + wd - 2 * overlap - 1) / (wd - 2 * overlap);
+
+    int ht = _min(_min(max_ht, full_ht), (int)fminf(max_pixels / wd, (float)full_ht));
+    if(ht < full_ht) ht = _align_down(ht, halign);
+    if(ht < full_ht && ht <= 3 * overlap) continue;
+    const int nty = ht >= full_ht ? 1 : (full_ht + ht - 2 * overlap - 1) / (ht - 2 * overlap);
+    if(ntx * nty > max_tiles) continue;
+    /* taller tiles than needed for nty rows only cost memory, balance them */
+    if(nty > 1) ht = _min(ht, _align_up((full_ht + nty - 1) / nty + 2 * overlap, halign));
+
+    const double work = ((double)full_wd + 2.0 * overlap * (ntx - 1)) * ((double)full_ht + 2.0 * overlap * (nty - 1));
+    const double cost = work + (double)TILE_COST * ntx * nty;
+    if(best < 0.0 || cost < best)
+    {
+      best = cost;
+      best_work = work;
+      best_wd = wd;
+      best_ht = ht;
+      best_tx = ntx;
+      best_ty = nty;
+    }
+  }
+
+  if(best < 0.0)
+  {
+    /* nothing fits the constraints, leave it to the square tiles and the sanity checks of the caller */
+    *width = *height = _max(_min(_min(max_wd, max_ht), (int)sqrtf(max_pixels)), 1);
+    dt_print(DT_DEBUG_TILING, "[tiling] module '%s': no tile plan for %d x %d within %.0f pixels per tile\n", op,
+             full_wd, full_ht, max_pixels);
+    return 0.0f;
+  }
+
+  *width = best_wd;
+  *height = best_ht;
+  const float expected = best_work / ((double)full_wd * full_ht) - 1.0;
+  dt_print(DT_DEBUG_TILING,
+           "[tiling] module '%s': %d x %d tiles of %d x %d for %d x %d, overlap %d, expected overhead %.1f%%\n", op,
+           best_tx, best_ty, best_wd, best_ht, full_wd, full_ht, overlap, 100.0f * expected);
+  return expected;
+}
+
+/* compare what the planner expected with the pixels the tiles actually processed */
+static void _report_overhead(const char *op, const float expected, const size_t processed, const int full_wd,
+                             const int full_ht)
+{
+  dt_print(DT_DEBUG_TILING, "[tiling] module '%s': expected overhead %.1f%%, actual %.1f%%\n", op,
+           100.0f * expected, 100.0 * ((double)processed / ((double)full_wd * full_ht) - 1.0));
+}
+
+
 void _print_roi(const dt_iop_roi_t *roi, const char *label)
 {
   printf("{ %5d  %5d  %5d  %5d  %.6f } %s\n", roi->x, roi->y, roi->width, roi->height, roi->scale, label);
@@ -580,19 +665,194 @@ static int _fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_
 
 
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
+typedef struct _tiling_ptp_job_t
+{
+  struct dt_iop_module_t *self;
+  const struct dt_dev_pixelpipe_iop_t *origin; // the piece we tile for, checked for cancellation
+  struct dt_dev_pixelpipe_iop_t *tile_piece;   // the piece handed to process(), origin or our copy
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t piece;
+  const void *ivoid;
+  void *ovoid;
+  const dt_iop_roi_t *roi_in, *roi_out;
+  int in_bpp, out_bpp;
+  int width, height, overlap, tile_wd, tile_ht, tiles_x, tiles_y;
+  int slot, slots; // this job processes the tiles with index % slots == slot
+  int threads;     // openmp threads for process(), 0 to leave them alone
+  float processed_maximum_saved[4];
+  float processed_maximum_new[4];
+  size_t processed;
+  int success;
+} _tiling_ptp_job_t;
+
+// whether buf is a buffer of the pipe that lives in a memory mapped file
+static inline int _spilled(const struct dt_dev_pixelpipe_iop_t *piece, const void *buf)
+{
+  return piece && dt_dev_pixelpipe_cache_spilled(&piece->pipe->cache, buf);
+}
+
+/* how many tiles to process at once on the cpu. small tiles often don't keep all cores busy in the
+   module's own parallel loops, so each slot gets a share of the threads instead. only done for exports
+   and thumbnails, where no module looks at the pipe's identity, and only as far as memory permits. */
+static int _concurrent_tiles(const struct dt_dev_pixelpipe_iop_t *piece, const int tiles, const float available,
+                             const float per_tile)
+{
+  if(!(piece->pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return 1;
+  int slots = _min(_min(dt_conf_get_int("max_concurrent_tiles"), tiles), dt_get_num_threads() / 2);
+  if(per_tile > 0.0f) slots = _min(slots, (int)fminf(available / per_tile, (float)slots));
+  /* the extra slots need room next to the caches */
+  while(slots > 1 && !dt_memory_governor_request((size_t)((slots - 1) * per_tile))) slots--;
+  return _max(slots, 1);
+}
+
+static void *_tiling_ptp_worker(void *arg)
+{
+  _tiling_ptp_job_t *job = (_tiling_ptp_job_t *)arg;
+  struct dt_iop_module_t *self = job->self;
+  struct dt_dev_pixelpipe_iop_t *piece = job->tile_piece;
+  const dt_iop_roi_t *const roi_in = job->roi_in;
+  const dt_iop_roi_t *const roi_out = job->roi_out;
+  const int in_bpp = job->in_bpp, out_bpp = job->out_bpp;
+  const int ipitch = roi_in->width * in_bpp;
+  const int opitch = roi_out->width * out_bpp;
+  const int width = job->width, height = job->height, overlap = job->overlap;
+  const int tile_wd = job->tile_wd, tile_ht = job->tile_ht;
+  const void *const ivoid = job->ivoid;
+  void *const ovoid = job->ovoid;
+  int first = 1;
+
+#ifdef _OPENMP
+  if(job->threads > 0) omp_set_num_threads(job->threads);
+#endif
+
+  job->success = 0;
+  job->processed = 0;
+  for(int k = 0; k < 4; k++) job->processed_maximum_new[k] = 1.0f;
+
+  /* reserve input and output buffers for tiles */
+  void *input = dt_alloc_align(64, (size_t)width * height * in_bpp);
+  void *output = dt_alloc_align(64, (size_t)width * height * out_bpp);
+  if(input == NULL || output == NULL)
+  {
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc tile buffers for module '%s'\n",
+             self->op);
+    if(input != NULL) dt_free_align(input);
+    if(output != NULL) dt_free_align(output);
+    return NULL;
+  }
+
+  /* iterate over tiles */
+  for(size_t tx = 0; tx < job->tiles_x; tx++)
+  {
+    const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
+    for(size_t ty = 0; ty < job->tiles_y; ty++)
+    {
+      if((tx * job->tiles_y + ty) % job->slots != job->slot) continue;
+
+      piece->pipe->tiling = 1;
+
+      /* the result is going to be discarded, skip the remaining tiles */
+      if(dt_iop_process_cancelled(job->origin)) continue;
+
+      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
+
+      /* no need to process end-tiles that are smaller than the total overlap area */
+      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
+      job->processed += wd * ht;
+
+      /* origin and region of effective part of tile, which we want to store later */
+      size_t origin[] = { 0, 0, 0 };
+      size_t region[] = { wd, ht, 1 };
+
+      /* roi_in and roi_out for process_cl on subbuffer */
+      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
+      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
+
+      /* offsets of tile into ivoid and ovoid */
+      size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
+      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
+
+
+      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n",
+               tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
+
+/* prepare input tile buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+      dt_omp_firstprivate(ht, in_bpp, ipitch, ivoid, wd) \
+      shared(input, width, ioffs) \
+      schedule(static)
+#endif
+      for(size_t j = 0; j < ht; j++)
+        memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
+
+      /* take original processed_maximum as starting point */
+      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = job->processed_maximum_saved[k];
+
+      /* call process() of module */
+      self->process(self, piece, input, output, &iroi, &oroi);
+
+      /* aggregate resulting processed_maximum */
+      /* TODO: check if there really can be differences between tiles and take
+               appropriate action (calculate minimum, maximum, average, ...?) */
+      for(int k = 0; k < 4; k++)
+      {
+        if(!first && fabs(job->processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
+          dt_print(
+              DT_DEBUG_DEV,
+              "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k,
+              self->op);
+        job->processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
+      }
+      first = 0;
+
+      /* correct origin and region of tile for overlap.
+         make sure that we only copy back the "good" part. */
+      if(tx > 0)
+      {
+        origin[0] += overlap;
+        region[0] -= overlap;
+        ooffs += overlap * out_bpp;
+      }
+      if(ty > 0)
+      {
+        origin[1] += overlap;
+        region[1] -= overlap;
+        ooffs += overlap * opitch;
+      }
+
+/* copy "good" part of tile to output buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+      dt_omp_firstprivate(opitch, out_bpp, ovoid, wd) \
+      shared(ooffs, output, width, origin, region) \
+      schedule(static)
+#endif
+      for(size_t j = 0; j < region[1]; j++)
+        memcpy((char *)ovoid + ooffs + j * opitch,
+               (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
+    }
+  }
+
+  /* a slot without any tile keeps the maximum we started with */
+  if(first)
+    for(int k = 0; k < 4; k++) job->processed_maximum_new[k] = job->processed_maximum_saved[k];
+
+  dt_free_align(input);
+  dt_free_align(output);
+  job->success = 1;
+  return NULL;
+}
+
 static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                         const void *const ivoid, void *const ovoid,
                                         const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                                         const int in_bpp)
 {
-  void *input = NULL;
-  void *output = NULL;
   dt_iop_buffer_dsc_t dsc;
   self->output_format(self, piece->pipe, piece, &dsc);
   const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
 
-  const int ipitch = roi_in->width * in_bpp;
-  const int opitch = roi_out->width * out_bpp;
   const int max_bpp = _max(in_bpp, out_bpp);
 
   /* get tiling requirements of module */
@@ -612,10 +872,10 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   /* calculate optimal size of tiles */
   float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
-  /* correct for size of ivoid and ovoid which are needed on top of tiling */
-  available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
-                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
-                   0);
+  /* correct for size of ivoid and ovoid which are needed on top of tiling, unless the pipe keeps them in files */
+  const float in_size = _spilled(piece, ivoid) ? 0.0f : (float)roi_in->width * roi_in->height * in_bpp;
+  const float out_size = _spilled(piece, ovoid) ? 0.0f : (float)roi_out->width * roi_out->height * out_bpp;
+  available = fmax(available - out_size - in_size - tiling.overhead, 0);
 
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
      this will mainly allow tiling for modules with high and "unpredictable" memory demand which is
@@ -629,32 +889,11 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   int width = roi_in->width;
   int height = roi_in->height;
 
-  /* shrink tile size in case it would exceed singlebuffer size */
-  if((float)width * height * max_bpp * maxbuf > singlebuffer)
-  {
-    const float scale = singlebuffer / ((float)width * height * max_bpp * maxbuf);
-
-    /* TODO: can we make this more efficient to minimize total overlap between tiles? */
-    if(width < height && scale >= 0.333f)
-    {
-      height = floorf(height * scale);
-    }
-    else if(height <= width && scale >= 0.333f)
-    {
-      width = floorf(width * scale);
-    }
-    else
-    {
-      width = floorf(width * sqrt(scale));
-      height = floorf(height * sqrt(scale));
-    }
-  }
-
-  /* make sure we have a reasonably effective tile dimension. if not try square tiles */
-  if(3 * tiling.overlap > width || 3 * tiling.overlap > height)
-  {
-    width = height = floorf(sqrtf((float)width * height));
-  }
+  /* pick the tile dimensions with the least total work */
+  const unsigned int plan_align = _lcm(tiling.xalign, tiling.yalign);
+  const float expected = _plan_tiles(self->op, roi_in->width, roi_in->height, width, height,
+                                     singlebuffer / (max_bpp * maxbuf), _align_up(tiling.overlap, plan_align),
+                                     plan_align, plan_align, max_bpp, &width, &height);
 
   /* Alignment rules: we need to make sure that alignment requirements of module are fulfilled.
      Modules will report alignment requirements via xalign and yalign within tiling_callback().
@@ -700,119 +939,90 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
            "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n",
            tiles_x, tiles_y, width, height, overlap);
 
-  /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width * height * in_bpp);
-  if(input == NULL)
-  {
-    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
+  /* process several tiles at once if memory allows, each slot with its own buffers */
+  const int slots = _concurrent_tiles(piece, tiles_x * tiles_y, available,
+                                      (float)width * height * max_bpp * factor);
+  if(slots > 1)
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] processing %d tiles at once for module '%s'\n", slots,
              self->op);
-    goto error;
-  }
-  output = dt_alloc_align(64, (size_t)width * height * out_bpp);
-  if(output == NULL)
+
+  _tiling_ptp_job_t *jobs = calloc(slots, sizeof(_tiling_ptp_job_t));
+  pthread_t *threads = calloc(slots, sizeof(pthread_t));
+  int *started = calloc(slots, sizeof(int));
+  if(!jobs || !threads || !started)
   {
-    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
-             self->op);
+    free(jobs);
+    free(threads);
+    free(started);
     goto error;
   }
 
-  /* store processed_maximum to be re-used and aggregated */
-  float processed_maximum_saved[4];
-  float processed_maximum_new[4] = { 1.0f };
-  for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
-
-
-  /* iterate over tiles */
-  for(size_t tx = 0; tx < tiles_x; tx++)
+  for(int k = 0; k < slots; k++)
   {
-    const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
-    for(size_t ty = 0; ty < tiles_y; ty++)
+    _tiling_ptp_job_t *job = jobs + k;
+    job->self = self;
+    job->origin = piece;
+    if(slots > 1)
     {
-      piece->pipe->tiling = 1;
-
-      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
-
-      /* no need to process end-tiles that are smaller than the total overlap area */
-      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
-
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
-
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
-
-      /* offsets of tile into ivoid and ovoid */
-      size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
-      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
-
-
-      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%zu, %zu) with %zu x %zu at origin [%zu, %zu]\n",
-               tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
+      /* private copies keep processed_maximum and the tiling flag of concurrent tiles apart */
+      job->pipe = *piece->pipe;
+      job->piece = *piece;
+      job->piece.pipe = &job->pipe;
+      job->tile_piece = &job->piece;
+    }
+    else
+      job->tile_piece = piece;
+    job->ivoid = ivoid;
+    job->ovoid = ovoid;
+    job->roi_in = roi_in;
+    job->roi_out = roi_out;
+    job->in_bpp = in_bpp;
+    job->out_bpp = out_bpp;
+    job->width = width;
+    job->height = height;
+    job->overlap = overlap;
+    job->tile_wd = tile_wd;
+    job->tile_ht = tile_ht;
+    job->tiles_x = tiles_x;
+    job->tiles_y = tiles_y;
+    job->slot = k;
+    job->slots = slots;
+    job->threads = slots > 1 ? _max(dt_get_num_threads() / slots, 1) : 0;
+    for(int c = 0; c < 4; c++) job->processed_maximum_saved[c] = piece->pipe->dsc.processed_maximum[c];
+  }
 
-/* prepare input tile buffer */
+  /* the first slot runs on our own thread */
+  piece->pipe->tiling = 1;
+  for(int k = 1; k < slots; k++) started[k] = !dt_pthread_create(&threads[k], _tiling_ptp_worker, jobs + k);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(ht, in_bpp, ipitch, ivoid, wd) \
-      shared(input, width, ioffs) \
-      schedule(static)
+  const int omp_threads = omp_get_max_threads();
 #endif
-      for(size_t j = 0; j < ht; j++)
-        memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
-
-      /* take original processed_maximum as starting point */
-      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi, &oroi);
-
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
-      for(int k = 0; k < 4; k++)
-      {
-        if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
-          dt_print(
-              DT_DEBUG_DEV,
-              "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k,
-              self->op);
-        processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
-      }
-
-      /* correct origin and region of tile for overlap.
-         make sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += overlap * out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += overlap * opitch;
-      }
-
-/* copy "good" part of tile to output buffer */
+  _tiling_ptp_worker(jobs);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(opitch, out_bpp, ovoid, wd) \
-      shared(ooffs, output, width, origin, region) \
-      schedule(static)
+  omp_set_num_threads(omp_threads);
 #endif
-      for(size_t j = 0; j < region[1]; j++)
-        memcpy((char *)ovoid + ooffs + j * opitch,
-               (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
-    }
+
+  int success = jobs[0].success;
+  size_t processed = jobs[0].processed;
+  for(int k = 1; k < slots; k++)
+  {
+    if(started[k])
+      pthread_join(threads[k], NULL);
+    else
+      _tiling_ptp_worker(jobs + k);
+    success = success && jobs[k].success;
+    processed += jobs[k].processed;
   }
 
   /* copy back final processed_maximum */
-  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
+  for(int c = 0; c < 4; c++) piece->pipe->dsc.processed_maximum[c] = jobs[0].processed_maximum_new[c];
+  _report_overhead(self->op, expected, processed, roi_in->width, roi_in->height);
+
+  free(started);
+  free(threads);
+  free(jobs);
+  if(!success) goto error;
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
   piece->pipe->tiling = 0;
   return;
 
@@ -821,8 +1031,6 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n",
            self->op);
@@ -832,6 +1040,123 @@ fallback:
 
 
 
+typedef struct _tiling_cl_band_t
+{
+  struct dt_iop_module_t *self;
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_iop_t piece;
+  const void *ivoid;
+  void *ovoid;
+  dt_iop_roi_t roi;
+  int in_bpp;
+  int good_y0, good_y1;
+  int success;
+} _tiling_cl_band_t;
+
+static void *_tiling_cl_band_worker(void *arg)
+{
+  _tiling_cl_band_t *band = (_tiling_cl_band_t *)arg;
+  band->success = _default_process_tiling_cl_ptp(band->self, &band->piece, band->ivoid, band->ovoid, &band->roi,
+                                                 &band->roi, band->in_bpp, band->good_y0, band->good_y1);
+  return NULL;
+}
+
+/* ptp tiling spread over all opencl devices we can get hold of: the image is cut into horizontal bands
+   (overlapping by the module's tiling overlap), one per device, and every band is tiled according to the
+   memory of its own device. each band writes only its own rows, so the output is stitched in place.
+   every device works on private copies of pipe and piece which only differ in devid. */
+static int _default_process_tiling_cl_ptp_multi(struct dt_iop_module_t *self,
+                                                struct dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                                                void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                                const dt_iop_roi_t *const roi_out, const int in_bpp)
+{
+  const int num_devs = darktable.opencl->num_devs;
+  int *devs = malloc(sizeof(int) * num_devs);
+  int ndevs = 0;
+  devs[ndevs++] = piece->pipe->devid;
+  while(ndevs < num_devs)
+  {
+    const int devid = dt_opencl_trylock_device(piece->pipe->type);
+    if(devid < 0) break;
+    devs[ndevs++] = devid;
+  }
+
+  if(ndevs == 1)
+  {
+    free(devs);
+    return _default_process_tiling_cl_ptp(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp, 0,
+                                          roi_out->height);
+  }
+
+  dt_iop_buffer_dsc_t dsc;
+  self->output_format(self, piece->pipe, piece, &dsc);
+  const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
+
+  /* bands start aligned and overlap just like tiles do */
+  dt_develop_tiling_t tiling = { 0 };
+  self->tiling_callback(self, piece, roi_in, roi_out, &tiling);
+  const unsigned int xyalign = _lcm(tiling.xalign, tiling.yalign);
+  const int overlap = tiling.overlap % xyalign != 0 ? (tiling.overlap / xyalign + 1) * xyalign
+                                                    : tiling.overlap;
+  const int band_ht = _align_up((roi_out->height + ndevs - 1) / ndevs, xyalign);
+
+  _tiling_cl_band_t *bands = calloc(ndevs, sizeof(_tiling_cl_band_t));
+  pthread_t *threads = calloc(ndevs, sizeof(pthread_t));
+  int *started = calloc(ndevs, sizeof(int));
+  int nbands = 0;
+  for(int k = 0; k < ndevs && k * band_ht < roi_out->height; k++, nbands++)
+  {
+    const int y0 = k * band_ht;
+    const int y1 = _min(y0 + band_ht, roi_out->height);
+    const int in_y0 = _max(_align_down(y0 - overlap, xyalign), 0);
+    const int in_y1 = _min(y1 + overlap, roi_in->height);
+
+    _tiling_cl_band_t *band = bands + k;
+    band->self = self;
+    band->pipe = *piece->pipe;
+    band->pipe.devid = devs[k];
+    band->piece = *piece;
+    band->piece.pipe = &band->pipe;
+    band->ivoid = (const char *)ivoid + (size_t)in_y0 * roi_in->width * in_bpp;
+    band->ovoid = (char *)ovoid + (size_t)in_y0 * roi_out->width * out_bpp;
+    band->roi = *roi_in;
+    band->roi.y += in_y0;
+    band->roi.height = in_y1 - in_y0;
+    band->in_bpp = in_bpp;
+    band->good_y0 = y0 - in_y0;
+    band->good_y1 = y1 - in_y0;
+  }
+
+  dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] distributing module '%s' over %d devices\n",
+           self->op, nbands);
+
+  /* the first band stays on our own device and thread */
+  for(int k = 1; k < nbands; k++) started[k] = !dt_pthread_create(&threads[k], _tiling_cl_band_worker, bands + k);
+  _tiling_cl_band_worker(bands);
+
+  int success = bands[0].success;
+  for(int k = 1; k < nbands; k++)
+  {
+    if(started[k])
+      pthread_join(threads[k], NULL);
+    else
+      _tiling_cl_band_worker(bands + k);
+    success = success && bands[k].success;
+  }
+
+  for(int k = 1; k < ndevs; k++) dt_opencl_unlock_device(devs[k]);
+
+  if(success)
+    for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = bands[0].pipe.dsc.processed_maximum[k];
+
+  free(started);
+  free(threads);
+  free(bands);
+  free(devs);
+  return success;
+}
+
+
 /* more elaborate tiling algorithm for roi_in != roi_out: slower than the ptp variant,
    more tiles and larger overlap */
 static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
@@ -879,10 +1204,10 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   /* calculate optimal size of tiles */
   float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
-  /* correct for size of ivoid and ovoid which are needed on top of tiling */
-  available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
-                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
-                   0);
+  /* correct for size of ivoid and ovoid which are needed on top of tiling, unless the pipe keeps them in files */
+  const float in_size = _spilled(piece, ivoid) ? 0.0f : (float)roi_in->width * roi_in->height * in_bpp;
+  const float out_size = _spilled(piece, ovoid) ? 0.0f : (float)roi_out->width * roi_out->height * out_bpp;
+  available = fmax(available - out_size - in_size - tiling.overhead, 0);
 
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
      this will mainly allow tiling for modules with high and "unpredictable" memory demand which is
@@ -896,32 +1221,11 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   int width = _max(roi_in->width, roi_out->width);
   int height = _max(roi_in->height, roi_out->height);
 
-  /* shrink tile size in case it would exceed singlebuffer size */
-  if((float)width * height * max_bpp * maxbuf > singlebuffer)
-  {
-    const float scale = singlebuffer / ((float)width * height * max_bpp * maxbuf);
-
-    /* TODO: can we make this more efficient to minimize total overlap between tiles? */
-    if(width < height && scale >= 0.333f)
-    {
-      height = floorf(height * scale);
-    }
-    else if(height <= width && scale >= 0.333f)
-    {
-      width = floorf(width * scale);
-    }
-    else
-    {
-      width = floorf(width * sqrt(scale));
-      height = floorf(height * sqrt(scale));
-    }
-  }
-
-  /* make sure we have a reasonably effective tile dimension. if not try square tiles */
-  if(3 * tiling.overlap > width || 3 * tiling.overlap > height)
-  {
-    width = height = floorf(sqrtf((float)width * height));
-  }
+  /* pick the tile dimensions with the least total work */
+  const unsigned int plan_align = _lcm(tiling.xalign, tiling.yalign);
+  const float expected = _plan_tiles(self->op, width, height, width, height, singlebuffer / (max_bpp * maxbuf),
+                                     _align_up(tiling.overlap, plan_align), plan_align, plan_align, max_bpp,
+                                     &width, &height);
 
   /* Alignment rules: we need to make sure that alignment requirements of module are fulfilled.
      Modules will report alignment requirements via xalign and yalign within tiling_callback().
@@ -988,12 +1292,17 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   float processed_maximum_new[4] = { 1.0f };
   for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
 
+  size_t processed = 0;
+
   /* iterate over tiles */
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
       piece->pipe->tiling = 1;
 
+      /* the result is going to be discarded, skip the remaining tiles */
+      if(dt_iop_process_cancelled(piece)) continue;
+
       /* the output dimensions of the good part of this specific tile */
       size_t wd = (tx + 1) * tile_wd > roi_out->width ? roi_out->width - tx * tile_wd : tile_wd;
       size_t ht = (ty + 1) * tile_ht > roi_out->height ? roi_out->height - ty * tile_ht : tile_ht;
@@ -1071,6 +1380,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
       iroi_full.y = _max(iroi_full.y, roi_in->y);
       iroi_full.width = _min(iroi_full.width, roi_in->width + roi_in->x - iroi_full.x);
       iroi_full.height = _min(iroi_full.height, roi_in->height + roi_in->y - iroi_full.y);
+      processed += (size_t)iroi_full.width * iroi_full.height;
 
 
       //_print_roi(&iroi_full, "tile iroi_full final");
@@ -1151,6 +1461,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
+  _report_overhead(self->op, expected, processed, roi_in->width, roi_in->height);
 
   if(input != NULL) dt_free_align(input);
   if(output != NULL) dt_free_align(output);
@@ -1192,11 +1503,239 @@ void default_process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpip
 
 
 #ifdef HAVE_OPENCL
-/* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
+/* tile geometry as worked out by _default_process_tiling_cl_ptp() */
+typedef struct _tiling_cl_layout_t
+{
+  int width, height, overlap;
+  int tile_wd, tile_ht;
+  int tiles_x, tiles_y;
+  int good_y0, good_y1;
+} _tiling_cl_layout_t;
+
+/* one tile in flight: its pinned staging buffers, its device buffers and where its good part goes */
+typedef struct _tiling_cl_slot_t
+{
+  cl_mem pinned_input, pinned_output;
+  void *input_buffer, *output_buffer;
+  cl_mem input, output;
+  cl_event done;
+  int pending;
+  size_t wd;
+  size_t ooffs;
+  size_t origin[3], region[3];
+} _tiling_cl_slot_t;
+
+/* wait for the tile in slot and copy its good part from the pinned output buffer into ovoid */
+static int _tiling_cl_slot_finish(const int devid, _tiling_cl_slot_t *slot, void *const ovoid, const int opitch,
+                                  const int out_bpp)
+{
+  if(!slot->pending) return TRUE;
+  slot->pending = 0;
+
+  int ok = TRUE;
+  if(slot->done)
+    ok = dt_opencl_wait_for_marker(slot->done) == CL_SUCCESS;
+  else
+    ok = dt_opencl_finish(devid);
+  slot->done = NULL;
+
+  if(ok)
+    for(size_t j = 0; j < slot->region[1]; j++)
+      memcpy((char *)ovoid + slot->ooffs + j * opitch,
+             (char *)slot->output_buffer + ((j + slot->origin[1]) * slot->wd + slot->origin[0]) * out_bpp,
+             (size_t)slot->region[0] * out_bpp);
+
+  dt_opencl_release_mem_object(slot->input);
+  slot->input = NULL;
+  dt_opencl_release_mem_object(slot->output);
+  slot->output = NULL;
+  return ok;
+}
+
+/* variant of the ptp tiling loop with two tiles in flight: all transfers are non-blocking and only a marker
+   behind each tile is waited for, two tiles later. while the device works on one tile the host stages the
+   input of the next one into the other slot's pinned buffer and stitches the output of the previous one. */
+static int _default_process_tiling_cl_ptp_pipelined(struct dt_iop_module_t *self,
+                                                    struct dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                                                    void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                                    const dt_iop_roi_t *const roi_out, const int in_bpp,
+                                                    const int out_bpp, const _tiling_cl_layout_t *layout,
+                                                    const float *processed_maximum_saved)
+{
+  const int devid = piece->pipe->devid;
+  const int ipitch = roi_in->width * in_bpp;
+  const int opitch = roi_out->width * out_bpp;
+  const int width = layout->width, height = layout->height, overlap = layout->overlap;
+  const int tile_wd = layout->tile_wd, tile_ht = layout->tile_ht;
+  const size_t insize = (size_t)width * height * in_bpp;
+  const size_t outsize = (size_t)width * height * out_bpp;
+
+  float processed_maximum_new[4] = { 1.0f };
+  _tiling_cl_slot_t slots[2] = { { 0 } };
+  int ok = TRUE;
+
+  for(int k = 0; k < 2 && ok; k++)
+  {
+    _tiling_cl_slot_t *slot = slots + k;
+    slot->pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, insize,
+                                                                  CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    slot->pinned_output = dt_opencl_alloc_device_buffer_with_flags(devid, outsize,
+                                                                   CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    if(slot->pinned_input)
+      slot->input_buffer = dt_opencl_map_buffer(devid, slot->pinned_input, CL_TRUE, CL_MAP_WRITE, 0, insize);
+    if(slot->pinned_output)
+      slot->output_buffer = dt_opencl_map_buffer(devid, slot->pinned_output, CL_TRUE, CL_MAP_READ, 0, outsize);
+    ok = slot->input_buffer && slot->output_buffer;
+  }
+  if(!ok)
+    dt_print(DT_DEBUG_OPENCL,
+             "[default_process_tiling_cl_ptp] could not set up pinned buffers for pipelined tiling of '%s'\n",
+             self->op);
+
+  int n = 0;
+  for(size_t tx = 0; tx < layout->tiles_x && ok; tx++)
+    for(size_t ty = 0; ty < layout->tiles_y && ok; ty++)
+    {
+      piece->pipe->tiling = 1;
+
+      /* the result is going to be discarded, skip the remaining tiles */
+      if(dt_iop_process_cancelled(piece)) continue;
+
+      const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
+      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
+
+      /* no need to process (end)tiles that are smaller than the total overlap area */
+      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
+
+      /* the slot is free once the tile from two steps ago has been stitched */
+      _tiling_cl_slot_t *slot = slots + (n++ & 1);
+      if(!(ok = _tiling_cl_slot_finish(devid, slot, ovoid, opitch, out_bpp))) break;
+
+      const size_t origin[] = { 0, 0, 0 };
+      const size_t region[] = { wd, ht, 1 };
+      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
+      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
+      const size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
+
+      if(!(slot->input = dt_opencl_alloc_device(devid, wd, ht, in_bpp))
+         || !(slot->output = dt_opencl_alloc_device(devid, wd, ht, out_bpp)))
+      {
+        ok = FALSE;
+        break;
+      }
+
+      /* stage the input while the device is still busy with the previous tile */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+      dt_omp_firstprivate(in_bpp, ipitch, ivoid, ioffs, wd, ht) \
+      shared(slot) \
+      schedule(static)
+#endif
+      for(size_t j = 0; j < ht; j++)
+        memcpy((char *)slot->input_buffer + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch,
+               (size_t)wd * in_bpp);
+
+      if(dt_opencl_write_host_to_device_raw(devid, slot->input_buffer, slot->input, origin, region,
+                                            wd * in_bpp, CL_FALSE) != CL_SUCCESS)
+      {
+        ok = FALSE;
+        break;
+      }
+
+      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
+
+      if(!self->process_cl(self, piece, slot->input, slot->output, &iroi, &oroi))
+      {
+        ok = FALSE;
+        break;
+      }
+
+      for(int k = 0; k < 4; k++) processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
+
+      if(dt_opencl_read_host_from_device_raw(devid, slot->output_buffer, slot->output, origin, region,
+                                             wd * out_bpp, CL_FALSE) != CL_SUCCESS)
+      {
+        ok = FALSE;
+        break;
+      }
+
+      /* good part of the tile, same rules as in the sequential loop */
+      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
+      size_t gorigin[] = { 0, 0, 0 };
+      size_t gregion[] = { wd, ht, 1 };
+      if(tx > 0)
+      {
+        gorigin[0] += overlap;
+        gregion[0] -= overlap;
+        ooffs += overlap * out_bpp;
+      }
+      if(ty > 0)
+      {
+        gorigin[1] += overlap;
+        gregion[1] -= overlap;
+        ooffs += overlap * opitch;
+      }
+      const int row0 = ty * tile_ht + gorigin[1];
+      const int row1 = row0 + gregion[1];
+      if(row0 < layout->good_y0)
+      {
+        const int skip = _min(layout->good_y0 - row0, gregion[1]);
+        gorigin[1] += skip;
+        gregion[1] -= skip;
+        ooffs += skip * opitch;
+      }
+      if(row1 > layout->good_y1) gregion[1] -= _min(row1 - layout->good_y1, gregion[1]);
+
+      slot->wd = wd;
+      slot->ooffs = ooffs;
+      memcpy(slot->origin, gorigin, sizeof(gorigin));
+      memcpy(slot->region, gregion, sizeof(gregion));
+      slot->done = dt_opencl_enqueue_marker(devid);
+      slot->pending = 1;
+    }
+
+  /* drain, oldest tile first */
+  for(int k = 0; k < 2; k++)
+  {
+    _tiling_cl_slot_t *slot = slots + ((n + k) & 1);
+    if(ok)
+      ok = _tiling_cl_slot_finish(devid, slot, ovoid, opitch, out_bpp);
+    else
+    {
+      /* don't let pending transfers write into buffers we are about to release */
+      dt_opencl_finish(devid);
+      if(slot->done) dt_opencl_wait_for_marker(slot->done);
+      dt_opencl_release_mem_object(slot->input);
+      dt_opencl_release_mem_object(slot->output);
+    }
+  }
+
+  for(int k = 0; k < 2; k++)
+  {
+    _tiling_cl_slot_t *slot = slots + k;
+    if(slot->input_buffer) dt_opencl_unmap_mem_object(devid, slot->pinned_input, slot->input_buffer);
+    dt_opencl_release_mem_object(slot->pinned_input);
+    if(slot->output_buffer) dt_opencl_unmap_mem_object(devid, slot->pinned_output, slot->output_buffer);
+    dt_opencl_release_mem_object(slot->pinned_output);
+  }
+  dt_opencl_finish(devid);
+
+  for(int k = 0; k < 4; k++)
+    piece->pipe->dsc.processed_maximum[k] = ok ? processed_maximum_new[k] : processed_maximum_saved[k];
+  piece->pipe->tiling = 0;
+  if(!ok)
+    dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] couldn't run pipelined tiling for module '%s'\n",
+             self->op);
+  return ok;
+}
+
+/* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations.
+   only rows good_y0 .. good_y1-1 (relative to roi_out) are written to ovoid, which allows several devices
+   to work on overlapping horizontal bands of the same image. */
 static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                           const void *const ivoid, void *const ovoid,
                                           const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
-                                          const int in_bpp)
+                                          const int in_bpp, const int good_y0, const int good_y1)
 {
   cl_int err = -999;
   cl_mem input = NULL;
@@ -1221,6 +1760,9 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
 
   /* shall we use pinned memory transfers? */
   int use_pinned_memory = dt_conf_get_bool("opencl_use_pinned_memory");
+  /* pipelined transfers keep two tiles in flight, each with its own set of buffers */
+  const int pipelined = use_pinned_memory && dt_conf_get_bool("opencl_pipelined_tiling");
+  const int slots = pipelined ? 2 : 1;
   const int pinned_buffer_overhead = use_pinned_memory ? 2 : 0; // add two additional pinned memory buffers
                                                                 // which seemingly get allocated not only on
                                                                 // host but also on device (why???)
@@ -1233,38 +1775,18 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   float headroom = dt_conf_get_float("opencl_memory_headroom") * 1024.0f * 1024.0f;
   headroom = fmin(fmax(headroom, 0.0f), (float)darktable.opencl->dev[devid].max_global_mem);
   const float available = darktable.opencl->dev[devid].max_global_mem - headroom;
-  float factor = fmax(tiling.factor + pinned_buffer_overhead, 1.0f);
+  float factor = fmax(slots * (tiling.factor + pinned_buffer_overhead), 1.0f);
   const float singlebuffer = fmin(fmax((available - tiling.overhead) / factor, 0.0f),
                                   pinned_buffer_slack * darktable.opencl->dev[devid].max_mem_alloc);
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
   int width = _min(roi_in->width, darktable.opencl->dev[devid].max_image_width);
   int height = _min(roi_in->height, darktable.opencl->dev[devid].max_image_height);
 
-  /* shrink tile size in case it would exceed singlebuffer size */
-  if((float)width * height * max_bpp * maxbuf > singlebuffer)
-  {
-    const float scale = singlebuffer / ((float)width * height * max_bpp * maxbuf);
-
-    if(width < height && scale >= 0.333f)
-    {
-      height = floorf(height * scale);
-    }
-    else if(height <= width && scale >= 0.333f)
-    {
-      width = floorf(width * scale);
-    }
-    else
-    {
-      width = floorf(width * sqrt(scale));
-      height = floorf(height * sqrt(scale));
-    }
-  }
-
-  /* make sure we have a reasonably effective tile dimension. if not try square tiles */
-  if(3 * tiling.overlap > width || 3 * tiling.overlap > height)
-  {
-    width = height = floorf(sqrtf((float)width * height));
-  }
+  /* pick the tile dimensions with the least total work */
+  const unsigned int plan_align = _lcm(tiling.xalign, tiling.yalign);
+  const float expected = _plan_tiles(self->op, roi_in->width, roi_in->height, width, height,
+                                     singlebuffer / (max_bpp * maxbuf), _align_up(tiling.overlap, plan_align),
+                                     _lcm(plan_align, CL_ALIGNMENT), plan_align, max_bpp, &width, &height);
 
 
   /* Alignment rules: we need to make sure that alignment requirements of module are fulfilled.
@@ -1324,6 +1846,16 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   float processed_maximum_new[4] = { 1.0f };
   for(int k = 0; k < 4; k++) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
 
+  if(pipelined)
+  {
+    const _tiling_cl_layout_t layout = { .width = width, .height = height, .overlap = overlap,
+                                         .tile_wd = tile_wd, .tile_ht = tile_ht,
+                                         .tiles_x = tiles_x, .tiles_y = tiles_y,
+                                         .good_y0 = good_y0, .good_y1 = good_y1 };
+    return _default_process_tiling_cl_ptp_pipelined(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp, out_bpp,
+                                                     &layout, processed_maximum_saved);
+  }
+
   /* reserve pinned input and output memory for host<->device data transfer */
   if(use_pinned_memory)
   {
@@ -1380,17 +1912,23 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
     }
   }
 
+  size_t processed = 0;
+
   /* iterate over tiles */
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
       piece->pipe->tiling = 1;
 
+      /* the result is going to be discarded, skip the remaining tiles */
+      if(dt_iop_process_cancelled(piece)) continue;
+
       size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
       size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
 
       /* no need to process (end)tiles that are smaller than the total overlap area */
       if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
+      processed += wd * ht;
 
       /* origin and region of effective part of tile, which we want to store later */
       size_t origin[] = { 0, 0, 0 };
@@ -1484,7 +2022,19 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
         ooffs += overlap * opitch;
       }
 
-      if(use_pinned_memory)
+      /* stay within the rows we are responsible for */
+      const int row0 = ty * tile_ht + origin[1];
+      const int row1 = row0 + region[1];
+      if(row0 < good_y0)
+      {
+        const int skip = _min(good_y0 - row0, region[1]);
+        origin[1] += skip;
+        region[1] -= skip;
+        ooffs += skip * opitch;
+      }
+      if(row1 > good_y1) region[1] -= _min(row1 - good_y1, region[1]);
+
+      if(region[1] > 0 && use_pinned_memory)
       {
 /* copy "good" part of tile from pinned output buffer to output image */
 #if 0 // def _OPENMP
@@ -1496,7 +2046,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
                  (char *)output_buffer + ((j + origin[1]) * wd + origin[0]) * out_bpp,
                  (size_t)region[0] * out_bpp);
       }
-      else
+      else if(region[1] > 0)
       {
         /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
         err = dt_opencl_read_host_from_device_raw(devid, (char *)ovoid + ooffs, output, origin, region,
@@ -1517,6 +2067,7 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
+  _report_overhead(self->op, expected, processed, roi_in->width, roi_in->height);
 
   if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
   dt_opencl_release_mem_object(pinned_input);
@@ -1608,31 +2159,12 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
   int width = _min(_max(roi_in->width, roi_out->width), darktable.opencl->dev[devid].max_image_width);
   int height = _min(_max(roi_in->height, roi_out->height), darktable.opencl->dev[devid].max_image_height);
 
-  /* shrink tile size in case it would exceed singlebuffer size */
-  if((float)width * height * max_bpp * maxbuf > singlebuffer)
-  {
-    const float scale = singlebuffer / ((float)width * height * max_bpp * maxbuf);
-
-    if(width < height && scale >= 0.333f)
-    {
-      height = floorf(height * scale);
-    }
-    else if(height <= width && scale >= 0.333f)
-    {
-      width = floorf(width * scale);
-    }
-    else
-    {
-      width = floorf(width * sqrt(scale));
-      height = floorf(height * sqrt(scale));
-    }
-  }
-
-  /* make sure we have a reasonably effective tile dimension. if not try square tiles */
-  if(3 * tiling.overlap > width || 3 * tiling.overlap > height)
-  {
-    width = height = floorf(sqrtf((float)width * height));
-  }
+  /* pick the tile dimensions with the least total work */
+  const unsigned int plan_align = _lcm(_lcm(tiling.xalign, tiling.yalign), CL_ALIGNMENT);
+  const float expected = _plan_tiles(self->op, _max(roi_in->width, roi_out->width),
+                                     _max(roi_in->height, roi_out->height), width, height,
+                                     singlebuffer / (max_bpp * maxbuf), _align_up(tiling.overlap, plan_align),
+                                     plan_align, plan_align, max_bpp, &width, &height);
 
 
   /* Alignment rules: we need to make sure that alignment requirements of module are fulfilled.
@@ -1760,12 +2292,17 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
   }
 
 
+  size_t processed = 0;
+
   /* iterate over tiles */
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
       piece->pipe->tiling = 1;
 
+      /* the result is going to be discarded, skip the remaining tiles */
+      if(dt_iop_process_cancelled(piece)) continue;
+
       /* the output dimensions of the good part of this specific tile */
       size_t wd = (tx + 1) * tile_wd > roi_out->width ? roi_out->width - tx * tile_wd : tile_wd;
       size_t ht = (ty + 1) * tile_ht > roi_out->height ? roi_out->height - ty * tile_ht : tile_ht;
@@ -1842,6 +2379,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
       iroi_full.y = _max(iroi_full.y, roi_in->y);
       iroi_full.width = _min(iroi_full.width, roi_in->width + roi_in->x - iroi_full.x);
       iroi_full.height = _min(iroi_full.height, roi_in->height + roi_in->y - iroi_full.y);
+      processed += (size_t)iroi_full.width * iroi_full.height;
 
       //_print_roi(&iroi_full, "tile iroi_full");
       //_print_roi(&oroi_full, "tile oroi_full");
@@ -1958,6 +2496,7 @@ static int _default_process_tiling_cl_roi(struct dt_iop_module_t *self, struct d
 
   /* copy back final processed_maximum */
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
+  _report_overhead(self->op, expected, processed, roi_in->width, roi_in->height);
   if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
   dt_opencl_release_mem_object(pinned_input);
   if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
@@ -1995,8 +2534,11 @@ int default_process_tiling_cl(struct dt_iop_module_t *self, struct dt_dev_pixelp
 {
   if(memcmp(roi_in, roi_out, sizeof(struct dt_iop_roi_t)) || (self->flags() & IOP_FLAGS_TILING_FULL_ROI))
     return _default_process_tiling_cl_roi(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+  else if(piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT && dt_conf_get_bool("opencl_multi_device_tiling"))
+    return _default_process_tiling_cl_ptp_multi(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
   else
-    return _default_process_tiling_cl_ptp(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+    return _default_process_tiling_cl_ptp(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp, 0,
+                                          roi_out->height);
 }
 
 #else
@@ -2053,11 +2595,18 @@ void default_tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   return;
 }
 
-int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
-                                     const float factor, const size_t overhead)
+// host_memory_limit as read by dt_tiling_piece_fits_host_memory(), -1 until then
+static int host_memory_limit = -1;
+
+void dt_tiling_update_settings(void)
 {
-  static int host_memory_limit = -1;
+  host_memory_limit = -1;
+}
 
+int dt_tiling_piece_fits_host_memory(const struct dt_dev_pixelpipe_iop_t *piece, const void *input,
+                                     const void *output, const size_t width, const size_t height,
+                                     const unsigned bpp, const float factor, const size_t overhead)
+{
   /* first time run */
   if(host_memory_limit < 0)
   {
@@ -2070,11 +2619,253 @@ int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, co
 
   float requirement = factor * width * height * bpp + overhead;
 
-  if(host_memory_limit == 0 || requirement <= host_memory_limit * 1024.0f * 1024.0f) return TRUE;
+  // the factor includes input and output, in files they only use page cache the kernel can write back
+  const float buffer = (float)width * height * bpp;
+  if(_spilled(piece, input)) requirement -= buffer;
+  if(_spilled(piece, output)) requirement -= buffer;
+  requirement = fmaxf(requirement, (float)overhead);
 
-  return FALSE;
+  if(host_memory_limit != 0 && requirement > host_memory_limit * 1024.0f * 1024.0f) return FALSE;
+
+  // within our own limit, but the caches may have filled the rest of the memory. have the
+  // governor make room by evicting from them, and only tile if that doesn't suffice.
+  return dt_memory_governor_request((size_t)requirement);
+}
+
+/* tiling calibration: with -d tilingcalib the pixelpipe measures the peak of host and device memory
+   of every module that is processed untiled. with the input and output buffers that gives the
+   requirement in the units of dt_develop_tiling_t, and a line through the measurements at several
+   buffer sizes splits it into factor and overhead. the overlap can't be derived from allocations,
+   it is only reported as declared. */
+
+// measured requirements get this much on top before they are used for tiling decisions
+#define CALIBRATION_MARGIN 1.1
+// a module needs this many measurements before tiling/use_calibration takes them
+#define CALIBRATION_MIN_SAMPLES 3
+#define CALIBRATION_FILE "tiling_calibration.txt"
+
+typedef struct _calibration_t
+{
+  // least squares sums of the buffer size x and the measured requirement y, both in MB
+  double n, sx, sy, sxx, sxy;
+  double max_ratio; // largest y / x seen
+  float declared_factor;
+  unsigned declared_overhead, declared_overlap;
+} _calibration_t;
+
+static GMutex _calibration_lock;
+static GHashTable *_calibration = NULL; // "op:cpu" or "op:opencl" -> _calibration_t
+static gboolean _calibration_use = FALSE;
+
+static void _calibration_path(char *path, const size_t len)
+{
+  char configdir[PATH_MAX] = { 0 };
+  dt_loc_get_user_config_dir(configdir, sizeof(configdir));
+  snprintf(path, len, "%s/" CALIBRATION_FILE, configdir);
+}
+
+// lazily reads the measurements of earlier runs, the caller holds _calibration_lock
+static void _calibration_load(void)
+{
+  if(_calibration) return;
+  _calibration = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  _calibration_use = dt_conf_get_bool("tiling/use_calibration");
+
+  char path[PATH_MAX] = { 0 };
+  _calibration_path(path, sizeof(path));
+  FILE *f = g_fopen(path, "r");
+  if(!f) return;
+  char key[128];
+  _calibration_t c = { 0 };
+  while(fscanf(f, "%127s %lf %lf %lf %lf %lf %lf", key, &c.n, &c.sx, &c.sy, &c.sxx, &c.sxy, &c.max_ratio) == 7)
+    g_hash_table_insert(_calibration, g_strdup(key), g_memdup(&c, sizeof(c)));
+  fclose(f);
+}
+
+// requirement = factor * x + overhead through the measurements, overhead in MB
+static gboolean _calibration_fit(const _calibration_t *c, double *factor, double *overhead)
+{
+  if(c->n < 1) return FALSE;
+  const double mx = c->sx / c->n, my = c->sy / c->n;
+  const double var = c->sxx / c->n - mx * mx;
+  const double cov = c->sxy / c->n - mx * my;
+  *factor = c->max_ratio;
+  *overhead = 0.0;
+  // only one buffer size so far, or sizes too close to tell a slope: all of it is factor
+  if(var <= 1e-6 * mx * mx || cov <= 0.0) return TRUE;
+  const double f = cov / var;
+  const double o = my - f * mx;
+  if(o < 0.0) return TRUE;
+  *factor = f;
+  *overhead = o;
+  return TRUE;
+}
+
+void dt_tiling_calibration_begin(struct dt_dev_pixelpipe_t *pipe, const size_t device_input,
+                                 dt_tiling_calibration_t *calib)
+{
+  calib->active = (darktable.unmuted & DT_DEBUG_TILING_CALIBRATE) != 0;
+  if(!calib->active) return;
+
+  calib->host_start = dt_alloc_align_mark();
+  if(pipe->arena)
+  {
+    dt_pthread_mutex_lock(&pipe->arena->lock);
+    pipe->arena->peak = pipe->arena->used;
+    dt_pthread_mutex_unlock(&pipe->arena->lock);
+  }
+  calib->devid = pipe->devid;
+  calib->device_start = 0;
+#ifdef HAVE_OPENCL
+  if(calib->devid >= 0 && dt_opencl_is_inited())
+  {
+    dt_opencl_device_t *dev = &darktable.opencl->dev[calib->devid];
+    dev->peak_memory = dev->memory_in_use;
+    calib->device_start = dev->memory_in_use - MIN(dev->memory_in_use, device_input);
+  }
+#endif
+}
+
+void dt_tiling_calibration_end(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                               const dt_tiling_calibration_t *calib, const dt_iop_roi_t *roi_in,
+                               const dt_iop_roi_t *roi_out, const unsigned bpp,
+                               const dt_develop_tiling_t *tiling, const gboolean on_device,
+                               const gboolean tiled)
+{
+  if(!calib->active || tiled) return;
+
+  // the unit of factor: the larger of the input and output buffers
+  const double mb = 1024.0 * 1024.0;
+  const double x = (double)MAX(roi_in->width, roi_out->width) * MAX(roi_in->height, roi_out->height) * bpp / mb;
+  if(x <= 0.0) return;
+
+  double y;
+  if(on_device)
+  {
+#ifdef HAVE_OPENCL
+    const dt_opencl_device_t *dev = &darktable.opencl->dev[calib->devid];
+    y = (dev->peak_memory - MIN(dev->peak_memory, calib->device_start)) / mb;
+#else
+    return;
+#endif
+  }
+  else
+  {
+    // input and output were allocated by the pipe before, the scratch memory comes on top
+    const dt_dev_pixelpipe_arena_t *arena = piece->pipe->arena;
+    const size_t scratch = arena ? arena->peak : 0;
+    y = 2.0 * x + (dt_alloc_align_peak() - MIN(dt_alloc_align_peak(), calib->host_start) + scratch) / mb;
+  }
+
+  const double declared = tiling->factor * x + tiling->overhead / mb;
+  dt_print(DT_DEBUG_TILING,
+           "[tiling calibration] module '%s' on %s: %dx%d, measured %.1f MB (factor %.2f), declared %.1f MB"
+           " (factor %.2f, overhead %.1f MB)%s\n",
+           self->op, on_device ? "opencl" : "cpu", roi_out->width, roi_out->height, y, y / x, declared,
+           tiling->factor, tiling->overhead / mb,
+           y > declared ? ", underestimated" : (declared > 2.0 * y ? ", overestimated" : ""));
+
+  gchar *key = g_strdup_printf("%s:%s", self->op, on_device ? "opencl" : "cpu");
+  g_mutex_lock(&_calibration_lock);
+  _calibration_load();
+  _calibration_t *c = g_hash_table_lookup(_calibration, key);
+  if(!c)
+  {
+    c = g_malloc0(sizeof(_calibration_t));
+    g_hash_table_insert(_calibration, key, c);
+  }
+  else
+    g_free(key);
+  c->n += 1.0;
+  c->sx += x;
+  c->sy += y;
+  c->sxx += x * x;
+  c->sxy += x * y;
+  c->max_ratio = MAX(c->max_ratio, y / x);
+  c->declared_factor = tiling->factor;
+  c->declared_overhead = tiling->overhead;
+  c->declared_overlap = tiling->overlap;
+  g_mutex_unlock(&_calibration_lock);
+}
+
+void dt_tiling_calibration_apply(struct dt_iop_module_t *self, dt_develop_tiling_t *tiling)
+{
+  g_mutex_lock(&_calibration_lock);
+  _calibration_load();
+  // while calibrating the measurements are compared to the declared values
+  if(_calibration_use && !(darktable.unmuted & DT_DEBUG_TILING_CALIBRATE))
+  {
+    // the same requirements are used for the decisions on both paths, take the larger one
+    double factor = 0.0, overhead = 0.0;
+    for(int k = 0; k < 2; k++)
+    {
+      gchar *key = g_strdup_printf("%s:%s", self->op, k ? "opencl" : "cpu");
+      const _calibration_t *c = g_hash_table_lookup(_calibration, key);
+      g_free(key);
+      double f, o;
+      if(c && c->n >= CALIBRATION_MIN_SAMPLES && _calibration_fit(c, &f, &o))
+      {
+        factor = MAX(factor, f);
+        overhead = MAX(overhead, o);
+      }
+    }
+    if(factor > 0.0)
+    {
+      tiling->factor = CALIBRATION_MARGIN * factor;
+      tiling->overhead = CALIBRATION_MARGIN * overhead * 1024 * 1024;
+    }
+  }
+  g_mutex_unlock(&_calibration_lock);
 }
 
+void dt_tiling_calibration_cleanup(void)
+{
+  g_mutex_lock(&_calibration_lock);
+  if(_calibration && (darktable.unmuted & DT_DEBUG_TILING_CALIBRATE))
+  {
+    char path[PATH_MAX] = { 0 };
+    _calibration_path(path, sizeof(path));
+    FILE *f = g_fopen(path, "w");
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, _calibration);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+      const _calibration_t *c = (_calibration_t *)value;
+      double factor, overhead;
+      if(_calibration_fit(c, &factor, &overhead))
+      {
+        // modules measured in earlier runs only don't know their declared values
+        if(c->declared_factor > 0.0f)
+          dt_print(DT_DEBUG_TILING,
+                   "[tiling calibration] %s: %.0f runs, suggested factor %.2f, overhead %.0f MB; declared"
+                   " factor %.2f, overhead %.0f MB, overlap %u\n",
+                   (const char *)key, c->n, factor, ceil(overhead), c->declared_factor,
+                   c->declared_overhead / (1024.0 * 1024.0), c->declared_overlap);
+        else
+          dt_print(DT_DEBUG_TILING, "[tiling calibration] %s: %.0f runs, suggested factor %.2f, overhead %.0f MB\n",
+                   (const char *)key, c->n, factor, ceil(overhead));
+      }
+      if(f)
+        fprintf(f, "%s %.17g %.17g %.17g %.17g %.17g %.17g\n", (const char *)key, c->n, c->sx, c->sy, c->sxx,
+                c->sxy, c->max_ratio);
+    }
+    if(f)
+    {
+      fclose(f);
+      dt_print(DT_DEBUG_TILING, "[tiling calibration] measurements written to %s\n", path);
+    }
+  }
+  if(_calibration) g_hash_table_destroy(_calibration);
+  _calibration = NULL;
+  g_mutex_unlock(&_calibration_lock);
+}
+
+#undef CALIBRATION_MARGIN
+#undef CALIBRATION_MIN_SAMPLES
+#undef CALIBRATION_FILE
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -67,8 +67,41 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
                      const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                      struct dt_develop_tiling_t *tiling);
 
-int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
-                                     const float factor, const size_t overhead);
+/** memory a module really uses while it processes, measured with -d tilingcalib. */
+typedef struct dt_tiling_calibration_t
+{
+  gboolean active;
+  size_t host_start;   // dt_alloc_align() bytes in use when the module started
+  int devid;
+  size_t device_start; // device bytes in use when the module started, without its input
+} dt_tiling_calibration_t;
+
+/** starts measuring a module. device_input is the size of its input if that is already on the device. */
+void dt_tiling_calibration_begin(struct dt_dev_pixelpipe_t *pipe, const size_t device_input,
+                                 dt_tiling_calibration_t *calib);
+
+/** adds the peak of the module since dt_tiling_calibration_begin() to its measurements. runs that
+    were tiled are left out, they don't tell what the whole roi needs. */
+void dt_tiling_calibration_end(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                               const dt_tiling_calibration_t *calib, const dt_iop_roi_t *roi_in,
+                               const dt_iop_roi_t *roi_out, const unsigned bpp,
+                               const dt_develop_tiling_t *tiling, const gboolean on_device,
+                               const gboolean tiled);
+
+/** with tiling/use_calibration, replaces factor and overhead by what was measured for the module. */
+void dt_tiling_calibration_apply(struct dt_iop_module_t *self, dt_develop_tiling_t *tiling);
+
+/** prints the suggested requirements and writes the measurements to tiling_calibration.txt. */
+void dt_tiling_calibration_cleanup(void);
+
+/** have the next dt_tiling_piece_fits_host_memory() read host_memory_limit again. */
+void dt_tiling_update_settings(void);
+
+/** whether the module can process input into output of width x height untiled. input and output the pipe
+    keeps in files (see dt_dev_pixelpipe_cache_spill()) don't count against host memory. */
+int dt_tiling_piece_fits_host_memory(const struct dt_dev_pixelpipe_iop_t *piece, const void *input,
+                                     const void *output, const size_t width, const size_t height,
+                                     const unsigned bpp, const float factor, const size_t overhead);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -279,6 +279,7 @@ static void _thumbs_move(dt_culling_t *table, int move)
 
   if(new_offset != table->offset)
   {
+    table->direction = (new_offset > table->offset) ? 1 : -1;
     table->offset = new_offset;
     dt_culling_full_redraw(table, TRUE);
   }
@@ -881,90 +882,67 @@ void dt_culling_init(dt_culling_t *table, int offset)
   table->offset_imgid = first_id;
 }
 
-static void _thumbs_prefetch(dt_culling_t *table)
+// prefetch the next (or previous) count images after imgid
+static void _thumbs_prefetch_from(dt_culling_t *table, const int imgid, const gboolean next, const int count,
+                                  const dt_mipmap_size_t mip)
 {
-  if(!table || g_list_length(table->list) < 1) return;
-
-  // get the mip level by using the max image size actually shown
-  int maxw = 0;
-  int maxh = 0;
-  GList *l = table->list;
-  while(l)
-  {
-    dt_thumbnail_t *th = (dt_thumbnail_t *)l->data;
-    maxw = MAX(maxw, th->width);
-    maxh = MAX(maxh, th->height);
-    l = g_list_next(l);
-  }
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, maxw, maxh);
-
-  // prefetch next image
   gchar *query;
   sqlite3_stmt *stmt;
-  dt_thumbnail_t *last = (dt_thumbnail_t *)g_list_last(table->list)->data;
   if(table->navigate_inside_selection)
   {
-    query
-        = dt_util_dstrcat(NULL,
-                          "SELECT m.imgid "
-                          "FROM memory.collected_images AS m, main.selected_images AS s "
-                          "WHERE m.imgid = s.imgid"
-                          " AND m.rowid > (SELECT mm.rowid FROM memory.collected_images AS mm WHERE mm.imgid=%d) "
-                          "ORDER BY m.rowid "
-                          "LIMIT 1",
-                          last->imgid);
+    query = dt_util_dstrcat(NULL,
+                            "SELECT m.imgid "
+                            "FROM memory.collected_images AS m, main.selected_images AS s "
+                            "WHERE m.imgid = s.imgid"
+                            " AND m.rowid %s (SELECT mm.rowid FROM memory.collected_images AS mm WHERE mm.imgid=%d) "
+                            "ORDER BY m.rowid %s "
+                            "LIMIT %d",
+                            next ? ">" : "<", imgid, next ? "ASC" : "DESC", count);
   }
   else
   {
-    query
-        = dt_util_dstrcat(NULL,
-                          "SELECT m.imgid "
-                          "FROM memory.collected_images AS m "
-                          "WHERE m.rowid > (SELECT mm.rowid FROM memory.collected_images AS mm WHERE mm.imgid=%d) "
-                          "ORDER BY m.rowid "
-                          "LIMIT 1",
-                          last->imgid);
+    query = dt_util_dstrcat(NULL,
+                            "SELECT m.imgid "
+                            "FROM memory.collected_images AS m "
+                            "WHERE m.rowid %s (SELECT mm.rowid FROM memory.collected_images AS mm WHERE mm.imgid=%d) "
+                            "ORDER BY m.rowid %s "
+                            "LIMIT %d",
+                            next ? ">" : "<", imgid, next ? "ASC" : "DESC", count);
   }
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
     const int id = sqlite3_column_int(stmt, 0);
     if(id > 0) dt_mipmap_cache_get(darktable.mipmap_cache, NULL, id, mip, DT_MIPMAP_PREFETCH, 'r');
   }
   sqlite3_finalize(stmt);
   g_free(query);
+}
 
-  // prefetch previous image
-  dt_thumbnail_t *prev = (dt_thumbnail_t *)g_list_first(table->list)->data;
-  if(table->navigate_inside_selection)
-  {
-    query
-        = dt_util_dstrcat(NULL,
-                          "SELECT m.imgid "
-                          "FROM memory.collected_images AS m, main.selected_images AS s "
-                          "WHERE m.imgid = s.imgid"
-                          " AND m.rowid < (SELECT mm.rowid FROM memory.collected_images AS mm WHERE mm.imgid=%d) "
-                          "ORDER BY m.rowid DESC "
-                          "LIMIT 1",
-                          prev->imgid);
-  }
-  else
-  {
-    query
-        = dt_util_dstrcat(NULL,
-                          "SELECT m.imgid "
-                          "FROM memory.collected_images AS m "
-                          "WHERE m.rowid < (SELECT mm.rowid FROM memory.collected_images AS mm WHERE mm.imgid=%d) "
-                          "ORDER BY m.rowid DESC "
-                          "LIMIT 1",
-                          prev->imgid);
-  }
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+static void _thumbs_prefetch(dt_culling_t *table)
+{
+  if(!table || g_list_length(table->list) < 1) return;
+
+  // get the mip level by using the max image size actually shown
+  int maxw = 0;
+  int maxh = 0;
+  GList *l = table->list;
+  while(l)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    if(id > 0) dt_mipmap_cache_get(darktable.mipmap_cache, NULL, id, mip, DT_MIPMAP_PREFETCH, 'r');
+    dt_thumbnail_t *th = (dt_thumbnail_t *)l->data;
+    maxw = MAX(maxw, th->width);
+    maxh = MAX(maxh, th->height);
+    l = g_list_next(l);
   }
+  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, maxw, maxh);
+
+  // a whole page in the direction we are browsing, so the next key press finds the right mips in memory,
+  // and a single image the other way
+  const int ahead = MAX(1, table->thumbs_count);
+  dt_thumbnail_t *last = (dt_thumbnail_t *)g_list_last(table->list)->data;
+  dt_thumbnail_t *first = (dt_thumbnail_t *)g_list_first(table->list)->data;
+  _thumbs_prefetch_from(table, last->imgid, TRUE, table->direction >= 0 ? ahead : 1, mip);
+  _thumbs_prefetch_from(table, first->imgid, FALSE, table->direction < 0 ? ahead : 1, mip);
 }
 
 static gboolean _thumbs_recreate_list_at(dt_culling_t *table, const int offset)
@@ -1359,6 +1337,7 @@ void dt_culling_full_redraw(dt_culling_t *table, gboolean force)
     table->select_desactivate = TRUE;
     // deselect all
     DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM main.selected_images", NULL, NULL, NULL);
+    dt_selection_invalidate(darktable.selection);
     // select all active images
     GList *ls = NULL;
     l = table->list;
@@ -52,6 +52,7 @@ typedef struct dt_culling_t
   int offset_imgid;
 
   int thumbs_count;            // last nb of thumb to display
+  int direction;               // sign of the last move, we prefetch more images that way
   int view_width, view_height; // last main widget size
   GdkRectangle thumbs_area;    // coordinate of all the currently loaded thumbs area
 
@@ -197,6 +197,7 @@ static gboolean _event_image_draw(GtkWidget *widget, cairo_t *cr, gpointer user_
   // if we don't have it in memory, we want the image surface
   if(!thumb->img_surf || thumb->img_surf_dirty)
   {
+    gboolean standin = FALSE;
     // let's ensure we have the right margins
     _thumb_retrieve_margins(thumb);
 
@@ -304,16 +305,21 @@ static gboolean _event_image_draw(GtkWidget *widget, cairo_t *cr, gpointer user_
       {
         // if the image is missing, we reload it again
         g_timeout_add(250, _thumb_expose_again, widget);
-        // we still draw the thumb to avoid flickering
-        _thumb_draw_image(thumb, cr);
-        return TRUE;
+        if(!img_surf)
+        {
+          // we still draw the thumb to avoid flickering
+          _thumb_draw_image(thumb, cr);
+          return TRUE;
+        }
+        // another mip stands in, we show it upscaled instead of nothing until the right one is ready
+        standin = TRUE;
       }
 
       cairo_surface_t *tmp_surf = thumb->img_surf;
       thumb->img_surf = img_surf;
       if(tmp_surf && cairo_surface_get_reference_count(tmp_surf) > 0) cairo_surface_destroy(tmp_surf);
 
-      if(thumb->display_focus)
+      if(thumb->display_focus && !standin)
       {
         uint8_t *full_res_thumb = NULL;
         int32_t full_res_thumb_wd, full_res_thumb_ht;
@@ -339,7 +345,7 @@ static gboolean _event_image_draw(GtkWidget *widget, cairo_t *cr, gpointer user_
       }
     }
 
-    thumb->img_surf_dirty = FALSE;
+    thumb->img_surf_dirty = standin;
     // let save thumbnail image size
     thumb->img_width = cairo_image_surface_get_width(thumb->img_surf);
     thumb->img_height = cairo_image_surface_get_height(thumb->img_surf);
@@ -621,6 +627,7 @@ static gboolean _event_grouping_release(GtkWidget *widget, GdkEventButton *event
       DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, thumb->groupid);
       sqlite3_step(stmt);
       sqlite3_finalize(stmt);
+      dt_selection_invalidate(darktable.selection);
     }
     else if(!darktable.gui->grouping
             || thumb->groupid == darktable.gui->expanded_group_id) // the group is already expanded, so ...
@@ -703,14 +710,7 @@ static void _dt_selection_changed_callback(gpointer instance, gpointer user_data
   if(!thumb) return;
   if(!gtk_widget_is_visible(thumb->w_main)) return;
 
-  gboolean selected = FALSE;
-  /* clear and reset statements */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-  /* bind imgid to prepared statements */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, thumb->imgid);
-  /* lets check if imgid is selected */
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW) selected = TRUE;
+  const gboolean selected = dt_selection_is_selected(darktable.selection, thumb->imgid);
 
   // if there's a change, update the thumb
   if(selected != thumb->selected)
@@ -838,6 +838,32 @@ static gboolean _event_main_drag_motion(GtkWidget *widget, GdkDragContext *dc, g
   return TRUE;
 }
 
+static void _thumb_connect_signals(dt_thumbnail_t *thumb)
+{
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_ACTIVE_IMAGES_CHANGE,
+                            G_CALLBACK(_dt_active_images_callback), thumb);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_SELECTION_CHANGED,
+                            G_CALLBACK(_dt_selection_changed_callback), thumb);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED,
+                            G_CALLBACK(_dt_mipmaps_updated_callback), thumb);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_PREVIEW_PIPE_FINISHED,
+                            G_CALLBACK(_dt_preview_updated_callback), thumb);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED,
+                            G_CALLBACK(_dt_image_info_changed_callback), thumb);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
+                            G_CALLBACK(_dt_collection_changed_callback), thumb);
+}
+
+static void _thumb_disconnect_signals(dt_thumbnail_t *thumb)
+{
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_selection_changed_callback), thumb);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_active_images_callback), thumb);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_mipmaps_updated_callback), thumb);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_preview_updated_callback), thumb);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_image_info_changed_callback), thumb);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_changed_callback), thumb);
+}
+
 GtkWidget *dt_thumbnail_create_widget(dt_thumbnail_t *thumb)
 {
   // main widget (overlay)
@@ -855,18 +881,7 @@ GtkWidget *dt_thumbnail_create_widget(dt_thumbnail_t *thumb)
     g_signal_connect(G_OBJECT(thumb->w_main), "button-release-event", G_CALLBACK(_event_main_release), thumb);
 
     g_object_set_data(G_OBJECT(thumb->w_main), "thumb", thumb);
-    dt_control_signal_connect(darktable.signals, DT_SIGNAL_ACTIVE_IMAGES_CHANGE,
-                              G_CALLBACK(_dt_active_images_callback), thumb);
-    dt_control_signal_connect(darktable.signals, DT_SIGNAL_SELECTION_CHANGED,
-                              G_CALLBACK(_dt_selection_changed_callback), thumb);
-    dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED,
-                              G_CALLBACK(_dt_mipmaps_updated_callback), thumb);
-    dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_PREVIEW_PIPE_FINISHED,
-                              G_CALLBACK(_dt_preview_updated_callback), thumb);
-    dt_control_signal_connect(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED,
-                              G_CALLBACK(_dt_image_info_changed_callback), thumb);
-    dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
-                              G_CALLBACK(_dt_collection_changed_callback), thumb);
+    _thumb_connect_signals(thumb);
 
     // the background
     thumb->w_back = gtk_event_box_new();
@@ -1038,22 +1053,13 @@ GtkWidget *dt_thumbnail_create_widget(dt_thumbnail_t *thumb)
   return thumb->w_main;
 }
 
-dt_thumbnail_t *dt_thumbnail_new(int width, int height, int imgid, int rowid, dt_thumbnail_overlay_t over, gboolean zoomable)
+// read and cache all the infos from dt_image_t that we need
+static void _thumb_read_image(dt_thumbnail_t *thumb)
 {
-  dt_thumbnail_t *thumb = calloc(1, sizeof(dt_thumbnail_t));
-  thumb->width = width;
-  thumb->height = height;
-  thumb->imgid = imgid;
-  thumb->rowid = rowid;
-  thumb->over = over;
-  thumb->zoomable = zoomable;
-  thumb->zoom = 1.0f;
-  thumb->overlay_timeout_duration = dt_conf_get_int("plugins/lighttable/overlay_timeout");
-
-  // we read and cache all the infos from dt_image_t that we need
   const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->imgid, 'r');
   if(img)
   {
+    g_free(thumb->filename);
     thumb->filename = g_strdup(img->filename);
     if(thumb->over != DT_THUMBNAIL_OVERLAYS_NONE)
     {
@@ -1063,15 +1069,16 @@ dt_thumbnail_t *dt_thumbnail_new(int width, int height, int imgid, int rowid, dt
     dt_image_cache_read_release(darktable.image_cache, img);
   }
   if(thumb->over == DT_THUMBNAIL_OVERLAYS_ALWAYS_EXTENDED || thumb->over == DT_THUMBNAIL_OVERLAYS_HOVER_EXTENDED
-     || over == DT_THUMBNAIL_OVERLAYS_MIXED || thumb->over == DT_THUMBNAIL_OVERLAYS_HOVER_BLOCK)
+     || thumb->over == DT_THUMBNAIL_OVERLAYS_MIXED || thumb->over == DT_THUMBNAIL_OVERLAYS_HOVER_BLOCK)
     _thumb_update_extended_infos_line(thumb);
 
   // we read all other infos
   _image_get_infos(thumb);
+}
 
-  // we create the widget
-  dt_thumbnail_create_widget(thumb);
-
+// selection, active and mouse over state, altered tooltip and icons of a freshly (re)filled thumbnail
+static void _thumb_update_state(dt_thumbnail_t *thumb)
+{
   // let's see if the images are selected or active or mouse_overed
   _dt_active_images_callback(NULL, thumb);
   _dt_selection_changed_callback(NULL, thumb);
@@ -1090,19 +1097,90 @@ dt_thumbnail_t *dt_thumbnail_new(int width, int height, int imgid, int rowid, dt
 
   // ensure all icons are up to date
   _thumb_update_icons(thumb);
+}
+
+dt_thumbnail_t *dt_thumbnail_new(int width, int height, int imgid, int rowid, dt_thumbnail_overlay_t over, gboolean zoomable)
+{
+  dt_thumbnail_t *thumb = calloc(1, sizeof(dt_thumbnail_t));
+  thumb->width = width;
+  thumb->height = height;
+  thumb->imgid = imgid;
+  thumb->rowid = rowid;
+  thumb->over = over;
+  thumb->zoomable = zoomable;
+  thumb->zoom = 1.0f;
+  thumb->overlay_timeout_duration = dt_conf_get_int("plugins/lighttable/overlay_timeout");
+
+  _thumb_read_image(thumb);
+
+  // we create the widget
+  dt_thumbnail_create_widget(thumb);
+
+  _thumb_update_state(thumb);
 
   return thumb;
 }
 
+// give a thumbnail released by dt_thumbnail_recycle() a new image, keeping its widgets
+void dt_thumbnail_reuse(dt_thumbnail_t *thumb, int width, int height, int imgid, int rowid,
+                        dt_thumbnail_overlay_t over)
+{
+  thumb->imgid = imgid;
+  thumb->rowid = rowid;
+  thumb->mouse_over = FALSE;
+  thumb->selected = FALSE;
+  thumb->active = FALSE;
+  thumb->has_audio = FALSE;
+  thumb->has_localcopy = FALSE;
+  thumb->moved = FALSE;
+  thumb->zoom = 1.0f;
+  thumb->zoomx = thumb->zoomy = thumb->current_zx = thumb->current_zy = 0;
+  thumb->zoom_100 = 0.0f;
+  dt_thumbnail_set_group_border(thumb, DT_THUMBNAIL_BORDER_NONE);
+  gtk_style_context_remove_class(gtk_widget_get_style_context(thumb->w_main), "dt_last_active");
+  _set_flag(thumb->w_bottom_eb, GTK_STATE_FLAG_PRELIGHT, FALSE);
+  _set_flag(thumb->w_image_box, GTK_STATE_FLAG_PRELIGHT, FALSE);
+  gtk_widget_set_tooltip_text(thumb->w_altered, NULL);
+
+  // the overlays mode may have changed while the thumbnail was waiting to be reused
+  if(thumb->over != over) dt_thumbnail_set_overlay(thumb, over);
+
+  _thumb_read_image(thumb);
+
+  gchar *lb = NULL;
+  if(thumb->over == DT_THUMBNAIL_OVERLAYS_ALWAYS_EXTENDED || thumb->over == DT_THUMBNAIL_OVERLAYS_HOVER_EXTENDED
+     || thumb->over == DT_THUMBNAIL_OVERLAYS_MIXED || thumb->over == DT_THUMBNAIL_OVERLAYS_HOVER_BLOCK)
+    lb = dt_util_dstrcat(NULL, "%s", thumb->info_line);
+  gtk_label_set_markup(GTK_LABEL(thumb->w_bottom), lb ? lb : "");
+  g_free(lb);
+  GtkDarktableThumbnailBtn *btn = (GtkDarktableThumbnailBtn *)thumb->w_color;
+  btn->icon_flags = thumb->colorlabels;
+
+  _thumb_connect_signals(thumb);
+  gtk_widget_show(thumb->w_main);
+  dt_thumbnail_resize(thumb, width, height, FALSE);
+  dt_thumbnail_image_refresh(thumb);
+
+  _thumb_update_state(thumb);
+}
+
+// detach the thumbnail from its image so it can be handed to dt_thumbnail_reuse() later
+void dt_thumbnail_recycle(dt_thumbnail_t *thumb)
+{
+  if(thumb->overlay_timeout_id > 0) g_source_remove(thumb->overlay_timeout_id);
+  thumb->overlay_timeout_id = 0;
+  _thumb_disconnect_signals(thumb);
+  if(thumb->img_surf && cairo_surface_get_reference_count(thumb->img_surf) > 0)
+    cairo_surface_destroy(thumb->img_surf);
+  thumb->img_surf = NULL;
+  thumb->img_surf_dirty = TRUE;
+  gtk_widget_hide(thumb->w_main);
+}
+
 void dt_thumbnail_destroy(dt_thumbnail_t *thumb)
 {
   if(thumb->overlay_timeout_id > 0) g_source_remove(thumb->overlay_timeout_id);
-  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_selection_changed_callback), thumb);
-  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_active_images_callback), thumb);
-  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_mipmaps_updated_callback), thumb);
-  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_preview_updated_callback), thumb);
-  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_image_info_changed_callback), thumb);
-  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_changed_callback), thumb);
+  _thumb_disconnect_signals(thumb);
   if(thumb->img_surf && cairo_surface_get_reference_count(thumb->img_surf) > 0)
     cairo_surface_destroy(thumb->img_surf);
   thumb->img_surf = NULL;
@@ -131,6 +131,10 @@ typedef struct
 
 dt_thumbnail_t *dt_thumbnail_new(int width, int height, int imgid, int rowid, dt_thumbnail_overlay_t over, gboolean zoomable);
 void dt_thumbnail_destroy(dt_thumbnail_t *thumb);
+// detach a thumbnail from its image, hiding it, and give it a new one without recreating the widgets
+void dt_thumbnail_recycle(dt_thumbnail_t *thumb);
+void dt_thumbnail_reuse(dt_thumbnail_t *thumb, int width, int height, int imgid, int rowid,
+                        dt_thumbnail_overlay_t over);
 GtkWidget *dt_thumbnail_create_widget(dt_thumbnail_t *thumb);
 void dt_thumbnail_resize(dt_thumbnail_t *thumb, int width, int height, gboolean force);
 void dt_thumbnail_set_group_border(dt_thumbnail_t *thumb, dt_thumbnail_border_t border);
@@ -21,9 +21,12 @@
 #include "common/colorlabels.h"
 #include "common/debug.h"
 #include "common/history.h"
+#include "common/image_cache.h"
+#include "common/mipmap_cache.h"
 #include "common/ratings.h"
 #include "common/selection.h"
 #include "control/control.h"
+#include "control/jobs.h"
 #include "gui/accelerators.h"
 #include "gui/drag_and_drop.h"
 #include "views/view.h"
@@ -36,11 +39,66 @@ static gint _list_compare_by_imgid(gconstpointer a, gconstpointer b)
   if(th->imgid < 0 || b < 0) return 1;
   return (th->imgid != imgid);
 }
-static void _list_remove_thumb(gpointer user_data)
+
+// maximum number of hidden thumbnails kept for reuse
+#define THUMBTABLE_POOL_SIZE 256
+
+// image and position of a thumbnail still to be created in dt_thumbtable_full_redraw()
+typedef struct _thumb_place_t
+{
+  int imgid, rowid;
+  int x, y;
+} _thumb_place_t;
+
+// get a thumbnail for the image, recycled from the pool if possible
+static dt_thumbnail_t *_thumb_get_new(dt_thumbtable_t *table, const int imgid, const int rowid)
+{
+  dt_thumbnail_t *thumb = NULL;
+  if(table->pool)
+  {
+    thumb = (dt_thumbnail_t *)table->pool->data;
+    table->pool = g_list_delete_link(table->pool, table->pool);
+    dt_thumbnail_reuse(thumb, table->thumb_size, table->thumb_size, imgid, rowid, table->overlays);
+  }
+  else
+    thumb = dt_thumbnail_new(table->thumb_size, table->thumb_size, imgid, rowid, table->overlays, FALSE);
+
+  if(table->mode == DT_THUMBTABLE_MODE_FILMSTRIP)
+  {
+    thumb->single_click = TRUE;
+    thumb->sel_mode = DT_THUMBNAIL_SEL_MODE_MOD_ONLY;
+  }
+  else
+  {
+    thumb->single_click = FALSE;
+    thumb->sel_mode = DT_THUMBNAIL_SEL_MODE_NORMAL;
+  }
+  return thumb;
+}
+
+// put the thumbnail at its position, recycled ones are already inside the main widget
+static void _thumb_put(dt_thumbtable_t *table, dt_thumbnail_t *thumb)
+{
+  if(gtk_widget_get_parent(thumb->w_main) == table->widget)
+    gtk_layout_move(GTK_LAYOUT(table->widget), thumb->w_main, thumb->x, thumb->y);
+  else
+    gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, thumb->x, thumb->y);
+}
+
+// the thumbnail is not needed anymore, keep it for later if the pool isn't full
+static void _thumb_release(dt_thumbtable_t *table, dt_thumbnail_t *thumb)
 {
-  dt_thumbnail_t *thumb = (dt_thumbnail_t *)user_data;
-  gtk_container_remove(GTK_CONTAINER(gtk_widget_get_parent(thumb->w_main)), thumb->w_main);
-  dt_thumbnail_destroy(thumb);
+  if(g_list_length(table->pool) < THUMBTABLE_POOL_SIZE
+     && gtk_widget_get_parent(thumb->w_main) == table->widget)
+  {
+    dt_thumbnail_recycle(thumb);
+    table->pool = g_list_prepend(table->pool, thumb);
+  }
+  else
+  {
+    gtk_container_remove(GTK_CONTAINER(gtk_widget_get_parent(thumb->w_main)), thumb->w_main);
+    dt_thumbnail_destroy(thumb);
+  }
 }
 
 // get the class name associated with the overlays mode
@@ -197,6 +255,128 @@ static int _thumb_get_rowid(int imgid)
   return id;
 }
 
+// read-ahead of the thumbnails in scroll direction.
+// we read one screen ahead, plus what the current scroll speed covers in THUMBTABLE_PREFETCH_LOOKAHEAD
+// seconds, but never more than THUMBTABLE_PREFETCH_SCREENS screens
+#define THUMBTABLE_PREFETCH_LOOKAHEAD 0.5
+#define THUMBTABLE_PREFETCH_SCREENS 4
+
+// bumped whenever the queued prefetches are no longer wanted, jobs of older generations do nothing
+static gint _prefetch_generation = 0;
+
+typedef struct _prefetch_t
+{
+  gint generation;
+  dt_mipmap_size_t mip;
+  int count;
+  int32_t imgid[];
+} _prefetch_t;
+
+static int32_t _prefetch_job_run(dt_job_t *job)
+{
+  const _prefetch_t *p = dt_control_job_get_params(job);
+  if(g_atomic_int_get(&_prefetch_generation) != p->generation) return 0;
+  // the thumbs of this row will need their image structs as well
+  dt_image_cache_prefetch(darktable.image_cache, p->imgid, p->count);
+  for(int k = 0; k < p->count; k++)
+  {
+    if(g_atomic_int_get(&_prefetch_generation) != p->generation) break;
+    // only what the disk cache can give back quickly, generating thumbnails is left to the visible ones
+    if(!dt_mipmap_cache_thumbnail_on_disk(darktable.mipmap_cache, p->imgid[k], p->mip)) continue;
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, p->imgid[k], p->mip, DT_MIPMAP_BLOCKING_PREFETCH, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+  return 0;
+}
+
+// queue the images with rowid in [from, to], nearest to the view first, one job per row
+static void _prefetch_rows(dt_thumbtable_t *table, const int from, const int to, const int dir)
+{
+  const int per_row = MAX(1, table->thumbs_per_row);
+  const dt_mipmap_size_t mip
+      = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, table->thumb_size, table->thumb_size);
+  const gint generation = g_atomic_int_get(&_prefetch_generation);
+
+  sqlite3_stmt *stmt;
+  gchar *query = dt_util_dstrcat(NULL,
+                                 "SELECT imgid FROM memory.collected_images WHERE rowid>=%d AND rowid<=%d"
+                                 " ORDER BY rowid %s",
+                                 from, to, dir > 0 ? "ASC" : "DESC");
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  gboolean done = FALSE;
+  while(!done)
+  {
+    const size_t size = sizeof(_prefetch_t) + sizeof(int32_t) * per_row;
+    _prefetch_t *p = (_prefetch_t *)calloc(1, size);
+    if(!p) break;
+    p->generation = generation;
+    p->mip = mip;
+    while(p->count < per_row && !(done = sqlite3_step(stmt) != SQLITE_ROW))
+      p->imgid[p->count++] = sqlite3_column_int(stmt, 0);
+    dt_job_t *job = p->count ? dt_control_job_create(&_prefetch_job_run, "prefetch %d thumbnails", p->count) : NULL;
+    if(!job)
+    {
+      free(p);
+      break;
+    }
+    dt_control_job_set_params_with_size(job, p, size, free);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  }
+  g_free(query);
+  sqlite3_finalize(stmt);
+}
+
+// called whenever the offset may have changed, tracks scroll direction and speed
+static void _prefetch_update(dt_thumbtable_t *table)
+{
+  if(table->mode != DT_THUMBTABLE_MODE_FILEMANAGER && table->mode != DT_THUMBTABLE_MODE_FILMSTRIP) return;
+  if(!dt_conf_get_bool("cache_disk_backend") || table->rows <= 0) return;
+
+  const int per_row = MAX(1, table->thumbs_per_row);
+  const double now = dt_get_wtime();
+  const float drows = (float)(table->offset - table->prefetch_offset) / per_row;
+  const double elapsed = now - table->prefetch_time;
+  table->prefetch_offset = table->offset;
+  table->prefetch_time = now;
+  if(drows == 0.0f) return;
+
+  const int dir = drows > 0.0f ? 1 : -1;
+  if(dir != table->prefetch_dir)
+  {
+    // what is still queued lies behind us now
+    g_atomic_int_inc(&_prefetch_generation);
+    table->prefetch_dir = dir;
+    table->prefetch_end = 0;
+    table->prefetch_velocity = 0.0f;
+  }
+  // smoothed speed in rows per second, a pause of a second starts over
+  const float velocity = elapsed > 0.0 && elapsed < 1.0 ? fabsf(drows) / elapsed : 0.0f;
+  table->prefetch_velocity = 0.5f * (table->prefetch_velocity + velocity);
+
+  const int ahead = per_row
+                    * MIN(table->rows * THUMBTABLE_PREFETCH_SCREENS,
+                          table->rows + (int)(table->prefetch_velocity * THUMBTABLE_PREFETCH_LOOKAHEAD));
+  // in filmstrip the offset is the image in the center
+  const int first = (table->mode == DT_THUMBTABLE_MODE_FILMSTRIP) ? MAX(1, table->offset - table->rows / 2)
+                                                                   : table->offset;
+  const int last = first + table->rows * per_row - 1;
+  if(dir > 0)
+  {
+    const int from = table->prefetch_end ? MAX(last + 1, table->prefetch_end + 1) : last + 1;
+    const int to = last + ahead;
+    if(from <= to) _prefetch_rows(table, from, to, dir);
+    table->prefetch_end = MAX(table->prefetch_end, to);
+  }
+  else
+  {
+    const int to = table->prefetch_end ? MIN(first - 1, table->prefetch_end - 1) : first - 1;
+    const int from = MAX(1, first - ahead);
+    if(from <= to) _prefetch_rows(table, from, to, dir);
+    table->prefetch_end = table->prefetch_end ? MIN(table->prefetch_end, from) : from;
+  }
+}
+
 // get the coordinate of the rectangular area used by all the loaded thumbs
 static void _pos_compute_area(dt_thumbtable_t *table)
 {
@@ -416,8 +596,7 @@ static int _thumbs_remove_unneeded(dt_thumbtable_t *table)
            && (th->x + table->thumb_size <= 0 || th->x > table->view_width)))
     {
       table->list = g_list_remove_link(table->list, l);
-      gtk_container_remove(GTK_CONTAINER(gtk_widget_get_parent(th->w_main)), th->w_main);
-      dt_thumbnail_destroy(th);
+      _thumb_release(table, th);
       g_list_free(l);
       changed++;
     }
@@ -457,17 +636,12 @@ static int _thumbs_load_needed(dt_thumbtable_t *table)
     {
       if(posy < table->view_height) // we don't load invisible thumbs
       {
-        dt_thumbnail_t *thumb = dt_thumbnail_new(table->thumb_size, table->thumb_size, sqlite3_column_int(stmt, 1),
-                                                 sqlite3_column_int(stmt, 0), table->overlays, FALSE);
-        if(table->mode == DT_THUMBTABLE_MODE_FILMSTRIP)
-        {
-          thumb->single_click = TRUE;
-          thumb->sel_mode = DT_THUMBNAIL_SEL_MODE_MOD_ONLY;
-        }
+        dt_thumbnail_t *thumb
+            = _thumb_get_new(table, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 0));
         thumb->x = posx;
         thumb->y = posy;
         table->list = g_list_prepend(table->list, thumb);
-        gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
+        _thumb_put(table, thumb);
         changed++;
       }
       _pos_get_previous(table, &posx, &posy);
@@ -499,17 +673,12 @@ static int _thumbs_load_needed(dt_thumbtable_t *table)
     {
       if(posy + table->thumb_size >= 0) // we don't load invisible thumbs
       {
-        dt_thumbnail_t *thumb = dt_thumbnail_new(table->thumb_size, table->thumb_size, sqlite3_column_int(stmt, 1),
-                                                 sqlite3_column_int(stmt, 0), table->overlays, FALSE);
-        if(table->mode == DT_THUMBTABLE_MODE_FILMSTRIP)
-        {
-          thumb->single_click = TRUE;
-          thumb->sel_mode = DT_THUMBNAIL_SEL_MODE_MOD_ONLY;
-        }
+        dt_thumbnail_t *thumb
+            = _thumb_get_new(table, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 0));
         thumb->x = posx;
         thumb->y = posy;
         table->list = g_list_append(table->list, thumb);
-        gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
+        _thumb_put(table, thumb);
         changed++;
       }
       _pos_get_next(table, &posx, &posy);
@@ -648,6 +817,8 @@ static gboolean _move(dt_thumbtable_t *table, const int x, const int y, gboolean
   // update scrollbars
   _thumbtable_update_scrollbars(table);
 
+  _prefetch_update(table);
+
   return TRUE;
 }
 
@@ -1164,6 +1335,9 @@ static void _dt_collection_changed_callback(gpointer instance, dt_collection_cha
 {
   if(!user_data) return;
   dt_thumbtable_t *table = (dt_thumbtable_t *)user_data;
+  // rowids don't mean the same anymore, start the read-ahead over
+  g_atomic_int_inc(&_prefetch_generation);
+  table->prefetch_dir = table->prefetch_end = 0;
   if(query_change == DT_COLLECTION_CHANGE_RELOAD)
   {
     /** Here's how it works
@@ -1536,6 +1710,7 @@ void dt_thumbtable_scrollbar_changed(dt_thumbtable_t *table, const int x, const
     {
       table->offset = new_offset;
       dt_thumbtable_full_redraw(table, TRUE);
+      _prefetch_update(table);
     }
   }
   else if(table->mode == DT_THUMBTABLE_MODE_ZOOM)
@@ -1615,7 +1790,9 @@ void dt_thumbtable_full_redraw(dt_thumbtable_t *table, gboolean force)
     }
 
     // we add the thumbs
+    // the new ones are only created once the old ones not needed anymore are in the pool, so they can be reused
     GList *newlist = NULL;
+    GArray *pending = g_array_new(FALSE, FALSE, sizeof(_thumb_place_t));
     int nbnew = 0;
     gchar *query
         = dt_util_dstrcat(NULL, "SELECT rowid, imgid FROM memory.collected_images WHERE rowid>=%d LIMIT %d",
@@ -1646,17 +1823,10 @@ void dt_thumbtable_full_redraw(dt_thumbtable_t *table, gboolean force)
       }
       else
       {
-        // we create a completly new thumb
-        dt_thumbnail_t *thumb = dt_thumbnail_new(table->thumb_size, table->thumb_size, nid, nrow, table->overlays, FALSE);
-        if(table->mode == DT_THUMBTABLE_MODE_FILMSTRIP)
-        {
-          thumb->single_click = TRUE;
-          thumb->sel_mode = DT_THUMBNAIL_SEL_MODE_MOD_ONLY;
-        }
-        thumb->x = posx;
-        thumb->y = posy;
-        newlist = g_list_append(newlist, thumb);
-        gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
+        // we need a new thumb, keep its place in the list
+        const _thumb_place_t place = { .imgid = nid, .rowid = nrow, .x = posx, .y = posy };
+        g_array_append_val(pending, place);
+        newlist = g_list_append(newlist, NULL);
         nbnew++;
       }
       _pos_get_next(table, &posx, &posy);
@@ -1665,9 +1835,33 @@ void dt_thumbtable_full_redraw(dt_thumbtable_t *table, gboolean force)
     }
 
     // now we cleanup all remaining thumbs from old table->list and set it again
-    g_list_free_full(table->list, _list_remove_thumb);
+    for(GList *l = table->list; l; l = g_list_next(l)) _thumb_release(table, (dt_thumbnail_t *)l->data);
+    g_list_free(table->list);
     table->list = newlist;
 
+    // the new thumbs all want their image struct, read the missing ones at once
+    if(pending->len > 1)
+    {
+      int32_t *ids = (int32_t *)g_malloc(sizeof(int32_t) * pending->len);
+      for(guint k = 0; k < pending->len; k++) ids[k] = g_array_index(pending, _thumb_place_t, k).imgid;
+      dt_image_cache_prefetch(darktable.image_cache, ids, pending->len);
+      g_free(ids);
+    }
+
+    // and fill the holes with recycled or new thumbs
+    guint p = 0;
+    for(GList *l = table->list; l && p < pending->len; l = g_list_next(l))
+    {
+      if(l->data) continue;
+      const _thumb_place_t *place = &g_array_index(pending, _thumb_place_t, p++);
+      dt_thumbnail_t *thumb = _thumb_get_new(table, place->imgid, place->rowid);
+      thumb->x = place->x;
+      thumb->y = place->y;
+      _thumb_put(table, thumb);
+      l->data = thumb;
+    }
+    g_array_free(pending, TRUE);
+
     _pos_compute_area(table);
 
     if(g_slist_length(darktable.view_manager->active_images) > 0
@@ -1813,6 +2007,7 @@ gboolean dt_thumbtable_set_offset(dt_thumbtable_t *table, const int offset, cons
   table->offset = offset;
   dt_conf_set_int("plugins/lighttable/recentcollect/pos0", table->offset);
   if(redraw) dt_thumbtable_full_redraw(table, TRUE);
+  _prefetch_update(table);
   return TRUE;
 }
 
@@ -1828,7 +2023,7 @@ static gboolean _accel_rate(GtkAccelGroup *accel_group, GObject *acceleratable,
 {
   GList *imgs = dt_view_get_images_to_act_on(FALSE);
   dt_ratings_apply_on_list(imgs, GPOINTER_TO_INT(data), TRUE);
-  dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, imgs);
+  dt_collection_update_query_images(darktable.collection, DT_COLLECTION_SORT_RATING, imgs);
   return TRUE;
 }
 static gboolean _accel_color(GtkAccelGroup *accel_group, GObject *acceleratable, const guint keyval,
@@ -1836,7 +2031,7 @@ static gboolean _accel_color(GtkAccelGroup *accel_group, GObject *acceleratable,
 {
   GList *imgs = dt_view_get_images_to_act_on(FALSE);
   dt_colorlabels_toggle_label_on_list(imgs, GPOINTER_TO_INT(data), FALSE);
-  dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, imgs);
+  dt_collection_update_query_images(darktable.collection, DT_COLLECTION_SORT_COLOR, imgs);
   return TRUE;
 }
 static gboolean _accel_copy(GtkAccelGroup *accel_group, GObject *acceleratable, const guint keyval,
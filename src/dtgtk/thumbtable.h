@@ -53,6 +53,10 @@ typedef struct dt_thumbtable_t
   // for zoommable, this is all the images in the row drawn at screen. We don't load laterals images on fly.
   GList *list;
 
+  // thumbnails no longer shown, hidden inside the main widget and waiting to be given a new image
+  // (dt_thumbnail_t), so that scrolling and zooming don't rebuild the widgets of each of them
+  GList *pool;
+
   // rowid of the main shown image inside 'memory.collected_images'
   // for filmstrip this is the image in the center.
   // for zoomable, this is the top-left image (which can be out of screen)
@@ -93,6 +97,13 @@ typedef struct dt_thumbtable_t
 
   // in lighttable preview or culling, we can navigate inside selection or inside full collection
   gboolean navigate_inside_selection;
+
+  // read-ahead of thumbnails in scroll direction
+  int prefetch_offset;     // offset at the last update
+  double prefetch_time;    // and when that was
+  float prefetch_velocity; // smoothed scroll speed in rows per second
+  int prefetch_dir;        // 1 forward, -1 backward
+  int prefetch_end;        // farthest rowid already queued in prefetch_dir, 0 for none
 } dt_thumbtable_t;
 
 dt_thumbtable_t *dt_thumbtable_new();
@@ -17,6 +17,7 @@
 */
 
 #include <glib.h>    // for g_mkdir_with_parents, _
+#include <glib/gstdio.h> // for g_stat, g_unlink
 #include <gtk/gtk.h> // for gtk_init_check
 #include <libintl.h> // for bind_textdomain_codeset, etc
 #include <limits.h>  // for PATH_MAX
@@ -26,13 +27,14 @@
 #include <stdio.h>   // for fprintf, stderr, snprintf, NULL, etc
 #include <stdlib.h>  // for exit, EXIT_FAILURE
 #include <string.h>  // for strcmp
-#include <unistd.h>  // for access, R_OK
 
 #include "common/darktable.h"    // for darktable, darktable_t, dt_cleanup, etc
 #include "common/database.h"     // for dt_database_get
 #include "common/debug.h"        // for DT_DEBUG_SQLITE3_PREPARE_V2
 #include "common/mipmap_cache.h" // for dt_mipmap_size_t, etc
 #include "common/history.h"      // for dt_history_hash_set_mipmap
+#include "common/image.h"        // for dt_image_full_path
+#include "common/opencl.h"       // for dt_opencl_wait_for_programs
 #include "config.h"              // for GETTEXT_PACKAGE, etc
 #include "control/conf.h"        // for dt_conf_get_bool
 
@@ -44,7 +46,116 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+typedef struct _generate_t
+{
+  dt_mipmap_size_t min_mip, max_mip;
+  int32_t min_imgid, max_imgid;
+  gboolean stale_only;
+  int32_t *ids; // ascending
+  size_t count;
+  size_t next;      // next index to hand out to a worker
+  uint8_t *done;    // per index
+  size_t watermark; // all indices below are done
+  size_t finished;
+  gchar *checkpoint;
+  dt_pthread_mutex_t lock;
+} _generate_t;
+
+// the checkpoint holds the parameters of the run and the first image id not known to be done
+static int32_t _checkpoint_read(const _generate_t *g)
+{
+  gchar *contents = NULL;
+  int32_t resume = g->min_imgid;
+  if(g_file_get_contents(g->checkpoint, &contents, NULL, NULL))
+  {
+    int min_mip, max_mip, min_imgid, max_imgid, next;
+    if(sscanf(contents, "%d %d %d %d %d", &min_mip, &max_mip, &min_imgid, &max_imgid, &next) == 5
+       && min_mip == g->min_mip && max_mip == g->max_mip && min_imgid == g->min_imgid && max_imgid == g->max_imgid)
+    {
+      fprintf(stderr, _("resuming interrupted run at image id %d\n"), next);
+      resume = MAX(next, g->min_imgid);
+    }
+    g_free(contents);
+  }
+  return resume;
+}
+
+// expects the lock to be held
+static void _checkpoint_write(const _generate_t *g)
+{
+  const int32_t next = g->watermark < g->count ? g->ids[g->watermark] : g->ids[g->count - 1] + 1;
+  gchar *contents
+      = g_strdup_printf("%d %d %d %d %d\n", g->min_mip, g->max_mip, g->min_imgid, g->max_imgid, next);
+  g_file_set_contents(g->checkpoint, contents, -1, NULL);
+  g_free(contents);
+}
+
+static int64_t _xmp_mtime(const int32_t imgid)
+{
+  char filename[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
+  dt_image_path_append_version(imgid, filename, sizeof(filename));
+  g_strlcat(filename, ".xmp", sizeof(filename));
+  GStatBuf st;
+  return g_stat(filename, &st) ? 0 : st.st_mtime;
+}
+
+static void _generate_image(const _generate_t *g, const int32_t imgid)
+{
+  if(g->stale_only)
+  {
+    // an edit after the thumbnails were written makes all of them stale
+    const int64_t xmp = _xmp_mtime(imgid);
+    gboolean stale = FALSE;
+    for(int k = g->max_mip; k >= (int)g->min_mip && !stale; k--)
+      stale = dt_mipmap_cache_thumbnail_on_disk(darktable.mipmap_cache, imgid, k)
+              && dt_mipmap_cache_thumbnail_mtime(darktable.mipmap_cache, imgid, k) < xmp;
+    if(stale) dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  }
+
+  for(int k = g->max_mip; k >= (int)g->min_mip && k >= 0; k--)
+  {
+    // if the thumbnail is already on disc - do nothing
+    if(dt_mipmap_cache_thumbnail_on_disk(darktable.mipmap_cache, imgid, k)) continue;
+
+    // else, generate thumbnail and store in mipmap cache.
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+
+  // and immediately write thumbs to disc and remove from mipmap cache.
+  dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
+  // thumbnail in sync with image
+  dt_history_hash_set_mipmap(imgid);
+}
+
+static void *_generate_worker(void *data)
+{
+  _generate_t *g = (_generate_t *)data;
+  while(TRUE)
+  {
+    const size_t i = __sync_fetch_and_add(&g->next, 1);
+    if(i >= g->count) break;
+    _generate_image(g, g->ids[i]);
+
+    dt_pthread_mutex_lock(&g->lock);
+    g->done[i] = 1;
+    g->finished++;
+    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", g->finished, g->count, 100.0 * g->finished / g->count,
+            g->ids[i]);
+    const size_t before = g->watermark;
+    while(g->watermark < g->count && g->done[g->watermark]) g->watermark++;
+    if(g->watermark / 32 != before / 32) _checkpoint_write(g);
+    dt_pthread_mutex_unlock(&g->lock);
+  }
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip,
+                                    const int32_t min_imgid, const int32_t max_imgid, const int jobs,
+                                    const gboolean stale_only)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
@@ -60,65 +171,75 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // some progress counter
+  _generate_t g = { .min_mip = min_mip, .max_mip = max_mip, .min_imgid = min_imgid, .max_imgid = max_imgid,
+                    .stale_only = stale_only };
+  g.checkpoint = g_strdup_printf("%s.checkpoint", darktable.mipmap_cache->cachedir);
+  const int32_t first_imgid = _checkpoint_read(&g);
+
+  // collect the images up front, the workers hand out indices into this list
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, first_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    image_count = sqlite3_column_int(stmt, 0);
+    g.count = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
   }
   else
   {
+    g_free(g.checkpoint);
     return 1;
   }
 
-  if(!image_count)
+  if(!g.count)
   {
     fprintf(stderr, _("warning: no images are matching the requested image id range\n"));
     if(min_imgid > max_imgid)
     {
       fprintf(stderr, _("warning: did you want to swap these boundaries?\n"));
     }
+    g_unlink(g.checkpoint);
+    g_free(g.checkpoint);
+    return 0;
   }
 
-  // go through all images:
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  g.ids = (int32_t *)calloc(g.count, sizeof(int32_t));
+  g.done = (uint8_t *)calloc(g.count, sizeof(uint8_t));
+  if(!g.ids || !g.done)
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid);
-
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
-    {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
-      // if the thumbnail is already on disc - do nothing
-      if(!access(filename, R_OK)) continue;
-
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-    }
-
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
-    // thumbnail in sync with image
-    dt_history_hash_set_mipmap(imgid);
+    free(g.ids);
+    free(g.done);
+    g_free(g.checkpoint);
+    return 1;
   }
-
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2 ORDER BY id", -1, &stmt, 0);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, first_imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
+  size_t n = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW && n < g.count) g.ids[n++] = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
+  g.count = n;
+
+  // the pixelpipe and the caches are used from several threads in the gui as well. processes would
+  // have to share the library lock and the thumbnail packs, so threads it is.
+  dt_pthread_mutex_init(&g.lock, NULL);
+  const int workers = CLAMP(jobs, 1, 64);
+  pthread_t threads[64];
+  int started = 0;
+  for(int k = 1; k < workers; k++)
+    if(!dt_pthread_create(&threads[started], _generate_worker, &g)) started++;
+  _generate_worker(&g);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+  dt_pthread_mutex_destroy(&g.lock);
+
+  // a complete run leaves nothing to resume
+  g_unlink(g.checkpoint);
+  g_free(g.checkpoint);
+  free(g.ids);
+  free(g.done);
   fprintf(stderr, "done\n");
 
   return 0;
@@ -131,13 +252,25 @@ static void usage(const char *progname)
       "usage: %s [-h, --help; --version]\n"
       "  [--min-mip <0-7> (default = 0)] [-m, --max-mip <0-7> (default = 2)]\n"
       "  [--min-imgid <N>] [--max-imgid <N>]\n"
+      "  [-j, --jobs <N> (default = 1)] [--stale-only]\n"
+      "  [--kernels-only]\n"
       "  [--core <darktable options>]\n"
       "\n"
       "When multiple mipmap sizes are requested, the biggest one is computed\n"
       "while the rest are quickly downsampled.\n"
       "\n"
       "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-      "numbers to work on.\n",
+      "numbers to work on.\n"
+      "\n"
+      "--jobs processes that many images at the same time. An interrupted\n"
+      "run resumes where it stopped when started again with the same mip\n"
+      "and image id ranges.\n"
+      "\n"
+      "--stale-only regenerates the thumbnails of images whose XMP sidecar\n"
+      "is newer than the thumbnails on disk, and skips the others.\n"
+      "\n"
+      "The OpenCL kernels are always compiled into the binary cache, so the\n"
+      "first start of darktable doesn't have to. --kernels-only stops there.\n",
       progname);
 }
 
@@ -157,6 +290,9 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = 0;
   int32_t max_imgid = INT32_MAX;
+  gboolean kernels_only = FALSE;
+  int jobs = 1;
+  gboolean stale_only = FALSE;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -191,6 +327,19 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--jobs")) && argc > k + 1)
+    {
+      k++;
+      jobs = MIN(MAX(atoi(arg[k]), 1), 64);
+    }
+    else if(!strcmp(arg[k], "--stale-only"))
+    {
+      stale_only = TRUE;
+    }
+    else if(!strcmp(arg[k], "--kernels-only"))
+    {
+      kernels_only = TRUE;
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -214,6 +363,16 @@ int main(int argc, char *arg[])
     exit(EXIT_FAILURE);
   }
 
+  // dt_init() has loaded or compiled the kernels by now, which filled the binary cache
+  const int devices = dt_opencl_wait_for_programs();
+  fprintf(stderr, _("OpenCL kernels cached for %d device(s)\n"), devices);
+  if(kernels_only)
+  {
+    dt_cleanup();
+    free(m_arg);
+    exit(EXIT_SUCCESS);
+  }
+
   if(!dt_conf_get_bool("cache_disk_backend"))
   {
     fprintf(stderr,
@@ -234,7 +393,7 @@ int main(int argc, char *arg[])
 
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid, jobs, stale_only))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
@@ -26,6 +26,7 @@
 #include "common/l10n.h"
 #include "common/presets.h"
 #include "control/control.h"
+#include "control/jobs/control_jobs.h"
 #include "develop/imageop.h"
 #include "gui/accelerators.h"
 #include "gui/draw.h"
@@ -33,6 +34,13 @@
 #include "gui/preferences.h"
 #include "gui/presets.h"
 #include "libs/lib.h"
+
+// the button at the end of the cpu / gpu / memory tab in preferences_gen.h
+static void _autotune_callback(GtkButton *button, gpointer user_data)
+{
+  dt_control_autotune();
+}
+
 #include "preferences_gen.h"
 #ifdef USE_LUA
 #include "lua/preferences.h"
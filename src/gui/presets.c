@@ -33,6 +33,7 @@
 #endif
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 static const int dt_gui_presets_exposure_value_cnt = 24;
@@ -74,6 +75,126 @@ typedef struct dt_gui_presets_edit_dialog_t
   GtkWidget *format_btn[3];
 } dt_gui_presets_edit_dialog_t;
 
+// an in-memory index of the presets of every operation, so module init and gui setup don't each query
+// data.presets. writes through this file keep it up to date, any other change to the database shows in
+// sqlite3_total_changes() and has the index reloaded with a single query on its next use.
+typedef struct dt_gui_presets_entry_t
+{
+  gchar *name;
+  int32_t op_version;
+  int32_t blendop_version; // 0 without blend params
+  gboolean writeprotect;
+} dt_gui_presets_entry_t;
+
+static GMutex _index_lock;
+static GHashTable *_index = NULL; // operation -> GQueue of entries, built-in first, each by rowid
+static int _index_changes = -1;   // sqlite3_total_changes() the index is in sync with
+
+static void _index_entry_free(gpointer data)
+{
+  dt_gui_presets_entry_t *e = (dt_gui_presets_entry_t *)data;
+  g_free(e->name);
+  g_free(e);
+}
+
+static void _index_queue_free(gpointer data)
+{
+  g_queue_free_full((GQueue *)data, _index_entry_free);
+}
+
+// the caller holds _index_lock
+static GQueue *_index_queue(const char *op)
+{
+  GQueue *q = g_hash_table_lookup(_index, op);
+  if(!q)
+  {
+    q = g_queue_new();
+    g_hash_table_insert(_index, g_strdup(op), q);
+  }
+  return q;
+}
+
+static inline gboolean _index_in_sync(void)
+{
+  return _index && _index_changes == sqlite3_total_changes(dt_database_get(darktable.db));
+}
+
+// the caller holds _index_lock
+static void _index_load(void)
+{
+  if(_index_in_sync()) return;
+  if(_index) g_hash_table_destroy(_index);
+  _index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _index_queue_free);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT operation, name, op_version, blendop_version, blendop_params IS NOT NULL,"
+                              "       writeprotect"
+                              " FROM data.presets"
+                              " ORDER BY writeprotect DESC, rowid",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *op = (const char *)sqlite3_column_text(stmt, 0);
+    dt_gui_presets_entry_t *e = g_malloc(sizeof(dt_gui_presets_entry_t));
+    e->name = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+    e->op_version = sqlite3_column_int(stmt, 2);
+    e->blendop_version = sqlite3_column_int(stmt, 4) ? sqlite3_column_int(stmt, 3) : 0;
+    e->writeprotect = sqlite3_column_int(stmt, 5) != 0;
+    g_queue_push_tail(_index_queue(op), e);
+  }
+  sqlite3_finalize(stmt);
+  _index_changes = sqlite3_total_changes(dt_database_get(darktable.db));
+}
+
+// runs a statement that doesn't touch the indexed columns without losing the index
+static void _step_keeping_index(sqlite3_stmt *stmt)
+{
+  g_mutex_lock(&_index_lock);
+  const gboolean in_sync = _index_in_sync();
+  sqlite3_step(stmt);
+  if(in_sync) _index_changes = sqlite3_total_changes(dt_database_get(darktable.db));
+  g_mutex_unlock(&_index_lock);
+}
+
+GList *dt_gui_presets_get_names(const char *op, const int32_t version)
+{
+  GList *names = NULL;
+  g_mutex_lock(&_index_lock);
+  _index_load();
+  const GQueue *q = g_hash_table_lookup(_index, op);
+  for(const GList *l = q ? q->head : NULL; l; l = g_list_next(l))
+  {
+    const dt_gui_presets_entry_t *e = (dt_gui_presets_entry_t *)l->data;
+    if(version < 0 || e->op_version == version) names = g_list_prepend(names, g_strdup(e->name));
+  }
+  g_mutex_unlock(&_index_lock);
+  return g_list_reverse(names);
+}
+
+gboolean dt_gui_presets_need_update(const char *op, const int32_t version)
+{
+  gboolean outdated = FALSE;
+  g_mutex_lock(&_index_lock);
+  _index_load();
+  const GQueue *q = g_hash_table_lookup(_index, op);
+  for(const GList *l = q ? q->head : NULL; l && !outdated; l = g_list_next(l))
+  {
+    const dt_gui_presets_entry_t *e = (dt_gui_presets_entry_t *)l->data;
+    outdated = e->op_version < version || e->blendop_version < dt_develop_blend_version();
+  }
+  g_mutex_unlock(&_index_lock);
+  return outdated;
+}
+
+void dt_gui_presets_cleanup()
+{
+  g_mutex_lock(&_index_lock);
+  if(_index) g_hash_table_destroy(_index);
+  _index = NULL;
+  g_mutex_unlock(&_index_lock);
+}
+
 // this is also called for non-gui applications linking to libdarktable!
 // so beware, don't use any darktable.gui stuff here .. (or change this behaviour in darktable.c)
 void dt_gui_presets_init()
@@ -136,7 +257,41 @@ void dt_gui_presets_add_with_blendop(
   DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 6, blend_params, sizeof(dt_develop_blend_params_t),
                              SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 7, dt_develop_blend_version());
+
+  // the built-in presets of all modules go in at startup, keep the index instead of reloading it for each
+  g_mutex_lock(&_index_lock);
+  const gboolean in_sync = _index_in_sync();
   sqlite3_step(stmt);
+  if(in_sync)
+  {
+    GQueue *q = _index_queue(op);
+    // a replaced preset is gone, the new row is the last of the built-in ones
+    GList *last = NULL;
+    for(GList *l = q->head; l;)
+    {
+      GList *next = g_list_next(l);
+      dt_gui_presets_entry_t *e = (dt_gui_presets_entry_t *)l->data;
+      if(e->op_version == version && !strcmp(e->name, name))
+      {
+        _index_entry_free(e);
+        g_queue_delete_link(q, l);
+      }
+      else if(e->writeprotect)
+        last = l;
+      l = next;
+    }
+    dt_gui_presets_entry_t *e = g_malloc(sizeof(dt_gui_presets_entry_t));
+    e->name = g_strdup(name);
+    e->op_version = version;
+    e->blendop_version = dt_develop_blend_version();
+    e->writeprotect = TRUE;
+    if(last)
+      g_queue_insert_after(q, last, e);
+    else
+      g_queue_push_head(q, e);
+    _index_changes = sqlite3_total_changes(dt_database_get(darktable.db));
+  }
+  g_mutex_unlock(&_index_lock);
   sqlite3_finalize(stmt);
 }
 
@@ -997,7 +1152,7 @@ void dt_gui_presets_update_mml(const char *name, dt_dev_operation_t op, const in
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 5, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1014,7 +1169,7 @@ void dt_gui_presets_update_iso(const char *name, dt_dev_operation_t op, const in
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 4, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1031,7 +1186,7 @@ void dt_gui_presets_update_av(const char *name, dt_dev_operation_t op, const int
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 4, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1048,7 +1203,7 @@ void dt_gui_presets_update_tv(const char *name, dt_dev_operation_t op, const int
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 4, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1065,7 +1220,7 @@ void dt_gui_presets_update_fl(const char *name, dt_dev_operation_t op, const int
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 4, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1080,7 +1235,7 @@ void dt_gui_presets_update_ldr(const char *name, dt_dev_operation_t op, const in
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1095,7 +1250,7 @@ void dt_gui_presets_update_autoapply(const char *name, dt_dev_operation_t op, co
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -1110,7 +1265,7 @@ void dt_gui_presets_update_filter(const char *name, dt_dev_operation_t op, const
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op, -1, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, version);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, name, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
+  _step_keeping_index(stmt);
   sqlite3_finalize(stmt);
 }
 
@@ -10,6 +10,15 @@ typedef enum dt_gui_presets_format_flag_t
 
 /** create a db table with presets for all operations. */
 void dt_gui_presets_init();
+/** free the in-memory index of the presets. */
+void dt_gui_presets_cleanup();
+
+/** names of the presets of an operation, built-in ones first, as a list of strings to be freed by
+    the caller. version -1 lists all versions. */
+GList *dt_gui_presets_get_names(const char *op, const int32_t version);
+/** whether a preset of the operation has older params or blend params than version and the current
+    blend version, so that init has to look at them. */
+gboolean dt_gui_presets_need_update(const char *op, const int32_t version);
 
 /** add or replace a generic (i.e. non-exif specific) preset for this operation. */
 void dt_gui_presets_add_generic(const char *name, dt_dev_operation_t op, const int32_t version,
@@ -18,12 +18,23 @@
 
 #pragma once
 
+#include <gtk/gtk.h>
+
 /** shows a dialog for creating a new style */
 void dt_gui_styles_dialog_new(int imgid);
 
 /** shows a dialog for editing existing style */
 void dt_gui_styles_dialog_edit(const char *name);
 
+/** the preview of the style applied to imgid with the current apply mode, or NULL and a background job
+ * renders it. unref it when done. */
+GdkPixbuf *dt_gui_styles_preview_get(const int32_t imgid, const char *name);
+/** fills a tooltip with markup and the preview of the style next to it, for query-tooltip handlers */
+gboolean dt_gui_styles_preview_tooltip(GtkTooltip *tooltip, const int32_t imgid, const char *name,
+                                       const char *markup);
+/** forgets the cached previews, after styles were changed */
+void dt_gui_styles_preview_flush();
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -21,6 +21,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/history.h"
+#include "common/imageio.h"
 #include "common/styles.h"
 #include "control/control.h"
 #include "develop/imageop.h"
@@ -568,6 +569,205 @@ static void _gui_styles_dialog_run(gboolean edit, const char *name, int imgid)
   gtk_widget_show_all(GTK_WIDGET(dialog));
   gtk_dialog_run(GTK_DIALOG(dialog));
 }
+// previews of styles applied to an image, for the tooltips of the style lists. they are rendered by a
+// background job from the downscaled input and kept for the last few (image, style, history) combinations.
+#define DT_STYLES_PREVIEW_SIZE 256
+#define DT_STYLES_PREVIEW_CACHED 32
+
+typedef struct _preview_data_t
+{
+  dt_imageio_module_data_t head;
+  uint8_t *buf;
+} _preview_data_t;
+
+typedef struct _preview_job_t
+{
+  int32_t imgid;
+  gchar *name;
+  gboolean append;
+  gchar *key;
+  int generation;
+} _preview_job_t;
+
+static GMutex _preview_lock; // protects everything below
+static GHashTable *_preview_cache = NULL; // key -> GdkPixbuf, or NULL while it is rendered
+static GQueue _preview_lru = G_QUEUE_INIT; // keys of the finished previews, most recent first
+// bumped by every request for a preview that isn't cached, older jobs give up before rendering
+static int _preview_generation = 0;
+
+static int _preview_levels(dt_imageio_module_data_t *data)
+{
+  return IMAGEIO_RGB | IMAGEIO_INT8;
+}
+
+static int _preview_bpp(dt_imageio_module_data_t *data)
+{
+  return 8;
+}
+
+static int _preview_write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
+                                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                                void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
+                                const gboolean export_masks)
+{
+  _preview_data_t *d = (_preview_data_t *)data;
+  d->buf = g_malloc((size_t)data->width * data->height * 4);
+  memcpy(d->buf, in, (size_t)data->width * data->height * 4);
+  return 0;
+}
+
+// the history changes the look as much as the style, so it is part of the key
+static gchar *_preview_key(const int32_t imgid, const char *name, const gboolean append)
+{
+  dt_history_hash_values_t hash = { NULL, 0, NULL, 0, NULL, 0 };
+  dt_history_hash_read(imgid, &hash);
+  guint h = 5381;
+  for(int k = 0; k < hash.current_len; k++) h = h * 33 + hash.current[k];
+  g_free(hash.basic);
+  g_free(hash.auto_apply);
+  g_free(hash.current);
+  return g_strdup_printf("%d/%d/%08x/%s", imgid, append, h, name);
+}
+
+static gboolean _preview_ready(gpointer data)
+{
+  // let the tooltip under the pointer pick up the preview
+  gtk_tooltip_trigger_tooltip_query(gdk_display_get_default());
+  return FALSE;
+}
+
+static int32_t _preview_job_run(dt_job_t *job)
+{
+  _preview_job_t *params = dt_control_job_get_params(job);
+  GdkPixbuf *pixbuf = NULL;
+
+  if(g_atomic_int_get(&_preview_generation) == params->generation)
+  {
+    dt_imageio_module_format_t format = { 0 };
+    format.bpp = _preview_bpp;
+    format.write_image = _preview_write_image;
+    format.levels = _preview_levels;
+    _preview_data_t dat = { 0 };
+    dat.head.max_width = dat.head.max_height = DT_STYLES_PREVIEW_SIZE;
+    g_strlcpy(dat.head.style, params->name, sizeof(dat.head.style));
+    dat.head.style_append = params->append;
+
+    if(!dt_imageio_export_style_preview(params->imgid, &format, (dt_imageio_module_data_t *)&dat) && dat.buf)
+    {
+      const int width = dat.head.width, height = dat.head.height;
+      pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+      if(pixbuf)
+      {
+        // the pipe writes rgbx, the pixbuf wants packed rgb
+        guchar *const out = gdk_pixbuf_get_pixels(pixbuf);
+        const int stride = gdk_pixbuf_get_rowstride(pixbuf);
+        for(int j = 0; j < height; j++)
+          for(int i = 0; i < width; i++)
+            for(int c = 0; c < 3; c++) out[(size_t)j * stride + 3 * i + c] = dat.buf[4 * ((size_t)j * width + i) + c];
+      }
+    }
+    g_free(dat.buf);
+  }
+
+  g_mutex_lock(&_preview_lock);
+  // the pending entry is gone if the cache was flushed meanwhile, the style might have been edited
+  if(pixbuf && _preview_cache && g_hash_table_contains(_preview_cache, params->key))
+  {
+    g_hash_table_replace(_preview_cache, g_strdup(params->key), pixbuf);
+    g_queue_push_head(&_preview_lru, g_strdup(params->key));
+    while(g_queue_get_length(&_preview_lru) > DT_STYLES_PREVIEW_CACHED)
+    {
+      gchar *old = g_queue_pop_tail(&_preview_lru);
+      g_hash_table_remove(_preview_cache, old);
+      g_free(old);
+    }
+    g_idle_add(_preview_ready, NULL);
+  }
+  else
+  {
+    // stale or failed, a later hover asks again
+    if(_preview_cache) g_hash_table_remove(_preview_cache, params->key);
+    if(pixbuf) g_object_unref(pixbuf);
+  }
+  g_mutex_unlock(&_preview_lock);
+  return 0;
+}
+
+static void _preview_job_cleanup(void *p)
+{
+  _preview_job_t *params = p;
+  g_free(params->name);
+  g_free(params->key);
+  free(params);
+}
+
+static void _preview_unref(gpointer data)
+{
+  if(data) g_object_unref(data);
+}
+
+GdkPixbuf *dt_gui_styles_preview_get(const int32_t imgid, const char *name)
+{
+  if(imgid <= 0 || !name || !*name) return NULL;
+
+  const gboolean append = dt_conf_get_int("plugins/lighttable/style/applymode") == 0;
+  gchar *key = _preview_key(imgid, name, append);
+
+  g_mutex_lock(&_preview_lock);
+  if(!_preview_cache) _preview_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _preview_unref);
+
+  gpointer cached = NULL;
+  if(g_hash_table_lookup_extended(_preview_cache, key, NULL, &cached))
+  {
+    g_mutex_unlock(&_preview_lock);
+    g_free(key);
+    // NULL while the job for it is still pending
+    return cached ? g_object_ref(cached) : NULL;
+  }
+
+  // the pointer moved on, whatever is still queued for the previous style is not wanted anymore
+  const int generation = g_atomic_int_add(&_preview_generation, 1) + 1;
+  dt_job_t *job = dt_control_job_create(&_preview_job_run, "style preview %d (%d)", imgid, generation);
+  _preview_job_t *params = job ? (_preview_job_t *)calloc(1, sizeof(_preview_job_t)) : NULL;
+  if(!params)
+  {
+    if(job) dt_control_job_dispose(job);
+    g_mutex_unlock(&_preview_lock);
+    g_free(key);
+    return NULL;
+  }
+  params->imgid = imgid;
+  params->name = g_strdup(name);
+  params->append = append;
+  params->key = key;
+  params->generation = generation;
+  dt_control_job_set_params(job, params, _preview_job_cleanup);
+  g_hash_table_insert(_preview_cache, g_strdup(key), NULL);
+  g_mutex_unlock(&_preview_lock);
+
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, job);
+  return NULL;
+}
+
+gboolean dt_gui_styles_preview_tooltip(GtkTooltip *tooltip, const int32_t imgid, const char *name,
+                                       const char *markup)
+{
+  if(!markup || !*markup) return FALSE;
+  gtk_tooltip_set_markup(tooltip, markup);
+  GdkPixbuf *pixbuf = dt_gui_styles_preview_get(imgid, name);
+  gtk_tooltip_set_icon(tooltip, pixbuf);
+  if(pixbuf) g_object_unref(pixbuf);
+  return TRUE;
+}
+
+void dt_gui_styles_preview_flush()
+{
+  g_mutex_lock(&_preview_lock);
+  if(_preview_cache) g_hash_table_remove_all(_preview_cache);
+  gchar *key;
+  while((key = g_queue_pop_head(&_preview_lru))) g_free(key);
+  g_mutex_unlock(&_preview_lock);
+}
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
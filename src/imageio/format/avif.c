@@ -40,7 +40,7 @@
 #define AVIF_MAX_TILE_SIZE 3072
 #define AVIF_DEFAULT_TILE_SIZE AVIF_MIN_TILE_SIZE * 4
 
-DT_MODULE(1)
+DT_MODULE(2)
 
 enum avif_compression_type_e {
   AVIF_COMP_LOSSLESS = 0,
@@ -52,12 +52,18 @@ enum avif_tiling_e {
   AVIF_TILING_OFF
 };
 
+enum avif_encoder_speed_e {
+  AVIF_ENCODER_SPEED_BEST = 0,
+  AVIF_ENCODER_SPEED_FAST_WEB
+};
+
 typedef struct dt_imageio_avif_t {
   dt_imageio_module_data_t global;
   uint32_t bit_depth;
   uint32_t compression_type;
   uint32_t quality;
   uint32_t tiling;
+  uint32_t speed;
 } dt_imageio_avif_t;
 
 typedef struct dt_imageio_avif_gui_t {
@@ -65,6 +71,7 @@ typedef struct dt_imageio_avif_gui_t {
   GtkWidget *compression_type;
   GtkWidget *quality;
   GtkWidget *tiling;
+  GtkWidget *speed;
 } dt_imageio_avif_gui_t;
 
 static const struct {
@@ -100,24 +107,12 @@ static const char *avif_get_compression_string(enum avif_compression_type_e comp
   return "unknown";
 }
 
-/* Lookup table for tiling choices */
-static int flp2(int i)
+/* log2 of the number of tiles of at least tile_size, av1 allows at most 2^6 */
+static int _tiles_log2(const size_t size, const size_t tile_size)
 {
-                                  /* 0   1,  2,  3,  4,  5,  6,  7,  8,  9 */
-  static const int flp2_table[] = {  0,  0,  2,  2,  4,  4,  4,  4,  8,  8,
-                                     8,  8,  8,  8,  8,  8, 16, 16, 16, 16,
-                                    16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
-                                    16, 16, 32, 32, 32, 32, 32, 32, 32, 32,
-                                    32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
-                                    32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
-                                    32, 32, 32, 32 };
-                                  /* 0   1,  2,  3,  4,  5,  6,  7,  8,  9 */
-
-  if (i >= 64) {
-    return 64;
-  }
-
-  return flp2_table[i];
+  int l = 0;
+  while(l < 6 && ((size_t)2 << l) * tile_size <= size) l++;
+  return l;
 }
 
 void init(dt_imageio_module_format_t *self)
@@ -161,6 +156,22 @@ void init(dt_imageio_module_format_t *self)
                                 dt_imageio_avif_t,
                                 quality,
                                 int);
+
+  /* encoder speed */
+  luaA_enum(darktable.lua_state.state,
+            enum avif_encoder_speed_e);
+  luaA_enum_value(darktable.lua_state.state,
+                  enum avif_encoder_speed_e,
+                  AVIF_ENCODER_SPEED_BEST);
+  luaA_enum_value(darktable.lua_state.state,
+                  enum avif_encoder_speed_e,
+                  AVIF_ENCODER_SPEED_FAST_WEB);
+
+  dt_lua_register_module_member(darktable.lua_state.state,
+                                self,
+                                dt_imageio_avif_t,
+                                speed,
+                                enum avif_encoder_speed_e);
 #endif
 }
 
@@ -463,41 +474,53 @@ int write_image(struct dt_imageio_module_data_t *data,
     break;
   }
 
-  encoder->maxThreads = dt_get_num_threads();
+  /*
+   * The fast web speed trades some compression efficiency for a much
+   * faster encode, for both lossy and lossless.
+   */
+  if (d->speed == AVIF_ENCODER_SPEED_FAST_WEB) {
+    encoder->speed = 8;
+  }
+
+  encoder->maxThreads = dt_imageio_encoder_threads();
 
   /*
    * Tiling reduces the image quality but it has a negligible impact on
    * still images.
    *
-   * The minmum suggested size for a tile is 512x512.
+   * The minmum suggested size for a tile is 512x512. The encoder runs the
+   * tiles in parallel, so the fast web speed uses the smallest tiles to keep
+   * all threads busy.
    */
-  switch (d->tiling) {
-  case AVIF_TILING_ON: {
+  if (d->tiling == AVIF_TILING_ON || d->speed == AVIF_ENCODER_SPEED_FAST_WEB) {
     size_t width_tile_size  = AVIF_DEFAULT_TILE_SIZE;
     size_t height_tile_size = AVIF_DEFAULT_TILE_SIZE;
 
-    if (width >= 4096) {
-        width_tile_size = AVIF_MAX_TILE_SIZE;
+    if (d->speed == AVIF_ENCODER_SPEED_FAST_WEB) {
+        width_tile_size = height_tile_size = AVIF_MIN_TILE_SIZE;
     }
-    if (height >= 4096) {
-        height_tile_size = AVIF_MAX_TILE_SIZE;
+    else {
+      if (width >= 4096) {
+          width_tile_size = AVIF_MAX_TILE_SIZE;
+      }
+      if (height >= 4096) {
+          height_tile_size = AVIF_MAX_TILE_SIZE;
+      }
     }
 
-    encoder->tileColsLog2 = flp2(width / width_tile_size);
-    encoder->tileRowsLog2 = flp2(height / height_tile_size);
-  }
-  case AVIF_TILING_OFF:
-    break;
+    encoder->tileColsLog2 = _tiles_log2(width, width_tile_size);
+    encoder->tileRowsLog2 = _tiles_log2(height, height_tile_size);
   }
 
   dt_print(DT_DEBUG_IMAGEIO,
            "[avif quality: %u => maxQuantizer: %u, minQuantizer: %u, "
-           "tileColsLog2: %u, tileRowsLog2: %u, threads: %u]\n",
+           "tileColsLog2: %u, tileRowsLog2: %u, speed: %d, threads: %u]\n",
            d->quality,
            encoder->maxQuantizer,
            encoder->minQuantizer,
            encoder->tileColsLog2,
            encoder->tileRowsLog2,
+           encoder->speed,
            encoder->maxThreads);
 
   avifRWData output = AVIF_DATA_EMPTY;
@@ -556,6 +579,33 @@ size_t params_size(dt_imageio_module_format_t *self)
   return sizeof(dt_imageio_avif_t);
 }
 
+void *legacy_params(dt_imageio_module_format_t *self,
+                    const void *const old_params,
+                    const size_t old_params_size,
+                    const int old_version,
+                    const int new_version,
+                    size_t *new_size)
+{
+  if (old_version == 1 && new_version == 2) {
+    typedef struct dt_imageio_avif_v1_t {
+      dt_imageio_module_data_t global;
+      uint32_t bit_depth;
+      uint32_t compression_type;
+      uint32_t quality;
+      uint32_t tiling;
+    } dt_imageio_avif_v1_t;
+
+    const dt_imageio_avif_v1_t *o = (dt_imageio_avif_v1_t *)old_params;
+    dt_imageio_avif_t *n = (dt_imageio_avif_t *)calloc(1, sizeof(dt_imageio_avif_t));
+
+    memcpy(n, o, sizeof(dt_imageio_avif_v1_t));
+    n->speed = AVIF_ENCODER_SPEED_BEST;
+    *new_size = self->params_size(self);
+    return n;
+  }
+  return NULL;
+}
+
 void *get_params(dt_imageio_module_format_t *self)
 {
   dt_imageio_avif_t *d = (dt_imageio_avif_t *)calloc(1, sizeof(dt_imageio_avif_t));
@@ -584,6 +634,7 @@ void *get_params(dt_imageio_module_format_t *self)
   }
 
   d->tiling = dt_conf_get_int("plugins/imageio/format/avif/tiling");
+  d->speed = dt_conf_get_int("plugins/imageio/format/avif/speed");
 
   return d;
 }
@@ -600,6 +651,7 @@ int set_params(dt_imageio_module_format_t *self,
   dt_imageio_avif_gui_t *g = (dt_imageio_avif_gui_t *)self->gui_data;
   dt_bauhaus_combobox_set(g->bit_depth, d->bit_depth);
   dt_bauhaus_combobox_set(g->tiling, d->tiling);
+  dt_bauhaus_combobox_set(g->speed, d->speed);
   dt_bauhaus_combobox_set(g->compression_type, d->compression_type);
   dt_bauhaus_slider_set(g->quality, d->quality);
 
@@ -657,6 +709,13 @@ static void tiling_changed(GtkWidget *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/avif/tiling", tiling);
 }
 
+static void speed_changed(GtkWidget *widget, gpointer user_data)
+{
+  const enum avif_encoder_speed_e speed = dt_bauhaus_combobox_get(widget);
+
+  dt_conf_set_int("plugins/imageio/format/avif/speed", speed);
+}
+
 static void compression_type_changed(GtkWidget *widget, gpointer user_data)
 {
   const enum avif_compression_type_e compression_type = dt_bauhaus_combobox_get(widget);
@@ -689,6 +748,7 @@ void gui_init(dt_imageio_module_format_t *self)
   const enum avif_tiling_e tiling = dt_conf_get_int("plugins/imageio/format/avif/tiling");
   const enum avif_compression_type_e compression_type = dt_conf_get_int("plugins/imageio/format/avif/compression_type");
   const uint32_t quality = dt_conf_get_int("plugins/imageio/format/avif/quality");
+  const enum avif_encoder_speed_e speed = dt_conf_get_int("plugins/imageio/format/avif/speed");
 
   self->gui_data = (void *)gui;
 
@@ -739,6 +799,29 @@ void gui_init(dt_imageio_module_format_t *self)
                      TRUE,
                      0);
 
+  /*
+   * Encoder speed combo box
+   */
+  gui->speed = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(gui->speed,
+                              NULL,
+                              _("encoder speed"));
+  dt_bauhaus_combobox_add(gui->speed,
+                          _("best compression"));
+  dt_bauhaus_combobox_add(gui->speed,
+                          _("fast web"));
+  dt_bauhaus_combobox_set(gui->speed, speed);
+
+  gtk_widget_set_tooltip_text(gui->speed,
+          _("fast web encodes several times faster in small tiles on all\n"
+            "threads, for slightly larger files."));
+
+  gtk_box_pack_start(GTK_BOX(self->widget),
+                     gui->speed,
+                     TRUE,
+                     TRUE,
+                     0);
+
   /*
    * Compression type combo box
    */
@@ -806,6 +889,10 @@ void gui_init(dt_imageio_module_format_t *self)
                    "value-changed",
                    G_CALLBACK(tiling_changed),
                    (gpointer)self);
+  g_signal_connect(G_OBJECT(gui->speed),
+                   "value-changed",
+                   G_CALLBACK(speed_changed),
+                   NULL);
   g_signal_connect(G_OBJECT(gui->compression_type),
                    "value-changed",
                    G_CALLBACK(compression_type_changed),
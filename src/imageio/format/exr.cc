@@ -198,7 +198,8 @@ icc_end:
 
   header.setTileDescription(Imf::TileDescription(100, 100, Imf::ONE_LEVEL));
 
-  Imf::TiledOutputFile file(filename, header);
+  // the global pool is shared by all exports, bound this file to the threads of its export job
+  Imf::TiledOutputFile file(filename, header, dt_imageio_encoder_threads());
 
   Imf::FrameBuffer data;
 
@@ -80,6 +80,13 @@ int write_image(struct dt_imageio_module_data_t *data, const char *filename, con
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                 void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
                 const gboolean export_masks);
+/* optional streaming interface, the image is handed over in strips of rows from top to bottom, each
+ * converted like the buffer passed to write_image. exif has to stay valid until write_image_end. */
+int write_image_begin(struct dt_imageio_module_data_t *data, const char *filename,
+                      dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                      void *exif, int exif_len, int imgid, int num, int total);
+int write_image_rows(struct dt_imageio_module_data_t *data, const void *in, const int rows);
+int write_image_end(struct dt_imageio_module_data_t *data);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 int levels(struct dt_imageio_module_data_t *data);
 
@@ -38,12 +38,19 @@
 #undef HAVE_STDLIB_H
 #undef HAVE_STDDEF_H
 
-DT_MODULE(2)
+DT_MODULE(3)
+
+typedef enum dt_imageio_jpeg_speed_t
+{
+  DT_JPEG_SPEED_SIZE = 0,
+  DT_JPEG_SPEED_FAST = 1
+} dt_imageio_jpeg_speed_t;
 
 typedef struct dt_imageio_jpeg_t
 {
   dt_imageio_module_data_t global;
   int quality;
+  dt_imageio_jpeg_speed_t speed;
   struct jpeg_source_mgr src;
   struct jpeg_destination_mgr dest;
   struct jpeg_decompress_struct dinfo;
@@ -54,6 +61,7 @@ typedef struct dt_imageio_jpeg_t
 typedef struct dt_imageio_jpeg_gui_data_t
 {
   GtkWidget *quality;
+  GtkWidget *speed;
 } dt_imageio_jpeg_gui_data_t;
 
 
@@ -330,18 +338,34 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
 
   jpg->cinfo.image_width = jpg->global.width;
   jpg->cinfo.image_height = jpg->global.height;
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo reads our rgbx rows directly and converts and subsamples them with simd
+  jpg->cinfo.input_components = 4;
+  jpg->cinfo.in_color_space = JCS_EXT_RGBX;
+#else
   jpg->cinfo.input_components = 3;
   jpg->cinfo.in_color_space = JCS_RGB;
+#endif
   jpeg_set_defaults(&(jpg->cinfo));
   jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
   if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
   if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+  if(jpg->speed == DT_JPEG_SPEED_FAST)
+  {
+    // skip the second pass over the coefficients for optimal huffman tables, the smoothing prefilter and the
+    // float dct. files grow by a few percent, encoding takes about half the time
+    jpg->cinfo.dct_method = jpg->quality < 90 ? JDCT_IFAST : JDCT_ISLOW;
+    jpg->cinfo.optimize_coding = 0;
+  }
+  else
+  {
+    if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
+    if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
+    if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
+    if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
+    if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
+    jpg->cinfo.optimize_coding = 1;
+  }
 
   // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
   // describes an image with unknown unit and square pixels.
@@ -377,19 +401,30 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
     }
   }
 
+  const size_t stride = (size_t)4 * jpg->global.width;
+#ifdef JCS_EXTENSIONS
+  JSAMPROW rows[16];
+  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  {
+    const int n = MIN(16, jpg->cinfo.image_height - jpg->cinfo.next_scanline);
+    for(int j = 0; j < n; j++) rows[j] = (JSAMPROW)(in + stride * (jpg->cinfo.next_scanline + j));
+    jpeg_write_scanlines(&(jpg->cinfo), rows, n);
+  }
+#else
   uint8_t *row = dt_alloc_align(64, (size_t)3 * jpg->global.width * sizeof(uint8_t));
   const uint8_t *buf;
   while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
   {
     JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
+    buf = in + stride * jpg->cinfo.next_scanline;
     for(int i = 0; i < jpg->global.width; i++)
       for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
     tmp[0] = row;
     jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
   }
-  jpeg_finish_compress(&(jpg->cinfo));
   dt_free_align(row);
+#endif
+  jpeg_finish_compress(&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
 
@@ -464,14 +499,14 @@ int read_image(dt_imageio_module_data_t *jpg_tmp, uint8_t *out)
 
 size_t params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_module_data_t) + sizeof(int);
+  return sizeof(dt_imageio_module_data_t) + sizeof(int) + sizeof(dt_imageio_jpeg_speed_t);
 }
 
 void *legacy_params(dt_imageio_module_format_t *self, const void *const old_params,
                     const size_t old_params_size, const int old_version, const int new_version,
                     size_t *new_size)
 {
-  if(old_version == 1 && new_version == 2)
+  if(old_version == 1 && new_version == 3)
   {
     typedef struct dt_imageio_jpeg_v1_t
     {
@@ -496,6 +531,7 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     g_strlcpy(n->global.style, o->style, sizeof(o->style));
     n->global.style_append = FALSE;
     n->quality = o->quality;
+    n->speed = DT_JPEG_SPEED_SIZE;
     n->src = o->src;
     n->dest = o->dest;
     n->dinfo = o->dinfo;
@@ -504,6 +540,23 @@ void *legacy_params(dt_imageio_module_format_t *self, const void *const old_para
     *new_size = self->params_size(self);
     return n;
   }
+  else if(old_version == 2 && new_version == 3)
+  {
+    typedef struct dt_imageio_jpeg_v2_t
+    {
+      dt_imageio_module_data_t global;
+      int quality;
+    } dt_imageio_jpeg_v2_t;
+
+    const dt_imageio_jpeg_v2_t *o = (dt_imageio_jpeg_v2_t *)old_params;
+    dt_imageio_jpeg_t *n = (dt_imageio_jpeg_t *)calloc(1, sizeof(dt_imageio_jpeg_t));
+
+    n->global = o->global;
+    n->quality = o->quality;
+    n->speed = DT_JPEG_SPEED_SIZE;
+    *new_size = self->params_size(self);
+    return n;
+  }
   return NULL;
 }
 
@@ -513,6 +566,7 @@ void *get_params(dt_imageio_module_format_t *self)
   dt_imageio_jpeg_t *d = (dt_imageio_jpeg_t *)calloc(1, sizeof(dt_imageio_jpeg_t));
   d->quality = dt_conf_get_int("plugins/imageio/format/jpeg/quality");
   if(d->quality <= 0 || d->quality > 100) d->quality = 100;
+  d->speed = dt_conf_get_int("plugins/imageio/format/jpeg/speed");
   return d;
 }
 
@@ -527,6 +581,7 @@ int set_params(dt_imageio_module_format_t *self, const void *params, const int s
   const dt_imageio_jpeg_t *d = (dt_imageio_jpeg_t *)params;
   dt_imageio_jpeg_gui_data_t *g = (dt_imageio_jpeg_gui_data_t *)self->gui_data;
   dt_bauhaus_slider_set(g->quality, d->quality);
+  dt_bauhaus_combobox_set(g->speed, d->speed);
   return 0;
 }
 
@@ -559,6 +614,11 @@ void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
   dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_jpeg_t, quality, int);
+  luaA_enum(darktable.lua_state.state, dt_imageio_jpeg_speed_t);
+  luaA_enum_value(darktable.lua_state.state, dt_imageio_jpeg_speed_t, DT_JPEG_SPEED_SIZE);
+  luaA_enum_value(darktable.lua_state.state, dt_imageio_jpeg_speed_t, DT_JPEG_SPEED_FAST);
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_jpeg_t, speed,
+                                dt_imageio_jpeg_speed_t);
 #endif
 }
 void cleanup(dt_imageio_module_format_t *self)
@@ -580,12 +640,18 @@ static void quality_changed(GtkWidget *slider, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/jpeg/quality", quality);
 }
 
+static void speed_changed(GtkWidget *widget, gpointer user_data)
+{
+  const int speed = dt_bauhaus_combobox_get(widget);
+  dt_conf_set_int("plugins/imageio/format/jpeg/speed", speed);
+}
+
 void gui_init(dt_imageio_module_format_t *self)
 {
   dt_imageio_jpeg_gui_data_t *g = (dt_imageio_jpeg_gui_data_t *)malloc(sizeof(dt_imageio_jpeg_gui_data_t));
   self->gui_data = g;
   // construct gui with jpeg specific options:
-  GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+  GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   self->widget = box;
   // quality slider
   g->quality = dt_bauhaus_slider_new_with_range(NULL, 5, 100, 1, 95, 0);
@@ -593,6 +659,16 @@ void gui_init(dt_imageio_module_format_t *self)
   dt_bauhaus_slider_set_default(g->quality, 95);
   gtk_box_pack_start(GTK_BOX(box), GTK_WIDGET(g->quality), TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(g->quality), "value-changed", G_CALLBACK(quality_changed), NULL);
+  // speed over size
+  g->speed = dt_bauhaus_combobox_new(NULL);
+  dt_bauhaus_widget_set_label(g->speed, NULL, _("optimize for"));
+  gtk_widget_set_tooltip_text(g->speed, _("speed skips the optimized huffman tables and uses the fast dct,\n"
+                                          "for files a few percent larger"));
+  dt_bauhaus_combobox_add(g->speed, _("size"));
+  dt_bauhaus_combobox_add(g->speed, _("speed"));
+  dt_bauhaus_combobox_set(g->speed, dt_conf_get_int("plugins/imageio/format/jpeg/speed"));
+  gtk_box_pack_start(GTK_BOX(box), GTK_WIDGET(g->speed), TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(g->speed), "value-changed", G_CALLBACK(speed_changed), NULL);
   // TODO: add more options: subsample dreggn
 }
 
@@ -605,6 +681,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 {
   dt_imageio_jpeg_gui_data_t *g = (dt_imageio_jpeg_gui_data_t *)self->gui_data;
   dt_bauhaus_slider_set(g->quality, dt_conf_get_int("plugins/imageio/format/jpeg/quality"));
+  dt_bauhaus_combobox_set(g->speed, dt_conf_get_int("plugins/imageio/format/jpeg/speed"));
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
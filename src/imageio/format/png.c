@@ -117,10 +117,9 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
-int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+int write_image_begin(dt_imageio_module_data_t *p_tmp, const char *filename,
+                      dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                      void *exif, int exif_len, int imgid, int num, int total)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->global.width, height = p->global.height;
@@ -201,30 +200,74 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
    */
   png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  png_bytep *row_pointers = dt_alloc_align(64, (size_t)height * sizeof(png_bytep));
+  /* swap bytes of 16 bit files to most significant bit first */
+  if(p->bpp > 8) png_set_swap(png_ptr);
 
-  if(p->bpp > 8)
-  {
-    /* swap bytes of 16 bit files to most significant bit first */
-    png_set_swap(png_ptr);
+  p->f = f;
+  p->png_ptr = png_ptr;
+  p->info_ptr = info_ptr;
+  return 0;
+}
 
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
-  }
-  else
+// the error handlers of libpng longjmp() back into the function which called setjmp(), so that
+// needs to be done again in every function calling into libpng
+static void _abort_write(dt_imageio_png_t *p)
+{
+  fclose(p->f);
+  png_destroy_write_struct(&p->png_ptr, &p->info_ptr);
+  p->f = NULL;
+  p->png_ptr = NULL;
+  p->info_ptr = NULL;
+}
+
+int write_image_rows(dt_imageio_module_data_t *p_tmp, const void *in, const int rows)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  if(!p->png_ptr) return 1;
+
+  if(setjmp(png_jmpbuf(p->png_ptr)))
   {
-    for(unsigned i = 0; i < height; i++) row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
+    _abort_write(p);
+    return 1;
   }
 
-  png_write_image(png_ptr, row_pointers);
+  const size_t stride = (size_t)4 * p->global.width * (p->bpp > 8 ? sizeof(uint16_t) : sizeof(uint8_t));
+  for(int i = 0; i < rows; i++) png_write_row(p->png_ptr, (png_bytep)in + stride * i);
 
-  dt_free_align(row_pointers);
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *p_tmp)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  if(!p->png_ptr) return 1;
+
+  if(setjmp(png_jmpbuf(p->png_ptr)))
+  {
+    _abort_write(p);
+    return 1;
+  }
 
-  png_write_end(png_ptr, info_ptr);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(f);
+  png_write_end(p->png_ptr, p->info_ptr);
+  png_destroy_write_struct(&p->png_ptr, &p->info_ptr);
+  fclose(p->f);
+  p->f = NULL;
+  p->png_ptr = NULL;
+  p->info_ptr = NULL;
   return 0;
 }
 
+int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  if(write_image_begin(p_tmp, filename, over_type, over_filename, exif, exif_len, imgid, num, total))
+    return 1;
+  if(write_image_rows(p_tmp, ivoid, p_tmp->height)) return 1;
+  return write_image_end(p_tmp);
+}
+
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
 {
   dt_imageio_png_t *png = (dt_imageio_png_t *)p_tmp;
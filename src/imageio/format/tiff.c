@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 
 #define CLAMP_FLT(A) ((A) > (0.0f) ? ((A) < (1.0f) ? (A) : (1.0f)) : (0.0f))
 
@@ -37,6 +38,10 @@
 // but at least GIMP can't open TIFF files where not all layers have the same format.
 #define MASKS_USE_SAME_FORMAT
 
+// rows per strip of the main image. strips are compressed in parallel, so they have to be large enough
+// to give zlib some context and small enough to keep all threads busy
+#define DT_TIFF_STRIP_ROWS 32
+
 DT_MODULE(3)
 
 typedef struct dt_imageio_tiff_t
@@ -46,6 +51,11 @@ typedef struct dt_imageio_tiff_t
   int compress;
   int compresslevel;
   TIFF *handle;
+  // state of a streamed export, see write_image_begin()
+  struct _tiff_writer_t *writer;
+  gchar *filename;
+  void *exif;
+  int exif_len;
 } dt_imageio_tiff_t;
 
 typedef struct dt_imageio_tiff_gui_t
@@ -56,66 +66,8 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
-int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+static void _set_compression(TIFF *tif, const dt_imageio_tiff_t *d)
 {
-  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
-
-  uint8_t *profile = NULL;
-  uint32_t profile_len = 0;
-
-  TIFF *tif = NULL;
-
-  void *rowdata = NULL;
-
-  gboolean free_mask = FALSE;
-  float *raster_mask = NULL;
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-#endif
-  int rc = 1; // default to error
-
-  if(imgid > 0)
-  {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
-    cmsSaveProfileToMem(out_profile, 0, &profile_len);
-    if(profile_len > 0)
-    {
-      profile = malloc(profile_len);
-      if(!profile)
-      {
-        rc = 1;
-        goto exit;
-      }
-      cmsSaveProfileToMem(out_profile, profile, &profile_len);
-    }
-  }
-
-  int n_pages = 1;
-  // only when masks are to be stored we check for extra pages!
-  if(export_masks && pipe)
-  {
-    for(GList *iter = pipe->nodes; iter; iter = g_list_next(iter))
-      n_pages += g_hash_table_size(((dt_dev_pixelpipe_iop_t *)iter->data)->raster_masks);
-  }
-
-  // Create little endian tiff image
-#ifdef _WIN32
-  tif = TIFFOpenW(wfilename, "wl");
-#else
-  tif = TIFFOpen(filename, "wl");
-#endif
-
-  if(!tif)
-  {
-    rc = 1;
-    goto exit;
-  }
-
-  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
-
   // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
   // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
   // "software vendors. This code should be considered obsolete. We recommend"
@@ -148,6 +100,46 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   {
     TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
   }
+}
+
+// opens filename and sets up the tags of the main image, returns NULL on failure
+static TIFF *_open_image(const dt_imageio_tiff_t *d, const char *filename,
+                         dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                         const int imgid)
+{
+  uint8_t *profile = NULL;
+  uint32_t profile_len = 0;
+
+  if(imgid > 0)
+  {
+    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
+    cmsSaveProfileToMem(out_profile, 0, &profile_len);
+    if(profile_len > 0)
+    {
+      profile = malloc(profile_len);
+      if(!profile) return NULL;
+      cmsSaveProfileToMem(out_profile, profile, &profile_len);
+    }
+  }
+
+  // Create little endian tiff image
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  TIFF *tif = TIFFOpenW(wfilename, "wl");
+  g_free(wfilename);
+#else
+  TIFF *tif = TIFFOpen(filename, "wl");
+#endif
+
+  if(!tif)
+  {
+    free(profile);
+    return NULL;
+  }
+
+  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
+
+  _set_compression(tif, d);
 
   TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
   if(profile != NULL)
@@ -161,10 +153,10 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->global.height);
   TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_RGB);
   TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)1);
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)DT_TIFF_STRIP_ROWS);
   TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
 
-  int resolution = dt_conf_get_int("metadata/resolution");
+  const int resolution = dt_conf_get_int("metadata/resolution");
   if(resolution > 0)
   {
     TIFFSetField(tif, TIFFTAG_XRESOLUTION, (float)resolution);
@@ -172,69 +164,274 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
   }
 
-  const size_t rowsize = (d->global.width * 3) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  // libtiff copies the tag data
+  free(profile);
+
+  return tif;
+}
+
+// writer of the main image. unless libtiff has to apply a predictor we can't reproduce (the float
+// ones), the strips are packed, predicted and deflated here, several at once, and only handed to
+// libtiff as raw strips. zlib would otherwise run on a single thread for the whole image.
+typedef struct _tiff_writer_t
+{
+  const dt_imageio_tiff_t *d;
+  TIFF *tif;
+  gboolean parallel;
+  gboolean predict;
+  size_t rowsize;     // bytes of a row with 3 samples per pixel
+  uint8_t *carry;     // the strip being filled, DT_TIFF_STRIP_ROWS rows
+  int carry_rows;
+  int row;            // next row of the image
+} _tiff_writer_t;
+
+static _tiff_writer_t *_writer_new(const dt_imageio_tiff_t *d, TIFF *tif)
+{
+  _tiff_writer_t *w = calloc(1, sizeof(_tiff_writer_t));
+  if(!w) return NULL;
+  w->d = d;
+  w->tif = tif;
+  w->predict = d->compress == 2 || d->compress == 3;
+  w->parallel = !(d->bpp == 32 && w->predict);
+  w->rowsize = (size_t)d->global.width * 3 * d->bpp / 8;
+  w->carry = malloc(w->rowsize * DT_TIFF_STRIP_ROWS);
+  if(!w->carry)
   {
-    rc = 1;
-    goto exit;
+    free(w);
+    return NULL;
   }
+  return w;
+}
 
-  if(d->bpp == 32)
+static void _writer_free(_tiff_writer_t *w)
+{
+  if(!w) return;
+  free(w->carry);
+  free(w);
+}
+
+// drops the 4th channel of a row of the pipe output
+static void _pack_row(const dt_imageio_tiff_t *d, uint8_t *out, const uint8_t *in)
+{
+  const size_t bytes = d->bpp / 8;
+  for(int x = 0; x < d->global.width; x++, in += 4 * bytes, out += 3 * bytes) memcpy(out, in, 3 * bytes);
+}
+
+// applies the horizontal predictor and the byte order of the file to a packed strip, in place
+static void _prepare_strip(const _tiff_writer_t *w, uint8_t *strip, const int rows)
+{
+  const int width = w->d->global.width;
+  for(int y = 0; y < rows; y++)
   {
-    for(int y = 0; y < d->global.height; y++)
+    uint8_t *row = strip + w->rowsize * y;
+    if(w->d->bpp == 16)
+    {
+      uint16_t *p = (uint16_t *)row;
+      if(w->predict)
+        for(int i = 3 * width - 1; i >= 3; i--) p[i] -= p[i - 3];
+      if(TIFFIsByteSwapped(w->tif)) TIFFSwabArrayOfShort(p, 3 * width);
+    }
+    else if(w->d->bpp == 32)
+    {
+      if(TIFFIsByteSwapped(w->tif)) TIFFSwabArrayOfLong((uint32_t *)row, 3 * width);
+    }
+    else if(w->predict)
     {
-      float *in = (float *)in_void + (size_t)4 * y * d->global.width;
-      float *out = (float *)rowdata;
+      for(int i = 3 * width - 1; i >= 3; i--) row[i] -= row[i - 3];
+    }
+  }
+}
 
-      for(int x = 0; x < d->global.width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
+// deflates a prepared strip, returns NULL on failure
+static uint8_t *_compress_strip(const _tiff_writer_t *w, const uint8_t *strip, const int rows, size_t *size)
+{
+  const uLong len = w->rowsize * rows;
+  uLongf compressed = compressBound(len);
+  uint8_t *out = malloc(compressed);
+  if(!out) return NULL;
+  if(compress2(out, &compressed, strip, len, w->d->compresslevel) != Z_OK)
+  {
+    free(out);
+    return NULL;
+  }
+  *size = compressed;
+  return out;
+}
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+// writes the packed strip of rows pixel rows which starts at image row first_row
+static int _write_strip(_tiff_writer_t *w, uint8_t *strip, const int first_row, const int rows)
+{
+  _prepare_strip(w, strip, rows);
+  const tstrip_t s = first_row / DT_TIFF_STRIP_ROWS;
+  if(w->d->compress == 0)
+    return TIFFWriteRawStrip(w->tif, s, strip, w->rowsize * rows) == -1;
+
+  size_t size = 0;
+  uint8_t *out = _compress_strip(w, strip, rows, &size);
+  if(!out) return 1;
+  const int rc = TIFFWriteRawStrip(w->tif, s, out, size) == -1;
+  free(out);
+  return rc;
+}
+
+// packs, predicts and compresses nstrips complete strips of the input in parallel and writes them
+static int _write_strips(_tiff_writer_t *w, const uint8_t *in, const size_t in_stride, const int nstrips)
+{
+  const dt_imageio_tiff_t *d = w->d;
+  const int first_row = w->row;
+
+  uint8_t **out = calloc(nstrips, sizeof(uint8_t *));
+  size_t *size = calloc(nstrips, sizeof(size_t));
+  if(!out || !size)
+  {
+    free(out);
+    free(size);
+    return 1;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(w, d, in, in_stride, nstrips, first_row, out, size) \
+  schedule(dynamic)
+#endif
+  for(int s = 0; s < nstrips; s++)
+  {
+    const int y0 = first_row + s * DT_TIFF_STRIP_ROWS;
+    const int rows = MIN(DT_TIFF_STRIP_ROWS, d->global.height - y0);
+    uint8_t *strip = malloc(w->rowsize * rows);
+    if(!strip) continue;
+    for(int y = 0; y < rows; y++)
+      _pack_row(d, strip + w->rowsize * y, in + in_stride * (s * DT_TIFF_STRIP_ROWS + y));
+    _prepare_strip(w, strip, rows);
+    if(d->compress == 0)
+    {
+      out[s] = strip;
+      size[s] = w->rowsize * rows;
     }
+    else
+    {
+      out[s] = _compress_strip(w, strip, rows, &size[s]);
+      free(strip);
+    }
+  }
+
+  int rc = 0;
+  for(int s = 0; s < nstrips; s++)
+  {
+    if(!rc && (!out[s] || TIFFWriteRawStrip(w->tif, first_row / DT_TIFF_STRIP_ROWS + s, out[s], size[s]) == -1))
+      rc = 1;
+    free(out[s]);
   }
-  else if(d->bpp == 16)
+  free(out);
+  free(size);
+
+  w->row = MIN(d->global.height, first_row + nstrips * DT_TIFF_STRIP_ROWS);
+  return rc;
+}
+
+// writes the next rows rows of the main image from the 4 channel buffer in_void
+static int _write_rows(_tiff_writer_t *w, const void *in_void, const int rows)
+{
+  const dt_imageio_tiff_t *d = w->d;
+  const size_t in_stride = (size_t)4 * d->global.width * d->bpp / 8;
+  const uint8_t *in = (const uint8_t *)in_void;
+
+  if(w->row + rows > d->global.height) return 1;
+
+  if(!w->parallel)
   {
-    for(int y = 0; y < d->global.height; y++)
+    for(int y = 0; y < rows; y++, w->row++)
     {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->global.width;
-      uint16_t *out = (uint16_t *)rowdata;
+      _pack_row(d, w->carry, in + in_stride * y);
+      if(TIFFWriteScanline(w->tif, w->carry, w->row, 0) == -1) return 1;
+    }
+    return 0;
+  }
 
-      for(int x = 0; x < d->global.width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint16_t));
-      }
+  // bound the memory of the compressed strips in flight
+  const int batch = 4 * dt_imageio_encoder_threads();
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+  int y = 0;
+  while(y < rows)
+  {
+    const int strip_start = w->row - w->carry_rows;
+    const int strip_rows = MIN(DT_TIFF_STRIP_ROWS, d->global.height - strip_start);
+
+    if(w->carry_rows > 0 || rows - y < strip_rows)
+    {
+      // a strip split between calls is collected in the carry buffer
+      const int n = MIN(strip_rows - w->carry_rows, rows - y);
+      for(int k = 0; k < n; k++, y++, w->row++, w->carry_rows++)
+        _pack_row(d, w->carry + w->rowsize * w->carry_rows, in + in_stride * y);
+      if(w->carry_rows == strip_rows)
       {
-        rc = 1;
-        goto exit;
+        w->carry_rows = 0;
+        if(_write_strip(w, w->carry, strip_start, strip_rows)) return 1;
       }
+      continue;
     }
+
+    // complete strips straight from the input, the last one of the image may be short
+    int nstrips = (rows - y) / DT_TIFF_STRIP_ROWS;
+    if((rows - y) % DT_TIFF_STRIP_ROWS && w->row + rows - y == d->global.height) nstrips++;
+    nstrips = MIN(nstrips, batch);
+
+    const int before = w->row;
+    if(_write_strips(w, in + in_stride * y, in_stride, nstrips)) return 1;
+    y += w->row - before;
   }
-  else
+
+  return 0;
+}
+
+int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  TIFF *tif = NULL;
+
+  void *rowdata = NULL;
+
+  gboolean free_mask = FALSE;
+  float *raster_mask = NULL;
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+#endif
+  int rc = 1; // default to error
+
+  int n_pages = 1;
+  // only when masks are to be stored we check for extra pages!
+  if(export_masks && pipe)
   {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->global.width;
-      uint8_t *out = (uint8_t *)rowdata;
+    for(GList *iter = pipe->nodes; iter; iter = g_list_next(iter))
+      n_pages += g_hash_table_size(((dt_dev_pixelpipe_iop_t *)iter->data)->raster_masks);
+  }
 
-      for(int x = 0; x < d->global.width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint8_t));
-      }
+  tif = _open_image(d, filename, over_type, over_filename, imgid);
+  if(!tif)
+  {
+    rc = 1;
+    goto exit;
+  }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
+  const int resolution = dt_conf_get_int("metadata/resolution");
+
+  _tiff_writer_t *writer = _writer_new(d, tif);
+  if(!writer)
+  {
+    rc = 1;
+    goto exit;
+  }
+
+  const int written = _write_rows(writer, in_void, d->global.height);
+  _writer_free(writer);
+  if(written)
+  {
+    rc = 1;
+    goto exit;
   }
 
   rc = 0;
@@ -316,31 +513,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         else
           TIFFSetField(tif, TIFFTAG_PAGENAME, piece->module->name());
 
-        if(d->compress == 1)
-        {
-          TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-          TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)PREDICTOR_NONE);
-          TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-        }
-        else if(d->compress == 2)
-        {
-          TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-          TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)PREDICTOR_HORIZONTAL);
-          TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-        }
-        else if(d->compress == 3)
-        {
-          TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-          if(d->bpp == 32)
-            TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)PREDICTOR_FLOATINGPOINT);
-          else
-            TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)PREDICTOR_HORIZONTAL);
-          TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-        }
-        else // (d->compress == 0)
-        {
-          TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
-        }
+        _set_compression(tif, d);
 
         TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
 
@@ -461,8 +634,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   rc = 0;
 
 exit:
-  free(profile);
-  profile = NULL;
+  if(tif) TIFFClose(tif);
   free(rowdata);
   rowdata = NULL;
 #ifdef _WIN32
@@ -474,6 +646,71 @@ exit:
   return rc;
 }
 
+int write_image_begin(dt_imageio_module_data_t *d_tmp, const char *filename,
+                      dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                      void *exif, int exif_len, int imgid, int num, int total)
+{
+  dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  d->handle = _open_image(d, filename, over_type, over_filename, imgid);
+  if(!d->handle) return 1;
+
+  d->writer = _writer_new(d, d->handle);
+  if(!d->writer)
+  {
+    TIFFClose(d->handle);
+    d->handle = NULL;
+    return 1;
+  }
+
+  d->filename = g_strdup(filename);
+  // the blob stays with the caller until write_image_end() returned
+  d->exif = exif;
+  d->exif_len = exif_len;
+  return 0;
+}
+
+int write_image_rows(dt_imageio_module_data_t *d_tmp, const void *in, const int rows)
+{
+  dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  if(!d->handle) return 1;
+
+  return _write_rows(d->writer, in, rows);
+}
+
+int write_image_end(dt_imageio_module_data_t *d_tmp)
+{
+  dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  if(!d->handle) return 1;
+
+  int rc = d->writer->row == d->global.height ? 0 : 1;
+
+  TIFFSetField(d->handle, TIFFTAG_PAGENAME, _("image"));
+  TIFFSetField(d->handle, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+  TIFFSetField(d->handle, TIFFTAG_PAGENUMBER, 0, 1);
+
+  // close the file before adding exif data
+  TIFFClose(d->handle);
+  d->handle = NULL;
+
+  if(!rc && d->exif)
+  {
+    rc = dt_exif_write_blob(d->exif, d->exif_len, d->filename, d->compress > 0);
+    // Until we get symbolic error status codes, if rc is 1, return 0
+    rc = (rc == 1) ? 0 : 1;
+  }
+
+  _writer_free(d->writer);
+  d->writer = NULL;
+  g_free(d->filename);
+  d->filename = NULL;
+  d->exif = NULL;
+
+  return rc;
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
@@ -495,7 +732,7 @@ int dt_imageio_tiff_read(dt_imageio_tiff_t *tiff, uint8_t *out)
 
 size_t params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_tiff_t) - sizeof(TIFF *);
+  return offsetof(dt_imageio_tiff_t, handle);
 }
 
 void *legacy_params(dt_imageio_module_format_t *self, const void *const old_params,
@@ -223,6 +223,12 @@ void gui_reset(dt_imageio_module_storage_t *self)
   dt_conf_set_int("plugins/imageio/storage/disk/overwrite", dt_bauhaus_combobox_get(d->onsave_action));
 }
 
+gboolean parallel_store(dt_imageio_module_storage_t *self)
+{
+  // output file names are made up under darktable.plugin_threadsafe
+  return TRUE;
+}
+
 int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const int imgid,
           dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int num, const int total,
           const gboolean high_quality, const gboolean upscale, const gboolean export_masks,
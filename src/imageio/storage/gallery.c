@@ -341,10 +341,20 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
            esc_relthumbfilename,
            num, num-1, title ? title : "&nbsp;", description ? description : "&nbsp;");
 
+  // the thumbnail is the filename with -thumb, downscaled from the same render
+  char thumbfilename[PATH_MAX] = { 0 };
+  g_strlcpy(thumbfilename, filename, sizeof(thumbfilename));
+  c = thumbfilename + strlen(thumbfilename);
+  for(; c > thumbfilename && *c != '.' && *c != '/'; c--)
+    ;
+  if(c <= thumbfilename || *c == '/') c = thumbfilename + strlen(thumbfilename);
+  snprintf(c, sizeof(thumbfilename) - (c - thumbfilename), "-thumb.%s", ext);
+
   // export image to file. need this to be able to access meaningful
   // fdata->width and height below.
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality, upscale, TRUE, export_masks, icc_type,
-                       icc_filename, icc_intent, self, sdata, num, total, metadata) != 0)
+  if(dt_imageio_export_with_thumbnail(imgid, filename, format, fdata, high_quality, upscale, TRUE, export_masks,
+                                      icc_type, icc_filename, icc_intent, self, sdata, num, total, metadata,
+                                      thumbfilename, 200) != 0)
   {
     fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
@@ -371,30 +381,6 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
   if(res_desc) g_list_free_full(res_desc, &g_free);
   d->l = g_list_insert_sorted(d->l, pair, (GCompareFunc)sort_pos);
 
-  /* also export thumbnail: */
-  // write with reduced resolution:
-  const int save_max_width = fdata->max_width;
-  const int save_max_height = fdata->max_height;
-  fdata->max_width = 200;
-  fdata->max_height = 200;
-  // alter filename with -thumb:
-  c = filename + strlen(filename);
-  for(; c > filename && *c != '.' && *c != '/'; c--)
-    ;
-  if(c <= filename || *c == '/') c = filename + strlen(filename);
-  ext = format->extension(fdata);
-  sprintf(c, "-thumb.%s", ext);
-  if(dt_imageio_export(imgid, filename, format, fdata, FALSE, TRUE, FALSE, export_masks, icc_type, icc_filename,
-                       icc_intent, self, sdata, num, total, NULL) != 0)
-  {
-    fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
-    dt_control_log(_("could not export to file `%s'!"), filename);
-    return 1;
-  }
-  // restore for next image:
-  fdata->max_width = save_max_width;
-  fdata->max_height = save_max_height;
-
   printf("[export_job] exported to `%s'\n", filename);
   dt_control_log(ngettext("%d/%d exported to `%s'", "%d/%d exported to `%s'", num),
                  num, total, filename);
@@ -72,6 +72,8 @@ int store(struct dt_imageio_module_storage_t *self, struct dt_imageio_module_dat
           enum dt_iop_color_intent_t icc_intent, struct dt_export_metadata_t *metadata);
 /* called once at the end (after exporting all images), if implemented. */
 void finalize_store(struct dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *data);
+/* return TRUE if store() may be called for several images of one export at the same time. */
+gboolean parallel_store(struct dt_imageio_module_storage_t *self);
 
 void *legacy_params(struct dt_imageio_module_storage_t *self, const void *const old_params,
                     const size_t old_params_size, const int old_version, const int new_version,
@@ -45,10 +45,20 @@ DT_MODULE(1)
 
 #define MAX_ALBUM_NAME_SIZE 100
 
+/** cookies, connections and tls sessions shared by all contexts of one export, so the upload
+    threads reuse the session and the keep-alive connections of the login */
+typedef struct _piwigo_share_t
+{
+  CURLSH *handle;
+  GMutex lock[CURL_LOCK_DATA_LAST];
+  gint refcount;
+} _piwigo_share_t;
+
 typedef struct _piwigo_api_context_t
 {
   /// curl context
   CURL *curl_ctx;
+  _piwigo_share_t *share;
   JsonParser *json_parser;
   JsonObject *response;
   gboolean authenticated;
@@ -109,8 +119,21 @@ typedef struct dt_storage_piwigo_params_t
   int privacy;
   gboolean export_tags; // deprecated - let here not to change params size. to be removed on next version change
   gchar *tags;
+  // uploads run here while the next images are exported
+  GThreadPool *uploads;
+  GAsyncQueue *upload_ctx; // idle contexts of the upload threads
+  gint upload_failed;
+  gint uploaded;
 } dt_storage_piwigo_params_t;
 
+typedef struct _piwigo_upload_t
+{
+  dt_storage_piwigo_params_t *p;
+  gchar *fname;
+  gchar *author, *caption, *description, *tags;
+  int total;
+} _piwigo_upload_t;
+
 /* low-level routine doing the HTTP POST request */
 static void _piwigo_api_post(_piwigo_api_context_t *ctx, GList *args, char *filename, gboolean isauth);
 
@@ -132,24 +155,80 @@ static GList *_piwigo_query_add_arguments(GList *args, const char *name, const c
   return g_list_append(args, arg);
 }
 
+static void _piwigo_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+  g_mutex_lock(&((_piwigo_share_t *)userptr)->lock[data]);
+}
+
+static void _piwigo_share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+  g_mutex_unlock(&((_piwigo_share_t *)userptr)->lock[data]);
+}
+
+static _piwigo_share_t *_piwigo_share_new(void)
+{
+  _piwigo_share_t *share = g_malloc0(sizeof(_piwigo_share_t));
+  for(int k = 0; k < CURL_LOCK_DATA_LAST; k++) g_mutex_init(&share->lock[k]);
+  share->refcount = 1;
+  share->handle = curl_share_init();
+  curl_share_setopt(share->handle, CURLSHOPT_LOCKFUNC, _piwigo_share_lock);
+  curl_share_setopt(share->handle, CURLSHOPT_UNLOCKFUNC, _piwigo_share_unlock);
+  curl_share_setopt(share->handle, CURLSHOPT_USERDATA, share);
+  curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+  curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  return share;
+}
+
+static void _piwigo_share_unref(_piwigo_share_t *share)
+{
+  if(!g_atomic_int_dec_and_test(&share->refcount)) return;
+  curl_share_cleanup(share->handle);
+  for(int k = 0; k < CURL_LOCK_DATA_LAST; k++) g_mutex_clear(&share->lock[k]);
+  g_free(share);
+}
+
 static _piwigo_api_context_t *_piwigo_ctx_init(void)
 {
   _piwigo_api_context_t *ctx = malloc(sizeof(struct _piwigo_api_context_t));
 
   ctx->curl_ctx = curl_easy_init();
+  ctx->share = _piwigo_share_new();
   ctx->json_parser = json_parser_new();
   ctx->authenticated = FALSE;
   ctx->url = NULL;
   ctx->cookie_file = NULL;
+  ctx->server = ctx->username = ctx->password = NULL;
   ctx->error_occured = FALSE;
   return ctx;
 }
 
+// a context for another thread, logged in through the session of ctx
+static _piwigo_api_context_t *_piwigo_ctx_clone(const _piwigo_api_context_t *ctx)
+{
+  _piwigo_api_context_t *clone = malloc(sizeof(struct _piwigo_api_context_t));
+
+  clone->curl_ctx = curl_easy_init();
+  clone->share = ctx->share;
+  g_atomic_int_inc(&clone->share->refcount);
+  clone->json_parser = json_parser_new();
+  clone->authenticated = ctx->authenticated;
+  clone->url = g_strdup(ctx->url);
+  clone->cookie_file = NULL;
+  clone->server = g_strdup(ctx->server);
+  clone->username = g_strdup(ctx->username);
+  clone->password = g_strdup(ctx->password);
+  clone->error_occured = FALSE;
+  return clone;
+}
+
 static void _piwigo_ctx_destroy(_piwigo_api_context_t **ctx)
 {
   if(*ctx)
   {
     curl_easy_cleanup((*ctx)->curl_ctx);
+    _piwigo_share_unref((*ctx)->share);
     if((*ctx)->cookie_file) g_unlink((*ctx)->cookie_file);
     g_object_unref((*ctx)->json_parser);
     g_free((*ctx)->cookie_file);
@@ -281,6 +360,9 @@ static int _piwigo_api_post_internal(_piwigo_api_context_t *ctx, GList *args, ch
 
   dt_curl_init(ctx->curl_ctx, piwigo_EXTRA_VERBOSE);
 
+  curl_easy_setopt(ctx->curl_ctx, CURLOPT_SHARE, ctx->share->handle);
+  curl_easy_setopt(ctx->curl_ctx, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(ctx->curl_ctx, CURLOPT_TCP_KEEPALIVE, 1L);
   curl_easy_setopt(ctx->curl_ctx, CURLOPT_URL, url->str);
   curl_easy_setopt(ctx->curl_ctx, CURLOPT_POST, 1);
   curl_easy_setopt(ctx->curl_ctx, CURLOPT_WRITEFUNCTION, curl_write_data_cb);
@@ -301,7 +383,8 @@ static int _piwigo_api_post_internal(_piwigo_api_context_t *ctx, GList *args, ch
   }
   else
   {
-    curl_easy_setopt(ctx->curl_ctx, CURLOPT_COOKIEFILE, ctx->cookie_file);
+    // the session cookie is in the share, "" just enables the cookie engine of the upload contexts
+    curl_easy_setopt(ctx->curl_ctx, CURLOPT_COOKIEFILE, ctx->cookie_file ? ctx->cookie_file : "");
   }
 
   if(filename)
@@ -670,8 +753,8 @@ static gboolean _piwigo_api_create_new_album(dt_storage_piwigo_params_t *p)
   return TRUE;
 }
 
-static gboolean _piwigo_api_upload_photo(dt_storage_piwigo_params_t *p, gchar *fname,
-                                         gchar *author, gchar *caption, gchar *description)
+static gboolean _piwigo_api_upload_photo(_piwigo_api_context_t *ctx, dt_storage_piwigo_params_t *p, gchar *fname,
+                                         gchar *author, gchar *caption, gchar *description, gchar *tags)
 {
   GList *args = NULL;
   char cat[10];
@@ -694,13 +777,68 @@ static gboolean _piwigo_api_upload_photo(dt_storage_piwigo_params_t *p, gchar *f
   if(description && strlen(description)>0)
     args = _piwigo_query_add_arguments(args, "comment", description);
 
-  if(p->tags && strlen(p->tags)>0)
-    args = _piwigo_query_add_arguments(args, "tags", p->tags);
-  _piwigo_api_post(p->api, args, fname, FALSE);
+  if(tags && strlen(tags)>0)
+    args = _piwigo_query_add_arguments(args, "tags", tags);
+  _piwigo_api_post(ctx, args, fname, FALSE);
 
   g_list_free(args);
 
-  return !p->api->error_occured;
+  return !ctx->error_occured;
+}
+
+static void _piwigo_upload_free(_piwigo_upload_t *upload)
+{
+  g_free(upload->fname);
+  g_free(upload->author);
+  g_free(upload->caption);
+  g_free(upload->description);
+  g_free(upload->tags);
+  free(upload);
+}
+
+// runs on the upload threads. the contexts are reused, so every upload goes through the curl handle and
+// connection of a previous one
+static void _piwigo_upload_run(gpointer data, gpointer user_data)
+{
+  _piwigo_upload_t *upload = (_piwigo_upload_t *)data;
+  dt_storage_piwigo_params_t *p = upload->p;
+
+  if(!g_atomic_int_get(&p->upload_failed))
+  {
+    _piwigo_api_context_t *ctx = g_async_queue_try_pop(p->upload_ctx);
+    if(!ctx) ctx = _piwigo_ctx_clone(p->api);
+
+    if(!_piwigo_api_upload_photo(ctx, p, upload->fname, upload->author, upload->caption, upload->description,
+                                 upload->tags))
+    {
+      fprintf(stderr, "[imageio_storage_piwigo] could not upload to piwigo!\n");
+      dt_control_log(_("could not upload to piwigo!"));
+      g_atomic_int_set(&p->upload_failed, TRUE);
+    }
+    else
+    {
+      const int num = g_atomic_int_add(&p->uploaded, 1) + 1;
+      dt_control_log(ngettext("%d/%d exported to piwigo webalbum", "%d/%d exported to piwigo webalbum", num),
+                     num, upload->total);
+    }
+    g_async_queue_push(p->upload_ctx, ctx);
+  }
+
+  // And remove from filesystem..
+  g_unlink(upload->fname);
+  _piwigo_upload_free(upload);
+}
+
+// waits for the queued uploads and drops the upload threads with their contexts
+static void _piwigo_uploads_finish(dt_storage_piwigo_params_t *p)
+{
+  if(!p->uploads) return;
+  g_thread_pool_free(p->uploads, FALSE, TRUE);
+  p->uploads = NULL;
+  _piwigo_api_context_t *ctx;
+  while((ctx = g_async_queue_try_pop(p->upload_ctx))) _piwigo_ctx_destroy(&ctx);
+  g_async_queue_unref(p->upload_ctx);
+  p->upload_ctx = NULL;
 }
 
 // Login button pressed...
@@ -896,6 +1034,7 @@ static gboolean _finalize_store(gpointer user_data)
 
 void finalize_store(struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data)
 {
+  _piwigo_uploads_finish((dt_storage_piwigo_params_t *)data);
   g_main_context_invoke(NULL, _finalize_store, self->gui_data);
 }
 
@@ -976,10 +1115,11 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
     gboolean status = TRUE;
     dt_storage_piwigo_params_t *p = (dt_storage_piwigo_params_t *)sdata;
 
+    gchar *tags = NULL;
     if(metadata->flags & DT_META_TAG)
     {
       GList *tags_list = dt_tag_get_list_export(imgid, metadata->flags);
-      p->tags = dt_util_glist_to_str(",", tags_list);
+      tags = dt_util_glist_to_str(",", tags_list);
       g_list_free_full(tags_list, g_free);
     }
 
@@ -987,46 +1127,55 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
     {
       status = _piwigo_api_create_new_album(p);
       if(!status) dt_control_log(_("cannot create a new piwigo album!"));
-    }
-
-    if(status)
-    {
-      status = _piwigo_api_upload_photo(p, fname, author, caption, description);
-      if(!status)
-      {
-        fprintf(stderr, "[imageio_storage_piwigo] could not upload to piwigo!\n");
-        dt_control_log(_("could not upload to piwigo!"));
-        result = 1;
-      }
-      else if (p->new_album)
+      else
       {
         // we do not want to create more albums when multiple upload
         p->new_album = FALSE;
         _piwigo_refresh_albums(ui, p->album);
       }
     }
-    if (p->tags)
+
+    if(g_atomic_int_get(&p->upload_failed))
+      status = FALSE;
+
+    if(status)
     {
-      g_free(p->tags);
-      p->tags = NULL;
+      if(!p->uploads)
+      {
+        const int threads = CLAMP(dt_conf_get_int("plugins/imageio/storage/piwigo/concurrent_uploads"), 1, 16);
+        p->upload_ctx = g_async_queue_new();
+        p->uploads = g_thread_pool_new(_piwigo_upload_run, NULL, threads, TRUE, NULL);
+      }
+      // don't fill the tmp dir when exporting is faster than uploading
+      while(g_thread_pool_unprocessed(p->uploads) > 2 * g_thread_pool_get_max_threads(p->uploads))
+        g_usleep(10000);
+      // the upload owns the file from here on
+      _piwigo_upload_t *upload = calloc(1, sizeof(_piwigo_upload_t));
+      upload->p = p;
+      upload->fname = g_strdup(fname);
+      upload->author = author;
+      upload->caption = caption;
+      upload->description = description;
+      upload->tags = tags;
+      upload->total = total;
+      author = caption = description = tags = NULL;
+      fname[0] = '\0';
+      g_thread_pool_push(p->uploads, upload, NULL);
     }
+    else
+      result = 1;
+    g_free(tags);
   }
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
 cleanup:
 
   // And remove from filesystem..
-  g_unlink(fname);
+  if(fname[0]) g_unlink(fname);
   g_free(caption);
   g_free(description);
   g_free(author);
 
-  if(!result)
-  {
-    // this makes sense only if the export was successful
-    dt_control_log(ngettext("%d/%d exported to piwigo webalbum", "%d/%d exported to piwigo webalbum", num),
-                   num, total);
-  }
   return result;
 }
 
@@ -1169,6 +1318,7 @@ void free_params(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *pa
 
   if(p)
   {
+    _piwigo_uploads_finish(p);
     g_free(p->album);
     g_free(p->tags);
     _piwigo_ctx_destroy(&p->api);
@@ -173,10 +173,12 @@ public:
   int lookupOffset(const Key &key, bool create = true)
   {
     size_t h = key.hash & capacity_bits;
-    // Find the entry with the given key
+    // Find the entry with the given key. the hash is kept next to the key index, so probing
+    // a crowded run of the table only touches the (flat, contiguous) entries array and the
+    // key itself is only fetched on a hash match.
     while(1)
     {
-      Entry e = entries[h];
+      const Entry e = entries[h];
       // check if the cell is empty
       if(e.keyIdx == -1)
       {
@@ -189,11 +191,12 @@ public:
         // need to create an entry. Store the given key.
 	keys[filled] = key;
         entries[h].keyIdx = filled;
+        entries[h].hash = key.hash;
         return filled++;
       }
 
       // check if the cell has a matching key
-      if (keys[e.keyIdx] == key)
+      if(e.hash == key.hash && keys[e.keyIdx] == key)
 	 return e.keyIdx;
 
       // increment the bucket with wraparound
@@ -239,7 +242,7 @@ public:
     for(size_t i = 0; i < oldCapacity; i++)
     {
       if(entries[i].keyIdx == -1) continue;
-      size_t h = keys[entries[i].keyIdx].hash & capacity_bits;
+      size_t h = entries[i].hash & capacity_bits;
       while(newEntries[h].keyIdx != -1)
       {
         h = (h+1) & capacity_bits;
@@ -251,13 +254,14 @@ public:
   }
 
 private:
-  // Private struct for the hash table entries.
+  // Private struct for the hash table entries, 8 bytes so that a cache line holds 8 buckets.
   struct Entry
   {
-    Entry() : keyIdx(-1)
+    Entry() : keyIdx(-1), hash(0)
     {
     }
     int keyIdx;
+    unsigned hash;
   };
 
   Key *keys;
@@ -308,6 +308,25 @@ typedef struct dt_iop_ashift_line_t
   float L[3];
 } dt_iop_ashift_line_t;
 
+// the unfiltered outcome of the last line detection and the input it was run on. as long as the
+// preview input hasn't changed, structure detection copies these instead of running LSD again
+typedef struct dt_iop_ashift_detected_t
+{
+  uint64_t hash;
+  dt_iop_ashift_enhance_t enhance;
+  int width;
+  int height;
+  int x_off;
+  int y_off;
+  float scale;
+  dt_iop_ashift_line_t *lines;
+  int lines_count;
+  int vertical_count;
+  int horizontal_count;
+  float vertical_weight;
+  float horizontal_weight;
+} dt_iop_ashift_detected_t;
+
 typedef struct dt_iop_ashift_points_idx_t
 {
   size_t offset;
@@ -397,6 +416,7 @@ typedef struct dt_iop_ashift_gui_data_t
   int lines_version;
   float vertical_weight;
   float horizontal_weight;
+  dt_iop_ashift_detected_t detected;
   float *points;
   dt_iop_ashift_points_idx_t *points_idx;
   int points_lines_count;
@@ -1548,10 +1568,18 @@ error:
   return FALSE;
 }
 
+// forget about the cached outcome of the last line detection
+static void clear_detected(dt_iop_ashift_detected_t *det)
+{
+  free(det->lines);
+  memset(det, 0, sizeof(dt_iop_ashift_detected_t));
+}
+
 // get image from buffer, analyze for structure and save results
 static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhance)
 {
   dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)module->gui_data;
+  dt_iop_ashift_detected_t *det = &g->detected;
 
   float *buffer = NULL;
   int width = 0;
@@ -1559,6 +1587,8 @@ static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhanc
   int x_off = 0;
   int y_off = 0;
   float scale = 0.0f;
+  uint64_t hash = 0;
+  gboolean cached = FALSE;
 
   dt_pthread_mutex_lock(&g->lock);
   // read buffer data if they are available
@@ -1569,15 +1599,23 @@ static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhanc
     x_off = g->buf_x_off;
     y_off = g->buf_y_off;
     scale = g->buf_scale;
+    hash = g->buf_hash;
+
+    // the preview input is unchanged since the last detection, so are its line segments
+    cached = det->lines != NULL && det->hash == hash && det->enhance == enhance && det->width == width
+             && det->height == height && det->x_off == x_off && det->y_off == y_off && det->scale == scale;
 
-    // create a temporary buffer to hold image data
-    buffer = malloc((size_t)width * height * 4 * sizeof(float));
-    if(buffer != NULL)
-      memcpy(buffer, g->buf, (size_t)width * height * 4 * sizeof(float));
+    if(!cached)
+    {
+      // create a temporary buffer to hold image data
+      buffer = malloc((size_t)width * height * 4 * sizeof(float));
+      if(buffer != NULL)
+        memcpy(buffer, g->buf, (size_t)width * height * 4 * sizeof(float));
+    }
   }
   dt_pthread_mutex_unlock(&g->lock);
 
-  if(buffer == NULL) goto error;
+  if(buffer == NULL && !cached) goto error;
 
   // get rid of old structural data
   g->lines_count = 0;
@@ -1586,29 +1624,44 @@ static int get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhanc
   free(g->lines);
   g->lines = NULL;
 
-  dt_iop_ashift_line_t *lines;
-  int lines_count;
-  int vertical_count;
-  int horizontal_count;
-  float vertical_weight;
-  float horizontal_weight;
+  if(!cached)
+  {
+    clear_detected(det);
 
-  // get new structural data
-  if(!line_detect(buffer, width, height, x_off, y_off, scale, &lines, &lines_count,
-                  &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
-                  enhance, dt_image_is_raw(&module->dev->image_storage)))
-    goto error;
+    // get new structural data
+    if(!line_detect(buffer, width, height, x_off, y_off, scale, &det->lines, &det->lines_count,
+                    &det->vertical_count, &det->horizontal_count, &det->vertical_weight,
+                    &det->horizontal_weight, enhance, dt_image_is_raw(&module->dev->image_storage)))
+    {
+      clear_detected(det);
+      goto error;
+    }
+
+    det->hash = hash;
+    det->enhance = enhance;
+    det->width = width;
+    det->height = height;
+    det->x_off = x_off;
+    det->y_off = y_off;
+    det->scale = scale;
+  }
+
+  // the lines get flagged by outlier removal and by the user, so hand out a copy
+  const size_t lines_size = (size_t)det->lines_count * sizeof(dt_iop_ashift_line_t);
+  dt_iop_ashift_line_t *lines = malloc(lines_size);
+  if(lines == NULL) goto error;
+  memcpy(lines, det->lines, lines_size);
 
   // save new structural data
   g->lines_in_width = width;
   g->lines_in_height = height;
   g->lines_x_off = x_off;
   g->lines_y_off = y_off;
-  g->lines_count = lines_count;
-  g->vertical_count = vertical_count;
-  g->horizontal_count = horizontal_count;
-  g->vertical_weight = vertical_weight;
-  g->horizontal_weight = horizontal_weight;
+  g->lines_count = det->lines_count;
+  g->vertical_count = det->vertical_count;
+  g->horizontal_count = det->horizontal_count;
+  g->vertical_weight = det->vertical_weight;
+  g->horizontal_weight = det->horizontal_weight;
   g->lines_version++;
   g->lines_suppressed = 0;
   g->lines = lines;
@@ -4657,6 +4710,7 @@ void reload_defaults(dt_iop_module_t *module)
     g->fitting = 0;
     free(g->lines);
     g->lines = NULL;
+    clear_detected(&g->detected);
     g->lines_count =0;
     g->horizontal_count = 0;
     g->vertical_count = 0;
@@ -4812,6 +4866,7 @@ void gui_init(struct dt_iop_module_t *self)
 
   g->fitting = 0;
   g->lines = NULL;
+  memset(&g->detected, 0, sizeof(dt_iop_ashift_detected_t));
   g->lines_count = 0;
   g->vertical_count = 0;
   g->horizontal_count = 0;
@@ -5046,6 +5101,7 @@ void gui_cleanup(struct dt_iop_module_t *self)
   dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)self->gui_data;
   dt_pthread_mutex_destroy(&g->lock);
   free(g->lines);
+  free(g->detected.lines);
   free(g->buf);
   free(g->points);
   free(g->points_idx);
@@ -656,10 +656,9 @@ static image_double gaussian_sampler( image_double in, double scale,
                                       double sigma_scale )
 {
   image_double aux,out;
-  ntuple_list kernel;
-  unsigned int N,M,h,n,x,y,i;
-  int xc,yc,j,double_x_size,double_y_size;
-  double sigma,xx,yy,sum,prec;
+  unsigned int N,M,h,n;
+  int double_x_size,double_y_size;
+  double sigma,prec;
 
   /* check parameters */
   if( in == NULL || in->data == NULL || in->xsize == 0 || in->ysize == 0 )
@@ -690,82 +689,107 @@ static image_double gaussian_sampler( image_double in, double scale,
   prec = 3.0;
   h = (unsigned int) ceil( sigma * sqrt( 2.0 * prec * log(10.0) ) );
   n = 1+2*h; /* kernel size */
-  kernel = new_ntuple_list(n);
 
   /* auxiliary double image size variables */
   double_x_size = (int) (2 * in->xsize);
   double_y_size = (int) (2 * in->ysize);
 
   /* First subsampling: x axis */
-  for(x=0;x<aux->xsize;x++)
-    {
-      /*
-         x   is the coordinate in the new image.
-         xx  is the corresponding x-value in the original size image.
-         xc  is the integer value, the pixel coordinate of xx.
-       */
-      xx = (double) x / scale;
-      /* coordinate (0.0,0.0) is in the center of pixel (0,0),
-         so the pixel with xc=0 get the values of xx from -0.5 to 0.5 */
-      xc = (int) floor( xx + 0.5 );
-      gaussian_kernel( kernel, sigma, (double) h + xx - (double) xc );
-      /* the kernel must be computed for each x because the fine
-         offset xx-xc is different in each case */
-
-      for(y=0;y<aux->ysize;y++)
-        {
-          sum = 0.0;
-          for(i=0;i<kernel->dim;i++)
-            {
-              j = xc - h + i;
+#ifdef _OPENMP
+#pragma omp parallel default(none) \
+  dt_omp_firstprivate(in, aux, scale, sigma, h, n, double_x_size)
+#endif
+  {
+    /* the kernel is recomputed for each column, so every thread needs its own */
+    ntuple_list kern = new_ntuple_list(n);
 
-              /* symmetry boundary condition */
-              while( j < 0 ) j += double_x_size;
-              while( j >= double_x_size ) j -= double_x_size;
-              if( j >= (int) in->xsize ) j = double_x_size-1-j;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(unsigned int x=0;x<aux->xsize;x++)
+      {
+        /*
+           x   is the coordinate in the new image.
+           xx  is the corresponding x-value in the original size image.
+           xc  is the integer value, the pixel coordinate of xx.
+         */
+        const double xx = (double) x / scale;
+        /* coordinate (0.0,0.0) is in the center of pixel (0,0),
+           so the pixel with xc=0 get the values of xx from -0.5 to 0.5 */
+        const int xc = (int) floor( xx + 0.5 );
+        gaussian_kernel( kern, sigma, (double) h + xx - (double) xc );
+        /* the kernel must be computed for each x because the fine
+           offset xx-xc is different in each case */
+
+        for(unsigned int y=0;y<aux->ysize;y++)
+          {
+            double sum = 0.0;
+            for(unsigned int i=0;i<kern->dim;i++)
+              {
+                int j = xc - h + i;
+
+                /* symmetry boundary condition */
+                while( j < 0 ) j += double_x_size;
+                while( j >= double_x_size ) j -= double_x_size;
+                if( j >= (int) in->xsize ) j = double_x_size-1-j;
+
+                sum += in->data[ j + y * in->xsize ] * kern->values[i];
+              }
+            aux->data[ x + y * aux->xsize ] = sum;
+          }
+      }
 
-              sum += in->data[ j + y * in->xsize ] * kernel->values[i];
-            }
-          aux->data[ x + y * aux->xsize ] = sum;
-        }
-    }
+    free_ntuple_list(kern);
+  }
 
   /* Second subsampling: y axis */
-  for(y=0;y<out->ysize;y++)
-    {
-      /*
-         y   is the coordinate in the new image.
-         yy  is the corresponding x-value in the original size image.
-         yc  is the integer value, the pixel coordinate of xx.
-       */
-      yy = (double) y / scale;
-      /* coordinate (0.0,0.0) is in the center of pixel (0,0),
-         so the pixel with yc=0 get the values of yy from -0.5 to 0.5 */
-      yc = (int) floor( yy + 0.5 );
-      gaussian_kernel( kernel, sigma, (double) h + yy - (double) yc );
-      /* the kernel must be computed for each y because the fine
-         offset yy-yc is different in each case */
-
-      for(x=0;x<out->xsize;x++)
-        {
-          sum = 0.0;
-          for(i=0;i<kernel->dim;i++)
-            {
-              j = yc - h + i;
+#ifdef _OPENMP
+#pragma omp parallel default(none) \
+  dt_omp_firstprivate(in, aux, out, scale, sigma, h, n, double_y_size)
+#endif
+  {
+    ntuple_list kern = new_ntuple_list(n);
 
-              /* symmetry boundary condition */
-              while( j < 0 ) j += double_y_size;
-              while( j >= double_y_size ) j -= double_y_size;
-              if( j >= (int) in->ysize ) j = double_y_size-1-j;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(unsigned int y=0;y<out->ysize;y++)
+      {
+        /*
+           y   is the coordinate in the new image.
+           yy  is the corresponding x-value in the original size image.
+           yc  is the integer value, the pixel coordinate of xx.
+         */
+        const double yy = (double) y / scale;
+        /* coordinate (0.0,0.0) is in the center of pixel (0,0),
+           so the pixel with yc=0 get the values of yy from -0.5 to 0.5 */
+        const int yc = (int) floor( yy + 0.5 );
+        gaussian_kernel( kern, sigma, (double) h + yy - (double) yc );
+        /* the kernel must be computed for each y because the fine
+           offset yy-yc is different in each case */
+
+        for(unsigned int x=0;x<out->xsize;x++)
+          {
+            double sum = 0.0;
+            for(unsigned int i=0;i<kern->dim;i++)
+              {
+                int j = yc - h + i;
+
+                /* symmetry boundary condition */
+                while( j < 0 ) j += double_y_size;
+                while( j >= double_y_size ) j -= double_y_size;
+                if( j >= (int) in->ysize ) j = double_y_size-1-j;
+
+                sum += aux->data[ x + j * aux->xsize ] * kern->values[i];
+              }
+            out->data[ x + y * out->xsize ] = sum;
+          }
+      }
 
-              sum += aux->data[ x + j * aux->xsize ] * kernel->values[i];
-            }
-          out->data[ x + y * out->xsize ] = sum;
-        }
-    }
+    free_ntuple_list(kern);
+  }
 
   /* free memory */
-  free_ntuple_list(kernel);
   free_image_double(aux);
 
   return out;
@@ -798,8 +822,8 @@ static image_double ll_angle( image_double in, double threshold,
                               image_double * modgrad, unsigned int n_bins )
 {
   image_double g;
-  unsigned int n,p,x,y,adr,i;
-  double com1,com2,gx,gy,norm,norm2;
+  unsigned int n,p,x,y,i;
+  double norm;
   /* the rest of the variables are used for pseudo-ordering
      the gradient magnitude values */
   int list_count = 0;
@@ -844,11 +868,17 @@ static image_double ll_angle( image_double in, double threshold,
   for(x=0;x<p;x++) g->data[(n-1)*p+x] = NOTDEF;
   for(y=0;y<n;y++) g->data[p*y+p-1]   = NOTDEF;
 
-  /* compute gradient on the remaining pixels */
-  for(x=0;x<p-1;x++)
-    for(y=0;y<n-1;y++)
+  /* compute gradient on the remaining pixels, rows are independent of each other */
+  image_double mg = *modgrad;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, g, mg, n, p, threshold) \
+  schedule(static) reduction(max : max_grad)
+#endif
+  for(y=0;y<n-1;y++)
+    for(unsigned int x=0;x<p-1;x++)
       {
-        adr = y*p+x;
+        const unsigned int adr = y*p+x;
 
         /*
            Norm 2 computation using 2x2 pixel window:
@@ -861,15 +891,15 @@ static image_double ll_angle( image_double in, double threshold,
              gy = C+D - (A+B)   vertical difference
            com1 and com2 are just to avoid 2 additions.
          */
-        com1 = in->data[adr+p+1] - in->data[adr];
-        com2 = in->data[adr+1]   - in->data[adr+p];
+        const double com1 = in->data[adr+p+1] - in->data[adr];
+        const double com2 = in->data[adr+1]   - in->data[adr+p];
 
-        gx = com1+com2; /* gradient x component */
-        gy = com1-com2; /* gradient y component */
-        norm2 = gx*gx+gy*gy;
-        norm = sqrt( norm2 / 4.0 ); /* gradient norm */
+        const double gx = com1+com2; /* gradient x component */
+        const double gy = com1-com2; /* gradient y component */
+        const double norm2 = gx*gx+gy*gy;
+        const double norm = sqrt( norm2 / 4.0 ); /* gradient norm */
 
-        (*modgrad)->data[adr] = norm; /* store gradient norm */
+        mg->data[adr] = norm; /* store gradient norm */
 
         if( norm <= threshold ) /* norm too small, gradient no defined */
           g->data[adr] = NOTDEF; /* gradient angle not defined */
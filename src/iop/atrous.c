@@ -564,61 +564,75 @@ static void eaw_decompose_sse2(float *const out, const float *const in, float *c
 #undef SUM_PIXEL_EPILOGUE_SSE
 #endif
 
-typedef void((*eaw_synthesize_t)(float *const out, const float *const in, const float *const detail,
-                                 const float *thrsf, const float *boostf, const int32_t width,
-                                 const int32_t height));
-
-static void eaw_synthesize(float *const out, const float *const in, const float *const detail,
-                           const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+typedef void((*eaw_synthesize_t)(float *const out, const float *const in, float *const *const detail,
+                                 const float (*const thrsf)[4], const float (*const boostf)[4],
+                                 const int max_scale, const int32_t width, const int32_t height));
+
+// the synthesis of all scales is a per pixel sum of the coarse residual and the thresholded, boosted details.
+// do it in a single pass instead of one full buffer pass per scale, adding coarsest to finest as before.
+// out may be the same buffer as in.
+static void eaw_synthesize(float *const out, const float *const in, float *const *const detail,
+                           const float (*const thrsf)[4], const float (*const boostf)[4], const int max_scale,
+                           const int32_t width, const int32_t height)
 {
-  const float threshold[4] = { thrsf[0], thrsf[1], thrsf[2], thrsf[3] };
-  const float boost[4] = { boostf[0], boostf[1], boostf[2], boostf[3] };
-
 #ifdef _OPENMP
-#pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(boost, detail, height, in, out, width, threshold) \
-  schedule(static) \
-  collapse(2)
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(boostf, detail, height, in, max_scale, out, thrsf, width) \
+  schedule(static)
 #endif
   for(size_t k = 0; k < (size_t)4 * width * height; k += 4)
   {
-    for(size_t c = 0; c < 4; c++)
+    float px[4] = { in[k], in[k + 1], in[k + 2], in[k + 3] };
+    for(int scale = max_scale - 1; scale >= 0; scale--)
     {
-      const float absamt = fmaxf(0.0f, (fabsf(detail[k + c]) - threshold[c]));
-      const float amount = copysignf(absamt, detail[k + c]);
-      out[k + c] = in[k + c] + (boost[c] * amount);
+      const float *const pdetail = detail[scale] + k;
+      for(size_t c = 0; c < 4; c++)
+      {
+        const float absamt = fmaxf(0.0f, (fabsf(pdetail[c]) - thrsf[scale][c]));
+        const float amount = copysignf(absamt, pdetail[c]);
+        px[c] += boostf[scale][c] * amount;
+      }
     }
+    for(size_t c = 0; c < 4; c++) out[k + c] = px[c];
   }
 }
 
 #if defined(__SSE2__)
-static void eaw_synthesize_sse2(float *const out, const float *const in, const float *const detail,
-                                const float *thrsf, const float *boostf, const int32_t width,
-                                const int32_t height)
+static void eaw_synthesize_sse2(float *const out, const float *const in, float *const *const detail,
+                                const float (*const thrsf)[4], const float (*const boostf)[4],
+                                const int max_scale, const int32_t width, const int32_t height)
 {
-  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
-  const __m128 boost = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
+  __m128 threshold[MAX_NUM_SCALES];
+  __m128 boost[MAX_NUM_SCALES];
+  for(int scale = 0; scale < max_scale; scale++)
+  {
+    threshold[scale] = _mm_loadu_ps(thrsf[scale]);
+    boost[scale] = _mm_loadu_ps(boostf[scale]);
+  }
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(boost, detail, height, in, out, threshold, width) \
+  dt_omp_firstprivate(boost, detail, height, in, max_scale, out, threshold, width) \
   schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
-    // TODO: prefetch? _mm_prefetch()
+    const __m128i maski = _mm_set1_epi32(0x80000000u);
+    const __m128 mask = _mm_castsi128_ps(maski);
     const __m128 *pin = (__m128 *)in + (size_t)j * width;
-    __m128 *pdetail = (__m128 *)detail + (size_t)j * width;
     float *pout = out + (size_t)4 * j * width;
     for(int i = 0; i < width; i++)
     {
-      const __m128i maski = _mm_set1_epi32(0x80000000u);
-      const __m128 *mask = (__m128 *)&maski;
-      const __m128 absamt
-          = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-      pdetail++;
+      __m128 px = *pin;
+      for(int scale = max_scale - 1; scale >= 0; scale--)
+      {
+        const __m128 pdetail = *((__m128 *)detail[scale] + (size_t)j * width + i);
+        const __m128 absamt
+            = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(mask, pdetail), threshold[scale]));
+        const __m128 amount = _mm_or_ps(_mm_and_ps(pdetail, mask), absamt);
+        px = _mm_add_ps(px, _mm_mul_ps(boost[scale], amount));
+      }
+      _mm_stream_ps(pout, px);
       pin++;
       pout += 4;
     }
@@ -732,7 +746,7 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   float *buf2 = NULL;
   float *buf1 = NULL;
 
-  tmp = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+  tmp = (float *)dt_dev_pixelpipe_scratch_alloc(piece, (size_t)sizeof(float) * 4 * width * height);
   if(tmp == NULL)
   {
     fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
@@ -741,7 +755,7 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
   for(int k = 0; k < max_scale; k++)
   {
-    detail[k] = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+    detail[k] = (float *)dt_dev_pixelpipe_scratch_alloc(piece, (size_t)sizeof(float) * 4 * width * height);
     if(detail[k] == NULL)
     {
       fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
@@ -761,17 +775,11 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
     buf1 = buf3;
   }
 
-  for(int scale = max_scale - 1; scale >= 0; scale--)
-  {
-    synthesize(buf2, buf1, detail[scale], thrs[scale], boost[scale], width, height);
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-  /* due to symmetric processing, output will be left in (float *)o */
+  // buf1 holds the coarse residual now, which is either tmp or (float *)o
+  synthesize((float *)o, buf1, detail, (const float(*)[4])thrs, (const float(*)[4])boost, max_scale, width, height);
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(detail[k]);
-  dt_free_align(tmp);
+  for(int k = 0; k < max_scale; k++) dt_dev_pixelpipe_scratch_free(piece, detail[k]);
+  dt_dev_pixelpipe_scratch_free(piece, tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, width, height);
 
@@ -779,8 +787,8 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
 error:
   for(int k = 0; k < max_scale; k++)
-    if(detail[k] != NULL) dt_free_align(detail[k]);
-  if(tmp != NULL) dt_free_align(tmp);
+    if(detail[k] != NULL) dt_dev_pixelpipe_scratch_free(piece, detail[k]);
+  if(tmp != NULL) dt_dev_pixelpipe_scratch_free(piece, tmp);
   return;
 }
 
@@ -23,6 +23,7 @@ extern "C" {
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -64,6 +65,18 @@ typedef struct dt_iop_bilateral_data_t
   float sigma[5];
 } dt_iop_bilateral_data_t;
 
+typedef struct dt_iop_bilateral_global_data_t
+{
+  int kernel_permutohedral_clear;
+  int kernel_permutohedral_splat_keys;
+  int kernel_permutohedral_insert;
+  int kernel_permutohedral_enumerate;
+  int kernel_permutohedral_splat_values;
+  int kernel_permutohedral_blur;
+  int kernel_permutohedral_slice;
+  int kernel_bilateral_small;
+} dt_iop_bilateral_global_data_t;
+
 const char *name()
 {
   return _("denoise (bilateral filter)");
@@ -252,6 +265,219 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+#ifdef HAVE_OPENCL
+// launches kernel once for each of the n elements of a buffer, laid out in rows of width
+static cl_int enqueue_buffer_kernel(const int devid, const int kernel, const int n, const int width)
+{
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT((n + width - 1) / width), 1 };
+  return dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+}
+
+static cl_int process_small_cl(dt_iop_bilateral_global_data_t *gd, const int devid, cl_mem dev_in,
+                               cl_mem dev_out, const int width, const int height, const int rad,
+                               const float *sigma)
+{
+  const float isig2col[4] = { 1.f / (2.0f * sigma[2] * sigma[2]), 1.f / (2.0f * sigma[3] * sigma[3]),
+                              1.f / (2.0f * sigma[4] * sigma[4]), 0.0f };
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 4, sizeof(int), (void *)&rad);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 5, sizeof(float), (void *)&sigma[0]);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral_small, 6, 4 * sizeof(float), (void *)&isig2col);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_bilateral_small, sizes);
+}
+
+/*
+ * the permutohedral lattice on the gpu, see data/kernels/permutohedral.cl. the lattice vertices of
+ * all pixels are computed first, then inserted into a flat hash table which has more buckets than
+ * there are keys, so that inserting never has to grow it. only the number of vertices is read back to
+ * size the value buffers, everything else stays on the device.
+ */
+static cl_int process_lattice_cl(dt_iop_bilateral_global_data_t *gd, const int devid, cl_mem dev_in,
+                                 cl_mem dev_out, const int width, const int height, const float *sigma)
+{
+  cl_int err = -999;
+  const int nkeys = width * height * 6;
+  int capacity = 1;
+  while(capacity <= nkeys) capacity <<= 1;
+  const unsigned int mask = capacity - 1;
+  const int empty = -1;
+  const int zero = 0;
+  int nvertices = 0;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  cl_mem dev_keys = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(cl_short) * 5 * nkeys);
+  cl_mem dev_weights = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(float) * nkeys);
+  cl_mem dev_slots = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * nkeys);
+  cl_mem dev_vertex_key = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * nkeys);
+  cl_mem dev_entries = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * capacity);
+  cl_mem dev_vertex_of_slot = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * capacity);
+  cl_mem dev_count = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int));
+  cl_mem dev_values[2] = { NULL, NULL };
+
+  if(dev_keys == NULL || dev_weights == NULL || dev_slots == NULL || dev_vertex_key == NULL
+     || dev_entries == NULL || dev_vertex_of_slot == NULL || dev_count == NULL)
+    goto cleanup;
+
+  // compute the enclosing simplex of every pixel
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_keys, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_keys, 1, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_keys, 2, sizeof(int), (void *)&height);
+  for(int k = 0; k < 5; k++)
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_keys, 3 + k, sizeof(float), (void *)&sigma[k]);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_keys, 8, sizeof(cl_mem), (void *)&dev_keys);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_keys, 9, sizeof(cl_mem), (void *)&dev_weights);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_splat_keys, sizes);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  // build the hash table
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 0, sizeof(cl_mem), (void *)&dev_entries);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 1, sizeof(int), (void *)&capacity);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 3, sizeof(int), (void *)&empty);
+  err = enqueue_buffer_kernel(devid, gd->kernel_permutohedral_clear, capacity, width);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_insert, 0, sizeof(cl_mem), (void *)&dev_keys);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_insert, 1, sizeof(int), (void *)&nkeys);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_insert, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_insert, 3, sizeof(cl_mem), (void *)&dev_entries);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_insert, 4, sizeof(unsigned int), (void *)&mask);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_insert, 5, sizeof(cl_mem), (void *)&dev_slots);
+  err = enqueue_buffer_kernel(devid, gd->kernel_permutohedral_insert, nkeys, width);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  // number the vertices densely
+  err = dt_opencl_write_buffer_to_device(devid, (void *)&zero, dev_count, 0, sizeof(int), CL_TRUE);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_enumerate, 0, sizeof(cl_mem), (void *)&dev_entries);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_enumerate, 1, sizeof(int), (void *)&capacity);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_enumerate, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_enumerate, 3, sizeof(cl_mem), (void *)&dev_vertex_of_slot);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_enumerate, 4, sizeof(cl_mem), (void *)&dev_vertex_key);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_enumerate, 5, sizeof(cl_mem), (void *)&dev_count);
+  err = enqueue_buffer_kernel(devid, gd->kernel_permutohedral_enumerate, capacity, width);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  err = dt_opencl_read_buffer_from_device(devid, (void *)&nvertices, dev_count, 0, sizeof(int), CL_TRUE);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  // splat
+  err = -999;
+  dev_values[0] = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(float) * 4 * nvertices);
+  dev_values[1] = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(float) * 4 * nvertices);
+  if(dev_values[0] == NULL || dev_values[1] == NULL) goto cleanup;
+
+  {
+    const int nvalues = 4 * nvertices;
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 0, sizeof(cl_mem), (void *)&dev_values[0]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 1, sizeof(int), (void *)&nvalues);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_clear, 3, sizeof(int), (void *)&zero);
+    err = enqueue_buffer_kernel(devid, gd->kernel_permutohedral_clear, nvalues, width);
+    if(err != CL_SUCCESS) goto cleanup;
+  }
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 1, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 2, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 3, sizeof(cl_mem), (void *)&dev_weights);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 4, sizeof(cl_mem), (void *)&dev_slots);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 5, sizeof(cl_mem),
+                           (void *)&dev_vertex_of_slot);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat_values, 6, sizeof(cl_mem), (void *)&dev_values[0]);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_splat_values, sizes);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  // blur along each of the d+1 axes, ping-ponging between the value buffers
+  for(int dim = 0; dim <= 5; dim++)
+  {
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 0, sizeof(cl_mem), (void *)&dev_keys);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 1, sizeof(cl_mem), (void *)&dev_entries);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 2, sizeof(unsigned int), (void *)&mask);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 3, sizeof(cl_mem), (void *)&dev_vertex_of_slot);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 4, sizeof(cl_mem), (void *)&dev_vertex_key);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 5, sizeof(int), (void *)&nvertices);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 6, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 7, sizeof(int), (void *)&dim);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 8, sizeof(cl_mem), (void *)&dev_values[dim & 1]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 9, sizeof(cl_mem),
+                             (void *)&dev_values[(dim + 1) & 1]);
+    err = enqueue_buffer_kernel(devid, gd->kernel_permutohedral_blur, nvertices, width);
+    if(err != CL_SUCCESS) goto cleanup;
+  }
+
+  // slice, after an even number of blur passes the result is back in the first buffer
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 4, sizeof(cl_mem), (void *)&dev_weights);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 5, sizeof(cl_mem), (void *)&dev_slots);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 6, sizeof(cl_mem), (void *)&dev_values[0]);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_slice, sizes);
+
+cleanup:
+  dt_opencl_release_mem_object(dev_values[1]);
+  dt_opencl_release_mem_object(dev_values[0]);
+  dt_opencl_release_mem_object(dev_count);
+  dt_opencl_release_mem_object(dev_vertex_of_slot);
+  dt_opencl_release_mem_object(dev_entries);
+  dt_opencl_release_mem_object(dev_vertex_key);
+  dt_opencl_release_mem_object(dev_slots);
+  dt_opencl_release_mem_object(dev_weights);
+  dt_opencl_release_mem_object(dev_keys);
+  return err;
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_bilateral_data_t *data = (dt_iop_bilateral_data_t *)piece->data;
+  dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)self->global_data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  cl_int err = -999;
+
+  float sigma[5];
+  sigma[0] = data->sigma[0] * roi_in->scale / piece->iscale;
+  sigma[1] = data->sigma[1] * roi_in->scale / piece->iscale;
+  sigma[2] = data->sigma[2];
+  sigma[3] = data->sigma[3];
+  sigma[4] = data->sigma[4];
+
+  // same choice of algorithm as in process()
+  const int rad = (int)(3.0 * fmaxf(sigma[0], sigma[1]) + 1.0);
+  if(fmaxf(sigma[0], sigma[1]) < .1 || (rad <= 6 && (piece->pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)))
+  {
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { (size_t)width, (size_t)height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+  }
+  else if(rad <= 6)
+    err = process_small_cl(gd, devid, dev_in, dev_out, width, height, rad, sigma);
+  else
+  {
+    for(int k = 0; k < 5; k++) sigma[k] = 1.0f / sigma[k];
+    err = process_lattice_cl(gd, devid, dev_in, dev_out, width, height, sigma);
+  }
+
+  if(err != CL_SUCCESS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_bilateral] couldn't enqueue kernel! %d\n", err);
+    return FALSE;
+  }
+  return TRUE;
+}
+#endif
+
 static void sigma_callback(GtkWidget *slider, dt_iop_module_t *self)
 {
   if(self->dt->gui->reset) return;
@@ -322,6 +548,37 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   return;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 33; // permutohedral.cl, from programs.conf
+  dt_iop_bilateral_global_data_t *gd
+      = (dt_iop_bilateral_global_data_t *)malloc(sizeof(dt_iop_bilateral_global_data_t));
+  module->data = gd;
+  gd->kernel_permutohedral_clear = dt_opencl_create_kernel(program, "permutohedral_clear");
+  gd->kernel_permutohedral_splat_keys = dt_opencl_create_kernel(program, "permutohedral_splat_keys");
+  gd->kernel_permutohedral_insert = dt_opencl_create_kernel(program, "permutohedral_insert");
+  gd->kernel_permutohedral_enumerate = dt_opencl_create_kernel(program, "permutohedral_enumerate");
+  gd->kernel_permutohedral_splat_values = dt_opencl_create_kernel(program, "permutohedral_splat_values");
+  gd->kernel_permutohedral_blur = dt_opencl_create_kernel(program, "permutohedral_blur");
+  gd->kernel_permutohedral_slice = dt_opencl_create_kernel(program, "permutohedral_slice");
+  gd->kernel_bilateral_small = dt_opencl_create_kernel(program, "bilateral_small");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_permutohedral_clear);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_splat_keys);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_insert);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_enumerate);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_splat_values);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_blur);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_slice);
+  dt_opencl_free_kernel(gd->kernel_bilateral_small);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   // module->data = malloc(sizeof(dt_iop_bilateral_data_t));
@@ -21,9 +21,11 @@
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "dtgtk/resetlabel.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
@@ -61,6 +63,14 @@ typedef struct dt_iop_rlce_data_t
 } dt_iop_rlce_data_t;
 
 
+typedef struct dt_iop_rlce_global_data_t
+{
+  int kernel_clahe_bins;
+  int kernel_clahe_rows;
+  int kernel_clahe_apply;
+} dt_iop_rlce_global_data_t;
+
+
 const char *name()
 {
   return _("local contrast");
@@ -73,7 +83,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED | IOP_FLAGS_ALLOW_TILING;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -81,15 +91,25 @@ int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   return iop_cs_rgb;
 }
 
+#define BINS (256)
+
+// rows are handed out to the threads in strips of this height
+#define STRIP_HEIGHT (32)
+
+static inline int _get_radius(const dt_iop_rlce_data_t *data, const dt_dev_pixelpipe_iop_t *piece,
+                              const dt_iop_roi_t *const roi_in)
+{
+  return data->radius * roi_in->scale / piece->iscale;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
   const int ch = piece->colors;
 
-  // PASS1: Get a luminance map of image...
-  float *luminance = (float *)malloc(((size_t)roi_out->width * roi_out->height) * sizeof(float));
-// double lsmax=0.0,lsmin=1.0;
+  // PASS1: Get a luminance map of image, already quantised to the bins of the histograms
+  uint16_t *luminance = (uint16_t *)malloc(((size_t)roi_out->width * roi_out->height) * sizeof(uint16_t));
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(ch, ivoid, roi_out) \
@@ -99,12 +119,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   for(int j = 0; j < roi_out->height; j++)
   {
     float *in = (float *)ivoid + (size_t)j * roi_out->width * ch;
-    float *lm = luminance + (size_t)j * roi_out->width;
+    uint16_t *lm = luminance + (size_t)j * roi_out->width;
     for(int i = 0; i < roi_out->width; i++)
     {
       double pmax = CLIP(fmax(in[0], fmax(in[1], in[2]))); // Max value in RGB set
       double pmin = CLIP(fmin(in[0], fmin(in[1], in[2]))); // Min value in RGB set
-      *lm = (pmax + pmin) / 2.0;                           // Pixel luminocity
+      const float l = (pmax + pmin) / 2.0;                 // Pixel luminocity
+      *lm = ROUND_POSISTIVE(l * (float)BINS);
       in += ch;
       lm++;
     }
@@ -112,133 +133,151 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
 
   // Params
-  const int rad = data->radius * roi_in->scale / piece->iscale;
-
-#define BINS (256)
+  const int rad = _get_radius(data, piece, roi_in);
 
   const float slope = data->slope;
 
   const size_t destbuf_size = roi_out->width;
   float *const dest_buf = malloc(destbuf_size * sizeof(float) * dt_get_num_threads());
 
+  const int strips = (roi_out->height + STRIP_HEIGHT - 1) / STRIP_HEIGHT;
+
 // CLAHE
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(ch, dest_buf, destbuf_size, ivoid, ovoid, rad, roi_in, \
-                      roi_out, slope) \
+                      roi_out, slope, strips) \
   shared(luminance) \
-  schedule(static)
+  schedule(dynamic)
 #endif
-  for(int j = 0; j < roi_out->height; j++)
+  for(int strip = 0; strip < strips; strip++)
   {
-    int yMin = fmax(0, j - rad);
-    int yMax = fmin(roi_in->height, j + rad + 1);
-    int h = yMax - yMin;
+    const int j0 = strip * STRIP_HEIGHT;
+    const int j1 = MIN(j0 + STRIP_HEIGHT, roi_out->height);
 
     int xMin0 = fmax(0, 0 - rad);
     int xMax0 = fmin(roi_in->width - 1, rad);
 
+    // the histogram of the window of the first pixel in a row. it slides down along the rows
+    // of the strip, so it is filled from scratch only once per strip
+    int rowhist[BINS + 1];
     int hist[BINS + 1];
     int clippedhist[BINS + 1];
 
     float *dest = dest_buf + destbuf_size * dt_get_thread_num();
 
     /* initially fill histogram */
-    memset(hist, 0, (BINS + 1) * sizeof(int));
-    for(int yi = yMin; yi < yMax; ++yi)
-      for(int xi = xMin0; xi < xMax0; ++xi)
-        ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xi] * (float)BINS)];
-
-    // Destination row
-    memset(dest, 0, roi_out->width * sizeof(float));
-    float *ld = dest;
+    memset(rowhist, 0, (BINS + 1) * sizeof(int));
+    for(int yi = MAX(0, j0 - rad); yi < MIN(roi_in->height, j0 + rad + 1); ++yi)
+      for(int xi = xMin0; xi < xMax0; ++xi) ++rowhist[luminance[(size_t)yi * roi_in->width + xi]];
 
-    for(int i = 0; i < roi_out->width; i++)
+    for(int j = j0; j < j1; j++)
     {
+      int yMin = fmax(0, j - rad);
+      int yMax = fmin(roi_in->height, j + rad + 1);
+      int h = yMax - yMin;
 
-      int v = ROUND_POSISTIVE(luminance[(size_t)j * roi_in->width + i] * (float)BINS);
-
-      int xMin = fmax(0, i - rad);
-      int xMax = i + rad + 1;
-      int w = fmin(roi_in->width, xMax) - xMin;
-      int n = h * w;
-
-      int limit = (int)(slope * n / BINS + 0.5f);
-
-      /* remove left behind values from histogram */
-      if(xMin > 0)
+      /* move the row histogram down by one row */
+      if(j > j0)
       {
-        int xMin1 = xMin - 1;
-        for(int yi = yMin; yi < yMax; ++yi)
-          --hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xMin1] * (float)BINS)];
+        if(j - rad - 1 >= 0)
+          for(int xi = xMin0; xi < xMax0; ++xi) --rowhist[luminance[(size_t)(j - rad - 1) * roi_in->width + xi]];
+        if(j + rad < roi_in->height)
+          for(int xi = xMin0; xi < xMax0; ++xi) ++rowhist[luminance[(size_t)(j + rad) * roi_in->width + xi]];
       }
+      memcpy(hist, rowhist, (BINS + 1) * sizeof(int));
 
-      /* add newly included values to histogram */
-      if(xMax <= roi_in->width)
-      {
-        int xMax1 = xMax - 1;
-        for(int yi = yMin; yi < yMax; ++yi)
-          ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xMax1] * (float)BINS)];
-      }
+      // Destination row
+      memset(dest, 0, roi_out->width * sizeof(float));
+      float *ld = dest;
 
-      /* clip histogram and redistribute clipped entries */
-      memcpy(clippedhist, hist, (BINS + 1) * sizeof(int));
-      int ce = 0, ceb = 0;
-      do
+      for(int i = 0; i < roi_out->width; i++)
       {
-        ceb = ce;
-        ce = 0;
-        for(int b = 0; b <= BINS; b++)
+        int v = luminance[(size_t)j * roi_in->width + i];
+
+        int xMin = fmax(0, i - rad);
+        int xMax = i + rad + 1;
+        int w = fmin(roi_in->width, xMax) - xMin;
+        int n = h * w;
+
+        int limit = (int)(slope * n / BINS + 0.5f);
+
+        /* remove left behind values from histogram */
+        if(xMin > 0)
         {
-          int d = clippedhist[b] - limit;
-          if(d > 0)
-          {
-            ce += d;
-            clippedhist[b] = limit;
-          }
+          int xMin1 = xMin - 1;
+          for(int yi = yMin; yi < yMax; ++yi) --hist[luminance[(size_t)yi * roi_in->width + xMin1]];
         }
 
-        int d = (ce / (float)(BINS + 1));
-        int m = ce % (BINS + 1);
-        for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
-
-        if(m != 0)
+        /* add newly included values to histogram */
+        if(xMax <= roi_in->width)
         {
-          int s = BINS / (float)m;
-          for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
+          int xMax1 = xMax - 1;
+          for(int yi = yMin; yi < yMax; ++yi) ++hist[luminance[(size_t)yi * roi_in->width + xMax1]];
         }
-      } while(ce != ceb);
 
-      /* build cdf of clipped histogram */
-      unsigned int hMin = BINS;
-      for(int b = 0; b < hMin; b++)
-        if(clippedhist[b] != 0) hMin = b;
+        /* clip histogram and redistribute clipped entries. after a clipping pass all bins are at most
+           at the limit, so unless the redistribution raised all of them only the bins it incremented
+           need to be looked at again. s is the stride of these bins, 1 for all, 0 for none */
+        memcpy(clippedhist, hist, (BINS + 1) * sizeof(int));
+        int ce = 0, ceb = 0, s = 1;
+        do
+        {
+          ceb = ce;
+          ce = 0;
+          for(int b = 0; s && b <= BINS; b += s)
+          {
+            int d = clippedhist[b] - limit;
+            if(d > 0)
+            {
+              ce += d;
+              clippedhist[b] = limit;
+            }
+          }
 
-      int cdf = 0;
-      for(int b = hMin; b <= v; b++) cdf += clippedhist[b];
+          int d = (ce / (float)(BINS + 1));
+          int m = ce % (BINS + 1);
+          if(d != 0)
+            for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
 
-      int cdfMax = cdf;
-      for(int b = v + 1; b <= BINS; b++) cdfMax += clippedhist[b];
+          s = 0;
+          if(m != 0)
+          {
+            s = BINS / (float)m;
+            for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
+          }
+          if(d != 0) s = 1;
+        } while(ce != ceb);
 
-      int cdfMin = clippedhist[hMin];
+        /* build cdf of clipped histogram */
+        unsigned int hMin = BINS;
+        for(int b = 0; b < hMin; b++)
+          if(clippedhist[b] != 0) hMin = b;
 
-      *ld = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+        int cdf = 0;
+        for(int b = hMin; b <= v; b++) cdf += clippedhist[b];
 
-      ld++;
-    }
+        int cdfMax = cdf;
+        for(int b = v + 1; b <= BINS; b++) cdfMax += clippedhist[b];
 
-    // Apply row
-    float *in = ((float *)ivoid) + (size_t)j * roi_out->width * ch;
-    float *out = ((float *)ovoid) + (size_t)j * roi_out->width * ch;
-    for(int r = 0; r < roi_out->width; r++)
-    {
-      float H, S, L;
-      rgb2hsl(in, &H, &S, &L);
-      // hsl2rgb(out,H,S,( L / dest[r] ) * (L-lsmin) + lsmin );
-      hsl2rgb(out, H, S, dest[r]);
-      out += ch;
-      in += ch;
-      ld++;
+        int cdfMin = clippedhist[hMin];
+
+        *ld = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+
+        ld++;
+      }
+
+      // Apply row
+      float *in = ((float *)ivoid) + (size_t)j * roi_out->width * ch;
+      float *out = ((float *)ovoid) + (size_t)j * roi_out->width * ch;
+      for(int r = 0; r < roi_out->width; r++)
+      {
+        float H, S, L;
+        rgb2hsl(in, &H, &S, &L);
+        hsl2rgb(out, H, S, dest[r]);
+        out += ch;
+        in += ch;
+      }
     }
   }
 
@@ -246,10 +285,103 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   // Cleanup
   free(luminance);
+}
 
-#undef BINS
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)self->global_data;
+
+  cl_int err = -999;
+  cl_mem dev_bins = NULL;
+  cl_mem dev_hist = NULL;
+  cl_mem dev_clipped = NULL;
+  cl_mem dev_dest = NULL;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  const int rad = _get_radius(data, piece, roi_in);
+  const float slope = data->slope;
+
+  dev_bins = dt_opencl_alloc_device_buffer(devid, (size_t)width * height * sizeof(uint16_t));
+  if(dev_bins == NULL) goto error;
+  dev_hist = dt_opencl_alloc_device_buffer(devid, (size_t)(BINS + 1) * height * sizeof(int));
+  if(dev_hist == NULL) goto error;
+  dev_clipped = dt_opencl_alloc_device_buffer(devid, (size_t)(BINS + 1) * height * sizeof(int));
+  if(dev_clipped == NULL) goto error;
+  dev_dest = dt_opencl_alloc_device_buffer(devid, (size_t)width * height * sizeof(float));
+  if(dev_dest == NULL) goto error;
+
+  size_t sizes[3] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 1, sizeof(cl_mem), (void *)&dev_bins);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 3, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_bins, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // one work item per row
+  size_t rsizes[3] = { ROUNDUPHT(height), 1, 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 0, sizeof(cl_mem), (void *)&dev_bins);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 1, sizeof(cl_mem), (void *)&dev_hist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 2, sizeof(cl_mem), (void *)&dev_clipped);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 3, sizeof(cl_mem), (void *)&dev_dest);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 5, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 6, sizeof(int), (void *)&rad);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_rows, 7, sizeof(float), (void *)&slope);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_rows, rsizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 2, sizeof(cl_mem), (void *)&dev_dest);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 4, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_dest);
+  dt_opencl_release_mem_object(dev_clipped);
+  dt_opencl_release_mem_object(dev_hist);
+  dt_opencl_release_mem_object(dev_bins);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_dest);
+  dt_opencl_release_mem_object(dev_clipped);
+  dt_opencl_release_mem_object(dev_hist);
+  dt_opencl_release_mem_object(dev_bins);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_clahe] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
+
+  const int rad = _get_radius(data, piece, roi_in);
+
+  tiling->factor = 2.375f; // in + out + luminance bins (0.125) + equalised luminance (0.25)
+  tiling->maxbuf = 1.0f;
+  // the two per row histograms of the opencl code path
+  tiling->overhead = (size_t)2 * (BINS + 1) * sizeof(int) * roi_out->height;
+  tiling->overlap = rad;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+  return;
 }
 
+#undef STRIP_HEIGHT
+#undef BINS
+
 static void radius_callback(GtkWidget *slider, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
@@ -313,6 +445,26 @@ void init(dt_iop_module_t *module)
   memcpy(module->default_params, &tmp, sizeof(dt_iop_rlce_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 34; // clahe.cl, from programs.conf
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)malloc(sizeof(dt_iop_rlce_global_data_t));
+  module->data = gd;
+  gd->kernel_clahe_bins = dt_opencl_create_kernel(program, "clahe_bins");
+  gd->kernel_clahe_rows = dt_opencl_create_kernel(program, "clahe_rows");
+  gd->kernel_clahe_apply = dt_opencl_create_kernel(program, "clahe_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_clahe_bins);
+  dt_opencl_free_kernel(gd->kernel_clahe_rows);
+  dt_opencl_free_kernel(gd->kernel_clahe_apply);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
@@ -101,11 +101,29 @@ typedef struct dt_iop_colorchecker_data_t
   float coeff_L[MAX_PATCHES+4];
   float coeff_a[MAX_PATCHES+4];
   float coeff_b[MAX_PATCHES+4];
+  // source_Lab by channel, for process()
+  float patch_L[MAX_PATCHES];
+  float patch_a[MAX_PATCHES];
+  float patch_b[MAX_PATCHES];
 } dt_iop_colorchecker_data_t;
 
+#define COLORCHECKER_CACHE_ENTRIES 4
+
+// the last solved systems, several pipes commit the same parameters
+typedef struct dt_iop_colorchecker_cache_t
+{
+  uint64_t hash;
+  uint64_t used;
+  dt_iop_colorchecker_params_t params;
+  dt_iop_colorchecker_data_t data;
+} dt_iop_colorchecker_cache_t;
+
 typedef struct dt_iop_colorchecker_global_data_t
 {
   int kernel_colorchecker;
+  dt_pthread_mutex_t lock; // protects the cache
+  uint64_t clock;
+  dt_iop_colorchecker_cache_t cache[COLORCHECKER_CACHE_ENTRIES];
 } dt_iop_colorchecker_global_data_t;
 
 
@@ -493,16 +511,26 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       out[2] += data->coeff_b[data->num_patches+1] * in[0] +
                 data->coeff_b[data->num_patches+2] * in[1] +
                 data->coeff_b[data->num_patches+3] * in[2];
-#if defined(_OPENMP) && defined(OPENMP_SIMD_) // <== nice try, i don't think this does anything here
-#pragma omp SIMD()
+      // rbf from thin plate spline, on the patches by channel so that the patches vectorise
+      const float Lin = in[0], ain = in[1], bin = in[2];
+      float L = 0.0f, a = 0.0f, b = 0.0f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:L, a, b)
 #endif
       for(int k=0;k<data->num_patches;k++)
-      { // rbf from thin plate spline
-        const float phi = kernel(in, data->source_Lab + 3*k);
-        out[0] += data->coeff_L[k] * phi;
-        out[1] += data->coeff_a[k] * phi;
-        out[2] += data->coeff_b[k] * phi;
+      {
+        const float dL = Lin - data->patch_L[k];
+        const float da = ain - data->patch_a[k];
+        const float db = bin - data->patch_b[k];
+        const float r2 = dL * dL + da * da + db * db;
+        const float phi = r2 * fastlog(MAX(1e-8f, r2));
+        L += data->coeff_L[k] * phi;
+        a += data->coeff_a[k] * phi;
+        b += data->coeff_b[k] * phi;
       }
+      out[0] += L;
+      out[1] += a;
+      out[2] += b;
     }
   }
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -621,19 +649,64 @@ error:
 #endif
 
 
+static uint64_t _params_hash(const dt_iop_colorchecker_params_t *p);
+static void _solve(const dt_iop_colorchecker_params_t *p, dt_iop_colorchecker_data_t *d);
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_colorchecker_params_t *p = (dt_iop_colorchecker_params_t *)p1;
   dt_iop_colorchecker_data_t *d = (dt_iop_colorchecker_data_t *)piece->data;
+  dt_iop_colorchecker_global_data_t *gd = (dt_iop_colorchecker_global_data_t *)self->global_data;
+
+  // solving the system is the expensive part, see if one of the pipes did that already
+  const uint64_t hash = _params_hash(p);
+  dt_pthread_mutex_lock(&gd->lock);
+  for(int k = 0; k < COLORCHECKER_CACHE_ENTRIES; k++)
+  {
+    dt_iop_colorchecker_cache_t *e = &gd->cache[k];
+    if(e->used && e->hash == hash && !memcmp(&e->params, p, sizeof(*p)))
+    {
+      e->used = ++gd->clock;
+      *d = e->data;
+      dt_pthread_mutex_unlock(&gd->lock);
+      return;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  _solve(p, d);
+
+  dt_pthread_mutex_lock(&gd->lock);
+  int lru = 0;
+  for(int k = 1; k < COLORCHECKER_CACHE_ENTRIES; k++)
+    if(gd->cache[k].used < gd->cache[lru].used) lru = k;
+  gd->cache[lru].hash = hash;
+  gd->cache[lru].used = ++gd->clock;
+  gd->cache[lru].params = *p;
+  gd->cache[lru].data = *d;
+  dt_pthread_mutex_unlock(&gd->lock);
+}
 
+static uint64_t _params_hash(const dt_iop_colorchecker_params_t *p)
+{
+  // fnv-1a over the parameter bytes
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char *c = (const unsigned char *)p;
+  for(size_t k = 0; k < sizeof(*p); k++) hash = (hash ^ c[k]) * 1099511628211ull;
+  return hash;
+}
+
+// fits the thin plate spline through the patches
+static void _solve(const dt_iop_colorchecker_params_t *p, dt_iop_colorchecker_data_t *d)
+{
   d->num_patches = MIN(MAX_PATCHES, p->num_patches);
   const int N = d->num_patches, N4 = N + 4;
   for(int k = 0; k < N; k++)
   {
-    d->source_Lab[3*k+0] = p->source_L[k];
-    d->source_Lab[3*k+1] = p->source_a[k];
-    d->source_Lab[3*k+2] = p->source_b[k];
+    d->source_Lab[3*k+0] = d->patch_L[k] = p->source_L[k];
+    d->source_Lab[3*k+1] = d->patch_a[k] = p->source_a[k];
+    d->source_Lab[3*k+2] = d->patch_b[k] = p->source_b[k];
   }
 
   // initialize coefficients with default values that will be
@@ -929,8 +1002,9 @@ void cleanup(dt_iop_module_t *module)
 void init_global(dt_iop_module_so_t *module)
 {
   dt_iop_colorchecker_global_data_t *gd
-      = (dt_iop_colorchecker_global_data_t *)malloc(sizeof(dt_iop_colorchecker_global_data_t));
+      = (dt_iop_colorchecker_global_data_t *)calloc(1, sizeof(dt_iop_colorchecker_global_data_t));
   module->data = gd;
+  dt_pthread_mutex_init(&gd->lock, NULL);
 
   const int program = 8; // extended.cl, from programs.conf
   gd->kernel_colorchecker = dt_opencl_create_kernel(program, "colorchecker");
@@ -940,6 +1014,7 @@ void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_colorchecker_global_data_t *gd = (dt_iop_colorchecker_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_colorchecker);
+  dt_pthread_mutex_destroy(&gd->lock);
   free(module->data);
   module->data = NULL;
 }
@@ -137,6 +137,20 @@ void connect_key_accels(dt_iop_module_t *self)
                               GTK_WIDGET(g->b_scale));
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *const buf,
+                    const size_t npixels)
+{
+  const dt_iop_colorcontrast_params_t *const d = (dt_iop_colorcontrast_params_t *)piece->data;
+  const float lo = d->unbound ? -INFINITY : -128.0f;
+  const float hi = d->unbound ? INFINITY : 128.0f;
+
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    buf[k + 1] = CLAMP((buf[k + 1] * d->a_steepness) + d->a_offset, lo, hi);
+    buf[k + 2] = CLAMP((buf[k + 2] * d->b_steepness) + d->b_offset, lo, hi);
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
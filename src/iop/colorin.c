@@ -648,6 +648,7 @@ static inline void apply_blue_mapping(const float *const in, float *const out)
   }
 }
 
+__DT_CLONE_TARGETS__
 static void process_cmatrix_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                                const dt_iop_roi_t *const roi_out)
@@ -730,6 +731,7 @@ static void process_cmatrix_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
   }
 }
 
+__DT_CLONE_TARGETS__
 static void process_cmatrix_fastpath_simple(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                             const void *const ivoid, void *const ovoid,
                                             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -764,6 +766,7 @@ static void process_cmatrix_fastpath_simple(struct dt_iop_module_t *self, dt_dev
   }
 }
 
+__DT_CLONE_TARGETS__
 static void process_cmatrix_fastpath_clipping(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                               const void *const ivoid, void *const ovoid,
                                               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -830,6 +833,7 @@ static void process_cmatrix_fastpath(struct dt_iop_module_t *self, dt_dev_pixelp
   }
 }
 
+__DT_CLONE_TARGETS__
 static void process_cmatrix_proper(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                    const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                                    const dt_iop_roi_t *const roi_out)
@@ -1058,6 +1062,16 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+#if defined(__SSE__) && defined(DT_HAVE_CLONE_TARGETS)
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // the matrix code paths of process() are built with __DT_CLONE_TARGETS__, on this cpu they
+  // resolve to their avx2 (or avx512f) clones, which beat the hand written sse2 version
+  process(self, piece, ivoid, ovoid, roi_in, roi_out);
+}
+#endif
+
 #if defined(__SSE2__)
 static void process_sse2_cmatrix_bm(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                     const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
@@ -343,6 +343,7 @@ error:
 }
 #endif
 
+__DT_CLONE_TARGETS__
 static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                               const void *const ivoid, void *const ovoid,
                                               const dt_iop_roi_t *const roi_in,
@@ -396,44 +397,54 @@ static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self, dt_d
   }
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+__DT_CLONE_TARGETS__
+static void process_fastpath_matrix(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                    const dt_iop_roi_t *const roi_out)
 {
   const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
   const int ch = piece->colors;
-  const int gamutcheck = (d->mode == DT_PROFILE_GAMUTCHECK);
 
-  if(d->type == DT_COLORSPACE_LAB)
-  {
-    memcpy(ovoid, ivoid, sizeof(float)*4*roi_out->width*roi_out->height);
-  }
-  else if(!isnan(d->cmatrix[0]))
-  {
 // fprintf(stderr,"Using cmatrix codepath\n");
 // convert to rgb using matrix
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(d, ch, ivoid, ovoid, roi_out) \
-    schedule(static)
+  dt_omp_firstprivate(d, ch, ivoid, ovoid, roi_out) \
+  schedule(static)
 #endif
-    for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
-    {
-      const float *const in = (const float *const)ivoid + (size_t)k;
-      float *out = (float *)ovoid + (size_t)k;
+  for(size_t k = 0; k < (size_t)ch * roi_out->width * roi_out->height; k += ch)
+  {
+    const float *const in = (const float *const)ivoid + (size_t)k;
+    float *out = (float *)ovoid + (size_t)k;
 
-      float xyz[3];
-      dt_Lab_to_XYZ(in, xyz);
+    float xyz[3];
+    dt_Lab_to_XYZ(in, xyz);
 
-      for(int c = 0; c < 3; c++)
+    for(int c = 0; c < 3; c++)
+    {
+      out[c] = 0.0f;
+      for(int i = 0; i < 3; i++)
       {
-        out[c] = 0.0f;
-        for(int i = 0; i < 3; i++)
-        {
-          out[c] += d->cmatrix[3 * c + i] * xyz[i];
-        }
+        out[c] += d->cmatrix[3 * c + i] * xyz[i];
       }
     }
+  }
+}
 
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_colorout_data_t *const d = (dt_iop_colorout_data_t *)piece->data;
+  const int ch = piece->colors;
+  const int gamutcheck = (d->mode == DT_PROFILE_GAMUTCHECK);
+
+  if(d->type == DT_COLORSPACE_LAB)
+  {
+    memcpy(ovoid, ivoid, sizeof(float)*4*roi_out->width*roi_out->height);
+  }
+  else if(!isnan(d->cmatrix[0]))
+  {
+    process_fastpath_matrix(self, piece, ivoid, ovoid, roi_in, roi_out);
     process_fastpath_apply_tonecurves(self, piece, ivoid, ovoid, roi_in, roi_out);
   }
   else
@@ -472,6 +483,16 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+#if defined(__SSE__) && defined(DT_HAVE_CLONE_TARGETS)
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // the matrix code path of process() is built with __DT_CLONE_TARGETS__, on this cpu it resolves
+  // to its avx2 (or avx512f) clone
+  process(self, piece, ivoid, ovoid, roi_in, roi_out);
+}
+#endif
+
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -112,6 +112,9 @@ typedef struct dt_iop_colorreconstruct_data_t
   float range;
   float hue;
   dt_iop_colorreconstruct_precedence_t precedence;
+  // blurred grid of the last run of this pipe and what it was made of, see grid_hash()
+  dt_iop_colorreconstruct_bilateral_frozen_t *grid;
+  uint64_t grid_hash;
 } dt_iop_colorreconstruct_data_t;
 
 typedef struct dt_iop_colorreconstruct_global_data_t
@@ -222,6 +225,28 @@ static inline float hue_conversion(const float HSL_Hue)
 }
 
 
+// the blurred grid only depends on the module input and the parameters of the splat. if the pipe runs
+// again with the same of both, e.g. for a change of the blend parameters, we can go straight to slicing.
+// returns 0 if the grid should not be kept.
+static uint64_t grid_hash(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in)
+{
+  const dt_iop_colorreconstruct_data_t *d = (dt_iop_colorreconstruct_data_t *)piece->data;
+
+  // export pipes only run once, and tiles of one run never see the same input twice
+  if(!self->dev->gui_attached || piece->pipe->tiling) return 0;
+
+  uint64_t hash = dt_dev_hash_plus(self->dev, piece->pipe, self->iop_order, DT_DEV_TRANSFORM_DIR_BACK_EXCL);
+  if(!hash) return 0;
+
+  const int ikey[6] = { piece->pipe->image.id, roi_in->x, roi_in->y, roi_in->width, roi_in->height, d->precedence };
+  const float fkey[6] = { roi_in->scale, piece->iscale, d->threshold, d->spatial, d->range, d->hue };
+  const char *str = (const char *)ikey;
+  for(size_t k = 0; k < sizeof(ikey); k++) hash = ((hash << 5) + hash) ^ str[k];
+  str = (const char *)fkey;
+  for(size_t k = 0; k < sizeof(fkey); k++) hash = ((hash << 5) + hash) ^ str[k];
+  return hash;
+}
+
 static inline void image_to_grid(const dt_iop_colorreconstruct_bilateral_t *const b, const float i, const float j, const float L, float *x,
                           float *y, float *z)
 {
@@ -642,15 +667,27 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     }
   }
 
+  const uint64_t hash = can ? 0 : grid_hash(self, piece, roi_in);
+
   if(can)
   {
     b = dt_iop_colorreconstruct_bilateral_thaw(can);
   }
+  else if(hash && hash == data->grid_hash)
+  {
+    b = dt_iop_colorreconstruct_bilateral_thaw(data->grid);
+  }
   else
   {
     b = dt_iop_colorreconstruct_bilateral_init(roi_in, piece->iscale, sigma_s, sigma_r);
     dt_iop_colorreconstruct_bilateral_splat(b, in, data->threshold, data->precedence, params);
     dt_iop_colorreconstruct_bilateral_blur(b);
+    if(hash)
+    {
+      dt_iop_colorreconstruct_bilateral_dump(data->grid);
+      data->grid = dt_iop_colorreconstruct_bilateral_freeze(b);
+      data->grid_hash = data->grid ? hash : 0;
+    }
   }
 
   if(!b) goto error;
@@ -1095,11 +1132,18 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     }
   }
 
+  const uint64_t hash = can ? 0 : grid_hash(self, piece, roi_in);
+
   if(can)
   {
     b = dt_iop_colorreconstruct_bilateral_thaw_cl(can, piece->pipe->devid, gd);
     if(!b) goto error;
   }
+  else if(hash && hash == d->grid_hash)
+  {
+    b = dt_iop_colorreconstruct_bilateral_thaw_cl(d->grid, piece->pipe->devid, gd);
+    if(!b) goto error;
+  }
   else
   {
     b = dt_iop_colorreconstruct_bilateral_init_cl(piece->pipe->devid, gd, roi_in, piece->iscale, sigma_s, sigma_r);
@@ -1108,6 +1152,12 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     if(err != CL_SUCCESS) goto error;
     err = dt_iop_colorreconstruct_bilateral_blur_cl(b);
     if(err != CL_SUCCESS) goto error;
+    if(hash)
+    {
+      dt_iop_colorreconstruct_bilateral_dump(d->grid);
+      d->grid = dt_iop_colorreconstruct_bilateral_freeze_cl(b);
+      d->grid_hash = d->grid ? hash : 0;
+    }
   }
 
   err = dt_iop_colorreconstruct_bilateral_slice_cl(b, dev_in, dev_out, d->threshold, roi_in, piece->iscale);
@@ -1277,6 +1327,8 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_colorreconstruct_data_t *d = (dt_iop_colorreconstruct_data_t *)piece->data;
+  dt_iop_colorreconstruct_bilateral_dump(d->grid);
   free(piece->data);
   piece->data = NULL;
 }
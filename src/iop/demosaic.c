@@ -568,6 +568,7 @@ static inline const short * hexmap(const int row, const int col, short (*const a
 /*
    Frank Markesteijn's algorithm for Fuji X-Trans sensors
  */
+__DT_CLONE_TARGETS__
 static void xtrans_markesteijn_interpolate(float *out, const float *const in,
                                            const dt_iop_roi_t *const roi_out,
                                            const dt_iop_roi_t *const roi_in,
@@ -971,16 +972,25 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
       memset(homo, 0, (size_t)ndir * TS * TS * sizeof(uint8_t));
       const int pad_homo = (passes == 1) ? 10 : 15;
       for(int row = pad_homo; row < mrow - pad_homo; row++)
+      {
+        // threshold for the whole row first, so that the counting below runs along
+        // contiguous columns of one direction and vectorises
+        float tr[TS];
         for(int col = pad_homo; col < mcol - pad_homo; col++)
         {
-          float tr = FLT_MAX;
-          for(int d = 0; d < ndir; d++)
-            if(tr > drv[d][row][col]) tr = drv[d][row][col];
-          tr *= 8;
-          for(int d = 0; d < ndir; d++)
-            for(int v = -1; v <= 1; v++)
-              for(int h = -1; h <= 1; h++) homo[d][row][col] += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
+          float t = FLT_MAX;
+          for(int d = 0; d < ndir; d++) t = fminf(t, drv[d][row][col]);
+          tr[col] = 8 * t;
         }
+        for(int d = 0; d < ndir; d++)
+          for(int v = -1; v <= 1; v++)
+          {
+            const float *const dv = drv[d][row + v];
+            uint8_t *const hm = homo[d][row];
+            for(int col = pad_homo; col < mcol - pad_homo; col++)
+              hm[col] += (dv[col - 1] <= tr[col]) + (dv[col] <= tr[col]) + (dv[col + 1] <= tr[col]);
+          }
+      }
 
       /* Build 5x5 sum of homogeneity maps for each pixel & direction */
       for(int d = 0; d < ndir; d++)
@@ -2815,7 +2825,17 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
       }
       break;
     case DT_DEV_PIXELPIPE_EXPORT:
-      flags |= DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
+      // fast exports go down to the output size right in demosaic, like thumbnails, see below
+      if(dt_conf_get_bool("plugins/lighttable/export/fast_demosaic") && (roi_out->scale <= .99999f))
+        flags |= DEMOSAIC_MEDIUM_QUAL;
+      else
+        flags |= DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
+      break;
+    case DT_DEV_PIXELPIPE_PREVIEW:
+      // navigation and histogram don't need more than PPG (or the half-size superpixels below
+      // when zoomed out by half or more), unless full quality is requested for darkroom
+      if ((get_quality() < 2) && (roi_out->scale <= .99999f))
+        flags |= DEMOSAIC_MEDIUM_QUAL;
       break;
     case DT_DEV_PIXELPIPE_THUMBNAIL:
       // we check if we need ultra-high quality thumbnail for this size
@@ -2823,6 +2843,8 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
       {
         flags |= DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
       }
+      else if (roi_out->scale <= .99999f)
+        flags |= DEMOSAIC_MEDIUM_QUAL;
       break;
     default: // make C not complain about missing enum members
       break;
@@ -2879,7 +2901,23 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
      (demosaicing_method != DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME)) // do not touch this special method
     demosaicing_method = (piece->pipe->dsc.filters != 9u) ? DT_IOP_DEMOSAIC_PPG : DT_IOP_DEMOSAIC_MARKESTEIJN;
 
-  const float *const pixels = (float *)i;
+  // a mosaic kept as uint16 by the raw stage (see pixelpipe_raw_uint16) is widened here, once
+  float *expanded = NULL;
+  if(piece->dsc_in.datatype == TYPE_UINT16)
+  {
+    const size_t npixels = (size_t)roi_in->width * roi_in->height;
+    expanded = (float *)dt_alloc_align(64, npixels * sizeof(float));
+    if(!expanded) return;
+    const uint16_t *const in16 = (const uint16_t *const)i;
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) \
+    dt_omp_firstprivate(expanded, in16, npixels) \
+    schedule(static)
+#endif
+    for(size_t k = 0; k < npixels; k++) expanded[k] = dt_raw_uint16_to_float(in16[k]);
+  }
+
+  const float *const pixels = expanded ? expanded : (float *)i;
 
   if(qual_flags & DEMOSAIC_FULL_SCALE)
   {
@@ -2978,6 +3016,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
                                                 piece->pipe->dsc.filters);
   }
   if(data->color_smoothing) color_smoothing(o, roi_out, data->color_smoothing);
+  dt_free_align(expanded);
 }
 
 #ifdef HAVE_OPENCL
@@ -4913,6 +4952,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev
   // green-equilibrate over full image excludes tiling
   if(d->green_eq == DT_IOP_GREEN_EQ_FULL || d->green_eq == DT_IOP_GREEN_EQ_BOTH) piece->process_tiling_ready = 0;
 
+  // process() widens a uint16 mosaic before demosaicing it
+  piece->process_uint16_ready = 1;
+
   if (self->dev->image_storage.flags & DT_IMAGE_4BAYER)
   {
     // 4Bayer images not implemented in OpenCL yet
@@ -285,6 +285,7 @@ typedef struct dt_iop_denoiseprofile_global_data_t
   int kernel_denoiseprofile_backtransform_Y0U0V0;
   int kernel_denoiseprofile_decompose;
   int kernel_denoiseprofile_synthesize;
+  int kernel_denoiseprofile_synthesize_backtransform;
   int kernel_denoiseprofile_reduce_first;
   int kernel_denoiseprofile_reduce_second;
 } dt_iop_denoiseprofile_global_data_t;
@@ -718,6 +719,23 @@ static inline void precondition(const float *const in, float *const buf, const i
   }
 }
 
+static inline void backtransform_px(float *const px, const float a[3], const float sigma2_plus_1_8[3])
+{
+  for(int c = 0; c < 3; c++)
+  {
+    const float x = px[c], x2 = x * x;
+    // closed form approximation to unbiased inverse (input range was 0..200 for fit, not 0..1)
+    if(x < .5f)
+      px[c] = 0.0f;
+    else
+      px[c] = 1.f / 4.f * x2 + 1.f / 4.f * sqrtf(3.f / 2.f) / x - 11.f / 8.f / x2
+              + 5.f / 8.f * sqrtf(3.f / 2.f) / (x * x2) - sigma2_plus_1_8[c];
+    // asymptotic form:
+    // px[c] = fmaxf(0.0f, 1./4.*x*x - 1./8. - sigma2[c]);
+    px[c] *= a[c];
+  }
+}
+
 static inline void backtransform(float *const buf, const int wd, const int ht, const float a[3],
                                  const float b[3])
 {
@@ -737,19 +755,7 @@ static inline void backtransform(float *const buf, const int wd, const int ht, c
     float *buf2 = buf + (size_t)4 * j * wd;
     for(int i = 0; i < wd; i++)
     {
-      for(int c = 0; c < 3; c++)
-      {
-        const float x = buf2[c], x2 = x * x;
-        // closed form approximation to unbiased inverse (input range was 0..200 for fit, not 0..1)
-        if(x < .5f)
-          buf2[c] = 0.0f;
-        else
-          buf2[c] = 1.f / 4.f * x2 + 1.f / 4.f * sqrtf(3.f / 2.f) / x - 11.f / 8.f / x2
-                    + 5.f / 8.f * sqrtf(3.f / 2.f) / (x * x2) - sigma2_plus_1_8[c];
-        // asymptotic form:
-        // buf2[c] = fmaxf(0.0f, 1./4.*x*x - 1./8. - sigma2[c]);
-        buf2[c] *= a[c];
-      }
+      backtransform_px(buf2, a, sigma2_plus_1_8);
       buf2 += 4;
     }
   }
@@ -861,6 +867,20 @@ static inline void precondition_v2(const float *const in, float *const buf, cons
 // control the bias:
 // we replace the 2 * p * constant / (2 - p) part of delta by user
 // defined bias controller.
+static inline void backtransform_v2_px(float *const px, const float a, const float p[3], const float b,
+                                       const float bias, const float wb[3])
+{
+  for(int c = 0; c < 3; c++)
+  {
+    const float x = MAX(px[c], 0.0f);
+    const float delta = x * x + bias;
+    const float denominator = 4.0f / (sqrt(a) * (2.0f - p[c]));
+    const float z1 = (x + sqrt(MAX(delta, 0.0f))) / denominator;
+    px[c] = powf(z1, 1.0f / (1.0f - p[c] / 2.0f)) - b;
+    px[c] *= wb[c];
+  }
+}
+
 static inline void backtransform_v2(float *const buf, const int wd, const int ht, const float a, const float p[3],
                                     const float b, const float bias, const float wb[3])
 {
@@ -874,15 +894,7 @@ static inline void backtransform_v2(float *const buf, const int wd, const int ht
     float *buf2 = buf + (size_t)4 * j * wd;
     for(int i = 0; i < wd; i++)
     {
-      for(int c = 0; c < 3; c++)
-      {
-        const float x = MAX(buf2[c], 0.0f);
-        const float delta = x * x + bias;
-        const float denominator = 4.0f / (sqrt(a) * (2.0f - p[c]));
-        const float z1 = (x + sqrt(MAX(delta, 0.0f))) / denominator;
-        buf2[c] = powf(z1, 1.0f / (1.0f - p[c] / 2.0f)) - b;
-        buf2[c] *= wb[c];
-      }
+      backtransform_v2_px(buf2, a, p, b, bias, wb);
       buf2 += 4;
     }
   }
@@ -921,6 +933,28 @@ static inline void precondition_Y0U0V0(const float *const in, float *const buf,
   }
 }
 
+static inline void backtransform_Y0U0V0_px(float *const px, const float a, const float p[3], const float b,
+                                           const float bias, const float wb[3], const float toRGB[9])
+{
+  float rgb[3];
+  for(int c = 0; c < 3; c++)
+  {
+    rgb[c] = 0.0f;
+    for(int k = 0; k < 3; k++)
+    {
+      rgb[c] += toRGB[3 * c + k] * px[k];
+    }
+  }
+  for(int c = 0; c < 3; c++)
+  {
+    const float x = MAX(rgb[c], 0.0f);
+    const float delta = x * x + bias * wb[c];
+    const float denominator = 4.0f / (sqrt(a) * (2.0f - p[c]));
+    const float z1 = (x + sqrt(MAX(delta, 0.0f))) / denominator;
+    px[c] = powf(z1, 1.0f / (1.0f - p[c] / 2.0f)) - b;
+  }
+}
+
 static inline void backtransform_Y0U0V0(float *const buf, const int wd, const int ht, const float a, const float p[3],
                                     const float b, const float bias, const float wb[3], const float toRGB[9])
 {
@@ -934,29 +968,39 @@ static inline void backtransform_Y0U0V0(float *const buf, const int wd, const in
     float *buf2 = buf + (size_t)4 * j * wd;
     for(int i = 0; i < wd; i++)
     {
-      float rgb[3];
-      for(int c = 0; c < 3; c++)
-      {
-        rgb[c] = 0.0f;
-        for(int k = 0; k < 3; k++)
-        {
-          rgb[c] += toRGB[3 * c + k] * buf2[k];
-        }
-      }
-      for(int c = 0; c < 3; c++)
-      {
-        const float x = MAX(rgb[c], 0.0f);
-        const float delta = x * x + bias * wb[c];
-        const float denominator = 4.0f / (sqrt(a) * (2.0f - p[c]));
-        const float z1 = (x + sqrt(MAX(delta, 0.0f))) / denominator;
-        buf2[c] = powf(z1, 1.0f / (1.0f - p[c] / 2.0f)) - b;
-      }
+      backtransform_Y0U0V0_px(buf2, a, p, b, bias, wb, toRGB);
       buf2 += 4;
     }
   }
 }
 
 
+// the inverse variance stabilizing transform of the wavelets mode, applied by the last synthesis step
+typedef enum dt_iop_denoiseprofile_vst_t
+{
+  DT_DENOISE_VST_ANSCOMBE = 0,
+  DT_DENOISE_VST_V2 = 1,
+  DT_DENOISE_VST_Y0U0V0 = 2
+} dt_iop_denoiseprofile_vst_t;
+
+typedef struct dt_iop_denoiseprofile_vst_params_t
+{
+  dt_iop_denoiseprofile_vst_t vst;
+  float a[3], sigma2_plus_1_8[3]; // anscombe
+  float a1, p[3], b1, bias, wb[3]; // v2 and Y0U0V0
+  float toRGB[9];                  // Y0U0V0
+} dt_iop_denoiseprofile_vst_params_t;
+
+static inline void backtransform_vst_px(float *const px, const dt_iop_denoiseprofile_vst_params_t *const v)
+{
+  if(v->vst == DT_DENOISE_VST_ANSCOMBE)
+    backtransform_px(px, v->a, v->sigma2_plus_1_8);
+  else if(v->vst == DT_DENOISE_VST_V2)
+    backtransform_v2_px(px, v->a1, v->p, v->b1, v->bias, v->wb);
+  else
+    backtransform_Y0U0V0_px(px, v->a1, v->p, v->b1, v->bias, v->wb, v->toRGB);
+}
+
 // =====================================================================================
 // begin wavelet code:
 // =====================================================================================
@@ -1352,16 +1396,38 @@ static void eaw_decompose_sse(float *const out, const float *const in, float *co
 #undef SUM_PIXEL_EPILOGUE_SSE
 #endif
 
+// if vst is not NULL, the inverse variance stabilizing transform is applied to the output
 typedef void((*eaw_synthesize_t)(float *const out, const float *const in, const float *const detail,
                                  const float *thrsf, const float *boostf, const int32_t width,
-                                 const int32_t height));
+                                 const int32_t height, const dt_iop_denoiseprofile_vst_params_t *const vst));
 
 static void eaw_synthesize(float *const out, const float *const in, const float *const detail,
-                           const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+                           const float *thrsf, const float *boostf, const int32_t width, const int32_t height,
+                           const dt_iop_denoiseprofile_vst_params_t *const vst)
 {
   const float threshold[4] = { thrsf[0], thrsf[1], thrsf[2], thrsf[3] };
   const float boost[4] = { boostf[0], boostf[1], boostf[2], boostf[3] };
 
+  if(vst)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(boost, detail, height, in, out, threshold, vst, width) \
+  schedule(static)
+#endif
+    for(size_t k = 0; k < (size_t)4 * width * height; k += 4)
+    {
+      for(size_t c = 0; c < 4; c++)
+      {
+        const float absamt = MAX(0.0f, (fabsf(detail[k + c]) - threshold[c]));
+        const float amount = copysignf(absamt, detail[k + c]);
+        out[k + c] = in[k + c] + (boost[c] * amount);
+      }
+      backtransform_vst_px(out + k, vst);
+    }
+    return;
+  }
+
 #ifdef _OPENMP
 #pragma omp parallel for SIMD() default(none) \
   dt_omp_firstprivate(boost, detail, height, in, out, threshold, width) \
@@ -1382,14 +1448,14 @@ static void eaw_synthesize(float *const out, const float *const in, const float
 #if defined(__SSE2__)
 static void eaw_synthesize_sse2(float *const out, const float *const in, const float *const detail,
                                 const float *thrsf, const float *boostf, const int32_t width,
-                                const int32_t height)
+                                const int32_t height, const dt_iop_denoiseprofile_vst_params_t *const vst)
 {
   const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
   const __m128 boost = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(boost, detail, height, in, out, threshold, width) \
+  dt_omp_firstprivate(boost, detail, height, in, out, threshold, vst, width) \
   schedule(static)
 #endif
   for(int j = 0; j < height; j++)
@@ -1406,7 +1472,16 @@ static void eaw_synthesize_sse2(float *const out, const float *const in, const f
       const __m128 absamt
           = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
       const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
+      const __m128 sum = _mm_add_ps(*pin, _mm_mul_ps(boost, amount));
+      if(vst)
+      {
+        float DT_ALIGNED_PIXEL px[4];
+        _mm_store_ps(px, sum);
+        backtransform_vst_px(px, vst);
+        _mm_stream_ps(pout, _mm_load_ps(px));
+      }
+      else
+        _mm_stream_ps(pout, sum);
 #endif
       // _mm_stream_ps(pout, _mm_add_ps(*pin, *pdetail));
       pdetail++;
@@ -1546,8 +1621,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   float *tmp = NULL;
   float *buf1 = NULL, *buf2 = NULL;
   for(int k = 0; k < max_scale; k++)
-    buf[k] = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
-  tmp = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
+    buf[k] = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)4 * sizeof(float) * npixels);
+  tmp = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)4 * sizeof(float) * npixels);
 
   const float wb_mean = (piece->pipe->dsc.temperature.coeffs[0] + piece->pipe->dsc.temperature.coeffs[1]
                          + piece->pipe->dsc.temperature.coeffs[2])
@@ -1629,8 +1704,35 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   buf1 = (float *)ovoid;
   buf2 = tmp;
 
+  // the inverse transform is done by the last synthesis step
+  dt_iop_denoiseprofile_vst_params_t vst = { 0 };
+  if(!d->use_new_vst)
+  {
+    vst.vst = DT_DENOISE_VST_ANSCOMBE;
+    for(int c = 0; c < 3; c++)
+    {
+      vst.a[c] = aa[c];
+      vst.sigma2_plus_1_8[c] = (bb[c] / aa[c]) * (bb[c] / aa[c]) + 1.f / 8.f;
+    }
+  }
+  else
+  {
+    vst.vst = (d->wavelet_color_mode == MODE_RGB) ? DT_DENOISE_VST_V2 : DT_DENOISE_VST_Y0U0V0;
+    vst.a1 = d->a[1] * compensate_p;
+    vst.b1 = d->b[1];
+    vst.bias = d->bias - 0.5 * logf(in_scale);
+    for(int c = 0; c < 3; c++)
+    {
+      vst.p[c] = p[c];
+      vst.wb[c] = wb[c];
+    }
+    for(int k = 0; k < 9; k++) vst.toRGB[k] = toRGB[k];
+  }
+  gboolean vst_done = FALSE;
+
   for(int scale = 0; scale < max_scale; scale++)
   {
+    if(dt_iop_process_cancelled(piece)) goto cancelled;
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
@@ -1663,6 +1765,7 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   // now do everything backwards, so the result will end up in *ovoid
   for(int scale = max_scale - 1; scale >= 0; scale--)
   {
+    if(dt_iop_process_cancelled(piece)) goto cancelled;
 #if 1
     // variance stabilizing transform maps sigma to unity.
     const float sigma = 1.0f;
@@ -1734,7 +1837,11 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 #endif
     const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
     // const float thrs[4] = { 0.0, 0.0, 0.0, 0.0 };
-    synthesize(buf2, buf1, buf[scale], thrs, boost, width, height);
+    // the decomposition and synthesis steps alternate between ovoid and tmp for an even number of
+    // steps, so the last synthesis writes ovoid
+    const gboolean last = (scale == 0 && buf2 == (float *)ovoid);
+    synthesize(buf2, buf1, buf[scale], thrs, boost, width, height, last ? &vst : NULL);
+    vst_done |= last;
     // DEBUG: clean out temporary memory:
     // memset(buf1, 0, sizeof(float)*4*width*height);
 
@@ -1743,7 +1850,11 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     buf1 = buf3;
   }
 
-  if(!d->use_new_vst)
+  if(vst_done)
+  {
+    // already applied by the last synthesis step
+  }
+  else if(!d->use_new_vst)
   {
     backtransform((float *)ovoid, width, height, aa, bb);
   }
@@ -1756,10 +1867,16 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     backtransform_Y0U0V0((float *)ovoid, width, height, d->a[1] * compensate_p, p, d->b[1], d->bias - 0.5 * logf(in_scale), wb, toRGB);
   }
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
-  dt_free_align(tmp);
+  for(int k = 0; k < max_scale; k++) dt_dev_pixelpipe_scratch_free(piece, buf[k]);
+  dt_dev_pixelpipe_scratch_free(piece, tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
+  return;
+
+cancelled:
+  // the pipe discards this output anyway
+  for(int k = 0; k < max_scale; k++) dt_dev_pixelpipe_scratch_free(piece, buf[k]);
+  dt_dev_pixelpipe_scratch_free(piece, tmp);
 
 #undef MAX_MAX_SCALE
 }
@@ -1815,10 +1932,10 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
+  float *Sa = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
-  float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  float *in = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb_mean = (piece->pipe->dsc.temperature.coeffs[0] + piece->pipe->dsc.temperature.coeffs[1]
                          + piece->pipe->dsc.temperature.coeffs[2])
@@ -1867,6 +1984,13 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   // for each shift vector
   for(int kj_index = -K; kj_index <= K; kj_index++)
   {
+    // every row of shift vectors is a full pass over the image, give up early if the result is not wanted any more
+    if(dt_iop_process_cancelled(piece))
+    {
+      dt_dev_pixelpipe_scratch_free(piece, Sa);
+      dt_dev_pixelpipe_scratch_free(piece, in);
+      return;
+    }
     for(int ki_index = -K; ki_index <= K; ki_index++)
     {
       // This formula is made for:
@@ -1998,8 +2122,8 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   }
 
   // free shared tmp memory:
-  dt_free_align(Sa);
-  dt_free_align(in);
+  dt_dev_pixelpipe_scratch_free(piece, Sa);
+  dt_dev_pixelpipe_scratch_free(piece, in);
   if(!d->use_new_vst)
   {
     backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
@@ -2055,10 +2179,10 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
+  float *Sa = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
-  float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  float *in = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb_mean = (piece->pipe->dsc.temperature.coeffs[0] + piece->pipe->dsc.temperature.coeffs[1]
                          + piece->pipe->dsc.temperature.coeffs[2])
@@ -2108,6 +2232,13 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
   // for each shift vector
   for(int kj_index = -K; kj_index <= K; kj_index++)
   {
+    // every row of shift vectors is a full pass over the image, give up early if the result is not wanted any more
+    if(dt_iop_process_cancelled(piece))
+    {
+      dt_dev_pixelpipe_scratch_free(piece, Sa);
+      dt_dev_pixelpipe_scratch_free(piece, in);
+      return;
+    }
     for(int ki_index = -K; ki_index <= K; ki_index++)
     {
       // This formula is made for:
@@ -2287,8 +2418,8 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
     }
   }
   // free shared tmp memory:
-  dt_free_align(Sa);
-  dt_free_align(in);
+  dt_dev_pixelpipe_scratch_free(piece, Sa);
+  dt_dev_pixelpipe_scratch_free(piece, in);
   if(!d->use_new_vst)
   {
     backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
@@ -2787,6 +2918,7 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
   const size_t npixels = (size_t)width * height;
 
   cl_mem dev_tmp = NULL;
+  cl_mem dev_toRGB = NULL;
   cl_mem dev_buf1 = NULL;
   cl_mem dev_buf2 = NULL;
   cl_mem dev_m = NULL;
@@ -2969,6 +3101,11 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
     }
   }
 
+  // the last synthesis step may do the inverse transform, which needs the matrix back to rgb
+  dev_toRGB = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 9, toRGB);
+  if(dev_toRGB == NULL) goto error;
+  gboolean vst_done = FALSE;
+
   dev_buf1 = dev_out;
   dev_buf2 = dev_tmp;
 
@@ -3120,6 +3257,34 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
 
     const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
 
+    // the decomposition and synthesis steps alternate between dev_out and dev_tmp for an even number
+    // of steps, so the last synthesis writes dev_out and can do the inverse transform on the way
+    if(s == 0 && dev_buf2 == dev_out)
+    {
+      const int vst = !d->use_new_vst ? 0 : (d->wavelet_color_mode == MODE_RGB) ? 1 : 2;
+      const float bias = d->bias - 0.5 * logf(scale);
+      const int k = gd->kernel_denoiseprofile_synthesize_backtransform;
+      dt_opencl_set_kernel_arg(devid, k, 0, sizeof(cl_mem), (void *)&dev_buf1);
+      dt_opencl_set_kernel_arg(devid, k, 1, sizeof(cl_mem), (void *)&dev_detail[s]);
+      dt_opencl_set_kernel_arg(devid, k, 2, sizeof(cl_mem), (void *)&dev_out);
+      dt_opencl_set_kernel_arg(devid, k, 3, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, k, 4, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, k, 5, 4 * sizeof(float), (void *)&thrs);
+      dt_opencl_set_kernel_arg(devid, k, 6, 4 * sizeof(float), (void *)&boost);
+      dt_opencl_set_kernel_arg(devid, k, 7, sizeof(int), (void *)&vst);
+      dt_opencl_set_kernel_arg(devid, k, 8, 4 * sizeof(float), (void *)&aa);
+      dt_opencl_set_kernel_arg(devid, k, 9, 4 * sizeof(float), (void *)&p);
+      dt_opencl_set_kernel_arg(devid, k, 10, 4 * sizeof(float), (void *)&bb);
+      dt_opencl_set_kernel_arg(devid, k, 11, 4 * sizeof(float), (void *)&sigma2);
+      dt_opencl_set_kernel_arg(devid, k, 12, sizeof(float), (void *)&bias);
+      dt_opencl_set_kernel_arg(devid, k, 13, 4 * sizeof(float), (void *)&wb);
+      dt_opencl_set_kernel_arg(devid, k, 14, sizeof(cl_mem), (void *)&dev_toRGB);
+      err = dt_opencl_enqueue_kernel_2d(devid, k, sizes);
+      if(err != CL_SUCCESS) goto error;
+      vst_done = TRUE;
+      break;
+    }
+
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize, 0, sizeof(cl_mem),
                              (void *)&dev_buf1);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize, 1, sizeof(cl_mem),
@@ -3153,7 +3318,7 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
 
   // copy output of last run of synthesize kernel to dev_tmp (if not already there)
   // note: we need to take swap of buffers into account, so current output lies in dev_buf1
-  if(dev_buf1 != dev_tmp)
+  if(!vst_done && dev_buf1 != dev_tmp)
   {
     size_t origin[] = { 0, 0, 0 };
     size_t region[] = { width, height, 1 };
@@ -3161,7 +3326,11 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
     if(err != CL_SUCCESS) goto error;
   }
 
-  if(!d->use_new_vst)
+  if(vst_done)
+  {
+    // the last synthesis step already wrote dev_out
+  }
+  else if(!d->use_new_vst)
   {
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform, 0, sizeof(cl_mem), (void *)&dev_tmp);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform, 1, sizeof(cl_mem), (void *)&dev_out);
@@ -3189,30 +3358,19 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
   }
   else
   {
-    cl_mem dev_RGB = NULL;
-    dev_RGB = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 9, toRGB);
-    if(dev_RGB != NULL)
-    {
-      const float bias = d->bias - 0.5 * logf(scale);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 0, sizeof(cl_mem), (void *)&dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 1, sizeof(cl_mem), (void *)&dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 2, sizeof(int), (void *)&width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 3, sizeof(int), (void *)&height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 4, 4 * sizeof(float), (void *)&aa);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 5, 4 * sizeof(float), (void *)&p);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 6, 4 * sizeof(float), (void *)&bb);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 7, sizeof(float), (void *)&bias);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 8, 4 * sizeof(float), (void *)&wb);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 9, sizeof(cl_mem), (void *)&dev_RGB);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, sizes);
-      dt_opencl_release_mem_object(dev_RGB);
-      if(err != CL_SUCCESS) goto error;
-    }
-    else
-    {
-      dt_opencl_release_mem_object(dev_RGB);
-      goto error;
-    }
+    const float bias = d->bias - 0.5 * logf(scale);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 0, sizeof(cl_mem), (void *)&dev_tmp);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 4, 4 * sizeof(float), (void *)&aa);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 5, 4 * sizeof(float), (void *)&p);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 6, 4 * sizeof(float), (void *)&bb);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 7, sizeof(float), (void *)&bias);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 8, 4 * sizeof(float), (void *)&wb);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, 9, sizeof(cl_mem), (void *)&dev_toRGB);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_denoiseprofile_backtransform_Y0U0V0, sizes);
+    if(err != CL_SUCCESS) goto error;
   }
 
   if(!darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
@@ -3222,6 +3380,7 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
   dt_opencl_release_mem_object(dev_r);
   dt_opencl_release_mem_object(dev_m);
   dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_toRGB);
   dt_opencl_release_mem_object(dev_filter);
   for(int k = 0; k < max_scale; k++)
     dt_opencl_release_mem_object(dev_detail[k]);
@@ -3233,6 +3392,7 @@ error:
   dt_opencl_release_mem_object(dev_r);
   dt_opencl_release_mem_object(dev_m);
   dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_toRGB);
   dt_opencl_release_mem_object(dev_filter);
   for(int k = 0; k < max_scale; k++)
     dt_opencl_release_mem_object(dev_detail[k]);
@@ -3439,6 +3599,8 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_denoiseprofile_backtransform_Y0U0V0 = dt_opencl_create_kernel(program, "denoiseprofile_backtransform_Y0U0V0");
   gd->kernel_denoiseprofile_decompose = dt_opencl_create_kernel(program, "denoiseprofile_decompose");
   gd->kernel_denoiseprofile_synthesize = dt_opencl_create_kernel(program, "denoiseprofile_synthesize");
+  gd->kernel_denoiseprofile_synthesize_backtransform
+      = dt_opencl_create_kernel(program, "denoiseprofile_synthesize_backtransform");
   gd->kernel_denoiseprofile_reduce_first = dt_opencl_create_kernel(program, "denoiseprofile_reduce_first");
   gd->kernel_denoiseprofile_reduce_second = dt_opencl_create_kernel(program, "denoiseprofile_reduce_second");
 }
@@ -3459,6 +3621,7 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_denoiseprofile_backtransform_v2);
   dt_opencl_free_kernel(gd->kernel_denoiseprofile_decompose);
   dt_opencl_free_kernel(gd->kernel_denoiseprofile_synthesize);
+  dt_opencl_free_kernel(gd->kernel_denoiseprofile_synthesize_backtransform);
   dt_opencl_free_kernel(gd->kernel_denoiseprofile_reduce_first);
   dt_opencl_free_kernel(gd->kernel_denoiseprofile_reduce_second);
   free(module->data);
@@ -3467,29 +3630,7 @@ void cleanup_global(dt_iop_module_so_t *module)
 
 static dt_noiseprofile_t dt_iop_denoiseprofile_get_auto_profile(dt_iop_module_t *self)
 {
-  GList *profiles = dt_noiseprofile_get_matching(&self->dev->image_storage);
-  dt_noiseprofile_t interpolated = dt_noiseprofile_generic; // default to generic poissonian
-
-  const int iso = self->dev->image_storage.exif_iso;
-  dt_noiseprofile_t *last = NULL;
-  for(GList *iter = profiles; iter; iter = g_list_next(iter))
-  {
-    dt_noiseprofile_t *current = (dt_noiseprofile_t *)iter->data;
-    if(current->iso == iso)
-    {
-      interpolated = *current;
-      break;
-    }
-    if(last && last->iso < iso && current->iso > iso)
-    {
-      interpolated.iso = iso;
-      dt_noiseprofile_interpolate(last, current, &interpolated);
-      break;
-    }
-    last = current;
-  }
-  g_list_free_full(profiles, dt_noiseprofile_free);
-  return interpolated;
+  return dt_noiseprofile_get_interpolated(&self->dev->image_storage);
 }
 
 /** commit is the synch point between core and gui, so it copies params to pipe data. */
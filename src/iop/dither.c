@@ -233,6 +233,55 @@ static inline void _diffuse_error_sse(float *val, const __m128 err, const float
 }
 #endif
 
+// floyd-steinberg takes the error of the row above from up to one column ahead and pushes its own to the
+// row below from one column back. rows can run in parallel, one thread each, as long as every row stays
+// DITHER_FS_LAG columns behind the row above. that keeps all accesses and the order of the error additions
+// of the serial scan, so the result doesn't change. done[j] counts the finished columns of row j.
+#define DITHER_FS_LAG 3
+#define DITHER_FS_BLOCK 64
+
+static inline void _fs_wait(const int *const done, const int j, const int end, const int width)
+{
+  if(j == 0) return;
+  const int need = MIN(end + DITHER_FS_LAG - 1, width);
+  while(g_atomic_int_get(done + j - 1) < need) g_thread_yield();
+}
+
+// the pixels [i0, i1) of one row
+static void _fs_pixels(float *const out, const int width, const int ch, const int i0, const int i1,
+                       const int last_row, _find_nearest_color *nearest_color, const float f, const float rf)
+{
+  float err[4];
+  for(int i = i0; i < i1; i++)
+  {
+    float *const px = out + ch * i;
+    nearest_color(px, err, f, rf);
+    if(i < width - 1) _diffuse_error(px + ch, err, 7.0f / 16.0f);
+    if(last_row) continue;
+    if(i > 0) _diffuse_error(px - ch + ch * width, err, 3.0f / 16.0f);
+    _diffuse_error(px + ch * width, err, 5.0f / 16.0f);
+    if(i < width - 1) _diffuse_error(px + ch + ch * width, err, 1.0f / 16.0f);
+  }
+}
+
+#if defined(__SSE2__)
+static void _fs_pixels_sse2(float *const out, const int width, const int ch, const int i0, const int i1,
+                            const int last_row, _find_nearest_color_sse *nearest_color, const float f,
+                            const float rf)
+{
+  for(int i = i0; i < i1; i++)
+  {
+    float *const px = out + ch * i;
+    const __m128 err = nearest_color(px, f, rf);
+    if(i < width - 1) _diffuse_error_sse(px + ch, err, 7.0f / 16.0f);
+    if(last_row) continue;
+    if(i > 0) _diffuse_error_sse(px - ch + ch * width, err, 3.0f / 16.0f);
+    _diffuse_error_sse(px + ch * width, err, 5.0f / 16.0f);
+    if(i < width - 1) _diffuse_error_sse(px + ch + ch * width, err, 1.0f / 16.0f);
+  }
+}
+#endif
+
 static inline float clipnan(const float x)
 {
   float r;
@@ -357,55 +406,34 @@ static void process_floyd_steinberg(struct dt_iop_module_t *self, dt_dev_pixelpi
     return;
   }
 
-  // floyd-steinberg dithering follows here
+  // floyd-steinberg dithering follows here, in a wavefront over the rows
+  int *const done = calloc(height, sizeof(int));
 
-  // first height-1 rows
-  for(int j = 0; j < height - 1; j++)
+#ifdef _OPENMP
+#pragma omp parallel default(none) \
+  dt_omp_firstprivate(ch, done, f, height, nearest_color, ovoid, rf, width)
+#endif
   {
-    float *out = ((float *)ovoid) + (size_t)ch * j * width;
-
-    // first column
-    nearest_color(out, err, f, rf);
-    _diffuse_error(out + ch, err, 7.0f / 16.0f);
-    _diffuse_error(out + ch * width, err, 5.0f / 16.0f);
-    _diffuse_error(out + ch * (width + 1), err, 1.0f / 16.0f);
-
-
-    // main part of image
-    for(int i = 1; i < width - 1; i++)
+#ifdef _OPENMP
+    const int nthreads = omp_get_num_threads();
+#else
+    const int nthreads = 1;
+#endif
+    // each thread takes its rows in order, so the row above is always finished or in progress
+    for(int j = dt_get_thread_num(); j < height; j += nthreads)
     {
-      nearest_color(out + ch * i, err, f, rf);
-      _diffuse_error(out + ch * (i + 1), err, 7.0f / 16.0f);
-      _diffuse_error(out + ch * (i - 1) + ch * width, err, 3.0f / 16.0f);
-      _diffuse_error(out + ch * i + ch * width, err, 5.0f / 16.0f);
-      _diffuse_error(out + ch * (i + 1) + ch * width, err, 1.0f / 16.0f);
+      float *out = ((float *)ovoid) + (size_t)ch * j * width;
+      for(int i = 0; i < width; i += DITHER_FS_BLOCK)
+      {
+        const int end = MIN(i + DITHER_FS_BLOCK, width);
+        _fs_wait(done, j, end, width);
+        _fs_pixels(out, width, ch, i, end, j == height - 1, nearest_color, f, rf);
+        g_atomic_int_set(done + j, end);
+      }
     }
-
-    // last column
-    nearest_color(out + ch * (width - 1), err, f, rf);
-    _diffuse_error(out + ch * (width - 2) + ch * width, err, 3.0f / 16.0f);
-    _diffuse_error(out + ch * (width - 1) + ch * width, err, 5.0f / 16.0f);
   }
 
-  // last row
-  {
-    float *out = ((float *)ovoid) + (size_t)ch * (height - 1) * width;
-
-    // lower left pixel
-    nearest_color(out, err, f, rf);
-    _diffuse_error(out + ch, err, 7.0f / 16.0f);
-
-    // main part of last row
-    for(int i = 1; i < width - 1; i++)
-    {
-      nearest_color(out + ch * i, err, f, rf);
-      _diffuse_error(out + ch * (i + 1), err, 7.0f / 16.0f);
-    }
-
-    // lower right pixel
-    nearest_color(out + ch * (width - 1), err, f, rf);
-
-  }
+  free(done);
 
   // copy alpha channel if needed
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -509,7 +537,6 @@ static void process_floyd_steinberg_sse2(struct dt_iop_module_t *self, dt_dev_pi
 
   const float f = levels - 1;
   const float rf = 1.0 / f;
-  __m128 err;
 
   // dither without error diffusion on very tiny images
   if(width < 3 || height < 3)
@@ -524,55 +551,34 @@ static void process_floyd_steinberg_sse2(struct dt_iop_module_t *self, dt_dev_pi
     return;
   }
 
-  // floyd-steinberg dithering follows here
+  // floyd-steinberg dithering follows here, in a wavefront over the rows
+  int *const done = calloc(height, sizeof(int));
 
-  // first height-1 rows
-  for(int j = 0; j < height - 1; j++)
+#ifdef _OPENMP
+#pragma omp parallel default(none) \
+  dt_omp_firstprivate(ch, done, f, height, nearest_color, ovoid, rf, width)
+#endif
   {
-    float *out = ((float *)ovoid) + (size_t)ch * j * width;
-
-    // first column
-    err = nearest_color(out, f, rf);
-    _diffuse_error_sse(out + ch, err, 7.0f / 16.0f);
-    _diffuse_error_sse(out + ch * width, err, 5.0f / 16.0f);
-    _diffuse_error_sse(out + ch * (width + 1), err, 1.0f / 16.0f);
-
-
-    // main part of image
-    for(int i = 1; i < width - 1; i++)
+#ifdef _OPENMP
+    const int nthreads = omp_get_num_threads();
+#else
+    const int nthreads = 1;
+#endif
+    // each thread takes its rows in order, so the row above is always finished or in progress
+    for(int j = dt_get_thread_num(); j < height; j += nthreads)
     {
-      err = nearest_color(out + ch * i, f, rf);
-      _diffuse_error_sse(out + ch * (i + 1), err, 7.0f / 16.0f);
-      _diffuse_error_sse(out + ch * (i - 1) + ch * width, err, 3.0f / 16.0f);
-      _diffuse_error_sse(out + ch * i + ch * width, err, 5.0f / 16.0f);
-      _diffuse_error_sse(out + ch * (i + 1) + ch * width, err, 1.0f / 16.0f);
+      float *out = ((float *)ovoid) + (size_t)ch * j * width;
+      for(int i = 0; i < width; i += DITHER_FS_BLOCK)
+      {
+        const int end = MIN(i + DITHER_FS_BLOCK, width);
+        _fs_wait(done, j, end, width);
+        _fs_pixels_sse2(out, width, ch, i, end, j == height - 1, nearest_color, f, rf);
+        g_atomic_int_set(done + j, end);
+      }
     }
-
-    // last column
-    err = nearest_color(out + ch * (width - 1), f, rf);
-    _diffuse_error_sse(out + ch * (width - 2) + ch * width, err, 3.0f / 16.0f);
-    _diffuse_error_sse(out + ch * (width - 1) + ch * width, err, 5.0f / 16.0f);
   }
 
-  // last row
-  {
-    float *out = ((float *)ovoid) + (size_t)ch * (height - 1) * width;
-
-    // lower left pixel
-    err = nearest_color(out, f, rf);
-    _diffuse_error_sse(out + ch, err, 7.0f / 16.0f);
-
-    // main part of last row
-    for(int i = 1; i < width - 1; i++)
-    {
-      err = nearest_color(out + ch * i, f, rf);
-      _diffuse_error_sse(out + ch * (i + 1), err, 7.0f / 16.0f);
-    }
-
-    // lower right pixel
-    (void)nearest_color(out + ch * (width - 1), f, rf);
-
-  }
+  free(done);
 
   // copy alpha channel if needed
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -616,12 +622,13 @@ static void process_random(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   const int ch = piece->colors;
 
   const float dither = powf(2.0f, data->random.damping / 10.0f);
+  const int x0 = roi_in->x, y0 = roi_in->y;
 
-  unsigned int *const tea_states = calloc(2 * dt_get_num_threads(), sizeof(unsigned int));
-
+  // the noise of each pixel comes from its position in the image alone, not from a random state carried
+  // along the row. pixels are independent that way and the result doesn't depend on the number of threads.
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ch, dither, height, ivoid, ovoid, tea_states, width) \
+  dt_omp_firstprivate(ch, dither, height, ivoid, ovoid, width, x0, y0) \
   schedule(static)
 #endif
   for(int j = 0; j < height; j++)
@@ -629,21 +636,21 @@ static void process_random(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
     const size_t k = (size_t)ch * width * j;
     const float *in = (const float *)ivoid + k;
     float *out = (float *)ovoid + k;
-    unsigned int *tea_state = tea_states + 2 * dt_get_thread_num();
-    tea_state[0] = j * height + dt_get_thread_num();
-    for(int i = 0; i < width; i++, in += ch, out += ch)
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(int i = 0; i < width; i++)
     {
+      unsigned int tea_state[2] = { x0 + i, y0 + j };
       encrypt_tea(tea_state);
-      float dith = dither * tpdf(tea_state[0]);
+      const float dith = dither * tpdf(tea_state[0]);
 
-      out[0] = CLIP(in[0] + dith);
-      out[1] = CLIP(in[1] + dith);
-      out[2] = CLIP(in[2] + dith);
+      out[ch * i + 0] = CLIP(in[ch * i + 0] + dith);
+      out[ch * i + 1] = CLIP(in[ch * i + 1] + dith);
+      out[ch * i + 2] = CLIP(in[ch * i + 2] + dith);
     }
   }
 
-  free(tea_states);
-
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
 }
 
@@ -154,6 +154,10 @@ typedef struct dt_iop_filmicrgb_gui_data_t
   struct dt_iop_filmic_rgb_spline_t spline DT_ALIGNED_ARRAY;
 } dt_iop_filmicrgb_gui_data_t;
 
+// entries of the tables over the log encoded value in [0; 1], see commit_params()
+#define FILMIC_CURVE_LUT_SIZE 4096
+#define FILMIC_DESATURATION_LUT_SIZE 2048
+
 typedef struct dt_iop_filmicrgb_data_t
 {
   float max_grad;
@@ -166,6 +170,10 @@ typedef struct dt_iop_filmicrgb_data_t
   float sigma_toe, sigma_shoulder;
   int preserve_color;
   struct dt_iop_filmic_rgb_spline_t spline DT_ALIGNED_ARRAY;
+  // the curve with the display transfer function and the desaturation, tabulated if baked
+  int baked;
+  float curve_lut[FILMIC_CURVE_LUT_SIZE + 1];
+  float desaturation_lut[FILMIC_DESATURATION_LUT_SIZE + 1];
 } dt_iop_filmicrgb_data_t;
 
 
@@ -423,6 +431,45 @@ static inline float linear_saturation(const float x, const float luminance, cons
 }
 
 
+#ifdef _OPENMP
+#pragma omp declare simd uniform(lut, size)
+#endif
+static inline float lut_interpolate(const float *const lut, const int size, const float x)
+{
+  // x is in [0; 1]
+  const float f = x * size;
+  const int i = MIN((int)f, size - 1);
+  const float t = f - i;
+  return lut[i] + t * (lut[i + 1] - lut[i]);
+}
+
+
+// the S curve followed by the transfer function of the display
+#ifdef _OPENMP
+#pragma omp declare simd uniform(data, spline)
+#endif
+static inline float filmic_curve(const float x, const dt_iop_filmicrgb_data_t *const data,
+                                 const dt_iop_filmic_rgb_spline_t *const spline)
+{
+  // desaturation can push values out of the table, those are rare enough to be computed
+  if(data->baked && x >= 0.0f && x <= 1.0f) return lut_interpolate(data->curve_lut, FILMIC_CURVE_LUT_SIZE, x);
+  return powf(clamp_simd(filmic_spline(x, spline->M1, spline->M2, spline->M3, spline->M4, spline->M5,
+                                       spline->latitude_min, spline->latitude_max)),
+              data->output_power);
+}
+
+
+#ifdef _OPENMP
+#pragma omp declare simd uniform(data)
+#endif
+static inline float filmic_desaturation(const float x, const dt_iop_filmicrgb_data_t *const data)
+{
+  if(data->baked && x >= 0.0f && x <= 1.0f)
+    return lut_interpolate(data->desaturation_lut, FILMIC_DESATURATION_LUT_SIZE, x);
+  return filmic_desaturate(x, data->sigma_toe, data->sigma_shoulder, data->saturation);
+}
+
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const restrict ivoid, void *const restrict ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -472,13 +519,13 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
                                                                            work_profile->lutsize,
                                                                            work_profile->nonlinearlut)
                                         : dt_camera_rgb_luminance(temp);
-      const float desaturation = filmic_desaturate(lum, data->sigma_toe, data->sigma_shoulder, data->saturation);
+      const float desaturation = filmic_desaturation(lum, data);
 
       // Desaturate on the non-linear parts of the curve
       // Filmic S curve on the max RGB
       // Apply the transfer function of the display
       for(int c = 0; c < 3; c++)
-        pix_out[c] = powf(clamp_simd(filmic_spline(linear_saturation(temp[c], lum, desaturation), spline.M1, spline.M2, spline.M3, spline.M4, spline.M5, spline.latitude_min, spline.latitude_max)), data->output_power);
+        pix_out[c] = filmic_curve(linear_saturation(temp[c], lum, desaturation), data, &spline);
 
     }
   }
@@ -510,7 +557,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
       norm = log_tonemapping(norm, data->grey_source, data->black_source, data->dynamic_range);
 
       // Get the desaturation value based on the log value
-      const float desaturation = filmic_desaturate(norm, data->sigma_toe, data->sigma_shoulder, data->saturation);
+      const float desaturation = filmic_desaturation(norm, data);
 
       for(int c = 0; c < 3; c++) ratios[c] *= norm;
 
@@ -527,7 +574,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
       // Filmic S curve on the max RGB
       // Apply the transfer function of the display
-      norm = powf(clamp_simd(filmic_spline(norm, spline.M1, spline.M2, spline.M3, spline.M4, spline.M5, spline.latitude_min, spline.latitude_max)), data->output_power);
+      norm = filmic_curve(norm, data, &spline);
 
       // Re-apply ratios
       for(int c = 0; c < 3; c++) pix_out[c] = ratios[c] * norm;
@@ -1153,6 +1200,26 @@ void commit_params(dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_
   d->saturation = (2.0f * p->saturation / 100.0f + 1.0f);
   d->sigma_toe = powf(d->spline.latitude_min / 3.0f, 2.0f);
   d->sigma_shoulder = powf((1.0f - d->spline.latitude_max) / 3.0f, 2.0f);
+
+  // the log encoded values are in [0; 1], tabulate what process() computes from them. the opencl kernels
+  // keep evaluating the curve, transcendentals are cheap there.
+  d->baked = dt_conf_get_bool("plugins/darkroom/filmicrgb/baked_curve");
+  if(d->baked)
+  {
+    const dt_iop_filmic_rgb_spline_t *const spline = &d->spline;
+    for(int k = 0; k <= FILMIC_CURVE_LUT_SIZE; k++)
+    {
+      const float x = (float)k / FILMIC_CURVE_LUT_SIZE;
+      d->curve_lut[k] = powf(clamp_simd(filmic_spline(x, spline->M1, spline->M2, spline->M3, spline->M4,
+                                                      spline->M5, spline->latitude_min, spline->latitude_max)),
+                             d->output_power);
+    }
+    for(int k = 0; k <= FILMIC_DESATURATION_LUT_SIZE; k++)
+    {
+      const float x = (float)k / FILMIC_DESATURATION_LUT_SIZE;
+      d->desaturation_lut[k] = filmic_desaturate(x, d->sigma_toe, d->sigma_shoulder, d->saturation);
+    }
+  }
 }
 
 void init_pipe(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -58,6 +58,15 @@ int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   return iop_cs_rgb;
 }
 
+void output_format(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                   dt_iop_buffer_dsc_t *dsc)
+{
+  default_output_format(self, pipe, piece, dsc);
+
+  // 8 bit BGRA for the display, so the cache line and the backbuf are no larger than that
+  dsc->datatype = TYPE_UINT8;
+}
+
 static inline float Hue_2_RGB(float v1, float v2, float vH)
 {
   if(vH < 0.0f) vH += 1.0f;
@@ -24,6 +24,7 @@
 #include <string.h>
 
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -47,6 +48,11 @@
 #define GRAIN_LUT_DELTA_MIN 0.0001
 #define GRAIN_LUT_PAPER_GAMMA 1.0
 
+// samples of the rank-1 lattice which filters the noise when zoomed out
+#define GRAIN_LATTICE 21
+// the simplex noise repeats with this period in x and y, as its lattice wraps after 256 cells
+#define GRAIN_NOISE_PERIOD 1536.0
+
 #define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
 DT_MODULE_INTROSPECTION(2, dt_iop_grain_params_t)
 
@@ -83,6 +89,11 @@ typedef struct dt_iop_grain_data_t
   float grain_lut[GRAIN_LUT_SIZE * GRAIN_LUT_SIZE];
 } dt_iop_grain_data_t;
 
+typedef struct dt_iop_grain_global_data_t
+{
+  int kernel_grain;
+} dt_iop_grain_global_data_t;
+
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params,
                   const int new_version)
@@ -139,21 +150,45 @@ static int permutation[]
         222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156, 180 };
 
 static int perm[512];
+// perm[] % 12, the gradient index of a lattice point without the division
+static int perm12[512];
 static void _simplex_noise_init()
 {
-  for(int i = 0; i < 512; i++) perm[i] = permutation[i & 255];
+  for(int i = 0; i < 512; i++)
+  {
+    perm[i] = permutation[i & 255];
+    perm12[i] = perm[i] % 12;
+  }
 }
-static double dot(int g[], double x, double y, double z)
+
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline double dot(const int g[], double x, double y, double z)
 {
   return g[0] * x + g[1] * y + g[2] * z;
 }
 
 #define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
 
+// the contribution of one corner of the simplex
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline double _simplex_corner(const int gi, const double x, const double y, const double z)
+{
+  double t = fmax(0.6 - x * x - y * y - z * z, 0.0);
+  t *= t;
+  return t * t * dot(grad3[gi], x, y, z);
+}
+
+// without branches, so that whole rows of it can be vectorised
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
 static double _simplex_noise(double xin, double yin, double zin)
 {
-  double n0, n1, n2, n3; // Noise contributions from the four corners
-                         // Skew the input space to determine which simplex cell we're in
+  // Skew the input space to determine which simplex cell we're in
   const double F3 = 1.0 / 3.0;
   const double s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
   const int i = FASTFLOOR(xin + s);
@@ -168,69 +203,15 @@ static double _simplex_noise(double xin, double yin, double zin)
   const double y0 = yin - Y0;
   const double z0 = zin - Z0;
   // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
-  // Determine which simplex we are in.
-  int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
-  int i2, j2, k2; // Offsets for third corner of simplex in (i,j,k) coords
-  if(x0 >= y0)
-  {
-    if(y0 >= z0)
-    {
-      i1 = 1; // X Y Z order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
-    }
-    else if(x0 >= z0)
-    {
-      i1 = 1; // X Z Y order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
-    }
-    else
-    {
-      i1 = 0; // Z X Y order
-      j1 = 0;
-      k1 = 1;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
-    }
-  }
-  else // x0<y0
-  {
-    if(y0 < z0)
-    {
-      i1 = 0; // Z Y X order
-      j1 = 0;
-      k1 = 1;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
-    }
-    else if(x0 < z0)
-    {
-      i1 = 0; // Y Z X order
-      j1 = 1;
-      k1 = 0;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
-    }
-    else
-    {
-      i1 = 0; // Y X Z order
-      j1 = 1;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
-    }
-  }
+  // Determine which simplex we are in, from the order of x0, y0 and z0:
+  // X Y Z, X Z Y, Z X Y, Z Y X, Y Z X or Y X Z, with ties broken as the usual if cascade does.
+  const int xy = x0 >= y0, yz = y0 >= z0, xz = x0 >= z0;
+  const int i1 = xy & (yz | xz); // Offsets for second corner of simplex in (i,j,k) coords
+  const int j1 = !xy & yz;
+  const int k1 = !yz & !(xy & xz);
+  const int i2 = xy | (yz & xz); // Offsets for third corner of simplex in (i,j,k) coords
+  const int j2 = !xy | yz;
+  const int k2 = !yz | (!xy & !xz);
   //  A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
   //  a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
   //  a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
@@ -248,46 +229,14 @@ static double _simplex_noise(double xin, double yin, double zin)
   const int ii = i & 255;
   const int jj = j & 255;
   const int kk = k & 255;
-  const int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
-  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
-  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
-  const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
-  // Calculate the contribution from the four corners
-  double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
-  if(t0 < 0)
-    n0 = 0.0;
-  else
-  {
-    t0 *= t0;
-    n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-  }
-  double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
-  if(t1 < 0)
-    n1 = 0.0;
-  else
-  {
-    t1 *= t1;
-    n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-  }
-  double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
-  if(t2 < 0)
-    n2 = 0.0;
-  else
-  {
-    t2 *= t2;
-    n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
-  }
-  double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
-  if(t3 < 0)
-    n3 = 0.0;
-  else
-  {
-    t3 *= t3;
-    n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
-  }
+  const int gi0 = perm12[ii + perm[jj + perm[kk]]];
+  const int gi1 = perm12[ii + i1 + perm[jj + j1 + perm[kk + k1]]];
+  const int gi2 = perm12[ii + i2 + perm[jj + j2 + perm[kk + k2]]];
+  const int gi3 = perm12[ii + 1 + perm[jj + 1 + perm[kk + 1]]];
   // Add contributions from each corner to get the final noise value.
   // The result is scaled to stay just inside [-1,1]
-  return 32.0 * (n0 + n1 + n2 + n3);
+  return 32.0 * (_simplex_corner(gi0, x0, y0, z0) + _simplex_corner(gi1, x1, y1, z1)
+                 + _simplex_corner(gi2, x2, y2, z2) + _simplex_corner(gi3, x3, y3, z3));
 }
 
 #define PRIME_LEVELS 4
@@ -346,17 +295,20 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
+// parametrization of octaves to match power spectrum of real grain scans
+static const double _simplex_octave_f[] = {0.4910, 0.9441, 1.7280};
+static const double _simplex_octave_a[] = {0.2340, 0.7850, 1.2150};
+
+#ifdef _OPENMP
+#pragma omp declare simd uniform(octaves, persistance, z)
+#endif
 static double _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
 {
   double total = 0;
 
-  // parametrization of octaves to match power spectrum of real grain scans
-  static double f[] = {0.4910, 0.9441, 1.7280};
-  static double a[] = {0.2340, 0.7850, 1.2150};
-
   for(uint32_t o = 0; o < octaves; o++)
   {
-    total += (_simplex_noise(x * f[o] / z, y * f[o] / z, o) * a[o]);
+    total += (_simplex_noise(x * _simplex_octave_f[o] / z, y * _simplex_octave_f[o] / z, o) * _simplex_octave_a[o]);
   }
   return total;
 }
@@ -459,41 +411,86 @@ static unsigned int _hash_string(char *s)
   return h;
 }
 
+// the noise of the grain at world position (x, y), normalized to the shorter side of the image. the
+// parameters of all pixels come from a _grain_noise_t, set up once per process() call.
+typedef struct _grain_noise_t
+{
+  double zoom;
+  double hash;
+  int filter;
+  // rank-1 lattice of the footprint of one output pixel, if zoomed out
+  float dx[GRAIN_LATTICE], dy[GRAIN_LATTICE];
+} _grain_noise_t;
+
+static void _grain_noise_setup(_grain_noise_t *n, const dt_iop_grain_data_t *const data,
+                               dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_out)
+{
+  // double zoom=1.0+(8*(data->scale/100.0));
+  const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
+  n->zoom = (1.0 + 8 * data->scale / 100) / 800.0;
+  n->hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  n->filter = fabsf(roi_out->scale - 1.0f) > 0.01;
+  // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to
+  // pixelpipe iscale)
+  const double filtermul = piece->iscale / (roi_out->scale * wd);
+  const float fib1 = 34.0, fib2 = GRAIN_LATTICE;
+  const float fib1div2 = fib1 / fib2;
+  for(int l = 0; l < GRAIN_LATTICE; l++)
+  {
+    float px = l / fib2, py = l * fib1div2;
+    py -= (int)py;
+    n->dx[l] = px * filtermul;
+    n->dy[l] = py * filtermul;
+  }
+}
+
+#ifdef _OPENMP
+#pragma omp declare simd uniform(n)
+#endif
+static inline double _grain_noise(const _grain_noise_t *const n, const double x, const double y)
+{
+  const double octaves = 3;
+  //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
+  if(!n->filter) return _simplex_2d_noise(x + n->hash, y, octaves, 1.0, n->zoom);
+
+  // if zoomed out a lot, use rank-1 lattice downsampling
+  double noise = 0.0;
+  for(int l = 0; l < GRAIN_LATTICE; l++)
+    noise += (1.0 / GRAIN_LATTICE) * _simplex_2d_noise(x + n->dx[l] + n->hash, y + n->dy[l], octaves, 1.0, n->zoom);
+  return noise;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
 
-  unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  _grain_noise_t noise;
+  _grain_noise_setup(&noise, data, piece, roi_out);
 
   const int ch = piece->colors;
   // Apply grain to image
   const double strength = (data->strength / 100.0);
-  const double octaves = 3;
-  // double zoom=1.0+(8*(data->scale/100.0));
   const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
-  const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
-  const int filter = fabsf(roi_out->scale - 1.0f) > 0.01;
-  // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to
-  // pixelpipe iscale)
-  const double filtermul = piece->iscale / (roi_out->scale * wd);
-  const float fib1 = 34.0, fib2 = 21.0;
-  const float fib1div2 = fib1 / fib2;
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ch, filter, filtermul, ivoid, ovoid, roi_out, strength, \
-                      wd, zoom, octaves, fib2, fib1div2) \
-  shared(data, hash)
+  dt_omp_firstprivate(ch, ivoid, ovoid, roi_out, strength, wd) \
+  shared(data, noise)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
-    float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
+    const float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
     float *out = ((float *)ovoid) + (size_t)roi_out->width * j * ch;
     const double wy = (roi_out->y + j) / roi_out->scale;
     const double y = wy / wd;
     // y: normalized to shorter side of image, so with pixel aspect = 1.
 
+    // the noise of the whole row first, in the output's L channel. without the lut lookups in between
+    // this loop vectorises.
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < roi_out->width; i++)
     {
       // calculate x, y in a resolution independent way:
@@ -501,25 +498,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       const double wx = (roi_out->x + i) / roi_out->scale;
       // x: normalized to shorter side of image, so with pixel aspect = 1.
       const double x = wx / wd;
-      //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
-      double noise = 0.0;
-      if(filter)
-      {
-        // if zoomed out a lot, use rank-1 lattice downsampling
-        for(int l = 0; l < fib2; l++)
-        {
-          float px = l / fib2, py = l * fib1div2;
-          py -= (int)py;
-          float dx = px * filtermul, dy = py * filtermul;
-          noise += (1.0 / fib2) * _simplex_2d_noise(x + dx + hash, y + dy, octaves, 1.0, zoom);
-        }
-      }
-      else
-      {
-        noise = _simplex_2d_noise(x + hash, y, octaves, 1.0, zoom);
-      }
-
-      out[0] = in[0] + dt_lut_lookup_2d_1c(data->grain_lut, (noise * strength) * GRAIN_LIGHTNESS_STRENGTH_SCALE, in[0] / 100.0f);
+      out[(size_t)ch * i] = _grain_noise(&noise, x, y);
+    }
+
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      const float n = out[0];
+      out[0] = in[0] + dt_lut_lookup_2d_1c(data->grain_lut, (n * strength) * GRAIN_LIGHTNESS_STRENGTH_SCALE, in[0] / 100.0f);
       out[1] = in[1];
       out[2] = in[2];
       out[3] = in[3];
@@ -530,6 +515,83 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)self->global_data;
+
+  cl_int err = -999;
+  cl_mem dev_perm = NULL;
+  cl_mem dev_lut = NULL;
+  cl_mem dev_lattice = NULL;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  _grain_noise_t noise;
+  _grain_noise_setup(&noise, data, piece, roi_out);
+  const float strength = data->strength / 100.0f * GRAIN_LIGHTNESS_STRENGTH_SCALE;
+
+  // floats can't hold the noise coordinates of large images with the precision the lattice needs. the noise
+  // repeats every GRAIN_NOISE_PERIOD in x and y though, so the origin of each octave is wrapped here in
+  // double and the kernel only adds the offsets of its pixel.
+  const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
+  float origin_x[4] = { 0.0f }, origin_y[4] = { 0.0f }, step[4] = { 0.0f };
+  for(int o = 0; o < 3; o++)
+  {
+    const double f = _simplex_octave_f[o] / noise.zoom;
+    origin_x[o] = fmod((roi_out->x / roi_out->scale / wd + noise.hash) * f, GRAIN_NOISE_PERIOD);
+    origin_y[o] = fmod(roi_out->y / roi_out->scale / wd * f, GRAIN_NOISE_PERIOD);
+    step[o] = f / (roi_out->scale * wd);
+  }
+  float lattice[2 * GRAIN_LATTICE];
+  const int samples = noise.filter ? GRAIN_LATTICE : 1;
+  for(int l = 0; l < samples; l++)
+  {
+    lattice[2 * l] = noise.filter ? noise.dx[l] / noise.zoom : 0.0f;
+    lattice[2 * l + 1] = noise.filter ? noise.dy[l] / noise.zoom : 0.0f;
+  }
+
+  dev_perm = dt_opencl_copy_host_to_device_constant(devid, sizeof(perm), perm);
+  if(dev_perm == NULL) goto error;
+  dev_lut = dt_opencl_copy_host_to_device_constant(devid, sizeof(data->grain_lut), data->grain_lut);
+  if(dev_lut == NULL) goto error;
+  dev_lattice = dt_opencl_copy_host_to_device_constant(devid, sizeof(lattice), lattice);
+  if(dev_lattice == NULL) goto error;
+
+  size_t sizes[3] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 4, 4 * sizeof(float), (void *)origin_x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 5, 4 * sizeof(float), (void *)origin_y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 6, 4 * sizeof(float), (void *)step);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 7, sizeof(cl_mem), (void *)&dev_lattice);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 8, sizeof(int), (void *)&samples);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 9, sizeof(float), (void *)&strength);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 10, sizeof(cl_mem), (void *)&dev_perm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 11, sizeof(cl_mem), (void *)&dev_lut);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_grain, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_lattice);
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_perm);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_lattice);
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_perm);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_grain] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 static void scale_callback(GtkWidget *slider, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
@@ -608,6 +670,22 @@ void init(dt_iop_module_t *module)
   memcpy(module->default_params, &tmp, sizeof(dt_iop_grain_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 35; // grain.cl, from programs.conf
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)malloc(sizeof(dt_iop_grain_global_data_t));
+  module->data = gd;
+  gd->kernel_grain = dt_opencl_create_kernel(program, "grain");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_grain);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
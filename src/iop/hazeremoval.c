@@ -313,13 +313,6 @@ static inline void free_gray_image(gray_image *img_p)
 }
 
 
-// copy 1-component image img1 to img2
-static inline void copy_gray_image(gray_image img1, gray_image img2)
-{
-  memcpy(img2.data, img1.data, sizeof(float) * img1.width * img1.height);
-}
-
-
 // minimum of two integers
 static inline int min_i(int a, int b)
 {
@@ -334,170 +327,144 @@ static inline int max_i(int a, int b)
 }
 
 
-// swap the two floats that the pointers point to
-static inline void pointer_swap_f(float *a, float *b)
+// minimum or maximum of two floats
+static inline float min_max_f(const float a, const float b, const int take_max)
 {
-  float t = *a;
-  *a = *b;
-  *b = t;
+  return take_max ? fmaxf(a, b) : fminf(a, b);
 }
 
 
-// calculate the one-dimensional moving maximum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_max_1d(int N, const float *x, float *y, size_t stride_y, int w)
+// calculate the one-dimensional moving minimum (or maximum) over a window of size 2*w+1 with the van
+// Herk/Gil-Werman algorithm: running extrema from the left (g) and the right (h) within blocks of 2*w+1
+// elements combine to the extremum of any window, independent of w. y may be identical to x.
+static inline void box_min_max_1d(const int N, const float *const x, float *const y, float *const g,
+                                  float *const h, const int w, const int take_max)
 {
-  float m = -(INFINITY);
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++) m = fmaxf(x[i], m);
+  const int k = 2 * w + 1;
+  for(int s = 0; s < N; s += k)
+  {
+    const int e = min_i(s + k, N);
+    g[s] = x[s];
+    for(int i = s + 1; i < e; i++) g[i] = min_max_f(g[i - 1], x[i], take_max);
+    h[e - 1] = x[e - 1];
+    for(int i = e - 2; i >= s; i--) h[i] = min_max_f(h[i + 1], x[i], take_max);
+  }
   for(int i = 0; i < N; i++)
   {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      m = -(INFINITY);
-      for(int j = max_i(i - w + 1, 0), j_end = min_i(i + w + 2, N); j < j_end; j++) m = fmaxf(x[j], m);
-    }
-    if(i + w + 1 < N) m = fmaxf(x[i + w + 1], m);
+    // the window [a, b] spans at most two blocks, when it lies in a single one it starts at the
+    // beginning of the block or ends at the end of the data
+    const int a = max_i(i - w, 0);
+    const int b = min_i(i + w, N - 1);
+    if(a / k != b / k)
+      y[i] = min_max_f(h[a], g[b], take_max);
+    else
+      y[i] = (a % k == 0) ? g[b] : h[a];
   }
 }
 
 
-// calculate the two-dimensional moving maximum over a box of size (2*w+1) x (2*w+1)
+// calculate the two-dimensional moving minimum (or maximum) over a box of size (2*w+1) x (2*w+1)
 // does the calculation in-place if input and output images are identical
-static void box_max(const gray_image img1, const gray_image img2, const int w)
+static void box_min_max(const gray_image img1, const gray_image img2, const int w, const int take_max)
 {
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
+  const int width = img1.width;
+  const int height = img1.height;
+  const int k = 2 * w + 1;
+
+  // horizontally line by line
 #ifdef _OPENMP
 #pragma omp parallel default(none) \
-    dt_omp_firstprivate(img1, img2, w) \
-    private(img2_bak)
+  dt_omp_firstprivate(img1, img2, w, width, height, take_max)
 #endif
-    {
-      img2_bak = new_gray_image(img2.width, 1);
+  {
+    gray_image g = new_gray_image(width, 1);
+    gray_image h = new_gray_image(width, 1);
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(static)
 #endif
-      for(int i1 = 0; i1 < img2.height; i1++)
-      {
-        memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-        box_max_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-      }
-      free_gray_image(&img2_bak);
-    }
+    for(int i1 = 0; i1 < height; i1++)
+      box_min_max_1d(width, img1.data + (size_t)i1 * width, img2.data + (size_t)i1 * width, g.data, h.data, w,
+                     take_max);
+    free_gray_image(&g);
+    free_gray_image(&h);
   }
-  else
+
+  // vertically the same recursions run on whole lines, so the inner loops walk contiguous memory
+  gray_image g = new_gray_image(width, height);
+  gray_image h = new_gray_image(width, height);
+  const int blocks = (height + k - 1) / k;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(img2, g, h, width, height, k, blocks, take_max) \
+  schedule(static)
+#endif
+  for(int block = 0; block < blocks; block++)
   {
+    const int s = block * k;
+    const int e = min_i(s + k, height);
+    memcpy(g.data + (size_t)s * width, img2.data + (size_t)s * width, sizeof(float) * width);
+    for(int i1 = s + 1; i1 < e; i1++)
+    {
+      const float *const x = img2.data + (size_t)i1 * width;
+      const float *const gp = g.data + (size_t)(i1 - 1) * width;
+      float *const gc = g.data + (size_t)i1 * width;
 #ifdef _OPENMP
-#pragma omp parallel default(none) \
-    dt_omp_firstprivate(img1, img2, w) \
-    private(img2_bak)
+#pragma omp simd
 #endif
+      for(int i0 = 0; i0 < width; i0++) gc[i0] = min_max_f(gp[i0], x[i0], take_max);
+    }
+    memcpy(h.data + (size_t)(e - 1) * width, img2.data + (size_t)(e - 1) * width, sizeof(float) * width);
+    for(int i1 = e - 2; i1 >= s; i1--)
     {
+      const float *const x = img2.data + (size_t)i1 * width;
+      const float *const hn = h.data + (size_t)(i1 + 1) * width;
+      float *const hc = h.data + (size_t)i1 * width;
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp simd
 #endif
-      for(int i1 = 0; i1 < img1.height; i1++)
-        box_max_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
+      for(int i0 = 0; i0 < width; i0++) hc[i0] = min_max_f(hn[i0], x[i0], take_max);
     }
   }
+
 #ifdef _OPENMP
-#pragma omp parallel default(none) \
-  dt_omp_firstprivate(img1, img2, w) \
-  private(img2_bak)
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(img2, g, h, w, width, height, k, take_max) \
+  schedule(static)
 #endif
+  for(int i1 = 0; i1 < height; i1++)
   {
-    img2_bak = new_gray_image(1, img2.height);
+    const int a = max_i(i1 - w, 0);
+    const int b = min_i(i1 + w, height - 1);
+    const float *const ha = h.data + (size_t)a * width;
+    const float *const gb = g.data + (size_t)b * width;
+    float *const y = img2.data + (size_t)i1 * width;
+    if(a / k != b / k)
+    {
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp simd
 #endif
-    for(int i0 = 0; i0 < img1.width; i0++)
-    {
-      for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-      box_max_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
+      for(int i0 = 0; i0 < width; i0++) y[i0] = min_max_f(ha[i0], gb[i0], take_max);
     }
-    free_gray_image(&img2_bak);
+    else
+      memcpy(y, (a % k == 0) ? gb : ha, sizeof(float) * width);
   }
+
+  free_gray_image(&g);
+  free_gray_image(&h);
 }
 
 
-// calculate the one-dimensional moving minimum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_min_1d(int N, const float *x, float *y, size_t stride_y, int w)
+// calculate the two-dimensional moving maximum over a box of size (2*w+1) x (2*w+1)
+static inline void box_max(const gray_image img1, const gray_image img2, const int w)
 {
-  float m = INFINITY;
-  for(int i = 0, i_end = min_i(w + 1, N); i < i_end; i++) m = fminf(x[i], m);
-  for(int i = 0; i < N; i++)
-  {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      m = INFINITY;
-      for(int j = max_i(i - w + 1, 0), j_end = min_i(i + w + 2, N); j < j_end; j++) m = fminf(x[j], m);
-    }
-    if(i + w + 1 < N) m = fminf(x[i + w + 1], m);
-  }
+  box_min_max(img1, img2, w, TRUE);
 }
 
 
 // calculate the two-dimensional moving minimum over a box of size (2*w+1) x (2*w+1)
-// does the calculation in-place if input and output images are identical
-static void box_min(const gray_image img1, const gray_image img2, const int w)
+static inline void box_min(const gray_image img1, const gray_image img2, const int w)
 {
-  gray_image img2_bak;
-  if(img1.data == img2.data)
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) \
-    dt_omp_firstprivate(img1, img2, w) \
-    private(img2_bak)
-#endif
-    {
-      img2_bak = new_gray_image(img2.width, 1);
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img2.height; i1++)
-      {
-        memcpy(img2_bak.data, img2.data + (size_t)i1 * img2.width, sizeof(float) * img2.width);
-        box_min_1d(img2.width, img2_bak.data, img2.data + (size_t)i1 * img2.width, 1, w);
-      }
-      free_gray_image(&img2_bak);
-    }
-  }
-  else
-  {
-#ifdef _OPENMP
-#pragma omp parallel default(none) \
-    dt_omp_firstprivate(img1, img2, w) \
-    private(img2_bak)
-#endif
-    {
-#ifdef _OPENMP
-#pragma omp for
-#endif
-      for(int i1 = 0; i1 < img1.height; i1++)
-        box_min_1d(img1.width, img1.data + (size_t)i1 * img1.width, img2.data + (size_t)i1 * img2.width, 1, w);
-    }
-  }
-#ifdef _OPENMP
-#pragma omp parallel default(none) \
-  dt_omp_firstprivate(img1, img2, w) \
-  private(img2_bak)
-#endif
-  {
-    img2_bak = new_gray_image(1, img2.height);
-#ifdef _OPENMP
-#pragma omp for schedule(static)
-#endif
-    for(int i0 = 0; i0 < img1.width; i0++)
-    {
-      for(int i1 = 0; i1 < img1.height; i1++) img2_bak.data[i1] = img2.data[i0 + (size_t)i1 * img2.width];
-      box_min_1d(img1.height, img2_bak.data, img2.data + i0, img1.width, w);
-    }
-    free_gray_image(&img2_bak);
-  }
+  box_min_max(img1, img2, w, FALSE);
 }
 
 
@@ -544,56 +511,46 @@ static void transition_map(const const_rgb_image img1, const gray_image img2, co
 }
 
 
-// partition the array [first, last) using the pivot value val, i.e.,
-// reorder the elements in the range [first, last) in such a way that
-// all elements that are less than the pivot precede the elements
-// which are larger or equal the pivot
-static float *partition(float *first, float *last, float val)
+// map floats to unsigned integers of the same order: negative numbers get all bits flipped, positive
+// ones just the sign bit
+static inline uint32_t float_to_key(const float f)
 {
-  for(; first != last; ++first)
-  {
-    if(!((*first) < val)) break;
-  }
-  if(first == last) return first;
-  for(float *i = first + 1; i != last; ++i)
-  {
-    if((*i) < val)
-    {
-      pointer_swap_f(i, first);
-      ++first;
-    }
-  }
-  return first;
+  union { float f; uint32_t u; } v = { .f = f };
+  return (v.u & 0x80000000u) ? ~v.u : (v.u | 0x80000000u);
 }
 
 
-// quick select algorithm, arranges the range [first, last) such that
-// the element pointed to by nth is the same as the element that would
-// be in that position if the entire range [first, last) had been
-// sorted, additionally, none of the elements in the range [nth, last)
-// is less than any of the elements in the range [first, nth)
-void quick_select(float *first, float *nth, float *last)
+static inline float key_to_float(const uint32_t k)
 {
-  if(first == last) return;
-  for(;;)
+  union { uint32_t u; float f; } v = { .u = (k & 0x80000000u) ? (k & 0x7fffffffu) : ~k };
+  return v.f;
+}
+
+
+// the element at position nth if data[0, n) were sorted, found with two histograms over the upper
+// and the lower 16 bits of the float keys, instead of reordering a copy of the data
+static float select_nth(const float *const data, const size_t n, const size_t nth)
+{
+  if(n == 0) return 0.f;
+  size_t *hist = calloc(1 << 16, sizeof(size_t));
+  if(!hist) return 0.f;
+
+  for(size_t i = 0; i < n; i++) hist[float_to_key(data[i]) >> 16]++;
+  size_t rank = nth;
+  uint32_t upper = 0;
+  while(rank >= hist[upper]) rank -= hist[upper++];
+
+  memset(hist, 0, sizeof(size_t) << 16);
+  for(size_t i = 0; i < n; i++)
   {
-    // select pivot by median of three heuristic for better performance
-    float *p1 = first;
-    float *pivot = first + (last - first) / 2;
-    float *p3 = last - 1;
-    if(!(*p1 < *pivot)) pointer_swap_f(p1, pivot);
-    if(!(*p1 < *p3)) pointer_swap_f(p1, p3);
-    if(!(*pivot < *p3)) pointer_swap_f(pivot, p3);
-    pointer_swap_f(pivot, last - 1); // move pivot to end
-    partition(first, last - 1, *(last - 1));
-    pointer_swap_f(last - 1, pivot); // move pivot to its final place
-    if(nth == pivot)
-      break;
-    else if(nth < pivot)
-      last = pivot;
-    else
-      first = pivot + 1;
+    const uint32_t key = float_to_key(data[i]);
+    if((key >> 16) == upper) hist[key & 0xffffu]++;
   }
+  uint32_t lower = 0;
+  while(rank >= hist[lower]) rank -= hist[lower++];
+
+  free(hist);
+  return key_to_float((upper << 16) | lower);
 }
 
 
@@ -611,41 +568,43 @@ static float ambient_light(const const_rgb_image img, int w1, rgb_pixel *pA0)
   // calculate dark channel, which is an estimate for local amount of haze
   gray_image dark_ch = new_gray_image(width, height);
   dark_channel(img, dark_ch, w1);
-  // determine the brightest pixels among the most hazy pixels
-  gray_image bright_hazy = new_gray_image(width, height);
   // first determine the most hazy pixels
-  copy_gray_image(dark_ch, bright_hazy);
-  size_t p = (size_t)(size * dark_channel_quantil);
-  quick_select(bright_hazy.data, bright_hazy.data + p, bright_hazy.data + size);
-  const float crit_haze_level = bright_hazy.data[p];
+  const float crit_haze_level = select_nth(dark_ch.data, size, (size_t)(size * dark_channel_quantil));
+  // then the brightest pixels among the most hazy pixels, which are only a few percent of the image
+  const float *const dark = dark_ch.data;
   size_t N_most_hazy = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(crit_haze_level, dark, size) \
+  schedule(static) \
+  reduction(+ : N_most_hazy)
+#endif
   for(size_t i = 0; i < size; i++)
-    if(dark_ch.data[i] >= crit_haze_level)
+    if(dark[i] >= crit_haze_level) N_most_hazy++;
+  float *bright_hazy = dt_alloc_align(64, sizeof(float) * MAX(N_most_hazy, 1));
+  size_t n = 0;
+  for(size_t i = 0; i < size && n < N_most_hazy; i++)
+    if(dark[i] >= crit_haze_level)
     {
       const float *pixel_in = img.data + i * img.stride;
-      // next line prevents parallelization via OpenMP
-      bright_hazy.data[N_most_hazy] = pixel_in[0] + pixel_in[1] + pixel_in[2];
-      N_most_hazy++;
+      bright_hazy[n++] = pixel_in[0] + pixel_in[1] + pixel_in[2];
     }
-  p = (size_t)(N_most_hazy * bright_quantil);
-  quick_select(bright_hazy.data, bright_hazy.data + p, bright_hazy.data + N_most_hazy);
-  const float crit_brightness = bright_hazy.data[p];
-  free_gray_image(&bright_hazy);
+  const float crit_brightness = select_nth(bright_hazy, N_most_hazy, (size_t)(N_most_hazy * bright_quantil));
+  dt_free_align(bright_hazy);
   // average over the brightest pixels among the most hazy pixels to
   // estimate the diffusive ambient light
   float A0_r = 0, A0_g = 0, A0_b = 0;
   size_t N_bright_hazy = 0;
-  const float *const data = dark_ch.data;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(crit_brightness, crit_haze_level, data, img, size) \
+  dt_omp_firstprivate(crit_brightness, crit_haze_level, dark, img, size) \
   schedule(static) \
   reduction(+ : N_bright_hazy, A0_r, A0_g, A0_b)
 #endif
   for(size_t i = 0; i < size; i++)
   {
     const float *pixel_in = img.data + i * img.stride;
-    if((data[i] >= crit_haze_level) && (pixel_in[0] + pixel_in[1] + pixel_in[2] >= crit_brightness))
+    if((dark[i] >= crit_haze_level) && (pixel_in[0] + pixel_in[1] + pixel_in[2] >= crit_brightness))
     {
       A0_r += pixel_in[0];
       A0_g += pixel_in[1];
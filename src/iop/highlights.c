@@ -69,6 +69,7 @@ typedef struct dt_iop_highlights_global_data_t
   int kernel_highlights_1f_clip;
   int kernel_highlights_1f_lch_bayer;
   int kernel_highlights_1f_lch_xtrans;
+  int kernel_highlights_1f_inpaint;
   int kernel_highlights_4f_clip;
 } dt_iop_highlights_global_data_t;
 
@@ -129,6 +130,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   cl_int err = -999;
   cl_mem dev_xtrans = NULL;
+  cl_mem dev_acc = NULL;
 
   const int devid = piece->pipe->devid;
   const int width = roi_in->width;
@@ -221,16 +223,52 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_highlights_1f_lch_xtrans, sizes, local);
     if(err != CL_SUCCESS) goto error;
   }
+  else if(d->mode == DT_IOP_HIGHLIGHTS_INPAINT)
+  {
+    // raw images with color inpainting, one work item per row and then one per column.
+    // the row passes leave their sums for the clipped pixels in dev_acc.
+    const float clips[4] = { 0.987f * d->clip * piece->pipe->dsc.processed_maximum[0],
+                             0.987f * d->clip * piece->pipe->dsc.processed_maximum[1],
+                             0.987f * d->clip * piece->pipe->dsc.processed_maximum[2], clip };
+
+    dev_acc = dt_opencl_alloc_device_buffer(devid, sizeof(float) * width * height);
+    if(dev_acc == NULL) goto error;
+
+    // the kernel wants a buffer argument for bayer sensors as well
+    dev_xtrans
+        = dt_opencl_copy_host_to_device_constant(devid, sizeof(piece->pipe->dsc.xtrans), piece->pipe->dsc.xtrans);
+    if(dev_xtrans == NULL) goto error;
+
+    for(int dim = 0; dim < 2; dim++)
+    {
+      size_t sizes[] = { ROUNDUPWD(dim ? width : height), 1, 1 };
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 0, sizeof(cl_mem), (void *)&dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 1, sizeof(cl_mem), (void *)&dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 2, sizeof(cl_mem), (void *)&dev_acc);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 3, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 4, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 5, sizeof(int), (void *)&roi_out->x);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 6, sizeof(int), (void *)&roi_out->y);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 7, sizeof(int), (void *)&filters);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 8, sizeof(cl_mem), (void *)&dev_xtrans);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 9, 4 * sizeof(float), (void *)&clips);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_1f_inpaint, 10, sizeof(int), (void *)&dim);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_highlights_1f_inpaint, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
 
   // update processed maximum
   const float m = fmaxf(fmaxf(piece->pipe->dsc.processed_maximum[0], piece->pipe->dsc.processed_maximum[1]),
                         piece->pipe->dsc.processed_maximum[2]);
   for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] = m;
 
+  dt_opencl_release_mem_object(dev_acc);
   dt_opencl_release_mem_object(dev_xtrans);
   return TRUE;
 
 error:
+  dt_opencl_release_mem_object(dev_acc);
   dt_opencl_release_mem_object(dev_xtrans);
   dt_print(DT_DEBUG_OPENCL, "[opencl_highlights] couldn't enqueue kernel! %d\n", err);
   return FALSE;
@@ -244,7 +282,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   dt_iop_highlights_data_t *d = (dt_iop_highlights_data_t *)piece->data;
   const uint32_t filters = piece->pipe->dsc.filters;
 
-  tiling->factor = 2.0f;  // in + out
+  tiling->factor = (d->mode == DT_IOP_HIGHLIGHTS_INPAINT) ? 3.0f : 2.0f;  // in + out (+ inpaint sums)
   tiling->maxbuf = 1.0f;
   tiling->overhead = 0;
 
@@ -866,6 +904,24 @@ static void process_clip(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
     dt_unreachable_codepath();
 }
 
+// the uint16 mosaic of the raw stage, see pixelpipe_raw_uint16
+static void process_clip_uint16(const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_out,
+                                const float clip)
+{
+  const uint16_t clip16 = dt_raw_float_to_uint16(clip);
+  const uint16_t *const in = (const uint16_t *const)ivoid;
+  uint16_t *const out = (uint16_t *const)ovoid;
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) \
+  dt_omp_firstprivate(clip16, in, out, roi_out) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
+  {
+    out[k] = MIN(clip16, in[k]);
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -957,7 +1013,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       break;
     default:
     case DT_IOP_HIGHLIGHTS_CLIP:
-      process_clip(piece, ivoid, ovoid, roi_in, roi_out, clip);
+      if(piece->dsc_in.datatype == TYPE_UINT16)
+        process_clip_uint16(ivoid, ovoid, roi_out, clip);
+      else
+        process_clip(piece, ivoid, ovoid, roi_in, roi_out, clip);
       break;
   }
 
@@ -994,8 +1053,8 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   piece->process_cl_ready = 1;
 
-  // no OpenCL for DT_IOP_HIGHLIGHTS_INPAINT yet.
-  if(d->mode == DT_IOP_HIGHLIGHTS_INPAINT) piece->process_cl_ready = 0;
+  // only clipping takes the uint16 raw stage, or goes through the raw stage in one pass with rawprepare
+  piece->process_uint16_ready = piece->process_pointwise = d->mode == DT_IOP_HIGHLIGHTS_CLIP;
 }
 
 void init_global(dt_iop_module_so_t *module)
@@ -1008,6 +1067,7 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_highlights_1f_lch_bayer = dt_opencl_create_kernel(program, "highlights_1f_lch_bayer");
   gd->kernel_highlights_1f_lch_xtrans = dt_opencl_create_kernel(program, "highlights_1f_lch_xtrans");
   gd->kernel_highlights_4f_clip = dt_opencl_create_kernel(program, "highlights_4f_clip");
+  gd->kernel_highlights_1f_inpaint = dt_opencl_create_kernel(program, "highlights_1f_inpaint");
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
@@ -1017,6 +1077,7 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_highlights_1f_lch_bayer);
   dt_opencl_free_kernel(gd->kernel_highlights_1f_lch_xtrans);
   dt_opencl_free_kernel(gd->kernel_highlights_1f_clip);
+  dt_opencl_free_kernel(gd->kernel_highlights_1f_inpaint);
   free(module->data);
   module->data = NULL;
 }
@@ -20,6 +20,7 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -61,6 +62,11 @@ typedef struct dt_iop_hotpixels_data_t
   gboolean markfixed;
 } dt_iop_hotpixels_data_t;
 
+typedef struct dt_iop_hotpixels_global_data_t
+{
+  int kernel_hotpixels;
+} dt_iop_hotpixels_global_data_t;
+
 
 const char *name()
 {
@@ -164,14 +170,11 @@ static int process_bayer(const dt_iop_hotpixels_data_t *data,
   return fixed;
 }
 
-/* X-Trans sensor equivalent of process_bayer(). */
-static int process_xtrans(const dt_iop_hotpixels_data_t *data,
-                          const void *const ivoid, void *const ovoid,
-                          const dt_iop_roi_t *const roi_out, const uint8_t (*const xtrans)[6])
+/* for each cell of sensor array, pre-calculate, a list of the x/y
+ * offsets of the four radially nearest pixels of the same color */
+static void xtrans_offsets(int offsets[6][6][4][2], const dt_iop_roi_t *const roi_out,
+                           const uint8_t (*const xtrans)[6])
 {
-  // for each cell of sensor array, pre-calculate, a list of the x/y
-  // offsets of the four radially nearest pixels of the same color
-  int offsets[6][6][4][2];
   // increasing offsets from pixel to find nearest like-colored pixels
   const int search[20][2] = { { -1, 0 },
                               { 1, 0 },
@@ -209,6 +212,15 @@ static int process_xtrans(const dt_iop_hotpixels_data_t *data,
       }
     }
   }
+}
+
+/* X-Trans sensor equivalent of process_bayer(). */
+static int process_xtrans(const dt_iop_hotpixels_data_t *data,
+                          const void *const ivoid, void *const ovoid,
+                          const dt_iop_roi_t *const roi_out, const uint8_t (*const xtrans)[6])
+{
+  int offsets[6][6][4][2];
+  xtrans_offsets(offsets, roi_out, xtrans);
 
   const float threshold = data->threshold;
   const float multiplier = data->multiplier;
@@ -303,6 +315,92 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_hotpixels_gui_data_t *g = (dt_iop_hotpixels_gui_data_t *)self->gui_data;
+  const dt_iop_hotpixels_data_t *data = (dt_iop_hotpixels_data_t *)piece->data;
+  const dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)self->global_data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int min_neighbours = data->permissive ? 3 : 4;
+  const int markfixed = data->markfixed;
+  const uint32_t filters = piece->pipe->dsc.filters;
+  int fixed = 0;
+
+  cl_int err = -999;
+  cl_mem dev_offsets = NULL;
+  cl_mem dev_xtrans = NULL;
+  cl_mem dev_fixed = NULL;
+
+  // the same-color neighbours of every cell of the 6x6 pattern, bayer sensors use the same four everywhere
+  int offsets[6][6][4][2];
+  if(filters == 9u)
+  {
+    xtrans_offsets(offsets, roi_out, (const uint8_t(*const)[6])piece->pipe->dsc.xtrans);
+  }
+  else
+  {
+    const int bayer[4][2] = { { -2, 0 }, { 0, -2 }, { 2, 0 }, { 0, 2 } };
+    for(int j = 0; j < 6; ++j)
+      for(int i = 0; i < 6; ++i) memcpy(offsets[j][i], bayer, sizeof(bayer));
+  }
+
+  dev_offsets = dt_opencl_copy_host_to_device_constant(devid, sizeof(offsets), offsets);
+  if(dev_offsets == NULL) goto error;
+
+  dev_xtrans
+      = dt_opencl_copy_host_to_device_constant(devid, sizeof(piece->pipe->dsc.xtrans), piece->pipe->dsc.xtrans);
+  if(dev_xtrans == NULL) goto error;
+
+  dev_fixed = dt_opencl_alloc_device_buffer(devid, sizeof(int));
+  if(dev_fixed == NULL) goto error;
+  err = dt_opencl_write_buffer_to_device(devid, &fixed, dev_fixed, 0, sizeof(int), CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 4, sizeof(float), (void *)&data->threshold);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 5, sizeof(float), (void *)&data->multiplier);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 6, sizeof(int), (void *)&min_neighbours);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 7, sizeof(int), (void *)&markfixed);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 8, sizeof(cl_mem), (void *)&dev_offsets);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 9, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 10, sizeof(int), (void *)&roi_out->x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 11, sizeof(int), (void *)&roi_out->y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 12, sizeof(cl_mem), (void *)&dev_xtrans);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 13, sizeof(cl_mem), (void *)&dev_fixed);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hotpixels, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  if(g != NULL && self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
+  {
+    // only the gui wants to know how many pixels got fixed, don't stall the other pipes for it
+    err = dt_opencl_read_buffer_from_device(devid, &fixed, dev_fixed, 0, sizeof(int), CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    g->pixels_fixed = fixed;
+  }
+
+  dt_opencl_release_mem_object(dev_fixed);
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_offsets);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_fixed);
+  dt_opencl_release_mem_object(dev_xtrans);
+  dt_opencl_release_mem_object(dev_offsets);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_hotpixels] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void reload_defaults(dt_iop_module_t *module)
 {
   const dt_iop_hotpixels_params_t tmp
@@ -322,9 +420,25 @@ end:
   memcpy(module->default_params, &tmp, sizeof(dt_iop_hotpixels_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 32; // hotpixels.cl, from programs.conf
+  dt_iop_hotpixels_global_data_t *gd
+      = (dt_iop_hotpixels_global_data_t *)malloc(sizeof(dt_iop_hotpixels_global_data_t));
+  module->data = gd;
+  gd->kernel_hotpixels = dt_opencl_create_kernel(program, "hotpixels");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_hotpixels);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
-  module->global_data = NULL;
   module->params = calloc(1, sizeof(dt_iop_hotpixels_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_hotpixels_params_t));
   module->default_enabled = 0;
@@ -338,8 +452,6 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
   free(module->default_params);
   module->default_params = NULL;
-  free(module->global_data);
-  module->global_data = NULL;
 }
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
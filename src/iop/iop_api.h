@@ -181,6 +181,12 @@ void process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
 void process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
                     const struct dt_iop_roi_t *const roi_out, const int bpp);
+/** applies the module in place to npixels consecutive 4 channel pixels of its input colorspace, for modules
+ *  whose output pixel only depends on the same input pixel. lets the pipe fuse runs of such modules into a
+ *  single pass, so it is called concurrently on different blocks and must not start threads itself. */
+/** can be provided by each IOP. */
+void process_pixels(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *const buf,
+                    const size_t npixels);
 
 #if defined(__SSE__)
 /** a variant process(), that can contain SSE2 intrinsics. */
@@ -188,6 +194,16 @@ void process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                   void *const o, const struct dt_iop_roi_t *const roi_in,
                   const struct dt_iop_roi_t *const roi_out);
+/** a variant process(), that can contain AVX2 and FMA code. preferred over process_sse2() when the CPU
+ *  supports it. */
+void process_avx2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                  void *const o, const struct dt_iop_roi_t *const roi_in,
+                  const struct dt_iop_roi_t *const roi_out);
+/** a variant process(), that can contain AVX-512F code. preferred over process_avx2() when the CPU
+ *  supports it. */
+void process_avx512(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
+                    void *const o, const struct dt_iop_roi_t *const roi_in,
+                    const struct dt_iop_roi_t *const roi_out);
 #endif
 
 #ifdef HAVE_OPENCL
@@ -122,8 +122,28 @@ typedef struct dt_iop_lensfun_global_data_t
   int kernel_lens_distort_lanczos2;
   int kernel_lens_distort_lanczos3;
   int kernel_lens_vignette;
+  int kernel_lens_map_expand;
 } dt_iop_lensfun_global_data_t;
 
+// the distorted coordinates of a coarse grid of nodes over the whole image at one size, as computed by
+// ApplySubpixelGeometryDistortion(). they only depend on the lens parameters and the image size, so the maps
+// are kept in the piece across pipe runs and interpolated bilinearly in between the nodes.
+#define LENSFUN_MAP_STEP 8
+#define LENSFUN_MAP_SLOTS 2
+
+typedef struct dt_iop_lensfun_map_t
+{
+  uint64_t params_hash;
+  float orig_w, orig_h;
+  int width, height; // in nodes
+  int refs;
+  float *coords;     // 6 floats per node
+#ifdef HAVE_OPENCL
+  int devid;         // the device dev_coords lives on
+  cl_mem dev_coords;
+#endif
+} dt_iop_lensfun_map_t;
+
 typedef struct dt_iop_lensfun_data_t
 {
   lfLens *lens;
@@ -138,6 +158,9 @@ typedef struct dt_iop_lensfun_data_t
   gboolean do_nan_checks;
   gboolean tca_override;
   lfLensCalibTCA custom_tca;
+  uint64_t params_hash; // of the committed params, to tell if a distortion map is still valid
+  dt_pthread_mutex_t map_lock;
+  dt_iop_lensfun_map_t *maps[LENSFUN_MAP_SLOTS]; // most recently used first
 } dt_iop_lensfun_data_t;
 
 
@@ -385,10 +408,103 @@ static lfModifier * get_modifier(int *mods_done, int w, int h, const dt_iop_lens
   return mod;
 }
 
+static void _map_free(dt_iop_lensfun_map_t *map)
+{
+#ifdef HAVE_OPENCL
+  dt_opencl_release_mem_object(map->dev_coords);
+#endif
+  dt_free_align(map->coords);
+  free(map);
+}
+
+static void _map_release(dt_iop_lensfun_data_t *d, dt_iop_lensfun_map_t *map)
+{
+  dt_pthread_mutex_lock(&d->map_lock);
+  const int refs = --map->refs;
+  dt_pthread_mutex_unlock(&d->map_lock);
+  if(refs == 0) _map_free(map);
+}
+
+// returns the distortion map of the piece for an image of orig_w x orig_h, made with modifier if there is none
+// yet. the map stays valid until it is given back with _map_release().
+static dt_iop_lensfun_map_t *_map_get(dt_iop_lensfun_data_t *d, const lfModifier *modifier, const float orig_w,
+                                      const float orig_h)
+{
+  dt_pthread_mutex_lock(&d->map_lock);
+  for(int k = 0; k < LENSFUN_MAP_SLOTS; k++)
+  {
+    dt_iop_lensfun_map_t *map = d->maps[k];
+    if(map && map->params_hash == d->params_hash && map->orig_w == orig_w && map->orig_h == orig_h)
+    {
+      map->refs++;
+      d->maps[k] = d->maps[0];
+      d->maps[0] = map;
+      dt_pthread_mutex_unlock(&d->map_lock);
+      return map;
+    }
+  }
+  dt_pthread_mutex_unlock(&d->map_lock);
+
+  dt_iop_lensfun_map_t *map = (dt_iop_lensfun_map_t *)calloc(1, sizeof(dt_iop_lensfun_map_t));
+  map->params_hash = d->params_hash;
+  map->orig_w = orig_w;
+  map->orig_h = orig_h;
+  // one node beyond the image on each side, so the rightmost and lowest pixels are interpolated too
+  const int width = map->width = (int)ceilf(orig_w / LENSFUN_MAP_STEP) + 2;
+  const int height = map->height = (int)ceilf(orig_h / LENSFUN_MAP_STEP) + 2;
+  float *const coords = map->coords = (float *)dt_alloc_align(64, sizeof(float) * 6 * width * height);
+#ifdef HAVE_OPENCL
+  map->devid = -1;
+#endif
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(coords, height, width) \
+  shared(modifier) \
+  schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+      modifier->ApplySubpixelGeometryDistortion(i * LENSFUN_MAP_STEP, j * LENSFUN_MAP_STEP, 1, 1,
+                                                coords + 6 * ((size_t)j * width + i));
+
+  // one reference for the caller, one for the slot
+  map->refs = 2;
+  dt_pthread_mutex_lock(&d->map_lock);
+  dt_iop_lensfun_map_t *evicted = d->maps[LENSFUN_MAP_SLOTS - 1];
+  for(int k = LENSFUN_MAP_SLOTS - 1; k > 0; k--) d->maps[k] = d->maps[k - 1];
+  d->maps[0] = map;
+  const int evicted_refs = evicted ? --evicted->refs : -1;
+  dt_pthread_mutex_unlock(&d->map_lock);
+  if(evicted_refs == 0) _map_free(evicted);
+
+  return map;
+}
+
+// interpolates the coordinates of ApplySubpixelGeometryDistortion(x, y, width, 1, out) from the map
+static void _map_row(const dt_iop_lensfun_map_t *const map, const float x, const float y, const int width,
+                     float *const out)
+{
+  const float fy = y / LENSFUN_MAP_STEP;
+  const int j = CLAMP((int)floorf(fy), 0, map->height - 2);
+  const float ty = fy - j;
+  for(int k = 0; k < width; k++)
+  {
+    const float fx = (x + k) / LENSFUN_MAP_STEP;
+    const int i = CLAMP((int)floorf(fx), 0, map->width - 2);
+    const float tx = fx - i;
+    const float *const n00 = map->coords + 6 * ((size_t)j * map->width + i);
+    const float *const n10 = n00 + 6 * map->width;
+    for(int c = 0; c < 6; c++)
+      out[6 * k + c] = (1.0f - ty) * ((1.0f - tx) * n00[c] + tx * n00[c + 6])
+                       + ty * ((1.0f - tx) * n10[c] + tx * n10[c + 6]);
+  }
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  const dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
+  dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
 
   const int ch = piece->colors;
@@ -413,11 +529,14 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
   const struct dt_interpolation *const interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  const gboolean distort
+      = (modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE)) != 0;
+  dt_iop_lensfun_map_t *const map = distort ? _map_get(d, modifier, orig_w, orig_h) : NULL;
 
   if(d->inverse)
   {
     // reverse direction (useful for renderings)
-    if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
+    if(distort)
     {
       // acquire temp memory for distorted pixel coords
       const size_t bufsize = (size_t)roi_out->width * 2 * 3;
@@ -425,15 +544,15 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(bufsize, ch, ch_width, d, interpolation, ivoid, \
+      dt_omp_firstprivate(bufsize, ch, ch_width, d, interpolation, ivoid, map, \
                           mask_display, ovoid, roi_in, roi_out) \
-      shared(buf, modifier) \
+      shared(buf) \
       schedule(static)
 #endif
       for(int y = 0; y < roi_out->height; y++)
       {
         float *bufptr = ((float *)buf) + (size_t)bufsize * dt_get_thread_num();
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, bufptr);
+        _map_row(map, roi_out->x, roi_out->y + y, roi_out->width, bufptr);
 
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
@@ -521,7 +640,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
       }
     }
 
-    if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
+    if(distort)
     {
       // acquire temp memory for distorted pixel coords
       const size_t buf2size = (size_t)roi_out->width * 2 * 3;
@@ -529,15 +648,14 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(buf2size, ch, ch_width, d, interpolation, mask_display, ovoid, roi_in, roi_out) \
-      shared(buf2, buf, modifier) \
+      dt_omp_firstprivate(buf2size, ch, ch_width, d, interpolation, map, mask_display, ovoid, roi_in, roi_out) \
+      shared(buf2, buf) \
       schedule(static)
 #endif
       for(int y = 0; y < roi_out->height; y++)
       {
         float *buf2ptr = ((float *)buf2) + (size_t)buf2size * dt_get_thread_num();
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width,
-                                                  1, buf2ptr);
+        _map_row(map, roi_out->x, roi_out->y + y, roi_out->width, buf2ptr);
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
         for(int x = 0; x < roi_out->width; x++, buf2ptr += 6, out += ch)
@@ -582,6 +700,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     }
     dt_free_align(buf);
   }
+  if(map) _map_release(d, map);
   delete modifier;
 
   if(self->dev->gui_attached && g && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
@@ -593,6 +712,38 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 }
 
 #ifdef HAVE_OPENCL
+// fills dev_pi with the distorted coordinates of roi_out like ApplySubpixelGeometryDistortion() would, from the
+// map which is uploaded to the device once
+static cl_int _map_expand_cl(const dt_iop_lensfun_global_data_t *const gd, dt_iop_lensfun_map_t *const map,
+                             const int devid, cl_mem dev_pi, const dt_iop_roi_t *const roi_out)
+{
+  if(map->devid != devid)
+  {
+    dt_opencl_release_mem_object(map->dev_coords);
+    map->dev_coords = (cl_mem)dt_opencl_copy_host_to_device_constant(
+        devid, sizeof(float) * 6 * map->width * map->height, map->coords);
+    map->devid = map->dev_coords ? devid : -1;
+    if(map->dev_coords == NULL) return -999;
+  }
+
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int roi_x = roi_out->x;
+  const int roi_y = roi_out->y;
+  const float step = LENSFUN_MAP_STEP;
+  size_t sizes[] = { (size_t)ROUNDUPWD(width), (size_t)ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 0, sizeof(cl_mem), (void *)&map->dev_coords);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 1, sizeof(int), (void *)&map->width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 2, sizeof(int), (void *)&map->height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 3, sizeof(float), (void *)&step);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 4, sizeof(cl_mem), (void *)&dev_pi);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 5, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 6, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 7, sizeof(int), (void *)&roi_x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_lens_map_expand, 8, sizeof(int), (void *)&roi_y);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_lens_map_expand, sizes);
+}
+
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -617,7 +768,6 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   const int width = MAX(iwidth, owidth);
   const int height = MAX(iheight, oheight);
   const int ch = piece->colors;
-  const int tmpbufwidth = owidth * 2 * 3;
   const size_t tmpbuflen = d->inverse ? (size_t)oheight * owidth * 2 * 3 * sizeof(float)
                                       : MAX((size_t)oheight * owidth * 2 * 3, (size_t)iheight * iwidth * ch)
                                         * sizeof(float);
@@ -633,6 +783,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   int modflags;
   int ldkernel = -1;
+  dt_iop_lensfun_map_t *map = NULL;
   const struct dt_interpolation *interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
 
   if(!d->lens || !d->lens->Maker || d->crop <= 0.0f)
@@ -678,21 +829,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     // reverse direction (useful for renderings)
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(tmpbufwidth, roi_out) \
-      shared(tmpbuf, d, modifier) \
-      schedule(static)
-#endif
-      for(int y = 0; y < roi_out->height; y++)
-      {
-        float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, pi);
-      }
-
-      /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
-      err = dt_opencl_write_buffer_to_device(devid, tmpbuf, dev_tmpbuf, 0,
-                                             (size_t)owidth * oheight * 2 * 3 * sizeof(float), CL_TRUE);
+      map = _map_get(d, modifier, orig_w, orig_h);
+      err = _map_expand_cl(gd, map, devid, dev_tmpbuf, roi_out);
       if(err != CL_SUCCESS) goto error;
 
       dt_opencl_set_kernel_arg(devid, ldkernel, 0, sizeof(cl_mem), (void *)&dev_in);
@@ -795,21 +933,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(tmpbufwidth, roi_out) \
-      shared(tmpbuf, d, modifier) \
-      schedule(static)
-#endif
-      for(int y = 0; y < roi_out->height; y++)
-      {
-        float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, pi);
-      }
-
-      /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
-      err = dt_opencl_write_buffer_to_device(devid, tmpbuf, dev_tmpbuf, 0,
-                                             (size_t)owidth * oheight * 2 * 3 * sizeof(float), CL_TRUE);
+      map = _map_get(d, modifier, orig_w, orig_h);
+      err = _map_expand_cl(gd, map, devid, dev_tmpbuf, roi_out);
       if(err != CL_SUCCESS) goto error;
 
       dt_opencl_set_kernel_arg(devid, ldkernel, 0, sizeof(cl_mem), (void *)&dev_tmp);
@@ -842,6 +967,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dt_opencl_release_mem_object(dev_tmpbuf);
   dt_opencl_release_mem_object(dev_tmp);
   if(tmpbuf != NULL) dt_free_align(tmpbuf);
+  if(map != NULL) _map_release(d, map);
   if(modifier != NULL) delete modifier;
   return TRUE;
 
@@ -849,6 +975,7 @@ error:
   dt_opencl_release_mem_object(dev_tmp);
   dt_opencl_release_mem_object(dev_tmpbuf);
   if(tmpbuf != NULL) dt_free_align(tmpbuf);
+  if(map != NULL) _map_release(d, map);
   if(modifier != NULL) delete modifier;
   dt_print(DT_DEBUG_OPENCL, "[opencl_lens] couldn't enqueue kernel! %d\n", err);
   return FALSE;
@@ -943,7 +1070,7 @@ int distort_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
 void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *const in,
                   float *const out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  const dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
+  dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
 
   if(!d->lens || !d->lens->Maker || d->crop <= 0.0f)
   {
@@ -954,11 +1081,13 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
   const float orig_w = roi_in->scale * piece->buf_in.width, orig_h = roi_in->scale * piece->buf_in.height;
   dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
   int modflags;
-  lfModifier *modifier = get_modifier(&modflags, orig_w, orig_h, d, /*LF_MODIFY_TCA |*/ LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE);
+  // the full modifier, to share the distortion map of process(). tca only moves the red and blue channels, the
+  // green coordinates used here are the same as without it.
+  lfModifier *modifier = get_modifier(&modflags, orig_w, orig_h, d, LF_MODIFY_ALL);
 
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
-  if(!(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE)))
+  if(!(modflags & (LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE)))
   {
     memcpy(out, in, sizeof(float) * roi_out->width * roi_out->height);
     delete modifier;
@@ -966,6 +1095,7 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
   }
 
   const struct dt_interpolation *const interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  dt_iop_lensfun_map_t *const map = _map_get(d, modifier, orig_w, orig_h);
 
   // acquire temp memory for distorted pixel coords
   const size_t bufsize = (size_t)roi_out->width * 2 * 3;
@@ -973,14 +1103,14 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(bufsize, d, in, interpolation, out, roi_in, roi_out) \
-  shared(buf, modifier) \
+  dt_omp_firstprivate(bufsize, d, in, interpolation, map, out, roi_in, roi_out) \
+  shared(buf) \
   schedule(static)
 #endif
   for(int y = 0; y < roi_out->height; y++)
   {
     float *bufptr = buf + bufsize * dt_get_thread_num();
-    modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, bufptr);
+    _map_row(map, roi_out->x, roi_out->y + y, roi_out->width, bufptr);
 
     // reverse transform the global coords from lf to our buffer
     float *_out = out + (size_t)y * roi_out->width;
@@ -1000,6 +1130,7 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
     }
   }
   dt_free_align(buf);
+  _map_release(d, map);
   delete modifier;
 }
 
@@ -1213,11 +1344,21 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   {
     d->do_nan_checks = FALSE;
   }
+
+  // the distortion maps stay valid as long as the params and the camera crop factor don't change
+  uint64_t hash = 5381;
+  const char *const pstr = (const char *)p;
+  for(size_t i = 0; i < sizeof(dt_iop_lensfun_params_t); i++) hash = ((hash << 5) + hash) ^ pstr[i];
+  const char *const cstr = (const char *)&d->crop;
+  for(size_t i = 0; i < sizeof(d->crop); i++) hash = ((hash << 5) + hash) ^ cstr[i];
+  d->params_hash = hash;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = calloc(1, sizeof(dt_iop_lensfun_data_t));
+  dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)calloc(1, sizeof(dt_iop_lensfun_data_t));
+  dt_pthread_mutex_init(&d->map_lock, NULL);
+  piece->data = d;
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
@@ -1230,6 +1371,9 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
     delete d->lens;
     d->lens = NULL;
   }
+  for(int k = 0; k < LENSFUN_MAP_SLOTS; k++)
+    if(d->maps[k]) _map_release(d, d->maps[k]);
+  dt_pthread_mutex_destroy(&d->map_lock);
   free(piece->data);
   piece->data = NULL;
 }
@@ -1245,6 +1389,7 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_lens_distort_lanczos2 = dt_opencl_create_kernel(program, "lens_distort_lanczos2");
   gd->kernel_lens_distort_lanczos3 = dt_opencl_create_kernel(program, "lens_distort_lanczos3");
   gd->kernel_lens_vignette = dt_opencl_create_kernel(program, "lens_vignette");
+  gd->kernel_lens_map_expand = dt_opencl_create_kernel(program, "lens_map_expand");
 
   lfDatabase *dt_iop_lensfun_db = new lfDatabase;
   gd->db = (lfDatabase *)dt_iop_lensfun_db;
@@ -1455,6 +1600,7 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_lens_distort_lanczos2);
   dt_opencl_free_kernel(gd->kernel_lens_distort_lanczos3);
   dt_opencl_free_kernel(gd->kernel_lens_vignette);
+  dt_opencl_free_kernel(gd->kernel_lens_map_expand);
   free(module->data);
   module->data = NULL;
 }
@@ -259,6 +259,25 @@ typedef struct
   int warp_kernel;
 } dt_iop_liquify_global_data_t;
 
+// the pipe data: the params, plus the distortion map of the last run. the map covers the extent of all the
+// warps and is kept along with the warps it was built from, so the next run only has to rebuild where warps
+// have changed.
+typedef struct
+{
+  dt_iop_liquify_params_t params; // first, piece->data is used as params
+  dt_pthread_mutex_t lock;
+  float scale;                    // roi scale of the map
+  int n_warps;
+  dt_liquify_warp_t *warps;       // the interpolated warps, in piece coordinates
+  float complex *map;
+  cairo_rectangle_int_t extent;
+#ifdef HAVE_OPENCL
+  int devid;                      // the device dev_map lives on
+  cl_mem dev_map;
+  int dev_dirty_y0, dev_dirty_y1; // the rows of the map changed since the last upload
+#endif
+} dt_iop_liquify_data_t;
+
 typedef struct
 {
   dt_pthread_mutex_t lock;
@@ -1037,6 +1056,7 @@ static void build_round_stamp (float complex **pstamp,
 
 static void add_to_global_distortion_map (float complex *global_map,
                                           const cairo_rectangle_int_t *global_map_extent,
+                                          const cairo_rectangle_int_t *clip,
                                           const dt_liquify_warp_t *warp,
                                           const float complex *stamp,
                                           const cairo_rectangle_int_t *stamp_extent)
@@ -1046,9 +1066,9 @@ static void add_to_global_distortion_map (float complex *global_map,
   mmext.y += (int) round (cimag (warp->point));
   cairo_rectangle_int_t cmmext = mmext;
   cairo_region_t *mmreg = cairo_region_create_rectangle (&mmext);
-  cairo_region_intersect_rectangle (mmreg, global_map_extent);
+  cairo_region_intersect_rectangle (mmreg, clip);
   cairo_region_get_extents (mmreg, &cmmext);
-  free (mmreg);
+  cairo_region_destroy (mmreg);
 
   #ifdef _OPENMP
   #pragma omp parallel for schedule (static) default (shared)
@@ -1089,50 +1109,49 @@ static void apply_global_distortion_map (struct dt_iop_module_t *module,
   const struct dt_interpolation * const interpolation =
     dt_interpolation_new (DT_INTERPOLATION_USERPREF);
 
+  // only the part of the map inside roi_out
+  const int x_from = MAX (extent->x, roi_out->x);
+  const int x_to = MIN (extent->x + extent->width, roi_out->x + roi_out->width);
+  const int y_from = MAX (extent->y, roi_out->y);
+  const int y_to = MIN (extent->y + extent->height, roi_out->y + roi_out->height);
+
   #ifdef _OPENMP
   #pragma omp parallel for schedule (static) default (shared)
   #endif
 
-  for (int y = extent->y; y < extent->y + extent->height; y++)
+  for (int y = y_from; y < y_to; y++)
   {
-    // point inside roi_out ?
-    if (y >= roi_out->y && y < roi_out->y + roi_out->height)
+    const float complex *row = map + (y - extent->y) * extent->width + x_from - extent->x;
+    float* out_sample = out + ((y - roi_out->y) * roi_out->width +
+                             x_from - roi_out->x) * ch;
+    for (int x = x_from; x < x_to; x++)
     {
-      const float complex *row = map + (y - extent->y) * extent->width;
-      float* out_sample = out + ((y - roi_out->y) * roi_out->width +
-                               extent->x - roi_out->x) * ch;
-      for (int x = extent->x; x < extent->x + extent->width; x++)
+      // point actually warped ?
+      if (*row != 0)
       {
-        if (
-          // point inside roi_out ?
-          (x >= roi_out->x && x < roi_out->x + roi_out->width) &&
-          // point actually warped ?
-          (*row != 0))
-        {
-          if(ch == 1)
-            *out_sample = dt_interpolation_compute_sample(interpolation,
-                                                          in,
-                                                          x + creal (*row) - roi_in->x,
-                                                          y + cimag (*row) - roi_in->y,
-                                                          roi_in->width,
-                                                          roi_in->height,
-                                                          ch,
-                                                          ch_width);
-          else
-            dt_interpolation_compute_pixel4c (
-              interpolation,
-              in,
-              out_sample,
-              x + creal (*row) - roi_in->x,
-              y + cimag (*row) - roi_in->y,
-              roi_in->width,
-              roi_in->height,
-              ch_width);
+        if(ch == 1)
+          *out_sample = dt_interpolation_compute_sample(interpolation,
+                                                        in,
+                                                        x + creal (*row) - roi_in->x,
+                                                        y + cimag (*row) - roi_in->y,
+                                                        roi_in->width,
+                                                        roi_in->height,
+                                                        ch,
+                                                        ch_width);
+        else
+          dt_interpolation_compute_pixel4c (
+            interpolation,
+            in,
+            out_sample,
+            x + creal (*row) - roi_in->x,
+            y + cimag (*row) - roi_in->y,
+            roi_in->width,
+            roi_in->height,
+            ch_width);
 
-        }
-        ++row;
-        out_sample += ch;
       }
+      ++row;
+      out_sample += ch;
     }
   }
 }
@@ -1181,7 +1200,7 @@ static float complex *create_global_distortion_map (const cairo_rectangle_int_t
     float complex *stamp = NULL;
     cairo_rectangle_int_t r;
     build_round_stamp (&stamp, &r, warp);
-    add_to_global_distortion_map (map, map_extent, warp, stamp, &r);
+    add_to_global_distortion_map (map, map_extent, map_extent, warp, stamp, &r);
     free ((void *) stamp);
   }
 
@@ -1246,26 +1265,151 @@ static float complex *create_global_distortion_map (const cairo_rectangle_int_t
   return map;
 }
 
-static float complex *build_global_distortion_map (struct dt_iop_module_t *module,
-                                                   const dt_dev_pixelpipe_iop_t *piece,
-                                                   const dt_iop_roi_t *roi_in,
-                                                   const dt_iop_roi_t *roi_out,
-                                                   cairo_rectangle_int_t *map_extent)
+// the extent of the stamp of warp in the map, as add_to_global_distortion_map() places it
+
+static void _get_warp_extent (const dt_liquify_warp_t *warp, cairo_rectangle_int_t *r)
 {
+  const int iradius = round (cabs (warp->radius - warp->point));
+  r->x = (int) round (creal (warp->point)) - iradius;
+  r->y = (int) round (cimag (warp->point)) - iradius;
+  r->width = r->height = 2 * iradius + 1;
+}
+
+/*
+  Brings the distortion map of the pipe data up to date with the warps of the params and returns it, NULL if
+  there aren't any warps. The map covers all the warps, map_extent is set to its extent. Only the region
+  covered by the warps which differ from the ones of the last call is rebuilt, as long as the scale and the
+  extent stay the same. d->lock has to be held while the map is in use.
+*/
+
+static const float complex *_get_distortion_map (struct dt_iop_module_t *module,
+                                                 const dt_dev_pixelpipe_iop_t *piece,
+                                                 const dt_iop_roi_t *roi_in,
+                                                 cairo_rectangle_int_t *map_extent)
+{
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+
   // copy params
   dt_iop_liquify_params_t copy_params;
-  memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data, sizeof(dt_iop_liquify_params_t));
+  memcpy(&copy_params, &d->params, sizeof(dt_iop_liquify_params_t));
 
   distort_paths_raw_to_piece (module, piece->pipe, roi_in->scale, &copy_params, FALSE);
 
   GList *interpolated = interpolate_paths (&copy_params);
 
-  _get_map_extent (roi_out, interpolated, map_extent);
+  const int n_warps = g_list_length (interpolated);
+  dt_liquify_warp_t *warps = malloc (sizeof (dt_liquify_warp_t) * MAX (n_warps, 1));
+  cairo_region_t *map_region = cairo_region_create ();
+  int k = 0;
+  for (GList *i = interpolated; i != NULL; i = i->next, k++)
+  {
+    warps[k] = *((dt_liquify_warp_t *) i->data);
+    cairo_rectangle_int_t r;
+    _get_warp_extent (&warps[k], &r);
+    cairo_region_union_rectangle (map_region, &r);
+  }
+  g_list_free_full (interpolated, free);
+
+  cairo_rectangle_int_t extent;
+  cairo_region_get_extents (map_region, &extent);
+  cairo_region_destroy (map_region);
+
+  if (n_warps == 0 || extent.width == 0 || extent.height == 0)
+  {
+    free (warps);
+    dt_free_align (d->map);
+    free (d->warps);
+    d->map = NULL;
+    d->warps = NULL;
+    d->n_warps = 0;
+    return NULL;
+  }
 
-  float complex *map = create_global_distortion_map(map_extent, interpolated, FALSE);
+  cairo_rectangle_int_t dirty = extent;
 
-  g_list_free_full (interpolated, free);
-  return map;
+  if (d->map && d->scale == roi_in->scale && !memcmp (&d->extent, &extent, sizeof (extent)))
+  {
+    // moving a node changes a run of consecutive warps, everything before and after it stays the same
+    int head = 0;
+    while (head < n_warps && head < d->n_warps && !memcmp (&warps[head], &d->warps[head], sizeof (dt_liquify_warp_t)))
+      head++;
+    int tail = 0;
+    while (tail < n_warps - head && tail < d->n_warps - head
+           && !memcmp (&warps[n_warps - 1 - tail], &d->warps[d->n_warps - 1 - tail], sizeof (dt_liquify_warp_t)))
+      tail++;
+
+    cairo_region_t *dirty_region = cairo_region_create ();
+    for (int i = head; i < d->n_warps - tail; i++)
+    {
+      cairo_rectangle_int_t r;
+      _get_warp_extent (&d->warps[i], &r);
+      cairo_region_union_rectangle (dirty_region, &r);
+    }
+    for (int i = head; i < n_warps - tail; i++)
+    {
+      cairo_rectangle_int_t r;
+      _get_warp_extent (&warps[i], &r);
+      cairo_region_union_rectangle (dirty_region, &r);
+    }
+    cairo_region_intersect_rectangle (dirty_region, &extent);
+    cairo_region_get_extents (dirty_region, &dirty);
+    cairo_region_destroy (dirty_region);
+
+    free (d->warps);
+    d->warps = warps;
+    d->n_warps = n_warps;
+    *map_extent = extent;
+
+    // nothing changed
+    if (dirty.width == 0 || dirty.height == 0) return d->map;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule (static) default (shared)
+    #endif
+
+    for (int y = dirty.y; y < dirty.y + dirty.height; y++)
+      memset (d->map + (y - extent.y) * extent.width + dirty.x - extent.x, 0, sizeof (float complex) * dirty.width);
+  }
+  else
+  {
+    const size_t mapsize = (size_t)extent.width * extent.height;
+    dt_free_align (d->map);
+    d->map = dt_alloc_align (64, mapsize * sizeof (float complex));
+    memset (d->map, 0, mapsize * sizeof (float complex));
+    d->scale = roi_in->scale;
+    d->extent = extent;
+    free (d->warps);
+    d->warps = warps;
+    d->n_warps = n_warps;
+    *map_extent = extent;
+#ifdef HAVE_OPENCL
+    // the size of the map may have changed
+    dt_opencl_release_mem_object (d->dev_map);
+    d->dev_map = NULL;
+#endif
+  }
+
+  // redo the dirty region from all the warps which touch it
+  for (int i = 0; i < n_warps; i++)
+  {
+    cairo_rectangle_int_t r;
+    _get_warp_extent (&warps[i], &r);
+    if (r.x >= dirty.x + dirty.width || r.x + r.width <= dirty.x
+        || r.y >= dirty.y + dirty.height || r.y + r.height <= dirty.y)
+      continue;
+
+    float complex *stamp = NULL;
+    build_round_stamp (&stamp, &r, &warps[i]);
+    add_to_global_distortion_map (d->map, &extent, &dirty, &warps[i], stamp, &r);
+    free ((void *) stamp);
+  }
+
+#ifdef HAVE_OPENCL
+  d->dev_dirty_y0 = MIN (d->dev_dirty_y0, dirty.y - extent.y);
+  d->dev_dirty_y1 = MAX (d->dev_dirty_y1, dirty.y + dirty.height - extent.y);
+#endif
+
+  return d->map;
 }
 
 // 1st pass: how large would the output be, given this input roi?
@@ -1436,14 +1580,15 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
 
   // 2. build the distortion map
 
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  dt_pthread_mutex_lock (&d->lock);
+
   cairo_rectangle_int_t map_extent;
-  float complex *map = build_global_distortion_map (self, piece, roi_in, roi_out, &map_extent);
-  if (map == NULL)
-    return;
+  const float complex *map = _get_distortion_map (self, piece, roi_in, &map_extent);
 
   // 3. apply the map
 
-  if (map_extent.width != 0 && map_extent.height != 0)
+  if (map)
   {
     int ch = piece->colors;
     piece->colors = 1;
@@ -1451,8 +1596,7 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
     piece->colors = ch;
   }
 
-  dt_free_align ((void *) map);
-
+  dt_pthread_mutex_unlock (&d->lock);
 }
 
 void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const in,
@@ -1482,17 +1626,18 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
 
   // 2. build the distortion map
 
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  dt_pthread_mutex_lock (&d->lock);
+
   cairo_rectangle_int_t map_extent;
-  float complex *map = build_global_distortion_map (module, piece, roi_in, roi_out, &map_extent);
-  if (map == NULL)
-    return;
+  const float complex *map = _get_distortion_map (module, piece, roi_in, &map_extent);
 
   // 3. apply the map
 
-  if (map_extent.width != 0 && map_extent.height != 0)
+  if (map)
     apply_global_distortion_map (module, piece, in, out, roi_in, roi_out, map, &map_extent);
 
-  dt_free_align ((void *) map);
+  dt_pthread_mutex_unlock (&d->lock);
 }
 
 #ifdef HAVE_OPENCL
@@ -1532,7 +1677,7 @@ static cl_int_t apply_global_distortion_map_cl (struct dt_iop_module_t *module,
                                                 const cl_mem_t dev_out,
                                                 const dt_iop_roi_t *roi_in,
                                                 const dt_iop_roi_t *roi_out,
-                                                const float complex *map,
+                                                const cl_mem_t dev_map,
                                                 const cairo_rectangle_int_t *map_extent)
 {
   cl_int_t err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
@@ -1581,9 +1726,6 @@ static cl_int_t apply_global_distortion_map_cl (struct dt_iop_module_t *module,
   cl_mem_t dev_roi_out = dt_opencl_copy_host_to_device_constant
     (devid, sizeof (dt_iop_roi_t), (void *) roi_out);
 
-  cl_mem_t dev_map = dt_opencl_copy_host_to_device_constant
-    (devid, map_extent->width * map_extent->height * sizeof (float complex), (void *) map);
-
   cl_mem_t dev_map_extent = dt_opencl_copy_host_to_device_constant
     (devid, sizeof (cairo_rectangle_int_t), (void *) map_extent);
 
@@ -1593,7 +1735,7 @@ static cl_int_t apply_global_distortion_map_cl (struct dt_iop_module_t *module,
   cl_mem_t dev_kernel = dt_opencl_copy_host_to_device_constant
     (devid, (kdesc.size * kdesc.resolution  + 1) * sizeof (float), (void *) k);
 
-  if (dev_roi_in == NULL || dev_roi_out == NULL || dev_map == NULL || dev_map_extent == NULL
+  if (dev_roi_in == NULL || dev_roi_out == NULL || dev_map_extent == NULL
       || dev_kdesc == NULL || dev_kernel == NULL)
     goto error;
 
@@ -1615,7 +1757,6 @@ error:
   dt_opencl_release_mem_object (dev_kernel);
   dt_opencl_release_mem_object (dev_kdesc);
   dt_opencl_release_mem_object (dev_map_extent);
-  dt_opencl_release_mem_object (dev_map);
   dt_opencl_release_mem_object (dev_roi_out);
   dt_opencl_release_mem_object (dev_roi_in);
   if (k) free (k);
@@ -1646,19 +1787,53 @@ int process_cl (struct dt_iop_module_t *module,
     if (err != CL_SUCCESS) goto error;
   }
 
-  // 2. build the distortion map
+  // 2. build the distortion map, and bring its copy on the device up to date
+
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  dt_pthread_mutex_lock (&d->lock);
 
   cairo_rectangle_int_t map_extent;
-  const float complex *map = build_global_distortion_map (module, piece, roi_in, roi_out, &map_extent);
+  const float complex *map = _get_distortion_map (module, piece, roi_in, &map_extent);
   if (map == NULL)
+  {
+    dt_pthread_mutex_unlock (&d->lock);
     return TRUE;
+  }
+
+  const size_t map_row = (size_t)map_extent.width * sizeof (float complex);
+  if (d->dev_map == NULL || d->devid != devid)
+  {
+    dt_opencl_release_mem_object (d->dev_map);
+    d->dev_map = dt_opencl_alloc_device_buffer (devid, map_row * map_extent.height);
+    d->devid = devid;
+    d->dev_dirty_y0 = 0;
+    d->dev_dirty_y1 = map_extent.height;
+  }
+  if (d->dev_map == NULL)
+  {
+    err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+    dt_pthread_mutex_unlock (&d->lock);
+    goto error;
+  }
+  if (d->dev_dirty_y0 < d->dev_dirty_y1)
+  {
+    err = dt_opencl_write_buffer_to_device (devid, (void *) (map + (size_t)d->dev_dirty_y0 * map_extent.width),
+                                            d->dev_map, map_row * d->dev_dirty_y0,
+                                            map_row * (d->dev_dirty_y1 - d->dev_dirty_y0), CL_TRUE);
+    if (err != CL_SUCCESS)
+    {
+      dt_pthread_mutex_unlock (&d->lock);
+      goto error;
+    }
+    d->dev_dirty_y0 = map_extent.height;
+    d->dev_dirty_y1 = 0;
+  }
 
   // 3. apply the map
 
-  if (map_extent.width != 0 && map_extent.height != 0)
-    err = apply_global_distortion_map_cl (module, piece, dev_in, dev_out, roi_in, roi_out, map, &map_extent);
+  err = apply_global_distortion_map_cl (module, piece, dev_in, dev_out, roi_in, roi_out, d->dev_map, &map_extent);
 
-  dt_free_align ((void *) map);
+  dt_pthread_mutex_unlock (&d->lock);
   if (err != CL_SUCCESS) goto error;
 
   return TRUE;
@@ -1710,12 +1885,24 @@ void cleanup(dt_iop_module_t *module)
 
 void init_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc (module->params_size);
+  dt_iop_liquify_data_t *d = calloc (1, sizeof (dt_iop_liquify_data_t));
+  dt_pthread_mutex_init (&d->lock, NULL);
+#ifdef HAVE_OPENCL
+  d->devid = -1;
+#endif
+  piece->data = d;
   module->commit_params (module, module->default_params, pipe, piece);
 }
 
 void cleanup_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+#ifdef HAVE_OPENCL
+  dt_opencl_release_mem_object (d->dev_map);
+#endif
+  dt_free_align (d->map);
+  free (d->warps);
+  dt_pthread_mutex_destroy (&d->lock);
   free (piece->data);
   piece->data = NULL;
 }
@@ -1727,7 +1914,8 @@ void commit_params (struct dt_iop_module_t *module,
                     dt_dev_pixelpipe_t *pipe,
                     dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy (piece->data, params, module->params_size);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  memcpy (&d->params, params, module->params_size);
 }
 
 // calculate the dot product of 2 vectors.
@@ -31,6 +31,7 @@
 #include "gui/accelerators.h"
 #include "iop/iop_api.h"
 
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <libgen.h>
 #include <png.h>
@@ -98,11 +99,27 @@ typedef enum dt_lut3d_cols_t
 
 const char invalid_filepath_prefix[] = "INVALID >> ";
 
+// an expanded clut, shared by all the pipes which use the same lut. the table doesn't depend on the
+// application color space, that is applied around the lookup in process().
+typedef struct dt_iop_lut3d_clut_t
+{
+  gchar *key;     // full path of the file, or the file and lut names plus a hash of the compressed lut
+  gint64 mtime;   // of the file when it was read, 0 for compressed luts
+  gint64 size;
+  float *clut;
+  uint16_t level;
+  int refs;
+} dt_iop_lut3d_clut_t;
+
+// how many unused cluts are kept around for the next pipe
+#define DT_IOP_LUT3D_CACHED_CLUTS 4
+
 typedef struct dt_iop_lut3d_data_t
 {
   dt_iop_lut3d_params_t params;
   float *clut;  // cube lut pointer
   uint16_t level; // cube_size
+  dt_iop_lut3d_clut_t *cached; // the cache entry clut belongs to
 } dt_iop_lut3d_data_t;
 
 typedef struct dt_iop_lut3d_global_data_t
@@ -111,6 +128,8 @@ typedef struct dt_iop_lut3d_global_data_t
   int kernel_lut3d_trilinear;
   int kernel_lut3d_pyramid;
   int kernel_lut3d_none;
+  dt_pthread_mutex_t clut_lock;
+  GList *cluts; // of dt_iop_lut3d_clut_t, most recently used first
 } dt_iop_lut3d_global_data_t;
 
 #ifdef HAVE_GMIC
@@ -1158,6 +1177,16 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_lut3d_trilinear = dt_opencl_create_kernel(program, "lut3d_trilinear");
   gd->kernel_lut3d_pyramid = dt_opencl_create_kernel(program, "lut3d_pyramid");
   gd->kernel_lut3d_none = dt_opencl_create_kernel(program, "lut3d_none");
+  dt_pthread_mutex_init(&gd->clut_lock, NULL);
+  gd->cluts = NULL;
+}
+
+static void _clut_free(gpointer data)
+{
+  dt_iop_lut3d_clut_t *entry = (dt_iop_lut3d_clut_t *)data;
+  dt_free_align(entry->clut);
+  g_free(entry->key);
+  free(entry);
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
@@ -1167,6 +1196,8 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_lut3d_trilinear);
   dt_opencl_free_kernel(gd->kernel_lut3d_pyramid);
   dt_opencl_free_kernel(gd->kernel_lut3d_none);
+  g_list_free_full(gd->cluts, _clut_free);
+  dt_pthread_mutex_destroy(&gd->clut_lock);
   free(module->data);
   module->data = NULL;
 }
@@ -1209,6 +1240,110 @@ static int calculate_clut(dt_iop_lut3d_params_t *const p, float **clut)
   return level;
 }
 
+// drops the unused cluts beyond DT_IOP_LUT3D_CACHED_CLUTS, least recently used first. clut_lock has to be held.
+static void _clut_trim(dt_iop_lut3d_global_data_t *gd)
+{
+  int unused = 0;
+  for(GList *l = gd->cluts; l; l = g_list_next(l))
+    if(((dt_iop_lut3d_clut_t *)l->data)->refs == 0) unused++;
+
+  GList *l = g_list_last(gd->cluts);
+  while(l && unused > DT_IOP_LUT3D_CACHED_CLUTS)
+  {
+    GList *prev = g_list_previous(l);
+    dt_iop_lut3d_clut_t *entry = (dt_iop_lut3d_clut_t *)l->data;
+    if(entry->refs == 0)
+    {
+      gd->cluts = g_list_delete_link(gd->cluts, l);
+      _clut_free(entry);
+      unused--;
+    }
+    l = prev;
+  }
+}
+
+static void _clut_release(dt_iop_lut3d_global_data_t *gd, dt_iop_lut3d_clut_t *entry)
+{
+  dt_pthread_mutex_lock(&gd->clut_lock);
+  entry->refs--;
+  _clut_trim(gd);
+  dt_pthread_mutex_unlock(&gd->clut_lock);
+}
+
+// returns the clut of the params from the cache, reading it first if it isn't there or if the file has changed
+// since. NULL if the lut can't be read.
+static dt_iop_lut3d_clut_t *_clut_acquire(dt_iop_lut3d_global_data_t *gd, dt_iop_lut3d_params_t *const p)
+{
+  if(!p->filepath[0]) return NULL;
+
+  gchar *key = NULL;
+  gint64 mtime = 0, size = 0;
+#ifdef HAVE_GMIC
+  if(p->nb_keypoints)
+  {
+    uint32_t hash = 5381;
+    for(size_t i = 0; i < sizeof(p->c_clut); i++) hash = ((hash << 5) + hash) ^ (unsigned char)p->c_clut[i];
+    key = g_strdup_printf("%s\n%s\n%d\n%08x", p->filepath, p->lutname, p->nb_keypoints, hash);
+  }
+  else
+#endif // HAVE_GMIC
+  {
+    gchar *lutfolder = dt_conf_get_string("plugins/darkroom/lut3d/def_path");
+    if(lutfolder[0])
+    {
+      key = g_build_filename(lutfolder, p->filepath, NULL);
+      GStatBuf st;
+      if(g_stat(key, &st) == 0)
+      {
+        mtime = st.st_mtime;
+        size = st.st_size;
+      }
+    }
+    g_free(lutfolder);
+    if(!key) return NULL;
+  }
+
+  dt_pthread_mutex_lock(&gd->clut_lock);
+  for(GList *l = gd->cluts; l; l = g_list_next(l))
+  {
+    dt_iop_lut3d_clut_t *entry = (dt_iop_lut3d_clut_t *)l->data;
+    if(entry->mtime == mtime && entry->size == size && !strcmp(entry->key, key))
+    {
+      entry->refs++;
+      gd->cluts = g_list_delete_link(gd->cluts, l);
+      gd->cluts = g_list_prepend(gd->cluts, entry);
+      dt_pthread_mutex_unlock(&gd->clut_lock);
+      g_free(key);
+      return entry;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->clut_lock);
+
+  // parse outside of the lock, the big .cube files take a while
+  float *clut = NULL;
+  const uint16_t level = calculate_clut(p, &clut);
+  if(level == 0)
+  {
+    if(clut) dt_free_align(clut);
+    g_free(key);
+    return NULL;
+  }
+
+  dt_iop_lut3d_clut_t *entry = (dt_iop_lut3d_clut_t *)malloc(sizeof(dt_iop_lut3d_clut_t));
+  entry->key = key;
+  entry->mtime = mtime;
+  entry->size = size;
+  entry->clut = clut;
+  entry->level = level;
+  entry->refs = 1;
+
+  dt_pthread_mutex_lock(&gd->clut_lock);
+  gd->cluts = g_list_prepend(gd->cluts, entry);
+  _clut_trim(gd);
+  dt_pthread_mutex_unlock(&gd->clut_lock);
+  return entry;
+}
+
 #ifdef HAVE_GMIC
 static gboolean list_match_string(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, dt_iop_lut3d_gui_data_t *g)
 {
@@ -1378,16 +1513,23 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 {
   dt_iop_lut3d_params_t *p = (dt_iop_lut3d_params_t *)p1;
   dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;
+  dt_iop_lut3d_global_data_t *gd = (dt_iop_lut3d_global_data_t *)self->global_data;
 
   if (strcmp(p->filepath, d->params.filepath) != 0 || strcmp(p->lutname, d->params.lutname) != 0 )
   { // new clut file
-    if (d->clut)
+    if (d->cached)
     { // reset current clut if any
-      dt_free_align(d->clut);
+      _clut_release(gd, d->cached);
+      d->cached = NULL;
       d->clut = NULL;
       d->level = 0;
     }
-    d->level = calculate_clut(p, &d->clut);
+    d->cached = _clut_acquire(gd, p);
+    if(d->cached)
+    {
+      d->clut = d->cached->clut;
+      d->level = d->cached->level;
+    }
   }
   memcpy(&d->params, p, sizeof(dt_iop_lut3d_params_t));
 }
@@ -1399,15 +1541,17 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
   memcpy(&d->params, self->default_params, sizeof(dt_iop_lut3d_params_t));
   d->clut = NULL;
   d->level = 0;
+  d->cached = NULL;
   d->params.filepath[0] = '\0';
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;;
-  if (d->clut)
-    dt_free_align(d->clut);
+  dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;
+  if (d->cached)
+    _clut_release((dt_iop_lut3d_global_data_t *)self->global_data, d->cached);
+  d->cached = NULL;
   d->clut = NULL;
   d->level = 0;
   free(piece->data);
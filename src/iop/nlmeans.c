@@ -362,8 +362,12 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   return;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+// number of horizontal shift vectors handled in one pass over the image by nlmeans_denoise()
+#define NLMEANS_OFFSETS 4
+
+__DT_CLONE_TARGETS__
+static void nlmeans_denoise(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                            void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   // this is called for preview and full pipe separately, each with its own pixelpipe piece.
   // get our data struct:
@@ -383,15 +387,25 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   float nL = 1.0f / max_L, nC = 1.0f / max_C;
   const float norm2[4] = { nL * nL, nC * nC, nC * nC, 1.0f };
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
+  float *Sa = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)sizeof(float) * roi_out->width * NLMEANS_OFFSETS
+                                                        * dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
 
   // for each shift vector
   for(int kj = -K; kj <= K; kj++)
   {
-    for(int ki = -K; ki <= K; ki++)
+    // every row of shift vectors is a full pass over the image, give up early if the result is not wanted any more
+    if(dt_iop_process_cancelled(piece))
     {
+      dt_dev_pixelpipe_scratch_free(piece, Sa);
+      return;
+    }
+    // a group of up to NLMEANS_OFFSETS horizontal shifts shares one pass over the image: the output row is
+    // read and written once for all of them, and they are added per pixel in the same order as before
+    for(int ki0 = -K; ki0 <= K; ki0 += NLMEANS_OFFSETS)
+    {
+      const int nk = MIN(NLMEANS_OFFSETS, K - ki0 + 1);
       int inited_slide = 0;
 // don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else
 // we will add up errors)
@@ -399,16 +413,17 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 // memory
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(ivoid, norm2, ovoid, P, roi_in, roi_out, sharpness) \
+      dt_omp_firstprivate(ivoid, nk, norm2, ovoid, P, roi_in, roi_out, sharpness) \
       firstprivate(inited_slide) \
-      shared(kj, ki, Sa) \
+      shared(kj, ki0, Sa) \
       schedule(static)
 #endif
       for(int j = 0; j < roi_out->height; j++)
       {
         if(j + kj < 0 || j + kj >= roi_out->height) continue;
-        float *S = Sa + (size_t)dt_get_thread_num() * roi_out->width;
-        const float *ins = ((float *)ivoid) + 4 * ((size_t)roi_in->width * (j + kj) + ki);
+        // one column sum line per shift vector of the group
+        float *const Sg = Sa + (size_t)dt_get_thread_num() * roi_out->width * NLMEANS_OFFSETS;
+        const float *const ins = ((float *)ivoid) + 4 * ((size_t)roi_in->width * (j + kj) + ki0);
         float *out = ((float *)ovoid) + 4 * (size_t)roi_out->width * j;
 
         const int Pm = MIN(MIN(P, j + kj), j);
@@ -417,61 +432,74 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         // TODO: also every once in a while to assert numerical precision!
         if(!inited_slide)
         {
-          // sum up a line
-          memset(S, 0x0, sizeof(float) * roi_out->width);
-          for(int jj = -Pm; jj <= PM; jj++)
+          for(int n = 0; n < nk; n++)
           {
-            int i = MAX(0, -ki);
-            float *s = S + i;
-            const float *inp = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j + jj);
-            const float *inps = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j + jj + kj) + ki);
-            const int last = roi_out->width + MIN(0, -ki);
-            for(; i < last; i++, inp += 4, inps += 4, s++)
+            const int ki = ki0 + n;
+            float *const S = Sg + (size_t)n * roi_out->width;
+            // sum up a line
+            memset(S, 0x0, sizeof(float) * roi_out->width);
+            for(int jj = -Pm; jj <= PM; jj++)
             {
-              for(int k = 0; k < 3; k++) s[0] += (inp[k] - inps[k]) * (inp[k] - inps[k]) * norm2[k];
+              int i = MAX(0, -ki);
+              float *s = S + i;
+              const float *inp = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j + jj);
+              const float *inps = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j + jj + kj) + ki);
+              const int last = roi_out->width + MIN(0, -ki);
+              for(; i < last; i++, inp += 4, inps += 4, s++)
+              {
+                for(int k = 0; k < 3; k++) s[0] += (inp[k] - inps[k]) * (inp[k] - inps[k]) * norm2[k];
+              }
             }
           }
           // only reuse this if we had a full stripe
           if(Pm == P && PM == P) inited_slide = 1;
         }
 
-        // sliding window for this line:
-        float *s = S;
-        float slide = 0.0f;
+        // sliding windows for this line:
+        float slide[NLMEANS_OFFSETS] = { 0.0f };
         // sum up the first -P..P
-        for(int i = 0; i < 2 * P + 1; i++) slide += s[i];
-        for(int i = 0; i < roi_out->width; i++, s++, ins += 4, out += 4)
+        for(int n = 0; n < nk; n++)
+          for(int i = 0; i < 2 * P + 1; i++) slide[n] += Sg[(size_t)n * roi_out->width + i];
+        for(int i = 0; i < roi_out->width; i++, out += 4)
         {
-          if(i - P > 0 && i + P < roi_out->width) slide += s[P] - s[-P - 1];
-          if(i + ki >= 0 && i + ki < roi_out->width)
+          for(int n = 0; n < nk; n++)
           {
-            const float iv[4] = { ins[0], ins[1], ins[2], 1.0f };
-#if defined(_OPENMP) && defined(OPENMP_SIMD_)
-#pragma omp SIMD()
-#endif
-            for(size_t c = 0; c < 4; c++)
+            const int ki = ki0 + n;
+            const float *const s = Sg + (size_t)n * roi_out->width + i;
+            if(i - P > 0 && i + P < roi_out->width) slide[n] += s[P] - s[-P - 1];
+            if(i + ki >= 0 && i + ki < roi_out->width)
             {
-              out[c] += iv[c] * gh(slide, sharpness);
+              const float *const in = ins + 4 * (i + n);
+              const float iv[4] = { in[0], in[1], in[2], 1.0f };
+              const float w = gh(slide[n], sharpness);
+              for(size_t c = 0; c < 4; c++)
+              {
+                out[c] += iv[c] * w;
+              }
             }
           }
         }
         if(inited_slide && j + P + 1 + MAX(0, kj) < roi_out->height)
         {
           // sliding window in j direction:
-          int i = MAX(0, -ki);
-          s = S + i;
-          const float *inp = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j + P + 1);
-          const float *inps = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j + P + 1 + kj) + ki);
-          const float *inm = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j - P);
-          const float *inms = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j - P + kj) + ki);
-          const int last = roi_out->width + MIN(0, -ki);
-          for(; i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
+          for(int n = 0; n < nk; n++)
           {
-            float stmp = s[0];
-            for(int k = 0; k < 3; k++)
-              stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]))
-                      * norm2[k];
-            s[0] = stmp;
+            const int ki = ki0 + n;
+            int i = MAX(0, -ki);
+            float *s = Sg + (size_t)n * roi_out->width + i;
+            const float *inp = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j + P + 1);
+            const float *inps = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j + P + 1 + kj) + ki);
+            const float *inm = ((float *)ivoid) + 4 * i + 4 * (size_t)roi_in->width * (j - P);
+            const float *inms = ((float *)ivoid) + 4 * i + 4 * ((size_t)roi_in->width * (j - P + kj) + ki);
+            const int last = roi_out->width + MIN(0, -ki);
+            for(; i < last; i++, inp += 4, inps += 4, inm += 4, inms += 4, s++)
+            {
+              float stmp = s[0];
+              for(int k = 0; k < 3; k++)
+                stmp += ((inp[k] - inps[k]) * (inp[k] - inps[k]) - (inm[k] - inms[k]) * (inm[k] - inms[k]))
+                        * norm2[k];
+              s[0] = stmp;
+            }
           }
         }
         else
@@ -502,11 +530,27 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 
   // free shared tmp memory:
-  dt_free_align(Sa);
+  dt_dev_pixelpipe_scratch_free(piece, Sa);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  nlmeans_denoise(self, piece, ivoid, ovoid, roi_in, roi_out);
+}
+
+#if defined(__SSE__) && defined(DT_HAVE_CLONE_TARGETS)
+void process_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // nlmeans_denoise() is built with __DT_CLONE_TARGETS__, on this cpu it resolves to its avx2
+  // (or avx512f) clone, which lets the patch distance and accumulation loops use the wide registers
+  nlmeans_denoise(self, piece, ivoid, ovoid, roi_in, roi_out);
+}
+#endif
+
 #if defined(__SSE__)
 /** process, all real work is done here. */
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
@@ -528,13 +572,19 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
   float nL = 1.0f / max_L, nC = 1.0f / max_C;
   const float norm2[4] = { nL * nL, nC * nC, nC * nC, 1.0f };
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
+  float *Sa = dt_dev_pixelpipe_scratch_alloc(piece, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
 
   // for each shift vector
   for(int kj = -K; kj <= K; kj++)
   {
+    // every row of shift vectors is a full pass over the image, give up early if the result is not wanted any more
+    if(dt_iop_process_cancelled(piece))
+    {
+      dt_dev_pixelpipe_scratch_free(piece, Sa);
+      return;
+    }
     for(int ki = -K; ki <= K; ki++)
     {
       int inited_slide = 0;
@@ -697,7 +747,7 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
     }
   }
   // free shared tmp memory:
-  dt_free_align(Sa);
+  dt_dev_pixelpipe_scratch_free(piece, Sa);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
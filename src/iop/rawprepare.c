@@ -306,7 +306,35 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   const int csx = compute_proper_crop(piece, roi_in, d->x), csy = compute_proper_crop(piece, roi_in, d->y);
 
-  if(piece->pipe->dsc.filters && piece->dsc_in.channels == 1 && piece->dsc_in.datatype == TYPE_UINT16)
+  if(piece->pipe->dsc.filters && piece->dsc_in.channels == 1 && piece->dsc_in.datatype == TYPE_UINT16
+     && piece->dsc_out.datatype == TYPE_UINT16)
+  { // raw mosaic, kept as uint16 up to demosaic
+
+    const uint16_t *const in = (const uint16_t *const)ivoid;
+    uint16_t *const out = (uint16_t *const)ovoid;
+
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) \
+    dt_omp_firstprivate(csx, csy, d, in, out, roi_in, roi_out) \
+    schedule(static) \
+    collapse(2)
+#endif
+    for(int j = 0; j < roi_out->height; j++)
+    {
+      for(int i = 0; i < roi_out->width; i++)
+      {
+        const size_t pin = (size_t)(roi_in->width * (j + csy) + csx) + i;
+        const size_t pout = (size_t)j * roi_out->width + i;
+
+        const int id = BL(roi_out, d, j, i);
+        out[pout] = dt_raw_float_to_uint16((in[pin] - d->sub[id]) / d->div[id]);
+      }
+    }
+
+    piece->pipe->dsc.filters = dt_rawspeed_crop_dcraw_filters(self->dev->image_storage.buf_dsc.filters, csx, csy);
+    adjust_xtrans_filters(piece->pipe, csx, csy);
+  }
+  else if(piece->pipe->dsc.filters && piece->dsc_in.channels == 1 && piece->dsc_in.datatype == TYPE_UINT16)
   { // raw mosaic
 
     const uint16_t *const in = (const uint16_t *const)ivoid;
@@ -402,6 +430,13 @@ void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const vo
   // fprintf(stderr, "roi in %d %d %d %d\n", roi_in->x, roi_in->y, roi_in->width, roi_in->height);
   // fprintf(stderr, "roi out %d %d %d %d\n", roi_out->x, roi_out->y, roi_out->width, roi_out->height);
 
+  // the uint16 raw stage has no sse path
+  if(piece->dsc_out.datatype == TYPE_UINT16)
+  {
+    process(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
   const int csx = compute_proper_crop(piece, roi_in, d->x), csy = compute_proper_crop(piece, roi_in, d->y);
 
   if(piece->pipe->dsc.filters && piece->dsc_in.channels == 1 && piece->dsc_in.datatype == TYPE_UINT16)
@@ -689,6 +724,9 @@ void commit_params(dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelp
   d->rawprepare.raw_black_level = (uint16_t)(black / 4.0f);
   d->rawprepare.raw_white_point = p->raw_white_point;
 
+  // only the uint16 mosaic straight from the raw loader can be written as uint16
+  piece->process_uint16_ready = piece->pipe->dsc.filters && piece->pipe->image.buf_dsc.datatype == TYPE_UINT16;
+
   if(!(dt_image_is_rawprepare_supported(&piece->pipe->image)) || image_is_normalized(&piece->pipe->image)) piece->enabled = 0;
 }
 
@@ -128,6 +128,9 @@ typedef struct dt_iop_retouch_gui_data_t
   int preview_auto_levels;   // should we calculate levels automatically?
   float preview_levels[3];   // values for the levels
   int first_scale_visible;   // 1st scale visible at current zoom level
+  dt_dwt_cache_t *dwt_cache; // decomposition of the last full pipe run, NULL if disabled
+  guint interaction_timeout; // pending end of a slider or bar interaction
+  int interacting;           // the darkroom pipe works at the fit to screen scale meanwhile
 
   GtkLabel *label_form;                                                   // display number of forms
   GtkLabel *label_form_selected;                                          // display number of forms selected
@@ -1374,6 +1377,37 @@ static gboolean rt_wdbar_scrolled(GtkWidget *widget, GdkEventScroll *event, dt_i
   return TRUE;
 }
 
+#define RETOUCH_INTERACTION_TIMEOUT 300
+
+static gboolean rt_interaction_end(gpointer user_data)
+{
+  dt_iop_module_t *self = (dt_iop_module_t *)user_data;
+  dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
+
+  g->interaction_timeout = 0;
+  if(g->interacting)
+  {
+    // the pipe cache holds the output at the scale of the interaction, get the full one
+    g->interacting = 0;
+    dt_dev_reprocess_center(self->dev);
+  }
+  return FALSE;
+}
+
+// a single change is processed at full scale right away. only when the next one comes within
+// RETOUCH_INTERACTION_TIMEOUT ms, as when dragging a slider, the darkroom pipe falls back to the
+// scale of the whole image fitted to the screen until the changes stop.
+static void rt_interaction_start(dt_iop_module_t *self)
+{
+  dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
+  if(g->interaction_timeout)
+  {
+    g_source_remove(g->interaction_timeout);
+    g->interacting = 1;
+  }
+  g->interaction_timeout = g_timeout_add(RETOUCH_INTERACTION_TIMEOUT, rt_interaction_end, self);
+}
+
 static gboolean rt_wdbar_motion_notify(GtkWidget *widget, GdkEventMotion *event, dt_iop_module_t *self)
 {
   dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
@@ -1392,12 +1426,14 @@ static gboolean rt_wdbar_motion_notify(GtkWidget *widget, GdkEventMotion *event,
   if(g->is_dragging == DT_IOP_RETOUCH_WDBAR_DRAG_BOTTOM)
   {
     const int num_scales = rt_mouse_x_to_wdbar_box(g->wdbar_mouse_x, width);
+    rt_interaction_start(self);
     rt_num_scales_update(num_scales, self);
   }
 
   if(g->is_dragging == DT_IOP_RETOUCH_WDBAR_DRAG_TOP)
   {
     const int merge_from_scale = rt_mouse_x_to_wdbar_box(g->wdbar_mouse_x, width);
+    rt_interaction_start(self);
     rt_merge_from_scale_update(merge_from_scale, self);
   }
 
@@ -1627,6 +1663,7 @@ static void rt_preview_levels_update(const float levels[3], dt_iop_module_t *sel
 
   gtk_widget_queue_draw(g->preview_levels_bar);
 
+  rt_interaction_start(self);
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
@@ -2032,6 +2069,7 @@ static void rt_mask_opacity_callback(GtkWidget *slider, dt_iop_module_t *self)
     rt_masks_form_change_opacity(self, shape_id, opacity);
   }
 
+  rt_interaction_start(self);
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
@@ -2309,6 +2347,7 @@ static void rt_blur_radius_callback(GtkWidget *slider, dt_iop_module_t *self)
     }
   }
 
+  rt_interaction_start(self);
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
@@ -2356,6 +2395,7 @@ static void rt_fill_brightness_callback(GtkWidget *slider, dt_iop_module_t *self
     }
   }
 
+  rt_interaction_start(self);
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
@@ -2635,6 +2675,7 @@ void gui_init(dt_iop_module_t *self)
   dt_iop_retouch_params_t *p = (dt_iop_retouch_params_t *)self->params;
 
   dt_pthread_mutex_init(&g->lock, NULL);
+  g->dwt_cache = dt_conf_get_bool("plugins/darkroom/retouch/cache_wavelets") ? dt_dwt_cache_new() : NULL;
   change_image(self);
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
@@ -3007,6 +3048,8 @@ void gui_cleanup(dt_iop_module_t *self)
   dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
   if(g)
   {
+    if(g->interaction_timeout) g_source_remove(g->interaction_timeout);
+    dt_dwt_cache_free(g->dwt_cache);
     dt_pthread_mutex_destroy(&g->lock);
   }
   free(self->gui_data);
@@ -4414,9 +4457,43 @@ static void rt_process_forms(float *layer, dwt_params_t *const wt_p, const int s
   }
 }
 
+// scale of the darkroom pipe while sliders are dragged, relative to roi_in. 1 if we process as requested.
+static float rt_interaction_scale(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                  const dt_iop_roi_t *const roi_in)
+{
+  dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
+  if(!g || !g->interacting || !self->dev || piece->pipe != self->dev->pipe || !self->dev->pipe->processed_width)
+    return 1.f;
+
+  // the whole image fitted to the screen, what the preview pipe renders
+  const float scale = dt_dev_get_zoom_scale(self->dev, DT_ZOOM_FIT, 1, 0) / roi_in->scale;
+  // not worth the resampling when only slightly zoomed in
+  return (scale > 0.f && scale < 0.5f) ? scale : 1.f;
+}
+
+// roi_in and roi_out at the given scale, keeping roi_out inside roi_in
+static void rt_interaction_rois(const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                                const float scale, dt_iop_roi_t *roi_in_s, dt_iop_roi_t *roi_out_s)
+{
+  *roi_in_s = *roi_in;
+  roi_in_s->x = roi_in->x * scale;
+  roi_in_s->y = roi_in->y * scale;
+  roi_in_s->width = MAX(1, (int)(roi_in->width * scale));
+  roi_in_s->height = MAX(1, (int)(roi_in->height * scale));
+  roi_in_s->scale = roi_in->scale * scale;
+
+  *roi_out_s = *roi_out;
+  roi_out_s->x = roi_in_s->x + (int)((roi_out->x - roi_in->x) * scale);
+  roi_out_s->y = roi_in_s->y + (int)((roi_out->y - roi_in->y) * scale);
+  roi_out_s->width = CLAMP((int)(roi_out->width * scale), 1, roi_in_s->width - (roi_out_s->x - roi_in_s->x));
+  roi_out_s->height = CLAMP((int)(roi_out->height * scale), 1, roi_in_s->height - (roi_out_s->y - roi_in_s->y));
+  roi_out_s->scale = roi_out->scale * scale;
+}
+
+// scaled: runs at the scale of an interaction, don't touch what describes the full scale run
 static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                              void *const ovoid, const dt_iop_roi_t *const roi_in,
-                             const dt_iop_roi_t *const roi_out, const int use_sse)
+                             const dt_iop_roi_t *const roi_out, const int use_sse, const int scaled)
 {
   dt_iop_retouch_params_t *p = (dt_iop_retouch_params_t *)piece->data;
   dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
@@ -4456,6 +4533,10 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
                       roi_in->scale / piece->iscale, use_sse);
   if(dwt_p == NULL) goto cleanup;
 
+  // the darkroom pipe replays the last decomposition when only the shapes on the scales changed.
+  // the one of a scaled run would only evict the full scale one we are going to need next.
+  if(g && piece->pipe == self->dev->pipe && !scaled) dwt_p->cache = g->dwt_cache;
+
   // check if this module should expose mask.
   if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && g && g->mask_display && self->dev->gui_attached
      && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe))
@@ -4467,7 +4548,7 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     usr_data.mask_display = 1;
   }
 
-  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && !scaled)
   {
     // check if the image support this number of scales
     if(gui_active)
@@ -4538,17 +4619,48 @@ cleanup:
   if(dwt_p) dt_dwt_free(dwt_p);
 }
 
+// while sliders are dragged the darkroom pipe decomposes the image at the fit to screen scale and upscales
+// the result, the full scale follows once the interaction stopped
+static void process_interactive(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                const dt_iop_roi_t *const roi_out, const int use_sse)
+{
+  const float scale = rt_interaction_scale(self, piece, roi_in);
+  float *in_s = NULL, *out_s = NULL;
+  dt_iop_roi_t roi_in_s, roi_out_s;
+  if(scale < 1.f)
+  {
+    rt_interaction_rois(roi_in, roi_out, scale, &roi_in_s, &roi_out_s);
+    in_s = dt_alloc_align(64, (size_t)roi_in_s.width * roi_in_s.height * 4 * sizeof(float));
+    out_s = dt_alloc_align(64, (size_t)roi_out_s.width * roi_out_s.height * 4 * sizeof(float));
+  }
+  if(!in_s || !out_s)
+  {
+    if(in_s) dt_free_align(in_s);
+    if(out_s) dt_free_align(out_s);
+    process_internal(self, piece, ivoid, ovoid, roi_in, roi_out, use_sse, 0);
+    return;
+  }
+
+  dt_iop_clip_and_zoom_roi(in_s, ivoid, &roi_in_s, roi_in, roi_in_s.width, roi_in->width);
+  process_internal(self, piece, in_s, out_s, &roi_in_s, &roi_out_s, use_sse, 1);
+  dt_iop_clip_and_zoom_roi(ovoid, out_s, roi_out, &roi_out_s, roi_out->width, roi_out_s.width);
+
+  dt_free_align(in_s);
+  dt_free_align(out_s);
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  process_internal(self, piece, ivoid, ovoid, roi_in, roi_out, 0);
+  process_interactive(self, piece, ivoid, ovoid, roi_in, roi_out, 0);
 }
 
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  process_internal(self, piece, ivoid, ovoid, roi_in, roi_out, 1);
+  process_interactive(self, piece, ivoid, ovoid, roi_in, roi_out, 1);
 }
 #endif
 
@@ -5246,8 +5358,9 @@ static cl_int rt_process_forms_cl(cl_mem dev_layer, dwt_params_cl_t *const wt_p,
   return err;
 }
 
-int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
-               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+static int process_cl_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
+                               cl_mem dev_out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                               const int scaled)
 {
   dt_iop_retouch_params_t *p = (dt_iop_retouch_params_t *)piece->data;
   dt_iop_retouch_global_data_t *gd = (dt_iop_retouch_global_data_t *)self->global_data;
@@ -5323,7 +5436,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     usr_data.mask_display = 1;
   }
 
-  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && !scaled)
   {
     // check if the image support this number of scales
     if(gui_active)
@@ -5411,6 +5524,33 @@ cleanup:
 
   return (err == CL_SUCCESS) ? TRUE : FALSE;
 }
+
+// same as process_interactive()
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const float scale = rt_interaction_scale(self, piece, roi_in);
+  if(scale >= 1.f) return process_cl_internal(self, piece, dev_in, dev_out, roi_in, roi_out, 0);
+
+  const int devid = piece->pipe->devid;
+  dt_iop_roi_t roi_in_s, roi_out_s;
+  rt_interaction_rois(roi_in, roi_out, scale, &roi_in_s, &roi_out_s);
+
+  int ok = FALSE;
+  cl_mem dev_in_s = dt_opencl_alloc_device(devid, roi_in_s.width, roi_in_s.height, 4 * sizeof(float));
+  cl_mem dev_out_s = dt_opencl_alloc_device(devid, roi_out_s.width, roi_out_s.height, 4 * sizeof(float));
+  if(dev_in_s == NULL || dev_out_s == NULL) goto error;
+
+  if(dt_iop_clip_and_zoom_roi_cl(devid, dev_in_s, dev_in, &roi_in_s, roi_in) != CL_SUCCESS) goto error;
+  if(!process_cl_internal(self, piece, dev_in_s, dev_out_s, &roi_in_s, &roi_out_s, 1)) goto error;
+  if(dt_iop_clip_and_zoom_roi_cl(devid, dev_out, dev_out_s, roi_out, &roi_out_s) != CL_SUCCESS) goto error;
+  ok = TRUE;
+
+error:
+  if(dev_in_s) dt_opencl_release_mem_object(dev_in_s);
+  if(dev_out_s) dt_opencl_release_mem_object(dev_out_s);
+  return ok;
+}
 #endif
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -369,12 +369,23 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     const float sigma_s = sigma;
     const float detail = -1.0f; // we want the bilateral base layer
 
-    dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
-    if(!b) return;
-    dt_bilateral_splat(b, in);
-    dt_bilateral_blur(b);
+    // the grid does not depend on the shadows and highlights sliders, keep it for the interactive pipes
+    const gboolean keep_grid = (piece->pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW)) != 0;
+    const uint64_t hash
+        = keep_grid ? dt_dev_pixelpipe_cache_hash(piece->pipe->image.id, roi_in, piece->pipe, self->iop_order) : 0;
+    dt_bilateral_t *b = keep_grid ? dt_bilateral_cache_take(hash, width, height, sigma_s, sigma_r) : NULL;
+    if(!b)
+    {
+      b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+      if(!b) return;
+      dt_bilateral_splat(b, in);
+      dt_bilateral_blur(b);
+    }
     dt_bilateral_slice(b, in, out, detail);
-    dt_bilateral_free(b);
+    if(keep_grid)
+      dt_bilateral_cache_put(hash, sigma_s, sigma_r, b);
+    else
+      dt_bilateral_free(b);
   }
 
 // invert and desaturate
@@ -447,9 +447,55 @@ static void dt_wb_preset_interpolate(const wb_data *const p1, // the smaller tun
   }
 }
 
+static void _update_dsc(dt_dev_pixelpipe_iop_t *piece, const dt_iop_temperature_data_t *const d)
+{
+  piece->pipe->dsc.temperature.enabled = 1;
+  for(int k = 0; k < 4; k++)
+  {
+    piece->pipe->dsc.temperature.coeffs[k] = d->coeffs[k];
+    piece->pipe->dsc.processed_maximum[k] = d->coeffs[k] * piece->pipe->dsc.processed_maximum[k];
+  }
+}
+
+// the uint16 mosaic of the raw stage, see pixelpipe_raw_uint16
+static void _process_uint16(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
+                            const dt_iop_roi_t *const roi_out)
+{
+  const uint32_t filters = piece->pipe->dsc.filters;
+  const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->pipe->dsc.xtrans;
+  const dt_iop_temperature_data_t *const d = (dt_iop_temperature_data_t *)piece->data;
+
+  const uint16_t *const in = (const uint16_t *const)ivoid;
+  uint16_t *const out = (uint16_t *const)ovoid;
+
+#ifdef _OPENMP
+#pragma omp parallel for SIMD() default(none) \
+    dt_omp_firstprivate(d, filters, in, out, roi_out, xtrans) \
+    schedule(static) \
+    collapse(2)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      const size_t p = (size_t)j * roi_out->width + i;
+      const int c = (filters == 9u) ? FCxtrans(j, i, roi_out, xtrans) : FC(j + roi_out->y, i + roi_out->x, filters);
+      out[p] = dt_raw_float_to_uint16(dt_raw_uint16_to_float(in[p]) * d->coeffs[c]);
+    }
+  }
+
+  _update_dsc(piece, d);
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
+  if(piece->dsc_in.datatype == TYPE_UINT16)
+  {
+    _process_uint16(piece, ivoid, ovoid, roi_out);
+    return;
+  }
+
   const uint32_t filters = piece->pipe->dsc.filters;
   const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->pipe->dsc.xtrans;
   const dt_iop_temperature_data_t *const d = (dt_iop_temperature_data_t *)piece->data;
@@ -513,18 +559,19 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
   }
 
-  piece->pipe->dsc.temperature.enabled = 1;
-  for(int k = 0; k < 4; k++)
-  {
-    piece->pipe->dsc.temperature.coeffs[k] = d->coeffs[k];
-    piece->pipe->dsc.processed_maximum[k] = d->coeffs[k] * piece->pipe->dsc.processed_maximum[k];
-  }
+  _update_dsc(piece, d);
 }
 
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
+  if(piece->dsc_in.datatype == TYPE_UINT16)
+  {
+    _process_uint16(piece, ivoid, ovoid, roi_out);
+    return;
+  }
+
   const uint32_t filters = piece->pipe->dsc.filters;
   const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->pipe->dsc.xtrans;
   dt_iop_temperature_data_t *d = (dt_iop_temperature_data_t *)piece->data;
@@ -641,12 +688,7 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
     if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
   }
 
-  piece->pipe->dsc.temperature.enabled = 1;
-  for(int k = 0; k < 4; k++)
-  {
-    piece->pipe->dsc.temperature.coeffs[k] = d->coeffs[k];
-    piece->pipe->dsc.processed_maximum[k] = d->coeffs[k] * piece->pipe->dsc.processed_maximum[k];
-  }
+  _update_dsc(piece, d);
 }
 #endif
 
@@ -738,6 +780,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   // 4Bayer images not implemented in OpenCL yet
   if(self->dev->image_storage.flags & DT_IMAGE_4BAYER) piece->process_cl_ready = 0;
+
+  piece->process_uint16_ready = 1;
+  piece->process_pointwise = 1;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
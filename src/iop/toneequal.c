@@ -183,7 +183,15 @@ typedef struct dt_iop_toneequalizer_data_t
 
 typedef struct dt_iop_toneequalizer_global_data_t
 {
-  // TODO: put OpenCL kernels here at some point
+  int kernel_luminance_mask;
+  int kernel_interpolate_bilinear;
+  int kernel_variance_products;
+  int kernel_box_mean_x;
+  int kernel_box_mean_y;
+  int kernel_variance_solve;
+  int kernel_linear_blending;
+  int kernel_apply;
+  int kernel_show_luminance_mask;
 } dt_iop_toneequalizer_global_data_t;
 
 
@@ -1032,6 +1040,357 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
     toneeq_process(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
 
+#ifdef HAVE_OPENCL
+static inline cl_int box_average_cl(const int devid, const dt_iop_toneequalizer_global_data_t *const gd,
+                                    cl_mem image, cl_mem temp, const int width, const int height,
+                                    const int radius)
+{
+  // Compute in-place a box average on a 4-channel image, convolving along columns then rows
+  // like box_average() does on CPU
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_y, 0, sizeof(cl_mem), (void *)&image);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_y, 1, sizeof(cl_mem), (void *)&temp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_y, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_y, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_y, 4, sizeof(int), (void *)&radius);
+  const cl_int err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_box_mean_y, sizes);
+  if(err != CL_SUCCESS) return err;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_x, 0, sizeof(cl_mem), (void *)&temp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_x, 1, sizeof(cl_mem), (void *)&image);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_x, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_x, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_box_mean_x, 4, sizeof(int), (void *)&radius);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_box_mean_x, sizes);
+}
+
+
+static inline cl_int interpolate_bilinear_cl(const int devid, const dt_iop_toneequalizer_global_data_t *const gd,
+                                             cl_mem in, const int width_in, const int height_in,
+                                             cl_mem out, const int width_out, const int height_out)
+{
+  size_t sizes[] = { ROUNDUPWD(width_out), ROUNDUPHT(height_out), 1 };
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 0, sizeof(cl_mem), (void *)&in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 1, sizeof(int), (void *)&width_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 2, sizeof(int), (void *)&height_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 3, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 4, sizeof(int), (void *)&width_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_interpolate_bilinear, 5, sizeof(int), (void *)&height_out);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_interpolate_bilinear, sizes);
+}
+
+
+static inline cl_int linear_blending_cl(const int devid, const dt_iop_toneequalizer_global_data_t *const gd,
+                                        cl_mem image, cl_mem ab, cl_mem out, const int width, const int height,
+                                        const dt_iop_guided_filter_blending_t filter)
+{
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  const int geomean = (filter == DT_GF_BLENDING_GEOMEAN);
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_linear_blending, 0, sizeof(cl_mem), (void *)&image);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_linear_blending, 1, sizeof(cl_mem), (void *)&ab);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_linear_blending, 2, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_linear_blending, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_linear_blending, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_linear_blending, 5, sizeof(int), (void *)&geomean);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_linear_blending, sizes);
+}
+
+
+static cl_int fast_surface_blur_cl(const int devid, const dt_iop_toneequalizer_global_data_t *const gd,
+                                   cl_mem image, cl_mem out, const int width, const int height,
+                                   const int radius, const float feathering, const int iterations,
+                                   const dt_iop_guided_filter_blending_t filter,
+                                   const float quantization, const float quantize_min, const float quantize_max)
+{
+  // OpenCL version of fast_surface_blur() from common/fast_guided_filter.h, same downscaling,
+  // iterations and blending, except the filtered grey image is written to out.
+  // guided_filter_cl() from common/guided_filter.h is no fit here : it is guided by the RGB image
+  // and can't apply the a and b params to the unquantized or full-size mask.
+  const float scaling = 4.0f;
+  const int ds_radius = (radius < 4) ? 1 : radius / scaling;
+
+  const int ds_height = MAX((int)(height / scaling), 1);
+  const int ds_width = MAX((int)(width / scaling), 1);
+  size_t ds_sizes[] = { ROUNDUPWD(ds_width), ROUNDUPHT(ds_height), 1 };
+
+  cl_int err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+  cl_mem ds_image = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float));
+  cl_mem ds_image_tmp = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float));
+  cl_mem ds_var = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ds_ab = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ds_temp = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ab = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  if(ds_image == NULL || ds_image_tmp == NULL || ds_var == NULL || ds_ab == NULL || ds_temp == NULL || ab == NULL)
+    goto error;
+
+  // Downsample the image for speed-up
+  err = interpolate_bilinear_cl(devid, gd, image, width, height, ds_image, ds_width, ds_height);
+  if(err != CL_SUCCESS) goto error;
+
+  // Iterations of filter models the diffusion, sort of
+  for(int i = 0; i < iterations; ++i)
+  {
+    // (Re)build the mask from the quantized image to help guiding
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 0, sizeof(cl_mem), (void *)&ds_image);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 1, sizeof(cl_mem), (void *)&ds_var);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 2, sizeof(int), (void *)&ds_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 3, sizeof(int), (void *)&ds_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 4, sizeof(float), (void *)&quantization);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 5, sizeof(float), (void *)&quantize_min);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_products, 6, sizeof(float), (void *)&quantize_max);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_variance_products, ds_sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    // Perform the patch-wise variance analyse to get
+    // the a and b parameters for the linear blending s.t. mask = a * I + b
+    err = box_average_cl(devid, gd, ds_var, ds_temp, ds_width, ds_height, ds_radius);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_solve, 0, sizeof(cl_mem), (void *)&ds_var);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_solve, 1, sizeof(cl_mem), (void *)&ds_ab);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_solve, 2, sizeof(int), (void *)&ds_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_solve, 3, sizeof(int), (void *)&ds_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_variance_solve, 4, sizeof(float), (void *)&feathering);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_variance_solve, ds_sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    // Compute the patch-wise average of parameters a and b
+    err = box_average_cl(devid, gd, ds_ab, ds_temp, ds_width, ds_height, ds_radius);
+    if(err != CL_SUCCESS) goto error;
+
+    if(i != iterations - 1)
+    {
+      // Process the intermediate filtered image
+      err = linear_blending_cl(devid, gd, ds_image, ds_ab, ds_image_tmp, ds_width, ds_height,
+                               DT_GF_BLENDING_LINEAR);
+      if(err != CL_SUCCESS) goto error;
+
+      cl_mem swap = ds_image;
+      ds_image = ds_image_tmp;
+      ds_image_tmp = swap;
+    }
+  }
+
+  // Upsample the blending parameters a and b
+  err = interpolate_bilinear_cl(devid, gd, ds_ab, ds_width, ds_height, ab, width, height);
+  if(err != CL_SUCCESS) goto error;
+
+  // Finally, blend the guided image
+  err = linear_blending_cl(devid, gd, image, ab, out, width, height, filter);
+
+error:
+  dt_opencl_release_mem_object(ab);
+  dt_opencl_release_mem_object(ds_temp);
+  dt_opencl_release_mem_object(ds_ab);
+  dt_opencl_release_mem_object(ds_var);
+  dt_opencl_release_mem_object(ds_image_tmp);
+  dt_opencl_release_mem_object(ds_image);
+  return err;
+}
+
+
+static cl_int compute_luminance_mask_cl(const int devid, const dt_iop_toneequalizer_global_data_t *const gd,
+                                        cl_mem dev_in, cl_mem luminance, const int width, const int height,
+                                        const dt_iop_toneequalizer_data_t *const d)
+{
+  // Same as compute_luminance_mask(), contrast boosting is only done in DT_TONEEQ_GUIDED mode
+  const int guided = (d->details == DT_TONEEQ_AVG_GUIDED || d->details == DT_TONEEQ_GUIDED);
+  const int method = d->method;
+  const float fulcrum = (d->details == DT_TONEEQ_GUIDED) ? CONTRAST_FULCRUM : 0.0f;
+  const float contrast_boost = (d->details == DT_TONEEQ_GUIDED) ? d->contrast_boost : 1.0f;
+
+  cl_mem mask = luminance;
+  if(guided)
+  {
+    mask = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+    if(mask == NULL) return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+  }
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 1, sizeof(cl_mem), (void *)&mask);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 4, sizeof(int), (void *)&method);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 5, sizeof(float), (void *)&d->exposure_boost);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 6, sizeof(float), (void *)&fulcrum);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_luminance_mask, 7, sizeof(float), (void *)&contrast_boost);
+  cl_int err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_luminance_mask, sizes);
+
+  if(guided)
+  {
+    if(err == CL_SUCCESS)
+      err = fast_surface_blur_cl(devid, gd, mask, luminance, width, height, d->radius, d->feathering,
+                                 d->iterations,
+                                 (d->details == DT_TONEEQ_GUIDED) ? DT_GF_BLENDING_LINEAR : DT_GF_BLENDING_GEOMEAN,
+                                 d->quantization, exp2f(-14.0f), 4.0f);
+    dt_opencl_release_mem_object(mask);
+  }
+
+  return err;
+}
+
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_toneequalizer_data_t *const d = (const dt_iop_toneequalizer_data_t *const)piece->data;
+  const dt_iop_toneequalizer_global_data_t *const gd = (dt_iop_toneequalizer_global_data_t *)self->global_data;
+  dt_iop_toneequalizer_gui_data_t *const g = (dt_iop_toneequalizer_gui_data_t *)self->gui_data;
+
+  cl_int err = -999;
+  cl_mem luminance = NULL;
+  cl_mem dev_factors = NULL;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  // Sanity checks, let the CPU path deal with the odd cases
+  if(width < 1 || height < 1) return FALSE;
+  if(roi_in->width < roi_out->width || roi_in->height < roi_out->height) return FALSE;
+  if(piece->colors != 4) return FALSE;
+
+  // The output dimensions need to be smaller or equal to the input ones, see apply_exposure()
+  const int offset_x = (roi_in->x < roi_out->x) ? -roi_in->x + roi_out->x : 0;
+  const int offset_y = (roi_in->y < roi_out->y) ? -roi_in->y + roi_out->y : 0;
+  const int out_width = roi_out->width;
+  const int out_height = roi_out->height;
+  size_t sizes[] = { ROUNDUPWD(out_width), ROUNDUPHT(out_height), 1 };
+
+  if(!sanity_check(self))
+  {
+    // if module just got disabled by sanity checks, due to pipe position, just pass input through
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { out_width, out_height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  // Get the hash of the upstream pipe to track changes
+  const int position = self->iop_order;
+  const uint64_t hash = dt_dev_pixelpipe_cache_hash(piece->pipe->image.id, roi_out, piece->pipe, position);
+
+  if(self->dev->gui_attached)
+  {
+    // If the module instance has changed order in the pipe, invalidate the caches
+    if(g->pipe_order != position)
+    {
+      dt_pthread_mutex_lock(&g->lock);
+      g->ui_preview_hash = 0;
+      g->thumb_preview_hash = 0;
+      g->pipe_order = position;
+      g->luminance_valid = 0;
+      g->histogram_valid = 0;
+      dt_pthread_mutex_unlock(&g->lock);
+    }
+  }
+
+  // The luminance mask is computed on the device no matter what, it's cheaper than uploading the host cache
+  luminance = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(luminance == NULL)
+  {
+    err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+    goto error;
+  }
+
+  err = compute_luminance_mask_cl(devid, gd, dev_in, luminance, width, height, d);
+  if(err != CL_SUCCESS) goto error;
+
+  if(self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+  {
+    // For DT_DEV_PIXELPIPE_PREVIEW, the GUI reads the luminance mask on host to compute the image stats
+    // and the exposure under the cursor, so bring it back whenever upstream pipe state has changed
+    const size_t num_elem = (size_t)width * height;
+
+    dt_pthread_mutex_lock(&g->lock);
+    if(g->thumb_preview_buf_width != width || g->thumb_preview_buf_height != height)
+    {
+      if(g->thumb_preview_buf) dt_free_align(g->thumb_preview_buf);
+      g->thumb_preview_buf = dt_alloc_sse_ps(num_elem);
+      g->thumb_preview_buf_width = width;
+      g->thumb_preview_buf_height = height;
+      g->luminance_valid = FALSE;
+    }
+
+    if(g->thumb_preview_buf && (g->thumb_preview_hash != hash || !g->luminance_valid))
+    {
+      err = dt_opencl_read_host_from_device(devid, g->thumb_preview_buf, luminance, width, height, sizeof(float));
+      g->thumb_preview_hash = (err == CL_SUCCESS) ? hash : 0;
+      g->histogram_valid = FALSE;
+      g->luminance_valid = (err == CL_SUCCESS);
+    }
+    dt_pthread_mutex_unlock(&g->lock);
+
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  if(self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_FULL && g->mask_display)
+  {
+    // Display output
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 1, sizeof(cl_mem), (void *)&luminance);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 3, sizeof(int), (void *)&out_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 4, sizeof(int), (void *)&out_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 5, sizeof(int), (void *)&offset_x);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_show_luminance_mask, 6, sizeof(int), (void *)&offset_y);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_show_luminance_mask, sizes);
+    if(err != CL_SUCCESS) goto error;
+  }
+  else
+  {
+    dev_factors = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * PIXEL_CHAN, (void *)d->factors);
+    if(dev_factors == NULL)
+    {
+      err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+      goto error;
+    }
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 1, sizeof(cl_mem), (void *)&luminance);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 3, sizeof(int), (void *)&out_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 4, sizeof(int), (void *)&out_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 5, sizeof(int), (void *)&offset_x);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 6, sizeof(int), (void *)&offset_y);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 7, sizeof(cl_mem), (void *)&dev_factors);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_apply, 8, sizeof(float), (void *)&d->smoothing);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_apply, sizes);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  dt_opencl_release_mem_object(dev_factors);
+  dt_opencl_release_mem_object(luminance);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_factors);
+  dt_opencl_release_mem_object(luminance);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_toneequalizer] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  // the module is not tilable, this only tells the pipe how much memory to expect
+  tiling->factor = 4.0f; // in + out + luminance mask + guided filter params
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  tiling->overlap = 0;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
 
 void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                    const dt_iop_roi_t *roi_out, dt_iop_roi_t *roi_in)
@@ -1408,15 +1767,35 @@ static inline gboolean update_curve_lut(struct dt_iop_module_t *self)
 
 void init_global(dt_iop_module_so_t *module)
 {
+  const int program = 31; // toneequal.cl, from programs.conf
   dt_iop_toneequalizer_global_data_t *gd
       = (dt_iop_toneequalizer_global_data_t *)malloc(sizeof(dt_iop_toneequalizer_global_data_t));
 
   module->data = gd;
+  gd->kernel_luminance_mask = dt_opencl_create_kernel(program, "toneequalizer_luminance_mask");
+  gd->kernel_interpolate_bilinear = dt_opencl_create_kernel(program, "toneequalizer_interpolate_bilinear");
+  gd->kernel_variance_products = dt_opencl_create_kernel(program, "toneequalizer_variance_products");
+  gd->kernel_box_mean_x = dt_opencl_create_kernel(program, "toneequalizer_box_mean_x");
+  gd->kernel_box_mean_y = dt_opencl_create_kernel(program, "toneequalizer_box_mean_y");
+  gd->kernel_variance_solve = dt_opencl_create_kernel(program, "toneequalizer_variance_solve");
+  gd->kernel_linear_blending = dt_opencl_create_kernel(program, "toneequalizer_linear_blending");
+  gd->kernel_apply = dt_opencl_create_kernel(program, "toneequalizer_apply");
+  gd->kernel_show_luminance_mask = dt_opencl_create_kernel(program, "toneequalizer_show_luminance_mask");
 }
 
 
 void cleanup_global(dt_iop_module_so_t *module)
 {
+  dt_iop_toneequalizer_global_data_t *gd = (dt_iop_toneequalizer_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_luminance_mask);
+  dt_opencl_free_kernel(gd->kernel_interpolate_bilinear);
+  dt_opencl_free_kernel(gd->kernel_variance_products);
+  dt_opencl_free_kernel(gd->kernel_box_mean_x);
+  dt_opencl_free_kernel(gd->kernel_box_mean_y);
+  dt_opencl_free_kernel(gd->kernel_variance_solve);
+  dt_opencl_free_kernel(gd->kernel_linear_blending);
+  dt_opencl_free_kernel(gd->kernel_apply);
+  dt_opencl_free_kernel(gd->kernel_show_luminance_mask);
   free(module->data);
   module->data = NULL;
 }
@@ -128,6 +128,37 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
   return 1;
 }
 
+static inline void _velvia_pixel(const float *const in, float *const out, const float strength, const float bias)
+{
+  // calculate vibrance, and apply boost velvia saturation at least saturated pixels
+  float pmax = MAX(in[0], MAX(in[1], in[2])); // max value in RGB set
+  float pmin = MIN(in[0], MIN(in[1], in[2])); // min value in RGB set
+  float plum = (pmax + pmin) / 2.0f;          // pixel luminocity
+  float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
+                              : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+
+  float pweight = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - bias)))
+                             / (1.0f + (1.0f - bias)),
+                         0.0f, 1.0f);    // The weight of pixel
+  float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
+
+  // Apply velvia saturation values, in and out may be the same pixel
+  const float r = in[0], g = in[1], b = in[2];
+  out[0] = CLAMPS(r + saturation * (r - 0.5f * (g + b)), 0.0f, 1.0f);
+  out[1] = CLAMPS(g + saturation * (g - 0.5f * (b + r)), 0.0f, 1.0f);
+  out[2] = CLAMPS(b + saturation * (b - 0.5f * (r + g)), 0.0f, 1.0f);
+}
+
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *const buf,
+                    const size_t npixels)
+{
+  const dt_iop_velvia_data_t *const data = (dt_iop_velvia_data_t *)piece->data;
+  const float strength = data->strength / 100.0f;
+  if(strength <= 0.0) return;
+
+  for(size_t k = 0; k < npixels; k++) _velvia_pixel(buf + 4 * k, buf + 4 * k, strength, data->bias);
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -150,24 +181,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       const float *const in = (const float *const)ivoid + (size_t)ch * k;
       float *const out = (float *const)ovoid + (size_t)ch * k;
-
-      // calculate vibrance, and apply boost velvia saturation at least saturated pixels
-      float pmax = MAX(in[0], MAX(in[1], in[2])); // max value in RGB set
-      float pmin = MIN(in[0], MIN(in[1], in[2])); // min value in RGB set
-      float plum = (pmax + pmin) / 2.0f;          // pixel luminocity
-      float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
-                                  : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
-
-      float pweight
-          = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
-                       / (1.0f + (1.0f - data->bias)),
-                   0.0f, 1.0f);              // The weight of pixel
-      float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
-
-      // Apply velvia saturation values
-      out[0] = CLAMPS(in[0] + saturation * (in[0] - 0.5f * (in[1] + in[2])), 0.0f, 1.0f);
-      out[1] = CLAMPS(in[1] + saturation * (in[1] - 0.5f * (in[2] + in[0])), 0.0f, 1.0f);
-      out[2] = CLAMPS(in[2] + saturation * (in[2] - 0.5f * (in[0] + in[1])), 0.0f, 1.0f);
+      _velvia_pixel(in, out, strength, data->bias);
     }
   }
 
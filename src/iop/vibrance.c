@@ -92,6 +92,24 @@ void connect_key_accels(dt_iop_module_t *self)
                               GTK_WIDGET(g->amount_scale));
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *const buf,
+                    const size_t npixels)
+{
+  const dt_iop_vibrance_data_t *const d = (dt_iop_vibrance_data_t *)piece->data;
+  const float amount = (d->amount * 0.01);
+
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    /* saturation weight 0 - 1 */
+    float sw = sqrt((buf[k + 1] * buf[k + 1]) + (buf[k + 2] * buf[k + 2])) / 256.0;
+    float ls = 1.0 - ((amount * sw) * .25);
+    float ss = 1.0 + (amount * sw);
+    buf[k + 0] = buf[k + 0] * ls;
+    buf[k + 1] = buf[k + 1] * ss;
+    buf[k + 2] = buf[k + 2] * ss;
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
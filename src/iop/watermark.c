@@ -112,6 +112,32 @@ typedef struct dt_iop_watermark_gui_data_t
   GtkWidget *color_picker_button;
 } dt_iop_watermark_gui_data_t;
 
+// a rendered watermark: the svg document after variable substitution, scaled but not yet rotated or
+// placed on the image. parsing and rendering the svg has to be serialised, so processing stays
+// parallel only if each distinct watermark is rendered just once
+typedef struct dt_iop_watermark_raster_t
+{
+  gchar *svgdoc;
+  uint32_t hash; // of svgdoc
+  float scale;
+  RsvgDimensionData dimension;
+  int width;
+  int height;
+  int stride;
+  guint8 *pixels;
+  int refs;
+} dt_iop_watermark_raster_t;
+
+// how many unused rasters are kept around. at full resolution they are as large as the image, so this
+// only covers the darkroom pipes and one export size
+#define DT_IOP_WATERMARK_CACHED_RASTERS 3
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  GList *rasters; // of dt_iop_watermark_raster_t, most recently used first
+} dt_iop_watermark_global_data_t;
+
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
                   void *new_params, const int new_version)
 {
@@ -880,10 +906,76 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   return svgdoc;
 }
 
+static uint32_t _svgdoc_hash(const gchar *svgdoc)
+{
+  uint32_t hash = 5381;
+  for(const gchar *c = svgdoc; *c; c++) hash = ((hash << 5) + hash) ^ (unsigned char)*c;
+  return hash;
+}
+
+static void _raster_free(gpointer data)
+{
+  dt_iop_watermark_raster_t *raster = (dt_iop_watermark_raster_t *)data;
+  g_free(raster->svgdoc);
+  g_free(raster->pixels);
+  free(raster);
+}
+
+// drops the unused rasters beyond DT_IOP_WATERMARK_CACHED_RASTERS, least recently used first.
+// gd->lock has to be held.
+static void _raster_trim(dt_iop_watermark_global_data_t *gd)
+{
+  int unused = 0;
+  for(GList *l = gd->rasters; l; l = g_list_next(l))
+    if(((dt_iop_watermark_raster_t *)l->data)->refs == 0) unused++;
+
+  GList *l = g_list_last(gd->rasters);
+  while(l && unused > DT_IOP_WATERMARK_CACHED_RASTERS)
+  {
+    GList *prev = g_list_previous(l);
+    dt_iop_watermark_raster_t *raster = (dt_iop_watermark_raster_t *)l->data;
+    if(raster->refs == 0)
+    {
+      gd->rasters = g_list_delete_link(gd->rasters, l);
+      _raster_free(raster);
+      unused--;
+    }
+    l = prev;
+  }
+}
+
+static void _raster_release(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_raster_t *raster)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  raster->refs--;
+  _raster_trim(gd);
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+// looks up the raster of svgdoc at the given scale, a scale of 0 matches any. the returned raster has
+// to be released. gd->lock has to be held.
+static dt_iop_watermark_raster_t *_raster_find(dt_iop_watermark_global_data_t *gd, const gchar *svgdoc,
+                                               const uint32_t hash, const float scale)
+{
+  for(GList *l = gd->rasters; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_raster_t *raster = (dt_iop_watermark_raster_t *)l->data;
+    if(raster->hash == hash && (scale == 0.0f || raster->scale == scale) && !strcmp(raster->svgdoc, svgdoc))
+    {
+      raster->refs++;
+      gd->rasters = g_list_delete_link(gd->rasters, l);
+      gd->rasters = g_list_prepend(gd->rasters, raster);
+      return raster;
+    }
+  }
+  return NULL;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->global_data;
   float *in = (float *)ivoid;
   float *out = (float *)ovoid;
   const int ch = piece->colors;
@@ -896,6 +988,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
     return;
   }
+  const uint32_t hash = _svgdoc_hash(svgdoc);
 
   /* setup stride for performance */
   const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
@@ -908,34 +1001,52 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   {
     fprintf(stderr,"[watermark] Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
     g_free(image);
+    g_free(svgdoc);
     memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
     return;
   }
 
-  // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  /* the dimension of the svg is known if it has been rendered before at any scale */
+  RsvgDimensionData dimension;
+  RsvgHandle *svg = NULL;
 
-  /* create the rsvghandle from parsed svg data */
-  GError *error = NULL;
-  RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-  g_free(svgdoc);
-  if(!svg || error)
+  dt_pthread_mutex_lock(&gd->lock);
+  dt_iop_watermark_raster_t *raster = _raster_find(gd, svgdoc, hash, 0.0f);
+  if(raster)
   {
-    cairo_surface_destroy(surface);
-    g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    fprintf(stderr, "[watermark] error processing svg file: %s\n", error->message);
-    g_error_free(error);
-    return;
+    dimension = raster->dimension;
+    raster->refs--;
   }
+  dt_pthread_mutex_unlock(&gd->lock);
 
-  /* get the dimension of svg */
-  RsvgDimensionData dimension;
-  rsvg_handle_get_dimensions(svg, &dimension);
-  // if no text is given dimensions are null
-  if(!dimension.width) dimension.width = 1;
-  if(!dimension.height) dimension.height = 1;
+  // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
+  if(!raster)
+  {
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+
+    /* create the rsvghandle from parsed svg data */
+    GError *error = NULL;
+    svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
+    if(!svg || error)
+    {
+      cairo_surface_destroy(surface);
+      g_free(image);
+      g_free(svgdoc);
+      memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+      fprintf(stderr, "[watermark] error processing svg file: %s\n", error->message);
+      g_error_free(error);
+      return;
+    }
+
+    /* get the dimension of svg */
+    rsvg_handle_get_dimensions(svg, &dimension);
+    // if no text is given dimensions are null
+    if(!dimension.width) dimension.width = 1;
+    if(!dimension.height) dimension.height = 1;
+
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  }
 
   //  width/height of current (possibly cropped) image
   const float iw = piece->buf_in.width;
@@ -1023,30 +1134,87 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float svg_offset_x = ceilf(3.0f * scale);
   const float svg_offset_y = ceilf(3.0f * scale);
 
-  const int watermark_width =  (int)((dimension.width  * scale) + 3* svg_offset_x);
-  const int watermark_height = (int)((dimension.height * scale) + 3* svg_offset_y) ;
-
-  const int stride_two = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, watermark_width);
-  guint8 *image_two = (guint8 *)g_malloc0_n(watermark_height, stride_two);
+  /* the scaled watermark is taken from the cache, or rendered and added to it */
+  dt_pthread_mutex_lock(&gd->lock);
+  raster = _raster_find(gd, svgdoc, hash, scale);
+  dt_pthread_mutex_unlock(&gd->lock);
 
-  cairo_surface_t *surface_two = cairo_image_surface_create_for_data(image_two, CAIRO_FORMAT_ARGB32, watermark_width,
-                                                                 watermark_height, stride_two);
-  if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS) || (image_two == NULL))
+  if(!raster)
   {
-    fprintf(stderr,"[watermark] Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface_two)));
-    cairo_surface_destroy(surface);
-    g_object_unref(svg);
-    g_free(image);
-    g_free(image_two);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+    const int watermark_width =  (int)((dimension.width  * scale) + 3* svg_offset_x);
+    const int watermark_height = (int)((dimension.height * scale) + 3* svg_offset_y) ;
+
+    const int stride_two = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, watermark_width);
+    guint8 *image_two = (guint8 *)g_malloc0_n(watermark_height, stride_two);
+
+    cairo_surface_t *surface_two = cairo_image_surface_create_for_data(image_two, CAIRO_FORMAT_ARGB32,
+                                                                       watermark_width, watermark_height,
+                                                                       stride_two);
+    if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS) || (image_two == NULL))
+    {
+      fprintf(stderr,"[watermark] Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface_two)));
+      cairo_surface_destroy(surface);
+      cairo_surface_destroy(surface_two);
+      if(svg) g_object_unref(svg);
+      g_free(image);
+      g_free(image_two);
+      g_free(svgdoc);
+      memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+      return;
+    }
+
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+
+    if(!svg) svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), NULL);
+    if(svg)
+    {
+      /* create cairo context for the scaled watermark */
+      cairo_t *cr_two = cairo_create(surface_two);
+
+      // now set proper scale and translationfor the watermark itself
+      cairo_translate(cr_two, svg_offset_x,svg_offset_y);
+      cairo_scale(cr_two, scale, scale);
+      /* render svg into surface*/
+      rsvg_handle_render_cairo(svg, cr_two);
+      cairo_destroy(cr_two);
+      g_object_unref(svg);
+    }
+    cairo_surface_flush(surface_two);
+
+    // no more non-thread safe rsvg usage
     dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    return;
+
+    cairo_surface_destroy(surface_two);
+
+    raster = (dt_iop_watermark_raster_t *)malloc(sizeof(dt_iop_watermark_raster_t));
+    raster->svgdoc = svgdoc;
+    raster->hash = hash;
+    raster->scale = scale;
+    raster->dimension = dimension;
+    raster->width = watermark_width;
+    raster->height = watermark_height;
+    raster->stride = stride_two;
+    raster->pixels = image_two;
+    raster->refs = 1;
+    svgdoc = NULL;
+
+    dt_pthread_mutex_lock(&gd->lock);
+    gd->rasters = g_list_prepend(gd->rasters, raster);
+    _raster_trim(gd);
+    dt_pthread_mutex_unlock(&gd->lock);
   }
+  else if(svg)
+    g_object_unref(svg);
+
+  g_free(svgdoc);
+
+  /* the cached pixels are only read from here on, by any number of pipes at once */
+  cairo_surface_t *surface_two = cairo_image_surface_create_for_data(raster->pixels, CAIRO_FORMAT_ARGB32,
+                                                                     raster->width, raster->height,
+                                                                     raster->stride);
 
   /* create cairo context and setup transformation/scale */
   cairo_t *cr = cairo_create(surface);
-  /* create cairo context for the scaled watermark */
-  cairo_t *cr_two = cairo_create(surface_two);
 
   // compute bounding box of rotated watermark
   const float bb_width = fabsf(svg_width * cosf(angle)) + fabsf(svg_height * sinf(angle));
@@ -1088,21 +1256,12 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   cairo_rotate(cr, angle);
   cairo_translate(cr, -cX, -cY);
 
-  // now set proper scale and translationfor the watermark itself
-  cairo_translate(cr_two, svg_offset_x,svg_offset_y);
-  cairo_scale(cr_two, scale, scale);
-  /* render svg into surface*/
-  rsvg_handle_render_cairo(svg, cr_two);
-  cairo_surface_flush(surface_two);
-
   cairo_set_source_surface(cr, surface_two,-svg_offset_x,-svg_offset_y);
   cairo_paint(cr);
 
-  // no more non-thread safe rsvg usage
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-
   cairo_destroy(cr);
-  cairo_destroy(cr_two);
+  cairo_surface_destroy(surface_two);
+  _raster_release(gd, raster);
 
   /* ensure that all operations on surface finishing up */
   cairo_surface_flush(surface);
@@ -1133,10 +1292,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   /* clean up */
   cairo_surface_destroy(surface);
-  cairo_surface_destroy(surface_two);
-  g_object_unref(svg);
   g_free(image);
-  g_free(image_two);
 }
 
 static void watermark_callback(GtkWidget *tb, gpointer user_data)
@@ -1426,6 +1582,24 @@ void gui_update(struct dt_iop_module_t *self)
   gtk_font_chooser_set_font(GTK_FONT_CHOOSER(g->fontsel), p->font);
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd
+      = (dt_iop_watermark_global_data_t *)malloc(sizeof(dt_iop_watermark_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  gd->rasters = NULL;
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  g_list_free_full(gd->rasters, _raster_free);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   module->params = calloc(1, sizeof(dt_iop_watermark_params_t));
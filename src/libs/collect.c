@@ -22,6 +22,7 @@
 #include "common/debug.h"
 #include "common/film.h"
 #include "common/metadata.h"
+#include "common/selection.h"
 #include "common/utility.h"
 #include "common/history.h"
 #include "control/conf.h"
@@ -69,6 +70,12 @@ typedef struct dt_lib_collect_t
 
   gboolean singleclick;
   struct dt_lib_collect_params_t *params;
+
+  // rows of the queries already run, see _collect_rows_get()
+  GHashTable *rows_cache;
+  gchar *fetching;     // query being run in the background
+  guint fetch_version; // results of older fetches are dropped
+  int view_property;   // property the view shows, even when out of date
 } dt_lib_collect_t;
 
 typedef struct dt_lib_collect_params_rule_t
@@ -96,6 +103,22 @@ typedef enum dt_lib_collect_cols_t
   DT_LIB_COLLECT_NUM_COLS
 } dt_lib_collect_cols_t;
 
+// a result row of the queries of tree_view() and list_view()
+typedef struct _collect_row_t
+{
+  gchar *name;  // first column
+  gchar *name1; // second column as text
+  int id;       // second column
+  int count;    // third column
+} _collect_row_t;
+
+typedef struct _collect_fetch_t
+{
+  guint version;
+  gchar *query;
+  GPtrArray *rows;
+} _collect_fetch_t;
+
 typedef struct _range_t
 {
   gchar *start;
@@ -107,6 +130,7 @@ typedef struct _range_t
 static void _lib_collect_gui_update(dt_lib_module_t *self);
 static void _lib_folders_update_collection(const gchar *filmroll);
 static void entry_changed(GtkEntry *entry, dt_lib_collect_rule_t *dr);
+static void update_view(dt_lib_collect_rule_t *dr);
 static void collection_updated(gpointer instance, dt_collection_change_t query_change, gpointer imgs, int next,
                                gpointer self);
 static void row_activated_with_event(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *col, GdkEventButton *event, dt_lib_collect_t *d);
@@ -413,6 +437,7 @@ static void view_popup_menu_onRemove(GtkWidget *menuitem, gpointer userdata)
                             " WHERE film_id IN (SELECT id FROM main.film_rolls WHERE folder LIKE '%s%%')",
                             filmroll_path);
     DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq, NULL, NULL, NULL);
+    dt_selection_invalidate(darktable.selection);
 
     if (dt_control_remove_images())
     {
@@ -863,6 +888,7 @@ static void _lib_folders_update_collection(const gchar *filmroll)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    dt_selection_invalidate(darktable.selection);
 
     /* free allocated strings */
     g_free(complete_query);
@@ -1067,6 +1093,111 @@ void tree_count_show(GtkTreeViewColumn *col, GtkCellRenderer *renderer, GtkTreeM
   g_free(name);
 }
 
+static void _collect_row_free(gpointer data)
+{
+  _collect_row_t *row = (_collect_row_t *)data;
+  g_free(row->name);
+  g_free(row->name1);
+  free(row);
+}
+
+static void _collect_fetch_free(void *data)
+{
+  _collect_fetch_t *fetch = (_collect_fetch_t *)data;
+  g_free(fetch->query);
+  if(fetch->rows) g_ptr_array_unref(fetch->rows);
+  free(fetch);
+}
+
+// back on the gui thread, keep the rows and update the view which asked for them
+static gboolean _collect_fetch_done(gpointer user_data)
+{
+  _collect_fetch_t *fetch = (_collect_fetch_t *)user_data;
+  dt_lib_module_t *self = darktable.view_manager->proxy.module_collect.module;
+  dt_lib_collect_t *d = self ? (dt_lib_collect_t *)self->data : NULL;
+
+  // otherwise the tables have changed or another query has been asked for meanwhile
+  if(d && fetch->version == d->fetch_version)
+  {
+    g_hash_table_insert(d->rows_cache, fetch->query, fetch->rows);
+    fetch->query = NULL;
+    fetch->rows = NULL;
+    g_free(d->fetching);
+    d->fetching = NULL;
+
+    const int reset = darktable.gui->reset;
+    darktable.gui->reset = 1;
+    d->view_rule = -1;
+    update_view(d->rule + d->active_rule);
+    darktable.gui->reset = reset;
+  }
+  _collect_fetch_free(fetch);
+  return FALSE;
+}
+
+static int32_t _collect_fetch_job_run(dt_job_t *job)
+{
+  _collect_fetch_t *params = (_collect_fetch_t *)dt_control_job_get_params(job);
+  _collect_fetch_t *fetch = (_collect_fetch_t *)calloc(1, sizeof(_collect_fetch_t));
+  fetch->version = params->version;
+  fetch->query = g_strdup(params->query);
+  fetch->rows = g_ptr_array_new_with_free_func(_collect_row_free);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), fetch->query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    _collect_row_t *row = (_collect_row_t *)malloc(sizeof(_collect_row_t));
+    row->name = g_strdup((const char *)sqlite3_column_text(stmt, 0));
+    row->name1 = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+    row->id = sqlite3_column_int(stmt, 1);
+    row->count = sqlite3_column_int(stmt, 2);
+    g_ptr_array_add(fetch->rows, row);
+  }
+  sqlite3_finalize(stmt);
+
+  g_main_context_invoke(NULL, _collect_fetch_done, fetch);
+  return 0;
+}
+
+/* the rows of query. the counts over a large library take seconds, so they are queried by a background
+   job and kept until the tables change. returns NULL while they are on their way, the view is updated
+   again once they are there */
+static GPtrArray *_collect_rows_get(dt_lib_collect_t *d, const char *query)
+{
+  GPtrArray *rows = (GPtrArray *)g_hash_table_lookup(d->rows_cache, query);
+  if(rows || !g_strcmp0(d->fetching, query)) return rows;
+
+  dt_job_t *job = dt_control_job_create(&_collect_fetch_job_run, "collect counts");
+  if(!job) return NULL;
+  _collect_fetch_t *fetch = (_collect_fetch_t *)calloc(1, sizeof(_collect_fetch_t));
+  fetch->version = ++d->fetch_version;
+  fetch->query = g_strdup(query);
+  dt_control_job_set_params(job, fetch, _collect_fetch_free);
+
+  g_free(d->fetching);
+  d->fetching = g_strdup(query);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, job);
+  return NULL;
+}
+
+// forget the rows of the earlier queries, and drop those on their way
+static void _collect_rows_clear(dt_lib_collect_t *d)
+{
+  g_hash_table_remove_all(d->rows_cache);
+  g_free(d->fetching);
+  d->fetching = NULL;
+  d->fetch_version++;
+}
+
+// while the rows are fetched the view keeps showing the same property, out of date, or nothing
+static void _collect_view_wait(dt_lib_collect_t *d, const int property)
+{
+  if(d->view_property == property) return;
+  gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
+  gtk_widget_hide(GTK_WIDGET(d->sw2));
+}
+
 static const char *UNCATEGORIZED_TAG = N_("uncategorized");
 static void tree_view(dt_lib_collect_rule_t *dr)
 {
@@ -1087,19 +1218,13 @@ static void tree_view(dt_lib_collect_rule_t *dr)
   if(d->view_rule != property)
   {
     // tree creation/recreation
-    sqlite3_stmt *stmt;
     GtkTreeIter uncategorized = { 0 };
     GtkTreeIter temp;
 
-    g_object_ref(model);
-    g_object_unref(d->treefilter);
-    gtk_tree_view_set_model(GTK_TREE_VIEW(d->view), NULL);
-    gtk_tree_store_clear(GTK_TREE_STORE(model));
-    gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
-    gtk_widget_hide(GTK_WIDGET(d->sw2));
-
     /* query construction */
     gchar *where_ext = dt_collection_get_extended_where(darktable.collection, dr->num);
+    // without other rules the tags are counted over the whole library, which tag_counts has ready
+    const gboolean unrestricted = !g_strcmp0(where_ext, "(1=1)");
     gchar *query = g_strdup_printf(
       folders ?
         "SELECT folder, film_rolls_id, COUNT(*) AS count"
@@ -1108,6 +1233,13 @@ static void tree_view(dt_lib_collect_rule_t *dr)
         "   ON film_id = film_rolls_id "
         " WHERE %s"
         " GROUP BY folder, film_rolls_id":
+      tags && unrestricted ?
+        "SELECT name, tagid, count"
+        " FROM main.tag_counts"
+        " JOIN data.tags"
+        "   ON id = tagid"
+        " WHERE %s"
+        " ORDER BY name, tagid" :
       tags ?
         "SELECT name, tag_id, COUNT(*) AS count"
         " FROM main.images AS mi"
@@ -1132,7 +1264,20 @@ static void tree_view(dt_lib_collect_rule_t *dr)
 
     g_free(where_ext);
 
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    GPtrArray *rows = _collect_rows_get(d, query);
+    g_free(query);
+    if(!rows)
+    {
+      _collect_view_wait(d, property);
+      return;
+    }
+
+    g_object_ref(model);
+    g_object_unref(d->treefilter);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(d->view), NULL);
+    gtk_tree_store_clear(GTK_TREE_STORE(model));
+    gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
+    gtk_widget_hide(GTK_WIDGET(d->sw2));
 
     char **last_tokens = NULL;
     int last_tokens_length = 0;
@@ -1141,13 +1286,14 @@ static void tree_view(dt_lib_collect_rule_t *dr)
     // we need to sort the names ourselves and not let sqlite handle this
     // because it knows nothing about path separators.
     GList *sorted_names = NULL;
-    while(sqlite3_step(stmt) == SQLITE_ROW)
+    for(int k = 0; k < rows->len; k++)
     {
-      char *name = g_strdup((const char *)sqlite3_column_text(stmt, 0));
+      const _collect_row_t *row = (_collect_row_t *)g_ptr_array_index(rows, k);
+      char *name = g_strdup(row->name);
       char *name_folded = g_utf8_casefold(name, -1);
       gchar *collate_key = NULL;
 
-      const int count = sqlite3_column_int(stmt, 2);
+      const int count = row->count;
 
       if(folders)
       {
@@ -1164,8 +1310,6 @@ static void tree_view(dt_lib_collect_rule_t *dr)
       tuple->count = count;
       sorted_names = g_list_prepend(sorted_names, tuple);
     }
-    sqlite3_finalize(stmt);
-    g_free(query);
     sorted_names = g_list_sort(sorted_names,(sort_descend && (folders || days || times))
         ? neg_sort_folder_tag : sort_folder_tag);
 
@@ -1305,6 +1449,7 @@ static void tree_view(dt_lib_collect_rule_t *dr)
     g_object_unref(model);
     g_strfreev(last_tokens);
     d->view_rule = property;
+    d->view_property = property;
   }
 
   // if needed, we restrict the tree to matching entries
@@ -1363,49 +1508,19 @@ static void list_view(dt_lib_collect_rule_t *dr)
   GtkTreeModel *model = gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(d->listfilter));
   if(d->view_rule != property)
   {
-    sqlite3_stmt *stmt;
     GtkTreeIter iter;
-    g_object_unref(d->listfilter);
-    g_object_ref(model);
-    gtk_tree_view_set_model(GTK_TREE_VIEW(d->view), NULL);
-    gtk_list_store_clear(GTK_LIST_STORE(model));
-    gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
-    gtk_widget_hide(GTK_WIDGET(d->sw2));
     gchar *where_ext = dt_collection_get_extended_where(darktable.collection, dr->num);
 
     char query[1024] = { 0 };
 
     switch(property)
     {
-      case DT_COLLECTION_PROP_CAMERA:; // camera
-        int index = 0;
-        gchar *makermodel_query = NULL;
-        makermodel_query = dt_util_dstrcat(makermodel_query, "SELECT maker, model, COUNT(*) AS count "
-                "FROM main.images AS mi WHERE %s GROUP BY maker, model", where_ext);
-
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                makermodel_query,
-                                -1, &stmt, NULL);
-
-        while(sqlite3_step(stmt) == SQLITE_ROW)
-        {
-          char *exif_maker = (char *)sqlite3_column_text(stmt, 0);
-          char *exif_model = (char *)sqlite3_column_text(stmt, 1);
-          const int count = sqlite3_column_int(stmt, 2);
-
-          gchar *value =  dt_collection_get_makermodel(exif_maker, exif_model);
-
-          gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-          gtk_list_store_set(GTK_LIST_STORE(model), &iter, DT_LIB_COLLECT_COL_TEXT, value,
-                             DT_LIB_COLLECT_COL_ID, index, DT_LIB_COLLECT_COL_TOOLTIP, value,
-                             DT_LIB_COLLECT_COL_PATH, value, DT_LIB_COLLECT_COL_VISIBLE, TRUE,
-                             DT_LIB_COLLECT_COL_COUNT, count,
-                             -1);
-
-          g_free(value);
-          index++;
-        }
-        g_free(makermodel_query);
+      case DT_COLLECTION_PROP_CAMERA: // camera
+        g_snprintf(query, sizeof(query),
+                   "SELECT maker, model, COUNT(*) AS count"
+                   " FROM main.images AS mi"
+                   " WHERE %s"
+                   " GROUP BY maker, model", where_ext);
         break;
 
       case DT_COLLECTION_PROP_HISTORY: // History
@@ -1632,12 +1747,43 @@ static void list_view(dt_lib_collect_rule_t *dr)
 
     g_free(where_ext);
 
-    if(strlen(query) > 0)
+    GPtrArray *rows = NULL;
+    if(strlen(query) > 0 && !(rows = _collect_rows_get(d, query)))
     {
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-      while(sqlite3_step(stmt) == SQLITE_ROW)
+      _collect_view_wait(d, property);
+      return;
+    }
+
+    g_object_unref(d->listfilter);
+    g_object_ref(model);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(d->view), NULL);
+    gtk_list_store_clear(GTK_LIST_STORE(model));
+    gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
+    gtk_widget_hide(GTK_WIDGET(d->sw2));
+
+    if(rows && property == DT_COLLECTION_PROP_CAMERA)
+    {
+      for(int k = 0; k < rows->len; k++)
+      {
+        const _collect_row_t *row = (_collect_row_t *)g_ptr_array_index(rows, k);
+        gchar *value = dt_collection_get_makermodel(row->name, row->name1);
+
+        gtk_list_store_append(GTK_LIST_STORE(model), &iter);
+        gtk_list_store_set(GTK_LIST_STORE(model), &iter, DT_LIB_COLLECT_COL_TEXT, value,
+                           DT_LIB_COLLECT_COL_ID, k, DT_LIB_COLLECT_COL_TOOLTIP, value,
+                           DT_LIB_COLLECT_COL_PATH, value, DT_LIB_COLLECT_COL_VISIBLE, TRUE,
+                           DT_LIB_COLLECT_COL_COUNT, row->count,
+                           -1);
+
+        g_free(value);
+      }
+    }
+    else if(rows)
+    {
+      for(int k = 0; k < rows->len; k++)
       {
-        const char *folder = (const char *)sqlite3_column_text(stmt, 0);
+        const _collect_row_t *row = (_collect_row_t *)g_ptr_array_index(rows, k);
+        const char *folder = row->name;
         if(folder == NULL) continue; // safeguard against degenerated db entries
 
         gtk_list_store_append(GTK_LIST_STORE(model), &iter);
@@ -1645,8 +1791,8 @@ static void list_view(dt_lib_collect_rule_t *dr)
         {
           folder = dt_image_film_roll_name(folder);
         }
-        gchar *value = (gchar *)sqlite3_column_text(stmt, 0);
-        const int count = sqlite3_column_int(stmt, 2);
+        gchar *value = row->name;
+        const int count = row->count;
 
         // replace invalid utf8 characters if any
         gchar *text = g_strdup(value);
@@ -1656,14 +1802,13 @@ static void list_view(dt_lib_collect_rule_t *dr)
         gchar *escaped_text = g_markup_escape_text(text, -1);
 
         gtk_list_store_set(GTK_LIST_STORE(model), &iter, DT_LIB_COLLECT_COL_TEXT, folder,
-                           DT_LIB_COLLECT_COL_ID, sqlite3_column_int(stmt, 1), DT_LIB_COLLECT_COL_TOOLTIP,
+                           DT_LIB_COLLECT_COL_ID, row->id, DT_LIB_COLLECT_COL_TOOLTIP,
                            escaped_text, DT_LIB_COLLECT_COL_PATH, value, DT_LIB_COLLECT_COL_VISIBLE, TRUE,
                            DT_LIB_COLLECT_COL_COUNT, count,
                            -1);
         g_free(text);
         g_free(escaped_text);
       }
-      sqlite3_finalize(stmt);
     }
 
     gtk_tree_view_set_tooltip_column(GTK_TREE_VIEW(d->view), DT_LIB_COLLECT_COL_TOOLTIP);
@@ -1689,6 +1834,7 @@ static void list_view(dt_lib_collect_rule_t *dr)
     g_object_unref(model);
 
     d->view_rule = property;
+    d->view_property = property;
   }
 
   // if needed, we restrict the tree to matching entries
@@ -2080,6 +2226,9 @@ static void collection_updated(gpointer instance, dt_collection_change_t query_c
   dt_lib_module_t *dm = (dt_lib_module_t *)self;
   dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
 
+  // the images have changed, a new query or filter doesn't change the counts of the queries run so far
+  if(query_change == DT_COLLECTION_CHANGE_RELOAD) _collect_rows_clear(d);
+
   // update tree
   d->view_rule = -1;
   d->rule[d->active_rule].typing = FALSE;
@@ -2089,6 +2238,8 @@ static void collection_updated(gpointer instance, dt_collection_change_t query_c
 
 static void filmrolls_updated(gpointer instance, gpointer self)
 {
+  dt_lib_module_t *dm = (dt_lib_module_t *)self;
+  _collect_rows_clear((dt_lib_collect_t *)dm->data);
   // TODO: We should update the count of images here
   _lib_collect_gui_update(self);
 }
@@ -2097,6 +2248,7 @@ static void filmrolls_imported(gpointer instance, int film_id, gpointer self)
 {
   dt_lib_module_t *dm = (dt_lib_module_t *)self;
   dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
+  _collect_rows_clear(d);
 
   // update tree
   d->view_rule = -1;
@@ -2108,6 +2260,7 @@ static void filmrolls_removed(gpointer instance, gpointer self)
 {
   dt_lib_module_t *dm = (dt_lib_module_t *)self;
   dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
+  _collect_rows_clear(d);
 
   // update tree
   if (d->view_rule != DT_COLLECTION_PROP_FOLDERS)
@@ -2122,6 +2275,7 @@ static void tag_changed(gpointer instance, gpointer self)
 {
   dt_lib_module_t *dm = (dt_lib_module_t *)self;
   dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
+  _collect_rows_clear(d);
 
   // update tree
   if(_combo_get_active_collection(GTK_COMBO_BOX(d->rule[d->active_rule].combo)) == DT_COLLECTION_PROP_TAG)
@@ -2136,6 +2290,7 @@ static void metadata_changed(gpointer instance, int type, gpointer self)
 {
   dt_lib_module_t *dm = (dt_lib_module_t *)self;
   dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
+  _collect_rows_clear(d);
   if(type != DT_METADATA_SIGNAL_NEW_VALUE)
   {
     // hidden metadata have changed - update the collection list
@@ -2289,6 +2444,19 @@ static gboolean popup_button_callback(GtkWidget *widget, GdkEventButton *event,
   return TRUE;
 }
 
+static void image_info_changed(gpointer instance, gpointer imgs, gpointer self)
+{
+  dt_lib_module_t *dm = (dt_lib_module_t *)self;
+  _collect_rows_clear((dt_lib_collect_t *)dm->data);
+}
+
+static void view_changed(gpointer instance, dt_view_t *old_view, dt_view_t *new_view, gpointer self)
+{
+  // the history may have changed in darkroom
+  dt_lib_module_t *dm = (dt_lib_module_t *)self;
+  _collect_rows_clear((dt_lib_collect_t *)dm->data);
+}
+
 static void view_set_click(gpointer instance, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
@@ -2307,6 +2475,8 @@ void gui_init(dt_lib_module_t *self)
   d->active_rule = 0;
   d->nb_rules = 0;
   d->params = (dt_lib_collect_params_t *)malloc(sizeof(dt_lib_collect_params_t));
+  d->rows_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+  d->view_property = -1;
   view_set_click(NULL, self);
 
   GtkBox *box;
@@ -2431,6 +2601,12 @@ void gui_init(dt_lib_module_t *self)
 
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_METADATA_CHANGED, G_CALLBACK(metadata_changed), self);
 
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, G_CALLBACK(image_info_changed),
+                            self);
+
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_VIEWMANAGER_VIEW_CHANGED, G_CALLBACK(view_changed),
+                            self);
+
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_PREFERENCES_CHANGE, G_CALLBACK(view_set_click), self);
 }
 
@@ -2445,9 +2621,14 @@ void gui_cleanup(dt_lib_module_t *self)
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(filmrolls_imported), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(filmrolls_removed), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(tag_changed), self);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(metadata_changed), self);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(image_info_changed), self);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(view_changed), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(view_set_click), self);
   darktable.view_manager->proxy.module_collect.module = NULL;
   free(d->params);
+  g_hash_table_destroy(d->rows_cache);
+  g_free(d->fetching);
 
   /* cleanup mem */
 
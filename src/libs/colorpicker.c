@@ -385,6 +385,7 @@ static void _add_sample(GtkButton *widget, gpointer self)
   int i;
 
   sample->locked = 0;
+  sample->hash = 0;
   sample->rgb.red = 0.7;
   sample->rgb.green = 0.7;
   sample->rgb.blue = 0.7;
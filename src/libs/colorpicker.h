@@ -43,6 +43,9 @@ typedef struct dt_colorpicker_sample_t
   float picked_color_lab_min[3];
   float picked_color_lab_max[3];
 
+  /** what the picked colors were taken from: pipe buffer, area and profiles, 0 when not yet picked */
+  uint64_t hash;
+
   /** The GUI elements */
   GtkWidget *container;
   GtkWidget *color_patch;
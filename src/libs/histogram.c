@@ -54,6 +54,17 @@ typedef enum dt_lib_histogram_waveform_type_t
 const gchar *dt_lib_histogram_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear" };
 const gchar *dt_lib_histogram_waveform_type_names[DT_LIB_HISTOGRAM_WAVEFORM_N] = { "overlaid", "parade" };
 
+// everything the cached scope surface depends on besides the pipe output
+typedef struct dt_lib_histogram_scope_key_t
+{
+  int width, height;
+  gboolean valid; // the preview pipe output belongs to the current image
+  dt_dev_scope_type_t scope_type;
+  dt_dev_histogram_type_t histogram_type;
+  dt_lib_histogram_waveform_type_t waveform_type;
+  gboolean red, green, blue;
+} dt_lib_histogram_scope_key_t;
+
 typedef struct dt_lib_histogram_t
 {
   float exposure, black;
@@ -64,6 +75,11 @@ typedef struct dt_lib_histogram_t
   gboolean red, green, blue;
   float type_x, mode_x, red_x, green_x, blue_x;
   float button_w, button_h, button_y, button_spacing;
+  // the scope drawn on a transparent background, only rebuilt when the preview pipe delivered new data or
+  // the way it is drawn changed. redraws for hovering and dragging just paint it
+  cairo_surface_t *scope;
+  gboolean scope_dirty;
+  dt_lib_histogram_scope_key_t scope_key;
 } dt_lib_histogram_t;
 
 const char *name(dt_lib_module_t *self)
@@ -96,6 +112,8 @@ int position()
 static void _lib_histogram_change_callback(gpointer instance, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
+  d->scope_dirty = TRUE;
   dt_control_queue_redraw_widget(self->widget);
 }
 
@@ -267,90 +285,53 @@ static gboolean _lib_histogram_configure_callback(GtkWidget *widget, GdkEventCon
   return TRUE;
 }
 
-static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gpointer user_data)
+// renders the histogram or waveform of the last preview pipe output into d->scope
+static void _lib_histogram_render_scope(dt_lib_histogram_t *d, const dt_lib_histogram_scope_key_t *key)
 {
-  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
-  dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
   dt_develop_t *dev = darktable.develop;
-
-  GtkAllocation allocation;
-  gtk_widget_get_allocation(widget, &allocation);
-  const int width = allocation.width, height = allocation.height;
+  const int width = key->width, height = key->height;
 
   dt_pthread_mutex_lock(&dev->preview_pipe_mutex);
 
   const int waveform_width = dev->histogram_waveform_width;
   const int waveform_height = dev->histogram_waveform_height;
   const gint waveform_stride = dev->histogram_waveform_stride;
-  const size_t histsize = dev->scope_type == DT_DEV_SCOPE_WAVEFORM
+  const size_t histsize = key->scope_type == DT_DEV_SCOPE_WAVEFORM
                             ? sizeof(uint8_t) * waveform_height * waveform_stride * 3
                             : 256 * 4 * sizeof(uint32_t); // histogram size is hardcoded :(
   void *buf = dt_alloc_align(64, histsize);
 
   if(buf)
   {
-    if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
+    if(key->scope_type == DT_DEV_SCOPE_WAVEFORM)
       memcpy(buf, dev->histogram_waveform, histsize);
     else
       memcpy(buf, dev->histogram, histsize);
   }
 
   dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
-  if(buf == NULL) return FALSE;
-
-  cairo_surface_t *cst = dt_cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-  cairo_t *cr = cairo_create(cst);
+  if(buf == NULL) return;
 
-  gtk_render_background(gtk_widget_get_style_context(widget), cr, 0, 0, width, height);
-  cairo_set_line_width(cr, DT_PIXEL_APPLY_DPI(.5)); // borders width
-
-  // Draw frame and background
-  cairo_save(cr);
-  cairo_rectangle(cr, 0, 0, width, height);
-  set_color(cr, darktable.bauhaus->graph_border);
-  cairo_stroke_preserve(cr);
-  set_color(cr, darktable.bauhaus->graph_bg);
-  cairo_fill(cr);
-  cairo_restore(cr);
-
-  // exposure change regions
-  if(d->highlight == DT_LIB_HISTOGRAM_HIGHLIGHT_BLACK_POINT)
+  if(d->scope && (d->scope_key.width != width || d->scope_key.height != height))
   {
-    cairo_set_source_rgb(cr, .5, .5, .5);
-    if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
-      cairo_rectangle(cr, 0, 7.0/9.0 * height, width, height);
-    else
-      cairo_rectangle(cr, 0, 0, 0.2 * width, height);
-    cairo_fill(cr);
-  }
-  else if(d->highlight == DT_LIB_HISTOGRAM_HIGHLIGHT_EXPOSURE)
-  {
-    cairo_set_source_rgb(cr, .5, .5, .5);
-    if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
-      cairo_rectangle(cr, 0, 0, width, 7.0/9.0 * height);
-    else
-      cairo_rectangle(cr, 0.2 * width, 0, width, height);
-    cairo_fill(cr);
+    cairo_surface_destroy(d->scope);
+    d->scope = NULL;
   }
+  if(!d->scope) d->scope = dt_cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cr = cairo_create(d->scope);
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
-  // draw grid
-  set_color(cr, darktable.bauhaus->graph_grid);
-
-  if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
-    dt_draw_waveform_lines(cr, 0, 0, width, height);
-  else
-    dt_draw_grid(cr, 4, 0, 0, width, height);
-
-  // draw histogram
-  if(dev->image_storage.id == dev->preview_pipe->output_imgid)
+  if(key->valid)
   {
     cairo_save(cr);
-    if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
+    if(key->scope_type == DT_DEV_SCOPE_WAVEFORM)
     {
       uint8_t *hist_wav = buf;
-      uint8_t mask[3] = { d->blue, d->green, d->red };
+      uint8_t mask[3] = { key->blue, key->green, key->red };
 
-      if(d->waveform_type == DT_LIB_HISTOGRAM_WAVEFORM_OVERLAID)
+      if(key->waveform_type == DT_LIB_HISTOGRAM_WAVEFORM_OVERLAID)
       {
         // NOTE: The nice way to do this would be to draw each color
         // channel separately, overlaid, via cairo. Unfortunately,
@@ -401,32 +382,117 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
     else if(dev->histogram_max)
     {
       uint32_t *hist = buf;
-      const float hist_max = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR ? dev->histogram_max
+      const float hist_max = key->histogram_type == DT_DEV_HISTOGRAM_LINEAR ? dev->histogram_max
                                                                             : logf(1.0 + dev->histogram_max);
       cairo_translate(cr, 0, height);
       cairo_scale(cr, width / 255.0, -(height - 10) / hist_max);
       cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
       cairo_set_line_width(cr, DT_PIXEL_APPLY_DPI(1.));
-      if(d->red)
+      if(key->red)
       {
         cairo_set_source_rgba(cr, 1., 0., 0., 0.5);
-        dt_draw_histogram_8(cr, hist, 4, 0, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
+        dt_draw_histogram_8(cr, hist, 4, 0, key->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
       }
-      if(d->green)
+      if(key->green)
       {
         cairo_set_source_rgba(cr, 0., 1., 0., 0.5);
-        dt_draw_histogram_8(cr, hist, 4, 1, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
+        dt_draw_histogram_8(cr, hist, 4, 1, key->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
       }
-      if(d->blue)
+      if(key->blue)
       {
         cairo_set_source_rgba(cr, 0., 0., 1., 0.5);
-        dt_draw_histogram_8(cr, hist, 4, 2, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
+        dt_draw_histogram_8(cr, hist, 4, 2, key->histogram_type == DT_DEV_HISTOGRAM_LINEAR);
       }
       cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
     }
     cairo_restore(cr);
   }
 
+  cairo_destroy(cr);
+  dt_free_align(buf);
+}
+
+static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gpointer user_data)
+{
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
+  dt_develop_t *dev = darktable.develop;
+
+  GtkAllocation allocation;
+  gtk_widget_get_allocation(widget, &allocation);
+  const int width = allocation.width, height = allocation.height;
+
+  const dt_lib_histogram_scope_key_t key = { .width = width,
+                                             .height = height,
+                                             .valid = dev->image_storage.id == dev->preview_pipe->output_imgid,
+                                             .scope_type = dev->scope_type,
+                                             .histogram_type = dev->histogram_type,
+                                             .waveform_type = d->waveform_type,
+                                             .red = d->red,
+                                             .green = d->green,
+                                             .blue = d->blue };
+  if(d->scope_dirty || !d->scope || memcmp(&key, &d->scope_key, sizeof(key)))
+  {
+    _lib_histogram_render_scope(d, &key);
+    d->scope_key = key;
+    d->scope_dirty = FALSE;
+  }
+
+  cairo_surface_t *cst = dt_cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cr = cairo_create(cst);
+
+  gtk_render_background(gtk_widget_get_style_context(widget), cr, 0, 0, width, height);
+  cairo_set_line_width(cr, DT_PIXEL_APPLY_DPI(.5)); // borders width
+
+  // Draw frame and background
+  cairo_save(cr);
+  cairo_rectangle(cr, 0, 0, width, height);
+  set_color(cr, darktable.bauhaus->graph_border);
+  cairo_stroke_preserve(cr);
+  set_color(cr, darktable.bauhaus->graph_bg);
+  cairo_fill(cr);
+  cairo_restore(cr);
+
+  // exposure change regions
+  if(d->highlight == DT_LIB_HISTOGRAM_HIGHLIGHT_BLACK_POINT)
+  {
+    cairo_set_source_rgb(cr, .5, .5, .5);
+    if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
+      cairo_rectangle(cr, 0, 7.0/9.0 * height, width, height);
+    else
+      cairo_rectangle(cr, 0, 0, 0.2 * width, height);
+    cairo_fill(cr);
+  }
+  else if(d->highlight == DT_LIB_HISTOGRAM_HIGHLIGHT_EXPOSURE)
+  {
+    cairo_set_source_rgb(cr, .5, .5, .5);
+    if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
+      cairo_rectangle(cr, 0, 0, width, 7.0/9.0 * height);
+    else
+      cairo_rectangle(cr, 0.2 * width, 0, width, height);
+    cairo_fill(cr);
+  }
+
+  // draw grid
+  set_color(cr, darktable.bauhaus->graph_grid);
+
+  if(dev->scope_type == DT_DEV_SCOPE_WAVEFORM)
+    dt_draw_waveform_lines(cr, 0, 0, width, height);
+  else
+    dt_draw_grid(cr, 4, 0, 0, width, height);
+
+  // draw histogram
+  if(d->scope)
+  {
+    cairo_save(cr);
+    // the overlaid waveform and the histogram add up their channels, the parade is drawn over
+    if(!(dev->scope_type == DT_DEV_SCOPE_WAVEFORM && d->waveform_type == DT_LIB_HISTOGRAM_WAVEFORM_PARADE))
+      cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
+    cairo_set_source_surface(cr, d->scope, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+  }
+
   // buttons to control the display of the histogram: linear/log, r, g, b
   if(d->highlight != DT_LIB_HISTOGRAM_HIGHLIGHT_NONE)
   {
@@ -455,8 +521,6 @@ static gboolean _lib_histogram_draw_callback(GtkWidget *widget, cairo_t *crf, gp
   cairo_paint(crf);
   cairo_surface_destroy(cst);
 
-  dt_free_align(buf);
-
   return TRUE;
 }
 
@@ -809,6 +873,8 @@ void gui_cleanup(dt_lib_module_t *self)
   /* disconnect callback from  signal */
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_histogram_change_callback), self);
 
+  dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
+  if(d->scope) cairo_surface_destroy(d->scope);
   g_free(self->data);
   self->data = NULL;
 }
@@ -52,6 +52,8 @@ typedef struct dt_lib_history_t
   GList *previous_snapshot;
   int previous_history_end;
   GList *previous_iop_order_list;
+  // after_snapshot of the last undo record, the next one shares its unchanged items
+  GList *last_snapshot;
 } dt_lib_history_t;
 
 /* 3 widgets in each history line */
@@ -116,6 +118,7 @@ void gui_init(dt_lib_module_t *self)
   d->previous_snapshot = NULL;
   d->previous_history_end = 0;
   d->previous_iop_order_list = NULL;
+  d->last_snapshot = NULL;
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   dt_gui_add_help_link(self->widget, dt_get_help_url(self->plugin_name));
@@ -158,6 +161,7 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_history_change_callback), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_lib_history_module_remove_callback), self);
+  _snapshot_free(((dt_lib_history_t *)self->data)->last_snapshot);
   g_free(self->data);
   self->data = NULL;
 }
@@ -255,6 +259,84 @@ struct _cb_data
   int multi_priority;
 };
 
+// history items are never changed once they are in an undo snapshot (other than forgetting or finding their
+// module again, which holds for every snapshot alike), so consecutive snapshots share the items which are
+// equal at the same position and only the changed ones are copied. the undo snapshots don't belong to this
+// module's instance, they are freed by the undo list, so the number of snapshots holding every item is kept
+// here.
+static GHashTable *_snapshot_items = NULL;
+static GMutex _snapshot_items_lock;
+
+static int32_t _item_params_size(const dt_dev_history_item_t *item)
+{
+  if(item->module) return item->module->params_size;
+  const dt_iop_module_t *base = dt_iop_get_module(item->op_name);
+  return base ? base->params_size : 0;
+}
+
+static gboolean _item_equal(const dt_dev_history_item_t *a, const dt_dev_history_item_t *b)
+{
+  if(a->module != b->module || a->enabled != b->enabled || a->iop_order != b->iop_order
+     || a->multi_priority != b->multi_priority || a->num != b->num || a->focus_hash != b->focus_hash
+     || strcmp(a->op_name, b->op_name) || strcmp(a->multi_name, b->multi_name))
+    return FALSE;
+
+  return !memcmp(a->params, b->params, _item_params_size(a))
+         && !memcmp(a->blend_params, b->blend_params, sizeof(dt_develop_blend_params_t))
+         && dt_masks_forms_equal(a->forms, b->forms);
+}
+
+// a snapshot of hist, with the items equal to those at the same position of ref taken from there. size, if
+// given, grows by what had to be copied.
+static GList *_snapshot_share(GList *hist, GList *ref, size_t *size)
+{
+  GList *result = NULL;
+
+  g_mutex_lock(&_snapshot_items_lock);
+  if(!_snapshot_items) _snapshot_items = g_hash_table_new(NULL, NULL);
+
+  for(GList *h = g_list_first(hist), *r = g_list_first(ref); h; h = g_list_next(h), r = g_list_next(r))
+  {
+    dt_dev_history_item_t *item = (dt_dev_history_item_t *)h->data;
+    if(r && _item_equal(item, (dt_dev_history_item_t *)r->data))
+      item = (dt_dev_history_item_t *)r->data;
+    else
+    {
+      GList one = { .data = item, .next = NULL, .prev = NULL };
+      GList *copy = dt_history_duplicate(&one);
+      item = (dt_dev_history_item_t *)copy->data;
+      g_list_free(copy);
+      if(size)
+        *size += sizeof(dt_dev_history_item_t) + _item_params_size(item) + sizeof(dt_develop_blend_params_t)
+                 + dt_masks_forms_size(item->forms);
+    }
+    const int refs = GPOINTER_TO_INT(g_hash_table_lookup(_snapshot_items, item));
+    g_hash_table_insert(_snapshot_items, item, GINT_TO_POINTER(refs + 1));
+    result = g_list_prepend(result, item);
+  }
+
+  g_mutex_unlock(&_snapshot_items_lock);
+  return g_list_reverse(result);
+}
+
+static void _snapshot_free(GList *snapshot)
+{
+  g_mutex_lock(&_snapshot_items_lock);
+  for(GList *s = snapshot; s; s = g_list_next(s))
+  {
+    const int refs = GPOINTER_TO_INT(g_hash_table_lookup(_snapshot_items, s->data)) - 1;
+    if(refs > 0)
+      g_hash_table_insert(_snapshot_items, s->data, GINT_TO_POINTER(refs));
+    else
+    {
+      g_hash_table_remove(_snapshot_items, s->data);
+      dt_dev_free_history_item(s->data);
+    }
+  }
+  g_mutex_unlock(&_snapshot_items_lock);
+  g_list_free(snapshot);
+}
+
 static void _undo_items_cb(gpointer user_data, dt_undo_type_t type, dt_undo_data_t data)
 {
   struct _cb_data *udata = (struct _cb_data *)user_data;
@@ -633,8 +715,8 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
 static void _history_undo_data_free(gpointer data)
 {
   dt_undo_history_t *hist = (dt_undo_history_t *)data;
-  g_list_free_full(hist->before_snapshot, dt_dev_free_history_item);
-  g_list_free_full(hist->after_snapshot, dt_dev_free_history_item);
+  _snapshot_free(hist->before_snapshot);
+  _snapshot_free(hist->after_snapshot);
   g_list_free_full(hist->before_iop_order_list, free);
   g_list_free_full(hist->after_iop_order_list, free);
   free(data);
@@ -642,7 +724,11 @@ static void _history_undo_data_free(gpointer data)
 
 static void _lib_history_module_remove_callback(gpointer instance, dt_iop_module_t *module, gpointer user_data)
 {
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_history_t *d = (dt_lib_history_t *)self->data;
   dt_undo_iterate(darktable.undo, DT_UNDO_HISTORY, module, &_history_invalidate_cb);
+  // the undo list may have forgotten the record this one comes from
+  dt_dev_invalidate_history_module(d->last_snapshot, module);
 }
 
 static void _lib_history_will_change_callback(gpointer instance, GList *history, int history_end, GList *iop_order_list,
@@ -682,16 +768,23 @@ static void _lib_history_change_callback(gpointer instance, gpointer user_data)
   {
     /* record undo/redo history snapshot */
     dt_undo_history_t *hist = malloc(sizeof(dt_undo_history_t));
-    hist->before_snapshot = dt_history_duplicate(d->previous_snapshot);
+    size_t size = sizeof(dt_undo_history_t);
+    hist->before_snapshot = _snapshot_share(d->previous_snapshot, d->last_snapshot, &size);
     hist->before_end = d->previous_history_end;
     hist->before_iop_order_list = dt_ioppr_iop_order_copy_deep(d->previous_iop_order_list);
 
-    hist->after_snapshot = dt_history_duplicate(darktable.develop->history);
+    hist->after_snapshot = _snapshot_share(darktable.develop->history, hist->before_snapshot, &size);
     hist->after_end = darktable.develop->history_end;
     hist->after_iop_order_list = dt_ioppr_iop_order_copy_deep(darktable.develop->iop_order_list);
 
-    dt_undo_record(darktable.undo, self, DT_UNDO_HISTORY, (dt_undo_data_t)hist,
-                   _pop_undo, _history_undo_data_free);
+    size += (g_list_length(hist->before_iop_order_list) + g_list_length(hist->after_iop_order_list))
+            * (sizeof(dt_iop_order_entry_t) + sizeof(GList));
+
+    _snapshot_free(d->last_snapshot);
+    d->last_snapshot = _snapshot_share(hist->after_snapshot, hist->after_snapshot, NULL);
+
+    dt_undo_record_sized(darktable.undo, self, DT_UNDO_HISTORY, (dt_undo_data_t)hist, size,
+                         _pop_undo, _history_undo_data_free);
   }
   else
     d->record_undo = TRUE;
@@ -1188,21 +1188,15 @@ void dt_lib_connect_common_accels(dt_lib_module_t *module)
   }
   if(module->init_presets)
   {
-    sqlite3_stmt *stmt;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT name FROM data.presets WHERE operation=?1 "
-                                                               "AND op_version=?2 ORDER BY writeprotect DESC, "
-                                                               "name, rowid",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->plugin_name, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, module->version());
-    while(sqlite3_step(stmt) == SQLITE_ROW)
+    GList *names = dt_gui_presets_get_names(module->plugin_name, module->version());
+    for(const GList *n = names; n; n = g_list_next(n))
     {
       char path[1024];
-      snprintf(path, sizeof(path), "%s/%s", _("preset"), (char *)sqlite3_column_text(stmt, 0));
+      snprintf(path, sizeof(path), "%s/%s", _("preset"), (const char *)n->data);
       dt_accel_register_lib(module, path, 0, 0);
-      dt_accel_connect_preset_lib(module, (char *)sqlite3_column_text(stmt, 0));
+      dt_accel_connect_preset_lib(module, (const char *)n->data);
     }
-    sqlite3_finalize(stmt);
+    g_list_free_full(names, g_free);
   }
 }
 
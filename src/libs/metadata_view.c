@@ -39,6 +39,9 @@
 
 #define SHOW_FLAGS 1
 
+// delay in ms before the hovered image is shown, moving across the grid only updates once
+#define UPDATE_DELAY 50
+
 DT_MODULE(1)
 
 enum
@@ -154,6 +157,18 @@ typedef struct dt_lib_metadata_view_t
 {
   GtkLabel *name[md_size];
   GtkLabel *metadata[md_size];
+
+  guint update_timeout; // pending update, see _mouse_over_image_callback()
+  gboolean outdated;    // an update was skipped while the panel was not shown
+
+  // prepared once, these run for every hovered image
+  sqlite3_stmt *selected_stmt;
+  sqlite3_stmt *filmroll_stmt;
+  sqlite3_stmt *metadata_stmt;
+
+  // film roll of the last image
+  int32_t film_id;
+  char filmroll[512];
 } dt_lib_metadata_view_t;
 
 const char *name(dt_lib_module_t *self)
@@ -238,11 +253,8 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
     }
     else
     {
-      sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images LIMIT 1",
-                                  -1, &stmt, NULL);
-      if(sqlite3_step(stmt) == SQLITE_ROW) mouse_over_id = sqlite3_column_int(stmt, 0);
-      sqlite3_finalize(stmt);
+      if(sqlite3_step(d->selected_stmt) == SQLITE_ROW) mouse_over_id = sqlite3_column_int(d->selected_stmt, 0);
+      sqlite3_reset(d->selected_stmt);
     }
   }
 
@@ -266,7 +278,19 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
 
     /* update all metadata */
 
-    dt_image_film_roll(img, value, sizeof(value));
+    if(img->film_id != d->film_id)
+    {
+      // same as dt_image_film_roll()
+      DT_DEBUG_SQLITE3_BIND_INT(d->filmroll_stmt, 1, img->film_id);
+      if(sqlite3_step(d->filmroll_stmt) == SQLITE_ROW)
+        g_strlcpy(d->filmroll, dt_image_film_roll_name((const char *)sqlite3_column_text(d->filmroll_stmt, 0)),
+                  sizeof(d->filmroll));
+      else
+        g_strlcpy(d->filmroll, _("orphaned image"), sizeof(d->filmroll));
+      sqlite3_reset(d->filmroll_stmt);
+      d->film_id = img->film_id;
+    }
+    g_strlcpy(value, d->filmroll, sizeof(value));
     _metadata_update_value(d->metadata[md_internal_filmroll], value);
 
     char tooltip[512];
@@ -548,10 +572,20 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
     _metadata_update_value(d->metadata[md_width], value);
 
     /* XMP */
+    // all the values of the image at once, the first one of each key as dt_metadata_get() would
+    gchar *metadata[DT_METADATA_NUMBER] = { NULL };
+    DT_DEBUG_SQLITE3_BIND_INT(d->metadata_stmt, 1, img->id);
+    while(sqlite3_step(d->metadata_stmt) == SQLITE_ROW)
+    {
+      const int keyid = sqlite3_column_int(d->metadata_stmt, 0);
+      if(keyid >= 0 && keyid < DT_METADATA_NUMBER && !metadata[keyid])
+        metadata[keyid] = g_strdup((const char *)sqlite3_column_text(d->metadata_stmt, 1));
+    }
+    sqlite3_reset(d->metadata_stmt);
+
     for(unsigned int i = 0; i < DT_METADATA_NUMBER; i++)
     {
       const uint32_t keyid = dt_metadata_get_keyid_by_display_order(i);
-      const gchar *key = dt_metadata_get_key(keyid);
       const gchar *name = dt_metadata_get_name(keyid);
       gchar *setting = dt_util_dstrcat(NULL, "plugins/lighttable/metadata/%s_flag", name);
       const gboolean hidden = dt_conf_get_int(setting) & DT_METADATA_FLAG_HIDDEN;
@@ -567,18 +601,17 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
       {
         gtk_widget_show(GTK_WIDGET(d->name[md_xmp_metadata+i]));
         gtk_widget_show(GTK_WIDGET(d->metadata[md_xmp_metadata+i]));
-        GList *res = dt_metadata_get(img->id, key, NULL);
-        if(res)
+        if(metadata[keyid])
         {
-          g_strlcpy(value, (char *)res->data, sizeof(value));
+          g_strlcpy(value, metadata[keyid], sizeof(value));
           _filter_non_printable(value, sizeof(value));
-          g_list_free_full(res, &g_free);
         }
         else
           g_strlcpy(value, NODATA_STRING, sizeof(value));
       }
       _metadata_update_value(d->metadata[md_xmp_metadata+i], value);
     }
+    for(unsigned int i = 0; i < DT_METADATA_NUMBER; i++) g_free(metadata[i]);
 
     /* geotagging */
     /* latitude */
@@ -754,11 +787,47 @@ static gboolean _jump_to_accel(GtkAccelGroup *accel_group, GObject *acceleratabl
   return TRUE;
 }
 
+static gboolean _metadata_view_update_timeout(gpointer user_data)
+{
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  d->update_timeout = 0;
+
+  if(!dt_control_running()) return FALSE;
+
+  // nothing to see while collapsed or hidden, the update is done once shown again
+  if(!gtk_widget_get_mapped(self->widget))
+  {
+    d->outdated = TRUE;
+    return FALSE;
+  }
+  d->outdated = FALSE;
+  _metadata_view_update_values(self);
+  return FALSE;
+}
+
 /* callback for the mouse over image change signal */
 static void _mouse_over_image_callback(gpointer instance, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
-  if(dt_control_running()) _metadata_view_update_values(self);
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  // the hovered image can change for every thumbnail crossed, only the one the mouse stops on is shown
+  if(!d->update_timeout) d->update_timeout = g_timeout_add(UPDATE_DELAY, _metadata_view_update_timeout, self);
+}
+
+static void _filmrolls_changed_callback(gpointer instance, gpointer user_data)
+{
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  // a film roll may have been moved
+  d->film_id = -1;
+  _mouse_over_image_callback(instance, user_data);
+}
+
+static void _metadata_view_map(GtkWidget *widget, dt_lib_module_t *self)
+{
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  if(d->outdated) _mouse_over_image_callback(NULL, self);
 }
 
 void init_key_accels(dt_lib_module_t *self)
@@ -779,6 +848,15 @@ void gui_init(dt_lib_module_t *self)
   self->data = (void *)d;
   _lib_metatdata_view_init_labels();
 
+  d->film_id = -1;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images LIMIT 1",
+                              -1, &d->selected_stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT folder FROM main.film_rolls WHERE id = ?1",
+                              -1, &d->filmroll_stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT key, value FROM main.meta_data WHERE id = ?1 ORDER BY key, value", -1,
+                              &d->metadata_stmt, NULL);
+
   self->widget = gtk_grid_new();
   dt_gui_add_help_link(self->widget, dt_get_help_url(self->plugin_name));
   gtk_grid_set_column_spacing(GTK_GRID(self->widget), DT_PIXEL_APPLY_DPI(5));
@@ -805,6 +883,8 @@ void gui_init(dt_lib_module_t *self)
     gtk_grid_attach_next_to(GTK_GRID(self->widget), GTK_WIDGET(evb), GTK_WIDGET(name), GTK_POS_RIGHT, 1, 1);
   }
 
+  g_signal_connect(G_OBJECT(self->widget), "map", G_CALLBACK(_metadata_view_map), self);
+
   /* lets signup for mouse over image change signals */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_MOUSE_OVER_IMAGE_CHANGE,
                             G_CALLBACK(_mouse_over_image_callback), self);
@@ -821,11 +901,20 @@ void gui_init(dt_lib_module_t *self)
   /* signup for tags changes */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_TAG_CHANGED,
                             G_CALLBACK(_mouse_over_image_callback), self);
+
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
+                            G_CALLBACK(_filmrolls_changed_callback), self);
 }
 
 void gui_cleanup(dt_lib_module_t *self)
 {
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_mouse_over_image_callback), self);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_filmrolls_changed_callback), self);
+  if(d->update_timeout) g_source_remove(d->update_timeout);
+  sqlite3_finalize(d->selected_stmt);
+  sqlite3_finalize(d->filmroll_stmt);
+  sqlite3_finalize(d->metadata_stmt);
   g_free(self->data);
   self->data = NULL;
 }
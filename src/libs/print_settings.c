@@ -222,6 +222,7 @@ static int _print_job_run(dt_job_t *job)
   buf.levels = levels;
   buf.bpp = bpp;
   buf.write_image = write_image;
+  buf.write_image_begin = NULL;
 
   dt_print_format_t dat;
   dat.head.max_width = max_width;
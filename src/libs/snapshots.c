@@ -29,6 +29,10 @@
 #include "libs/lib.h"
 #include "libs/lib_api.h"
 
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
 DT_MODULE(1)
 
 #define DT_LIB_SNAPSHOTS_COUNT 4
@@ -41,6 +45,10 @@ typedef struct dt_lib_snapshot_t
   GtkWidget *button;
   float zoom_x, zoom_y, zoom_scale;
   int32_t zoom, closeup;
+  // the center view as it was drawn, kept in memory so showing it again is instant. filename
+  // only gets a copy of it when lua asks for it.
+  cairo_surface_t *surface;
+  gboolean written;
   char filename[512];
 } dt_lib_snapshot_t;
 
@@ -346,6 +354,7 @@ void gui_reset(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
   d->num_snapshots = 0;
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
   d->snapshot_image = NULL;
 
   for(uint32_t k = 0; k < d->size; k++)
@@ -425,6 +434,12 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
+  for(uint32_t k = 0; k < d->size; k++)
+  {
+    if(d->snapshot[k].surface) cairo_surface_destroy(d->snapshot[k].surface);
+    if(d->snapshot[k].written) g_unlink(d->snapshot[k].filename);
+  }
   g_free(d->snapshot);
 
   g_free(self->data);
@@ -455,6 +470,7 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   GtkWidget *b = d->snapshot[0].button;
   d->snapshot[0] = last;
   d->snapshot[0].button = b;
+  d->snapshot[0].written = FALSE;
   const gchar *name = _("original");
   if(darktable.develop->history_end > 0)
   {
@@ -483,7 +499,7 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   for(uint32_t k = 0; k < d->num_snapshots; k++) gtk_widget_show(d->snapshot[k].button);
 
   /* request a new snapshot for top slot */
-  dt_dev_snapshot_request(darktable.develop, (const char *)&d->snapshot[0].filename);
+  dt_dev_snapshot_request(darktable.develop, &d->snapshot[0].surface);
 }
 
 static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer user_data)
@@ -511,15 +527,22 @@ static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer us
     /* setup snapshot */
     d->selected = which;
     dt_lib_snapshot_t *s = d->snapshot + (which - 1);
-    dt_control_set_dev_zoom_y(s->zoom_y);
-    dt_control_set_dev_zoom_x(s->zoom_x);
-    dt_control_set_dev_zoom(s->zoom);
-    dt_control_set_dev_closeup(s->closeup);
-    dt_control_set_dev_zoom_scale(s->zoom_scale);
 
-    dt_dev_invalidate(darktable.develop);
+    // the main view only needs to be processed again if the snapshot was taken at another position
+    if(dt_control_get_dev_zoom_x() != s->zoom_x || dt_control_get_dev_zoom_y() != s->zoom_y
+       || dt_control_get_dev_zoom() != s->zoom || dt_control_get_dev_closeup() != s->closeup
+       || dt_control_get_dev_zoom_scale() != s->zoom_scale)
+    {
+      dt_control_set_dev_zoom_y(s->zoom_y);
+      dt_control_set_dev_zoom_x(s->zoom_x);
+      dt_control_set_dev_zoom(s->zoom);
+      dt_control_set_dev_closeup(s->closeup);
+      dt_control_set_dev_zoom_scale(s->zoom_scale);
+
+      dt_dev_invalidate(darktable.develop);
+    }
 
-    d->snapshot_image = dt_cairo_image_surface_create_from_png(s->filename);
+    if(s->surface) d->snapshot_image = cairo_surface_reference(s->surface);
   }
 
   /* redraw center view */
@@ -714,6 +737,15 @@ static int number_member(lua_State *L)
 }
 
 
+static cairo_status_t _write_snapshot_data(void *closure, const unsigned char *data, unsigned int length)
+{
+  const int fd = GPOINTER_TO_INT(closure);
+  ssize_t res = write(fd, data, length);
+  if(res != length)
+    return CAIRO_STATUS_WRITE_ERROR;
+  return CAIRO_STATUS_SUCCESS;
+}
+
 static int filename_member(lua_State *L)
 {
   dt_lua_snapshot_t index;
@@ -724,7 +756,18 @@ static int filename_member(lua_State *L)
   {
     return luaL_error(L, "Accessing a non-existent snapshot");
   }
-  lua_pushstring(L, d->snapshot[index].filename);
+  dt_lib_snapshot_t *s = d->snapshot + index;
+  if(!s->written && s->surface)
+  {
+    const int fd = g_open(s->filename, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0600);
+    if(fd >= 0)
+    {
+      s->written = cairo_surface_write_to_png_stream(s->surface, _write_snapshot_data, GINT_TO_POINTER(fd))
+                   == CAIRO_STATUS_SUCCESS;
+      close(fd);
+    }
+  }
+  lua_pushstring(L, s->filename);
   return 1;
 }
 static int name_member(lua_State *L)
@@ -27,6 +27,7 @@
 #include "gui/styles.h"
 #include "libs/lib.h"
 #include "libs/lib_api.h"
+#include "views/view.h"
 #ifdef GDK_WINDOWING_QUARTZ
 #include "osx/osx.h"
 #endif
@@ -195,7 +196,6 @@ static void _gui_styles_update_view(dt_lib_styles_t *d)
     g_list_free_full(result, dt_style_free);
   }
 
-  gtk_tree_view_set_tooltip_column(GTK_TREE_VIEW(d->tree), DT_STYLES_COL_TOOLTIP);
   gtk_tree_view_set_model(GTK_TREE_VIEW(d->tree), model);
   g_object_unref(model);
 }
@@ -391,9 +391,31 @@ static gboolean duplicate_callback(GtkEntry *entry, gpointer user_data)
 static void _styles_changed_callback(gpointer instance, gpointer user_data)
 {
   dt_lib_styles_t *d = (dt_lib_styles_t *)user_data;
+  dt_gui_styles_preview_flush();
   _gui_styles_update_view(d);
 }
 
+// the tooltip column plus a preview of the style on the image it would be applied to
+static gboolean _styles_query_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode,
+                                      GtkTooltip *tooltip, gpointer user_data)
+{
+  GtkTreeModel *model = NULL;
+  GtkTreePath *path = NULL;
+  GtkTreeIter iter;
+  if(!gtk_tree_view_get_tooltip_context(GTK_TREE_VIEW(widget), &x, &y, keyboard_mode, &model, &path, &iter))
+    return FALSE;
+
+  gchar *markup = NULL, *name = NULL;
+  gtk_tree_model_get(model, &iter, DT_STYLES_COL_TOOLTIP, &markup, DT_STYLES_COL_FULLNAME, &name, -1);
+  const gboolean res = dt_gui_styles_preview_tooltip(tooltip, name ? dt_view_get_image_to_act_on() : -1, name, markup);
+  if(res) gtk_tree_view_set_tooltip_row(GTK_TREE_VIEW(widget), tooltip, path);
+
+  gtk_tree_path_free(path);
+  g_free(markup);
+  g_free(name);
+  return res;
+}
+
 static void applymode_combobox_changed(GtkWidget *widget, gpointer user_data)
 {
   const int mode = dt_bauhaus_combobox_get(widget);
@@ -425,6 +447,7 @@ void gui_init(dt_lib_module_t *self)
   g_object_unref(treestore);
 
   gtk_widget_set_tooltip_text(GTK_WIDGET(d->tree), _("available styles,\ndoubleclick to apply"));
+  g_signal_connect(d->tree, "query-tooltip", G_CALLBACK(_styles_query_tooltip), d);
   g_signal_connect(d->tree, "row-activated", G_CALLBACK(_styles_row_activated_callback), d);
 
   /* filter entry */
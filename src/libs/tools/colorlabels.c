@@ -100,7 +100,7 @@ static void _lib_colorlabels_button_clicked_callback(GtkWidget *w, gpointer user
 {
   GList *imgs = dt_view_get_images_to_act_on(FALSE);
   dt_colorlabels_toggle_label_on_list(imgs, GPOINTER_TO_INT(user_data), TRUE);
-  dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, imgs);
+  dt_collection_update_query_images(darktable.collection, DT_COLLECTION_SORT_COLOR, imgs);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -198,7 +198,7 @@ static gboolean _lib_ratings_button_press_callback(GtkWidget *widget, GdkEventBu
   {
     GList *imgs = dt_view_get_images_to_act_on(FALSE);
     dt_ratings_apply_on_list(imgs, d->current, TRUE);
-    dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, imgs);
+    dt_collection_update_query_images(darktable.collection, DT_COLLECTION_SORT_RATING, imgs);
 
     dt_control_queue_redraw_center();
   }
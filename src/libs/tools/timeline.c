@@ -733,24 +733,44 @@ static int _block_get_at_zoom(dt_lib_module_t *self, int width)
   if(_time_compare_at_zoom(strip->start_t, strip->time_pos, strip->zoom) < 0) strip->start_x = -2;
   if(_time_compare_at_zoom(strip->stop_t, strip->time_pos, strip->zoom) < 0) strip->stop_x = -1;
 
+  // each row is a date with its number of images, in the library and in the collection.
+  // bars of a day or more are read from the per day counts maintained by the database triggers, only the
+  // images of the collection need to be grouped. finer bars need the time of each image
   sqlite3_stmt *stmt;
-  gchar *query = g_strdup_printf("SELECT db.datetime_taken, col.imgid FROM main.images AS db LEFT JOIN "
-                                 "memory.collected_images AS col ON db.id=col.imgid WHERE "
-                                 "LENGTH(db.datetime_taken) = 19 AND "
-                                 "db.datetime_taken > '%s' ORDER BY db.datetime_taken ASC",
-                                 _time_format_for_db(strip->time_pos, strip->zoom, TRUE));
+  gchar *from = _time_format_for_db(strip->time_pos, strip->zoom, TRUE);
+  gchar *query = NULL;
+  if(strip->zoom <= DT_LIB_TIMELINE_ZOOM_MONTH)
+    query = g_strdup_printf("SELECT d.day, d.count, IFNULL(c.count, 0) FROM main.images_day_counts AS d "
+                            "LEFT JOIN (SELECT SUBSTR(db.datetime_taken, 1, 10) AS day, COUNT(*) AS count "
+                            "           FROM main.images AS db, memory.collected_images AS col "
+                            "           WHERE db.id = col.imgid AND LENGTH(db.datetime_taken) = 19"
+                            "           GROUP BY day) AS c ON c.day = d.day "
+                            "WHERE d.day >= SUBSTR('%s', 1, 10) ORDER BY d.day ASC",
+                            from);
+  else
+    query = g_strdup_printf("SELECT db.datetime_taken, 1, col.imgid IS NOT NULL FROM main.images AS db LEFT JOIN "
+                            "memory.collected_images AS col ON db.id=col.imgid WHERE "
+                            "LENGTH(db.datetime_taken) = 19 AND "
+                            "db.datetime_taken > '%s' ORDER BY db.datetime_taken ASC",
+                            from);
+  g_free(from);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
 
   char *tx = "";
-  int id = 0;
+  int nb = 0, nb_collect = 0;
   int stat = sqlite3_step(stmt);
   if(stat == SQLITE_ROW)
   {
     tx = (char *)sqlite3_column_text(stmt, 0);
-    id = sqlite3_column_int(stmt, 1);
+    nb = sqlite3_column_int(stmt, 1);
+    nb_collect = sqlite3_column_int(stmt, 2);
   }
   else
+  {
+    sqlite3_finalize(stmt);
+    g_free(query);
     return 0;
+  }
 
   dt_lib_timeline_time_t tt = strip->time_pos;
   // we round correctly this date
@@ -813,11 +833,12 @@ static int _block_get_at_zoom(dt_lib_module_t *self, int width)
       // and we count how many photos we have for this time
       while(stat == SQLITE_ROW && _time_compare_at_zoom(tt, _time_get_from_db(tx, FALSE), strip->zoom) == 0)
       {
-        bloc->values[i]++;
-        if(id > 0) bloc->collect_values[i]++;
+        bloc->values[i] += nb;
+        bloc->collect_values[i] += nb_collect;
         stat = sqlite3_step(stmt);
         tx = (char *)sqlite3_column_text(stmt, 0);
-        id = sqlite3_column_int(stmt, 1);
+        nb = sqlite3_column_int(stmt, 1);
+        nb_collect = sqlite3_column_int(stmt, 2);
       }
 
       // and we jump to next date
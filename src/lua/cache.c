@@ -0,0 +1,83 @@
+/*
+   This file is part of darktable,
+   Copyright (C) 2020 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/cache.h"
+#include "common/darktable.h"
+#include "common/mipmap_cache.h"
+
+static void push_level_stats(lua_State *L, const dt_mipmap_size_t mip)
+{
+  dt_mipmap_cache_stats_t s;
+  dt_mipmap_cache_get_stats(darktable.mipmap_cache, mip, &s);
+
+  lua_newtable(L);
+  lua_pushinteger(L, s.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, s.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, s.disk_hits);
+  lua_setfield(L, -2, "disk_hits");
+  lua_pushinteger(L, s.evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_pushinteger(L, s.resident);
+  lua_setfield(L, -2, "bytes_resident");
+  lua_pushinteger(L, s.loads);
+  lua_setfield(L, -2, "loads");
+  lua_pushnumber(L, s.loads ? s.load_usec / (1000.0 * s.loads) : 0.0);
+  lua_setfield(L, -2, "average_load_ms");
+  lua_pushinteger(L, s.prefetches);
+  lua_setfield(L, -2, "prefetches");
+  lua_pushinteger(L, s.prefetch_used);
+  lua_setfield(L, -2, "prefetches_used");
+}
+
+// returns a table with one table of counters per mip level, keyed
+// "mip0" to "mip8", "float" and "full"
+static int mipmap_stats(lua_State *L)
+{
+  lua_newtable(L);
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_NONE; k++)
+  {
+    push_level_stats(L, k);
+    if(k == DT_MIPMAP_F)
+      lua_setfield(L, -2, "float");
+    else if(k == DT_MIPMAP_FULL)
+      lua_setfield(L, -2, "full");
+    else
+    {
+      char level[8];
+      snprintf(level, sizeof(level), "mip%d", (int)k);
+      lua_setfield(L, -2, level);
+    }
+  }
+  return 1;
+}
+
+int dt_lua_init_cache(lua_State *L)
+{
+  dt_lua_push_darktable_lib(L);
+  dt_lua_goto_subtable(L, "cache");
+
+  lua_pushcfunction(L, mipmap_stats);
+  lua_setfield(L, -2, "mipmap_stats");
+
+  lua_pop(L, 1);
+  return 0;
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
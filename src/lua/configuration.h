@@ -36,9 +36,9 @@
 /* incompatible API change */
 #define LUA_API_VERSION_MAJOR 5
 /* backward compatible API change */
-#define LUA_API_VERSION_MINOR 0
+#define LUA_API_VERSION_MINOR 1
 /* bugfixes that should not change anything to the API */
-#define LUA_API_VERSION_PATCH 2
+#define LUA_API_VERSION_PATCH 0
 /* suffix for unstable version */
 #define LUA_API_VERSION_SUFFIX ""
 
@@ -283,9 +283,7 @@ int dt_lua_init_database(lua_State *L)
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, G_CALLBACK(on_film_imported),
                             NULL);
 
-  lua_pushcfunction(L, dt_lua_event_multiinstance_register);
-  lua_pushcfunction(L, dt_lua_event_multiinstance_trigger);
-  dt_lua_event_add(L, "post-import-image");
+  dt_lua_event_add_deferrable(L, "post-import-image", FALSE);
 
   return 0;
 }
@@ -197,6 +197,136 @@ int dt_lua_event_multiinstance_trigger(lua_State *L)
 
 
 
+/*
+ * DEFERRABLE EVENTS
+ * multiinstance events whose handlers are split into the "sync" and "async" lists of the data table.
+ * the number of handlers in each list is mirrored on the C side, so the raising thread can decide
+ * what to do without taking the lua lock.
+ *
+ * data table is "event => { sync => { # => callback }, async => { # => callback } }"
+ */
+
+// deferred events waiting for the lua thread, the raising threads block beyond that
+#define DT_LUA_EVENT_QUEUE_SIZE 256
+
+typedef struct dt_lua_deferrable_event_t
+{
+  gboolean default_sync;
+  gint handlers[2]; // sync, async
+} dt_lua_deferrable_event_t;
+
+// event name -> dt_lua_deferrable_event_t, only written while lua is initialized
+static GHashTable *_deferrable_events = NULL;
+
+static GMutex _deferred_lock;
+static GCond _deferred_cond;
+static int _deferred_pending = 0;
+
+static int deferrable_register(lua_State *L)
+{
+  // 1 is the data table
+  // 2 is the event name (checked)
+  // 3 is the action to perform (checked)
+  // 4 is the optional mode
+  dt_lua_deferrable_event_t *evt = g_hash_table_lookup(_deferrable_events, luaL_checkstring(L, 2));
+  gboolean sync = evt->default_sync;
+  if(!lua_isnoneornil(L, 4))
+  {
+    const char *mode = luaL_checkstring(L, 4);
+    if(!strcmp(mode, "sync"))
+      sync = TRUE;
+    else if(!strcmp(mode, "async"))
+      sync = FALSE;
+    else
+      return luaL_error(L, "unknown mode '%s' for event %s, expected sync or async", mode, luaL_checkstring(L, 2));
+  }
+
+  lua_getfield(L, 1, sync ? "sync" : "async");
+  if(lua_isnil(L, -1))
+  {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, 1, sync ? "sync" : "async");
+  }
+  lua_pushvalue(L, 3);
+  luaL_ref(L, -2);
+  g_atomic_int_inc(&evt->handlers[sync ? 0 : 1]);
+  return 0;
+}
+
+static int deferrable_trigger(lua_State *L)
+{
+  // 1 : the data table
+  // 2 : the name of the event
+  // 3 : the mode
+  // .. : other parameters
+  const int mode = luaL_checkinteger(L, 3);
+  const int arg_top = lua_gettop(L);
+  const char *lists[] = { "sync", "async" };
+  for(int k = 0; k < 2; k++)
+  {
+    if(!(mode & (1 << k))) continue;
+    lua_getfield(L, 1, lists[k]);
+    const int table = lua_gettop(L);
+    if(lua_istable(L, table))
+    {
+      lua_pushnil(L);
+      while(lua_next(L, table))
+      {
+        lua_pushvalue(L, 2);
+        for(int i = 4; i <= arg_top; i++)
+        {
+          lua_pushvalue(L, i);
+        }
+        dt_lua_treated_pcall(L, arg_top - 2, 0);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+void dt_lua_event_add_deferrable(lua_State *L, const char *evt_name, gboolean default_sync)
+{
+  if(!_deferrable_events) _deferrable_events = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  dt_lua_deferrable_event_t *evt = g_malloc0(sizeof(dt_lua_deferrable_event_t));
+  evt->default_sync = default_sync;
+  g_hash_table_insert(_deferrable_events, g_strdup(evt_name), evt);
+
+  lua_pushcfunction(L, deferrable_register);
+  lua_pushcfunction(L, deferrable_trigger);
+  dt_lua_event_add(L, evt_name);
+}
+
+gboolean dt_lua_event_has_handlers(const char *evt_name, dt_lua_event_mode_t mode)
+{
+  dt_lua_deferrable_event_t *evt = _deferrable_events ? g_hash_table_lookup(_deferrable_events, evt_name) : NULL;
+  if(!evt) return FALSE;
+  return ((mode & DT_LUA_EVENT_SYNC) && g_atomic_int_get(&evt->handlers[0]))
+         || ((mode & DT_LUA_EVENT_ASYNC) && g_atomic_int_get(&evt->handlers[1]));
+}
+
+void dt_lua_event_deferred_reserve()
+{
+  g_mutex_lock(&_deferred_lock);
+  // don't wait for a lua thread which is going away
+  while(_deferred_pending >= DT_LUA_EVENT_QUEUE_SIZE && !darktable.lua_state.ending)
+    g_cond_wait_until(&_deferred_cond, &_deferred_lock, g_get_monotonic_time() + 100 * G_TIME_SPAN_MILLISECOND);
+  _deferred_pending++;
+  g_mutex_unlock(&_deferred_lock);
+}
+
+int dt_lua_event_deferred_trigger_wrapper(lua_State *L)
+{
+  dt_lua_event_trigger_wrapper(L);
+  g_mutex_lock(&_deferred_lock);
+  _deferred_pending--;
+  g_cond_signal(&_deferred_cond);
+  g_mutex_unlock(&_deferred_lock);
+  return 0;
+}
+
 static int lua_register_event(lua_State *L)
 {
   // 1 is event name
@@ -283,9 +413,8 @@ int dt_lua_init_events(lua_State *L)
   dt_lua_event_add(L, "shortcut");
 
 
-  lua_pushcfunction(L, dt_lua_event_multiinstance_register);
-  lua_pushcfunction(L, dt_lua_event_multiinstance_trigger);
-  dt_lua_event_add(L, "intermediate-export-image");
+  // the file is only there while the handlers run, so they are synchronous unless asked otherwise
+  dt_lua_event_add_deferrable(L, "intermediate-export-image", TRUE);
 
   lua_pushcfunction(L, dt_lua_event_multiinstance_register);
   lua_pushcfunction(L, dt_lua_event_multiinstance_trigger);
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <glib.h>
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
@@ -91,6 +92,33 @@ int dt_lua_event_multiinstance_trigger(lua_State *L);
 int dt_lua_event_keyed_register(lua_State *L);
 int dt_lua_event_keyed_trigger(lua_State *L);
 
+/**
+  DEFERRABLE EVENT
+  a multiinstance event raised by worker threads (import, export). its handlers are queued for
+  the lua thread so a slow script doesn't hold up the worker. handlers that must run before the
+  worker goes on (to modify a temporary file for example) are registered with "sync" as extra
+  parameter, "async" asks for the other mode explicitly. default_sync is the mode of handlers
+  registered without one.
+
+  the trigger function wants the bottom most arg to be a dt_lua_event_mode_t telling which
+  handlers to call. the other args are passed to the handlers.
+  */
+typedef enum dt_lua_event_mode_t
+{
+  DT_LUA_EVENT_SYNC = 1 << 0,
+  DT_LUA_EVENT_ASYNC = 1 << 1,
+  DT_LUA_EVENT_ALL = DT_LUA_EVENT_SYNC | DT_LUA_EVENT_ASYNC
+} dt_lua_event_mode_t;
+
+void dt_lua_event_add_deferrable(lua_State *L, const char *evt_name, gboolean default_sync);
+/** whether handlers of the given modes are registered. doesn't need the lua lock. */
+gboolean dt_lua_event_has_handlers(const char *evt_name, dt_lua_event_mode_t mode);
+/** reserve a slot in the queue of deferred events, blocks while it is full. to be followed by
+    dt_lua_async_call_alien(dt_lua_event_deferred_trigger_wrapper, ...) */
+void dt_lua_event_deferred_reserve();
+/** like dt_lua_event_trigger_wrapper, releasing the slot of dt_lua_event_deferred_reserve() */
+int dt_lua_event_deferred_trigger_wrapper(lua_State *L);
+
 
 
 /**
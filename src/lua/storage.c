@@ -17,7 +17,10 @@
  */
 #include "lua/storage.h"
 #include "common/imageio.h"
+#include "common/styles.h"
 #include "control/conf.h"
+#include "control/jobs/control_jobs.h"
+#include "lua/call.h"
 #include "lua/image.h"
 #include "lua/modules.h"
 #include "lua/types.h"
@@ -38,6 +41,150 @@ static int supports_format(lua_State *L)
   return 1;
 }
 
+// state of one storage:export_images() call, owned by the export job. the lua side is only touched
+// from the lua thread, the export threads queue their results there.
+typedef struct dt_lua_export_batch_t
+{
+  int callback; // registry reference, LUA_NOREF if there is none
+} dt_lua_export_batch_t;
+
+static int export_image_done_cb(lua_State *L)
+{
+  dt_lua_export_batch_t *batch = lua_touserdata(L, 1);
+  if(batch->callback == LUA_NOREF) return 0;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, batch->callback);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 3);
+  lua_call(L, 2, 0);
+  return 0;
+}
+
+static int export_images_release_cb(lua_State *L)
+{
+  dt_lua_export_batch_t *batch = lua_touserdata(L, 1);
+  luaL_unref(L, LUA_REGISTRYINDEX, batch->callback);
+  free(batch);
+  return 0;
+}
+
+static void export_image_done(const int imgid, const gboolean ok, gpointer user_data)
+{
+  dt_lua_async_call_alien(export_image_done_cb,
+      0, NULL, NULL,
+      LUA_ASYNC_TYPENAME, "void*", user_data,
+      LUA_ASYNC_TYPENAME, "dt_lua_image_t", GINT_TO_POINTER(imgid),
+      LUA_ASYNC_TYPENAME, "bool", GINT_TO_POINTER(ok),
+      LUA_ASYNC_DONE);
+}
+
+static void export_images_release(gpointer user_data)
+{
+  // queued behind the results of the last images
+  dt_lua_async_call_alien(export_images_release_cb,
+      0, NULL, NULL,
+      LUA_ASYNC_TYPENAME, "void*", user_data,
+      LUA_ASYNC_DONE);
+}
+
+/*
+   storage:export_images(images, format [, options])
+   queues one export job for all images and returns immediately, the images are processed by the
+   export threads like an export from the gui. options is a table with the optional fields
+   style (name or style), style_append, high_quality, upscale and callback, a function called with
+   (image, success) for every finished image.
+   */
+static int export_images(lua_State *L)
+{
+  luaL_argcheck(L, dt_lua_isa(L, 1, dt_imageio_module_storage_t), 1, "dt_imageio_module_storage_t expected");
+  lua_getmetatable(L, 1);
+  lua_getfield(L, -1, "__luaA_Type");
+  luaA_Type storage_type = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "__associated_object");
+  dt_imageio_module_storage_t *storage = lua_touserdata(L, -1);
+  lua_pop(L, 2);
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  luaL_argcheck(L, dt_lua_isa(L, 3, dt_imageio_module_format_t), 3, "dt_imageio_module_format_t expected");
+  lua_getmetatable(L, 3);
+  lua_getfield(L, -1, "__luaA_Type");
+  luaA_Type format_type = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "__associated_object");
+  dt_imageio_module_format_t *format = lua_touserdata(L, -1);
+  lua_pop(L, 2);
+
+  if(!storage->supported(storage, format))
+    return luaL_error(L, "storage %s doesn't support format %s", storage->plugin_name, format->plugin_name);
+
+  gboolean high_quality = dt_conf_get_bool("plugins/lighttable/export/high_quality_processing");
+  gboolean upscale = FALSE;
+  gboolean style_append = FALSE;
+  const char *style = NULL;
+  int callback_idx = 0;
+  if(!lua_isnoneornil(L, 4))
+  {
+    luaL_checktype(L, 4, LUA_TTABLE);
+    lua_getfield(L, 4, "high_quality");
+    if(!lua_isnil(L, -1)) high_quality = lua_toboolean(L, -1);
+    lua_getfield(L, 4, "upscale");
+    upscale = lua_toboolean(L, -1);
+    lua_getfield(L, 4, "style_append");
+    style_append = lua_toboolean(L, -1);
+    lua_pop(L, 3);
+    lua_getfield(L, 4, "style");
+    if(dt_lua_isa(L, -1, dt_style_t))
+    {
+      dt_style_t s;
+      luaA_to(L, dt_style_t, &s, -1);
+      style = s.name;
+    }
+    else if(!lua_isnil(L, -1))
+      style = luaL_checkstring(L, -1);
+    // the style stays on the stack until its name is copied
+    lua_getfield(L, 4, "callback");
+    if(!lua_isnil(L, -1))
+    {
+      luaL_checktype(L, -1, LUA_TFUNCTION);
+      callback_idx = lua_gettop(L);
+    }
+  }
+
+  GList *imgs = NULL;
+  const int count = luaL_len(L, 2);
+  for(int k = 1; k <= count; k++)
+  {
+    lua_rawgeti(L, 2, k);
+    dt_lua_image_t imgid;
+    luaA_to(L, dt_lua_image_t, &imgid, -1);
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(imgid));
+    lua_pop(L, 1);
+  }
+  imgs = g_list_reverse(imgs);
+
+  dt_imageio_module_data_t *sdata = storage->get_params(storage);
+  if(!sdata)
+  {
+    g_list_free(imgs);
+    return luaL_error(L, "failed to get parameters from storage %s", storage->plugin_name);
+  }
+  luaA_to_type(L, storage_type, sdata, 1);
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  luaA_to_type(L, format_type, fdata, 3);
+
+  dt_lua_export_batch_t *batch = malloc(sizeof(dt_lua_export_batch_t));
+  batch->callback = LUA_NOREF;
+  if(callback_idx)
+  {
+    lua_pushvalue(L, callback_idx);
+    batch->callback = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  dt_control_export_with_params(imgs, format, fdata, storage, sdata, high_quality, upscale, style, style_append,
+                                export_image_done, batch, export_images_release);
+  return 0;
+}
+
 static int plugin_name_member(lua_State *L)
 {
   luaL_getmetafield(L, 1, "__associated_object");
@@ -164,6 +311,10 @@ int dt_lua_init_early_storage(lua_State *L)
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const(L, dt_imageio_module_storage_t, "supports_format");
 
+  lua_pushcfunction(L, export_images);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_imageio_module_storage_t, "export_images");
+
   dt_lua_module_new(L, "storage");
 
   dt_lua_push_darktable_lib(L);
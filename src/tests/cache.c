@@ -22,7 +22,7 @@
 #define dt_alloc_align(A, B) malloc(B)
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-// unit test for the concurrent hopscotch hashmap and the LRU cache built on top of it.
+// unit test and contention benchmark for the (optionally sharded) LRU cache.
 #include "common/cache.h"
 #include "common/cache.c"
 
@@ -33,98 +33,177 @@
 #include <omp.h>
 #endif
 
-int32_t alloc_dummy(void *data, const uint32_t key, int32_t *cost, void **buf)
+static void alloc_dummy(void *data, dt_cache_entry_t *entry)
 {
-  *cost = 1; // also the default
-  *buf = (void *)(long int)key;
-  // request write lock for our buffer?
-  return 0;
+  entry->cost = 1; // also the default
+  entry->data_size = sizeof(uint32_t);
+  entry->data = malloc(entry->data_size);
+  *(uint32_t *)entry->data = entry->key;
 }
 
-int main(int argc, char *arg[])
+static void cleanup_dummy(void *data, dt_cache_entry_t *entry)
+{
+  free(entry->data);
+}
+
+// walks one list of a segment and checks it against the hash table.
+// returns the number of entries or -1 on inconsistency.
+static int list_check_consistency(dt_cache_segment_t *seg, dt_cache_entry_t *head, dt_cache_entry_t *tail,
+                                  const int in_window)
+{
+  int cnt = 0;
+  dt_cache_entry_t *prev = NULL;
+  for(dt_cache_entry_t *entry = head; entry; entry = entry->lru_next)
+  {
+    if(entry->lru_prev != prev) return -1;
+    if(entry->_in_window != in_window) return -1;
+    prev = entry;
+    if(g_hash_table_lookup(seg->hashtable, GINT_TO_POINTER(entry->key)) != entry) return -1;
+    cnt++;
+  }
+  if(prev != tail) return -1;
+  return cnt;
+}
+
+// walks all lru lists and windows and checks them against the hash tables.
+// returns the number of entries or -1 on inconsistency.
+static int lru_check_consistency(dt_cache_t *cache)
+{
+  int cnt = 0;
+  for(uint32_t k = 0; k < cache->num_segments; k++)
+  {
+    dt_cache_segment_t *seg = cache->segments + k;
+    const int main_cnt = list_check_consistency(seg, seg->lru_head, seg->lru_tail, 0);
+    const int window_cnt = list_check_consistency(seg, seg->window_head, seg->window_tail, 1);
+    if(main_cnt < 0 || window_cnt < 0) return -1;
+    if(window_cnt != seg->window_cost) return -1; // all entries cost 1 here
+    if(main_cnt + window_cnt != g_hash_table_size(seg->hashtable)) return -1;
+    cnt += main_cnt + window_cnt;
+  }
+  return cnt;
+}
+
+static void test_insert(const size_t quota, const uint32_t segments, const int frequency_aware)
 {
   dt_cache_t cache;
-  // dt_cache_init(&cache, 110000, 16, 64, 100000);
   // really hammer it, make quota insanely low:
-  dt_cache_init(&cache, 110000, 16, 64, 100);
+  dt_cache_init_sharded(&cache, 0, quota, segments);
+  if(frequency_aware) dt_cache_set_frequency_aware(&cache, quota);
   dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
 
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(guided) shared(cache, stderr) num_threads(16)
+#pragma omp parallel for default(none) schedule(guided) shared(cache) num_threads(16)
 #endif
   for(int k = 0; k < 100000; k++)
   {
-    void *data = (void *)(long int)k;
-    const int size = 0; // dt_cache_size(&cache);
     const int con1 = dt_cache_contains(&cache, k);
-    const int val1 = (int)(long int)dt_cache_read_get(&cache, k);
-    const int val2 = (int)(long int)dt_cache_read_get(&cache, k);
-    // fprintf(stderr, "\rinserted number %d, size %d, value %d - %d, contains %d - %d", k, size, val1, val2,
-    // con1, con2);
+    // allocate callback is set, so we come back write locked:
+    dt_cache_entry_t *entry = dt_cache_get(&cache, k, 'w');
+    const uint32_t val = *(uint32_t *)entry->data;
     const int con2 = dt_cache_contains(&cache, k);
+    dt_cache_release(&cache, entry);
     assert(con1 == 0);
     assert(con2 == 1);
-    assert(val2 == k);
-    dt_cache_read_release(&cache, k);
-    dt_cache_read_release(&cache, k);
+    assert(val == k);
+    (void)con1;
+    (void)con2;
+    (void)val;
   }
-  dt_cache_print_locked(&cache);
-  // fprintf(stderr, "\n");
-  fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
 
-  const int size = dt_cache_size(&cache);
   const int lru_cnt = lru_check_consistency(&cache);
-  const int lru_cnt_r = lru_check_consistency_reverse(&cache);
-  // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-  assert(size == lru_cnt);
-  assert(lru_cnt_r == lru_cnt);
-  fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
+  assert(lru_cnt >= 0);
+  assert(lru_cnt == dt_cache_get_cost(&cache));
+  fprintf(stderr, "[passed] inserting 100000 entries concurrently into %u segments, quota %zu, %s, "
+                  "%d entries left.\n", cache.num_segments, quota, frequency_aware ? "w-tinylfu" : "lru", lru_cnt);
+  dt_cache_cleanup(&cache);
+}
+
+// a working set used over and over, then one scan over many other keys.
+// returns how much of the working set survived the scan.
+static float test_scan(const int frequency_aware)
+{
+  const int quota = 1000, working_set = 500, scan = 20000;
+  dt_cache_t cache;
+  dt_cache_init(&cache, 0, quota);
+  if(frequency_aware) dt_cache_set_frequency_aware(&cache, quota);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
+
+  for(int round = 0; round < 8; round++)
+    for(int k = 0; k < working_set; k++) dt_cache_release(&cache, dt_cache_get(&cache, k, 'r'));
+  for(int k = 0; k < scan; k++) dt_cache_release(&cache, dt_cache_get(&cache, working_set + k, 'r'));
 
+  int kept = 0;
+  for(int k = 0; k < working_set; k++) kept += dt_cache_contains(&cache, k);
+  const int lru_cnt = lru_check_consistency(&cache);
+  assert(lru_cnt >= 0);
+  assert(lru_cnt == dt_cache_get_cost(&cache));
+  (void)lru_cnt;
   dt_cache_cleanup(&cache);
+  return kept / (float)working_set;
+}
 
+// many threads reading a working set that fits the cache, the mipmap cache hit path.
+static double bench_contention(const uint32_t segments, const int threads)
+{
+  const int working_set = 4096;
+  const int iterations = 2000000;
+  dt_cache_t cache;
+  dt_cache_init_sharded(&cache, 0, 2 * working_set, segments);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
 
+  for(int k = 0; k < working_set; k++)
+    dt_cache_release(&cache, dt_cache_get(&cache, k, 'w'));
 
+#ifdef _OPENMP
+  const double start = omp_get_wtime();
+#pragma omp parallel for default(none) schedule(static) shared(cache) num_threads(threads)
+#endif
+  for(int k = 0; k < iterations; k++)
   {
-    // now a harder case: a cache with only one entry and a lot of threads fighting over it:
-    dt_cache_t cache2;
-    // really hammer it, make quota insanely low:
-    // capacity 1 num threads 1 cache line size 64 ignored, quota 2 (80% => 1)
-    dt_cache_init(&cache2, 1, 1, 64, 2);
-    dt_cache_set_allocate_callback(&cache2, alloc_dummy, NULL);
-
+    const uint32_t key = ((uint32_t)k * 2654435761u) % working_set;
+    dt_cache_entry_t *entry = dt_cache_get(&cache, key, 'r');
+    assert(*(uint32_t *)entry->data == key);
+    dt_cache_release(&cache, entry);
+  }
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(guided) shared(cache2, stderr) num_threads(16)
+  const double end = omp_get_wtime();
+#else
+  const double start = 0.0, end = 0.0;
 #endif
-    for(int k = 0; k < 100000; k++)
-    {
-      void *data = (void *)(long int)k;
-      const int size = 0; // dt_cache_size(&cache);
-      const int con1 = dt_cache_contains(&cache2, k);
-      const int val1 = (int)(long int)dt_cache_read_get(&cache2, k);
-      const int val2 = (int)(long int)dt_cache_read_get(&cache2, k);
-      // fprintf(stderr, "\rinserted number %d, size %d, value %d - %d, contains %d - %d", k, size, val1,
-      // val2, con1, con2);
-      const int con2 = dt_cache_contains(&cache2, k);
-      assert(con1 == 0);
-      assert(con2 == 1);
-      assert(val2 == k);
-      dt_cache_read_release(&cache2, k);
-      dt_cache_read_release(&cache2, k);
-    }
-    dt_cache_print_locked(&cache2);
-    // fprintf(stderr, "\n");
-    fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
-
-    const int size = dt_cache_size(&cache2);
-    const int lru_cnt = lru_check_consistency(&cache2);
-    const int lru_cnt_r = lru_check_consistency_reverse(&cache2);
-    // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-    assert(size == lru_cnt);
-    assert(lru_cnt_r == lru_cnt);
-    fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
-    dt_cache_cleanup(&cache2);
+
+  dt_cache_cleanup(&cache);
+  return end - start;
+}
+
+int main(int argc, char *arg[])
+{
+  for(int frequency_aware = 0; frequency_aware < 2; frequency_aware++)
+  {
+    test_insert(100, 1, frequency_aware);
+    test_insert(100, 16, frequency_aware);
+    // a cache with only one entry and a lot of threads fighting over it:
+    test_insert(1, 1, frequency_aware);
   }
 
+  const float kept_lru = test_scan(0);
+  const float kept_tinylfu = test_scan(1);
+  assert(kept_tinylfu > 0.9f);
+  (void)kept_lru;
+  fprintf(stderr, "[passed] working set kept after a scan: lru %.0f%%, w-tinylfu %.0f%%\n", 100.0f * kept_lru,
+          100.0f * kept_tinylfu);
+
+#ifdef _OPENMP
+  const int threads = omp_get_num_procs();
+#else
+  const int threads = 1;
+#endif
+  fprintf(stderr, "[bench] 2M concurrent lookups on %d threads:\n", threads);
+  for(uint32_t segments = 1; segments <= 64; segments <<= 1)
+    fprintf(stderr, "[bench] %2u segments: %.3fs\n", segments, bench_contention(segments, threads));
+
   exit(0);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
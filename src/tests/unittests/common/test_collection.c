@@ -0,0 +1,221 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the query plans of common/collection.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/collection.c"
+#include "common/database.h"
+#include "common/file_location.h"
+
+/*
+ * DEFINITIONS
+ */
+
+// tables a collection filter may scan: the images themselves and the small lookup tables which are
+// read once per query. every other table has to be searched through an index, a full scan over them
+// is what makes the lighttable slow on large libraries.
+static const char *allowed_scans[] = { "mi", "images", "film_rolls", "tags", "darktable_iop_names",
+                                       "history_hash", NULL };
+
+static gchar *tmpdir = NULL;
+
+/*
+ * HELPER FUNCTIONS
+ */
+
+static gchar *_sample_text(const dt_collection_properties_t property)
+{
+  switch(property)
+  {
+    case DT_COLLECTION_PROP_FILMROLL:   return g_strdup("/home/user/pictures/2020");
+    case DT_COLLECTION_PROP_FOLDERS:    return g_strdup("/home/user/pictures");
+    case DT_COLLECTION_PROP_FILENAME:   return g_strdup("IMG_0001");
+    case DT_COLLECTION_PROP_CAMERA:     return g_strdup("Canon EOS 5D");
+    case DT_COLLECTION_PROP_LENS:       return g_strdup("50mm");
+    case DT_COLLECTION_PROP_APERTURE:   return g_strdup("[2.8;5.6]");
+    case DT_COLLECTION_PROP_EXPOSURE:   return g_strdup("1/125");
+    case DT_COLLECTION_PROP_FOCAL_LENGTH: return g_strdup(">=50");
+    case DT_COLLECTION_PROP_ISO:        return g_strdup("100");
+    case DT_COLLECTION_PROP_DAY:        return g_strdup("2020:06:01");
+    case DT_COLLECTION_PROP_TIME:       return g_strdup("[2020:06:01 08:00:00;2020:06:01 20:00:00]");
+    case DT_COLLECTION_PROP_GEOTAGGING: return g_strdup(_("tagged"));
+    case DT_COLLECTION_PROP_ASPECT_RATIO: return g_strdup("[1.4;1.6]");
+    case DT_COLLECTION_PROP_TAG:        return g_strdup("darktable|format|%");
+    case DT_COLLECTION_PROP_COLORLABEL: return g_strdup(_("red"));
+    case DT_COLLECTION_PROP_GROUPING:   return g_strdup(_("group leaders"));
+    case DT_COLLECTION_PROP_LOCAL_COPY: return g_strdup(_("copied locally"));
+    case DT_COLLECTION_PROP_HISTORY:    return g_strdup(_("altered"));
+    case DT_COLLECTION_PROP_MODULE:     return g_strdup("exposure");
+    case DT_COLLECTION_PROP_ORDER:      return g_strdup(_(dt_iop_order_string(DT_IOP_ORDER_V30)));
+    default:                            return g_strdup("holiday"); // metadata
+  }
+}
+
+// returns the table a "SCAN ..." line of the query plan reads, NULL for any other line
+static gchar *_scanned_table(const char *detail)
+{
+  if(!g_str_has_prefix(detail, "SCAN ")) return NULL;
+
+  const char *name = detail + strlen("SCAN ");
+  if(g_str_has_prefix(name, "TABLE ")) name += strlen("TABLE "); // sqlite before 3.36
+  if(name[0] == '(' || g_str_has_prefix(name, "CONSTANT ROW")) return NULL;
+
+  // drop the schema, main.color_labels is reported as color_labels
+  const char *dot = strchr(name, '.');
+  const char *end = strchr(name, ' ');
+  if(dot && (!end || dot < end)) name = dot + 1;
+  end = strchr(name, ' ');
+  return end ? g_strndup(name, end - name) : g_strdup(name);
+}
+
+static gboolean _scan_allowed(const char *table)
+{
+  for(int k = 0; allowed_scans[k]; k++)
+    if(!strcmp(table, allowed_scans[k])) return TRUE;
+  return FALSE;
+}
+
+// runs EXPLAIN QUERY PLAN on the query and fails on every full scan of a table which isn't allowed to
+static void _assert_no_scan(const char *query)
+{
+  sqlite3_stmt *stmt;
+  gchar *explain = g_strdup_printf("EXPLAIN QUERY PLAN %s", query);
+  const int rc = sqlite3_prepare_v2(dt_database_get(darktable.db), explain, -1, &stmt, NULL);
+  if(rc != SQLITE_OK) fail_msg("can't prepare `%s': %s", query, sqlite3_errmsg(dt_database_get(darktable.db)));
+
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+    TR_DEBUG("  %s", detail);
+    gchar *table = _scanned_table(detail);
+    if(table && !_scan_allowed(table))
+    {
+      sqlite3_finalize(stmt);
+      fail_msg("`%s' scans table %s:\n%s", query, table, detail);
+    }
+    g_free(table);
+  }
+  sqlite3_finalize(stmt);
+  g_free(explain);
+}
+
+/*
+ * SETUP AND TEARDOWN
+ */
+
+static int setup(void **state)
+{
+  tmpdir = g_dir_make_tmp("darktable-test-XXXXXX", NULL);
+  if(!tmpdir) return 1;
+
+  dt_loc_init_datadir(NULL);
+  dt_loc_init_user_config_dir(tmpdir);
+  dt_loc_init_user_cache_dir(tmpdir);
+
+  darktable.conf = (dt_conf_t *)calloc(1, sizeof(dt_conf_t));
+  gchar *rc = g_build_filename(tmpdir, "darktablerc", NULL);
+  dt_conf_init(darktable.conf, rc, NULL);
+  g_free(rc);
+
+  // a fresh library, created with the same schema as a new installation
+  darktable.db = dt_database_init(":memory:", FALSE, FALSE);
+  return darktable.db ? 0 : 1;
+}
+
+static int teardown(void **state)
+{
+  dt_database_destroy(darktable.db);
+  darktable.db = NULL;
+  dt_conf_cleanup(darktable.conf);
+  free(darktable.conf);
+  darktable.conf = NULL;
+  g_rmdir(tmpdir);
+  g_free(tmpdir);
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_property_query_plans(void **state)
+{
+  TR_STEP("verify that the filter of every collection property avoids full table scans");
+  for(dt_collection_properties_t property = 0; property < DT_COLLECTION_PROP_LAST; property++)
+  {
+    gchar *text = _sample_text(property);
+    gchar *where = get_query_string(property, text);
+    gchar *query = g_strdup_printf("SELECT DISTINCT mi.id FROM main.images AS mi WHERE %s", where);
+    TR_DEBUG("property %d: %s", property, query);
+    _assert_no_scan(query);
+    g_free(query);
+    g_free(where);
+    g_free(text);
+  }
+}
+
+static void test_sort_join_query_plans(void **state)
+{
+  TR_STEP("verify that the tables joined for sorting are searched by image id");
+  // the joins dt_collection_update() adds for sorting by color label, title and description
+  const char *joins[] = {
+    "LEFT OUTER JOIN main.color_labels AS b ON mi.id = b.imgid",
+    "LEFT OUTER JOIN main.meta_data AS m ON mi.id = m.id AND m.key = 3",
+    "LEFT OUTER JOIN main.color_labels AS b ON mi.id = b.imgid"
+    " LEFT OUTER JOIN main.meta_data AS m ON mi.id = m.id AND m.key = 3",
+    NULL
+  };
+  for(int k = 0; joins[k]; k++)
+  {
+    gchar *query = g_strdup_printf("SELECT DISTINCT mi.id FROM (SELECT * FROM main.images AS mi WHERE "
+                                   "(flags & 7) >= 1) AS mi %s",
+                                   joins[k]);
+    TR_DEBUG("join %d: %s", k, query);
+    _assert_no_scan(query);
+    g_free(query);
+  }
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_property_query_plans),
+    cmocka_unit_test(test_sort_join_query_plans)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
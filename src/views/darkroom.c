@@ -34,6 +34,7 @@
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
+#include "control/jobs/image_jobs.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -43,6 +44,7 @@
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
+#include "gui/styles.h"
 #include "libs/colorpicker.h"
 #include "views/view.h"
 #include "views/view_api.h"
@@ -181,15 +183,6 @@ void cleanup(dt_view_t *self)
   free(dev);
 }
 
-static cairo_status_t write_snapshot_data(void *closure, const unsigned char *data, unsigned int length)
-{
-  const int fd = GPOINTER_TO_INT(closure);
-  ssize_t res = write(fd, data, length);
-  if(res != length)
-    return CAIRO_STATUS_WRITE_ERROR;
-  return CAIRO_STATUS_SUCCESS;
-}
-
 static dt_darkroom_layout_t _lib_darkroom_get_layout(dt_view_t *self)
 {
   dt_develop_t *dev = (dt_develop_t *)self->data;
@@ -304,12 +297,14 @@ void expose(
     // draw image
     mutex = &dev->pipe->backbuf_mutex;
     dt_pthread_mutex_lock(mutex);
+    // a coarse pass of progressive rendering is stretched to the size of the final image
+    const int coarse = dev->pipe->output_backbuf_coarse;
     float wd = dev->pipe->output_backbuf_width;
     float ht = dev->pipe->output_backbuf_height;
     stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
     surface = dt_cairo_image_surface_create_for_data(dev->pipe->output_backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
-    wd /= darktable.gui->ppd;
-    ht /= darktable.gui->ppd;
+    wd *= (float)coarse / darktable.gui->ppd;
+    ht *= (float)coarse / darktable.gui->ppd;
 
     if(dev->iso_12646.enabled)
     {
@@ -343,6 +338,12 @@ void expose(
 
     cairo_rectangle(cr, 0, 0, wd, ht);
     cairo_set_source_surface(cr, surface, 0, 0);
+    if(coarse > 1)
+    {
+      cairo_matrix_t matrix;
+      cairo_matrix_init_scale(&matrix, 1.0 / coarse, 1.0 / coarse);
+      cairo_pattern_set_matrix(cairo_get_source(cr), &matrix);
+    }
     if(closeup)
       cairo_pattern_set_filter(cairo_get_source(cr), darktable.gui->filter_image);
     else
@@ -350,7 +351,7 @@ void expose(
 
     cairo_fill(cr);
 
-    if(darktable.gui->show_focus_peaking)
+    if(darktable.gui->show_focus_peaking && coarse == 1)
     {
       cairo_save(cr);
       cairo_scale(cr, 1./ darktable.gui->ppd, 1. / darktable.gui->ppd);
@@ -459,15 +460,19 @@ void expose(
     /* reset the request */
     darktable.develop->proxy.snapshot.request = FALSE;
 
-    /* validation of snapshot filename */
-    g_assert(darktable.develop->proxy.snapshot.filename != NULL);
+    /* validation of snapshot target */
+    g_assert(darktable.develop->proxy.snapshot.surface != NULL);
 
-    /* Store current image surface to snapshot file.
+    /* Keep a copy of the current image surface as snapshot, it is drawn into again on the next expose.
        FIXME: add checks so that we don't make snapshots of preview pipe image surface.
     */
-    int fd = g_open(darktable.develop->proxy.snapshot.filename, O_CREAT | O_WRONLY | O_BINARY, 0600);
-    cairo_surface_write_to_png_stream(image_surface, write_snapshot_data, GINT_TO_POINTER(fd));
-    close(fd);
+    cairo_surface_t **snapshot = darktable.develop->proxy.snapshot.surface;
+    if(*snapshot) cairo_surface_destroy(*snapshot);
+    *snapshot = dt_cairo_image_surface_create(CAIRO_FORMAT_RGB24, image_surface_width, image_surface_height);
+    cairo_t *cs = cairo_create(*snapshot);
+    cairo_set_source_surface(cs, image_surface, 0, 0);
+    cairo_paint(cs);
+    cairo_destroy(cs);
   }
 
   // Displaying sample areas if enabled
@@ -478,8 +483,8 @@ void expose(
 
     cairo_save(cri);
     // The colorpicker samples bounding rectangle should only be displayed inside the visible image
-    const int pwidth = (dev->pipe->output_backbuf_width<<closeup) / darktable.gui->ppd;
-    const int pheight = (dev->pipe->output_backbuf_height<<closeup) / darktable.gui->ppd;
+    const int pwidth = (dev->pipe->output_backbuf_width * dev->pipe->output_backbuf_coarse<<closeup) / darktable.gui->ppd;
+    const int pheight = (dev->pipe->output_backbuf_height * dev->pipe->output_backbuf_coarse<<closeup) / darktable.gui->ppd;
 
     const float hbar = (self->width - pwidth) * .5f;
     const float tbar = (self->height - pheight) * .5f;
@@ -549,8 +554,8 @@ void expose(
   if(dev->gui_module && dev->gui_module->request_color_pick != DT_REQUEST_COLORPICK_OFF && dev->gui_module->enabled)
   {
     // The colorpicker bounding rectangle should only be displayed inside the visible image
-    const int pwidth = (dev->pipe->output_backbuf_width<<closeup) / darktable.gui->ppd;
-    const int pheight = (dev->pipe->output_backbuf_height<<closeup) / darktable.gui->ppd;
+    const int pwidth = (dev->pipe->output_backbuf_width * dev->pipe->output_backbuf_coarse<<closeup) / darktable.gui->ppd;
+    const int pheight = (dev->pipe->output_backbuf_height * dev->pipe->output_backbuf_coarse<<closeup) / darktable.gui->ppd;
 
     const float hbar = (self->width - pwidth) * .5f;
     const float tbar = (self->height - pheight) * .5f;
@@ -1008,6 +1013,35 @@ static void _view_darkroom_filmstrip_activate_callback(gpointer instance, int im
   }
 }
 
+// load the next images in the direction of travel in the background, so the following jump finds the raw
+// decoded and the preview pipe input ready. the full cache only holds a few buffers, so leave room for
+// the current image and the thumbnails.
+static void _dev_prefetch_images(const int imgid, const int diff)
+{
+  const int full_slots = (int)darktable.mipmap_cache->mip_full.cache.cost_quota - 2;
+  const int count = MIN(dt_conf_get_int("plugins/darkroom/prefetch"), MAX(1, full_slots));
+  if(count <= 0 || diff == 0) return;
+
+  int32_t imgids[8];
+  int found = 0;
+  sqlite3_stmt *stmt;
+  gchar *query = dt_util_dstrcat(NULL, "SELECT imgid "
+                                       "FROM memory.collected_images "
+                                       "WHERE rowid %s (SELECT rowid FROM memory.collected_images WHERE imgid=%d) "
+                                       "ORDER BY rowid %s "
+                                       "LIMIT %d",
+                                 diff > 0 ? ">" : "<", imgid, diff > 0 ? "ASC" : "DESC", MIN(count, 8));
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW && found < 8) imgids[found++] = sqlite3_column_int(stmt, 0);
+  g_free(query);
+  sqlite3_finalize(stmt);
+
+  // a new job also stops the one of the previous jump, whichever direction it was going
+  if(found > 0)
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG,
+                       dt_image_prefetch_job_create(imgids, found, DT_MIPMAP_F));
+}
+
 static void dt_dev_jump_image(dt_develop_t *dev, int diff, gboolean by_key)
 {
   if(dev->image_loading) return;
@@ -1036,6 +1070,7 @@ static void dt_dev_jump_image(dt_develop_t *dev, int diff, gboolean by_key)
   // if id seems valid, we change the image and move filmstrip
   dt_dev_change_image(dev, new_id);
   dt_thumbtable_set_offset(dt_ui_thumbtable(darktable.gui->ui), new_offset, TRUE);
+  _dev_prefetch_images(new_id, diff);
 
   // if it's a change by key_press, we set mouse_over to the active image
   if(by_key) dt_control_set_mouse_over_id(new_id);
@@ -1179,6 +1214,17 @@ static void _darkroom_ui_apply_style_activate_callback(gchar *name)
   dt_dev_reload_image(darktable.develop, darktable.develop->image_storage.id);
 }
 
+// the items of the style next to a preview of it on the current image
+static gboolean _darkroom_ui_style_query_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode,
+                                                 GtkTooltip *tooltip, gpointer user_data)
+{
+  gchar *markup = gtk_widget_get_tooltip_markup(widget);
+  const gboolean res = dt_gui_styles_preview_tooltip(tooltip, darktable.develop->image_storage.id,
+                                                     (const char *)user_data, markup);
+  g_free(markup);
+  return res;
+}
+
 static void _darkroom_ui_apply_style_popupmenu(GtkWidget *w, gpointer user_data)
 {
   /* show styles popup menu */
@@ -1220,6 +1266,8 @@ static void _darkroom_ui_apply_style_popupmenu(GtkWidget *w, gpointer user_data)
 
       GtkWidget *mi = gtk_menu_item_new_with_label(mi_name);
       gtk_widget_set_tooltip_markup(mi, tooltip);
+      g_signal_connect_data(G_OBJECT(mi), "query-tooltip", G_CALLBACK(_darkroom_ui_style_query_tooltip),
+                            g_strdup(style->name), (GClosureNotify)g_free, 0);
       g_free(mi_name);
 
       // check if we already have a sub-menu with this name
@@ -2965,8 +3013,8 @@ static int mouse_in_imagearea(dt_view_t *self, double x, double y)
   dt_develop_t *dev = (dt_develop_t *)self->data;
 
   const int closeup = dt_control_get_dev_closeup();
-  const int pwidth = (dev->pipe->output_backbuf_width<<closeup) / darktable.gui->ppd;
-  const int pheight = (dev->pipe->output_backbuf_height<<closeup) / darktable.gui->ppd;
+  const int pwidth = (dev->pipe->output_backbuf_width * dev->pipe->output_backbuf_coarse<<closeup) / darktable.gui->ppd;
+  const int pheight = (dev->pipe->output_backbuf_height * dev->pipe->output_backbuf_coarse<<closeup) / darktable.gui->ppd;
 
   x -= (self->width - pwidth) / 2;
   y -= (self->height - pheight) / 2;
@@ -67,6 +67,7 @@ typedef struct dt_map_t
 typedef struct dt_map_image_t
 {
   gint imgid;
+  gint count; // number of images of the grid cell this thumbnail stands for
   OsmGpsMapImage *image;
   gint width, height;
 } dt_map_image_t;
@@ -372,6 +373,36 @@ static GdkPixbuf *init_place_pin()
   cairo_surface_destroy(cst);
   return pixbuf;
 }
+
+// returns a copy of the thumbnail with the number of images of its cluster written into the top left corner
+static GdkPixbuf *_view_map_draw_count(GdkPixbuf *thumb, const int count)
+{
+  const int w = gdk_pixbuf_get_width(thumb), h = gdk_pixbuf_get_height(thumb);
+  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  cairo_t *cr = cairo_create(cst);
+  gdk_cairo_set_source_pixbuf(cr, thumb, 0, 0);
+  cairo_paint(cr);
+
+  gchar *text = g_strdup_printf("%d", count);
+  cairo_text_extents_t te;
+  cairo_set_font_size(cr, DT_PIXEL_APPLY_DPI(10));
+  cairo_text_extents(cr, text, &te);
+  const double pad = DT_PIXEL_APPLY_DPI(2);
+  const double border = DT_PIXEL_APPLY_DPI(thumb_border);
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.7);
+  cairo_rectangle(cr, border, border, te.width + 2 * pad, te.height + 2 * pad);
+  cairo_fill(cr);
+  cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 1.0);
+  cairo_move_to(cr, border + pad - te.x_bearing, border + pad - te.y_bearing);
+  cairo_show_text(cr, text);
+  g_free(text);
+
+  cairo_destroy(cr);
+  GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface(cst, 0, 0, w, h);
+  cairo_surface_destroy(cst);
+  return pixbuf;
+}
+
 void expose(dt_view_t *self, cairo_t *cri, int32_t width, int32_t height, int32_t pointerx, int32_t pointery)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
@@ -567,6 +598,9 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 4, bb_1_lat - south_border);
   DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 5, center_lat);
   DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 6, center_lon);
+  /* grid cells of the size of the enlargement above, all images of a cell end up in one thumbnail */
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 7, MAX(west_border, 1e-9));
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 8, MAX(south_border, 1e-9));
 
   /* remove the old images */
   if(lib->images)
@@ -588,6 +622,7 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
   {
     int imgid = sqlite3_column_int(lib->statements.main_query, 0);
+    const int count = sqlite3_column_int(lib->statements.main_query, 2);
     dt_mipmap_buffer_t buf;
     dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT, 'r');
 
@@ -622,6 +657,14 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
       // and finally add the pin
       gdk_pixbuf_copy_area(lib->image_pin, 0, 0, w + 2 * _thumb_border, _pin_size, thumb, 0, h + 2 * _thumb_border);
 
+      if(count > 1)
+      {
+        GdkPixbuf *counted = _view_map_draw_count(thumb, count);
+        g_object_unref(thumb);
+        thumb = counted;
+        if(!thumb) goto map_changed_failure;
+      }
+
       const dt_image_t *cimg = dt_image_cache_get(darktable.image_cache, imgid, 'r');
       if(!cimg) goto map_changed_failure;
       dt_map_image_t *entry = (dt_map_image_t *)malloc(sizeof(dt_map_image_t));
@@ -631,6 +674,7 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
         goto map_changed_failure;
       }
       entry->imgid = imgid;
+      entry->count = count;
       entry->image = osm_gps_map_image_add_with_alignment(map, cimg->geoloc.latitude, cimg->geoloc.longitude, thumb, 0, 1);
       entry->width = w;
       entry->height = h;
@@ -1351,9 +1395,15 @@ static void _view_map_build_main_query(dt_map_t *lib)
   lib->max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
   if(lib->max_images_drawn == 0) lib->max_images_drawn = 100;
   lib->filter_images_drawn = dt_conf_get_bool("plugins/map/filter_images_drawn");
-  geo_query = g_strdup_printf("SELECT * FROM (SELECT id, latitude FROM %s WHERE longitude >= ?1 AND "
+  // the images are clustered on a grid of thumbnail sized cells (?7, ?8 in degrees) so only one thumbnail
+  // per cell is materialised, no matter how many images share it. the bare latitude and longitude columns are
+  // the ones of the lowest id of each cell, see the sqlite docs on min() in aggregate queries
+  geo_query = g_strdup_printf("SELECT * FROM (SELECT MIN(id) AS id, latitude, COUNT(*) AS count, longitude "
+                              "FROM %s WHERE longitude >= ?1 AND "
                               "longitude <= ?2 AND latitude <= ?3 AND latitude >= ?4 AND longitude NOT NULL AND "
-                              "latitude NOT NULL ORDER BY ABS(latitude - ?5), ABS(longitude - ?6) LIMIT 0, %d) "
+                              "latitude NOT NULL "
+                              "GROUP BY CAST((longitude - ?1) / ?7 AS INTEGER), CAST((latitude - ?4) / ?8 AS INTEGER) "
+                              "ORDER BY ABS(latitude - ?5), ABS(longitude - ?6) LIMIT 0, %d) "
                               "ORDER BY (180 - latitude), id",
                               lib->filter_images_drawn
                               ? "main.images i INNER JOIN memory.collected_images c ON i.id = c.imgid"
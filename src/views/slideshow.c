@@ -22,6 +22,7 @@
 #include "common/dtpthread.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "dtgtk/thumbtable.h"
@@ -35,6 +36,10 @@
 
 DT_MODULE(1)
 
+// slides rendered ahead at most, and concurrent renders
+#define S_MAX_AHEAD 4
+#define S_WORKERS 2
+
 typedef enum dt_slideshow_event_t
 {
   S_REQUEST_STEP,
@@ -45,8 +50,8 @@ typedef enum dt_slideshow_slot_t
 {
   S_LEFT      = 0,
   S_CURRENT   = 1,
-  S_RIGHT     = 2,
-  S_SLOT_LAST = 3
+  S_RIGHT     = 2, // first of the slides ahead
+  S_SLOT_LAST = S_RIGHT + S_MAX_AHEAD
 } dt_slideshow_slot_t;
 
 typedef struct _slideshow_buf_t
@@ -56,6 +61,7 @@ typedef struct _slideshow_buf_t
   uint32_t height;
   int32_t rank;
   gboolean invalidated;
+  gboolean rendering;
 } dt_slideshow_buf_t;
 
 typedef struct dt_slideshow_t
@@ -65,6 +71,7 @@ typedef struct dt_slideshow_t
 
   // buffers
   dt_slideshow_buf_t buf[S_SLOT_LAST];
+  int slot_count;
   gboolean init_phase;
 
   // state machine stuff for image transitions:
@@ -72,6 +79,7 @@ typedef struct dt_slideshow_t
 
   gboolean auto_advance;
   int exporting;
+  int jobs; // queued or running, protected by lock
   int delay;
 
   // some magic to hide the mouse pointer
@@ -122,41 +130,63 @@ static int write_image(dt_imageio_module_data_t *datai, const char *filename, co
 
 static void shift_left(dt_slideshow_t *d)
 {
-  uint32_t *tmp_buf = d->buf[S_LEFT].buf;
+  const int last = d->slot_count - 1;
+  const dt_slideshow_buf_t tmp = d->buf[S_LEFT];
 
-  for(int k=S_LEFT; k<S_RIGHT; k++)
-  {
-    d->buf[k].buf         = d->buf[k+1].buf;
-    d->buf[k].rank        = d->buf[k+1].rank;
-    d->buf[k].width       = d->buf[k+1].width;
-    d->buf[k].height      = d->buf[k+1].height;
-    d->buf[k].invalidated = d->buf[k+1].invalidated;
-  }
-  d->buf[S_RIGHT].invalidated = TRUE;
-  d->buf[S_RIGHT].rank = d->buf[S_CURRENT].rank + 1;
-  d->buf[S_RIGHT].buf = tmp_buf;
+  for(int k=S_LEFT; k<last; k++)
+    d->buf[k] = d->buf[k+1];
+
+  // the leftmost buffer is reused for the new slide ahead
+  d->buf[last] = tmp;
+  d->buf[last].rank = d->buf[last-1].rank + 1;
+  d->buf[last].invalidated = d->buf[last].rank < d->col_count;
+  d->buf[last].rendering = FALSE;
 }
 
 static void shift_right(dt_slideshow_t *d)
 {
-  uint32_t *tmp_buf = d->buf[S_RIGHT].buf;
+  const int last = d->slot_count - 1;
+  const dt_slideshow_buf_t tmp = d->buf[last];
 
-  for(int k=S_RIGHT; k>S_LEFT; k--)
-  {
-    d->buf[k].buf         = d->buf[k-1].buf;
-    d->buf[k].rank        = d->buf[k-1].rank;
-    d->buf[k].width       = d->buf[k-1].width;
-    d->buf[k].height      = d->buf[k-1].height;
-    d->buf[k].invalidated = d->buf[k-1].invalidated;
-  }
-  d->buf[S_LEFT].invalidated = TRUE;
+  for(int k=last; k>S_LEFT; k--)
+    d->buf[k] = d->buf[k-1];
+
+  d->buf[S_LEFT] = tmp;
   d->buf[S_LEFT].rank = d->buf[S_CURRENT].rank - 1;
-  d->buf[S_LEFT].buf = tmp_buf;
+  d->buf[S_LEFT].invalidated = d->buf[S_LEFT].rank >= 0;
+  d->buf[S_LEFT].rendering = FALSE;
+}
+
+static gboolean _slot_needed(const dt_slideshow_t *d, const int slot)
+{
+  const dt_slideshow_buf_t *b = &d->buf[slot];
+  return b->buf && b->invalidated && b->rank >= 0 && b->rank < d->col_count;
+}
+
+// the slot to render next: the current slide, then the ones ahead in order, then the one behind
+static int _next_slot(const dt_slideshow_t *d)
+{
+  if(_slot_needed(d, S_CURRENT) && !d->buf[S_CURRENT].rendering) return S_CURRENT;
+  for(int k=S_RIGHT; k<d->slot_count; k++)
+    if(_slot_needed(d, k) && !d->buf[k].rendering) return k;
+  if(_slot_needed(d, S_LEFT) && !d->buf[S_LEFT].rendering) return S_LEFT;
+  return -1;
 }
 
+// start as many jobs as there are slides to render, up to S_WORKERS. must be called with d->lock held.
 static void requeue_job(dt_slideshow_t *d)
 {
-  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, process_job_create(d));
+  int needed = 0;
+  for(int k=S_LEFT; k<d->slot_count; k++)
+    if(_slot_needed(d, k)) needed++;
+
+  while(d->jobs < MIN(needed, S_WORKERS))
+  {
+    dt_job_t *job = process_job_create(d);
+    if(!job) break;
+    d->jobs++;
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
+  }
 }
 
 static void _set_delay(dt_slideshow_t *d, int value)
@@ -165,13 +195,55 @@ static void _set_delay(dt_slideshow_t *d, int value)
   dt_conf_set_int("slideshow_delay", d->delay);
 }
 
-static int process_image(dt_slideshow_t *d, dt_slideshow_slot_t slot)
+// a thumbnail at least as large as the screen, already in memory or in the disk cache, is shown as is
+// instead of running the export pipe
+static gboolean _process_from_mipmap(const int32_t imgid, dt_slideshow_buf_t *out, const uint32_t width,
+                                     const uint32_t height)
+{
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  const dt_mipmap_size_t mip
+      = dt_mipmap_cache_get_matching_size(cache, width / darktable.gui->ppd, height / darktable.gui->ppd);
+  if(mip >= DT_MIPMAP_F || cache->max_width[mip] < width || cache->max_height[mip] < height) return FALSE;
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(cache, &buf, imgid, mip, DT_MIPMAP_TESTLOCK, 'r');
+  const gboolean in_memory = buf.buf != NULL;
+  dt_mipmap_cache_release(cache, &buf);
+  if(!in_memory)
+  {
+    if(!dt_mipmap_cache_thumbnail_on_disk(cache, imgid, mip)) return FALSE;
+    dt_mipmap_cache_get(cache, &buf, imgid, mip, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(cache, &buf);
+  }
+
+  cairo_surface_t *surface = NULL;
+  if(dt_view_image_get_surface_at_mip(imgid, mip, width, height, FALSE, &surface) || !surface)
+  {
+    if(surface) cairo_surface_destroy(surface);
+    return FALSE;
+  }
+
+  cairo_surface_flush(surface);
+  const int wd = MIN(cairo_image_surface_get_width(surface), width);
+  const int ht = MIN(cairo_image_surface_get_height(surface), height);
+  const int stride = cairo_image_surface_get_stride(surface);
+  const uint8_t *data = cairo_image_surface_get_data(surface);
+  for(int j = 0; j < ht; j++) memcpy(out->buf + (size_t)j * wd, data + (size_t)j * stride, sizeof(uint32_t) * wd);
+  out->width = wd;
+  out->height = ht;
+  cairo_surface_destroy(surface);
+
+  return wd > 0 && ht > 0;
+}
+
+static int process_image(dt_slideshow_t *d, const int32_t rank)
 {
   dt_imageio_module_format_t buf;
   buf.mime = mime;
   buf.levels = levels;
   buf.bpp = bpp;
   buf.write_image = write_image;
+  buf.write_image_begin = NULL;
 
   // lock to copy the information to process the image
   dt_pthread_mutex_lock(&d->lock);
@@ -179,12 +251,12 @@ static int process_image(dt_slideshow_t *d, dt_slideshow_slot_t slot)
   dat.head.width = dat.head.max_width = d->width;
   dat.head.height = dat.head.max_height = d->height;
   dat.head.style[0] = '\0';
-  dat.rank = d->buf[slot].rank;
+  dat.rank = rank;
   dat.buf.buf = dt_alloc_align(64, sizeof(uint32_t) * d->width * d->height);
+  dat.buf.width = dat.buf.height = 0;
 
   d->exporting++;
 
-  const int32_t rank = dat.rank;
   const gchar *query = dt_collection_get_query(darktable.collection);
 
   if(rank<0 || rank>=d->col_count || !query)
@@ -209,27 +281,33 @@ static int process_image(dt_slideshow_t *d, dt_slideshow_slot_t slot)
   // this is a little slow, might be worth to do an option:
   const gboolean high_quality = dt_conf_get_bool("plugins/slideshow/high_quality");
 
-  if(id)
+  if(id && !_process_from_mipmap(id, &dat.buf, dat.head.width, dat.head.height))
   {
     // the flags are: ignore exif, display byteorder, high quality, upscale, thumbnail
     dt_imageio_export_with_flags(id, "unused", &buf, (dt_imageio_module_data_t *)&dat, TRUE, TRUE,
                                  high_quality, TRUE, FALSE, NULL, FALSE, FALSE, DT_COLORSPACE_DISPLAY,
                                  NULL, DT_INTENT_LAST, NULL, NULL, 1, 1, NULL);
+  }
 
-    // lock to copy back into the slot the rendered buffer, not that this is done only if
-    // the slot rank is still the same as the local buffer rank. This can be false if the
-    // buffers have been shifted to advance to next image.
-    dt_pthread_mutex_lock(&d->lock);
-    if(dat.rank == d->buf[slot].rank)
-    {
-      memcpy(d->buf[slot].buf, dat.buf.buf, sizeof(uint32_t) * dat.buf.width * dat.buf.height);
-      d->buf[slot].width = dat.buf.width;
-      d->buf[slot].height = dat.buf.height;
-      d->buf[slot].invalidated = FALSE;
-    }
-    d->exporting--;
-    dt_pthread_mutex_unlock(&d->lock);
+  // lock to copy back into the slot the rendered buffer. the buffers may have been shifted to advance
+  // to another image meanwhile, so look the slot up by rank, the slide could also be gone already.
+  dt_pthread_mutex_lock(&d->lock);
+  gboolean current = FALSE;
+  for(int k=S_LEFT; k<d->slot_count; k++)
+  {
+    if(d->buf[k].rank != rank || !d->buf[k].buf) continue;
+    memcpy(d->buf[k].buf, dat.buf.buf, sizeof(uint32_t) * dat.buf.width * dat.buf.height);
+    d->buf[k].width = dat.buf.width;
+    d->buf[k].height = dat.buf.height;
+    d->buf[k].invalidated = FALSE;
+    d->buf[k].rendering = FALSE;
+    current = k == S_CURRENT;
+    break;
   }
+  d->exporting--;
+  dt_pthread_mutex_unlock(&d->lock);
+
+  if(current) dt_control_queue_redraw_center();
 
   dt_free_align(dat.buf.buf);
   return 0;
@@ -241,9 +319,12 @@ static int process_image(dt_slideshow_t *d, dt_slideshow_slot_t slot)
 
 static gboolean _is_idle(dt_slideshow_t *d)
 {
-  return !((d->buf[S_LEFT].invalidated && d->buf[S_LEFT].rank <= d->col_count)
-           || (d->buf[S_CURRENT].invalidated && d->buf[S_CURRENT].rank <= d->col_count)
-           || (d->buf[S_RIGHT].invalidated && d->buf[S_RIGHT].rank <= d->col_count));
+  dt_pthread_mutex_lock(&d->lock);
+  gboolean idle = TRUE;
+  for(int k=S_LEFT; k<d->slot_count; k++)
+    if(_slot_needed(d, k)) idle = FALSE;
+  dt_pthread_mutex_unlock(&d->lock);
+  return idle;
 }
 
 static gboolean auto_advance(gpointer user_data)
@@ -259,23 +340,19 @@ static int32_t process_job_run(dt_job_t *job)
 {
   dt_slideshow_t *d = dt_control_job_get_params(job);
 
-  if(d->buf[S_CURRENT].invalidated && d->buf[S_CURRENT].rank <= d->col_count)
-  {
-    process_image(d, S_CURRENT);
-    dt_control_queue_redraw_center();
-  }
-  else if(d->buf[S_RIGHT].invalidated && d->buf[S_RIGHT].rank <= d->col_count)
-  {
-    process_image(d, S_RIGHT);
-  }
-  else if(d->buf[S_LEFT].invalidated && d->buf[S_LEFT].rank >= 0)
-  {
-    process_image(d, S_LEFT);
-  }
+  dt_pthread_mutex_lock(&d->lock);
+  const int slot = _next_slot(d);
+  const int32_t rank = slot < 0 ? -1 : d->buf[slot].rank;
+  if(slot >= 0) d->buf[slot].rendering = TRUE;
+  dt_pthread_mutex_unlock(&d->lock);
+
+  if(slot >= 0) process_image(d, rank);
 
   // any other slot to fill?
-  if(!_is_idle(d))
-    requeue_job(d);
+  dt_pthread_mutex_lock(&d->lock);
+  d->jobs--;
+  if(slot >= 0) requeue_job(d);
+  dt_pthread_mutex_unlock(&d->lock);
 
   return 0;
 }
@@ -304,8 +381,6 @@ static void _step_state(dt_slideshow_t *d, dt_slideshow_event_t event)
     if(d->buf[S_CURRENT].rank < d->col_count - 1)
     {
       shift_left(d);
-      d->buf[S_RIGHT].rank = d->buf[S_CURRENT].rank + 1;
-      d->buf[S_RIGHT].invalidated = d->buf[S_RIGHT].rank < d->col_count;
       _refresh_display(d);
       requeue_job(d);
     }
@@ -320,8 +395,6 @@ static void _step_state(dt_slideshow_t *d, dt_slideshow_event_t event)
     if(d->buf[S_CURRENT].rank > 0)
     {
       shift_right(d);
-      d->buf[S_LEFT].rank = d->buf[S_CURRENT].rank - 1;
-      d->buf[S_LEFT].invalidated = d->buf[S_LEFT].rank >= 0;
       _refresh_display(d);
       requeue_job(d);
     }
@@ -416,12 +489,15 @@ void enter(dt_view_t *self)
   d->width = rect.width * darktable.gui->ppd;
   d->height = rect.height * darktable.gui->ppd;
 
-  for(int k=S_LEFT; k<S_SLOT_LAST; k++)
+  d->slot_count = S_RIGHT + CLAMP(dt_conf_get_int("plugins/slideshow/render_ahead"), 1, S_MAX_AHEAD);
+
+  for(int k=S_LEFT; k<d->slot_count; k++)
   {
     d->buf[k].buf = dt_alloc_align(64, sizeof(uint32_t) * d->width * d->height);
     d->buf[k].width =  d->width;
     d->buf[k].height = d->height;
     d->buf[k].invalidated = TRUE;
+    d->buf[k].rendering = FALSE;
   }
 
   // if one selected start with it, otherwise start at the current lighttable offset
@@ -447,19 +523,19 @@ void enter(dt_view_t *self)
 
   d->buf[S_CURRENT].rank = selrank == -1 ? dt_thumbtable_get_offset(dt_ui_thumbtable(darktable.gui->ui)) : selrank;
   d->buf[S_LEFT].rank = d->buf[S_CURRENT].rank - 1;
-  d->buf[S_RIGHT].rank = d->buf[S_CURRENT].rank + 1;
+  for(int k=S_RIGHT; k<d->slot_count; k++)
+    d->buf[k].rank = d->buf[S_CURRENT].rank + k - S_CURRENT;
 
   d->col_count = dt_collection_get_count(darktable.collection);
 
   d->auto_advance = FALSE;
   d->delay = dt_conf_get_int("slideshow_delay");
   // restart from beginning, will first increment counter by step and then prefetch
+  // start first jobs
+  requeue_job(d);
   dt_pthread_mutex_unlock(&d->lock);
 
   gtk_widget_grab_focus(dt_ui_center(darktable.gui->ui));
-
-  // start first job
-  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, process_job_create(d));
   dt_control_log(_("waiting to start slideshow"));
 }
 
@@ -480,7 +556,7 @@ void leave(dt_view_t *self)
 
   dt_pthread_mutex_lock(&d->lock);
 
-  for(int k=S_LEFT; k<S_SLOT_LAST; k++)
+  for(int k=S_LEFT; k<d->slot_count; k++)
   {
     dt_free_align(d->buf[k].buf);
     d->buf[k].buf = NULL;
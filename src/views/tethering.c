@@ -176,6 +176,9 @@ static void _expose_tethered_mode(dt_view_t *self, cairo_t *cr, int32_t width, i
 
       const float w = width - (MARGIN * 2.0f);
       const float h = height - (MARGIN * 2.0f) - BAR_HEIGHT;
+      // in device pixels, for the decoder
+      cam->live_view_width = w * darktable.gui->ppd;
+      cam->live_view_height = h * darktable.gui->ppd;
 
       float scale;
       if(cam->live_view_rotation % 2 == 0)
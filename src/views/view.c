@@ -50,6 +50,18 @@
 #include <strings.h>
 
 #define DECORATION_SIZE_LIMIT 40
+// number of focus peaking maps kept, a full culling layout and a few of its neighbours
+#define DT_VIEW_FOCUS_PEAKING_CACHE 16
+
+typedef struct dt_view_focus_peaking_t
+{
+  int32_t imgid; // 0 for a free slot
+  dt_mipmap_size_t mip;
+  int width, height;
+  uint64_t hash;   // of the mipmap buffer the map belongs to, edits change it
+  uint8_t *levels; // NULL while it is being computed
+  uint64_t used;
+} dt_view_focus_peaking_t;
 
 static void dt_view_manager_load_modules(dt_view_manager_t *vm);
 static int dt_view_load_module(void *v, const char *libname, const char *module_name);
@@ -89,6 +101,10 @@ void dt_view_manager_init(dt_view_manager_t *vm)
 
   vm->current_view = NULL;
   vm->audio.audio_player_id = -1;
+
+  dt_pthread_mutex_init(&vm->focus_peaking.lock, NULL);
+  vm->focus_peaking.entries = calloc(DT_VIEW_FOCUS_PEAKING_CACHE, sizeof(dt_view_focus_peaking_t));
+  vm->focus_peaking.clock = 0;
 }
 
 void dt_view_manager_gui_init(dt_view_manager_t *vm)
@@ -103,6 +119,11 @@ void dt_view_manager_gui_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(GList *iter = vm->views; iter; iter = g_list_next(iter)) dt_view_unload_module((dt_view_t *)iter->data);
+
+  // jobs still computing a map have been shut down along with the control threads
+  for(int k = 0; k < DT_VIEW_FOCUS_PEAKING_CACHE; k++) dt_free_align(vm->focus_peaking.entries[k].levels);
+  free(vm->focus_peaking.entries);
+  dt_pthread_mutex_destroy(&vm->focus_peaking.lock);
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -1156,7 +1177,140 @@ dt_view_image_over_t dt_view_guess_image_over(int32_t width, int32_t height, int
   return DT_VIEW_DESERT;
 }
 
+typedef struct _focus_peaking_job_t
+{
+  int32_t imgid;
+  dt_mipmap_size_t mip;
+  int width, height;
+  uint64_t hash;
+  uint8_t *image;
+} _focus_peaking_job_t;
+
+// a sample of the pixels is enough to tell an edited mipmap apart
+static uint64_t _focus_peaking_hash(const uint8_t *const buf, const int width, const int height)
+{
+  const size_t n = (size_t)width * height;
+  const size_t step = MAX(1, n / 4096);
+  const uint32_t *const px = (const uint32_t *)buf;
+  uint64_t hash = 14695981039346656037ull;
+  for(size_t k = 0; k < n; k += step) hash = (hash ^ px[k]) * 1099511628211ull;
+  return hash;
+}
+
+// needs the lock
+static dt_view_focus_peaking_t *_focus_peaking_find(const int32_t imgid, const dt_mipmap_size_t mip,
+                                                    const int width, const int height, const uint64_t hash)
+{
+  dt_view_focus_peaking_t *entries = darktable.view_manager->focus_peaking.entries;
+  for(int k = 0; k < DT_VIEW_FOCUS_PEAKING_CACHE; k++)
+    if(entries[k].imgid == imgid && entries[k].mip == mip && entries[k].width == width
+       && entries[k].height == height && entries[k].hash == hash)
+      return entries + k;
+  return NULL;
+}
+
+static int32_t _focus_peaking_job_run(dt_job_t *job)
+{
+  _focus_peaking_job_t *params = dt_control_job_get_params(job);
+  uint8_t *levels = dt_focuspeaking_compute(params->image, params->width, params->height);
+
+  dt_pthread_mutex_lock(&darktable.view_manager->focus_peaking.lock);
+  dt_view_focus_peaking_t *e
+      = _focus_peaking_find(params->imgid, params->mip, params->width, params->height, params->hash);
+  if(e && !e->levels)
+  {
+    e->levels = levels;
+    levels = NULL;
+  }
+  dt_pthread_mutex_unlock(&darktable.view_manager->focus_peaking.lock);
+
+  if(levels)
+    dt_free_align(levels);
+  else // have the thumbnails of the image fetch their surface again
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, params->imgid);
+  return 0;
+}
+
+static void _focus_peaking_job_cleanup(void *p)
+{
+  _focus_peaking_job_t *params = (_focus_peaking_job_t *)p;
+
+  // a job thrown out of the queue never ran, free its slot to have the map requested again
+  dt_pthread_mutex_lock(&darktable.view_manager->focus_peaking.lock);
+  dt_view_focus_peaking_t *e
+      = _focus_peaking_find(params->imgid, params->mip, params->width, params->height, params->hash);
+  if(e && !e->levels) e->imgid = 0;
+  dt_pthread_mutex_unlock(&darktable.view_manager->focus_peaking.lock);
+
+  dt_free_align(params->image);
+  free(params);
+}
+
+// draws the focus peaking map of the mipmap buffer into cr, which is set up to draw the buffer. the map
+// is computed once per buffer by a background job, until it is done nothing is drawn.
+static void _focus_peaking_draw(cairo_t *cr, const int32_t imgid, const dt_mipmap_buffer_t *buf)
+{
+  const uint64_t hash = _focus_peaking_hash(buf->buf, buf->width, buf->height);
+  dt_job_t *job = NULL;
+
+  dt_pthread_mutex_lock(&darktable.view_manager->focus_peaking.lock);
+  dt_view_focus_peaking_t *e = _focus_peaking_find(imgid, buf->size, buf->width, buf->height, hash);
+  if(e)
+  {
+    if(e->levels)
+    {
+      e->used = ++darktable.view_manager->focus_peaking.clock;
+      dt_focuspeaking_draw(cr, e->levels, e->width, e->height);
+    }
+  }
+  else
+  {
+    // take a free slot or the least recently used finished map
+    dt_view_focus_peaking_t *entries = darktable.view_manager->focus_peaking.entries;
+    for(int k = 0; k < DT_VIEW_FOCUS_PEAKING_CACHE; k++)
+    {
+      if(entries[k].imgid && !entries[k].levels) continue;
+      if(!e || !entries[k].imgid || (e->imgid && entries[k].used < e->used)) e = entries + k;
+    }
+
+    _focus_peaking_job_t *params = e ? malloc(sizeof(_focus_peaking_job_t)) : NULL;
+    if(params)
+    {
+      const size_t size = (size_t)4 * buf->width * buf->height;
+      *params = (_focus_peaking_job_t){ .imgid = imgid, .mip = buf->size, .width = buf->width,
+                                        .height = buf->height, .hash = hash,
+                                        .image = dt_alloc_align(64, size) };
+      memcpy(params->image, buf->buf, size);
+
+      dt_free_align(e->levels);
+      *e = (dt_view_focus_peaking_t){ .imgid = imgid, .mip = buf->size, .width = buf->width,
+                                      .height = buf->height, .hash = hash, .levels = NULL,
+                                      .used = ++darktable.view_manager->focus_peaking.clock };
+
+      job = dt_control_job_create(&_focus_peaking_job_run, "focus peaking %d", imgid);
+      if(job)
+        dt_control_job_set_params(job, params, _focus_peaking_job_cleanup);
+      else
+      {
+        e->imgid = 0;
+        dt_free_align(params->image);
+        free(params);
+      }
+    }
+  }
+  dt_pthread_mutex_unlock(&darktable.view_manager->focus_peaking.lock);
+
+  if(job) dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, job);
+}
+
 int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t **surface)
+{
+  const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, width, height);
+  return dt_view_image_get_surface_at_mip(imgid, mip, width, height, darktable.gui->show_focus_peaking, surface);
+}
+
+int dt_view_image_get_surface_at_mip(int imgid, dt_mipmap_size_t mip, int width, int height,
+                                     gboolean focus_peaking, cairo_surface_t **surface)
 {
   // if surface not null, clean it up
   if(*surface && cairo_surface_get_reference_count(*surface) > 0) cairo_surface_destroy(*surface);
@@ -1164,7 +1318,6 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
 
   // get mipmap cahe image
   dt_mipmap_cache_t *cache = darktable.mipmap_cache;
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(cache, width, height);
 
   // if needed, we load the mimap buffer
   dt_mipmap_buffer_t buf;
@@ -1180,13 +1333,15 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
   else if(mip != buf.size)
     buf_ok = FALSE;
 
-  // if we got a different mip than requested, and it's not a skull (8x8 px), we count
-  // this thumbnail as missing (to trigger re-exposure)
-  if(!buf_ok && buf_wd != 8 && buf_ht != 8)
+  if(!buf.buf)
   {
     dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
     return 1;
   }
+  // if we got a different mip than requested, and it's not a skull (8x8 px), we count
+  // this thumbnail as missing (to trigger re-exposure), but still scale it to the requested
+  // size so that something gets shown until the right mip is there.
+  const gboolean standin = !buf_ok && buf_wd != 8 && buf_ht != 8;
 
   // so we create a new image surface to return
   const float scale = fminf(width / (float)buf_wd, height / (float)buf_ht);
@@ -1201,6 +1356,7 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
   {
     gboolean have_lock = FALSE;
     cmsHTRANSFORM transform = NULL;
+    const dt_colorspaces_display_lut_t *lut = NULL;
 
     if(dt_conf_get_bool("cache_color_managed"))
     {
@@ -1212,10 +1368,12 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
       if(buf.color_space == DT_COLORSPACE_SRGB && darktable.color_profiles->transform_srgb_to_display)
       {
         transform = darktable.color_profiles->transform_srgb_to_display;
+        lut = darktable.color_profiles->lut_srgb_to_display;
       }
       else if(buf.color_space == DT_COLORSPACE_ADOBERGB && darktable.color_profiles->transform_adobe_rgb_to_display)
       {
         transform = darktable.color_profiles->transform_adobe_rgb_to_display;
+        lut = darktable.color_profiles->lut_adobe_rgb_to_display;
       }
       else
       {
@@ -1235,14 +1393,18 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
     }
 
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
+#pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform, lut)
 #endif
     for(int i = 0; i < buf.height; i++)
     {
       const uint8_t *in = buf.buf + i * buf.width * 4;
       uint8_t *out = rgbbuf + i * buf.width * 4;
 
-      if(transform)
+      if(lut)
+      {
+        dt_colorspaces_display_lut_apply(lut, in, out, buf.width);
+      }
+      else if(transform)
       {
         cmsDoTransform(transform, in, out, buf.width);
       }
@@ -1280,9 +1442,8 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
 
     cairo_paint(cr);
 
-    if(darktable.gui->show_focus_peaking)
-      dt_focuspeaking(cr, img_width, img_height, cairo_image_surface_get_data(*surface),
-                      cairo_image_surface_get_width(*surface), cairo_image_surface_get_height(*surface));
+    // the map is drawn at the resolution of the mipmap, through the same scaling as the image
+    if(focus_peaking && buf_ok) _focus_peaking_draw(cr, imgid, &buf);
 
     cairo_surface_destroy(tmp_surface);
     cairo_destroy(cr);
@@ -1290,7 +1451,7 @@ int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t
 
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
   if(rgbbuf) free(rgbbuf);
-  return 0;
+  return standin ? 1 : 0;
 }
 
 char* dt_view_extend_modes_str(const char * name, const gboolean is_hdr, const gboolean is_bw)
@@ -1354,16 +1515,7 @@ int dt_view_image_expose(dt_view_image_expose_t *vals)
 
   int selected = 0, is_grouped = 0;
 
-  if (draw_selected)
-  {
-    /* clear and reset statements */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-    DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-    /* bind imgid to prepared statements */
-    DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-    /* lets check if imgid is selected */
-    if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW) selected = 1;
-  }
+  if(draw_selected) selected = dt_selection_is_selected(darktable.selection, imgid);
 
   // do we need to surround the image ?
   gboolean surrounded = FALSE;
@@ -1550,6 +1702,7 @@ int dt_view_image_expose(dt_view_image_expose_t *vals)
         {
           gboolean have_lock = FALSE;
           cmsHTRANSFORM transform = NULL;
+          const dt_colorspaces_display_lut_t *lut = NULL;
 
           if(dt_conf_get_bool("cache_color_managed"))
           {
@@ -1561,11 +1714,13 @@ int dt_view_image_expose(dt_view_image_expose_t *vals)
             if(buf.color_space == DT_COLORSPACE_SRGB && darktable.color_profiles->transform_srgb_to_display)
             {
               transform = darktable.color_profiles->transform_srgb_to_display;
+              lut = darktable.color_profiles->lut_srgb_to_display;
             }
             else if(buf.color_space == DT_COLORSPACE_ADOBERGB
                     && darktable.color_profiles->transform_adobe_rgb_to_display)
             {
               transform = darktable.color_profiles->transform_adobe_rgb_to_display;
+              lut = darktable.color_profiles->lut_adobe_rgb_to_display;
             }
             else
             {
@@ -1587,14 +1742,18 @@ int dt_view_image_expose(dt_view_image_expose_t *vals)
           }
 
 #ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
+  #pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform, lut)
 #endif
           for(int i = 0; i < buf.height; i++)
           {
             const uint8_t *in = buf.buf + i * buf.width * 4;
             uint8_t *out = rgbbuf + i * buf.width * 4;
 
-            if(transform)
+            if(lut)
+            {
+              dt_colorspaces_display_lut_apply(lut, in, out, buf.width);
+            }
+            else if(transform)
             {
               cmsDoTransform(transform, in, out, buf.width);
             }
@@ -2130,14 +2289,7 @@ dt_view_image_only_expose(
  */
 void dt_view_set_selection(int imgid, int value)
 {
-  /* clear and reset statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-
-  /* setup statement and iterate over rows */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
+  if(dt_selection_is_selected(darktable.selection, imgid))
   {
     if(!value)
     {
@@ -2150,6 +2302,7 @@ void dt_view_set_selection(int imgid, int value)
       /* setup statement and execute */
       DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.delete_from_selected, 1, imgid);
       sqlite3_step(darktable.view_manager->statements.delete_from_selected);
+      dt_selection_mark(darktable.selection, imgid, FALSE);
     }
   }
   else if(value)
@@ -2163,6 +2316,7 @@ void dt_view_set_selection(int imgid, int value)
     /* setup statement and execute */
     DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.make_selected, 1, imgid);
     sqlite3_step(darktable.view_manager->statements.make_selected);
+    dt_selection_mark(darktable.selection, imgid, TRUE);
   }
 }
 
@@ -2172,14 +2326,7 @@ void dt_view_set_selection(int imgid, int value)
  */
 void dt_view_toggle_selection(int imgid)
 {
-
-  /* clear and reset statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-
-  /* setup statement and iterate over rows */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
+  if(dt_selection_is_selected(darktable.selection, imgid))
   {
     /* clear and reset statement */
     DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.delete_from_selected);
@@ -2188,6 +2335,7 @@ void dt_view_toggle_selection(int imgid)
     /* setup statement and execute */
     DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.delete_from_selected, 1, imgid);
     sqlite3_step(darktable.view_manager->statements.delete_from_selected);
+    dt_selection_mark(darktable.selection, imgid, FALSE);
   }
   else
   {
@@ -2198,6 +2346,7 @@ void dt_view_toggle_selection(int imgid)
     /* setup statement and execute */
     DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.make_selected, 1, imgid);
     sqlite3_step(darktable.view_manager->statements.make_selected);
+    dt_selection_mark(darktable.selection, imgid, TRUE);
   }
 }
 
@@ -20,6 +20,7 @@
 
 #include "common/history.h"
 #include "common/image.h"
+#include "common/mipmap_cache.h"
 #ifdef HAVE_PRINT
 #include "common/cups_print.h"
 #endif
@@ -231,8 +232,12 @@ typedef struct dt_view_image_expose_t
 char* dt_view_extend_modes_str(const char * name, const int is_hdr, const int is_bw);
 /** expose an image, set image over flags. return != 0 if thumbnail wasn't loaded yet. */
 int dt_view_image_expose(dt_view_image_expose_t *vals);
-/** expose an image and return a cairi_surface. return != 0 if thumbnail wasn't loaded yet. */
+/** expose an image and return a cairi_surface. return != 0 if thumbnail wasn't loaded yet, in which case
+ * the surface may still hold a smaller or larger mip scaled to width x height to show in the meantime. */
 int dt_view_image_get_surface(int imgid, int width, int height, cairo_surface_t **surface);
+/** same at the given mipmap size, optionally without the focus peaking overlay. */
+int dt_view_image_get_surface_at_mip(int imgid, dt_mipmap_size_t mip, int width, int height,
+                                     gboolean focus_peaking, cairo_surface_t **surface);
 
 /* expose only the image imgid at position (offsetx,offsety) into the cairo surface occupying width/height pixels.
    this routine does not output any meta-data as the version above.
@@ -296,6 +301,14 @@ typedef struct dt_view_manager_t
     sqlite3_stmt *get_grouped;
   } statements;
 
+  // focus peaking maps of the mipmaps drawn by dt_view_image_get_surface(), computed in the background
+  struct
+  {
+    dt_pthread_mutex_t lock;
+    struct dt_view_focus_peaking_t *entries;
+    uint64_t clock;
+  } focus_peaking;
+
   struct
   {
     GPid audio_player_pid;   // the pid of the child process
@@ -151,6 +151,15 @@ static gboolean handle_enter_key(GtkWidget *widget, GdkEvent *event, gpointer da
       <xsl:apply-templates select="." mode="tab_block"/>
     </xsl:if>
   </xsl:for-each>
+<xsl:text>
+   {
+      GtkWidget *button = gtk_button_new_with_label(_("tune for this machine"));
+      gtk_widget_set_halign(button, GTK_ALIGN_START);
+      gtk_widget_set_tooltip_text(button, _("process the images to act on with several thread, OpenCL and memory settings and keep the fastest ones. the measurements are appended to autotune.txt in the config directory."));
+      g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(_autotune_callback), NULL);
+      gtk_grid_attach(GTK_GRID(grid), button, 1, line++, 1, 1);
+   }
+</xsl:text>
   <xsl:value-of select="$tab_end" />
 
   <!-- storage -->